@@ -1,12 +1,17 @@
 /// \file
 /// \brief Definitions for board configuration functions
 #include "BoardConfig.h"
+#include "ConfigParser.h"
+#include "FlashQueue.h"
+#include "MbedCRC.h"
+#include "VirtualPorts.h"
 #include "debugging.h"
+#include <algorithm>
 #include <cctype>
 
-void printSpecs(BoardSpecs &Specs) {
+void printSpecs(const BoardSpecs &Specs) {
     printf("\r\nPossible Sensor Info: \r\n");
-    for (auto Sensor : Specs.Sensors){
+    for (const SensorInfo &Sensor : Specs.Sensors){
         printf("Type = %s, Unit = %s, Multiplier = %f, RangeFloor = %f, RangeCeiling = %f\r\n", Sensor.Type.c_str(), Sensor.Unit.c_str(), Sensor.Multiplier, Sensor.RangeFloor, Sensor.RangeCeiling);
     }
     printf("\r\nBoard information\r\n");
@@ -27,181 +32,792 @@ void printSpecs(BoardSpecs &Specs) {
     printf("Remote Hostname = %s\r\n", Specs.HostName.c_str());
 }
 // ============================================================================
-BoardSpecs readSDCard(const char *FileName) {
+bool readSDCard(const char *FileName, BoardSpecs &Specs) {
 
     // try to open sd card
     printf("\r\nReading from SD card...\r\n\n\n");
     FILE *fp = fopen(FileName, "rb");
+    if (fp == NULL) {
+        printf("\nReading Failed!\r\n");
+        return false;
+    }
 
-    BoardSpecs Output;
-
-    if (fp != NULL) {
+    // read config from SD card
+    readConfigText(fp, Specs);
+    printf("\r\n %d Ports were configured\r\n", Specs.Ports.size());
+    fclose(fp);
+    return true;
+}
 
-        // get file size for buffer
-        fseek(fp, 0, SEEK_END);
-        size_t FileSize = ftell(fp);
-        char *Buffer = new char[FileSize + 1];
 
-        // reset file pointer and  read file
-        rewind(fp);
-        fread(Buffer, sizeof(char), FileSize, fp);
-        // set \0 for Cstring compatability
-        Buffer[FileSize] = '\0';
+// ============================================================================
+void readConfigText(FILE *fp, BoardSpecs &Specs) {
+    // the parser wants the whole file in RAM
+    vector<char> Text;
+    char Buffer[BUFFLEN];
+    size_t Got;
+    while ((Got = fread(Buffer, 1, BUFFLEN, fp)) > 0) {
+        Text.insert(Text.end(), Buffer, Buffer + Got);
+    }
+    parseConfigText(Text.data(), Text.size(), Specs);
+}
 
-        delete[] Buffer; // clean up
+// reads a Sensor line's
+// "Type,Unit,Multiplier,Floor,Ceiling[,Oversample][,AC][,Deadband][,Heartbeat]
+// [,Resolution][,Averaging][,SampleCycles][,Interval]". A sensor whose names
+// do not fit into the name table keeps its place, so the IDs of the ones
+// after it stay, with a multiplier of 0 that leaves out its ports
+static SensorInfo parseSensor(ConfigParser &Parser) {
+    SensorInfo tmp;
+    Span<const char> value;
+
+    // get past the :
+    Parser.nextField(':', value);
+
+    bool Named = true;
+    if (Parser.nextField(',', value)) {
+        Named = tmp.Type.assign(value.data(), value.size());
+    }
+    // get the unit of the sensor
+    if (Parser.nextField(',', value) && Named) {
+        Named = tmp.Unit.assign(value.data(), value.size());
+    }
+    if (!Named) {
+        printf("%.*s does not fit into the name table, skipping its "
+               "ports\r\n",
+               (int)Parser.line().size(), Parser.line().data());
+        return SensorInfo();
+    }
+    // get unit multiplier
+    if (Parser.nextField(',', value)) {
+        tmp.Multiplier = spanToFloat(value);
+    }
+    // get range start
+    if (Parser.nextField(',', value)) {
+        tmp.RangeFloor = spanToFloat(value);
+    }
+    // get range end
+    if (Parser.nextField(',', value)) {
+        tmp.RangeCeiling = spanToFloat(value);
+    }
 
-        // read config from SD card
-        rewind(fp);
-        Output = readConfigText(fp);
-        printf("\r\n %d Ports were configured\r\n", Output.Ports.size());
-        fclose(fp);
+    // the oversampling ratio is optional, older config files stop after the
+    // range end
+    if (Parser.nextField(',', value) && spanToInt(value) > 0) {
+        tmp.Oversample = spanToInt(value);
+    }
 
-    } else {
-        printf("\nReading Failed!\r\n");
+    // AC sensors get their RMS computed instead of a single reading
+    if (Parser.nextField(',', value) && spanContains(value, "AC")) {
+        tmp.AC = true;
     }
 
-    return Output;
-}
+    // readings within the deadband of the last one that was sent are not
+    // sent again, see Deadband.h
+    if (Parser.nextField(',', value) && spanToFloat(value) > 0.0f) {
+        tmp.Deadband = spanToFloat(value);
+        tmp.DeadbandPercent = spanContains(value, "%");
+    }
+    if (Parser.nextField(',', value) && spanToInt(value) > 0) {
+        tmp.Heartbeat = spanToInt(value);
+    }
 
+    // how the ADC converts the sensor's ports, see ADCScan.h. An empty
+    // field keeps the default
+    if (Parser.nextField(',', value) && spanToInt(value) > 0) {
+        tmp.Resolution = spanToInt(value);
+    }
+    if (Parser.nextField(',', value) && spanToInt(value) > 0) {
+        tmp.Averaging = spanToInt(value);
+    }
+    if (Parser.nextField(',', value) && spanToInt(value) >= 0) {
+        tmp.SampleCycles = spanToInt(value);
+    }
 
-// ============================================================================
-BoardSpecs readConfigText(FILE *fp) {
-    BoardSpecs Specs;
-    Specs.Ports.reserve(10);   // reserve space for ports
-    Specs.Sensors.reserve(10); // and sensor types
+    // the sensor's own reading interval, see RateSchedule.h
+    if (Parser.nextField(',', value) && spanToFloat(value) > 0.0f) {
+        tmp.Interval = spanToFloat(value);
+    }
 
-    int prtCnt = 0; // # of ports
+    printf("Sensor type: %s, Unit: %s, range start: %f, range-end: %f, "
+           "oversampling: %u, %s, deadband: %f%s, ADC: %u bits x%u +%u, "
+           "interval: %f\r\n",
+           tmp.Type.c_str(), tmp.Unit.c_str(), tmp.RangeFloor,
+           tmp.RangeCeiling, tmp.Oversample, tmp.AC ? "AC" : "DC",
+           tmp.Deadband, tmp.DeadbandPercent ? "%" : "", tmp.Resolution,
+           tmp.Averaging, tmp.SampleCycles, tmp.Interval);
+    return tmp;
+}
 
-    // temporary buffer
-    char Buffer[BUFFLEN];
+// reads a Calibration line's "SensorID,Gain,Offset[,Reading:Value ...]"
+// into the sensor with that ID, once all of the sensors were read
+static void parseCalibration(ConfigParser &Parser, BoardSpecs &Specs) {
+    Span<const char> value;
 
-    // read through and get sensor ids before getting the port information
-    while (fgets(Buffer, BUFFLEN, fp) != NULL) {
+    // get past the :
+    Parser.nextField(':', value);
 
-        // if the line has 'Sensor' in it, then get the sensor info from it
-        if (strstr(Buffer, "Sensor") && Buffer[0] == 'S') {
-            SensorInfo tmp;
+    int ID = Parser.nextField(',', value) ? spanToInt(value) : -1;
+    if (ID < 0 || ID >= (int)Specs.Sensors.size()) {
+        printf("Calibration for an out of bounds Sensor ID= %d, skipping\r\n",
+               ID);
+        return;
+    }
+    SensorInfo &Sensor = Specs.Sensors[ID];
+    if (Parser.nextField(',', value)) {
+        Sensor.Gain = spanToFloat(value);
+    }
+    if (Parser.nextField(',', value)) {
+        Sensor.Offset = spanToFloat(value);
+    }
 
-            // get the id number
-            strtok(Buffer, ":"); // get past the :
+    // the points of the curve are "Reading:Value"
+    Sensor.Curve.clear();
+    while (Parser.nextField(',', value)) {
+        size_t Colon = 0;
+        while (Colon < value.size() && value[Colon] != ':') {
+            ++Colon;
+        }
+        if (Colon + 1 >= value.size()) {
+            continue;
+        }
+        CalibrationPoint Point;
+        Point.Reading = spanToFloat(value.first(Colon));
+        Point.Value = spanToFloat(value.subspan(Colon + 1));
+        Sensor.Curve.push_back(Point);
+    }
+    std::sort(Sensor.Curve.begin(), Sensor.Curve.end(),
+              [](const CalibrationPoint &A, const CalibrationPoint &B) {
+                  return A.Reading < B.Reading;
+              });
+    if (Sensor.Curve.size() == 1) {
+        printf("The curve of Sensor ID= %d needs two points, ignoring it\r\n",
+               ID);
+        Sensor.Curve.clear();
+    }
 
-            const char token[] = ","; // token to split values
+    printf("Sensor ID= %d calibration: gain= %f, offset= %f, %u points\r\n",
+           ID, Sensor.Gain, Sensor.Offset, (unsigned)Sensor.Curve.size());
+}
 
-            char *value = strtok(NULL, token);
-            tmp.Type = value;
+// reads a Modbus line's "Slave,Function,Register"
+// returns false if it is not a register that ModbusMaster can read
+static bool parseModbus(ConfigParser &Parser, ModbusPoint &Point) {
+    Span<const char> value;
+
+    // get past the :
+    Parser.nextField(':', value);
+
+    int Slave = Parser.nextField(',', value) ? spanToInt(value) : -1;
+    int Function = Parser.nextField(',', value) ? spanToInt(value) : -1;
+    int Register = Parser.restOfLine(value) ? spanToInt(value) : -1;
+    if (Slave < 1 || Slave > 247 || (Function != 3 && Function != 4) ||
+        Register < 0 || Register > 0xFFFF) {
+        printf("Modbus register %d of slave %d with function %d can not be "
+               "read, skipping\r\n",
+               Register, Slave, Function);
+        return false;
+    }
+    Point.Slave = Slave;
+    Point.Function = Function;
+    Point.Register = Register;
+    printf("Modbus Info: slave= %d function= %d register= %d\r\n", Slave,
+           Function, Register);
+    return true;
+}
 
-            // get the unit of the sensor
-            value = strtok(NULL, token);
-            tmp.Unit = value;
+// ============================================================================
+bool resolvePort(const BoardSpecs &Specs, PortInfo &tmp) {
+    if (tmp.SensorID < 0 || tmp.SensorID >= (int)Specs.Sensors.size()) {
+        // skip this sensor, sensor id is bad
+        printf("Port %s has an out of bounds Sensor ID= %d, skipping\r\n",
+               tmp.Name.c_str(), tmp.SensorID);
+        return false;
+    }
+    const SensorInfo &Sensor = Specs.Sensors[tmp.SensorID];
+
+    // get port multiplier
+    tmp.Multiplier = Sensor.Multiplier;
+
+    // get sensorname
+    string Description = Sensor.Type.c_str();
+    Description.append(" in ");
+    Description.append(Sensor.Unit.c_str());
+    if (!tmp.Description.assign(Description)) {
+        printf("The description of port %s does not fit into the name "
+               "table, skipping\r\n",
+               tmp.Name.c_str());
+        return false;
+    }
 
-            // get unit multiplier
-            value = strtok(NULL, token);
-            tmp.Multiplier = atof(value);
+    tmp.RangeCeiling = Sensor.RangeCeiling;
+    tmp.RangeFloor = Sensor.RangeFloor;
+    tmp.Oversample = Sensor.Oversample;
+    tmp.AC = Sensor.AC;
 
-            // get range start
-            value = strtok(NULL, token);
-            tmp.RangeFloor = atof(value);
+    // a percent deadband is taken from the range the port has now
+    tmp.Deadband = Sensor.Deadband;
+    if (Sensor.DeadbandPercent) {
+        tmp.Deadband *= fabsf(tmp.RangeCeiling - tmp.RangeFloor) / 100.0f;
+    }
+    tmp.Heartbeat = Sensor.Heartbeat;
+    tmp.Resolution = Sensor.Resolution;
+    tmp.Averaging = Sensor.Averaging;
+    tmp.SampleCycles = Sensor.SampleCycles;
+    tmp.Interval = Sensor.Interval;
+
+    printf("Port Info: name= %s id=  %d Multiplier= %0.2f description=%s\r\n",
+           tmp.Name.c_str(), tmp.SensorID, tmp.Multiplier,
+           tmp.Description.c_str());
+
+    if (tmp.Multiplier == 0.0f) {
+        printf("Port %s has a multiplier of 0, skipping\r\n", tmp.Name.c_str());
+        return false;
+    }
+    return true;
+}
 
-            // get range end till end of line
-            value = strtok(NULL, "\n");
-            tmp.RangeCeiling = atof(value);
+// ============================================================================
+void parseConfigText(const char *Text, size_t Size, BoardSpecs &Specs) {
+    // the strings and vectors keep their room for the new settings
+    Specs.clear();
+    Specs.Ports.reserve(10);   // reserve space for ports
+    Specs.Sensors.reserve(10); // and sensor types
 
-            Specs.Sensors.push_back(tmp); // store those values
-            printf("Sensor type: %s, Unit: %s, range start: %f, range-end: %f\r\n", tmp.Type.c_str(),
-                   tmp.Unit.c_str(), tmp.RangeFloor, tmp.RangeCeiling);
-        }
-    }
+    // ports only get their sensor after the whole file was read, so they can
+    // come before the sensors they use
+    vector<PortInfo> Ports;
+    Ports.reserve(10);
 
-    rewind(fp); // get ready to read again.
+    // the same goes for the calibrations, their lines are read at the end
+    vector<size_t> Calibrations;
 
-    while (fgets(Buffer, BUFFLEN, fp) != NULL) {
+    ConfigParser Parser(Text, Size);
+    Span<const char> value;
+    while (Parser.nextLine()) {
 
-        const char *s = ":";
+        // if the line has 'Sensor' in it, then get the sensor info from it
+        if (Parser.lineIs('S', "Sensor")) {
+            Specs.Sensors.push_back(parseSensor(Parser));
+
+        // a sensor's calibration, see Calibration.h
+        } else if (Parser.lineIs('C', "Calibration")) {
+            Calibrations.push_back(Parser.line().data() - Text);
+
+        // a register of a Modbus slave, see ModbusMaster.h
+        } else if (Parser.lineIs('M', "Modbus")) {
+            ModbusPoint Point;
+            if (parseModbus(Parser, Point)) {
+                Specs.Modbus.push_back(Point);
+            }
 
         // save the remote connection info
-        if (Buffer[0] == 'C' && strstr(Buffer, "ConnInfo")) {
+        } else if (Parser.lineIs('C', "ConnInfo")) {
 
             // we don't need the first token
-            char *tmp = strtok(Buffer, s);
+            Parser.nextField(':', value);
 
-            Specs.RemoteIP = strtok(NULL, ",");
+            if (Parser.nextField(',', value)) {
+                Specs.RemoteIP.assign(value.data(), value.size());
+            }
 
             // make sure there is a digit to convert, and set an error value
-            tmp = strtok(NULL, ",");
-            if (isdigit(tmp[0])) {
-                Specs.RemotePort = atoi(tmp);
+            if (Parser.nextField(',', value) && isdigit(value[0])) {
+                Specs.RemotePort = spanToInt(value);
             } else {
                 Specs.RemotePort = 0;
             }
 
-            Specs.HostName = strtok(NULL, ",");
+            if (Parser.nextField(',', value)) {
+                Specs.HostName.assign(value.data(), value.size());
+            }
 
-            Specs.RemoteDir = strtok(NULL, "\n");
-        }
+            // the directory is the rest of the line
+            if (Parser.restOfLine(value)) {
+                Specs.RemoteDir.assign(value.data(), value.size());
+            }
 
         // checks the character at the beginning of each line
-        if (Buffer[0] == 'B' && strstr(Buffer, "Board")) {
+        } else if (Parser.lineIs('B', "Board")) {
 
             // get past the :
-            strtok(Buffer, s);
+            Parser.nextField(':', value);
 
             // get WIFI SSID and assign it
-            Specs.NetworkSSID = strtok(NULL, ",");
+            if (Parser.nextField(',', value)) {
+                Specs.NetworkSSID.assign(value.data(), value.size());
+            }
 
             // get WIFI Password and assign it
-            Specs.NetworkPassword = strtok(NULL, ",");
+            if (Parser.nextField(',', value)) {
+                Specs.NetworkPassword.assign(value.data(), value.size());
+            }
 
             // getting and assigning Database tablename
-            Specs.DatabaseTableName = strtok(NULL, "\n"); 
-        } else if (Buffer[0] == 'P' && strstr(Buffer, "Port")) { // if a port description is detected
+            if (Parser.restOfLine(value)) {
+                Specs.DatabaseTableName.assign(value.data(), value.size());
+            }
 
-            // hold a Port entry
-            // then assign them to the vector in Specs
+        // if a port description is detected
+        } else if (Parser.lineIs('P', "Port")) {
             PortInfo tmp;
 
-            ++prtCnt;
-            // skip the : 
-            strtok(Buffer, ":"); 
-            
-            // grab the port name 
-            tmp.Name = strtok(NULL, ",");
+            // skip the :
+            Parser.nextField(':', value);
+
+            // grab the port name, a port without it would be sent as
+            // another one
+            if (Parser.nextField(',', value) &&
+                !tmp.Name.assign(value.data(), value.size())) {
+                printf("Port %.*s does not fit into the name table, "
+                       "skipping\r\n",
+                       (int)value.size(), value.data());
+                continue;
+            }
+
+            // the sensor id, and "hidden" for a port that is only read for
+            // the formulas of the virtual ports
+            tmp.SensorID = Parser.nextField(',', value) ? spanToInt(value) : -1;
+            if (Parser.restOfLine(value)) {
+                tmp.Hidden = spanContains(value, "hidden");
+            }
+            Ports.push_back(tmp);
+
+        // a port that is worked out from the others, see VirtualPorts.h
+        } else if (Parser.lineIs('V', "Virtual")) {
+            PortInfo tmp;
+
+            // skip the :
+            Parser.nextField(':', value);
+
+            if (Parser.nextField(',', value) &&
+                !tmp.Name.assign(value.data(), value.size())) {
+                printf("Port %.*s does not fit into the name table, "
+                       "skipping\r\n",
+                       (int)value.size(), value.data());
+                continue;
+            }
+            tmp.SensorID = Parser.nextField(',', value) ? spanToInt(value) : -1;
+
+            // the formula is the rest of the line, it has commas of its own
+            FormulaCode Code;
+            if (!Parser.restOfLine(value) ||
+                !compileFormula(value.data(), value.size(), Code)) {
+                printf("Port %s has a formula that can not be used, "
+                       "skipping\r\n",
+                       tmp.Name.c_str());
+                continue;
+            }
+            tmp.Formula.assign(value.data(), value.size());
+            Ports.push_back(tmp);
+        }
+    }
+
+    for (size_t Start : Calibrations) {
+        ConfigParser Line(Text + Start, Size - Start);
+        Line.nextLine();
+        parseCalibration(Line, Specs);
+    }
 
-            tmp.SensorID = atoi(strtok(NULL, "\n"));
+    for (PortInfo &tmp : Ports) {
+        if (resolvePort(Specs, tmp)) {
+            Specs.Ports.push_back(tmp);
+        }
+    }
+    printSpecs(Specs);
+}
 
-            if (tmp.SensorID < Specs.Sensors.size() && tmp.SensorID >= 0){
+// ============================================================================
+// The cached BoardSpecs is a ConfigCacheHeader followed by the fields below
+// in order. Strings are a uint16_t length and their characters, numbers are
+// stored as they are in RAM: little endian, an int, unsigned int or float in
+// 4 bytes, a bool in 1 and a ModbusPoint in 4. gen_config_bin.py packs a
+// binary config file the same way, a change here needs a new
+// CONFIGCACHEVERSION there as well.
+
+// appends Size bytes of Data to Out
+static void packBytes(vector<uint8_t> &Out, const void *Data, size_t Size) {
+    const uint8_t *Bytes = static_cast<const uint8_t *>(Data);
+    Out.insert(Out.end(), Bytes, Bytes + Size);
+}
+
+template <typename T> static void packValue(vector<uint8_t> &Out, T Value) {
+    packBytes(Out, &Value, sizeof(Value));
+}
 
-            // get port multiplier
-                tmp.Multiplier = Specs.Sensors[ tmp.SensorID].Multiplier;
+static void packString(vector<uint8_t> &Out, const string &Value) {
+    packValue<uint16_t>(Out, Value.size());
+    packBytes(Out, Value.data(), Value.size());
+}
+
+static void packString(vector<uint8_t> &Out, const InternedName &Value) {
+    size_t Size = strlen(Value.c_str());
+    packValue<uint16_t>(Out, Size);
+    packBytes(Out, Value.c_str(), Size);
+}
 
-                // get sensorname
-                tmp.Description = Specs.Sensors[ tmp.SensorID].Type;
-                tmp.Description.append(" in ");
-                tmp.Description.append(Specs.Sensors[ tmp.SensorID].Unit);
+/// Reads the packed fields back. Ok turns false at the first one that runs
+/// past the end, and everything after it is left alone.
+struct SpecsReader {
+    const uint8_t *Data;
+    size_t Left;
+    bool Ok;
+
+    void bytes(void *Out, size_t Size) {
+        if (!Ok || Size > Left) {
+            Ok = false;
+            return;
+        }
+        memcpy(Out, Data, Size);
+        Data += Size;
+        Left -= Size;
+    }
 
-                tmp.RangeCeiling = Specs.Sensors[tmp.SensorID].RangeCeiling;
-                tmp.RangeFloor= Specs.Sensors[tmp.SensorID].RangeFloor;
+    template <typename T> void value(T &Out) { bytes(&Out, sizeof(Out)); }
 
-            printf("Port Info: name= %s id=  %d Multiplier= %0.2f description=%s\r\n", tmp.Name.c_str(),
+    void text(string &Out) {
+        uint16_t Size = 0;
+        value(Size);
+        if (!Ok || Size > Left) {
+            Ok = false;
+            return;
+        }
+        Out.assign(reinterpret_cast<const char *>(Data), Size);
+        Data += Size;
+        Left -= Size;
+    }
 
-                   tmp.SensorID, tmp.Multiplier, tmp.Description.c_str());
+    void text(InternedName &Out) {
+        uint16_t Size = 0;
+        value(Size);
+        if (!Ok || Size > Left) {
+            Ok = false;
+            return;
+        }
+        // the cache is not used without all of its names
+        Ok = Out.assign(reinterpret_cast<const char *>(Data), Size);
+        Data += Size;
+        Left -= Size;
+    }
+};
+
+// appends the configuration in Specs to Out
+static void packSpecs(const BoardSpecs &Specs, vector<uint8_t> &Out) {
+    packString(Out, Specs.ID);
+    packString(Out, Specs.NetworkSSID);
+    packString(Out, Specs.NetworkPassword);
+    packString(Out, Specs.DatabaseTableName);
+    packString(Out, Specs.RemoteIP);
+    packString(Out, Specs.RemoteDir);
+    packString(Out, Specs.HostName);
+    packValue(Out, Specs.RemotePort);
+    packValue(Out, Specs.ConfigVersion);
+    packValue(Out, Specs.PollingInterval);
+
+    packValue<uint16_t>(Out, Specs.Sensors.size());
+    for (const SensorInfo &Sensor : Specs.Sensors) {
+        packValue(Out, Sensor.ID);
+        packString(Out, Sensor.Type);
+        packString(Out, Sensor.Unit);
+        packValue(Out, Sensor.Multiplier);
+        packValue(Out, Sensor.RangeFloor);
+        packValue(Out, Sensor.RangeCeiling);
+        packValue(Out, Sensor.Oversample);
+        packValue(Out, Sensor.AC);
+        packValue(Out, Sensor.Deadband);
+        packValue(Out, Sensor.DeadbandPercent);
+        packValue(Out, Sensor.Heartbeat);
+        packValue(Out, Sensor.Resolution);
+        packValue(Out, Sensor.Averaging);
+        packValue(Out, Sensor.SampleCycles);
+        packValue(Out, Sensor.Interval);
+        packValue(Out, Sensor.Gain);
+        packValue(Out, Sensor.Offset);
+        packValue<uint16_t>(Out, Sensor.Curve.size());
+        for (const CalibrationPoint &Point : Sensor.Curve) {
+            packValue(Out, Point.Reading);
+            packValue(Out, Point.Value);
+        }
+    }
 
-                if (tmp.Multiplier != 0.0f){
-                    Specs.Ports.push_back(tmp);
-                }
-                else {
+    packValue<uint16_t>(Out, Specs.Ports.size());
+    for (const PortInfo &Port : Specs.Ports) {
+        packString(Out, Port.Name);
+        packString(Out, Port.Description);
+        packValue(Out, Port.Multiplier);
+        packValue(Out, Port.SensorID);
+        packValue(Out, Port.RangeFloor);
+        packValue(Out, Port.RangeCeiling);
+        packValue(Out, Port.Oversample);
+        packValue(Out, Port.AC);
+        packValue(Out, Port.Deadband);
+        packValue(Out, Port.Heartbeat);
+        packValue(Out, Port.Resolution);
+        packValue(Out, Port.Averaging);
+        packValue(Out, Port.SampleCycles);
+        packValue(Out, Port.Interval);
+        packString(Out, Port.Formula);
+        packValue(Out, Port.Hidden);
+    }
 
-                    printf ("Port %s has a multiplier of 0, skipping\r\n", tmp.Name.c_str());
-                }
-            }
-            else {
-                // skip this sensor, sensor id is bad
-                printf("Port %s has an out of bounds Sensor ID= %d, skipping\r\n", tmp.Name.c_str(), tmp.SensorID);
-            }
-            
+    packValue<uint16_t>(Out, Specs.Modbus.size());
+    for (const ModbusPoint &Point : Specs.Modbus) {
+        packValue(Out, Point);
+    }
+}
 
+// reads a configuration from packSpecs() into Specs
+// returns false if it is cut short
+static bool unpackSpecs(const uint8_t *Data, size_t Size, BoardSpecs &Specs) {
+    SpecsReader In = {Data, Size, true};
+    BoardSpecs Out;
+    In.text(Out.ID);
+    In.text(Out.NetworkSSID);
+    In.text(Out.NetworkPassword);
+    In.text(Out.DatabaseTableName);
+    In.text(Out.RemoteIP);
+    In.text(Out.RemoteDir);
+    In.text(Out.HostName);
+    In.value(Out.RemotePort);
+    In.value(Out.ConfigVersion);
+    In.value(Out.PollingInterval);
+
+    uint16_t Count = 0;
+    In.value(Count);
+    for (uint16_t i = 0; i < Count && In.Ok; ++i) {
+        SensorInfo Sensor;
+        In.value(Sensor.ID);
+        In.text(Sensor.Type);
+        In.text(Sensor.Unit);
+        In.value(Sensor.Multiplier);
+        In.value(Sensor.RangeFloor);
+        In.value(Sensor.RangeCeiling);
+        In.value(Sensor.Oversample);
+        In.value(Sensor.AC);
+        In.value(Sensor.Deadband);
+        In.value(Sensor.DeadbandPercent);
+        In.value(Sensor.Heartbeat);
+        In.value(Sensor.Resolution);
+        In.value(Sensor.Averaging);
+        In.value(Sensor.SampleCycles);
+        In.value(Sensor.Interval);
+        In.value(Sensor.Gain);
+        In.value(Sensor.Offset);
+        uint16_t Points = 0;
+        In.value(Points);
+        for (uint16_t k = 0; k < Points && In.Ok; ++k) {
+            CalibrationPoint Point;
+            In.value(Point.Reading);
+            In.value(Point.Value);
+            Sensor.Curve.push_back(Point);
         }
+        Out.Sensors.push_back(Sensor);
     }
-    printSpecs(Specs);
-    return Specs;
+
+    Count = 0;
+    In.value(Count);
+    for (uint16_t i = 0; i < Count && In.Ok; ++i) {
+        PortInfo Port;
+        In.text(Port.Name);
+        In.text(Port.Description);
+        In.value(Port.Multiplier);
+        In.value(Port.SensorID);
+        In.value(Port.RangeFloor);
+        In.value(Port.RangeCeiling);
+        In.value(Port.Oversample);
+        In.value(Port.AC);
+        In.value(Port.Deadband);
+        In.value(Port.Heartbeat);
+        In.value(Port.Resolution);
+        In.value(Port.Averaging);
+        In.value(Port.SampleCycles);
+        In.value(Port.Interval);
+        In.text(Port.Formula);
+        In.value(Port.Hidden);
+        Out.Ports.push_back(Port);
+    }
+
+    Count = 0;
+    In.value(Count);
+    for (uint16_t i = 0; i < Count && In.Ok; ++i) {
+        ModbusPoint Point;
+        In.value(Point);
+        Out.Modbus.push_back(Point);
+    }
+
+    if (In.Ok) {
+        // moves the vectors over, nothing is copied
+        swap(Specs, Out);
+    }
+    return In.Ok;
 }
 
+// reads all of FileName into a new[] buffer
+// returns NULL if it can not be read
+static char *readWholeFile(const char *FileName, size_t &Size) {
+    FILE *fp = fopen(FileName, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long FileSize = ftell(fp);
+    rewind(fp);
+
+    char *Text = NULL;
+    if (FileSize > 0) {
+        Text = new char[FileSize];
+        Size = fread(Text, 1, FileSize, fp);
+        if (Size != (size_t)FileSize) {
+            delete[] Text;
+            Text = NULL;
+        }
+    }
+    fclose(fp);
+    return Text;
+}
+
+// keeps Specs in the flash, as parsed from a file of Size bytes with CRC32
+// crc
+static int saveSpecsCache(const BoardSpecs &Specs, uint32_t crc,
+                          size_t Size) {
+    ConfigCacheHeader New = {CONFIGCACHEMAGIC, CONFIGCACHEVERSION, 0, crc,
+                             (uint32_t)Size};
+    vector<uint8_t> Out;
+    packBytes(Out, &New, sizeof(New));
+    packSpecs(Specs, Out);
+    return Out.size() <= FLASHCONFIGMAX
+               ? saveConfigCache(Out.data(), Out.size())
+               : -1;
+}
+
+// the name of the binary config file of FileName
+static string binaryName(const char *FileName) {
+    string Name = FileName;
+    size_t Dot = Name.rfind('.');
+    if (Dot != string::npos && Name.find('/', Dot) == string::npos) {
+        Name.erase(Dot);
+    }
+    return Name + CONFIGBINARYEXT;
+}
+
+// reads the binary config file of FileName into Specs, and keeps it in the
+// flash unless Cached, the header of the copy there, says it came from it
+// returns false if there is none, or it is not valid
+static bool readBinaryConfig(const char *FileName,
+                             const ConfigCacheHeader *Cached,
+                             BoardSpecs &Specs) {
+    string Name = binaryName(FileName);
+    size_t Size = 0;
+    char *Data = readWholeFile(Name.c_str(), Size);
+    if (Data == NULL) {
+        return false;
+    }
+    const ConfigCacheHeader *Header =
+        reinterpret_cast<const ConfigCacheHeader *>(Data);
+    const uint8_t *Packed =
+        reinterpret_cast<const uint8_t *>(Data) + sizeof(ConfigCacheHeader);
+    bool valid = Size >= sizeof(ConfigCacheHeader) &&
+                 Header->Magic == CONFIGBINARYMAGIC &&
+                 Header->Version == CONFIGCACHEVERSION &&
+                 Header->SourceSize == Size - sizeof(ConfigCacheHeader);
+    uint32_t crc = 0;
+    if (valid) {
+        MbedCRC<POLY_32BIT_ANSI, 32> ct;
+        ct.compute(Packed, Header->SourceSize, &crc);
+        valid = crc == Header->SourceCRC &&
+                unpackSpecs(Packed, Header->SourceSize, Specs);
+    }
+    delete[] Data;
+    if (!valid) {
+        printf("\r\n%s can not be used, reading the config file\r\n",
+               Name.c_str());
+        return false;
+    }
+    printf("\r\nRead the board settings from %s\r\n", Name.c_str());
+
+    // the copy is only written again when the file changed
+    if (Cached == NULL || Cached->SourceCRC != crc ||
+        Cached->SourceSize != Size) {
+        int err = saveSpecsCache(Specs, crc, Size);
+        if (err) {
+            printf("The settings could not be kept in the flash (%d)\r\n",
+                   err);
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+bool loadBoardSpecs(const char *FileName, bool OnSD, BoardSpecs &Specs) {
+    uint8_t *Cache = new uint8_t[FLASHCONFIGMAX];
+    size_t CacheSize = readConfigCache(Cache, FLASHCONFIGMAX);
+    const ConfigCacheHeader *Header =
+        reinterpret_cast<const ConfigCacheHeader *>(Cache);
+    bool cached = CacheSize >= sizeof(ConfigCacheHeader) &&
+                  Header->Magic == CONFIGCACHEMAGIC &&
+                  Header->Version == CONFIGCACHEVERSION;
+    const uint8_t *Packed = Cache + sizeof(ConfigCacheHeader);
+    size_t PackedSize = CacheSize - sizeof(ConfigCacheHeader);
+
+    // a binary config file needs no parsing, the text is only read without
+    // a valid one
+    bool found = OnSD && readBinaryConfig(FileName, cached ? Header : NULL,
+                                          Specs);
+    size_t Size = 0;
+    char *Text = OnSD && !found ? readWholeFile(FileName, Size) : NULL;
+    if (Text != NULL) {
+        MbedCRC<POLY_32BIT_ANSI, 32> ct;
+        uint32_t crc = 0;
+        ct.compute(Text, Size, &crc);
+
+        if (cached && Header->SourceCRC == crc && Header->SourceSize == Size &&
+            unpackSpecs(Packed, PackedSize, Specs)) {
+            printf("\r\n%s did not change, using the settings in the "
+                   "flash\r\n",
+                   FileName);
+            found = true;
+        } else {
+            printf("\r\nReading board settings from %s\r\n", FileName);
+            parseConfigText(Text, Size, Specs);
+            found = true;
+
+            // the next boot does not have to parse it again
+            int err = saveSpecsCache(Specs, crc, Size);
+            if (err) {
+                printf("The settings could not be kept in the flash "
+                       "(%d)\r\n",
+                       err);
+            }
+        }
+        delete[] Text;
+    } else if (OnSD && !found) {
+        printf("\nReading %s Failed!\r\n", FileName);
+    }
+
+    // the last settings that worked keep the board going without the card
+    if (!found && cached && unpackSpecs(Packed, PackedSize, Specs)) {
+        printf("\r\nUsing the board settings in the flash\r\n");
+        found = true;
+    }
+    delete[] Cache;
+
+    if (found) {
+        printf("\r\n %d Ports were configured\r\n", Specs.Ports.size());
+    }
+    return found;
+}
+
+// ============================================================================
+int saveBoardSpecs(const BoardSpecs &Specs) {
+    // it still belongs to the same config file
+    ConfigCacheHeader Header;
+    uint8_t *Cache = new uint8_t[FLASHCONFIGMAX];
+    size_t CacheSize = readConfigCache(Cache, FLASHCONFIGMAX);
+    memcpy(&Header, Cache, sizeof(Header));
+    delete[] Cache;
+    if (CacheSize < sizeof(Header) || Header.Magic != CONFIGCACHEMAGIC) {
+        Header.SourceCRC = 0;
+        Header.SourceSize = 0;
+    }
+    return saveSpecsCache(Specs, Header.SourceCRC, Header.SourceSize);
+}
@@ -18,23 +18,87 @@ using namespace std;
 /// Arbitrary length for char buffers
 #define BUFFLEN 1024
 
+/// Identifies a BoardSpecs cached in the flash, "IACC" in little endian
+#define CONFIGCACHEMAGIC (0x43434149)
+
+/// Version of the cached BoardSpecs layout, and the schema version of a
+/// binary config file
+#define CONFIGCACHEVERSION (8)
+
+/// Identifies a binary config file, "IACB" in little endian
+#define CONFIGBINARYMAGIC (0x42434149)
+
+/// What a binary config file has in place of the config file's extension
+#define CONFIGBINARYEXT ".bin"
+
+/// The start of a cached BoardSpecs, the packed strings, numbers, sensors
+/// and ports follow it.
+///
+/// A binary config file has the same layout with CONFIGBINARYMAGIC, and
+/// SourceCRC and SourceSize are the CRC32 and the size of the packed fields
+/// after the header. BoardConfig/gen_config_bin.py makes one from a config
+/// file. It is loaded without parsing anything, and one of another
+/// CONFIGCACHEVERSION is not loaded.
+struct ConfigCacheHeader {
+    uint32_t Magic;      ///< always CONFIGCACHEMAGIC
+    uint16_t Version;    ///< always CONFIGCACHEVERSION
+    uint16_t Reserved;   ///< always 0
+    uint32_t SourceCRC;  ///< CRC32 of the config file it was parsed from
+    uint32_t SourceSize; ///< size of that file in bytes
+};
+
 /// Prints out most of the values of the member variables in Specs
 /// This excludes the port configuration values.
-void printSpecs(BoardSpecs &Specs);
+void printSpecs(const BoardSpecs &Specs);
 
-/// Tries to open the specified file to read and return the configuration.
-/// \returns The board's configuration
+/// Tries to open the specified file to read the configuration from.
+/// \param FileName The config file
+/// \param Specs Set to the board's configuration
+/// \returns false if the file could not be opened, Specs is left alone
 /// \sa BoardSpecs
-BoardSpecs readSDCard(const char *FileName);
+bool readSDCard(const char *FileName, BoardSpecs &Specs);
 
-/// Reads the fp and derives the board configuration from that file.
-/// This function gets the Board's ID, network SSID, network password, and
-/// database table name from the file pointer. In addition to that, it reads the
-/// number of ports and their type. All of that data is returned in a struct.
+/// Reads the rest of fp into RAM and parses it with parseConfigText().
 /// \param fp The file pointer to read
-/// \returns The board's configuration
+/// \param Specs Set to the board's configuration
 /// \sa BoardSpecs
-BoardSpecs readConfigText(FILE *fp);
+void readConfigText(FILE *fp, BoardSpecs &Specs);
+
+/// Derives the board configuration from the text of a config file.
+/// This function gets the Board's network SSID, network password, database
+/// table name and the remote connection info. In addition to that, it reads
+/// the sensor types and the ports that use them. The text is read once, and
+/// a port may name a sensor that is declared after it.
+/// \param Text The config file, it does not have to end with a '\0'
+/// \param Size The size of Text in bytes
+/// \param Specs Set to the board's configuration. Whatever it held before
+/// is dropped, its storage is used again
+/// \sa BoardSpecs ConfigParser
+void parseConfigText(const char *Text, size_t Size, BoardSpecs &Specs);
+
+/// Fills in the multiplier, range and description of Port from the sensor
+/// type Port.SensorID in Specs.Sensors.
+/// \returns false if the port has to be skipped
+bool resolvePort(const BoardSpecs &Specs, PortInfo &Port);
+
+/// Gets the board's configuration from the config file FileName, or from the
+/// copy of its parsed BoardSpecs in the flash. If OnSD, the file is read
+/// once and only parsed if its CRC32 is not the one the copy was made from,
+/// and the copy is then replaced. A valid binary config file next to it,
+/// with CONFIGBINARYEXT in place of its extension, is taken instead, and
+/// kept in the flash the same way. Without the SD card the copy is used as
+/// it is.
+/// \param FileName The config file on the SD card
+/// \param OnSD False if the SD card or its config file can not be read
+/// \param Specs Set to the configuration
+/// \returns false if there was no configuration in either place
+bool loadBoardSpecs(const char *FileName, bool OnSD, BoardSpecs &Specs);
+
+/// Replaces the copy of the parsed BoardSpecs in the flash with Specs, after
+/// the server changed it. It is still used for as long as the config file
+/// is not changed, a new config file replaces it.
+/// \returns 0 on success, or a negative error code
+int saveBoardSpecs(const BoardSpecs &Specs);
 
 
 #endif // BOARDCONFIG
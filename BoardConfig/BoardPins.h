@@ -0,0 +1,74 @@
+#ifndef BOARDPINS_H
+#define BOARDPINS_H
+/// \file
+/// \brief The pins and the peripherals of the board the firmware is built
+/// for.
+///
+/// The analog pins of the ports, the UART of the ESP8266 and the card
+/// detect of the SD slot used to be the FRDM-K64F's, written into
+/// main.cpp. They come from here now, by target: the FRDM-K64F, and the
+/// FRDM-K66F, which has the same Kinetis peripherals at 180 MHz, twice the
+/// flash and room for four more ports on its second ADC. Every pin can be
+/// set in mbed_app.json as well, for another board of the same family:
+/// "port-pins" is the list of the analog pins in port order, "sd-detect"
+/// the card detect, and "esp8266.tx" and "esp8266.rx" the UART of the
+/// ESP8266, which its driver takes too.
+///
+/// What the modules need of the part, its ADCs, comparators and DMA
+/// channels, is taken from the features of its MCUXpresso SDK, so a part
+/// with less of them fails to build instead of failing at run time.
+
+#include "mbed.h"
+
+#include "fsl_device_registers.h"
+
+/// The analog pins of the ports, in port order, as a list without braces.
+/// Set with "port-pins" in mbed_app.json.
+#ifdef MBED_CONF_APP_PORT_PINS
+#define BOARDPORTPINS MBED_CONF_APP_PORT_PINS
+#elif defined(TARGET_K64F)
+#define BOARDPORTPINS                                                         \
+    PTB2, PTB3, PTB10, PTB11, PTC11, PTC10, PTC2, PTC0, PTC9, PTC8
+#elif defined(TARGET_K66F)
+// the same pins as the K64F, the Arduino header's A0 to A3 are on ADC1 too
+#define BOARDPORTPINS                                                         \
+    PTB2, PTB3, PTB10, PTB11, PTC11, PTC10, PTC2, PTC0, PTC9, PTC8, PTB7,     \
+        PTB6, PTB5, PTB4
+#else
+#error "no port pins for this target, set port-pins in mbed_app.json"
+#endif
+
+/// The card detect of the SD slot, high with a card in it.
+/// Set with "sd-detect" in mbed_app.json.
+#ifdef MBED_CONF_APP_SD_DETECT
+#define BOARDSDDETECT MBED_CONF_APP_SD_DETECT
+#elif defined(TARGET_K66F)
+#define BOARDSDDETECT (PTD10)
+#else
+#define BOARDSDDETECT (PTE6)
+#endif
+
+/// The UART of the ESP8266, the pins its driver is configured with
+#if defined(MBED_CONF_ESP8266_TX) && defined(MBED_CONF_ESP8266_RX)
+#define BOARDESPTX (MBED_CONF_ESP8266_TX)
+#define BOARDESPRX (MBED_CONF_ESP8266_RX)
+#else
+#define BOARDESPTX (PTC17)
+#define BOARDESPRX (PTC16)
+#endif
+
+/// The ADC16 instances of the part
+#define BOARDADCS (FSL_FEATURE_SOC_ADC16_COUNT)
+
+/// The analog comparators of the part
+#define BOARDCOMPARATORS (FSL_FEATURE_SOC_CMP_COUNT)
+
+/// The channels of the part's eDMA
+#define BOARDDMACHANNELS (FSL_FEATURE_EDMA_MODULE_CHANNEL)
+
+// the scan takes two channels of every ADC, the ESP8266's UART one
+#if BOARDDMACHANNELS < 2 * BOARDADCS + 1
+#error "the part has too few DMA channels for the scan and the ESP8266"
+#endif
+
+#endif // BOARDPINS
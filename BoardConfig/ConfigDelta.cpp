@@ -0,0 +1,232 @@
+/// \file
+/// \brief Parses and applies the config deltas from the server
+#include "ConfigDelta.h"
+#include "BoardConfig.h"
+#include "ConfigParser.h"
+#include "FixedPorts.h"
+
+/// what comes right before the delta in a response
+#define DELTASTART "config=\""
+
+/// the delta waiting for the sampling loop
+static ConfigDelta Pending;
+
+static volatile bool HavePending = false;
+
+/// guards Pending, the uploader writes it and the sampling loop reads it
+static Mutex PendingLock;
+
+// copies a port name out of Field, returns false if it is empty or too long
+static bool copyName(Span<const char> Field, char (&Name)[DELTANAMELEN]) {
+    if (Field.empty() || (size_t)Field.size() >= DELTANAMELEN) {
+        return false;
+    }
+    memcpy(Name, Field.data(), Field.size());
+    Name[Field.size()] = '\0';
+    return true;
+}
+
+// reads one "Name=Value,Value" operation
+static bool parseOp(Span<const char> Text, DeltaOp &Op) {
+    ConfigParser Parser(Text.data(), Text.size());
+    Parser.nextLine();
+    memset(&Op, 0, sizeof(Op));
+
+    Span<const char> Key, Name, A, B;
+    if (!Parser.nextField('=', Key)) {
+        return false;
+    }
+    if (spanEquals(Key, "interval")) {
+        Op.Kind = DeltaInterval;
+        if (!Parser.restOfLine(A)) {
+            return false;
+        }
+        Op.A = spanToFloat(A);
+        return Op.A > 0.0f;
+    }
+
+    if (!Parser.nextField(',', Name) || !copyName(Name, Op.Port)) {
+        return false;
+    }
+    if (spanEquals(Key, "mult")) {
+        Op.Kind = DeltaMultiplier;
+        if (!Parser.restOfLine(A)) {
+            return false;
+        }
+        Op.A = spanToFloat(A);
+    } else if (spanEquals(Key, "range")) {
+        Op.Kind = DeltaRange;
+        if (!Parser.nextField(',', A) || !Parser.restOfLine(B)) {
+            return false;
+        }
+        Op.A = spanToFloat(A);
+        Op.B = spanToFloat(B);
+        return Op.A < Op.B;
+    } else if (spanEquals(Key, "add")) {
+        Op.Kind = DeltaAdd;
+        if (!Parser.restOfLine(A)) {
+            return false;
+        }
+        Op.SensorID = spanToInt(A);
+    } else if (spanEquals(Key, "remove")) {
+        Op.Kind = DeltaRemove;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+bool parseConfigDelta(const char *Response, ConfigDelta &Delta) {
+    const char *Start = strstr(Response, DELTASTART);
+    if (Start == NULL) {
+        return false;
+    }
+    Start += strlen(DELTASTART);
+    const char *End = strchr(Start, '"');
+    if (End == NULL || !isdigit(Start[0])) {
+        // the end of the delta did not fit into the response buffer
+        return false;
+    }
+
+    ConfigParser Parser(Start, End - Start);
+    Parser.nextLine();
+    Span<const char> Field;
+    if (!Parser.nextField(':', Field)) {
+        return false;
+    }
+    Delta.Version = strtoul(Field.data(), NULL, 10);
+    Delta.Count = 0;
+    while (Parser.nextField(';', Field)) {
+        if (Delta.Count == CONFIGDELTAMAX ||
+            !parseOp(Field, Delta.Ops[Delta.Count])) {
+            return false;
+        }
+        ++Delta.Count;
+    }
+    return Delta.Count > 0;
+}
+
+// ============================================================================
+void offerConfigDelta(const char *Response) {
+    if (strstr(Response, DELTASTART) == NULL) {
+        return;
+    }
+    // a delta that is not valid does not replace one that is waiting
+    ConfigDelta Delta;
+    if (!parseConfigDelta(Response, Delta)) {
+        printf("The config change from the server is not valid, "
+               "ignoring it\r\n");
+        return;
+    }
+    PendingLock.lock();
+    Pending = Delta;
+    HavePending = true;
+    PendingLock.unlock();
+}
+
+// ============================================================================
+bool configDeltaPending() { return HavePending; }
+
+// returns the index of the port called Name, or Ports.size()
+static size_t findPort(const vector<PortInfo> &Ports, const char *Name) {
+    size_t i = 0;
+    while (i < Ports.size() && Ports[i].Name != Name) {
+        ++i;
+    }
+    return i;
+}
+
+// applies Op to Ports and Interval, returns false if it can not be
+static bool applyOp(const BoardSpecs &Specs, const DeltaOp &Op,
+                    vector<PortInfo> &Ports, float &Interval,
+                    size_t MaxPorts) {
+    if (Op.Kind == DeltaInterval) {
+        Interval = Op.A;
+        return true;
+    }
+#if FIXEDPORTS
+    // the ports are compiled in
+    printf("Ports are fixed, %s can not be changed\r\n", Op.Port);
+    return false;
+#else
+    size_t i = findPort(Ports, Op.Port);
+    if (Op.Kind == DeltaAdd) {
+        PortInfo tmp;
+        tmp.SensorID = Op.SensorID;
+        if (i == Ports.size() && Ports.size() >= MaxPorts) {
+            printf("There is no pin left for port %s\r\n", Op.Port);
+            return false;
+        }
+        if (!tmp.Name.assign(Op.Port)) {
+            return false;
+        }
+        if (!resolvePort(Specs, tmp)) {
+            return false;
+        }
+        if (i < Ports.size()) {
+            // a removed port keeps its formula, or stays hidden
+            tmp.Formula = Ports[i].Formula;
+            tmp.Hidden = Ports[i].Hidden;
+        }
+        if (i == Ports.size()) {
+            Ports.push_back(tmp);
+        } else {
+            Ports[i] = tmp;
+        }
+        return true;
+    }
+
+    if (i == Ports.size()) {
+        printf("There is no port %s to change\r\n", Op.Port);
+        return false;
+    }
+    if (Op.Kind == DeltaMultiplier) {
+        Ports[i].Multiplier = Op.A;
+    } else if (Op.Kind == DeltaRange) {
+        Ports[i].RangeFloor = Op.A;
+        Ports[i].RangeCeiling = Op.B;
+    } else {
+        // a multiplier of 0 is how a port is left out, see readPorts()
+        Ports[i].Multiplier = 0.0f;
+    }
+    return true;
+#endif
+}
+
+// ============================================================================
+bool applyConfigDelta(BoardSpecs &Specs, size_t MaxPorts) {
+    if (!HavePending) {
+        return false;
+    }
+    PendingLock.lock();
+    HavePending = false;
+    bool Changed = false;
+    if (Pending.Version > Specs.ConfigVersion) {
+        // the operations work on copies, so a failed one leaves Specs alone
+        vector<PortInfo> Ports = Specs.Ports;
+        float Interval = Specs.PollingInterval;
+        uint16_t Names = nameCount();
+        Changed = true;
+        for (size_t i = 0; i < Pending.Count && Changed; ++i) {
+            Changed =
+                applyOp(Specs, Pending.Ops[i], Ports, Interval, MaxPorts);
+        }
+
+        if (Changed) {
+            Specs.Ports.swap(Ports);
+            Specs.PollingInterval = Interval;
+            Specs.ConfigVersion = Pending.Version;
+            printf("Config version %lu from the server was applied\r\n",
+                   (unsigned long)Pending.Version);
+        } else {
+            // only the copies have the names of its new ports, a server that
+            // keeps sending deltas with new names does not fill the table
+            dropNames(Names);
+            printf("Config version %lu from the server was rejected\r\n",
+                   (unsigned long)Pending.Version);
+        }
+    }
+    PendingLock.unlock();
+    return Changed;
+}
@@ -0,0 +1,74 @@
+#ifndef CONFIGDELTA_H
+#define CONFIGDELTA_H
+/// \file
+/// \brief Changes to the board's configuration that the server sends back in
+/// its responses, so boards can be recalibrated without pulling the SD card.
+///
+/// Next to samplerate=, a response can hold
+/// config="Version:Op;Op;...", with these operations:
+/// - interval=Seconds sets the polling interval
+/// - mult=Port,Multiplier changes a port's multiplier
+/// - range=Port,Floor,Ceiling changes a port's valid range
+/// - add=Port,SensorID adds a port, or sets up a removed one again, with a
+///   sensor type from the config file like a Port line does
+/// - remove=Port stops reading a port. It keeps its place, so the ports
+///   after it stay on their pins
+///
+/// Every request carries the board's Config_Version, and a delta is only
+/// applied if its version is newer. All of its operations are applied
+/// together between two readings, or none of them if one does not work.
+/// The result is kept in the flash with the cached config file, see
+/// saveBoardSpecs().
+
+#include "Structs.h"
+
+/// The most operations in one delta
+#define CONFIGDELTAMAX (16)
+
+/// The longest port name in a delta, with the '\0'
+#define DELTANAMELEN (32)
+
+/// What one operation of a delta changes
+enum DeltaKind {
+    DeltaInterval,   ///< A is the polling interval
+    DeltaMultiplier, ///< A is the port's multiplier
+    DeltaRange,      ///< A and B are the port's floor and ceiling
+    DeltaAdd,        ///< SensorID is the port's sensor type
+    DeltaRemove      ///< the port is not read any more
+};
+
+/// One operation of a delta
+struct DeltaOp {
+    DeltaKind Kind;
+    char Port[DELTANAMELEN]; ///< empty for DeltaInterval
+    float A;
+    float B;
+    int SensorID;
+};
+
+/// A parsed config="..." of a server response
+struct ConfigDelta {
+    uint32_t Version;
+    size_t Count;
+    DeltaOp Ops[CONFIGDELTAMAX];
+};
+
+/// Parses the config="..." out of a server response.
+/// \param Response The response with a '\0' at the end
+/// \returns false if there is none, or it is not valid
+bool parseConfigDelta(const char *Response, ConfigDelta &Delta);
+
+/// Keeps the delta in Response, if there is one, until the sampling loop
+/// applies it. Called from the uploader thread by parseServerResponse().
+void offerConfigDelta(const char *Response);
+
+/// Returns true if a delta from the server is waiting to be applied
+bool configDeltaPending();
+
+/// Applies the waiting delta to Specs, if its version is newer than
+/// Specs.ConfigVersion. Nothing else may use Specs while this runs.
+/// \param MaxPorts The number of ports the board has pins for
+/// \returns true if Specs was changed
+bool applyConfigDelta(BoardSpecs &Specs, size_t MaxPorts);
+
+#endif // CONFIGDELTA
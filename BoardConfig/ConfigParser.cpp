@@ -0,0 +1,114 @@
+/// \file
+/// \brief Implementation of the config file tokenizer
+#include "ConfigParser.h"
+
+#include <cstdlib>
+#include <cstring>
+
+ConfigParser::ConfigParser(const char *Text, size_t Size)
+    : Next(Text), End(Text + Size), Line(), Pos(0) {}
+
+// ============================================================================
+bool ConfigParser::nextLine() {
+    if (Next >= End) {
+        return false;
+    }
+    const char *Start = Next;
+    const char *Stop =
+        static_cast<const char *>(memchr(Start, '\n', End - Start));
+    if (Stop == NULL) {
+        Stop = End;
+        Next = End;
+    } else {
+        Next = Stop + 1;
+    }
+    // files edited on Windows end their lines with "\r\n"
+    if (Stop > Start && Stop[-1] == '\r') {
+        --Stop;
+    }
+    Line = Span<const char>(Start, Stop - Start);
+    Pos = 0;
+    return true;
+}
+
+// ============================================================================
+bool ConfigParser::lineIs(char First, const char *Word) const {
+    return !Line.empty() && Line[0] == First && spanContains(Line, Word);
+}
+
+// ============================================================================
+bool ConfigParser::nextField(char Delimiter, Span<const char> &Field) {
+    size_t Size = Line.size();
+    while (Pos < Size && Line[Pos] == Delimiter) {
+        ++Pos;
+    }
+    if (Pos >= Size) {
+        return false;
+    }
+    size_t Start = Pos;
+    while (Pos < Size && Line[Pos] != Delimiter) {
+        ++Pos;
+    }
+    Field = Line.subspan(Start, Pos - Start);
+    if (Pos < Size) {
+        ++Pos; // past the delimiter
+    }
+    return true;
+}
+
+// ============================================================================
+bool ConfigParser::restOfLine(Span<const char> &Field) {
+    if (Pos >= (size_t)Line.size()) {
+        return false;
+    }
+    Field = Line.subspan(Pos);
+    Pos = Line.size();
+    return true;
+}
+
+// ============================================================================
+bool spanContains(Span<const char> Field, const char *Word) {
+    size_t Len = strlen(Word);
+    size_t Size = Field.size();
+    for (size_t i = 0; Len <= Size && i <= Size - Len; ++i) {
+        if (memcmp(Field.data() + i, Word, Len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+bool spanEquals(Span<const char> Field, const char *Word) {
+    size_t Len = strlen(Word);
+    return (size_t)Field.size() == Len && memcmp(Field.data(), Word, Len) == 0;
+}
+
+// ============================================================================
+std::string spanToString(Span<const char> Field) {
+    return std::string(Field.data(), Field.size());
+}
+
+// copies Field into Buffer with a '\0', so the C conversions stop in it
+static void terminate(Span<const char> Field, char (&Buffer)[CONFIGNUMBERLEN]) {
+    size_t Len = Field.size();
+    if (Len >= CONFIGNUMBERLEN) {
+        Len = CONFIGNUMBERLEN - 1;
+    }
+    memcpy(Buffer, Field.data(), Len);
+    Buffer[Len] = '\0';
+}
+
+// ============================================================================
+float spanToFloat(Span<const char> Field) {
+    char Buffer[CONFIGNUMBERLEN];
+    terminate(Field, Buffer);
+    return atof(Buffer);
+}
+
+// ============================================================================
+int spanToInt(Span<const char> Field) {
+    char Buffer[CONFIGNUMBERLEN];
+    terminate(Field, Buffer);
+    return atoi(Buffer);
+}
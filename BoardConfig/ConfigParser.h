@@ -0,0 +1,70 @@
+#ifndef CONFIGPARSER_H
+#define CONFIGPARSER_H
+/// \file
+/// \brief Splits a config file that is already in RAM into lines and fields.
+///
+/// The fields are Spans into the text itself, so nothing is copied or
+/// changed until a value is kept, and the parser does not share any state
+/// the way strtok() does. It does not use mbed's drivers, so it also builds
+/// on a PC.
+
+#include "platform/Span.h"
+
+#include <cstddef>
+#include <string>
+
+using mbed::Span;
+
+/// The longest number that toFloat() and toInt() read, longer ones are cut
+#define CONFIGNUMBERLEN (32)
+
+class ConfigParser {
+  public:
+    /// \param Text The config file, it does not have to end with a '\0'
+    /// \param Size The size of Text in bytes
+    ConfigParser(const char *Text, size_t Size);
+
+    /// Moves to the next line of the text.
+    /// \returns false once every line was read
+    bool nextLine();
+
+    /// The line nextLine() moved to, without its "\n" or "\r\n"
+    Span<const char> line() const { return Line; }
+
+    /// Checks whether the line starts with First and has Word anywhere in it,
+    /// which is how the config file marks its lines
+    bool lineIs(char First, const char *Word) const;
+
+    /// Sets Field to the text of the line up to the next Delimiter. Like
+    /// strtok(), delimiters next to each other do not make empty fields.
+    /// \returns false if there are no more fields on the line
+    bool nextField(char Delimiter, Span<const char> &Field);
+
+    /// Sets Field to all of the line after the fields that were read, as the
+    /// last value on a line may have the delimiter in it.
+    /// \returns false if nothing is left on the line
+    bool restOfLine(Span<const char> &Field);
+
+  private:
+    const char *Next; ///< start of the line after this one
+    const char *End;  ///< end of the text
+    Span<const char> Line;
+    size_t Pos; ///< where the next field of Line starts
+};
+
+/// Checks whether Word is anywhere in Field
+bool spanContains(Span<const char> Field, const char *Word);
+
+/// Checks whether Field is the same text as Word
+bool spanEquals(Span<const char> Field, const char *Word);
+
+/// Copies Field into a string
+std::string spanToString(Span<const char> Field);
+
+/// Reads Field as a floating point number, like atof()
+float spanToFloat(Span<const char> Field);
+
+/// Reads Field as an integer, like atoi()
+int spanToInt(Span<const char> Field);
+
+#endif // CONFIGPARSER
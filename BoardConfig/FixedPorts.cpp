@@ -0,0 +1,33 @@
+/// \file
+/// \brief Copies the fixed port table into a BoardSpecs
+#include "FixedPorts.h"
+
+void useFixedPorts(BoardSpecs &Specs) {
+#if FIXEDPORTS
+    vector<PortInfo>().swap(Specs.Ports);
+    vector<SensorInfo>().swap(Specs.Sensors);
+    Specs.Ports.reserve(FIXEDPORTCOUNT);
+
+    for (const FixedPort &Port : FixedPortTable) {
+        PortInfo tmp;
+        if (!tmp.Name.assign(Port.Name) ||
+            !tmp.Description.assign(Port.Description)) {
+            printf("Fixed port %s does not fit into the name table, "
+                   "skipping\r\n",
+                   Port.Name);
+            continue;
+        }
+        tmp.Multiplier = Port.Multiplier;
+        tmp.SensorID = -1; // the table has no sensor types
+        tmp.RangeFloor = Port.RangeFloor;
+        tmp.RangeCeiling = Port.RangeCeiling;
+        tmp.Oversample = Port.Oversample;
+        tmp.AC = Port.AC;
+        tmp.Deadband = Port.Deadband;
+        tmp.Heartbeat = Port.Heartbeat;
+        Specs.Ports.push_back(tmp);
+    }
+    printf("\r\n %d fixed ports replace the ones in the config file\r\n",
+           Specs.Ports.size());
+#endif
+}
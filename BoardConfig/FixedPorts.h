@@ -0,0 +1,52 @@
+#ifndef FIXEDPORTS_H
+#define FIXEDPORTS_H
+/// \file
+/// \brief The port table of a board whose wiring never changes.
+///
+/// With "fixed-ports" set, the ports come from PortTable.h, which
+/// gen_port_table.py makes from the config file, and not from the Sensor and
+/// Port lines of the config file on the SD card. The table is constexpr, so
+/// the sampling loop knows the number of ports and every multiplier and
+/// range when it is compiled. The network settings are still read from the
+/// config file.
+
+#include "Structs.h"
+
+#include <array>
+
+/// Set to 1 to take the ports from PortTable.h. Set with "fixed-ports" in
+/// mbed_app.json, and run gen_port_table.py after the config file changes.
+#ifdef MBED_CONF_APP_FIXED_PORTS
+#define FIXEDPORTS MBED_CONF_APP_FIXED_PORTS
+#else
+#define FIXEDPORTS 0
+#endif
+
+/// One port of the fixed table, only constants so that the table can be
+/// constexpr and stays in the flash
+struct FixedPort {
+    const char *Name;        ///< same as PortInfo::Name
+    const char *Description; ///< same as PortInfo::Description
+    PinName Pin;             ///< the analog pin the sensor is wired to
+    float Multiplier;        ///< same as PortInfo::Multiplier, never 0
+    float RangeFloor;        ///< same as PortInfo::RangeFloor
+    float RangeCeiling;      ///< same as PortInfo::RangeCeiling
+    unsigned int Oversample; ///< same as PortInfo::Oversample
+    bool AC;                 ///< same as PortInfo::AC
+    float Deadband;          ///< same as PortInfo::Deadband
+    unsigned int Heartbeat;  ///< same as PortInfo::Heartbeat
+};
+
+#if FIXEDPORTS
+#include "PortTable.h"
+
+static_assert(FIXEDPORTCOUNT > 0 && FIXEDPORTCOUNT <= FRAMEMAXPORTS,
+              "PortTable.h needs between 1 and FRAMEMAXPORTS ports");
+#endif
+
+/// Replaces the ports in Specs with the ones in FixedPortTable, for the
+/// network and the backup log, and drops the sensor types that are not
+/// needed any more. Does nothing without FIXEDPORTS.
+void useFixedPorts(BoardSpecs &Specs);
+
+#endif // FIXEDPORTS
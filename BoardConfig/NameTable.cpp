@@ -0,0 +1,75 @@
+/// \file
+/// \brief Implementation of the name table
+#include "NameTable.h"
+
+/// The names the table starts with, the empty one, NAMENOSENSOR and
+/// NAMENOUNIT
+#define FIXEDNAMES (3)
+
+/// the text of every name, each ends with a '\0'. Name 0 is the empty one
+/// at the start, NAMENOSENSOR and NAMENOUNIT follow it
+static char Text[NAMETABLESIZE] = "\0" NAMENOSENSOR "\0" NAMENOUNIT;
+
+/// where each name starts in Text
+static uint16_t Starts[NAMETABLEMAX] = {0, 1, sizeof(NAMENOSENSOR) + 1};
+
+/// the names and the bytes of Text in use. A name is written before it is
+/// counted, so nameText() works without the lock
+static volatile uint16_t Count = FIXEDNAMES;
+static size_t Used = sizeof(NAMENOSENSOR) + sizeof(NAMENOUNIT) + 1;
+
+/// only one thread adds names at a time
+static Mutex TableLock;
+
+// ============================================================================
+bool internName(const char *Name, size_t Length, uint16_t &Id) {
+    Id = 0;
+    if (Length == 0) {
+        return true;
+    }
+    TableLock.lock();
+    for (uint16_t i = 1; i < Count; ++i) {
+        const char *Known = Text + Starts[i];
+        if (strncmp(Known, Name, Length) == 0 && Known[Length] == 0) {
+            TableLock.unlock();
+            Id = i;
+            return true;
+        }
+    }
+
+    if (Count < NAMETABLEMAX && Used + Length + 1 <= sizeof(Text)) {
+        Id = Count;
+        Starts[Id] = Used;
+        memcpy(Text + Used, Name, Length);
+        Text[Used + Length] = 0;
+        Used += Length + 1;
+        Count = Id + 1;
+    }
+    TableLock.unlock();
+
+    if (Id == 0) {
+        printf("The name table is full, there is no room for %.*s\r\n",
+               (int)Length, Name);
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+uint16_t nameCount() { return Count; }
+
+// ============================================================================
+void dropNames(uint16_t Keep) {
+    TableLock.lock();
+    if (Keep >= FIXEDNAMES && Keep < Count) {
+        // the names are in Text in the order of their numbers
+        Count = Keep;
+        Used = Starts[Keep];
+    }
+    TableLock.unlock();
+}
+
+// ============================================================================
+const char *nameText(uint16_t Id) {
+    return Id < Count ? Text + Starts[Id] : Text;
+}
@@ -0,0 +1,95 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+/// \file
+/// \brief The names of the ports and sensors, kept once in a static table
+/// and referred to by their number in it.
+///
+/// A config file has the same few types and units over and over, and every
+/// port and sensor held each of its names as a string on the heap, copied
+/// along with it. Here every name is interned once: internName() keeps its
+/// text in NAMETABLESIZE bytes and returns its number, and the same text
+/// gives the same number again. PortInfo and SensorInfo only hold an
+/// InternedName, two bytes that copy like an integer and compare without
+/// a strcmp(). A config that is read again finds its names already there.
+///
+/// A name that does not fit is not left empty: internName() and assign()
+/// fail, and the line of the config file it is on is left out, since a
+/// port without its name would be sent as another one. Names are only
+/// removed with dropNames(), for a config change that was not taken, the
+/// ones of a config that is in use stay. Only the main thread adds names.
+
+#include "mbed.h"
+#include <string>
+
+using namespace std;
+
+/// The bytes of text that the table holds, with the '\0's
+#define NAMETABLESIZE (1024)
+
+/// The most names the table holds, with the empty one
+#define NAMETABLEMAX (96)
+
+/// The names that every sensor starts with, which the table has from the
+/// start so they always fit
+#define NAMENOSENSOR "No Sensor"
+#define NAMENOUNIT "No Unit"
+
+/// Sets Id to the number of the Length bytes of Text, and keeps them if they
+/// are new
+/// \returns false if the table is full, Id is then 0, the empty name
+bool internName(const char *Text, size_t Length, uint16_t &Id);
+
+/// Returns how many names the table has, for dropNames()
+uint16_t nameCount();
+
+/// Drops the names that were added since nameCount() returned Keep. Only
+/// for names that nothing holds any more, like the ones of a config change
+/// that was rejected
+void dropNames(uint16_t Keep);
+
+/// Returns the text of name Id, "" for one that is not in the table
+const char *nameText(uint16_t Id);
+
+/// A name in the name table
+class InternedName {
+  public:
+    /// The empty name
+    InternedName() : Id(0) {}
+
+    /// Interns the Length bytes at Text, which do not need a '\0'
+    /// \returns false if the table is full, the name is then empty
+    bool assign(const char *Text, size_t Length) {
+        return internName(Text, Length, Id);
+    }
+
+    bool assign(const char *Text) { return assign(Text, strlen(Text)); }
+
+    bool assign(const string &Text) {
+        return assign(Text.data(), Text.size());
+    }
+
+    const char *c_str() const { return nameText(Id); }
+
+    bool empty() const { return Id == 0; }
+
+    /// The same text always has the same number
+    bool operator==(const InternedName &Other) const {
+        return Id == Other.Id;
+    }
+
+    bool operator!=(const InternedName &Other) const {
+        return Id != Other.Id;
+    }
+
+    /// Compares with a text that is not interned, without interning it
+    bool operator==(const char *Text) const {
+        return strcmp(c_str(), Text) == 0;
+    }
+
+    bool operator!=(const char *Text) const { return !(*this == Text); }
+
+  private:
+    uint16_t Id;
+};
+
+#endif // NAMETABLE
@@ -0,0 +1,20 @@
+#ifndef PORTTABLE_H
+#define PORTTABLE_H
+/// \file
+/// \brief The fixed port table, generated from IAC_Config_File.txt by
+/// gen_port_table.py. Do not edit it, run the script again.
+
+#include "FixedPorts.h"
+
+/// The number of ports in FixedPortTable
+#define FIXEDPORTCOUNT (2)
+
+/// The ports of this board, in scan order
+static constexpr std::array<FixedPort, FIXEDPORTCOUNT> FixedPortTable = {{
+    {"TestPort", " Potentiometer in  Volts", PTB2,
+     1.0f, 0.0f, 0.3f, 1, false, 0.0f, 0},
+    {"OtherTestPort", " Potentiometer in  Volts", PTB3,
+     1.0f, 0.0f, 0.3f, 1, false, 0.0f, 0},
+}};
+
+#endif // PORTTABLE
@@ -3,7 +3,9 @@
 /// \file
 ///  \brief Has the structs that store the board's information.
 
+#include "NameTable.h"
 #include "mbed.h"
+#include <cmath>
 #include <string>
 #include <vector>
 using namespace std;
@@ -12,13 +14,13 @@ using namespace std;
 struct PortInfo {
 
     /// Name of the port (Port_1, Port_2, etc.)
-    string Name;
+    InternedName Name;
 
     /// The value of the port, read from a sensor.
     float Value;
 
     /// Port description
-    string Description;
+    InternedName Description;
 
     /// Multiplies port value to convert units
     float Multiplier;
@@ -30,20 +32,87 @@ struct PortInfo {
 
     float RangeCeiling; ///< Any port reading above this is cosidered an error.
 
+    /// How many conversions are averaged into every reading of this port
+    unsigned int Oversample;
+
+    /// True if the port carries an AC waveform. Value is then the RMS of
+    /// the waveform, and Mean and Peak are filled in too.
+    bool AC;
+
+    float Mean; ///< DC part of an AC port's waveform, in the port's unit
+
+    float RMS; ///< RMS of an AC port's waveform, in the port's unit
+
+    float Peak; ///< largest distance from Mean of an AC port's waveform
+
+    /// How far a reading has to move from the last one that was sent before
+    /// it is sent again, in the port's unit. 0 sends every reading, see
+    /// Deadband.h
+    float Deadband;
+
+    /// The most seconds between two readings that are sent with a deadband,
+    /// 0 for DEADBANDHEARTBEAT
+    unsigned int Heartbeat;
+
+    /// How the ADC converts this port, see SensorInfo::Resolution
+    unsigned int Resolution;
+    unsigned int Averaging;
+    unsigned int SampleCycles;
+
+    /// The seconds between two readings of this port, see
+    /// SensorInfo::Interval. 0 for the polling interval
+    float Interval;
+
+    /// The formula of a virtual port, from its Virtual line, see
+    /// VirtualPorts.h. Empty for a port that is read from an input. It is
+    /// not in the name table, which never frees its names, and where a
+    /// full table would leave it empty and turn the port into an input
+    string Formula;
+
+    /// True if the port is only read for the formulas of the virtual ports,
+    /// and never sent
+    bool Hidden;
+
     /// Default Constructor.
-    /// Sets all string values to "", integers to 0, and floats to 0.0
+    /// Sets all names to "", integers to 0, and floats to 0.0
+    /// The oversampling ratio is set to 1 (no oversampling), and the ADC to
+    /// 16 bits with 4 conversions averaged
     PortInfo()
-        : Name(""), Value(0.0), Description(""), Multiplier(0.0), SensorID(0),
-           RangeFloor(0.0), RangeCeiling(0.0) {}
+        : Name(), Value(0.0), Description(), Multiplier(0.0), SensorID(0),
+           RangeFloor(0.0), RangeCeiling(0.0), Oversample(1), AC(false),
+           Mean(0.0), RMS(0.0), Peak(0.0), Deadband(0.0), Heartbeat(0),
+           Resolution(16), Averaging(4), SampleCycles(0), Interval(0.0),
+           Formula(), Hidden(false) {}
+};
+
+/// One point of a sensor's calibration curve
+struct CalibrationPoint {
+    /// The reading, as a fraction of the ADC's full scale from 0.0 to 1.0
+    float Reading;
+
+    /// What the sensor measures at that reading, in the sensor's unit
+    float Value;
+};
+
+/// A register of a Modbus slave that is read as a port, see ModbusMaster.h
+struct ModbusPoint {
+    /// The slave's address, 1 to 247
+    uint8_t Slave;
+
+    /// 3 for a holding register, 4 for an input register
+    uint8_t Function;
+
+    /// The register's address on the wire, from 0
+    uint16_t Register;
 };
 
 /// Stores information regarding specific sensors
 struct SensorInfo {
     int ID; ///< The sensor's id integer
 
-    string Type; ///< quantity that the sensor type measures.
+    InternedName Type; ///< quantity that the sensor type measures.
 
-    string Unit; ///< Unit the quantity is measured in
+    InternedName Unit; ///< Unit the quantity is measured in
 
     float
         Multiplier; ///< Multiplier to convert sensor's value to specified unit
@@ -52,9 +121,184 @@ struct SensorInfo {
 
     float RangeCeiling; ///< Any port reading above this is cosidered an error.
 
+    /// How many conversions are averaged into every reading.
+    /// This is the optional 6th field of a Sensor line, and defaults to 1
+    unsigned int Oversample;
+
+    /// True if the sensor measures an AC waveform.
+    /// This is the optional 7th field of a Sensor line (AC or DC), and
+    /// defaults to DC
+    bool AC;
+
+    /// How far a reading has to move before it is sent again.
+    /// This is the optional 8th field of a Sensor line, in Unit or with a %
+    /// as a percent of the range, and defaults to 0, every reading is sent
+    float Deadband;
+
+    /// True if Deadband is a percent of the range
+    bool DeadbandPercent;
+
+    /// The most seconds between two readings that are sent with a deadband.
+    /// This is the optional 9th field of a Sensor line, and defaults to 0,
+    /// DEADBANDHEARTBEAT
+    unsigned int Heartbeat;
+
+    /// The bits of every conversion, 16, 12, 10 or 8. A port that needs
+    /// less precision converts in less time. This is the optional 10th
+    /// field of a Sensor line, and defaults to 16
+    unsigned int Resolution;
+
+    /// How many conversions the ADC averages in hardware, 1, 4, 8, 16 or
+    /// 32. This is the optional 11th field of a Sensor line, and defaults
+    /// to 4
+    unsigned int Averaging;
+
+    /// Extra ADC clock cycles of sample time for a sensor with a high
+    /// output impedance, 0, 2, 6, 12 or 20. This is the optional 12th field
+    /// of a Sensor line, and defaults to 0
+    unsigned int SampleCycles;
+
+    /// The seconds between two readings of the sensor's ports, so a slow
+    /// temperature is not sent as often as a current. This is the optional
+    /// 13th field of a Sensor line, and defaults to 0, the polling interval
+    /// of the board, see RateSchedule.h
+    float Interval;
+
+    /// The value in Unit is Gain * (the reading on Curve) + Offset.
+    /// These come from a Calibration line, see Calibration.h, and default
+    /// to no calibration
+    float Gain;
+    float Offset; ///< in Unit
+
+    /// The reading of a non-linear sensor, sorted by Reading. Empty for a
+    /// linear sensor, whose reading is scaled by Multiplier
+    vector<CalibrationPoint> Curve;
+
     SensorInfo()
-        : ID(0), Type("No Sensor"), Unit("No Unit"), Multiplier(0.0),
-          RangeFloor(0.0), RangeCeiling(0) {}
+        : ID(0), Multiplier(0.0), RangeFloor(0.0), RangeCeiling(0),
+          Oversample(1), AC(false), Deadband(0.0), DeadbandPercent(false),
+          Heartbeat(0), Resolution(16), Averaging(4), SampleCycles(0),
+          Interval(0.0), Gain(1.0), Offset(0.0) {
+        // the table always has these two
+        Type.assign(NAMENOSENSOR);
+        Unit.assign(NAMENOUNIT);
+    }
+
+    /// Returns true if the readings of this sensor are calibrated
+    bool calibrated() const {
+        return Gain != 1.0f || Offset != 0.0f || !Curve.empty();
+    }
+};
+
+/// The most ports that a SampleFrame can hold
+#define FRAMEMAXPORTS (16)
+
+/// What the readings of a SampleFrame are
+enum FrameKind {
+    FrameReading, ///< one reading of every port
+    FrameBurst,   ///< a reading that was kept because a port left its
+                  ///< range while the readings are summed up, see
+                  ///< Aggregator.h
+    FrameMean,    ///< the mean of every port over a window
+    FrameMin,     ///< the smallest reading of every port over a window
+    FrameMax,     ///< the largest reading of every port over a window
+    FrameP50,     ///< the median of every port over a window
+    FrameP95,     ///< the 95th percentile of every port over a window
+    FrameP99,     ///< the 99th percentile of every port over a window
+    FRAMEKINDS
+};
+
+/// A SampleFrame as it was before frames had a kind. The backup log of
+/// version 1 and the flash queue of older firmware hold these.
+struct SampleFrameV1 {
+    uint32_t Timestamp;
+    uint16_t PortMask;
+    uint16_t OverMask;
+    uint16_t UnderMask;
+    uint16_t Raw[FRAMEMAXPORTS];
+};
+
+/// One reading of every active port, without any of the port metadata.
+///
+/// Readings are stored as 16 bit fractions of the ADC's full scale, before
+/// the port's multiplier is applied. The port names, units and multipliers
+/// stay in BoardSpecs, so a frame can be copied and stored without touching
+/// the heap.
+/// \sa BoardSpecs
+struct SampleFrame {
+    /// When the frame was taken, in seconds (time(NULL))
+    uint32_t Timestamp;
+
+    /// Bit i is set if Raw[i] holds a reading of BoardSpecs::Ports[i]
+    uint16_t PortMask;
+
+    /// Bit i is set if port i was above its RangeCeiling
+    uint16_t OverMask;
+
+    /// Bit i is set if port i was below its RangeFloor
+    uint16_t UnderMask;
+
+    /// Fraction of the ADC's full scale, 0xFFFF is full scale
+    uint16_t Raw[FRAMEMAXPORTS];
+
+    /// How many readings a summary was made of, 0 for a single reading
+    uint16_t Count;
+
+    /// One of FrameKind
+    uint8_t Kind;
+
+    /// The number of the reading in the board's stream, 0 if it has none,
+    /// see Sequence.h. It has to stay last, the flash queue of older
+    /// firmware holds frames without it
+    uint32_t Sequence;
+
+    /// Returns true if port i has a reading in this frame
+    bool hasPort(size_t i) const { return (PortMask >> i) & 1U; }
+
+    /// Stores reading (from 0.0 to 1.0) for port i and marks it as present
+    void setReading(size_t i, float reading) {
+        if (reading < 0.0f) {
+            reading = 0.0f;
+        } else if (reading > 1.0f) {
+            reading = 1.0f;
+        }
+        Raw[i] = (uint16_t)(reading * 0xFFFF + 0.5f);
+        PortMask |= 1U << i;
+    }
+
+    /// Returns the value of port i in the port's unit. Out of range
+    /// readings give HUGE_VAL or -HUGE_VAL, the error values of the
+    /// requests.
+    float value(size_t i, float multiplier) const {
+        if ((OverMask >> i) & 1U) {
+            return HUGE_VAL;
+        }
+        if ((UnderMask >> i) & 1U) {
+            return -HUGE_VAL;
+        }
+        return Raw[i] * (1.0f / (float)0xFFFF) * multiplier;
+    }
+
+    /// Clears every port and the timestamp, and makes it a single reading
+    void clear() {
+        Timestamp = 0;
+        PortMask = 0;
+        OverMask = 0;
+        UnderMask = 0;
+        Count = 0;
+        Kind = FrameReading;
+        Sequence = 0;
+    }
+
+    /// Takes the readings of a frame from older firmware
+    void load(const SampleFrameV1 &Old) {
+        clear();
+        Timestamp = Old.Timestamp;
+        PortMask = Old.PortMask;
+        OverMask = Old.OverMask;
+        UnderMask = Old.UnderMask;
+        memcpy(Raw, Old.Raw, sizeof(Raw));
+    }
 };
 
 /// Contains board properties and the ports' data and info.
@@ -89,23 +333,53 @@ struct BoardSpecs {
     /// the http port used in the GET request
     uint16_t RemotePort;
 
+    /// The version of the last config delta from the server that was
+    /// applied, 0 if the settings are the ones from the config file
+    uint32_t ConfigVersion;
+
+    /// The polling interval in seconds that the server set with a config
+    /// delta, 0 if it did not set one
+    float PollingInterval;
+
     /// The collection of ports and their information
     vector<PortInfo> Ports;
 
     /// Collection of possible sensor types.
     vector<SensorInfo> Sensors;
 
+    /// The registers of the Modbus ports, in the order of their ports
+    vector<ModbusPoint> Modbus;
+
     /// Sets the number of ports for the board
     void setPortNum(unsigned int Num) { Ports.resize(Num); }
 
     /// Returns number of ports
     unsigned int getPortNum() { return Ports.size(); }
 
+    /// Sets everything back to how the constructor left it, but the strings
+    /// and vectors keep the memory they have
+    void clear() {
+        ID.clear();
+        NetworkSSID.clear();
+        NetworkPassword.clear();
+        DatabaseTableName.clear();
+        RemoteIP.clear();
+        RemoteDir.clear();
+        HostName.clear();
+        RemotePort = 0;
+        ConfigVersion = 0;
+        PollingInterval = 0.0f;
+        Ports.clear();
+        Sensors.clear();
+        Modbus.clear();
+    }
+
     /// Default constructor.
     /// Sets all strings to "" and sets the initializes the vector size to 0
     BoardSpecs()
         : ID(""), NetworkSSID(""), NetworkPassword(""), DatabaseTableName(""),
-          RemoteIP(""), RemoteDir(""), RemotePort(0), Ports() {}
+          RemoteIP(""), RemoteDir(""), RemotePort(0), ConfigVersion(0),
+          PollingInterval(0.0f), Ports() {}
 };
 
 #endif // STRUCTS
@@ -0,0 +1,529 @@
+#!/usr/bin/env python3
+"""Generates the binary config file of a board from its config file.
+
+The binary file holds the BoardSpecs that parseConfigText() would make of the
+config file, packed the way the board keeps them in the flash, so the board
+loads it without parsing any text. Copy it next to the config file on the SD
+card, as IAC_Config_File.bin for IAC_Config_File.txt. The board takes it
+instead of the text file while its schema version is CONFIGCACHEVERSION in
+BoardConfig.h, and reads the text file again once it is not.
+
+    python3 BoardConfig/gen_config_bin.py IAC_Config_File.txt \\
+        -o IAC_Config_File.bin
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+# CONFIGBINARYMAGIC and CONFIGCACHEVERSION in BoardConfig.h
+MAGIC = 0x42434149
+SCHEMA_VERSION = 8
+
+# CONFIGNUMBERLEN in ConfigParser.h, the longest number that is read
+NUMBER_LEN = 32
+
+# the most bytes of code, numbers and stack of one formula, see VirtualPorts.h
+FORMULA_CODE_MAX = 32
+FORMULA_CONSTANTS = 8
+FORMULA_STACK = 8
+FORMULA_NESTING = 16
+FRAME_MAX_PORTS = 16
+
+FORMULA_FUNCTIONS = {"abs": 1, "sqrt": 1, "min": 2, "max": 2}
+
+
+def f32(value):
+    """Rounds value to a float, like the board keeps it."""
+    return struct.unpack("<f", struct.pack("<f", value))[0]
+
+
+def to_float(text):
+    """Reads a number like spanToFloat(), 0.0 if there is none."""
+    text = text[:NUMBER_LEN - 1].lstrip()
+    for end in range(len(text), 0, -1):
+        try:
+            return f32(float(text[:end]))
+        except ValueError:
+            pass
+    return 0.0
+
+
+def to_int(text):
+    """Reads a number like spanToInt(), 0 if there is none."""
+    text = text[:NUMBER_LEN - 1].lstrip()
+    end = 1 if text[:1] in "+-" else 0
+    while end < len(text) and text[end].isdigit():
+        end += 1
+    try:
+        return int(text[:end])
+    except ValueError:
+        return 0
+
+
+class Line:
+    """One line of the config file, read field by field like ConfigParser."""
+
+    def __init__(self, text):
+        self.text = text
+        self.pos = 0
+
+    def is_(self, first, word):
+        return self.text[:1] == first and word in self.text
+
+    def next_field(self, delimiter):
+        """The next field up to delimiter, None at the end of the line."""
+        size = len(self.text)
+        while self.pos < size and self.text[self.pos] == delimiter:
+            self.pos += 1
+        if self.pos >= size:
+            return None
+        start = self.pos
+        while self.pos < size and self.text[self.pos] != delimiter:
+            self.pos += 1
+        field = self.text[start:self.pos]
+        if self.pos < size:
+            self.pos += 1
+        return field
+
+    def rest(self):
+        """The rest of the line, None if nothing is left."""
+        if self.pos >= len(self.text):
+            return None
+        field = self.text[self.pos:]
+        self.pos = len(self.text)
+        return field
+
+
+def lines(path):
+    """The lines of the config file at path, without their line ends."""
+    with open(path, "rb") as config:
+        text = config.read().decode("latin-1")
+    if not text:
+        return []
+    raw = text.split("\n")
+    if text.endswith("\n"):
+        raw.pop()
+    return [Line(l[:-1] if l.endswith("\r") else l) for l in raw]
+
+
+def new_sensor():
+    return {"Type": "No Sensor", "Unit": "No Unit", "Multiplier": 0.0,
+            "RangeFloor": 0.0, "RangeCeiling": 0.0, "Oversample": 1,
+            "AC": False, "Deadband": 0.0, "DeadbandPercent": False,
+            "Heartbeat": 0, "Resolution": 16, "Averaging": 4,
+            "SampleCycles": 0, "Interval": 0.0, "Gain": 1.0, "Offset": 0.0,
+            "Curve": []}
+
+
+def parse_sensor(line):
+    """A Sensor line, like parseSensor()."""
+    sensor = new_sensor()
+    line.next_field(":")
+    keys = ["Type", "Unit", "Multiplier", "RangeFloor", "RangeCeiling"]
+    for key in keys:
+        value = line.next_field(",")
+        if value is None:
+            continue
+        sensor[key] = value if key in ("Type", "Unit") else to_float(value)
+
+    value = line.next_field(",")
+    if value is not None and to_int(value) > 0:
+        sensor["Oversample"] = to_int(value)
+    value = line.next_field(",")
+    if value is not None and "AC" in value:
+        sensor["AC"] = True
+    value = line.next_field(",")
+    if value is not None and to_float(value) > 0.0:
+        sensor["Deadband"] = to_float(value)
+        sensor["DeadbandPercent"] = "%" in value
+    for key, least in (("Heartbeat", 1), ("Resolution", 1), ("Averaging", 1),
+                       ("SampleCycles", 0)):
+        value = line.next_field(",")
+        if value is not None and to_int(value) >= least:
+            sensor[key] = to_int(value)
+    value = line.next_field(",")
+    if value is not None and to_float(value) > 0.0:
+        sensor["Interval"] = to_float(value)
+    return sensor
+
+
+def parse_calibration(line, sensors):
+    """A Calibration line, like parseCalibration()."""
+    line.next_field(":")
+    value = line.next_field(",")
+    sensor_id = to_int(value) if value is not None else -1
+    if not 0 <= sensor_id < len(sensors):
+        print("Calibration for an out of bounds Sensor ID= %d, skipping"
+              % sensor_id, file=sys.stderr)
+        return
+    sensor = sensors[sensor_id]
+    for key in ("Gain", "Offset"):
+        value = line.next_field(",")
+        if value is not None:
+            sensor[key] = to_float(value)
+
+    curve = []
+    while True:
+        value = line.next_field(",")
+        if value is None:
+            break
+        colon = value.find(":")
+        if colon < 0 or colon + 1 >= len(value):
+            continue
+        curve.append((to_float(value[:colon]), to_float(value[colon + 1:])))
+    curve.sort(key=lambda point: point[0])
+    if len(curve) == 1:
+        print("The curve of Sensor ID= %d needs two points, ignoring it"
+              % sensor_id, file=sys.stderr)
+        curve = []
+    sensor["Curve"] = curve
+
+
+def parse_modbus(line):
+    """A Modbus line, like parseModbus(), None if it can not be read."""
+    line.next_field(":")
+    values = [line.next_field(","), line.next_field(","), line.rest()]
+    slave, function, register = [to_int(v) if v is not None else -1
+                                 for v in values]
+    if (not 1 <= slave <= 247 or function not in (3, 4) or
+            not 0 <= register <= 0xFFFF):
+        print("Modbus register %d of slave %d with function %d can not be "
+              "read, skipping" % (register, slave, function), file=sys.stderr)
+        return None
+    return (slave, function, register)
+
+
+class Formula:
+    """Checks a formula like compileFormula(), without the code."""
+
+    def __init__(self, text):
+        self.text = text
+        self.at = 0
+        self.length = 0
+        self.constants = 0
+        self.depth = 0
+        self.deepest = 0
+        self.ok = True
+        self.nesting = 0
+
+    def peek(self):
+        while self.at < len(self.text) and self.text[self.at].isspace():
+            self.at += 1
+        return self.text[self.at] if self.at < len(self.text) else ""
+
+    def nest(self):
+        self.nesting += 1
+        self.ok = self.ok and self.nesting <= FORMULA_NESTING
+        return self.ok
+
+    def take(self, char):
+        if self.peek() != char:
+            return False
+        self.at += 1
+        return True
+
+    def emit(self, size, change):
+        self.length += size
+        self.ok = self.ok and self.length <= FORMULA_CODE_MAX
+        self.depth += change
+        self.deepest = max(self.deepest, self.depth)
+
+    def number(self):
+        while self.at < len(self.text) and (self.text[self.at].isdigit() or
+                                            self.text[self.at] == "."):
+            self.at += 1
+        if self.text[self.at:self.at + 1] in ("e", "E"):
+            self.at += 1
+            if self.text[self.at:self.at + 1] in ("+", "-"):
+                self.at += 1
+            while self.at < len(self.text) and self.text[self.at].isdigit():
+                self.at += 1
+        self.constants += 1
+        self.ok = self.ok and self.constants <= FORMULA_CONSTANTS
+        self.emit(2, 1)
+
+    def port(self):
+        self.at += 1
+        start = self.at
+        while self.at < len(self.text) and self.text[self.at].isdigit():
+            self.at += 1
+        self.ok = self.ok and int(self.text[start:self.at]) < FRAME_MAX_PORTS
+        self.emit(2, 1)
+
+    def function(self):
+        start = self.at
+        while self.at < len(self.text) and self.text[self.at].isalpha():
+            self.at += 1
+        arguments = FORMULA_FUNCTIONS.get(self.text[start:self.at])
+        if arguments is None or not self.take("("):
+            self.ok = False
+            return
+        self.expression()
+        for _ in range(1, arguments):
+            if not self.take(","):
+                self.ok = False
+                return
+            self.expression()
+        self.ok = self.ok and self.take(")")
+        self.emit(1, 1 - arguments)
+
+    def primary(self):
+        char = self.peek()
+        if self.take("("):
+            self.expression()
+            self.ok = self.ok and self.take(")")
+        elif char.isdigit() or char == ".":
+            self.number()
+        elif (char in ("P", "p") and
+              self.text[self.at + 1:self.at + 2].isdigit()):
+            self.port()
+        elif char.isalpha():
+            self.function()
+        else:
+            self.ok = False
+
+    def unary(self):
+        if self.take("-"):
+            if not self.nest():
+                return
+            self.unary()
+            self.nesting -= 1
+            self.emit(1, 0)
+        else:
+            self.take("+")
+            self.primary()
+
+    def binary(self, operand, operators):
+        operand()
+        while self.ok:
+            if not any(self.take(op) for op in operators):
+                return
+            operand()
+            self.emit(1, -1)
+
+    def term(self):
+        self.binary(self.unary, "*/")
+
+    def expression(self):
+        if not self.nest():
+            return
+        self.binary(self.term, "+-")
+        self.nesting -= 1
+
+    def valid(self):
+        self.expression()
+        return (self.ok and self.peek() == "" and self.depth == 1 and
+                self.deepest <= FORMULA_STACK)
+
+
+def new_port(name, sensor_id):
+    return {"Name": name, "SensorID": sensor_id, "Formula": "",
+            "Hidden": False}
+
+
+def read_config(path):
+    """Returns the BoardSpecs that parseConfigText() makes of path."""
+    specs = {"RemoteIP": "", "RemotePort": 0, "HostName": "",
+             "RemoteDir": "", "NetworkSSID": "", "NetworkPassword": "",
+             "DatabaseTableName": "", "Sensors": [], "Modbus": []}
+    ports = []
+    calibrations = []
+    for line in lines(path):
+        if line.is_("S", "Sensor"):
+            specs["Sensors"].append(parse_sensor(line))
+        elif line.is_("C", "Calibration"):
+            calibrations.append(line)
+        elif line.is_("M", "Modbus"):
+            point = parse_modbus(line)
+            if point is not None:
+                specs["Modbus"].append(point)
+        elif line.is_("C", "ConnInfo"):
+            line.next_field(":")
+            value = line.next_field(",")
+            if value is not None:
+                specs["RemoteIP"] = value
+            value = line.next_field(",")
+            specs["RemotePort"] = (to_int(value) & 0xFFFF
+                                   if value is not None and
+                                   value[0].isdigit() else 0)
+            value = line.next_field(",")
+            if value is not None:
+                specs["HostName"] = value
+            value = line.rest()
+            if value is not None:
+                specs["RemoteDir"] = value
+        elif line.is_("B", "Board"):
+            line.next_field(":")
+            for key in ("NetworkSSID", "NetworkPassword"):
+                value = line.next_field(",")
+                if value is not None:
+                    specs[key] = value
+            value = line.rest()
+            if value is not None:
+                specs["DatabaseTableName"] = value
+        elif line.is_("P", "Port"):
+            line.next_field(":")
+            name = line.next_field(",") or ""
+            value = line.next_field(",")
+            port = new_port(name, to_int(value) if value is not None else -1)
+            value = line.rest()
+            if value is not None:
+                port["Hidden"] = "hidden" in value
+            ports.append(port)
+        elif line.is_("V", "Virtual"):
+            line.next_field(":")
+            name = line.next_field(",") or ""
+            value = line.next_field(",")
+            port = new_port(name, to_int(value) if value is not None else -1)
+            formula = line.rest()
+            if formula is None or not Formula(formula).valid():
+                print("Port %s has a formula that can not be used, skipping"
+                      % name, file=sys.stderr)
+                continue
+            port["Formula"] = formula
+            ports.append(port)
+
+    for line in calibrations:
+        parse_calibration(line, specs["Sensors"])
+
+    # the ports that resolvePort() keeps, in the same order
+    specs["Ports"] = []
+    for port in ports:
+        sensors = specs["Sensors"]
+        if not 0 <= port["SensorID"] < len(sensors):
+            print("Port %s has an out of bounds Sensor ID= %d, skipping"
+                  % (port["Name"], port["SensorID"]), file=sys.stderr)
+            continue
+        sensor = sensors[port["SensorID"]]
+        for key in ("Multiplier", "RangeFloor", "RangeCeiling", "Oversample",
+                    "AC", "Deadband", "Heartbeat", "Resolution", "Averaging",
+                    "SampleCycles", "Interval"):
+            port[key] = sensor[key]
+        port["Description"] = sensor["Type"] + " in " + sensor["Unit"]
+        if sensor["DeadbandPercent"]:
+            span = f32(abs(f32(sensor["RangeCeiling"] -
+                                sensor["RangeFloor"])) / 100.0)
+            port["Deadband"] = f32(port["Deadband"] * span)
+        if port["Multiplier"] == 0.0:
+            print("Port %s has a multiplier of 0, skipping" % port["Name"],
+                  file=sys.stderr)
+            continue
+        specs["Ports"].append(port)
+    return specs
+
+
+class Packer:
+    """Packs the fields like packSpecs() does."""
+
+    def __init__(self):
+        self.out = bytearray()
+
+    def string(self, text):
+        data = text.encode("latin-1")
+        self.out += struct.pack("<H", len(data)) + data
+
+    def int(self, value):
+        self.out += struct.pack("<i", value)
+
+    def unsigned(self, value):
+        self.out += struct.pack("<I", value)
+
+    def float(self, value):
+        self.out += struct.pack("<f", value)
+
+    def bool(self, value):
+        self.out += struct.pack("<?", value)
+
+    def count(self, value):
+        self.out += struct.pack("<H", value)
+
+
+def pack_specs(specs):
+    """The packed fields of specs, in the order of packSpecs()."""
+    out = Packer()
+    # the board's ID comes from the server, and the config version and the
+    # polling interval are 0 after a config file like they are on the board
+    out.string("")
+    for key in ("NetworkSSID", "NetworkPassword", "DatabaseTableName",
+                "RemoteIP", "RemoteDir", "HostName"):
+        out.string(specs[key])
+    out.out += struct.pack("<H", specs["RemotePort"])
+    out.unsigned(0)
+    out.float(0.0)
+
+    out.count(len(specs["Sensors"]))
+    for sensor in specs["Sensors"]:
+        out.int(0)
+        out.string(sensor["Type"])
+        out.string(sensor["Unit"])
+        out.float(sensor["Multiplier"])
+        out.float(sensor["RangeFloor"])
+        out.float(sensor["RangeCeiling"])
+        out.unsigned(sensor["Oversample"])
+        out.bool(sensor["AC"])
+        out.float(sensor["Deadband"])
+        out.bool(sensor["DeadbandPercent"])
+        out.unsigned(sensor["Heartbeat"])
+        out.unsigned(sensor["Resolution"])
+        out.unsigned(sensor["Averaging"])
+        out.unsigned(sensor["SampleCycles"])
+        out.float(sensor["Interval"])
+        out.float(sensor["Gain"])
+        out.float(sensor["Offset"])
+        out.count(len(sensor["Curve"]))
+        for reading, value in sensor["Curve"]:
+            out.float(reading)
+            out.float(value)
+
+    out.count(len(specs["Ports"]))
+    for port in specs["Ports"]:
+        out.string(port["Name"])
+        out.string(port["Description"])
+        out.float(port["Multiplier"])
+        out.int(port["SensorID"])
+        out.float(port["RangeFloor"])
+        out.float(port["RangeCeiling"])
+        out.unsigned(port["Oversample"])
+        out.bool(port["AC"])
+        out.float(port["Deadband"])
+        out.unsigned(port["Heartbeat"])
+        out.unsigned(port["Resolution"])
+        out.unsigned(port["Averaging"])
+        out.unsigned(port["SampleCycles"])
+        out.float(port["Interval"])
+        out.string(port["Formula"])
+        out.bool(port["Hidden"])
+
+    out.count(len(specs["Modbus"]))
+    for slave, function, register in specs["Modbus"]:
+        out.out += struct.pack("<BBH", slave, function, register)
+    return bytes(out.out)
+
+
+def binary_config(specs):
+    """The binary config file of specs, a ConfigCacheHeader and the fields."""
+    packed = pack_specs(specs)
+    header = struct.pack("<IHHII", MAGIC, SCHEMA_VERSION, 0,
+                         zlib.crc32(packed) & 0xFFFFFFFF, len(packed))
+    return header + packed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("config", help="the board's config file")
+    parser.add_argument("-o", "--output", required=True,
+                        help="where to write the binary config file")
+    args = parser.parse_args()
+
+    specs = read_config(args.config)
+    with open(args.output, "wb") as out:
+        out.write(binary_config(specs))
+    print("%d sensors and %d ports in %s" % (len(specs["Sensors"]),
+                                             len(specs["Ports"]),
+                                             args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Generates PortTable.h, the fixed port table of a board, from its config file.
+
+For boards whose wiring never changes. Build with "fixed-ports" set to 1 in
+mbed_app.json, and the ports, multipliers and ranges come from the table
+instead of the config file. The Sensor and Port lines are read the same way as
+parseConfigText() reads them, so the table matches what the config file would
+give at boot.
+
+    python3 BoardConfig/gen_port_table.py IAC_Config_File.txt \\
+        -o BoardConfig/PortTable.h
+"""
+
+import argparse
+import os
+import sys
+
+# the sensor ports of the board, in the order main.cpp scans them
+DEFAULT_PINS = ["PTB2", "PTB3", "PTB10", "PTB11", "PTC11",
+                "PTC10", "PTC2", "PTC0", "PTC9", "PTC8"]
+
+
+def fields(text, delimiter):
+    """Splits text like strtok() does, without empty fields."""
+    return [f for f in text.split(delimiter) if f]
+
+
+def after_colon(line):
+    """The part of a line after its "Name:" marker."""
+    return line.partition(":")[2]
+
+
+def to_float(text):
+    """Reads a number like atof(), 0.0 if there is none."""
+    text = text.strip()
+    for end in range(len(text), 0, -1):
+        try:
+            return float(text[:end])
+        except ValueError:
+            pass
+    return 0.0
+
+
+def to_int(text):
+    """Reads a number like atoi(), 0 if there is none."""
+    text = text.strip()
+    end = 1 if text[:1] in "+-" else 0
+    while end < len(text) and text[end].isdigit():
+        end += 1
+    try:
+        return int(text[:end])
+    except ValueError:
+        return 0
+
+
+def read_config(path):
+    """Returns the sensors and ports of the config file at path."""
+    sensors = []
+    ports = []
+    with open(path, "rb") as config:
+        for raw in config.read().decode("latin-1").split("\n"):
+            line = raw[:-1] if raw.endswith("\r") else raw
+            if line.startswith("S") and "Sensor" in line:
+                values = fields(after_colon(line), ",")
+                values += [""] * (9 - len(values))
+                sensors.append({
+                    "Type": values[0],
+                    "Unit": values[1],
+                    "Multiplier": to_float(values[2]),
+                    "RangeFloor": to_float(values[3]),
+                    "RangeCeiling": to_float(values[4]),
+                    "Oversample": max(to_int(values[5]), 1),
+                    "AC": "AC" in values[6],
+                    "Deadband": max(to_float(values[7]), 0.0),
+                    "DeadbandPercent": "%" in values[7],
+                    "Heartbeat": max(to_int(values[8]), 0),
+                })
+            elif line.startswith("P") and "Port" in line:
+                name, _, sensor = after_colon(line).lstrip(",").partition(",")
+                ports.append((name, to_int(sensor) if sensor else -1))
+
+    # the ports that parseConfigText() would keep, in the same order
+    table = []
+    for name, sensor_id in ports:
+        if not 0 <= sensor_id < len(sensors):
+            print("Port %s has an out of bounds Sensor ID= %d, skipping"
+                  % (name, sensor_id), file=sys.stderr)
+            continue
+        sensor = sensors[sensor_id]
+        if sensor["Multiplier"] == 0.0:
+            print("Port %s has a multiplier of 0, skipping" % name,
+                  file=sys.stderr)
+            continue
+        port = dict(sensor)
+        port["Name"] = name
+        port["Description"] = sensor["Type"] + " in " + sensor["Unit"]
+        # a percent deadband is taken from the range, like resolvePort()
+        if sensor["DeadbandPercent"]:
+            port["Deadband"] *= abs(sensor["RangeCeiling"] -
+                                    sensor["RangeFloor"]) / 100.0
+        table.append(port)
+    return table
+
+
+def c_string(text):
+    """Quotes text as a C string literal."""
+    out = '"'
+    for char in text:
+        if char in '"\\':
+            out += "\\" + char
+        elif 32 <= ord(char) < 127:
+            out += char
+        else:
+            out += '\\%03o' % ord(char)
+    return out + '"'
+
+
+def c_float(value):
+    return repr(float(value)) + "f"
+
+
+def write_table(table, pins, source, out):
+    """Writes the PortTable.h for table to out."""
+    out.write("#ifndef PORTTABLE_H\n")
+    out.write("#define PORTTABLE_H\n")
+    out.write("/// \\file\n")
+    out.write("/// \\brief The fixed port table, generated from %s by\n"
+              % os.path.basename(source))
+    out.write("/// gen_port_table.py. Do not edit it, run the script again.\n")
+    out.write("\n")
+    out.write('#include "FixedPorts.h"\n')
+    out.write("\n")
+    out.write("/// The number of ports in FixedPortTable\n")
+    out.write("#define FIXEDPORTCOUNT (%d)\n" % len(table))
+    out.write("\n")
+    out.write("/// The ports of this board, in scan order\n")
+    out.write("static constexpr std::array<FixedPort, FIXEDPORTCOUNT> "
+              "FixedPortTable = {{\n")
+    for i, port in enumerate(table):
+        out.write("    {%s, %s, %s,\n" % (c_string(port["Name"]),
+                                         c_string(port["Description"]),
+                                         pins[i]))
+        out.write("     %s, %s, %s, %d, %s, %s, %d},\n" % (
+            c_float(port["Multiplier"]), c_float(port["RangeFloor"]),
+            c_float(port["RangeCeiling"]), port["Oversample"],
+            "true" if port["AC"] else "false", c_float(port["Deadband"]),
+            port["Heartbeat"]))
+    out.write("}};\n")
+    out.write("\n")
+    out.write("#endif // PORTTABLE\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("config", help="the board's config file")
+    parser.add_argument("-o", "--output", default="-",
+                        help="where to write the header, stdout by default")
+    parser.add_argument("--pins", default=",".join(DEFAULT_PINS),
+                        help="the board's sensor pins in scan order, "
+                             "comma separated")
+    args = parser.parse_args()
+
+    table = read_config(args.config)
+    pins = fields(args.pins, ",")
+    if len(table) > len(pins):
+        sys.exit("%d ports are configured, but there are only %d pins"
+                 % (len(table), len(pins)))
+
+    if args.output == "-":
+        write_table(table, pins, args.config, sys.stdout)
+    else:
+        with open(args.output, "w") as out:
+            write_table(table, pins, args.config, out)
+
+
+if __name__ == "__main__":
+    main()
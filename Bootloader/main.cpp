@@ -0,0 +1,81 @@
+/// \file
+/// \brief The bootloader, which swaps a checked update into the running
+/// firmware's place and starts it.
+///
+/// It is a program of its own, built from this directory, which the app's
+/// build leaves out with .mbedignore:
+///
+///     mbed compile -m K64F -t GCC_ARM --source Bootloader --source mbed-os
+///         --build BUILD/bootloader
+///
+/// The app then has "target.bootloader_img" set to its .bin, which puts the
+/// app at SLOTAPPSTART. If the update slot has a SlotReady, the image in it
+/// is copied over the app a sector at a time and checked, and the trailer
+/// is erased. A reset in the middle only copies it again, the slot is not
+/// touched until the copy checked out.
+
+#include "../Storage/SlotLayout.h"
+
+#include "MbedCRC.h"
+#include "mbed.h"
+#include "mbed_application.h"
+
+#include <cstddef>
+#include <cstring>
+
+/// How many times a copy that does not check out is done again
+#define BOOTCOPIES (3)
+
+static FlashIAP Flash;
+
+/// the sector that is copied, the flash can not be read while it programs
+static uint8_t Sector[SLOTSECTOR];
+
+// the CRC-32 of the Size bytes at Address
+static uint32_t imageCrc(uint32_t Address, uint32_t Size) {
+    MbedCRC<POLY_32BIT_ANSI, 32> Crc;
+    uint32_t Sum = 0;
+    Crc.compute((const void *)Address, Size, &Sum);
+    return Sum;
+}
+
+// returns true if the slot has a whole image that was checked, and sets
+// Manifest to its manifest
+static bool slotReady(SlotManifest &Manifest) {
+    SlotReady Ready;
+    memcpy(&Manifest, (const void *)SLOTTRAILER, sizeof(Manifest));
+    memcpy(&Ready, (const void *)SLOTREADYADDRESS, sizeof(Ready));
+    return Manifest.Magic == SLOTMANIFESTMAGIC &&
+           Manifest.ManifestCrc ==
+               imageCrc(SLOTTRAILER, offsetof(SlotManifest, ManifestCrc)) &&
+           Manifest.Size <= SLOTIMAGEMAX && Ready.Magic == SLOTREADYMAGIC &&
+           Ready.ManifestCrc == Manifest.ManifestCrc &&
+           imageCrc(SLOTSTART, Manifest.Size) == Manifest.Crc;
+}
+
+// copies the image in the slot over the app
+static bool copySlot(const SlotManifest &Manifest) {
+    for (uint32_t At = 0; At < Manifest.Size; At += SLOTSECTOR) {
+        memcpy(Sector, (const void *)(SLOTSTART + At), SLOTSECTOR);
+        if (Flash.erase(SLOTAPPSTART + At, SLOTSECTOR) != 0 ||
+            Flash.program(Sector, SLOTAPPSTART + At, SLOTSECTOR) != 0) {
+            return false;
+        }
+    }
+    return imageCrc(SLOTAPPSTART, Manifest.Size) == Manifest.Crc;
+}
+
+int main() {
+    SlotManifest Manifest;
+    if (Flash.init() == 0 && slotReady(Manifest)) {
+        for (int i = 0; i < BOOTCOPIES; ++i) {
+            if (copySlot(Manifest)) {
+                // the next update starts on an empty trailer
+                Flash.erase(SLOTTRAILER, SLOTSECTOR);
+                break;
+            }
+        }
+    }
+    Flash.deinit();
+    mbed_start_application(SLOTAPPSTART);
+}
@@ -0,0 +1,51 @@
+/// \file
+/// \brief Implementation of the AT command timeouts
+#include "ATTimeouts.h"
+
+#include <cmath>
+#include <cstring>
+
+/// the shortest timeout of every class. An answer that is just slower than
+/// usual is not worth the command it would fail
+static const uint16_t MinimumMs[ATCLASSES] = {50, 1000, 50, 250, 100};
+
+ATTimeouts::ATTimeouts() { memset(Classes, 0, sizeof(Classes)); }
+
+// ============================================================================
+int ATTimeouts::timeout(ATCommandClass Class) const {
+    const Estimate &Rtt = Classes[Class];
+    if (Rtt.BackoffMs > 0) {
+        return Rtt.BackoffMs;
+    }
+    if (!Rtt.Measured) {
+        return ATRTTMAXMS;
+    }
+    float Ms = Rtt.SmoothedMs + ATRTTK * Rtt.DeviationMs;
+    if (Ms < MinimumMs[Class]) {
+        return MinimumMs[Class];
+    }
+    return Ms < ATRTTMAXMS ? (int)Ms : ATRTTMAXMS;
+}
+
+// ============================================================================
+void ATTimeouts::answered(ATCommandClass Class, uint32_t Ms) {
+    Estimate &Rtt = Classes[Class];
+    if (!Rtt.Measured) {
+        Rtt.SmoothedMs = Ms;
+        Rtt.DeviationMs = Ms / 2.0f;
+        Rtt.Measured = true;
+    } else {
+        // the gains of RFC 6298, 1/4 for the deviation and 1/8 for the mean
+        Rtt.DeviationMs += 0.25f * (fabsf(Ms - Rtt.SmoothedMs) -
+                                    Rtt.DeviationMs);
+        Rtt.SmoothedMs += 0.125f * (Ms - Rtt.SmoothedMs);
+    }
+    Rtt.BackoffMs = 0;
+}
+
+// ============================================================================
+void ATTimeouts::timedOut(ATCommandClass Class) {
+    Estimate &Rtt = Classes[Class];
+    uint32_t Doubled = 2 * timeout(Class);
+    Rtt.BackoffMs = Doubled < ATRTTMAXMS ? Doubled : ATRTTMAXMS;
+}
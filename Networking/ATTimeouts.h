@@ -0,0 +1,67 @@
+#ifndef ATTIMEOUTS_H
+#define ATTIMEOUTS_H
+/// \file
+/// \brief Timeouts for the ESP8266's AT commands from how long their answers
+/// take.
+///
+/// ATCmdParser waits up to its timeout for every byte of an answer, so an
+/// answer that is lost costs all of it. With SERIALTIMEOUT for every command
+/// a lost OK after an AT+CIFSR, which takes about 20 ms, held the uploader
+/// for 3 s. Every class of command keeps the smoothed time of its answers
+/// and their mean deviation, the way TCP works out its retransmission
+/// timeout (RFC 6298), and waits for the smoothed time and ATRTTK
+/// deviations. A command that timed out doubles the timeout of its class
+/// until one is answered again. Its time is not taken, the answer may have
+/// been the late one of an earlier command.
+
+#include "Networking.h"
+
+#include <cstdint>
+
+/// The kinds of AT commands, each has a timeout of its own
+enum ATCommandClass {
+    ATQUERY,   ///< AT+CIFSR and the other questions about the ESP8266
+    ATCONNECT, ///< AT+CIPSTART, with the DNS lookup and the TCP handshake
+    ATPROMPT,  ///< the '>' after an AT+CIPSEND
+    ATSENT,    ///< the SEND OK once the data went out
+    ATCLOSE,   ///< AT+CIPCLOSE
+    ATCLASSES
+};
+
+/// How many mean deviations the timeout is above the smoothed time
+#define ATRTTK (4)
+
+/// The longest timeout, also the one before a class was measured
+#define ATRTTMAXMS (SERIALTIMEOUT)
+
+class ATTimeouts {
+  public:
+    ATTimeouts();
+
+    /// Returns how long to wait for each byte of the answer to a command of
+    /// Class, in milliseconds
+    int timeout(ATCommandClass Class) const;
+
+    /// A command of Class was answered after Ms milliseconds
+    void answered(ATCommandClass Class, uint32_t Ms);
+
+    /// A command of Class got no answer within timeout()
+    void timedOut(ATCommandClass Class);
+
+  private:
+    struct Estimate {
+        /// the smoothed time of the answers and its mean deviation
+        float SmoothedMs;
+        float DeviationMs;
+
+        /// the timeout after a command timed out, 0 once one was answered
+        uint32_t BackoffMs;
+
+        /// false until the first answer
+        bool Measured;
+    };
+
+    Estimate Classes[ATCLASSES];
+};
+
+#endif // ATTIMEOUTS
@@ -0,0 +1,83 @@
+/// \file
+/// \brief Implementation of the backlog's token bucket
+#define TRACE_GROUP "net"
+#include "BacklogThrottle.h"
+
+#if BACKLOGTHROTTLE
+
+#include "DeferredLog.h"
+#include "platform/mbed_atomic.h"
+
+#include <cctype>
+
+/// What precedes the rate in a response
+#define BACKLOGRATESTART "backlograte=\""
+
+/// every byte that went out, the LoRaWAN stack counts from its own thread
+static volatile uint32_t Sent = 0;
+
+/// the bytes per second of the site, BACKLOGRATE until the server sends one
+static volatile uint32_t Rate = BACKLOGRATE;
+
+/// what the bucket holds, below 0 after a batch that took more, and when it
+/// was last filled up, from Kernel::get_ms_count()
+static int64_t Tokens = BACKLOGBURST;
+static uint64_t FilledMs = 0;
+
+/// true while the backlog waits for the bucket, so that it is only logged
+/// once
+static bool Waiting = false;
+
+// ============================================================================
+void uplinkSent(size_t Bytes) { core_util_atomic_incr_u32(&Sent, Bytes); }
+
+// ============================================================================
+uint32_t uplinkBytes() { return core_util_atomic_load_u32(&Sent); }
+
+// ============================================================================
+bool backlogMayGo() {
+    uint64_t Now = Kernel::get_ms_count();
+    uint32_t PerSecond = Rate;
+    if (FilledMs == 0) {
+        FilledMs = Now;
+    }
+    Tokens += (int64_t)((Now - FilledMs) * PerSecond / 1000);
+    if (Tokens > BACKLOGBURST) {
+        Tokens = BACKLOGBURST;
+    }
+    FilledMs = Now;
+
+    bool MayGo = PerSecond == 0 || Tokens > 0;
+    if (!MayGo && !Waiting) {
+        tr_debug("The backlog waits for its %lu B/s",
+                 (unsigned long)PerSecond);
+    }
+    Waiting = !MayGo;
+    return MayGo;
+}
+
+// ============================================================================
+void backlogUsed(uint32_t Bytes) {
+    if (Rate != 0) {
+        Tokens -= Bytes;
+    }
+}
+
+// ============================================================================
+void offerBacklogRate(const char *Response) {
+    const char *Offer = strstr(Response, BACKLOGRATESTART);
+    if (Offer == NULL) {
+        return;
+    }
+    Offer += strlen(BACKLOGRATESTART);
+    if (!isdigit((unsigned char)Offer[0])) {
+        return;
+    }
+    uint32_t PerSecond = strtoul(Offer, NULL, 10);
+    if (PerSecond != Rate) {
+        tr_info("The backlog may use %lu B/s now", (unsigned long)PerSecond);
+        Rate = PerSecond;
+    }
+}
+
+#endif // BACKLOGTHROTTLE
@@ -0,0 +1,78 @@
+#ifndef BACKLOGTHROTTLE_H
+#define BACKLOGTHROTTLE_H
+/// \file
+/// \brief A token bucket that holds the backlog to a share of the site's
+/// network, so a board that drains its backlog after an outage does not
+/// take all of the plant's Wi-Fi.
+///
+/// Every byte of a request counts, whichever backend sends it. The bucket
+/// fills at the rate of the site, up to BACKLOGBURST bytes, and the
+/// uploader only starts the next backlog batch while it is not empty. A
+/// batch takes what it sent out of the bucket when it is done, so the
+/// bucket can go below empty and then waits for the rate to make it up.
+/// The live readings do not go through the bucket, they are never held
+/// back. The rate is BACKLOGRATE until a response has a
+/// backlograte="BytesPerSecond", 0 lets the backlog go as fast as it can.
+/// Set with "backlog-throttle" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to hold the backlog to the rate of the site. Set with
+/// "backlog-throttle" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_THROTTLE
+#define BACKLOGTHROTTLE MBED_CONF_APP_BACKLOG_THROTTLE
+#else
+#define BACKLOGTHROTTLE 0
+#endif
+
+/// The bytes per second of the backlog until the server sends a rate, 0
+/// for no limit. Set with "backlog-rate" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_RATE
+#define BACKLOGRATE MBED_CONF_APP_BACKLOG_RATE
+#else
+#define BACKLOGRATE (2048)
+#endif
+
+/// The most bytes that the bucket holds, what the backlog can send at once
+/// after it waited. Set with "backlog-burst" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_BURST
+#define BACKLOGBURST MBED_CONF_APP_BACKLOG_BURST
+#else
+#define BACKLOGBURST (8192)
+#endif
+
+#if BACKLOGTHROTTLE
+
+/// Counts Bytes of a request that went out to the server
+void uplinkSent(size_t Bytes);
+
+/// Returns the bytes that went out to the server since the boot, wrapping
+/// at 2^32
+uint32_t uplinkBytes();
+
+/// Returns true if the bucket is not empty, so the next backlog batch may
+/// go out. Only the uploader thread calls this
+bool backlogMayGo();
+
+/// Takes the Bytes that a backlog batch sent out of the bucket
+void backlogUsed(uint32_t Bytes);
+
+/// Keeps the backlograte="BytesPerSecond" of a response, if there is one.
+/// Called from parseServerSettings()
+void offerBacklogRate(const char *Response);
+
+#else
+
+inline void uplinkSent(size_t Bytes) {}
+
+inline uint32_t uplinkBytes() { return 0; }
+
+inline bool backlogMayGo() { return true; }
+
+inline void backlogUsed(uint32_t Bytes) {}
+
+inline void offerBacklogRate(const char *Response) {}
+
+#endif // BACKLOGTHROTTLE
+
+#endif // BACKLOGTHROTTLE
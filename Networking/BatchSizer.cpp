@@ -0,0 +1,46 @@
+/// \file
+/// \brief Implementation of the batch sizes of the backlog links
+#include "BatchSizer.h"
+
+BatchSizer::BatchSizer() {
+    for (size_t i = 0; i < BACKLOGLINKS; ++i) {
+        Links[i].Limit = BACKUPBATCHMAX;
+        Links[i].Goodput = 0.0f;
+    }
+}
+
+// ============================================================================
+size_t BatchSizer::limit(int Link) const {
+    return Links[Link - BACKLOGLINK].Limit;
+}
+
+// ============================================================================
+void BatchSizer::sent(int Link, size_t Readings, size_t Bytes, uint32_t Ms) {
+    LinkBatch &Batch = Links[Link - BACKLOGLINK];
+    // a response within the same millisecond still counts as one
+    float Goodput = Bytes / (Ms > 0 ? (float)Ms : 1.0f);
+    bool Faster = Batch.Goodput == 0.0f ||
+                  Goodput >= BATCHGOODPUT * Batch.Goodput;
+    if (Batch.Goodput == 0.0f) {
+        Batch.Goodput = Goodput;
+    } else {
+        Batch.Goodput += BATCHWEIGHT * (Goodput - Batch.Goodput);
+    }
+
+    // only a full batch says anything about a larger one
+    if (Faster && Readings >= Batch.Limit) {
+        Batch.Limit += BATCHSTEP;
+        if (Batch.Limit > BACKUPBATCHMAX) {
+            Batch.Limit = BACKUPBATCHMAX;
+        }
+    }
+}
+
+// ============================================================================
+void BatchSizer::failed(int Link) {
+    LinkBatch &Batch = Links[Link - BACKLOGLINK];
+    Batch.Limit /= 2;
+    if (Batch.Limit < BATCHMIN) {
+        Batch.Limit = BATCHMIN;
+    }
+}
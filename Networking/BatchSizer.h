@@ -0,0 +1,63 @@
+#ifndef BATCHSIZER_H
+#define BATCHSIZER_H
+/// \file
+/// \brief How many backed up readings go into each request on a backlog
+/// link.
+///
+/// A small batch spends most of its time on the request line and the
+/// response, a large one has to be sent again in full when its SEND OK or
+/// its response is lost. Every backlog link keeps its own limit and grows
+/// it by BATCHSTEP after a request that got its response, as long as the
+/// bytes per millisecond of that request did not fall below BATCHGOODPUT of
+/// the link's average. A request that failed halves the limit. The limit is
+/// never more than BACKUPBATCHMAX, the frames of the batch are in a static
+/// buffer of that size.
+
+#include "NetworkBackend.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The smallest limit, a request of fewer readings is mostly overhead
+#define BATCHMIN (4)
+
+/// How many readings the limit grows by after a request that went well
+#define BATCHSTEP (4)
+
+/// A request that was slower than this much of the average goodput of its
+/// link does not grow the limit
+#define BATCHGOODPUT (0.9f)
+
+/// How much a new request counts in the average goodput
+#define BATCHWEIGHT (0.125f)
+
+class BatchSizer {
+  public:
+    /// Every link starts at BACKUPBATCHMAX
+    BatchSizer();
+
+    /// Returns the most readings for the next request on the backlog link
+    /// Link
+    size_t limit(int Link) const;
+
+    /// A request of Readings in Bytes on Link got its response after Ms
+    /// milliseconds, counted from its first byte
+    void sent(int Link, size_t Readings, size_t Bytes, uint32_t Ms);
+
+    /// A request on Link could not be sent, or got no response
+    void failed(int Link);
+
+  private:
+    struct LinkBatch {
+        /// the most readings in a request
+        size_t Limit;
+
+        /// the average bytes per millisecond of the requests, 0 before the
+        /// first one
+        float Goodput;
+    };
+
+    LinkBatch Links[BACKLOGLINKS];
+};
+
+#endif // BATCHSIZER
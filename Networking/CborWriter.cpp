@@ -0,0 +1,62 @@
+/// \file
+/// \brief Implementation of the CBOR encoder
+#include "CborWriter.h"
+
+#include <cstring>
+
+void CborWriter::head(uint8_t major, uint32_t value) {
+    // CBOR is big endian
+    char bytes[5];
+    size_t length;
+    major <<= 5;
+    if (value < 24) {
+        bytes[0] = major | value;
+        length = 1;
+    } else if (value <= 0xFF) {
+        bytes[0] = major | 24;
+        bytes[1] = value;
+        length = 2;
+    } else if (value <= 0xFFFF) {
+        bytes[0] = major | 25;
+        bytes[1] = value >> 8;
+        bytes[2] = value;
+        length = 3;
+    } else {
+        bytes[0] = major | 26;
+        bytes[1] = value >> 24;
+        bytes[2] = value >> 16;
+        bytes[3] = value >> 8;
+        bytes[4] = value;
+        length = 5;
+    }
+    Out.append(bytes, length);
+}
+
+void CborWriter::signedInt(int32_t value) {
+    if (value >= 0) {
+        head(0, value);
+    } else {
+        // -1 - n is stored as n
+        head(1, (uint32_t)(-1 - value));
+    }
+}
+
+void CborWriter::text(const char *value) { text(value, strlen(value)); }
+
+void CborWriter::text(const char *value, size_t length) {
+    head(3, length);
+    Out.append(value, length);
+}
+
+void CborWriter::bytes(const void *value, size_t length) {
+    head(2, length);
+    Out.append(static_cast<const char *>(value), length);
+}
+
+void CborWriter::float32(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    char bytes[5] = {(char)0xFA, (char)(bits >> 24), (char)(bits >> 16),
+                     (char)(bits >> 8), (char)bits};
+    Out.append(bytes, sizeof(bytes));
+}
@@ -0,0 +1,49 @@
+#ifndef CBORWRITER_H
+#define CBORWRITER_H
+/// \file
+/// \brief Encodes CBOR (RFC 7049) items into a RequestWriter.
+
+#include "RequestWriter.h"
+
+/// Writes the CBOR items that the request bodies use. Every item goes
+/// straight into the RequestWriter, so a body can be streamed or measured
+/// the same way as the text of a request.
+class CborWriter {
+  public:
+    explicit CborWriter(RequestWriter &out) : Out(out) {}
+
+    /// Starts a map of count key and value pairs
+    void map(uint32_t count) { head(5, count); }
+
+    /// Starts an array of count items
+    void array(uint32_t count) { head(4, count); }
+
+    void unsignedInt(uint32_t value) { head(0, value); }
+
+    /// A negative value is written as CBOR major type 1
+    void signedInt(int32_t value);
+
+    void text(const char *value);
+    void text(const char *value, size_t length);
+    void text(const string &value) { text(value.c_str(), value.size()); }
+
+    void bytes(const void *value, size_t length);
+
+    /// Starts a byte string of unknown length, which is made of the bytes()
+    /// items up to the next stop()
+    void startBytes() { Out.append("\x5F", 1); }
+
+    /// Ends the item that startBytes() started
+    void stop() { Out.append("\xFF", 1); }
+
+    /// A single precision float, 5 bytes
+    void float32(float value);
+
+  private:
+    /// writes the item head with the shortest encoding of value
+    void head(uint8_t major, uint32_t value);
+
+    RequestWriter &Out;
+};
+
+#endif // CBORWRITER
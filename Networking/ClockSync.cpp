@@ -0,0 +1,190 @@
+/// \file
+/// \brief Implementation of the network time
+#define TRACE_GROUP "sntp"
+#include "ClockSync.h"
+
+#include "DeferredLog.h"
+
+#if CLOCKSYNC
+
+#include "NetworkBackend.h"
+#include "TimeSync.h"
+#include "UDPSocket.h"
+#include "hal/lp_ticker_api.h"
+#include "hal/ticker_api.h"
+#include "platform/mbed_critical.h"
+
+#include <cstring>
+
+/// the UDP port of NTP
+#define NTPPORT (123)
+
+/// the bytes of an SNTP request and answer
+#define NTPPACKET (48)
+
+/// the seconds from 1900, where NTP counts from, to 1970
+#define NTPUNIXOFFSET (2208988800UL)
+
+/// a sync whose offset is further than this from where the drift put it
+/// starts the drift over, in microseconds
+#define CLOCKSYNCSTEPUS (100000)
+
+/// the drift is only taken from syncs that are at least this far apart, in
+/// microseconds
+#define CLOCKSYNCDRIFTAFTERUS (10000000ULL)
+
+/// the network time is Ref + Offset at the localMicros() Ref, and moves
+/// by Drift for every microsecond after it. Set by the uploader, read by
+/// the sampling loop in critical sections
+static bool Synced = false;
+static bool HaveDrift = false;
+static uint64_t Ref = 0;
+static int64_t Offset = 0;
+static double Drift = 0.0;
+
+/// when the last sync was tried, in Kernel::get_ms_count() milliseconds
+static uint64_t LastAttemptMs = 0;
+static bool Attempted = false;
+
+// writes Value into Out big endian, in 8 bytes
+static void putBig64(uint8_t *Out, uint64_t Value) {
+    for (size_t i = 0; i < 8; ++i) {
+        Out[i] = (Value >> (56 - 8 * i)) & 0xFF;
+    }
+}
+
+// the big endian 64-bit value at In
+static uint64_t getBig64(const uint8_t *In) {
+    uint64_t Value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        Value = (Value << 8) | In[i];
+    }
+    return Value;
+}
+
+// the NTP timestamp at In in microseconds since 1970
+static uint64_t ntpMicros(const uint8_t *In) {
+    uint64_t Stamp = getBig64(In);
+    uint32_t Seconds = (uint32_t)(Stamp >> 32) - NTPUNIXOFFSET;
+    uint64_t Fraction = (uint32_t)Stamp;
+    return Seconds * 1000000ULL + ((Fraction * 1000000ULL) >> 32);
+}
+
+// takes the offset of a sync at the localMicros() At
+static void keepOffset(uint64_t At, int64_t NewOffset) {
+    core_util_critical_section_enter();
+    if (Synced) {
+        uint64_t Span = At - Ref;
+        int64_t Error =
+            NewOffset - Offset - (int64_t)((double)Span * Drift);
+        if (Error <= -CLOCKSYNCSTEPUS || Error >= CLOCKSYNCSTEPUS) {
+            // the server or the path changed, the drift of before is no
+            // good
+            Drift = 0.0;
+            HaveDrift = false;
+        } else if (Span >= CLOCKSYNCDRIFTAFTERUS) {
+            // the drift is how fast the offset moved since the sync before
+            double Measured = (double)(NewOffset - Offset) / (double)Span;
+            Drift = HaveDrift
+                        ? Drift + CLOCKSYNCDRIFTWEIGHT * (Measured - Drift)
+                        : Measured;
+            HaveDrift = true;
+        }
+    }
+    Ref = At;
+    Offset = NewOffset;
+    Synced = true;
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+uint64_t localMicros() { return ticker_read_us(get_lp_ticker_data()); }
+
+// ============================================================================
+bool networkTime(uint64_t Local, uint64_t &Utc) {
+    core_util_critical_section_enter();
+    bool Valid = Synced;
+    uint64_t At = Ref;
+    int64_t Off = Offset;
+    double Rate = Drift;
+    core_util_critical_section_exit();
+    if (!Valid) {
+        return false;
+    }
+    int64_t Since = (int64_t)(Local - At);
+    Utc = Local + Off + (int64_t)((double)Since * Rate);
+    return true;
+}
+
+// ============================================================================
+int syncNetworkTime() {
+    uint64_t NowMs = Kernel::get_ms_count();
+    if (Attempted && NowMs - LastAttemptMs < CLOCKSYNCPERIODS * 1000ULL) {
+        return NETWORKSUCCESS;
+    }
+    Attempted = true;
+    LastAttemptMs = NowMs;
+
+    NetworkInterface *Net = socketInterface();
+    SocketAddress Server;
+    if (Net->gethostbyname(CLOCKSYNCSERVER, &Server) != NSAPI_ERROR_OK) {
+        tr_warn("Could not look up %s", CLOCKSYNCSERVER);
+        return -1;
+    }
+    Server.set_port(NTPPORT);
+    UDPSocket Link;
+    if (Link.open(Net) != NSAPI_ERROR_OK) {
+        return -1;
+    }
+    Link.set_timeout(CLOCKSYNCTIMEOUTMS);
+
+    // the answer with the shortest round trip has the offset with the
+    // smallest error
+    bool Found = false;
+    int64_t BestRtt = CLOCKSYNCMAXRTTUS;
+    int64_t BestOffset = 0;
+    uint64_t BestAt = 0;
+    for (int s = 0; s < CLOCKSYNCSAMPLES; ++s) {
+        uint8_t Packet[NTPPACKET];
+        memset(Packet, 0, sizeof(Packet));
+        // no leap warning, version 4, client
+        Packet[0] = 0x23;
+        uint64_t Sent = localMicros();
+        // the server sends it back as the originate time, so an answer
+        // to an earlier request is told apart
+        putBig64(Packet + 40, Sent);
+        if (Link.sendto(Server, Packet, sizeof(Packet)) != NTPPACKET) {
+            continue;
+        }
+        nsapi_size_or_error_t Got = Link.recvfrom(NULL, Packet, NTPPACKET);
+        uint64_t Back = localMicros();
+        if (Got < NTPPACKET || (Packet[0] & 0x07) != 4 || Packet[1] == 0 ||
+            getBig64(Packet + 24) != Sent) {
+            continue;
+        }
+        uint64_t Received = ntpMicros(Packet + 32);
+        uint64_t Answered = ntpMicros(Packet + 40);
+        int64_t Rtt = (int64_t)(Back - Sent) - (int64_t)(Answered - Received);
+        if (Rtt < 0 || Rtt >= BestRtt) {
+            continue;
+        }
+        BestRtt = Rtt;
+        BestOffset =
+            ((int64_t)(Received - Sent) + (int64_t)(Answered - Back)) / 2;
+        BestAt = Sent + (Back - Sent) / 2;
+        Found = true;
+    }
+    Link.close();
+    if (!Found) {
+        tr_warn("No good answer from %s", CLOCKSYNCSERVER);
+        return -5;
+    }
+
+    keepOffset(BestAt, BestOffset);
+    syncClock((uint32_t)((BestAt + BestOffset) / 1000000ULL));
+    tr_info("Network time from %s, round trip %ld us, drift %ld ppb",
+            CLOCKSYNCSERVER, (long)BestRtt, (long)(Drift * 1e9));
+    return NETWORKSUCCESS;
+}
+
+#endif // CLOCKSYNC
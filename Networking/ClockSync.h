@@ -0,0 +1,83 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+/// \file
+/// \brief The network time to the microsecond from SNTP, so the readings of
+/// every board are taken at the same instants.
+///
+/// For the power of a circuit whose voltage is on one board and whose
+/// current is on another, the readings have to be taken together. Every
+/// board used to time its readings from its own start. With CLOCKSYNC the
+/// uploader asks CLOCKSYNCSERVER for the time every CLOCKSYNCPERIODS, in a
+/// burst of CLOCKSYNCSAMPLES requests, and keeps the one with the shortest
+/// round trip, whose offset has the smallest error. The offset is half of
+/// the difference of the two one way times, so a symmetric path cancels
+/// out. From two syncs on, the drift of the crystal against the server is
+/// taken out as well, so the network time holds between them.
+///
+/// The sampling loop then puts every reading on the scan frame that is
+/// nearest to the next whole interval of the network time, see
+/// SampleClock::align(), and stamps it with that time. Boards with the
+/// same interval take them at the same instant, to the scan's frame and the
+/// error of the server's time. That is about 1 ms with an NTP server on the
+/// site's network, a pool server across the internet is further off.
+
+#include "Networking.h"
+
+#include <cstdint>
+
+/// Set to 1 to time the readings by the network time. Needs
+/// NETWORKSOCKETS. Set with "clock-sync" in mbed_app.json.
+#ifdef MBED_CONF_APP_CLOCK_SYNC
+#define CLOCKSYNC MBED_CONF_APP_CLOCK_SYNC
+#else
+#define CLOCKSYNC (0)
+#endif
+
+#if CLOCKSYNC && !NETWORKSOCKETS
+#error "clock-sync needs network-sockets set to 1"
+#endif
+
+/// The NTP server, best one on the site's network.
+/// Set with "ntp-server" in mbed_app.json.
+#ifdef MBED_CONF_APP_NTP_SERVER
+#define CLOCKSYNCSERVER MBED_CONF_APP_NTP_SERVER
+#else
+#define CLOCKSYNCSERVER "pool.ntp.org"
+#endif
+
+/// How often the time is asked for, in seconds.
+/// Set with "clock-sync-s" in mbed_app.json.
+#ifdef MBED_CONF_APP_CLOCK_SYNC_S
+#define CLOCKSYNCPERIODS MBED_CONF_APP_CLOCK_SYNC_S
+#else
+#define CLOCKSYNCPERIODS (64)
+#endif
+
+/// The requests of one sync
+#define CLOCKSYNCSAMPLES (4)
+
+/// How long one request waits for its answer, in milliseconds
+#define CLOCKSYNCTIMEOUTMS (1000)
+
+/// A round trip longer than this is not taken, in microseconds
+#define CLOCKSYNCMAXRTTUS (200000)
+
+/// The weight of a new drift against the ones before
+#define CLOCKSYNCDRIFTWEIGHT (0.25)
+
+/// Asks the NTP server for the time if CLOCKSYNCPERIODS went by since the
+/// last time. Called from the uploader's housekeeping
+/// \returns NETWORKSUCCESS, or -1 if it could not reach the server, -5 if
+/// no good answer came
+int syncNetworkTime();
+
+/// Returns the microseconds of the low power ticker, which the network
+/// time is worked out from. It keeps counting in deep sleep
+uint64_t localMicros();
+
+/// Sets Utc to the network time at Local, a localMicros(), in microseconds
+/// since 1970. Safe to call from any thread
+/// \returns false before the first sync
+bool networkTime(uint64_t Local, uint64_t &Utc);
+
+#endif // CLOCKSYNC
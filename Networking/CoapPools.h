@@ -0,0 +1,71 @@
+#ifndef COAPPOOLS_H
+#define COAPPOOLS_H
+/// \file
+/// \brief The block pools that mbed-coap allocates from instead of the heap.
+///
+/// Kept out of CoapUplink.cpp, which needs the board's Networking.h, so the
+/// host tests can run mbed-coap on the same pools.
+
+#include "BlockPool.h"
+
+/// The number of block pools behind mbed-coap's allocations
+#define COAPPOOLS (4)
+
+/// Tokens and addresses, mbed-coap's structs, the packets it keeps for
+/// resending, and the copy of a payload that goes out in blocks. PacketSize
+/// is the largest datagram and PayloadSize the largest payload with its
+/// options
+template <size_t PacketSize, size_t PayloadSize> class CoapPools {
+  public:
+    /// Takes a block of the smallest pool that has a free one big enough
+    /// \returns NULL if there is none, mbed-coap then drops the message it
+    /// was building
+    void *alloc(uint16_t Size) {
+        void *Block = NULL;
+        if (Size <= Tiny.blockSize()) {
+            Block = Tiny.alloc();
+        }
+        if (Block == NULL && Size <= Small.blockSize()) {
+            Block = Small.alloc();
+        }
+        if (Block == NULL && Size <= Packets.blockSize()) {
+            Block = Packets.alloc();
+        }
+        if (Block == NULL && Size <= Payloads.blockSize()) {
+            Block = Payloads.alloc();
+        }
+        if (Block == NULL) {
+            printf("No CoAP block of %u bytes is free\r\n", Size);
+        }
+        return Block;
+    }
+
+    /// Puts a block from alloc() back into its pool
+    void free(void *Pointer) {
+        if (Pointer != NULL && !Tiny.free(Pointer) && !Small.free(Pointer) &&
+            !Packets.free(Pointer)) {
+            Payloads.free(Pointer);
+        }
+    }
+
+    /// Copies how full each pool is into Stats, up to Count of them,
+    /// smallest blocks first
+    /// \returns the number of pools copied
+    size_t stats(BlockPoolStats *Stats, size_t Count) const {
+        const BlockPoolStats Pools[COAPPOOLS] = {
+            Tiny.stats(), Small.stats(), Packets.stats(), Payloads.stats()};
+        size_t Copied = Count < COAPPOOLS ? Count : COAPPOOLS;
+        for (size_t i = 0; i < Copied; ++i) {
+            Stats[i] = Pools[i];
+        }
+        return Copied;
+    }
+
+  private:
+    BlockPool<32, 16> Tiny;
+    BlockPool<128, 16> Small;
+    BlockPool<PacketSize, 4> Packets;
+    BlockPool<PayloadSize, 2> Payloads;
+};
+
+#endif // COAPPOOLS_H
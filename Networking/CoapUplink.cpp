@@ -0,0 +1,364 @@
+/// \file
+/// \brief Implementation of the CoAP uplink
+#define TRACE_GROUP "coap"
+#include "CoapUplink.h"
+
+#if NETWORKSOCKETS
+
+#include "BacklogThrottle.h"
+#include "DeferredLog.h"
+#include "FlashQueue.h"
+#include "LinkStats.h"
+#include "mbed-coap/sn_config.h"
+
+#if COAPDTLS
+#include "mbedtls/platform_util.h"
+
+#include <cstdio>
+#include <new>
+#endif
+
+#if COAPUPLINK && SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE == 0
+#error "coap needs SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE in the macros"
+#endif
+
+#if SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE + 64 > COAPPACKETMAX
+#error "a CoAP block does not fit into COAPPACKETMAX"
+#endif
+
+#if COAPDTLS && !FLASHQUEUE
+#error "coap-dtls keeps its key in the flash queue, set flash-queue to 1"
+#endif
+
+/// mbed-coap's allocations come out of these instead of the heap
+static CoapPools<COAPPACKETMAX, COAPPAYLOADMAX + 16> Pools;
+
+static void *coapMalloc(uint16_t Size) { return Pools.alloc(Size); }
+
+static void coapFree(void *Pointer) { Pools.free(Pointer); }
+
+// ============================================================================
+size_t CoapUplink::poolStats(BlockPoolStats *Stats, size_t Count) {
+    return Pools.stats(Stats, Count);
+}
+
+// the address of Server the way mbed-coap keeps it
+static sn_nsdl_addr_s coapAddress(const SocketAddress &Server) {
+    sn_nsdl_addr_s Address;
+    Address.addr_len = 4;
+    Address.type = SN_NSDL_ADDRESS_TYPE_IPV4;
+    Address.port = Server.get_port();
+    Address.addr_ptr = (uint8_t *)Server.get_ip_bytes();
+    return Address;
+}
+
+#if COAPDTLS
+/// the only suite that is offered
+static const int PskSuites[] = {MBEDTLS_TLS_PSK_WITH_AES_128_CCM_8, 0};
+
+/// the identity and key the way they are kept in the flash
+struct PskRecord {
+    uint8_t IdentityLength;
+    uint8_t KeyLength;
+    char Identity[COAPPSKIDMAX];
+    uint8_t Key[COAPPSKMAX];
+};
+
+static_assert(sizeof(PskRecord) <= FLASHPSKMAX,
+              "the pre-shared key does not fit into FLASHPSKMAX");
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// reads "identity,hex key" from Line into Psk
+static bool parsePsk(const char *Line, PskRecord &Psk) {
+    const char *Comma = strchr(Line, ',');
+    if (Comma == NULL || Comma == Line || Comma - Line > COAPPSKIDMAX) {
+        return false;
+    }
+    Psk.IdentityLength = Comma - Line;
+    memcpy(Psk.Identity, Line, Psk.IdentityLength);
+
+    const char *Hex = Comma + 1;
+    Psk.KeyLength = 0;
+    while (hexDigit(Hex[0]) >= 0 && hexDigit(Hex[1]) >= 0) {
+        if (Psk.KeyLength == COAPPSKMAX) {
+            return false;
+        }
+        Psk.Key[Psk.KeyLength++] = hexDigit(Hex[0]) << 4 | hexDigit(Hex[1]);
+        Hex += 2;
+    }
+    return Psk.KeyLength > 0 && hexDigit(*Hex) < 0;
+}
+
+// the key from COAPPSKFILE, which is then moved into the flash, or the one
+// that is in the flash already
+static bool loadPsk(PskRecord &Psk) {
+    FILE *fp = fopen(COAPPSKFILE, "r");
+    if (fp != NULL) {
+        char Line[COAPPSKIDMAX + 2 * COAPPSKMAX + 4];
+        bool Parsed = fgets(Line, sizeof(Line), fp) != NULL &&
+                      parsePsk(Line, Psk);
+        fclose(fp);
+        mbedtls_platform_zeroize(Line, sizeof(Line));
+        if (!Parsed) {
+            tr_warn("%s is not 'identity,hex key'", COAPPSKFILE);
+        } else {
+            // the file stays until the key is safe in the flash
+            if (savePskCache(&Psk, sizeof(Psk)) == 0) {
+                remove(COAPPSKFILE);
+                tr_info("Moved the DTLS key into the flash");
+            }
+            return true;
+        }
+    }
+    return readPskCache(&Psk, sizeof(Psk)) == sizeof(Psk) &&
+           Psk.KeyLength > 0 && Psk.KeyLength <= COAPPSKMAX &&
+           Psk.IdentityLength <= COAPPSKIDMAX;
+}
+
+bool CoapUplink::secure(const SocketAddress &Address) {
+    if (Secure != NULL && SecureServer == Address) {
+        return true;
+    }
+    dropSession();
+
+    PskRecord Psk;
+    if (!loadPsk(Psk)) {
+        tr_warn("There is no DTLS key");
+        return false;
+    }
+    DTLSSocketWrapper *Tls = new (std::nothrow) DTLSSocketWrapper(
+        &Link, NULL, DTLSSocketWrapper::TRANSPORT_CONNECT);
+    if (Tls == NULL) {
+        return false;
+    }
+
+    // mbed TLS keeps its own copy of the key
+    mbedtls_ssl_config *Config = Tls->get_ssl_config();
+    mbedtls_ssl_conf_ciphersuites(Config, PskSuites);
+    int Error = mbedtls_ssl_conf_psk(
+        Config, Psk.Key, Psk.KeyLength, (const unsigned char *)Psk.Identity,
+        Psk.IdentityLength);
+    mbedtls_platform_zeroize(&Psk, sizeof(Psk));
+    mbedtls_ssl_conf_handshake_timeout(Config, COAPRESENDSECONDS * 1000,
+                                       COAPTIMEOUT);
+
+    // this connects Link to the server, and does the handshake
+    Tls->set_timeout(COAPTIMEOUT);
+    nsapi_error_t Connected = Error == 0 ? Tls->connect(Address) : Error;
+    if (Connected != NSAPI_ERROR_OK && Connected != NSAPI_ERROR_IS_CONNECTED) {
+        tr_warn("DTLS handshake failed: %d", Connected);
+        delete Tls;
+        return false;
+    }
+    Secure = Tls;
+    SecureServer = Address;
+    Stream = Tls;
+    return true;
+}
+
+void CoapUplink::dropSession() {
+    // this sends the close_notify, Link stays open
+    delete Secure;
+    Secure = NULL;
+    Stream = &Link;
+}
+#endif // COAPDTLS
+
+CoapUplink::CoapUplink()
+    : Stream(&Link), Coap(NULL), Tokens(0), Failed(false) {
+#if COAPDTLS
+    Secure = NULL;
+#endif
+}
+
+uint8_t CoapUplink::transmit(uint8_t *Packet, uint16_t Length,
+                             sn_nsdl_addr_s *Address, void *Param) {
+    CoapUplink *Uplink = static_cast<CoapUplink *>(Param);
+    nsapi_size_or_error_t sent =
+        Uplink->Stream->sendto(Uplink->Server, Packet, Length);
+    if (sent > 0) {
+        linkSent(sent);
+        uplinkSent(sent);
+    }
+    return sent == Length ? 1 : 0;
+}
+
+int8_t CoapUplink::received(sn_coap_hdr_s *Header, sn_nsdl_addr_s *Address,
+                            void *Param) {
+    if (Header != NULL &&
+        (Header->coap_status == COAP_STATUS_BUILDER_MESSAGE_SENDING_FAILED ||
+         Header->coap_status == COAP_STATUS_BUILDER_BLOCK_SENDING_FAILED)) {
+        static_cast<CoapUplink *>(Param)->Failed = true;
+    }
+    return 0;
+}
+
+bool CoapUplink::start(NetworkInterface *Net) {
+    if (Coap != NULL) {
+        return true;
+    }
+    if (Link.open(Net) != NSAPI_ERROR_OK) {
+        return false;
+    }
+    Coap = sn_coap_protocol_init(coapMalloc, coapFree, transmit, received);
+    if (Coap == NULL) {
+        Link.close();
+        return false;
+    }
+    sn_coap_protocol_set_retransmission_parameters(Coap, COAPRESENDS,
+                                                   COAPRESENDSECONDS);
+    return true;
+}
+
+void CoapUplink::forget() {
+    sn_coap_protocol_clear_retransmission_buffer(Coap);
+    sn_coap_protocol_clear_sent_blockwise_messages(Coap);
+#if COAPDTLS
+    // the server may have lost the session, a new one is cheap
+    dropSession();
+#endif
+}
+
+// ============================================================================
+int CoapUplink::post(NetworkInterface *Net, const SocketAddress &Address,
+                     const char *Path, uint16_t ContentFormat,
+                     uint8_t *Payload, size_t Length, char *Response,
+                     size_t Size) {
+    if (!start(Net) || Length > UINT16_MAX) {
+        return -1;
+    }
+#if COAPDTLS
+    if (!secure(Address)) {
+        return -1;
+    }
+#endif
+    Server = Address;
+    sn_nsdl_addr_s From = coapAddress(Server);
+
+    // a new token for every POST, so a late response to an earlier one is
+    // never taken for this one
+    ++Tokens;
+    for (size_t i = 0; i < sizeof(Token); ++i) {
+        Token[i] = (uint8_t)(Tokens >> (8 * i));
+    }
+
+    // the Uri-Path options are split at the '/'s by mbed-coap
+    while (*Path == '/') {
+        ++Path;
+    }
+    sn_coap_hdr_s Request;
+    sn_coap_parser_init_message(&Request);
+    Request.msg_type = COAP_MSG_TYPE_CONFIRMABLE;
+    Request.msg_code = COAP_MSG_CODE_REQUEST_POST;
+    Request.token_ptr = Token;
+    Request.token_len = sizeof(Token);
+    Request.uri_path_ptr = (uint8_t *)Path;
+    Request.uri_path_len = strlen(Path);
+    Request.content_format = (sn_coap_content_format_e)ContentFormat;
+    Request.payload_ptr = Payload;
+    Request.payload_len = Length;
+
+    // a longer payload starts a Block1 transfer. Only the first block is
+    // built here, mbed-coap sends the next one when the server acknowledges
+    // it
+    if (Length > SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) {
+        if (sn_coap_parser_alloc_options(Coap, &Request) == NULL) {
+            return -1;
+        }
+        // block 0, more blocks follow, and the block size as 2^(4 + SZX)
+        uint8_t SizeExponent = 0;
+        while ((16U << SizeExponent) < SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) {
+            ++SizeExponent;
+        }
+        Request.options_list_ptr->block1 = 0x08 | SizeExponent;
+        Request.options_list_ptr->use_size1 = true;
+        Request.options_list_ptr->size1 = Length;
+    }
+
+    Failed = false;
+    sn_coap_protocol_exec(Coap, Kernel::get_ms_count() / 1000);
+    int16_t Built = -1;
+    if (sn_coap_builder_calc_needed_packet_data_size_2(
+            &Request, SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) <= sizeof(Packet)) {
+        Built = sn_coap_protocol_build(Coap, &From, Packet, &Request, this);
+    }
+    // mbed-coap has its own copy of the options now
+    coapFree(Request.options_list_ptr);
+    if (Built < 0 || !transmit(Packet, Built, &From, this)) {
+        forget();
+        return -4;
+    }
+
+    uint64_t Start = Kernel::get_ms_count();
+    Stream->set_timeout(COAPPOLLMS);
+    while (!Failed && Kernel::get_ms_count() - Start < COAPTIMEOUT) {
+        nsapi_size_or_error_t got =
+            Stream->recvfrom(NULL, Packet, sizeof(Packet));
+        sn_coap_protocol_exec(Coap, Kernel::get_ms_count() / 1000);
+        if (got == NSAPI_ERROR_WOULD_BLOCK) {
+            continue;
+        }
+        if (got < 0) {
+            break;
+        }
+        linkReceived(got);
+
+        sn_coap_hdr_s *Reply =
+            sn_coap_protocol_parse(Coap, &From, got, Packet, this);
+        if (Reply == NULL) {
+            continue;
+        }
+
+        // the ACKs of the blocks before the last one, and an empty ACK
+        // before a separate response, are handled by mbed-coap
+        bool Ours = Reply->coap_status == COAP_STATUS_OK &&
+                    Reply->msg_code >= COAP_MSG_CODE_RESPONSE_CREATED &&
+                    Reply->token_len == sizeof(Token) &&
+                    memcmp(Reply->token_ptr, Token, sizeof(Token)) == 0;
+        int Code = 0;
+        if (Ours) {
+            Code = (Reply->msg_code >> 5) * 100 + (Reply->msg_code & 0x1F);
+            size_t Kept = Reply->payload_len < Size ? Reply->payload_len
+                                                    : Size - 1;
+            if (Kept > 0) {
+                memcpy(Response, Reply->payload_ptr, Kept);
+            }
+            Response[Kept] = '\0';
+
+            // a separate response is confirmable, and needs its own ACK
+            if (Reply->msg_type == COAP_MSG_TYPE_CONFIRMABLE) {
+                sn_coap_hdr_s *Ack =
+                    sn_coap_build_response(Coap, Reply, COAP_MSG_CODE_EMPTY);
+                if (Ack != NULL) {
+                    Built = sn_coap_protocol_build(Coap, &From, Packet, Ack,
+                                                   this);
+                    if (Built > 0) {
+                        transmit(Packet, Built, &From, this);
+                    }
+                    sn_coap_parser_release_allocated_coap_msg_mem(Coap, Ack);
+                }
+            }
+        }
+        sn_coap_parser_release_allocated_coap_msg_mem(Coap, Reply);
+        if (Ours) {
+            return Code;
+        }
+    }
+
+    forget();
+    return -5;
+}
+
+#endif // NETWORKSOCKETS
@@ -0,0 +1,132 @@
+#ifndef COAPUPLINK_H
+#define COAPUPLINK_H
+/// \file
+/// \brief Confirmable CoAP POSTs over a UDPSocket, with mbed-coap.
+///
+/// mbed-coap does the retransmissions and splits payloads that are longer
+/// than SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE into Block1 transfers, which is
+/// set in the macros of mbed_app.json. Everything mbed-coap allocates comes
+/// out of fixed block pools, see poolStats(). Only built when
+/// NETWORKSOCKETS is set, see COAPUPLINK in Networking.h.
+///
+/// With COAPDTLS the datagrams go through a DTLSSocketWrapper on top of the
+/// UDPSocket, with TLS-PSK-WITH-AES-128-CCM-8. There are no certificates
+/// and no key exchange, so the handshake is two round trips of small
+/// datagrams, and every record only adds 29 bytes. The session is kept
+/// between POSTs, and is only started again after a POST failed. The
+/// identity and the key are read from COAPPSKFILE once, kept in the flash
+/// queue's store, and the file is deleted. mbed TLS allocates its record
+/// buffers of MBEDTLS_SSL_IN_CONTENT_LEN and MBEDTLS_SSL_OUT_CONTENT_LEN
+/// when the session starts, which the macros can bring down to about
+/// COAPPACKETMAX.
+
+#include "CoapPools.h"
+#include "Networking.h"
+
+#if NETWORKSOCKETS
+
+#include "UDPSocket.h"
+#include "mbed-coap/sn_coap_protocol.h"
+
+#if COAPDTLS
+#include "DTLSSocketWrapper.h"
+#endif
+
+/// The largest datagram that is sent or received. It has to hold a block
+/// and the CoAP header, or the response the server sends back
+#define COAPPACKETMAX (RESPONSESIZE + 64)
+
+/// How long to wait for the server's response, with the retransmissions
+/// and every block, in milliseconds
+#define COAPTIMEOUT (15000)
+
+/// How long each wait for a datagram is, mbed-coap gets the time between
+/// them to resend, in milliseconds
+#define COAPPOLLMS (250)
+
+/// Seconds before the first retransmission, it doubles after each one
+#define COAPRESENDSECONDS (2)
+
+/// How many times a message is resent before the POST fails
+#define COAPRESENDS (3)
+
+/// The file the DTLS identity and pre-shared key are provisioned with.
+/// Set with "coap-psk-file" in mbed_app.json.
+#ifdef MBED_CONF_APP_COAP_PSK_FILE
+#define COAPPSKFILE MBED_CONF_APP_COAP_PSK_FILE
+#else
+#define COAPPSKFILE "/sd/IAC_PSK.txt"
+#endif
+
+/// The longest DTLS identity, and the longest pre-shared key in bytes
+#define COAPPSKIDMAX (48)
+#define COAPPSKMAX (32)
+
+class CoapUplink {
+  public:
+    CoapUplink();
+
+    /// Sends a confirmable POST with Length bytes of Payload to Path on the
+    /// server at Address, and waits for its response. At most Size - 1
+    /// bytes of the response's payload are kept in Response, '\0'
+    /// terminated.
+    /// \returns the response code, 2.04 as 204, or a negative number if
+    /// there was no response
+    int post(NetworkInterface *Net, const SocketAddress &Address,
+             const char *Path, uint16_t ContentFormat, uint8_t *Payload,
+             size_t Length, char *Response, size_t Size);
+
+    /// Copies how full each of mbed-coap's block pools is into Stats, up to
+    /// Count of them, smallest blocks first
+    /// \returns the number of pools copied
+    static size_t poolStats(BlockPoolStats *Stats, size_t Count);
+
+  private:
+    /// mbed-coap's way to send a datagram, Param is the CoapUplink
+    static uint8_t transmit(uint8_t *Packet, uint16_t Length,
+                            sn_nsdl_addr_s *Address, void *Param);
+
+    /// mbed-coap's way to report a message that was resent too often
+    static int8_t received(sn_coap_hdr_s *Header, sn_nsdl_addr_s *Address,
+                           void *Param);
+
+    /// opens Link and starts mbed-coap the first time it is needed
+    bool start(NetworkInterface *Net);
+
+    /// drops what mbed-coap still has of an earlier POST
+    void forget();
+
+#if COAPDTLS
+    /// starts the DTLS session with Address, unless there is one already
+    bool secure(const SocketAddress &Address);
+
+    /// ends the session, the next POST starts a new one
+    void dropSession();
+
+    /// the session on top of Link, and the server it is with
+    DTLSSocketWrapper *Secure;
+    SocketAddress SecureServer;
+#endif
+
+    UDPSocket Link;
+
+    /// what the datagrams are sent on, Link or the DTLS on top of it
+    Socket *Stream;
+    struct coap_s *Coap;
+
+    /// where the datagrams go
+    SocketAddress Server;
+
+    /// the token of the POST that is waiting for its response
+    uint8_t Token[4];
+    uint32_t Tokens;
+
+    /// set by received() when mbed-coap gives up on the POST
+    bool Failed;
+
+    uint8_t Packet[COAPPACKETMAX];
+};
+
+#endif // NETWORKSOCKETS
+
+#endif // COAPUPLINK
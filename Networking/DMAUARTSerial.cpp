@@ -0,0 +1,225 @@
+/// \file
+/// \brief Implementation of the eDMA receive serial port
+#include "DMAUARTSerial.h"
+
+#include "DMAPool.h"
+#include "PeripheralPins.h"
+#include "dma_api.h"
+#include "pinmap.h"
+
+/// Array of UART peripheral base addresses.
+static UART_Type *const uart_addrs[] = UART_BASE_PTRS;
+
+/// DMA request sources for the receive flag of each UART. UART4 and UART5
+/// share one request for receive and transmit, which still works since
+/// transmit DMA is never enabled.
+static const uint32_t uart_rx_requests[] = {
+    kDmaRequestMux0UART0Rx, kDmaRequestMux0UART1Rx, kDmaRequestMux0UART2Rx,
+    kDmaRequestMux0UART3Rx, kDmaRequestMux0UART4,   kDmaRequestMux0UART5};
+
+DMAUARTSerial::DMAUARTSerial(PinName tx, PinName rx, int baud,
+                             size_t rxSize)
+    : Baud(baud), Size(rxSize), Channel(DMA_ERROR_OUT_OF_CHANNELS), Wraps(0),
+      Taken(0), Overruns(0), Blocking(true) {
+    // received() counts up to 2^32, which only a power of two divides
+    if (Size == 0 || Size > DMAUARTRXMAX || (Size & (Size - 1)) != 0) {
+        error("DMAUARTSerial: the ring has to be a power of two\r\n");
+    }
+
+    // the HAL sets up the pins, the clock and the frame format
+    serial_init(&Serial, tx, rx);
+    serial_baud(&Serial, baud);
+
+    uint32_t instance = pinmap_merge(pinmap_peripheral(tx, PinMap_UART_TX),
+                                     pinmap_peripheral(rx, PinMap_UART_RX));
+    Base = uart_addrs[instance];
+
+    dma_init();
+
+    edma_config_t dma_config;
+    EDMA_GetDefaultConfig(&dma_config);
+    EDMA_Init(DMA0, &dma_config);
+
+    Ring = (uint8_t *)dmaAlloc(Size, sizeof(uint32_t));
+    if (Ring == NULL) {
+        error("DMAUARTSerial: no room for the ring in the DMA pool\r\n");
+    }
+
+    Channel = dma_channel_allocate(uart_rx_requests[instance]);
+    if (Channel == DMA_ERROR_OUT_OF_CHANNELS) {
+        error("DMAUARTSerial: no DMA channel left\r\n");
+    }
+
+    memset(&Handle, 0, sizeof(Handle));
+    EDMA_CreateHandle(&Handle, DMA0, Channel);
+
+    // UARTn_D -> Ring, one byte per request, wrapping back to the start
+    edma_transfer_config_t transfer;
+    EDMA_PrepareTransfer(&transfer, (void *)&Base->D, sizeof(uint8_t), Ring,
+                         sizeof(uint8_t), sizeof(uint8_t), Size,
+                         kEDMA_PeripheralToMemory);
+    EDMA_SetTransferConfig(DMA0, Channel, &transfer, NULL);
+    DMA0->TCD[Channel].DLAST_SGA = -(int32_t)Size;
+
+    // the major interrupt only counts wraps, the data never needs the CPU
+    EDMA_SetCallback(&Handle, &DMAUARTSerial::onRingDone, this);
+    EDMA_EnableChannelInterrupts(DMA0, Channel, kEDMA_MajorInterruptEnable);
+
+    UART_EnableRxDMA(Base, true);
+    EDMA_StartTransfer(&Handle);
+}
+
+DMAUARTSerial::~DMAUARTSerial() {
+    UART_EnableRxDMA(Base, false);
+    if (Channel != DMA_ERROR_OUT_OF_CHANNELS) {
+        EDMA_AbortTransfer(&Handle);
+        dma_channel_free(Channel);
+    }
+    serial_free(&Serial);
+}
+
+// ============================================================================
+void DMAUARTSerial::onRingDone(edma_handle_t *handle, void *data, bool done,
+                               uint32_t tcds) {
+    DMAUARTSerial *port = static_cast<DMAUARTSerial *>(data);
+    ++port->Wraps;
+    if (port->SigIO) {
+        port->SigIO();
+    }
+}
+
+uint32_t DMAUARTSerial::received() const {
+    uint32_t wraps;
+    uint32_t address;
+    uint32_t pending;
+
+    // DADDR wraps back as soon as the last byte of a pass is written, but
+    // Wraps only counts it once the interrupt runs. A pending interrupt
+    // flag means the wrap already happened.
+    core_util_critical_section_enter();
+    do {
+        pending = DMA0->INT & (1U << Channel);
+        address = DMA0->TCD[Channel].DADDR;
+    } while (pending != (DMA0->INT & (1U << Channel)));
+    wraps = Wraps + (pending ? 1 : 0);
+    core_util_critical_section_exit();
+
+    return wraps * Size + (address - (uint32_t)Ring);
+}
+
+void DMAUARTSerial::checkOverrun() {
+    uint32_t end = received();
+    uint32_t waiting = end - Taken;
+
+    // the DMA went all the way around and wrote over unread data
+    if (waiting > Size) {
+        Overruns += waiting - Size;
+        Taken = end - Size;
+    }
+
+    // the DMA did not get to a byte in time
+    if (UART_GetStatusFlags(Base) & kUART_RxOverrunFlag) {
+        UART_ClearStatusFlags(Base, kUART_RxOverrunFlag);
+        ++Overruns;
+    }
+}
+
+// ============================================================================
+ssize_t DMAUARTSerial::read(void *buffer, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+
+    checkOverrun();
+    while (received() == Taken) {
+        if (!Blocking) {
+            return -EAGAIN;
+        }
+        thread_sleep_for(1);
+    }
+
+    uint8_t *out = static_cast<uint8_t *>(buffer);
+    size_t count = 0;
+    uint32_t end = received();
+    while (count < length && Taken != end) {
+        out[count++] = Ring[Taken & (Size - 1)];
+        ++Taken;
+    }
+    return count;
+}
+
+// ============================================================================
+mbed::Span<const uint8_t> DMAUARTSerial::peek_span() {
+    checkOverrun();
+    uint32_t waiting = received() - Taken;
+    uint32_t start = Taken & (Size - 1);
+
+    // the bytes at the start of the ring come after the ones at its end
+    if (waiting > Size - start) {
+        waiting = Size - start;
+    }
+    return mbed::Span<const uint8_t>(Ring + start, waiting);
+}
+
+// ============================================================================
+void DMAUARTSerial::consume(size_t length) {
+    uint32_t waiting = received() - Taken;
+    Taken += length < waiting ? length : waiting;
+}
+
+ssize_t DMAUARTSerial::write(const void *buffer, size_t length) {
+    const uint8_t *data = static_cast<const uint8_t *>(buffer);
+    for (size_t i = 0; i < length; ++i) {
+        serial_putc(&Serial, data[i]);
+    }
+    return length;
+}
+
+short DMAUARTSerial::poll(short events) const {
+    short revents = 0;
+    if (received() != Taken) {
+        revents |= POLLIN;
+    }
+    if (serial_writable(const_cast<serial_t *>(&Serial))) {
+        revents |= POLLOUT;
+    }
+    return revents;
+}
+
+void DMAUARTSerial::sigio(Callback<void()> func) {
+    core_util_critical_section_enter();
+    SigIO = func;
+    core_util_critical_section_exit();
+}
+
+void DMAUARTSerial::set_baud(int baud) {
+    Baud = baud;
+    serial_baud(&Serial, baud);
+}
+
+void DMAUARTSerial::retime() { serial_baud(&Serial, Baud); }
+
+void DMAUARTSerial::set_flow_control(FlowControl type, PinName flow1,
+                                     PinName flow2) {
+    serial_set_flow_control(&Serial, type, flow1, flow2);
+}
+
+void DMAUARTSerial::set_format(int bits, SerialParity parity, int stop_bits) {
+    serial_format(&Serial, bits, parity, stop_bits);
+}
+
+void DMAUARTSerial::set_rs485(PinName de) {
+    pinmap_pinout(de, PinMap_UART_RTS);
+    Base->MODEM &= ~(UART_MODEM_TXCTSE_MASK | UART_MODEM_RXRTSE_MASK);
+    Base->MODEM |= UART_MODEM_TXRTSE_MASK | UART_MODEM_TXRTSPOL_MASK;
+}
+
+void DMAUARTSerial::drain() {
+    while (!(UART_GetStatusFlags(Base) & kUART_TransmissionCompleteFlag)) {
+    }
+}
+
+void DMAUARTSerial::discard() {
+    checkOverrun();
+    Taken = received();
+}
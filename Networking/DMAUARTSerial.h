@@ -0,0 +1,144 @@
+#ifndef DMAUARTSERIAL_H
+#define DMAUARTSERIAL_H
+/// \file
+/// \brief A serial port FileHandle that receives through eDMA.
+///
+/// UARTSerial takes an interrupt for every received byte. Here the UART's
+/// receive DMA request has an eDMA channel copy every byte into a RAM ring
+/// that wraps back on its own, so a burst of +IPD data does not need the CPU
+/// at all. read() and poll() find the end of the data from the channel's
+/// destination address. peek_span() and consume() let the data be looked at
+/// where the DMA put it, without copying it out first.
+
+#include "mbed.h"
+
+#include "fsl_edma.h"
+#include "fsl_uart.h"
+#include "platform/Span.h"
+#include "serial_api.h"
+
+/// Default size of the receive ring in bytes. At 921600 baud this is about
+/// 22 ms of data that can pile up before read() has to be called
+#define DMAUARTRXSIZE (2048)
+
+/// The largest receive ring, the eDMA counts at most 32767 bytes in a pass
+#define DMAUARTRXMAX (16384)
+
+/// A serial port that can be used in place of UARTSerial, for example by
+/// ATCmdParser. Writes are blocking, reads come out of the DMA ring.
+class DMAUARTSerial : public FileHandle, private NonCopyable<DMAUARTSerial> {
+  public:
+    /// Sets up the UART and starts receiving into a ring of rxSize bytes,
+    /// which has to be a power of two of at most DMAUARTRXMAX.
+    /// If no DMA channel is free, or the DMA pool has no room for the ring,
+    /// error() is called.
+    DMAUARTSerial(PinName tx, PinName rx, int baud,
+                  size_t rxSize = DMAUARTRXSIZE);
+
+    virtual ~DMAUARTSerial();
+
+    /// Copies up to length received bytes into buffer.
+    /// If the port is blocking, this waits for at least one byte.
+    virtual ssize_t read(void *buffer, size_t length);
+
+    /// Returns the received bytes that were not read yet and follow each
+    /// other in the ring, without taking them out. They are empty if none
+    /// came in, and the rest follows once the first ones are consumed. The
+    /// DMA writes over them after another rxSize bytes came in
+    mbed::Span<const uint8_t> peek_span();
+
+    /// Takes the first length bytes of peek_span() out, as read() would
+    void consume(size_t length);
+
+    /// Sends all length bytes from buffer
+    virtual ssize_t write(const void *buffer, size_t length);
+
+    virtual off_t seek(off_t offset, int whence) { return -ESPIPE; }
+
+    virtual int close() { return 0; }
+
+    virtual int isatty() { return 1; }
+
+    virtual short poll(short events) const;
+
+    virtual int set_blocking(bool blocking) {
+        Blocking = blocking;
+        return 0;
+    }
+
+    virtual bool is_blocking() const { return Blocking; }
+
+    /// Called from interrupt context every time the ring wraps around
+    virtual void sigio(Callback<void()> func);
+
+    /// Changes the baud rate, the ring is kept
+    void set_baud(int baud);
+
+    /// Sets the baud rate again for the clock that the UART runs from now,
+    /// for clockAttach()
+    void retime();
+
+    /// Turns hardware flow control on or off. flow1 is RTS and flow2 is CTS
+    /// for FlowControlRTSCTS, like SerialBase::set_flow_control()
+    void set_flow_control(FlowControl type, PinName flow1 = NC,
+                          PinName flow2 = NC);
+
+    /// Sets the data bits, the parity and the stop bits of every character
+    void set_format(int bits, SerialParity parity, int stop_bits);
+
+    /// Drives the driver enable of an RS-485 transceiver from the UART's
+    /// RTS pin de, which the UART sets while it sends, so the bus is let go
+    /// right after the last stop bit without the CPU
+    void set_rs485(PinName de);
+
+    /// Waits until the last character of a write() is out of the UART
+    void drain();
+
+    /// Drops everything that was received and not read yet
+    void discard();
+
+    /// Returns the number of bytes that were lost because the ring, or the
+    /// UART itself, was full
+    uint32_t overruns() const { return Overruns; }
+
+  private:
+    /// the total number of bytes the DMA has written, wrapping at 2^32
+    uint32_t received() const;
+
+    /// drops what the DMA has written over, and clears a UART overrun
+    void checkOverrun();
+
+    static void onRingDone(edma_handle_t *handle, void *data, bool done,
+                           uint32_t tcds);
+
+    serial_t Serial;
+
+    UART_Type *Base;
+
+    /// the baud rate from the constructor or set_baud()
+    int Baud;
+
+    /// Size bytes from dmaAlloc()
+    uint8_t *Ring;
+
+    /// the size of Ring, a power of two
+    size_t Size;
+
+    int Channel;
+
+    edma_handle_t Handle;
+
+    /// number of times the DMA wrapped back to the start of Ring
+    volatile uint32_t Wraps;
+
+    /// the total number of bytes taken out by read()
+    uint32_t Taken;
+
+    uint32_t Overruns;
+
+    bool Blocking;
+
+    Callback<void()> SigIO;
+};
+
+#endif // DMAUARTSERIAL
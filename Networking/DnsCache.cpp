@@ -0,0 +1,118 @@
+/// \file
+/// \brief Implementation of the cache of the server address
+#define TRACE_GROUP "dns"
+#include "DnsCache.h"
+
+#include "DeferredLog.h"
+#include "FlashQueue.h"
+#include "TimeSync.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+/// What is kept in the flash
+struct DnsEntry {
+    /// the name that was looked up, the entry is not used for another one
+    char Host[DNSHOSTMAX];
+    char Address[DNSADDRESSMAX];
+
+    /// when the address expires, in time(NULL) seconds. 0 if the clock did
+    /// not have the time when it was looked up
+    uint32_t Expires;
+};
+
+static_assert(sizeof(DnsEntry) <= FLASHDNSMAX,
+              "the server address does not fit into FLASHDNSMAX");
+
+static DnsEntry Entry;
+
+/// when Entry expires, in Kernel::get_ms_count() milliseconds
+static uint64_t ExpiresMs = 0;
+
+/// false until Entry was read from the flash
+static bool EntryLoaded = false;
+
+// reads the address of an earlier boot, and works out how long it has left
+static void loadEntry() {
+    EntryLoaded = true;
+    if (readDnsCache(&Entry, sizeof(Entry)) != sizeof(Entry) ||
+        Entry.Host[sizeof(Entry.Host) - 1] != '\0' ||
+        Entry.Address[sizeof(Entry.Address) - 1] != '\0') {
+        memset(&Entry, 0, sizeof(Entry));
+        return;
+    }
+    uint64_t Now = Kernel::get_ms_count();
+    uint32_t Clock = (uint32_t)time(NULL);
+    if (!clockValid() || Entry.Expires == 0) {
+        ExpiresMs = Now + DNSCACHES * 1000ULL;
+    } else if (Entry.Expires > Clock) {
+        ExpiresMs = Now + (Entry.Expires - Clock) * 1000ULL;
+    } else {
+        ExpiresMs = Now;
+    }
+}
+
+// ============================================================================
+bool isAddress(const char *Host) {
+    unsigned a, b, c, d;
+    char Rest;
+    if (sscanf(Host, "%3u.%3u.%3u.%3u%c", &a, &b, &c, &d, &Rest) == 4 &&
+        a < 256 && b < 256 && c < 256 && d < 256) {
+        return true;
+    }
+    // an IPv6 address has colons, and only hex digits and dots besides them
+    size_t Length = strlen(Host);
+    return Length > 1 && Length < DNSADDRESSMAX &&
+           strchr(Host, ':') != NULL &&
+           strspn(Host, "0123456789abcdefABCDEF:.") == Length;
+}
+
+// ============================================================================
+const char *cachedAddress(const char *Host, bool Stale) {
+    if (!EntryLoaded) {
+        loadEntry();
+    }
+    if (Entry.Address[0] == '\0' || strcmp(Entry.Host, Host) != 0) {
+        return NULL;
+    }
+    if (!Stale && Kernel::get_ms_count() >= ExpiresMs) {
+        return NULL;
+    }
+    return Entry.Address;
+}
+
+// ============================================================================
+void cacheAddress(const char *Host, const char *Address) {
+    if (strlen(Host) >= sizeof(Entry.Host) ||
+        strlen(Address) >= sizeof(Entry.Address)) {
+        return;
+    }
+    EntryLoaded = true;
+    ExpiresMs = Kernel::get_ms_count() + DNSCACHES * 1000ULL;
+
+    DnsEntry Found;
+    memset(&Found, 0, sizeof(Found));
+    strcpy(Found.Host, Host);
+    strcpy(Found.Address, Address);
+    if (clockValid()) {
+        Found.Expires = (uint32_t)time(NULL) + DNSCACHES;
+    }
+
+    // the flash is only written when the address moved, not for every
+    // lookup that found the same one
+    bool Moved = strcmp(Found.Host, Entry.Host) != 0 ||
+                 strcmp(Found.Address, Entry.Address) != 0;
+    Entry = Found;
+    if (Moved) {
+        tr_info("%s is at %s", Host, Address);
+        int err = saveDnsCache(&Entry, sizeof(Entry));
+        if (err) {
+            tr_warn("The server address could not be kept in the flash (%d)",
+                    err);
+        }
+    }
+}
+
+// ============================================================================
+void expireAddress() { ExpiresMs = Kernel::get_ms_count(); }
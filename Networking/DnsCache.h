@@ -0,0 +1,54 @@
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+/// \file
+/// \brief Keeps the address that the server name resolved to.
+///
+/// The server in the config file can be a name instead of an address. Every
+/// backend resolves it the first time a link opens, with AT+CIPDOMAIN or
+/// with the interface's gethostbyname(), and keeps the answer here. Neither
+/// of them passes on the TTL of the answer, so the address is used for
+/// DNSCACHES seconds, and then the name is looked up again.
+///
+/// The address is also kept in the flash with saveDnsCache(), so that the
+/// first connect after a reset does not wait for a lookup. Until the clock
+/// has the time, the address from the flash is used for DNSCACHES from
+/// boot.
+///
+/// When a lookup fails the last address is used anyway, the server most
+/// likely did not move while the name server is out of reach. When a
+/// connect to the address fails it is expired, so the next connect looks
+/// the name up again and finds a server that moved.
+
+#include <cstddef>
+#include <cstdint>
+
+/// How long a resolved address is used, in seconds. Set with "dns-cache-s"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_DNS_CACHE_S
+#define DNSCACHES MBED_CONF_APP_DNS_CACHE_S
+#else
+#define DNSCACHES (3600)
+#endif
+
+/// The longest server name that is cached
+#define DNSHOSTMAX (64)
+
+/// The longest IPv6 address and the '\0', like NSAPI_IPv6_SIZE. The mesh of
+/// NETWORKMESH only has IPv6
+#define DNSADDRESSMAX (46)
+
+/// Returns true if Host is an IPv4 or IPv6 address, which needs no lookup
+bool isAddress(const char *Host);
+
+/// Returns the address that Host resolved to, NULL if there is none or it
+/// expired. With Stale an expired address is returned as well
+const char *cachedAddress(const char *Host, bool Stale);
+
+/// Keeps Address as what Host resolved to, for DNSCACHES from now
+void cacheAddress(const char *Host, const char *Address);
+
+/// A connect to the cached address failed. The address is still returned as
+/// a stale one, but the name is looked up again first
+void expireAddress();
+
+#endif // DNSCACHE
@@ -0,0 +1,306 @@
+/// \file
+/// \brief Implementation of the transcript recorder and replay
+#include "ESPTranscript.h"
+
+#if ESPTRANSCRIPT
+
+#include "hal/us_ticker_api.h"
+
+#include <cctype>
+#include <cstring>
+
+// writes the Length bytes at Data to File the way the transcript has them
+static void putEscaped(FILE *File, const uint8_t *Data, size_t Length) {
+    for (size_t i = 0; i < Length; ++i) {
+        uint8_t c = Data[i];
+        if (c == '\r') {
+            fputs("\\r", File);
+        } else if (c == '\n') {
+            fputs("\\n", File);
+        } else if (c == '\\') {
+            fputs("\\\\", File);
+        } else if (c >= 0x20 && c < 0x7F) {
+            fputc(c, File);
+        } else {
+            fprintf(File, "\\x%02X", c);
+        }
+    }
+}
+
+// the value of the hex digit c
+static uint8_t hexValue(char c) {
+    return isdigit((unsigned char)c) ? c - '0' : (toupper(c) - 'A' + 10);
+}
+
+// decodes the escaped bytes of Text into Out, up to Size of them
+static size_t getEscaped(const char *Text, uint8_t *Out, size_t Size) {
+    size_t Length = 0;
+    while (*Text != '\0' && *Text != '\n' && Length < Size) {
+        if (Text[0] != '\\' || Text[1] == '\0') {
+            Out[Length++] = *Text++;
+            continue;
+        }
+        switch (Text[1]) {
+        case 'r':
+            Out[Length++] = '\r';
+            break;
+        case 'n':
+            Out[Length++] = '\n';
+            break;
+        case 'x':
+            if (isxdigit((unsigned char)Text[2]) &&
+                isxdigit((unsigned char)Text[3])) {
+                Out[Length++] = (hexValue(Text[2]) << 4) | hexValue(Text[3]);
+                Text += 2;
+            }
+            break;
+        default:
+            Out[Length++] = Text[1];
+            break;
+        }
+        Text += 2;
+    }
+    return Length;
+}
+
+TranscriptRecorder::TranscriptRecorder(FileHandle *Port, const char *Path)
+    : Port(Port), Path(Path), File(NULL), Start(0), Direction(0), First(0),
+      Last(0), Length(0) {}
+
+TranscriptRecorder::~TranscriptRecorder() { close(); }
+
+ssize_t TranscriptRecorder::read(void *buffer, size_t length) {
+    ssize_t Got = Port->read(buffer, length);
+    if (Got > 0) {
+        add('<', (const uint8_t *)buffer, Got);
+    }
+    return Got;
+}
+
+ssize_t TranscriptRecorder::write(const void *buffer, size_t length) {
+    ssize_t Sent = Port->write(buffer, length);
+    if (Sent > 0) {
+        add('>', (const uint8_t *)buffer, Sent);
+    }
+    return Sent;
+}
+
+int TranscriptRecorder::close() {
+    flush();
+    if (File != NULL) {
+        fclose(File);
+        File = NULL;
+    }
+    return 0;
+}
+
+void TranscriptRecorder::add(char To, const uint8_t *Data, size_t Count) {
+    if (File == NULL) {
+        File = fopen(Path, "a");
+        if (File == NULL) {
+            return;
+        }
+        Start = us_ticker_read();
+        fputs("# recorded by TranscriptRecorder, see ESPTranscript.h\n",
+              File);
+    }
+    uint32_t Now = us_ticker_read() - Start;
+    for (size_t i = 0; i < Count; ++i) {
+        if (Length > 0 && (Direction != To || Length == ESPTRANSCRIPTCHUNK)) {
+            flush();
+        }
+        if (Length == 0) {
+            Direction = To;
+            First = Now;
+        }
+        Chunk[Length++] = Data[i];
+        Last = Now;
+        if (Data[i] == '\n') {
+            flush();
+        }
+    }
+}
+
+void TranscriptRecorder::flush() {
+    if (Length == 0 || File == NULL) {
+        Length = 0;
+        return;
+    }
+    fprintf(File, "%lu %lu %c ", (unsigned long)First, (unsigned long)Last,
+            Direction);
+    putEscaped(File, Chunk, Length);
+    fputc('\n', File);
+    Length = 0;
+}
+
+TranscriptReplay::TranscriptReplay(const char *Path, int Scale)
+    : Path(Path), Scale(Scale), File(NULL), Blocking(true), HaveNext(false),
+      Direction(0), First(0), Last(0), Length(0), Played(0), Differs(false),
+      AnchorStamp(0), AnchorUs(0), Early(false), WrittenLength(0),
+      Mismatches(0) {}
+
+TranscriptReplay::~TranscriptReplay() { close(); }
+
+int TranscriptReplay::close() {
+    if (File != NULL) {
+        fclose(File);
+        File = NULL;
+    }
+    HaveNext = false;
+    return 0;
+}
+
+void TranscriptReplay::rewind() {
+    close();
+    WrittenLength = 0;
+    Mismatches = 0;
+    open();
+}
+
+bool TranscriptReplay::open() {
+    if (File != NULL) {
+        return true;
+    }
+    File = fopen(Path, "r");
+    if (File == NULL) {
+        return false;
+    }
+    AnchorStamp = 0;
+    AnchorUs = us_ticker_read();
+    Early = false;
+    load();
+    return true;
+}
+
+bool TranscriptReplay::load() {
+    static char Line[ESPTRANSCRIPTLINE];
+    HaveNext = false;
+    while (fgets(Line, sizeof(Line), File) != NULL) {
+        unsigned long From, To;
+        char Way;
+        int Used = 0;
+        if (Line[0] == '#' ||
+            sscanf(Line, "%lu %lu %c %n", &From, &To, &Way, &Used) < 3 ||
+            (Way != '<' && Way != '>')) {
+            continue;
+        }
+        Length = getEscaped(Line + Used, Chunk, sizeof(Chunk));
+        if (Length == 0) {
+            continue;
+        }
+        Direction = Way;
+        First = From;
+        Last = To < From ? From : To;
+        Played = 0;
+        Differs = false;
+        HaveNext = true;
+        return true;
+    }
+    return false;
+}
+
+size_t TranscriptReplay::due() const {
+    if (!HaveNext || Direction != '<') {
+        return 0;
+    }
+    if (Early || Scale <= 0) {
+        return Length - Played;
+    }
+    // how far the recording is by now. The bytes of the chunk are spread
+    // from its first to its last time, as they came over the UART
+    uint64_t Elapsed = (uint64_t)(us_ticker_read() - AnchorUs) * 100 / Scale;
+    uint32_t Begin = First > AnchorStamp ? First - AnchorStamp : 0;
+    if (Elapsed < Begin) {
+        return 0;
+    }
+    size_t Ready = Length;
+    if (Last > First && Length > 1) {
+        uint64_t Into = (Elapsed - Begin) * (Length - 1) / (Last - First) + 1;
+        Ready = Into < Length ? (size_t)Into : Length;
+    }
+    return Ready > Played ? Ready - Played : 0;
+}
+
+short TranscriptReplay::poll(short events) const {
+    // the file can only be opened once the SD card is mounted
+    if (!const_cast<TranscriptReplay *>(this)->open()) {
+        return POLLOUT & events;
+    }
+    short Ready = POLLOUT;
+    if (due() > 0) {
+        Ready |= POLLIN;
+    }
+    return Ready & events;
+}
+
+ssize_t TranscriptReplay::read(void *buffer, size_t length) {
+    size_t Count = 0;
+    while (Count == 0) {
+        if (open()) {
+            Count = due();
+        }
+        if (Count == 0) {
+            if (!Blocking) {
+                return -EAGAIN;
+            }
+            ThisThread::sleep_for(1);
+        }
+    }
+    if (Count > length) {
+        Count = length;
+    }
+    memcpy(buffer, Chunk + Played, Count);
+    Played += Count;
+    if (Played == Length) {
+        load();
+        match();
+    }
+    return Count;
+}
+
+ssize_t TranscriptReplay::write(const void *buffer, size_t length) {
+    open();
+    const uint8_t *Data = (const uint8_t *)buffer;
+    for (size_t i = 0; i < length; ++i) {
+        if (WrittenLength == sizeof(Written)) {
+            // the board wrote far more than the recording has here
+            ++Mismatches;
+            WrittenLength = 0;
+        }
+        Written[WrittenLength++] = Data[i];
+    }
+    if (HaveNext && Direction == '<') {
+        // the board did not wait for what the recording has before this
+        Early = true;
+    }
+    match();
+    return length;
+}
+
+void TranscriptReplay::match() {
+    while (HaveNext && Direction == '>' && WrittenLength > 0) {
+        size_t Count = Length - Played;
+        if (Count > WrittenLength) {
+            Count = WrittenLength;
+        }
+        if (memcmp(Chunk + Played, Written, Count) != 0) {
+            Differs = true;
+        }
+        Played += Count;
+        WrittenLength -= Count;
+        memmove(Written, Written + Count, WrittenLength);
+        if (Played < Length) {
+            return;
+        }
+        if (Differs) {
+            ++Mismatches;
+        }
+        // what the ESP8266 sent after this write is timed from its end
+        AnchorStamp = Last;
+        AnchorUs = us_ticker_read();
+        Early = false;
+        load();
+    }
+}
+
+#endif // ESPTRANSCRIPT
@@ -0,0 +1,210 @@
+#ifndef ESPTRANSCRIPT_H
+#define ESPTRANSCRIPT_H
+/// \file
+/// \brief Records what goes over the ESP8266's UART with its timing, and
+/// plays it back in place of the ESP8266, so the AT code can be timed on the
+/// same input again and again.
+///
+/// TranscriptRecorder sits between ATCmdParser and the serial port and
+/// appends every chunk to ESPTRANSCRIPTFILE. TranscriptReplay is a FileHandle
+/// that ATCmdParser takes instead of the serial port. It needs nothing of
+/// the board, so the same transcript plays on the host as well. Each line of
+/// a transcript is one chunk:
+///
+///     <first us> <last us> <direction> <bytes>
+///
+/// with the microseconds of its first and last byte since the recording
+/// started, '>' for what the board wrote and '<' for what the ESP8266 sent,
+/// +IPD data, "busy p..." and the CLOSED messages included. The bytes are
+/// as they are, except for \\r, \\n, \\\\ and \\xHH for the ones that are not
+/// printable. A chunk ends at a '\\n', when the direction changes, or at
+/// ESPTRANSCRIPTCHUNK bytes. A transcript can be written by hand as well.
+///
+/// The replay holds back what the ESP8266 sent until the board has written
+/// everything the recording has before it, and then lets it out on the
+/// recorded times after the end of that write, stretched by
+/// ESPTRANSCRIPTSCALE percent: 100 is the real timing, 0 as fast as the
+/// parser reads. The bytes of a chunk come out at the pace that they came
+/// over the UART. What the board writes is compared with the recording,
+/// mismatches() counts the chunks that differ, the replay goes on either
+/// way. At the end of the transcript the ESP8266 stops answering, so the
+/// timeouts and the recovery run too. Set with "esp-transcript" in
+/// mbed_app.json.
+
+#include "mbed.h"
+
+/// Nothing is recorded or played
+#define ESPTRANSCRIPTOFF (0)
+
+/// What goes over the UART is appended to ESPTRANSCRIPTFILE
+#define ESPTRANSCRIPTRECORD (1)
+
+/// ESPTRANSCRIPTFILE is played instead of talking to the ESP8266
+#define ESPTRANSCRIPTREPLAY (2)
+
+/// One of the ESPTRANSCRIPT values above. Set with "esp-transcript" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_TRANSCRIPT
+#define ESPTRANSCRIPT MBED_CONF_APP_ESP_TRANSCRIPT
+#else
+#define ESPTRANSCRIPT ESPTRANSCRIPTOFF
+#endif
+
+/// The transcript. Set with "esp-transcript-file" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_TRANSCRIPT_FILE
+#define ESPTRANSCRIPTFILE MBED_CONF_APP_ESP_TRANSCRIPT_FILE
+#else
+#define ESPTRANSCRIPTFILE "/sd/esp.txt"
+#endif
+
+/// How much the recorded times are stretched, in percent. Set with
+/// "esp-transcript-scale" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_TRANSCRIPT_SCALE
+#define ESPTRANSCRIPTSCALE MBED_CONF_APP_ESP_TRANSCRIPT_SCALE
+#else
+#define ESPTRANSCRIPTSCALE (100)
+#endif
+
+/// The most bytes of one chunk
+#define ESPTRANSCRIPTCHUNK (256)
+
+/// The longest line of a transcript, every byte of a chunk escaped
+#define ESPTRANSCRIPTLINE (32 + 4 * ESPTRANSCRIPTCHUNK)
+
+/// Passes everything through to a serial port, and appends it to a
+/// transcript. The file is opened with the first byte once the SD card is
+/// there, what goes over before that is not recorded
+class TranscriptRecorder : public FileHandle,
+                           private NonCopyable<TranscriptRecorder> {
+  public:
+    /// Records what goes over Port into the file at Path
+    TranscriptRecorder(FileHandle *Port, const char *Path);
+
+    virtual ~TranscriptRecorder();
+
+    virtual ssize_t read(void *buffer, size_t length);
+
+    virtual ssize_t write(const void *buffer, size_t length);
+
+    virtual off_t seek(off_t offset, int whence) { return -ESPIPE; }
+
+    virtual int close();
+
+    virtual int isatty() { return 1; }
+
+    virtual short poll(short events) const { return Port->poll(events); }
+
+    virtual int set_blocking(bool blocking) {
+        return Port->set_blocking(blocking);
+    }
+
+    virtual bool is_blocking() const { return Port->is_blocking(); }
+
+    /// Writes out the chunk that is not complete yet
+    void flush();
+
+  private:
+    /// adds Length bytes that went in Direction to the chunk
+    void add(char Direction, const uint8_t *Data, size_t Length);
+
+    FileHandle *Port;
+    const char *Path;
+    FILE *File;
+
+    /// us_ticker_read() when the recording started
+    uint32_t Start;
+
+    /// the chunk that is being put together
+    char Direction;
+    uint32_t First;
+    uint32_t Last;
+    uint8_t Chunk[ESPTRANSCRIPTCHUNK];
+    size_t Length;
+};
+
+/// Plays a transcript in place of the ESP8266's serial port. The file is
+/// opened when the parser first uses it, after the SD card is mounted
+class TranscriptReplay : public FileHandle,
+                         private NonCopyable<TranscriptReplay> {
+  public:
+    /// Plays the file at Path with its times stretched by Scale percent
+    TranscriptReplay(const char *Path, int Scale = ESPTRANSCRIPTSCALE);
+
+    virtual ~TranscriptReplay();
+
+    virtual ssize_t read(void *buffer, size_t length);
+
+    virtual ssize_t write(const void *buffer, size_t length);
+
+    virtual off_t seek(off_t offset, int whence) { return -ESPIPE; }
+
+    virtual int close();
+
+    virtual int isatty() { return 1; }
+
+    virtual short poll(short events) const;
+
+    virtual int set_blocking(bool blocking) {
+        Blocking = blocking;
+        return 0;
+    }
+
+    virtual bool is_blocking() const { return Blocking; }
+
+    /// Starts the transcript over from its first line
+    void rewind();
+
+    /// Returns how many chunks the board wrote differently from the
+    /// recording
+    uint32_t mismatches() const { return Mismatches; }
+
+    /// Returns true once the whole transcript was played
+    bool ended() const { return !HaveNext; }
+
+  private:
+    /// opens the file if it is not open yet, false if it can not be
+    bool open();
+
+    /// reads the next line of the file into Next, false at its end
+    bool load();
+
+    /// the number of bytes of Next that may be read by now
+    size_t due() const;
+
+    /// matches what was written against the '>' chunks that are next
+    void match();
+
+    const char *Path;
+    int Scale;
+    FILE *File;
+    bool Blocking;
+
+    /// the next chunk of the transcript, and how much of it was played
+    bool HaveNext;
+    char Direction;
+    uint32_t First;
+    uint32_t Last;
+    uint8_t Chunk[ESPTRANSCRIPTCHUNK];
+    size_t Length;
+    size_t Played;
+
+    /// set when the board wrote something else than Next
+    bool Differs;
+
+    /// the recorded time at which the board's last write ended, and the
+    /// us_ticker_read() when it ended in the replay
+    uint32_t AnchorStamp;
+    uint32_t AnchorUs;
+
+    /// set while the board writes before the ESP8266's bytes were due,
+    /// they are then let out at once
+    bool Early;
+
+    /// what the board wrote that was not matched yet
+    uint8_t Written[ESPTRANSCRIPTCHUNK];
+    size_t WrittenLength;
+
+    uint32_t Mismatches;
+};
+
+#endif // ESPTRANSCRIPT
@@ -0,0 +1,176 @@
+/// \file
+/// \brief Implementation of the over the air updates
+#define TRACE_GROUP "ota"
+#include "FirmwareUpdate.h"
+
+#include "DeferredLog.h"
+
+#if OTAUPDATE
+#include "DeltaPatch.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+/// the version the server offered, 0 before it offered one
+static uint32_t Offered = 0;
+
+/// the version whose patch did not work, it is not fetched again
+static uint32_t Rejected = 0;
+
+/// true while the patch of Manifest is built
+static bool Active = false;
+static SlotManifest Manifest;
+static SlotSignature Signature;
+static DeltaPatch Patch;
+
+/// the sector of the new image that is built, and its bytes so far
+static uint8_t Sector[SLOTSECTOR];
+static size_t Fill = 0;
+
+static uint8_t Piece[FIRMWAREPIECE];
+
+// ============================================================================
+void offerFirmware(const char *Response) {
+    const char *Offer = strstr(Response, "firmware=\"");
+    if (Offer != NULL && isdigit(Offer[10])) {
+        uint32_t Version = strtoul(Offer + 10, NULL, 10);
+        if (Version != Offered) {
+            tr_info("The server offers firmware %lu", (unsigned long)Version);
+        }
+        Offered = Version;
+    }
+}
+
+// drops the update, a new offer starts it over
+static int rejectUpdate(const char *Why) {
+    tr_warn("Firmware %lu not taken: %s", (unsigned long)Offered, Why);
+    Rejected = Offered;
+    Active = false;
+    return FIRMWAREIDLE;
+}
+
+// goes on with the update in the slot, from its last checkpoint
+static bool resumeUpdate() {
+    // the board may have been flashed with another firmware since
+    if (!slotManifest(Manifest) || Manifest.Firmware != Offered ||
+        imageCrc(runningImage(), Manifest.BaseSize) != Manifest.BaseCrc) {
+        return false;
+    }
+    SlotCheckpoint At;
+    if (lastCheckpoint(At)) {
+        Patch.resume(runningImage(), Manifest.BaseSize, At);
+        tr_info("Firmware %lu goes on from byte %lu",
+                (unsigned long)Offered, (unsigned long)At.PatchAt);
+    } else {
+        Patch.start(runningImage(), Manifest.BaseSize);
+    }
+    // a checkpoint is taken with every sector
+    Fill = 0;
+    Active = true;
+    return true;
+}
+
+// takes the manifest and its signature at the start of the first piece
+static bool beginUpdate(const uint8_t *Data, size_t Length) {
+    if (Length >= SLOTPATCHHEAD) {
+        memcpy(&Manifest, Data, sizeof(Manifest));
+        memcpy(&Signature, Data + sizeof(Manifest), sizeof(Signature));
+    }
+    if (Length < SLOTPATCHHEAD || !manifestValid(Manifest) ||
+        Manifest.Firmware != Offered) {
+        rejectUpdate("bad manifest");
+        return false;
+    }
+    if (!manifestSigned(Manifest, Signature)) {
+        rejectUpdate("the manifest is not signed");
+        return false;
+    }
+    if (imageCrc(runningImage(), Manifest.BaseSize) != Manifest.BaseCrc) {
+        rejectUpdate("not against this firmware");
+        return false;
+    }
+    if (beginSlot(Manifest, Signature) != 0) {
+        rejectUpdate("the slot could not be erased");
+        return false;
+    }
+    Patch.start(runningImage(), Manifest.BaseSize);
+    Fill = 0;
+    Active = true;
+    return true;
+}
+
+// builds the image from the Length bytes of the patch at Data, a sector at
+// a time
+static int applyPiece(const uint8_t *Data, size_t Length) {
+    size_t Used = 0;
+    do {
+        size_t Written;
+        Used += Patch.run(Data + Used, Length - Used, Sector + Fill,
+                          SLOTSECTOR - Fill, Written);
+        Fill += Written;
+        if (Patch.failed() || Patch.newAt() > Manifest.Size) {
+            return rejectUpdate("bad patch");
+        }
+        if (Fill == SLOTSECTOR || (Patch.done() && Fill > 0)) {
+            if (writeSlotSector(Patch.newAt() - Fill, Sector, Fill) != 0) {
+                return rejectUpdate("the slot could not be written");
+            }
+            Fill = 0;
+            SlotCheckpoint At;
+            Patch.checkpoint(At);
+            keepCheckpoint(At);
+        }
+    } while (Used < Length && !Patch.done());
+
+    if (!Patch.done()) {
+        return FIRMWAREBUSY;
+    }
+    if (Patch.newAt() != Manifest.Size || !finishSlot(Manifest)) {
+        return rejectUpdate("the new image does not check out");
+    }
+    tr_info("Firmware %lu is ready", (unsigned long)Offered);
+    return FIRMWAREREADY;
+}
+
+// ============================================================================
+int stepFirmwareUpdate(ATCmdParser *_parser, BoardSpecs &Specs) {
+    if (Offered <= FIRMWAREVERSION || Offered == Rejected) {
+        return FIRMWAREIDLE;
+    }
+    if (!Active && resumeUpdate() && slotReady()) {
+        return FIRMWAREREADY;
+    }
+
+    for (int i = 0; i < FIRMWARESTEPPIECES; ++i) {
+        uint32_t At = Active ? Patch.patchAt() : 0;
+        size_t Length;
+        int err = fetchFirmwareTCP(_parser, Specs, Offered, At, Piece,
+                                   sizeof(Piece), Length);
+        if (err == NETWORKNOTFOUND) {
+            // the server does not have it any more
+            return rejectUpdate("no patch");
+        }
+        if (err != NETWORKSUCCESS) {
+            return err;
+        }
+        if (Length == 0) {
+            return rejectUpdate("the patch ends early");
+        }
+        const uint8_t *Data = Piece;
+        if (!Active) {
+            if (!beginUpdate(Piece, Length)) {
+                return FIRMWAREIDLE;
+            }
+            Data += SLOTPATCHHEAD;
+            Length -= SLOTPATCHHEAD;
+        }
+        int State = applyPiece(Data, Length);
+        if (State != FIRMWAREBUSY) {
+            return State;
+        }
+    }
+    return FIRMWAREBUSY;
+}
+
+#endif // OTAUPDATE
@@ -0,0 +1,53 @@
+#ifndef FIRMWAREUPDATE_H
+#define FIRMWAREUPDATE_H
+/// \file
+/// \brief Over the air firmware updates, fetched as a patch against the
+/// running firmware in pieces between the uploads.
+///
+/// With OTAUPDATE every request has &Firmware=FIRMWAREVERSION, and a
+/// response with firmware="Version" offers an update to that version. The
+/// uploader then fetches the patch of Storage/make_delta.py a piece at a
+/// time with GET ...?Board_ID=...&Firmware=...&Update=Version&Offset=...,
+/// whose body is the FIRMWAREPIECE bytes of the patch from Offset on, or
+/// fewer at its end. The first piece has the manifest and its signature,
+/// and an update that is not signed with the key of OTAPUBLICKEY, or whose
+/// patch is not against the running image, is not taken.
+///
+/// DeltaPatch.h builds the new image from the pieces into the update slot
+/// of FirmwareSlot.h. A lost link only stops it until the next piece, and a
+/// reset until the last sector that was programmed. Once the image in the
+/// slot is checked, the board resets into the bootloader, which copies it
+/// over the running firmware.
+
+#include "FirmwareSlot.h"
+#include "Networking.h"
+
+#if OTAUPDATE && (MQTTPUBLISH || COAPUPLINK || LORAWANUPLINK ||              \
+                  GATEWAYROLE == GATEWAYCHILD)
+#error "ota needs the HTTP requests to the server"
+#endif
+
+/// The most bytes of the patch in one response, what a response body holds
+#define FIRMWAREPIECE (RESPONSESIZE)
+
+/// The most pieces that one stepFirmwareUpdate() fetches, so the uploader
+/// checks in with the supervisor in between
+#define FIRMWARESTEPPIECES (4)
+
+/// What stepFirmwareUpdate() returns besides the errors of the pieces
+#define FIRMWAREIDLE (0)
+#define FIRMWAREBUSY (1)
+#define FIRMWAREREADY (2)
+
+/// Keeps the firmware="Version" of a response, if there is one, for
+/// stepFirmwareUpdate(). Called from parseServerSettings()
+void offerFirmware(const char *Response);
+
+/// Fetches the next pieces of the offered update and builds the new image
+/// from them
+/// \returns FIRMWAREIDLE if there is no update, FIRMWAREBUSY while it goes
+/// on, FIRMWAREREADY once the bootloader can take it, or the error of a
+/// piece that could not be fetched
+int stepFirmwareUpdate(ATCmdParser *_parser, BoardSpecs &Specs);
+
+#endif // FIRMWAREUPDATE
@@ -0,0 +1,85 @@
+/// \file
+/// \brief Implementation of the gateway's queue of its children's readings
+#include "Gateway.h"
+
+#if GATEWAYROLE == GATEWAYHUB
+
+#include <cstring>
+
+static_assert(sizeof(GatewayHeader) == 12,
+              "the header is the same on every board");
+
+/// the length in front of every body
+#define GATEWAYLENGTHSIZE (sizeof(uint16_t))
+
+GatewayQueue::GatewayQueue() : Used(0), Count(0), Since(0) {}
+
+// ============================================================================
+bool GatewayQueue::push(const uint8_t *Body, size_t Size) {
+    if (Size == 0 || Size > GATEWAYBODYMAX ||
+        Used + GATEWAYLENGTHSIZE + Size > sizeof(Data)) {
+        return false;
+    }
+    uint16_t Length = (uint16_t)Size;
+    memcpy(Data + Used, &Length, GATEWAYLENGTHSIZE);
+    memcpy(Data + Used + GATEWAYLENGTHSIZE, Body, Size);
+    Used += GATEWAYLENGTHSIZE + Size;
+    if (Count++ == 0) {
+        Since = Kernel::get_ms_count();
+    }
+    return true;
+}
+
+// ============================================================================
+uint32_t GatewayQueue::age() const {
+    return Count == 0 ? 0 : (uint32_t)(Kernel::get_ms_count() - Since);
+}
+
+// ============================================================================
+size_t GatewayQueue::take(size_t Max, size_t &Bytes) const {
+    size_t Taken = 0;
+    size_t At = 0;
+    Bytes = 0;
+    while (Taken < Count) {
+        uint16_t Length;
+        memcpy(&Length, Data + At, GATEWAYLENGTHSIZE);
+        if (Bytes + Length > Max) {
+            break;
+        }
+        Bytes += Length;
+        At += GATEWAYLENGTHSIZE + Length;
+        ++Taken;
+    }
+    return Taken;
+}
+
+// ============================================================================
+void GatewayQueue::write(RequestWriter &Out, size_t Bodies) const {
+    size_t At = 0;
+    for (size_t i = 0; i < Bodies && i < Count; ++i) {
+        uint16_t Length;
+        memcpy(&Length, Data + At, GATEWAYLENGTHSIZE);
+        Out.append((const char *)Data + At + GATEWAYLENGTHSIZE, Length);
+        At += GATEWAYLENGTHSIZE + Length;
+    }
+}
+
+// ============================================================================
+void GatewayQueue::pop(size_t Bodies) {
+    size_t At = 0;
+    size_t Dropped = 0;
+    while (Dropped < Bodies && Dropped < Count) {
+        uint16_t Length;
+        memcpy(&Length, Data + At, GATEWAYLENGTHSIZE);
+        At += GATEWAYLENGTHSIZE + Length;
+        ++Dropped;
+    }
+    memmove(Data, Data + At, Used - At);
+    Used -= At;
+    Count -= Dropped;
+
+    // what is left came in while the batch was sent
+    Since = Kernel::get_ms_count();
+}
+
+#endif // GATEWAYROLE
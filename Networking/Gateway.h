@@ -0,0 +1,176 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+/// \file
+/// \brief The datagrams between a gateway board and the boards around it,
+/// and the readings that the gateway holds for them.
+///
+/// At a large site every board used to keep its own association with the
+/// access point and its own links to the server. With GATEWAYROLE one board
+/// is the gateway: the access point of the ESP8266 (the soft-AP of
+/// CWMODE=3) is up as GATEWAYSSID, and it listens for UDP datagrams on
+/// GATEWAYPORT. The other boards, the children, have GATEWAYSSID in their
+/// config file instead of the site's network, and send every batch of
+/// readings to GATEWAYADDRESS as one datagram. A datagram has the CBOR body
+/// that the board would have POSTed, with the frames of FrameCodec.h when
+/// PACKEDREADINGS is set, so the gateway does not have to know the ports of
+/// its children.
+///
+/// The gateway keeps the bodies in a GatewayQueue and acks every one of
+/// them once it is queued. Every GATEWAYHOLDMS, or once the queue is half
+/// full, they go to the server as a single POST whose body is a CBOR array
+/// of them, on one of the gateway's backlog links. A child that gets no ack
+/// within GATEWAYACKMS, or an ack that the queue is full, backs the readings
+/// up like after any send that failed, and sends them again later. A body
+/// whose ack was lost is sent twice, SEQUENCEDUPLOADS lets the server drop
+/// the second one. What is in the queue is lost if the gateway resets.
+///
+/// The ESP8266 takes up to GATEWAYSTATIONS stations on its access point,
+/// so a site with more boards needs more gateways. The children get no
+/// response from the server: their clock is set from the time in the ack,
+/// their settings come from their config file, and waveform captures are
+/// not sent.
+
+#include "Networking.h"
+#include "RequestWriter.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The SSID of the gateway's access point.
+/// Set with "gateway-ssid" in mbed_app.json.
+#ifdef MBED_CONF_APP_GATEWAY_SSID
+#define GATEWAYSSID MBED_CONF_APP_GATEWAY_SSID
+#else
+#define GATEWAYSSID "IAC-Gateway"
+#endif
+
+/// The WPA2 password of the gateway's access point, 8 to 64 characters.
+/// Set with "gateway-password" in mbed_app.json.
+#ifdef MBED_CONF_APP_GATEWAY_PASSWORD
+#define GATEWAYPASSWORD MBED_CONF_APP_GATEWAY_PASSWORD
+#else
+#define GATEWAYPASSWORD "iac-gateway"
+#endif
+
+/// The address of the gateway on its access point, which is where the
+/// ESP8266 puts itself. Set with "gateway-address" in mbed_app.json.
+#ifdef MBED_CONF_APP_GATEWAY_ADDRESS
+#define GATEWAYADDRESS MBED_CONF_APP_GATEWAY_ADDRESS
+#else
+#define GATEWAYADDRESS "192.168.4.1"
+#endif
+
+/// The UDP port of the datagrams, on both ends.
+/// Set with "gateway-port" in mbed_app.json.
+#ifdef MBED_CONF_APP_GATEWAY_PORT
+#define GATEWAYPORT MBED_CONF_APP_GATEWAY_PORT
+#else
+#define GATEWAYPORT (4210)
+#endif
+
+/// The channel the access point starts on. Once the station side joined
+/// the site's network the ESP8266 moves it to that channel
+#define GATEWAYCHANNEL (1)
+
+/// The most children on one gateway, the ESP8266 takes no more stations
+#define GATEWAYSTATIONS (8)
+
+/// The longest datagram, header and body
+#define GATEWAYDATAGRAMMAX (1024)
+
+/// How long a child waits for the ack of a datagram, in milliseconds. The
+/// gateway sends its acks between its own requests
+#define GATEWAYACKMS (5000)
+
+/// How many bytes of bodies the gateway holds for its children
+#define GATEWAYQUEUEBYTES (8192)
+
+/// How long the oldest body waits in the gateway for more, in milliseconds
+#define GATEWAYHOLDMS (10000)
+
+/// The most bytes of bodies in one relayed POST, the rest of REQUESTMAX is
+/// for the request line and the headers
+#define GATEWAYBATCHMAX (REQUESTMAX - 512)
+
+/// How many datagrams a child sends without the port table after one with
+/// it, so a server that lost it gets it back
+#define GATEWAYTABLEEVERY (32)
+
+/// How many acks wait to be sent at most, a datagram that comes in while
+/// they are all taken is not queued
+#define GATEWAYACKS (GATEWAYSTATIONS)
+
+/// The first two bytes of every datagram, "IG"
+#define GATEWAYMAGIC (0x4749)
+
+/// The kinds of datagrams
+#define GATEWAYREADINGS (1)
+#define GATEWAYACK (2)
+
+/// What an ack says about the body of its datagram
+#define GATEWAYQUEUED (0)
+#define GATEWAYFULL (1)
+
+/// What every datagram starts with. The body of a GATEWAYREADINGS follows
+/// it, an ack is only the header
+struct GatewayHeader {
+    uint16_t Magic;
+
+    /// GATEWAYREADINGS or GATEWAYACK
+    uint8_t Kind;
+
+    /// GATEWAYQUEUED or GATEWAYFULL in an ack
+    uint8_t Status;
+
+    /// the number the child gave the datagram, its ack has the same
+    uint16_t Id;
+    uint16_t Reserved;
+
+    /// the sender's clock, 0 if it was not set
+    uint32_t Time;
+};
+
+/// The longest body of one datagram
+#define GATEWAYBODYMAX (GATEWAYDATAGRAMMAX - sizeof(GatewayHeader))
+
+/// The bodies that the gateway holds for its children, oldest first, in one
+/// buffer that never touches the heap. Every body is kept with its length
+/// right in front of it. Bodies are only taken from the front, so a body
+/// that comes in while the front ones are being sent does not move them.
+class GatewayQueue {
+  public:
+    GatewayQueue();
+
+    /// Adds the Size bytes of Body at the end
+    /// \returns false if there is no room for it
+    bool push(const uint8_t *Body, size_t Size);
+
+    /// Returns how many bodies there are
+    size_t count() const { return Count; }
+
+    /// Returns how many of the buffer's GATEWAYQUEUEBYTES are taken
+    size_t used() const { return Used; }
+
+    /// Returns how long the oldest body has waited, in milliseconds
+    uint32_t age() const;
+
+    /// Returns how many of the oldest bodies fit into Max bytes together,
+    /// and sets Bytes to their size without the lengths in front of them
+    size_t take(size_t Max, size_t &Bytes) const;
+
+    /// Appends the Bodies oldest bodies to Out, one after the other
+    void write(RequestWriter &Out, size_t Bodies) const;
+
+    /// Drops the Bodies oldest bodies
+    void pop(size_t Bodies);
+
+  private:
+    uint8_t Data[GATEWAYQUEUEBYTES];
+    size_t Used;
+    size_t Count;
+
+    /// when the oldest body came in
+    uint64_t Since;
+};
+
+#endif // GATEWAY
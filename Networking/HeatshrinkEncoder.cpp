@@ -0,0 +1,85 @@
+/// \file
+/// \brief Implementation of the heatshrink encoder
+#include "HeatshrinkEncoder.h"
+
+/// the window and the longest match
+#define WINDOWBYTES (1U << HEATSHRINKWINDOW)
+#define MATCHMAX (1U << HEATSHRINKLOOKAHEAD)
+
+/// A match takes 1 + HEATSHRINKWINDOW + HEATSHRINKLOOKAHEAD bits and a byte
+/// 9, so 2 bytes are the shortest match that pays
+#define MATCHMIN (2)
+
+#define RINGMASK (HEATSHRINKRING - 1)
+
+HeatshrinkEncoder::HeatshrinkEncoder(RequestWriter &Out)
+    : Out(Out), Input(0), Encoded(0), Bits(0), BitCount(0) {}
+
+// ============================================================================
+bool HeatshrinkEncoder::push(const char *data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        Ring[Input++ & RINGMASK] = (uint8_t)data[i];
+        // a byte is only encoded once the longest match after it is in
+        if (Input - Encoded == MATCHMAX) {
+            encodeNext(MATCHMAX);
+        }
+    }
+    return !Out.overflowed();
+}
+
+// ============================================================================
+void HeatshrinkEncoder::finish() {
+    while (Encoded < Input) {
+        encodeNext(Input - Encoded);
+    }
+    if (BitCount > 0) {
+        putBits(0, 8 - BitCount);
+    }
+}
+
+void HeatshrinkEncoder::encodeNext(uint32_t Available) {
+    uint32_t Window = Encoded < WINDOWBYTES ? Encoded : WINDOWBYTES;
+    uint32_t Longest = Available < MATCHMAX ? Available : MATCHMAX;
+    uint32_t Best = 0;
+    uint32_t BestDistance = 0;
+
+    // the nearest of the longest matches, a match can run on into the
+    // bytes that it repeats
+    for (uint32_t Distance = 1; Distance <= Window && Best < Longest;
+         ++Distance) {
+        uint32_t Length = 0;
+        while (Length < Longest &&
+               Ring[(Encoded - Distance + Length) & RINGMASK] ==
+                   Ring[(Encoded + Length) & RINGMASK]) {
+            ++Length;
+        }
+        if (Length > Best) {
+            Best = Length;
+            BestDistance = Distance;
+        }
+    }
+
+    if (Best >= MATCHMIN) {
+        putBits(0, 1);
+        putBits(BestDistance - 1, HEATSHRINKWINDOW);
+        putBits(Best - 1, HEATSHRINKLOOKAHEAD);
+        Encoded += Best;
+    } else {
+        putBits(1, 1);
+        putBits(Ring[Encoded & RINGMASK], 8);
+        ++Encoded;
+    }
+}
+
+void HeatshrinkEncoder::putBits(uint32_t Value, unsigned Count) {
+    while (Count > 0) {
+        --Count;
+        Bits = (uint8_t)((Bits << 1) | ((Value >> Count) & 1U));
+        if (++BitCount == 8) {
+            char Byte = (char)Bits;
+            Out.append(&Byte, 1);
+            Bits = 0;
+            BitCount = 0;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef HEATSHRINKENCODER_H
+#define HEATSHRINKENCODER_H
+/// \file
+/// \brief Compresses a request body as it is formatted, in the format of
+/// heatshrink.
+///
+/// The body is LZSS with a window of 2^HEATSHRINKWINDOW bytes and matches
+/// of up to 2^HEATSHRINKLOOKAHEAD bytes, which heatshrink's decoder takes
+/// with the same two sizes. It is a stream of bits, the highest first:
+///  - 1 and the 8 bits of a byte that is sent as it is
+///  - 0, the distance back to the match minus 1 in HEATSHRINKWINDOW bits
+///    and its length minus 1 in HEATSHRINKLOOKAHEAD bits
+///
+/// The last byte is filled up with 0 bits. The encoder is the flush
+/// function of the writer that the body is formatted into, so the body is
+/// never in RAM as a whole. Only the window and the lookahead are kept, and
+/// every match is looked for in all of the window, which is quick enough at
+/// 256 bytes.
+
+#include "RequestWriter.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The window is 2^HEATSHRINKWINDOW bytes
+#define HEATSHRINKWINDOW (8)
+
+/// A match is up to 2^HEATSHRINKLOOKAHEAD bytes
+#define HEATSHRINKLOOKAHEAD (4)
+
+/// The bytes that are kept, the window and the lookahead in a power of two
+#define HEATSHRINKRING (1U << (HEATSHRINKWINDOW + 1))
+
+class HeatshrinkEncoder {
+  public:
+    /// Compresses into Out
+    explicit HeatshrinkEncoder(RequestWriter &Out);
+
+    /// Takes the next length bytes of the body, used as a
+    /// RequestWriter::FlushCallback
+    /// \returns false if Out overflowed
+    bool push(const char *data, size_t length);
+
+    /// Compresses the bytes that wait for more to match, and writes the
+    /// last bits
+    void finish();
+
+  private:
+    /// writes a literal or a match for the byte at Encoded, with up to
+    /// Available bytes after it
+    void encodeNext(uint32_t Available);
+
+    /// writes the lowest Count bits of Value, the highest first
+    void putBits(uint32_t Value, unsigned Count);
+
+    RequestWriter &Out;
+
+    /// the body so far, at its offset modulo HEATSHRINKRING
+    uint8_t Ring[HEATSHRINKRING];
+
+    /// how many bytes came in, and how many of them were encoded
+    uint32_t Input;
+    uint32_t Encoded;
+
+    /// the bits of the byte that is not full yet
+    uint8_t Bits;
+    unsigned BitCount;
+};
+
+#endif // HEATSHRINKENCODER
@@ -0,0 +1,241 @@
+/// \file
+/// \brief Implementation of the HTTP response parser
+#include "HttpResponse.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+HttpResponse::HttpResponse(char *body, size_t size)
+    : LineLength(0), Body(body), Size(size), BodyLength(0), Truncated(false),
+      State(StatusLine), Status(0), KeepAlive(true), Chunked(false),
+      HasLength(false), Remaining(0), Date(0) {
+    Line[0] = '\0';
+    if (Size > 0) {
+        Body[0] = '\0';
+    }
+}
+
+// checks whether Line is the header Name, which is not case sensitive, and
+// returns its value without the spaces in front, or NULL
+static const char *headerValue(const char *Line, const char *Name) {
+    while (*Name != '\0') {
+        if (tolower((unsigned char)*Line) != *Name) {
+            return NULL;
+        }
+        ++Line;
+        ++Name;
+    }
+    if (*Line != ':') {
+        return NULL;
+    }
+    ++Line;
+    while (*Line == ' ' || *Line == '\t') {
+        ++Line;
+    }
+    return Line;
+}
+
+// checks whether Word is in Value, which is not case sensitive
+static bool valueHas(const char *Value, const char *Word) {
+    size_t Len = strlen(Word);
+    for (; *Value != '\0'; ++Value) {
+        size_t i = 0;
+        while (i < Len && tolower((unsigned char)Value[i]) == Word[i]) {
+            ++i;
+        }
+        if (i == Len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// reads a Date header like "Sun, 06 Nov 1994 08:49:37 GMT" into seconds
+// since 1970, or 0 if it is not in that format
+static uint32_t httpDate(const char *Value) {
+    static const char Months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int Day, Year, Hour, Minute, Second;
+    char Month[4];
+    if (sscanf(Value, "%*3s, %2d %3s %4d %2d:%2d:%2d", &Day, Month, &Year,
+               &Hour, &Minute, &Second) != 6 ||
+        Year < 1970) {
+        return 0;
+    }
+    const char *Found = strstr(Months, Month);
+    if (strlen(Month) != 3 || Found == NULL || (Found - Months) % 3 != 0) {
+        return 0;
+    }
+    int Mon = (Found - Months) / 3 + 1;
+
+    // days since 1970 of the civil date, with March as the first month so
+    // the leap day is at the end of the year
+    int Y = Mon <= 2 ? Year - 1 : Year;
+    int Era = Y / 400;
+    int YearOfEra = Y - Era * 400;
+    int DayOfYear = (153 * (Mon + (Mon > 2 ? -3 : 9)) + 2) / 5 + Day - 1;
+    int DayOfEra =
+        YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100 + DayOfYear;
+    uint32_t Days = Era * 146097 + DayOfEra - 719468;
+    return Days * 86400 + Hour * 3600 + Minute * 60 + Second;
+}
+
+bool HttpResponse::lineByte(char c) {
+    if (c != '\n') {
+        // a longer line is cut off, the start is the part that matters
+        if (LineLength < HTTPLINEMAX) {
+            Line[LineLength++] = c;
+        }
+        return false;
+    }
+    if (LineLength > 0 && Line[LineLength - 1] == '\r') {
+        --LineLength;
+    }
+    Line[LineLength] = '\0';
+    return true;
+}
+
+void HttpResponse::parseStatusLine() {
+    // "HTTP/1.1 200 OK"
+    if (strncmp(Line, "HTTP/1.", 7) != 0 || Line[8] != ' ' ||
+        !isdigit((unsigned char)Line[9])) {
+        State = Failed;
+        return;
+    }
+    // HTTP/1.0 closes the link unless the server says otherwise
+    KeepAlive = Line[7] != '0';
+    Status = atoi(Line + 9);
+    State = HeaderLine;
+}
+
+void HttpResponse::parseHeaderLine() {
+    const char *Value = headerValue(Line, "content-length");
+    if (Value != NULL) {
+        if (!isdigit((unsigned char)Value[0])) {
+            State = Failed;
+            return;
+        }
+        Remaining = strtoul(Value, NULL, 10);
+        HasLength = true;
+    } else if ((Value = headerValue(Line, "transfer-encoding")) != NULL) {
+        Chunked = valueHas(Value, "chunked");
+    } else if ((Value = headerValue(Line, "date")) != NULL) {
+        Date = httpDate(Value);
+    } else if ((Value = headerValue(Line, "connection")) != NULL) {
+        if (valueHas(Value, "close")) {
+            KeepAlive = false;
+        } else if (valueHas(Value, "keep-alive")) {
+            KeepAlive = true;
+        }
+    }
+}
+
+void HttpResponse::startBody() {
+    if (Status / 100 == 1) {
+        // 100 Continue and friends, the real response follows
+        State = StatusLine;
+        Status = 0;
+        Chunked = false;
+        HasLength = false;
+    } else if (Status == 204 || Status == 304) {
+        State = Done;
+    } else if (Chunked) {
+        State = ChunkSize;
+    } else if (HasLength) {
+        State = Remaining > 0 ? FixedBody : Done;
+    } else {
+        // the server closes the link to end the body
+        State = CloseBody;
+        KeepAlive = false;
+    }
+}
+
+void HttpResponse::keepBody(const char *data, size_t length) {
+    if (Size == 0) {
+        Truncated = Truncated || length > 0;
+        return;
+    }
+    size_t Room = Size - 1 - BodyLength;
+    if (length > Room) {
+        Truncated = true;
+        length = Room;
+    }
+    memcpy(Body + BodyLength, data, length);
+    BodyLength += length;
+    Body[BodyLength] = '\0';
+}
+
+// ============================================================================
+size_t HttpResponse::feed(const char *data, size_t length) {
+    size_t Used = 0;
+    while (Used < length && State != Done && State != Failed) {
+        if (State == FixedBody || State == ChunkData) {
+            size_t Take = length - Used;
+            if (Take > Remaining) {
+                Take = Remaining;
+            }
+            keepBody(data + Used, Take);
+            Used += Take;
+            Remaining -= Take;
+            if (Remaining == 0) {
+                State = State == FixedBody ? Done : ChunkEnd;
+            }
+            continue;
+        }
+        if (State == CloseBody) {
+            keepBody(data + Used, length - Used);
+            Used = length;
+            continue;
+        }
+
+        // everything else is read a line at a time
+        if (!lineByte(data[Used++])) {
+            continue;
+        }
+        char *End = NULL;
+        switch (State) {
+        case StatusLine:
+            parseStatusLine();
+            break;
+        case HeaderLine:
+            if (LineLength == 0) {
+                startBody();
+            } else {
+                parseHeaderLine();
+            }
+            break;
+        case ChunkSize:
+            // the size may be followed by ";extensions"
+            Remaining = strtoul(Line, &End, 16);
+            if (End == Line) {
+                State = Failed;
+            } else {
+                State = Remaining > 0 ? ChunkData : TrailerLine;
+            }
+            break;
+        case ChunkEnd:
+            State = LineLength == 0 ? ChunkSize : Failed;
+            break;
+        case TrailerLine:
+            if (LineLength == 0) {
+                State = Done;
+            }
+            break;
+        default:
+            break;
+        }
+        LineLength = 0;
+    }
+    return Used;
+}
+
+// ============================================================================
+void HttpResponse::closed() {
+    if (State == CloseBody) {
+        State = Done;
+    } else if (State != Done) {
+        State = Failed;
+    }
+    KeepAlive = false;
+}
@@ -0,0 +1,98 @@
+#ifndef HTTPRESPONSE_H
+#define HTTPRESPONSE_H
+/// \file
+/// \brief Parses an HTTP/1.1 response as its bytes come in from the ESP8266.
+
+#include <cstddef>
+#include <cstdint>
+
+/// The longest status or header line that is looked at, the rest of a
+/// longer line is skipped
+#define HTTPLINEMAX (128)
+
+/// Takes a response in pieces of any size, and knows from the status line,
+/// Content-Length or the chunk sizes when the whole response is there. Only
+/// the first bytes of the body are kept, in a buffer owned by the caller,
+/// the rest is counted and dropped.
+class HttpResponse {
+  public:
+    /// \param body Where the body goes. It is always kept '\0' terminated
+    /// \param size The size of body in bytes, including the '\0'
+    HttpResponse(char *body, size_t size);
+
+    /// Parses the next length bytes of the response.
+    /// \returns how many of them belong to this response, which is less than
+    /// length once it is complete
+    size_t feed(const char *data, size_t length);
+
+    /// Tells the parser that the server closed the link. A body without a
+    /// length ends here, any other response that is not complete failed.
+    void closed();
+
+    /// Returns true once the whole response was parsed
+    bool complete() const { return State == Done; }
+
+    /// Returns true if the response is not valid HTTP, or was cut short
+    bool failed() const { return State == Failed; }
+
+    /// Returns the status code, or 0 before the status line was parsed
+    int status() const { return Status; }
+
+    /// Returns false if the server closes the link after this response
+    bool keepAlive() const { return KeepAlive; }
+
+    /// Returns the start of the body, '\0' terminated
+    const char *body() const { return Body; }
+
+    /// Returns the number of body bytes that were kept
+    size_t bodyLength() const { return BodyLength; }
+
+    /// Returns true if the body did not fit into the buffer
+    bool truncated() const { return Truncated; }
+
+    /// Returns the time of the Date header in seconds since 1970, or 0 if
+    /// there was none that could be read
+    uint32_t date() const { return Date; }
+
+  private:
+    enum ParseState {
+        StatusLine,  ///< waiting for "HTTP/1.x nnn reason"
+        HeaderLine,  ///< a header, or the empty line that ends them
+        FixedBody,   ///< Remaining bytes of a Content-Length body
+        CloseBody,   ///< a body that ends when the link is closed
+        ChunkSize,   ///< the hex size line of the next chunk
+        ChunkData,   ///< Remaining bytes of the chunk
+        ChunkEnd,    ///< the CRLF after a chunk
+        TrailerLine, ///< trailers after the last chunk
+        Done,
+        Failed
+    };
+
+    /// adds one byte of a line, returns true once the line is complete
+    bool lineByte(char c);
+    void parseStatusLine();
+    void parseHeaderLine();
+    void startBody();
+    void keepBody(const char *data, size_t length);
+
+    char Line[HTTPLINEMAX + 1];
+    size_t LineLength;
+
+    char *Body;
+    size_t Size;
+    size_t BodyLength;
+    bool Truncated;
+
+    ParseState State;
+    int Status;
+    bool KeepAlive;
+    bool Chunked;
+    bool HasLength;
+
+    /// bytes left of a Content-Length body or a chunk
+    uint32_t Remaining;
+
+    uint32_t Date;
+};
+
+#endif // HTTPRESPONSE
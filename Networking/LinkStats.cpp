@@ -0,0 +1,135 @@
+/// \file
+/// \brief Implementation of the link counters
+#define TRACE_GROUP "net"
+#include "LinkStats.h"
+
+#if LINKSTATS
+
+#include "DeferredLog.h"
+#include "platform/mbed_critical.h"
+
+/// The counters of one window
+struct LinkWindow {
+    uint32_t Sent;
+    uint32_t Received;
+    uint32_t Connects;
+    uint32_t ConnectFails;
+    uint32_t Requests;
+    uint32_t Unanswered;
+    uint32_t Retries;
+    uint32_t Rtt[LINKRTTBUCKETS];
+};
+
+static const uint32_t RttBounds[LINKRTTBUCKETS - 1] = LINKRTTBOUNDS;
+
+/// the window that counts now, only changed in a critical section. The
+/// LoRaWAN stack and the ESP8266's messages count from other threads
+static LinkWindow Current;
+
+/// the window that ended, and whether the server has it
+static LinkWindow Ended;
+static bool EndedWaiting = false;
+
+/// when the window started, from Kernel::get_ms_count()
+static uint64_t WindowMs = 0;
+
+/// when the request on each link was written, 0 if none waits
+static uint64_t RequestMs[LINKSTATSLINKS];
+
+// adds Count to Counter
+static void add(uint32_t &Counter, uint32_t Count) {
+    core_util_critical_section_enter();
+    Counter += Count;
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void linkConnected(bool Worked) {
+    add(Current.Connects, 1);
+    if (!Worked) {
+        add(Current.ConnectFails, 1);
+    }
+}
+
+// ============================================================================
+void linkSent(size_t Bytes) { add(Current.Sent, Bytes); }
+
+// ============================================================================
+void linkReceived(size_t Bytes) { add(Current.Received, Bytes); }
+
+// ============================================================================
+void linkRetried(uint32_t Count) { add(Current.Retries, Count); }
+
+// ============================================================================
+void linkRequestSent(int Link) {
+    if (Link >= 0 && Link < LINKSTATSLINKS) {
+        RequestMs[Link] = Kernel::get_ms_count();
+    }
+}
+
+// ============================================================================
+void linkRequestDone(int Link, bool Answered) {
+    add(Current.Requests, 1);
+    if (!Answered) {
+        add(Current.Unanswered, 1);
+    }
+    if (Link < 0 || Link >= LINKSTATSLINKS || RequestMs[Link] == 0) {
+        return;
+    }
+    if (Answered) {
+        uint64_t Took = Kernel::get_ms_count() - RequestMs[Link];
+        size_t Bucket = 0;
+        while (Bucket < LINKRTTBUCKETS - 1 && Took >= RttBounds[Bucket]) {
+            ++Bucket;
+        }
+        add(Current.Rtt[Bucket], 1);
+    }
+    RequestMs[Link] = 0;
+}
+
+// ============================================================================
+void linkStatsRoll() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (WindowMs == 0) {
+        WindowMs = Now;
+    }
+    if (Now - WindowMs < LINKSTATSWINDOWMS) {
+        return;
+    }
+    WindowMs = Now;
+
+    core_util_critical_section_enter();
+    Ended = Current;
+    memset(&Current, 0, sizeof(Current));
+    core_util_critical_section_exit();
+    EndedWaiting = true;
+    tr_info("Links: %lu B out, %lu B in, %lu/%lu connects failed, "
+            "%lu/%lu requests unanswered, %lu sent again",
+            (unsigned long)Ended.Sent, (unsigned long)Ended.Received,
+            (unsigned long)Ended.ConnectFails, (unsigned long)Ended.Connects,
+            (unsigned long)Ended.Unanswered, (unsigned long)Ended.Requests,
+            (unsigned long)Ended.Retries);
+}
+
+// ============================================================================
+bool linkStatsWindow(uint32_t (&Values)[LINKVALUES]) {
+    if (!EndedWaiting) {
+        return false;
+    }
+    Values[0] = Ended.Sent;
+    Values[1] = Ended.Received;
+    Values[2] = Ended.Connects;
+    Values[3] = Ended.ConnectFails;
+    Values[4] = Ended.Requests;
+    Values[5] = Ended.Unanswered;
+    Values[6] = Ended.Retries;
+    for (size_t i = 0; i < LINKRTTBUCKETS; ++i) {
+        Values[7 + i] = Ended.Rtt[i];
+    }
+    return true;
+}
+
+// ============================================================================
+void linkStatsSent() { EndedWaiting = false; }
+
+#endif // LINKSTATS
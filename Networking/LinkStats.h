@@ -0,0 +1,106 @@
+#ifndef LINKSTATS_H
+#define LINKSTATS_H
+/// \file
+/// \brief How the links to the server did over the last window, counted the
+/// same way for every backend and sent with the readings.
+///
+/// mbed-os's SocketStats only sees sockets, and the raw AT backend has none.
+/// These counters sit where Networking.cpp opens the links, writes the
+/// requests and takes the responses, which is the same for the AT commands
+/// and for every socket backend, and LoraUplink.cpp counts its uplinks the
+/// same way. The bytes received are counted where each backend takes them
+/// in. Every LINKSTATSWINDOWMS linkStatsRoll() keeps the window that ended
+/// and starts a new one. The window that ended goes out with the requests as
+/// &Link=, or as "l" in a CBOR body, until one of them was answered, with
+/// the LINKVALUES values in this order:
+/// - the bytes sent and received
+/// - the connects, and how many of them failed
+/// - the requests, and how many of them got no response
+/// - the requests that were sent again, on a new link or by the LoRaWAN
+///   stack
+/// - how many responses came within each of the LINKRTTBOUNDS times after
+///   their request was written, and how many came later
+///
+/// A site whose failures or round trips go up shows it before its backlog
+/// does. Set with "link-stats" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to send the link counters with the readings. Set with
+/// "link-stats" in mbed_app.json.
+#ifdef MBED_CONF_APP_LINK_STATS
+#define LINKSTATS MBED_CONF_APP_LINK_STATS
+#else
+#define LINKSTATS 0
+#endif
+
+/// How long one window counts, in milliseconds
+#define LINKSTATSWINDOWMS (600000)
+
+/// The upper bounds of the round trip buckets, in milliseconds, the last
+/// bucket is for the ones after them
+#define LINKRTTBOUNDS {100, 250, 500, 1000, 2500, 5000, 10000}
+
+/// The number of round trip buckets
+#define LINKRTTBUCKETS (8)
+
+/// The number of values of a window
+#define LINKVALUES (7 + LINKRTTBUCKETS)
+
+/// The most links that are timed apart
+#define LINKSTATSLINKS (4)
+
+#if LINKSTATS
+
+/// Counts a connect to the server, and whether it worked
+void linkConnected(bool Worked);
+
+/// Counts Bytes that were sent
+void linkSent(size_t Bytes);
+
+/// Counts Bytes that came in from the server
+void linkReceived(size_t Bytes);
+
+/// Counts Count requests that were sent again
+void linkRetried(uint32_t Count);
+
+/// Marks the request on Link as written, its round trip starts now
+void linkRequestSent(int Link);
+
+/// Counts the request on Link, and times its round trip if it was Answered
+void linkRequestDone(int Link, bool Answered);
+
+/// Keeps the window once LINKSTATSWINDOWMS have passed, and starts the
+/// next one. Only the uploader thread calls this
+void linkStatsRoll();
+
+/// Copies the values of the window that ended into Values, in the order
+/// they are sent. Returns false if there is none, or it was sent
+bool linkStatsWindow(uint32_t (&Values)[LINKVALUES]);
+
+/// Drops the window that ended once the server has it
+void linkStatsSent();
+
+#else
+
+inline void linkConnected(bool Worked) {}
+
+inline void linkSent(size_t Bytes) {}
+
+inline void linkReceived(size_t Bytes) {}
+
+inline void linkRetried(uint32_t Count) {}
+
+inline void linkRequestSent(int Link) {}
+
+inline void linkRequestDone(int Link, bool Answered) {}
+
+inline void linkStatsRoll() {}
+
+inline bool linkStatsWindow(uint32_t (&Values)[LINKVALUES]) { return false; }
+
+inline void linkStatsSent() {}
+
+#endif // LINKSTATS
+
+#endif // LINKSTATS
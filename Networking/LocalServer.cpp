@@ -0,0 +1,247 @@
+/// \file
+/// \brief Implementation of the local server
+#define TRACE_GROUP "local"
+#include "LocalServer.h"
+
+#include "DeferredLog.h"
+
+#if LOCALSERVER
+
+#include "NetworkBackend.h"
+
+#include <cstring>
+
+/// how long the thread waits before it tries to listen again, while the
+/// Ethernet port is down, in milliseconds
+#define LOCALSERVERRETRYMS (1000)
+
+/// the flag of Fresh that publish() sets
+#define LOCALSERVERFRESH (1U)
+
+// writes Value into Out little endian, in Size bytes
+static void putLittle(uint8_t *Out, uint32_t Value, size_t Size) {
+    for (size_t i = 0; i < Size; ++i) {
+        Out[i] = (Value >> (8 * i)) & 0xFF;
+    }
+}
+
+LocalServer::LocalServer()
+    : Server(osPriorityBelowNormal, LOCALSERVERSTACKSIZE, NULL, "local"),
+      Listening(false), Published(0), Sent(0) {
+    for (size_t i = 0; i < LOCALSERVERCLIENTS; ++i) {
+        Clients[i] = NULL;
+        Subscribed[i] = false;
+    }
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Multipliers[i] = 1.0f;
+    }
+    Latest.clear();
+}
+
+LocalServer::~LocalServer() {
+    Server.terminate();
+    for (size_t i = 0; i < LOCALSERVERCLIENTS; ++i) {
+        if (Clients[i] != NULL) {
+            drop(i);
+        }
+    }
+    Listener.close();
+}
+
+// ============================================================================
+void LocalServer::configure(const vector<PortInfo> &Ports) {
+    Lock.lock();
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Multipliers[i] = i < Ports.size() ? Ports[i].Multiplier : 1.0f;
+    }
+    Lock.unlock();
+}
+
+// ============================================================================
+int LocalServer::start() {
+    if (Server.get_state() != Thread::Deleted) {
+        return LOCALSERVERSUCCESS;
+    }
+    if (Server.start(callback(this, &LocalServer::run)) != osOK) {
+        return -1;
+    }
+    return LOCALSERVERSUCCESS;
+}
+
+// ============================================================================
+void LocalServer::publish(const SampleFrame &Frame) {
+    Lock.lock();
+    Latest = Frame;
+    ++Published;
+    Lock.unlock();
+    Fresh.set(LOCALSERVERFRESH);
+}
+
+void LocalServer::run() {
+    uint32_t Pushed = 0;
+    float Scale[FRAMEMAXPORTS];
+    SampleFrame Frame;
+    while (true) {
+        if (!Listening && !listen()) {
+            ThisThread::sleep_for(LOCALSERVERRETRYMS);
+            continue;
+        }
+        accept();
+
+        // wakes as soon as a frame is published, and every
+        // LOCALSERVERPOLLMS for the clients that came in or asked
+        Fresh.wait_any(LOCALSERVERFRESH, LOCALSERVERPOLLMS);
+        Lock.lock();
+        Frame = Latest;
+        uint32_t Count = Published;
+        memcpy(Scale, Multipliers, sizeof(Scale));
+        Lock.unlock();
+        bool New = Count != Pushed;
+        Pushed = Count;
+
+        // the packet is built once, for all of the clients
+        size_t Length = 0;
+        for (size_t i = 0; i < LOCALSERVERCLIENTS; ++i) {
+            if (Clients[i] == NULL) {
+                continue;
+            }
+            bool Asked = readRequests(i);
+            if (Clients[i] == NULL || Count == 0 ||
+                !(Asked || (New && Subscribed[i]))) {
+                continue;
+            }
+            if (Length == 0) {
+                Length = pack(Frame, Scale);
+            }
+            send(i, Length);
+        }
+    }
+}
+
+bool LocalServer::listen() {
+    NetworkInterface *Net = wiredInterface();
+    nsapi_connection_status_t Status = Net->get_connection_status();
+    if (Status != NSAPI_STATUS_GLOBAL_UP && Status != NSAPI_STATUS_LOCAL_UP) {
+        return false;
+    }
+    nsapi_error_t err = Listener.open(Net);
+    if (err == NSAPI_ERROR_OK) {
+        err = Listener.bind(LOCALSERVERPORT);
+    }
+    if (err == NSAPI_ERROR_OK) {
+        err = Listener.listen(LOCALSERVERCLIENTS);
+    }
+    if (err != NSAPI_ERROR_OK) {
+        tr_warn("Could not listen on port %d (%d)", LOCALSERVERPORT, err);
+        Listener.close();
+        return false;
+    }
+    // accept() only takes the clients that are already waiting
+    Listener.set_blocking(false);
+    Listening = true;
+    tr_info("Listening for local clients on port %d", LOCALSERVERPORT);
+    return true;
+}
+
+void LocalServer::accept() {
+    nsapi_error_t err;
+    TCPSocket *Client = Listener.accept(&err);
+    if (Client == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < LOCALSERVERCLIENTS; ++i) {
+        if (Clients[i] == NULL) {
+            Client->set_blocking(false);
+            Clients[i] = Client;
+            Subscribed[i] = false;
+            return;
+        }
+    }
+    tr_warn("Too many local clients, one was closed");
+    // an accepted socket deletes itself when it is closed
+    Client->close();
+}
+
+bool LocalServer::readRequests(size_t i) {
+    bool Asked = false;
+    uint8_t Requests[8];
+    nsapi_size_or_error_t Got;
+    while ((Got = Clients[i]->recv(Requests, sizeof(Requests))) > 0) {
+        for (nsapi_size_or_error_t r = 0; r < Got; ++r) {
+            if (Requests[r] == 'G') {
+                Asked = true;
+            } else if (Requests[r] == 'S') {
+                Subscribed[i] = true;
+                Asked = true;
+            } else if (Requests[r] == 'U') {
+                Subscribed[i] = false;
+            }
+        }
+    }
+    // 0 is the client closing its end
+    if (Got != NSAPI_ERROR_WOULD_BLOCK) {
+        drop(i);
+        return false;
+    }
+    return Asked;
+}
+
+size_t LocalServer::pack(const SampleFrame &Frame, const float *Scale) {
+    Packet[0] = 0xA5;
+    Packet[1] = 0x5C;
+    Packet[2] = LOCALSERVERVERSION;
+    Packet[3] = Frame.Kind;
+    putLittle(Packet + 4, Frame.Count, 2);
+    putLittle(Packet + 6, Frame.PortMask, 2);
+    putLittle(Packet + 8, Frame.OverMask, 2);
+    putLittle(Packet + 10, Frame.UnderMask, 2);
+    putLittle(Packet + 12, Frame.Sequence, 4);
+    putLittle(Packet + 16, Frame.Timestamp, 4);
+
+    uint8_t *Out = Packet + LOCALSERVERHEADER;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (Frame.hasPort(i)) {
+            float Value = Frame.value(i, Scale[i]);
+            uint32_t Bits;
+            memcpy(&Bits, &Value, sizeof(Bits));
+            putLittle(Out, Bits, 4);
+            Out += 4;
+        }
+    }
+
+    size_t Length = Out - Packet;
+    uint32_t Sum = 0;
+    Crc.compute(Packet, Length, &Sum);
+    putLittle(Out, Sum, 2);
+    return Length + 2;
+}
+
+void LocalServer::send(size_t i, size_t Length) {
+    // the socket does not block, so a packet that only went out in part
+    // is finished until LOCALSERVERSENDMS ran out
+    uint64_t Start = Kernel::get_ms_count();
+    size_t Done = 0;
+    while (Done < Length) {
+        nsapi_size_or_error_t Put =
+            Clients[i]->send(Packet + Done, Length - Done);
+        if (Put > 0) {
+            Done += Put;
+        } else if (Put != NSAPI_ERROR_WOULD_BLOCK ||
+                   Kernel::get_ms_count() - Start >= LOCALSERVERSENDMS) {
+            tr_warn("A local client did not take its packet, closing it");
+            drop(i);
+            return;
+        } else {
+            ThisThread::sleep_for(1);
+        }
+    }
+    ++Sent;
+}
+
+void LocalServer::drop(size_t i) {
+    Clients[i]->close();
+    Clients[i] = NULL;
+    Subscribed[i] = false;
+}
+
+#endif // LOCALSERVER
@@ -0,0 +1,165 @@
+#ifndef LOCALSERVER_H
+#define LOCALSERVER_H
+/// \file
+/// \brief A TCP server on the site's network that gives the latest readings
+/// to a SCADA system on site, and pushes every new one to the clients that
+/// subscribed.
+///
+/// The readings used to reach on-site operators only through the remote
+/// server, seconds after they were taken. With LOCALSERVER the board
+/// listens on LOCALSERVERPORT of its Ethernet port for up to
+/// LOCALSERVERCLIENTS clients. The sampling loop publishes every frame to a
+/// snapshot as it is taken, before the deadband, which costs it a copy, and
+/// the server's thread sends it to the subscribers right away. Nothing is
+/// read from the SD card, the clients only ever get the latest frame.
+///
+/// A client sends single bytes:
+///  - 'G' for the latest frame, once
+///  - 'S' to get every new frame from now on, and the latest one right away
+///  - 'U' to stop getting them
+///
+/// Every frame is sent as a packet, little endian:
+///  - 0xA5 0x5C, then the version, LOCALSERVERVERSION
+///  - the FrameKind, one byte
+///  - how many readings a summary was made of, two bytes, 0 for one reading
+///  - the PortMask, OverMask and UnderMask of the frame, two bytes each
+///  - the frame's sequence number, four bytes, and its timestamp, four
+///  - the value of every port in PortMask in the port's unit, a 32-bit
+///    float each, in port order. Out of range ones are infinite
+///  - the CRC-16/CCITT-FALSE of everything before it, two bytes
+///
+/// A client that does not take a packet within LOCALSERVERSENDMS is closed,
+/// so a slow one never holds the others up. The ESP8266 driver can not
+/// listen for connections, so the server needs NETWORKETHERNET.
+
+#include "mbed.h"
+
+#include "MbedCRC.h"
+#include "Networking.h"
+#include "TCPSocket.h"
+
+/// Set to 1 for the local server. Set with "local-server" in mbed_app.json.
+#ifdef MBED_CONF_APP_LOCAL_SERVER
+#define LOCALSERVER MBED_CONF_APP_LOCAL_SERVER
+#else
+#define LOCALSERVER (0)
+#endif
+
+#if LOCALSERVER && !NETWORKETHERNET
+#error "local-server needs ethernet, the ESP8266 can not take connections"
+#endif
+
+/// The TCP port the server listens on.
+/// Set with "local-server-port" in mbed_app.json.
+#ifdef MBED_CONF_APP_LOCAL_SERVER_PORT
+#define LOCALSERVERPORT MBED_CONF_APP_LOCAL_SERVER_PORT
+#else
+#define LOCALSERVERPORT (5020)
+#endif
+
+/// The most clients at once, one more is closed as soon as it connects
+#define LOCALSERVERCLIENTS (4)
+
+/// The layout of the packets
+#define LOCALSERVERVERSION (1)
+
+/// How long a packet may take to be sent to a client, in milliseconds
+#define LOCALSERVERSENDMS (50)
+
+/// How often the thread takes new clients and their requests while no
+/// frame comes in, in milliseconds
+#define LOCALSERVERPOLLMS (20)
+
+/// the bytes in front of the values of a packet
+#define LOCALSERVERHEADER (20)
+
+/// the longest packet, the header, a value of every port and the CRC
+#define LOCALSERVERPACKETMAX (LOCALSERVERHEADER + FRAMEMAXPORTS * 4 + 2)
+
+/// the stack size of the server's thread, the packet is a member.
+/// Set with "local-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_LOCAL_STACK_SIZE
+#define LOCALSERVERSTACKSIZE MBED_CONF_APP_LOCAL_STACK_SIZE
+#else
+#define LOCALSERVERSTACKSIZE (1536)
+#endif
+
+/// a constant value that is returned from server functions upon success
+#define LOCALSERVERSUCCESS (0)
+
+class LocalServer {
+  public:
+    LocalServer();
+
+    ~LocalServer();
+
+    /// Takes the multipliers of Ports, the values of the packets are
+    /// scaled with them. Called again when the ports change
+    void configure(const vector<PortInfo> &Ports);
+
+    /// Starts the thread. It waits for the Ethernet port to come up before
+    /// it listens
+    /// \returns LOCALSERVERSUCCESS, or a negative integer if the thread did
+    /// not start
+    int start();
+
+    /// Makes Frame the latest frame and wakes the thread to push it. Called
+    /// from the sampling loop, it only copies the frame
+    void publish(const SampleFrame &Frame);
+
+    /// Returns the number of packets that were sent
+    uint32_t packets() const { return Sent; }
+
+  private:
+    /// listens, takes the clients and their requests, and pushes the
+    /// frames
+    void run();
+
+    /// opens the listening socket on the Ethernet port
+    /// \returns true if it listens
+    bool listen();
+
+    /// takes a waiting client, if there is room for it
+    void accept();
+
+    /// reads the requests of client i
+    /// \returns true if the client asked for the latest frame
+    bool readRequests(size_t i);
+
+    /// puts Frame into Packet, with the values scaled by the FRAMEMAXPORTS
+    /// multipliers of Scale
+    /// \returns the length of the packet
+    size_t pack(const SampleFrame &Frame, const float *Scale);
+
+    /// sends the Length bytes of Packet to client i, and closes it if they
+    /// did not go out
+    void send(size_t i, size_t Length);
+
+    /// closes client i
+    void drop(size_t i);
+
+    Thread Server;
+
+    TCPSocket Listener;
+    bool Listening;
+
+    TCPSocket *Clients[LOCALSERVERCLIENTS];
+    bool Subscribed[LOCALSERVERCLIENTS];
+
+    /// the latest frame and how many were published, under Lock
+    Mutex Lock;
+    SampleFrame Latest;
+    uint32_t Published;
+    float Multipliers[FRAMEMAXPORTS];
+
+    /// set by publish()
+    EventFlags Fresh;
+
+    uint32_t Sent;
+
+    uint8_t Packet[LOCALSERVERPACKETMAX];
+
+    MbedCRC<POLY_16BIT_CCITT, 16> Crc;
+};
+
+#endif // LOCALSERVER
@@ -0,0 +1,209 @@
+/// \file
+/// \brief Implementation of the LoRaWAN uplink packer
+#include "LoraPacker.h"
+
+#include "FrameCodec.h"
+
+#include <cstring>
+
+BitWriter::BitWriter(uint8_t *Out, size_t Size)
+    : Out(Out), Size(Size), Bits(0) {}
+
+// ============================================================================
+bool BitWriter::put(uint32_t Value, unsigned Width) {
+    if (Bits + Width > Size * 8) {
+        return false;
+    }
+    for (unsigned i = Width; i > 0; --i) {
+        if (Bits % 8 == 0) {
+            Out[Bits / 8] = 0;
+        }
+        if ((Value >> (i - 1)) & 1U) {
+            Out[Bits / 8] |= 0x80 >> (Bits % 8);
+        }
+        ++Bits;
+    }
+    return true;
+}
+
+// the number of bits that Value needs
+static unsigned bitsFor(uint32_t Value) {
+    unsigned Bits = 0;
+    while (Value != 0) {
+        ++Bits;
+        Value >>= 1;
+    }
+    return Bits;
+}
+
+// the ports of Frame that are configured
+static uint16_t packedPorts(const SampleFrame &Frame, size_t Ports) {
+    uint16_t Configured = Ports >= 16 ? 0xFFFF : (1U << Ports) - 1;
+    return Frame.PortMask & Configured;
+}
+
+// Raw as a value of Resolution bits
+static uint32_t quantize(uint16_t Raw, unsigned Resolution) {
+    uint32_t Top = (1UL << Resolution) - 1;
+    return ((uint32_t)Raw * Top + 0x7FFF) / 0xFFFF;
+}
+
+LoraPacker::LoraPacker() : Bits(0), Packed(0), Ports(0) {}
+
+// ============================================================================
+size_t LoraPacker::pack(const SampleFrame *Frames, size_t Count,
+                        Span<const PortInfo> Table, uint32_t Version,
+                        size_t Size) {
+    Ports = (size_t)Table.size() < FRAMEMAXPORTS ? (size_t)Table.size()
+                                                 : FRAMEMAXPORTS;
+    for (size_t i = 0; i < Ports; ++i) {
+        unsigned Bits = Table[i].Resolution;
+        Resolution[i] = Bits < 1 ? 1 : Bits > 16 ? 16 : Bits;
+    }
+    Count = Count < LORAFRAMESMAX ? Count : LORAFRAMESMAX;
+    Size = Size < LORAPAYLOADMAX ? Size : LORAPAYLOADMAX;
+    Bits = 0;
+    Packed = 0;
+    if (Count == 0) {
+        return 0;
+    }
+
+    pickWidths(Frames, Count);
+    size_t Fit = write(Frames, Count, Version, Size);
+
+    // the frames that did not fit may have made the widths wider, so the
+    // ones that did are packed again without them
+    if (Fit > 0 && Fit < Count) {
+        pickWidths(Frames, Fit);
+        write(Frames, Fit, Version, Size);
+    }
+    return Packed;
+}
+
+// ============================================================================
+size_t LoraPacker::framesIn(size_t Bytes) const {
+    size_t Frames = 0;
+    while (Frames < Packed && Ends[Frames] <= Bytes * 8) {
+        ++Frames;
+    }
+    return Frames;
+}
+
+void LoraPacker::pickWidths(const SampleFrame *Frames, size_t Count) {
+    uint32_t Largest[FRAMEMAXPORTS] = {0};
+    uint32_t Last[FRAMEMAXPORTS] = {0};
+    bool Seen[FRAMEMAXPORTS] = {false};
+    for (size_t f = 0; f < Count; ++f) {
+        const SampleFrame &Frame = Frames[f];
+        uint16_t Mask = packedPorts(Frame, Ports) &
+                        ~(Frame.OverMask | Frame.UnderMask);
+        for (size_t i = 0; i < Ports; ++i) {
+            if (((Mask >> i) & 1U) == 0) {
+                continue;
+            }
+            uint32_t Value = quantize(Frame.Raw[i], Resolution[i]);
+            if (Seen[i]) {
+                uint32_t Step = zigzag((int32_t)(Value - Last[i]));
+                Largest[i] = Step > Largest[i] ? Step : Largest[i];
+            }
+            Last[i] = Value;
+            Seen[i] = true;
+        }
+    }
+
+    // a difference as wide as the value itself gains nothing
+    for (size_t i = 0; i < Ports; ++i) {
+        unsigned Width = bitsFor(Largest[i]);
+        Widths[i] = Width >= LORAABSOLUTE || Width >= Resolution[i]
+                        ? LORAABSOLUTE
+                        : Width;
+    }
+}
+
+size_t LoraPacker::write(const SampleFrame *Frames, size_t Count,
+                         uint32_t Version, size_t Size) {
+    BitWriter Out(Data, Size);
+    Bits = 0;
+    Packed = 0;
+    bool Fits = Out.put(LORAFORMAT, 8) && Out.put(Version & 0xFFFF, 16) &&
+                Out.put(Ports, 8) && Out.put(Frames[0].Timestamp, 32);
+    for (size_t i = 0; i < Ports && Fits; ++i) {
+        Fits = Out.put(Widths[i], 4);
+    }
+    if (!Fits) {
+        return 0;
+    }
+    size_t Header = Out.bits();
+
+    uint32_t LastTime = Frames[0].Timestamp;
+    int32_t LastStep = 0;
+    uint16_t LastMask = 0;
+    uint32_t Last[FRAMEMAXPORTS] = {0};
+    bool Seen[FRAMEMAXPORTS] = {false};
+    for (size_t f = 0; f < Count && Fits; ++f) {
+        const SampleFrame &Frame = Frames[f];
+        uint16_t Mask = packedPorts(Frame, Ports);
+        uint16_t Over = Frame.OverMask & Mask;
+        uint16_t Under = Frame.UnderMask & Mask;
+        Fits = Out.put(1, 1);
+
+        int32_t Step = (int32_t)(Frame.Timestamp - LastTime);
+        if (Step == LastStep) {
+            Fits = Fits && Out.put(LORASTEPSAME, 2);
+        } else {
+            uint32_t Zigzag = zigzag(Step);
+            unsigned Width = Zigzag < 0x100 ? 8 : Zigzag < 0x10000 ? 16 : 32;
+            unsigned Kind = Width == 8 ? LORASTEP8
+                                       : Width == 16 ? LORASTEP16 : LORASTEP32;
+            Fits = Fits && Out.put(Kind, 2) && Out.put(Zigzag, Width);
+        }
+        LastTime = Frame.Timestamp;
+        LastStep = Step;
+
+        if (Mask != LastMask) {
+            Fits = Fits && Out.put(1, 1) && Out.put(Mask, Ports);
+        } else {
+            Fits = Fits && Out.put(0, 1);
+        }
+        LastMask = Mask;
+        if (Over != 0 || Under != 0) {
+            Fits = Fits && Out.put(1, 1) && Out.put(Over, Ports) &&
+                   Out.put(Under, Ports);
+        } else {
+            Fits = Fits && Out.put(0, 1);
+        }
+        if (Frame.Kind != FrameReading) {
+            Fits = Fits && Out.put(1, 1) && Out.put(Frame.Kind, 3) &&
+                   Out.put(Frame.Count, 16);
+        } else {
+            Fits = Fits && Out.put(0, 1);
+        }
+
+        // a port that is out of range has no value
+        uint16_t Valued = Mask & ~(Over | Under);
+        for (size_t i = 0; i < Ports && Fits; ++i) {
+            if (((Valued >> i) & 1U) == 0) {
+                continue;
+            }
+            uint32_t Value = quantize(Frame.Raw[i], Resolution[i]);
+            if (!Seen[i] || Widths[i] == LORAABSOLUTE) {
+                Fits = Out.put(Value, Resolution[i]);
+            } else {
+                Fits = Out.put(zigzag((int32_t)(Value - Last[i])), Widths[i]);
+            }
+            Last[i] = Value;
+            Seen[i] = true;
+        }
+        if (Fits) {
+            Ends[Packed++] = Out.bits();
+        }
+    }
+
+    // the frame that did not fit is cut off, what is left of its last byte
+    // has to be the 0 bits of the end
+    Bits = Packed > 0 ? Ends[Packed - 1] : Header;
+    if (Bits % 8 != 0) {
+        Data[Bits / 8] &= (uint8_t)(0xFF << (8 - Bits % 8));
+    }
+    return Packed;
+}
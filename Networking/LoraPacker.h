@@ -0,0 +1,127 @@
+#ifndef LORAPACKER_H
+#define LORAPACKER_H
+/// \file
+/// \brief Packs a run of sample frames bit by bit into one LoRaWAN uplink.
+///
+/// A LoRaWAN uplink has 51 bytes at the slowest data rate and 222 at the
+/// fastest, so the readings are packed much closer than FrameCodec.h does.
+/// Every reading is quantized to the Resolution of its port, the bits the
+/// ADC really converts. A port's first value in the uplink is written with
+/// all of those bits, every later one as the zig-zag difference to the one
+/// before it, in a width that is picked for each port and uplink from its
+/// largest difference.
+///
+/// The bits are written high bit first, and the uplink is:
+///  - 8 bits of LORAFORMAT
+///  - the low 16 bits of the config version, the port table of that
+///    version goes out on LORATABLEPORT, see LoraUplink.h
+///  - 8 bits of the number of ports N that the masks have
+///  - 32 bits of the time of the first frame
+///  - 4 bits of the difference width of every port, or LORAABSOLUTE if
+///    every value of the port has all of its bits
+///  - the frames, each after a 1 bit. The uplink ends with 0 bits, or where
+///    the bytes run out in the middle of a frame, which is then dropped
+///
+/// Each frame is:
+///  - 2 bits for the time step to the frame before it: LORASTEPSAME for the
+///    same step as the last one, which starts as 0, or LORASTEP8, LORASTEP16
+///    or LORASTEP32 for a zig-zag step of that many bits that follows
+///  - 1 bit, set if N bits of the port mask follow, else it is the last one,
+///    which starts empty
+///  - 1 bit, set if N bits of the over range mask and N of the under range
+///    mask follow, else both are empty
+///  - 1 bit, set if 3 bits of the kind and 16 bits of the count follow,
+///    else it is a FrameReading
+///  - the value of every port in the mask that is not out of range
+///
+/// A value v of a port with a Resolution of R bits is the reading
+/// v / (2^R - 1) of full scale.
+
+#include "Structs.h"
+#include "platform/Span.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The version of the uplink's layout
+#define LORAFORMAT (1)
+
+/// The longest uplink of any region, US915 at DR4
+#define LORAPAYLOADMAX (242)
+
+/// The most frames in one uplink
+#define LORAFRAMESMAX (32)
+
+/// The width of a port whose values all have all of their bits
+#define LORAABSOLUTE (15)
+
+/// How a frame's time step is written
+#define LORASTEPSAME (0)
+#define LORASTEP8 (1)
+#define LORASTEP16 (2)
+#define LORASTEP32 (3)
+
+/// Writes values of any width up to 32 bits into a buffer, high bit first
+class BitWriter {
+  public:
+    BitWriter(uint8_t *Out, size_t Size);
+
+    /// Writes the low Width bits of Value
+    /// \returns false if they did not fit, nothing is written then
+    bool put(uint32_t Value, unsigned Width);
+
+    /// Returns how many bits were written
+    size_t bits() const { return Bits; }
+
+    /// Returns how many bytes the bits take, the last one padded with 0 bits
+    size_t bytes() const { return (Bits + 7) / 8; }
+
+  private:
+    uint8_t *Out;
+    size_t Size;
+    size_t Bits;
+};
+
+class LoraPacker {
+  public:
+    LoraPacker();
+
+    /// Packs as many of the Count frames as fit into Size bytes, at most
+    /// LORAFRAMESMAX and LORAPAYLOADMAX bytes
+    /// \returns how many of them were packed
+    size_t pack(const SampleFrame *Frames, size_t Count,
+                Span<const PortInfo> Ports, uint32_t Version, size_t Size);
+
+    /// Returns the packed uplink
+    const uint8_t *data() const { return Data; }
+
+    /// Returns how many bytes the packed uplink has
+    size_t length() const { return (Bits + 7) / 8; }
+
+    /// Returns how many of the packed frames are whole in the first Bytes
+    /// bytes of the uplink, for when the stack sent less than all of it
+    size_t framesIn(size_t Bytes) const;
+
+  private:
+    /// picks the width of every port for the first Count frames
+    void pickWidths(const SampleFrame *Frames, size_t Count);
+
+    /// writes the first Count frames with the widths that were picked
+    /// \returns how many of them fit into Size bytes
+    size_t write(const SampleFrame *Frames, size_t Count, uint32_t Version,
+                 size_t Size);
+
+    uint8_t Data[LORAPAYLOADMAX];
+    size_t Bits;
+
+    /// the bit that each packed frame ends at
+    size_t Ends[LORAFRAMESMAX];
+    size_t Packed;
+
+    /// the ports of the masks, and the Resolution of each
+    size_t Ports;
+    uint8_t Resolution[FRAMEMAXPORTS];
+    uint8_t Widths[FRAMEMAXPORTS];
+};
+
+#endif // LORAPACKER
@@ -0,0 +1,280 @@
+/// \file
+/// \brief Implementation of the LoRaWAN uplink, and the functions of
+/// Networking.h and NetworkBackend.h on top of it
+#define TRACE_GROUP "lora"
+#include "LoraUplink.h"
+
+#include "BacklogThrottle.h"
+#include "DeferredLog.h"
+#include "LinkStats.h"
+#include "NetworkBackend.h"
+
+#if LORAWANUPLINK
+
+#include "LoraPacker.h"
+#include "SX1276_LoRaRadio.h"
+
+/// The flags that onEvent() sets
+#define LORAJOINED (1U << 0)
+#define LORAJOINFAILED (1U << 1)
+#define LORATXDONE (1U << 2)
+#define LORATXFAILED (1U << 3)
+
+/// The longest uplink the stack takes, "lora.tx-max-size"
+#define LORAROOMMAX                                                            \
+    (MBED_CONF_LORA_TX_MAX_SIZE < LORAPAYLOADMAX ? MBED_CONF_LORA_TX_MAX_SIZE \
+                                                 : LORAPAYLOADMAX)
+
+/// The most events of the stack that wait at once
+#define LORAEVENTS (16)
+
+/// The stack of the thread that runs the stack's events.
+/// Set with "lora-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_LORA_STACK_SIZE
+#define LORASTACKSIZE MBED_CONF_APP_LORA_STACK_SIZE
+#else
+#define LORASTACKSIZE (2048)
+#endif
+
+/// A data rate that the stack is never on, so the first uplink takes the
+/// room of the one it is on
+#define LORANORATE (0xFF)
+
+LoraUplink::LoraUplink(LoRaRadio &Radio)
+    : Stack(Radio), Queue(LORAEVENTS * EVENTS_EVENT_SIZE),
+      Worker(osPriorityAboveNormal, LORASTACKSIZE, NULL, "lora"),
+      Joined(false), Joins(0), LastUplink(0), Rate(LORANORATE), Room(LORAROOMMAX),
+      DownlinkLength(0) {}
+
+// ============================================================================
+int LoraUplink::start() {
+    if (Worker.start(callback(&Queue, &events::EventQueue::dispatch_forever))
+        != osOK) {
+        return -1;
+    }
+    if (Stack.initialize(&Queue) != LORAWAN_STATUS_OK) {
+        printf("The LoRaWAN stack did not start\r\n");
+        return -1;
+    }
+    Callbacks.events = callback(this, &LoraUplink::onEvent);
+    Stack.add_app_callbacks(&Callbacks);
+    Stack.set_confirmed_msg_retries(LORARETRIES);
+
+    // the network server moves the board to the fastest data rate that the
+    // gateways still hear
+    Stack.enable_adaptive_datarate();
+    return NETWORKSUCCESS;
+}
+
+// ============================================================================
+int LoraUplink::join() {
+    if (Joined) {
+        return NETWORKSUCCESS;
+    }
+    Flags.clear(LORAJOINED | LORAJOINFAILED);
+    lorawan_status_t Status = Stack.connect();
+    if (Status == LORAWAN_STATUS_ALREADY_CONNECTED) {
+        Joined = true;
+        return NETWORKSUCCESS;
+    }
+    // a join that is still going from an earlier attempt is waited for
+    if (Status != LORAWAN_STATUS_OK &&
+        Status != LORAWAN_STATUS_CONNECT_IN_PROGRESS &&
+        Status != LORAWAN_STATUS_BUSY) {
+        tr_warn("The join did not start (%d)", Status);
+        linkConnected(false);
+        return -1;
+    }
+    uint32_t Got = Flags.wait_any(LORAJOINED | LORAJOINFAILED, LORAJOINMS);
+    bool Worked = (Got & osFlagsError) == 0 && (Got & LORAJOINED);
+    linkConnected(Worked);
+    return Worked ? NETWORKSUCCESS : -1;
+}
+
+// ============================================================================
+bool LoraUplink::slotDue() {
+    if (!Joined) {
+        return false;
+    }
+    // the duty cycle of the region, the stack knows when it may send again
+    int Backoff = 0;
+    if (Stack.get_backoff_metadata(Backoff) == LORAWAN_STATUS_OK &&
+        Backoff > 0) {
+        return false;
+    }
+    return LastUplink == 0 ||
+           Kernel::get_ms_count() - LastUplink >= LORAINTERVAL * 1000ULL;
+}
+
+// ============================================================================
+int LoraUplink::send(uint8_t Port, const uint8_t *Data, size_t Length,
+                     size_t &Sent) {
+    Sent = 0;
+    Flags.clear(LORATXDONE | LORATXFAILED);
+    int16_t Took =
+        Stack.send(Port, Data, Length,
+                   LORACONFIRMED ? MSG_CONFIRMED_FLAG : MSG_UNCONFIRMED_FLAG);
+    if (Took < 0) {
+        tr_warn("The stack did not take the uplink (%d)", Took);
+        if (Took == LORAWAN_STATUS_NO_ACTIVE_SESSIONS ||
+            Took == LORAWAN_STATUS_NO_NETWORK_JOINED) {
+            Joined = false;
+        }
+        linkRequestDone(LIVELINK, false);
+        return -4;
+    }
+    LastUplink = Kernel::get_ms_count();
+    Sent = (size_t)Took;
+    linkSent(Sent);
+    uplinkSent(Sent);
+    linkRequestSent(LIVELINK);
+
+    uint32_t Got = Flags.wait_any(LORATXDONE | LORATXFAILED, LORATXMS);
+    if (Got & osFlagsError) {
+        // still waiting for the duty cycle to let a retry go
+        Stack.cancel_sending();
+        linkRequestDone(LIVELINK, false);
+        return LORACONFIRMED ? -5 : -4;
+    }
+    if (Got & LORATXFAILED) {
+        linkRequestDone(LIVELINK, false);
+        return LORACONFIRMED ? -5 : -4;
+    }
+    // with LORACONFIRMED the round trip ends with the network's ack
+    linkRequestDone(LIVELINK, true);
+
+    // ADR may have moved the board to a data rate with more or less room,
+    // the stack cutting the uplink shows how much there is
+    lorawan_tx_metadata Meta;
+    if (Stack.get_tx_metadata(Meta) == LORAWAN_STATUS_OK) {
+        // the stack's own retries of a confirmed uplink
+        linkRetried(Meta.nb_retries);
+        if (Meta.data_rate != Rate) {
+            Rate = Meta.data_rate;
+            Room = LORAROOMMAX;
+        }
+    }
+    if (Sent < Length) {
+        Room = Sent;
+    }
+    return NETWORKSUCCESS;
+}
+
+// ============================================================================
+size_t LoraUplink::takeDownlink(char *Text, size_t Size) {
+    DownlinkLock.lock();
+    size_t Length = DownlinkLength < Size ? DownlinkLength : Size - 1;
+    memcpy(Text, Downlink, Length);
+    Text[Length] = '\0';
+    DownlinkLength = 0;
+    DownlinkLock.unlock();
+    return Length;
+}
+
+void LoraUplink::onEvent(lorawan_event_t Event) {
+    switch (Event) {
+    case CONNECTED:
+        Joined = true;
+        ++Joins;
+        Flags.set(LORAJOINED);
+        break;
+    case DISCONNECTED:
+        Joined = false;
+        break;
+    case JOIN_FAILURE:
+        Flags.set(LORAJOINFAILED);
+        break;
+    case TX_DONE:
+        Flags.set(LORATXDONE);
+        break;
+    case TX_TIMEOUT:
+    case TX_ERROR:
+    case TX_CRYPTO_ERROR:
+    case TX_SCHEDULING_ERROR:
+        Flags.set(LORATXFAILED);
+        break;
+    case RX_DONE: {
+        uint8_t Port;
+        int RxFlags;
+        DownlinkLock.lock();
+        int16_t Got =
+            Stack.receive((uint8_t *)Downlink, LORADOWNLINKMAX, Port, RxFlags);
+        DownlinkLength = Got > 0 ? (size_t)Got : 0;
+        DownlinkLock.unlock();
+        linkReceived(DownlinkLength);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static SX1276_LoRaRadio Radio(LORAMOSI, LORAMISO, LORASCLK, LORACS, LORARESET,
+                              LORADIO0, LORADIO1, LORADIO2, LORADIO3,
+                              LORADIO4, LORADIO5, NC, NC, NC, NC,
+                              LORAANTSWITCH);
+
+static LoraUplink Uplink(Radio);
+
+// ============================================================================
+LoraUplink &loraUplink() { return Uplink; }
+
+// ============================================================================
+// the radio is there as soon as the board is
+bool waitESPReady(ATCmdParser *_parser, int timeout_ms) { return true; }
+
+// ============================================================================
+int startESP(ATCmdParser *_parser, DMAUARTSerial *_serial) {
+    return Uplink.start();
+}
+
+// the network has no SSID or password, the keys are those of "lora.*"
+int connectESPWiFi(ATCmdParser *_parser, BoardSpecs &Specs) {
+    return Uplink.join();
+}
+
+bool checkESPWiFiConnection(ATCmdParser *_parser) { return Uplink.joined(); }
+
+bool isConnected(ATCmdParser *_parser) { return Uplink.joined(); }
+
+// the stack sends no AT commands
+int answerESP(ATCmdParser *_parser) { return -1; }
+
+// the stack puts the radio to sleep after the receive windows of every
+// uplink
+void sleepESP(ATCmdParser *_parser) {}
+
+bool wakeESP(ATCmdParser *_parser) { return true; }
+
+uint32_t espWakeMs() { return 0; }
+
+// there are no links to the server, the readings go out as uplinks, see
+// Networking.cpp
+void closeServerLink(ATCmdParser *_parser, int Link) {}
+
+bool serverLinkOpen(int Link) { return false; }
+
+const char *serverAddress(ATCmdParser *_parser, BoardSpecs &Specs) {
+    return Specs.RemoteIP.c_str();
+}
+
+int openServerLink(ATCmdParser *_parser, BoardSpecs &Specs, int Link) {
+    return -1;
+}
+
+bool writeServerLink(ATCmdParser *_parser, int Link, const char *data,
+                     size_t length) {
+    return false;
+}
+
+int readServerResponse(ATCmdParser *_parser, int Link, float &response) {
+    return -1;
+}
+
+int readServerBody(ATCmdParser *_parser, int Link, uint8_t *Body, size_t Size,
+                   size_t &Length) {
+    Length = 0;
+    return -1;
+}
+
+#endif // LORAWANUPLINK
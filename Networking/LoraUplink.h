@@ -0,0 +1,168 @@
+#ifndef LORAUPLINK_H
+#define LORAUPLINK_H
+/// \file
+/// \brief The readings of remote sites as LoRaWAN uplinks, with the stack
+/// of features/lorawan.
+///
+/// With LORAWANUPLINK the board has no ESP8266, the functions of
+/// Networking.h for it are those of the LoRaWAN stack in LoraUplink.cpp.
+/// The board joins over the air with the keys of "lora.device-eui",
+/// "lora.application-eui" and "lora.application-key" in mbed_app.json, on
+/// the region of "lora.phy". The stack picks the data rate with ADR, so an
+/// uplink has 51 to 222 bytes depending on how far the gateway is, and the
+/// duty cycle of the region decides how often one may go.
+///
+/// So the readings wait in the backup log, and every uplink carries as many
+/// of them as fit, bit-packed by LoraPacker.h, on LORAREADINGSPORT. An
+/// uplink goes once the stack is free to send and LORAINTERVAL has passed
+/// after the last one. The port table that the server decodes them with is
+/// a CBOR [config version, [[port name, multiplier, resolution], ...]],
+/// sent on LORATABLEPORT after every join and when the config changes, in
+/// pieces of one uplink each after a byte with the number of the piece in
+/// bits 0 to 6 and bit 7 set on the last one. The uplinks are confirmed
+/// with LORACONFIRMED, and the readings are only acked in the backup log
+/// once the network server acked them.
+///
+/// A downlink has the same text as the body of an HTTP response, and
+/// time="seconds since 1970" sets the clock, which LoRaWAN does not.
+///
+/// The radio is the SX1276 of the mbed-semtech-lora-rf-drivers library,
+/// which has to be added to the project, on the pins of the SX1276MB1xAS
+/// shield by default.
+
+#include "Networking.h"
+
+#if LORAWANUPLINK
+
+#include "LoRaWANInterface.h"
+#include "events/EventQueue.h"
+
+/// The pins of the SX1276, the SX1276MB1xAS shield on the Arduino header.
+/// Another wiring sets them in the macros of mbed_app.json
+#ifndef LORAMOSI
+#define LORAMOSI D11
+#define LORAMISO D12
+#define LORASCLK D13
+#define LORACS D10
+#define LORARESET A0
+#define LORADIO0 D2
+#define LORADIO1 D3
+#define LORADIO2 D4
+#define LORADIO3 D5
+#define LORADIO4 D8
+#define LORADIO5 D9
+#define LORAANTSWITCH A4
+#endif
+
+/// Set to 1 for every uplink to be acked by the network server, which
+/// takes a downlink of the gateway each time. With 0 the readings are
+/// dropped once they went out. Set with "lora-confirmed" in mbed_app.json.
+#ifdef MBED_CONF_APP_LORA_CONFIRMED
+#define LORACONFIRMED MBED_CONF_APP_LORA_CONFIRMED
+#else
+#define LORACONFIRMED (1)
+#endif
+
+/// The least time between two uplinks in seconds, on top of the duty
+/// cycle, for the fair use policy of the network. Set with "lora-interval"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_LORA_INTERVAL
+#define LORAINTERVAL MBED_CONF_APP_LORA_INTERVAL
+#else
+#define LORAINTERVAL (60)
+#endif
+
+/// The application ports of the readings and of the port table
+#define LORAREADINGSPORT (1)
+#define LORATABLEPORT (2)
+
+/// How long connectESPWiFi() waits for the join, in milliseconds. A join
+/// that takes longer goes on, and the board is connected once it is done
+#define LORAJOINMS (20000)
+
+/// How long an uplink may take to go out and be acked, in milliseconds
+#define LORATXMS (30000)
+
+/// How many times a confirmed uplink is sent before it failed
+#define LORARETRIES (3)
+
+/// The longest downlink that is kept
+#define LORADOWNLINKMAX (128)
+
+/// The longest port table, sent in as many pieces as it takes
+#define LORATABLEMAX (512)
+
+class LoraUplink {
+  public:
+    LoraUplink(LoRaRadio &Radio);
+
+    /// Starts the stack on its own thread, with ADR
+    /// \returns NETWORKSUCCESS, or -1 if the radio did not start
+    int start();
+
+    /// Joins the network if it is not joined, and waits up to LORAJOINMS
+    /// \returns NETWORKSUCCESS once it is joined, -1 otherwise
+    int join();
+
+    /// Returns true while the board has a session with the network
+    bool joined() const { return Joined; }
+
+    /// Returns how many times the board joined, the server may have lost
+    /// what it knew of the board with every new session
+    uint32_t joins() const { return Joins; }
+
+    /// Returns true if an uplink can go out now
+    bool slotDue();
+
+    /// Returns how many bytes the next uplink may have at the data rate
+    /// that the stack is on
+    size_t room() const { return Room; }
+
+    /// Sends Length bytes of Data on Port and waits until they went out,
+    /// and were acked with LORACONFIRMED. Sent is set to how many of the
+    /// bytes the stack took, it cuts an uplink down to the room it has
+    /// \returns NETWORKSUCCESS, -4 if it could not be sent, or -5 if it was
+    /// not acked
+    int send(uint8_t Port, const uint8_t *Data, size_t Length, size_t &Sent);
+
+    /// Copies the last downlink into Text, at most Size - 1 bytes of it,
+    /// '\0' terminated, and forgets it
+    /// \returns its length, 0 if there was none
+    size_t takeDownlink(char *Text, size_t Size);
+
+  private:
+    /// the stack's events, on Worker
+    void onEvent(lorawan_event_t Event);
+
+    LoRaWANInterface Stack;
+    lorawan_app_callbacks_t Callbacks;
+
+    /// the stack runs on this queue, so the uploader can wait for it
+    events::EventQueue Queue;
+    Thread Worker;
+
+    /// what onEvent() tells the uploader
+    EventFlags Flags;
+
+    volatile bool Joined;
+    volatile uint32_t Joins;
+
+    /// when the last uplink went out
+    uint64_t LastUplink;
+
+    /// the data rate of the last uplink, and the room the stack had on it
+    uint8_t Rate;
+    size_t Room;
+
+    /// the last downlink, taken in on Worker
+    Mutex DownlinkLock;
+    char Downlink[LORADOWNLINKMAX + 1];
+    size_t DownlinkLength;
+};
+
+/// The uplink of LORAWANUPLINK, on the SX1276
+LoraUplink &loraUplink();
+
+#endif // LORAWANUPLINK
+
+#endif // LORAUPLINK
@@ -0,0 +1,299 @@
+/// \file
+/// \brief Implementation of the Modbus TCP server
+#define TRACE_GROUP "mbtcp"
+#include "ModbusServer.h"
+
+#include "DeferredLog.h"
+
+#if MODBUSSERVER
+
+#include "NetworkBackend.h"
+
+#include <cstring>
+
+/// how long the thread waits before it tries to listen again, while the
+/// Ethernet port is down, in milliseconds
+#define MODBUSRETRYMS (1000)
+
+/// the flag of Ready that the sockets set
+#define MODBUSREADY (1U)
+
+/// the MBAP header and the function code
+#define MODBUSHEADER (8)
+
+/// the exceptions
+#define MODBUSBADFUNCTION (1)
+#define MODBUSBADADDRESS (2)
+#define MODBUSBADVALUE (3)
+
+// the big endian 16-bit word at In
+static inline uint16_t getBig(const uint8_t *In) {
+    return (uint16_t)((In[0] << 8) | In[1]);
+}
+
+RegisterSnapshot::RegisterSnapshot() : Generation(0) {
+    memset(Registers, 0, sizeof(Registers));
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Multipliers[i] = 1.0f;
+    }
+}
+
+// ============================================================================
+void RegisterSnapshot::configure(const vector<PortInfo> &Ports) {
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Multipliers[i] = i < Ports.size() ? Ports[i].Multiplier : 1.0f;
+    }
+}
+
+// ============================================================================
+void RegisterSnapshot::publish(const SampleFrame &Frame) {
+    uint32_t Now = core_util_atomic_load_explicit_u32(
+        &Generation, mbed_memory_order_relaxed);
+    uint16_t *Next = Registers[(Now + 1) & 1];
+    memset(Next, 0, sizeof(Registers[0]));
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (Frame.hasPort(i)) {
+            float Value = Frame.value(i, Multipliers[i]);
+            uint32_t Bits;
+            memcpy(&Bits, &Value, sizeof(Bits));
+            Next[2 * i] = Bits >> 16;
+            Next[2 * i + 1] = Bits & 0xFFFF;
+            Next[MODBUSRAWREGISTERS + i] = Frame.Raw[i];
+        }
+    }
+    uint16_t *Status = Next + MODBUSSTATUSREGISTERS;
+    Status[0] = Frame.Timestamp >> 16;
+    Status[1] = Frame.Timestamp & 0xFFFF;
+    Status[2] = Frame.Sequence >> 16;
+    Status[3] = Frame.Sequence & 0xFFFF;
+    Status[4] = Frame.PortMask;
+    Status[5] = Frame.OverMask;
+    Status[6] = Frame.UnderMask;
+    Status[7] = Frame.Kind;
+    Status[8] = Frame.Count;
+
+    // the half has to be complete before a reader can take it
+    core_util_atomic_store_explicit_u32(&Generation, Now + 1,
+                                        mbed_memory_order_release);
+}
+
+// ============================================================================
+bool RegisterSnapshot::read(size_t First, size_t Count, uint8_t *Out) const {
+    if (Count == 0 || First + Count > MODBUSREGISTERS) {
+        return false;
+    }
+    while (true) {
+        uint32_t Before = core_util_atomic_load_explicit_u32(
+            &Generation, mbed_memory_order_acquire);
+        const uint16_t *Half = Registers[Before & 1];
+        for (size_t i = 0; i < Count; ++i) {
+            Out[2 * i] = Half[First + i] >> 8;
+            Out[2 * i + 1] = Half[First + i] & 0xFF;
+        }
+        // the writer only fills this half again after it made the other
+        // one current, so the copy is whole if that did not happen. The
+        // K64F has one core, the copy only has to stay before the load
+        MBED_BARRIER();
+        if (core_util_atomic_load_explicit_u32(
+                &Generation, mbed_memory_order_acquire) == Before) {
+            return true;
+        }
+    }
+}
+
+ModbusServer::ModbusServer()
+    : Server(osPriorityBelowNormal, MODBUSSERVERSTACKSIZE, NULL, "mbtcp"),
+      Listening(false), Answered(0) {
+    for (size_t i = 0; i < MODBUSSERVERCLIENTS; ++i) {
+        Clients[i] = NULL;
+        Fill[i] = 0;
+    }
+}
+
+ModbusServer::~ModbusServer() {
+    Server.terminate();
+    for (size_t i = 0; i < MODBUSSERVERCLIENTS; ++i) {
+        if (Clients[i] != NULL) {
+            drop(i);
+        }
+    }
+    Listener.close();
+}
+
+// ============================================================================
+int ModbusServer::start() {
+    if (Server.get_state() != Thread::Deleted) {
+        return MODBUSSERVERSUCCESS;
+    }
+    if (Server.start(callback(this, &ModbusServer::run)) != osOK) {
+        return -1;
+    }
+    return MODBUSSERVERSUCCESS;
+}
+
+void ModbusServer::run() {
+    while (true) {
+        if (!Listening && !listen()) {
+            ThisThread::sleep_for(MODBUSRETRYMS);
+            continue;
+        }
+        accept();
+        for (size_t i = 0; i < MODBUSSERVERCLIENTS; ++i) {
+            if (Clients[i] != NULL) {
+                serve(i);
+            }
+        }
+        // a socket that gets something while the clients are served sets
+        // the flag again, so nothing waits for MODBUSIDLEMS
+        Ready.wait_any(MODBUSREADY, MODBUSIDLEMS);
+    }
+}
+
+bool ModbusServer::listen() {
+    NetworkInterface *Net = wiredInterface();
+    nsapi_connection_status_t Status = Net->get_connection_status();
+    if (Status != NSAPI_STATUS_GLOBAL_UP && Status != NSAPI_STATUS_LOCAL_UP) {
+        return false;
+    }
+    nsapi_error_t err = Listener.open(Net);
+    if (err == NSAPI_ERROR_OK) {
+        err = Listener.bind(MODBUSSERVERPORT);
+    }
+    if (err == NSAPI_ERROR_OK) {
+        err = Listener.listen(MODBUSSERVERCLIENTS);
+    }
+    if (err != NSAPI_ERROR_OK) {
+        tr_warn("Could not listen on port %d (%d)", MODBUSSERVERPORT, err);
+        Listener.close();
+        return false;
+    }
+    // accept() only takes the clients that are already waiting
+    Listener.set_blocking(false);
+    Listener.sigio(callback(this, &ModbusServer::wake));
+    Listening = true;
+    tr_info("Modbus TCP on port %d", MODBUSSERVERPORT);
+    return true;
+}
+
+void ModbusServer::accept() {
+    nsapi_error_t err;
+    TCPSocket *Client;
+    while ((Client = Listener.accept(&err)) != NULL) {
+        size_t i = 0;
+        while (i < MODBUSSERVERCLIENTS && Clients[i] != NULL) {
+            ++i;
+        }
+        if (i == MODBUSSERVERCLIENTS) {
+            tr_warn("Too many Modbus clients, one was closed");
+            // an accepted socket deletes itself when it is closed
+            Client->close();
+            continue;
+        }
+        Client->set_blocking(false);
+        Client->sigio(callback(this, &ModbusServer::wake));
+        Clients[i] = Client;
+        Fill[i] = 0;
+    }
+}
+
+void ModbusServer::serve(size_t i) {
+    uint8_t *Buffer = Requests[i];
+    while (true) {
+        nsapi_size_or_error_t Got =
+            Clients[i]->recv(Buffer + Fill[i], MODBUSADUMAX - Fill[i]);
+        if (Got == NSAPI_ERROR_WOULD_BLOCK) {
+            return;
+        }
+        // 0 is the client closing its end
+        if (Got <= 0) {
+            drop(i);
+            return;
+        }
+        Fill[i] += Got;
+
+        // the MBAP header has the length of the rest
+        while (Fill[i] >= MODBUSHEADER) {
+            size_t Length = 6 + getBig(Buffer + 4);
+            if (getBig(Buffer + 2) != 0 || Length < MODBUSHEADER ||
+                Length > MODBUSADUMAX) {
+                tr_warn("A Modbus client sent no Modbus, closing it");
+                drop(i);
+                return;
+            }
+            if (Fill[i] < Length) {
+                break;
+            }
+            answer(i, Length);
+            if (Clients[i] == NULL) {
+                return;
+            }
+            Fill[i] -= Length;
+            memmove(Buffer, Buffer + Length, Fill[i]);
+        }
+    }
+}
+
+void ModbusServer::answer(size_t i, size_t Length) {
+    const uint8_t *Request = Requests[i];
+    // the transaction, the protocol and the unit go back as they came
+    memcpy(Response, Request, 7);
+    uint8_t Function = Request[7];
+    uint8_t Exception = 0;
+    size_t Pdu = 2;
+    if (Function != 3 && Function != 4) {
+        Exception = MODBUSBADFUNCTION;
+    } else if (Length != 12 || getBig(Request + 10) == 0 ||
+               getBig(Request + 10) > MODBUSREADMAX) {
+        Exception = MODBUSBADVALUE;
+    } else {
+        size_t Count = getBig(Request + 10);
+        if (Snapshot.read(getBig(Request + 8), Count, Response + 9)) {
+            Response[8] = Count * 2;
+            Pdu += Count * 2;
+        } else {
+            Exception = MODBUSBADADDRESS;
+        }
+    }
+    if (Exception != 0) {
+        Response[7] = Function | 0x80;
+        Response[8] = Exception;
+    } else {
+        Response[7] = Function;
+    }
+    // the length counts the unit too
+    Response[4] = (Pdu + 1) >> 8;
+    Response[5] = (Pdu + 1) & 0xFF;
+    send(i, 7 + Pdu);
+}
+
+void ModbusServer::send(size_t i, size_t Length) {
+    // the socket does not block, so a response that only went out in part
+    // is finished until MODBUSSENDMS ran out
+    uint64_t Start = Kernel::get_ms_count();
+    size_t Done = 0;
+    while (Done < Length) {
+        nsapi_size_or_error_t Put =
+            Clients[i]->send(Response + Done, Length - Done);
+        if (Put > 0) {
+            Done += Put;
+        } else if (Put != NSAPI_ERROR_WOULD_BLOCK ||
+                   Kernel::get_ms_count() - Start >= MODBUSSENDMS) {
+            tr_warn("A Modbus client did not take its response, closing it");
+            drop(i);
+            return;
+        } else {
+            ThisThread::sleep_for(1);
+        }
+    }
+    ++Answered;
+}
+
+void ModbusServer::drop(size_t i) {
+    Clients[i]->close();
+    Clients[i] = NULL;
+    Fill[i] = 0;
+}
+
+void ModbusServer::wake() { Ready.set(MODBUSREADY); }
+
+#endif // MODBUSSERVER
@@ -0,0 +1,183 @@
+#ifndef MODBUSSERVER_H
+#define MODBUSSERVER_H
+/// \file
+/// \brief A Modbus TCP server on the site's network, which the SCADA
+/// systems of the customers poll for the latest value of every port.
+///
+/// With MODBUSSERVER the board listens on MODBUSSERVERPORT of its Ethernet
+/// port for up to MODBUSSERVERCLIENTS clients, and answers FC03 and FC04
+/// with the same registers, for any unit id:
+///  - 0 on: the value of port i in its unit at 2 * i, a 32-bit float, high
+///    word first, infinite while it is out of range
+///  - MODBUSRAWREGISTERS on: the raw 16-bit reading of port i at
+///    MODBUSRAWREGISTERS + i
+///  - MODBUSSTATUSREGISTERS on: the timestamp and the sequence number of
+///    the frame, high word first, then its PortMask, OverMask, UnderMask,
+///    FrameKind and Count
+///
+/// The registers between those are 0, other functions get exception 01,
+/// and addresses after the last register exception 02.
+///
+/// The sampling loop builds the registers of every frame into one half of
+/// a RegisterSnapshot and then flips it, without a lock. A read copies the
+/// registers it asked for out of the other half, so how long it takes does
+/// not depend on the sampling loop or the uploads. The ESP8266 driver can
+/// not listen for connections, so the server needs NETWORKETHERNET.
+
+#include "mbed.h"
+
+#include "Networking.h"
+#include "TCPSocket.h"
+#include "platform/mbed_atomic.h"
+
+/// Set to 1 for the Modbus TCP server. Set with "modbus-server" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_MODBUS_SERVER
+#define MODBUSSERVER MBED_CONF_APP_MODBUS_SERVER
+#else
+#define MODBUSSERVER (0)
+#endif
+
+#if MODBUSSERVER && !NETWORKETHERNET
+#error "modbus-server needs ethernet, the ESP8266 can not take connections"
+#endif
+
+/// The TCP port the server listens on, 502 is the one of Modbus.
+/// Set with "modbus-server-port" in mbed_app.json.
+#ifdef MBED_CONF_APP_MODBUS_SERVER_PORT
+#define MODBUSSERVERPORT MBED_CONF_APP_MODBUS_SERVER_PORT
+#else
+#define MODBUSSERVERPORT (502)
+#endif
+
+/// The most clients at once, one more is closed as soon as it connects
+#define MODBUSSERVERCLIENTS (4)
+
+/// The first register of the raw readings
+#define MODBUSRAWREGISTERS (100)
+
+/// The first register of the frame's status
+#define MODBUSSTATUSREGISTERS (200)
+
+/// The number of registers, the last one is Count
+#define MODBUSREGISTERS (MODBUSSTATUSREGISTERS + 9)
+
+/// The most registers in one read, what fits into a response
+#define MODBUSREADMAX (125)
+
+/// The longest request or response, MBAP header and PDU
+#define MODBUSADUMAX (260)
+
+/// How long a response may take to be sent, in milliseconds
+#define MODBUSSENDMS (50)
+
+/// How long the thread waits for the sockets before it looks at them
+/// anyway, in milliseconds
+#define MODBUSIDLEMS (100)
+
+/// the stack size of the server's thread, the buffers are members.
+/// Set with "mbtcp-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_MBTCP_STACK_SIZE
+#define MODBUSSERVERSTACKSIZE MBED_CONF_APP_MBTCP_STACK_SIZE
+#else
+#define MODBUSSERVERSTACKSIZE (1536)
+#endif
+
+/// a constant value that is returned from server functions upon success
+#define MODBUSSERVERSUCCESS (0)
+
+/// The registers of the latest frame in two halves. Only one thread may
+/// publish(), any number may read(). The writer fills the half that is
+/// not current and then makes it current, and a reader that the writer
+/// overtook while it copied copies again.
+class RegisterSnapshot : private NonCopyable<RegisterSnapshot> {
+  public:
+    RegisterSnapshot();
+
+    /// Takes the multipliers of Ports for the values (writer only)
+    void configure(const vector<PortInfo> &Ports);
+
+    /// Builds the registers of Frame and makes them current (writer only)
+    void publish(const SampleFrame &Frame);
+
+    /// Copies Count registers from First on into Out, as they are sent
+    /// \returns false if they are not all registers
+    bool read(size_t First, size_t Count, uint8_t *Out) const;
+
+  private:
+    uint16_t Registers[2][MODBUSREGISTERS];
+
+    /// how many frames were published, the current half is Generation & 1
+    volatile uint32_t Generation;
+
+    float Multipliers[FRAMEMAXPORTS];
+};
+
+class ModbusServer {
+  public:
+    ModbusServer();
+
+    ~ModbusServer();
+
+    /// Starts the thread. It waits for the Ethernet port to come up before
+    /// it listens
+    /// \returns MODBUSSERVERSUCCESS, or a negative integer if the thread
+    /// did not start
+    int start();
+
+    /// The registers that are served, the sampling loop publishes to them
+    RegisterSnapshot &registers() { return Snapshot; }
+
+    /// Returns the number of requests that were answered
+    uint32_t requests() const { return Answered; }
+
+  private:
+    /// listens, takes the clients and answers their requests
+    void run();
+
+    /// opens the listening socket on the Ethernet port
+    /// \returns true if it listens
+    bool listen();
+
+    /// takes a waiting client, if there is room for it
+    void accept();
+
+    /// reads what client i sent and answers every whole request in it
+    void serve(size_t i);
+
+    /// answers the request of Length bytes at the start of the buffer of
+    /// client i
+    void answer(size_t i, size_t Length);
+
+    /// sends the Length bytes of Response to client i, and closes it if
+    /// they did not go out
+    void send(size_t i, size_t Length);
+
+    /// closes client i
+    void drop(size_t i);
+
+    /// wakes the thread, the sockets call it when they can be read
+    void wake();
+
+    RegisterSnapshot Snapshot;
+
+    Thread Server;
+
+    TCPSocket Listener;
+    bool Listening;
+
+    TCPSocket *Clients[MODBUSSERVERCLIENTS];
+
+    /// what each client sent that is not a whole request yet
+    uint8_t Requests[MODBUSSERVERCLIENTS][MODBUSADUMAX];
+    size_t Fill[MODBUSSERVERCLIENTS];
+
+    uint8_t Response[MODBUSADUMAX];
+
+    /// set when a socket has something
+    EventFlags Ready;
+
+    uint32_t Answered;
+};
+
+#endif // MODBUSSERVER
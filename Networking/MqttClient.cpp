@@ -0,0 +1,295 @@
+/// \file
+/// \brief Implementation of the MQTT 3.1.1 client
+#include "MqttClient.h"
+
+#include "BacklogThrottle.h"
+#include "LinkStats.h"
+
+#if NETWORKSOCKETS
+
+// the packet types, in the top 4 bits of the fixed header
+#define MQTTCONNECT (0x10)
+#define MQTTCONNACK (0x20)
+#define MQTTPUBLISHPACKET (0x30)
+#define MQTTPUBACK (0x40)
+#define MQTTSUBSCRIBE (0x82)
+#define MQTTSUBACK (0x90)
+#define MQTTPINGREQ (0xC0)
+#define MQTTPINGRESP (0xD0)
+#define MQTTDISCONNECT (0xE0)
+
+/// the QoS 1 and retain bits of a PUBLISH header
+#define MQTTQOS1 (0x02)
+#define MQTTRETAIN (0x01)
+
+/// the clean session bit of the CONNECT flags
+#define MQTTCLEANSESSION (0x02)
+
+MqttClient::MqttClient()
+    : Connected(false), PacketId(0), InFlightCount(0), LastSend(0) {
+    Message[0] = '\0';
+}
+
+// ============================================================================
+bool MqttClient::connect(NetworkInterface *Net, const SocketAddress &Address,
+                         const char *ClientId, const char *Subscribe) {
+    disconnect();
+    if (Link.open(Net) != NSAPI_ERROR_OK) {
+        return false;
+    }
+    Link.set_timeout(MQTTTIMEOUT);
+    bool Opened = Link.connect(Address) == NSAPI_ERROR_OK;
+    linkConnected(Opened);
+    if (!Opened) {
+        Link.close();
+        return false;
+    }
+    Connected = true;
+
+    // "MQTT", level 4 is 3.1.1, a clean session and the keep-alive time.
+    // Readings that were not acknowledged are still in the backup log, so
+    // the broker does not have to keep anything for the board
+    static const uint8_t Variable[] = {0, 4, 'M', 'Q', 'T', 'T',
+                                       4, MQTTCLEANSESSION, 0, MQTTKEEPALIVE};
+    size_t IdLength = strlen(ClientId);
+    if (!sendHeader(MQTTCONNECT, sizeof(Variable) + 2 + IdLength) ||
+        !sendAll((const char *)Variable, sizeof(Variable)) ||
+        !sendString(ClientId, IdLength)) {
+        disconnect();
+        return false;
+    }
+
+    uint8_t Ack[4];
+    if (!readAll((char *)Ack, sizeof(Ack)) || Ack[0] != MQTTCONNACK ||
+        Ack[1] != 2 || Ack[3] != 0) {
+        printf("The MQTT broker refused the connection\r\n");
+        disconnect();
+        return false;
+    }
+
+    // the SUBACK is handled by poll() like any other packet
+    size_t TopicLength = strlen(Subscribe);
+    uint16_t Id = nextPacketId();
+    uint8_t IdBytes[2] = {(uint8_t)(Id >> 8), (uint8_t)Id};
+    uint8_t QoS = 1;
+    if (!sendHeader(MQTTSUBSCRIBE, 2 + 2 + TopicLength + 1) ||
+        !sendAll((const char *)IdBytes, sizeof(IdBytes)) ||
+        !sendString(Subscribe, TopicLength) ||
+        !sendAll((const char *)&QoS, 1)) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+// ============================================================================
+void MqttClient::disconnect() {
+    if (Connected) {
+        sendShort(MQTTDISCONNECT, NULL, 0);
+    }
+    Link.close();
+    Connected = false;
+    InFlightCount = 0;
+}
+
+// ============================================================================
+bool MqttClient::beginPublish(const char *Topic, size_t Length, bool Retain) {
+    if (!Connected || InFlightCount >= MQTTWINDOW) {
+        return false;
+    }
+    size_t TopicLength = strlen(Topic);
+    uint16_t Id = nextPacketId();
+    uint8_t IdBytes[2] = {(uint8_t)(Id >> 8), (uint8_t)Id};
+    uint8_t Header = MQTTPUBLISHPACKET | MQTTQOS1 | (Retain ? MQTTRETAIN : 0);
+    if (!sendHeader(Header, 2 + TopicLength + 2 + Length) ||
+        !sendString(Topic, TopicLength) ||
+        !sendAll((const char *)IdBytes, sizeof(IdBytes))) {
+        return false;
+    }
+    InFlight[InFlightCount++] = Id;
+    return true;
+}
+
+bool MqttClient::write(const char *data, size_t length) {
+    return sendAll(data, length);
+}
+
+// ============================================================================
+int MqttClient::poll(int TimeoutMs) {
+    if (!Connected) {
+        return -1;
+    }
+
+    uint8_t Header;
+    Link.set_timeout(TimeoutMs);
+    nsapi_size_or_error_t got = Link.recv(&Header, 1);
+    Link.set_timeout(MQTTTIMEOUT);
+    if (got == NSAPI_ERROR_WOULD_BLOCK) {
+        return MQTTIDLE;
+    }
+    if (got <= 0) {
+        // 0 is the broker closing its end
+        disconnect();
+        return -1;
+    }
+
+    // the remaining length is 7 bits per byte, low bits first
+    size_t Length = 0;
+    for (int Shift = 0;; Shift += 7) {
+        uint8_t Byte;
+        if (Shift > 21 || !readAll((char *)&Byte, 1)) {
+            disconnect();
+            return -1;
+        }
+        Length |= (size_t)(Byte & 0x7F) << Shift;
+        if ((Byte & 0x80) == 0) {
+            break;
+        }
+    }
+
+    switch (Header & 0xF0) {
+    case MQTTPUBACK: {
+        uint8_t IdBytes[2];
+        if (Length != 2 || !readAll((char *)IdBytes, 2)) {
+            disconnect();
+            return -1;
+        }
+        uint16_t Id = (IdBytes[0] << 8) | IdBytes[1];
+        for (size_t i = 0; i < InFlightCount; ++i) {
+            if (InFlight[i] == Id) {
+                InFlight[i] = InFlight[--InFlightCount];
+                break;
+            }
+        }
+        return MQTTIDLE;
+    }
+    case MQTTPUBLISHPACKET:
+        return readPublish(Header, Length);
+    default:
+        // CONNACK, SUBACK and PINGRESP need nothing more
+        return skip(Length) ? MQTTIDLE : -1;
+    }
+}
+
+// ============================================================================
+bool MqttClient::keepAlive() {
+    if (!Connected) {
+        return false;
+    }
+    if (Kernel::get_ms_count() - LastSend < MQTTKEEPALIVE * 1000 / 2) {
+        return true;
+    }
+    if (!sendShort(MQTTPINGREQ, NULL, 0)) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+int MqttClient::readPublish(uint8_t Header, size_t Length) {
+    // the topic is not kept, there is only one subscription
+    uint8_t Bytes[2];
+    if (Length < 2 || !readAll((char *)Bytes, 2)) {
+        disconnect();
+        return -1;
+    }
+    size_t TopicLength = (Bytes[0] << 8) | Bytes[1];
+    bool QoS1 = (Header & 0x06) != 0;
+    size_t Used = 2 + TopicLength + (QoS1 ? 2 : 0);
+    if (Used > Length || !skip(TopicLength) ||
+        (QoS1 && !readAll((char *)Bytes, 2))) {
+        disconnect();
+        return -1;
+    }
+
+    size_t Payload = Length - Used;
+    size_t Kept = Payload < MQTTMESSAGEMAX ? Payload : MQTTMESSAGEMAX;
+    if (!readAll(Message, Kept) || !skip(Payload - Kept)) {
+        disconnect();
+        return -1;
+    }
+    Message[Kept] = '\0';
+
+    if (QoS1 && !sendShort(MQTTPUBACK, Bytes, 2)) {
+        disconnect();
+        return -1;
+    }
+    return MQTTMESSAGE;
+}
+
+bool MqttClient::sendAll(const char *data, size_t length) {
+    while (length > 0) {
+        nsapi_size_or_error_t sent = Link.send(data, length);
+        if (sent <= 0) {
+            return false;
+        }
+        linkSent(sent);
+        uplinkSent(sent);
+        data += sent;
+        length -= sent;
+    }
+    LastSend = Kernel::get_ms_count();
+    return true;
+}
+
+bool MqttClient::readAll(char *data, size_t length) {
+    while (length > 0) {
+        nsapi_size_or_error_t got = Link.recv(data, length);
+        if (got <= 0) {
+            return false;
+        }
+        linkReceived(got);
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+bool MqttClient::sendShort(uint8_t Header, const uint8_t *Rest,
+                           size_t Length) {
+    uint8_t Packet[6] = {Header, (uint8_t)Length};
+    if (Length > 0) {
+        memcpy(Packet + 2, Rest, Length);
+    }
+    return sendAll((const char *)Packet, 2 + Length);
+}
+
+bool MqttClient::sendHeader(uint8_t Header, size_t Length) {
+    uint8_t Bytes[5] = {Header};
+    size_t Used = 1;
+    do {
+        uint8_t Byte = Length & 0x7F;
+        Length >>= 7;
+        Bytes[Used++] = Length > 0 ? (Byte | 0x80) : Byte;
+    } while (Length > 0 && Used < sizeof(Bytes));
+    return sendAll((const char *)Bytes, Used);
+}
+
+bool MqttClient::sendString(const char *Text, size_t Length) {
+    uint8_t Bytes[2] = {(uint8_t)(Length >> 8), (uint8_t)Length};
+    return sendAll((const char *)Bytes, sizeof(Bytes)) &&
+           sendAll(Text, Length);
+}
+
+bool MqttClient::skip(size_t Length) {
+    char Scratch[32];
+    while (Length > 0) {
+        size_t Take = Length < sizeof(Scratch) ? Length : sizeof(Scratch);
+        if (!readAll(Scratch, Take)) {
+            disconnect();
+            return false;
+        }
+        Length -= Take;
+    }
+    return true;
+}
+
+uint16_t MqttClient::nextPacketId() {
+    // 0 is not a valid packet id
+    if (++PacketId == 0) {
+        PacketId = 1;
+    }
+    return PacketId;
+}
+
+#endif // NETWORKSOCKETS
@@ -0,0 +1,115 @@
+#ifndef MQTTCLIENT_H
+#define MQTTCLIENT_H
+/// \file
+/// \brief A small MQTT 3.1.1 client on top of one TCPSocket.
+///
+/// It only has what the board needs: QoS 1 publishes with a window of
+/// packets waiting for their PUBACK, one subscription, and the keep-alive
+/// pings. Only built when NETWORKSOCKETS is set, see MQTTPUBLISH in
+/// Networking.h.
+
+#include "Networking.h"
+
+#if NETWORKSOCKETS
+
+#include "TCPSocket.h"
+
+/// The most PUBLISH packets that can wait for their PUBACK at once
+#define MQTTWINDOW (4)
+
+/// The broker closes the link if nothing was sent for 1.5 times this many
+/// seconds
+#define MQTTKEEPALIVE (60)
+
+/// How long to wait for the rest of a packet, or for a CONNACK, in
+/// milliseconds
+#define MQTTTIMEOUT (5000)
+
+/// The most bytes of a message from the broker that are kept, the rest is
+/// dropped
+#define MQTTMESSAGEMAX (RESPONSESIZE)
+
+/// poll() read nothing, or a packet that was handled by the client
+#define MQTTIDLE (0)
+
+/// poll() read a message on the subscribed topic, see message()
+#define MQTTMESSAGE (1)
+
+class MqttClient {
+  public:
+    MqttClient();
+
+    /// Connects to the broker at Address, with a clean session, and
+    /// subscribes to Subscribe with QoS 1.
+    /// \returns false if the broker did not take the connection
+    bool connect(NetworkInterface *Net, const SocketAddress &Address,
+                 const char *ClientId, const char *Subscribe);
+
+    /// Sends a DISCONNECT and closes the link. Anything in flight is lost
+    void disconnect();
+
+    /// Returns true while the link to the broker is up
+    bool connected() const { return Connected; }
+
+    /// Starts a QoS 1 PUBLISH with a payload of Length bytes, which then
+    /// have to be written with write(). The window must not be full.
+    /// \returns false if the header could not be sent
+    bool beginPublish(const char *Topic, size_t Length, bool Retain);
+
+    /// Writes part of the payload of a PUBLISH. Also used as the flush
+    /// function of a RequestWriter
+    bool write(const char *data, size_t length);
+
+    /// Returns the number of PUBLISH packets waiting for their PUBACK
+    size_t inFlight() const { return InFlightCount; }
+
+    /// Waits up to TimeoutMs for a packet from the broker and handles it.
+    /// \returns MQTTIDLE, MQTTMESSAGE, or a negative number once the link is
+    /// lost
+    int poll(int TimeoutMs);
+
+    /// Sends a PINGREQ if nothing was sent for half of MQTTKEEPALIVE
+    /// \returns false if the link is lost
+    bool keepAlive();
+
+    /// Returns the payload of the last message, '\0' terminated
+    const char *message() const { return Message; }
+
+  private:
+    bool sendAll(const char *data, size_t length);
+    bool readAll(char *data, size_t length);
+
+    /// sends a packet with a fixed header and up to 4 bytes after it
+    bool sendShort(uint8_t Header, const uint8_t *Rest, size_t Length);
+
+    /// sends the fixed header of a packet of Length more bytes
+    bool sendHeader(uint8_t Header, size_t Length);
+
+    /// sends a string with its 16 bit length in front
+    bool sendString(const char *Text, size_t Length);
+
+    /// reads the body of a PUBLISH from the broker
+    int readPublish(uint8_t Header, size_t Length);
+
+    /// drops Length bytes of a packet that is not kept
+    bool skip(size_t Length);
+
+    uint16_t nextPacketId();
+
+    TCPSocket Link;
+    bool Connected;
+    uint16_t PacketId;
+
+    /// the packet ids that are waiting for their PUBACK
+    uint16_t InFlight[MQTTWINDOW];
+    size_t InFlightCount;
+
+    /// when something was last sent, from Kernel::get_ms_count()
+    uint64_t LastSend;
+
+    char Message[MQTTMESSAGEMAX + 1];
+};
+
+#endif // NETWORKSOCKETS
+
+#endif // MQTTCLIENT
@@ -0,0 +1,73 @@
+/// \file
+/// \brief Implementation of the choice between the network interfaces
+#include "Multipath.h"
+
+#include <cstring>
+
+Multipath::Multipath(size_t Count)
+    : Count(Count < MULTIPATHMAX ? Count : MULTIPATHMAX), Current(-1) {
+    memset(Paths, 0, sizeof(Paths));
+}
+
+// ============================================================================
+void Multipath::setUp(size_t Path, bool Up) { Paths[Path].Up = Up; }
+
+// ============================================================================
+void Multipath::sent(size_t Path, size_t Bytes, uint32_t Ms) {
+    PathStats &Stats = Paths[Path];
+    // a response within the same millisecond still counts as one
+    float Latency = Ms > 0 ? (float)Ms : 1.0f;
+    float Rate = Bytes * 1000.0f / Latency;
+    if (Stats.Requests == 0) {
+        Stats.LatencyMs = Latency;
+        Stats.BytesPerSecond = Rate;
+    } else {
+        Stats.LatencyMs += MULTIPATHWEIGHT * (Latency - Stats.LatencyMs);
+        Stats.BytesPerSecond += MULTIPATHWEIGHT * (Rate - Stats.BytesPerSecond);
+    }
+    ++Stats.Requests;
+    Stats.FailedInRow = 0;
+}
+
+// ============================================================================
+void Multipath::failed(size_t Path, uint64_t NowMs) {
+    PathStats &Stats = Paths[Path];
+    ++Stats.Failures;
+    if (Stats.FailedInRow < UINT8_MAX) {
+        ++Stats.FailedInRow;
+    }
+    Stats.FailedAtMs = NowMs;
+}
+
+bool Multipath::usable(size_t Path, uint64_t NowMs) const {
+    const PathStats &Stats = Paths[Path];
+    return Stats.Up && (Stats.FailedInRow < MULTIPATHFAILURES ||
+                        NowMs - Stats.FailedAtMs >= MULTIPATHRETRYMS);
+}
+
+// ============================================================================
+int Multipath::choose(uint64_t NowMs) {
+    if (Current >= 0 && !usable(Current, NowMs)) {
+        Current = -1;
+    }
+
+    for (size_t i = 0; i < Count; ++i) {
+        if (!usable(i, NowMs) || (int)i == Current) {
+            continue;
+        }
+        // the first usable path when there is none yet, an earlier one
+        // that is back unless it was measured to be slower, or one that was
+        // measured to be a lot faster
+        bool Measured = Current >= 0 && Paths[i].Requests > 0 &&
+                        Paths[Current].Requests > 0;
+        float Latency = Measured ? Paths[Current].LatencyMs : 0.0f;
+        bool Back = (int)i < Current &&
+                    !(Measured && Paths[i].LatencyMs > Latency);
+        bool Faster =
+            Measured && Paths[i].LatencyMs < MULTIPATHMARGIN * Latency;
+        if (Current < 0 || Back || Faster) {
+            Current = i;
+        }
+    }
+    return Current;
+}
@@ -0,0 +1,93 @@
+#ifndef MULTIPATH_H
+#define MULTIPATH_H
+/// \file
+/// \brief Picks which of the network interfaces the server links go over.
+///
+/// Every interface is a path. The socket backend tells it whether each path
+/// is up, and how long every request took from its first byte to the end of
+/// its response, or that it failed. From that it keeps the latency and the
+/// throughput of each path, as averages that follow the last few requests.
+///
+/// choose() stays on the path it is on while that works, so the links are
+/// not closed and opened again for nothing. It moves when the path is down
+/// or failed MULTIPATHFAILURES requests in a row, or when the other path was
+/// measured and is faster by MULTIPATHMARGIN. An earlier path that comes
+/// back is taken again, unless it was measured to be slower. The first path
+/// is the Ethernet port. With nothing to move to, the readings go to the
+/// backup log as they do without a network. A path that failed is tried
+/// again after MULTIPATHRETRYMS.
+
+#include <cstddef>
+#include <cstdint>
+
+/// The most interfaces, the Ethernet port and the ESP8266
+#define MULTIPATHMAX (2)
+
+/// Requests that fail in a row before a path is given up
+#define MULTIPATHFAILURES (3)
+
+/// How long a path that was given up is left alone, in milliseconds
+#define MULTIPATHRETRYMS (60000)
+
+/// Another path has to take less than this much of the latency of the
+/// current one before the links move to it
+#define MULTIPATHMARGIN (0.5f)
+
+/// How much a new request counts in the averages
+#define MULTIPATHWEIGHT (0.125f)
+
+/// What is known about one path
+struct PathStats {
+    /// the interface has an address
+    bool Up;
+
+    /// requests that got a response, and requests that failed
+    uint32_t Requests;
+    uint32_t Failures;
+
+    /// failures since the last request that got a response
+    uint8_t FailedInRow;
+
+    /// when the last failure was, in Kernel::get_ms_count() milliseconds
+    uint64_t FailedAtMs;
+
+    /// the average time from a request's first byte to its response
+    float LatencyMs;
+
+    /// the average bytes of a request over that time
+    float BytesPerSecond;
+};
+
+class Multipath {
+  public:
+    /// Count paths, none of them up yet
+    explicit Multipath(size_t Count);
+
+    /// Sets whether Path has an address
+    void setUp(size_t Path, bool Up);
+
+    /// A request of Bytes on Path got its response after Ms milliseconds
+    void sent(size_t Path, size_t Bytes, uint32_t Ms);
+
+    /// A request on Path could not be sent, or got no response
+    void failed(size_t Path, uint64_t NowMs);
+
+    /// Returns the path the links should be on at NowMs, -1 if none can be
+    /// used
+    int choose(uint64_t NowMs);
+
+    /// Returns what is known about Path
+    const PathStats &stats(size_t Path) const { return Paths[Path]; }
+
+  private:
+    /// true if Path is up and was not given up
+    bool usable(size_t Path, uint64_t NowMs) const;
+
+    PathStats Paths[MULTIPATHMAX];
+    size_t Count;
+
+    /// the path of the last choose(), -1 before the first
+    int Current;
+};
+
+#endif // MULTIPATH
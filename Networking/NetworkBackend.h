@@ -0,0 +1,85 @@
+#ifndef NETWORKBACKEND_H
+#define NETWORKBACKEND_H
+/// \file
+/// \brief The links to the server that each network backend has to provide.
+///
+/// Networking.cpp builds and streams the requests on top of these. They are
+/// implemented with raw AT commands in Networking.cpp, or on top of
+/// ESP8266Interface in SocketBackend.cpp when NETWORKSOCKETS is set. With
+/// LORAWANUPLINK there are none, LoraUplink.cpp has them only to fail.
+
+#include "Networking.h"
+
+/// The number of links to the server, the ESP8266 has 5 with CIPMUX=1
+#define SERVERLINKS (4)
+
+/// The link that live readings are sent on
+#define LIVELINK (0)
+
+/// The first of the links that backed up readings are sent on. A request
+/// goes out on each of them before the first response is read, so the
+/// server works on them at the same time
+#define BACKLOGLINK (1)
+
+/// The number of links for backed up readings
+#define BACKLOGLINKS (SERVERLINKS - BACKLOGLINK)
+
+/// Connects Link to the server in Specs if it is not open already, and
+/// gets it ready for the response to the next request
+/// returns NETWORKSUCCESS if successful, -1 otherwise
+int openServerLink(ATCmdParser *_parser, BoardSpecs &Specs, int Link);
+
+/// returns true if Link was left open by an earlier message
+bool serverLinkOpen(int Link);
+
+/// Writes one piece of a request to the open Link
+/// returns false if it could not be sent
+bool writeServerLink(ATCmdParser *_parser, int Link, const char *data,
+                     size_t length);
+
+/// Waits for the server's response to the request that was written to Link
+/// and passes it to parseServerResponse(). Responses on the other links are
+/// taken in while it waits.
+int readServerResponse(ATCmdParser *_parser, int Link, float &response);
+
+/// Waits for the server's response to the request that was written to Link
+/// like readServerResponse(), and copies its body to Body instead of
+/// parsing it. A body longer than Size bytes failed
+/// returns NETWORKSUCCESS with Length set to the bytes of the body, -5 if
+/// there was no whole response, or NETWORKNOTFOUND if it was not a 200
+int readServerBody(ATCmdParser *_parser, int Link, uint8_t *Body, size_t Size,
+                   size_t &Length);
+
+/// Closes Link, the next message on it then connects again
+void closeServerLink(ATCmdParser *_parser, int Link);
+
+/// Returns the address to connect to for the server in Specs, RemoteIP
+/// itself if it is an address, or what the name resolved to. The name is
+/// only looked up when DnsCache.h has no address for it that is still good
+const char *serverAddress(ATCmdParser *_parser, BoardSpecs &Specs);
+
+#if NETWORKSOCKETS
+#include "NetworkInterface.h"
+
+/// how long a socket call can block, in milliseconds. A mesh takes a hop
+/// of radio for every router on the way, and a modem in PSM may have to
+/// find the cell again
+#if NETWORKMESH || NETWORKCELLULAR
+#define SOCKETTIMEOUT (10000)
+#else
+#define SOCKETTIMEOUT (3000)
+#endif
+
+/// The ESP8266Interface, the EthernetInterface with NETWORKETHERNET, or the
+/// MeshInterface with NETWORKMESH, or the CellularContext with
+/// NETWORKCELLULAR, for sockets other than the server links
+NetworkInterface *socketInterface();
+
+#if NETWORKETHERNET
+/// The EthernetInterface, for the sockets that have to be on the site's
+/// wired network whichever path the server links took
+NetworkInterface *wiredInterface();
+#endif
+#endif
+
+#endif // NETWORKBACKEND
@@ -1,5 +1,41 @@
+#define TRACE_GROUP "net"
 #include "Networking.h"
 
+#include "ATTimeouts.h"
+#include "AdaptiveRate.h"
+#include "Aggregator.h"
+#include "AllocProfiler.h"
+#include "BacklogThrottle.h"
+#include "BatchSizer.h"
+#include "CaptureStore.h"
+#include "CborWriter.h"
+#include "CoapUplink.h"
+#include "ConfigDelta.h"
+#include "CrashLog.h"
+#include "DeferredLog.h"
+#include "DnsCache.h"
+#include "ESPTranscript.h"
+#include "EnergyIntegrator.h"
+#include "EnergyMeter.h"
+#include "FirmwareUpdate.h"
+#include "FlashQueue.h"
+#include "FrameCodec.h"
+#include "Gateway.h"
+#include "HeatshrinkEncoder.h"
+#include "LinkStats.h"
+#include "LoraPacker.h"
+#include "LoraUplink.h"
+#include "MemoryTelemetry.h"
+#include "MqttClient.h"
+#include "NetworkBackend.h"
+#include "PipelineTrace.h"
+#include "PowerQuality.h"
+#include "RemoteShell.h"
+#include "RequestWriter.h"
+#include "Sequence.h"
+#include "SensorHealth.h"
+#include "TimeSync.h"
+#include "platform/Span.h"
 #include "debugging.h"
 /// \file
 /// \brief Implementation for all network functions
@@ -9,8 +45,61 @@ const char *value_get_str = "&Value[]=";
 /// The string that preceeds the port ID field
 const char *port_get_str = "&Port_ID[]=";
 
+/// The string that preceeds the time of a backed up reading
+const char *time_get_str = "&Time[]=";
+
+/// The strings that preceed what a value is and how many readings it was
+/// made of, with AGGREGATEWINDOW, see Aggregator.h
+const char *kind_get_str = "&Kind[]=";
+const char *count_get_str = "&Count[]=";
+
+/// The Kind[] of each FrameKind
+static const char *const KindNames[FRAMEKINDS] = {
+    "raw", "burst", "mean", "min", "max", "p50", "p95", "p99"};
+
 const char *id_get_str = "Board_ID=";
 
+/// The string that preceeds the version of the config, see ConfigDelta.h
+const char *version_get_str = "&Config_Version=";
+
+/// The string that preceeds the memory telemetry, see MemoryTelemetry.h
+const char *telemetry_get_str = "&Mem=";
+
+/// The string that preceeds the power quality of a port, see PowerQuality.h
+const char *quality_get_str = "&PQ[]=";
+
+/// The string that preceeds the energy totals of a port, see
+/// EnergyIntegrator.h
+const char *energy_get_str = "&Energy[]=";
+
+/// The string that preceeds a port whose sensor is faulted, see
+/// SensorHealth.h
+const char *fault_get_str = "&Fault[]=";
+
+/// The string that preceeds the report of the last reset, see CrashLog.h
+const char *crash_get_str = "&Crash=";
+
+/// The string that preceeds the counters of the links, see LinkStats.h
+const char *link_get_str = "&Link=";
+
+/// The string that preceeds the answer to the server's diagnostic commands,
+/// see RemoteShell.h
+const char *diag_get_str = "&Diag=";
+
+/// The strings that preceed the sequence number of a reading, the stream
+/// the numbers are of, and the oldest number the board still has to send,
+/// see Sequence.h
+const char *sequence_get_str = "&Seq[]=";
+const char *stream_get_str = "&Stream=";
+const char *floor_get_str = "&Seq_Floor=";
+
+/// The strings that preceed the version of the running firmware, and the
+/// version and offset of the update whose patch is fetched, see
+/// FirmwareUpdate.h
+const char *firmware_get_str = "&Firmware=";
+const char *update_get_str = "&Update=";
+const char *offset_get_str = "&Offset=";
+
 const char *get_req_start = "GET ";
 
 /// required for the `Host` HTTP header
@@ -18,224 +107,3052 @@ const char *req_header = "Host: ";
 
 const char *get_req_end = "\r\n";
 
-const int response_size = 256;
+/// ends the request line, HTTP/1.1 is needed to keep the link open
+const char *http_version = " HTTP/1.1\r\n";
 
-int startESP(ATCmdParser *_parser) {
-    _parser->send("AT+CIPCLOSE=5");
-    _parser->recv("OK");
-    _parser->send("AT+CWMODE=3");
-    _parser->recv("OK");
-    _parser->send("AT+CIPMUX=1");
-    if (_parser->recv("OK"))
-        return NETWORKSUCCESS;
-    else
-        return -1;
-}
+/// asks the server to keep the link open after the response
+const char *keep_alive_header = "Connection: keep-alive\r\n";
 
-int connectESPWiFi(ATCmdParser *_parser, BoardSpecs &Specs) {
+/// starts a request with a CBOR body
+const char *post_req_start = "POST ";
 
-    _parser->send("AT+CWJAP=\"%s\",\"%s\"", Specs.NetworkSSID.c_str(),
-                  Specs.NetworkPassword.c_str());
+/// the headers of the CBOR body, the length follows
+const char *cbor_headers =
+    "Content-Type: application/cbor\r\nContent-Length: ";
 
-    if (_parser->recv("OK")) {
-        if (checkESPWiFiConnection(_parser)) {
-            return NETWORKSUCCESS;
-        } else {
-            return -2;
+/// the header of a body that went through HeatshrinkEncoder.h
+const char *heatshrink_header = "Content-Encoding: heatshrink\r\n";
+
+/// tells a waveform capture from the readings, after the board id
+const char *capture_get_str = "&Capture=1";
+
+/// tells the readings that a gateway relays for its children from its own,
+/// after the board id, with the number of bodies in the array
+const char *relayed_get_str = "&Relayed=";
+
+/// requests are formatted into here one piece at a time while they are sent,
+/// so sending never touches the heap
+static char ChunkBuffer[SENDCHUNKSIZE + 1];
+
+// swallows everything, used to measure requests
+static bool discardText(const char *data, size_t length) { return true; }
+
+/// The most requests that one batch of backed up readings is sent in, MQTT,
+/// CoAP and LoRaWAN send a batch their own way
+#if MQTTPUBLISH || COAPUPLINK || LORAWANUPLINK
+#define BATCHREQUESTS (1)
+#else
+#define BATCHREQUESTS (BACKLOGLINKS)
+#endif
+
+// appends a Port_ID/Value pair for every port in Frame, and the time of the
+// frame too if Stamp is true
+static void appendReadings(RequestWriter &Message, const SampleFrame &Frame,
+                           Span<const PortInfo> Ports, bool Stamp) {
+    for (size_t i = 0; i < (size_t)Ports.size(); ++i) {
+        if (Frame.hasPort(i)) {
+            Message.append(port_get_str);
+            Message.append(Ports[i].Name.c_str());
+            Message.append(value_get_str);
+            Message.appendFloat(Frame.value(i, Ports[i].Multiplier));
+            if (Stamp) {
+                Message.append(time_get_str);
+                Message.appendUnsigned(Frame.Timestamp);
+            }
+#if AGGREGATEWINDOW
+            // every pair has them, so the arrays stay lined up
+            Message.append(kind_get_str);
+            Message.append(KindNames[Frame.Kind]);
+            Message.append(count_get_str);
+            Message.appendUnsigned(Frame.Count > 0 ? Frame.Count : 1);
+#endif
+#if SEQUENCEDUPLOADS
+            Message.append(sequence_get_str);
+            Message.appendUnsigned(Frame.Sequence);
+#endif
         }
-    } else {
-        return -1;
     }
 }
 
-// =============================================================================
-string makeGetReqStr(BoardSpecs &Specs) {
-    // make the message to send
-    // get the size to allocate memory
-    size_t message_size = strlen(get_req_start) + Specs.RemoteDir.size() +
-                          Specs.DatabaseTableName.size() + 1;
-    // the 1 is for the '?'
-
-    size_t End = Specs.Ports.size();
-    size_t get_extras = strlen(port_get_str) + strlen(value_get_str);
-
-    for (size_t i = 0; i < End; ++i) {
-        if (Specs.Ports[i].Multiplier != 0) {
-            message_size += Specs.Ports[i].Name.size() +
-                            to_string(Specs.Ports[i].Value).size() + get_extras;
+#if POWERQUALITY
+// appends the metrics of every analyzed port, separated by commas
+static void appendPowerQuality(RequestWriter &Message) {
+    PowerStats Stats[PQMAXPORTS];
+    size_t Count = powerQuality().latest(Stats);
+    for (size_t i = 0; i < Count; ++i) {
+        float Values[PQVALUES];
+        powerValues(Stats[i], Values);
+        Message.append(quality_get_str);
+        Message.appendUnsigned(Stats[i].Port);
+        for (size_t j = 1; j < PQVALUES; ++j) {
+            Message.append(",");
+            Message.appendFloat(Values[j]);
         }
     }
-    // add on for the \r\n
-    message_size +=
-        strlen(id_get_str) + strlen(get_req_start) + strlen(get_req_end);
-    message_size += strlen(req_header) + Specs.HostName.size() + strlen("\r\n");
+}
+#endif
 
-    string Message = get_req_start;
+#if ENERGYINTEGRATOR
+// appends the kept totals of every port, separated by commas
+static void appendEnergy(RequestWriter &Message) {
+    EnergyTotals Totals;
+    size_t Count = energyIntegrator().latest(Totals);
+    for (size_t i = 0; i < Count; ++i) {
+        uint32_t Values[ENERGYVALUES];
+        energyValues(Totals, i, Values);
+        Message.append(energy_get_str);
+        for (size_t j = 0; j < ENERGYVALUES; ++j) {
+            if (j > 0) {
+                Message.append(",");
+            }
+            Message.appendUnsigned(Values[j]);
+        }
+    }
+}
+#endif
 
-    // reserve so that further allocations are not needed
-    Message.reserve(message_size);
+#if SENSORHEALTH
+// appends the faulted ports, separated by commas
+static void appendFaults(RequestWriter &Message) {
+    SensorFault Faults[FRAMEMAXPORTS];
+    size_t Count = sensorHealth().faults(Faults);
+    for (size_t i = 0; i < Count; ++i) {
+        uint32_t Values[SENSORFAULTVALUES];
+        faultValues(Faults[i], Values);
+        Message.append(fault_get_str);
+        for (size_t j = 0; j < SENSORFAULTVALUES; ++j) {
+            if (j > 0) {
+                Message.append(",");
+            }
+            Message.appendUnsigned(Values[j]);
+        }
+    }
+}
+#endif
 
+// writes the request line up to the end of the board id
+static void appendRequestStart(RequestWriter &Message, BoardSpecs &Specs) {
+    Message.append(get_req_start);
     Message.append(Specs.RemoteDir);
-
     Message.append("?");
-
     Message.append(id_get_str);
-
     Message.append(Specs.DatabaseTableName);
-
-    // append to get request for every active port
-    for (size_t i = 0; i < End; ++i) {
-        if (Specs.Ports[i].Multiplier != 0) {
-            Message.append(port_get_str);
-            Message.append(Specs.Ports[i].Name);
-            Message.append(value_get_str);
-            Message.append(to_string(Specs.Ports[i].Value));
+    Message.append(version_get_str);
+    Message.appendUnsigned(Specs.ConfigVersion);
+#if SEQUENCEDUPLOADS
+    Message.append(stream_get_str);
+    Message.appendUnsigned(sequenceStream());
+#endif
+#if OTAUPDATE
+    Message.append(firmware_get_str);
+    Message.appendUnsigned(FIRMWAREVERSION);
+#endif
+#if MEMORYTELEMETRY
+    // the values of the latest sample, separated by commas
+    uint32_t Values[TELEMETRYVALUES];
+    telemetryValues(memoryTelemetry(), Values);
+    Message.append(telemetry_get_str);
+    for (size_t i = 0; i < TELEMETRYVALUES; ++i) {
+        if (i > 0) {
+            Message.append(",");
+        }
+        Message.appendUnsigned(Values[i]);
+    }
+#endif
+#if POWERQUALITY
+    appendPowerQuality(Message);
+#endif
+#if ENERGYINTEGRATOR
+    appendEnergy(Message);
+#endif
+#if SENSORHEALTH
+    appendFaults(Message);
+#endif
+#if LINKSTATS
+    uint32_t Link[LINKVALUES];
+    if (linkStatsWindow(Link)) {
+        Message.append(link_get_str);
+        for (size_t i = 0; i < LINKVALUES; ++i) {
+            if (i > 0) {
+                Message.append(",");
+            }
+            Message.appendUnsigned(Link[i]);
         }
     }
-    Message.append("\r\n");
+#endif
+    // until a request with it was answered
+    const char *Crash = crashReport();
+    if (Crash != NULL) {
+        Message.append(crash_get_str);
+        Message.append(Crash);
+    }
+    const char *Diag = shellReply();
+    if (Diag != NULL) {
+        Message.append(diag_get_str);
+        Message.append(Diag);
+    }
+}
+
+// ends the request line and adds the headers
+static void appendRequestEnd(RequestWriter &Message, BoardSpecs &Specs) {
+    Message.append(http_version);
     Message.append(req_header);
     Message.append(Specs.HostName);
     Message.append(get_req_end);
+    Message.append(keep_alive_header);
+    Message.append(get_req_end);
+}
+
+// the number of digits that appendUnsigned() writes for Value
+static size_t digitCount(uint32_t Value) {
+    size_t Digits = 1;
+    while (Value >= 10) {
+        Value /= 10;
+        ++Digits;
+    }
+    return Digits;
+}
+
+// the number of bytes that appendRequestStart() adds
+static size_t requestStartSize(BoardSpecs &Specs) {
+    size_t Size = strlen(get_req_start) + Specs.RemoteDir.size() + 1 +
+                  strlen(id_get_str) + Specs.DatabaseTableName.size() +
+                  strlen(version_get_str) + digitCount(Specs.ConfigVersion);
+#if SEQUENCEDUPLOADS
+    Size += strlen(stream_get_str) + digitCount(sequenceStream());
+#endif
+#if OTAUPDATE
+    Size += strlen(firmware_get_str) + digitCount(FIRMWAREVERSION);
+#endif
+#if MEMORYTELEMETRY
+    uint32_t Values[TELEMETRYVALUES];
+    telemetryValues(memoryTelemetry(), Values);
+    Size += strlen(telemetry_get_str) + TELEMETRYVALUES - 1;
+    for (size_t i = 0; i < TELEMETRYVALUES; ++i) {
+        Size += digitCount(Values[i]);
+    }
+#endif
+#if POWERQUALITY
+    char Scratch[32];
+    RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+    appendPowerQuality(Counter);
+    Counter.finish();
+    Size += Counter.flushed();
+#endif
+#if ENERGYINTEGRATOR
+    EnergyTotals Totals;
+    size_t Ports = energyIntegrator().latest(Totals);
+    for (size_t i = 0; i < Ports; ++i) {
+        uint32_t Values[ENERGYVALUES];
+        energyValues(Totals, i, Values);
+        Size += strlen(energy_get_str) + ENERGYVALUES - 1;
+        for (size_t j = 0; j < ENERGYVALUES; ++j) {
+            Size += digitCount(Values[j]);
+        }
+    }
+#endif
+#if SENSORHEALTH
+    SensorFault Faults[FRAMEMAXPORTS];
+    size_t Faulted = sensorHealth().faults(Faults);
+    for (size_t i = 0; i < Faulted; ++i) {
+        uint32_t Values[SENSORFAULTVALUES];
+        faultValues(Faults[i], Values);
+        Size += strlen(fault_get_str) + SENSORFAULTVALUES - 1;
+        for (size_t j = 0; j < SENSORFAULTVALUES; ++j) {
+            Size += digitCount(Values[j]);
+        }
+    }
+#endif
+#if LINKSTATS
+    uint32_t Link[LINKVALUES];
+    if (linkStatsWindow(Link)) {
+        Size += strlen(link_get_str) + LINKVALUES - 1;
+        for (size_t i = 0; i < LINKVALUES; ++i) {
+            Size += digitCount(Link[i]);
+        }
+    }
+#endif
+    const char *Crash = crashReport();
+    if (Crash != NULL) {
+        Size += strlen(crash_get_str) + strlen(Crash);
+    }
+    const char *Diag = shellReply();
+    if (Diag != NULL) {
+        Size += strlen(diag_get_str) + strlen(Diag);
+    }
+    return Size;
+}
+
+// the number of bytes that appendRequestEnd() adds
+static size_t requestEndSize(BoardSpecs &Specs) {
+    return strlen(http_version) + strlen(req_header) + Specs.HostName.size() +
+           strlen(keep_alive_header) + 2 * strlen(get_req_end);
+}
 
-    return Message;
+static Span<const PortInfo> portSpan(BoardSpecs &Specs) {
+    return Span<const PortInfo>(Specs.Ports.data(), Specs.Ports.size());
 }
-// ===========================================================================
 
-string makeGetReqStr(vector<PortInfo> Ports, BoardSpecs &Specs) {
-    // make the message to send
-    // get the size to allocate memory
-    size_t message_size = strlen(get_req_start) + Specs.RemoteDir.size() +
-                          Specs.DatabaseTableName.size() + 1;
-    // the 1 is for the '?'
+// =============================================================================
+size_t makeGetReq(char *Buf, size_t Size, const SampleFrame &Frame,
+                  BoardSpecs &Specs) {
+    RequestWriter Message(Buf, Size);
+
+    appendRequestStart(Message, Specs);
+    appendReadings(Message, Frame, portSpan(Specs), false);
+    appendRequestEnd(Message, Specs);
+
+    return Message.overflowed() ? 0 : Message.length();
+}
 
-    size_t End = Ports.size();
-    size_t get_extras = strlen(port_get_str) + strlen(value_get_str);
+// =============================================================================
+size_t makeBatchGetReq(char *Buf, size_t Size, const SampleFrame *Frames,
+                       size_t Count, BoardSpecs &Specs, size_t &Used) {
+    RequestWriter Message(Buf, Size);
+    appendRequestStart(Message, Specs);
 
-    for (size_t i = 0; i < End; ++i) {
-        if (Ports[i].Multiplier != 0.0f) {
-            message_size += Ports[i].Name.size() +
-                            to_string(Ports[i].Value).size() + get_extras;
+    // add whole frames until the next one would not leave room for the end
+    size_t end_size = requestEndSize(Specs);
+    Used = 0;
+    while (Used < Count) {
+        size_t start = Message.length();
+        appendReadings(Message, Frames[Used], portSpan(Specs), true);
+        if (Message.overflowed() || Message.length() + end_size >= Size) {
+            Message.truncate(start);
+            break;
         }
+        ++Used;
     }
-    // add on for the \r\n
-    message_size +=
-        strlen(id_get_str) + strlen(get_req_start) + strlen(get_req_end);
 
-    message_size += strlen(req_header) + Specs.HostName.size() + strlen("\r\n");
+    appendRequestEnd(Message, Specs);
+    return Message.overflowed() || Used == 0 ? 0 : Message.length();
+}
+//==============================================================================
 
-    string Message = get_req_start;
+// ============================================================================
+int parseServerResponse(const HttpResponse &Http, float &response) {
+    tr_info("Response: %d %s", Http.status(), Http.body());
 
-    // reserve so that further allocations are not needed
-    Message.reserve(message_size);
+    // the server's clock stamps the readings from here on
+    syncClock(Http.date());
+    if (Http.status() == 404)
+        return NETWORKNOTFOUND;
 
-    Message.append(Specs.RemoteDir);
+    // the server puts its settings into the body
+    parseServerSettings(Http.body(), response);
+    return NETWORKSUCCESS;
+}
 
-    Message.append("?");
+// ============================================================================
+int takeResponseBody(const HttpResponse &Http, uint8_t *Body, size_t Size,
+                     size_t &Length) {
+    Length = 0;
+    if (!Http.complete()) {
+        return -5;
+    }
+    syncClock(Http.date());
+    if (Http.status() != 200) {
+        return NETWORKNOTFOUND;
+    }
+    if (Http.truncated() || Http.bodyLength() > Size) {
+        return -5;
+    }
+    memcpy(Body, Http.body(), Http.bodyLength());
+    Length = Http.bodyLength();
+    return NETWORKSUCCESS;
+}
 
-    Message.append(id_get_str);
+#if BACKLOGQUERY
+/// The range of the backlog that the server asked for, and where it was
+/// asked to start. Only the uploader thread parses and sends
+static LogQuery Query;
+static uint32_t QueryStart = 0;
+static bool QueryWaiting = false;
 
-    Message.append(Specs.DatabaseTableName);
+// takes the range of a resend="From-To" of sequence numbers or a
+// resendtime="From-To" of times in Text. The same range again, which the
+// responses to its own batches may have, does not start it over
+static void offerBacklogQuery(const char *Text) {
+    uint8_t By = LOGQUERYSEQUENCE;
+    const char *Range = strstr(Text, "resend=\"");
+    if (Range != NULL) {
+        Range += strlen("resend=\"");
+    } else if ((Range = strstr(Text, "resendtime=\"")) != NULL) {
+        Range += strlen("resendtime=\"");
+        By = LOGQUERYTIME;
+    } else {
+        return;
+    }
+    char *End;
+    uint32_t From = strtoul(Range, &End, 10);
+    if (End == Range || *End != '-' || !isdigit(End[1])) {
+        return;
+    }
+    uint32_t To = strtoul(End + 1, NULL, 10);
+    // the readings from before the clock was set only have the time since
+    // the start, they can be asked for by number
+    if (By == LOGQUERYTIME && From < TIMEVALIDAFTER) {
+        From = TIMEVALIDAFTER;
+    }
+    if (From > To || (QueryWaiting && Query.By == By && QueryStart == From &&
+                      Query.To == To)) {
+        return;
+    }
+    Query.By = By;
+    Query.From = From;
+    Query.To = To;
+    Query.Done = 0;
+    QueryStart = From;
+    QueryWaiting = true;
+    tr_info("The server asked for %s %lu to %lu of the backlog",
+            By == LOGQUERYTIME ? "times" : "readings", (unsigned long)From,
+            (unsigned long)To);
+}
+#endif
 
-    // append to get request for every active port
-    for (size_t i = 0; i < End; ++i) {
-        if (Ports[i].Multiplier != 0.0f) {
-            Message.append(port_get_str);
-            Message.append(Ports[i].Name);
-            Message.append(value_get_str);
-            Message.append(to_string(Ports[i].Value));
+// ============================================================================
+void parseServerSettings(const char *Buf, float &response) {
+    // get polling rate
+    const char *tok = "samplerate=\"";
+    const char *ratestart = strstr(Buf, tok);
+    if (ratestart != NULL) {
+        // go right up to the float value
+        ratestart += strlen(tok);
+
+        if (isdigit(ratestart[0])) {
+            response = atof(ratestart);
         }
     }
-    Message.append("\r\n");
-    Message.append(req_header);
-    Message.append(Specs.HostName);
-    Message.append(get_req_end);
 
-    return Message;
+#if SEQUENCEDUPLOADS
+    // the highest number up to which the server has every reading
+    const char *acked = strstr(Buf, "acked=\"");
+    if (acked != NULL && isdigit(acked[7])) {
+        sequenceAcked(strtoul(acked + 7, NULL, 10));
+    }
+#endif
+
+#if ADAPTIVESAMPLING
+    // the fast bound of the adaptive intervals
+    offerAdaptiveRate(Buf);
+#endif
+#if BACKLOGQUERY
+    // a range of the backlog that the server wants again
+    offerBacklogQuery(Buf);
+#endif
+
+    // the sampling loop applies config changes between readings
+    offerConfigDelta(Buf);
+#if REMOTESHELL
+    // the uploader runs them between uploads
+    offerShellCommands(Buf);
+#endif
+#if BACKLOGTHROTTLE
+    // the share of the site's network that the backlog may take
+    offerBacklogRate(Buf);
+#endif
+#if OTAUPDATE
+    // the uploader fetches the update between uploads
+    offerFirmware(Buf);
+#endif
 }
-//==============================================================================
 
-// return true if you are connected, and false if you are not connected
-bool checkESPWiFiConnection(ATCmdParser *_parser) {
-    _parser->debug_on(0);
-    // 000.000.000.000 max of 15 characters
-    char ip_addr[16];
-    _parser->send("AT+CIFSR");
+// Everything below talks to the ESP8266 with raw AT commands.
+// SocketBackend.cpp has the same functions on top of ESP8266Interface, and
+// LoraUplink.cpp on top of the LoRaWAN stack.
+#if !NETWORKSOCKETS && !LORAWANUPLINK
+/// How long readServerResponse() sleeps while nothing comes in, in
+/// milliseconds
+#define RESPONSEPOLLMS (5)
 
-    _parser->recv("+CIFSR:STAIP,\"%15[^\"]\"", ip_addr);
+/// one of the ESP8266's links to the server
+struct ATLink {
+    ATLink()
+        : Open(false), Waiting(0), ClosedEarly(false),
+          Http(Body, sizeof(Body)) {}
 
-    ip_addr[15] = 0;
+    /// true while the link is connected to the server
+    volatile bool Open;
 
-    if (!_parser->recv("OK"))
+    /// the bytes that the ESP8266 holds for this link in its passive
+    /// receive mode, from the last +IPD, and whether the link closed before
+    /// they were read
+    int Waiting;
+    bool ClosedEarly;
+
+    /// the response to the last request on this link, filled in by
+    /// onPacket() whenever a +IPD for it comes in
+    char Body[RESPONSESIZE + 1];
+    HttpResponse Http;
+};
+
+static ATLink Links[SERVERLINKS];
+
+/// the messages of the ESP8266 when it closes a link, one for each of Links
+static const char *const LinkClosedMessages[SERVERLINKS] = {
+    "0,CLOSED", "1,CLOSED", "2,CLOSED", "3,CLOSED"};
+
+/// the parser that the message handlers were added to
+static ATCmdParser *WatchedParser = NULL;
+
+/// set by startESP() so the baud rate can be found again after a reset
+static DMAUARTSerial *ESPSerial = NULL;
+
+/// 1 if the +IPD data is taken where the DMA put it rather than byte by
+/// byte through the parser. A transcript has to see every byte
+#define ESPINPLACE (ESPTRANSCRIPT == ESPTRANSCRIPTOFF)
+
+#if ESPPASSIVERECV
+/// The most bytes that one AT+CIPRECVDATA returns
+#define ESPRECVDATAMAX (2048)
+
+/// true once the ESP8266 took AT+CIPRECVMODE=1. It then only sends
+/// "+IPD,<link>,<length>" when data comes in, and keeps the data until
+/// pullData() asks for it, so nothing piles up in the UART while the board
+/// is busy elsewhere. Older firmware keeps sending the data with the +IPD
+static bool PassiveRecv = false;
+#endif
+
+// points Data at up to Wanted bytes of +IPD data in the ring of the
+// ESP8266's UART, waiting up to SERIALTIMEOUT for the first one. The parser
+// reads one byte at a time, so nothing after the ':' was taken out yet.
+// Returns how many there are, or -1 if none came
+static int peekPiece(int Wanted, const char *&Data) {
+    uint64_t Until = Kernel::get_ms_count() + SERIALTIMEOUT;
+    Span<const uint8_t> Waiting = ESPSerial->peek_span();
+    while (Waiting.empty()) {
+        if (Kernel::get_ms_count() >= Until) {
+            return -1;
+        }
+        thread_sleep_for(1);
+        Waiting = ESPSerial->peek_span();
+    }
+    Data = (const char *)Waiting.data();
+    return Waiting.size() < (size_t)Wanted ? Waiting.size() : Wanted;
+}
+
+// points Data at up to Left bytes of the data that follows in the UART,
+// where the DMA put them or read into Piece. Returns how many there are, or
+// a negative number if none came in time
+static int nextPiece(ATCmdParser *_parser, int Left, char *Piece,
+                     const char *&Data) {
+    if (ESPINPLACE && ESPSerial != NULL) {
+        return peekPiece(Left, Data);
+    }
+    Data = Piece;
+    return _parser->read(Piece, Left < RESPONSEPIECE ? Left : RESPONSEPIECE);
+}
+
+// takes the Got bytes of the last nextPiece() out of the UART
+static void donePiece(int Got) {
+    if (ESPINPLACE && ESPSerial != NULL) {
+        ESPSerial->consume(Got);
+    }
+}
+
+#if ESPPASSTHROUGH
+#if PIPELINEDEPTH < 1 || PIPELINEDEPTH > BACKLOGLINKS
+#error "pipeline-depth has to be from 1 to the number of backlog links"
+#endif
+
+/// In transparent mode the ESP8266 sends what it got after this many
+/// milliseconds without more bytes, "+++" has to come on its own
+#define PASSTHROUGHGAPMS (20)
+
+/// How long the ESP8266 takes to leave transparent mode after "+++", in
+/// milliseconds
+#define PASSTHROUGHEXITMS (1000)
+
+/// true while the ESP8266 is in transparent mode. It then has its one
+/// connection to the server, every link is sent on it in turn, and the
+/// UART carries the server's bytes without any +IPD around them
+static bool Passthrough = false;
+
+// closes the single connection and goes back to CIPMUX=1
+static void restoreLinks(ATCmdParser *_parser) {
+    _parser->send("AT+CIPMODE=0");
+    _parser->recv("OK");
+    _parser->send("AT+CIPCLOSE");
+    _parser->recv("OK");
+    _parser->send("AT+CIPMUX=1");
+    _parser->recv("OK");
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        Links[i].Open = false;
+    }
+}
+
+// closes every link and opens the one connection of transparent mode. The
+// requests then go out as they are written, at the rate of the UART
+static bool enterPassthrough(ATCmdParser *_parser, BoardSpecs &Specs) {
+    if (Passthrough) {
+        return true;
+    }
+    _parser->send("AT+CIPCLOSE=5");
+    _parser->recv("OK");
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        Links[i].Open = false;
+    }
+
+    _parser->send("AT+CIPMUX=0");
+    bool Started = _parser->recv("OK");
+    if (Started) {
+        _parser->send("AT+CIPSTART=\"TCP\",\"%s\",%d",
+                      serverAddress(_parser, Specs), Specs.RemotePort);
+        Started = _parser->recv("OK");
+        if (!Started) {
+            expireAddress();
+        }
+    }
+    if (Started) {
+        _parser->send("AT+CIPMODE=1");
+        Started = _parser->recv("OK");
+    }
+    if (Started) {
+        _parser->send("AT+CIPSEND");
+        Started = _parser->recv(">");
+    }
+    if (!Started) {
+        tr_warn("The ESP8266 did not go into transparent mode");
+        restoreLinks(_parser);
         return false;
+    }
+    Passthrough = true;
+    tr_debug("Sending in transparent mode");
+    return true;
+}
 
-    // if that expression is true, then 0.0.0.0 is not in the ip address, and we
-    // ar connected
+// gets the ESP8266 out of transparent mode, so it takes AT commands again
+static void leavePassthrough(ATCmdParser *_parser) {
+    if (!Passthrough) {
+        return;
+    }
+    Passthrough = false;
+    ThisThread::sleep_for(PASSTHROUGHGAPMS);
+    _parser->write("+++", 3);
+    ThisThread::sleep_for(PASSTHROUGHEXITMS);
+    // whatever the server sent after the last response
+    _parser->flush();
+    restoreLinks(_parser);
+}
 
-    _parser->debug_on(1);
-    return strstr(ip_addr, "0.0.0.0") == NULL;
+// takes the response from the UART as it is, there is nothing else on it.
+// Only its own bytes are taken, the responses to the pipelined requests
+// after it stay in the UART for their links
+static void readPassthrough(ATCmdParser *_parser, HttpResponse &Http) {
+    size_t Got = 0;
+    while (!Http.complete() && !Http.failed()) {
+        if (ESPINPLACE && ESPSerial != NULL) {
+            const char *Data;
+            int Waiting = peekPiece(RESPONSEPIECE, Data);
+            if (Waiting < 0) {
+                break;
+            }
+            size_t Used = Http.feed(Data, Waiting);
+            ESPSerial->consume(Used);
+            Got += Used;
+            continue;
+        }
+        int c = _parser->getc();
+        if (c < 0) {
+            break;
+        }
+        char Byte = (char)c;
+        Http.feed(&Byte, 1);
+        ++Got;
+    }
+    linkReceived(Got);
 }
-// ============================================================================
-int sendMessageTCP(ATCmdParser *_parser, BoardSpecs &Specs, string &message,
-                   float &response) {
+#endif // ESPPASSTHROUGH
 
-    _parser->send("AT+CIPSTART=0,\"TCP\",\"%s\",%d", Specs.RemoteIP.c_str(),
-                  Specs.RemotePort);
-    if (!_parser->recv("OK")) {
-        _parser->send("AT+CIPCLOSE=5");
-        return -1;
+#if GATEWAYROLE
+/// The ESP8266's fifth link, which none of the server links use. The
+/// datagrams to and from the gateway go on it
+#define GATEWAYLINK (SERVERLINKS)
+
+/// the message of the ESP8266 when it closes GATEWAYLINK
+static const char *const GatewayClosedMessage = "4,CLOSED";
+
+/// true while GATEWAYLINK is set up for the datagrams
+static volatile bool GatewayOpen = false;
+
+static void onGatewayClosed() { GatewayOpen = false; }
+
+#if GATEWAYROLE == GATEWAYHUB
+/// the readings of the children, until they are sent to the server
+static GatewayQueue Relay;
+
+/// an ack that waits to be sent to the child it is for
+struct GatewayAck {
+    char Ip[16];
+    int Port;
+    uint16_t Id;
+    uint8_t Status;
+};
+
+/// the acks of the datagrams that came in since pollGateway() sent the last
+/// ones, filled in by onPacket()
+static GatewayAck Acks[GATEWAYACKS];
+static size_t AckCount = 0;
+
+/// the last datagram that came in on GATEWAYLINK
+static uint8_t Datagram[GATEWAYDATAGRAMMAX];
+
+// a datagram of Size bytes from the child at Ip and Port. Its body is only
+// queued if its ack can be sent too, without one the child backs it up
+static void takeDatagram(size_t Size, const char *Ip, int Port) {
+    GatewayHeader Header;
+    if (Size <= sizeof(Header) || AckCount == GATEWAYACKS) {
+        return;
+    }
+    memcpy(&Header, Datagram, sizeof(Header));
+    if (Header.Magic != GATEWAYMAGIC || Header.Kind != GATEWAYREADINGS) {
+        return;
     }
+    GatewayAck &Ack = Acks[AckCount++];
+    strncpy(Ack.Ip, Ip, sizeof(Ack.Ip) - 1);
+    Ack.Ip[sizeof(Ack.Ip) - 1] = '\0';
+    Ack.Port = Port;
+    Ack.Id = Header.Id;
+    Ack.Status = Relay.push(Datagram + sizeof(Header), Size - sizeof(Header))
+                     ? GATEWAYQUEUED
+                     : GATEWAYFULL;
+}
+#else
+/// the number of the last datagram that was sent to the gateway
+static uint16_t GatewayId = 0;
 
-    _parser->send("AT+CIPSEND=0,%d", message.size());
+/// the ack of GatewayId, filled in by onPacket()
+static GatewayHeader GatewayAnswer;
+static volatile bool GatewayAnswered = false;
 
-    if (!_parser->recv(">"))
-        return -3;
+/// only the header of an ack is taken in
+static uint8_t Datagram[sizeof(GatewayHeader)];
 
-    if (!_parser->send("%s", message.c_str()))
-        return -4;
+// a datagram from the gateway, only the ack of the last one counts
+static void takeDatagram(size_t Size) {
+    GatewayHeader Header;
+    if (Size < sizeof(Header)) {
+        return;
+    }
+    memcpy(&Header, Datagram, sizeof(Header));
+    if (Header.Magic == GATEWAYMAGIC && Header.Kind == GATEWAYACK &&
+        Header.Id == GatewayId) {
+        GatewayAnswer = Header;
+        GatewayAnswered = true;
+    }
+}
+#endif // GATEWAYROLE
+#endif // GATEWAYROLE
 
-    if (!_parser->recv("SEND OK")){
-        if (!_parser->recv("+IPD"))
-            return -5;
+// the server or the ESP8266 closed Link. A response without a length ends
+// here
+static void onLinkClosed(ATLink *Link) {
+    Link->Open = false;
+#if ESPPASSIVERECV
+    // what the ESP8266 still holds of the link comes first
+    if (Link->Waiting > 0) {
+        Link->ClosedEarly = true;
+        return;
+    }
+#endif
+    Link->Http.closed();
+}
+
+// "+IPD,<link>,<length>:" and the data. It is read to its exact length
+// into the response of its link, whatever the parser was waiting for
+static void onPacket() {
+    ATCmdParser *_parser = WatchedParser;
+    int id = -1;
+    int received = 0;
+#if ESPPASSIVERECV
+    // only the length comes, the data waits in the ESP8266 for pullData()
+    if (PassiveRecv) {
+        if (_parser->recv("%d,%d\n", &id, &received) && id >= 0 &&
+            id < SERVERLINKS) {
+            Links[id].Waiting = received;
+        }
+        return;
+    }
+#endif
+#if GATEWAYROLE == GATEWAYHUB
+    // AT+CIPDINFO=1 puts the sender in front of the data, so every child
+    // gets its own ack
+    char Ip[16] = "";
+    int Port = 0;
+    if (!_parser->recv("%d,%d,%15[^,],%d:", &id, &received, Ip, &Port)) {
+        return;
     }
-    else {
-        if (_parser->recv("+IPD")){
+#else
+    if (!_parser->recv("%d,%d:", &id, &received)) {
+        return;
+    }
+#endif
 
-            char Buf[response_size + 1];
-            _parser->read(Buf, response_size);
-            Buf[response_size] = 0;
-            printf("Response: %s\r\n", Buf);
-            if (strstr(Buf, "404"))
-                return -6;
+    char Piece[RESPONSEPIECE];
+#if GATEWAYROLE
+    int Length = received;
+    size_t Kept = 0;
+#endif
+    while (received > 0) {
+        const char *Data;
+        int got = nextPiece(_parser, received, Piece, Data);
+        if (got <= 0) {
+            break;
+        }
+        // data for a link that is not waiting for anything is dropped
+        if (id >= 0 && id < SERVERLINKS) {
+            Links[id].Http.feed(Data, got);
+            linkReceived(got);
+        }
+#if GATEWAYROLE
+        // a datagram that is too long is cut off, and then dropped
+        if (id == GATEWAYLINK && Kept < sizeof(Datagram)) {
+            size_t Take = sizeof(Datagram) - Kept < (size_t)got
+                              ? sizeof(Datagram) - Kept
+                              : (size_t)got;
+            memcpy(Datagram + Kept, Data, Take);
+            Kept += Take;
+        }
+#endif
+        donePiece(got);
+        received -= got;
+    }
+#if GATEWAYROLE == GATEWAYHUB
+    if (id == GATEWAYLINK && Kept == (size_t)Length) {
+        takeDatagram(Kept, Ip, Port);
+    }
+#elif GATEWAYROLE
+    if (id == GATEWAYLINK && Kept == (size_t)Length) {
+        takeDatagram(Kept);
+    }
+#endif
+}
 
-            // get polling rate
-            const char *tok = "samplerate=\"";
-            char *ratestart = strstr(Buf, tok);
-            // go right up to the float value
-            ratestart += strlen(tok);
+#if ESPPASSIVERECV
+// asks the ESP8266 for what it holds of Link, ESPRECVDATAMAX at a time, and
+// feeds it into the response of the link
+static void pullData(ATCmdParser *_parser, int Link) {
+    ATLink &Server = Links[Link];
+    int Wanted =
+        Server.Waiting < ESPRECVDATAMAX ? Server.Waiting : ESPRECVDATAMAX;
+    int Length = 0;
 
-            if (isdigit(ratestart[0])) {
-                response = atof(ratestart);
+    // "+CIPRECVDATA,<length>:" and the data, then OK
+    _parser->send("AT+CIPRECVDATA=%d,%d", Link, Wanted);
+    if (_parser->recv("+CIPRECVDATA,%d:", &Length)) {
+        char Piece[RESPONSEPIECE];
+        int Left = Length;
+        while (Left > 0) {
+            const char *Data;
+            int got = nextPiece(_parser, Left, Piece, Data);
+            if (got <= 0) {
+                break;
             }
-        }    
+            Server.Http.feed(Data, got);
+            linkReceived(got);
+            donePiece(got);
+            Left -= got;
+        }
+        _parser->recv("OK");
     }
-    
-    _parser->send("AT+CIPCLOSE=5");
+
+    // a short answer is all that the ESP8266 had, and without one what it
+    // had is gone
+    Server.Waiting = Length < Wanted ? 0 : Server.Waiting - Length;
+    if (Server.Waiting <= 0 && Server.ClosedEarly) {
+        Server.Waiting = 0;
+        Server.ClosedEarly = false;
+        Server.Http.closed();
+    }
+}
+#endif
+
+/// the last known Wi-Fi state, kept up to date by the ESP8266's messages
+static volatile bool WifiUp = false;
+
+/// how long the answers of each class of command take
+static ATTimeouts Timeouts;
+
+/// when the command of beginCommand() was sent
+static uint64_t CommandStart = 0;
+
+// sets the timeout of Class for the command that is sent next
+static void beginCommand(ATCmdParser *_parser, ATCommandClass Class) {
+    _parser->set_timeout(Timeouts.timeout(Class));
+    CommandStart = Kernel::get_ms_count();
+}
+
+// takes the time of the answer to the command of Class, or that there was
+// none, and puts back the timeout of the other commands. Returns Answered
+static bool endCommand(ATCmdParser *_parser, ATCommandClass Class,
+                       bool Answered) {
+    // a failure is an answer too, it came as fast as an OK would have
+    if (Answered || _parser->failed()) {
+        Timeouts.answered(Class, Kernel::get_ms_count() - CommandStart);
+    } else {
+        Timeouts.timedOut(Class);
+    }
+    _parser->set_timeout(SERIALTIMEOUT);
+    return Answered;
+}
+
+#if GATEWAYROLE
+// sets GATEWAYLINK up for the datagrams. A GATEWAYHUB gets its access point
+// up first, and listens for every child on it. None of it is kept in the
+// ESP8266's flash, so it is done again after a reset
+static bool openGatewayLink(ATCmdParser *_parser) {
+#if GATEWAYROLE == GATEWAYHUB
+    _parser->send("AT+CWSAP_CUR=\"%s\",\"%s\",%d,3,%d", GATEWAYSSID,
+                  GATEWAYPASSWORD, GATEWAYCHANNEL, GATEWAYSTATIONS);
     _parser->recv("OK");
-    return NETWORKSUCCESS;
+    _parser->send("AT+CIPDINFO=1");
+    _parser->recv("OK");
+#endif
+    // a link that is still there from before would not start again
+    _parser->send("AT+CIPCLOSE=%d", GATEWAYLINK);
+    _parser->recv("OK");
+
+    beginCommand(_parser, ATCONNECT);
+#if GATEWAYROLE == GATEWAYHUB
+    // mode 2 takes a datagram from any child, and an ack goes to the child
+    // that is given with its AT+CIPSEND
+    _parser->send("AT+CIPSTART=%d,\"UDP\",\"0.0.0.0\",%d,%d,2", GATEWAYLINK,
+                  GATEWAYPORT, GATEWAYPORT);
+#else
+    _parser->send("AT+CIPSTART=%d,\"UDP\",\"%s\",%d,%d,0", GATEWAYLINK,
+                  GATEWAYADDRESS, GATEWAYPORT, GATEWAYPORT);
+#endif
+    GatewayOpen = endCommand(_parser, ATCONNECT, _parser->recv("OK"));
+    if (!GatewayOpen) {
+        tr_warn("The gateway link could not be set up");
+    }
+    return GatewayOpen;
 }
 
-int sendBackupDataTCP(ATCmdParser *_parser, BoardSpecs &Specs,
-                      const char *FileName, float &response) {
-    printf("Sending backup data over the network \r\n");
-    vector<PortInfo> Ports = getSensorDataFromFile(Specs, FileName);
-    string Message = makeGetReqStr(Ports, Specs);
-    return sendMessageTCP(_parser, Specs, Message, response);
+// sends the Size bytes of Data on GATEWAYLINK, to the child at Ip and Port
+// for a GATEWAYHUB
+static bool sendDatagram(ATCmdParser *_parser, const void *Data, size_t Size,
+                         const char *Ip, int Port) {
+    beginCommand(_parser, ATPROMPT);
+    if (Ip != NULL) {
+        _parser->send("AT+CIPSEND=%d,%d,\"%s\",%d", GATEWAYLINK, Size, Ip,
+                      Port);
+    } else {
+        _parser->send("AT+CIPSEND=%d,%d", GATEWAYLINK, Size);
+    }
+    if (!endCommand(_parser, ATPROMPT, _parser->recv(">"))) {
+        return false;
+    }
+    if (_parser->write((const char *)Data, Size) != (int)Size) {
+        return false;
+    }
+    beginCommand(_parser, ATSENT);
+    return endCommand(_parser, ATSENT, _parser->recv("SEND OK"));
 }
+#endif // GATEWAYROLE
 
-// =============================================================================
-int sendBulkDataTCP(ATCmdParser *_parser, BoardSpecs &Specs, float &response) {
+// ============================================================================
+const char *serverAddress(ATCmdParser *_parser, BoardSpecs &Specs) {
+    const char *Host = Specs.RemoteIP.c_str();
+    if (isAddress(Host)) {
+        return Host;
+    }
+    const char *Cached = cachedAddress(Host, false);
+    if (Cached != NULL) {
+        return Cached;
+    }
+
+    // +CIPDOMAIN:93.184.216.34
+    char Found[DNSADDRESSMAX];
+    beginCommand(_parser, ATCONNECT);
+    _parser->send("AT+CIPDOMAIN=\"%s\"", Host);
+    bool Resolved = _parser->recv("+CIPDOMAIN:%15[0-9.]", Found) &&
+                    _parser->recv("OK");
+    if (endCommand(_parser, ATCONNECT, Resolved) && isAddress(Found)) {
+        cacheAddress(Host, Found);
+    }
+
+    // CIPSTART resolves the name itself when there is no address at all
+    Cached = cachedAddress(Host, true);
+    return Cached != NULL ? Cached : Host;
+}
+
+static void onWifiGotIP() { WifiUp = true; }
+
+// WIFI DISCONNECT, or ready after the ESP8266 reset itself
+static void onWifiLost() {
+    WifiUp = false;
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        onLinkClosed(&Links[i]);
+    }
+#if GATEWAYROLE
+    // it is set up again before the next datagram
+    GatewayOpen = false;
+#endif
+}
+
+/// how long to wait for an answer to AT while looking for the baud rate
+#define ESPPROBETIMEOUT (100)
+
+/// baud rates to run the ESP8266 at, fastest first. ESPDEFAULTBAUD is last
+/// so there is always one left to fall back to.
+static const int esp_bauds[] = {921600, 460800, 230400, ESPDEFAULTBAUD};
+
+#define ESPBAUDCOUNT (sizeof(esp_bauds) / sizeof(esp_bauds[0]))
 
-    string message = makeGetReqStr(Specs);
+// returns true if the ESP8266 answers AT at the current baud rate
+static bool probeESP(ATCmdParser *_parser) {
+    bool ok = false;
+    _parser->set_timeout(ESPPROBETIMEOUT);
+    for (int i = 0; i < 3 && !ok; ++i) {
+        _parser->flush();
+        ok = _parser->send("AT") && _parser->recv("OK");
+    }
+    _parser->set_timeout(SERIALTIMEOUT);
+    return ok;
+}
+
+// tries every baud rate without flow control until the ESP8266 answers.
+// returns that rate, or 0 if it never answered
+static int findESPBaud(ATCmdParser *_parser, DMAUARTSerial *_serial) {
+    _serial->set_flow_control(FlowControlNone);
+
+    // after a reset it is at the default rate, so try that first
+    for (int i = ESPBAUDCOUNT - 1; i >= 0; --i) {
+        _serial->set_baud(esp_bauds[i]);
+        if (probeESP(_parser)) {
+            return esp_bauds[i];
+        }
+    }
+    return 0;
+}
 
-    return sendMessageTCP(_parser, Specs, message, response);
+// moves the ESP8266 and _serial to the fastest rate up to ESPBAUDRATE that
+// works. AT+UART_CUR is not stored in the ESP8266's flash, so a reset
+// always brings it back to ESPDEFAULTBAUD.
+// returns the rate in use, or 0 if the ESP8266 does not answer at all
+static int negotiateESPBaud(ATCmdParser *_parser, DMAUARTSerial *_serial) {
+    int Current = findESPBaud(_parser, _serial);
+    if (Current == 0) {
+        return 0;
+    }
+
+    PinName rts = MBED_CONF_ESP8266_RTS;
+    PinName cts = MBED_CONF_ESP8266_CTS;
+    bool Flow = rts != NC && cts != NC;
+
+    for (size_t i = 0; i < ESPBAUDCOUNT; ++i) {
+        if (esp_bauds[i] > ESPBAUDRATE) {
+            continue;
+        }
+
+        // the ESP8266 answers OK at the old rate, then switches
+        _parser->send("AT+UART_CUR=%d,8,1,0,%d", esp_bauds[i], Flow ? 3 : 0);
+        if (!_parser->recv("OK")) {
+            // it did not take this rate and is still at the old one
+            continue;
+        }
+        wait_us(10000);
+
+        _serial->set_baud(esp_bauds[i]);
+        if (Flow) {
+            _serial->set_flow_control(FlowControlRTSCTS, rts, cts);
+        }
+        if (probeESP(_parser)) {
+            printf("ESP8266 is running at %d baud%s\r\n", esp_bauds[i],
+                   Flow ? " with RTS/CTS" : "");
+            return esp_bauds[i];
+        }
+
+        // the link does not work at this rate, find where the ESP8266 is
+        // now and try the next slower one from there
+        printf("ESP8266 did not answer at %d baud\r\n", esp_bauds[i]);
+        Current = findESPBaud(_parser, _serial);
+        if (Current == 0) {
+            return 0;
+        }
+    }
+    return Current;
+}
+
+/// how many times wakeESP() sends AT, ESPPROBETIMEOUT apart
+#define ESPWAKETRIES (10)
+
+/// how much the last wake counts in espWakeMs()
+#define ESPWAKEWEIGHT (0.25f)
+
+/// true from sleepESP() until wakeESP() got an answer. A reset wakes it too
+static bool Asleep = false;
+
+/// the average time of wakeESP(), read by the sampling loop
+static volatile uint32_t WakeMs = 0;
+
+#if ESPSLEEP == ESPSLEEPLIGHT
+/// held high while the ESP8266 sleeps, a low level wakes it
+static DigitalOut WakePin(ESPWAKEPIN, 1);
+#endif
+
+// ============================================================================
+bool waitESPReady(ATCmdParser *_parser, int timeout_ms) {
+    uint64_t Deadline = Kernel::get_ms_count() + timeout_ms;
+    bool Ready = false;
+    _parser->set_timeout(ESPPROBETIMEOUT);
+    while (!Ready && Kernel::get_ms_count() < Deadline) {
+        // the boot messages before the banner are at 74880 baud and come
+        // in as noise, recv() skips them
+        Ready = _parser->recv("ready") ||
+                (_parser->send("AT") && _parser->recv("OK"));
+    }
+    _parser->set_timeout(SERIALTIMEOUT);
+    _parser->flush();
+    return Ready;
+}
+
+// ============================================================================
+int startESP(ATCmdParser *_parser, DMAUARTSerial *_serial) {
+    // what was asked before a reset is not answered
+    _parser->cancel_commands();
+    if (_serial != NULL) {
+        ESPSerial = _serial;
+        if (negotiateESPBaud(_parser, _serial) == 0) {
+            return -1;
+        }
+    }
+
+#if ESPPASSTHROUGH
+    // a reset ends transparent mode
+    Passthrough = false;
+#endif
+    Asleep = false;
+    energyActive(EnergyESP, true);
+    _parser->send("AT+CIPCLOSE=5");
+    _parser->recv("OK");
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        Links[i].Open = false;
+        Links[i].Waiting = 0;
+        Links[i].ClosedEarly = false;
+    }
+
+    // startESP() runs again after a reset, add the handlers only once
+    if (WatchedParser != _parser) {
+        WatchedParser = _parser;
+
+        // notice when the server closes a kept alive link, and take in
+        // what comes in on every link
+        for (int i = 0; i < SERVERLINKS; ++i) {
+            _parser->oob(LinkClosedMessages[i],
+                         callback(onLinkClosed, &Links[i]));
+        }
+        _parser->oob("+IPD,", callback(onPacket));
+#if GATEWAYROLE
+        _parser->oob(GatewayClosedMessage, callback(onGatewayClosed));
+#endif
+
+        // a command that failed ends the wait for its answer, the recv()
+        // returns false at once instead of waiting for SERIALTIMEOUT
+        _parser->fail("ERROR");
+        _parser->fail("FAIL");
+        _parser->fail("SEND FAIL");
+
+        // track the Wi-Fi state from what the ESP8266 reports on its own
+        _parser->oob("WIFI GOT IP", callback(onWifiGotIP));
+        _parser->oob("WIFI DISCONNECT", callback(onWifiLost));
+        _parser->oob("ready", callback(onWifiLost));
+    }
+    // it only sleeps as a station
+    _parser->send("AT+CWMODE=%d", ESPSLEEP ? 1 : 3);
+    _parser->recv("OK");
+    _parser->send("AT+CIPMUX=1");
+    if (!_parser->recv("OK"))
+        return -1;
+
+#if ESPPASSIVERECV
+    // it is not kept in the ESP8266's flash, so it is sent after every reset
+    _parser->send("AT+CIPRECVMODE=1");
+    PassiveRecv = _parser->recv("OK");
+    if (!PassiveRecv) {
+        tr_warn("The ESP8266 firmware has no passive receive mode");
+    }
+#endif
+
+#if GATEWAYROLE == GATEWAYHUB
+    // the children can send as soon as their readings come in
+    openGatewayLink(_parser);
+#elif GATEWAYROLE
+    // the link is set up with the first datagram, once there is a network
+    GatewayOpen = false;
+#endif
+
+    // the ESP8266 may have joined a network before this was called
+    checkESPWiFiConnection(_parser);
+    return NETWORKSUCCESS;
+}
+
+// ============================================================================
+void sleepESP(ATCmdParser *_parser) {
+#if ESPSLEEP
+    if (Asleep) {
+        return;
+    }
+#if ESPPASSTHROUGH
+    // AT commands are not heard in transparent mode
+    if (Passthrough) {
+        return;
+    }
+#endif
+#if ESPSLEEP == ESPSLEEPLIGHT
+    _parser->send("AT+WAKEUPGPIO=1,%d,0", ESPWAKEGPIO);
+    if (!_parser->recv("OK")) {
+        return;
+    }
+#endif
+    _parser->send("AT+SLEEP=%d", ESPSLEEP);
+    Asleep = _parser->recv("OK");
+    if (Asleep) {
+        energyActive(EnergyESP, false);
+    }
+#endif
+}
+
+// ============================================================================
+bool wakeESP(ATCmdParser *_parser) {
+#if ESPSLEEP
+    if (!Asleep) {
+        return true;
+    }
+    uint64_t Start = Kernel::get_ms_count();
+#if ESPSLEEP == ESPSLEEPLIGHT
+    WakePin = 0;
+#endif
+    // unlike probeESP() nothing is flushed, a link that closed while it
+    // slept is still noticed
+    bool Awake = false;
+    _parser->set_timeout(ESPPROBETIMEOUT);
+    for (int i = 0; i < ESPWAKETRIES && !Awake; ++i) {
+        Awake = _parser->send("AT") && _parser->recv("OK");
+    }
+    _parser->set_timeout(SERIALTIMEOUT);
+#if ESPSLEEP == ESPSLEEPLIGHT
+    WakePin = 1;
+#endif
+    if (Awake) {
+        // awake for the whole batch, the radio is not turned off between
+        // its requests
+        _parser->send("AT+SLEEP=0");
+        Awake = _parser->recv("OK");
+    }
+    if (!Awake) {
+        tr_warn("The ESP8266 did not wake up");
+        return false;
+    }
+    Asleep = false;
+    energyActive(EnergyESP, true);
+
+    uint32_t Took = Kernel::get_ms_count() - Start;
+    WakeMs = WakeMs == 0 ? Took
+                         : WakeMs + (int32_t)(ESPWAKEWEIGHT *
+                                              ((int32_t)Took - (int32_t)WakeMs));
+#endif
+    return true;
+}
+
+// ============================================================================
+uint32_t espWakeMs() { return WakeMs; }
+
+/// The access point that was joined last, and the address the DHCP server
+/// gave the board there. It is kept in the flash with saveWifiCache()
+struct AccessPoint {
+    /// the SSID it was joined with, the cache is not used for another one
+    char Ssid[33];
+
+    /// "aa:bb:cc:dd:ee:ff", empty until a join worked
+    char Bssid[18];
+    int Channel;
+
+    /// the DHCP lease, empty if the board did not get one
+    char Ip[16];
+    char Gateway[16];
+    char Netmask[16];
+};
+
+static_assert(sizeof(AccessPoint) <= FLASHWIFIMAX,
+              "the access point does not fit into FLASHWIFIMAX");
+
+static AccessPoint LastAP;
+
+/// false until LastAP was read from the flash
+static bool LastAPLoaded = false;
+
+/// how many joins used the cached address since the last DHCP join
+static int StaticJoins = 0;
+
+// empties LastAP, the next join looks for any access point with the SSID
+static void forgetAccessPoint() { memset(&LastAP, 0, sizeof(LastAP)); }
+
+// reads the access point of an earlier boot, if it was for this SSID
+static void loadAccessPoint(const BoardSpecs &Specs) {
+    LastAPLoaded = true;
+    if (readWifiCache(&LastAP, sizeof(LastAP)) != sizeof(LastAP) ||
+        LastAP.Ssid[sizeof(LastAP.Ssid) - 1] != '\0' ||
+        Specs.NetworkSSID != LastAP.Ssid) {
+        forgetAccessPoint();
+    }
+}
+
+// asks the ESP8266 which access point it joined and which address it has,
+// and keeps them in LastAP and the flash
+static void rememberAccessPoint(ATCmdParser *_parser,
+                                const BoardSpecs &Specs) {
+    AccessPoint AP;
+    memset(&AP, 0, sizeof(AP));
+    strncpy(AP.Ssid, Specs.NetworkSSID.c_str(), sizeof(AP.Ssid) - 1);
+
+    // +CWJAP:"ssid","bssid",channel,rssi
+    char Ssid[33];
+    _parser->send("AT+CWJAP?");
+    bool Got = _parser->recv("+CWJAP:\"%32[^\"]\",\"%17[^\"]\",%d", Ssid,
+                             AP.Bssid, &AP.Channel);
+    _parser->recv("OK");
+    if (!Got) {
+        return;
+    }
+
+    _parser->send("AT+CIPSTA_CUR?");
+    bool Lease = _parser->recv("+CIPSTA_CUR:ip:\"%15[^\"]\"", AP.Ip) &&
+                 _parser->recv("+CIPSTA_CUR:gateway:\"%15[^\"]\"",
+                               AP.Gateway) &&
+                 _parser->recv("+CIPSTA_CUR:netmask:\"%15[^\"]\"",
+                               AP.Netmask);
+    _parser->recv("OK");
+    if (!Lease) {
+        AP.Ip[0] = AP.Gateway[0] = AP.Netmask[0] = '\0';
+    }
+
+    tr_info("Joined %s on channel %d as %s", AP.Bssid, AP.Channel,
+            Lease ? AP.Ip : "?");
+    if (memcmp(&AP, &LastAP, sizeof(AP)) != 0) {
+        LastAP = AP;
+        int err = saveWifiCache(&LastAP, sizeof(LastAP));
+        if (err) {
+            tr_warn("The access point could not be kept in the flash (%d)",
+                    err);
+        }
+    }
+}
+
+// joins the network in Specs with AT+CWJAP, at the BSSID if one is given.
+// returns true once the ESP8266 says OK
+static bool joinAccessPoint(ATCmdParser *_parser, const BoardSpecs &Specs,
+                            const char *Bssid) {
+    if (Bssid != NULL) {
+        _parser->send("AT+CWJAP=\"%s\",\"%s\",\"%s\"",
+                      Specs.NetworkSSID.c_str(),
+                      Specs.NetworkPassword.c_str(), Bssid);
+    } else {
+        _parser->send("AT+CWJAP=\"%s\",\"%s\"", Specs.NetworkSSID.c_str(),
+                      Specs.NetworkPassword.c_str());
+    }
+    return _parser->recv("OK");
+}
+
+// the cached BSSID saves the ESP8266 from scanning every channel, and the
+// cached lease saves the DHCP exchange. AT+CIPSTA_CUR and AT+CWDHCP_CUR are
+// not stored in the ESP8266's flash, so a reset always brings DHCP back.
+// returns true if the ESP8266 joined with them
+static bool fastJoin(ATCmdParser *_parser, const BoardSpecs &Specs) {
+    if (LastAP.Bssid[0] == '\0') {
+        return false;
+    }
+
+    // every WIFISTATICJOINS joins, DHCP renews the lease
+    bool Static = LastAP.Ip[0] != '\0' && StaticJoins < WIFISTATICJOINS;
+    if (Static) {
+        _parser->send("AT+CIPSTA_CUR=\"%s\",\"%s\",\"%s\"", LastAP.Ip,
+                      LastAP.Gateway, LastAP.Netmask);
+        Static = _parser->recv("OK");
+    }
+
+    if (joinAccessPoint(_parser, Specs, LastAP.Bssid) &&
+        checkESPWiFiConnection(_parser)) {
+        StaticJoins = Static ? StaticJoins + 1 : 0;
+        return true;
+    }
+
+    // the access point may have been replaced, look for any with the SSID
+    tr_info("Could not join %s again", LastAP.Bssid);
+    forgetAccessPoint();
+    StaticJoins = 0;
+    if (Static) {
+        _parser->send("AT+CWDHCP_CUR=1,1");
+        _parser->recv("OK");
+    }
+    return false;
+}
+
+int connectESPWiFi(ATCmdParser *_parser, BoardSpecs &Specs) {
+    // the reconnect attempts come on their own, between the uploads
+    wakeESP(_parser);
+#if ESPPASSTHROUGH
+    leavePassthrough(_parser);
+#endif
+    if (!LastAPLoaded) {
+        loadAccessPoint(Specs);
+    }
+
+    if (fastJoin(_parser, Specs)) {
+        rememberAccessPoint(_parser, Specs);
+        return NETWORKSUCCESS;
+    }
+
+    if (joinAccessPoint(_parser, Specs, NULL)) {
+        if (checkESPWiFiConnection(_parser)) {
+            rememberAccessPoint(_parser, Specs);
+            return NETWORKSUCCESS;
+        } else {
+            return -2;
+        }
+    } else {
+        // the ESP8266 goes back to its default baud rate when it resets, so
+        // set it up again if it stopped answering
+        if (ESPSerial != NULL && !probeESP(_parser)) {
+            printf("ESP8266 is not answering, starting it again\r\n");
+            startESP(_parser, ESPSerial);
+        }
+        return -1;
+    }
+}
+
+//==============================================================================
+// return true if you are connected, and false if you are not connected
+bool checkESPWiFiConnection(ATCmdParser *_parser) {
+#if ESPPASSTHROUGH
+    leavePassthrough(_parser);
+#endif
+    _parser->debug_on(0);
+    // 000.000.000.000 max of 15 characters
+    char ip_addr[16];
+    bool Answered = false;
+
+    // only a question, so an answer that did not come is asked for again
+    // with the longer timeout
+    for (int attempt = 0; attempt < 2 && !Answered; ++attempt) {
+        ip_addr[0] = 0;
+        beginCommand(_parser, ATQUERY);
+        _parser->send("AT+CIFSR");
+        _parser->recv("+CIFSR:STAIP,\"%15[^\"]\"", ip_addr);
+        Answered = endCommand(_parser, ATQUERY, _parser->recv("OK"));
+        if (_parser->failed()) {
+            break;
+        }
+    }
+
+    ip_addr[15] = 0;
+
+    if (!Answered) {
+        _parser->debug_on(LOGATCOMMANDS);
+        WifiUp = false;
+        return false;
+    }
+
+    // if that expression is true, then 0.0.0.0 is not in the ip address, and we
+    // ar connected
+
+    _parser->debug_on(LOGATCOMMANDS);
+    WifiUp = strstr(ip_addr, "0.0.0.0") == NULL;
+    return WifiUp;
+}
+
+/// the AT+CIPSTATUS of isConnected(), it does not wait for the answer
+static ATCmdParser::command LinkQuery;
+
+/// true from when LinkQuery was submitted until it was answered
+static bool LinkQueryWaiting = false;
+
+/// when LinkQuery was last sent, in Kernel::get_ms_count() milliseconds
+static uint64_t LinkQueryMs = 0;
+
+// the answer to LinkQuery, from answerESP() or isConnected()
+static void onLinkStatus(ATCmdParser::command_result Result,
+                         const char *Line) {
+    LinkQueryWaiting = false;
+    if (Result == ATCmdParser::COMMAND_TIMEOUT) {
+        Timeouts.timedOut(ATQUERY);
+        return;
+    }
+    int Status = 0;
+    if (Result == ATCmdParser::COMMAND_OK &&
+        sscanf(Line, "STATUS:%d", &Status) == 1) {
+        Timeouts.answered(ATQUERY, Kernel::get_ms_count() - LinkQueryMs);
+        // 2 has an IP, 3 has links open and 4 closed them, 5 has no network
+        WifiUp = Status >= 2 && Status <= 4;
+    }
+}
+
+bool isConnected(ATCmdParser *_parser) {
+#if ESPPASSTHROUGH
+    // the UART only has the server's bytes, a lost network shows up as a
+    // failed request
+    if (Passthrough) {
+        return WifiUp;
+    }
+#endif
+    // only handles what is already waiting, this does not block
+    _parser->process_commands();
+
+    // a WIFI DISCONNECT that was lost in an overrun of the UART ring would
+    // leave WifiUp wrong, so the ESP8266 is asked now and then. The answer
+    // comes to a later call
+    uint64_t Now = Kernel::get_ms_count();
+    if (WatchedParser == _parser && !Asleep && !LinkQueryWaiting &&
+        Now - LinkQueryMs >= LINKQUERYMS) {
+        LinkQuery.text = "AT+CIPSTATUS";
+        LinkQuery.response = "STATUS:%d\nOK";
+        LinkQuery.timeout = Timeouts.timeout(ATQUERY);
+        LinkQuery.done = callback(onLinkStatus);
+        LinkQueryMs = Now;
+        LinkQueryWaiting = _parser->submit(&LinkQuery);
+    }
+    return WifiUp;
+}
+
+int answerESP(ATCmdParser *_parser) {
+#if ESPPASSTHROUGH
+    // the UART only has the server's bytes
+    if (Passthrough) {
+        return -1;
+    }
+#endif
+    _parser->process_commands();
+    return _parser->next_timeout();
+}
+
+// ============================================================================
+void closeServerLink(ATCmdParser *_parser, int Link) {
+#if ESPPASSTHROUGH
+    // the links share the one connection, so it closes for all of them
+    if (Passthrough) {
+        leavePassthrough(_parser);
+        return;
+    }
+#endif
+    beginCommand(_parser, ATCLOSE);
+    _parser->send("AT+CIPCLOSE=%d", Link);
+    endCommand(_parser, ATCLOSE, _parser->recv("OK"));
+    Links[Link].Open = false;
+}
+
+bool serverLinkOpen(int Link) { return Links[Link].Open; }
+
+int openServerLink(ATCmdParser *_parser, BoardSpecs &Specs, int Link) {
+    ATLink &Server = Links[Link];
+    Server.Http = HttpResponse(Server.Body, sizeof(Server.Body));
+#if ESPPASSTHROUGH
+    // every link takes its turn on the one connection
+    if (Passthrough) {
+        Server.Open = true;
+        return NETWORKSUCCESS;
+    }
+#endif
+    if (Server.Open) {
+        return NETWORKSUCCESS;
+    }
+    Server.Waiting = 0;
+    Server.ClosedEarly = false;
+
+    const char *Address = serverAddress(_parser, Specs);
+    beginCommand(_parser, ATCONNECT);
+    _parser->send("AT+CIPSTART=%d,\"TCP\",\"%s\",%d", Link, Address,
+                  Specs.RemotePort);
+    if (!endCommand(_parser, ATCONNECT, _parser->recv("OK"))) {
+        // the server may have moved, its name is looked up again next time
+        expireAddress();
+
+        // only this link, the others may be waiting for their responses
+        _parser->send("AT+CIPCLOSE=%d", Link);
+        _parser->recv("OK");
+
+        // a missed WIFI DISCONNECT would leave isConnected() wrong
+        checkESPWiFiConnection(_parser);
+        return -1;
+    }
+    Server.Open = true;
+    return NETWORKSUCCESS;
+}
+
+bool writeServerLink(ATCmdParser *_parser, int Link, const char *data,
+                     size_t length) {
+#if ESPPASSTHROUGH
+    if (Passthrough) {
+        return _parser->write(data, length) == (int)length;
+    }
+#endif
+    beginCommand(_parser, ATPROMPT);
+    _parser->send("AT+CIPSEND=%d,%d", Link, length);
+
+    if (!endCommand(_parser, ATPROMPT, _parser->recv(">")))
+        return false;
+
+    // written as is, send() would format it through a 256 byte buffer
+    if (_parser->write(data, length) != (int)length)
+        return false;
+
+    beginCommand(_parser, ATSENT);
+    return endCommand(_parser, ATSENT, _parser->recv("SEND OK"));
+}
+
+// waits until the response on Link is complete, and closes the link if it
+// can not take the next request
+static HttpResponse &awaitResponse(ATCmdParser *_parser, int Link) {
+    HttpResponse &Http = Links[Link].Http;
+
+    bool Raw = false;
+#if ESPPASSTHROUGH
+    if (Passthrough) {
+        readPassthrough(_parser, Http);
+        Raw = true;
+    }
+#endif
+    // onPacket() fills in the response, maybe while other requests were
+    // sent. This returns as soon as it is complete, and only waits for
+    // SERIALTIMEOUT if nothing comes in at all
+    uint64_t LastData = Kernel::get_ms_count();
+    while (!Raw && !Http.complete() && !Http.failed()) {
+#if ESPPASSIVERECV
+        // the data of the other links stays in the ESP8266 until their
+        // turn
+        if (Links[Link].Waiting > 0) {
+            pullData(_parser, Link);
+            LastData = Kernel::get_ms_count();
+            continue;
+        }
+#endif
+        if (_parser->process_oob()) {
+            LastData = Kernel::get_ms_count();
+        } else if (Kernel::get_ms_count() - LastData >= SERIALTIMEOUT) {
+            break;
+        } else {
+            ThisThread::sleep_for(RESPONSEPOLLMS);
+        }
+    }
+
+    // a link that is in the middle of a response can not take the next
+    // request
+    if (!Http.complete() || !Http.keepAlive()) {
+        closeServerLink(_parser, Link);
+    }
+    return Http;
+}
+
+int readServerResponse(ATCmdParser *_parser, int Link, float &response) {
+    HttpResponse &Http = awaitResponse(_parser, Link);
+    if (Http.status() == 0) {
+        // nothing came back, the request was still sent
+        return NETWORKSUCCESS;
+    }
+    return parseServerResponse(Http, response);
+}
+
+int readServerBody(ATCmdParser *_parser, int Link, uint8_t *Body, size_t Size,
+                   size_t &Length) {
+    return takeResponseBody(awaitResponse(_parser, Link), Body, Size, Length);
+}
+
+#endif // NETWORKSOCKETS || LORAWANUPLINK
+
+// ============================================================================
+// what goes into one streamed request
+struct RequestParts {
+    BoardSpecs *Specs;
+
+    /// a finished message, used instead of the frames if it is not NULL
+    const char *Message;
+    size_t Length;
+
+    const SampleFrame *Frames;
+    size_t Count;
+    bool Stamp;
+
+    /// true if the CBOR body has to have the port table
+    bool Table;
+
+    /// a capture file that is the body of a POST instead, see
+    /// CaptureStore.h
+    FILE *Capture;
+    size_t CaptureSize;
+
+    /// the oldest sequence number that the board still has to send, 0 if
+    /// it is not known
+    uint32_t Floor;
+
+    /// how many of the bodies that a GATEWAYHUB holds for its children are
+    /// the body instead, and their bytes, see Gateway.h
+    size_t Relayed;
+    size_t RelayedBytes;
+
+    /// the firmware version whose patch is fetched instead, from
+    /// UpdateOffset, 0 for none. See FirmwareUpdate.h
+    uint32_t Update;
+    uint32_t UpdateOffset;
+};
+
+#if REQUESTFORMAT == REQUESTCBOR
+/// false until the server has the port table of each link
+static bool TableSent[SERVERLINKS];
+
+/// the config version of the port table the server has on each link
+static uint32_t TableVersion[SERVERLINKS];
+#endif // REQUESTFORMAT
+
+#if REQUESTFORMAT == REQUESTCBOR || MQTTPUBLISH || COAPUPLINK ||              \
+    GATEWAYROLE == GATEWAYCHILD
+
+// the ports of Frame that are configured
+static uint16_t sentPorts(const SampleFrame &Frame,
+                          Span<const PortInfo> Ports) {
+    uint16_t Configured = Ports.size() >= 16 ? 0xFFFF
+                                             : (1U << Ports.size()) - 1;
+    return Frame.PortMask & Configured;
+}
+
+#if !PACKEDREADINGS
+// writes one reading as [seconds after Base, port mask, over range mask,
+// under range mask, the raw value of every port in the mask], and the kind
+// and count of the frame at the end if it is not a FrameReading
+static void writeCborReading(CborWriter &Cbor, const SampleFrame &Frame,
+                             Span<const PortInfo> Ports, uint32_t Base) {
+    uint16_t Mask = sentPorts(Frame, Ports);
+    size_t Count = 0;
+    for (uint16_t Bits = Mask; Bits != 0; Bits &= Bits - 1) {
+        ++Count;
+    }
+
+    bool Summary = Frame.Kind != FrameReading;
+    Cbor.array(4 + Count + (Summary ? 2 : 0));
+    Cbor.signedInt((int32_t)(Frame.Timestamp - Base));
+    Cbor.unsignedInt(Mask);
+    Cbor.unsignedInt(Frame.OverMask & Mask);
+    Cbor.unsignedInt(Frame.UnderMask & Mask);
+    for (size_t i = 0; i < (size_t)Ports.size() && i < FRAMEMAXPORTS; ++i) {
+        if ((Mask >> i) & 1U) {
+            Cbor.unsignedInt(Frame.Raw[i]);
+        }
+    }
+    if (Summary) {
+        Cbor.unsignedInt(Frame.Kind);
+        Cbor.unsignedInt(Frame.Count);
+    }
+}
+#else
+// writes Frame as one chunk of the packed readings. The ports that are not
+// configured are left out of the masks
+static void writeCborPacked(CborWriter &Cbor, FrameCodec &Codec,
+                            const SampleFrame &Frame,
+                            Span<const PortInfo> Ports) {
+    SampleFrame Sent = Frame;
+    Sent.PortMask = sentPorts(Frame, Ports);
+    Sent.OverMask &= Sent.PortMask;
+    Sent.UnderMask &= Sent.PortMask;
+
+    uint8_t Packed[FRAMECODEDMAX];
+    Cbor.bytes(Packed, Codec.encode(Sent, Packed));
+}
+#endif // PACKEDREADINGS
+
+
+// writes the port table as [[port name, multiplier], ...]
+static void writeCborPortTable(CborWriter &Cbor, BoardSpecs &Specs) {
+    Cbor.array(Specs.Ports.size());
+    for (const PortInfo &Port : Specs.Ports) {
+        Cbor.array(2);
+        Cbor.text(Port.Name.c_str());
+        Cbor.float32(Port.Multiplier);
+    }
+}
+
+// writes the body of a POST request as a map of
+// b: board name, v: config version, t: time of the first reading,
+// p: the port table if Parts.Table, m: the memory telemetry with
+// MEMORYTELEMETRY, q: the power quality with POWERQUALITY, w: the energy
+// totals with ENERGYINTEGRATOR, h: the faulted ports with SENSORHEALTH,
+// c: the report of the last reset if there is one, d: the answer to the
+// diagnostic commands if there is one, l: the link counters with LINKSTATS
+// if a window waits,
+// e: the stream, s: [sequence number, ...]
+// and f: the floor if it is known with SEQUENCEDUPLOADS,
+// r: [reading, ...], or z: the packed readings with PACKEDREADINGS
+static void writeCborBody(RequestWriter &Message, const RequestParts &Parts) {
+    BoardSpecs &Specs = *Parts.Specs;
+    uint32_t Base = Parts.Count > 0 ? Parts.Frames[0].Timestamp : 0;
+    CborWriter Cbor(Message);
+
+    const char *Crash = crashReport();
+    const char *Diag = shellReply();
+    uint32_t Link[LINKVALUES];
+    bool HasLink = linkStatsWindow(Link);
+    size_t Sequences = SEQUENCEDUPLOADS ? 2 + (Parts.Floor != 0 ? 1 : 0) : 0;
+    Cbor.map((Parts.Table ? 5 : 4) + (MEMORYTELEMETRY ? 1 : 0) +
+             (POWERQUALITY ? 1 : 0) + (ENERGYINTEGRATOR ? 1 : 0) +
+             (SENSORHEALTH ? 1 : 0) +
+             (Crash != NULL ? 1 : 0) +
+             (Diag != NULL ? 1 : 0) + (HasLink ? 1 : 0) + Sequences);
+    Cbor.text("b");
+    Cbor.text(Specs.DatabaseTableName);
+    Cbor.text("v");
+    Cbor.unsignedInt(Specs.ConfigVersion);
+    Cbor.text("t");
+    Cbor.unsignedInt(Base);
+
+#if MEMORYTELEMETRY
+    // [heap used, most heap used, failed allocations, free heap bytes,
+    // free heap chunks, least free stack, idle percent, deep sleep percent]
+    uint32_t Values[TELEMETRYVALUES];
+    telemetryValues(memoryTelemetry(), Values);
+    Cbor.text("m");
+    Cbor.array(TELEMETRYVALUES);
+    for (size_t i = 0; i < TELEMETRYVALUES; ++i) {
+        Cbor.unsignedInt(Values[i]);
+    }
+#endif
+#if POWERQUALITY
+    // [[port, RMS, fundamental in Hz, THD in percent, crest factor], ...]
+    PowerStats Quality[PQMAXPORTS];
+    size_t Analyzed = powerQuality().latest(Quality);
+    Cbor.text("q");
+    Cbor.array(Analyzed);
+    for (size_t i = 0; i < Analyzed; ++i) {
+        float Metrics[PQVALUES];
+        powerValues(Quality[i], Metrics);
+        Cbor.array(PQVALUES);
+        Cbor.unsignedInt(Quality[i].Port);
+        for (size_t j = 1; j < PQVALUES; ++j) {
+            Cbor.float32(Metrics[j]);
+        }
+    }
+#endif
+#if ENERGYINTEGRATOR
+    // [[port, total in thousandths of the unit's hours, seconds run], ...]
+    EnergyTotals Totals;
+    size_t Summed = energyIntegrator().latest(Totals);
+    Cbor.text("w");
+    Cbor.array(Summed);
+    for (size_t i = 0; i < Summed; ++i) {
+        uint32_t Energy[ENERGYVALUES];
+        energyValues(Totals, i, Energy);
+        Cbor.array(ENERGYVALUES);
+        for (size_t j = 0; j < ENERGYVALUES; ++j) {
+            Cbor.unsignedInt(Energy[j]);
+        }
+    }
+#endif
+#if SENSORHEALTH
+    // [[port, fault kind, since], ...]
+    SensorFault Faults[FRAMEMAXPORTS];
+    size_t Faulted = sensorHealth().faults(Faults);
+    Cbor.text("h");
+    Cbor.array(Faulted);
+    for (size_t i = 0; i < Faulted; ++i) {
+        uint32_t Fault[SENSORFAULTVALUES];
+        faultValues(Faults[i], Fault);
+        Cbor.array(SENSORFAULTVALUES);
+        for (size_t j = 0; j < SENSORFAULTVALUES; ++j) {
+            Cbor.unsignedInt(Fault[j]);
+        }
+    }
+#endif
+    if (Crash != NULL) {
+        Cbor.text("c");
+        Cbor.text(Crash);
+    }
+    if (Diag != NULL) {
+        Cbor.text("d");
+        Cbor.text(Diag);
+    }
+    if (HasLink) {
+        Cbor.text("l");
+        Cbor.array(LINKVALUES);
+        for (size_t i = 0; i < LINKVALUES; ++i) {
+            Cbor.unsignedInt(Link[i]);
+        }
+    }
+#if SEQUENCEDUPLOADS
+    Cbor.text("e");
+    Cbor.unsignedInt(sequenceStream());
+    if (Parts.Floor != 0) {
+        Cbor.text("f");
+        Cbor.unsignedInt(Parts.Floor);
+    }
+    Cbor.text("s");
+    Cbor.array(Parts.Count);
+    for (size_t i = 0; i < Parts.Count; ++i) {
+        Cbor.unsignedInt(Parts.Frames[i].Sequence);
+    }
+#endif
+
+    // the readings only have port indexes, the server keeps the table for
+    // as long as the link is open
+    if (Parts.Table) {
+        Cbor.text("p");
+        writeCborPortTable(Cbor, Specs);
+    }
+
+#if PACKEDREADINGS
+    // one byte string, with a chunk of FrameCodec.h for every frame
+    FrameCodec Codec;
+    Cbor.text("z");
+    Cbor.startBytes();
+    for (size_t i = 0; i < Parts.Count; ++i) {
+        writeCborPacked(Cbor, Codec, Parts.Frames[i], portSpan(Specs));
+    }
+    Cbor.stop();
+#else
+    Cbor.text("r");
+    Cbor.array(Parts.Count);
+    for (size_t i = 0; i < Parts.Count; ++i) {
+        writeCborReading(Cbor, Parts.Frames[i], portSpan(Specs), Base);
+    }
+#endif
+}
+
+// the number of bytes that writeCborBody() writes
+static size_t cborBodyLength(const RequestParts &Parts) {
+    char Scratch[32];
+    RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+    writeCborBody(Counter, Parts);
+    Counter.finish();
+    return Counter.flushed();
+}
+
+#if COMPRESSBATCHES
+// writes the CBOR body of Parts to Message through the compressor, one
+// window at a time
+static void writeCompressedBody(RequestWriter &Message,
+                                const RequestParts &Parts) {
+    HeatshrinkEncoder Encoder(Message);
+    char Plain[64];
+    RequestWriter Body(Plain, sizeof(Plain),
+                       callback(&Encoder, &HeatshrinkEncoder::push));
+    writeCborBody(Body, Parts);
+    Body.finish();
+    Encoder.finish();
+}
+
+// the number of bytes that writeCompressedBody() writes, it is compressed
+// twice to get the Content-Length
+static size_t compressedBodyLength(const RequestParts &Parts) {
+    char Scratch[32];
+    RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+    writeCompressedBody(Counter, Parts);
+    Counter.finish();
+    return Counter.flushed();
+}
+#endif // COMPRESSBATCHES
+#endif // REQUESTFORMAT || MQTTPUBLISH || COAPUPLINK || GATEWAYROLE
+
+#if COAPUPLINK
+/// CoAP's Content-Format number of application/cbor
+#define COAPCBOR (60)
+
+/// the UDP socket and mbed-coap
+static CoapUplink Uplink;
+
+/// false until the server acknowledged a body with the port table
+static bool CoapTableSent = false;
+
+/// the config version of the port table the server has
+static uint32_t CoapTableVersion = 0;
+
+/// the CBOR body is built here, mbed-coap keeps its own copy for the blocks
+static char CoapBody[COAPPAYLOADMAX + 1];
+
+// POSTs the frames of Parts in one confirmable CoAP message, with the port
+// table if the server may not have this version of it
+static int postReadings(RequestParts &Parts, float &response) {
+    BoardSpecs &Specs = *Parts.Specs;
+    Parts.Table = !CoapTableSent || CoapTableVersion != Specs.ConfigVersion;
+    RequestWriter Body(CoapBody, sizeof(CoapBody));
+    writeCborBody(Body, Parts);
+    if (!Body.finish()) {
+        return -3;
+    }
+
+    char Buf[RESPONSESIZE + 1];
+    SocketAddress Server(serverAddress(NULL, Specs), Specs.RemotePort);
+    int Code = Uplink.post(socketInterface(), Server, Specs.RemoteDir.c_str(),
+                           COAPCBOR, (uint8_t *)CoapBody, Body.length(), Buf,
+                           sizeof(Buf));
+    if (Code < 0) {
+        // the server may have lost the table while it could not be reached,
+        // or moved to another address
+        CoapTableSent = false;
+        expireAddress();
+
+        // the POST also fails if mbed-coap ran out of blocks
+        BlockPoolStats Pools[COAPPOOLS];
+        size_t Count = CoapUplink::poolStats(Pools, COAPPOOLS);
+        for (size_t i = 0; i < Count; ++i) {
+            tr_warn("CoAP %lu byte blocks: %lu of %lu in use, peak %lu, %lu "
+                    "failed",
+                    (unsigned long)Pools[i].BlockSize,
+                    (unsigned long)Pools[i].InUse,
+                    (unsigned long)Pools[i].Blocks,
+                    (unsigned long)Pools[i].Peak,
+                    (unsigned long)Pools[i].Failed);
+        }
+        return Code;
+    }
+    tr_info("Response: %d %s", Code, Buf);
+    if (Code == 404)
+        return NETWORKNOTFOUND;
+
+    if (Parts.Table) {
+        CoapTableSent = true;
+        CoapTableVersion = Specs.ConfigVersion;
+    }
+    parseServerSettings(Buf, response);
+    return NETWORKSUCCESS;
+}
+#endif // COAPUPLINK
+
+#if GATEWAYROLE == GATEWAYCHILD
+/// how many datagrams went since the last one with the port table
+static size_t SinceTable = GATEWAYTABLEEVERY;
+
+/// the config version of the last port table that went to the gateway
+static uint32_t GatewayTableVersion = 0;
+
+/// the datagram is built here, with the header in front of the body
+static char Outgoing[GATEWAYDATAGRAMMAX + 1];
+
+// sends the frames of Parts to the gateway in one datagram, with the port
+// table now and then, and waits for its ack. The clock is set from the ack
+static int pushToGateway(ATCmdParser *_parser, RequestParts &Parts) {
+    BoardSpecs &Specs = *Parts.Specs;
+    if (!GatewayOpen && !openGatewayLink(_parser)) {
+        return -1;
+    }
+    Parts.Table = SinceTable >= GATEWAYTABLEEVERY ||
+                  GatewayTableVersion != Specs.ConfigVersion;
+    GatewayHeader Header = {GATEWAYMAGIC, GATEWAYREADINGS, 0, ++GatewayId, 0,
+                            0};
+    Header.Time = clockValid() ? (uint32_t)time(NULL) : 0;
+    memcpy(Outgoing, &Header, sizeof(Header));
+    RequestWriter Body(Outgoing + sizeof(Header),
+                       sizeof(Outgoing) - sizeof(Header));
+    writeCborBody(Body, Parts);
+    if (!Body.finish()) {
+        return -3;
+    }
+
+    GatewayAnswered = false;
+    crashLogBegin(CrashSend, GATEWAYLINK);
+    bool Sent = sendDatagram(_parser, Outgoing, sizeof(Header) + Body.length(),
+                             NULL, 0);
+    crashLogEnd(CrashSend, Sent);
+    if (!Sent) {
+        // the gateway may have gone, the link is set up again next time
+        GatewayOpen = false;
+        return -4;
+    }
+
+    // the gateway acks between its own requests
+    TraceMark Start = traceMark();
+    uint64_t Sending = Kernel::get_ms_count();
+    while (!GatewayAnswered &&
+           Kernel::get_ms_count() - Sending < GATEWAYACKMS) {
+        if (!_parser->process_oob()) {
+            ThisThread::sleep_for(RESPONSEPOLLMS);
+        }
+    }
+    traceSince(TraceAck, Start);
+    if (!GatewayAnswered) {
+        tr_warn("The gateway did not ack the readings");
+        return -5;
+    }
+    if (GatewayAnswer.Time != 0) {
+        syncClock(GatewayAnswer.Time);
+    }
+    if (GatewayAnswer.Status != GATEWAYQUEUED) {
+        tr_warn("The gateway has no room for the readings");
+        return -5;
+    }
+    if (Parts.Table) {
+        SinceTable = 0;
+        GatewayTableVersion = Specs.ConfigVersion;
+    } else {
+        ++SinceTable;
+    }
+    return NETWORKSUCCESS;
+}
+#endif // GATEWAYROLE
+
+#if LORAWANUPLINK
+/// the config version of the port table the server has, and the join it
+/// went out after, false until it went out whole
+static bool LoraTableSent = false;
+static uint32_t LoraTableVersion = 0;
+static uint32_t LoraTableJoins = 0;
+
+/// where the next piece of the port table starts, and its number
+static size_t LoraTableAt = 0;
+static uint8_t LoraTablePiece = 0;
+
+/// the readings of the last uplink
+static LoraPacker Packer;
+
+// returns true if the server may not have the port table of this config
+static bool loraTableDue(BoardSpecs &Specs) {
+    return !LoraTableSent || LoraTableVersion != Specs.ConfigVersion ||
+           LoraTableJoins != loraUplink().joins();
+}
+
+// takes the settings and the time out of a downlink that came in with the
+// last uplink
+static void takeLoraDownlink(float &response) {
+    char Text[LORADOWNLINKMAX + 1];
+    if (loraUplink().takeDownlink(Text, sizeof(Text)) == 0) {
+        return;
+    }
+    tr_info("Downlink: %s", Text);
+    const char *Time = strstr(Text, "time=\"");
+    if (Time != NULL && isdigit(Time[6])) {
+        syncClock(strtoul(Time + 6, NULL, 10));
+    }
+    parseServerSettings(Text, response);
+}
+
+// sends the next piece of the port table as
+// [config version, [[port name, multiplier, resolution], ...]] in one
+// uplink. A piece that the stack cut is sent again whole, and replaces it
+static int sendLoraTable(BoardSpecs &Specs, float &response) {
+    static char Table[LORATABLEMAX + 1];
+    RequestWriter Out(Table, sizeof(Table));
+    CborWriter Cbor(Out);
+    Cbor.array(2);
+    Cbor.unsignedInt(Specs.ConfigVersion);
+    Cbor.array(Specs.Ports.size());
+    for (const PortInfo &Port : Specs.Ports) {
+        Cbor.array(3);
+        Cbor.text(Port.Name.c_str());
+        Cbor.float32(Port.Multiplier);
+        Cbor.unsignedInt(Port.Resolution);
+    }
+    if (!Out.finish()) {
+        tr_warn("The port table does not fit into LORATABLEMAX");
+        return -3;
+    }
+
+    // the table changed or the session is new, it starts over
+    if (LoraTableVersion != Specs.ConfigVersion ||
+        LoraTableJoins != loraUplink().joins() ||
+        LoraTableAt >= Out.length()) {
+        LoraTableSent = false;
+        LoraTableVersion = Specs.ConfigVersion;
+        LoraTableJoins = loraUplink().joins();
+        LoraTableAt = 0;
+        LoraTablePiece = 0;
+    }
+    uint8_t Piece[LORAPAYLOADMAX];
+    size_t Length = Out.length() - LoraTableAt;
+    if (Length > loraUplink().room() - 1) {
+        Length = loraUplink().room() - 1;
+    }
+    bool Last = LoraTableAt + Length == Out.length();
+    Piece[0] = (LoraTablePiece & 0x7F) | (Last ? 0x80 : 0);
+    memcpy(Piece + 1, Table + LoraTableAt, Length);
+
+    size_t Took = 0;
+    int err = loraUplink().send(LORATABLEPORT, Piece, 1 + Length, Took);
+    takeLoraDownlink(response);
+    if (err != NETWORKSUCCESS || Took < 1 + Length) {
+        return err;
+    }
+    LoraTableAt += Length;
+    ++LoraTablePiece;
+    LoraTableSent = Last;
+    return NETWORKSUCCESS;
+}
+
+// packs as many of the Count frames as fit into one uplink and sends it,
+// or the next piece of the port table if the server needs it first. Sent
+// is set to how many of the frames went
+static int sendLoraFrames(BoardSpecs &Specs, const SampleFrame *Frames,
+                          size_t Count, float &response, size_t &Sent) {
+    Sent = 0;
+    if (loraTableDue(Specs)) {
+        return sendLoraTable(Specs, response);
+    }
+    if (Packer.pack(Frames, Count, portSpan(Specs), Specs.ConfigVersion,
+                    loraUplink().room()) == 0) {
+        return -3;
+    }
+    size_t Took = 0;
+    int err = loraUplink().send(LORAREADINGSPORT, Packer.data(),
+                                Packer.length(), Took);
+    takeLoraDownlink(response);
+    if (err != NETWORKSUCCESS) {
+        return err;
+    }
+    // the stack cuts an uplink that does not fit the data rate, the frames
+    // that were cut off go in the next one
+    Sent = Packer.framesIn(Took);
+    return Sent > 0 ? NETWORKSUCCESS : -4;
+}
+#endif // LORAWANUPLINK
+
+#if MQTTPUBLISH
+/// The longest topic, MQTTTOPICROOT/<board>/<leaf>
+#define MQTTTOPICMAX (96)
+
+/// the link to the broker, kept open between readings
+static MqttClient Broker;
+
+/// false until the port table was published on this link
+static bool BrokerTableSent = false;
+
+/// the config version of the port table on the broker
+static uint32_t BrokerTableVersion = 0;
+
+// writes the topic MQTTTOPICROOT/<board>/Leaf into Topic
+// returns false if it does not fit
+static bool boardTopic(char (&Topic)[MQTTTOPICMAX], BoardSpecs &Specs,
+                       const char *Leaf) {
+    RequestWriter Name(Topic, sizeof(Topic));
+    Name.append(MQTTTOPICROOT);
+    Name.append("/");
+    Name.append(Specs.DatabaseTableName);
+    Name.append("/");
+    Name.append(Leaf);
+    return !Name.overflowed();
+}
+
+// writes the retained port table message as a map of
+// b: board name, v: config version, p: the port table
+static void writeCborPorts(RequestWriter &Message, BoardSpecs &Specs) {
+    CborWriter Cbor(Message);
+    Cbor.map(3);
+    Cbor.text("b");
+    Cbor.text(Specs.DatabaseTableName);
+    Cbor.text("v");
+    Cbor.unsignedInt(Specs.ConfigVersion);
+    Cbor.text("p");
+    writeCborPortTable(Cbor, Specs);
+}
+
+// publishes what Write writes to a RequestWriter as one message on Topic.
+// It is written twice, once to measure it and once to stream it out in
+// SENDCHUNKSIZE pieces
+template <typename Writer>
+static bool publishCbor(const char *Topic, bool Retain, Writer Write) {
+    char Scratch[32];
+    RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+    Write(Counter);
+    Counter.finish();
+
+    if (!Broker.beginPublish(Topic, Counter.flushed(), Retain)) {
+        return false;
+    }
+    RequestWriter Message(ChunkBuffer, sizeof(ChunkBuffer),
+                          callback(&Broker, &MqttClient::write));
+    Write(Message);
+    return Message.finish() && Message.flushed() == Counter.flushed();
+}
+
+// a message on the config topic has the same settings as an HTTP response
+static void takeBrokerMessage(float &response) {
+    tr_info("Broker: %s", Broker.message());
+    parseServerSettings(Broker.message(), response);
+}
+
+// handles packets from the broker until no more than Left messages wait for
+// their PUBACK, for up to MQTTTIMEOUT
+static int waitForAcks(size_t Left, float &response) {
+    uint64_t Start = Kernel::get_ms_count();
+    while (Broker.inFlight() > Left) {
+        uint64_t Waited = Kernel::get_ms_count() - Start;
+        if (Waited >= MQTTTIMEOUT) {
+            tr_warn("The MQTT broker did not acknowledge the readings");
+            Broker.disconnect();
+            return -5;
+        }
+        int got = Broker.poll(MQTTTIMEOUT - (int)Waited);
+        if (got < 0) {
+            return -5;
+        }
+        if (got == MQTTMESSAGE) {
+            takeBrokerMessage(response);
+        }
+    }
+    return NETWORKSUCCESS;
+}
+
+// connects to the broker if the link is not up, and publishes the port table
+// if the broker does not have this version of it
+static int connectBroker(BoardSpecs &Specs) {
+    if (!Broker.connected()) {
+        char Config[MQTTTOPICMAX];
+        if (!boardTopic(Config, Specs, "config")) {
+            return -1;
+        }
+        SocketAddress Address(serverAddress(NULL, Specs), Specs.RemotePort);
+        if (!Broker.connect(socketInterface(), Address,
+                            Specs.DatabaseTableName.c_str(), Config)) {
+            expireAddress();
+            return -1;
+        }
+        BrokerTableSent = false;
+    }
+
+    // the readings only have port indexes, the retained table tells every
+    // subscriber what they are
+    if (!BrokerTableSent || BrokerTableVersion != Specs.ConfigVersion) {
+        char Ports[MQTTTOPICMAX];
+        boardTopic(Ports, Specs, "ports");
+        if (!publishCbor(Ports, true, [&Specs](RequestWriter &Message) {
+                writeCborPorts(Message, Specs);
+            })) {
+            Broker.disconnect();
+            return -4;
+        }
+        BrokerTableSent = true;
+        BrokerTableVersion = Specs.ConfigVersion;
+    }
+    return NETWORKSUCCESS;
+}
+
+// publishes the Count frames in messages of up to MQTTBATCHFRAMES readings,
+// with up to MQTTWINDOW of them in flight. It only returns NETWORKSUCCESS
+// once the broker has acknowledged every one of them
+static int publishReadings(BoardSpecs &Specs, const SampleFrame *Frames,
+                           size_t Count, float &response) {
+    int err = connectBroker(Specs);
+    if (err != NETWORKSUCCESS) {
+        return err;
+    }
+    char Topic[MQTTTOPICMAX];
+    boardTopic(Topic, Specs, "readings");
+
+    for (size_t Next = 0; Next < Count; Next += MQTTBATCHFRAMES) {
+        err = waitForAcks(MQTTWINDOW - 1, response);
+        if (err != NETWORKSUCCESS) {
+            return err;
+        }
+        size_t Take = Count - Next < MQTTBATCHFRAMES ? Count - Next
+                                                     : MQTTBATCHFRAMES;
+        RequestParts Parts = {&Specs, NULL, 0, Frames + Next, Take, true,
+                              false};
+        if (!publishCbor(Topic, false, [&Parts](RequestWriter &Message) {
+                writeCborBody(Message, Parts);
+            })) {
+            Broker.disconnect();
+            return -4;
+        }
+    }
+    return waitForAcks(0, response);
+}
+#endif // MQTTPUBLISH
+
+static void writeRequest(RequestParts *Parts, RequestWriter &Message) {
+    if (Parts->Message != NULL) {
+        Message.append(Parts->Message, Parts->Length);
+        return;
+    }
+
+    // a capture is POSTed in both request formats
+    if (Parts->Capture != NULL) {
+        BoardSpecs &Specs = *Parts->Specs;
+        Message.append(post_req_start);
+        Message.append(Specs.RemoteDir);
+        Message.append("?");
+        Message.append(id_get_str);
+        Message.append(Specs.DatabaseTableName);
+        Message.append(capture_get_str);
+        Message.append(http_version);
+        Message.append(req_header);
+        Message.append(Specs.HostName);
+        Message.append(get_req_end);
+        Message.append(cbor_headers);
+        Message.appendUnsigned(Parts->CaptureSize);
+        Message.append(get_req_end);
+        Message.append(keep_alive_header);
+        Message.append(get_req_end);
+        // the capture is CBOR already, it goes from the SD card straight
+        // into the chunk that is sent
+        Message.appendFile(Parts->Capture, 0, Parts->CaptureSize);
+        return;
+    }
+
+#if OTAUPDATE
+    // a piece of the patch is a GET of its own, without readings
+    if (Parts->Update != 0) {
+        BoardSpecs &Specs = *Parts->Specs;
+        Message.append(get_req_start);
+        Message.append(Specs.RemoteDir);
+        Message.append("?");
+        Message.append(id_get_str);
+        Message.append(Specs.DatabaseTableName);
+        Message.append(firmware_get_str);
+        Message.appendUnsigned(FIRMWAREVERSION);
+        Message.append(update_get_str);
+        Message.appendUnsigned(Parts->Update);
+        Message.append(offset_get_str);
+        Message.appendUnsigned(Parts->UpdateOffset);
+        Message.append(http_version);
+        Message.append(req_header);
+        Message.append(Specs.HostName);
+        Message.append(get_req_end);
+        Message.append(keep_alive_header);
+        Message.append(get_req_end);
+        return;
+    }
+#endif
+
+#if GATEWAYROLE == GATEWAYHUB
+    // the bodies of the children are CBOR already, each of them a map like
+    // writeCborBody() writes. They go into one array as they are
+    if (Parts->Relayed != 0) {
+        BoardSpecs &Specs = *Parts->Specs;
+        char Scratch[8];
+        RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+        CborWriter(Counter).array(Parts->Relayed);
+        Counter.finish();
+
+        Message.append(post_req_start);
+        Message.append(Specs.RemoteDir);
+        Message.append("?");
+        Message.append(id_get_str);
+        Message.append(Specs.DatabaseTableName);
+        Message.append(relayed_get_str);
+        Message.appendUnsigned(Parts->Relayed);
+        Message.append(http_version);
+        Message.append(req_header);
+        Message.append(Specs.HostName);
+        Message.append(get_req_end);
+        Message.append(cbor_headers);
+        Message.appendUnsigned(Counter.flushed() + Parts->RelayedBytes);
+        Message.append(get_req_end);
+        Message.append(keep_alive_header);
+        Message.append(get_req_end);
+        CborWriter(Message).array(Parts->Relayed);
+        Relay.write(Message, Parts->Relayed);
+        return;
+    }
+#endif
+
+#if REQUESTFORMAT == REQUESTCBOR
+    BoardSpecs &Specs = *Parts->Specs;
+    Message.append(post_req_start);
+    Message.append(Specs.RemoteDir);
+    Message.append(http_version);
+    Message.append(req_header);
+    Message.append(Specs.HostName);
+    Message.append(get_req_end);
+#if COMPRESSBATCHES
+    // a single reading is too short to have anything to match
+    if (Parts->Count > 1) {
+        Message.append(heatshrink_header);
+        Message.append(cbor_headers);
+        Message.appendUnsigned(compressedBodyLength(*Parts));
+        Message.append(get_req_end);
+        Message.append(keep_alive_header);
+        Message.append(get_req_end);
+        writeCompressedBody(Message, *Parts);
+        return;
+    }
+#endif
+    Message.append(cbor_headers);
+    Message.appendUnsigned(cborBodyLength(*Parts));
+    Message.append(get_req_end);
+    Message.append(keep_alive_header);
+    Message.append(get_req_end);
+    writeCborBody(Message, *Parts);
+#else
+    appendRequestStart(Message, *Parts->Specs);
+#if SEQUENCEDUPLOADS
+    if (Parts->Floor != 0) {
+        Message.append(floor_get_str);
+        Message.appendUnsigned(Parts->Floor);
+    }
+#endif
+    for (size_t i = 0; i < Parts->Count; ++i) {
+        appendReadings(Message, Parts->Frames[i], portSpan(*Parts->Specs),
+                       Parts->Stamp);
+    }
+    appendRequestEnd(Message, *Parts->Specs);
+#endif
+}
+
+// where writeLink() writes to
+struct LinkWriter {
+    ATCmdParser *Parser;
+    int Link;
+
+    /// how long the pieces took to send, for the trace
+    TraceMark Sending;
+};
+
+static bool writeLink(LinkWriter *To, const char *data, size_t length) {
+    TraceMark Start = traceMark();
+    bool Sent = writeServerLink(To->Parser, To->Link, data, length);
+    TraceMark Took = traceElapsed(Start);
+    traceRecord(TraceSend, Took);
+    To->Sending.Us += Took.Us;
+    To->Sending.Cycles += Took.Cycles;
+    return Sent;
+}
+
+// streams the request to Link in SENDCHUNKSIZE pieces as it is formatted,
+// so the whole request never has to be in RAM. The response is not waited
+// for, see readServerResponse()
+static int writeRequestTCP(ATCmdParser *_parser, BoardSpecs &Specs, int Link,
+                           RequestParts &Parts) {
+    // a link that was kept open may have been closed by the server without
+    // the CLOSED message being seen yet, so try once more on a new link
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused = serverLinkOpen(Link);
+        bool Opened = openServerLink(_parser, Specs, Link) == NETWORKSUCCESS;
+        if (!reused) {
+            linkConnected(Opened);
+        }
+        if (!Opened) {
+            linkRequestDone(Link, false);
+            return -1;
+        }
+        if (attempt > 0) {
+            linkRetried(1);
+        }
+
+#if REQUESTFORMAT == REQUESTCBOR
+        // a new link or new ports need the port table again
+        Parts.Table = !reused || !TableSent[Link] ||
+                      TableVersion[Link] != Specs.ConfigVersion;
+#endif
+        LinkWriter To = {_parser, Link, {0, 0}};
+        RequestWriter Message(ChunkBuffer, sizeof(ChunkBuffer),
+                              callback(writeLink, &To));
+        TraceMark Start = traceMark();
+        uint32_t Allocated = allocCount();
+        crashLogBegin(CrashSend, Link);
+        writeRequest(&Parts, Message);
+        bool Written = Message.finish();
+        crashLogEnd(CrashSend, Written);
+        allocCheck("request", Allocated);
+        linkSent(Message.flushed());
+        uplinkSent(Message.flushed());
+
+        // the request is formatted while it is sent, the formatting is
+        // what is left without the sending
+        TraceMark Took = traceElapsed(Start);
+        Took.Us -= To.Sending.Us;
+        Took.Cycles -= To.Sending.Cycles;
+        traceRecord(TraceFormat, Took);
+        if (Written) {
+            linkRequestSent(Link);
+#if REQUESTFORMAT == REQUESTCBOR
+            // only the readings have the port table
+            if (Parts.Message == NULL && Parts.Capture == NULL &&
+                Parts.Relayed == 0 && Parts.Update == 0) {
+                TableSent[Link] = TableSent[Link] || Parts.Table;
+                TableVersion[Link] = Specs.ConfigVersion;
+            }
+#endif
+            return NETWORKSUCCESS;
+        }
+
+        closeServerLink(_parser, Link);
+        if (!reused || Message.flushed() != 0) {
+            linkRequestDone(Link, false);
+            return Message.flushed() == 0 ? -3 : -4;
+        }
+    }
+    linkRequestDone(Link, false);
+    return -3;
+}
+
+// sends the request on Link and waits for its response
+static int streamRequestTCP(ATCmdParser *_parser, BoardSpecs &Specs, int Link,
+                            RequestParts &Parts, float &response) {
+    int err = writeRequestTCP(_parser, Specs, Link, Parts);
+    if (err != NETWORKSUCCESS) {
+        return err;
+    }
+    TraceMark Start = traceMark();
+    crashLogBegin(CrashAck, Link);
+    err = readServerResponse(_parser, Link, response);
+    crashLogEnd(CrashAck, err);
+    traceSince(TraceAck, Start);
+    linkRequestDone(Link, err == NETWORKSUCCESS);
+    return err;
+}
+
+// the number of bytes that Frame adds to a batch request. Codec has seen
+// the frames in front of it in the request, it is only used with
+// PACKEDREADINGS
+static size_t readingsLength(const SampleFrame &Frame, BoardSpecs &Specs,
+                             FrameCodec &Codec) {
+    char Scratch[32];
+    RequestWriter Counter(Scratch, sizeof(Scratch), callback(discardText));
+#if REQUESTFORMAT == REQUESTCBOR && PACKEDREADINGS
+    CborWriter Cbor(Counter);
+    writeCborPacked(Cbor, Codec, Frame, portSpan(Specs));
+#elif REQUESTFORMAT == REQUESTCBOR
+    // up to 4 more bytes for the time after the first reading
+    CborWriter Cbor(Counter);
+    writeCborReading(Cbor, Frame, portSpan(Specs), Frame.Timestamp);
+    Counter.append("    ");
+#endif
+#if REQUESTFORMAT == REQUESTCBOR && SEQUENCEDUPLOADS
+    // its number in the s array
+    Cbor.unsignedInt(Frame.Sequence);
+#endif
+#if REQUESTFORMAT != REQUESTCBOR
+    appendReadings(Counter, Frame, portSpan(Specs), true);
+#endif
+    Counter.finish();
+    return Counter.flushed();
+}
+
+/// how many readings the requests on each backlog link take
+static BatchSizer BatchSizes;
+
+// sends the Count frames as up to Links requests of up to REQUESTMAX bytes
+// and the limit of BatchSizes, one on each backlog link, before any response
+// is read. Floor goes with every request, see RequestParts. Sent is set to
+// the frames of the requests that worked, up to the first one that did not,
+// as the backup log is only acknowledged from its start
+static int sendBatchRequestsTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                                const SampleFrame *Frames, size_t Count,
+                                size_t Links, uint32_t Floor, float &response,
+                                size_t &Sent) {
+    size_t Sizes[BACKLOGLINKS];
+    size_t Lengths[BACKLOGLINKS];
+    uint64_t Starts[BACKLOGLINKS];
+    int Errors[BACKLOGLINKS];
+    size_t Requests = 0;
+    size_t First = 0;
+    while (First < Count && Requests < Links && Requests < BACKLOGLINKS) {
+        // take frames until the request would get longer than REQUESTMAX,
+        // or than the link does well with
+        int Link = BACKLOGLINK + Requests;
+        size_t Limit = BatchSizes.limit(Link);
+        size_t Length = requestStartSize(Specs) + requestEndSize(Specs);
+#if SEQUENCEDUPLOADS && REQUESTFORMAT != REQUESTCBOR
+        Length += strlen(floor_get_str) + digitCount(Frames[0].Sequence);
+#endif
+        size_t Used = 0;
+        FrameCodec Codec;
+        while (First + Used < Count && Used < Limit) {
+            size_t More = readingsLength(Frames[First + Used], Specs, Codec);
+            if (Used > 0 && Length + More > REQUESTMAX) {
+                break;
+            }
+            Length += More;
+            ++Used;
+        }
+
+        tr_debug("%u readings in %u bytes on link %d", Used, Length, Link);
+        RequestParts Parts = {&Specs, NULL, 0, Frames + First, Used, true,
+                              false};
+        Parts.Floor = Floor;
+        Starts[Requests] = Kernel::get_ms_count();
+        Errors[Requests] = writeRequestTCP(_parser, Specs, Link, Parts);
+        Sizes[Requests] = Used;
+        Lengths[Requests] = Length;
+        First += Used;
+        // the next links would most likely fail the same way
+        if (Errors[Requests++] != NETWORKSUCCESS) {
+            break;
+        }
+    }
+
+    // the server works on the requests while the next ones are sent, the
+    // responses are taken in order
+    int err = NETWORKSUCCESS;
+    Sent = 0;
+    for (size_t i = 0; i < Requests; ++i) {
+        int LinkErr = Errors[i];
+        if (LinkErr == NETWORKSUCCESS) {
+            TraceMark Start = traceMark();
+            crashLogBegin(CrashAck, BACKLOGLINK + i);
+            LinkErr = readServerResponse(_parser, BACKLOGLINK + i, response);
+            crashLogEnd(CrashAck, LinkErr);
+            traceSince(TraceAck, Start);
+            linkRequestDone(BACKLOGLINK + i, LinkErr == NETWORKSUCCESS);
+        }
+        if (LinkErr == NETWORKSUCCESS) {
+            BatchSizes.sent(BACKLOGLINK + i, Sizes[i], Lengths[i],
+                            Kernel::get_ms_count() - Starts[i]);
+        } else {
+            BatchSizes.failed(BACKLOGLINK + i);
+        }
+        if (err == NETWORKSUCCESS && LinkErr != NETWORKSUCCESS) {
+            err = LinkErr;
+        }
+        if (err == NETWORKSUCCESS) {
+            Sent += Sizes[i];
+        }
+    }
+#if SEQUENCEDUPLOADS
+    // a request whose response was lost may still have been stored, the
+    // acks in the other responses tell
+    while (Sent < First && Frames[Sent].Sequence != 0 &&
+           Frames[Sent].Sequence <= ackedSequence()) {
+        ++Sent;
+    }
+#endif
+    return Sent > 0 ? NETWORKSUCCESS : err;
+}
+
+// ============================================================================
+int sendMessageTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                   const char *message, size_t length, float &response) {
+    RequestParts Parts = {&Specs, message, length, NULL, 0, false, false};
+    return streamRequestTCP(_parser, Specs, LIVELINK, Parts, response);
+}
+
+#if OTAUPDATE
+// =============================================================================
+int fetchFirmwareTCP(ATCmdParser *_parser, BoardSpecs &Specs, uint32_t Update,
+                     uint32_t Offset, uint8_t *Piece, size_t Size,
+                     size_t &Length) {
+    Length = 0;
+    RequestParts Parts = {&Specs, NULL, 0, NULL, 0, false, false};
+    Parts.Update = Update;
+    Parts.UpdateOffset = Offset;
+    int err = writeRequestTCP(_parser, Specs, LIVELINK, Parts);
+    if (err != NETWORKSUCCESS) {
+        return err;
+    }
+    crashLogBegin(CrashAck, LIVELINK);
+    err = readServerBody(_parser, LIVELINK, Piece, Size, Length);
+    crashLogEnd(CrashAck, err);
+    linkRequestDone(LIVELINK, err == NETWORKSUCCESS);
+    return err;
+}
+#endif
+
+int sendBackupDataTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                      const char *LogDir, float &response) {
+    tr_debug("Sending backup data over the network");
+    SampleFrame Frame;
+    uint32_t Allocated = allocCount();
+    bool Read = getSensorDataFromFile(Specs, LogDir, Frame);
+    allocCheck("backup read", Allocated);
+    if (!Read) {
+        return NETWORKNOTHINGSENT;
+    }
+    return sendBulkDataTCP(_parser, Specs, Frame, response);
+}
+
+// sends the Sent frames of the backup log on the uplink that is built in.
+// Sent is set to how many of them went out, an uplink may only take the
+// first few. Floor is the oldest sequence number that the board still has
+// to send, 0 if the frames do not start at it
+static int sendFramesTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                         SampleFrame *Frames, size_t &Sent, uint32_t Floor,
+                         float &response) {
+#if MQTTPUBLISH
+    return publishReadings(Specs, Frames, Sent, response);
+#elif COAPUPLINK
+    // the body has to fit into CoapBody, with the port table in case it is
+    // needed
+    RequestParts Parts = {&Specs, NULL, 0, Frames, Sent, true, true};
+    while (Parts.Count > 1 && cborBodyLength(Parts) > COAPPAYLOADMAX) {
+        --Parts.Count;
+    }
+    Sent = Parts.Count;
+    return postReadings(Parts, response);
+#elif GATEWAYROLE == GATEWAYCHILD
+    // the body has to fit into one datagram, with the port table in case it
+    // is needed
+    RequestParts Parts = {&Specs, NULL, 0, Frames, Sent, true, true};
+    Parts.Floor = Floor;
+    while (Parts.Count > 1 && cborBodyLength(Parts) > GATEWAYBODYMAX) {
+        --Parts.Count;
+    }
+    Sent = Parts.Count;
+    return pushToGateway(_parser, Parts);
+#elif LORAWANUPLINK
+    return sendLoraFrames(Specs, Frames, Sent, response, Sent);
+#else
+#if ESPPASSTHROUGH
+    // in transparent mode there is one connection, PIPELINEDEPTH requests
+    // go out on it one after the other and the server answers them in
+    // order. Their pieces go out without waiting for the ESP8266 each time
+    if (enterPassthrough(_parser, Specs)) {
+        return sendBatchRequestsTCP(_parser, Specs, Frames, Sent,
+                                    PIPELINEDEPTH, Floor, response, Sent);
+    }
+#endif
+    return sendBatchRequestsTCP(_parser, Specs, Frames, Sent, BACKLOGLINKS,
+                                Floor, response, Sent);
+#endif
+}
+
+/// The frames of the backlog that are being sent. Only the uploader thread
+/// sends, so they do not have to be on its stack. With BACKLOGPREFETCH the
+/// next batch is read into the other half
+static SampleFrame Batches[1 + BACKLOGPREFETCH][BACKUPBATCHMAX * BATCHREQUESTS];
+static size_t Half = 0;
+
+// =============================================================================
+int sendBackupBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                       const char *LogDir, float &response, size_t &Sent) {
+    tr_debug("Sending a batch of backup data over the network");
+    Half = (Half + 1) % (1 + BACKLOGPREFETCH);
+    SampleFrame *Frames = Batches[Half];
+    crashLogBegin(CrashBacklogRead);
+    Sent = getSensorDataBatch(Specs, LogDir, Frames,
+                              BACKUPBATCHMAX * BATCHREQUESTS);
+    crashLogEnd(CrashBacklogRead, Sent);
+    if (Sent == 0) {
+        return NETWORKNOTHINGSENT;
+    }
+#if BACKLOGPREFETCH
+    // the SD card reads the next batch while the ESP8266 sends this one
+    prefetchSensorDataBatch(Specs, LogDir, Batches[1 - Half],
+                            BACKUPBATCHMAX * BATCHREQUESTS);
+#endif
+
+    // readings that were logged before the clock was set get its step
+    for (size_t i = 0; i < Sent; ++i) {
+        Frames[i].Timestamp = syncedTime(Frames[i].Timestamp);
+    }
+
+    // frames without any configured ports can be acknowledged without
+    // being sent
+    bool Empty = true;
+    for (size_t i = 0; i < Sent && Empty; ++i) {
+        Empty = Frames[i].PortMask == 0;
+    }
+    if (Empty) {
+        return NETWORKNOTHINGSENT;
+    }
+
+#if SEQUENCEDUPLOADS
+    // the readings in front that the server acked already are dropped
+    // without being sent again
+    size_t Acked = 0;
+    while (Acked < Sent && Frames[Acked].Sequence != 0 &&
+           Frames[Acked].Sequence <= ackedSequence()) {
+        ++Acked;
+    }
+    if (Acked > 0) {
+        tr_info("%u backed up readings were acked already", Acked);
+        Sent = Acked;
+        return NETWORKNOTHINGSENT;
+    }
+#endif
+
+    // the batch starts at the oldest reading of the backup log
+    return sendFramesTCP(_parser, Specs, Frames, Sent, Frames[0].Sequence,
+                         response);
+}
+
+#if BACKLOGQUERY
+// =============================================================================
+bool backlogQueryWaiting() { return QueryWaiting; }
+
+// =============================================================================
+int sendQueriedBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                        const char *LogDir, float &response) {
+    if (!QueryWaiting) {
+        return NETWORKNOTHINGSENT;
+    }
+    // the batch that was sent last is done with, the prefetched one is in
+    // the other half
+    SampleFrame *Frames = Batches[Half];
+    crashLogBegin(CrashBacklogRead);
+    size_t Sent = querySensorData(Specs, LogDir, Query, Frames,
+                                  BACKUPBATCHMAX * BATCHREQUESTS);
+    crashLogEnd(CrashBacklogRead, Sent);
+    if (Sent == 0) {
+        tr_info("The asked for range of the backlog was sent");
+        QueryWaiting = false;
+        return NETWORKNOTHINGSENT;
+    }
+
+    // a time range starts after the clock was set, so the times of its
+    // readings stay as they are
+    for (size_t i = 0; i < Sent; ++i) {
+        Frames[i].Timestamp = syncedTime(Frames[i].Timestamp);
+    }
+
+    // readings without any configured ports are passed over
+    bool Empty = true;
+    for (size_t i = 0; i < Sent && Empty; ++i) {
+        Empty = Frames[i].PortMask == 0;
+    }
+    if (Empty) {
+        advanceQuery(Query, Frames, Sent);
+        return NETWORKNOTHINGSENT;
+    }
+
+    // the board has older readings to send than these, so there is no floor
+    int err = sendFramesTCP(_parser, Specs, Frames, Sent, 0, response);
+    if (err == NETWORKSUCCESS) {
+        advanceQuery(Query, Frames, Sent);
+    }
+    return err;
+}
+#endif
+
+// =============================================================================
+int sendBulkDataTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                    const SampleFrame &Frame, float &response) {
+    // a reading from the flash queue may be from before the clock was set
+    SampleFrame Stamped = Frame;
+    Stamped.Timestamp = syncedTime(Frame.Timestamp);
+#if MQTTPUBLISH
+    return publishReadings(Specs, &Stamped, 1, response);
+#elif COAPUPLINK
+    RequestParts Parts = {&Specs, NULL, 0, &Stamped, 1, false, false};
+    return postReadings(Parts, response);
+#elif GATEWAYROLE == GATEWAYCHILD
+    RequestParts Parts = {&Specs, NULL, 0, &Stamped, 1, false, false};
+    return pushToGateway(_parser, Parts);
+#elif LORAWANUPLINK
+    // the reading is backed up while the port table goes out
+    size_t Sent = 0;
+    int err = sendLoraFrames(Specs, &Stamped, 1, response, Sent);
+    return err == NETWORKSUCCESS && Sent == 0 ? -4 : err;
+#else
+    // the server stamps a reading without a time when it gets it, so the
+    // time is only sent once it is real
+    bool Stamp = Stamped.Timestamp >= TIMEVALIDAFTER;
+    RequestParts Parts = {&Specs, NULL, 0, &Stamped, 1, Stamp, false};
+    return streamRequestTCP(_parser, Specs, LIVELINK, Parts, response);
+#endif
+}
+
+// =============================================================================
+int sendCaptureTCP(ATCmdParser *_parser, BoardSpecs &Specs, const char *Dir,
+                   float &response) {
+    size_t Size = 0;
+    FILE *File = openCapture(Dir, Size);
+    if (File == NULL) {
+        return NETWORKNOTHINGSENT;
+    }
+    tr_debug("Sending a %u byte capture", Size);
+
+#if MQTTPUBLISH
+    int err = connectBroker(Specs);
+    if (err == NETWORKSUCCESS) {
+        char Topic[MQTTTOPICMAX];
+        boardTopic(Topic, Specs, "capture");
+        if (!publishCbor(Topic, false, [File, Size](RequestWriter &Message) {
+                Message.appendFile(File, 0, Size);
+            })) {
+            Broker.disconnect();
+            err = -4;
+        } else {
+            err = waitForAcks(0, response);
+        }
+    }
+#elif COAPUPLINK
+    // mbed-coap needs all of the body at once
+    int err = NETWORKNOTHINGSENT;
+    if (Size > COAPPAYLOADMAX) {
+        tr_warn("The capture does not fit into a CoAP POST, dropping it");
+    } else if (fread(CoapBody, 1, Size, File) == Size) {
+        char Buf[RESPONSESIZE + 1];
+        SocketAddress Server(serverAddress(NULL, Specs), Specs.RemotePort);
+        int Code = Uplink.post(socketInterface(), Server,
+                               Specs.RemoteDir.c_str(), COAPCBOR,
+                               (uint8_t *)CoapBody, Size, Buf, sizeof(Buf));
+        err = Code < 0      ? Code
+              : Code == 404 ? NETWORKNOTFOUND
+                            : NETWORKSUCCESS;
+        if (err == NETWORKSUCCESS) {
+            parseServerSettings(Buf, response);
+        }
+    }
+#elif GATEWAYROLE == GATEWAYCHILD
+    // the gateway only relays readings, a capture would hold up the backlog
+    tr_warn("A capture can not be sent through the gateway, dropping it");
+    int err = NETWORKNOTHINGSENT;
+#elif LORAWANUPLINK
+    // a capture would take the uplinks of hours of readings
+    tr_warn("A capture can not be sent over LoRaWAN, dropping it");
+    int err = NETWORKNOTHINGSENT;
+#else
+    RequestParts Parts = {&Specs, NULL, 0, NULL, 0, false, false, File, Size};
+    int err = streamRequestTCP(_parser, Specs, BACKLOGLINK, Parts, response);
+#endif
+    fclose(File);
+    return err;
+}
+
+// =============================================================================
+void pollGateway(ATCmdParser *_parser) {
+#if GATEWAYROLE == GATEWAYHUB
+    // only what is already there, every datagram that came in gets its ack
+    while (_parser->process_oob()) {
+    }
+    if (!GatewayOpen) {
+        openGatewayLink(_parser);
+    }
+    // a datagram that comes in while the acks are sent adds one to the end
+    GatewayHeader Header = {GATEWAYMAGIC, GATEWAYACK, 0, 0, 0, 0};
+    Header.Time = clockValid() ? (uint32_t)time(NULL) : 0;
+    for (size_t i = 0; i < AckCount; ++i) {
+        Header.Status = Acks[i].Status;
+        Header.Id = Acks[i].Id;
+        if (!sendDatagram(_parser, &Header, sizeof(Header), Acks[i].Ip,
+                          Acks[i].Port)) {
+            tr_warn("The ack could not be sent to %s", Acks[i].Ip);
+        }
+    }
+    AckCount = 0;
+#endif
+}
+
+// =============================================================================
+bool gatewayBatchDue() {
+#if GATEWAYROLE == GATEWAYHUB
+    return Relay.count() > 0 && (Relay.age() >= GATEWAYHOLDMS ||
+                                 Relay.used() >= GATEWAYQUEUEBYTES / 2);
+#else
+    return false;
+#endif
+}
+
+// =============================================================================
+int sendGatewayBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                        float &response) {
+#if GATEWAYROLE == GATEWAYHUB
+    RequestParts Parts = {&Specs, NULL, 0, NULL, 0, false, false};
+    Parts.Relayed = Relay.take(GATEWAYBATCHMAX, Parts.RelayedBytes);
+    if (Parts.Relayed == 0) {
+        return NETWORKNOTHINGSENT;
+    }
+    tr_debug("Relaying %u bodies of the children in %u bytes", Parts.Relayed,
+             Parts.RelayedBytes);
+    int err = streamRequestTCP(_parser, Specs, BACKLOGLINK, Parts, response);
+    if (err == NETWORKSUCCESS) {
+        Relay.pop(Parts.Relayed);
+    }
+    return err;
+#else
+    return NETWORKNOTHINGSENT;
+#endif
+}
+
+// =============================================================================
+bool loraSlotDue() {
+#if LORAWANUPLINK
+    return loraUplink().slotDue();
+#else
+    return true;
+#endif
+}
+
+// =============================================================================
+void pollMqtt(float &response) {
+#if MQTTPUBLISH
+    // only what is already there, the uploader does not wait here
+    while (Broker.poll(0) == MQTTMESSAGE) {
+        takeBrokerMessage(response);
+    }
+    Broker.keepAlive();
+#endif
 }
@@ -4,6 +4,8 @@
 /// \brief Networking function declarations
 #include "ATCmdParser.h"
 #include "BoardConfig.h"
+#include "DMAUARTSerial.h"
+#include "HttpResponse.h"
 #include "OfflineLogging.h"
 #include "SocketAddress.h"
 #include "Structs.h"
@@ -15,9 +17,486 @@
 #include <string>
 #include <vector>
 
-/// the number of times to try reconnecting to wifi before going into offline
-/// mode
-#define WIFITRIES (5)
+/// The cached DHCP lease is used for this many joins in a row, then DHCP
+/// renews it
+#define WIFISTATICJOINS (8)
+
+/// The largest message that the ESP8266 takes in one AT+CIPSEND
+#define ESPSENDMAX (2048)
+
+/// Requests are sent in pieces of this many bytes as they are formatted.
+/// It has to be ESPSENDMAX or less
+#define SENDCHUNKSIZE (512)
+
+/// The longest batch request, most servers take request lines up to 8 KB
+#define REQUESTMAX (8000)
+
+/// The most backed up readings that are sent in one request
+#define BACKUPBATCHMAX (32)
+
+/// Set to 1 to give every reading a sequence number, which the server acks
+/// and drops the readings it has already by, see Sequence.h. The server has
+/// to know the Seq[] and Stream of the requests, and bit 4 of the packed
+/// readings. Set with "sequenced-uploads" in mbed_app.json.
+#ifdef MBED_CONF_APP_SEQUENCED_UPLOADS
+#define SEQUENCEDUPLOADS MBED_CONF_APP_SEQUENCED_UPLOADS
+#else
+#define SEQUENCEDUPLOADS 0
+#endif
+
+/// Set to 1 for a new reading to go out before the backlog, so that it is
+/// only held up by a batch that is already being sent. With 0 the backlog
+/// goes first and the reading is backed up behind it. Set with "live-first"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_LIVE_FIRST
+#define LIVEFIRST MBED_CONF_APP_LIVE_FIRST
+#else
+#define LIVEFIRST 1
+#endif
+
+/// How much of the polling interval the backlog may take after a reading,
+/// in percent, 100 for as long as no new reading comes in. Set with
+/// "backlog-share" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_SHARE
+#define BACKLOGSHARE MBED_CONF_APP_BACKLOG_SHARE
+#else
+#define BACKLOGSHARE 100
+#endif
+
+/// How much of the server's response is kept to look for the sample rate
+/// and a config delta, see ConfigDelta.h
+#define RESPONSESIZE (512)
+
+/// The server's response is taken from the ESP8266 in pieces of this many
+/// bytes
+#define RESPONSEPIECE (64)
+
+/// Set to 1 to talk to the ESP8266 through ESP8266Interface and TCPSocket
+/// instead of raw AT commands. Set with "network-sockets" in mbed_app.json.
+#ifdef MBED_CONF_APP_NETWORK_SOCKETS
+#define NETWORKSOCKETS MBED_CONF_APP_NETWORK_SOCKETS
+#else
+#define NETWORKSOCKETS 0
+#endif
+
+/// Set to ETHERNETONLY for the sockets to go over the K64F's Ethernet port,
+/// with EthernetInterface on lwIP and DHCP, instead of the ESP8266. The SSID
+/// and password of the config file are not used then. Set to
+/// ETHERNETFAILOVER to have both, see Multipath.h. Needs NETWORKSOCKETS.
+/// The K64F's ENET inserts and checks the checksums in place of lwIP, and
+/// the depth of its descriptor rings is set with kinetis-emac.rx-ring-len
+/// and tx-ring-len. lwip.bulk-uplink sizes lwIP's TCP for the batches.
+/// Set with "ethernet" in mbed_app.json.
+#ifdef MBED_CONF_APP_ETHERNET
+#define NETWORKETHERNET MBED_CONF_APP_ETHERNET
+#else
+#define NETWORKETHERNET 0
+#endif
+
+/// Only the Ethernet port
+#define ETHERNETONLY (1)
+
+/// The Ethernet port while it works, and the ESP8266 when it does not
+#define ETHERNETFAILOVER (2)
+
+#if NETWORKETHERNET && !NETWORKSOCKETS
+#error "ethernet needs network-sockets set to 1"
+#endif
+
+/// Set to 1 for the sockets to go over a 6LoWPAN or Thread mesh of 802.15.4
+/// radios instead of the ESP8266, with the MeshInterface of nanostack. The
+/// mesh is the one of "nsapi.default-mesh-type", on the radio whose driver
+/// is in "target.components_add", like MCR20A for the FRDM-CR20A shield. A
+/// border router with Ethernet takes the mesh to the server, which has to
+/// be reachable over IPv6. Every message wakes the radio of every hop on its
+/// way, so the readings wait in the backup log until MESHBATCH of them go
+/// in one request. Needs NETWORKSOCKETS. Set with "mesh" in mbed_app.json.
+#ifdef MBED_CONF_APP_MESH
+#define NETWORKMESH MBED_CONF_APP_MESH
+#else
+#define NETWORKMESH 0
+#endif
+
+#if NETWORKMESH && !NETWORKSOCKETS
+#error "mesh needs network-sockets set to 1"
+#endif
+
+#if NETWORKMESH && NETWORKETHERNET
+#error "only one of mesh and ethernet can be set"
+#endif
+
+/// How many readings a mesh node sends in one request, they are backed up
+/// until then. Set with "mesh-batch" in mbed_app.json.
+#ifdef MBED_CONF_APP_MESH_BATCH
+#define MESHBATCH MBED_CONF_APP_MESH_BATCH
+#else
+#define MESHBATCH (16)
+#endif
+
+/// Set to 1 for the sockets to go over an LTE-M or NB-IoT modem instead of
+/// the ESP8266, with the CellularContext of features/cellular, for sites
+/// without a network. The modem is the one of the target's
+/// CellularDevice, like the one of "target.components_add". Every upload
+/// costs bytes of the data plan and the energy of a wake of the modem, so
+/// the readings wait in the backup log and go in one batch every
+/// CELLULARPSMTAU, when the modem is woken for its periodic update anyway.
+/// The modem asks for PSM with CELLULARPSMTAU and CELLULARPSMACTIVE, and
+/// sleeps in between, and the PDP context stays up, so a batch does not
+/// attach again. Needs NETWORKSOCKETS. Set with "cellular" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR
+#define NETWORKCELLULAR MBED_CONF_APP_CELLULAR
+#else
+#define NETWORKCELLULAR 0
+#endif
+
+#if NETWORKCELLULAR && !NETWORKSOCKETS
+#error "cellular needs network-sockets set to 1"
+#endif
+
+#if NETWORKCELLULAR && (NETWORKETHERNET || NETWORKMESH)
+#error "only one of cellular, mesh and ethernet can be set"
+#endif
+
+/// The APN of the SIM's operator, an empty one leaves it to
+/// "cellular.use-apn-lookup". Set with "cellular-apn" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR_APN
+#define CELLULARAPN MBED_CONF_APP_CELLULAR_APN
+#else
+#define CELLULARAPN ""
+#endif
+
+/// The periodic update of PSM that the modem asks the network for, in
+/// seconds, and how often the batches go. The network may grant another
+/// one, which is used then. Set with "cellular-psm-tau" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR_PSM_TAU
+#define CELLULARPSMTAU MBED_CONF_APP_CELLULAR_PSM_TAU
+#else
+#define CELLULARPSMTAU (3600)
+#endif
+
+/// How long the modem stays reachable after a batch before it goes into
+/// PSM, in seconds. Set with "cellular-psm-active" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR_PSM_ACTIVE
+#define CELLULARPSMACTIVE MBED_CONF_APP_CELLULAR_PSM_ACTIVE
+#else
+#define CELLULARPSMACTIVE (10)
+#endif
+
+/// The eDRX cycle of 3GPP TS 27.007 +CEDRXS, 0 to 15, for a modem or an
+/// operator without PSM, or -1 for none. It is on LTE-M, or on NB-IoT with
+/// CELLULARNBIOT. Set with "cellular-edrx" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR_EDRX
+#define CELLULAREDRX MBED_CONF_APP_CELLULAR_EDRX
+#else
+#define CELLULAREDRX (-1)
+#endif
+
+/// Set to 1 if the modem is on NB-IoT instead of LTE-M. Set with
+/// "cellular-nb-iot" in mbed_app.json.
+#ifdef MBED_CONF_APP_CELLULAR_NB_IOT
+#define CELLULARNBIOT MBED_CONF_APP_CELLULAR_NB_IOT
+#else
+#define CELLULARNBIOT 0
+#endif
+
+/// Set to 1 for the readings to go out as LoRaWAN uplinks of an SX1276
+/// radio instead of over the ESP8266, for remote sites without a network.
+/// They are backed up and bit-packed into one uplink whenever the duty
+/// cycle lets one go, see LoraUplink.h. Needs NETWORKSOCKETS set to 0.
+/// Set with "lorawan" in mbed_app.json.
+#ifdef MBED_CONF_APP_LORAWAN
+#define LORAWANUPLINK MBED_CONF_APP_LORAWAN
+#else
+#define LORAWANUPLINK 0
+#endif
+
+#if LORAWANUPLINK && NETWORKSOCKETS
+#error "lorawan only works with network-sockets set to 0"
+#endif
+
+/// Set to 1 for the raw AT commands to send the backlog in the ESP8266's
+/// transparent mode, without an AT+CIPSEND for every SENDCHUNKSIZE piece.
+/// See Networking.cpp. Set with "esp-passthrough" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_PASSTHROUGH
+#define ESPPASSTHROUGH MBED_CONF_APP_ESP_PASSTHROUGH
+#else
+#define ESPPASSTHROUGH 0
+#endif
+
+#if ESPPASSTHROUGH && NETWORKSOCKETS
+#error "esp-passthrough only works with network-sockets set to 0"
+#endif
+
+#if ESPPASSTHROUGH && LORAWANUPLINK
+#error "esp-passthrough needs the ESP8266, set lorawan to 0"
+#endif
+
+/// The backlog requests that go out one after the other on the one
+/// connection of ESPPASSTHROUGH before the first response is read, from 1
+/// to BACKLOGLINKS. The server answers them in order, so an answer that
+/// lost the link only fails the requests behind it. Set with
+/// "pipeline-depth" in mbed_app.json.
+#ifdef MBED_CONF_APP_PIPELINE_DEPTH
+#define PIPELINEDEPTH MBED_CONF_APP_PIPELINE_DEPTH
+#else
+#define PIPELINEDEPTH (1)
+#endif
+
+/// The board sends to the server itself
+#define GATEWAYNONE (0)
+
+/// The board is the gateway of the boards around it, see Gateway.h. It
+/// takes their readings on the access point of the ESP8266 and sends them to
+/// the server on its own links
+#define GATEWAYHUB (1)
+
+/// The board sends its readings to a gateway on its access point instead of
+/// the server, see Gateway.h
+#define GATEWAYCHILD (2)
+
+/// The board's part in the gateway mode, one of GATEWAYNONE, GATEWAYHUB and
+/// GATEWAYCHILD. Set with "gateway-role" in mbed_app.json.
+#ifdef MBED_CONF_APP_GATEWAY_ROLE
+#define GATEWAYROLE MBED_CONF_APP_GATEWAY_ROLE
+#else
+#define GATEWAYROLE GATEWAYNONE
+#endif
+
+#if GATEWAYROLE && NETWORKSOCKETS
+#error "gateway-role only works with network-sockets set to 0"
+#endif
+
+#if GATEWAYROLE && ESPPASSTHROUGH
+#error "gateway-role needs the links of esp-passthrough set to 0"
+#endif
+
+#if GATEWAYROLE && LORAWANUPLINK
+#error "gateway-role needs the ESP8266, set lorawan to 0"
+#endif
+
+/// Set to 1 for the raw AT commands to leave what the server sends in the
+/// ESP8266 (AT+CIPRECVMODE=1) until the response of its link is read, with
+/// AT+CIPRECVDATA. See Networking.cpp. Set with "esp-passive-receive" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_PASSIVE_RECEIVE
+#define ESPPASSIVERECV MBED_CONF_APP_ESP_PASSIVE_RECEIVE
+#else
+#define ESPPASSIVERECV 0
+#endif
+
+#if ESPPASSIVERECV && (NETWORKSOCKETS || LORAWANUPLINK)
+#error "esp-passive-receive needs the raw AT commands, set network-sockets and lorawan to 0"
+#endif
+
+#if ESPPASSIVERECV && (ESPPASSTHROUGH || GATEWAYROLE)
+#error "esp-passive-receive needs esp-passthrough and gateway-role set to 0"
+#endif
+
+/// The ESP8266 draws 70 mA while it is awake, so it sleeps while the
+/// uploader has nothing to send. ESPSLEEPLIGHT stops its CPU too and takes
+/// the least, but it only listens to the UART again after ESPWAKEPIN woke
+/// it. ESPSLEEPMODEM only turns the radio off between the beacons of the
+/// access point, and it still takes AT commands. Sleep needs station mode,
+/// so the ESP8266 has no access point of its own with either.
+#define ESPSLEEPNONE (0)
+#define ESPSLEEPLIGHT (1)
+#define ESPSLEEPMODEM (2)
+
+/// How the ESP8266 sleeps between the uploads, one of ESPSLEEPNONE,
+/// ESPSLEEPLIGHT and ESPSLEEPMODEM. The driver of NETWORKSOCKETS has no
+/// sleep, so it is ESPSLEEPNONE there, and so it is for a GATEWAYHUB,
+/// whose access point is always up, and with LORAWANUPLINK, which has no
+/// ESP8266. Set with "esp-sleep" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_SLEEP
+#define ESPSLEEP MBED_CONF_APP_ESP_SLEEP
+#elif NETWORKSOCKETS || GATEWAYROLE == GATEWAYHUB || LORAWANUPLINK
+#define ESPSLEEP ESPSLEEPNONE
+#else
+#define ESPSLEEP ESPSLEEPMODEM
+#endif
+
+#if ESPSLEEP && NETWORKSOCKETS
+#error "esp-sleep only works with network-sockets set to 0"
+#endif
+
+#if ESPSLEEP && GATEWAYROLE == GATEWAYHUB
+#error "esp-sleep would take the access point of gateway-role 1 down"
+#endif
+
+#if ESPSLEEP && LORAWANUPLINK
+#error "esp-sleep needs the ESP8266, set lorawan to 0"
+#endif
+
+/// The pin that is wired to ESPWAKEGPIO of the ESP8266, it is pulled low to
+/// wake it from ESPSLEEPLIGHT. Set with "esp-wake-pin" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_WAKE_PIN
+#define ESPWAKEPIN MBED_CONF_APP_ESP_WAKE_PIN
+#else
+#define ESPWAKEPIN NC
+#endif
+
+#if ESPSLEEP == ESPSLEEPLIGHT && !defined(MBED_CONF_APP_ESP_WAKE_PIN)
+#error "esp-sleep 1 needs esp-wake-pin"
+#endif
+
+/// The GPIO of the ESP8266 that ESPWAKEPIN is wired to. Set with
+/// "esp-wake-gpio" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_WAKE_GPIO
+#define ESPWAKEGPIO MBED_CONF_APP_ESP_WAKE_GPIO
+#else
+#define ESPWAKEGPIO (13)
+#endif
+
+/// The readings go into the query string of a GET request
+#define REQUESTGET (0)
+
+/// The readings go into a CBOR body of a POST request. The first request
+/// on every link also has the port table, later ones only the port indexes
+/// and the raw 16 bit readings
+#define REQUESTCBOR (1)
+
+/// How the readings are sent, one of the REQUEST values above.
+/// Set with "request-format" in mbed_app.json.
+#ifdef MBED_CONF_APP_REQUEST_FORMAT
+#define REQUESTFORMAT MBED_CONF_APP_REQUEST_FORMAT
+#else
+#define REQUESTFORMAT REQUESTGET
+#endif
+
+/// Set to 1 to send the readings of a CBOR body as one byte string of frames
+/// packed with FrameCodec.h, instead of an array for every reading.
+/// Set with "packed-readings" in mbed_app.json.
+#ifdef MBED_CONF_APP_PACKED_READINGS
+#define PACKEDREADINGS MBED_CONF_APP_PACKED_READINGS
+#else
+#define PACKEDREADINGS 0
+#endif
+
+/// Set to 1 to compress the CBOR body of a batch of readings, see
+/// HeatshrinkEncoder.h. The server gets it with "Content-Encoding:
+/// heatshrink". Set with "compress-batches" in mbed_app.json.
+#ifdef MBED_CONF_APP_COMPRESS_BATCHES
+#define COMPRESSBATCHES MBED_CONF_APP_COMPRESS_BATCHES
+#else
+#define COMPRESSBATCHES 0
+#endif
+
+#if COMPRESSBATCHES && REQUESTFORMAT != REQUESTCBOR
+#error "compress-batches needs request-format set to 1"
+#endif
+
+/// Set to 1 to publish the readings to an MQTT broker instead of sending
+/// HTTP requests. The broker is the server in the config file, the readings
+/// go to MQTTTOPICROOT/<board>/readings as CBOR like the POST body, the port
+/// table is kept on .../ports, and settings come in on .../config in the
+/// same text as an HTTP response. Needs NETWORKSOCKETS.
+/// Set with "mqtt" in mbed_app.json.
+#ifdef MBED_CONF_APP_MQTT
+#define MQTTPUBLISH MBED_CONF_APP_MQTT
+#else
+#define MQTTPUBLISH 0
+#endif
+
+#if MQTTPUBLISH && !NETWORKSOCKETS
+#error "mqtt needs network-sockets set to 1"
+#endif
+
+/// Set to 1 to send the readings as confirmable CoAP POSTs over UDP instead
+/// of HTTP. The body is CBOR like the POST body, to the server and path in
+/// the config file, and the response has the same settings as an HTTP
+/// response. Needs NETWORKSOCKETS. Set with "coap" in mbed_app.json.
+#ifdef MBED_CONF_APP_COAP
+#define COAPUPLINK MBED_CONF_APP_COAP
+#else
+#define COAPUPLINK 0
+#endif
+
+#if COAPUPLINK && !NETWORKSOCKETS
+#error "coap needs network-sockets set to 1"
+#endif
+
+#if COAPUPLINK && MQTTPUBLISH
+#error "only one of coap and mqtt can be set"
+#endif
+
+/// Set to 1 to send the CoAP datagrams over DTLS with a pre-shared key, see
+/// CoapUplink.h. Needs COAPUPLINK, and FLASHQUEUE for where the key is
+/// kept. Set with "coap-dtls" in mbed_app.json.
+#ifdef MBED_CONF_APP_COAP_DTLS
+#define COAPDTLS MBED_CONF_APP_COAP_DTLS
+#else
+#define COAPDTLS 0
+#endif
+
+#if COAPDTLS && !COAPUPLINK
+#error "coap-dtls needs coap set to 1"
+#endif
+
+/// Set to 1 to send the HTTP requests over TLS, see TlsLink.h. The links
+/// stay open between requests, and a link that was closed resumes its last
+/// session instead of doing the whole handshake again. Needs NETWORKSOCKETS.
+/// Set with "tls" in mbed_app.json.
+#ifdef MBED_CONF_APP_TLS
+#define TLSUPLINK MBED_CONF_APP_TLS
+#else
+#define TLSUPLINK 0
+#endif
+
+#if TLSUPLINK && !NETWORKSOCKETS
+#error "tls needs network-sockets set to 1"
+#endif
+
+#if TLSUPLINK && (COAPUPLINK || MQTTPUBLISH)
+#error "tls only works with the HTTP uplink"
+#endif
+
+/// The largest CBOR body of one CoAP POST, a batch of backed up readings
+/// is cut down to fit
+#define COAPPAYLOADMAX (1024)
+
+/// The first level of the board's MQTT topics.
+/// Set with "mqtt-topic-root" in mbed_app.json.
+#ifdef MBED_CONF_APP_MQTT_TOPIC_ROOT
+#define MQTTTOPICROOT MBED_CONF_APP_MQTT_TOPIC_ROOT
+#else
+#define MQTTTOPICROOT "iac"
+#endif
+
+/// The most readings in one MQTT message, a batch of backed up readings is
+/// split into messages of up to this many that are in flight together
+#define MQTTBATCHFRAMES (8)
+
+/// the serial timeout for the ESP8266 in milliseconds
+#define SERIALTIMEOUT (3000)
+
+/// How often isConnected() asks the ESP8266 for its link status without
+/// waiting for the answer, in milliseconds
+#define LINKQUERYMS (30000)
+
+/// The baud rate the ESP8266 starts at after a reset
+#define ESPDEFAULTBAUD (115200)
+
+/// How long waitESPReady() waits for the ESP8266 after it is powered on, in
+/// milliseconds
+#define ESPREADYMS (2000)
+
+/// The fastest baud rate startESP() tries to move the ESP8266 to.
+/// Set with "esp8266-baudrate" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP8266_BAUDRATE
+#define ESPBAUDRATE MBED_CONF_APP_ESP8266_BAUDRATE
+#else
+#define ESPBAUDRATE ESPDEFAULTBAUD
+#endif
+
+/// The RTS and CTS pins to the ESP8266, flow control is only used when both
+/// are set in mbed_app.json
+#ifndef MBED_CONF_ESP8266_RTS
+#define MBED_CONF_ESP8266_RTS NC
+#endif
+
+#ifndef MBED_CONF_ESP8266_CTS
+#define MBED_CONF_ESP8266_CTS NC
+#endif
 
 /// Arbitrary char array length
 #define BUFFLEN 1024
@@ -26,43 +505,208 @@
 // network operations
 #define NETWORKSUCCESS (0)
 
+/// returned when the server did not have what was asked for: it answered
+/// with a 404, or with something other than a 200 where a body was asked for
+#define NETWORKNOTFOUND (-6)
+
+/// returned by the sends of the backlog, the captures and the gateway batch
+/// when there was nothing to send
+#define NETWORKNOTHINGSENT (-7)
+
 using namespace std;
 
+/// With NETWORKSOCKETS set, _parser is not used by any of these functions and
+/// can be NULL. The ESP8266Interface owns the serial port to the ESP8266.
+/// With NETWORKMESH the functions of the ESP8266 are those of the mesh, and
+/// with LORAWANUPLINK those of the LoRaWAN stack. With NETWORKCELLULAR they
+/// are those of the modem, which wakes from PSM for a batch on its own.
+
+/// Waits until the ESP8266 is ready for AT commands at ESPDEFAULTBAUD, up to
+/// timeout_ms. It is ready when it prints its "ready" banner after a power
+/// on or reset, or when it answers AT because it was running already. An
+/// ESP8266 that is still at a faster rate from before the board was reset
+/// only times out, startESP() finds it then.
+/// returns true if it is ready
+bool waitESPReady(ATCmdParser *_parser, int timeout_ms = ESPREADYMS);
+
 /// starts the ESP8266 with the correct settings:
-/// CIPMUX=1 and CWMODE=3
+/// CIPMUX=1 and CWMODE=3, or CWMODE=1 when it sleeps with ESPSLEEP
+/// It also closes all links and starts watching for link 0 to be closed.
+/// A GATEWAYHUB also gets its access point up and listens for its children.
+/// If _serial is given, the ESP8266 and _serial are first moved to the
+/// fastest baud rate up to ESPBAUDRATE that works, with RTS/CTS if the pins
+/// are set. It falls back to slower rates on errors.
 /// returns NETWORKSUCCESS if successful, -1 otherwise.
-int startESP(ATCmdParser *_parser);
+int startESP(ATCmdParser *_parser, DMAUARTSerial *_serial = NULL);
 
-/// Uses the SSID and Password stored in Specs to connect to that network
+/// Uses the SSID and Password stored in Specs to connect to that network.
+/// The access point that was joined last is asked for by its BSSID, with the
+/// address the DHCP server gave the board there, so the ESP8266 does not
+/// have to scan or wait for DHCP. Without NETWORKSOCKETS they are kept in
+/// the flash, see saveWifiCache(), and a plain join is tried if they do not
+/// work.
 /// returns NETWORKSUCCESS if successful, and a negative integer otherwise
 int connectESPWiFi(ATCmdParser *_parser, BoardSpecs &Specs);
 
 /// return true if you are connected to a wifi network, and false if you are not
+/// This asks the ESP8266 with AT+CIFSR, use isConnected() in loops.
 bool checkESPWiFiConnection(ATCmdParser *_parser);
 
-/// makes a get request string to send the port readings from Ports to the
-/// remote database in Specs
-string makeGetReqStr(vector<PortInfo> Ports, BoardSpecs &Specs);
+/// return true if the ESP8266 has an IP address. The state comes from the
+/// WIFI GOT IP / WIFI DISCONNECT messages of the ESP8266, and an
+/// AT+CIPSTATUS every LINKQUERYMS whose answer is taken by a later call or
+/// by answerESP(), so this does not wait on the serial port.
+bool isConnected(ATCmdParser *_parser);
+
+/// Takes what the ESP8266 sent so far for the commands that went out
+/// without waiting, and its messages. This does not wait on the serial port.
+/// returns the milliseconds until it should run again, or -1 if no answer
+/// is outstanding
+int answerESP(ATCmdParser *_parser);
+
+/// Puts the ESP8266 to sleep in the ESPSLEEP mode. The uploader calls it
+/// once it has nothing left to send. The links to the server stay open.
+void sleepESP(ATCmdParser *_parser);
+
+/// Wakes the ESP8266 from sleepESP(), and waits until it answers. It does
+/// nothing if it is awake.
+/// returns false if it did not answer
+bool wakeESP(ATCmdParser *_parser);
+
+/// returns how long wakeESP() takes, on average over the last few, in
+/// milliseconds. The uploader is woken that much before a reading is due
+uint32_t espWakeMs();
 
-/// makes a get request string to send the Port samples in Specs to the remote
-/// database specified in Specs
-string makeGetReqStr(BoardSpecs &Specs);
+/// makes a get request in Buf to send the port readings in Frame to the
+/// remote database in Specs. The port names come from Specs.
+/// returns the length of the request, or 0 if it did not fit into Size bytes
+size_t makeGetReq(char *Buf, size_t Size, const SampleFrame &Frame,
+                  BoardSpecs &Specs);
+
+/// makes one get request in Buf with as many of the Count frames in Frames
+/// as fit into Size bytes. Every reading also gets the time of its frame, so
+/// the server can tell the frames apart. Used is set to the number of frames
+/// that made it into the request.
+/// returns the length of the request, or 0 if not even one frame fit
+size_t makeBatchGetReq(char *Buf, size_t Size, const SampleFrame *Frames,
+                       size_t Count, BoardSpecs &Specs, size_t &Used);
+
+/// looks for an error, the new sampling interval and a config delta in the
+/// server's response
+/// returns NETWORKSUCCESS, or NETWORKNOTFOUND if the server responded with a
+/// 404
+int parseServerResponse(const HttpResponse &Http, float &response);
+
+/// looks for the new sampling interval and a config delta in Text, which is
+/// the body of a response or a message from the MQTT broker
+void parseServerSettings(const char *Text, float &response);
+
+/// Copies the body of the complete response Http to Body, for
+/// readServerBody()
+/// returns NETWORKSUCCESS with Length set, -5 if it is not complete or
+/// longer than Size, or NETWORKNOTFOUND if it is not a 200
+int takeResponseBody(const HttpResponse &Http, uint8_t *Body, size_t Size,
+                     size_t &Length);
 
 /// Sends message over TCP to the destination specified in Specs
 /// response is the new sampling interval that you get
 /// back from the server (if the connection is successful).
-int sendMessageTCP(ATCmdParser *_parser, BoardSpecs &Specs, string &message,
-                   float &response);
+/// Link 0 is kept open between messages with HTTP/1.1 keep-alive, and is
+/// only connected again after the server closes it. The message is sent in
+/// SENDCHUNKSIZE pieces.
+int sendMessageTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                   const char *message, size_t length, float &response);
 
-/// sends a GET request with the most recent port readings to the remote
+/// sends a GET request with the port readings in Frame to the remote
 /// location specified in Specs. response is the new sampling interval for the
 /// board that you get back from the server.
-int sendBulkDataTCP(ATCmdParser *_parser, BoardSpecs &Specs, float &response);
+int sendBulkDataTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                    const SampleFrame &Frame, float &response);
 
-/// grabs port readings from FileName and
+/// grabs port readings from the backup log in LogDir and
 /// sends a GET request with those readings to the remote location specified in
 /// Specs. response is the new sampling interval for the board that you get back
-/// from the server.
+/// from the server. Returns NETWORKNOTHINGSENT if there was no reading in
+/// LogDir.
 int sendBackupDataTCP(ATCmdParser *_parser, BoardSpecs &Specs,
-                      const char *FileName, float &response);
+                      const char *LogDir, float &response);
+
+/// grabs up to BACKUPBATCHMAX port readings from the backup log in LogDir and sends them to
+/// the remote location specified in Specs in a single GET request of up to
+/// REQUESTMAX bytes. The request is streamed as it is formatted. Sent is
+/// set to the number of readings that the request covered, which should be
+/// acknowledged with deleteDataEntries() if the send worked. Returns
+/// NETWORKNOTHINGSENT if there was no reading in LogDir to send.
+int sendBackupBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                       const char *LogDir, float &response, size_t &Sent);
+
+#if BACKLOGQUERY
+/// returns true if the server asked for a range of the backlog again and
+/// not all of it was sent yet. A response asks with resend="From-To" for
+/// the readings with the sequence numbers From to To, or with
+/// resendtime="From-To" for the ones taken in between those times
+bool backlogQueryWaiting();
+
+/// reads the next batch of the range that the server asked for out of the
+/// backup log in LogDir, see querySensorData(), and sends it like
+/// sendBackupBatchTCP() does. The readings stay in the log as they were.
+/// Returns NETWORKNOTHINGSENT if nothing was sent, which once the range is
+/// done stops backlogQueryWaiting().
+int sendQueriedBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                        const char *LogDir, float &response);
+#endif
+
+/// sends the oldest waveform capture in Dir, see CaptureStore.h, as the
+/// CBOR body of a POST to the remote location specified in Specs, with
+/// Capture=1 after the board id. With MQTTPUBLISH it is published on
+/// MQTTTOPICROOT/<board>/capture, with COAPUPLINK it is POSTed if it fits
+/// into COAPPAYLOADMAX, with LORAWANUPLINK it is dropped. response is set
+/// like for the readings. The capture should be dropped with dropCapture()
+/// if the send worked. Returns NETWORKNOTHINGSENT if there was no capture,
+/// or it can not be sent this way.
+int sendCaptureTCP(ATCmdParser *_parser, BoardSpecs &Specs, const char *Dir,
+                   float &response);
+
+/// With GATEWAYHUB set, takes in the datagrams of the children that came in,
+/// sends their acks, and gets the access point and the listener up again if
+/// the ESP8266 lost them. Called while the uploader is idle and between the
+/// batches of the backlog. It does nothing for the other roles
+void pollGateway(ATCmdParser *_parser);
+
+/// returns true if a GATEWAYHUB holds readings of its children that should
+/// go to the server now, see Gateway.h
+bool gatewayBatchDue();
+
+/// sends the readings that the children of a GATEWAYHUB queued as one POST
+/// to the remote location specified in Specs, and drops them from the queue
+/// once the server has them. response is set like for the other sends.
+/// Returns NETWORKNOTHINGSENT if there was nothing to send.
+int sendGatewayBatchTCP(ATCmdParser *_parser, BoardSpecs &Specs,
+                        float &response);
+
+/// returns true if LORAWANUPLINK can send an uplink now, its duty cycle
+/// and LORAINTERVAL have passed. It is always true for the other backends
+bool loraSlotDue();
+
+/// With OTAUPDATE set, fetches the piece of the patch of firmware version
+/// Update that starts at Offset, at most Size bytes of it, on the live link
+/// returns NETWORKSUCCESS with Length set to the bytes of the piece, or the
+/// error of readServerBody()
+int fetchFirmwareTCP(ATCmdParser *_parser, BoardSpecs &Specs, uint32_t Update,
+                     uint32_t Offset, uint8_t *Piece, size_t Size,
+                     size_t &Length);
+
+#if NETWORKCELLULAR
+/// returns true once the period of PSM that the network granted, or
+/// CELLULARPSMTAU, has passed since the last batch
+bool cellularWindowDue();
+
+/// the batch of the window went out, the next one is a period later
+void cellularBatchSent();
+#endif
+
+/// With MQTTPUBLISH set, handles what the broker sent while nothing was
+/// published and keeps the link alive. Called while the uploader is idle,
+/// response is set like for the other sends.
+void pollMqtt(float &response);
 #endif
@@ -0,0 +1,102 @@
+/// \file
+/// \brief Implementation of the number formatting
+#include "NumberFormat.h"
+
+#include <cmath>
+
+/// 10 to the power of each number of decimals
+static const uint32_t Powers[FORMATMAXDECIMALS + 1] = {1,     10,     100,
+                                                       1000,  10000,  100000,
+                                                       1000000};
+
+// writes the digits of Value in Base, padded to Width
+static size_t formatDigits(char *Text, uint32_t Value, uint32_t Base,
+                           size_t Width) {
+    static const char Digits[] = "0123456789abcdef";
+
+    // the digits come out backwards
+    char Backwards[FORMATUNSIGNEDMAX];
+    size_t Count = 0;
+    do {
+        Backwards[Count++] = Digits[Value % Base];
+        Value /= Base;
+    } while (Value != 0);
+
+    size_t Length = 0;
+    for (; Length + Count < Width; ++Length) {
+        Text[Length] = '0';
+    }
+    for (size_t i = 0; i < Count; ++i) {
+        Text[Length++] = Backwards[Count - 1 - i];
+    }
+    Text[Length] = 0;
+    return Length;
+}
+
+// ============================================================================
+size_t formatUnsigned(char *Text, uint32_t Value, size_t Width) {
+    return formatDigits(Text, Value, 10, Width);
+}
+
+// ============================================================================
+size_t formatHex(char *Text, uint32_t Value, size_t Width) {
+    return formatDigits(Text, Value, 16, Width);
+}
+
+// ============================================================================
+size_t formatFixed(char *Text, float Value, unsigned Decimals) {
+    if (Decimals > FORMATMAXDECIMALS) {
+        Decimals = FORMATMAXDECIMALS;
+    }
+
+    size_t Length = 0;
+    if (std::isnan(Value)) {
+        Text[0] = 'n';
+        Text[1] = 'a';
+        Text[2] = 'n';
+        Text[3] = 0;
+        return 3;
+    }
+    if (std::signbit(Value)) {
+        Text[Length++] = '-';
+        Value = -Value;
+    }
+    if (std::isinf(Value)) {
+        Text[Length++] = 'i';
+        Text[Length++] = 'n';
+        Text[Length++] = 'f';
+        Text[Length] = 0;
+        return Length;
+    }
+
+    // the scaled value has to fit into 64 bits
+    if (Value >= 1.0e13f) {
+        Text[0] = 0;
+        return 0;
+    }
+
+    // a float has 24 bits and the power at most 20, so the double keeps the
+    // scaling exact. A tie is rounded to even, the way printf does
+    double Exact = (double)Value * Powers[Decimals];
+    uint64_t Scaled = (uint64_t)(Exact + 0.5);
+    if ((double)Scaled - Exact == 0.5 && (Scaled & 1) != 0) {
+        --Scaled;
+    }
+    uint64_t Whole = Scaled / Powers[Decimals];
+    uint32_t Fraction = (uint32_t)(Scaled % Powers[Decimals]);
+
+    if (Whole > UINT32_MAX) {
+        // split it so the digits only need 32 bit divisions
+        Length += formatUnsigned(Text + Length, (uint32_t)(Whole / 1000000));
+        Length += formatUnsigned(Text + Length, (uint32_t)(Whole % 1000000), 6);
+    } else {
+        Length += formatUnsigned(Text + Length, (uint32_t)Whole);
+    }
+
+    if (Decimals > 0) {
+        Text[Length++] = '.';
+        Length += formatUnsigned(Text + Length, Fraction, Decimals);
+    }
+    Text[Length] = 0;
+    return Length;
+}
@@ -0,0 +1,43 @@
+#ifndef NUMBERFORMAT_H
+#define NUMBERFORMAT_H
+/// \file
+/// \brief Turns numbers into text without printf.
+///
+/// The request writer, the backup log's file names and the flash queue's
+/// keys all format their numbers here. newlib's printf pulls in its whole
+/// float formatting and takes over a kilobyte of stack for "%f", and the
+/// minimal-printf profile, see minimal-printf.json, ignores widths like
+/// "%06lu". These write the digits one division at a time into the caller's
+/// buffer, and the result is the same with either printf.
+
+#include <cstddef>
+#include <cstdint>
+
+/// The most characters formatUnsigned() and formatHex() write, not counting
+/// the '\0'
+#define FORMATUNSIGNEDMAX (10)
+
+/// The most decimal places formatFixed() writes
+#define FORMATMAXDECIMALS (6)
+
+/// The most characters formatFixed() writes, not counting the '\0'. The sign,
+/// 13 digits of the whole part, the point and the decimals
+#define FORMATFIXEDMAX (1 + 13 + 1 + FORMATMAXDECIMALS)
+
+/// Writes the decimal digits of Value into Text, with leading zeros up to
+/// Width digits, and a '\0'. Text needs room for FORMATUNSIGNEDMAX + 1
+/// characters, or Width + 1 if that is more
+/// \returns the number of characters, without the '\0'
+size_t formatUnsigned(char *Text, uint32_t Value, size_t Width = 0);
+
+/// Like formatUnsigned(), with lower case hex digits
+size_t formatHex(char *Text, uint32_t Value, size_t Width = 0);
+
+/// Writes Value with Decimals decimal places, rounded, like "%.*f" does, and
+/// a '\0'. Decimals above FORMATMAXDECIMALS are cut to it. Text needs room
+/// for FORMATFIXEDMAX + 1 characters.
+/// \returns the number of characters, without the '\0', or 0 if the whole
+/// part has more than 13 digits, those are left to snprintf
+size_t formatFixed(char *Text, float Value, unsigned Decimals);
+
+#endif // NUMBERFORMAT
@@ -0,0 +1,83 @@
+/// \file
+/// \brief Implementation of the reconnect scheduler
+#define TRACE_GROUP "net"
+#include "ReconnectScheduler.h"
+
+#include "DeferredLog.h"
+
+#if DEVICE_TRNG
+#include "hal/trng_api.h"
+#endif
+
+// a seed that is different on every board, so their backoffs drift apart
+static uint32_t jitterSeed() {
+    uint32_t Seed = 0;
+#if DEVICE_TRNG
+    trng_t Trng;
+    size_t Got = 0;
+    trng_init(&Trng);
+    trng_get_bytes(&Trng, (uint8_t *)&Seed, sizeof(Seed), &Got);
+    trng_free(&Trng);
+#endif
+    // xorshift never leaves 0
+    Seed ^= (uint32_t)Kernel::get_ms_count() ^ (uint32_t)time(NULL);
+    return Seed != 0 ? Seed : 0x2545F491;
+}
+
+ReconnectScheduler::ReconnectScheduler(EventQueue &Queue,
+                                       Callback<bool()> Attempt)
+    : Queue(Queue), Attempt(Attempt),
+      Retries{{this, &ReconnectScheduler::attempt},
+              {this, &ReconnectScheduler::attempt}},
+      Waiting(-1), Next(0), DelayMs(RECONNECTFIRSTMS), Failures(0),
+      Random(jitterSeed()) {}
+
+ReconnectScheduler::~ReconnectScheduler() {
+    if (Waiting >= 0) {
+        Retries[Waiting].cancel();
+    }
+}
+
+// ============================================================================
+void ReconnectScheduler::lost() {
+    if (Waiting >= 0) {
+        return;
+    }
+    uint32_t Wait = jittered();
+    Retries[Next].delay(Wait);
+    if (Retries[Next].try_call_on(&Queue)) {
+        tr_info("Trying the Wi-Fi again in %lu ms", (unsigned long)Wait);
+        Waiting = Next;
+        Next ^= 1;
+    }
+}
+
+// ============================================================================
+void ReconnectScheduler::connected() {
+    if (Waiting >= 0) {
+        Retries[Waiting].cancel();
+        Waiting = -1;
+    }
+    DelayMs = RECONNECTFIRSTMS;
+    Failures = 0;
+}
+
+void ReconnectScheduler::attempt() {
+    Waiting = -1;
+    if (Attempt()) {
+        connected();
+        return;
+    }
+
+    ++Failures;
+    DelayMs = DelayMs < RECONNECTMAXMS / 2 ? DelayMs * 2 : RECONNECTMAXMS;
+    lost();
+}
+
+uint32_t ReconnectScheduler::jittered() {
+    Random ^= Random << 13;
+    Random ^= Random >> 17;
+    Random ^= Random << 5;
+    uint32_t Half = DelayMs / 2;
+    return Half + Random % (DelayMs - Half + 1);
+}
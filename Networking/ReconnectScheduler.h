@@ -0,0 +1,72 @@
+#ifndef RECONNECTSCHEDULER_H
+#define RECONNECTSCHEDULER_H
+/// \file
+/// \brief Retries the Wi-Fi connection with a jittered exponential backoff.
+///
+/// The attempts are events on an EventQueue, which the thread that owns the
+/// ESP8266 dispatches between its other work, so a lost access point never
+/// holds up the sampling loop. Every failed attempt doubles the wait, up to
+/// RECONNECTMAXMS, and each wait is picked at random from its upper half so
+/// that boards that lost the same access point do not all ask it again at
+/// once. The attempts are user allocated events, so scheduling one never
+/// takes memory from the queue.
+
+#include "events/mbed_events.h"
+#include "mbed.h"
+
+/// The wait before the first attempt after the link is lost, in milliseconds
+#define RECONNECTFIRSTMS (2000)
+
+/// The longest wait between two attempts, in milliseconds
+#define RECONNECTMAXMS (300000)
+
+class ReconnectScheduler {
+  public:
+    /// Attempt is called on Queue's dispatching thread, and returns true
+    /// once the board is connected again
+    ReconnectScheduler(EventQueue &Queue, Callback<bool()> Attempt);
+
+    ~ReconnectScheduler();
+
+    /// Schedules the next attempt after the current backoff. Does nothing if
+    /// one is already waiting
+    void lost();
+
+    /// The link is up, a later loss starts again from RECONNECTFIRSTMS
+    void connected();
+
+    /// Returns true while an attempt is waiting on the queue
+    bool waiting() const { return Waiting >= 0; }
+
+    /// Returns the number of attempts that failed since the link was lost
+    unsigned failures() const { return Failures; }
+
+  private:
+    /// the event that runs the attempt
+    void attempt();
+
+    /// returns a wait from the upper half of DelayMs
+    uint32_t jittered();
+
+    EventQueue &Queue;
+    Callback<bool()> Attempt;
+
+    /// an event can not be posted again before its handler returns, so a
+    /// failed attempt posts the other one of the pair
+    UserAllocatedEvent<Callback<void()>, void()> Retries[2];
+
+    /// the one of Retries that waits, -1 if there is none
+    int Waiting;
+
+    /// the one of Retries that is posted next
+    int Next;
+
+    /// the backoff, it doubles after each failed attempt
+    uint32_t DelayMs;
+    unsigned Failures;
+
+    /// the state of the xorshift generator behind the jitter
+    uint32_t Random;
+};
+
+#endif // RECONNECTSCHEDULER
@@ -0,0 +1,128 @@
+/// \file
+/// \brief Implementation of the fixed buffer request writer
+#include "RequestWriter.h"
+
+#include "NumberFormat.h"
+
+#include <cstdio>
+#include <cstring>
+
+RequestWriter::RequestWriter(char *buffer, size_t size)
+    : Buffer(buffer), Size(size), Length(0), Flushed(0),
+      Overflowed(size == 0) {
+    if (Size > 0) {
+        Buffer[0] = 0;
+    }
+}
+
+RequestWriter::RequestWriter(char *buffer, size_t size, FlushCallback flush)
+    : Buffer(buffer), Size(size), Length(0), Flushed(0),
+      Overflowed(size < 2), Flush(flush) {
+    if (Size > 0) {
+        Buffer[0] = 0;
+    }
+}
+
+void RequestWriter::append(const char *text) { append(text, strlen(text)); }
+
+void RequestWriter::append(const char *text, size_t length) {
+    if (Overflowed) {
+        return;
+    }
+
+    while (Length + length >= Size) {
+        if (!Flush) {
+            Overflowed = true;
+            return;
+        }
+
+        // fill the window up and pass it on
+        size_t room = Size - 1 - Length;
+        memcpy(Buffer + Length, text, room);
+        Length += room;
+        text += room;
+        length -= room;
+
+        if (!Flush(Buffer, Length)) {
+            Overflowed = true;
+            return;
+        }
+        Flushed += Length;
+        Length = 0;
+    }
+    memcpy(Buffer + Length, text, length);
+    Length += length;
+    Buffer[Length] = 0;
+}
+
+void RequestWriter::appendUnsigned(uint32_t value) {
+    char text[FORMATUNSIGNEDMAX + 1];
+    append(text, formatUnsigned(text, value));
+}
+
+void RequestWriter::appendFloat(float value) {
+    char text[FORMATFIXEDMAX + 1];
+    size_t length = formatFixed(text, value, 6);
+    if (length > 0) {
+        append(text, length);
+        return;
+    }
+
+    // leave the rare huge value to snprintf
+    char huge[48];
+    int printed = snprintf(huge, sizeof(huge), "%f", value);
+    append(huge, printed > 0 ? printed : 0);
+}
+
+void RequestWriter::appendFile(FILE *file, long offset, size_t length) {
+    if (Overflowed) {
+        return;
+    }
+    if (fseek(file, offset, SEEK_SET) != 0) {
+        Overflowed = true;
+        return;
+    }
+
+    while (length > 0) {
+        size_t room = Size - 1 - Length;
+        if (room == 0) {
+            if (!Flush || !Flush(Buffer, Length)) {
+                Overflowed = true;
+                return;
+            }
+            Flushed += Length;
+            Length = 0;
+            continue;
+        }
+        size_t want = length < room ? length : room;
+        size_t got = fread(Buffer + Length, 1, want, file);
+        Length += got;
+        length -= got;
+        if (got < want) {
+            Overflowed = true;
+            break;
+        }
+    }
+    Buffer[Length] = 0;
+}
+
+bool RequestWriter::finish() {
+    if (!Overflowed && Flush && Length > 0) {
+        if (Flush(Buffer, Length)) {
+            Flushed += Length;
+            Length = 0;
+            Buffer[0] = 0;
+        } else {
+            Overflowed = true;
+        }
+    }
+    return !Overflowed;
+}
+
+void RequestWriter::truncate(size_t length) {
+    if (length < Size) {
+        Length = length;
+        Buffer[Length] = 0;
+        Overflowed = false;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef REQUESTWRITER_H
+#define REQUESTWRITER_H
+/// \file
+/// \brief Formats requests straight into a fixed buffer owned by the caller.
+
+#include "mbed.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+/// Appends text and numbers to a fixed size char buffer without using the
+/// heap. Once something does not fit, the writer is marked as overflowed and
+/// the rest is ignored, so the result only needs to be checked at the end.
+///
+/// With a flush function the buffer is a window instead. It is handed to the
+/// flush function every time it fills up, so the text can be much longer than
+/// the buffer. A failed flush marks the writer as overflowed.
+class RequestWriter {
+  public:
+    /// Takes a full buffer. Returns false if it could not be written
+    typedef Callback<bool(const char *data, size_t length)> FlushCallback;
+
+    /// \param buffer Where the text goes. It is always kept '\0' terminated
+    /// \param size The size of buffer in bytes, including the '\0'
+    RequestWriter(char *buffer, size_t size);
+
+    /// \param flush Gets the buffer every time it is full, and from finish()
+    RequestWriter(char *buffer, size_t size, FlushCallback flush);
+
+    void append(const char *text);
+    void append(const char *text, size_t length);
+    void append(const string &text) { append(text.c_str(), text.size()); }
+
+    /// Appends the decimal digits of value
+    void appendUnsigned(uint32_t value);
+
+    /// Appends value with 6 decimal places, like to_string() and %f
+    void appendFloat(float value);
+
+    /// Appends length bytes of file from offset. They are read straight
+    /// into the buffer, which is flushed whenever it is full, so a body
+    /// that is already encoded is copied once on its way to the flush
+    /// function. A file that ends early marks the writer as overflowed.
+    void appendFile(FILE *file, long offset, size_t length);
+
+    /// Goes back to length bytes and clears the overflow, used to take back
+    /// something that did not fit. Flushed bytes can not be taken back.
+    void truncate(size_t length);
+
+    /// Flushes what is left in the buffer.
+    /// \returns false if the writer overflowed or a flush failed
+    bool finish();
+
+    /// Returns the number of bytes in the buffer, not counting the '\0'
+    size_t length() const { return Length; }
+
+    /// Returns the number of bytes that were flushed successfully
+    size_t flushed() const { return Flushed; }
+
+    /// Returns true if something did not fit into the buffer
+    bool overflowed() const { return Overflowed; }
+
+    const char *data() const { return Buffer; }
+
+  private:
+    char *Buffer;
+    size_t Size;
+    size_t Length;
+    size_t Flushed;
+    bool Overflowed;
+    FlushCallback Flush;
+};
+
+#endif // REQUESTWRITER
@@ -0,0 +1,466 @@
+#define TRACE_GROUP "net"
+#include "Networking.h"
+
+#include "DeferredLog.h"
+#include "DnsCache.h"
+#include "EnergyMeter.h"
+#include "LinkStats.h"
+#include "Multipath.h"
+#include "NetworkBackend.h"
+#include "TlsLink.h"
+#include "debugging.h"
+/// \file
+/// \brief The network functions on top of ESP8266Interface and TCPSocket.
+///
+/// Only built when NETWORKSOCKETS is set. The driver uses passive TCP mode
+/// and the serial port's flow control, so no bytes from the ESP8266 are lost
+/// while the main loop is busy. With TLSUPLINK the requests go through the
+/// TLS of TlsLink.cpp on top of the same sockets. With NETWORKETHERNET the
+/// same sockets are on the K64F's own MAC and lwIP instead, which takes the
+/// serial port out of the way. With ETHERNETFAILOVER both interfaces are up
+/// and Multipath.h picks the one each link opens on. With NETWORKMESH they
+/// are on the mesh of nanostack, over IPv6, and with NETWORKCELLULAR on the
+/// PDP context of an LTE-M or NB-IoT modem.
+
+#if NETWORKSOCKETS
+
+/// true if the ESP8266 is one of the paths
+#define WIFIPATH                                                               \
+    (NETWORKETHERNET != ETHERNETONLY && !NETWORKMESH && !NETWORKCELLULAR)
+
+#if NETWORKETHERNET
+#include "EthernetInterface.h"
+#endif
+#if NETWORKMESH
+#include "MeshInterface.h"
+#endif
+#if NETWORKCELLULAR
+#include "CellularContext.h"
+#include "CellularDevice.h"
+#endif
+#if WIFIPATH
+#include "ESP8266Interface.h"
+#endif
+#include "TCPSocket.h"
+
+#if NETWORKETHERNET
+static EthernetInterface Wired;
+#endif
+#if WIFIPATH
+static ESP8266Interface Wifi(MBED_CONF_ESP8266_TX, MBED_CONF_ESP8266_RX, false,
+                             MBED_CONF_ESP8266_RTS, MBED_CONF_ESP8266_CTS);
+#endif
+
+/// the paths Multipath chooses from, the Ethernet port first
+#if NETWORKMESH
+/// the mesh interface of the radio is only there once startESP() got it
+static NetworkInterface *Nets[] = {NULL};
+static const char *const NetNames[] = {"the mesh"};
+#elif NETWORKCELLULAR
+/// the context of the modem, only there once startESP() got it
+static CellularContext *Modem = NULL;
+static NetworkInterface *Nets[] = {NULL};
+static const char *const NetNames[] = {"the modem"};
+#elif NETWORKETHERNET == ETHERNETFAILOVER
+static NetworkInterface *const Nets[] = {&Wired, &Wifi};
+static const char *const NetNames[] = {"Ethernet", "Wi-Fi"};
+#elif NETWORKETHERNET
+static NetworkInterface *const Nets[] = {&Wired};
+static const char *const NetNames[] = {"Ethernet"};
+#else
+static NetworkInterface *const Nets[] = {&Wifi};
+static const char *const NetNames[] = {"Wi-Fi"};
+#endif
+
+/// the number of paths
+#define NETCOUNT (sizeof(Nets) / sizeof(Nets[0]))
+
+static Multipath Paths(NETCOUNT);
+
+/// the path of the last choosePath(), -1 if there was none
+static int Chosen = -1;
+
+/// kept open between messages like the links in the AT command version
+static TCPSocket Links[SERVERLINKS];
+
+/// true while a socket of Links is connected to the server
+static bool LinkOpen[SERVERLINKS];
+
+/// what the requests of each link are sent on, the TLS on top of its
+/// socket with TLSUPLINK, or the socket itself
+static Socket *Streams[SERVERLINKS];
+
+/// the path each link is open on
+static int LinkPath[SERVERLINKS];
+
+/// when the request on each link started, and its bytes so far. The time
+/// is 0 while nothing waits for a response
+static uint64_t RequestStart[SERVERLINKS];
+static size_t RequestBytes[SERVERLINKS];
+
+// checks which paths are up, and picks the one for the next link
+static int choosePath() {
+    for (size_t i = 0; i < NETCOUNT; ++i) {
+        Paths.setUp(i, Nets[i]->get_connection_status() ==
+                           NSAPI_STATUS_GLOBAL_UP);
+    }
+    int Path = Paths.choose(Kernel::get_ms_count());
+    if (Path != Chosen && Path >= 0) {
+        const PathStats &Stats = Paths.stats(Path);
+        tr_info("Sending over %s, %lu ms and %lu bytes/s so far",
+                NetNames[Path], (unsigned long)Stats.LatencyMs,
+                (unsigned long)Stats.BytesPerSecond);
+    }
+    Chosen = Path;
+    return Path;
+}
+
+#if NETWORKCELLULAR
+/// the period of PSM that the network granted, in seconds
+static int PsmPeriod = CELLULARPSMTAU;
+
+/// when the last batch went out, 0 before the first one
+static uint64_t LastBatch = 0;
+
+/// true once the timers of PSM and eDRX were asked for
+static bool PowerSaving = false;
+
+// asks the network for PSM and eDRX once the modem is attached, and takes
+// the period it granted
+static void startPowerSaving() {
+    CellularDevice *Device = Modem->get_device();
+    CellularNetwork *Network = Device->open_network();
+    if (!PowerSaving) {
+        if (Device->set_power_save_mode(CELLULARPSMTAU, CELLULARPSMACTIVE) !=
+            NSAPI_ERROR_OK) {
+            tr_warn("The modem does not take PSM");
+        }
+#if CELLULAREDRX >= 0
+        if (Network->set_receive_period(
+                1,
+                CELLULARNBIOT ? CellularNetwork::EDRXEUTRAN_NB_S1_mode
+                              : CellularNetwork::EDRXEUTRAN_WB_S1_mode,
+                CELLULAREDRX) != NSAPI_ERROR_OK) {
+            tr_warn("The modem does not take eDRX");
+        }
+#endif
+        PowerSaving = true;
+    }
+    CellularNetwork::registration_params_t Granted;
+    if (Network->get_registration_params(CellularNetwork::C_EREG, Granted) ==
+            NSAPI_ERROR_OK &&
+        Granted._periodic_tau > 0) {
+        PsmPeriod = Granted._periodic_tau;
+    }
+}
+
+// ============================================================================
+bool cellularWindowDue() {
+    return LastBatch == 0 ||
+           Kernel::get_ms_count() - LastBatch >= PsmPeriod * 1000ULL;
+}
+
+// ============================================================================
+void cellularBatchSent() { LastBatch = Kernel::get_ms_count(); }
+#endif
+
+// a request on Link failed, so its path did too
+static void linkFailed(int Link) {
+    Paths.failed(LinkPath[Link], Kernel::get_ms_count());
+    RequestStart[Link] = 0;
+}
+
+// ============================================================================
+// the driver resets the ESP8266 and waits for it in startESP()
+bool waitESPReady(ATCmdParser *_parser, int timeout_ms) { return true; }
+
+// ============================================================================
+int startESP(ATCmdParser *_parser, DMAUARTSerial *_serial) {
+    // the driver does not let the radio sleep
+    energyActive(EnergyESP, true);
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        closeServerLink(_parser, i);
+    }
+
+    // the driver resets and sets up the ESP8266 itself, at the baud rate of
+    // "esp8266.serial-baudrate" and with RTS/CTS if the pins are set. The
+    // Ethernet MAC is started by connect()
+#if NETWORKMESH
+    if (Nets[0] == NULL) {
+        Nets[0] = MeshInterface::get_default_instance();
+    }
+    if (Nets[0] == NULL) {
+        printf("There is no 802.15.4 radio for the mesh\r\n");
+        return -1;
+    }
+    // connect() waits until the board joined the mesh and has an address
+    // from the border router
+    if (Nets[0]->set_blocking(true) != NSAPI_ERROR_OK)
+        return -1;
+#elif NETWORKCELLULAR
+    if (Modem == NULL) {
+        Modem = CellularContext::get_default_instance();
+        Nets[0] = Modem;
+    }
+    if (Modem == NULL) {
+        printf("There is no cellular modem\r\n");
+        return -1;
+    }
+    if (CELLULARAPN[0] != '\0') {
+        Modem->set_credentials(CELLULARAPN);
+    }
+    // connect() waits until the modem is attached and has the PDP context
+    if (Modem->set_blocking(true) != NSAPI_ERROR_OK)
+        return -1;
+#elif NETWORKETHERNET == ETHERNETFAILOVER
+    // without a cable, DHCP would hold up the ESP8266 until it times out,
+    // so the Ethernet port comes up on its own and choosePath() sees it
+    Wired.set_blocking(false);
+    if (Wifi.set_blocking(true) != NSAPI_ERROR_OK)
+        return -1;
+#else
+    if (Nets[0]->set_blocking(true) != NSAPI_ERROR_OK)
+        return -1;
+#endif
+    return NETWORKSUCCESS;
+}
+
+int connectESPWiFi(ATCmdParser *_parser, BoardSpecs &Specs) {
+    nsapi_error_t err = NSAPI_ERROR_OK;
+#if NETWORKETHERNET
+    // the address comes from DHCP. Without the ESP8266 this waits for it,
+    // with it the port is up once choosePath() sees it
+    err = Wired.connect();
+#if NETWORKETHERNET == ETHERNETFAILOVER
+    if (err != NSAPI_ERROR_OK && err != NSAPI_ERROR_IS_CONNECTED &&
+        err != NSAPI_ERROR_BUSY && err != NSAPI_ERROR_ALREADY) {
+        tr_warn("Ethernet connect error %d", err);
+    }
+#endif
+#endif
+#if NETWORKMESH
+    // the mesh has no SSID or password, its network name and key are in
+    // the config of mbed-mesh-api
+    err = Nets[0]->connect();
+#endif
+#if NETWORKCELLULAR
+    // the PDP context outlives PSM, so a modem that slept is still attached
+    // and the context is kept instead of one more attach
+    err = Modem->is_connected() ? NSAPI_ERROR_IS_CONNECTED : Modem->connect();
+    if (err == NSAPI_ERROR_OK || err == NSAPI_ERROR_IS_CONNECTED) {
+        startPowerSaving();
+    }
+#endif
+#if WIFIPATH
+    err = Wifi.connect(Specs.NetworkSSID.c_str(),
+                       Specs.NetworkPassword.c_str(),
+                       Specs.NetworkPassword.empty() ? NSAPI_SECURITY_NONE
+                                                     : NSAPI_SECURITY_WPA_WPA2);
+#endif
+
+    if (err == NSAPI_ERROR_OK || err == NSAPI_ERROR_IS_CONNECTED ||
+        checkESPWiFiConnection(_parser)) {
+        return NETWORKSUCCESS;
+    }
+    tr_warn("Network connect error %d", err);
+    return err == NSAPI_ERROR_NO_CONNECTION ? -2 : -1;
+}
+
+bool checkESPWiFiConnection(ATCmdParser *_parser) {
+    for (size_t i = 0; i < NETCOUNT; ++i) {
+        if (Nets[i]->get_connection_status() == NSAPI_STATUS_GLOBAL_UP) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isConnected(ATCmdParser *_parser) {
+    // the driver already tracks the connection status
+    return checkESPWiFiConnection(_parser);
+}
+
+// the driver waits for the answers to its own commands
+int answerESP(ATCmdParser *_parser) { return -1; }
+
+// the driver has no sleep, see ESPSLEEP. A modem goes into PSM on its own
+// CELLULARPSMACTIVE after the last batch, and wakes for the next one
+void sleepESP(ATCmdParser *_parser) {}
+
+bool wakeESP(ATCmdParser *_parser) { return true; }
+
+uint32_t espWakeMs() { return 0; }
+
+// ============================================================================
+void closeServerLink(ATCmdParser *_parser, int Link) {
+#if TLSUPLINK
+    closeTlsLink(Link);
+#endif
+    Links[Link].close();
+    LinkOpen[Link] = false;
+}
+
+bool serverLinkOpen(int Link) { return LinkOpen[Link]; }
+
+NetworkInterface *socketInterface() {
+    int Path = choosePath();
+    return Nets[Path >= 0 ? Path : 0];
+}
+
+#if NETWORKETHERNET
+NetworkInterface *wiredInterface() { return &Wired; }
+#endif
+
+const char *serverAddress(ATCmdParser *_parser, BoardSpecs &Specs) {
+    const char *Host = Specs.RemoteIP.c_str();
+    if (isAddress(Host)) {
+        return Host;
+    }
+    const char *Cached = cachedAddress(Host, false);
+    if (Cached != NULL) {
+        return Cached;
+    }
+    SocketAddress Found;
+    // the mesh only has IPv6
+    if (socketInterface()->gethostbyname(
+            Host, &Found, NETWORKMESH ? NSAPI_IPv6 : NSAPI_IPv4) ==
+        NSAPI_ERROR_OK) {
+        cacheAddress(Host, Found.get_ip_address());
+    } else {
+        tr_warn("Could not look up %s", Host);
+    }
+    Cached = cachedAddress(Host, true);
+    return Cached != NULL ? Cached : Host;
+}
+
+int openServerLink(ATCmdParser *_parser, BoardSpecs &Specs, int Link) {
+    int Path = choosePath();
+    if (Path < 0) {
+        return -1;
+    }
+    // the driver keeps what comes in on each socket apart, so there is
+    // nothing to get ready. A link on the path that was left is moved
+    if (LinkOpen[Link] && LinkPath[Link] == Path) {
+        return NETWORKSUCCESS;
+    }
+    if (LinkOpen[Link]) {
+        closeServerLink(_parser, Link);
+    }
+    LinkPath[Link] = Path;
+
+    TCPSocket &Socket = Links[Link];
+    if (Socket.open(Nets[Path]) != NSAPI_ERROR_OK) {
+        linkFailed(Link);
+        return -1;
+    }
+    Socket.set_timeout(SOCKETTIMEOUT);
+
+    SocketAddress Server(serverAddress(_parser, Specs), Specs.RemotePort);
+#if TLSUPLINK
+    Streams[Link] = openTlsLink(Link, Socket, Server, Specs);
+    if (Streams[Link] == NULL) {
+        expireAddress();
+        Socket.close();
+        linkFailed(Link);
+        return -1;
+    }
+#else
+    if (Socket.connect(Server) != NSAPI_ERROR_OK) {
+        // the server may have moved, its name is looked up again next time
+        expireAddress();
+        Socket.close();
+        linkFailed(Link);
+        return -1;
+    }
+    Streams[Link] = &Socket;
+#endif
+    LinkOpen[Link] = true;
+    return NETWORKSUCCESS;
+}
+
+bool writeServerLink(ATCmdParser *_parser, int Link, const char *data,
+                     size_t length) {
+    if (RequestStart[Link] == 0) {
+        RequestStart[Link] = Kernel::get_ms_count();
+        RequestBytes[Link] = 0;
+    }
+    RequestBytes[Link] += length;
+    while (length > 0) {
+        nsapi_size_or_error_t sent = Streams[Link]->send(data, length);
+        if (sent <= 0) {
+            linkFailed(Link);
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// takes in the response on Link, and closes it if it can not take the next
+// request. Returns -5 if the link failed
+static int receiveResponse(ATCmdParser *_parser, int Link,
+                           HttpResponse &Http) {
+    // this returns as soon as the whole response is there, and only waits
+    // for SOCKETTIMEOUT if the server stops in the middle of it
+    char Piece[RESPONSEPIECE];
+    while (!Http.complete() && !Http.failed()) {
+        nsapi_size_or_error_t got = Streams[Link]->recv(Piece, sizeof(Piece));
+        if (got == NSAPI_ERROR_WOULD_BLOCK) {
+            break;
+        }
+        if (got < 0) {
+            linkFailed(Link);
+            closeServerLink(_parser, Link);
+            return -5;
+        }
+        // recv() returns 0 once the server has closed its end
+        if (got == 0) {
+            Http.closed();
+            break;
+        }
+        Http.feed(Piece, got);
+        linkReceived(got);
+    }
+
+    // a link that is in the middle of a response can not take the next
+    // request
+    if (!Http.complete() || !Http.keepAlive()) {
+        closeServerLink(_parser, Link);
+    }
+    if (Http.status() == 0) {
+        // nothing came back, the request was still sent. There is nothing
+        // to time it by
+        RequestStart[Link] = 0;
+        return NETWORKSUCCESS;
+    }
+    if (RequestStart[Link] != 0) {
+        Paths.sent(LinkPath[Link], RequestBytes[Link],
+                   Kernel::get_ms_count() - RequestStart[Link]);
+        RequestStart[Link] = 0;
+    }
+    return NETWORKSUCCESS;
+}
+
+int readServerResponse(ATCmdParser *_parser, int Link, float &response) {
+    char Buf[RESPONSESIZE + 1];
+    HttpResponse Http(Buf, sizeof(Buf));
+    int err = receiveResponse(_parser, Link, Http);
+    if (err != NETWORKSUCCESS || Http.status() == 0) {
+        return err;
+    }
+    return parseServerResponse(Http, response);
+}
+
+int readServerBody(ATCmdParser *_parser, int Link, uint8_t *Body, size_t Size,
+                   size_t &Length) {
+    char Buf[RESPONSESIZE + 1];
+    HttpResponse Http(Buf, sizeof(Buf));
+    int err = receiveResponse(_parser, Link, Http);
+    if (err != NETWORKSUCCESS) {
+        return err;
+    }
+    return takeResponseBody(Http, Body, Size, Length);
+}
+
+#endif // NETWORKSOCKETS
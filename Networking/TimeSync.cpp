@@ -0,0 +1,49 @@
+/// \file
+/// \brief Implementation of the clock sync
+#define TRACE_GROUP "net"
+#include "TimeSync.h"
+
+#include "DeferredLog.h"
+#include "mbed.h"
+
+/// the clock when the board started
+static uint32_t BootClock = 0;
+
+/// what the first sync of this boot added to the clock, valid once Stepped
+static uint32_t Step = 0;
+static bool Stepped = false;
+
+// ============================================================================
+void timeSyncStart() { BootClock = time(NULL); }
+
+// ============================================================================
+bool clockValid() { return (uint32_t)time(NULL) >= TIMEVALIDAFTER; }
+
+// ============================================================================
+void syncClock(uint32_t ServerTime) {
+    if (ServerTime < TIMEVALIDAFTER) {
+        return;
+    }
+    uint32_t Now = time(NULL);
+    int32_t Drift = (int32_t)(ServerTime - Now);
+    if (Now >= TIMEVALIDAFTER && Drift <= TIMESYNCSLACK &&
+        -Drift <= TIMESYNCSLACK) {
+        return;
+    }
+
+    // only the step from a clock that was never set moves the stamps
+    if (Now < TIMEVALIDAFTER && !Stepped) {
+        Step = ServerTime - Now;
+        Stepped = true;
+    }
+    set_time(ServerTime);
+    tr_info("The clock was set from the server, %ld seconds", (long)Drift);
+}
+
+// ============================================================================
+uint32_t syncedTime(uint32_t Stamp) {
+    if (Stamp >= TIMEVALIDAFTER || !Stepped || Stamp < BootClock) {
+        return Stamp;
+    }
+    return Stamp + Step;
+}
@@ -0,0 +1,46 @@
+#ifndef TIMESYNC_H
+#define TIMESYNC_H
+/// \file
+/// \brief Sets the RTC from the Date header of the server's responses.
+///
+/// Every reading is stamped with time(NULL) when it is taken. Until the
+/// clock was set it counts from when the board was powered, which is before
+/// TIMEVALIDAFTER. The first response with a Date header sets it, and the
+/// readings that were stamped before that in the same boot are moved by the
+/// same step as they are logged or sent, so the backlog after an outage
+/// keeps the times it was taken at. The clock is set again when it drifts
+/// more than TIMESYNCSLACK from the server.
+///
+/// Readings from an earlier boot that never had the time keep their stamps,
+/// and the server can tell them apart by their date. After a power cut the
+/// clock starts from 0 again, so those readings can not be told apart from
+/// the ones of this boot.
+///
+/// MQTT and CoAP responses have no date, so with those the clock is only
+/// set if the board kept it.
+
+#include <cstdint>
+
+/// A time before this, the start of 2020, is from a clock that was not set
+#define TIMEVALIDAFTER (1577836800UL)
+
+/// How far the clock may be from the server's Date before it is set again,
+/// in seconds. The Date header only has whole seconds
+#define TIMESYNCSLACK (2)
+
+/// Remembers where the clock is at boot, before the first reading
+void timeSyncStart();
+
+/// Sets the clock to ServerTime, in seconds since 1970, if it was not set
+/// or drifted
+void syncClock(uint32_t ServerTime);
+
+/// Returns true once the clock has the real time
+bool clockValid();
+
+/// Returns Stamp, a time(NULL) of this boot, moved by the step the clock
+/// took when it was first set. Stamps that were taken with the real time,
+/// or before this boot, are returned as they are
+uint32_t syncedTime(uint32_t Stamp);
+
+#endif // TIMESYNC
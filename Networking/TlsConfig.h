@@ -0,0 +1,33 @@
+#ifndef TLSCONFIG_H
+#define TLSCONFIG_H
+/// \file
+/// \brief The mbed TLS settings of the uplink. mbed TLS's config.h includes
+/// this as MBEDTLS_USER_CONFIG_FILE, so it has to stay plain C.
+///
+/// With TLSFASTECC a full handshake costs less of the K64F's time:
+/// - the table of the multiples of the P-256 base point is computed by the
+///   first handshake and kept, see MBEDTLS_ECP_FIXED_POINT_CACHE, instead of
+///   once for every ECDHE key and ECDSA signature check. It is built with
+///   windows of MBEDTLS_ECP_WINDOW_SIZE, which takes about 4 kB of heap
+/// - the server's certificate is only checked against the root
+///   certificates the first time, see TlsLink.h
+///
+/// The fast P-256 reduction, MBEDTLS_ECP_NIST_OPTIM, is on either way.
+
+/// Set to 1 to keep the P-256 tables and the server's certificate between
+/// handshakes. Needs TLSUPLINK. Set with "tls-fast-ecc" in mbed_app.json.
+#ifdef MBED_CONF_APP_TLS_FAST_ECC
+#define TLSFASTECC MBED_CONF_APP_TLS_FAST_ECC
+#else
+#define TLSFASTECC 0
+#endif
+
+#if TLSFASTECC
+#define MBEDTLS_ECP_FIXED_POINT_CACHE
+#undef MBEDTLS_ECP_WINDOW_SIZE
+#define MBEDTLS_ECP_WINDOW_SIZE 6
+#undef MBEDTLS_ECP_FIXED_POINT_OPTIM
+#define MBEDTLS_ECP_FIXED_POINT_OPTIM 1
+#endif // TLSFASTECC
+
+#endif // TLSCONFIG
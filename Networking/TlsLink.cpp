@@ -0,0 +1,254 @@
+/// \file
+/// \brief Implementation of the TLS server links
+#define TRACE_GROUP "tls"
+#include "TlsLink.h"
+
+#include "DeferredLog.h"
+#include "NetworkBackend.h"
+
+#if TLSUPLINK
+
+#include "TLSSocketWrapper.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+
+#include <cstdio>
+#include <new>
+
+/// the suites that are offered, in the order they are preferred. GCM and
+/// SHA-256 are the cheapest AES modes for mbed TLS on the Cortex-M4
+static const int CipherSuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA256, 0};
+
+/// only P-256, the other curves take longer and are seldom needed
+static const mbedtls_ecp_group_id Curves[] = {MBEDTLS_ECP_DP_SECP256R1,
+                                              MBEDTLS_ECP_DP_NONE};
+
+/// the root certificates, parsed from TLSCAFILE on the first connect
+static mbedtls_x509_crt CaChain;
+static bool CaLoaded = false;
+
+/// every link has its own settings, the wrapper points them at its own
+/// random generator while it is connected
+static mbedtls_ssl_config Configs[SERVERLINKS];
+static bool ConfigReady[SERVERLINKS];
+
+/// the TLS of every open link. A wrapper can only be used for one
+/// connection, so there is a new one for every connect
+static TLSSocketWrapper *Secure[SERVERLINKS];
+
+/// the session of the last connection of every link, offered again on the
+/// next connect
+static mbedtls_ssl_session Sessions[SERVERLINKS];
+static bool HaveSession[SERVERLINKS];
+
+#if TLSFASTECC
+/// the SHA-256 of the server's certificate and the host name it was checked
+/// for, once it was checked against the root certificates
+static unsigned char KnownCert[32];
+static bool CertKnown = false;
+#endif
+
+// reads and parses TLSCAFILE, once
+static bool loadCaChain() {
+    if (CaLoaded) {
+        return true;
+    }
+    FILE *fp = fopen(TLSCAFILE, "rb");
+    if (fp == NULL) {
+        tr_error("Could not open %s", TLSCAFILE);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long FileSize = ftell(fp);
+    rewind(fp);
+
+    // the PEM parser wants the terminating 0 to be counted
+    bool Loaded = false;
+    if (FileSize > 0) {
+        unsigned char *Pem = new unsigned char[FileSize + 1];
+        if (fread(Pem, 1, FileSize, fp) == (size_t)FileSize) {
+            Pem[FileSize] = 0;
+            mbedtls_x509_crt_init(&CaChain);
+            int Error = mbedtls_x509_crt_parse(&CaChain, Pem, FileSize + 1);
+            if (Error < 0) {
+                tr_error("Could not parse %s: -0x%04x", TLSCAFILE, -Error);
+                mbedtls_x509_crt_free(&CaChain);
+            } else {
+                Loaded = true;
+            }
+        }
+        delete[] Pem;
+    }
+    fclose(fp);
+    CaLoaded = Loaded;
+    return Loaded;
+}
+
+// the settings for Link, set up on its first connect
+static mbedtls_ssl_config *linkConfig(int Link) {
+    mbedtls_ssl_config *Config = &Configs[Link];
+    if (ConfigReady[Link]) {
+        return Config;
+    }
+    mbedtls_ssl_config_init(Config);
+    if (mbedtls_ssl_config_defaults(Config, MBEDTLS_SSL_IS_CLIENT,
+                                    MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        mbedtls_ssl_config_free(Config);
+        return NULL;
+    }
+    mbedtls_ssl_conf_authmode(Config, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(Config, &CaChain, NULL);
+    mbedtls_ssl_conf_ciphersuites(Config, CipherSuites);
+    mbedtls_ssl_conf_curves(Config, Curves);
+    mbedtls_ssl_conf_session_tickets(Config,
+                                     MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    // smaller records from the servers that take it, the requests are
+    // written in small pieces anyway
+    mbedtls_ssl_conf_max_frag_len(Config, MBEDTLS_SSL_MAX_FRAG_LEN_4096);
+    ConfigReady[Link] = true;
+    return Config;
+}
+
+#if TLSFASTECC
+// takes the server's certificate if it is the one that was checked before
+// for Host, or if it checks out now, and keeps it
+static bool checkServerCert(mbedtls_ssl_context *Context, const char *Host) {
+    const mbedtls_x509_crt *Peer = mbedtls_ssl_get_peer_cert(Context);
+    if (Peer == NULL) {
+        return false;
+    }
+    unsigned char Hash[sizeof(KnownCert)];
+    mbedtls_sha256_context Sha;
+    mbedtls_sha256_init(&Sha);
+    bool Hashed = mbedtls_sha256_starts_ret(&Sha, 0) == 0 &&
+                  mbedtls_sha256_update_ret(&Sha, Peer->raw.p, Peer->raw.len) ==
+                      0 &&
+                  mbedtls_sha256_update_ret(&Sha, (const unsigned char *)Host,
+                                            strlen(Host)) == 0 &&
+                  mbedtls_sha256_finish_ret(&Sha, Hash) == 0;
+    mbedtls_sha256_free(&Sha);
+    if (!Hashed) {
+        return false;
+    }
+
+    if (CertKnown && memcmp(Hash, KnownCert, sizeof(Hash)) == 0) {
+#if defined(MBEDTLS_HAVE_TIME_DATE)
+        return !mbedtls_x509_time_is_past(&Peer->valid_to);
+#else
+        return true;
+#endif
+    }
+    // the handshake checked the first one, a new one is checked here
+    uint32_t Flags;
+    if (CertKnown &&
+        mbedtls_x509_crt_verify(const_cast<mbedtls_x509_crt *>(Peer),
+                                &CaChain, NULL, Host, &Flags, NULL,
+                                NULL) != 0) {
+        tr_error("The server's new certificate did not check out: 0x%lx",
+                 (unsigned long)Flags);
+        return false;
+    }
+    memcpy(KnownCert, Hash, sizeof(Hash));
+    CertKnown = true;
+    return true;
+}
+#endif
+
+// ============================================================================
+Socket *openTlsLink(int Link, TCPSocket &Tcp, const SocketAddress &Server,
+                    BoardSpecs &Specs) {
+    closeTlsLink(Link);
+    mbedtls_ssl_config *Config = loadCaChain() ? linkConfig(Link) : NULL;
+    if (Config == NULL) {
+        return NULL;
+    }
+
+#ifdef TLSHOSTNAME
+    const char *Host = TLSHOSTNAME;
+#else
+    const char *Host = Specs.RemoteIP.c_str();
+#endif
+    TLSSocketWrapper *Tls = new (std::nothrow)
+        TLSSocketWrapper(&Tcp, Host, TLSSocketWrapper::TRANSPORT_KEEP);
+    if (Tls == NULL) {
+        return NULL;
+    }
+    Tls->set_ssl_config(Config);
+#if TLSFASTECC
+    // once the certificate is known the handshake leaves it alone, and
+    // checkServerCert() compares it instead of checking its chain again.
+    // The server still signs its key exchange with it
+    mbedtls_ssl_conf_authmode(Config, CertKnown ? MBEDTLS_SSL_VERIFY_NONE
+                                                : MBEDTLS_SSL_VERIFY_REQUIRED);
+#endif
+    uint64_t Start = Kernel::get_ms_count();
+
+    // the wrapper has no way to set the session before its handshake
+    // starts. The first try is made before Tcp is connected, so it sets up
+    // the context and stops at sending the ClientHello. The context is then
+    // reset with the session, and the handshake after the connect offers it
+    mbedtls_ssl_context *Context = Tls->get_ssl_context();
+    bool Offered = false;
+    if (HaveSession[Link]) {
+        Tls->connect(Server);
+        Offered = mbedtls_ssl_session_reset(Context) == 0 &&
+                  mbedtls_ssl_set_session(Context, &Sessions[Link]) == 0;
+    }
+
+    // the wrapper leaves Tcp non-blocking once it started, it waits for
+    // the data itself
+    Tcp.set_timeout(SOCKETTIMEOUT);
+    nsapi_error_t Error = Tcp.connect(Server);
+    Tcp.set_blocking(false);
+    Tls->set_timeout(SOCKETTIMEOUT);
+    if (Error == NSAPI_ERROR_OK) {
+        Error = Tls->connect(Server);
+    }
+    if (Error != NSAPI_ERROR_OK && Error != NSAPI_ERROR_IS_CONNECTED) {
+        tr_warn("TLS connect on link %d failed: %d", Link, Error);
+        delete Tls;
+        // the server may not know the session any more
+        HaveSession[Link] = false;
+        return NULL;
+    }
+#if TLSFASTECC
+    if (!checkServerCert(Context, Host)) {
+        delete Tls;
+        HaveSession[Link] = false;
+        return NULL;
+    }
+#endif
+
+    // the server takes the session back with the same id
+    const mbedtls_ssl_session *Now = mbedtls_ssl_get_session_pointer(Context);
+    bool Resumed = Offered && Now != NULL &&
+                   Now->id_len == Sessions[Link].id_len &&
+                   memcmp(Now->id, Sessions[Link].id, Now->id_len) == 0;
+    tr_info("TLS on link %d %s in %lu ms", Link,
+            Resumed ? "resumed" : "connected",
+            (unsigned long)(Kernel::get_ms_count() - Start));
+
+    mbedtls_ssl_session_free(&Sessions[Link]);
+    mbedtls_ssl_session_init(&Sessions[Link]);
+    HaveSession[Link] = mbedtls_ssl_get_session(Context, &Sessions[Link]) == 0;
+    Secure[Link] = Tls;
+    return Tls;
+}
+
+// ============================================================================
+void closeTlsLink(int Link) {
+    if (Secure[Link] == NULL) {
+        return;
+    }
+    // this sends the close_notify, the session stays in Sessions
+    delete Secure[Link];
+    Secure[Link] = NULL;
+}
+
+#endif // TLSUPLINK
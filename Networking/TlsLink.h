@@ -0,0 +1,62 @@
+#ifndef TLSLINK_H
+#define TLSLINK_H
+/// \file
+/// \brief TLS on top of the TCPSockets of the server links.
+///
+/// Only built when TLSUPLINK is set, see Networking.h. The full handshake
+/// takes the ESP8266 round trips and an ECDHE on the K64F, which is more
+/// than a second, so it is done as seldom as possible:
+///  - a link stays open between requests like the plain TCP links
+///  - the session of every link is kept when it closes, and offered to the
+///    server on the next connect. When the server takes it back, from its
+///    session cache or from the ticket it gave out, the handshake skips the
+///    certificates and the key exchange
+///  - only ECDHE with P-256 and AES-128 is offered, the cheapest ones that
+///    servers still take
+///  - with TLSFASTECC, see TlsConfig.h, the P-256 tables are kept from the
+///    first handshake, and the server's certificate is only checked against
+///    the root certificates until it was taken once. The handshakes after
+///    it compare the certificate to the one that was taken, and a different
+///    one is checked in full
+///
+/// The root certificates are read from TLSCAFILE once, and the same chain
+/// is used for every link.
+
+#include "Networking.h"
+#include "TlsConfig.h"
+
+#if TLSFASTECC && !TLSUPLINK
+#error "tls-fast-ecc needs tls set to 1"
+#endif
+
+#if TLSUPLINK
+
+#include "TCPSocket.h"
+
+/// The PEM file with the root certificates of the server.
+/// Set with "tls-ca-file" in mbed_app.json.
+#ifdef MBED_CONF_APP_TLS_CA_FILE
+#define TLSCAFILE MBED_CONF_APP_TLS_CA_FILE
+#else
+#define TLSCAFILE "/sd/IAC_CA.pem"
+#endif
+
+/// The name in the server's certificate, by default the server address of
+/// the config file. Set with "tls-hostname" in mbed_app.json.
+#ifdef MBED_CONF_APP_TLS_HOSTNAME
+#define TLSHOSTNAME MBED_CONF_APP_TLS_HOSTNAME
+#endif
+
+/// Connects Tcp to Server, and starts TLS for Link on top of it. Tcp has to
+/// be open and is left open if it fails.
+/// \returns the socket that the requests are sent on, NULL if it failed
+Socket *openTlsLink(int Link, TCPSocket &Tcp, const SocketAddress &Server,
+                    BoardSpecs &Specs);
+
+/// Ends the TLS of Link and keeps its session for the next connect. The
+/// TCPSocket under it is not closed.
+void closeTlsLink(int Link);
+
+#endif // TLSUPLINK
+
+#endif // TLSLINK
@@ -0,0 +1,338 @@
+#!/usr/bin/env python3
+"""Load tests the server with a fleet of simulated boards.
+
+Every board is a task that sends the requests the firmware sends with the
+default request-format, GET with the readings in the query string, on its
+own keep-alive links:
+
+- while the site is offline the readings are backed up, one every interval,
+  as the backup log does
+- when the access point comes back every board reconnects the way
+  ReconnectScheduler.h does it. The wait doubles from RECONNECTFIRSTMS up to
+  RECONNECTMAXMS after every failed attempt, and each attempt is picked from
+  the upper half of its wait, so the fleet comes back spread out like the
+  boards would
+- the live readings go out one at a time on LIVELINK, the backlog in batches
+  of up to BACKUPBATCHMAX readings with their Time[], on BACKLOGLINKS links
+  at once, each request below REQUESTMAX bytes
+- samplerate="..." in a response changes the interval, and with --sequenced
+  acked="..." clears the backlog up to it, see Sequence.h
+
+    python3 Networking/simulate_fleet.py server.example 80 --boards 1000 \\
+        --outage 3600 --duration 900
+
+It prints what the fleet sent and how long the server took every --report
+seconds, and at the end how long the boards took to drain their backlog.
+
+mbed-os/UNITTESTS/app/Networking/fleet runs the same outage with the
+firmware's ATCmdParser, RequestWriter and HttpResponse on every board, over
+an emulated ESP8266. It takes FLEET_SERVER=host:port/path, and catches the
+AT and parsing side that this simulator leaves out.
+"""
+
+import argparse
+import asyncio
+import random
+import re
+import sys
+import time
+
+# keep in step with Networking.h, NetworkBackend.h and ReconnectScheduler.h
+REQUESTMAX = 8000
+BACKUPBATCHMAX = 32
+SERVERLINKS = 4
+BACKLOGLINKS = SERVERLINKS - 1
+RECONNECTFIRSTMS = 2000
+RECONNECTMAXMS = 300000
+
+SAMPLERATE = re.compile(rb'samplerate="([0-9.]+)')
+ACKED = re.compile(rb'acked="([0-9]+)')
+
+
+class Stats:
+    """What the whole fleet sent and how the server answered."""
+
+    def __init__(self):
+        self.requests = 0
+        self.readings = 0
+        self.failures = 0
+        self.connects = 0
+        self.latencies = []
+        self.drained = []
+
+    def took(self, seconds, readings):
+        self.requests += 1
+        self.readings += readings
+        self.latencies.append(seconds)
+
+    def report(self, elapsed, boards):
+        latencies = sorted(self.latencies)
+        self.latencies = []
+        waiting = sum(len(board.backlog) for board in boards)
+        line = "%7.1f s %6d requests %7d readings %5d failed %5d connects" % (
+            elapsed, self.requests, self.readings, self.failures,
+            self.connects)
+        if latencies:
+            line += " latency p50 %.0f p99 %.0f max %.0f ms" % (
+                1000 * latencies[len(latencies) // 2],
+                1000 * latencies[(len(latencies) * 99) // 100],
+                1000 * latencies[-1])
+        print(line + ", %d readings backed up" % waiting)
+        self.requests = self.readings = self.failures = self.connects = 0
+
+
+class Link:
+    """One keep-alive connection of a board to the server."""
+
+    def __init__(self, board):
+        self.board = board
+        self.reader = None
+        self.writer = None
+
+    async def close(self):
+        if self.writer is not None:
+            self.writer.close()
+            try:
+                await self.writer.wait_closed()
+            except OSError:
+                pass
+        self.reader = self.writer = None
+
+    async def request(self, text, readings):
+        """Sends one request and reads the response, returns its body.
+
+        A link that the server closed is opened again once, as
+        writeRequestTCP() does it."""
+        args = self.board.args
+        for attempt in range(2):
+            reused = self.writer is not None
+            try:
+                if not reused:
+                    self.reader, self.writer = await asyncio.wait_for(
+                        asyncio.open_connection(args.host, args.port),
+                        args.timeout)
+                    self.board.stats.connects += 1
+                start = time.monotonic()
+                self.writer.write(text)
+                await self.writer.drain()
+                body = await asyncio.wait_for(self.response(), args.timeout)
+                self.board.stats.took(time.monotonic() - start, readings)
+                return body
+            except (OSError, asyncio.TimeoutError, ValueError,
+                    asyncio.IncompleteReadError):
+                await self.close()
+                if not reused:
+                    break
+        self.board.stats.failures += 1
+        return None
+
+    async def response(self):
+        head = await self.reader.readuntil(b"\r\n\r\n")
+        lines = head.split(b"\r\n")
+        parts = lines[0].split()
+        if len(parts) < 2 or not parts[0].startswith(b"HTTP/"):
+            raise ValueError("not an HTTP response")
+        length = None
+        close = False
+        for line in lines[1:]:
+            name, _, value = line.partition(b":")
+            name = name.strip().lower()
+            if name == b"content-length":
+                length = int(value)
+            elif name == b"connection" and b"close" in value.lower():
+                close = True
+        if length is not None:
+            body = await self.reader.readexactly(length)
+        else:
+            body = await self.reader.read()
+            close = True
+        if close:
+            await self.close()
+        if parts[1] != b"200":
+            raise ValueError("status " + parts[1].decode("latin-1"))
+        return body
+
+
+class Board:
+    """One simulated board with its backlog and its links."""
+
+    def __init__(self, number, args, stats, start):
+        self.args = args
+        self.stats = stats
+        self.name = "%s%04d" % (args.prefix, number)
+        self.interval = args.interval
+        self.stream = random.getrandbits(31)
+        self.sequence = 0
+        self.backlog = []
+        self.links = [Link(self) for _ in range(SERVERLINKS)]
+        # the readings that were backed up while the site was offline
+        for at in range(int(args.outage // args.interval)):
+            self.backlog.append(self.reading(start - args.outage +
+                                             at * args.interval))
+        self.drained_at = None
+
+    def reading(self, stamp):
+        self.sequence += 1
+        values = [random.uniform(0.0, 240.0) for _ in range(self.args.ports)]
+        return int(stamp), self.sequence, values
+
+    def start(self):
+        text = "GET %s?Board_ID=%s&Config_Version=0" % (self.args.remote_dir,
+                                                         self.name)
+        if self.args.sequenced:
+            text += "&Stream=%d" % self.stream
+            if self.backlog:
+                text += "&Seq_Floor=%d" % self.backlog[0][1]
+        return text
+
+    def pairs(self, frame, stamp):
+        text = ""
+        for port, value in enumerate(frame[2]):
+            text += "&Port_ID[]=P%d&Value[]=%.6f" % (port, value)
+            if stamp:
+                text += "&Time[]=%d" % frame[0]
+            if self.args.sequenced:
+                text += "&Seq[]=%d" % frame[1]
+        return text
+
+    def end(self):
+        return (" HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n" %
+                self.args.host)
+
+    def take(self, body):
+        if body is None:
+            return
+        rate = SAMPLERATE.search(body)
+        if rate and float(rate.group(1)) > 0:
+            self.interval = float(rate.group(1))
+        acked = ACKED.search(body)
+        if self.args.sequenced and acked:
+            upto = int(acked.group(1))
+            self.backlog = [r for r in self.backlog if r[1] > upto]
+
+    async def reconnect(self, outage, stop):
+        """Waits until the board would be back on the access point, or until
+        stop."""
+        # the attempts that failed while it was down
+        wait = RECONNECTFIRSTMS / 1000.0
+        at = 0.0
+        while True:
+            at += random.uniform(wait / 2, wait)
+            if at >= outage:
+                break
+            wait = min(wait * 2, RECONNECTMAXMS / 1000.0)
+        await asyncio.sleep(max(0.0, min(at - outage,
+                                         stop - time.monotonic())))
+
+    async def drain(self, link, until):
+        """Sends batches of the backlog on one of the backlog links, until
+        the next live reading is due."""
+        while self.backlog and time.monotonic() < until:
+            text = self.start()
+            end = self.end()
+            batch = []
+            for frame in self.backlog[:self.args.batch]:
+                if batch and len(text) + len(self.pairs(frame, True)) + \
+                        len(end) > REQUESTMAX:
+                    break
+                batch.append(frame)
+                text += self.pairs(frame, True)
+            # another link may have taken them while this one waited
+            self.backlog = self.backlog[len(batch):]
+            body = await link.request((text + end).encode("latin-1"),
+                                      len(batch))
+            if body is None:
+                self.backlog = batch + self.backlog
+                self.backlog.sort(key=lambda frame: frame[1])
+                return
+            self.take(body)
+
+    async def run(self, stop):
+        await self.reconnect(self.args.outage, stop)
+        live = self.links[0]
+        next_at = time.monotonic()
+        while time.monotonic() < stop:
+            frame = self.reading(time.time())
+            body = await live.request(
+                (self.start() + self.pairs(frame, True) +
+                 self.end()).encode("latin-1"), 1)
+            if body is None:
+                self.backlog.append(frame)
+            self.take(body)
+            next_at += self.interval
+            if self.backlog:
+                until = min(next_at, stop)
+                await asyncio.gather(*[
+                    self.drain(link, until)
+                    for link in self.links[1:1 + BACKLOGLINKS]])
+            if not self.backlog and self.drained_at is None:
+                self.drained_at = time.monotonic()
+                self.stats.drained.append(self.drained_at)
+            await asyncio.sleep(max(0.0, next_at - time.monotonic()))
+        for link in self.links:
+            await link.close()
+
+
+async def fleet(args):
+    stats = Stats()
+    start = time.monotonic()
+    stop = start + args.duration
+    now = time.time()
+    boards = [Board(i, args, stats, now) for i in range(args.boards)]
+    print("%d boards with %d readings each backed up" %
+          (args.boards, len(boards[0].backlog) if boards else 0))
+
+    async def reporter():
+        while time.monotonic() < stop:
+            await asyncio.sleep(args.report)
+            stats.report(time.monotonic() - start, boards)
+
+    tasks = [asyncio.ensure_future(board.run(stop)) for board in boards]
+    watcher = asyncio.ensure_future(reporter())
+    await asyncio.gather(*tasks)
+    watcher.cancel()
+    stats.report(time.monotonic() - start, boards)
+
+    drained = sorted(at - start for at in stats.drained)
+    if drained:
+        print("%d of %d boards drained their backlog, half after %.1f s, "
+              "the last after %.1f s" % (len(drained), args.boards,
+                                         drained[len(drained) // 2],
+                                         drained[-1]))
+    else:
+        print("No board drained its backlog")
+    return 0 if len(drained) == args.boards else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host", help="the server, as in the config file")
+    parser.add_argument("port", type=int, help="the server's port")
+    parser.add_argument("--remote-dir", default="/",
+                        help="the path of the requests")
+    parser.add_argument("--boards", type=int, default=100,
+                        help="how many boards to simulate")
+    parser.add_argument("--prefix", default="sim",
+                        help="what the board ids start with")
+    parser.add_argument("--ports", type=int, default=8,
+                        help="the ports of every board")
+    parser.add_argument("--interval", type=float, default=10.0,
+                        help="the polling interval, in seconds")
+    parser.add_argument("--outage", type=float, default=600.0,
+                        help="how long the site was offline, in seconds")
+    parser.add_argument("--batch", type=int, default=BACKUPBATCHMAX,
+                        help="the most backed up readings in a request")
+    parser.add_argument("--sequenced", action="store_true",
+                        help="send Seq[] and clear the backlog by acked=")
+    parser.add_argument("--timeout", type=float, default=10.0,
+                        help="how long a response is waited for, in seconds")
+    parser.add_argument("--duration", type=float, default=300.0,
+                        help="how long to run, in seconds")
+    parser.add_argument("--report", type=float, default=10.0,
+                        help="how often to print the numbers, in seconds")
+    args = parser.parse_args()
+    return asyncio.get_event_loop().run_until_complete(fleet(args))
+
+
+if __name__ == "__main__":
+    sys.exit(main())
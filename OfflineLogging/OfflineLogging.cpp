@@ -2,183 +2,1939 @@
  \brief    Implementations for Data logging functions
 
 */
+#define TRACE_GROUP "bkup"
 #include "OfflineLogging.h"
+#include "Aggregator.h"
+#include "BackupStore.h"
+#include "DeferredLog.h"
+#include "FrameCodec.h"
+#include "LogCipher.h"
+#include "MbedCRC.h"
+#include "NumberFormat.h"
+#include "mbed.h"
+
+#include <algorithm>
 #include "debugging.h"
+#include "platform/FilePath.h"
+
+#if BACKUPSTORE == BACKUPSTOREFAT || BACKUPSTORE == BACKUPSTORETIERED
+#include "FATFileSystem.h"
+#endif
+
+#if BACKUPSTORE != BACKUPSTOREFAT
+static_assert(LOGSTAGESIZE <= BACKUPLFSPROGSIZE,
+              "a staged block has to fit into one LittleFS program");
+#endif
+
+/// Where a backup file in the old CSV format is moved to
+#define LEGACYFILENAME "/sd/PortReadings.csv"
+
 // ============================================================================
-void dumpSensorDataToFile(BoardSpecs &Specs, const char *FileName) {
-    FILE *File = fopen(FileName, "r");
+// the K64F has DEVICE_CRC, so MbedCRC runs this on the CRC module
+static uint32_t logCRC(const void *Data, size_t Size) {
+    MbedCRC<POLY_32BIT_ANSI, 32> ct;
+    uint32_t crc = 0;
+    ct.compute(Data, Size, &crc);
+    return crc;
+}
+
+// The log goes to its filesystem through FileHandle and not through stdio, so
+// there is no FILE lock, buffer or retarget lookup in between. Every read
+// and write is one call of the filesystem with the buffer of the caller,
+// which for a block is the sector sized Stage.Buffer or Reader.Data.
+
+// opens Name on its filesystem with the open() Flags
+// returns NULL if it can not be opened
+static FileHandle *openFile(const char *Name, int Flags) {
+    FilePath Path(Name);
+    FileSystemLike *Fs = Path.fileSystem();
+    FileHandle *File = NULL;
+    if (Fs == NULL || Fs->open(&File, Path.fileName(), Flags) != 0) {
+        return NULL;
+    }
+    return File;
+}
+
+// reads Size bytes at the position of File into Data
+// returns false if there were not that many
+static bool readAll(FileHandle *File, void *Data, size_t Size) {
+    return File->read(Data, Size) == (ssize_t)Size;
+}
+
+// writes the Size bytes of Data at the position of File
+// returns false if not all of them were written
+static bool writeAll(FileHandle *File, const void *Data, size_t Size) {
+    return File->write(Data, Size) == (ssize_t)Size;
+}
+
+// moves File to Offset
+// returns false if it could not be moved there
+static bool seekTo(FileHandle *File, long Offset) {
+    return File->seek(Offset, SEEK_SET) == Offset;
+}
+
+// fills the header with the port table of the current configuration
+static void makeHeader(BoardSpecs &Specs, LogHeader &Header) {
+    memset(&Header, 0, sizeof(Header));
+    Header.Magic = LOGMAGIC;
+    Header.Version = LOGVERSION;
+    Header.RecordSize = sizeof(LogBlock);
+    Header.HeaderSize = LOGENCRYPT ? sizeof(LogHeader)
+                                   : offsetof(LogHeader, Seal);
+
+    int End = Specs.Ports.size();
+    for (int i = 0; i < End && i < FRAMEMAXPORTS; ++i) {
+        strncpy(Header.Ports[i].Name, Specs.Ports[i].Name.c_str(),
+                LOGNAMELEN - 1);
+        Header.Ports[i].Multiplier = Specs.Ports[i].Multiplier;
+        ++Header.PortCount;
+    }
+    Header.CRC = logCRC(&Header, offsetof(LogHeader, CRC));
+}
+
+// returns true if the blocks of the segment that starts with Header are
+// encrypted
+static bool sealedHeader(const LogHeader &Header) {
+    return Header.HeaderSize == sizeof(LogHeader);
+}
+
+// gives Header a new nonce, for a segment that is written from the start
+// returns false if there is no key to encrypt it with
+static bool sealHeader(LogHeader &Header) {
+    if (!sealedHeader(Header)) {
+        return true;
+    }
+    if (!logCipherReady()) {
+        return false;
+    }
+    newLogNonce(Header.Seal.Nonce, Header.Seal.KeyCheck);
+    Header.Seal.CRC = logCRC(&Header.Seal, offsetof(LogSeal, CRC));
+    return true;
+}
+
+// reads the header at the start of File
+// returns false if File does not start with a valid header, or with one
+// of a segment that was encrypted with another key
+static bool readHeader(FileHandle *File, LogHeader &Header) {
+    memset(&Header.Seal, 0, sizeof(Header.Seal));
+    if (!readAll(File, &Header, offsetof(LogHeader, Seal))) {
+        return false;
+    }
+    bool Layout = (Header.Version == 1 &&
+                   Header.RecordSize == sizeof(LogRecord)) ||
+                  (Header.Version == LOGVERSION &&
+                   Header.RecordSize == sizeof(LogBlock));
+    bool Valid = Header.Magic == LOGMAGIC && Layout &&
+                 (Header.HeaderSize == offsetof(LogHeader, Seal) ||
+                  sealedHeader(Header)) &&
+                 Header.PortCount <= FRAMEMAXPORTS &&
+                 Header.CRC == logCRC(&Header, offsetof(LogHeader, CRC));
+    if (!Valid || !sealedHeader(Header)) {
+        return Valid;
+    }
+    if (!readAll(File, &Header.Seal, sizeof(Header.Seal)) ||
+        Header.Seal.CRC != logCRC(&Header.Seal, offsetof(LogSeal, CRC))) {
+        return false;
+    }
+    if (!logCipherReady() ||
+        !logKeyMatches(Header.Seal.Nonce, Header.Seal.KeyCheck)) {
+        tr_warn("Skipping a backup segment that was encrypted with another "
+                "key");
+        return false;
+    }
+    return true;
+}
+
+// reads the record in slot Slot of a version 1 segment
+// returns false if it is not there or fails its CRC check
+static bool readRecord(FileHandle *File, const LogHeader &Header, uint32_t Slot,
+                       LogRecord &Record) {
+    if (!seekTo(File, Header.HeaderSize + Slot * Header.RecordSize) ||
+        !readAll(File, &Record, sizeof(Record))) {
+        return false;
+    }
+    if (Record.CRC != logCRC(&Record.Frame, sizeof(Record.Frame))) {
+        tr_warn("Skipping a corrupted backup record");
+        return false;
+    }
+    return true;
+}
+
+// returns false if Block can not be the start of a block, a frame takes at
+// least 2 bytes
+static bool blockValid(const LogBlock &Block) {
+    return Block.Count > 0 && Block.Size <= LOGSTAGESIZE - sizeof(LogBlock) &&
+           Block.Count * 2U <= Block.Size;
+}
+
+// finds the first block from From on whose head and CRC check out. A
+// damaged head does not say where the block after it starts, so every byte
+// is tried, with the cheap checks of the head first and the CRC only for
+// the ones that pass them
+// returns -1 if there is none before End
+static long findBlock(FileHandle *File, long From, long End) {
+    // a whole block has to be in the window to check its CRC
+    static uint8_t Window[2 * LOGSTAGESIZE];
+    long Base = From;
+    size_t Have = 0;
+    size_t Pos = 0;
+    while (Base + (long)(Pos + sizeof(LogBlock)) <= End) {
+        if (Have - Pos < LOGSTAGESIZE && Base + (long)Have < End) {
+            memmove(Window, Window + Pos, Have - Pos);
+            Base += Pos;
+            Have -= Pos;
+            Pos = 0;
+            ssize_t Read = seekTo(File, Base + Have)
+                               ? File->read(Window + Have, sizeof(Window) - Have)
+                               : -1;
+            if (Read < 0) {
+                return -1;
+            }
+            Have += Read;
+        }
+        if (Have - Pos < sizeof(LogBlock)) {
+            return -1;
+        }
+        LogBlock Block;
+        memcpy(&Block, Window + Pos, sizeof(Block));
+        if (blockValid(Block) && Pos + sizeof(Block) + Block.Size <= Have &&
+            Block.CRC == logCRC(Window + Pos + sizeof(Block.CRC),
+                                sizeof(Block) - sizeof(Block.CRC) +
+                                    Block.Size)) {
+            return Base + Pos;
+        }
+        ++Pos;
+    }
+    return -1;
+}
+
+// returns true if Block is the zeros after the written part of a segment
+// that was set aside whole
+static bool blockEmpty(const LogBlock &Block) {
+    return Block.CRC == 0 && Block.Count == 0 && Block.Size == 0;
+}
+
+// reads the head of the block at Next of File, which is End bytes long. A
+// head that is damaged or runs past the end, like the one of a block that
+// was cut off by a power cut, is skipped up to the next block that checks
+// out, and Next is moved there. A head of zeros is the end.
+// returns false if there are no more blocks
+static bool nextBlock(FileHandle *File, long &Next, long End, LogBlock &Block) {
+    if (Next + (long)sizeof(Block) > End) {
+        return false;
+    }
+    if (seekTo(File, Next) &&
+        readAll(File, &Block, sizeof(Block))) {
+        if (blockEmpty(Block)) {
+            return false;
+        }
+        if (blockValid(Block) &&
+            Next + (long)(sizeof(Block) + Block.Size) <= End) {
+            return true;
+        }
+    }
+    long Found = findBlock(File, Next + 1, End);
+    if (Found < 0) {
+        return false;
+    }
+    tr_warn("Skipping %ld damaged bytes of a backup segment", Found - Next);
+    Next = Found;
+    return seekTo(File, Next) &&
+           readAll(File, &Block, sizeof(Block));
+}
+
+// counts the records of a segment. Whole is set to false if the last
+// record or block was cut off, End to where the next block goes
+static uint32_t countRecords(FileHandle *File, const LogHeader &Header,
+                             bool &Whole, long &End) {
+    long Size = File->size();
+    End = Size;
+    if (Header.Version == 1) {
+        uint32_t Records = Size > Header.HeaderSize
+                               ? (Size - Header.HeaderSize) / Header.RecordSize
+                               : 0;
+        Whole = Size == (long)(Header.HeaderSize + Records * Header.RecordSize);
+        return Records;
+    }
+
+    // only the block heads are read, unless one is damaged. The reader
+    // skips the same blocks, so the slots are the same
+    uint32_t Records = 0;
+    long Next = Header.HeaderSize;
+    LogBlock Block;
+    while (nextBlock(File, Next, Size, Block)) {
+        Records += Block.Count;
+        Next += sizeof(Block) + Block.Size;
+    }
+
+    // the rest of a segment that was set aside whole is zeros. A block
+    // that was cut off before any of its head was written ends it too
+    Whole = Next == Size ||
+            (seekTo(File, Next) &&
+             readAll(File, &Block, sizeof(Block)) && blockEmpty(Block));
+    End = Next;
+    return Records;
+}
+
+/// Reads the records of a segment in order. The records of a block are
+/// packed against the ones before them, so a block is read whole and
+/// unpacked from its start. Only the uploader thread reads the log, and only
+/// one segment at a time, so there is one reader.
+struct SegmentReader {
+    FileHandle *File;
+    const LogHeader *Header;
+
+    /// the slot of the next record
+    uint32_t Slot;
+
+    /// where the block after the one in Data starts, and the length of File
+    long Next;
+    long Size;
+
+    /// the slots of the first record of the block in Data, of the first
+    /// record after it, and of the next record to unpack
+    uint32_t First;
+    uint32_t End;
+    uint32_t Unpacked;
+
+    /// false if the block in Data failed its CRC check
+    bool Valid;
+
+    /// the block, and where its next packed record starts
+    uint32_t Data[LOGSTAGESIZE / sizeof(uint32_t)];
+    size_t Pos;
+
+    FrameCodec Codec;
+};
+
+static SegmentReader Reader;
+
+// starts reading File at record Slot
+static void startReading(FileHandle *File, const LogHeader &Header, uint32_t Slot) {
+    Reader.File = File;
+    Reader.Header = &Header;
+    Reader.Slot = Slot;
+    Reader.Next = Header.HeaderSize;
+    off_t Size = File->size();
+    Reader.Size = Size > 0 ? Size : 0;
+    Reader.First = 0;
+    Reader.End = 0;
+}
+
+// reads the block that holds Slot into Data. The heads of the blocks in
+// front of it are all that is read of them.
+// returns false if there is no such block
+static bool loadBlock(uint32_t Slot) {
+    LogBlock &Block = *reinterpret_cast<LogBlock *>(Reader.Data);
+    while (Reader.End <= Slot) {
+        if (!nextBlock(Reader.File, Reader.Next, Reader.Size, Block)) {
+            return false;
+        }
+        Reader.First = Reader.End;
+        Reader.End += Block.Count;
+        Reader.Next += sizeof(Block) + Block.Size;
+    }
 
-    // if the file is not there, open in write, not append mode
+    // the head of the block is still in Data when it is read again
+    uint8_t *Bytes = reinterpret_cast<uint8_t *>(Reader.Data);
+    Reader.Valid =
+        seekTo(Reader.File, Reader.Next - Block.Size) &&
+        readAll(Reader.File, Bytes + sizeof(Block), Block.Size) &&
+        Block.CRC == logCRC(Bytes + sizeof(Block.CRC),
+                            sizeof(Block) - sizeof(Block.CRC) + Block.Size);
+    if (!Reader.Valid) {
+        tr_warn("Skipping a corrupted backup block");
+    } else if (sealedHeader(*Reader.Header)) {
+        cryptLog(Reader.Header->Seal.Nonce, Reader.Next - Block.Size,
+                 Bytes + sizeof(Block), Block.Size);
+    }
+    Reader.Unpacked = Reader.First;
+    Reader.Pos = sizeof(Block);
+    Reader.Codec.reset();
+    return true;
+}
+
+// reads the record at Reader.Slot, and moves on to the next slot
+// returns false if it is not there or damaged
+static bool readNext(SampleFrame &Frame) {
+    uint32_t Slot = Reader.Slot++;
+    if (Reader.Header->Version == 1) {
+        LogRecord Record;
+        if (!readRecord(Reader.File, *Reader.Header, Slot, Record)) {
+            return false;
+        }
+        Frame.load(Record.Frame);
+        return true;
+    }
+
+    bool InBlock = Slot >= Reader.First && Slot < Reader.End &&
+                   Slot >= Reader.Unpacked;
+    if (!InBlock && !loadBlock(Slot)) {
+        return false;
+    }
+
+    // the records in front of Slot have to be unpacked to get to it
+    const LogBlock &Block = *reinterpret_cast<LogBlock *>(Reader.Data);
+    const uint8_t *Bytes = reinterpret_cast<uint8_t *>(Reader.Data);
+    size_t Length = sizeof(Block) + Block.Size;
+    while (Reader.Valid && Reader.Unpacked <= Slot) {
+        size_t Used = Reader.Codec.decode(Bytes + Reader.Pos,
+                                          Length - Reader.Pos, Frame);
+        if (Used == 0) {
+            tr_warn("Skipping a corrupted backup block");
+            Reader.Valid = false;
+        }
+        Reader.Pos += Used;
+        ++Reader.Unpacked;
+    }
+    return Reader.Valid;
+}
+
+// the cursor file of a log from before the segments has the same name with
+// a .cur extension
+static string cursorFileName(const char *FileName) {
+    string Name(FileName);
+    size_t dot = Name.find_last_of('.');
+    if (dot != string::npos && Name.find('/', dot) == string::npos) {
+        Name.erase(dot);
+    }
+    return Name + ".cur";
+}
+
+// gets the offset of the oldest unsent record of the old log FileName.
+// A missing or damaged cursor starts over at the first record, so records
+// are sent twice rather than not at all.
+static uint32_t readCursor(const char *FileName, const LogHeader &Header) {
+    uint32_t Start = Header.HeaderSize;
+    FileHandle *File = openFile(cursorFileName(FileName).c_str(), O_RDONLY);
     if (File == NULL) {
-        printf("making new data file \r\n");
-        File = fopen(FileName, "wb");
+        return Start;
+    }
 
-        if (File == NULL) {
-            printf("Failed to open %s for logging. Skipping data logging\r\n",
-                   FileName);
+    LogCursor Cursor;
+    bool valid = readAll(File, &Cursor, sizeof(Cursor));
+    File->close();
+
+    if (!valid || Cursor.Magic != LOGMAGIC ||
+        Cursor.CRC != logCRC(&Cursor, offsetof(LogCursor, CRC)) ||
+        Cursor.Offset < Start ||
+        (Cursor.Offset - Start) % Header.RecordSize != 0) {
+        printf("Backup cursor is not valid, starting over\r\n");
+        return Start;
+    }
+    return Cursor.Offset;
+}
+
+// moves the readings of In from the port layout From to the port layout To.
+// Ports are matched by name, and the raw values are rescaled if the
+// multiplier of the port changed. Ports that are not in To are dropped.
+static void remapFrame(const LogHeader &From, const LogHeader &To,
+                       const SampleFrame &In, SampleFrame &Out) {
+    Out.clear();
+    Out.Timestamp = In.Timestamp;
+    Out.Count = In.Count;
+    Out.Kind = In.Kind;
+    Out.Sequence = In.Sequence;
+
+    for (int j = 0; j < From.PortCount; ++j) {
+        if (!In.hasPort(j)) {
+            continue;
+        }
+
+        int i = 0;
+        while (i < To.PortCount && (To.Ports[i].Multiplier == 0.0f ||
+                                    strncmp(From.Ports[j].Name,
+                                            To.Ports[i].Name, LOGNAMELEN))) {
+            ++i;
+        }
+        if (i == To.PortCount) {
+            continue;
+        }
+
+        float OldMult = From.Ports[j].Multiplier;
+        float NewMult = To.Ports[i].Multiplier;
+        if (OldMult == NewMult) {
+            Out.Raw[i] = In.Raw[j];
+            Out.PortMask |= 1U << i;
+        } else {
+            Out.setReading(i, In.Raw[j] * (OldMult / NewMult) / 0xFFFF);
+        }
+        if (In.OverMask & (1U << j)) {
+            Out.OverMask |= 1U << i;
+        }
+        if (In.UnderMask & (1U << j)) {
+            Out.UnderMask |= 1U << i;
+        }
+    }
+}
+
+// ============================================================================
+/// The index of the log that is in use, the copy in index.dat is only read
+/// when another LogDir is used
+static LogIndex Index;
+
+/// how many records in Index were not sent yet. It is counted again with
+/// every change of Index, so asking for it never reads the log
+static uint32_t Unsent = 0;
+
+/// The longest name of a file in the log, with its LogDir
+#define LOGPATHMAX (64)
+
+/// The name of a file in the log. The log writes the index after every
+/// flush, so the name is built on the stack instead of in a string
+struct LogPath {
+    char Name[LOGPATHMAX];
+
+    const char *c_str() const { return Name; }
+};
+
+/// the LogDir that Index belongs to, empty before the first use
+static char IndexDir[LOGPATHMAX];
+
+// keeps LogDir in Dir, cut to LOGPATHMAX - 1 characters
+static void keepDir(char (&Dir)[LOGPATHMAX], const char *LogDir) {
+    strncpy(Dir, LogDir, LOGPATHMAX - 1);
+    Dir[LOGPATHMAX - 1] = 0;
+}
+
+/// How many logs keep their unsent count when another one is in use, one
+/// for every LogClass
+#define LOGUNSENTKEPT (LOGCLASSES)
+
+/// The unsent records of a log whose index is not loaded
+struct LogUnsent {
+    char Dir[LOGPATHMAX];
+    uint32_t Unsent;
+};
+
+/// Asking another LogDir for its count takes it from here, so the classes
+/// of BACKLOGPRIORITY can be looked at without loading their indexes and
+/// closing the open segment. Only the log of Index changes, and it is
+/// kept here whenever it is counted
+static LogUnsent KeptUnsent[LOGUNSENTKEPT];
+static size_t KeptCount = 0;
+
+// returns the count that was kept of LogDir, NULL if there is none
+static LogUnsent *keptUnsent(const char *LogDir) {
+    for (size_t i = 0; i < KeptCount; ++i) {
+        if (strcmp(KeptUnsent[i].Dir, LogDir) == 0) {
+            return &KeptUnsent[i];
+        }
+    }
+    return NULL;
+}
+
+// counts the records in Index that were not sent yet, and keeps the count
+// for IndexDir
+static void countUnsent() {
+    Unsent = 0;
+    for (size_t i = 0; i < Index.Count; ++i) {
+        const LogSegment &Seg = Index.Segments[i];
+        Unsent += Seg.Acked < Seg.Records ? Seg.Records - Seg.Acked : 0;
+    }
+
+    LogUnsent *Kept = keptUnsent(IndexDir);
+    if (Kept == NULL) {
+        // the last one makes room, there is one log for every class
+        Kept = &KeptUnsent[KeptCount < LOGUNSENTKEPT ? KeptCount++
+                                                     : LOGUNSENTKEPT - 1];
+        keepDir(Kept->Dir, IndexDir);
+    }
+    Kept->Unsent = Unsent;
+}
+
+// the name of segment Number in LogDir
+static LogPath segmentName(const char *LogDir, uint32_t Number) {
+    // "%06lu" would come out without its zeros with minimal-printf
+    LogPath Path;
+    const size_t Room = sizeof(Path.Name) - FORMATUNSIGNEDMAX - sizeof(".seg");
+    int Length = snprintf(Path.Name, Room, "%s/", LogDir);
+    if (Length < 0 || (size_t)Length >= Room) {
+        Length = Length < 0 ? 0 : Room - 1;
+    }
+    Length += formatUnsigned(Path.Name + Length, Number, 6);
+    memcpy(Path.Name + Length, ".seg", sizeof(".seg"));
+    return Path;
+}
+
+#if BACKUPSTORE == BACKUPSTORETIERED
+// the directory on the SD card that BACKUPSTORETIERED moves the segments of
+// LogDir to, LogDir with BACKUPCOLDROOT in place of its filesystem
+static LogPath coldDir(const char *LogDir) {
+    LogPath Path;
+    const char *Rest = strchr(LogDir + 1, '/');
+    snprintf(Path.Name, sizeof(Path.Name), "%s%s", BACKUPCOLDROOT,
+             Rest != NULL ? Rest : "");
+    return Path;
+}
+
+// the name of segment Number of LogDir once it was moved to the SD card
+static LogPath coldSegmentName(const char *LogDir, uint32_t Number) {
+    return segmentName(coldDir(LogDir).c_str(), Number);
+}
+#endif
+
+static LogPath indexName(const char *LogDir) {
+    LogPath Path;
+    snprintf(Path.Name, sizeof(Path.Name), "%s/index.dat", LogDir);
+    return Path;
+}
+
+static LogPath journalName(const char *LogDir) {
+    LogPath Path;
+    snprintf(Path.Name, sizeof(Path.Name), "%s/index.jnl", LogDir);
+    return Path;
+}
+
+// opens segment Number of LogDir with the open() Flags. With
+// BACKUPSTORETIERED, a segment that is not in the flash any more is on the
+// SD card
+static FileHandle *openSegmentFile(const char *LogDir, uint32_t Number,
+                                   int Flags) {
+    FileHandle *File = openFile(segmentName(LogDir, Number).c_str(), Flags);
+#if BACKUPSTORE == BACKUPSTORETIERED
+    if (File == NULL) {
+        File = openFile(coldSegmentName(LogDir, Number).c_str(), Flags);
+    }
+#endif
+    return File;
+}
+
+// removes segment Number of LogDir, wherever it is
+static void removeSegment(const char *LogDir, uint32_t Number) {
+    remove(segmentName(LogDir, Number).c_str());
+#if BACKUPSTORE == BACKUPSTORETIERED
+    remove(coldSegmentName(LogDir, Number).c_str());
+#endif
+}
+
+/// what index.dat and index.jnl hold together, the entries of index.jnl,
+/// and how many of them are used, 0 if the journal can not be appended to
+static LogIndex Written;
+static LogJournalEntry Journal[LOGJOURNALENTRIES];
+static size_t JournalUsed = 0;
+
+// starts index.jnl over with the base of the index.dat that was just
+// written, and zeros after it
+static void startJournal(const char *LogDir) {
+    JournalUsed = 0;
+    memset(Journal, 0, sizeof(Journal));
+    Journal[0].Segment.Number = LOGJOURNALBASE;
+    Journal[0].Segment.Records = Index.CRC;
+    Journal[0].CRC = logCRC(&Journal[0].Segment, sizeof(LogSegment));
+
+    FileHandle *File = openFile(journalName(LogDir).c_str(), O_RDWR | O_CREAT);
+    if (File == NULL) {
+        return;
+    }
+    bool Started = writeAll(File, Journal, sizeof(Journal));
+    if (File->close() == 0 && Started) {
+        JournalUsed = 1;
+    }
+}
+
+// applies the entries of index.jnl that belong to Index
+static void replayJournal(const char *LogDir) {
+    JournalUsed = 0;
+    FileHandle *File = openFile(journalName(LogDir).c_str(), O_RDONLY);
+    if (File == NULL) {
+        return;
+    }
+    bool Read = readAll(File, Journal, sizeof(Journal));
+    File->close();
+    if (!Read || Journal[0].Segment.Number != LOGJOURNALBASE ||
+        Journal[0].Segment.Records != Index.CRC ||
+        Journal[0].CRC != logCRC(&Journal[0].Segment, sizeof(LogSegment))) {
+        return;
+    }
+
+    size_t Used = 1;
+    while (Used < LOGJOURNALENTRIES &&
+           Journal[Used].CRC ==
+               logCRC(&Journal[Used].Segment, sizeof(LogSegment))) {
+        const LogSegment &Entry = Journal[Used++].Segment;
+        for (size_t i = 0; i < Index.Count; ++i) {
+            if (Index.Segments[i].Number == Entry.Number) {
+                Index.Segments[i] = Entry;
+                break;
+            }
+        }
+    }
+    JournalUsed = Used;
+}
+
+// appends Seg to index.jnl
+// returns false if it is full or the entry could not be written
+static bool journalSegment(const char *LogDir, const LogSegment &Seg) {
+    if (JournalUsed == 0 || JournalUsed >= LOGJOURNALENTRIES) {
+        return false;
+    }
+    LogJournalEntry &Entry = Journal[JournalUsed];
+    Entry.Segment = Seg;
+    Entry.CRC = logCRC(&Entry.Segment, sizeof(LogSegment));
+
+    FileHandle *File = openFile(journalName(LogDir).c_str(), O_RDWR);
+    if (File == NULL) {
+        JournalUsed = 0;
+        return false;
+    }
+    bool Appended = seekTo(File, JournalUsed * sizeof(Entry)) &&
+                    writeAll(File, &Entry, sizeof(Entry));
+    if (File->close() != 0 || !Appended) {
+        // what is in the file is not known, index.dat is written instead
+        JournalUsed = 0;
+        return false;
+    }
+    ++JournalUsed;
+    return true;
+}
+
+// stores Index in index.dat. It is the same sized write no matter how long
+// the log is.
+static void writeIndex(const char *LogDir) {
+    countUnsent();
+    Index.Magic = LOGMAGIC;
+    Index.Version = LOGINDEXVERSION;
+    Index.CRC = logCRC(&Index, offsetof(LogIndex, CRC));
+
+    // overwrite in place so the file keeps its clusters
+    LogPath Name = indexName(LogDir);
+    FileHandle *File = openFile(Name.c_str(), O_RDWR | O_CREAT);
+    if (File == NULL) {
+        printf("Failed to open %s!\r\n", Name.c_str());
+        JournalUsed = 0;
+        return;
+    }
+    bool Stored = writeAll(File, &Index, sizeof(Index));
+    if (File->close() != 0 || !Stored) {
+        JournalUsed = 0;
+        return;
+    }
+    Written = Index;
+    startJournal(LogDir);
+}
+
+// stores what changed in Index since it was last stored. If only the counts
+// and times of a few segments changed they are appended to index.jnl, one
+// sector write for each, else index.dat is written
+static void storeIndex(const char *LogDir) {
+    countUnsent();
+    bool Same = Index.Count == Written.Count &&
+                Index.NextNumber == Written.NextNumber;
+    size_t Changed = 0;
+    for (size_t i = 0; Same && i < Index.Count; ++i) {
+        const LogSegment &Seg = Index.Segments[i];
+        Same = Seg.Number == Written.Segments[i].Number;
+        Changed += memcmp(&Seg, &Written.Segments[i], sizeof(Seg)) != 0;
+    }
+    if (Same && Changed == 0) {
+        return;
+    }
+    if (Same && JournalUsed + Changed <= LOGJOURNALENTRIES) {
+        // the oldest segment goes first, see LogJournalEntry
+        for (size_t i = 0; Same && i < Index.Count; ++i) {
+            LogSegment &Seg = Written.Segments[i];
+            if (memcmp(&Index.Segments[i], &Seg, sizeof(Seg)) == 0) {
+                continue;
+            }
+            Same = journalSegment(LogDir, Index.Segments[i]);
+            if (Same) {
+                Seg = Index.Segments[i];
+            }
+        }
+        if (Same) {
             return;
         }
+    }
+    writeIndex(LogDir);
+}
 
-    } else {
-        printf("Appending data to data file \r\n");
-        fclose(File);
-        File = fopen(FileName, "ab");
+// opens segment Number and checks its header. Whole is set to false if
+// the segment ends in a record that was cut off, End to where its next
+// block goes.
+// returns NULL if it is not there or not valid
+static FileHandle *openSegment(const char *LogDir, uint32_t Number,
+                               LogHeader &Header, uint32_t &Records,
+                               bool *Whole = NULL, long *End = NULL) {
+    FileHandle *File = openSegmentFile(LogDir, Number, O_RDONLY);
+    if (File == NULL) {
+        return NULL;
+    }
+    if (!readHeader(File, Header)) {
+        File->close();
+        return NULL;
     }
+    bool Ends;
+    long Next;
+    Records = countRecords(File, Header, Ends, Next);
+    if (Whole != NULL) {
+        *Whole = Ends;
+    }
+    if (End != NULL) {
+        *End = Next;
+    }
+    return File;
+}
 
-    // dump the data from all the sensors
-    int End = Specs.Ports.size();
-    for (int i = 0; i < End; ++i) {
+// adds the segment File to the end of Index, with its time range. If the
+// index is full, the oldest segment is deleted to make room.
+static void indexSegment(const char *LogDir, FileHandle *File,
+                         const LogHeader &Header, uint32_t Number,
+                         uint32_t Records, uint32_t Acked) {
+    if (Index.Count == LOGMAXSEGMENTS) {
+        tr_warn("The backup log is full, dropping its oldest segment");
+        removeSegment(LogDir, Index.Segments[0].Number);
+        memmove(&Index.Segments[0], &Index.Segments[1],
+                (LOGMAXSEGMENTS - 1) * sizeof(LogSegment));
+        --Index.Count;
+    }
+
+    LogSegment &Seg = Index.Segments[Index.Count++];
+    memset(&Seg, 0, sizeof(Seg));
+    Seg.Number = Number;
+    Seg.Records = Records;
+    Seg.Acked = Acked > Records ? Records : Acked;
+
+    SampleFrame Frame;
+    startReading(File, Header, 0);
+    if (Records > 0 && readNext(Frame)) {
+        Seg.FirstTime = Frame.Timestamp;
+    }
+    startReading(File, Header, Records - 1);
+    if (Records > 0 && readNext(Frame)) {
+        Seg.LastTime = Frame.Timestamp;
+    }
+    if (Index.NextNumber <= Number) {
+        Index.NextNumber = Number + 1;
+    }
+}
+
+// moves a log from before the segments into LogDir as its first segment.
+// Files with a valid header are renamed, which does not copy anything.
+static void importOldLog(const char *LogDir) {
+    string Old = string(LogDir) + ".dat";
+    FileHandle *File = openFile(Old.c_str(), O_RDONLY);
+    if (File == NULL) {
+        return;
+    }
 
-        // only dump the data if the port multipler != 0
-        if (Specs.Ports[i].Multiplier != 0.0f) {
+    LogHeader Header;
+    bool valid = readHeader(File, Header);
+    File->close();
 
-            fprintf(File, "%s,%f,%s", Specs.Ports[i].Name.c_str(),
-                    Specs.Ports[i].Value, Specs.Ports[i].Description.c_str());
-            // I moved adding the \n down here because fprintf may have been
-            // botching it I am not sure though act as you feel is best
-            fputc('\n', File);
+    // keep a backup file from before the binary format around
+    if (!valid) {
+        printf("Moving old backup file to %s\r\n", LEGACYFILENAME);
+        remove(LEGACYFILENAME);
+        if (rename(Old.c_str(), LEGACYFILENAME) != 0) {
+            remove(Old.c_str());
         }
+        return;
     }
 
-    fclose(File);
+    // the logs from before the segments are all of version 1
+    uint32_t Number = Index.NextNumber;
+    uint32_t Acked =
+        (readCursor(Old.c_str(), Header) - Header.HeaderSize) /
+        Header.RecordSize;
+    if (rename(Old.c_str(), segmentName(LogDir, Number).c_str()) != 0) {
+        printf("Could not move %s into %s\r\n", Old.c_str(), LogDir);
+        return;
+    }
+    remove(cursorFileName(Old.c_str()).c_str());
+
+    uint32_t Records;
+    File = openSegment(LogDir, Number, Header, Records);
+    if (File != NULL) {
+        printf("Moved %s into %s\r\n", Old.c_str(), LogDir);
+        indexSegment(LogDir, File, Header, Number, Records, Acked);
+        File->close();
+    }
 }
-//=============================================================================
-// 1. get the number of ports the board has (n ports)
-// 2. go down n ports
-// 3. transfer the rest of the file to another file (the first n entries were
-// read earlier);
-// 4. delete the original file
-bool deleteDataEntry(BoardSpecs &Specs, const char *FileName) {
-    printf("Deleting data entry!\r\n");
-    // get the data for the ports
-    // only get the data for ports where the multiplier != 0
-    int Size = 0;
-    int End = Specs.Ports.size();
-    for (int i = 0; i < End; ++i) {
-        if (Specs.Ports[i].Multiplier != 0.0f) {
-            ++Size;
+
+// adds the Numbers of the segment files in Path to Numbers
+static void listSegments(const char *Path, vector<uint32_t> &Numbers) {
+    DIR *Dir = opendir(Path);
+    if (Dir != NULL) {
+        struct dirent *Entry;
+        while ((Entry = readdir(Dir)) != NULL) {
+            unsigned long Number;
+            char Ext[5];
+            if (sscanf(Entry->d_name, "%6lu.%4s", &Number, Ext) == 2 &&
+                strcmp(Ext, "seg") == 0) {
+                Numbers.push_back(Number);
+            }
+        }
+        closedir(Dir);
+    }
+}
+
+// makes Index from the segment files in LogDir, when index.dat is missing
+// or damaged. Which records were sent is lost, so they are sent again.
+static void rebuildIndex(const char *LogDir) {
+    printf("Rebuilding the backup index of %s\r\n", LogDir);
+    memset(&Index, 0, sizeof(Index));
+
+    vector<uint32_t> Numbers;
+    listSegments(LogDir, Numbers);
+#if BACKUPSTORE == BACKUPSTORETIERED
+    // a segment that was cut off while it was moved is in both
+    listSegments(coldDir(LogDir).c_str(), Numbers);
+#endif
+    sort(Numbers.begin(), Numbers.end());
+    Numbers.erase(unique(Numbers.begin(), Numbers.end()), Numbers.end());
+
+    for (size_t i = 0; i < Numbers.size(); ++i) {
+        LogHeader Header;
+        uint32_t Records;
+        FileHandle *File = openSegment(LogDir, Numbers[i], Header, Records);
+        if (File == NULL) {
+            removeSegment(LogDir, Numbers[i]);
+            continue;
+        }
+        indexSegment(LogDir, File, Header, Numbers[i], Records, 0);
+        File->close();
+    }
+
+    importOldLog(LogDir);
+    writeIndex(LogDir);
+}
+
+// makes Index the index of LogDir
+static void loadIndex(const char *LogDir) {
+    if (strcmp(IndexDir, LogDir) == 0) {
+        return;
+    }
+    keepDir(IndexDir, LogDir);
+    mkdir(LogDir, 0777);
+
+    FileHandle *File = openFile(indexName(LogDir).c_str(), O_RDONLY);
+    bool valid = File != NULL && readAll(File, &Index, sizeof(Index));
+    if (File != NULL) {
+        File->close();
+    }
+    if (!valid || Index.Magic != LOGMAGIC ||
+        Index.Version != LOGINDEXVERSION || Index.Count > LOGMAXSEGMENTS ||
+        Index.CRC != logCRC(&Index, offsetof(LogIndex, CRC))) {
+        rebuildIndex(LogDir);
+    } else {
+        // index.jnl has the changes since index.dat was written
+        replayJournal(LogDir);
+        Written = Index;
+    }
+    countUnsent();
+}
+
+// drops the segments at the front that have nothing left to send but the
+// last Keep of them, and tells the card that their blocks are free
+static void dropSentSegments(const char *LogDir, size_t Keep) {
+    size_t Sent = 0;
+    while (Sent < Index.Count &&
+           Index.Segments[Sent].Acked >= Index.Segments[Sent].Records) {
+        ++Sent;
+    }
+    Sent = Sent > Keep ? Sent - Keep : 0;
+    for (size_t i = 0; i < Sent; ++i) {
+        removeSegment(LogDir, Index.Segments[i].Number);
+    }
+    if (Sent > 0) {
+        memmove(&Index.Segments[0], &Index.Segments[Sent],
+                (Index.Count - Sent) * sizeof(LogSegment));
+        Index.Count -= Sent;
+
+        int err = trimBackupStore();
+        if (err) {
+            tr_warn("Could not trim the removed segments (%d)", err);
         }
     }
+}
 
-    FILE *DataFile = fopen(FileName, "rb");
+// ============================================================================
+/// The segment that dumpSensorDataToFile() keeps open, and the records that
+/// were not written to it yet
+struct LogStage {
+    /// the open segment, or NULL. It is always the last one in Index.
+    FileHandle *File;
+
+    /// the LogDir of File
+    char Dir[LOGPATHMAX];
+
+    /// the port layout of File
+    LogHeader Header;
+
+    /// the block of records waiting to be written, its LogBlock is filled in
+    /// when it is written
+    uint32_t Buffer[LOGSTAGESIZE / sizeof(uint32_t)];
+
+    /// how many bytes of Buffer are used, with the LogBlock, 0 if there are
+    /// no records in it
+    size_t Used;
+
+    /// how many records are in Buffer
+    uint32_t Count;
+
+    /// packs the records of Buffer
+    FrameCodec Codec;
 
-    // if the file is not there, just return false (entry was not deleted)
-    if (DataFile == NULL) {
-        printf("Data file not found!\n");
+    /// when the oldest record in Buffer came in (Kernel::get_ms_count())
+    uint64_t OldestMs;
+};
+
+/// Only the uploader thread logs, so this needs no lock
+static LogStage Stage;
+
+/// the Number of the newest segment plus 1 if this boot made it and every
+/// block went in, 0 if not. An encrypted segment is only appended to then:
+/// a block that was cut off may have reached the card, and the next block
+/// at its offset would reuse its key stream
+static uint32_t Appendable = 0;
+
+// fills in the LogBlock at the start of Buffer, for the Count records that
+// make up Used bytes with it. The records are encrypted first if they go
+// into an encrypted segment with Header at offset At, so the CRC32 checks
+// them without the key
+static void sealBlock(const LogHeader &Header, long At, uint32_t *Buffer,
+                      size_t Used, uint32_t Count) {
+    LogBlock &Block = *reinterpret_cast<LogBlock *>(Buffer);
+    Block.Count = Count;
+    Block.Size = Used - sizeof(Block);
+    if (sealedHeader(Header)) {
+        cryptLog(Header.Seal.Nonce, At + sizeof(Block),
+                 reinterpret_cast<uint8_t *>(Buffer) + sizeof(Block),
+                 Block.Size);
+    }
+    Block.CRC = logCRC(&Block.Count, Used - sizeof(Block.CRC));
+}
+
+// writes the staged records to the segment as one block, then counts them
+// in the index
+static void flushStage() {
+    if (Stage.File == NULL || Stage.Used == 0) {
+        return;
+    }
+    sealBlock(Stage.Header, Stage.File->tell(), Stage.Buffer, Stage.Used,
+              Stage.Count);
+
+    uint32_t Count = Stage.Count;
+    Stage.Count = 0;
+    if (!writeAll(Stage.File, Stage.Buffer, Stage.Used)) {
+        // the card may be gone, the next record tries to open the segment
+        // again and goes somewhere else if that fails
+        tr_error("Failed to write the records to %s", Stage.Dir);
+        Appendable = 0;
+        Stage.File->close();
+        Stage.File = NULL;
+        Stage.Used = 0;
+        return;
+    }
+
+    // the block is on the card once the filesystem commits it
+    Stage.File->sync();
+
+    Index.Segments[Index.Count - 1].Records += Count;
+    Stage.Used = 0;
+    storeIndex(Stage.Dir);
+}
+
+// flushes and closes the segment, so that it can be read or removed
+static void closeStage() {
+    flushStage();
+    if (Stage.File != NULL) {
+        Stage.File->close();
+        Stage.File = NULL;
+    }
+}
+
+// how many records the open segment has, with the staged ones
+static uint32_t stagedRecords() {
+    return Index.Segments[Index.Count - 1].Records + Stage.Count;
+}
+
+#if BACKUPSTORE == BACKUPSTOREFAT || BACKUPSTORE == BACKUPSTORETIERED
+// makes the file Name on the FAT, Size bytes long and in one piece
+// returns 0 on success, or a negative error code
+static int setAside(const char *Name, off_t Size) {
+    FilePath Path(Name);
+    FileSystemLike *Fs = Path.fileSystem();
+    return Fs == NULL ? -ENODEV
+                      : static_cast<FATFileSystem *>(Fs)->expand(
+                            Path.fileName(), Size);
+}
+#endif
+
+// makes the segment Name that starts with Current. On FAT it gets
+// LOGSEGMENTEXTENT bytes of the card in one piece, which are cleared once
+// now: whatever the clusters held before could pass for blocks. It is left
+// at the end of the header
+static FileHandle *createSegment(const char *Name, const LogHeader &Current) {
+#if BACKUPSTORE == BACKUPSTOREFAT
+    int err = setAside(Name, LOGSEGMENTEXTENT);
+    FileHandle *Set = err == 0 ? openFile(Name, O_RDWR) : NULL;
+    if (Set != NULL) {
+        bool Cleared = writeAll(Set, &Current, Current.HeaderSize);
+
+        // Stage.Buffer is empty while a segment is made
+        memset(Stage.Buffer, 0, sizeof(Stage.Buffer));
+        for (long At = Current.HeaderSize; Cleared && At < LOGSEGMENTEXTENT;
+             At += sizeof(Stage.Buffer)) {
+            size_t Piece = LOGSEGMENTEXTENT - At < (long)sizeof(Stage.Buffer)
+                               ? LOGSEGMENTEXTENT - At
+                               : sizeof(Stage.Buffer);
+            Cleared = writeAll(Set, Stage.Buffer, Piece);
+        }
+        if (Cleared && Set->sync() == 0 && seekTo(Set, Current.HeaderSize)) {
+            return Set;
+        }
+        Set->close();
+    }
+    tr_warn("Could not set aside %s (%d), it grows as it is written", Name,
+            err);
+#endif
+    FileHandle *File = openFile(Name, O_RDWR | O_CREAT | O_TRUNC);
+    if (File != NULL) {
+        writeAll(File, &Current, Current.HeaderSize);
+        File->sync();
+    }
+    return File;
+}
+
+#if BACKUPSTORE == BACKUPSTORETIERED
+// copies the segment From in the flash to To on the SD card, through Chunk
+// returns false if the card did not take all of it
+static bool copySegment(const char *From, const char *To, uint8_t *Chunk) {
+    FileHandle *In = openFile(From, O_RDONLY);
+    if (In == NULL) {
         return false;
     }
+    long Size = In->size();
+    FileHandle *Out = NULL;
+    if (Size > 0) {
+        // the copy is written over, not appended to
+        Out = setAside(To, Size) == 0
+                  ? openFile(To, O_WRONLY)
+                  : openFile(To, O_WRONLY | O_CREAT | O_TRUNC);
+    }
+
+    bool Copied = Out != NULL;
+    if (Out != NULL) {
+        for (long Left = Size; Copied && Left > 0; Left -= BACKUPSPILLCHUNK) {
+            size_t Piece = Left < BACKUPSPILLCHUNK ? Left : BACKUPSPILLCHUNK;
+            Copied = readAll(In, Chunk, Piece) && writeAll(Out, Chunk, Piece);
+        }
+        Copied = Out->close() == 0 && Copied;
+    }
+    In->close();
+    if (!Copied) {
+        remove(To);
+    }
+    return Copied;
+}
+
+// moves all of the segments of LogDir that are in the flash to the SD card
+// once there are BACKUPHOTSEGMENTS of them. The stage has to be closed.
+// A segment that is moved is removed from the flash after it was copied,
+// so a reset in between leaves it in both places
+static void spillSegments(const char *LogDir) {
+    struct stat Info;
+    size_t Hot = 0;
+    for (size_t i = 0; i < Index.Count; ++i) {
+        if (stat(segmentName(LogDir, Index.Segments[i].Number).c_str(),
+                 &Info) == 0) {
+            ++Hot;
+        }
+    }
+    if (Hot < BACKUPHOTSEGMENTS) {
+        return;
+    }
+
+    mkdir(coldDir(LogDir).c_str(), 0777);
+    uint8_t *Chunk = new uint8_t[BACKUPSPILLCHUNK];
+    size_t Moved = 0;
+    for (size_t i = 0; i < Index.Count; ++i) {
+        uint32_t Number = Index.Segments[i].Number;
+        LogPath From = segmentName(LogDir, Number);
+        if (stat(From.c_str(), &Info) != 0) {
+            continue;
+        }
+        if (!copySegment(From.c_str(),
+                         coldSegmentName(LogDir, Number).c_str(), Chunk)) {
+            tr_warn("Could not move backup segment %s to the SD card",
+                    From.c_str());
+            break;
+        }
+        remove(From.c_str());
+        ++Moved;
+    }
+    delete[] Chunk;
+    tr_info("Moved %u of %u backup segments to the SD card", Moved, Hot);
+}
+#endif
 
-    // go down N port readings in the file
-    char *fgetstatus;
-    char Line[LINESIZE + 1];
-    while (Size > 0) {
-        fgetstatus = fgets(Line, LINESIZE, DataFile);
-        // in this case, you have already sent all the data entries and the
-        // backup file should be deleted
-        if (fgetstatus == NULL) {
-            fclose(DataFile);
-            remove(FileName);
+// opens the newest segment of LogDir for appending unless it is open
+// already. A new segment is made if the newest one is full, has another port
+// layout or encryption than Current, is of an older version, ends in a torn
+// record, or is encrypted and was not made by this boot.
+// returns false if no segment can be opened
+static bool openStage(const char *LogDir, const LogHeader &Current) {
+    if (Stage.File != NULL && strcmp(Stage.Dir, LogDir) == 0 &&
+        stagedRecords() < LOGSEGMENTRECORDS &&
+        memcmp(Stage.Header.Ports, Current.Ports, sizeof(Current.Ports)) ==
+            0) {
+        return true;
+    }
+    closeStage();
+    loadIndex(LogDir);
+
+    FileHandle *File = NULL;
+    if (Index.Count > 0) {
+        LogSegment &Seg = Index.Segments[Index.Count - 1];
+        uint32_t Records;
+        bool whole;
+        long End;
+        File = openSegment(LogDir, Seg.Number, Stage.Header, Records, &whole,
+                           &End);
+        if (File != NULL) {
+            File->close();
+            File = NULL;
+
+            // records that were written before a reset, but not counted
+            Seg.Records = Records;
+            countUnsent();
+            if (whole && Records < LOGSEGMENTRECORDS &&
+                Stage.Header.Version == LOGVERSION &&
+                Stage.Header.HeaderSize == Current.HeaderSize &&
+                (!sealedHeader(Stage.Header) ||
+                 Appendable == Seg.Number + 1) &&
+                memcmp(Stage.Header.Ports, Current.Ports,
+                       sizeof(Current.Ports)) == 0) {
+                // a segment that was set aside is written into, not
+                // appended to
+                File = openSegmentFile(LogDir, Seg.Number, O_RDWR);
+                if (File != NULL && !seekTo(File, End)) {
+                    File->close();
+                    File = NULL;
+                }
+            }
+        }
+    }
+
+    // start a new segment with the current port layout
+    if (File == NULL) {
+#if BACKUPSTORE == BACKUPSTORETIERED
+        // the closed segments make room in the flash first
+        spillSegments(LogDir);
+#endif
+        Stage.Header = Current;
+        if (!sealHeader(Stage.Header)) {
+            tr_error("There is no key for the backup log. Skipping data "
+                     "logging");
             return false;
         }
-        --Size;
+        uint32_t Number = Index.NextNumber++;
+        LogPath Name = segmentName(LogDir, Number);
+        tr_info("making new backup segment %s", Name.c_str());
+        File = createSegment(Name.c_str(), Stage.Header);
+        if (File == NULL) {
+            tr_error("Failed to open %s for logging. Skipping data logging",
+                     Name.c_str());
+            return false;
+        }
+        indexSegment(LogDir, File, Stage.Header, Number, 0, 0);
+        storeIndex(LogDir);
+        Appendable = Number + 1;
+
+        // indexing went to the end, which is past the zeros
+        seekTo(File, Current.HeaderSize);
     }
-    int flocation = ftell(DataFile);
-    if (fgets(Line, LINESIZE, DataFile) == NULL) {
-        fclose(DataFile);
-        remove(FileName);
-        printf("Removed DataFile\r\n");
-        return false;
+
+    Stage.File = File;
+    keepDir(Stage.Dir, LogDir);
+    Stage.Used = 0;
+    Stage.Count = 0;
+    return true;
+}
+
+/// A record in the log, the Number of its segment and its slot in there
+struct LogMark {
+    uint32_t Segment;
+    uint32_t Slot;
+};
+
+// reads up to MaxFrames unsent records of Index into Frames, starting at
+// From, in the port layout of Current. First is set to where the first of
+// them was, End to the slot after the last one
+static size_t readBatch(const char *LogDir, const LogHeader &Current,
+                        SampleFrame *Frames, size_t MaxFrames,
+                        const LogMark &From, LogMark &First, LogMark &End) {
+    size_t Count = 0;
+    End = From;
+    for (size_t i = 0; i < Index.Count && Count < MaxFrames; ++i) {
+        const LogSegment &Seg = Index.Segments[i];
+        uint32_t Start = Seg.Acked;
+        if (Seg.Number < From.Segment) {
+            continue;
+        } else if (Seg.Number == From.Segment && From.Slot > Start) {
+            Start = From.Slot;
+        }
+        if (Start >= Seg.Records) {
+            continue;
+        }
+
+        LogHeader Header;
+        uint32_t Records;
+        FileHandle *File = openSegment(LogDir, Seg.Number, Header, Records);
+        if (File == NULL) {
+            continue;
+        }
+
+        SampleFrame Frame;
+        startReading(File, Header, Start);
+        uint32_t Slot = Start;
+        for (; Slot < Seg.Records && Count < MaxFrames; ++Slot) {
+            if (readNext(Frame)) {
+                if (Count == 0) {
+                    First.Segment = Seg.Number;
+                    First.Slot = Slot;
+                }
+                remapFrame(Header, Current, Frame, Frames[Count]);
+                ++Count;
+            }
+        }
+        End.Segment = Seg.Number;
+        End.Slot = Slot;
+        File->close();
     }
+    return Count;
+}
+
+/// where the last batch of getSensorDataBatch() ended
+static LogMark BatchEnd;
+
+#if BACKLOGPREFETCH
+/// The batch that the prefetch thread reads while the uploader sends the one
+/// in front of it. Only one of the two threads uses the log at a time, the
+/// uploader waits for Done before it touches the log again
+struct LogPrefetch {
+    /// the log and the port layout of the batch
+    const char *Dir;
+    LogHeader Current;
+
+    /// the frames and how many of them there may be
+    SampleFrame *Frames;
+    size_t MaxFrames;
+
+    /// where the batch starts and ends in the log
+    LogMark From;
+    LogMark First;
+    LogMark End;
 
-    memset(Line, 0, LINESIZE + 1);
+    /// how many records were read
+    size_t Count;
 
-    // reset file position
-    fseek(DataFile, flocation, SEEK_SET);
+    /// the prefetch thread was started, it reads a batch, and the batch can
+    /// be taken
+    bool Started;
+    bool Busy;
+    bool Ready;
+};
 
-    // at this point, you need get the remaining data into a different file
-    // We do not need to eat up all the memory, so we will do it in steps
+static LogPrefetch Prefetch;
 
-    // use constant backup filename
-    const char TempFileName[] = {"/sd/#~TemporaryFile.dat~#"};
+/// tells the prefetch thread that a batch is wanted, and the uploader that
+/// it was read
+static EventFlags PrefetchFlags;
+#define PREFETCHWANTED (1)
+#define PREFETCHDONE (2)
 
-    // open the file with that temp name
-    FILE *TempFile = fopen(TempFileName, "wb");
+static Thread PrefetchThread(osPriorityNormal, PREFETCHSTACKSIZE, NULL,
+                             "prefetch");
 
-    // stop if the file was not able to be opened
-    if (TempFile == NULL) {
-        printf("Failed to open temporary file!\n");
-        return true; // data still needs to be transmitted
+// reads the batch in Prefetch whenever one is wanted
+static void runPrefetch() {
+    while (true) {
+        PrefetchFlags.wait_any(PREFETCHWANTED);
+        Prefetch.Count =
+            readBatch(Prefetch.Dir, Prefetch.Current, Prefetch.Frames,
+                      Prefetch.MaxFrames, Prefetch.From, Prefetch.First,
+                      Prefetch.End);
+        PrefetchFlags.set(PREFETCHDONE);
     }
+}
 
-    // transfer file contents
+// waits until the prefetch thread is done with the log
+static void waitPrefetch() {
+    if (Prefetch.Busy) {
+        PrefetchFlags.wait_any(PREFETCHDONE);
+        Prefetch.Busy = false;
+    }
+}
 
-    while (fgets(Line, LINESIZE, DataFile) != NULL) {
-        fputs(Line, TempFile);
-        memset(Line, 0, LINESIZE + 1);
+// moves the prefetched batch into Frames if it starts at the oldest unsent
+// record and has the ports of Current
+static bool takePrefetch(const char *LogDir, const LogHeader &Current,
+                         SampleFrame *Frames, size_t MaxFrames,
+                         size_t &Count) {
+    if (!Prefetch.Ready) {
+        return false;
+    }
+    Prefetch.Ready = false;
+    if (Prefetch.Count == 0 || Prefetch.Count > MaxFrames ||
+        strcmp(Prefetch.Dir, LogDir) != 0 ||
+        memcmp(Prefetch.Current.Ports, Current.Ports,
+               sizeof(Current.Ports)) != 0) {
+        return false;
     }
 
-    // close the data file
-    fclose(DataFile);
-    fclose(TempFile);
+    // the records in front of it have to be sent, nothing else can have
+    // moved the log on
+    size_t i = 0;
+    while (i < Index.Count &&
+           Index.Segments[i].Acked >= Index.Segments[i].Records) {
+        ++i;
+    }
+    if (i == Index.Count || Index.Segments[i].Number != Prefetch.First.Segment ||
+        Index.Segments[i].Acked != Prefetch.First.Slot) {
+        return false;
+    }
 
-    remove(FileName); // rename the DataFile
-    rename(TempFileName, FileName);
-    return true; // still data to read (probably)
+    if (Frames != Prefetch.Frames) {
+        memcpy(Frames, Prefetch.Frames, Prefetch.Count * sizeof(SampleFrame));
+    }
+    Count = Prefetch.Count;
+    BatchEnd = Prefetch.End;
+    return true;
 }
 
 // ============================================================================
-vector<PortInfo> getSensorDataFromFile(BoardSpecs &Specs,
-                                       const char *FileName) {
-    FILE *DataFile = fopen(FileName, "rb");
+void prefetchSensorDataBatch(BoardSpecs &Specs, const char *LogDir,
+                             SampleFrame *Frames, size_t MaxFrames) {
+    waitPrefetch();
+    closeStage();
+    loadIndex(LogDir);
 
-    // if the file is not there, just return an empty vector
-    if (DataFile == NULL) {
-        printf("Data file not found!\n");
-        return std::vector<PortInfo>(0);
+    // the port layout is taken here, Specs may change while it reads
+    Prefetch.Dir = LogDir;
+    makeHeader(Specs, Prefetch.Current);
+    Prefetch.Frames = Frames;
+    Prefetch.MaxFrames = MaxFrames;
+    Prefetch.From = BatchEnd;
+    Prefetch.Busy = true;
+    Prefetch.Ready = true;
+    if (!Prefetch.Started) {
+        PrefetchThread.start(runPrefetch);
+        Prefetch.Started = true;
     }
+    PrefetchFlags.set(PREFETCHWANTED);
+}
 
-    // get the data for the ports
-    // only get the data for ports where the multiplier != 0
-    int Size = 0;
-    int End = Specs.Ports.size();
-    for (int i = 0; i < End; ++i) {
+// drops the prefetched batch, the log changed under it
+static void forgetPrefetch() { Prefetch.Ready = false; }
+#else
+static void waitPrefetch() {}
+static void forgetPrefetch() {}
+#endif
 
-        if (Specs.Ports[i].Multiplier != 0.0f) {
-            ++Size;
-        }
+// ============================================================================
+/// The segment that compactSegment() writes. Its blocks are made in
+/// Stage.Buffer, which is empty while the stage is closed
+struct LogCompaction {
+    FileHandle *File;
+    LogHeader Header;
+    size_t Used;
+    uint32_t Count;
+    FrameCodec Codec;
+
+    /// how many records were written, and when the first and last are from
+    uint32_t Records;
+    uint32_t FirstTime;
+    uint32_t LastTime;
+
+    bool Failed;
+};
+
+// writes the records in Stage.Buffer to the file of Out as one block
+static void compactBlock(LogCompaction &Out) {
+    if (Out.Count == 0) {
+        return;
+    }
+    sealBlock(Out.Header, Out.File->tell(), Stage.Buffer, Out.Used,
+              Out.Count);
+    if (!writeAll(Out.File, Stage.Buffer, Out.Used)) {
+        Out.Failed = true;
+    }
+    Out.Count = 0;
+}
+
+// adds Frame to the segment that Out writes
+static void compactRecord(LogCompaction &Out, const SampleFrame &Frame) {
+    if (Out.Count > 0 && Out.Used + FRAMECODEDMAX > sizeof(Stage.Buffer)) {
+        compactBlock(Out);
+    }
+    if (Out.Count == 0) {
+        Out.Used = sizeof(LogBlock);
+        Out.Codec.reset();
     }
-    // init vector to read data into
-    vector<PortInfo> output(Size);
-    char Line[LINESIZE + 1];
-    Line[LINESIZE] = 0;
+    Out.Used += Out.Codec.encode(
+        Frame, reinterpret_cast<uint8_t *>(Stage.Buffer) + Out.Used);
+    ++Out.Count;
+    if (Out.Records++ == 0) {
+        Out.FirstTime = Frame.Timestamp;
+    }
+    Out.LastTime = Frame.Timestamp;
+}
 
-    for (int i = 0; i < Size; ++i) {
+/// the segments with a lower Number were already compacted, or only hold
+/// summaries. It starts over with every boot
+static uint32_t CompactFrom = 0;
 
-        // grab all the data
-        fgets(Line, LINESIZE, DataFile);
+// replaces the unsent records of segment i of Index with their FrameMean,
+// FrameMin and FrameMax over windows of LOGCOMPACTWINDOW seconds. The
+// summaries go into a .tmp file first, which then takes the place of the
+// segment. The stage has to be closed.
+// returns true if the segment got smaller
+static bool compactSegment(const char *LogDir, size_t i) {
+    LogSegment &Seg = Index.Segments[i];
+    CompactFrom = Seg.Number + 1;
 
-        output[i].Name = strtok(Line, ",");
+    LogHeader Header;
+    uint32_t Records;
+    FileHandle *In = openSegment(LogDir, Seg.Number, Header, Records);
+    if (In == NULL) {
+        return false;
+    }
 
-        char *number = strtok(NULL, ",");
+    // a segment that starts with a summary was compacted before, or was
+    // written by the aggregator
+    SampleFrame Frame;
+    startReading(In, Header, Seg.Acked);
+    if (!readNext(Frame) || Frame.Kind != FrameReading) {
+        In->close();
+        return false;
+    }
 
-        output[i].Value = atof(number);
+    // the summaries are written in the current version and encryption, with
+    // the same ports
+    LogPath Name = segmentName(LogDir, Seg.Number);
+    LogPath Temp = Name;
+    memcpy(Temp.Name + strlen(Temp.Name) - 3, "tmp", 3);
+    LogCompaction Out;
+    Out.File = openFile(Temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC);
+    Out.Used = 0;
+    Out.Count = 0;
+    Out.Records = 0;
+    Out.FirstTime = 0;
+    Out.LastTime = 0;
+    if (Out.File == NULL) {
+        In->close();
+        return false;
+    }
+    LogHeader &Compact = Out.Header;
+    Compact = Header;
+    Compact.Version = LOGVERSION;
+    Compact.RecordSize = sizeof(LogBlock);
+    Compact.HeaderSize = LOGENCRYPT ? sizeof(LogHeader)
+                                    : offsetof(LogHeader, Seal);
+    Compact.CRC = logCRC(&Compact, offsetof(LogHeader, CRC));
+    Out.Failed = !sealHeader(Compact) ||
+                 !writeAll(Out.File, &Compact, Compact.HeaderSize);
 
-        output[i].Description = strtok(NULL, "\n");
+    // summaries and bursts that are in there already are kept as they are
+    WindowAggregator Window(LOGCOMPACTWINDOW);
+    SampleFrame Ready[AGGREGATEFRAMES];
+    startReading(In, Header, Seg.Acked);
+    for (uint32_t Slot = Seg.Acked; Slot < Seg.Records && !Out.Failed;
+         ++Slot) {
+        if (!readNext(Frame)) {
+            continue;
+        }
+        size_t Count = 1;
+        if (Frame.Kind == FrameReading) {
+            Count = Window.push(Frame, Ready);
+        } else {
+            Ready[0] = Frame;
+        }
+        for (size_t j = 0; j < Count; ++j) {
+            compactRecord(Out, Ready[j]);
+        }
+    }
+    size_t Count = Window.flush(Ready);
+    for (size_t j = 0; j < Count; ++j) {
+        compactRecord(Out, Ready[j]);
+    }
+    compactBlock(Out);
+    In->close();
 
-        output[i].Multiplier = 1.0f;
+    bool Smaller = !Out.Failed && Out.Records < Seg.Records - Seg.Acked;
+    if (Out.File->close() != 0 || !Smaller) {
+        remove(Temp.c_str());
+        return false;
     }
-    fclose(DataFile);
-    return output;
+
+    // LittleFS replaces the segment in one step, the FAT has to lose it
+    // first
+    if (rename(Temp.c_str(), Name.c_str()) != 0) {
+        remove(Name.c_str());
+        if (rename(Temp.c_str(), Name.c_str()) != 0) {
+            tr_error("Could not put the compacted %s in place", Name.c_str());
+            remove(Temp.c_str());
+            return false;
+        }
+    }
+#if BACKUPSTORE == BACKUPSTORETIERED
+    // the compacted segment is back in the flash
+    remove(coldSegmentName(LogDir, Seg.Number).c_str());
+#endif
+    tr_info("Compacted %lu backup records of %s into %lu summaries",
+            (unsigned long)(Seg.Records - Seg.Acked), Name.c_str(),
+            (unsigned long)Out.Records);
+    Seg.Records = Out.Records;
+    Seg.Acked = 0;
+    Seg.FirstTime = Out.FirstTime;
+    Seg.LastTime = Out.LastTime;
+    return true;
 }
 
 // ============================================================================
-bool checkForBackupFile(const char *FileName) {
-    // try to open the file to see if it is there.
-    FILE *BackupFile = fopen(FileName, "rb");
+void compactSensorData(const char *LogDir) {
+#if LOGCOMPACTFILL
+    struct statvfs Info;
+    if (statvfs(LogDir, &Info) != 0 || Info.f_blocks == 0 ||
+        (uint64_t)(Info.f_blocks - Info.f_bfree) * 100 <
+            (uint64_t)Info.f_blocks * LOGCOMPACTFILL) {
+        return;
+    }
 
-    if (BackupFile == NULL)
+    waitPrefetch();
+    closeStage();
+    loadIndex(LogDir);
+
+#if BACKLOGQUERY
+    // the segments that were only kept for a query make room first
+    if (Index.Count > 0 &&
+        Index.Segments[0].Acked >= Index.Segments[0].Records) {
+        dropSentSegments(LogDir, 0);
+        storeIndex(LogDir);
+        return;
+    }
+#endif
+
+    // the newest segment keeps its raw readings
+    for (size_t i = 0; i + 1 < Index.Count; ++i) {
+        const LogSegment &Seg = Index.Segments[i];
+        if (Seg.Number < CompactFrom || Seg.Acked >= Seg.Records) {
+            continue;
+        }
+        if (compactSegment(LogDir, i)) {
+            // what the uploader read of the log is no longer there
+            forgetPrefetch();
+            BatchEnd.Segment = 0;
+            BatchEnd.Slot = 0;
+            storeIndex(LogDir);
+            trimBackupStore();
+            return;
+        }
+    }
+#endif
+}
+
+// ============================================================================
+LogClass logClass(const SampleFrame &Frame) {
+    switch (Frame.Kind) {
+    case FrameReading:
+        return (Frame.OverMask | Frame.UnderMask) != 0 ? LogEvents
+                                                       : LogReadings;
+    case FrameBurst:
+        return LogEvents;
+    default:
+        return LogSummaries;
+    }
+}
+
+// ============================================================================
+bool dumpSensorDataToFile(BoardSpecs &Specs, const SampleFrame &Frame,
+                          const char *LogDir) {
+    LogHeader Current;
+    makeHeader(Specs, Current);
+    waitPrefetch();
+    if (!openStage(LogDir, Current)) {
         return false;
+    }
+
+    if (Stage.Used + FRAMECODEDMAX > sizeof(Stage.Buffer)) {
+        flushStage();
+    }
+    if (Stage.Used == 0) {
+        // every block is packed on its own, so it can be read on its own
+        Stage.OldestMs = Kernel::get_ms_count();
+        Stage.Used = sizeof(LogBlock);
+        Stage.Codec.reset();
+    }
+
+    LogSegment &Seg = Index.Segments[Index.Count - 1];
+    if (stagedRecords() == 0) {
+        Seg.FirstTime = Frame.Timestamp;
+    }
+    Seg.LastTime = Frame.Timestamp;
+
+    Stage.Used += Stage.Codec.encode(
+        Frame, reinterpret_cast<uint8_t *>(Stage.Buffer) + Stage.Used);
+    ++Stage.Count;
 
-    fclose(BackupFile);
+    // a full segment is closed, the next record starts a new one
+    if (stagedRecords() >= LOGSEGMENTRECORDS) {
+        closeStage();
+    }
+
+    // do not let readings sit in RAM for too long
+    flushSensorData(LOGFLUSHMS);
     return true;
 }
+
+// ============================================================================
+void flushSensorData(uint32_t MaxAgeMs) {
+    waitPrefetch();
+    if (Stage.Used == 0) {
+        return;
+    }
+    if (MaxAgeMs == 0) {
+        closeStage();
+    } else if (Kernel::get_ms_count() - Stage.OldestMs >= MaxAgeMs) {
+        flushStage();
+    }
+}
+
+// ============================================================================
+bool sensorDataStaged() { return Stage.Used != 0; }
+
+// ============================================================================
+void releaseSensorData() {
+    waitPrefetch();
+    closeStage();
+    forgetPrefetch();
+    IndexDir[0] = 0;
+    KeptCount = 0;
+    CompactFrom = 0;
+}
+
+//=============================================================================
+bool deleteDataEntry(BoardSpecs &Specs, const char *LogDir) {
+    return deleteDataEntries(Specs, LogDir, 1);
+}
+
+//=============================================================================
+// 1. go to the first unsent record of the oldest segment
+// 2. move Acked past the oldest Count valid records, across segments
+// 3. drop the segments that are all sent and store the index
+bool deleteDataEntries(BoardSpecs &Specs, const char *LogDir, size_t Count) {
+    tr_debug("Deleting %u data entries!", Count);
+
+    waitPrefetch();
+    // the staged records have to be in the segment before it is read
+    closeStage();
+    loadIndex(LogDir);
+
+    for (size_t i = 0; i < Index.Count && Count > 0; ++i) {
+        LogSegment &Seg = Index.Segments[i];
+        if (Seg.Acked >= Seg.Records) {
+            continue;
+        }
+
+        LogHeader Header;
+        uint32_t Records;
+        FileHandle *File = openSegment(LogDir, Seg.Number, Header, Records);
+        if (File == NULL) {
+            // nothing in a missing segment can be sent
+            Seg.Acked = Seg.Records;
+            continue;
+        }
+
+        // records that fail the CRC check are skipped like the reader does
+        SampleFrame Frame;
+        startReading(File, Header, Seg.Acked);
+        while (Count > 0 && Seg.Acked < Seg.Records) {
+            if (readNext(Frame)) {
+                --Count;
+            }
+            ++Seg.Acked;
+        }
+        File->close();
+    }
+
+    dropSentSegments(LogDir, BACKLOGQUERY ? LOGKEEPSENT : 0);
+    storeIndex(LogDir);
+    return checkForBackupFile(LogDir);
+}
+
+// ============================================================================
+bool getSensorDataFromFile(BoardSpecs &Specs, const char *LogDir,
+                           SampleFrame &Frame) {
+    Frame.clear();
+    return getSensorDataBatch(Specs, LogDir, &Frame, 1) == 1 &&
+           Frame.PortMask != 0;
+}
+
+// ============================================================================
+size_t getSensorDataBatch(BoardSpecs &Specs, const char *LogDir,
+                          SampleFrame *Frames, size_t MaxFrames) {
+    waitPrefetch();
+    // the staged records have to be in the segment before it is read
+    closeStage();
+    loadIndex(LogDir);
+
+    // the ports in the log may not be the ports that are configured now
+    LogHeader Current;
+    makeHeader(Specs, Current);
+
+#if BACKLOGPREFETCH
+    size_t Count;
+    if (takePrefetch(LogDir, Current, Frames, MaxFrames, Count)) {
+        return Count;
+    }
+#endif
+    LogMark From = {0, 0};
+    LogMark First;
+    return readBatch(LogDir, Current, Frames, MaxFrames, From, First,
+                     BatchEnd);
+}
+
+#if BACKLOGQUERY
+// sets Sequence to the number of the first record of segment i of Index
+// returns false if it can not be read or has no number
+static bool firstSequence(const char *LogDir, size_t i, uint32_t &Sequence) {
+    LogHeader Header;
+    uint32_t Records;
+    FileHandle *File =
+        openSegment(LogDir, Index.Segments[i].Number, Header, Records);
+    if (File == NULL) {
+        return false;
+    }
+    SampleFrame Frame;
+    startReading(File, Header, 0);
+    bool Found = Records > 0 && readNext(Frame) && Frame.Sequence != 0;
+    File->close();
+    Sequence = Frame.Sequence;
+    return Found;
+}
+
+// finds the last segment of Index whose first record has a number of
+// Sequence or less, the one that Sequence is in if it is in the log. The
+// numbers go up through the log, so it is a binary search that reads one
+// block of a few segments. A segment without numbers is taken for an
+// older one
+static size_t findSequence(const char *LogDir, uint32_t Sequence) {
+    size_t Low = 0;
+    size_t High = Index.Count;
+    while (High - Low > 1) {
+        size_t Mid = Low + (High - Low) / 2;
+        uint32_t First;
+        if (!firstSequence(LogDir, Mid, First) || First <= Sequence) {
+            Low = Mid;
+        } else {
+            High = Mid;
+        }
+    }
+    return Low;
+}
+
+// ============================================================================
+size_t querySensorData(BoardSpecs &Specs, const char *LogDir,
+                       const LogQuery &Query, SampleFrame *Frames,
+                       size_t MaxFrames) {
+    waitPrefetch();
+    // the staged records have to be in the segment before it is read
+    closeStage();
+    loadIndex(LogDir);
+
+    LogHeader Current;
+    makeHeader(Specs, Current);
+
+    bool BySequence = Query.By == LOGQUERYSEQUENCE;
+    size_t Start = BySequence ? findSequence(LogDir, Query.From) : 0;
+    uint32_t Skip = Query.Done;
+    size_t Count = 0;
+    bool Past = false;
+    for (size_t i = Start; i < Index.Count && Count < MaxFrames && !Past;
+         ++i) {
+        // the times of a segment are in the index, a segment outside of
+        // the range is not opened
+        const LogSegment &Seg = Index.Segments[i];
+        if (Seg.Records == 0 ||
+            (!BySequence &&
+             (Seg.LastTime < Query.From || Seg.FirstTime > Query.To))) {
+            continue;
+        }
+
+        LogHeader Header;
+        uint32_t Records;
+        FileHandle *File = openSegment(LogDir, Seg.Number, Header, Records);
+        if (File == NULL) {
+            continue;
+        }
+        SampleFrame Frame;
+        startReading(File, Header, 0);
+        for (uint32_t Slot = 0;
+             Slot < Seg.Records && Count < MaxFrames && !Past; ++Slot) {
+            if (!readNext(Frame)) {
+                continue;
+            }
+            uint32_t Key = BySequence ? Frame.Sequence : Frame.Timestamp;
+            if (Key == 0 || Key < Query.From) {
+                continue;
+            }
+            if (Key > Query.To) {
+                // the numbers only go up, the times may go back when the
+                // clock is set
+                Past = BySequence;
+            } else if (Key == Query.From && Skip > 0) {
+                --Skip;
+            } else {
+                remapFrame(Header, Current, Frame, Frames[Count++]);
+            }
+        }
+        File->close();
+    }
+    return Count;
+}
+
+// ============================================================================
+void advanceQuery(LogQuery &Query, const SampleFrame *Frames, size_t Count) {
+    if (Count == 0) {
+        return;
+    }
+    // the records with the same key as the last one are skipped next time
+    uint32_t Last = Query.By == LOGQUERYSEQUENCE ? Frames[Count - 1].Sequence
+                                                 : Frames[Count - 1].Timestamp;
+    uint32_t Same = 0;
+    for (size_t i = 0; i < Count; ++i) {
+        uint32_t Key = Query.By == LOGQUERYSEQUENCE ? Frames[i].Sequence
+                                                    : Frames[i].Timestamp;
+        Same += Key == Last;
+    }
+    Query.Done = Last == Query.From ? Query.Done + Same : Same;
+    Query.From = Last;
+}
+#endif
+
+// ============================================================================
+size_t pendingSensorData(const char *LogDir) {
+    // the prefetch thread only reads Index, so it is only waited for if
+    // the index of another LogDir has to be loaded. A log that was counted
+    // before has no staged records, they are written when it is left
+    if (strcmp(IndexDir, LogDir) != 0) {
+        LogUnsent *Kept = keptUnsent(LogDir);
+        if (Kept != NULL) {
+            return Kept->Unsent;
+        }
+        waitPrefetch();
+        closeStage();
+        loadIndex(LogDir);
+    }
+
+    // staged records count as well
+    return Unsent + Stage.Count;
+}
+
+// ============================================================================
+bool checkForBackupFile(const char *LogDir) {
+    return pendingSensorData(LogDir) > 0;
+}
@@ -3,37 +3,373 @@
 /// \file
 /// \brief Has prototypes for functions that log data that cannot be sent to a
 /// database
-
+///
+/// The backup log is a directory of segment files, 000000.seg, 000001.seg
+/// and so on. Every segment starts with a LogHeader that holds the port table
+/// of the board that wrote it, followed by blocks of up to LOGSEGMENTRECORDS
+/// records in all. A block is a LogBlock and the records packed with
+/// FrameCodec.h, as the changes from the record before, and is written in
+/// one go when the records staged in RAM are flushed. A block whose head was
+/// damaged, or that was cut off by a power cut, is skipped by looking for
+/// the next head whose block has the right CRC32. On FAT, a new segment
+/// gets LOGSEGMENTEXTENT bytes of the card in one piece and filled with
+/// zeros, so a block is written without the FAT being searched or changed.
+/// A head of all zeros ends the written part of it. Segments of version 1
+/// have fixed size LogRecords instead, they are still read but never
+/// written. Records are never removed from the front of a segment, but a
+/// nearly full store has its oldest raw readings summed up, see
+/// compactSensorData(). The
+/// index.dat file in the directory holds a LogIndex, which has the time
+/// range, the record count and the number of sent records of every segment.
+/// A segment is only deleted once all of its records were sent, so dropping
+/// sent data costs one remove() no matter how big the backlog is. A change
+/// of the counts or times of a few segments, which every flush and every
+/// ack makes, is appended to index.jnl as a LogJournalEntry instead of
+/// writing index.dat again. See LogJournalEntry.
+///
+/// With BACKLOGQUERY the server can ask for a range of the log again, by
+/// time or by sequence number, see querySensorData(). The last
+/// LOGKEEPSENT segments that were all sent are kept for that, so a gap
+/// that the server finds in what it stored can still be filled. The range
+/// is found in the index: a time range from the times of the segments
+/// without reading any of them, a range of numbers with a binary search
+/// over the first record of the segments. Only the segments that hold the
+/// range are read, from their first block.
+///
+/// With BACKLOGPRIORITY the frames are kept in a log of their own for every
+/// LogClass, each with its index and its count of sent records, and the
+/// uploader sends the events first, then the summaries and then the raw
+/// readings. After a long outage the server has the alarms and the hourly
+/// figures right away, and the readings from days ago come after. The
+/// unsent count of every log is kept in RAM, so looking at the classes
+/// does not load their indexes. Only the raw readings are compacted and
+/// can be asked for again with BACKLOGQUERY.
+///
+/// With LOGENCRYPT the records of the blocks are encrypted, see LogCipher.h.
+/// Such a segment has a LogSeal after its header, and a HeaderSize of
+/// sizeof(LogHeader). A segment without it, one from before or written with
+/// "backlog-encrypt" off, ends its header at the LogSeal and is still read.
 #include "BoardConfig.h"
 
 #include <vector>
 
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 
+#include "LogCipher.h"
 #include "Structs.h"
-/// The maximum number of characters for a line in a file when getting backup
-/// data.
-#define LINESIZE 128
+
+/// The size of the buffer used to copy the backup file around
+#define COPYBUFFERSIZE (512)
+
+/// Identifies a binary backup log, "IACL" in little endian
+#define LOGMAGIC (0x4C434149)
+
+/// Version of the segment layout that is written, 1 had LogRecords and 2 has
+/// LogBlocks
+#define LOGVERSION (2)
+
+/// Records are staged in RAM and written to the log as a block of at most
+/// this many bytes, one SD card sector
+#define LOGSTAGESIZE (512)
+
+/// Staged records are written to the log once the oldest of them is this
+/// many milliseconds old
+#define LOGFLUSHMS (60000)
+
+/// Longest port name stored in the log's port table, including the '\0'
+#define LOGNAMELEN (16)
+
+/// How full the backup log's filesystem may get, in percent, before its
+/// oldest raw readings are replaced with summaries, 0 never does. Set with
+/// "backlog-compact-fill" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_COMPACT_FILL
+#define LOGCOMPACTFILL MBED_CONF_APP_BACKLOG_COMPACT_FILL
+#else
+#define LOGCOMPACTFILL (90)
+#endif
+
+/// The window in seconds that compactSensorData() sums the readings up over
+#define LOGCOMPACTWINDOW (900)
+
+/// Set to 1 to read the next batch of the backlog on a thread of its own
+/// while the current one is sent, see prefetchSensorDataBatch(). Set with
+/// "backlog-prefetch" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_PREFETCH
+#define BACKLOGPREFETCH MBED_CONF_APP_BACKLOG_PREFETCH
+#else
+#define BACKLOGPREFETCH 1
+#endif
+
+/// The stack size of the prefetch thread, it opens and reads segments.
+/// Set with "prefetch-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_PREFETCH_STACK_SIZE
+#define PREFETCHSTACKSIZE MBED_CONF_APP_PREFETCH_STACK_SIZE
+#else
+#define PREFETCHSTACKSIZE (3072)
+#endif
+
+/// Set to 1 to let the server ask for a range of the backlog again, see
+/// querySensorData(). Set with "backlog-query" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_QUERY
+#define BACKLOGQUERY MBED_CONF_APP_BACKLOG_QUERY
+#else
+#define BACKLOGQUERY 0
+#endif
+
+/// How many of the segments whose records were all sent are kept for
+/// querySensorData(), the oldest are removed first. A store that gets
+/// LOGCOMPACTFILL percent full drops them before it compacts anything. Set
+/// with "backlog-keep-sent" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_KEEP_SENT
+#define LOGKEEPSENT MBED_CONF_APP_BACKLOG_KEEP_SENT
+#else
+#define LOGKEEPSENT (8)
+#endif
+
+/// Set to 1 to send the events and the summaries of the backlog before its
+/// raw readings, see LogClass. Set with "backlog-priority" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_PRIORITY
+#define BACKLOGPRIORITY MBED_CONF_APP_BACKLOG_PRIORITY
+#else
+#define BACKLOGPRIORITY 0
+#endif
+
+/// What a LogQuery asks for
+#define LOGQUERYTIME (0)
+#define LOGQUERYSEQUENCE (1)
 
 using namespace std;
 
-/// Deletes data entries store in FileName 
-/// It deletes N entries where N is the number of ports currently active.
-/// It also deletes the backup file when no entries are left.
-bool deleteDataEntry(BoardSpecs &Specs, const char *FileName);
+/// One entry of the log's port table
+struct LogPortEntry {
+    /// Name of the port, cut off at LOGNAMELEN - 1 characters
+    char Name[LOGNAMELEN];
+
+    /// Multiplier the port had when the log was written
+    float Multiplier;
+};
+
+/// What follows the LogHeader of an encrypted segment
+struct LogSeal {
+    uint8_t Nonce[LOGNONCESIZE]; ///< of the counters of the segment
+    uint32_t KeyCheck;           ///< says which key encrypted it
+    uint32_t CRC;                ///< CRC32 of everything above
+};
+
+/// The start of every backup log
+struct LogHeader {
+    uint32_t Magic;       ///< always LOGMAGIC
+    uint16_t Version;     ///< LOGVERSION, or 1 in an older segment
+    uint16_t RecordSize;  ///< sizeof(LogRecord) in version 1, else
+                          ///< sizeof(LogBlock) of the writer
+    uint16_t PortCount;   ///< number of used entries in Ports
+    uint16_t HeaderSize;  ///< sizeof(LogHeader) of the writer if it is
+                          ///< encrypted, else where Seal starts
+    LogPortEntry Ports[FRAMEMAXPORTS]; ///< port i of every record
+    uint32_t CRC;         ///< CRC32 of everything above
+    LogSeal Seal;         ///< only there if the segment is encrypted
+};
+
+/// One sample frame in a backup log of version 1
+struct LogRecord {
+    SampleFrameV1 Frame; ///< the reading
+    uint32_t CRC;        ///< CRC32 of Frame
+};
+
+/// The start of a block of packed records, which follow it
+struct LogBlock {
+    uint32_t CRC;   ///< CRC32 of Count, Size and the packed records
+    uint16_t Count; ///< how many records are in the block
+    uint16_t Size;  ///< how many bytes the packed records take
+};
+
+/// Records in one segment file. With 16 slowly changing ports a full
+/// segment is about 5 KB, it was 12 KB with LogRecords
+#define LOGSEGMENTRECORDS (256)
+
+/// The bytes that are set aside for a new segment on FAT, whole clusters in
+/// one piece. Hardly changing ports fill less of it, and a segment that
+/// needs more grows past it as any file would
+#define LOGSEGMENTEXTENT (16384)
+
+/// The most segments a backup log keeps. When a new segment is needed and
+/// the index is full, the oldest segment is dropped even if it was not sent.
+#define LOGMAXSEGMENTS (64)
+
+/// Version of the LogIndex layout
+#define LOGINDEXVERSION (1)
+
+/// One segment file of a backup log
+struct LogSegment {
+    uint32_t Number;    ///< the file is named after it, "%06lu.seg"
+    uint32_t FirstTime; ///< Timestamp of the first record
+    uint32_t LastTime;  ///< Timestamp of the last record
+    uint32_t Records;   ///< how many records are in the file
+    uint32_t Acked;     ///< how many records at the front were sent
+};
+
+/// The index.dat of a backup log directory
+struct LogIndex {
+    uint32_t Magic;      ///< always LOGMAGIC
+    uint16_t Version;    ///< always LOGINDEXVERSION
+    uint16_t Count;      ///< number of used entries in Segments
+    uint32_t NextNumber; ///< the Number of the next new segment
+    LogSegment Segments[LOGMAXSEGMENTS]; ///< the oldest segment first
+    uint32_t CRC;        ///< CRC32 of everything above
+};
+
+/// The bytes of index.jnl, one SD card sector. On FAT the file keeps its
+/// size, so an entry is written in place and the FAT is not changed
+#define LOGJOURNALSIZE (512)
+
+/// The Number of the first entry of index.jnl, which says which index.dat
+/// the entries after it belong to
+#define LOGJOURNALBASE (0xFFFFFFFFUL)
+
+/// One entry of index.jnl, the new counts and times of a segment of the
+/// index. The first entry is a base: its Number is LOGJOURNALBASE and its
+/// Records the CRC of the index.dat it belongs to, a journal of another
+/// index is not read. Loading the index applies the entries in order, up to
+/// the first whose CRC fails, so a cut off write loses only itself. An ack
+/// that moves across segments writes the oldest one first, so a reset can
+/// only leave records to be sent again, never skip any. Once the journal is
+/// full or segments are added or removed, index.dat is written and the
+/// journal starts over with a new base
+struct LogJournalEntry {
+    LogSegment Segment; ///< the segment as it is now
+    uint32_t CRC;       ///< CRC32 of Segment
+};
+
+/// How many entries index.jnl holds, with its base
+#define LOGJOURNALENTRIES (LOGJOURNALSIZE / sizeof(LogJournalEntry))
+
+/// The offset of the oldest unsent record in a log from before the
+/// segments, which kept everything in one file with a .cur file next to it
+struct LogCursor {
+    uint32_t Magic;  ///< always LOGMAGIC
+    uint32_t Offset; ///< byte offset of the next record to send
+    uint32_t CRC;    ///< CRC32 of everything above
+};
+
+/// A range of the backup log that querySensorData() reads
+struct LogQuery {
+    uint8_t By;    ///< LOGQUERYTIME or LOGQUERYSEQUENCE
+    uint32_t From; ///< the first Timestamp or Sequence of the range
+    uint32_t To;   ///< the last one, which is in the range as well
+    uint32_t Done; ///< how many records with the key From were read already
+};
+
+/// The classes of the backup log with BACKLOGPRIORITY, in the order they
+/// are sent
+enum LogClass {
+    LogEvents,    ///< readings with a port out of its range, and FrameBurst
+    LogSummaries, ///< the frames of an aggregation window or a compaction
+    LogReadings,  ///< every other reading
+    LOGCLASSES
+};
+
+/// Returns the class of the backup log that Frame goes into
+LogClass logClass(const SampleFrame &Frame);
+
+/// All of these take the backup log's directory as LogDir. It is made if it
+/// is not there. A log from before the segments, LogDir with a .dat
+/// extension, is moved into it as the first segment.
+
+/// Marks the oldest record in LogDir as sent.
+/// Records that fail their CRC check in front of it are skipped as well.
+/// \returns false if there are no more records to send
+bool deleteDataEntry(BoardSpecs &Specs, const char *LogDir);
+
+/// Marks the oldest Count records in LogDir as sent with a single index
+/// write, and deletes the segments that have nothing left to send. Used to
+/// acknowledge a batch from getSensorDataBatch().
+/// \returns false if there are no more records to send
+bool deleteDataEntries(BoardSpecs &Specs, const char *LogDir, size_t Count);
+
+/// Appends the readings in Frame to the newest segment as one record.
+/// A new segment is started, with the port table in Specs in its header,
+/// when the newest one is full or has another port table. The segment is
+/// kept open, and the record is staged
+/// in RAM until LOGSTAGESIZE bytes of records are waiting, the oldest is
+/// LOGFLUSHMS old, or flushSensorData() is called. The other functions here
+/// write the staged records out before they read the file.
+/// \returns false if no segment could be opened, so the record was not kept
+bool dumpSensorDataToFile(BoardSpecs &Specs, const SampleFrame &Frame,
+                          const char *LogDir);
+
+/// Writes the staged records to the newest segment if the oldest of them has
+/// waited MaxAgeMs milliseconds. With 0 they are always written, and the
+/// file is closed, which is what has to happen before a reset.
+void flushSensorData(uint32_t MaxAgeMs = 0);
+
+/// Returns true if records are staged in RAM and not written yet
+bool sensorDataStaged();
+
+/// Writes the staged records out, closes the segment and forgets the index
+/// and a prefetched batch, so the log can be changed by something else while
+/// its filesystem is unmounted. The index is read again on the next use.
+void releaseSensorData();
+
+/// Reads the oldest unsent record from LogDir into Frame. The ports in the
+/// record are matched to the ports in Specs by name, so records from an older
+/// configuration still end up on the right ports.
+/// \returns false if there was no valid record in the log
+bool getSensorDataFromFile(BoardSpecs &Specs, const char *LogDir,
+                           SampleFrame &Frame);
+
+/// Reads up to MaxFrames of the oldest unsent records into Frames, matching
+/// the ports like getSensorDataFromFile(). A frame can come back without any
+/// ports if none of its ports are configured anymore. The index says where
+/// the oldest unsent record is, so nothing is scanned to find it.
+/// \returns the number of records that were read
+size_t getSensorDataBatch(BoardSpecs &Specs, const char *LogDir,
+                          SampleFrame *Frames, size_t MaxFrames);
+
+#if BACKLOGQUERY
+/// Reads up to MaxFrames records of Query out of LogDir into Frames, in the
+/// order they were logged, with the ports matched like
+/// getSensorDataFromFile(). Records that were sent already are read as
+/// well, as long as their segment is still there, see LOGKEEPSENT. Only
+/// the uploader thread reads the log, so it has to be called from there.
+/// \returns the number of records that were read, 0 once the range is done
+size_t querySensorData(BoardSpecs &Specs, const char *LogDir,
+                       const LogQuery &Query, SampleFrame *Frames,
+                       size_t MaxFrames);
+
+/// Moves Query past the first Count of the Frames that querySensorData()
+/// read, so that the next call reads the records after them
+void advanceQuery(LogQuery &Query, const SampleFrame *Frames, size_t Count);
+#endif
+
+#if BACKLOGPREFETCH
+/// Starts reading up to MaxFrames records that follow the last batch of
+/// getSensorDataBatch() into Frames, on the prefetch thread. The next
+/// getSensorDataBatch() takes them instead of reading the log, if the batch
+/// in front of them was marked as sent and the ports in Specs are the same.
+/// Frames has to stay until then. The other functions here wait for the
+/// read to be done before they use the log.
+void prefetchSensorDataBatch(BoardSpecs &Specs, const char *LogDir,
+                             SampleFrame *Frames, size_t MaxFrames);
+#endif
 
-/// Writes the sensor data in Specs to a file.
-/// It appends data if the file exists, and makes the file if it does not exist
-void dumpSensorDataToFile(BoardSpecs &Specs, const char *FileName);
+/// Once the filesystem of LogDir is LOGCOMPACTFILL percent full, replaces the
+/// unsent raw readings of its oldest segment that still has them with their
+/// FrameMean, FrameMin and FrameMax over LOGCOMPACTWINDOW seconds, like
+/// WindowAggregator does. Readings that left their range keep their
+/// FrameBurst. The newest segment is never compacted, and one segment is
+/// done per call, so it can run in between the uploads. A failed compaction
+/// leaves the segment as it was.
+void compactSensorData(const char *LogDir);
 
-/// Returns a single sensor reading from the file. That includes one sample from
-/// every active sensor. The size of the vector is the same size as the number
-/// of active ports in Specs
-vector<PortInfo> getSensorDataFromFile(BoardSpecs &Specs, const char *FileName);
+/// Returns how many records of LogDir were not sent yet, with the ones that
+/// are staged. The count is kept with the index in RAM, so the log is only
+/// read if another LogDir was used last, and the open segment stays open.
+size_t pendingSensorData(const char *LogDir);
 
-/// Returns true if FileName exists in the current filesystem.
-/// A full file path may be necessary for this function to work.
-bool checkForBackupFile(const char *FileName);
+/// Returns true if LogDir has records that were not sent yet, see
+/// pendingSensorData().
+bool checkForBackupFile(const char *LogDir);
 
 #endif // OFFLINELOGGING
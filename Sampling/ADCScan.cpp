@@ -0,0 +1,717 @@
+/// \file
+/// \brief Implementation of the PDB + eDMA ADC scan engine
+#include "ADCScan.h"
+
+#include "DMAPool.h"
+#include "EnergyMeter.h"
+#include "FlashCache.h"
+#include "PeripheralPins.h"
+#include "debugging.h"
+#include "dma_api.h"
+#include "pinmap.h"
+
+/// ADC conversion clock limit (same limit that analogin_api.c uses)
+#define MAX_FADC 6000000
+
+/// Array of ADC peripheral base addresses.
+static ADC_Type *const adc_addrs[] = ADC_BASE_PTRS;
+
+/// DMA request sources for the conversion complete flag of each ADC
+static const uint32_t adc_dma_requests[SCANADCCOUNT] = {kDmaRequestMux0ADC0,
+                                                        kDmaRequestMux0ADC1};
+
+/// Used to find the owner of a Converter from the DMA callback
+struct ConverterRef {
+    ADCScan *Owner;
+    size_t Instance;
+};
+
+static ConverterRef converter_refs[SCANADCCOUNT];
+
+/// Finds the PDB prescaler and multiplier with the finest tick that can still
+/// count a whole slot in the 16 bit PDB counter.
+/// \returns The PDB modulus for one slot, or 0 if slot_hz is too slow
+static uint32_t findPDBTiming(float slot_hz, uint32_t &prescaler,
+                              uint32_t &mult) {
+    const uint32_t mults[] = {1, 10, 20, 40};
+    uint32_t bus_clock = CLOCK_GetFreq(kCLOCK_BusClk);
+    uint32_t best_divider = 0;
+    uint32_t modulus = 0;
+
+    for (uint32_t m = 0; m < 4; ++m) {
+        for (uint32_t p = 0; p < 8; ++p) {
+            uint32_t divider = (1U << p) * mults[m];
+            float ticks = bus_clock / (float)divider / slot_hz;
+            if (ticks <= 65535.0f &&
+                (best_divider == 0 || divider < best_divider)) {
+                best_divider = divider;
+                modulus = (uint32_t)ticks;
+                prescaler = p;
+                mult = m;
+            }
+        }
+    }
+    return modulus;
+}
+
+/// How analogin_init() converts, and every pin until configure()
+static const ScanFormat default_format = {16, 4, 0};
+
+/// The ADCK divider that keeps the ADC clock within MAX_FADC, same clock
+/// setup as analogin_init()
+static uint32_t adcClockDivider() {
+    uint32_t bus_clock = CLOCK_GetFreq(kCLOCK_BusClk);
+    uint32_t clkdiv;
+    for (clkdiv = 0; clkdiv < 4; clkdiv++) {
+        if ((bus_clock >> clkdiv) <= MAX_FADC)
+            break;
+    }
+    if (clkdiv == 4) {
+        clkdiv = 0x3; // Set max div
+    }
+    return clkdiv;
+}
+
+// rounds a port's settings up to the next ones that the ADC has
+static ScanFormat roundFormat(unsigned bits, unsigned average,
+                              unsigned cycles) {
+    ScanFormat f;
+    f.Bits = bits <= 8 ? 8 : bits <= 10 ? 10 : bits <= 12 ? 12 : 16;
+    f.Average = average <= 1    ? 1
+                : average <= 4  ? 4
+                : average <= 8  ? 8
+                : average <= 16 ? 16
+                                : 32;
+    f.SampleCycles = cycles == 0    ? 0
+                     : cycles <= 2  ? 2
+                     : cycles <= 6  ? 6
+                     : cycles <= 12 ? 12
+                                    : 20;
+    return f;
+}
+
+static bool sameFormat(const ScanFormat &a, const ScanFormat &b) {
+    return a.Bits == b.Bits && a.Average == b.Average &&
+           a.SampleCycles == b.SampleCycles;
+}
+
+// the ADCK cycles of one conversion in f, from the conversion time of the
+// reference manual with the few bus clocks of the start rounded up
+static float conversionCycles(const ScanFormat &f) {
+    uint32_t cycles = f.Bits == 16 ? 25 : f.Bits == 8 ? 17 : 20;
+    return 5.0f + f.Average * (cycles + f.SampleCycles);
+}
+
+// sets the resolution, sample time and averaging of f and the side of the
+// mux in the CFG1, CFG2 and SC3 values of an ADC
+static void applyFormat(const ScanFormat &f, bool b_side, uint32_t &cfg1,
+                        uint32_t &cfg2, uint32_t &sc3) {
+    uint32_t mode = f.Bits == 8 ? 0 : f.Bits == 12 ? 1 : f.Bits == 10 ? 2 : 3;
+    cfg1 &= ~(ADC_CFG1_MODE_MASK | ADC_CFG1_ADLSMP_MASK);
+    cfg1 |= ADC_CFG1_MODE(mode);
+    cfg2 &= ~(ADC_CFG2_MUXSEL_MASK | ADC_CFG2_ADLSTS_MASK);
+    if (b_side) {
+        cfg2 |= ADC_CFG2_MUXSEL_MASK;
+    }
+    if (f.SampleCycles > 0) {
+        // ADLSTS 0 to 3 add 20, 12, 6 and 2 cycles
+        cfg1 |= ADC_CFG1_ADLSMP_MASK;
+        cfg2 |= ADC_CFG2_ADLSTS(f.SampleCycles == 20   ? 0
+                                : f.SampleCycles == 12 ? 1
+                                : f.SampleCycles == 6  ? 2
+                                                       : 3);
+    }
+    sc3 &= ~(ADC_SC3_CAL_MASK | ADC_SC3_CALF_MASK | ADC_SC3_AVGE_MASK |
+             ADC_SC3_AVGS_MASK);
+    if (f.Average > 1) {
+        // AVGS 0 to 3 average 4, 8, 16 and 32
+        sc3 |= ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(f.Average == 4    ? 0
+                                                : f.Average == 8  ? 1
+                                                : f.Average == 16 ? 2
+                                                                  : 3);
+    }
+}
+
+ADCScan::ADCScan(const PinName *pins, size_t count)
+    : Calibrations(0), Dropped(0), Slots(0), Count(0), External(NULL),
+      Extra(0), Published(0), Running(false), Listeners(0) {
+
+    memset(Adc, 0, sizeof(Adc));
+    memset(Calibration, 0, sizeof(Calibration));
+    memset(CalibratedAtMs, 0, sizeof(CalibratedAtMs));
+    memset(Latest, 0, sizeof(Latest));
+    memset(PortShift, 0, sizeof(PortShift));
+    for (size_t i = 0; i < SCANMAXPORTS; ++i) {
+        Format[i] = default_format;
+        Using[i] = default_format;
+    }
+
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        Adc[i].ResultChannel = DMA_ERROR_OUT_OF_CHANNELS;
+        Adc[i].MuxChannel = DMA_ERROR_OUT_OF_CHANNELS;
+    }
+
+    if (count > SCANMAXPORTS) {
+        printf("ADC scan only supports %d pins, ignoring the rest\r\n",
+               SCANMAXPORTS);
+        count = SCANMAXPORTS;
+    }
+
+    // the first pass finds the ADC and the raw channel number of every pin
+    uint32_t pin_channels[SCANMAXPORTS];
+    bool pin_b[SCANMAXPORTS];
+    for (size_t i = 0; i < count; ++i) {
+        ADCName adc = (ADCName)pinmap_peripheral(pins[i], PinMap_ADC);
+        MBED_ASSERT(adc != (ADCName)NC);
+
+        size_t instance = adc >> ADC_INSTANCE_SHIFT;
+        Converter &conv = Adc[instance];
+
+        uint32_t channel = adc & 0x1F;
+        bool b_side = adc & (1 << ADC_B_CHANNEL_SHIFT);
+
+        // channels 4-7 share one a/b mux select per ADC instance
+        pin_b[i] = false;
+        if (channel >= 4 && channel <= 7) {
+            if (b_side) {
+                conv.MuxB = true;
+                pin_b[i] = true;
+            }
+        }
+
+        PortAdc[i] = instance;
+        pin_channels[i] = channel;
+        pinmap_pinout(pins[i], PinMap_ADC);
+    }
+    Count = count;
+
+    // the second pass gives every pin the next free slot of its ADC. The
+    // second port of a pair on the other ADC takes the slot of the first,
+    // which is after the free slots of both
+    bool taken[SCANADCCOUNT][SCANMAXSLOTS];
+    memset(taken, 0, sizeof(taken));
+    size_t next[SCANADCCOUNT] = {0};
+    for (size_t i = 0; i < count; ++i) {
+        size_t instance = PortAdc[i];
+        size_t slot = next[instance];
+#if SCANPAIRS
+        if (i % 2 == 0 && i + 1 < count && PortAdc[i + 1] != instance) {
+            size_t other = next[PortAdc[i + 1]];
+            slot = other > slot ? other : slot;
+        } else if (i % 2 == 1 && PortAdc[i - 1] != instance) {
+            slot = PortSlot[i - 1];
+        }
+#endif
+        MBED_ASSERT(slot < SCANMAXSLOTS);
+        PortSlot[i] = slot;
+        Converter &conv = Adc[instance];
+        conv.SlotChannel[slot] = pin_channels[i];
+        conv.SlotPort[slot] = i;
+        conv.SlotB[slot] = pin_b[i];
+        taken[instance][slot] = true;
+        next[instance] = slot + 1;
+        ++Adc[instance].Used;
+    }
+
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        if (next[i] > Slots) {
+            Slots = next[i];
+        }
+    }
+
+    // both ADCs are triggered by the same PDB cycle, so the one with fewer
+    // pins repeats a channel in the slots it has no pin for, to stay in
+    // step with the other one
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        Converter &conv = Adc[i];
+        if (conv.Used == 0) {
+            continue;
+        }
+        size_t first = 0;
+        while (!taken[i][first]) {
+            ++first;
+        }
+        for (size_t s = 0; s < Slots; ++s) {
+            if (!taken[i][s]) {
+                size_t from = s < first ? first : s - 1;
+                conv.SlotChannel[s] = conv.SlotChannel[from];
+                conv.SlotPort[s] = conv.SlotPort[from];
+                conv.SlotB[s] = conv.SlotB[from];
+            }
+        }
+    }
+}
+
+ADCScan::~ADCScan() { stop(); }
+
+// ============================================================================
+bool ADCScan::extend(ExternalADC *external) {
+    if (Running || Count + external->count() > SCANMAXPORTS) {
+        return false;
+    }
+    External = external;
+    Extra = external->count();
+    return true;
+}
+
+// ============================================================================
+void ADCScan::configure(const vector<PortInfo> &ports) {
+    for (size_t i = 0; i < Count; ++i) {
+        Format[i] = i < ports.size()
+                        ? roundFormat(ports[i].Resolution, ports[i].Averaging,
+                                      ports[i].SampleCycles)
+                        : default_format;
+    }
+}
+
+// copies Format into Using, with less averaging and then less sample time
+// for the pins whose conversion does not fit into a slot at rate_hz
+void ADCScan::fitFormats(float rate_hz) {
+    uint32_t adck = CLOCK_GetFreq(kCLOCK_BusClk) >> adcClockDivider();
+    // the trigger and the register writes of the mux channel take a little
+    // of every slot
+    float slot_cycles = 0.9f * adck / (rate_hz * Slots);
+    for (size_t i = 0; i < Count; ++i) {
+        ScanFormat f = Format[i];
+        while (f.Average > 1 && conversionCycles(f) > slot_cycles) {
+            f.Average = f.Average == 4 ? 1 : f.Average / 2;
+        }
+        while (f.SampleCycles > 0 && conversionCycles(f) > slot_cycles) {
+            f.SampleCycles = f.SampleCycles == 20   ? 12
+                             : f.SampleCycles == 12 ? 6
+                             : f.SampleCycles == 6  ? 2
+                                                    : 0;
+        }
+        // only said once, not at every start in low-power mode
+        if (!sameFormat(f, Format[i]) && !sameFormat(f, Using[i])) {
+            printf("Port %u converts %u averaged with %u sample cycles to fit "
+                   "the scan rate\r\n",
+                   (unsigned)i, f.Average, f.SampleCycles);
+        }
+        Using[i] = f;
+        PortShift[i] = 16 - f.Bits;
+    }
+}
+
+// ============================================================================
+int ADCScan::start(float rate_hz) {
+    if (Running) {
+        stop();
+    }
+
+    if (Count == 0 || rate_hz <= 0.0f) {
+        return -1;
+    }
+
+    dma_init();
+
+    edma_config_t dma_config;
+    EDMA_GetDefaultConfig(&dma_config);
+    EDMA_Init(DMA0, &dma_config);
+
+    // ADC0 and ADC1 take their hardware trigger from the PDB
+    SIM->SOPT7 &= ~(SIM_SOPT7_ADC0ALTTRGEN_MASK | SIM_SOPT7_ADC1ALTTRGEN_MASK);
+
+    Published = 0;
+    fitFormats(rate_hz);
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        if (Adc[i].Used == 0) {
+            continue;
+        }
+        int err = startConverter(i);
+        if (err != SCANSUCCESS) {
+            printf("Failed to start the scan on ADC%d, error = %d\r\n", i,
+                   err);
+            stop();
+            return err;
+        }
+    }
+
+    uint32_t prescaler = 0;
+    uint32_t mult = 0;
+    uint32_t modulus = findPDBTiming(rate_hz * Slots, prescaler, mult);
+    if (modulus < 2) {
+        printf("ADC scan rate of %f Hz can not be reached\r\n", rate_hz);
+        stop();
+        return -2;
+    }
+
+    pdb_config_t pdb_config;
+    PDB_GetDefaultConfig(&pdb_config);
+    pdb_config.loadValueMode = kPDB_LoadValueImmediately;
+    pdb_config.prescalerDivider = (pdb_prescaler_divider_t)prescaler;
+    pdb_config.dividerMultiplicationFactor =
+        (pdb_divider_multiplication_factor_t)mult;
+    pdb_config.triggerInputSource = kPDB_TriggerSoftware;
+    pdb_config.enableContinuousMode = true;
+    PDB_Init(PDB0, &pdb_config);
+
+    PDB_SetModulusValue(PDB0, modulus - 1);
+    PDB_SetCounterDelayValue(PDB0, 0);
+
+    pdb_adc_pretrigger_config_t trigger_config;
+    trigger_config.enablePreTriggerMask = 1U;
+    trigger_config.enableOutputMask = 1U;
+    trigger_config.enableBackToBackOperationMask = 0U;
+
+    // PDB channel n triggers ADCn
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        if (Adc[i].Used != 0) {
+            PDB_SetADCPreTriggerConfig(PDB0, i, &trigger_config);
+            PDB_SetADCPreTriggerDelayValue(PDB0, i, 0, 1);
+        }
+    }
+    PDB_DoLoadValues(PDB0);
+
+    // the pins still work without the external ADC, its channels then stay
+    // at 0
+    if (External != NULL && External->start() != 0) {
+        printf("The external ADC could not be started\r\n");
+    }
+
+    Running = true;
+    energyActive(EnergyADC, true);
+    PDB_DoSoftwareTrigger(PDB0);
+    return SCANSUCCESS;
+}
+
+// ============================================================================
+int ADCScan::startConverter(size_t instance) {
+    ADC_Type *base = adc_addrs[instance];
+    Converter &conv = Adc[instance];
+
+    // the buffers are taken the first time, and kept for every start
+    if (conv.Ring == NULL) {
+        conv.Ring = (uint16_t *)dmaAlloc(
+            SCANDEPTH * SCANMAXSLOTS * sizeof(uint16_t), sizeof(uint16_t));
+        conv.MuxList = (uint32_t *)dmaAlloc(
+            SCANMAXSLOTS * SCANBLOCKWORDS * sizeof(uint32_t),
+            sizeof(uint32_t));
+    }
+    if (conv.Ring == NULL || conv.MuxList == NULL) {
+        return -4;
+    }
+
+    uint32_t clkdiv = adcClockDivider();
+
+    adc16_config_t adc16_config;
+    ADC16_GetDefaultConfig(&adc16_config);
+    adc16_config.clockSource = kADC16_ClockSourceAlt0;
+    adc16_config.clockDivider = (adc16_clock_divider_t)clkdiv;
+    adc16_config.resolution = kADC16_ResolutionSE16Bit;
+    ADC16_Init(base, &adc16_config);
+
+    // calibration has to run with the software trigger
+    ADC16_EnableHardwareTrigger(base, false);
+    calibrate(instance);
+
+    ADC16_SetHardwareAverage(base, kADC16_HardwareAverageCount4);
+    conv.Defaults[0] = base->CFG1;
+    conv.Defaults[1] = base->CFG2;
+    conv.Defaults[2] = base->SC3;
+    conv.Restore = true;
+
+    ADC16_EnableHardwareTrigger(base, true);
+    ADC16_EnableDMA(base, true);
+    fillMuxList(instance);
+
+    conv.ResultChannel = dma_channel_allocate(adc_dma_requests[instance]);
+    if (conv.ResultChannel == DMA_ERROR_OUT_OF_CHANNELS) {
+        return -3;
+    }
+    conv.MuxChannel = dma_channel_allocate(kDmaRequestMux0Disable);
+    if (conv.MuxChannel == DMA_ERROR_OUT_OF_CHANNELS) {
+        return -3;
+    }
+
+    memset(&conv.ResultHandle, 0, sizeof(conv.ResultHandle));
+    memset(&conv.MuxHandle, 0, sizeof(conv.MuxHandle));
+    EDMA_CreateHandle(&conv.ResultHandle, DMA0, conv.ResultChannel);
+    EDMA_CreateHandle(&conv.MuxHandle, DMA0, conv.MuxChannel);
+
+    size_t ring_bytes = SCANDEPTH * Slots * sizeof(uint16_t);
+    edma_transfer_config_t transfer;
+
+    // ADCn_R0 -> Ring, wrapping back to the start after SCANDEPTH frames
+    EDMA_PrepareTransfer(&transfer, (void *)&base->R[0], sizeof(uint16_t),
+                         conv.Ring, sizeof(uint16_t), sizeof(uint16_t),
+                         ring_bytes, kEDMA_PeripheralToMemory);
+    EDMA_SetTransferConfig(DMA0, conv.ResultChannel, &transfer, NULL);
+    DMA0->TCD[conv.ResultChannel].DLAST_SGA = -(int32_t)ring_bytes;
+
+    // start the mux channel after every result, including the last one
+    EDMA_SetChannelLink(DMA0, conv.ResultChannel, kEDMA_MinorLink,
+                        conv.MuxChannel);
+    EDMA_SetChannelLink(DMA0, conv.ResultChannel, kEDMA_MajorLink,
+                        conv.MuxChannel);
+
+    // MuxList -> ADCn_SC1A, one entry per link. The major loop is one frame,
+    // so the major interrupt of this channel marks a completed frame.
+    // A block goes from CFG1 up to CLP4, and the 64 byte modulo wraps the
+    // address around to SC1A and SC1B, where the next block starts again
+    size_t entry_bytes =
+        (conv.Blocks ? SCANBLOCKWORDS : 1) * sizeof(uint32_t);
+    static_assert(SCANBLOCKWORDS * sizeof(uint32_t) == 64,
+                  "the block has to be kEDMA_Modulo64bytes");
+    EDMA_PrepareTransfer(
+        &transfer, conv.MuxList, sizeof(uint32_t),
+        conv.Blocks ? (void *)&base->CFG1 : (void *)&base->SC1[0],
+        sizeof(uint32_t), entry_bytes, Slots * entry_bytes,
+        kEDMA_MemoryToPeripheral);
+    if (conv.Blocks) {
+        transfer.destOffset = sizeof(uint32_t);
+    }
+    EDMA_SetTransferConfig(DMA0, conv.MuxChannel, &transfer, NULL);
+    if (conv.Blocks) {
+        EDMA_SetModulo(DMA0, conv.MuxChannel, kEDMA_ModuloDisable,
+                       kEDMA_Modulo64bytes);
+    }
+    DMA0->TCD[conv.MuxChannel].SLAST = -(int32_t)(Slots * entry_bytes);
+
+    converter_refs[instance].Owner = this;
+    converter_refs[instance].Instance = instance;
+    EDMA_SetCallback(&conv.MuxHandle, &ADCScan::onMuxDone,
+                     &converter_refs[instance]);
+    EDMA_EnableChannelInterrupts(DMA0, conv.MuxChannel,
+                                 kEDMA_MajorInterruptEnable);
+
+    conv.Frames = 0;
+
+    // only the result channel listens to a hardware request
+    EDMA_StartTransfer(&conv.ResultHandle);
+    return SCANSUCCESS;
+}
+
+// writes MuxList for the formats in Using, and sets up the first slot.
+// The ADC has to be set up for the scan already, as the blocks copy the
+// rest of its registers
+void ADCScan::fillMuxList(size_t instance) {
+    ADC_Type *base = adc_addrs[instance];
+    Converter &conv = Adc[instance];
+
+    const ScanFormat &first = Using[conv.SlotPort[0]];
+    conv.Blocks = false;
+    for (size_t s = 0; s < Slots; ++s) {
+        uint32_t channel = conv.SlotChannel[s];
+        bool muxed = channel >= 4 && channel <= 7;
+        if (!sameFormat(Using[conv.SlotPort[s]], first) ||
+            (muxed && conv.SlotB[s] != conv.MuxB)) {
+            conv.Blocks = true;
+        }
+    }
+
+    if (!conv.Blocks) {
+        uint32_t cfg1 = base->CFG1;
+        uint32_t cfg2 = base->CFG2;
+        uint32_t sc3 = base->SC3;
+        applyFormat(first, conv.MuxB, cfg1, cfg2, sc3);
+        base->CFG1 = cfg1;
+        base->CFG2 = cfg2;
+        base->SC3 = sc3;
+        for (size_t s = 0; s < Slots; ++s) {
+            conv.MuxList[s] = ADC_SC1_ADCH(conv.SlotChannel[(s + 1) % Slots]);
+        }
+        // the first slot's channel is the last entry of the rotated list
+        base->SC1[0] = conv.MuxList[Slots - 1];
+        return;
+    }
+
+    // word k of a block is register k + 2, from CFG1 around to SC1B, so the
+    // channel is written once the rest is set up. The writes to R0 and R1
+    // are ignored
+    volatile uint32_t *regs = &base->SC1[0];
+    for (size_t s = 0; s < Slots; ++s) {
+        size_t next = (s + 1) % Slots;
+        uint32_t *block = &conv.MuxList[s * SCANBLOCKWORDS];
+        for (size_t k = 0; k < SCANBLOCKWORDS; ++k) {
+            block[k] = regs[(k + 2) % SCANBLOCKWORDS];
+        }
+        uint32_t channel = conv.SlotChannel[next];
+        bool b_side =
+            channel >= 4 && channel <= 7 ? conv.SlotB[next] : conv.MuxB;
+        applyFormat(Using[conv.SlotPort[next]], b_side, block[0], block[1],
+                    block[7]);
+        block[SCANBLOCKWORDS - 2] = ADC_SC1_ADCH(channel);
+        block[SCANBLOCKWORDS - 1] = ADC_SC1_ADCH(0x1F);
+    }
+
+    const uint32_t *last = &conv.MuxList[(Slots - 1) * SCANBLOCKWORDS];
+    base->CFG1 = last[0];
+    base->CFG2 = last[1];
+    base->SC3 = last[7];
+    base->SC1[0] = last[SCANBLOCKWORDS - 2];
+}
+
+// copies the calibration registers of base into cal, or back
+static void saveCalibration(ADC_Type *base, ScanCalibration &cal) {
+    cal.Offset = base->OFS;
+    cal.PlusGain = base->PG;
+    cal.MinusGain = base->MG;
+    // CLPD to CLP0 and CLMD to CLM0 are next to each other
+    for (size_t i = 0; i < 7; ++i) {
+        cal.Plus[i] = (&base->CLPD)[i];
+        cal.Minus[i] = (&base->CLMD)[i];
+    }
+    cal.Valid = 1;
+}
+
+static void restoreCalibration(ADC_Type *base, const ScanCalibration &cal) {
+    base->OFS = cal.Offset;
+    base->PG = cal.PlusGain;
+    base->MG = cal.MinusGain;
+    for (size_t i = 0; i < 7; ++i) {
+        (&base->CLPD)[i] = cal.Plus[i];
+        (&base->CLMD)[i] = cal.Minus[i];
+    }
+}
+
+// puts back the last calibration of instance while it is recent, and runs
+// the self-calibration again once it is not. It takes a few milliseconds,
+// and the scan can not start until it is done
+void ADCScan::calibrate(size_t instance) {
+    ADC_Type *base = adc_addrs[instance];
+    ScanCalibration &cal = Calibration[instance];
+    uint64_t now = Kernel::get_ms_count();
+    if (cal.Valid &&
+        now - CalibratedAtMs[instance] < SCANCALIBRATIONS * 1000ULL) {
+        restoreCalibration(base, cal);
+        return;
+    }
+    if (ADC16_DoAutoCalibration(base) != kStatus_Success) {
+        printf("ADC%d calibration failed\r\n", instance);
+        // an older calibration is still closer than none
+        if (cal.Valid) {
+            restoreCalibration(base, cal);
+        }
+        return;
+    }
+    saveCalibration(base, cal);
+    CalibratedAtMs[instance] = now;
+    ++Calibrations;
+}
+
+// ============================================================================
+void ADCScan::useCalibration(const ScanCalibration (&cal)[SCANADCCOUNT]) {
+    uint64_t now = Kernel::get_ms_count();
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        if (cal[i].Valid) {
+            Calibration[i] = cal[i];
+            CalibratedAtMs[i] = now;
+        }
+    }
+}
+
+// ============================================================================
+uint32_t ADCScan::calibration(ScanCalibration (&cal)[SCANADCCOUNT]) const {
+    memcpy(cal, Calibration, sizeof(Calibration));
+    return Calibrations;
+}
+
+// ============================================================================
+void ADCScan::stop() {
+    if (Running) {
+        PDB_Enable(PDB0, false);
+        PDB_Deinit(PDB0);
+    }
+    Running = false;
+    energyActive(EnergyADC, false);
+
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        stopConverter(i);
+    }
+    if (External != NULL) {
+        External->stop();
+    }
+}
+
+void ADCScan::stopConverter(size_t instance) {
+    Converter &conv = Adc[instance];
+
+    if (conv.ResultChannel != DMA_ERROR_OUT_OF_CHANNELS) {
+        EDMA_AbortTransfer(&conv.ResultHandle);
+        dma_channel_free(conv.ResultChannel);
+        conv.ResultChannel = DMA_ERROR_OUT_OF_CHANNELS;
+    }
+    if (conv.MuxChannel != DMA_ERROR_OUT_OF_CHANNELS) {
+        EDMA_AbortTransfer(&conv.MuxHandle);
+        dma_channel_free(conv.MuxChannel);
+        conv.MuxChannel = DMA_ERROR_OUT_OF_CHANNELS;
+    }
+
+    if (conv.Used != 0) {
+        // leave the ADC the way analogin_read_u16() expects it
+        ADC16_EnableDMA(adc_addrs[instance], false);
+        ADC16_EnableHardwareTrigger(adc_addrs[instance], false);
+    }
+    if (conv.Restore) {
+        adc_addrs[instance]->CFG1 = conv.Defaults[0];
+        adc_addrs[instance]->CFG2 = conv.Defaults[1];
+        adc_addrs[instance]->SC3 = conv.Defaults[2];
+        conv.Restore = false;
+    }
+}
+
+// ============================================================================
+bool ADCScan::attach(FrameCallback callback) {
+    core_util_critical_section_enter();
+    bool added = Listeners < SCANMAXLISTENERS;
+    if (added) {
+        OnFrame[Listeners++] = callback;
+    }
+    core_util_critical_section_exit();
+    return added;
+}
+
+bool ADCScan::readFrame(uint16_t *frame) {
+    core_util_critical_section_enter();
+    bool ready = Published != 0;
+    if (ready) {
+        memcpy(frame, Latest, (Count + Extra) * sizeof(uint16_t));
+    }
+    core_util_critical_section_exit();
+    return ready;
+}
+
+// ============================================================================
+// the eDMA interrupt runs these for every frame, so they are kept in SRAM_L
+RAMFUNC void ADCScan::onMuxDone(edma_handle_t *handle, void *data, bool done,
+                        uint32_t tcds) {
+    ConverterRef *ref = static_cast<ConverterRef *>(data);
+    ref->Owner->onFrame(ref->Instance);
+}
+
+RAMFUNC void ADCScan::onFrame(size_t instance) {
+    ++Adc[instance].Frames;
+
+    // a frame is only complete once every ADC in use has finished it
+    uint32_t complete = UINT32_MAX;
+    for (size_t i = 0; i < SCANADCCOUNT; ++i) {
+        if (Adc[i].Used != 0 && Adc[i].Frames < complete) {
+            complete = Adc[i].Frames;
+        }
+    }
+    if (complete == Published) {
+        return;
+    }
+
+    size_t offset = ((complete - 1) % SCANDEPTH) * Slots;
+    for (size_t i = 0; i < Count; ++i) {
+        Latest[i] = Adc[PortAdc[i]].Ring[offset + PortSlot[i]]
+                    << PortShift[i];
+    }
+    for (size_t i = 0; i < Extra; ++i) {
+        Latest[Count + i] = External->value(i);
+    }
+    Published = complete;
+
+    // the ring does not mask interrupts, so this is safe to do in here
+    Frame frame;
+    memcpy(frame.Values, Latest, sizeof(Latest));
+    if (!FrameQueue.push(frame)) {
+        ++Dropped;
+    }
+
+    for (size_t i = 0; i < Listeners; ++i) {
+        OnFrame[i](Latest, Count + Extra);
+    }
+}
@@ -0,0 +1,316 @@
+#ifndef ADCSCAN_H
+#define ADCSCAN_H
+/// \file
+/// \brief Hardware-triggered, DMA-driven scan of all the sensor ports.
+///
+/// The PDB timer triggers one conversion on ADC0 and ADC1 every slot. Each
+/// conversion complete flag raises a DMA request that copies the result into
+/// a RAM ring buffer, and a linked DMA channel then writes the next channel
+/// number into the ADC's SC1A register. The CPU is only involved once per
+/// completed frame, when the frame callback is called. The channels of an
+/// ExternalADC can follow the pins in every frame.
+///
+/// Every pin is converted by the ADC that PinMap_ADC gives it, so pins on
+/// ADC0 and ADC1 convert in pairs in the same slot. With SCANPAIRS the two
+/// ports of a pair, such as the voltage and the current of one circuit, are
+/// put into the same slot when they are on different ADCs, so that there is
+/// no skew between them for the real power.
+///
+/// Every port can have its own resolution, hardware averaging and sample
+/// time from configure(). While all of the pins of an ADC convert the same
+/// way that is set once when it starts. Otherwise the mux channel writes a
+/// whole block of the ADC's registers before every conversion, with the
+/// settings of the next pin, which takes a little longer than just the
+/// channel number. A port whose conversion would not fit into its slot at
+/// the scan rate averages fewer conversions.
+
+#include "mbed.h"
+
+#include "fsl_adc16.h"
+#include "fsl_edma.h"
+#include "fsl_pdb.h"
+
+#include "BoardPins.h"
+#include "ExternalADC.h"
+#include "SPSCRing.h"
+#include "ScanLimits.h"
+#include "Structs.h"
+
+/// The maximum number of ADC channels that one ADC instance can scan
+#define SCANMAXSLOTS (16)
+
+/// How many completed frames are kept in the ring buffer of each ADC
+#define SCANDEPTH (16)
+
+/// The number of ADC instances that are scanned, ADC0 and ADC1
+#define SCANADCCOUNT (2)
+
+#if BOARDADCS < SCANADCCOUNT
+#error "the scan needs two ADC16 instances"
+#endif
+
+/// How many completed frames readFrames() can fall behind before new frames
+/// are dropped. Has to be a power of two
+#define SCANQUEUEDEPTH (64)
+
+/// The number of functions that can be attached to the frame callback
+#define SCANMAXLISTENERS (8)
+
+/// The registers from CFG1 to CLP4 and then SC1A and SC1B, which the mux
+/// channel writes before every conversion when the pins of an ADC are
+/// converted in different ways. The DMA wraps its address around them
+#define SCANBLOCKWORDS (16)
+
+/// Set to 1 for ports 2k and 2k + 1 to be converted at the same moment when
+/// their pins are on different ADCs. The ADC that is ahead in the frame
+/// then waits for the other one, which can take a slot more than the ADC
+/// with the most pins. Set with "scan-pairs" in mbed_app.json.
+#ifdef MBED_CONF_APP_SCAN_PAIRS
+#define SCANPAIRS MBED_CONF_APP_SCAN_PAIRS
+#else
+#define SCANPAIRS 1
+#endif
+
+/// How long the self-calibration of an ADC is used before the next start()
+/// runs it again, in seconds. It drifts with the temperature of the board.
+/// Set with "scan-calibration-s" in mbed_app.json.
+#ifdef MBED_CONF_APP_SCAN_CALIBRATION_S
+#define SCANCALIBRATIONS MBED_CONF_APP_SCAN_CALIBRATION_S
+#else
+#define SCANCALIBRATIONS (3600)
+#endif
+
+/// The registers that the self-calibration of one ADC sets
+struct ScanCalibration {
+    /// false if the ADC was never calibrated
+    uint8_t Valid;
+
+    /// OFS, PG and MG
+    uint16_t Offset;
+    uint16_t PlusGain;
+    uint16_t MinusGain;
+
+    /// CLPD, CLPS and CLP4 to CLP0, then the same for the minus side
+    uint16_t Plus[7];
+    uint16_t Minus[7];
+};
+
+/// How the ADC converts one pin, the resolution of PortInfo rounded up to
+/// what it has
+struct ScanFormat {
+    /// 16, 12, 10 or 8
+    uint8_t Bits;
+
+    /// conversions averaged by the ADC, 1, 4, 8, 16 or 32
+    uint8_t Average;
+
+    /// extra ADCK cycles of sample time, 0, 2, 6, 12 or 20
+    uint8_t SampleCycles;
+};
+
+/// a constant value that is returned from scan functions upon success
+#define SCANSUCCESS (0)
+
+/// Converts all of the configured pins into a ring of frames without the CPU
+/// waiting on conversions.
+///
+/// A frame holds one raw 16 bit sample from every pin, in the same order as
+/// the pins were given to the constructor.
+class ADCScan {
+  public:
+    /// One completed frame, in port order
+    struct Frame {
+        uint16_t Values[SCANMAXPORTS];
+    };
+
+    /// Called from interrupt context every time a frame is completed.
+    /// The pointer is only valid for the duration of the call.
+    typedef Callback<void(const uint16_t *frame, size_t count)> FrameCallback;
+
+    /// Sets up the pins and the channel lists. Nothing is started until start()
+    /// is called.
+    /// \param pins The analog pins to scan, in port order
+    /// \param count The number of pins
+    ADCScan(const PinName *pins, size_t count);
+
+    ~ADCScan();
+
+    /// Adds the channels of external after the pins, with their latest
+    /// readings in every frame. It is started and stopped with the scan.
+    /// \returns false if the frames have no room for them
+    bool extend(ExternalADC *external);
+
+    /// Takes the resolution, averaging and sample time of every pin from
+    /// the Resolution, Averaging and SampleCycles of the port at the same
+    /// index. Pins without a port keep 16 bits with 4 averaged. A running
+    /// scan uses them after it is started again.
+    void configure(const vector<PortInfo> &ports);
+
+    /// Returns how pin port is converted by the running scan, which can
+    /// average less than configure() asked for
+    ScanFormat format(size_t port) const { return Using[port]; }
+
+    /// Configures the ADCs, DMA channels and PDB and starts converting.
+    /// \param rate_hz How many complete frames to convert every second
+    /// \returns SCANSUCCESS if the scan is running, and a negative integer
+    /// otherwise
+    int start(float rate_hz);
+
+    /// Stops the PDB and the DMA channels.
+    void stop();
+
+    /// Uses the calibration in cal, from calibration() of an earlier boot,
+    /// instead of calibrating the ADCs at the next start(). It is used for
+    /// SCANCALIBRATIONS from now, like one that just ran.
+    void useCalibration(const ScanCalibration (&cal)[SCANADCCOUNT]);
+
+    /// Copies the calibration of every ADC into cal
+    /// \returns how many self-calibrations ran since the scan was made, so
+    /// that a new one can be kept
+    uint32_t calibration(ScanCalibration (&cal)[SCANADCCOUNT]) const;
+
+    /// Adds a function that gets every completed frame. The functions are
+    /// called in the order that they were attached.
+    /// \returns false if SCANMAXLISTENERS functions are already attached
+    bool attach(FrameCallback callback);
+
+    /// Copies the most recent complete frame into frame.
+    /// \param frame Needs to hold at least count() values
+    /// \returns false if no frame has been completed yet
+    bool readFrame(uint16_t *frame);
+
+    /// Takes the oldest completed frames out of the frame queue, for code
+    /// that needs every frame and not just the latest one. This may only be
+    /// called from one thread.
+    /// \returns the number of frames copied into frames
+    size_t readFrames(Frame *frames, size_t max_frames) {
+        return FrameQueue.pop_n(frames, max_frames);
+    }
+
+    /// Returns the number of frames that were dropped because nothing called
+    /// readFrames() in time
+    uint32_t droppedFrames() const { return Dropped; }
+
+    /// Returns the number of completed frames since start() was called
+    uint32_t frameCount() const { return Published; }
+
+    /// Returns the number of pins and external channels in each frame
+    size_t count() const { return Count + Extra; }
+
+    /// Returns the number of conversions of each ADC in a frame
+    size_t slots() const { return Slots; }
+
+    /// Returns the slot of the frame that the pin of port is converted in.
+    /// Pins in the same slot are converted at the same moment
+    size_t slot(size_t port) const { return PortSlot[port]; }
+
+    /// Returns true while the scan is running
+    bool running() const { return Running; }
+
+  private:
+    /// The DMA and channel list state of one ADC instance
+    struct Converter {
+        /// number of pins converted by this ADC
+        size_t Used;
+
+        /// SC1A values, rotated by one so that the entry written after the
+        /// result of slot n is the channel for slot n + 1. With Blocks every
+        /// entry is SCANBLOCKWORDS registers instead. SCANMAXSLOTS *
+        /// SCANBLOCKWORDS words from dmaAlloc()
+        uint32_t *MuxList;
+
+        /// the channel of every slot, the port that it is converted for, and
+        /// true if that needs the b side of the mux. A slot without a pin
+        /// repeats the channel and the port of another slot
+        uint8_t SlotChannel[SCANMAXSLOTS];
+        uint8_t SlotPort[SCANMAXSLOTS];
+        bool SlotB[SCANMAXSLOTS];
+
+        /// true if the slots are not all converted in the same way, and
+        /// MuxList has a block of registers for every one
+        bool Blocks;
+
+        /// CFG1, CFG2 and SC3 from before the settings of the pins, put
+        /// back when the scan stops. Restore is true once they were changed
+        uint32_t Defaults[3];
+        bool Restore;
+
+        /// raw results, SCANDEPTH frames of Slots samples each, room for
+        /// SCANDEPTH * SCANMAXSLOTS from dmaAlloc()
+        uint16_t *Ring;
+
+        /// reads ADCn_R0 into Ring on every conversion complete request
+        int ResultChannel;
+
+        /// writes the next MuxList entry into ADCn_SC1A
+        int MuxChannel;
+
+        edma_handle_t ResultHandle;
+        edma_handle_t MuxHandle;
+
+        /// number of frames this ADC has completed
+        volatile uint32_t Frames;
+
+        /// true if the b side of the channel mux is needed
+        bool MuxB;
+    };
+
+    void fitFormats(float rate_hz);
+    void fillMuxList(size_t instance);
+    int startConverter(size_t instance);
+    void calibrate(size_t instance);
+    void stopConverter(size_t instance);
+    void onFrame(size_t instance);
+
+    static void onMuxDone(edma_handle_t *handle, void *data, bool done,
+                          uint32_t tcds);
+
+    Converter Adc[SCANADCCOUNT];
+
+    /// the calibration of every ADC, and when it ran or was given to
+    /// useCalibration() in Kernel::get_ms_count() milliseconds
+    ScanCalibration Calibration[SCANADCCOUNT];
+    uint64_t CalibratedAtMs[SCANADCCOUNT];
+    uint32_t Calibrations;
+
+    /// ADC instance of every pin
+    uint8_t PortAdc[SCANMAXPORTS];
+
+    /// slot inside of the ADC's frame of every pin
+    uint8_t PortSlot[SCANMAXPORTS];
+
+    /// how every pin is converted, from configure(), and what start() could
+    /// fit into the slots of the scan rate
+    ScanFormat Format[SCANMAXPORTS];
+    ScanFormat Using[SCANMAXPORTS];
+
+    /// how far the result of every pin is shifted up to 16 bits
+    uint8_t PortShift[SCANMAXPORTS];
+
+    /// the latest complete frame in port order
+    uint16_t Latest[SCANMAXPORTS];
+
+    /// every completed frame, filled from the DMA interrupt
+    SPSCRing<Frame, SCANQUEUEDEPTH> FrameQueue;
+
+    volatile uint32_t Dropped;
+
+    /// Same number of slots on both ADCs so that the frames stay in step
+    size_t Slots;
+
+    size_t Count;
+
+    /// the external ADC and its channels, after the Count pins
+    ExternalADC *External;
+    size_t Extra;
+
+    volatile uint32_t Published;
+
+    bool Running;
+
+    FrameCallback OnFrame[SCANMAXLISTENERS];
+
+    size_t Listeners;
+};
+
+#endif // ADCSCAN
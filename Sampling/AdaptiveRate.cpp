@@ -0,0 +1,137 @@
+/// \file
+/// \brief Implementation of the adaptive intervals
+#include "AdaptiveRate.h"
+
+#include "RateSchedule.h"
+#include "platform/mbed_atomic.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+/// the fast bound of the last fastrate=, the uploader sets it and the
+/// sampling loop reads it
+static volatile uint32_t OfferedFastMs = ADAPTIVEFASTMS;
+
+/// what SinceMs starts at, so the first reading of a port is sent
+#define ADAPTIVENEVER (UINT32_MAX / 2)
+
+// ============================================================================
+void offerAdaptiveRate(const char *Response) {
+    const char *Offer = strstr(Response, "fastrate=\"");
+    if (Offer != NULL && isdigit(Offer[10])) {
+        float Seconds = atof(Offer + 10);
+        if (Seconds > 0.0f) {
+            core_util_atomic_store_u32(&OfferedFastMs,
+                                       (uint32_t)(Seconds * 1000.0f + 0.5f));
+        }
+    }
+}
+
+AdaptiveRate::AdaptiveRate()
+    : Adaptive(0), FastMs(ADAPTIVEFASTMS), SlowMs(ADAPTIVEFASTMS), Seen(0),
+      Active(0) {
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        IntervalMs[i] = FastMs;
+        SinceMs[i] = ADAPTIVENEVER;
+    }
+}
+
+// ============================================================================
+void AdaptiveRate::configure(const vector<PortInfo> &ports) {
+    Adaptive = 0;
+    for (size_t i = 0; i < ports.size() && i < FRAMEMAXPORTS; ++i) {
+        if (ports[i].Interval <= 0.0f) {
+            Adaptive |= 1U << i;
+        }
+    }
+    Seen = 0;
+    Active = 0;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        IntervalMs[i] = FastMs;
+        SinceMs[i] = ADAPTIVENEVER;
+    }
+}
+
+// ============================================================================
+float AdaptiveRate::tick(float slow) {
+    uint32_t Fast = core_util_atomic_load_u32(&OfferedFastMs);
+    uint32_t Slow = (uint32_t)(slow * 1000.0f + 0.5f);
+    if (Slow < RATETICKMS) {
+        Slow = RATETICKMS;
+    }
+    if (Fast > Slow) {
+        Fast = Slow;
+    } else if (Fast < RATETICKMS) {
+        Fast = RATETICKMS;
+    }
+    if (Fast != FastMs || Slow != SlowMs) {
+        FastMs = Fast;
+        SlowMs = Slow;
+        for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+            if (IntervalMs[i] < FastMs) {
+                IntervalMs[i] = FastMs;
+            } else if (IntervalMs[i] > SlowMs) {
+                IntervalMs[i] = SlowMs;
+            }
+        }
+    }
+    return FastMs / 1000.0f;
+}
+
+// ============================================================================
+void AdaptiveRate::filter(SampleFrame &Sample, float tick) {
+    const float Threshold = ADAPTIVETHRESHOLD;
+    uint32_t TickMs = (uint32_t)(tick * 1000.0f + 0.5f);
+
+    // the ports with an interval of their own are left to the schedule
+    uint32_t Due = ~Adaptive;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        uint32_t Bit = 1U << i;
+        if (!(Adaptive & Bit) || !Sample.hasPort(i)) {
+            continue;
+        }
+
+        // a reading out of range always counts as moving
+        float Reading = Sample.Raw[i];
+        bool Moved = ((Sample.OverMask | Sample.UnderMask) & Bit) != 0;
+        if (!(Seen & Bit)) {
+            Mean[i] = Reading;
+            Variance[i] = 0.0f;
+            Seen |= Bit;
+            Moved = true;
+        } else {
+            float Step = fabsf(Reading - Last[i]);
+            float Delta = Reading - Mean[i];
+            Mean[i] += ADAPTIVEWEIGHT * Delta;
+            Variance[i] = (1.0f - ADAPTIVEWEIGHT) *
+                          (Variance[i] + ADAPTIVEWEIGHT * Delta * Delta);
+            Moved = Moved || Step > Threshold ||
+                    Variance[i] > Threshold * Threshold;
+        }
+        Last[i] = Sample.Raw[i];
+
+        if (SinceMs[i] < ADAPTIVENEVER) {
+            SinceMs[i] += TickMs;
+        }
+        if (Moved) {
+            Active |= Bit;
+            IntervalMs[i] = FastMs;
+        } else {
+            Active &= ~Bit;
+        }
+        if (SinceMs[i] >= IntervalMs[i]) {
+            Due |= Bit;
+            SinceMs[i] = 0;
+            // a steady port backs off with every reading that is sent
+            if (!Moved) {
+                IntervalMs[i] =
+                    IntervalMs[i] < SlowMs / 2 ? IntervalMs[i] * 2 : SlowMs;
+            }
+        }
+    }
+    Sample.PortMask &= Due;
+    Sample.OverMask &= Due;
+    Sample.UnderMask &= Due;
+}
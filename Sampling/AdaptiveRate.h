@@ -0,0 +1,101 @@
+#ifndef ADAPTIVERATE_H
+#define ADAPTIVERATE_H
+/// \file
+/// \brief Sends the ports faster while their signal moves and backs them
+/// off while it is steady, between the bounds that the server sets.
+///
+/// The server used to set one polling interval, samplerate=, for every port
+/// whether anything happened or not. With ADAPTIVESAMPLING the sampling
+/// loop runs at the fast bound instead, ADAPTIVEFASTMS or the fastrate= in
+/// seconds of a response, and every port that follows the polling interval
+/// is still read in every tick. Its rolling variance, an exponentially
+/// weighted one over the last few readings, and its slope from the last
+/// reading are checked against ADAPTIVETHRESHOLD each time. A port that is
+/// over it, like a motor that starts, is sent every tick. Once it is steady
+/// its interval doubles with every reading that is sent, up to the polling
+/// interval, the slow bound. A steady site then sends what it sent before,
+/// and a transient is seen within one tick of the fast bound.
+///
+/// Ports with an Interval of their own keep it, see RateSchedule.h. The
+/// ticks are shorter than the polling interval, so low-power mode only
+/// starts once the fast bound is at least LOWPOWERINTERVAL.
+
+#include "Structs.h"
+
+/// Set to 1 for the adaptive intervals. Set with "adaptive-sampling" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_ADAPTIVE_SAMPLING
+#define ADAPTIVESAMPLING MBED_CONF_APP_ADAPTIVE_SAMPLING
+#else
+#define ADAPTIVESAMPLING (0)
+#endif
+
+/// The fast bound until the server sends a fastrate=, in milliseconds.
+/// Set with "adaptive-fast-ms" in mbed_app.json.
+#ifdef MBED_CONF_APP_ADAPTIVE_FAST_MS
+#define ADAPTIVEFASTMS MBED_CONF_APP_ADAPTIVE_FAST_MS
+#else
+#define ADAPTIVEFASTMS (1000)
+#endif
+
+/// How far the standard deviation or the step of a port may go before it
+/// is sent fast, in raw counts of 0xFFFF for the full scale.
+/// Set with "adaptive-threshold" in mbed_app.json.
+#ifdef MBED_CONF_APP_ADAPTIVE_THRESHOLD
+#define ADAPTIVETHRESHOLD MBED_CONF_APP_ADAPTIVE_THRESHOLD
+#else
+#define ADAPTIVETHRESHOLD (655)
+#endif
+
+/// The weight of the newest reading in the rolling mean and variance, the
+/// variance spans about 1 / ADAPTIVEWEIGHT readings
+#define ADAPTIVEWEIGHT (0.25f)
+
+/// Keeps the fastrate="Seconds" of a response, if there is one, for the
+/// sampling loop. Called from parseServerSettings()
+void offerAdaptiveRate(const char *Response);
+
+class AdaptiveRate {
+  public:
+    AdaptiveRate();
+
+    /// Takes which ports follow the polling interval, and starts all of
+    /// them over at the fast bound
+    void configure(const vector<PortInfo> &ports);
+
+    /// Returns the interval for the loop in seconds, the fast bound, or
+    /// slow if that is shorter. slow is the polling interval
+    float tick(float slow);
+
+    /// Checks the readings of Sample and takes the ports that are not due
+    /// out of it. tick is the seconds since the last Sample
+    void filter(SampleFrame &Sample, float tick);
+
+    /// Returns the bits of the ports that are sent at the fast bound
+    uint32_t active() const { return Active; }
+
+  private:
+    /// the bits of the ports that follow the polling interval
+    uint32_t Adaptive;
+
+    /// the bounds in milliseconds
+    uint32_t FastMs;
+    uint32_t SlowMs;
+
+    /// the rolling mean and variance, and the last reading, of every port
+    /// in raw counts
+    float Mean[FRAMEMAXPORTS];
+    float Variance[FRAMEMAXPORTS];
+    uint16_t Last[FRAMEMAXPORTS];
+
+    /// the interval that each port is sent at and the time since it was
+    /// last sent, in milliseconds
+    uint32_t IntervalMs[FRAMEMAXPORTS];
+    uint32_t SinceMs[FRAMEMAXPORTS];
+
+    /// the bits of the ports that have a mean, and of those that moved
+    uint32_t Seen;
+    uint32_t Active;
+};
+
+#endif // ADAPTIVERATE
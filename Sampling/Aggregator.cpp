@@ -0,0 +1,123 @@
+/// \file
+/// \brief Implementation of the window aggregation
+#include "Aggregator.h"
+
+/// The quantiles of the FrameP50, FrameP95 and FrameP99 frames
+static const float Quantiles[] = {0.50f, 0.95f, 0.99f};
+
+WindowAggregator::WindowAggregator(uint32_t Window, QuantileSketch *Sketches)
+    : Window(Window), Start(0), Frames(0), PortMask(0), OverMask(0),
+      UnderMask(0), LastOut(0), Burst(0), Sketches(Sketches) {}
+
+// ============================================================================
+size_t WindowAggregator::flush(SampleFrame *Out) {
+    if (Frames == 0) {
+        return 0;
+    }
+
+    SampleFrame &Mean = Out[0];
+    SampleFrame &Low = Out[1];
+    SampleFrame &High = Out[2];
+    Mean.clear();
+    Mean.Timestamp = Start;
+    Mean.PortMask = PortMask;
+    Mean.Count = Frames;
+    Low = Mean;
+    High = Mean;
+    Mean.Kind = FrameMean;
+    Low.Kind = FrameMin;
+    High.Kind = FrameMax;
+
+    // the range checks of the window show up on the end they were on
+    Low.UnderMask = UnderMask;
+    High.OverMask = OverMask;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if ((PortMask >> i) & 1U) {
+            Mean.Raw[i] = (Sum[i] + Readings[i] / 2) / Readings[i];
+            Low.Raw[i] = Min[i];
+            High.Raw[i] = Max[i];
+        }
+    }
+
+    size_t Count = 3;
+    if (Sketches != NULL) {
+        for (size_t k = 0; k < 3; ++k) {
+            SampleFrame &Quantile = Out[Count++];
+            Quantile = Mean;
+            Quantile.Kind = FrameP50 + k;
+            for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+                if ((PortMask >> i) & 1U) {
+                    Quantile.Raw[i] =
+                        Sketches[i].quantile(Quantiles[k], Min[i], Max[i]);
+                }
+            }
+        }
+    }
+
+    Frames = 0;
+    PortMask = 0;
+    OverMask = 0;
+    UnderMask = 0;
+    return Count;
+}
+
+// ============================================================================
+size_t WindowAggregator::push(const SampleFrame &Frame, SampleFrame *Out) {
+    if (Window == 0) {
+        Out[0] = Frame;
+        return 1;
+    }
+
+    // a reading of another window ends this one, so does a clock that went
+    // back. The window is cut short before its counts would overflow
+    size_t Count = 0;
+    uint32_t FrameStart = Frame.Timestamp - Frame.Timestamp % Window;
+    if (Frames > 0 && (FrameStart != Start || Frames == 0xFFFF)) {
+        Count = flush(Out);
+    }
+    if (Frames == 0) {
+        Start = FrameStart;
+        memset(Sum, 0, sizeof(Sum));
+        memset(Readings, 0, sizeof(Readings));
+        for (size_t i = 0; Sketches != NULL && i < FRAMEMAXPORTS; ++i) {
+            Sketches[i].clear();
+        }
+    }
+
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (!Frame.hasPort(i)) {
+            continue;
+        }
+        uint16_t Raw = Frame.Raw[i];
+        if (!((PortMask >> i) & 1U)) {
+            Min[i] = Raw;
+            Max[i] = Raw;
+        } else {
+            Min[i] = Raw < Min[i] ? Raw : Min[i];
+            Max[i] = Raw > Max[i] ? Raw : Max[i];
+        }
+        Sum[i] += Raw;
+        ++Readings[i];
+        if (Sketches != NULL) {
+            Sketches[i].add(Raw);
+        }
+    }
+    ++Frames;
+    PortMask |= Frame.PortMask;
+    OverMask |= Frame.OverMask;
+    UnderMask |= Frame.UnderMask;
+
+    // a port that just left its range starts a burst of raw readings
+    uint16_t Outside = Frame.OverMask | Frame.UnderMask;
+    if ((Outside & ~LastOut) != 0) {
+        Burst = AGGREGATEBURST;
+    }
+    LastOut = Outside;
+    if (Burst > 0) {
+        --Burst;
+        Out[Count] = Frame;
+        Out[Count].Kind = FrameBurst;
+        ++Count;
+    }
+    return Count;
+}
@@ -0,0 +1,106 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+/// \file
+/// \brief Sums the readings up over windows of time, so the board can sample
+/// fast and still only send a summary now and then.
+///
+/// With AGGREGATEWINDOW set, every reading goes into the window of
+/// AGGREGATEWINDOW seconds it was taken in, counted from the start of the
+/// minute (or hour) on the clock. When a reading of the next window comes,
+/// the window is sent as three frames, its FrameMean, FrameMin and FrameMax,
+/// stamped with the start of the window, with the number of readings in
+/// Count. A port that leaves its range also sends the AGGREGATEBURST
+/// readings from then on as they are, as FrameBurst frames, so a motor's
+/// inrush is not lost in the mean.
+///
+/// With AGGREGATEQUANTILES set, every port also keeps a QuantileSketch of
+/// the readings of the window, and the window is sent as three more frames,
+/// its FrameP50, FrameP95 and FrameP99, so the server sees how the readings
+/// were spread and not only how far they went.
+
+#include "QuantileSketch.h"
+#include "Structs.h"
+
+/// The length of a window in seconds, 0 sends every reading as it is.
+/// Set with "aggregate-window" in mbed_app.json.
+#ifdef MBED_CONF_APP_AGGREGATE_WINDOW
+#define AGGREGATEWINDOW MBED_CONF_APP_AGGREGATE_WINDOW
+#else
+#define AGGREGATEWINDOW (0)
+#endif
+
+/// How many readings are sent as they are after a port left its range.
+/// Set with "aggregate-burst" in mbed_app.json.
+#ifdef MBED_CONF_APP_AGGREGATE_BURST
+#define AGGREGATEBURST MBED_CONF_APP_AGGREGATE_BURST
+#else
+#define AGGREGATEBURST (10)
+#endif
+
+/// Set to 1 to send the quantiles of every window as well.
+/// Set with "aggregate-quantiles" in mbed_app.json.
+#ifdef MBED_CONF_APP_AGGREGATE_QUANTILES
+#define AGGREGATEQUANTILES MBED_CONF_APP_AGGREGATE_QUANTILES
+#else
+#define AGGREGATEQUANTILES 0
+#endif
+
+/// The most frames of the summary of one window
+#define AGGREGATESUMMARY (AGGREGATEQUANTILES ? 6 : 3)
+
+/// The most frames that push() hands back, a summary and a burst reading
+#define AGGREGATEFRAMES (AGGREGATESUMMARY + 1)
+
+/// Keeps the running sum, min and max of every port over the window. Only
+/// the sampling loop uses it.
+class WindowAggregator {
+  public:
+    /// \param Window The length of a window in seconds, 0 passes every
+    /// reading through
+    /// \param Sketches A sketch for each of the FRAMEMAXPORTS ports, which
+    /// has to outlive the aggregator, NULL leaves the quantiles out
+    explicit WindowAggregator(uint32_t Window = AGGREGATEWINDOW,
+                              QuantileSketch *Sketches = NULL);
+
+    /// Adds Frame to its window.
+    /// \param Out Gets the frames that are ready to go, room for
+    /// AGGREGATEFRAMES
+    /// \returns the number of frames in Out
+    size_t push(const SampleFrame &Frame, SampleFrame *Out);
+
+    /// Writes the summary of the window so far to Out, which has room for
+    /// AGGREGATESUMMARY frames, and starts over
+    /// \returns the number of frames in Out, 0 if the window is empty
+    size_t flush(SampleFrame *Out);
+
+  private:
+    uint32_t Window;
+
+    /// the Timestamp the window started at
+    uint32_t Start;
+
+    /// how many frames are in the window
+    uint32_t Frames;
+
+    /// the ports that had a reading in the window, and were out of range
+    uint16_t PortMask;
+    uint16_t OverMask;
+    uint16_t UnderMask;
+
+    /// the range masks of the last frame, a port that left its range since
+    /// starts a burst
+    uint16_t LastOut;
+
+    /// how many readings of the burst are still to be sent
+    uint32_t Burst;
+
+    uint32_t Sum[FRAMEMAXPORTS];
+    uint16_t Readings[FRAMEMAXPORTS];
+    uint16_t Min[FRAMEMAXPORTS];
+    uint16_t Max[FRAMEMAXPORTS];
+
+    /// the readings of every port over the window, or NULL
+    QuantileSketch *Sketches;
+};
+
+#endif // AGGREGATOR
@@ -0,0 +1,75 @@
+/// \file
+/// \brief Implementation of the calibration tables
+#define TRACE_GROUP "smpl"
+#include "Calibration.h"
+
+#include "DeferredLog.h"
+
+// the value of Reading on Curve, from the segment it is in or the one at
+// the end it is past
+static float onCurve(const vector<CalibrationPoint> &Curve, float Reading) {
+    size_t k = 1;
+    while (k + 1 < Curve.size() && Reading > Curve[k].Reading) {
+        ++k;
+    }
+    const CalibrationPoint &A = Curve[k - 1];
+    const CalibrationPoint &B = Curve[k];
+    if (B.Reading == A.Reading) {
+        return B.Value;
+    }
+    return A.Value +
+           (B.Value - A.Value) * (Reading - A.Reading) / (B.Reading - A.Reading);
+}
+
+// fills Table for Sensor
+static void buildTable(const SensorInfo &Sensor,
+                       uint16_t (&Table)[CALSEGMENTS + 1]) {
+    for (size_t k = 0; k <= CALSEGMENTS; ++k) {
+        // the last entry is one past full scale, the end of the last segment
+        float Reading = (float)(k << CALSHIFT) / (float)0xFFFF;
+        float Value = Sensor.Curve.size() >= 2
+                          ? onCurve(Sensor.Curve, Reading)
+                          : Reading * Sensor.Multiplier;
+        Value = Value * Sensor.Gain + Sensor.Offset;
+
+        // back to a fraction of the full scale, the way the frames keep it
+        float Raw = Value / Sensor.Multiplier * 0xFFFF + 0.5f;
+        Table[k] = Raw <= 0.0f ? 0 : Raw >= 0xFFFF ? 0xFFFF : (uint16_t)Raw;
+    }
+}
+
+CalibrationTables::CalibrationTables() {
+    memset(Tables, 0, sizeof(Tables));
+    memset(Table, CALMAXTABLES, sizeof(Table));
+}
+
+// ============================================================================
+void CalibrationTables::configure(const BoardSpecs &Specs) {
+    memset(Table, CALMAXTABLES, sizeof(Table));
+
+    // ports of the same sensor share its table
+    int Sensor[CALMAXTABLES];
+    size_t Used = 0;
+    for (size_t i = 0; i < Specs.Ports.size() && i < FRAMEMAXPORTS; ++i) {
+        int ID = Specs.Ports[i].SensorID;
+        if (ID < 0 || ID >= (int)Specs.Sensors.size() ||
+            !Specs.Sensors[ID].calibrated() ||
+            Specs.Sensors[ID].Multiplier == 0.0f) {
+            continue;
+        }
+        size_t t = 0;
+        while (t < Used && Sensor[t] != ID) {
+            ++t;
+        }
+        if (t == Used) {
+            if (Used == CALMAXTABLES) {
+                tr_warn("%s is not calibrated, there are only %d tables",
+                        Specs.Ports[i].Name.c_str(), CALMAXTABLES);
+                continue;
+            }
+            buildTable(Specs.Sensors[ID], Tables[t]);
+            Sensor[Used++] = ID;
+        }
+        Table[i] = t;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+/// \file
+/// \brief Calibrates the raw readings of a port with integer lookup tables.
+///
+/// A Calibration line in the config file gives a sensor a gain, an offset
+/// and, for sensors that are not linear like thermistors, a curve of
+/// points:
+///
+///     Calibration: SensorID, Gain, Offset[, Reading:Value ...]
+///
+/// A Reading is a fraction of the ADC's full scale from 0.0 to 1.0 and its
+/// Value is in the sensor's unit. The value of a reading is Gain times the
+/// curve, or times Multiplier without one, plus Offset. Readings past the
+/// ends of the curve follow its first or last segment.
+///
+/// The frames keep fractions of the full scale and the multiplier is only
+/// applied when they are sent, so every calibrated sensor gets one table of
+/// CALSEGMENTS + 1 raw readings when it is configured, with the curve, gain,
+/// offset and multiplier folded in. A reading is then one lookup and one
+/// integer multiply between two entries, with no floats. A value below 0 or
+/// above the multiplier can not be sent as a fraction, so it is clamped.
+
+#include "Structs.h"
+
+/// The segments of every table, a power of two. A reading uses the two
+/// entries of its segment
+#define CALSEGMENTS (128)
+
+/// The bits of a raw reading that are within a segment
+#define CALSHIFT (9)
+
+/// The most sensors with a calibration in use at the same time, each one
+/// takes (CALSEGMENTS + 1) * 2 bytes
+#define CALMAXTABLES (4)
+
+/// Holds the table of every calibrated port. Only the sampling loop uses it,
+/// and with ENERGYINTEGRATOR apply() also runs in the scan's frame callback.
+/// A block that ends while configure() builds a table may take an entry of
+/// the old one.
+class CalibrationTables {
+  public:
+    CalibrationTables();
+
+    /// Builds a table for every sensor with a calibration that a port of
+    /// Specs uses, the other ports are left as they are
+    void configure(const BoardSpecs &Specs);
+
+    /// Returns the calibrated raw reading of port i
+    uint16_t apply(size_t i, uint16_t raw) const {
+        if (i >= FRAMEMAXPORTS || Table[i] >= CALMAXTABLES) {
+            return raw;
+        }
+        const uint16_t *Entry = Tables[Table[i]] + (raw >> CALSHIFT);
+        int32_t Step = (int32_t)Entry[1] - Entry[0];
+        int32_t Within = raw & ((1U << CALSHIFT) - 1);
+        return Entry[0] + ((Step * Within + (1 << (CALSHIFT - 1))) >> CALSHIFT);
+    }
+
+  private:
+    uint16_t Tables[CALMAXTABLES][CALSEGMENTS + 1];
+
+    /// the table of every port, CALMAXTABLES or more for none
+    uint8_t Table[FRAMEMAXPORTS];
+};
+
+#endif // CALIBRATION
@@ -0,0 +1,55 @@
+/// \file
+/// \brief Implementation of the deadband filter
+#include "Deadband.h"
+
+DeadbandFilter::DeadbandFilter() { memset(Ports, 0, sizeof(Ports)); }
+
+// ============================================================================
+void DeadbandFilter::configure(const vector<PortInfo> &Ports) {
+    memset(this->Ports, 0, sizeof(this->Ports));
+    for (size_t i = 0; i < Ports.size() && i < FRAMEMAXPORTS; ++i) {
+        const PortInfo &Port = Ports[i];
+        if (Port.Deadband <= 0.0f || Port.Multiplier == 0.0f) {
+            continue;
+        }
+
+        // the frames hold fractions of the full scale, before the multiplier
+        float Band = Port.Deadband / fabsf(Port.Multiplier) * 0xFFFF;
+        this->Ports[i].Band = Band >= 0xFFFF ? 0xFFFF : (uint16_t)Band;
+        this->Ports[i].Heartbeat = Port.Heartbeat > 0 ? Port.Heartbeat
+                                                      : DEADBANDHEARTBEAT;
+    }
+}
+
+// ============================================================================
+bool DeadbandFilter::filter(SampleFrame &Frame) {
+    // the summaries and bursts of Aggregator.h are always sent
+    if (Frame.Kind != FrameReading) {
+        return Frame.PortMask != 0;
+    }
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (!Frame.hasPort(i)) {
+            continue;
+        }
+        PortState &Port = Ports[i];
+        uint8_t Range = ((Frame.OverMask >> i) & 1U) ? 1
+                        : ((Frame.UnderMask >> i) & 1U) ? 2
+                                                        : 0;
+        int32_t Change = (int32_t)Frame.Raw[i] - Port.Raw;
+        bool Report = Port.Band == 0 || !Port.Reported ||
+                      Range != Port.Range ||
+                      (Change < 0 ? -Change : Change) > Port.Band ||
+                      Frame.Timestamp - Port.Time >= Port.Heartbeat;
+        if (Report) {
+            Port.Raw = Frame.Raw[i];
+            Port.Range = Range;
+            Port.Time = Frame.Timestamp;
+            Port.Reported = true;
+        } else {
+            Frame.PortMask &= ~(1U << i);
+            Frame.OverMask &= ~(1U << i);
+            Frame.UnderMask &= ~(1U << i);
+        }
+    }
+    return Frame.PortMask != 0;
+}
@@ -0,0 +1,65 @@
+#ifndef DEADBAND_H
+#define DEADBAND_H
+/// \file
+/// \brief Report by exception, drops the readings of a port that have not
+/// moved since the last one that was sent.
+///
+/// A port with a deadband only reports again once its reading is more than
+/// the deadband away from the last reading it reported, its range check
+/// changes, or it was quiet for its heartbeat. The deadband is the optional
+/// 8th field of a Sensor line, in the sensor's unit or as a percent of its
+/// range like "2%", and the heartbeat is the 9th, in seconds. The readings
+/// that are dropped never reach the network or the backup log, so the
+/// server keeps the last reading of a port until a new one comes.
+
+#include "Structs.h"
+
+/// How long a port with a deadband stays quiet at most, in seconds, when its
+/// Sensor line has no heartbeat. Set with "deadband-heartbeat" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_DEADBAND_HEARTBEAT
+#define DEADBANDHEARTBEAT MBED_CONF_APP_DEADBAND_HEARTBEAT
+#else
+#define DEADBANDHEARTBEAT (900)
+#endif
+
+/// Keeps the last reported reading of every port and takes the ports that
+/// are within their deadband out of a frame. Only the sampling loop uses it.
+class DeadbandFilter {
+  public:
+    DeadbandFilter();
+
+    /// Takes the deadband and heartbeat of every port from Ports, and
+    /// starts over, so every port reports with the next frame
+    void configure(const vector<PortInfo> &Ports);
+
+    /// Clears the ports of Frame that are within their deadband since the
+    /// last time they were reported
+    /// \returns false if no port is left, so the frame is not worth sending
+    bool filter(SampleFrame &Frame);
+
+  private:
+    struct PortState {
+        /// the deadband in raw ADC counts, 0 reports every reading
+        uint16_t Band;
+
+        /// the raw reading that was reported last
+        uint16_t Raw;
+
+        /// 1 if the last report was over range, 2 if it was under
+        uint8_t Range;
+
+        /// the most seconds between two reports
+        uint32_t Heartbeat;
+
+        /// the Timestamp of the last report
+        uint32_t Time;
+
+        /// false until the port was reported once
+        bool Reported;
+    };
+
+    PortState Ports[FRAMEMAXPORTS];
+};
+
+#endif // DEADBAND
@@ -0,0 +1,191 @@
+/// \file
+/// \brief Implementation of the energy integrator
+#define TRACE_GROUP "kwh"
+#include "EnergyIntegrator.h"
+
+#if ENERGYINTEGRATOR
+
+#include "DeferredLog.h"
+#include "FlashQueue.h"
+
+#include <cmath>
+
+/// A block without frames for longer than this, in frames, is a stop of
+/// the scan and not a late update
+#define ENERGYGAPSLACK (ENERGYBLOCK)
+
+EnergyIntegrator::EnergyIntegrator()
+    : BlockFrames(0), Frames(0), FramesTaken(0), Count(0), Tables(NULL),
+      Rate(0.0f), UpdatedMs(0), SavedMs(0) {
+    memset(Sum, 0, sizeof(Sum));
+    memset(RunFrames, 0, sizeof(RunFrames));
+    memset(BlockSum, 0, sizeof(BlockSum));
+    memset(BlockSquares, 0, sizeof(BlockSquares));
+    memset(LastValue, 0, sizeof(LastValue));
+    memset(SumTaken, 0, sizeof(SumTaken));
+    memset(RunTaken, 0, sizeof(RunTaken));
+    memset(AC, 0, sizeof(AC));
+    memset(RunLevel, 0, sizeof(RunLevel));
+    memset(&Running, 0, sizeof(Running));
+    memset(&Saved, 0, sizeof(Saved));
+}
+
+// ============================================================================
+EnergyIntegrator &energyIntegrator() {
+    static EnergyIntegrator Integrator;
+    return Integrator;
+}
+
+// ============================================================================
+void EnergyIntegrator::restore() {
+    EnergyTotals Kept;
+    if (readEnergyCache(&Kept, sizeof(Kept)) != sizeof(Kept)) {
+        return;
+    }
+    Running = Kept;
+    Saved = Kept;
+    tr_info("The energy totals from %lu were restored",
+            (unsigned long)Kept.Time);
+}
+
+// ============================================================================
+void EnergyIntegrator::configure(const vector<PortInfo> &Ports,
+                                 const CalibrationTables &Calibration,
+                                 float rate) {
+    Rate = rate;
+    Tables = &Calibration;
+    size_t count = Ports.size() < SCANMAXPORTS ? Ports.size() : SCANMAXPORTS;
+    for (size_t i = 0; i < count; ++i) {
+        const PortInfo &Port = Ports[i];
+        AC[i] = Port.AC;
+
+        // the run level as a raw reading, the full scale without a range
+        float Ceiling =
+            Port.RangeCeiling > 0.0f ? Port.RangeCeiling : Port.Multiplier;
+        float Level = Port.Multiplier > 0.0f
+                          ? Ceiling * ENERGYRUNPERCENT / 100.0f /
+                                Port.Multiplier * (float)0xFFFF
+                          : (float)0xFFFF;
+        RunLevel[i] = Level >= (float)0xFFFF ? 0xFFFF : (uint16_t)Level;
+    }
+    Count = count;
+}
+
+// ============================================================================
+void EnergyIntegrator::push(const uint16_t *frame, size_t count) {
+    if (count > Count) {
+        count = Count;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t sample = frame[i];
+        BlockSum[i] += sample;
+        BlockSquares[i] += sample * sample;
+    }
+    ++Frames;
+    if (++BlockFrames < ENERGYBLOCK) {
+        return;
+    }
+
+    // N^2 * variance = N * sum(x^2) - sum(x)^2, as in RMSEngine::read()
+    uint64_t n = BlockFrames;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t Value;
+        if (AC[i]) {
+            uint64_t spread = n * BlockSquares[i] - BlockSum[i] * BlockSum[i];
+            Value = (uint32_t)(sqrtf((float)spread) / (float)n + 0.5f);
+        } else {
+            Value = (uint32_t)((BlockSum[i] + n / 2) / n);
+        }
+        if (Value > 0xFFFF) {
+            Value = 0xFFFF;
+        }
+        if (Tables != NULL) {
+            Value = Tables->apply(i, Value);
+        }
+        LastValue[i] = Value;
+        Sum[i] += Value * n;
+        if (Value >= RunLevel[i]) {
+            RunFrames[i] += n;
+        }
+        BlockSum[i] = 0;
+        BlockSquares[i] = 0;
+    }
+    BlockFrames = 0;
+}
+
+// ============================================================================
+void EnergyIntegrator::update(const vector<PortInfo> &Ports) {
+    uint64_t Now = Kernel::get_ms_count();
+    if (UpdatedMs == 0 || Rate <= 0.0f) {
+        UpdatedMs = Now;
+        SavedMs = Now;
+        FramesTaken = Frames;
+        return;
+    }
+
+    uint64_t Sums[SCANMAXPORTS];
+    uint64_t Runs[SCANMAXPORTS];
+    uint16_t Holds[SCANMAXPORTS];
+    core_util_critical_section_enter();
+    uint32_t Pushed = Frames - FramesTaken;
+    FramesTaken = Frames;
+    for (size_t i = 0; i < Count; ++i) {
+        Sums[i] = Sum[i] - SumTaken[i];
+        Runs[i] = RunFrames[i] - RunTaken[i];
+        SumTaken[i] = Sum[i];
+        RunTaken[i] = RunFrames[i];
+        Holds[i] = LastValue[i];
+    }
+    core_util_critical_section_exit();
+
+    // the time without frames, the scan was stopped for it
+    uint64_t Elapsed = (uint64_t)((Now - UpdatedMs) * Rate / 1000.0f);
+    UpdatedMs = Now;
+    uint64_t Gap =
+        Elapsed > Pushed + ENERGYGAPSLACK ? Elapsed - Pushed : 0;
+
+    double Hours = 1.0 / ((double)Rate * 3600.0);
+    for (size_t i = 0; i < Count && i < Ports.size(); ++i) {
+        if (Ports[i].Multiplier == 0.0f) {
+            continue;
+        }
+        uint64_t Counts = Sums[i] + (uint64_t)Holds[i] * Gap;
+        uint64_t Ran = Runs[i] + (Holds[i] >= RunLevel[i] ? Gap : 0);
+        Running.Total[i] +=
+            (double)Counts / (double)0xFFFF * Ports[i].Multiplier * Hours;
+        Running.RunSeconds[i] += (double)Ran / (double)Rate;
+    }
+
+    if (Now - SavedMs >= ENERGYSAVEMS) {
+        save();
+    }
+}
+
+// ============================================================================
+void EnergyIntegrator::save() {
+    SavedMs = Kernel::get_ms_count();
+    Running.Time = time(NULL);
+    int err = saveEnergyCache(&Running, sizeof(Running));
+    if (err) {
+        tr_error("The energy totals could not be kept (%d)", err);
+        return;
+    }
+    Saved = Running;
+}
+
+// ============================================================================
+size_t EnergyIntegrator::latest(EnergyTotals &Totals) const {
+    Totals = Saved;
+    return Count;
+}
+
+// ============================================================================
+void energyValues(const EnergyTotals &Totals, size_t i,
+                  uint32_t (&Values)[ENERGYVALUES]) {
+    // both wrap around like the registers of a meter
+    Values[0] = i;
+    Values[1] = (uint32_t)(uint64_t)(Totals.Total[i] * 1000.0);
+    Values[2] = (uint32_t)(uint64_t)Totals.RunSeconds[i];
+}
+
+#endif // ENERGYINTEGRATOR
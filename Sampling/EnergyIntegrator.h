@@ -0,0 +1,152 @@
+#ifndef ENERGYINTEGRATOR_H
+#define ENERGYINTEGRATOR_H
+/// \file
+/// \brief The energy and run time of every port, summed up on the board from
+/// every scan frame and kept in the flash store.
+///
+/// The server only sees the readings that are sent, and a sum of those is
+/// only as good as their rate. Every scan frame goes into a block of
+/// ENERGYBLOCK frames instead, a whole number of cycles at 50 and at 60 Hz.
+/// A block's value is its mean, the RMS with the mean taken out for an AC
+/// port, calibrated like a reading, and it is added to the port's total
+/// times the block's length. A block at ENERGYRUNPERCENT of the port's
+/// range or more also counts as run time. While the scan is stopped between
+/// readings in low-power mode, the value of the last block holds for the
+/// time that had no frames.
+///
+/// A total is the integral of the port's value over time, in the port's
+/// unit times hours: kWh for a port in kW, Ah for a port in A. The totals
+/// are kept in the flash store every ENERGYSAVEMS, before the firmware
+/// update resets the board, and on a brown-out. The totals that are sent
+/// are the ones that were kept, so a reset never makes them go back. They
+/// go with the readings as &Energy[]=Port,Total,Seconds, or as "w" in a
+/// CBOR body, with the totals in thousandths of the unit's hours.
+/// The totals are by port number, a config that moves a sensor to
+/// another port carries its total on. Set with "energy-integrator" in
+/// mbed_app.json.
+
+#include "ADCScan.h"
+#include "Calibration.h"
+#include "Structs.h"
+
+/// Set to 1 to sum up the energy and run time of the ports.
+/// Set with "energy-integrator" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_INTEGRATOR
+#define ENERGYINTEGRATOR MBED_CONF_APP_ENERGY_INTEGRATOR
+#else
+#define ENERGYINTEGRATOR 0
+#endif
+
+/// The percent of a port's range from which it counts as running.
+/// Set with "energy-run-percent" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_RUN_PERCENT
+#define ENERGYRUNPERCENT MBED_CONF_APP_ENERGY_RUN_PERCENT
+#else
+#define ENERGYRUNPERCENT (5)
+#endif
+
+/// The frames in one block, 10 cycles at 50 Hz and 12 at 60 Hz with 2000
+/// frames a second
+#define ENERGYBLOCK (400)
+
+/// How often the totals are kept in the flash store, in milliseconds
+#define ENERGYSAVEMS (900000)
+
+/// The number of values for one port, in the order they are sent
+#define ENERGYVALUES (3)
+
+/// What is kept of the ports, in the flash store
+struct EnergyTotals {
+    /// the time(NULL) the totals were kept at
+    uint32_t Time;
+
+    /// the integral of every port's value, in the port's unit times hours
+    double Total[FRAMEMAXPORTS];
+
+    /// how long every port ran, in seconds
+    double RunSeconds[FRAMEMAXPORTS];
+};
+
+/// Sums the blocks of scan frames up in push(), and into the totals in
+/// update(). push() runs in the scan's frame callback. configure(),
+/// update(), save() and latest() may not run at the same time, the main
+/// loop and the uploader hold the uploader's lock on the port settings for
+/// them.
+class EnergyIntegrator {
+  public:
+    EnergyIntegrator();
+
+    /// Reads the totals that were kept in the flash store, once it started
+    void restore();
+
+    /// Sums up the ports of Ports from the next block on, calibrated with
+    /// Calibration, which has to outlive the scan
+    /// \param rate The scan frames per second
+    void configure(const vector<PortInfo> &Ports,
+                   const CalibrationTables &Calibration, float rate);
+
+    /// Adds a scan frame to the block.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Adds the blocks since the last update to the totals, and keeps them
+    /// once ENERGYSAVEMS have passed
+    void update(const vector<PortInfo> &Ports);
+
+    /// Keeps the totals in the flash store now
+    void save();
+
+    /// Copies the totals that were kept last into Totals
+    /// \returns the number of ports in Totals
+    size_t latest(EnergyTotals &Totals) const;
+
+  private:
+    /// the blocks that were summed up, in calibrated raw counts times
+    /// frames. Only push() changes them
+    uint64_t Sum[SCANMAXPORTS];
+    uint64_t RunFrames[SCANMAXPORTS];
+
+    /// the block that is filled
+    uint64_t BlockSum[SCANMAXPORTS];
+    uint64_t BlockSquares[SCANMAXPORTS];
+    uint32_t BlockFrames;
+
+    /// the value of the last block of every port, in calibrated raw counts
+    uint16_t LastValue[SCANMAXPORTS];
+
+    /// the frames that were pushed
+    volatile uint32_t Frames;
+
+    /// what the totals had of Sum, RunFrames and Frames at the last update
+    uint64_t SumTaken[SCANMAXPORTS];
+    uint64_t RunTaken[SCANMAXPORTS];
+    uint32_t FramesTaken;
+
+    /// the ports that are summed up, and how they are read
+    size_t Count;
+    bool AC[SCANMAXPORTS];
+    uint16_t RunLevel[SCANMAXPORTS];
+    const CalibrationTables *Tables;
+
+    float Rate;
+
+    /// when update() last ran and when the totals were kept, from
+    /// Kernel::get_ms_count()
+    uint64_t UpdatedMs;
+    uint64_t SavedMs;
+
+    /// the totals so far, and the ones that were kept last
+    EnergyTotals Running;
+    EnergyTotals Saved;
+};
+
+/// Returns the integrator that the scan feeds and the requests report
+EnergyIntegrator &energyIntegrator();
+
+/// Copies the values of port i of Totals into Values in the order they are
+/// sent: the port, the total in thousandths of the unit's hours, and the
+/// seconds it ran
+void energyValues(const EnergyTotals &Totals, size_t i,
+                  uint32_t (&Values)[ENERGYVALUES]);
+
+#endif // ENERGYINTEGRATOR
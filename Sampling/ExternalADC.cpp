@@ -0,0 +1,222 @@
+/// \file
+/// \brief Implementation of the external ADC readers
+#include "ExternalADC.h"
+
+#if EXTERNALADC
+
+#include "DMAPool.h"
+#include "PeripheralPins.h"
+#include "dma_api.h"
+#include "pinmap.h"
+
+#if EXTERNALADC == EXTERNALADCADS1115
+
+/// the ADS1115's registers
+#define ADS1115CONVERSION (0x00)
+#define ADS1115CONFIG (0x01)
+
+/// start a single conversion (OS), +-4.096 V (PGA 001), single shot, 860
+/// samples a second and no comparator. The input mux goes in bits 12-14
+#define ADS1115START (0x8000 | 0x0200 | 0x0100 | 0x00E0 | 0x0003)
+
+/// AINn against ground
+#define ADS1115SINGLE(n) ((0x4 + (n)) << 12)
+
+static I2C_Type *const i2c_addrs[] = I2C_BASE_PTRS;
+
+/// DMA request sources of the I2C instances
+static const uint32_t i2c_dma_requests[] = {
+    kDmaRequestMux0I2C0, kDmaRequestMux0I2C1, kDmaRequestMux0I2C2};
+
+ExternalADC::ExternalADC()
+    : Bus(EXTADCSDA, EXTADCSCL), Base(NULL),
+      DmaChannel(DMA_ERROR_OUT_OF_CHANNELS), Starting(false), Data(NULL),
+      Channel(0),
+      Running(false), Busy(false), Sweeps(0), Errors(0) {
+    memset((void *)Held, 0, sizeof(Held));
+    Bus.frequency(EXTADCI2CHZ);
+    Base = i2c_addrs[pinmap_peripheral(EXTADCSDA, PinMap_I2C_SDA)];
+}
+
+ExternalADC::~ExternalADC() { stop(); }
+
+// ============================================================================
+int ExternalADC::start() {
+    if (Running) {
+        return 0;
+    }
+    if (Data == NULL) {
+        Data = (uint8_t *)dmaAlloc(2, sizeof(uint16_t));
+    }
+    if (Data == NULL) {
+        return -4;
+    }
+    size_t Instance = pinmap_peripheral(EXTADCSDA, PinMap_I2C_SDA);
+    DmaChannel = dma_channel_allocate(i2c_dma_requests[Instance]);
+    if (DmaChannel == DMA_ERROR_OUT_OF_CHANNELS) {
+        return -3;
+    }
+    memset(&DmaHandle, 0, sizeof(DmaHandle));
+    EDMA_CreateHandle(&DmaHandle, DMA0, DmaChannel);
+    I2C_MasterCreateEDMAHandle(Base, &Handle, &ExternalADC::onTransfer, this,
+                               &DmaHandle);
+
+    Channel = 0;
+    Starting = true;
+    Running = true;
+    next();
+    return 0;
+}
+
+// ============================================================================
+void ExternalADC::stop() {
+    if (!Running) {
+        return;
+    }
+    Running = false;
+    Wait.detach();
+    I2C_MasterTransferAbortEDMA(Base, &Handle);
+    dma_channel_free(DmaChannel);
+    DmaChannel = DMA_ERROR_OUT_OF_CHANNELS;
+}
+
+void ExternalADC::next() {
+    memset(&Transfer, 0, sizeof(Transfer));
+    Transfer.slaveAddress = EXTADCADDRESS;
+    Transfer.subaddressSize = 1;
+    Transfer.data = Data;
+    Transfer.dataSize = 2;
+    if (Starting) {
+        uint16_t Config = ADS1115START | ADS1115SINGLE(Channel);
+        Data[0] = Config >> 8;
+        Data[1] = Config & 0xFF;
+        Transfer.direction = kI2C_Write;
+        Transfer.subaddress = ADS1115CONFIG;
+    } else {
+        Transfer.direction = kI2C_Read;
+        Transfer.subaddress = ADS1115CONVERSION;
+    }
+    if (I2C_MasterTransferEDMA(Base, &Handle, &Transfer) != kStatus_Success) {
+        keep(false);
+    }
+}
+
+void ExternalADC::keep(bool ok) {
+    if (!ok) {
+        ++Errors;
+    } else if (!Starting) {
+        // the result is signed, a single ended input only goes below 0 by
+        // its offset
+        int16_t Result = (int16_t)((Data[0] << 8) | Data[1]);
+        Held[Channel] = Result <= 0 ? 0 : (uint16_t)(Result << 1);
+    }
+
+    if (!Running) {
+        return;
+    }
+    if (Starting && ok) {
+        // the result is read once the conversion is done
+        Starting = false;
+        Wait.attach_us(callback(this, &ExternalADC::next), EXTADCCONVERTUS);
+        return;
+    }
+    if (++Channel >= EXTADCCHANNELS) {
+        Channel = 0;
+        ++Sweeps;
+    }
+    Starting = true;
+    // a failed transfer is tried again after a wait, so a missing chip does
+    // not keep the bus busy
+    if (ok) {
+        next();
+    } else {
+        Wait.attach_us(callback(this, &ExternalADC::next), EXTADCCONVERTUS);
+    }
+}
+
+void ExternalADC::onTransfer(I2C_Type *base, i2c_master_edma_handle_t *handle,
+                             status_t status, void *data) {
+    static_cast<ExternalADC *>(data)->keep(status == kStatus_Success);
+}
+
+#elif EXTERNALADC == EXTERNALADCMCP3208
+
+ExternalADC::ExternalADC()
+    : Bus(EXTADCMOSI, EXTADCMISO, EXTADCSCLK), Select(EXTADCCS, 1),
+      Channel(0), Running(false), Busy(false), Sweeps(0), Errors(0) {
+    memset((void *)Held, 0, sizeof(Held));
+    memset(Tx, 0, sizeof(Tx));
+    memset(Rx, 0, sizeof(Rx));
+    Bus.format(8, 0);
+    Bus.frequency(EXTADCSPIHZ);
+}
+
+ExternalADC::~ExternalADC() { stop(); }
+
+// ============================================================================
+int ExternalADC::start() {
+    if (Running) {
+        return 0;
+    }
+    Running = true;
+    Busy = false;
+    Sweep.attach_us(callback(this, &ExternalADC::next),
+                    1000000 / EXTADCSWEEPHZ);
+    return 0;
+}
+
+// ============================================================================
+void ExternalADC::stop() {
+    Running = false;
+    Sweep.detach();
+}
+
+void ExternalADC::next() {
+    // a sweep that is still going on is not started again
+    if (Busy || !Running) {
+        return;
+    }
+    Busy = true;
+    Channel = 0;
+    keep(true);
+}
+
+void ExternalADC::keep(bool ok) {
+    if (Channel > 0) {
+        if (ok) {
+            // the 12 bit result is the last 4 bits of the second byte and
+            // the third byte, stretched to 16 bits
+            uint16_t Result = ((Rx[1] & 0x0F) << 8) | Rx[2];
+            Held[Channel - 1] = (Result << 4) | (Result >> 8);
+        } else {
+            ++Errors;
+        }
+    }
+    if (Channel >= EXTADCCHANNELS || !Running) {
+        Busy = false;
+        ++Sweeps;
+        return;
+    }
+
+    // start bit, single ended and the channel number
+    Tx[0] = 0x06 | (Channel >> 2);
+    Tx[1] = (Channel & 0x03) << 6;
+    Tx[2] = 0;
+    ++Channel;
+    Select = 0;
+    if (Bus.transfer(Tx, sizeof(Tx), Rx, sizeof(Rx),
+                     callback(this, &ExternalADC::onTransfer)) != 0) {
+        Select = 1;
+        ++Errors;
+        Busy = false;
+    }
+}
+
+void ExternalADC::onTransfer(int event) {
+    Select = 1;
+    keep((event & SPI_EVENT_COMPLETE) != 0);
+}
+
+#endif
+
+#endif // EXTERNALADC
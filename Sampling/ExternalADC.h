@@ -0,0 +1,170 @@
+#ifndef EXTERNALADC_H
+#define EXTERNALADC_H
+/// \file
+/// \brief More ports from an ADC chip on I2C or SPI, next to the scan of
+/// the K64F's own ADCs.
+///
+/// The chip is read channel by channel in the background, with every
+/// transfer started from the interrupt of the one before, and only its
+/// latest reading of each channel is kept. ADCScan puts those readings
+/// after its own pins in every frame, so the ports of the chip go through
+/// the same oversampling, RMS, calibration and range check as the others,
+/// and a frame costs the same no matter how many channels the chip has.
+///
+/// The channels are sampled at the chip's rate and held between its
+/// readings. An ADS1115 converts about 800 times a second in all, an
+/// MCP3208 is swept EXTADCSWEEPHZ times a second. Both are read as
+/// fractions of their full scale, like the K64F's pins: the ADS1115 with
+/// its +-4.096 V range, the MCP3208 of its reference voltage.
+
+#include "mbed.h"
+
+#include "fsl_edma.h"
+#include "fsl_i2c_edma.h"
+
+/// no external ADC, the ports are the K64F's own pins
+#define EXTERNALADCNONE (0)
+
+/// a TI ADS1115, 4 single ended channels on I2C, 16 bit
+#define EXTERNALADCADS1115 (1)
+
+/// a Microchip MCP3208, 8 single ended channels on SPI, 12 bit
+#define EXTERNALADCMCP3208 (2)
+
+/// The chip whose channels are added as ports, one of the values above.
+/// Set with "external-adc" in mbed_app.json.
+#ifdef MBED_CONF_APP_EXTERNAL_ADC
+#define EXTERNALADC MBED_CONF_APP_EXTERNAL_ADC
+#else
+#define EXTERNALADC EXTERNALADCNONE
+#endif
+
+#if EXTERNALADC == EXTERNALADCADS1115
+#define EXTADCMAXCHANNELS (4)
+#elif EXTERNALADC == EXTERNALADCMCP3208
+#define EXTADCMAXCHANNELS (8)
+#else
+#define EXTADCMAXCHANNELS (0)
+#endif
+
+/// How many channels of the chip are ports, from the first one. Set with
+/// "external-adc-channels" in mbed_app.json, the frames have room for
+/// SCANMAXPORTS ports in all
+#if EXTERNALADC == EXTERNALADCNONE
+#define EXTADCCHANNELS (0)
+#elif defined(MBED_CONF_APP_EXTERNAL_ADC_CHANNELS)
+#define EXTADCCHANNELS MBED_CONF_APP_EXTERNAL_ADC_CHANNELS
+#else
+#define EXTADCCHANNELS (EXTADCMAXCHANNELS)
+#endif
+
+static_assert(EXTADCCHANNELS <= EXTADCMAXCHANNELS,
+              "the external ADC does not have that many channels");
+
+/// The ADS1115 is on the I2C bus of the FRDM-K64F's Arduino header, with its
+/// ADDR pin to ground
+#define EXTADCSDA (PTE25)
+#define EXTADCSCL (PTE24)
+#define EXTADCADDRESS (0x48)
+#define EXTADCI2CHZ (400000)
+
+/// How long an ADS1115 conversion at 860 samples a second takes, with some
+/// margin for its clock, in microseconds
+#define EXTADCCONVERTUS (1250)
+
+/// The MCP3208 is on the SPI pins of the Arduino header. It runs at 1 MHz
+/// at 3.3 V
+#define EXTADCMOSI (PTD2)
+#define EXTADCMISO (PTD3)
+#define EXTADCSCLK (PTD1)
+#define EXTADCCS (PTD0)
+#define EXTADCSPIHZ (1000000)
+
+/// How often the MCP3208 is read, every channel once
+#define EXTADCSWEEPHZ (2000)
+
+/// The latest reading of every channel of the chip. Only ADCScan uses it.
+class ExternalADC {
+  public:
+    ExternalADC();
+
+    ~ExternalADC();
+
+    /// Starts reading the chip over and over
+    /// \returns 0 if it was started, a negative number otherwise
+    int start();
+
+    /// Stops after the transfer that is going on
+    void stop();
+
+    /// Returns the number of channels that are ports
+    size_t count() const { return EXTADCCHANNELS; }
+
+    /// Returns the latest reading of channel i as a fraction of the full
+    /// scale, 0xFFFF is full scale.
+    /// This is safe to call from interrupt context.
+    uint16_t value(size_t i) const { return Held[i]; }
+
+    /// Returns the number of times every channel was read
+    uint32_t sweeps() const { return Sweeps; }
+
+    /// Returns the number of transfers that failed, the channel keeps its
+    /// last reading
+    uint32_t errors() const { return Errors; }
+
+  private:
+    /// starts the transfer of the next step
+    void next();
+
+    /// keeps the reading that the last transfer got
+    void keep(bool ok);
+
+#if EXTERNALADC == EXTERNALADCADS1115
+    static void onTransfer(I2C_Type *base, i2c_master_edma_handle_t *handle,
+                           status_t status, void *data);
+
+    /// sets up the bus pins and the I2C clock
+    I2C Bus;
+    I2C_Type *Base;
+
+    int DmaChannel;
+    edma_handle_t DmaHandle;
+    i2c_master_edma_handle_t Handle;
+    i2c_master_transfer_t Transfer;
+
+    /// waits for the conversion between the start and the read
+    Timeout Wait;
+
+    /// true while the config register is written, false while the result
+    /// is read
+    bool Starting;
+
+    /// the two bytes of a register, from dmaAlloc()
+    uint8_t *Data;
+#elif EXTERNALADC == EXTERNALADCMCP3208
+    void onTransfer(int event);
+
+    SPI Bus;
+    DigitalOut Select;
+
+    /// starts every sweep
+    Ticker Sweep;
+    uint8_t Tx[3];
+    uint8_t Rx[3];
+#endif
+
+    volatile uint16_t Held[EXTADCMAXCHANNELS > 0 ? EXTADCMAXCHANNELS : 1];
+
+    /// the channel that is read now
+    size_t Channel;
+
+    volatile bool Running;
+
+    /// true while a sweep of the MCP3208 is going on
+    volatile bool Busy;
+
+    volatile uint32_t Sweeps;
+    volatile uint32_t Errors;
+};
+
+#endif // EXTERNALADC
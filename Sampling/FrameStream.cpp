@@ -0,0 +1,108 @@
+/// \file
+/// \brief Implementation of the USB frame stream
+#include "FrameStream.h"
+
+#if FRAMESTREAM
+
+#include "USBCDC.h"
+
+/// how often the thread looks for a program on the port while there is
+/// none, in milliseconds
+#define FRAMESTREAMIDLEMS (50)
+
+// writes Value into Out little endian, in Size bytes
+static void putLittle(uint8_t *Out, uint32_t Value, size_t Size) {
+    for (size_t i = 0; i < Size; ++i) {
+        Out[i] = (Value >> (8 * i)) & 0xFF;
+    }
+}
+
+FrameStream::FrameStream(ADCScan &scan)
+    : Scan(scan), Port(NULL),
+      Streamer(osPriorityBelowNormal, FRAMESTREAMSTACKSIZE, NULL, "stream"),
+      Rate(0), Sequence(0) {}
+
+FrameStream::~FrameStream() {
+    Streamer.terminate();
+    delete Port;
+}
+
+// ============================================================================
+int FrameStream::start(float rate_hz) {
+    if (Port != NULL) {
+        return FRAMESTREAMSUCCESS;
+    }
+    Rate = rate_hz < 65535.0f ? (uint16_t)rate_hz : 65535;
+
+    // the computer sees the port as soon as it is plugged in, the thread
+    // waits for a program to open it
+    Port = new USBCDC(false);
+    Port->connect();
+    if (Streamer.start(callback(this, &FrameStream::run)) != osOK) {
+        return -1;
+    }
+    return FRAMESTREAMSUCCESS;
+}
+
+// ============================================================================
+void FrameStream::run() {
+    while (true) {
+        if (!Port->ready()) {
+            // the frames of before are stale once a program opens the port
+            while (Scan.readFrames(Frames, FRAMESTREAMBATCH) > 0) {
+            }
+            ThisThread::sleep_for(FRAMESTREAMIDLEMS);
+            continue;
+        }
+
+        // a packet is sent once it is full, or FRAMESTREAMLATENCYMS after it
+        // was started
+        uint64_t Start = Kernel::get_ms_count();
+        size_t Got = Scan.readFrames(Frames, FRAMESTREAMBATCH);
+        while (Got < FRAMESTREAMBATCH &&
+               Kernel::get_ms_count() - Start < FRAMESTREAMLATENCYMS) {
+            ThisThread::sleep_for(1);
+            Got += Scan.readFrames(Frames + Got, FRAMESTREAMBATCH - Got);
+        }
+        if (Got == 0) {
+            // the scan is stopped in low-power mode
+            ThisThread::sleep_for(FRAMESTREAMIDLEMS);
+            continue;
+        }
+
+        // blocks while the computer does not take the data, false once the
+        // port was closed
+        size_t Length = pack(Got);
+        if (Port->send(Packet, Length)) {
+            ++Sequence;
+        }
+    }
+}
+
+size_t FrameStream::pack(size_t count) {
+    size_t Ports = Scan.count();
+    Packet[0] = 0xA5;
+    Packet[1] = 0x5A;
+    Packet[2] = FRAMESTREAMVERSION;
+    Packet[3] = Ports;
+    putLittle(Packet + 4, count, 2);
+    putLittle(Packet + 6, Sequence, 4);
+    putLittle(Packet + 10, Scan.droppedFrames(), 4);
+    putLittle(Packet + 14, Rate, 2);
+
+    uint8_t *Out = Packet + FRAMESTREAMHEADER;
+    for (size_t f = 0; f < count; ++f) {
+        for (size_t i = 0; i < Ports; ++i) {
+            putLittle(Out, Frames[f].Values[i], 2);
+            Out += 2;
+        }
+    }
+
+    size_t Length = Out - Packet;
+    uint32_t Sum = 0;
+    Crc.compute(Packet, Length, &Sum);
+    putLittle(Out, Sum, 2);
+    return Length + 2;
+}
+
+#endif // FRAMESTREAM
@@ -0,0 +1,120 @@
+#ifndef FRAMESTREAM_H
+#define FRAMESTREAM_H
+/// \file
+/// \brief Streams every raw frame of the ADC scan to a computer on the
+/// K64F's USB device port, for commissioning and waveform analysis.
+///
+/// The stdio UART is far too slow for the scan, at 2000 frames of 10 ports
+/// every second that is 40 KB/s. Here the frames are taken out of the scan's
+/// frame queue, see ADCScan::readFrames(), on a thread of their own and
+/// sent as packets over USBCDC, which shows up as a serial port on the
+/// computer. The baud rate that the computer sets does not matter. Nothing
+/// is sent until a program opens the port, and the frames that came before
+/// are dropped, so the first packet is fresh. The computer pulls the data,
+/// so a program that reads too slowly holds the thread up, the scan's queue
+/// fills and further frames are dropped and counted, never the readings.
+///
+/// A packet is, little endian:
+///  - 0xA5 0x5A, then the version, FRAMESTREAMVERSION
+///  - the ports in every frame, one byte, and the frames in the packet, two
+///  - the packet's number, four bytes, counting from 0
+///  - the frames the scan dropped since it started, four bytes, which went
+///    up if frames are missing before this packet
+///  - the scan frames per second, two bytes
+///  - the frames, every one the raw 16-bit reading of every port in order
+///  - the CRC-16/CCITT-FALSE of everything before it, two bytes
+///
+/// The USB device port can only be one device, so the stream can not be
+/// used together with the USB service mode of USBService.h.
+
+#include "mbed.h"
+
+#include "ADCScan.h"
+#include "MbedCRC.h"
+#include "USBService.h"
+
+/// Set to 1 to stream the frames. Set with "frame-stream" in mbed_app.json.
+#ifdef MBED_CONF_APP_FRAME_STREAM
+#define FRAMESTREAM MBED_CONF_APP_FRAME_STREAM
+#else
+#define FRAMESTREAM (0)
+#endif
+
+#if FRAMESTREAM && USBSERVICE
+#error "frame-stream and usb-service both need the USB port, turn one off"
+#endif
+
+/// The layout of the packets
+#define FRAMESTREAMVERSION (1)
+
+/// The most frames in one packet
+#define FRAMESTREAMBATCH (32)
+
+/// How long the first frame of a packet waits for the rest of them, in
+/// milliseconds
+#define FRAMESTREAMLATENCYMS (10)
+
+/// the bytes in front of the frames of a packet
+#define FRAMESTREAMHEADER (16)
+
+/// the longest packet, the header, the frames and the CRC
+#define FRAMESTREAMPACKETMAX                                                   \
+    (FRAMESTREAMHEADER + FRAMESTREAMBATCH * SCANMAXPORTS * 2 + 2)
+
+/// the stack size of the streaming thread, the packet is a member.
+/// Set with "stream-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_STREAM_STACK_SIZE
+#define FRAMESTREAMSTACKSIZE MBED_CONF_APP_STREAM_STACK_SIZE
+#else
+#define FRAMESTREAMSTACKSIZE (1024)
+#endif
+
+/// a constant value that is returned from stream functions upon success
+#define FRAMESTREAMSUCCESS (0)
+
+class USBCDC;
+
+class FrameStream {
+  public:
+    /// \param scan The scan whose frames are streamed. Nothing else may
+    /// call its readFrames()
+    FrameStream(ADCScan &scan);
+
+    ~FrameStream();
+
+    /// Starts the USB device and the thread
+    /// \param rate_hz The scan frames per second, it goes into the packets
+    /// \returns FRAMESTREAMSUCCESS, or a negative integer if the thread did
+    /// not start
+    int start(float rate_hz);
+
+    /// Returns the number of packets that were sent
+    uint32_t packets() const { return Sequence; }
+
+  private:
+    /// sends the frames of the scan for as long as a program has the port
+    /// open
+    void run();
+
+    /// puts Count frames of Frames into Packet
+    /// \returns the length of the packet
+    size_t pack(size_t count);
+
+    ADCScan &Scan;
+
+    USBCDC *Port;
+
+    Thread Streamer;
+
+    uint16_t Rate;
+
+    uint32_t Sequence;
+
+    ADCScan::Frame Frames[FRAMESTREAMBATCH];
+
+    uint8_t Packet[FRAMESTREAMPACKETMAX];
+
+    MbedCRC<POLY_16BIT_CCITT, 16> Crc;
+};
+
+#endif // FRAMESTREAM
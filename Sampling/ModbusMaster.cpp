@@ -0,0 +1,260 @@
+/// \file
+/// \brief Implementation of the Modbus RTU master
+#include "ModbusMaster.h"
+
+#if MODBUSPOINTS
+
+#include <algorithm>
+
+/// The flag of stop() in ModbusMaster::Flags
+#define MODBUSSTOP (1U << 0)
+
+/// bits on the wire for one character, start, 8 data, parity and stop
+#define MODBUSCHARBITS (11)
+
+/// The request of a register read, the slave, the function, the first
+/// register, the count and the CRC
+#define MODBUSREQUESTLEN (8)
+
+/// The slave, the function, and the exception code or the byte count, and
+/// the CRC. The smallest reply there is
+#define MODBUSREPLYMIN (5)
+
+/// Set in the function of a reply that is an exception
+#define MODBUSEXCEPTION (0x80)
+
+ModbusMaster::ModbusMaster(PinName tx, PinName rx, PinName de, int baud)
+    : Serial(tx, rx, baud, MODBUSRXSIZE),
+      Poller(osPriorityBelowNormal, MODBUSSTACKSIZE, NULL, "modbus"),
+      Interval(MODBUSPOLLMS), Points(0), Crc(0xFFFF, 0, true, true),
+      Errors(0), Running(false) {
+    Serial.set_format(8, ParityEven, 1);
+    Serial.set_rs485(de);
+    Serial.set_blocking(false);
+
+    CharUs = (MODBUSCHARBITS * 1000000 + baud - 1) / baud;
+    // the standard keeps the gap at 1.75 ms over 19200 baud
+    GapUs = baud > 19200 ? 1750 : (CharUs * 35 + 9) / 10;
+
+    memset(Values, 0, sizeof(Values));
+    memset(Updated, 0, sizeof(Updated));
+    Idle.start();
+}
+
+ModbusMaster::~ModbusMaster() { stop(); }
+
+// ============================================================================
+int ModbusMaster::start(const vector<ModbusPoint> &points,
+                        uint32_t interval_ms) {
+    if (Running) {
+        return MODBUSSUCCESS;
+    }
+    Points = points.size() < MODBUSPOINTS ? points.size() : MODBUSPOINTS;
+    if (points.size() > Points) {
+        printf("Only the first %u Modbus registers are ports\r\n",
+               (unsigned)Points);
+    }
+    Interval = interval_ms;
+
+    // sorted by slave, function and register, the points of one request
+    // are next to each other
+    size_t Order[MODBUSPOINTS];
+    for (size_t i = 0; i < Points; ++i) {
+        Order[i] = i;
+    }
+    std::sort(Order, Order + Points, [&points](size_t A, size_t B) {
+        const ModbusPoint &a = points[A];
+        const ModbusPoint &b = points[B];
+        if (a.Slave != b.Slave) {
+            return a.Slave < b.Slave;
+        }
+        if (a.Function != b.Function) {
+            return a.Function < b.Function;
+        }
+        return a.Register < b.Register;
+    });
+
+    Requests.clear();
+    for (size_t k = 0; k < Points; ++k) {
+        const ModbusPoint &Point = points[Order[k]];
+        bool Merged = false;
+        if (!Requests.empty()) {
+            Request &Last = Requests.back();
+            uint32_t End = Last.Start + Last.Count;
+            if (Last.Slave == Point.Slave &&
+                Last.Function == Point.Function &&
+                Point.Register <= End + MODBUSMAXGAP &&
+                Point.Register - Last.Start < MODBUSMAXREGISTERS) {
+                if (Point.Register >= End) {
+                    Last.Count = Point.Register - Last.Start + 1;
+                }
+                Merged = true;
+            }
+        }
+        if (!Merged) {
+            Request New = {Point.Slave, Point.Function, Point.Register, 1,
+                           false};
+            Requests.push_back(New);
+        }
+        PointRequest[Order[k]] = Requests.size() - 1;
+        PointOffset[Order[k]] = Point.Register - Requests.back().Start;
+    }
+    if (Requests.empty()) {
+        return MODBUSSUCCESS;
+    }
+    printf("%u Modbus registers are read with %u requests\r\n",
+           (unsigned)Points, (unsigned)Requests.size());
+
+    Running = true;
+    if (Poller.start(callback(this, &ModbusMaster::run)) != osOK) {
+        Running = false;
+        return -1;
+    }
+    return MODBUSSUCCESS;
+}
+
+// ============================================================================
+void ModbusMaster::stop() {
+    if (!Running) {
+        return;
+    }
+    Running = false;
+    Flags.set(MODBUSSTOP);
+    Poller.join();
+}
+
+// ============================================================================
+bool ModbusMaster::read(size_t point, uint16_t &raw) const {
+    if (point >= Points) {
+        return false;
+    }
+    core_util_critical_section_enter();
+    uint64_t When = Updated[point];
+    raw = Values[point];
+    core_util_critical_section_exit();
+    return When != 0 &&
+           Kernel::get_ms_count() - When <= MODBUSSTALEPOLLS * Interval;
+}
+
+// ============================================================================
+void ModbusMaster::run() {
+    uint64_t Next = Kernel::get_ms_count();
+    while (Running) {
+        // the UART stops in deep sleep, a reply would be lost
+        sleep_manager_lock_deep_sleep();
+        int Deaf = -1;
+        for (Request &R : Requests) {
+            if (R.Slave == Deaf) {
+                continue;
+            }
+            int err = poll(R);
+            if (err != MODBUSSUCCESS) {
+                ++Errors;
+                if (!R.Failing) {
+                    printf("Modbus slave %u did not return registers %u to "
+                           "%u (%d)\r\n",
+                           R.Slave, R.Start, R.Start + R.Count - 1, err);
+                }
+            }
+            R.Failing = err != MODBUSSUCCESS;
+            if (err == MODBUSNOREPLY) {
+                Deaf = R.Slave;
+            }
+        }
+        sleep_manager_unlock_deep_sleep();
+
+        // a round that took longer than the interval is not caught up on
+        Next += Interval;
+        uint64_t Now = Kernel::get_ms_count();
+        if (Next < Now) {
+            Next = Now;
+        }
+        Flags.wait_any(MODBUSSTOP, Next - Now);
+    }
+}
+
+// ============================================================================
+int ModbusMaster::poll(Request &R) {
+    Frame[0] = R.Slave;
+    Frame[1] = R.Function;
+    Frame[2] = R.Start >> 8;
+    Frame[3] = R.Start & 0xFF;
+    Frame[4] = R.Count >> 8;
+    Frame[5] = R.Count & 0xFF;
+    seal(6);
+
+    waitGap();
+    // whatever came in since the last reply is a late or stray frame
+    Serial.discard();
+    Serial.write(Frame, MODBUSREQUESTLEN);
+    Serial.drain();
+    Idle.reset();
+
+    // the reply's length is only known from its third byte on
+    size_t Expected = MODBUSREPLYMIN + 2 * R.Count;
+    uint64_t Deadline =
+        Kernel::get_ms_count() + MODBUSTIMEOUTMS + Expected * CharUs / 1000;
+    size_t Need = MODBUSREPLYMIN;
+    size_t Got = 0;
+    while (Got < Need) {
+        ssize_t Read = Serial.read(Frame + Got, Need - Got);
+        if (Read > 0) {
+            Got += Read;
+            Idle.reset();
+            if (Got >= 3 && !(Frame[1] & MODBUSEXCEPTION)) {
+                Need = MODBUSREPLYMIN + Frame[2];
+                if (Need > sizeof(Frame)) {
+                    return MODBUSBADREPLY;
+                }
+            }
+            continue;
+        }
+        if (Kernel::get_ms_count() >= Deadline) {
+            return Got == 0 ? MODBUSNOREPLY : MODBUSBADREPLY;
+        }
+        ThisThread::sleep_for(1);
+    }
+
+    uint32_t Sum = 0;
+    Crc.compute(Frame, Got - 2, &Sum);
+    if (Frame[Got - 2] != (Sum & 0xFF) || Frame[Got - 1] != (Sum >> 8) ||
+        Frame[0] != R.Slave || Frame[1] != R.Function ||
+        Got != Expected) {
+        return MODBUSBADREPLY;
+    }
+
+    uint64_t Now = Kernel::get_ms_count();
+    size_t Index = &R - Requests.data();
+    for (size_t i = 0; i < Points; ++i) {
+        if (PointRequest[i] != Index) {
+            continue;
+        }
+        const uint8_t *Register = Frame + 3 + 2 * PointOffset[i];
+        uint16_t Value = (Register[0] << 8) | Register[1];
+        core_util_critical_section_enter();
+        Values[i] = Value;
+        Updated[i] = Now;
+        core_util_critical_section_exit();
+    }
+    return MODBUSSUCCESS;
+}
+
+void ModbusMaster::waitGap() {
+    int Left = (int)GapUs - Idle.read_us();
+    if (Left > 1000) {
+        ThisThread::sleep_for(Left / 1000);
+        Left = (int)GapUs - Idle.read_us();
+    }
+    if (Left > 0) {
+        wait_us(Left);
+    }
+}
+
+void ModbusMaster::seal(size_t length) {
+    uint32_t Sum = 0;
+    Crc.compute(Frame, length, &Sum);
+    Frame[length] = Sum & 0xFF;
+    Frame[length + 1] = Sum >> 8;
+}
+
+#endif // MODBUSPOINTS
@@ -0,0 +1,195 @@
+#ifndef MODBUSMASTER_H
+#define MODBUSMASTER_H
+/// \file
+/// \brief Reads registers of industrial meters over Modbus RTU, as more
+/// ports after the pulse counters.
+///
+/// The meters hang on an RS-485 bus on UART1, TX on PTC4 and RX on PTC3.
+/// The transceiver's driver enable is on PTC1, the UART's RTS, which the
+/// UART itself raises while it sends, so the bus is free for the reply
+/// right after the last stop bit. The replies come into RAM through the
+/// eDMA ring of DMAUARTSerial.
+///
+/// Every Modbus line of the config file is one port, in order. The points
+/// are sorted by slave, function and register, and registers of one slave
+/// that are at most MODBUSMAXGAP apart are read with one FC03 or FC04
+/// request of up to MODBUSMAXREGISTERS, so a meter with 20 values costs one
+/// round trip instead of 20. A thread polls all of the requests back to
+/// back every MODBUSPOLLMS, one slave after the other, with the next
+/// request going out as soon as the 3.5 character gap after the last reply
+/// is over. The gap is timed from the us_ticker's PIT. A slave that does
+/// not answer is skipped for the rest of the round, so a meter that is off
+/// does not hold up the others by a timeout for each of its requests.
+///
+/// The sampling loop only takes the latest values, it never waits for the
+/// bus. The reading of a Modbus port is the unsigned 16-bit register as a
+/// raw reading, so its Multiplier is 65535 times the unit of one count. A
+/// register that was not read in the last MODBUSSTALEPOLLS rounds is left
+/// out of the readings.
+
+#include "mbed.h"
+
+#include "DMAUARTSerial.h"
+#include "MbedCRC.h"
+#include "Structs.h"
+
+/// How many ports are Modbus registers, from the first Modbus lines of the
+/// config file. 0 turns the master off. Set with "modbus-points" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_MODBUS_POINTS
+#define MODBUSPOINTS MBED_CONF_APP_MODBUS_POINTS
+#else
+#define MODBUSPOINTS (0)
+#endif
+
+/// The baud rate of the bus, with even parity and one stop bit
+#ifdef MBED_CONF_APP_MODBUS_BAUD
+#define MODBUSBAUD MBED_CONF_APP_MODBUS_BAUD
+#else
+#define MODBUSBAUD (19200)
+#endif
+
+/// How often the registers are read, in milliseconds
+#ifdef MBED_CONF_APP_MODBUS_POLL_MS
+#define MODBUSPOLLMS MBED_CONF_APP_MODBUS_POLL_MS
+#else
+#define MODBUSPOLLMS (1000)
+#endif
+
+/// The pins of the bus, the driver enable is the RTS of the same UART
+#define MODBUSTX (PTC4)
+#define MODBUSRX (PTC3)
+#define MODBUSDE (PTC1)
+
+/// The most registers of one FC03 or FC04 request
+#define MODBUSMAXREGISTERS (125)
+
+/// Registers between two points of a slave that are read and dropped
+/// rather than sending another request
+#define MODBUSMAXGAP (8)
+
+/// How long a slave has to start its reply, in milliseconds. The time the
+/// reply itself takes on the wire comes on top
+#define MODBUSTIMEOUTMS (100)
+
+/// After this many rounds without a reply a register is not sent
+#define MODBUSSTALEPOLLS (3)
+
+/// The receive ring of the bus. A reply is at most 256 bytes, and one is
+/// read before the next request goes out
+#define MODBUSRXSIZE (512)
+
+/// the stack size of the polling thread, the frames are members.
+/// Set with "modbus-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_MODBUS_STACK_SIZE
+#define MODBUSSTACKSIZE MBED_CONF_APP_MODBUS_STACK_SIZE
+#else
+#define MODBUSSTACKSIZE (1024)
+#endif
+
+/// a constant value that is returned from master functions upon success
+#define MODBUSSUCCESS (0)
+
+/// poll() heard nothing from the slave
+#define MODBUSNOREPLY (-1)
+
+/// poll() got a reply with a bad CRC, an exception or the wrong registers
+#define MODBUSBADREPLY (-2)
+
+class ModbusMaster {
+  public:
+    ModbusMaster(PinName tx = MODBUSTX, PinName rx = MODBUSRX,
+                 PinName de = MODBUSDE, int baud = MODBUSBAUD);
+
+    ~ModbusMaster();
+
+    /// Merges the first MODBUSPOINTS points into requests and starts
+    /// polling them
+    /// \returns MODBUSSUCCESS, or a negative integer if the thread did not
+    /// start
+    int start(const vector<ModbusPoint> &points,
+              uint32_t interval_ms = MODBUSPOLLMS);
+
+    /// Stops polling once the request on the bus is done
+    void stop();
+
+    /// Sets raw to the latest value of point
+    /// \returns false if it was not read in the last MODBUSSTALEPOLLS rounds
+    bool read(size_t point, uint16_t &raw) const;
+
+    /// Returns the number of points that are polled
+    size_t count() const { return Points; }
+
+    /// Returns the number of requests of one round
+    size_t requests() const { return Requests.size(); }
+
+    /// Returns the number of requests that failed, with a timeout, a bad
+    /// CRC or an exception
+    uint32_t errors() const { return Errors; }
+
+  private:
+    /// One FC03 or FC04 request of Count registers from Start
+    struct Request {
+        uint8_t Slave;
+        uint8_t Function;
+        uint16_t Start;
+        uint16_t Count;
+
+        /// the last round of this request failed, so a failure is only
+        /// printed once
+        bool Failing;
+    };
+
+    /// polls all of the requests every Interval until stop()
+    void run();
+
+    /// sends request R and takes the registers of its reply into Values
+    /// \returns MODBUSSUCCESS, MODBUSNOREPLY if the slave did not answer or
+    /// MODBUSBADREPLY for a reply that is not the registers
+    int poll(Request &R);
+
+    /// waits until the bus was quiet for the 3.5 character gap
+    void waitGap();
+
+    /// appends the CRC of the length bytes of Frame
+    void seal(size_t length);
+
+    DMAUARTSerial Serial;
+
+    Thread Poller;
+
+    /// set by stop(), the thread waits on it between the rounds
+    EventFlags Flags;
+
+    /// the time since the last byte on the bus
+    Timer Idle;
+
+    /// one character and the gap between two frames, in microseconds
+    uint32_t CharUs;
+    uint32_t GapUs;
+
+    uint32_t Interval;
+
+    vector<Request> Requests;
+
+    /// the request of every point and its register in the reply
+    uint16_t PointRequest[MODBUSPOINTS > 0 ? MODBUSPOINTS : 1];
+    uint16_t PointOffset[MODBUSPOINTS > 0 ? MODBUSPOINTS : 1];
+    size_t Points;
+
+    /// the latest value of every point, and when it was read in
+    /// Kernel::get_ms_count() milliseconds, 0 if it never was
+    uint16_t Values[MODBUSPOINTS > 0 ? MODBUSPOINTS : 1];
+    uint64_t Updated[MODBUSPOINTS > 0 ? MODBUSPOINTS : 1];
+
+    /// the frame on the bus, a request or a reply of up to 125 registers
+    uint8_t Frame[256];
+
+    MbedCRC<POLY_16BIT_IBM, 16> Crc;
+
+    volatile uint32_t Errors;
+
+    bool Running;
+};
+
+#endif // MODBUSMASTER
@@ -0,0 +1,69 @@
+/// \file
+/// \brief Implementation of the per port boxcar decimator
+#include "Oversampler.h"
+
+Oversampler::Oversampler(size_t count)
+    : Count(count < SCANMAXPORTS ? count : SCANMAXPORTS) {
+    memset(Ports, 0, sizeof(Ports));
+    for (size_t i = 0; i < SCANMAXPORTS; ++i) {
+        Ports[i].Ratio = 1;
+    }
+}
+
+void Oversampler::setRatio(size_t port, uint32_t ratio) {
+    if (port >= Count) {
+        return;
+    }
+    // 4096 16 bit samples still fit into the 32 bit sum
+    if (ratio == 0) {
+        ratio = 1;
+    } else if (ratio > MAXOVERSAMPLE) {
+        ratio = MAXOVERSAMPLE;
+    }
+
+    core_util_critical_section_enter();
+    Ports[port].Ratio = ratio;
+    Ports[port].Count = 0;
+    Ports[port].Sum = 0;
+    Ports[port].Ready = false;
+    core_util_critical_section_exit();
+}
+
+uint32_t Oversampler::ratio(size_t port) const {
+    return port < Count ? Ports[port].Ratio : 0;
+}
+
+// ============================================================================
+void Oversampler::push(const uint16_t *frame, size_t count) {
+    if (count > Count) {
+        count = Count;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Accumulator &acc = Ports[i];
+        acc.Sum += frame[i];
+        if (++acc.Count >= acc.Ratio) {
+            acc.Last = acc.Sum;
+            acc.Sum = 0;
+            acc.Count = 0;
+            acc.Ready = true;
+        }
+    }
+}
+
+bool Oversampler::read(size_t port, float &value) {
+    if (port >= Count) {
+        return false;
+    }
+
+    core_util_critical_section_enter();
+    bool ready = Ports[port].Ready;
+    uint32_t sum = Ports[port].Last;
+    uint32_t ratio = Ports[port].Ratio;
+    core_util_critical_section_exit();
+
+    if (ready) {
+        value = sum * (1.0f / ((float)0xFFFF * ratio));
+    }
+    return ready;
+}
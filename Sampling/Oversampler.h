@@ -0,0 +1,53 @@
+#ifndef OVERSAMPLER_H
+#define OVERSAMPLER_H
+/// \file
+/// \brief Per port oversampling and boxcar decimation of the ADC scan frames
+
+#include "ADCScan.h"
+#include "mbed.h"
+
+/// The largest oversampling ratio that a port can have
+#define MAXOVERSAMPLE (4096)
+
+/// Averages N consecutive scan frames for every port.
+///
+/// push() is meant to be attached to ADCScan so that it runs from the scan's
+/// frame callback. Every port has its own ratio, and a port's output is only
+/// updated once its whole burst of conversions has been summed.
+class Oversampler {
+  public:
+    /// \param count The number of ports in every frame
+    explicit Oversampler(size_t count);
+
+    /// Sets how many conversions are averaged into one output for a port.
+    /// A ratio of 1 passes the samples through.
+    void setRatio(size_t port, uint32_t ratio);
+
+    /// Returns the oversampling ratio of port
+    uint32_t ratio(size_t port) const;
+
+    /// Adds a frame to every port's accumulator.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Gets the latest decimated value of port, scaled from 0.0 to 1.0 like
+    /// AnalogIn::read(). The averaging keeps the fractional bits, so the
+    /// value has more resolution than one conversion.
+    /// \returns false if the port has not finished a burst yet
+    bool read(size_t port, float &value);
+
+  private:
+    struct Accumulator {
+        uint32_t Ratio; ///< conversions per output
+        uint32_t Count; ///< conversions in the current burst
+        uint32_t Sum;   ///< sum of the current burst
+        uint32_t Last;  ///< sum of the last complete burst
+        bool Ready;     ///< true once a burst has completed
+    };
+
+    Accumulator Ports[SCANMAXPORTS];
+
+    size_t Count;
+};
+
+#endif // OVERSAMPLER
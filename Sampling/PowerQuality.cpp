@@ -0,0 +1,208 @@
+/// \file
+/// \brief Implementation of the power quality analysis
+#include "PowerQuality.h"
+
+#if POWERQUALITY
+
+#include "arm_math.h"
+#include "platform/mbed_critical.h"
+
+#include <cmath>
+
+/// the FFT and the filter, set up once for PQFFTSIZE. Only update() uses
+/// them, so they are shared by every instance
+static arm_rfft_fast_instance_f32 Fft;
+static arm_biquad_casd_df1_inst_f32 LowPass;
+static float LowPassCoeffs[5];
+static float LowPassState[4];
+
+/// the block without its mean, as q15 and as floats, and the spectrum
+static q15_t Centered[PQFFTSIZE];
+static float Work[PQFFTSIZE];
+static float Spectrum[PQFFTSIZE];
+
+// the sum of the power of the bins around Center
+static float binPower(const float *Power, int Center) {
+    float Sum = 0.0f;
+    for (int k = Center - PQBINSPREAD; k <= Center + PQBINSPREAD; ++k) {
+        Sum += Power[k];
+    }
+    return Sum;
+}
+
+PowerQuality::PowerQuality()
+    : Used(0), Frames(0), Ready(false), Rate(0.0f), LastCount(0) {
+    memset(Filling, 0, sizeof(Filling));
+    memset(Complete, 0, sizeof(Complete));
+    arm_rfft_fast_init_f32(&Fft, PQFFTSIZE);
+}
+
+// ============================================================================
+PowerQuality &powerQuality() {
+    // the blocks take 8 KB, so there is only the one
+    static PowerQuality Quality;
+    return Quality;
+}
+
+// ============================================================================
+void PowerQuality::configure(const vector<PortInfo> &Ports, float rate) {
+    // a Butterworth low-pass, from the audio EQ cookbook. CMSIS adds the
+    // feedback terms, so they are negated
+    Rate = rate;
+    float W0 = 2.0f * PI * PQCUTOFF / Rate;
+    float Alpha = sinf(W0) / (2.0f * 0.7071f);
+    float Cos = cosf(W0);
+    float A0 = 1.0f + Alpha;
+    LowPassCoeffs[0] = (1.0f - Cos) / 2.0f / A0;
+    LowPassCoeffs[1] = (1.0f - Cos) / A0;
+    LowPassCoeffs[2] = LowPassCoeffs[0];
+    LowPassCoeffs[3] = 2.0f * Cos / A0;
+    LowPassCoeffs[4] = -(1.0f - Alpha) / A0;
+
+    core_util_critical_section_enter();
+    Used = 0;
+    for (size_t i = 0; i < Ports.size() && i < SCANMAXPORTS; ++i) {
+        if (Ports[i].AC && Used < PQMAXPORTS) {
+            Port[Used] = i;
+            Multiplier[Used] = Ports[i].Multiplier;
+            ++Used;
+        }
+    }
+    Frames = 0;
+    Ready = false;
+    core_util_critical_section_exit();
+    LastCount = 0;
+}
+
+// ============================================================================
+void PowerQuality::push(const uint16_t *frame, size_t count) {
+    if (Used == 0) {
+        return;
+    }
+    for (size_t i = 0; i < Used; ++i) {
+        Filling[i][Frames] = Port[i] < count ? frame[Port[i]] : 0;
+    }
+    if (++Frames < PQFFTSIZE) {
+        return;
+    }
+    Frames = 0;
+
+    // a block that update() did not get to in time is skipped
+    if (!Ready) {
+        memcpy(Complete, Filling, sizeof(Complete));
+        Ready = true;
+    }
+}
+
+// ============================================================================
+void PowerQuality::update() {
+    if (!Ready) {
+        return;
+    }
+    PowerStats Stats[PQMAXPORTS];
+    size_t Count = Used;
+    for (size_t i = 0; i < Count; ++i) {
+        analyze(i, Complete[i], Stats[i]);
+    }
+    Ready = false;
+    memcpy(Last, Stats, sizeof(Stats));
+    LastCount = Count;
+}
+
+// ============================================================================
+size_t PowerQuality::latest(PowerStats (&Stats)[PQMAXPORTS]) const {
+    memcpy(Stats, Last, sizeof(Last));
+    return LastCount;
+}
+
+void PowerQuality::analyze(size_t slot, const uint16_t *block,
+                           PowerStats &stats) {
+    stats.Port = Port[slot];
+    stats.RMS = 0.0f;
+    stats.Fundamental = 0.0f;
+    stats.THD = 0.0f;
+    stats.Crest = 0.0f;
+
+    // the raw readings are 16 bit unsigned, half of the distance from the
+    // mean fits into a q15 either way
+    uint32_t Sum = 0;
+    for (size_t n = 0; n < PQFFTSIZE; ++n) {
+        Sum += block[n];
+    }
+    int32_t Mean = (Sum + PQFFTSIZE / 2) / PQFFTSIZE;
+    int32_t Peak = 0;
+    for (size_t n = 0; n < PQFFTSIZE; ++n) {
+        int32_t Distance = (int32_t)block[n] - Mean;
+        Peak = abs(Distance) > Peak ? abs(Distance) : Peak;
+        Centered[n] = (q15_t)(Distance / 2);
+    }
+
+    q15_t Rms;
+    arm_rms_q15(Centered, PQFFTSIZE, &Rms);
+    float RawRms = 2.0f * Rms;
+    stats.RMS = RawRms * (1.0f / (float)0xFFFF) * Multiplier[slot];
+    if (RawRms < PQMINRMS) {
+        return;
+    }
+    stats.Crest = Peak / RawRms;
+
+    // the filter starts from rest on every block, the window hides how it
+    // settles
+    arm_q15_to_float(Centered, Work, PQFFTSIZE);
+    memset(LowPassState, 0, sizeof(LowPassState));
+    arm_biquad_cascade_df1_init_f32(&LowPass, 1, LowPassCoeffs, LowPassState);
+    arm_biquad_cascade_df1_f32(&LowPass, Work, Work, PQFFTSIZE);
+    for (size_t n = 0; n < PQFFTSIZE; ++n) {
+        Work[n] *= 0.5f - 0.5f * cosf(2.0f * PI * n / (PQFFTSIZE - 1));
+    }
+
+    // bin 0 and the Nyquist bin are packed into Spectrum[0] and [1], the
+    // rest are complex. Work gets the power of bins 1 to PQFFTSIZE / 2 - 1
+    arm_rfft_fast_f32(&Fft, Work, Spectrum, 0);
+    const int Bins = PQFFTSIZE / 2;
+    float *Power = Work;
+    Power[0] = 0.0f;
+    arm_cmplx_mag_squared_f32(Spectrum + 2, Power + 1, Bins - 1);
+
+    // the strongest bin in the range of the fundamental, moved between the
+    // bins by how its neighbours of the Hann window's main lobe compare
+    float BinHz = Rate / PQFFTSIZE;
+    int Low = (int)ceilf(PQMINHZ / BinHz);
+    int High = (int)(PQMAXHZ / BinHz);
+    if (Low < PQBINSPREAD + 1 || High + PQBINSPREAD >= Bins) {
+        return;
+    }
+    int Top = Low;
+    for (int k = Low + 1; k <= High; ++k) {
+        Top = Power[k] > Power[Top] ? k : Top;
+    }
+    float Left = sqrtf(Power[Top - 1]);
+    float Middle = sqrtf(Power[Top]);
+    float Right = sqrtf(Power[Top + 1]);
+    float Shift = 2.0f * (Right - Left) / (Left + 2.0f * Middle + Right);
+    stats.Fundamental = (Top + Shift) * BinHz;
+
+    float Fundamental = binPower(Power, Top);
+    float Harmonics = 0.0f;
+    for (int h = 2; h <= PQHARMONICS; ++h) {
+        int Center = (int)(h * stats.Fundamental / BinHz + 0.5f);
+        if (Center + PQBINSPREAD >= Bins) {
+            break;
+        }
+        Harmonics += binPower(Power, Center);
+    }
+    if (Fundamental > 0.0f) {
+        stats.THD = 100.0f * sqrtf(Harmonics / Fundamental);
+    }
+}
+
+// ============================================================================
+void powerValues(const PowerStats &Stats, float (&Values)[PQVALUES]) {
+    Values[0] = Stats.Port;
+    Values[1] = Stats.RMS;
+    Values[2] = Stats.Fundamental;
+    Values[3] = Stats.THD;
+    Values[4] = Stats.Crest;
+}
+
+#endif // POWERQUALITY
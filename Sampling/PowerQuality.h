@@ -0,0 +1,135 @@
+#ifndef POWERQUALITY_H
+#define POWERQUALITY_H
+/// \file
+/// \brief Harmonics and power quality of the AC ports, with the CMSIS-DSP
+/// kernels of the Cortex-M4F.
+///
+/// The scan frames of the first PQMAXPORTS AC ports are collected into
+/// blocks of PQFFTSIZE frames, 512 ms at 2000 frames a second. Every block
+/// gets:
+///  - its true RMS with arm_rms_q15(), with the mean taken out
+///  - a biquad low-pass at PQCUTOFF with arm_biquad_cascade_df1_f32(), so
+///    the noise above the harmonics that are looked at stays out of them
+///  - a Hann window and arm_rfft_fast_f32()
+///  - the fundamental between PQMINHZ and PQMAXHZ, and the THD of the
+///    harmonics up to PQHARMONICS
+///
+/// The metrics of the last block go with the readings, like the memory
+/// telemetry. The uploader thread runs the analysis between requests, so
+/// the metrics do not change while a request is measured and sent. It
+/// takes a few milliseconds per port and block.
+
+#include "ScanLimits.h"
+#include "Structs.h"
+
+/// Set to 1 to work out and send the power quality of the AC ports.
+/// Set with "power-quality" in mbed_app.json.
+#ifdef MBED_CONF_APP_POWER_QUALITY
+#define POWERQUALITY MBED_CONF_APP_POWER_QUALITY
+#else
+#define POWERQUALITY 0
+#endif
+
+/// The most AC ports that are analyzed, the first ones are used
+#define PQMAXPORTS (2)
+
+/// The frames in one block, a power of two that arm_rfft_fast_f32() takes
+#define PQFFTSIZE (1024)
+
+/// The range the fundamental is looked for in, in Hz
+#define PQMINHZ (40.0f)
+#define PQMAXHZ (70.0f)
+
+/// A block with less RMS than this many raw counts has no fundamental, it
+/// is only noise
+#define PQMINRMS (16)
+
+/// The highest harmonic that goes into the THD
+#define PQHARMONICS (13)
+
+/// The corner of the low-pass filter in Hz, above the highest harmonic
+#define PQCUTOFF (850.0f)
+
+/// How many FFT bins either side of a harmonic are added up, the Hann
+/// window spreads a tone over about three of them
+#define PQBINSPREAD (2)
+
+/// The number of values for one port, in the order they are sent
+#define PQVALUES (5)
+
+/// The power quality of one port over one block
+struct PowerStats {
+    /// the port number
+    uint8_t Port;
+
+    /// RMS with the mean taken out, in the port's unit
+    float RMS;
+
+    /// the frequency of the fundamental in Hz, 0 if there was none
+    float Fundamental;
+
+    /// total harmonic distortion, in percent of the fundamental
+    float THD;
+
+    /// the peak distance from the mean over RMS
+    float Crest;
+};
+
+/// Collects blocks of scan frames in push(), and analyzes them in update().
+/// push() runs in the scan's frame callback. configure(), update() and
+/// latest() may not run at the same time, the main loop holds the uploader's
+/// lock on the port settings for them.
+class PowerQuality {
+  public:
+    PowerQuality();
+
+    /// Analyzes the first PQMAXPORTS AC ports of Ports from the next block
+    /// on
+    /// \param rate The scan frames per second
+    void configure(const vector<PortInfo> &Ports, float rate);
+
+    /// Adds a scan frame to the block.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Analyzes the last complete block, if there is a new one
+    void update();
+
+    /// Copies the metrics of the last block into Stats
+    /// \returns the number of ports in Stats, 0 until a block was analyzed
+    size_t latest(PowerStats (&Stats)[PQMAXPORTS]) const;
+
+  private:
+    void analyze(size_t slot, const uint16_t *block, PowerStats &stats);
+
+    /// the blocks that are filled, and the last complete ones
+    uint16_t Filling[PQMAXPORTS][PQFFTSIZE];
+    uint16_t Complete[PQMAXPORTS][PQFFTSIZE];
+
+    /// the port of every block, and the multiplier of the port
+    uint8_t Port[PQMAXPORTS];
+    float Multiplier[PQMAXPORTS];
+
+    size_t Used;
+
+    /// frames in the blocks that are filled
+    uint32_t Frames;
+
+    /// set by push() when Complete has a new block, cleared by update()
+    volatile bool Ready;
+
+    float Rate;
+
+    /// the metrics of the last analyzed block
+    PowerStats Last[PQMAXPORTS];
+    size_t LastCount;
+};
+
+/// Returns the analysis that the scan feeds and the requests report
+PowerQuality &powerQuality();
+
+/// Copies the values of Stats into Values in the order they are sent: the
+/// port, RMS, fundamental, THD and crest factor
+void powerValues(const PowerStats &Stats, float (&Values)[PQVALUES]);
+
+#endif // POWERQUALITY
@@ -0,0 +1,150 @@
+/// \file
+/// \brief Implementation of the FTM pulse counters
+#include "PulseCounter.h"
+
+#if PULSECHANNELS
+
+#include "fsl_ftm.h"
+#include "pinmap.h"
+
+/// The FTM, the pins and the interrupt of every channel
+struct PulseInput {
+    FTM_Type *Base;
+    PinName PhaseA;
+    PinName PhaseB;
+    IRQn_Type Irq;
+};
+
+static const PulseInput pulse_inputs[PULSEMAXCHANNELS] = {
+    {FTM1, PTB0, PTB1, FTM1_IRQn}, {FTM2, PTB18, PTB19, FTM2_IRQn}};
+
+/// the quadrature decoder is on ALT6 of all four pins
+#define PULSEPINALT (6)
+
+/// the longest phase filter, 4 bus clocks for every step
+#define PULSEFILTER (15)
+
+/// The interrupts only have a static function, there is one counter
+static PulseCounter *Counter = NULL;
+
+PulseCounter::PulseCounter() : Started(0) {
+    memset((void *)Wraps, 0, sizeof(Wraps));
+    memset(Taken, 0, sizeof(Taken));
+    Counter = this;
+}
+
+PulseCounter::~PulseCounter() {
+    stop();
+    Counter = NULL;
+}
+
+// ============================================================================
+int PulseCounter::start() {
+    stop();
+
+    static void (*const handlers[PULSEMAXCHANNELS])() = {
+        &PulseCounter::onOverflow1, &PulseCounter::onOverflow2};
+
+    sleep_manager_lock_deep_sleep();
+    for (size_t i = 0; i < PULSECHANNELS; ++i) {
+        const PulseInput &In = pulse_inputs[i];
+        pin_function(In.PhaseA, PULSEPINALT);
+        pin_function(In.PhaseB, PULSEPINALT);
+        // meters have open collector outputs
+        pin_mode(In.PhaseA, PullUp);
+        pin_mode(In.PhaseB, PullUp);
+
+        ftm_config_t config;
+        FTM_GetDefaultConfig(&config);
+        Started = i + 1;
+        if (FTM_Init(In.Base, &config) != kStatus_Success) {
+            printf("FTM of pulse counter %u could not be set up\r\n",
+                   (unsigned)i);
+            stop();
+            return -1;
+        }
+
+        ftm_phase_params_t phase;
+        phase.enablePhaseFilter = true;
+        phase.phaseFilterVal = PULSEFILTER;
+        phase.phasePolarity = kFTM_QuadPhaseNormal;
+        FTM_SetQuadDecoderModuloValue(In.Base, 0, 0xFFFF);
+        FTM_SetupQuadDecode(In.Base, &phase, &phase, kFTM_QuadCountAndDir);
+        In.Base->CNT = 0;
+
+        Wraps[i] = 0;
+        Taken[i] = 0;
+        FTM_ClearStatusFlags(In.Base, kFTM_TimeOverflowFlag);
+        NVIC_SetVector(In.Irq, (uint32_t)handlers[i]);
+        NVIC_EnableIRQ(In.Irq);
+        FTM_EnableInterrupts(In.Base, kFTM_TimeOverflowInterruptEnable);
+
+        // the filter runs from the bus clock, the pulses clock the counter
+        FTM_StartTimer(In.Base, kFTM_SystemClock);
+    }
+    return PULSESUCCESS;
+}
+
+// ============================================================================
+void PulseCounter::stop() {
+    if (Started == 0) {
+        return;
+    }
+    for (size_t i = 0; i < Started; ++i) {
+        const PulseInput &In = pulse_inputs[i];
+        NVIC_DisableIRQ(In.Irq);
+        FTM_Deinit(In.Base);
+    }
+    Started = 0;
+    sleep_manager_unlock_deep_sleep();
+}
+
+// ============================================================================
+uint32_t PulseCounter::take(size_t channel) {
+    int64_t Now = position(channel);
+    int64_t Pulses = Now - Taken[channel];
+    Taken[channel] = Now;
+    // the direction does not matter, the phase B pin may be tied low
+    return (uint32_t)(Pulses < 0 ? -Pulses : Pulses);
+}
+
+// ============================================================================
+int64_t PulseCounter::total(size_t channel) { return position(channel); }
+
+int64_t PulseCounter::position(size_t channel) {
+    FTM_Type *base = pulse_inputs[channel].Base;
+    core_util_critical_section_enter();
+    // an overflow that is still pending belongs to the count, and one can
+    // come between the flag and the counter
+    onOverflow(channel);
+    uint32_t Count = base->CNT;
+    if (FTM_GetStatusFlags(base) & kFTM_TimeOverflowFlag) {
+        onOverflow(channel);
+        Count = base->CNT;
+    }
+    int64_t Position = (int64_t)Wraps[channel] * 0x10000 + Count;
+    core_util_critical_section_exit();
+    return Position;
+}
+
+// ============================================================================
+void PulseCounter::onOverflow1() { Counter->onOverflow(0); }
+
+void PulseCounter::onOverflow2() { Counter->onOverflow(1); }
+
+// TOFDIR says whether the counter went over the top or under the bottom
+void PulseCounter::onOverflow(size_t channel) {
+    FTM_Type *base = pulse_inputs[channel].Base;
+    if (!(FTM_GetStatusFlags(base) & kFTM_TimeOverflowFlag)) {
+        return;
+    }
+    if (FTM_GetQuadDecoderFlags(base) &
+        kFTM_QuadDecoderCountingOverflowOnTopFlag) {
+        ++Wraps[channel];
+    } else {
+        --Wraps[channel];
+    }
+    FTM_ClearStatusFlags(base, kFTM_TimeOverflowFlag);
+}
+
+#endif // PULSECHANNELS
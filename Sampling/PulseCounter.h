@@ -0,0 +1,85 @@
+#ifndef PULSECOUNTER_H
+#define PULSECOUNTER_H
+/// \file
+/// \brief Counts the pulses of utility meters in hardware, as more ports
+/// after the pins and the external ADC.
+///
+/// Every counter is the 16-bit counter of a FlexTimer in its quadrature
+/// decoder's count and direction mode. The meter's pulses go to the
+/// phase A pin and count the FTM up, the phase B pin sets the direction
+/// and is pulled up, so it is left open. Only the overflow of the counter
+/// raises an interrupt, one every 65536 pulses, so pulses into the kHz
+/// range cost no CPU and none are lost while the loop is busy. The phase
+/// filter takes out glitches of under a microsecond, a meter with a relay
+/// output needs its own debouncing.
+///
+/// The LPTMR, which could count in deep sleep, is the kernel's low-power
+/// ticker. The FTMs stop without the bus clock, so deep sleep is locked
+/// while the counters run.
+///
+/// The reading of a pulse port is the number of pulses since the reading
+/// before, up to 0xFFFF, as a raw reading. Its Multiplier is 65535 times
+/// the unit of one pulse, 65.535 for a meter with 1000 pulses per kWh.
+
+#include "mbed.h"
+
+/// How many counters there are, up to PULSEMAXCHANNELS. 0 turns them off.
+/// Set with "pulse-counters" in mbed_app.json.
+#ifdef MBED_CONF_APP_PULSE_COUNTERS
+#define PULSECHANNELS MBED_CONF_APP_PULSE_COUNTERS
+#else
+#define PULSECHANNELS (0)
+#endif
+
+/// FTM1 with its phase A on PTB0 and phase B on PTB1, and FTM2 on PTB18
+/// and PTB19
+#define PULSEMAXCHANNELS (2)
+
+static_assert(PULSECHANNELS <= PULSEMAXCHANNELS,
+              "only two FTMs have a quadrature decoder");
+
+/// a constant value that is returned from counter functions upon success
+#define PULSESUCCESS (0)
+
+class PulseCounter {
+  public:
+    PulseCounter();
+
+    ~PulseCounter();
+
+    /// Sets up the pins and the FTMs and starts counting from 0
+    /// \returns PULSESUCCESS, or a negative integer if an FTM did not start
+    int start();
+
+    /// Stops the FTMs
+    void stop();
+
+    /// Returns the pulses on channel since the last take()
+    uint32_t take(size_t channel);
+
+    /// Returns the pulses on channel since start()
+    int64_t total(size_t channel);
+
+    /// Returns the number of counters
+    size_t count() const { return PULSECHANNELS; }
+
+  private:
+    static void onOverflow1();
+    static void onOverflow2();
+    void onOverflow(size_t channel);
+
+    /// the counter with its wraps, which is only read with the interrupts
+    /// off
+    int64_t position(size_t channel);
+
+    /// the wraps of every counter, up or down
+    volatile int32_t Wraps[PULSEMAXCHANNELS];
+
+    /// the position of the last take()
+    int64_t Taken[PULSEMAXCHANNELS];
+
+    /// the channels that start() set up, stop() only touches those
+    size_t Started;
+};
+
+#endif // PULSECOUNTER
@@ -0,0 +1,93 @@
+/// \file
+/// \brief Implementation of the quantile sketch
+#include "QuantileSketch.h"
+
+#include <string.h>
+
+/// The readings that have a bin each
+#define QUANTILEEXACT (2 << QUANTILEBITS)
+
+// the bin of Raw
+static size_t binOf(uint16_t Raw) {
+    if (Raw < QUANTILEEXACT) {
+        return Raw;
+    }
+    int Octave = 31 - __builtin_clz(Raw);
+    int Shift = Octave - QUANTILEBITS;
+    size_t Step = (Raw >> Shift) & ((1U << QUANTILEBITS) - 1);
+    return QUANTILEEXACT +
+           (size_t)(Octave - QUANTILEBITS - 1) * (1U << QUANTILEBITS) + Step;
+}
+
+// the smallest reading of Bin, and how many readings it is wide
+static void binRange(size_t Bin, uint32_t &Low, uint32_t &Width) {
+    if (Bin < QUANTILEEXACT) {
+        Low = Bin;
+        Width = 1;
+        return;
+    }
+    size_t Above = Bin - QUANTILEEXACT;
+    int Shift = (int)(Above >> QUANTILEBITS) + 1;
+    uint32_t Step = Above & ((1U << QUANTILEBITS) - 1);
+    Low = ((1U << QUANTILEBITS) + Step) << Shift;
+    Width = 1U << Shift;
+}
+
+QuantileSketch::QuantileSketch() { clear(); }
+
+// ============================================================================
+void QuantileSketch::clear() {
+    memset(Bins, 0, sizeof(Bins));
+    Count = 0;
+}
+
+// ============================================================================
+void QuantileSketch::add(uint16_t Raw) {
+    if (Count == 0xFFFF) {
+        return;
+    }
+    ++Bins[binOf(Raw)];
+    ++Count;
+}
+
+// ============================================================================
+void QuantileSketch::merge(const QuantileSketch &Other) {
+    for (size_t b = 0; b < QUANTILEBINS; ++b) {
+        uint16_t Room = 0xFFFF - Count;
+        uint16_t Added = Other.Bins[b] < Room ? Other.Bins[b] : Room;
+        Bins[b] += Added;
+        Count += Added;
+    }
+}
+
+// ============================================================================
+uint16_t QuantileSketch::quantile(float Fraction, uint16_t Min,
+                                  uint16_t Max) const {
+    if (Count == 0) {
+        return Min;
+    }
+
+    // the rank of the quantile among the readings, from 0
+    float Rank = Fraction * (float)(Count - 1);
+    uint32_t Before = 0;
+    for (size_t b = 0; b < QUANTILEBINS; ++b) {
+        if (Bins[b] == 0 || (float)(Before + Bins[b]) <= Rank) {
+            Before += Bins[b];
+            continue;
+        }
+
+        // the readings of a bin are taken as spread evenly over it
+        uint32_t Low, Width;
+        binRange(b, Low, Width);
+        float Value = (float)Low + ((Rank - (float)Before) + 0.5f) /
+                                       (float)Bins[b] * (float)Width;
+        if (Value <= (float)Min) {
+            return Min;
+        }
+        if (Value >= (float)Max) {
+            return Max;
+        }
+        return (uint16_t)Value;
+    }
+    return Max;
+}
@@ -0,0 +1,50 @@
+#ifndef QUANTILESKETCH_H
+#define QUANTILESKETCH_H
+/// \file
+/// \brief A histogram of the raw readings of one port in a fixed amount of
+/// memory, from which its quantiles are read.
+///
+/// The bins are log-linear, like an HDR histogram: the readings below
+/// 2^(QUANTILEBITS + 1) each have a bin, and every octave above them is
+/// split into 2^QUANTILEBITS bins. A bin is then at most an eighth of its
+/// readings wide, and a quantile is interpolated within its bin, so it is
+/// within a few percent of the exact one however many readings went in.
+/// The bins of two sketches of the same port add up to the sketch of both.
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// The bits of a reading below its leading one that pick its bin
+#define QUANTILEBITS (3)
+
+/// The bins, enough for every 16-bit reading
+#define QUANTILEBINS                                                          \
+    ((2 << QUANTILEBITS) + (15 - QUANTILEBITS) * (1 << QUANTILEBITS))
+
+/// The readings of one port, at most 0xFFFF of them
+class QuantileSketch {
+  public:
+    QuantileSketch();
+
+    /// Empties the sketch
+    void clear();
+
+    /// Adds one reading
+    void add(uint16_t Raw);
+
+    /// Adds the readings of Other
+    void merge(const QuantileSketch &Other);
+
+    /// \returns the number of readings
+    uint16_t count() const { return Count; }
+
+    /// Reads quantile Fraction, from 0 to 1, clamped to the smallest and
+    /// largest reading, which the caller keeps exactly
+    uint16_t quantile(float Fraction, uint16_t Min, uint16_t Max) const;
+
+  private:
+    uint16_t Bins[QUANTILEBINS];
+    uint16_t Count;
+};
+
+#endif // QUANTILESKETCH
@@ -0,0 +1,86 @@
+/// \file
+/// \brief Implementation of the streaming RMS engine
+#include "RMSEngine.h"
+
+#include <cmath>
+
+RMSEngine::RMSEngine(size_t count, uint32_t window)
+    : Window(window), Frames(0), Windows(0),
+      Count(count < SCANMAXPORTS ? count : SCANMAXPORTS) {
+    if (Window == 0) {
+        Window = 1;
+    } else if (Window > MAXRMSWINDOW) {
+        Window = MAXRMSWINDOW;
+    }
+    for (size_t i = 0; i < SCANMAXPORTS; ++i) {
+        resetSums(Current[i]);
+        resetSums(Last[i]);
+    }
+}
+
+void RMSEngine::resetSums(Sums &sums) {
+    sums.Sum = 0;
+    sums.SumSquares = 0;
+    sums.Min = UINT16_MAX;
+    sums.Max = 0;
+}
+
+// ============================================================================
+void RMSEngine::push(const uint16_t *frame, size_t count) {
+    if (count > Count) {
+        count = Count;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Sums &sums = Current[i];
+        uint32_t sample = frame[i];
+        sums.Sum += sample;
+        sums.SumSquares += sample * sample;
+        if (sample < sums.Min) {
+            sums.Min = sample;
+        }
+        if (sample > sums.Max) {
+            sums.Max = sample;
+        }
+    }
+
+    if (++Frames >= Window) {
+        for (size_t i = 0; i < count; ++i) {
+            Last[i] = Current[i];
+            resetSums(Current[i]);
+        }
+        Frames = 0;
+        ++Windows;
+    }
+}
+
+bool RMSEngine::read(size_t port, WaveformStats &stats) {
+    if (port >= Count) {
+        return false;
+    }
+
+    core_util_critical_section_enter();
+    bool ready = Windows != 0;
+    Sums sums = Last[port];
+    core_util_critical_section_exit();
+
+    if (!ready) {
+        return false;
+    }
+
+    // N^2 * variance = N * sum(x^2) - sum(x)^2, done in 64 bit integers so
+    // that the subtraction does not lose the precision a float would
+    uint64_t n = Window;
+    uint64_t spread = n * sums.SumSquares - sums.Sum * sums.Sum;
+    float mean = (float)sums.Sum / Window;
+    float variance = (float)spread / ((float)n * (float)n);
+
+    const float scale = 1.0f / (float)0xFFFF;
+    float peak_high = sums.Max - mean;
+    float peak_low = mean - sums.Min;
+
+    stats.Mean = mean * scale;
+    stats.RMS = sqrtf(variance) * scale;
+    stats.Peak = (peak_high > peak_low ? peak_high : peak_low) * scale;
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef RMSENGINE_H
+#define RMSENGINE_H
+/// \file
+/// \brief Streaming mean, true-RMS and peak of the AC sensor ports
+
+#include "ADCScan.h"
+#include "mbed.h"
+
+/// The longest window in frames. Longer windows can overflow the 64 bit
+/// integer math in RMSEngine::read()
+#define MAXRMSWINDOW (32768)
+
+/// The aggregates of one port over one window.
+/// All of the values are scaled from 0.0 to 1.0 like AnalogIn::read()
+struct WaveformStats {
+    float Mean; ///< average of the window (the DC part of the signal)
+    float RMS;  ///< RMS of the window with the mean taken out
+    float Peak; ///< largest distance of a sample from the mean
+};
+
+/// Keeps running sums of every port over a window of scan frames.
+///
+/// push() only does integer adds and one 16x16 multiply per port, so it can
+/// run from the scan's frame callback at high frame rates. The square root
+/// and the divisions are done in read().
+class RMSEngine {
+  public:
+    /// \param count The number of ports in every frame
+    /// \param window The number of frames in every window
+    RMSEngine(size_t count, uint32_t window);
+
+    /// Adds a frame to every port's window.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Gets the aggregates of the last complete window of port.
+    /// \returns false if no window has been completed yet
+    bool read(size_t port, WaveformStats &stats);
+
+    /// Returns the number of frames in every window
+    uint32_t window() const { return Window; }
+
+  private:
+    struct Sums {
+        uint64_t Sum;
+        uint64_t SumSquares;
+        uint16_t Min;
+        uint16_t Max;
+    };
+
+    void resetSums(Sums &sums);
+
+    /// the window that is being summed right now
+    Sums Current[SCANMAXPORTS];
+
+    /// the last complete window
+    Sums Last[SCANMAXPORTS];
+
+    uint32_t Window;
+
+    /// frames in the current window
+    uint32_t Frames;
+
+    /// number of completed windows
+    volatile uint32_t Windows;
+
+    size_t Count;
+};
+
+#endif // RMSENGINE
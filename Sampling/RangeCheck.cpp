@@ -0,0 +1,79 @@
+/// \file
+/// \brief Implementation of the range check
+#include "RangeCheck.h"
+
+RangeCheck::RangeCheck() : AlwaysAbove(0), AlwaysBelow(0), Inverted(0) {
+    memset(High, 0xFF, sizeof(High));
+    memset(Low, 0, sizeof(Low));
+}
+
+// ============================================================================
+void RangeCheck::configure(const vector<PortInfo> &Ports) {
+    memset(High, 0xFF, sizeof(High));
+    memset(Low, 0, sizeof(Low));
+    AlwaysAbove = 0;
+    AlwaysBelow = 0;
+    Inverted = 0;
+    for (size_t i = 0; i < Ports.size() && i < FRAMEMAXPORTS; ++i) {
+        const PortInfo &Port = Ports[i];
+        if (Port.Multiplier == 0.0f) {
+            continue;
+        }
+
+        // the value is Raw / 0xFFFF * Multiplier, a negative multiplier
+        // swaps which end of the raw readings the floor and ceiling are at
+        double Scale = (double)0xFFFF / Port.Multiplier;
+        double Above = Port.RangeCeiling * Scale;
+        double Below = Port.RangeFloor * Scale;
+        if (Port.Multiplier < 0.0f) {
+            Above = Port.RangeFloor * Scale;
+            Below = Port.RangeCeiling * Scale;
+            Inverted |= 1U << i;
+        }
+
+        if (Above < 0.0) {
+            AlwaysAbove |= 1U << i;
+        } else if (Above < 0xFFFF) {
+            High[i] = (uint16_t)floor(Above);
+        }
+        if (Below > 0xFFFF) {
+            AlwaysBelow |= 1U << i;
+        } else if (Below > 0.0) {
+            Low[i] = (uint16_t)ceil(Below);
+        }
+    }
+}
+
+// ============================================================================
+void RangeCheck::check(SampleFrame &Frame) const {
+    uint32_t Above = AlwaysAbove;
+    uint32_t Below = AlwaysBelow;
+#if defined(__ARM_FEATURE_SIMD32)
+    // USUB16 sets the GE flags of each half that did not borrow, and SEL
+    // picks the halves by them, so a half is 0xFFFF where the limit was
+    // crossed. The readings of the frame are not word aligned
+    for (size_t i = 0; i < FRAMEMAXPORTS; i += 2) {
+        uint32_t Raw, Limit;
+        memcpy(&Raw, Frame.Raw + i, sizeof(Raw));
+        memcpy(&Limit, High + i, sizeof(Limit));
+        __USUB16(Limit, Raw);
+        uint32_t Crossed = __SEL(0, 0xFFFFFFFF);
+        Above |= ((Crossed & 1U) | ((Crossed >> 15) & 2U)) << i;
+
+        memcpy(&Limit, Low + i, sizeof(Limit));
+        __USUB16(Raw, Limit);
+        Crossed = __SEL(0, 0xFFFFFFFF);
+        Below |= ((Crossed & 1U) | ((Crossed >> 15) & 2U)) << i;
+    }
+#else
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Above |= (uint32_t)(Frame.Raw[i] > High[i]) << i;
+        Below |= (uint32_t)(Frame.Raw[i] < Low[i]) << i;
+    }
+#endif
+    uint16_t Over = ((Above & ~Inverted) | (Below & Inverted)) & Frame.PortMask;
+    uint16_t Under = ((Below & ~Inverted) | (Above & Inverted)) &
+                     Frame.PortMask & ~Over;
+    Frame.OverMask = Over;
+    Frame.UnderMask = Under;
+}
@@ -0,0 +1,44 @@
+#ifndef RANGECHECK_H
+#define RANGECHECK_H
+/// \file
+/// \brief Checks every port of a frame against its range in one pass.
+///
+/// The floor and ceiling of every port are turned into raw readings when
+/// the ports are configured, so the check compares the 16 bit readings of
+/// the frame as they are, without the multiplier and without floats. On
+/// the Cortex-M4 two ports are compared at once with __USUB16() and
+/// __SEL(). A reading that is out of range keeps its raw value and is only
+/// marked in OverMask or UnderMask, the requests turn the marks into their
+/// error values.
+
+#include "Structs.h"
+
+/// Holds the range of every port as raw readings. Only the sampling loop
+/// uses it.
+class RangeCheck {
+  public:
+    RangeCheck();
+
+    /// Takes the range and multiplier of every port from Ports
+    void configure(const vector<PortInfo> &Ports);
+
+    /// Sets the OverMask and UnderMask of Frame for the ports in its
+    /// PortMask. A port that is over its ceiling is not under its floor too.
+    void check(SampleFrame &Frame) const;
+
+  private:
+    /// a reading is above if it is more than High, and below if it is less
+    /// than Low. Pairs of them are read as one word
+    alignas(4) uint16_t High[FRAMEMAXPORTS];
+    alignas(4) uint16_t Low[FRAMEMAXPORTS];
+
+    /// ports whose limit is past the end of the raw readings, so every
+    /// reading is above or below
+    uint16_t AlwaysAbove;
+    uint16_t AlwaysBelow;
+
+    /// ports with a negative multiplier, a reading above is under the floor
+    uint16_t Inverted;
+};
+
+#endif // RANGECHECK
@@ -0,0 +1,107 @@
+/// \file
+/// \brief Implementation of the per-port reading intervals
+#include "RateSchedule.h"
+
+#include <cmath>
+
+// the greatest common divisor of a and b
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// rounds seconds to a whole number of RATETICKMS steps, at least one
+static uint32_t roundMs(float seconds) {
+    float Steps = roundf(seconds * 1000.0f / RATETICKMS);
+    if (Steps < 1.0f) {
+        return RATETICKMS;
+    }
+    if (Steps > (float)(UINT32_MAX / RATETICKMS)) {
+        return UINT32_MAX / RATETICKMS * RATETICKMS;
+    }
+    return (uint32_t)Steps * RATETICKMS;
+}
+
+RateSchedule::RateSchedule()
+    : Ports(0), Polling(0.0f), TickMs(0), Hyper(1), Count(0) {
+    memset(PortMs, 0, sizeof(PortMs));
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        Every[i] = 1;
+    }
+}
+
+// ============================================================================
+void RateSchedule::configure(const vector<PortInfo> &ports) {
+    Ports = ports.size() < FRAMEMAXPORTS ? ports.size() : FRAMEMAXPORTS;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        PortMs[i] = i < Ports && ports[i].Interval > 0.0f
+                        ? roundMs(ports[i].Interval)
+                        : 0;
+    }
+    // the next tick() plans again
+    Polling = 0.0f;
+}
+
+// ============================================================================
+float RateSchedule::tick(float interval) {
+    if (interval != Polling) {
+        Polling = interval;
+        plan();
+    }
+    return TickMs / 1000.0f;
+}
+
+void RateSchedule::plan() {
+    uint32_t PollingMs = roundMs(Polling);
+    TickMs = PollingMs;
+    for (size_t i = 0; i < Ports; ++i) {
+        if (PortMs[i] != 0) {
+            TickMs = gcd(TickMs, PortMs[i]);
+        }
+    }
+
+    // ports after the configured ones have no reading, they go with every
+    // tick so they never hold a bit back
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        uint32_t Ms = i >= Ports ? TickMs : PortMs[i] ? PortMs[i] : PollingMs;
+        Every[i] = Ms / TickMs;
+    }
+
+    // the hyperperiod, which is only kept while it fits
+    uint64_t Lcm = 1;
+    for (size_t i = 0; i < FRAMEMAXPORTS && Lcm != 0; ++i) {
+        Lcm = Lcm / gcd((uint32_t)Lcm, Every[i]) * Every[i];
+        if (Lcm > UINT32_MAX) {
+            Lcm = 0;
+        }
+    }
+    Hyper = (uint32_t)Lcm;
+    Count = 0;
+}
+
+// ============================================================================
+uint32_t RateSchedule::due() const {
+    uint32_t Due = 0;
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (Count % Every[i] == 0) {
+            Due |= 1U << i;
+        }
+    }
+    return Due;
+}
+
+// ============================================================================
+void RateSchedule::filter(SampleFrame &Sample) {
+    uint32_t Due = due();
+    Sample.PortMask &= Due;
+    Sample.OverMask &= Due;
+    Sample.UnderMask &= Due;
+    ++Count;
+    if (Hyper != 0 && Count >= Hyper) {
+        Count = 0;
+    }
+}
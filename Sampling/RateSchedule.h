@@ -0,0 +1,69 @@
+#ifndef RATESCHEDULE_H
+#define RATESCHEDULE_H
+/// \file
+/// \brief Reads every port at its own interval instead of all of them at
+/// the board's polling interval.
+///
+/// A port whose sensor has an Interval, the 13th field of its Sensor line,
+/// is read every that many seconds, the others at the polling interval that
+/// the server can change. The sampling loop runs at the tick, the greatest
+/// common divisor of all of the intervals in RATETICKMS steps, and every
+/// interval is a whole number of ticks. Tick 0 of every hyperperiod, the
+/// least common multiple of the ticks of all the ports, reads all of them,
+/// so a minute port stays on the whole minute of the second ports. A port
+/// that is not due in a tick is taken out of the reading, so it is neither
+/// sent nor logged, and the requests and the backup log only carry the
+/// ports that have a reading. The scan, the oversampling and the RMS
+/// windows keep running for all of them, so a reading that is due is as
+/// good as one at the polling interval.
+
+#include "Structs.h"
+
+/// Every interval is rounded to this many milliseconds, which is the
+/// shortest tick
+#define RATETICKMS (100)
+
+class RateSchedule {
+  public:
+    RateSchedule();
+
+    /// Takes the Interval of every port, starting over at tick 0
+    void configure(const vector<PortInfo> &ports);
+
+    /// Returns the seconds between two readings of the loop for the polling
+    /// interval interval, which the ports without their own use. A new
+    /// interval starts over at tick 0
+    float tick(float interval);
+
+    /// Takes the ports that are not due in this tick out of Sample, and
+    /// moves on to the next tick
+    void filter(SampleFrame &Sample);
+
+    /// Returns the bits of the ports that are due in this tick
+    uint32_t due() const;
+
+  private:
+    /// works out the tick, the ticks of every port and the hyperperiod
+    void plan();
+
+    /// the Interval of every port in milliseconds, 0 for the polling
+    /// interval
+    uint32_t PortMs[FRAMEMAXPORTS];
+    size_t Ports;
+
+    /// the polling interval that the plan is for, in seconds
+    float Polling;
+    uint32_t TickMs;
+
+    /// every how many ticks each port is read
+    uint32_t Every[FRAMEMAXPORTS];
+
+    /// the ticks of the hyperperiod, 0 if it does not fit 32 bits and the
+    /// count just wraps
+    uint32_t Hyper;
+
+    /// the tick in the hyperperiod
+    uint32_t Count;
+};
+
+#endif // RATESCHEDULE
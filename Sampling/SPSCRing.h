@@ -0,0 +1,136 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+/// \file
+/// \brief A lock-free ring buffer for one producer and one consumer.
+///
+/// CircularBuffer wraps every push() and pop() in a critical section. Here
+/// only the producer writes Head and only the consumer writes Tail, so an
+/// acquire load of the other side's index and a release store of its own is
+/// all either side needs. The producer can be an interrupt handler and the
+/// consumer a thread, or the other way around, without masking interrupts.
+
+#include "mbed.h"
+
+#include "platform/Span.h"
+#include "platform/mbed_atomic.h"
+
+/// A ring of N elements of T. N has to be a power of two so that the free
+/// running indexes stay correct when they wrap at 2^32.
+///
+/// push(), push_n() may only be called from a single producer, and pop(),
+/// pop_n(), peek() and consume() only from a single consumer.
+template <typename T, uint32_t N>
+class SPSCRing : private NonCopyable<SPSCRing<T, N> > {
+    MBED_STATIC_ASSERT(N > 0 && (N & (N - 1)) == 0,
+                       "SPSCRing size has to be a power of two");
+
+  public:
+    SPSCRing() : Head(0), Tail(0) {}
+
+    /// Adds item to the ring (producer only)
+    /// \returns false if the ring is full
+    bool push(const T &item) { return push_n(&item, 1) == 1; }
+
+    /// Adds as many of the count items as there is room for (producer only)
+    /// \returns the number of items added
+    size_t push_n(const T *items, size_t count) {
+        uint32_t head = core_util_atomic_load_explicit_u32(
+            &Head, mbed_memory_order_relaxed);
+        uint32_t tail = core_util_atomic_load_explicit_u32(
+            &Tail, mbed_memory_order_acquire);
+
+        uint32_t room = N - (head - tail);
+        if (count > room) {
+            count = room;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            Buffer[(head + i) % N] = items[i];
+        }
+
+        // the items have to be in place before the consumer can see them
+        core_util_atomic_store_explicit_u32(&Head, head + count,
+                                            mbed_memory_order_release);
+        return count;
+    }
+
+    /// Takes the oldest item out of the ring (consumer only)
+    /// \returns false if the ring is empty
+    bool pop(T &item) { return pop_n(&item, 1) == 1; }
+
+    /// Takes up to count of the oldest items out of the ring (consumer only)
+    /// \returns the number of items copied into items
+    size_t pop_n(T *items, size_t count) {
+        uint32_t tail = core_util_atomic_load_explicit_u32(
+            &Tail, mbed_memory_order_relaxed);
+        uint32_t head = core_util_atomic_load_explicit_u32(
+            &Head, mbed_memory_order_acquire);
+
+        if (count > head - tail) {
+            count = head - tail;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            items[i] = Buffer[(tail + i) % N];
+        }
+
+        // the items have to be copied out before the producer reuses them
+        core_util_atomic_store_explicit_u32(&Tail, tail + count,
+                                            mbed_memory_order_release);
+        return count;
+    }
+
+    /// Returns the oldest items without taking them out (consumer only).
+    /// The span stops at the end of the buffer, so a second peek() after
+    /// consume() returns the rest if the items wrap around.
+    Span<const T> peek() const {
+        uint32_t tail = core_util_atomic_load_explicit_u32(
+            &Tail, mbed_memory_order_relaxed);
+        uint32_t head = core_util_atomic_load_explicit_u32(
+            &Head, mbed_memory_order_acquire);
+
+        uint32_t start = tail % N;
+        uint32_t count = head - tail;
+        if (count > N - start) {
+            count = N - start;
+        }
+        return Span<const T>(&Buffer[start], count);
+    }
+
+    /// Drops the count oldest items, after they were used through peek()
+    /// (consumer only)
+    void consume(size_t count) {
+        uint32_t tail = core_util_atomic_load_explicit_u32(
+            &Tail, mbed_memory_order_relaxed);
+        uint32_t head = core_util_atomic_load_explicit_u32(
+            &Head, mbed_memory_order_acquire);
+
+        if (count > head - tail) {
+            count = head - tail;
+        }
+        core_util_atomic_store_explicit_u32(&Tail, tail + count,
+                                            mbed_memory_order_release);
+    }
+
+    /// Returns the number of items in the ring. It can be out of date as
+    /// soon as it returns if the other side is running.
+    size_t size() const {
+        return core_util_atomic_load_u32(&Head) -
+               core_util_atomic_load_u32(&Tail);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    bool full() const { return size() == N; }
+
+    static size_t capacity() { return N; }
+
+  private:
+    T Buffer[N];
+
+    /// the number of items ever pushed, only written by the producer
+    volatile uint32_t Head;
+
+    /// the number of items ever taken out, only written by the consumer
+    volatile uint32_t Tail;
+};
+
+#endif // SPSCRING
@@ -0,0 +1,105 @@
+/// \file
+/// \brief Implementation of the sample clock
+#include "SampleClock.h"
+
+#include "hal/lp_ticker_api.h"
+#include "hal/ticker_api.h"
+
+/// the flag that is set when a frame was taken
+#define CLOCKTAKEN (1U << 0)
+
+SampleClock::SampleClock()
+    : Count(0), Frames(0), Last(0), Due(0), Period(0), Interval(0.0f),
+      Rate(0.0f), TakenFrame(0), TakenUs(0), Taken(false), Missed(0) {
+    memset(Held, 0, sizeof(Held));
+}
+
+// ============================================================================
+void SampleClock::start(float interval, float rate) {
+    core_util_critical_section_enter();
+    Rate = rate;
+    Interval = interval;
+    Period = (uint64_t)(interval * rate * 65536.0f);
+    Frames = 0;
+    Last = 0;
+    Due = Period > 0 ? Period : 1ULL << 16;
+    TakenFrame = 0;
+    Taken = false;
+    core_util_critical_section_exit();
+    Flags.clear(CLOCKTAKEN);
+}
+
+// ============================================================================
+void SampleClock::setInterval(float interval) {
+    core_util_critical_section_enter();
+    Period = (uint64_t)(interval * Rate * 65536.0f);
+    Interval = interval;
+    Due = Last + Period;
+
+    // a shorter interval may already be over
+    if (Due <= Frames) {
+        Due = Frames + (1ULL << 16);
+    }
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void SampleClock::align(uint64_t at_us) {
+    core_util_critical_section_enter();
+    uint64_t Frame = TakenFrame;
+    uint64_t Us = TakenUs;
+    core_util_critical_section_exit();
+    if (Frame == 0 || at_us <= Us) {
+        return;
+    }
+    // counted from the last frame that was taken, so the PDB and the
+    // ticker only drift apart over one interval
+    uint64_t Target =
+        Frame + (uint64_t)((double)(at_us - Us) * Rate / 1e6 + 0.5);
+    core_util_critical_section_enter();
+    if ((Target << 16) > Frames) {
+        Due = Target << 16;
+    }
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+uint64_t SampleClock::takenMicros() const {
+    core_util_critical_section_enter();
+    uint64_t Us = TakenUs;
+    core_util_critical_section_exit();
+    return Us;
+}
+
+// ============================================================================
+void SampleClock::push(const uint16_t *frame, size_t count) {
+    Frames += 1ULL << 16;
+    if (Period == 0 || Frames < Due) {
+        return;
+    }
+    // the ticker keeps the time of the reading for align()
+    TakenFrame = Frames >> 16;
+    TakenUs = ticker_read_us(get_lp_ticker_data());
+    Last = Due;
+    Due += Period;
+    if (Taken) {
+        ++Missed;
+    }
+    Count = count < SCANMAXPORTS ? count : SCANMAXPORTS;
+    memcpy(Held, frame, Count * sizeof(uint16_t));
+    Taken = true;
+    Flags.set(CLOCKTAKEN);
+}
+
+// ============================================================================
+bool SampleClock::wait(uint16_t *frame, uint32_t timeout_ms) {
+    uint32_t Got = Flags.wait_any(CLOCKTAKEN, timeout_ms);
+    if (Got & osFlagsError) {
+        return false;
+    }
+    core_util_critical_section_enter();
+    memcpy(frame, Held, Count * sizeof(uint16_t));
+    Taken = false;
+    core_util_critical_section_exit();
+    return true;
+}
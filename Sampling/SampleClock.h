@@ -0,0 +1,91 @@
+#ifndef SAMPLECLOCK_H
+#define SAMPLECLOCK_H
+/// \file
+/// \brief Times the readings by the scan's frames instead of the kernel
+/// tick.
+///
+/// The PDB starts every scan frame from the bus clock, so counting frames
+/// is a clock that no thread can hold up. The sample clock picks the frame
+/// every interval in the frame callback and keeps it, and the sampling loop
+/// reads that frame whenever it gets to run. A reading is then always
+/// a whole number of frames after the one before, and the time between them
+/// does not depend on how long the loop or the network took. An interval
+/// that is not a whole number of frames carries the rest over to the next
+/// reading, so the readings do not drift either.
+///
+/// In low-power mode the scan is stopped between readings, and the loop
+/// times them by the kernel again.
+
+#include "ADCScan.h"
+
+/// Picks a frame out of the scan every interval.
+class SampleClock {
+  public:
+    SampleClock();
+
+    /// Takes a frame one interval from now, and one every interval after
+    /// that.
+    /// \param interval The seconds between two readings
+    /// \param rate The scan frames per second
+    void start(float interval, float rate);
+
+    /// Moves to a new interval, counted from the last frame that was taken
+    void setInterval(float interval);
+
+    /// Takes the next reading on the frame nearest to at_us, in the
+    /// microseconds of the low power ticker, instead of one interval after
+    /// the last one. Does nothing before the first frame was taken, or if
+    /// that frame already went by
+    void align(uint64_t at_us);
+
+    /// Returns when the last frame that was taken came in, in the
+    /// microseconds of the low power ticker
+    uint64_t takenMicros() const;
+
+    /// Returns the interval that the frames are taken at
+    float interval() const { return Interval; }
+
+    /// Counts a scan frame, and keeps it if it is due.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Waits for the next frame that was taken and copies it into frame.
+    /// \param frame Needs to hold count() values of the scan
+    /// \param timeout_ms How long to wait at most
+    /// \returns false if no frame came in time
+    bool wait(uint16_t *frame, uint32_t timeout_ms);
+
+    /// Returns the number of frames that were taken before wait() had
+    /// picked up the one before, those readings were lost
+    uint32_t missed() const { return Missed; }
+
+  private:
+    /// where the frames are between the callback and wait()
+    EventFlags Flags;
+    uint16_t Held[SCANMAXPORTS];
+    size_t Count;
+
+    /// the frames since start(), when the last reading and the next one
+    /// are due, with 16 bits for the part of a frame
+    uint64_t Frames;
+    uint64_t Last;
+    uint64_t Due;
+
+    /// the frames between two readings, with 16 bits for the part of a
+    /// frame
+    uint64_t Period;
+
+    float Interval;
+    float Rate;
+
+    /// the number of the last frame that was taken and when it came in,
+    /// 0 before the first one
+    uint64_t TakenFrame;
+    uint64_t TakenUs;
+
+    /// true from when a frame was taken until wait() picked it up
+    volatile bool Taken;
+    volatile uint32_t Missed;
+};
+
+#endif // SAMPLECLOCK
@@ -0,0 +1,10 @@
+#ifndef SCANLIMITS_H
+#define SCANLIMITS_H
+/// \file
+/// \brief How wide a scan frame can be, for the code that takes the frames
+/// without needing the ADC, eDMA and PDB drivers of ADCScan.h.
+
+/// The maximum number of pins that can be in one scan
+#define SCANMAXPORTS (16)
+
+#endif // SCANLIMITS_H
@@ -0,0 +1,155 @@
+/// \file
+/// \brief Implementation of the sensor health checks
+#define TRACE_GROUP "hlth"
+#include "SensorHealth.h"
+
+#if SENSORHEALTH
+
+#include "DeferredLog.h"
+
+/// The mean step of a noisy port, in raw counts
+#define SENSORNOISECOUNTS (0xFFFFU * SENSORNOISEPERCENT / 100)
+
+/// The mean step is taken over about this many readings
+#define SENSORSTEPWEIGHT (8)
+
+static const char *const FaultNames[SENSORFAULTKINDS] = {
+    "fine", "stuck", "open", "saturated", "noisy"};
+
+SensorHealth::SensorHealth() : Count(0) { memset(Ports, 0, sizeof(Ports)); }
+
+// ============================================================================
+SensorHealth &sensorHealth() {
+    static SensorHealth Health;
+    return Health;
+}
+
+// ============================================================================
+void SensorHealth::configure(const vector<PortInfo> &Ports, size_t Analog) {
+    size_t count = Analog < Ports.size() ? Analog : Ports.size();
+    if (count > FRAMEMAXPORTS) {
+        count = FRAMEMAXPORTS;
+    }
+    core_util_critical_section_enter();
+    memset(this->Ports, 0, sizeof(this->Ports));
+    Count = count;
+    core_util_critical_section_exit();
+    for (size_t i = 0; i < count; ++i) {
+        this->Ports[i].Checked = Ports[i].Formula.empty();
+        this->Ports[i].LiveZero = !Ports[i].AC && Ports[i].RangeFloor > 0.0f;
+    }
+}
+
+// counts a reading that is like the ones before, up to the limit
+static uint16_t inRow(bool Like, uint16_t Count) {
+    if (!Like) {
+        return 0;
+    }
+    return Count < SENSORFAULTREADINGS ? Count + 1 : Count;
+}
+
+// ============================================================================
+uint8_t SensorHealth::judge(PortHealth &Port, uint16_t Raw) {
+    if (!Port.Seen) {
+        Port.Seen = true;
+        Port.Last = Raw;
+        return SensorFine;
+    }
+    uint32_t Step = Raw > Port.Last ? Raw - Port.Last : Port.Last - Raw;
+    bool AtLow = Raw <= SENSORRAILCOUNTS;
+    bool AtHigh = Raw >= 0xFFFF - SENSORRAILCOUNTS;
+    Port.Same = inRow(Step == 0 && !AtLow && !AtHigh, Port.Same);
+    Port.Low = inRow(AtLow && Port.LiveZero, Port.Low);
+    Port.High = inRow(AtHigh, Port.High);
+    Port.Last = Raw;
+
+    // an exponential mean, the first steps fill it up
+    if (Port.Steps < SENSORFAULTREADINGS) {
+        ++Port.Steps;
+    }
+    Port.Step = Port.Step + Step / SENSORSTEPWEIGHT -
+                Port.Step / SENSORSTEPWEIGHT;
+
+    if (Port.Low >= SENSORFAULTREADINGS) {
+        return SensorOpen;
+    }
+    if (Port.High >= SENSORFAULTREADINGS) {
+        return SensorSaturated;
+    }
+    if (Port.Same >= SENSORFAULTREADINGS) {
+        return SensorStuck;
+    }
+    if (Port.Steps >= SENSORFAULTREADINGS && Port.Step > SENSORNOISECOUNTS) {
+        return SensorNoisy;
+    }
+    return SensorFine;
+}
+
+// ============================================================================
+void SensorHealth::check(SampleFrame &Frame) {
+    uint16_t Faulted = 0;
+    for (size_t i = 0; i < Count; ++i) {
+        PortHealth &Port = Ports[i];
+        if (!Port.Checked) {
+            continue;
+        }
+        if (Frame.hasPort(i)) {
+            uint8_t Now = judge(Port, Frame.Raw[i]);
+            if (Now == SensorFine) {
+                Port.Fine = inRow(true, Port.Fine);
+                if (Port.Fault != SensorFine &&
+                    Port.Fine >= SENSORFAULTREADINGS) {
+                    tr_info("Port %u reads fine again", (unsigned)i);
+                    Port.Fault = SensorFine;
+                }
+            } else if (Now != Port.Fault) {
+                // a fault is reported once, and again if it turns into
+                // another kind
+                tr_warn("Port %u is %s, it is left out from %lu",
+                        (unsigned)i, FaultNames[Now],
+                        (unsigned long)Frame.Timestamp);
+                core_util_critical_section_enter();
+                if (Port.Fault == SensorFine) {
+                    Port.Since = Frame.Timestamp;
+                }
+                Port.Fault = Now;
+                core_util_critical_section_exit();
+                Port.Fine = 0;
+            } else {
+                Port.Fine = 0;
+            }
+        }
+        if (Port.Fault != SensorFine) {
+            Faulted |= 1U << i;
+        }
+    }
+    Frame.PortMask &= ~Faulted;
+    Frame.OverMask &= ~Faulted;
+    Frame.UnderMask &= ~Faulted;
+}
+
+// ============================================================================
+size_t SensorHealth::faults(SensorFault *Faults) const {
+    size_t Found = 0;
+    core_util_critical_section_enter();
+    for (size_t i = 0; i < Count; ++i) {
+        if (Ports[i].Fault != SensorFine) {
+            Faults[Found].Port = i;
+            Faults[Found].Kind = Ports[i].Fault;
+            Faults[Found].Since = Ports[i].Since;
+            ++Found;
+        }
+    }
+    core_util_critical_section_exit();
+    return Found;
+}
+
+// ============================================================================
+void faultValues(const SensorFault &Fault,
+                 uint32_t (&Values)[SENSORFAULTVALUES]) {
+    Values[0] = Fault.Port;
+    Values[1] = Fault.Kind;
+    Values[2] = Fault.Since;
+}
+
+#endif // SENSORHEALTH
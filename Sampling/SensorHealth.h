@@ -0,0 +1,135 @@
+#ifndef SENSORHEALTH_H
+#define SENSORHEALTH_H
+/// \file
+/// \brief Finds the analog sensors that are broken from their readings, and
+/// takes them out of the frames until they read sensibly again.
+///
+/// A sensor that comes off its port keeps sending a reading and, before,
+/// it was sent and logged like any other, or as an error value of the
+/// range check with every reading. Every reading of an analog port now goes
+/// through the rolling statistics of its port, and a port is faulted once
+/// it was, for SENSORFAULTREADINGS readings in a row:
+///  - stuck, the same raw reading every time, away from both rails. A live
+///    ADC reading moves by a count or two even on a steady signal
+///  - open, at the bottom rail, only for a DC port with a RangeFloor above
+///    0, a live zero like 4-20 mA that never reads 0 while it is wired
+///  - saturated, at the top rail
+///  - noisy, with a rolling mean step between readings over
+///    SENSORNOISEPERCENT of the full scale
+///
+/// A faulted port is taken out of every frame after the range check, so
+/// nothing is sent or logged for it, and it is reported once as a warning
+/// and as &Fault[]=Port,Kind,Since with every request, or as "h" in a CBOR
+/// body, while it lasts. It clears after SENSORFAULTREADINGS readings that
+/// look fine. The pulse, Modbus and virtual ports are left alone, a
+/// constant count or register is how they read when nothing happens.
+
+#include "Structs.h"
+
+/// Set to 1 to find the broken sensors and leave them out.
+/// Set with "sensor-health" in mbed_app.json.
+#ifdef MBED_CONF_APP_SENSOR_HEALTH
+#define SENSORHEALTH MBED_CONF_APP_SENSOR_HEALTH
+#else
+#define SENSORHEALTH 0
+#endif
+
+/// How many readings in a row make a fault, and clear it.
+/// Set with "sensor-fault-readings" in mbed_app.json.
+#ifdef MBED_CONF_APP_SENSOR_FAULT_READINGS
+#define SENSORFAULTREADINGS MBED_CONF_APP_SENSOR_FAULT_READINGS
+#else
+#define SENSORFAULTREADINGS (60)
+#endif
+
+/// How close to a rail a reading is at it, in raw counts
+#define SENSORRAILCOUNTS (64)
+
+/// The mean step between readings that is noise, in percent of the full
+/// scale
+#define SENSORNOISEPERCENT (20)
+
+/// The number of values for one fault, in the order they are sent
+#define SENSORFAULTVALUES (3)
+
+/// What is wrong with a port
+enum SensorFaultKind {
+    SensorFine,
+    SensorStuck,
+    SensorOpen,
+    SensorSaturated,
+    SensorNoisy,
+    SENSORFAULTKINDS
+};
+
+/// A port that is faulted
+struct SensorFault {
+    uint8_t Port;
+    uint8_t Kind; ///< a SensorFaultKind
+    uint32_t Since; ///< the Timestamp of the reading that faulted it
+};
+
+/// Keeps the statistics of every analog port. The sampling loop configures
+/// it and checks the frames, faults() is safe to call from any thread.
+class SensorHealth {
+  public:
+    SensorHealth();
+
+    /// Checks the first Analog ports of Ports from the next reading on, and
+    /// starts over
+    void configure(const vector<PortInfo> &Ports, size_t Analog);
+
+    /// Adds the readings of Frame to the statistics, and takes the ports
+    /// that are faulted out of it
+    void check(SampleFrame &Frame);
+
+    /// Copies the faulted ports into Faults, which has room for
+    /// FRAMEMAXPORTS
+    /// \returns the number of faults
+    size_t faults(SensorFault *Faults) const;
+
+  private:
+    struct PortHealth {
+        /// the last raw reading, Seen is false before the first one
+        uint16_t Last;
+        bool Seen;
+
+        /// the readings in a row that were the same, at the bottom rail,
+        /// at the top rail and that looked fine
+        uint16_t Same;
+        uint16_t Low;
+        uint16_t High;
+        uint16_t Fine;
+
+        /// the rolling mean step between readings in raw counts, and how
+        /// many steps went into it
+        uint32_t Step;
+        uint16_t Steps;
+
+        /// false for a virtual port, true for a port that can be open at
+        /// the bottom rail
+        bool Checked;
+        bool LiveZero;
+
+        /// a SensorFaultKind, and the Timestamp it started at
+        volatile uint8_t Fault;
+        volatile uint32_t Since;
+    };
+
+    // what Port reads like with Raw as its next reading
+    static uint8_t judge(PortHealth &Port, uint16_t Raw);
+
+    PortHealth Ports[FRAMEMAXPORTS];
+    size_t Count;
+};
+
+/// Returns the health of the ports that the sampling loop checks and the
+/// requests report
+SensorHealth &sensorHealth();
+
+/// Copies Fault into Values in the order it is sent: the port, the
+/// SensorFaultKind and the Timestamp it started at
+void faultValues(const SensorFault &Fault,
+                 uint32_t (&Values)[SENSORFAULTVALUES]);
+
+#endif // SENSORHEALTH
@@ -0,0 +1,198 @@
+/// \file
+/// \brief Implementation of the comparator wake-up
+#include "ThresholdMonitor.h"
+
+#if THRESHOLDPORTS
+
+#include "fsl_cmp.h"
+#include "pinmap.h"
+
+/// The flag of a crossing in ThresholdMonitor::Flags
+#define THRESHOLDTRIPPED (1U << 0)
+
+/// The minus input of every comparator that is its DAC
+#define THRESHOLDDACINPUT (7)
+
+static CMP_Type *const cmp_bases[THRESHOLDCOMPARATORS] = CMP_BASE_PTRS;
+static const IRQn_Type cmp_irqs[THRESHOLDCOMPARATORS] = CMP_IRQS;
+
+/// The pins that are an input of a comparator, all of them with their
+/// analog function on ALT0
+struct ComparatorInput {
+    PinName Pin;
+    uint8_t Instance;
+    uint8_t Input;
+};
+
+static const ComparatorInput comparator_inputs[] = {
+    {PTC6, 0, 0}, {PTC7, 0, 1}, {PTC8, 0, 2},  {PTC9, 0, 3},
+    {PTC2, 1, 0}, {PTC3, 1, 1}, {PTA12, 2, 0}, {PTA13, 2, 1}};
+
+/// The interrupts only have a static function, there is one monitor
+static ThresholdMonitor *Monitor = NULL;
+
+ThresholdMonitor::ThresholdMonitor(const PinName *pins, size_t count,
+                                   uint16_t ports)
+    : Tripped(0), Trips(0) {
+    for (size_t i = 0; i < THRESHOLDCOMPARATORS; ++i) {
+        Cmp[i].Port = -1;
+        Cmp[i].Input = 0;
+        Cmp[i].Level = 0;
+        Cmp[i].Watched = false;
+        Cmp[i].Armed = false;
+    }
+    Monitor = this;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!((ports >> i) & 1U)) {
+            continue;
+        }
+        bool Found = false;
+        for (const ComparatorInput &In : comparator_inputs) {
+            if (In.Pin != pins[i]) {
+                continue;
+            }
+            Found = true;
+            if (Cmp[In.Instance].Port >= 0) {
+                printf("CMP%u already watches port %d, not port %u\r\n",
+                       In.Instance, Cmp[In.Instance].Port, (unsigned)i);
+                break;
+            }
+            Cmp[In.Instance].Port = i;
+            Cmp[In.Instance].Input = In.Input;
+            // the pin may not be set up by the scan
+            pin_function(pins[i], 0);
+            break;
+        }
+        if (!Found) {
+            printf("Port %u is not on a comparator input, it is not "
+                   "watched\r\n",
+                   (unsigned)i);
+        }
+    }
+}
+
+ThresholdMonitor::~ThresholdMonitor() {
+    disarm();
+    Monitor = NULL;
+}
+
+// ============================================================================
+void ThresholdMonitor::configure(const vector<PortInfo> &ports) {
+    for (size_t i = 0; i < THRESHOLDCOMPARATORS; ++i) {
+        Comparator &C = Cmp[i];
+        C.Watched = false;
+        if (C.Port < 0 || (size_t)C.Port >= ports.size()) {
+            continue;
+        }
+        const PortInfo &Port = ports[C.Port];
+        if (Port.Multiplier <= 0.0f) {
+            continue;
+        }
+        // the reading is Raw / 0xFFFF * Multiplier, the same full scale as
+        // the DAC of VDD in 64 steps
+        float Fraction = Port.RangeCeiling / Port.Multiplier;
+        int Level = (int)ceilf(Fraction * 64.0f) - 1;
+        if (Fraction <= 0.0f || Level > 63) {
+            continue;
+        }
+        C.Level = Level < 0 ? 0 : Level;
+        C.Watched = true;
+    }
+}
+
+// ============================================================================
+void ThresholdMonitor::arm() {
+    Flags.clear(THRESHOLDTRIPPED);
+    for (size_t i = 0; i < THRESHOLDCOMPARATORS; ++i) {
+        Comparator &C = Cmp[i];
+        if (!C.Watched || C.Armed) {
+            continue;
+        }
+        CMP_Type *base = cmp_bases[i];
+
+        // without the filter and the sampling the comparator keeps going
+        // in stop modes, where there is no bus clock
+        cmp_config_t config;
+        CMP_GetDefaultConfig(&config);
+        config.hysteresisMode = kCMP_HysteresisLevel1;
+        CMP_Init(base, &config);
+        cmp_filter_config_t filter;
+        memset(&filter, 0, sizeof(filter));
+        CMP_SetFilterConfig(base, &filter);
+        cmp_dac_config_t dac;
+        dac.referenceVoltageSource = kCMP_VrefSourceVin2;
+        dac.DACValue = C.Level;
+        CMP_SetDACConfig(base, &dac);
+        CMP_SetInputChannels(base, C.Input, THRESHOLDDACINPUT);
+
+        // the output settles within a few microseconds of the DAC. A port
+        // that is already over its level stays unarmed
+        wait_us(10);
+        if (CMP_GetStatusFlags(base) & kCMP_OutputAssertEventFlag) {
+            CMP_Deinit(base);
+            continue;
+        }
+        CMP_ClearStatusFlags(base, kCMP_OutputRisingEventFlag |
+                                       kCMP_OutputFallingEventFlag);
+
+        static void (*const handlers[THRESHOLDCOMPARATORS])() = {
+            &ThresholdMonitor::onCompare0, &ThresholdMonitor::onCompare1,
+            &ThresholdMonitor::onCompare2};
+        NVIC_SetVector(cmp_irqs[i], (uint32_t)handlers[i]);
+        NVIC_EnableIRQ(cmp_irqs[i]);
+        C.Armed = true;
+        CMP_EnableInterrupts(base, kCMP_OutputRisingInterruptEnable);
+    }
+}
+
+// ============================================================================
+void ThresholdMonitor::disarm() {
+    for (size_t i = 0; i < THRESHOLDCOMPARATORS; ++i) {
+        if (!Cmp[i].Armed) {
+            continue;
+        }
+        NVIC_DisableIRQ(cmp_irqs[i]);
+        CMP_Deinit(cmp_bases[i]);
+        Cmp[i].Armed = false;
+    }
+}
+
+// ============================================================================
+bool ThresholdMonitor::wait(uint64_t until_ms) {
+    uint64_t Now = Kernel::get_ms_count();
+    uint32_t Timeout = until_ms > Now ? (uint32_t)(until_ms - Now) : 0;
+    uint32_t Got = Flags.wait_any(THRESHOLDTRIPPED, Timeout);
+    return !(Got & osFlagsError);
+}
+
+// ============================================================================
+uint16_t ThresholdMonitor::tripped() {
+    core_util_critical_section_enter();
+    uint16_t Ports = Tripped;
+    Tripped = 0;
+    core_util_critical_section_exit();
+    return Ports;
+}
+
+// ============================================================================
+void ThresholdMonitor::onCompare0() { Monitor->onCompare(0); }
+
+void ThresholdMonitor::onCompare1() { Monitor->onCompare(1); }
+
+void ThresholdMonitor::onCompare2() { Monitor->onCompare(2); }
+
+// one crossing is enough to wake the loop, the comparator stays off until
+// the next arm()
+void ThresholdMonitor::onCompare(size_t instance) {
+    CMP_Type *base = cmp_bases[instance];
+    CMP_DisableInterrupts(base, kCMP_OutputRisingInterruptEnable);
+    CMP_ClearStatusFlags(base, kCMP_OutputRisingEventFlag |
+                                   kCMP_OutputFallingEventFlag);
+    NVIC_DisableIRQ(cmp_irqs[instance]);
+    Tripped |= 1U << Cmp[instance].Port;
+    ++Trips;
+    Flags.set(THRESHOLDTRIPPED);
+}
+
+#endif // THRESHOLDPORTS
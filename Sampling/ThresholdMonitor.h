@@ -0,0 +1,102 @@
+#ifndef THRESHOLDMONITOR_H
+#define THRESHOLDMONITOR_H
+/// \file
+/// \brief Watches a few ports with the analog comparators while the scan is
+/// stopped, and wakes the sampling loop when one goes over its range.
+///
+/// In low-power mode the scan is stopped between readings, so a spike in
+/// between is not seen until the next one. The K64F has three comparators,
+/// CMP0 to CMP2, that compare a pin against their own 6-bit DAC without the
+/// CPU, in deep sleep as well. Every port in THRESHOLDPORTS whose pin is an
+/// input of a comparator is watched by it, with the DAC at the first step
+/// over the port's RangeCeiling. A rising output raises the interrupt,
+/// which disarms the comparator and wakes wait(). The loop then takes a
+/// reading right away, and forces a capture of the port, see
+/// WaveCapture::force().
+///
+/// Only the first port in THRESHOLDPORTS on every comparator is watched. A
+/// port that is already over its ceiling when the loop goes to sleep is not
+/// armed, so it does not wake the loop again right away. While the scan
+/// runs the capture's CAPTURELEVEL trigger sees every frame instead.
+
+#include "mbed.h"
+
+#include "BoardPins.h"
+#include "Structs.h"
+
+/// The ports that are watched, bit i for port i. 0 turns the comparators
+/// off. Set with "threshold-ports" in mbed_app.json.
+#ifdef MBED_CONF_APP_THRESHOLD_PORTS
+#define THRESHOLDPORTS MBED_CONF_APP_THRESHOLD_PORTS
+#else
+#define THRESHOLDPORTS (0)
+#endif
+
+/// The comparators of the part, CMP0 to CMP2 on the K64F
+#define THRESHOLDCOMPARATORS (BOARDCOMPARATORS)
+
+class ThresholdMonitor {
+  public:
+    /// Finds the comparator input of every pin in ports.
+    /// \param pins The analog pins of the scan, in port order
+    /// \param count The number of pins
+    /// \param ports The bits of the ports to watch
+    ThresholdMonitor(const PinName *pins, size_t count,
+                     uint16_t ports = THRESHOLDPORTS);
+
+    ~ThresholdMonitor();
+
+    /// Takes the DAC level of every watched port from its RangeCeiling and
+    /// Multiplier. A port whose ceiling is past the end of the readings, or
+    /// with a negative multiplier, is not watched
+    void configure(const vector<PortInfo> &ports);
+
+    /// Starts the comparators of the ports that are under their level
+    void arm();
+
+    /// Stops all of the comparators
+    void disarm();
+
+    /// Sleeps until until_ms in Kernel::get_ms_count() milliseconds, or
+    /// until an armed port crossed its level
+    /// \returns true if a port crossed it
+    bool wait(uint64_t until_ms);
+
+    /// Returns the bits of the ports that crossed their level since the
+    /// last call, and clears them
+    uint16_t tripped();
+
+    /// Returns the number of times a port crossed its level
+    uint32_t trips() const { return Trips; }
+
+  private:
+    /// One comparator and the port that it watches
+    struct Comparator {
+        /// the port, -1 if the comparator is not used
+        int8_t Port;
+
+        /// the input of the port's pin
+        uint8_t Input;
+
+        /// the DAC value, the output goes high over (Level + 1) / 64 VDD.
+        /// Watched is false if the port has no level that can be reached
+        uint8_t Level;
+        bool Watched;
+
+        bool Armed;
+    };
+
+    static void onCompare0();
+    static void onCompare1();
+    static void onCompare2();
+    void onCompare(size_t instance);
+
+    Comparator Cmp[THRESHOLDCOMPARATORS];
+
+    /// set from the interrupt, wait() sleeps on it
+    EventFlags Flags;
+    volatile uint16_t Tripped;
+    volatile uint32_t Trips;
+};
+
+#endif // THRESHOLDMONITOR
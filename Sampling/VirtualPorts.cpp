@@ -0,0 +1,347 @@
+/// \file
+/// \brief Implementation of the virtual ports
+#include "VirtualPorts.h"
+
+#include "ConfigParser.h"
+
+#include <cctype>
+#include <cmath>
+
+/// The operations of a formula
+enum FormulaOp {
+    FormulaPort,  ///< pushes the value of the port in the next byte
+    FormulaConst, ///< pushes the constant in the next byte
+    FormulaAdd,
+    FormulaSub,
+    FormulaMul,
+    FormulaDiv,
+    FormulaNeg,
+    FormulaAbs,
+    FormulaSqrt,
+    FormulaMin,
+    FormulaMax
+};
+
+/// A function of a formula, with how many arguments it takes
+struct FormulaFunction {
+    const char *Name;
+    uint8_t Op;
+    uint8_t Arguments;
+};
+
+static const FormulaFunction Functions[] = {{"abs", FormulaAbs, 1},
+                                            {"sqrt", FormulaSqrt, 1},
+                                            {"min", FormulaMin, 2},
+                                            {"max", FormulaMax, 2}};
+
+/// Compiles a formula by recursive descent, the operations come out in the
+/// order they run
+struct FormulaCompiler {
+    const char *At;
+    const char *End;
+    FormulaCode &Code;
+
+    /// how deep the stack is after the code so far, and the deepest it went
+    int Depth;
+    int Deepest;
+
+    bool Ok;
+
+    /// how deep the compiler recursed, up to FORMULANESTING
+    int Nesting;
+
+    // goes one level deeper, or fails past FORMULANESTING
+    bool nest() {
+        if (++Nesting > FORMULANESTING) {
+            Ok = false;
+        }
+        return Ok;
+    }
+
+    // skips the spaces, and returns the next character or 0 at the end
+    char peek() {
+        while (At < End && isspace((unsigned char)*At)) {
+            ++At;
+        }
+        return At < End ? *At : 0;
+    }
+
+    // takes Character if it is next
+    bool take(char Character) {
+        if (peek() != Character) {
+            return false;
+        }
+        ++At;
+        return true;
+    }
+
+    // adds an operation that leaves the stack Change deeper
+    void emit(uint8_t Op, int Change) {
+        if (Code.Length >= FORMULACODEMAX) {
+            Ok = false;
+            return;
+        }
+        Code.Code[Code.Length++] = Op;
+        Depth += Change;
+        if (Depth > Deepest) {
+            Deepest = Depth;
+        }
+    }
+
+    // adds the number of a port or constant after an operation
+    void operand(uint8_t Index) {
+        if (Code.Length >= FORMULACODEMAX) {
+            Ok = false;
+            return;
+        }
+        Code.Code[Code.Length++] = Index;
+    }
+
+    void number() {
+        const char *Start = At;
+        while (At < End && (isdigit((unsigned char)*At) || *At == '.')) {
+            ++At;
+        }
+        if (At < End && (*At == 'e' || *At == 'E')) {
+            ++At;
+            if (At < End && (*At == '+' || *At == '-')) {
+                ++At;
+            }
+            while (At < End && isdigit((unsigned char)*At)) {
+                ++At;
+            }
+        }
+        if (Code.ConstantCount >= FORMULACONSTANTS) {
+            Ok = false;
+            return;
+        }
+        Code.Constants[Code.ConstantCount] =
+            spanToFloat(Span<const char>(Start, At - Start));
+        emit(FormulaConst, 1);
+        operand(Code.ConstantCount++);
+    }
+
+    void port() {
+        ++At;
+        if (At >= End || !isdigit((unsigned char)*At)) {
+            Ok = false;
+            return;
+        }
+        int Index = 0;
+        while (At < End && isdigit((unsigned char)*At)) {
+            Index = Index * 10 + (*At++ - '0');
+            if (Index >= FRAMEMAXPORTS) {
+                Ok = false;
+                return;
+            }
+        }
+        Code.Inputs |= 1U << Index;
+        emit(FormulaPort, 1);
+        operand(Index);
+    }
+
+    void function() {
+        const char *Start = At;
+        while (At < End && isalpha((unsigned char)*At)) {
+            ++At;
+        }
+        Span<const char> Name(Start, At - Start);
+        for (const FormulaFunction &Function : Functions) {
+            if (!spanEquals(Name, Function.Name)) {
+                continue;
+            }
+            if (!take('(')) {
+                break;
+            }
+            expression();
+            for (uint8_t k = 1; k < Function.Arguments; ++k) {
+                if (!take(',')) {
+                    Ok = false;
+                    return;
+                }
+                expression();
+            }
+            if (!take(')')) {
+                break;
+            }
+            emit(Function.Op, 1 - Function.Arguments);
+            return;
+        }
+        Ok = false;
+    }
+
+    void primary() {
+        char Next = peek();
+        if (take('(')) {
+            expression();
+            Ok = Ok && take(')');
+        } else if (isdigit((unsigned char)Next) || Next == '.') {
+            number();
+        } else if ((Next == 'P' || Next == 'p') && At + 1 < End &&
+                   isdigit((unsigned char)At[1])) {
+            port();
+        } else if (isalpha((unsigned char)Next)) {
+            function();
+        } else {
+            Ok = false;
+        }
+    }
+
+    void unary() {
+        if (take('-')) {
+            if (!nest()) {
+                return;
+            }
+            unary();
+            --Nesting;
+            emit(FormulaNeg, 0);
+        } else {
+            take('+');
+            primary();
+        }
+    }
+
+    void term() {
+        unary();
+        while (Ok) {
+            if (take('*')) {
+                unary();
+                emit(FormulaMul, -1);
+            } else if (take('/')) {
+                unary();
+                emit(FormulaDiv, -1);
+            } else {
+                return;
+            }
+        }
+    }
+
+    void expression() {
+        if (!nest()) {
+            return;
+        }
+        term();
+        while (Ok) {
+            if (take('+')) {
+                term();
+                emit(FormulaAdd, -1);
+            } else if (take('-')) {
+                term();
+                emit(FormulaSub, -1);
+            } else {
+                break;
+            }
+        }
+        --Nesting;
+    }
+};
+
+// ============================================================================
+bool compileFormula(const char *Text, size_t Length, FormulaCode &Code) {
+    memset(&Code, 0, sizeof(Code));
+    FormulaCompiler Compiler = {Text, Text + Length, Code, 0, 0, true, 0};
+    Compiler.expression();
+    return Compiler.Ok && Compiler.peek() == 0 && Compiler.Depth == 1 &&
+           Compiler.Deepest <= FORMULASTACK;
+}
+
+// ============================================================================
+bool runFormula(const FormulaCode &Code, const float *Values, float &Result) {
+    float Stack[FORMULASTACK];
+    size_t Top = 0;
+    for (size_t k = 0; k < Code.Length; ++k) {
+        float Right = Top > 0 ? Stack[Top - 1] : 0.0f;
+        switch (Code.Code[k]) {
+        case FormulaPort:
+            Stack[Top++] = Values[Code.Code[++k]];
+            continue;
+        case FormulaConst:
+            Stack[Top++] = Code.Constants[Code.Code[++k]];
+            continue;
+        case FormulaNeg:
+            Stack[Top - 1] = -Right;
+            continue;
+        case FormulaAbs:
+            Stack[Top - 1] = fabsf(Right);
+            continue;
+        case FormulaSqrt:
+            Stack[Top - 1] = sqrtf(Right);
+            continue;
+        }
+
+        // the rest take two values and leave one
+        float &Left = Stack[Top - 2];
+        switch (Code.Code[k]) {
+        case FormulaAdd:
+            Left += Right;
+            break;
+        case FormulaSub:
+            Left -= Right;
+            break;
+        case FormulaMul:
+            Left *= Right;
+            break;
+        case FormulaDiv:
+            Left /= Right;
+            break;
+        case FormulaMin:
+            Left = Right < Left ? Right : Left;
+            break;
+        case FormulaMax:
+            Left = Right > Left ? Right : Left;
+            break;
+        }
+        --Top;
+    }
+    Result = Stack[0];
+    return isfinite(Result);
+}
+
+VirtualPorts::VirtualPorts() : Count(0), Hidden(0) {}
+
+// ============================================================================
+void VirtualPorts::configure(const vector<PortInfo> &Ports) {
+    Count = 0;
+    Hidden = 0;
+    for (size_t i = 0; i < Ports.size() && i < FRAMEMAXPORTS; ++i) {
+        if (Ports[i].Hidden) {
+            Hidden |= 1U << i;
+        }
+        if (Ports[i].Formula.empty() || Ports[i].Multiplier == 0.0f) {
+            continue;
+        }
+        // every port that the formula uses has to be there
+        const char *Text = Ports[i].Formula.c_str();
+        if (Count == VIRTUALMAX ||
+            !compileFormula(Text, strlen(Text), Codes[Count]) ||
+            (Codes[Count].Inputs >> Ports.size()) != 0) {
+            printf("The formula of port %s can not be used, skipping\r\n",
+                   Ports[i].Name.c_str());
+            continue;
+        }
+        Port[Count++] = i;
+    }
+}
+
+// ============================================================================
+void VirtualPorts::read(const vector<PortInfo> &Ports,
+                        SampleFrame &Sample) const {
+    float Values[FRAMEMAXPORTS];
+    for (size_t k = 0; k < Count; ++k) {
+        const FormulaCode &Code = Codes[k];
+        if ((Sample.PortMask & Code.Inputs) != Code.Inputs) {
+            continue;
+        }
+        for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+            if ((Code.Inputs >> i) & 1U) {
+                Values[i] = Sample.value(i, Ports[i].Multiplier);
+            }
+        }
+        float Result;
+        size_t i = Port[k];
+        if (runFormula(Code, Values, Result)) {
+            Sample.setReading(i, Result / Ports[i].Multiplier);
+        }
+    }
+    Sample.PortMask &= ~Hidden;
+}
@@ -0,0 +1,103 @@
+#ifndef VIRTUALPORTS_H
+#define VIRTUALPORTS_H
+/// \file
+/// \brief Ports whose value is worked out on the board from other ports,
+/// with a formula from the config file.
+///
+/// A Virtual line is a port like a Port line, with a formula after its
+/// sensor type:
+///
+///     Virtual: PortName, SensorID, Formula
+///
+/// The formula has numbers, Pn for the value of port n in its unit, + - * /,
+/// parentheses and abs(), sqrt(), min() and max(), like P0*P1*0.9 for the
+/// real power of a voltage and a current port. The sensor type gives the
+/// virtual port its unit, range and deadband like any other port, and its
+/// multiplier is the full scale of the value, which is kept as a fraction
+/// of it in the frames. A value below 0 or above it is clamped.
+///
+/// configure() compiles every formula into FORMULACODEMAX bytes of stack
+/// code, once, and read() runs them on every reading, after the inputs are
+/// read and before the ranges are checked. A formula whose port has no
+/// reading in the frame, or that divides by 0, leaves its port out of the
+/// reading. A formula can use the virtual ports before it, their values
+/// are worked out in the order of the ports.
+///
+/// A Port line with "hidden" after its sensor type is read for the
+/// formulas and taken out of the reading after them, so only the values
+/// that were worked out are sent and logged:
+///
+///     Port: PortName, SensorID, hidden
+///
+/// Only the sampling loop uses it.
+
+#include "Structs.h"
+
+/// The most bytes of code of one formula
+#define FORMULACODEMAX (32)
+
+/// The most numbers in one formula
+#define FORMULACONSTANTS (8)
+
+/// The deepest the stack of a formula goes
+#define FORMULASTACK (8)
+
+/// How deep a formula nests. The formula is one level, and every
+/// parenthesis, function call and minus sign in it one more. The compiler
+/// recurses once for every level, so a formula that goes deeper is not
+/// compiled
+#define FORMULANESTING (16)
+
+/// The most virtual ports
+#define VIRTUALMAX (4)
+
+/// A compiled formula
+struct FormulaCode {
+    /// the operations, each FormulaPort and FormulaConst has the number of
+    /// its port or constant in the next byte
+    uint8_t Code[FORMULACODEMAX];
+    uint8_t Length;
+
+    float Constants[FORMULACONSTANTS];
+    uint8_t ConstantCount;
+
+    /// bit n is set if the formula uses port n
+    uint16_t Inputs;
+};
+
+/// Compiles the Length bytes of Text into Code.
+/// \returns false if it is not a formula, or does not fit
+bool compileFormula(const char *Text, size_t Length, FormulaCode &Code);
+
+/// Runs Code on the values of the ports, in their units. Values only has to
+/// hold the ports of Code.Inputs.
+/// \returns false if the result is not a number
+bool runFormula(const FormulaCode &Code, const float *Values, float &Result);
+
+/// Reads the virtual ports of a frame from the other ports of it
+class VirtualPorts {
+  public:
+    VirtualPorts();
+
+    /// Compiles the formulas of the virtual ports of Ports, the ones that
+    /// do not compile are left out of every reading
+    void configure(const vector<PortInfo> &Ports);
+
+    /// Adds the value of every virtual port to Sample, from the readings of
+    /// the ports before the ranges are checked, and takes the hidden ports
+    /// out of it
+    void read(const vector<PortInfo> &Ports, SampleFrame &Sample) const;
+
+  private:
+    FormulaCode Codes[VIRTUALMAX];
+
+    /// the port of every formula
+    uint8_t Port[VIRTUALMAX];
+
+    size_t Count;
+
+    /// bit n is set if port n is hidden
+    uint16_t Hidden;
+};
+
+#endif // VIRTUALPORTS
@@ -0,0 +1,91 @@
+/// \file
+/// \brief Implementation of the pre-trigger capture rings
+#include "WaveCapture.h"
+
+WaveCapture::WaveCapture(size_t count, uint16_t ports)
+    : Used(0), End(0), Frames(0), Pushed(0), TriggerFrame(0), Trigger(0),
+      Forced(-1), State(Filling) {
+    memset(Ring, 0, sizeof(Ring));
+    memset(Last, 0, sizeof(Last));
+    for (size_t i = 0; i < count && i < SCANMAXPORTS; ++i) {
+        if (((ports >> i) & 1U) && Used < CAPTUREMAXPORTS) {
+            Port[Used++] = i;
+        }
+    }
+}
+
+// ============================================================================
+void WaveCapture::rearm() {
+    core_util_critical_section_enter();
+    Frames = 0;
+    State = Filling;
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+bool WaveCapture::force(size_t port) {
+    for (size_t i = 0; i < Used; ++i) {
+        if (Port[i] == port) {
+            Forced = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+void WaveCapture::push(const uint16_t *frame, size_t count) {
+    ++Pushed;
+    if (Used == 0 || State == Frozen) {
+        return;
+    }
+
+    bool Fired = false;
+    size_t Slot = End & (CAPTUREDEPTH - 1);
+    for (size_t i = 0; i < Used; ++i) {
+        if (Port[i] >= count) {
+            continue;
+        }
+        uint16_t Raw = frame[Port[i]];
+        Ring[i][Slot] = Raw;
+
+        // only the first port to fire is kept
+        if (State == Armed && !Fired) {
+            int32_t Step = (int32_t)Raw - Last[i];
+            bool Level = CAPTURELEVEL > 0 && Last[i] < CAPTURELEVEL &&
+                         Raw >= CAPTURELEVEL;
+            bool Slope = CAPTURESLOPE > 0 &&
+                         (Step >= CAPTURESLOPE || -Step >= CAPTURESLOPE);
+            if (Level || Slope || Forced == (int)i) {
+                Fired = true;
+                Trigger = i;
+                Forced = -1;
+            }
+        }
+        Last[i] = Raw;
+    }
+    ++End;
+
+    switch (State) {
+    case Filling:
+        // the pre-trigger part has to be there before a trigger counts
+        if (++Frames >= CAPTUREPRE) {
+            State = Armed;
+        }
+        break;
+    case Armed:
+        if (Fired) {
+            TriggerFrame = Pushed;
+            Frames = CAPTUREFRAMES - CAPTUREPRE - 1;
+            State = Frames == 0 ? Frozen : Holding;
+        }
+        break;
+    case Holding:
+        if (--Frames == 0) {
+            State = Frozen;
+        }
+        break;
+    default:
+        break;
+    }
+}
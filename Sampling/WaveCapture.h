@@ -0,0 +1,151 @@
+#ifndef WAVECAPTURE_H
+#define WAVECAPTURE_H
+/// \file
+/// \brief Keeps the last scan frames of a few ports in a ring, and freezes
+/// the waveform around a spike so it can be sent as a whole.
+///
+/// A reading only sees one value, or the RMS of a window, every interval.
+/// The capture sees every scan frame of the CAPTUREPORTS ports, at SCANRATE.
+/// Once a port crosses CAPTURELEVEL upwards, or moves by CAPTURESLOPE or
+/// more from one frame to the next, the ring keeps the CAPTUREPRE frames
+/// before and fills in the rest of the CAPTUREFRAMES after. The capture is
+/// then frozen until the uploader thread saved it, see CaptureStore.h, and
+/// sent with the backlog.
+
+#include "ADCScan.h"
+
+/// The ports that are captured, bit i for port i. 0 turns capturing off.
+/// Set with "capture-ports" in mbed_app.json.
+#ifdef MBED_CONF_APP_CAPTURE_PORTS
+#define CAPTUREPORTS MBED_CONF_APP_CAPTURE_PORTS
+#else
+#define CAPTUREPORTS (0)
+#endif
+
+/// A capture starts when a port goes from under to at least this raw
+/// reading, 0 turns the level trigger off.
+/// Set with "capture-level" in mbed_app.json.
+#ifdef MBED_CONF_APP_CAPTURE_LEVEL
+#define CAPTURELEVEL MBED_CONF_APP_CAPTURE_LEVEL
+#else
+#define CAPTURELEVEL (0)
+#endif
+
+/// A capture starts when a port's raw reading moves by this much or more
+/// between two scan frames, 0 turns the slope trigger off.
+/// Set with "capture-slope" in mbed_app.json.
+#ifdef MBED_CONF_APP_CAPTURE_SLOPE
+#define CAPTURESLOPE MBED_CONF_APP_CAPTURE_SLOPE
+#else
+#define CAPTURESLOPE (0)
+#endif
+
+/// The scan frames in one capture, 1000 are 500 ms at 2000 frames a second.
+/// Set with "capture-frames" in mbed_app.json.
+#ifdef MBED_CONF_APP_CAPTURE_FRAMES
+#define CAPTUREFRAMES MBED_CONF_APP_CAPTURE_FRAMES
+#else
+#define CAPTUREFRAMES (1000)
+#endif
+
+/// How many of the CAPTUREFRAMES are from before the trigger.
+/// Set with "capture-pre" in mbed_app.json.
+#ifdef MBED_CONF_APP_CAPTURE_PRE
+#define CAPTUREPRE MBED_CONF_APP_CAPTURE_PRE
+#else
+#define CAPTUREPRE (250)
+#endif
+
+/// The most ports in one capture, the lowest ones of CAPTUREPORTS are used
+#define CAPTUREMAXPORTS (4)
+
+/// The frames in the ring of every port. Has to be a power of two. Without
+/// CAPTUREPORTS the rings are never filled, and only take one frame
+#if CAPTUREPORTS
+#define CAPTUREDEPTH (1024)
+#else
+#define CAPTUREDEPTH (1)
+#endif
+
+#if CAPTUREPORTS &&                                                            \
+    (CAPTUREFRAMES > CAPTUREDEPTH || CAPTUREPRE >= CAPTUREFRAMES)
+#error "capture-frames has to be up to 1024 and more than capture-pre"
+#endif
+
+/// Rings of scan frames that freeze on a trigger. push() runs in the scan's
+/// frame callback, everything else on the sampling loop's thread.
+class WaveCapture {
+  public:
+    /// \param count The number of ports in every scan frame
+    /// \param ports The bits of the ports to capture
+    WaveCapture(size_t count, uint16_t ports = CAPTUREPORTS);
+
+    /// Adds a scan frame to the rings and looks for a trigger.
+    /// This is safe to call from interrupt context.
+    void push(const uint16_t *frame, size_t count);
+
+    /// Returns true once a capture is complete, the rings do not change
+    /// until rearm() is called
+    bool frozen() const { return State == Frozen; }
+
+    /// Starts looking for the next trigger
+    void rearm();
+
+    /// Sets the trigger off on port at the first frame that it can, without
+    /// a level or a slope, for a spike that was seen outside of the scan.
+    /// rearm() keeps it
+    /// \returns false if port is not captured
+    bool force(size_t port);
+
+    /// Returns the number of captured ports, 0 if capturing is off
+    size_t ports() const { return Used; }
+
+    /// Returns the port number of the i-th captured port
+    size_t port(size_t i) const { return Port[i]; }
+
+    /// Returns the captured port that set the trigger off
+    size_t triggerPort() const { return Trigger; }
+
+    /// Returns how many scan frames came since the trigger. Only valid
+    /// while frozen()
+    uint32_t framesSinceTrigger() const { return Pushed - TriggerFrame; }
+
+    /// Returns the raw reading of the i-th captured port in frame n of the
+    /// capture, in the order they were taken. Only valid while frozen()
+    uint16_t sample(size_t i, size_t n) const {
+        return Ring[i][(End - CAPTUREFRAMES + n) & (CAPTUREDEPTH - 1)];
+    }
+
+  private:
+    enum CaptureState { Filling, Armed, Holding, Frozen };
+
+    uint16_t Ring[CAPTUREMAXPORTS][CAPTUREDEPTH];
+
+    /// the port number of every ring
+    uint8_t Port[CAPTUREMAXPORTS];
+
+    size_t Used;
+
+    /// the last reading of every ring, for the triggers
+    uint16_t Last[CAPTUREMAXPORTS];
+
+    /// where the next frame goes into the rings
+    uint32_t End;
+
+    /// the frames pushed since the rings were armed, up to CAPTUREPRE, and
+    /// the frames still to come after the trigger while Holding
+    uint32_t Frames;
+
+    /// every frame that push() got, and the one of the trigger
+    volatile uint32_t Pushed;
+    uint32_t TriggerFrame;
+
+    uint8_t Trigger;
+
+    /// the ring that force() set the trigger off on, -1 if none
+    volatile int8_t Forced;
+
+    volatile CaptureState State;
+};
+
+#endif // WAVECAPTURE
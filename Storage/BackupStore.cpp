@@ -0,0 +1,79 @@
+/// \file
+/// \brief Implementation of the backup log's filesystem
+#include "BackupStore.h"
+
+#if BACKUPSTORE != BACKUPSTOREFAT
+#include "LittleFileSystem.h"
+
+#if BACKUPINFLASH
+#include "FlashIAPBlockDevice.h"
+#include "FlashStageBlockDevice.h"
+#else
+#include "MBRBlockDevice.h"
+#endif
+
+/// the backup log's filesystem, mounted at "/log". The block size stays
+/// the default one, which is kept on the store, so a store from before
+/// still mounts
+static LittleFileSystem logfs("log", NULL, BACKUPLFSREADSIZE,
+                              BACKUPLFSPROGSIZE, MBED_LFS_BLOCK_SIZE,
+                              BACKUPLFSLOOKAHEAD);
+#endif
+
+#if BACKUPINFLASH && FLASHSTAGE
+/// the internal flash, with its programs staged and its free sectors erased
+/// ahead of the log's appends
+static FlashIAPBlockDevice flashbd;
+static FlashStageBlockDevice stagedbd(&flashbd);
+#endif
+
+int mountBackupStore(BlockDevice *sd) {
+#if BACKUPSTORE == BACKUPSTOREFAT
+    // it is on the FAT that is already mounted
+    return 0;
+#else
+#if BACKUPINFLASH && FLASHSTAGE
+    FlashStageBlockDevice &logbd = stagedbd;
+    const char *where = "internal flash";
+#elif BACKUPINFLASH
+    static FlashIAPBlockDevice logbd;
+    const char *where = "internal flash";
+#else
+    static MBRBlockDevice logbd(sd, BACKUPPARTITION);
+    const char *where = "SD card partition";
+#endif
+
+    printf("Mounting the backup log on the %s... ", where);
+    fflush(stdout);
+    int err = logfs.mount(&logbd);
+    printf("%s\r\n", (err ? "Fail :(" : "OK"));
+    if (err) {
+        // only the backlog lives here, so it can be started over
+        printf("Formatting the backup log... ");
+        fflush(stdout);
+        err = logfs.reformat(&logbd);
+        printf("%s\r\n", (err ? "Fail :(" : "OK"));
+    }
+#if BACKUPINFLASH && FLASHSTAGE
+    // the blocks that are free now are erased before the log needs them
+    if (!err) {
+        trimBackupStore();
+    }
+#endif
+    return err;
+#endif
+}
+
+int trimBackupStore() {
+#if BACKUPSTORE == BACKUPSTOREPARTITION || (BACKUPINFLASH && FLASHSTAGE)
+    return logfs.trim_free();
+#else
+    return 0;
+#endif
+}
+
+void stepBackupStore() {
+#if BACKUPINFLASH && FLASHSTAGE
+    stagedbd.step();
+#endif
+}
@@ -0,0 +1,122 @@
+#ifndef BACKUPSTORE_H
+#define BACKUPSTORE_H
+/// \file
+/// \brief Picks the filesystem that holds the backup log.
+///
+/// On FAT, a brown-out in the middle of a write can leave the directory or
+/// the FAT itself half updated, and every mount has to trust it. The
+/// LittleFS stores are copy-on-write, so the last complete append and
+/// cursor write are always there after a reset, and they mount without a
+/// scan. The config file stays on the SD card's FAT filesystem either way,
+/// so it can still be edited on a PC.
+///
+/// The tiered store writes new segments to the internal flash, which takes
+/// an append without the SPI round trips and without wearing the card. A
+/// short outage is sent from there and never reaches the SD card. Once
+/// BACKUPHOTSEGMENTS segments pile up in the flash, all of them are moved
+/// to the log's directory on the card in one go, each one copied in
+/// BACKUPSPILLCHUNK pieces into a file that is set aside whole. The index
+/// stays in the flash, the log finds a segment in either place.
+///
+/// Storage/simulate_wear.py compares how the stores wear and how long
+/// their writes take under months of outages.
+
+#include "mbed.h"
+
+#include "BlockDevice.h"
+
+/// the backup log is next to the config file on the SD card's FAT
+#define BACKUPSTOREFAT (0)
+
+/// the backup log is on LittleFS at the end of the K64F's internal flash,
+/// where "flashiap-block-device" in mbed_app.json puts it
+#define BACKUPSTOREFLASH (1)
+
+/// the backup log is on LittleFS in the SD card's BACKUPPARTITION
+#define BACKUPSTOREPARTITION (2)
+
+/// the newest segments of the backup log are on LittleFS in the internal
+/// flash like with BACKUPSTOREFLASH, the older ones are moved to the FAT
+#define BACKUPSTORETIERED (3)
+
+/// Where the backup log is kept, one of the BACKUPSTORE values above.
+/// Set with "backup-store" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKUP_STORE
+#define BACKUPSTORE MBED_CONF_APP_BACKUP_STORE
+#else
+#define BACKUPSTORE BACKUPSTOREFAT
+#endif
+
+/// 1 if the LittleFS store is in the internal flash, so the backup log
+/// works without the SD card
+#define BACKUPINFLASH                                                          \
+    (BACKUPSTORE == BACKUPSTOREFLASH || BACKUPSTORE == BACKUPSTORETIERED)
+
+/// The MBR partition of the SD card that BACKUPSTOREPARTITION uses, the FAT
+/// with the config file is expected in the first one
+#define BACKUPPARTITION (2)
+
+/// The read cache of the LittleFS stores in bytes, one SD card sector.
+/// Every block head that the readers look at is one read, not eight.
+#define BACKUPLFSREADSIZE (512)
+
+/// The program cache of the LittleFS stores in bytes, the size of a staged
+/// block of records (LOGSTAGESIZE). A flushed block goes to the card as one
+/// program, and the file is only synced then, so there is one metadata
+/// commit per block and not one per record
+#define BACKUPLFSPROGSIZE (512)
+
+/// How many blocks the LittleFS allocator looks ahead at, capped at the
+/// blocks of the store. It is one bit per block, so 512 bytes of RAM cover
+/// 2 MB of a partition with 512 byte blocks before the store has to be
+/// walked again to find free ones
+#define BACKUPLFSLOOKAHEAD (4096)
+
+/// The directory of the backup log's segments. A single file log from
+/// before the segments, with the same name and a .dat extension, is moved
+/// into it. With BACKLOGPRIORITY it only has the raw readings, and the
+/// events and the summaries are in logs of their own next to it.
+#if BACKUPSTORE == BACKUPSTOREFAT
+#define BACKUPLOGDIR "/sd/PortReadings"
+#define BACKUPEVENTDIR "/sd/PortEvents"
+#define BACKUPSUMMARYDIR "/sd/PortSummaries"
+#else
+#define BACKUPLOGDIR "/log/PortReadings"
+#define BACKUPEVENTDIR "/log/PortEvents"
+#define BACKUPSUMMARYDIR "/log/PortSummaries"
+#endif
+
+/// Where BACKUPSTORETIERED moves the older segments of a log, to the
+/// directory of the same name on the SD card, with the same names
+#define BACKUPCOLDROOT "/sd"
+
+/// How many segments BACKUPSTORETIERED keeps in the flash. About 8 KB each
+/// with the flash's 4 KB blocks, and a day of readings every 5 seconds
+#define BACKUPHOTSEGMENTS (8)
+
+/// The bytes that are copied to the SD card with every write when segments
+/// are moved there
+#define BACKUPSPILLCHUNK (4096)
+
+/// Mounts the filesystem that holds BACKUPLOGDIR. A LittleFS store that
+/// does not mount is formatted, which only loses the backlog and never the
+/// config file.
+/// \param sd The SD card's block device, with the FAT already mounted
+/// \returns 0 on success, or a negative error code
+int mountBackupStore(BlockDevice *sd);
+
+/// Tells the card which blocks of the backup log are free again, after
+/// segments were removed, so that its own erasing does not hold up later
+/// writes. The FAT does this for every file that is removed. In the
+/// internal flash, LittleFS erases a block right before it writes it, so
+/// only a store on a FlashStageBlockDevice has something to do there: it
+/// erases the free blocks in stepBackupStore().
+/// \returns 0 on success, or a negative error code
+int trimBackupStore();
+
+/// Erases one of the free blocks of the backup log in the internal flash
+/// ahead of time, with FLASHSTAGE. It runs from the main loop, so the
+/// erase does not hold up an append.
+void stepBackupStore();
+
+#endif // BACKUPSTORE
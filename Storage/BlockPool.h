@@ -0,0 +1,118 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+/// \file
+/// \brief A static pool of fixed size blocks, for buffers that would
+/// otherwise come from the heap on every message.
+///
+/// The blocks are in the pool object itself, so how much memory the pool
+/// takes is known when it is compiled and it can never fragment the heap.
+/// The free blocks are kept in a list that runs through the blocks, so
+/// alloc() and free() only take the head of the list, in a short critical
+/// section. Both can be called from any thread or interrupt handler. The
+/// pool counts how many blocks are in use, the most that ever were, and the
+/// allocations it could not serve.
+
+#include "mbed.h"
+
+#include "platform/mbed_critical.h"
+
+/// What BlockPool::stats() returns
+struct BlockPoolStats {
+    /// the number of blocks, and how big each of them is
+    uint32_t Blocks;
+    uint32_t BlockSize;
+
+    /// blocks that are allocated now, and the most that were at once
+    uint32_t InUse;
+    uint32_t Peak;
+
+    /// allocations that failed because every block was in use
+    uint32_t Failed;
+};
+
+/// Count blocks of Size bytes each, aligned for any type
+template <size_t Size, size_t Count>
+class BlockPool : private NonCopyable<BlockPool<Size, Count> > {
+    MBED_STATIC_ASSERT(Size > 0 && Count > 0,
+                       "BlockPool needs at least one block of one byte");
+
+  public:
+    BlockPool() : Free(&Blocks[0]), InUse(0), Peak(0), Failed(0) {
+        for (size_t i = 0; i + 1 < Count; ++i) {
+            Blocks[i].Next = &Blocks[i + 1];
+        }
+        Blocks[Count - 1].Next = NULL;
+    }
+
+    /// Takes a block out of the pool
+    /// \returns NULL if every block is in use
+    void *alloc() {
+        core_util_critical_section_enter();
+        Block *Taken = Free;
+        if (Taken != NULL) {
+            Free = Taken->Next;
+            if (++InUse > Peak) {
+                Peak = InUse;
+            }
+        } else {
+            ++Failed;
+        }
+        core_util_critical_section_exit();
+        return Taken;
+    }
+
+    /// Puts Pointer back into the pool
+    /// \returns false if Pointer is not a block of this pool
+    bool free(void *Pointer) {
+        if (!owns(Pointer)) {
+            return false;
+        }
+        Block *Given = static_cast<Block *>(Pointer);
+        core_util_critical_section_enter();
+        Given->Next = Free;
+        Free = Given;
+        --InUse;
+        core_util_critical_section_exit();
+        return true;
+    }
+
+    /// Returns true if Pointer is a block of this pool
+    bool owns(const void *Pointer) const {
+        const Block *Given = static_cast<const Block *>(Pointer);
+        return Given >= &Blocks[0] && Given < &Blocks[Count] &&
+               ((const char *)Given - (const char *)&Blocks[0]) %
+                       sizeof(Block) ==
+                   0;
+    }
+
+    /// Returns how full the pool is
+    BlockPoolStats stats() const {
+        BlockPoolStats Stats;
+        core_util_critical_section_enter();
+        Stats.Blocks = Count;
+        Stats.BlockSize = Size;
+        Stats.InUse = InUse;
+        Stats.Peak = Peak;
+        Stats.Failed = Failed;
+        core_util_critical_section_exit();
+        return Stats;
+    }
+
+    static size_t blockSize() { return Size; }
+
+  private:
+    /// a free block holds the next free one, an allocated one its data
+    union Block {
+        Block *Next;
+        uint64_t Align;
+        uint8_t Bytes[Size];
+    };
+
+    Block Blocks[Count];
+    Block *Free;
+    uint32_t InUse;
+    uint32_t Peak;
+    uint32_t Failed;
+};
+
+#endif // BLOCKPOOL
@@ -0,0 +1,224 @@
+/// \file
+/// \brief Implementation of the capture files
+#define TRACE_GROUP "capt"
+#include "CaptureStore.h"
+
+#include "CborWriter.h"
+#include "DeferredLog.h"
+#include "FrameCodec.h"
+#include "NumberFormat.h"
+#include "RequestWriter.h"
+
+#include <string>
+
+/// The longest name of a capture file, with its directory
+#define CAPTUREPATHMAX (64)
+
+/// The capture is written to the file in pieces of this many bytes
+#define CAPTUREPIECE (64)
+
+/// The name of a capture file, built on the stack like the segment names of
+/// the backup log
+struct CapturePath {
+    char Name[CAPTUREPATHMAX];
+
+    const char *c_str() const { return Name; }
+};
+
+/// the Dir that the numbers below belong to, empty before the first use
+static std::string StoreDir;
+
+/// the number of the oldest capture, and of the next one
+static uint32_t FirstNumber = 0;
+static uint32_t NextNumber = 0;
+
+// the name of capture Number in Dir, with the extension Ext
+static CapturePath captureName(const char *Dir, uint32_t Number,
+                               const char *Ext) {
+    CapturePath Path;
+    const size_t Room = sizeof(Path.Name) - FORMATUNSIGNEDMAX - 5;
+    int Length = snprintf(Path.Name, Room, "%s/", Dir);
+    if (Length < 0 || (size_t)Length >= Room) {
+        Length = Length < 0 ? 0 : Room - 1;
+    }
+    Length += formatUnsigned(Path.Name + Length, Number, 6);
+    snprintf(Path.Name + Length, sizeof(Path.Name) - Length, ".%s", Ext);
+    return Path;
+}
+
+// finds the oldest and newest capture in Dir when it is first used
+static void loadStore(const char *Dir) {
+    if (StoreDir == Dir) {
+        return;
+    }
+    StoreDir = Dir;
+    mkdir(Dir, 0777);
+
+    FirstNumber = UINT32_MAX;
+    NextNumber = 0;
+    DIR *Listing = opendir(Dir);
+    if (Listing != NULL) {
+        struct dirent *Entry;
+        while ((Entry = readdir(Listing)) != NULL) {
+            unsigned long Number;
+            char Ext[5];
+            if (sscanf(Entry->d_name, "%6lu.%4s", &Number, Ext) != 2) {
+                continue;
+            }
+            if (strcmp(Ext, "cbr") == 0) {
+                FirstNumber = Number < FirstNumber ? Number : FirstNumber;
+                NextNumber = Number >= NextNumber ? Number + 1 : NextNumber;
+            } else if (strcmp(Ext, "tmp") == 0) {
+                // a capture that was cut off by a reset
+                remove(captureName(Dir, Number, Ext).c_str());
+            }
+        }
+        closedir(Listing);
+    }
+    if (FirstNumber == UINT32_MAX) {
+        FirstNumber = NextNumber;
+    }
+}
+
+static bool writeFile(FILE *File, const char *data, size_t length) {
+    return fwrite(data, 1, length, File) == length;
+}
+
+// writes the body that is described in CaptureStore.h
+static void writeCapture(CborWriter &Cbor, const WaveCapture &Capture,
+                         BoardSpecs &Specs, uint32_t Time, uint32_t Rate) {
+    size_t Count = Capture.ports();
+    Cbor.map(11);
+    Cbor.text("b");
+    Cbor.text(Specs.DatabaseTableName);
+    Cbor.text("v");
+    Cbor.unsignedInt(Specs.ConfigVersion);
+    Cbor.text("t");
+    Cbor.unsignedInt(Time);
+    Cbor.text("r");
+    Cbor.unsignedInt(Rate);
+    Cbor.text("p");
+    Cbor.unsignedInt(CAPTUREPRE);
+    Cbor.text("f");
+    Cbor.unsignedInt(CAPTUREFRAMES);
+    Cbor.text("g");
+    Cbor.unsignedInt(Capture.triggerPort());
+
+    Cbor.text("i");
+    Cbor.array(Count);
+    for (size_t i = 0; i < Count; ++i) {
+        Cbor.unsignedInt(Capture.port(i));
+    }
+    Cbor.text("n");
+    Cbor.array(Count);
+    for (size_t i = 0; i < Count; ++i) {
+        size_t Port = Capture.port(i);
+        Cbor.text(Port < Specs.Ports.size() ? Specs.Ports[Port].Name.c_str() : "");
+    }
+    Cbor.text("m");
+    Cbor.array(Count);
+    for (size_t i = 0; i < Count; ++i) {
+        size_t Port = Capture.port(i);
+        Cbor.float32(Port < Specs.Ports.size() ? Specs.Ports[Port].Multiplier
+                                               : 0.0f);
+    }
+
+    // the frames go out in definite pieces of an indefinite byte string,
+    // so the length does not have to be known up front
+    Cbor.text("z");
+    Cbor.startBytes();
+    uint8_t Piece[CAPTUREPIECE];
+    size_t Used = 0;
+    uint16_t Last[CAPTUREMAXPORTS] = {0};
+    for (size_t n = 0; n < CAPTUREFRAMES; ++n) {
+        if (Used + Count * 3 > sizeof(Piece)) {
+            Cbor.bytes(Piece, Used);
+            Used = 0;
+        }
+        for (size_t i = 0; i < Count; ++i) {
+            uint16_t Raw = Capture.sample(i, n);
+            Used += putVarint(Piece + Used, zigzag((int32_t)Raw - Last[i]));
+            Last[i] = Raw;
+        }
+    }
+    if (Used > 0) {
+        Cbor.bytes(Piece, Used);
+    }
+    Cbor.stop();
+}
+
+// ============================================================================
+bool saveCapture(const char *Dir, const WaveCapture &Capture,
+                 BoardSpecs &Specs, uint32_t Time, uint32_t Rate) {
+    loadStore(Dir);
+    if (NextNumber - FirstNumber >= CAPTUREFILESMAX) {
+        tr_warn("Too many captures waiting, dropping the oldest");
+        dropCapture(Dir);
+    }
+
+    // the capture only gets its real name once all of it is written
+    CapturePath Temp = captureName(Dir, NextNumber, "tmp");
+    FILE *File = fopen(Temp.c_str(), "wb");
+    if (File == NULL) {
+        tr_error("Could not open %s", Temp.c_str());
+        return false;
+    }
+    char Buffer[CAPTUREPIECE * 2];
+    RequestWriter Out(Buffer, sizeof(Buffer), callback(writeFile, File));
+    CborWriter Cbor(Out);
+    writeCapture(Cbor, Capture, Specs, Time, Rate);
+    bool Written = Out.finish();
+    Written = fclose(File) == 0 && Written;
+
+    if (!Written ||
+        rename(Temp.c_str(), captureName(Dir, NextNumber, "cbr").c_str())) {
+        tr_error("Could not write the capture %lu",
+                 (unsigned long)NextNumber);
+        remove(Temp.c_str());
+        return false;
+    }
+    tr_info("Saved capture %lu, %lu bytes", (unsigned long)NextNumber,
+            (unsigned long)Out.flushed());
+    ++NextNumber;
+    return true;
+}
+
+// ============================================================================
+size_t captureCount(const char *Dir) {
+    loadStore(Dir);
+    return NextNumber - FirstNumber;
+}
+
+// ============================================================================
+FILE *openCapture(const char *Dir, size_t &Size) {
+    loadStore(Dir);
+    while (FirstNumber != NextNumber) {
+        FILE *File = fopen(captureName(Dir, FirstNumber, "cbr").c_str(), "rb");
+        if (File != NULL && fseek(File, 0, SEEK_END) == 0) {
+            long End = ftell(File);
+            if (End > 0 && fseek(File, 0, SEEK_SET) == 0) {
+                Size = (size_t)End;
+                return File;
+            }
+        }
+        // a file that is gone or empty is skipped
+        if (File != NULL) {
+            fclose(File);
+        }
+        dropCapture(Dir);
+    }
+    return NULL;
+}
+
+// ============================================================================
+void dropCapture(const char *Dir) {
+    loadStore(Dir);
+    if (FirstNumber == NextNumber) {
+        return;
+    }
+    remove(captureName(Dir, FirstNumber, "cbr").c_str());
+    ++FirstNumber;
+}
+
+// ============================================================================
+void releaseCaptures() { StoreDir.clear(); }
@@ -0,0 +1,59 @@
+#ifndef CAPTURESTORE_H
+#define CAPTURESTORE_H
+/// \file
+/// \brief Keeps the waveform captures until the uploader has sent them.
+///
+/// Every capture of WaveCapture.h is one file in CAPTUREDIR, written as the
+/// CBOR body that is sent to the server, so it can be streamed out of the
+/// file as it is. The body is a map of
+///  - b: the board name, v: the config version
+///  - t: the time of the trigger, r: the scan frames per second
+///  - p: the frames before the trigger, f: all of the frames
+///  - i: the port index of every captured port, n: their names, m: their
+///    multipliers, g: the captured port that set off the trigger
+///  - z: the frames as a byte string. Every frame has the zig-zag varint of
+///    the raw reading of every captured port minus the one in the frame
+///    before, see FrameCodec.h
+///
+/// The file numbers only go up, the oldest capture is sent first.
+
+#include "BackupStore.h"
+#include "Structs.h"
+#include "WaveCapture.h"
+
+#include <cstdio>
+
+/// The directory of the capture files, next to the backup log
+#if BACKUPSTORE == BACKUPSTOREFAT
+#define CAPTUREDIR "/sd/Captures"
+#else
+#define CAPTUREDIR "/log/Captures"
+#endif
+
+/// The most captures that are kept, the oldest one makes room for a new one
+#define CAPTUREFILESMAX (16)
+
+/// Writes the frozen capture into a new file in Dir.
+/// \param Time The time of the trigger
+/// \param Rate The scan frames per second
+/// \returns false if it could not be written
+bool saveCapture(const char *Dir, const WaveCapture &Capture,
+                 BoardSpecs &Specs, uint32_t Time, uint32_t Rate);
+
+/// Returns the number of captures in Dir that were not sent yet
+size_t captureCount(const char *Dir);
+
+/// Opens the oldest capture in Dir for reading. The caller closes it.
+/// \param Size Set to the length of the file
+/// \returns NULL if there is no capture
+FILE *openCapture(const char *Dir, size_t &Size);
+
+/// Deletes the oldest capture in Dir, once it was sent
+void dropCapture(const char *Dir);
+
+/// Forgets the numbers of the captures that were found, so the directory is
+/// listed again on the next use, after it may have been changed while its
+/// filesystem was unmounted
+void releaseCaptures();
+
+#endif // CAPTURESTORE
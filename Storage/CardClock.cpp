@@ -0,0 +1,135 @@
+/// \file
+/// \brief Implementation of the SD card clock tuning
+#include "CardClock.h"
+
+#if CARDCLOCKTUNE
+
+#if !COMPONENT_SD
+#error "sd-clock-tune needs the SD component for SDBlockDevice"
+#endif
+
+#include "FlashQueue.h"
+#include "MbedCRC.h"
+#include "SDBlockDevice.h"
+
+/// the block size of the reads
+#define CARDCLOCKBLOCK (512)
+
+/// the clock that the reads of every step are compared with, the one that
+/// SDBlockDevice is built with
+#define CARDCLOCKSTART (1000000)
+
+/// the clocks that are tried, slowest first. SDBlockDevice goes up to 25 MHz
+static const uint32_t CardClockSteps[] = {2000000,  4000000,  6000000,
+                                          8000000,  12000000, 15000000,
+                                          20000000, 25000000};
+
+#define CARDCLOCKSTEPS (sizeof(CardClockSteps) / sizeof(CardClockSteps[0]))
+
+static_assert(CARDCLOCKSTEPS >= 2, "the margin needs two steps");
+
+/// what is kept in the flash
+struct CardClock {
+    /// the CID of the card that it was tuned for
+    uint8_t Cid[16];
+
+    uint32_t Hz;
+};
+
+static_assert(sizeof(CardClock) <= FLASHCARDCLOCKMAX,
+              "the card clock does not fit into FLASHCARDCLOCKMAX");
+
+static uint8_t Block[CARDCLOCKBLOCK];
+
+// reads the first CARDCLOCKBLOCKS blocks at the current clock, with the
+// CRC-32 of every one of them into Sums
+static bool readBlocks(SDBlockDevice &sd, uint32_t *Sums) {
+    MbedCRC<POLY_32BIT_ANSI, 32> Crc;
+    for (size_t i = 0; i < CARDCLOCKBLOCKS; ++i) {
+        if (sd.read(Block, (bd_addr_t)i * CARDCLOCKBLOCK, CARDCLOCKBLOCK) !=
+            BD_ERROR_OK) {
+            return false;
+        }
+        Crc.compute(Block, CARDCLOCKBLOCK, &Sums[i]);
+    }
+    return true;
+}
+
+// returns true if every read at the current clock gets the blocks of
+// Reference, without a CRC error
+static bool stepPasses(SDBlockDevice &sd, const uint32_t *Reference) {
+    uint32_t Sums[CARDCLOCKBLOCKS];
+    for (int r = 0; r < CARDCLOCKREPEATS; ++r) {
+        if (!readBlocks(sd, Sums) ||
+            memcmp(Sums, Reference, sizeof(Sums)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ============================================================================
+int tuneCardClock(BlockDevice *bd) {
+    if (strcmp(bd->get_type(), "SD") != 0) {
+        return CARDCLOCKSUCCESS;
+    }
+    SDBlockDevice &sd = *static_cast<SDBlockDevice *>(bd);
+
+    // the CRC is turned on by init()
+    sd.crc(true);
+    sd.frequency(CARDCLOCKSTART);
+    int err = sd.init();
+    if (err != BD_ERROR_OK) {
+        return err;
+    }
+
+    // the same card gets the clock of the last boot
+    CardClock Card, Saved;
+    memset(&Card, 0, sizeof(Card));
+    bool Known = sd.cid(Card.Cid) == BD_ERROR_OK;
+    if (Known && readCardClockCache(&Saved, sizeof(Saved)) == sizeof(Saved) &&
+        memcmp(Saved.Cid, Card.Cid, sizeof(Card.Cid)) == 0) {
+        sd.frequency(Saved.Hz);
+        sd.deinit();
+        printf("The SD card runs at %lu Hz\r\n", (unsigned long)Saved.Hz);
+        return CARDCLOCKSUCCESS;
+    }
+
+    uint32_t Reference[CARDCLOCKBLOCKS];
+    if (!readBlocks(sd, Reference)) {
+        sd.deinit();
+        return BD_ERROR_DEVICE_ERROR;
+    }
+    size_t Passed = 0;
+    while (Passed < CARDCLOCKSTEPS) {
+        sd.frequency(CardClockSteps[Passed]);
+        if (!stepPasses(sd, Reference)) {
+            break;
+        }
+        ++Passed;
+    }
+
+    // one step of margin below the fastest one that passed, if one failed
+    if (Passed == CARDCLOCKSTEPS) {
+        Card.Hz = CardClockSteps[CARDCLOCKSTEPS - 1];
+    } else if (Passed >= 2) {
+        Card.Hz = CardClockSteps[Passed - 2];
+    } else {
+        Card.Hz = CARDCLOCKSTART;
+    }
+    sd.frequency(Card.Hz);
+
+    // a step that failed may have left the card in the middle of a
+    // transfer, the next init() starts it over
+    sd.deinit();
+    printf("The SD card is tuned to %lu Hz\r\n", (unsigned long)Card.Hz);
+    if (Known) {
+        err = saveCardClockCache(&Card, sizeof(Card));
+        if (err) {
+            printf("The SD card clock could not be kept (%d)\r\n", err);
+        }
+    }
+    return CARDCLOCKSUCCESS;
+}
+
+#endif // CARDCLOCKTUNE
@@ -0,0 +1,50 @@
+#ifndef CARDCLOCK_H
+#define CARDCLOCK_H
+/// \file
+/// \brief Finds the fastest SPI clock that the SD card works at on this
+/// board, with the CRC of every command and block checked.
+///
+/// SDBlockDevice moves data at the 1 MHz it is built with, and without the
+/// CRC a bit that flips on a long cable goes to the FAT unnoticed. Here the
+/// card is started with the CRC on, which the K64F's CRC engine computes
+/// for the blocks. A run of blocks at the start of the card is read at the
+/// starting clock, then again at every faster step of CARDCLOCKSTEPS. A step
+/// passes if every read comes back without a CRC error and the same as at
+/// the starting clock. The card keeps the step below the fastest one that
+/// passed, or the fastest step if none failed. The clock is kept in the
+/// flash with the card's CID, so the same card gets it right away on the
+/// next boot, and a new card is tried again.
+///
+/// Only the SPI SDBlockDevice is tuned. SDHCBlockDevice picks its clock
+/// from what the card says it supports.
+
+#include "mbed.h"
+
+#include "BlockDevice.h"
+
+/// Set to 1 to tune the clock of the SD card at boot. Set with
+/// "sd-clock-tune" in mbed_app.json.
+#ifdef MBED_CONF_APP_SD_CLOCK_TUNE
+#define CARDCLOCKTUNE MBED_CONF_APP_SD_CLOCK_TUNE
+#else
+#define CARDCLOCKTUNE (0)
+#endif
+
+/// How many blocks at the start of the card are read at every step
+#define CARDCLOCKBLOCKS (16)
+
+/// How many times the blocks are read at every step
+#define CARDCLOCKREPEATS (4)
+
+/// a constant value that is returned from tuneCardClock() upon success
+#define CARDCLOCKSUCCESS (0)
+
+/// Turns the CRC on and sets the clock of bd, from the flash if this card
+/// was tuned before. The card is left initialized as often as it was
+/// before, the clock holds for the later init() calls.
+/// \returns CARDCLOCKSUCCESS, also if bd is not an SDBlockDevice and
+/// nothing was done, or a negative error code if the card does not work
+/// even at the starting clock
+int tuneCardClock(BlockDevice *bd);
+
+#endif // CARDCLOCK
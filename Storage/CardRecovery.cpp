@@ -0,0 +1,185 @@
+/// \file
+/// \brief Implementation of the SD card recovery
+#include "CardRecovery.h"
+
+#include "ReadOnlyBlockDevice.h"
+#include "SDHCBlockDevice.h"
+
+#if COMPONENT_SD
+#include "SDBlockDevice.h"
+#endif
+
+#include <cerrno>
+
+/// the sector size of the boot sectors that are looked at
+#define CARDSECTOR (512)
+
+/// where a FAT32 volume keeps the copy of its boot sector, in sectors
+#define CARDBACKUPBOOT (6)
+
+/// the clocks of the retries, in Hz
+static const uint32_t CardRetryHz[CARDRETRIES] = {10000000, 4000000, 1000000};
+
+/// what repairVolume() found
+#define CARDINTACT (0)
+#define CARDREPAIRED (1)
+#define CARDBLANK (2)
+#define CARDBROKEN (3)
+
+/// the card behind fs while it is mounted read-only
+static ReadOnlyBlockDevice *ReadOnly = NULL;
+
+static uint8_t Sector[CARDSECTOR];
+
+// slows the card down to hz from its next init()
+static void slowDown(BlockDevice *bd, uint32_t hz) {
+    if (strcmp(bd->get_type(), "SDHC") == 0) {
+        static_cast<SDHCBlockDevice *>(bd)->limitFrequency(hz);
+    }
+#if COMPONENT_SD
+    if (strcmp(bd->get_type(), "SD") == 0) {
+        static_cast<SDBlockDevice *>(bd)->frequency(hz);
+    }
+#endif
+}
+
+// reads the sector at lba into Sector
+static bool readSector(BlockDevice *bd, uint32_t lba) {
+    return bd->read(Sector, (bd_addr_t)lba * CARDSECTOR, CARDSECTOR) ==
+           BD_ERROR_OK;
+}
+
+static uint16_t little16(const uint8_t *In) { return In[0] | (In[1] << 8); }
+
+static uint32_t little32(const uint8_t *In) {
+    return little16(In) | ((uint32_t)little16(In + 2) << 16);
+}
+
+// returns true if Sector is the boot sector of a FAT volume
+static bool isBootSector() {
+    return Sector[510] == 0x55 && Sector[511] == 0xAA &&
+           (Sector[0] == 0xEB || Sector[0] == 0xE9) &&
+           little16(Sector + 11) == CARDSECTOR;
+}
+
+// returns true if Sector is all zeros or all ones
+static bool isBlank() {
+    for (size_t i = 1; i < CARDSECTOR; ++i) {
+        if (Sector[i] != Sector[0]) {
+            return false;
+        }
+    }
+    return Sector[0] == 0x00 || Sector[0] == 0xFF;
+}
+
+// looks at the boot sector of the first volume, and puts the backup copy
+// back if it is broken. Nothing else is written
+static int repairVolume(BlockDevice *bd) {
+    if (!readSector(bd, 0)) {
+        return CARDBROKEN;
+    }
+    if (isBlank()) {
+        return CARDBLANK;
+    }
+    if (isBootSector()) {
+        return CARDINTACT;
+    }
+
+    // a partition table, the volume is the first partition
+    uint32_t Volume = 0;
+    if (Sector[510] == 0x55 && Sector[511] == 0xAA && Sector[446 + 4] != 0) {
+        Volume = little32(Sector + 446 + 8);
+        if (!readSector(bd, Volume)) {
+            return CARDBROKEN;
+        }
+        if (isBootSector()) {
+            return CARDINTACT;
+        }
+    }
+
+    // only FAT32 has the copy, its FAT size in the old field is 0
+    if (!readSector(bd, Volume + CARDBACKUPBOOT) || !isBootSector() ||
+        little16(Sector + 22) != 0) {
+        return CARDBROKEN;
+    }
+    bd_addr_t Addr = (bd_addr_t)Volume * CARDSECTOR;
+    if (bd->erase(Addr, CARDSECTOR) != BD_ERROR_OK ||
+        bd->program(Sector, Addr, CARDSECTOR) != BD_ERROR_OK) {
+        return CARDBROKEN;
+    }
+    return CARDREPAIRED;
+}
+
+// returns true if a file can be written to fs
+static bool canWrite(FATFileSystem &fs) {
+    char Path[32];
+    snprintf(Path, sizeof(Path), "/%s/.probe", fs.getName());
+    FILE *fp = fopen(Path, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    bool Wrote = fputc(0, fp) != EOF;
+    Wrote = fclose(fp) == 0 && Wrote;
+    return remove(Path) == 0 && Wrote;
+}
+
+// mounts the FAT that did mount read-only
+static int mountReadOnly(FATFileSystem &fs, BlockDevice *bd) {
+    fs.unmount();
+    if (ReadOnly == NULL) {
+        ReadOnly = new ReadOnlyBlockDevice(bd);
+    }
+    return fs.mount(ReadOnly);
+}
+
+// ============================================================================
+int mountCard(FATFileSystem &fs, BlockDevice *bd, bool &read_only) {
+    read_only = false;
+    // a mount that failed still holds the drive, so every try unmounts
+    fs.unmount();
+    int err = fs.mount(bd);
+
+    // the card is initialized again, at a slower clock every time
+    for (int i = 0; i < CARDRETRIES && err == -EIO; ++i) {
+        printf("The SD card did not mount (%d), trying again at %lu Hz\r\n",
+               err, (unsigned long)CardRetryHz[i]);
+        fs.unmount();
+        bd->deinit();
+        slowDown(bd, CardRetryHz[i]);
+        err = fs.mount(bd);
+    }
+
+    // the card reads, but there is no FAT on it
+    if (err == -EINVAL) {
+        fs.unmount();
+        int found = CARDBROKEN;
+        if (bd->init() == BD_ERROR_OK) {
+            found = repairVolume(bd);
+            bd->deinit();
+        }
+        if (found == CARDREPAIRED) {
+            printf("The boot sector of the SD card was put back from its "
+                   "copy\r\n");
+            err = fs.mount(bd);
+        } else if (found == CARDBLANK) {
+            // this should only happen on the first boot
+            printf("The SD card is blank, formatting... ");
+            fflush(stdout);
+            err = fs.reformat(bd);
+            printf("%s\r\n", (err ? "Fail :(" : "OK"));
+        }
+    }
+    if (err != 0) {
+        fs.unmount();
+        printf("error: %s (%d), the SD card is left as it is\r\n",
+               strerror(-err), err);
+        return err;
+    }
+
+    if (!canWrite(fs)) {
+        printf("The SD card can not be written to, it is read-only\r\n");
+        read_only = true;
+        err = mountReadOnly(fs, bd);
+    }
+    return err;
+}
@@ -0,0 +1,37 @@
+#ifndef CARDRECOVERY_H
+#define CARDRECOVERY_H
+/// \file
+/// \brief Mounts the SD card's FAT without ever formatting away what is on
+/// it.
+///
+/// A card that did not mount used to be formatted right away, so a loose
+/// contact or a card that does not like the fast clock lost the whole
+/// backlog. Here the card is initialized again at slower and slower clocks
+/// first. A FAT32 volume whose boot sector is broken gets it back from the
+/// backup copy that FAT32 keeps a few sectors after it; nothing else on
+/// the card is written. Only a blank card, all zeros or all ones at the
+/// start, is formatted. A card that mounts but can not be written to is
+/// mounted read-only, so the config file is still read. In all of the other
+/// cases the card is left alone and the readings go to the flash queue,
+/// and the uploader tries again every CARDREMOUNTMS.
+
+#include "mbed.h"
+
+#include "BlockDevice.h"
+#include "FATFileSystem.h"
+
+/// How many times a card that does not mount is initialized again, every
+/// time at a slower clock
+#define CARDRETRIES (3)
+
+/// How often the uploader tries to mount a card again that did not mount,
+/// or that only mounted read-only, in milliseconds
+#define CARDREMOUNTMS (60000)
+
+/// Mounts fs on bd, see above. fs may be mounted already, it is mounted
+/// again
+/// \param read_only Set to true if fs is mounted but can not be written to
+/// \returns 0 on success, or the negative error code of the last mount
+int mountCard(FATFileSystem &fs, BlockDevice *bd, bool &read_only);
+
+#endif // CARDRECOVERY
@@ -0,0 +1,123 @@
+/// \file
+/// \brief Implementation of the firmware patch
+#include "DeltaPatch.h"
+
+DeltaPatch::DeltaPatch()
+    : Old(NULL), OldSize(0), PatchAt(0), NewAt(0), OldAt(0), Left(0),
+      Phase(PhaseOp), Op(DELTAEND), Shift(0) {}
+
+// ============================================================================
+void DeltaPatch::start(const uint8_t *Image, uint32_t Size) {
+    Old = Image;
+    OldSize = Size;
+    PatchAt = SLOTPATCHHEAD;
+    NewAt = 0;
+    OldAt = 0;
+    Left = 0;
+    Phase = PhaseOp;
+    Op = DELTAEND;
+    Shift = 0;
+}
+
+// ============================================================================
+void DeltaPatch::resume(const uint8_t *Image, uint32_t Size,
+                        const SlotCheckpoint &At) {
+    Old = Image;
+    OldSize = Size;
+    PatchAt = At.PatchAt;
+    NewAt = At.NewAt;
+    OldAt = At.OldAt;
+    Left = At.Left;
+    Phase = At.Phase <= PhaseData ? At.Phase : PhaseFailed;
+    Op = At.Op;
+    Shift = At.Shift;
+}
+
+// ============================================================================
+void DeltaPatch::checkpoint(SlotCheckpoint &At) const {
+    At.PatchAt = PatchAt;
+    At.NewAt = NewAt;
+    At.OldAt = OldAt;
+    At.Left = Left;
+    At.Phase = Phase;
+    At.Op = Op;
+    At.Shift = Shift;
+    At.Pad = 0;
+    At.Reserved = 0;
+}
+
+void DeltaPatch::startOp() {
+    Phase = PhaseData;
+    if (Op == DELTASEEK) {
+        // zig-zag back to a signed step
+        int32_t Step = (int32_t)(Left >> 1) ^ -(int32_t)(Left & 1);
+        uint32_t To = OldAt + (uint32_t)Step;
+        Phase = To <= OldSize ? PhaseOp : PhaseFailed;
+        OldAt = To;
+        Left = 0;
+    } else if (Op != DELTAINSERT && Left > OldSize - OldAt) {
+        Phase = PhaseFailed;
+    } else if (Left == 0) {
+        Phase = PhaseOp;
+    }
+}
+
+// ============================================================================
+size_t DeltaPatch::run(const uint8_t *In, size_t Length, uint8_t *Out,
+                       size_t Room, size_t &Written) {
+    size_t Taken = 0;
+    Written = 0;
+    while (Phase != PhaseDone && Phase != PhaseFailed) {
+        if (Phase == PhaseData && Op == DELTACOPY) {
+            // the patch has nothing for a copy, only the room counts
+            if (Written == Room) {
+                break;
+            }
+            Out[Written++] = Old[OldAt++];
+            ++NewAt;
+            if (--Left == 0) {
+                Phase = PhaseOp;
+            }
+            continue;
+        }
+        if (Taken == Length || (Phase == PhaseData && Written == Room)) {
+            break;
+        }
+        uint8_t Byte = In[Taken++];
+        ++PatchAt;
+        switch (Phase) {
+        case PhaseOp:
+            Op = Byte;
+            Left = 0;
+            Shift = 0;
+            if (Op == DELTAEND) {
+                Phase = PhaseDone;
+            } else if (Op > DELTASEEK) {
+                Phase = PhaseFailed;
+            } else {
+                Phase = PhaseLength;
+            }
+            break;
+        case PhaseLength:
+            if (Shift > 28) {
+                Phase = PhaseFailed;
+                break;
+            }
+            Left |= (uint32_t)(Byte & 0x7F) << Shift;
+            Shift += 7;
+            if ((Byte & 0x80) == 0) {
+                startOp();
+            }
+            break;
+        default:
+            Out[Written++] = Op == DELTAADD ? (uint8_t)(Old[OldAt++] + Byte)
+                                            : Byte;
+            ++NewAt;
+            if (--Left == 0) {
+                Phase = PhaseOp;
+            }
+            break;
+        }
+    }
+    return Taken;
+}
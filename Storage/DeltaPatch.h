@@ -0,0 +1,96 @@
+#ifndef DELTAPATCH_H
+#define DELTAPATCH_H
+/// \file
+/// \brief Builds a new firmware image from the running one and a patch, as
+/// the bytes of the patch come in.
+///
+/// The patch is bsdiff's idea without its compression: most of a new build
+/// is the old one, some of it moved, with addresses in it that changed by a
+/// few. So the new image is made of runs of the old one, copied as they
+/// are or with a small difference added to every byte, and the bytes that
+/// are new. These are operations of an op byte and a varint of FrameCodec.h
+/// each:
+///  - DELTACOPY n: the next n bytes of the old image
+///  - DELTAADD n, then n bytes: the next n bytes of the old image, each with
+///    its byte of the patch added
+///  - DELTAINSERT n, then n bytes: the n bytes of the patch
+///  - DELTASEEK z: moves the place in the old image by the zig-zag z
+///  - DELTAEND: the image is complete
+///
+/// Storage/make_delta.py writes them, with a SlotManifest and its
+/// SlotSignature in front, see SlotLayout.h. The state of the patch is a
+/// SlotCheckpoint, so it can be kept in the flash with every sector and
+/// started again from there.
+
+#include "SlotLayout.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The op bytes
+#define DELTAEND (0)
+#define DELTACOPY (1)
+#define DELTAADD (2)
+#define DELTAINSERT (3)
+#define DELTASEEK (4)
+
+class DeltaPatch {
+  public:
+    DeltaPatch();
+
+    /// Starts on the patch against the Size bytes of the image at Old, from
+    /// the start of its operations, after the manifest and the signature
+    void start(const uint8_t *Old, uint32_t Size);
+
+    /// Goes on from where a checkpoint was taken
+    void resume(const uint8_t *Old, uint32_t Size, const SlotCheckpoint &At);
+
+    /// Takes the next Length bytes of the patch, and writes the new image to
+    /// Out until Room bytes are written or the patch needs more
+    /// \param Written Set to the bytes written to Out
+    /// \returns the bytes of In that were taken
+    size_t run(const uint8_t *In, size_t Length, uint8_t *Out, size_t Room,
+               size_t &Written);
+
+    /// Returns true once DELTAEND was taken
+    bool done() const { return Phase == PhaseDone; }
+
+    /// Returns true if the patch reads outside of the old image, or has an
+    /// op that is not one of the ones above
+    bool failed() const { return Phase == PhaseFailed; }
+
+    /// Returns the bytes of the patch that were taken, with the manifest and
+    /// the signature
+    uint32_t patchAt() const { return PatchAt; }
+
+    /// Returns the bytes of the new image that were written
+    uint32_t newAt() const { return NewAt; }
+
+    /// Fills in the state of the patch, without the Magic and Crc
+    void checkpoint(SlotCheckpoint &At) const;
+
+  private:
+    enum DeltaPhase {
+        PhaseOp,     ///< waiting for the op byte
+        PhaseLength, ///< the varint of the op
+        PhaseData,   ///< Left bytes of the op
+        PhaseDone,
+        PhaseFailed
+    };
+
+    /// the op's varint is complete
+    void startOp();
+
+    const uint8_t *Old;
+    uint32_t OldSize;
+
+    uint32_t PatchAt;
+    uint32_t NewAt;
+    uint32_t OldAt;
+    uint32_t Left;
+    uint8_t Phase;
+    uint8_t Op;
+    uint8_t Shift;
+};
+
+#endif // DELTAPATCH
@@ -0,0 +1,214 @@
+/// \file
+/// \brief Implementation of the update slot
+#define TRACE_GROUP "ota"
+#include "FirmwareSlot.h"
+
+#include "DeferredLog.h"
+
+#if OTAUPDATE
+#include "MbedCRC.h"
+#include "mbed.h"
+#include "mbedtls/ecdsa.h"
+#include "mbedtls/sha256.h"
+
+#include <cstring>
+
+static_assert(SLOTCHECKPOINTS >= SLOTIMAGEMAX / SLOTSECTOR,
+              "every sector of the largest image has its checkpoint");
+
+/// the key that the manifests are signed with
+static const uint8_t PublicKey[] = OTAPUBLICKEY;
+
+static_assert(sizeof(PublicKey) == 65,
+              "ota-public-key is an uncompressed P-256 point");
+
+static FlashIAP Flash;
+
+static bool FlashReady = false;
+
+/// the place of the next checkpoint, SLOTCHECKPOINTS once it is full
+static size_t NextCheckpoint = 0;
+
+/// one sector of the new image as it is programmed
+static uint8_t Sector[SLOTSECTOR];
+
+// where checkpoint Index is in the trailer
+static uint32_t checkpointAddress(size_t Index) {
+    return SLOTTRAILER + SLOTPATCHHEAD + Index * sizeof(SlotCheckpoint);
+}
+
+static bool startFlash() {
+    if (!FlashReady) {
+        FlashReady = Flash.init() == 0;
+    }
+    return FlashReady;
+}
+
+// ============================================================================
+const uint8_t *runningImage() { return (const uint8_t *)SLOTAPPSTART; }
+
+// ============================================================================
+uint32_t imageCrc(const uint8_t *Image, uint32_t Size) {
+    MbedCRC<POLY_32BIT_ANSI, 32> Crc;
+    uint32_t Sum = 0;
+    Crc.compute(Image, Size, &Sum);
+    return Sum;
+}
+
+// ============================================================================
+bool manifestValid(const SlotManifest &Manifest) {
+    return Manifest.Magic == SLOTMANIFESTMAGIC &&
+           Manifest.ManifestCrc ==
+               imageCrc((const uint8_t *)&Manifest,
+                        offsetof(SlotManifest, ManifestCrc)) &&
+           Manifest.Size <= SLOTIMAGEMAX && Manifest.BaseSize <= SLOTIMAGEMAX;
+}
+
+// ============================================================================
+bool manifestSigned(const SlotManifest &Manifest,
+                    const SlotSignature &Signature) {
+    uint8_t Hash[32];
+    mbedtls_ecp_group Group;
+    mbedtls_ecp_point Key;
+    mbedtls_mpi R, S;
+    mbedtls_ecp_group_init(&Group);
+    mbedtls_ecp_point_init(&Key);
+    mbedtls_mpi_init(&R);
+    mbedtls_mpi_init(&S);
+    bool Signed =
+        mbedtls_sha256_ret((const uint8_t *)&Manifest, sizeof(Manifest), Hash,
+                           0) == 0 &&
+        mbedtls_ecp_group_load(&Group, MBEDTLS_ECP_DP_SECP256R1) == 0 &&
+        mbedtls_ecp_point_read_binary(&Group, &Key, PublicKey,
+                                      sizeof(PublicKey)) == 0 &&
+        mbedtls_mpi_read_binary(&R, Signature.R, sizeof(Signature.R)) == 0 &&
+        mbedtls_mpi_read_binary(&S, Signature.S, sizeof(Signature.S)) == 0 &&
+        mbedtls_ecdsa_verify(&Group, Hash, sizeof(Hash), &Key, &R, &S) == 0;
+    mbedtls_mpi_free(&S);
+    mbedtls_mpi_free(&R);
+    mbedtls_ecp_point_free(&Key);
+    mbedtls_ecp_group_free(&Group);
+    return Signed;
+}
+
+// ============================================================================
+bool slotManifest(SlotManifest &Manifest) {
+    // the flash is mapped, it is read like RAM
+    memcpy(&Manifest, (const void *)SLOTTRAILER, sizeof(Manifest));
+    return manifestValid(Manifest);
+}
+
+// ============================================================================
+bool slotReady() {
+    SlotManifest Manifest;
+    SlotReady Ready;
+    memcpy(&Ready, (const void *)SLOTREADYADDRESS, sizeof(Ready));
+    return slotManifest(Manifest) && Ready.Magic == SLOTREADYMAGIC &&
+           Ready.ManifestCrc == Manifest.ManifestCrc;
+}
+
+// ============================================================================
+int beginSlot(const SlotManifest &Manifest, const SlotSignature &Signature) {
+    if (!startFlash()) {
+        return -1;
+    }
+    int err = Flash.erase(SLOTTRAILER, SLOTSECTOR);
+    if (err == 0) {
+        err = Flash.program(&Manifest, SLOTTRAILER, sizeof(Manifest));
+    }
+    if (err == 0) {
+        err = Flash.program(&Signature, SLOTTRAILER + sizeof(Manifest),
+                            sizeof(Signature));
+    }
+    NextCheckpoint = 0;
+    return err;
+}
+
+// ============================================================================
+bool lastCheckpoint(SlotCheckpoint &At) {
+    // the checkpoints are programmed in order, the first one that was not
+    // ends them
+    bool Found = false;
+    NextCheckpoint = 0;
+    while (NextCheckpoint < SLOTCHECKPOINTS) {
+        SlotCheckpoint Next;
+        memcpy(&Next, (const void *)checkpointAddress(NextCheckpoint),
+               sizeof(Next));
+        if (Next.Magic != SLOTCHECKPOINTMAGIC) {
+            break;
+        }
+        // one that was cut off by a reset is skipped, the next one goes
+        // after it
+        ++NextCheckpoint;
+        if (Next.Crc == imageCrc((const uint8_t *)&Next,
+                                 offsetof(SlotCheckpoint, Crc))) {
+            At = Next;
+            Found = true;
+        }
+    }
+    return Found;
+}
+
+// ============================================================================
+int writeSlotSector(uint32_t At, const uint8_t *Data, size_t Length) {
+    if (!startFlash() || At % SLOTSECTOR != 0 || Length > SLOTSECTOR ||
+        At + SLOTSECTOR > SLOTIMAGEMAX) {
+        return -1;
+    }
+    const uint8_t *From = Data;
+    if (Length < SLOTSECTOR) {
+        memcpy(Sector, Data, Length);
+        memset(Sector + Length, 0xFF, SLOTSECTOR - Length);
+        From = Sector;
+    }
+    int err = Flash.erase(SLOTSTART + At, SLOTSECTOR);
+    if (err == 0) {
+        err = Flash.program(From, SLOTSTART + At, SLOTSECTOR);
+    }
+    if (err != 0) {
+        tr_warn("Sector %lu of the slot failed (%d)", (unsigned long)At, err);
+    }
+    return err;
+}
+
+// ============================================================================
+int keepCheckpoint(SlotCheckpoint &At) {
+    if (!startFlash() || NextCheckpoint >= SLOTCHECKPOINTS) {
+        return -1;
+    }
+    At.Magic = SLOTCHECKPOINTMAGIC;
+    At.Crc = imageCrc((const uint8_t *)&At, offsetof(SlotCheckpoint, Crc));
+    int err =
+        Flash.program(&At, checkpointAddress(NextCheckpoint), sizeof(At));
+    ++NextCheckpoint;
+    return err == 0 ? 0 : -1;
+}
+
+// ============================================================================
+bool finishSlot(const SlotManifest &Manifest) {
+    // the manifest may come from the trailer after a reset, its signature
+    // is checked again with the image
+    SlotSignature Signature;
+    memcpy(&Signature, (const void *)(SLOTTRAILER + sizeof(Manifest)),
+           sizeof(Signature));
+    if (!manifestSigned(Manifest, Signature)) {
+        tr_warn("The manifest of the new image is not signed");
+        return false;
+    }
+    const uint8_t *Image = (const uint8_t *)SLOTSTART;
+    if (imageCrc(Image, Manifest.Size) != Manifest.Crc) {
+        tr_warn("The new image does not match its CRC");
+        return false;
+    }
+    uint8_t Sha256[32];
+    if (mbedtls_sha256_ret(Image, Manifest.Size, Sha256, 0) != 0 ||
+        memcmp(Sha256, Manifest.Sha256, sizeof(Sha256)) != 0) {
+        tr_warn("The new image does not match its SHA-256");
+        return false;
+    }
+    SlotReady Ready = {SLOTREADYMAGIC, Manifest.ManifestCrc};
+    return startFlash() &&
+           Flash.program(&Ready, SLOTREADYADDRESS, sizeof(Ready)) == 0;
+}
+
+#endif // OTAUPDATE
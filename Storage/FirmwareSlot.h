@@ -0,0 +1,114 @@
+#ifndef FIRMWARESLOT_H
+#define FIRMWARESLOT_H
+/// \file
+/// \brief The update slot in the K64F's flash, where an over the air update
+/// is put together before the bootloader swaps it in.
+///
+/// The slot and its trailer are laid out in SlotLayout.h. The new image is
+/// programmed a sector at a time through FlashIAP, each one followed by a
+/// SlotCheckpoint, so a reset or a lost link only costs the sector that was
+/// not finished. Once the whole image is there and its CRC-32 and SHA-256
+/// match the manifest, and the manifest matches its signature, the
+/// SlotReady is programmed, and the bootloader copies the slot over the
+/// running firmware at the next reset. Only the uploader thread uses the
+/// slot, see FirmwareUpdate.h.
+///
+/// The CRCs and the SHA-256 only find a patch that went wrong, and the
+/// server hands it out over plain HTTP unless "tls" is set. What makes an
+/// update one of ours is the signature: Storage/make_delta.py signs the
+/// manifest with the private P-256 key of OTAPUBLICKEY, and a manifest
+/// whose signature does not check out is not taken, nor its image.
+
+#include "SlotLayout.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// Set to 1 for the board to take firmware updates from the server, see
+/// FirmwareUpdate.h. The board has to run on the bootloader of Bootloader/,
+/// set with "target.bootloader_img" in mbed_app.json. Set with "ota" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_OTA
+#define OTAUPDATE MBED_CONF_APP_OTA
+#else
+#define OTAUPDATE 0
+#endif
+
+/// The version of this firmware, the server offers an update with a higher
+/// one. Set with "firmware-version" in mbed_app.json.
+#ifdef MBED_CONF_APP_FIRMWARE_VERSION
+#define FIRMWAREVERSION MBED_CONF_APP_FIRMWARE_VERSION
+#else
+#define FIRMWAREVERSION (1)
+#endif
+
+/// The public key that the updates are signed with, the 65 bytes of an
+/// uncompressed P-256 point as {0x04, ...}. make_delta.py --show-key
+/// prints it for the private key. Set with "ota-public-key" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_OTA_PUBLIC_KEY
+#define OTAPUBLICKEY MBED_CONF_APP_OTA_PUBLIC_KEY
+#endif
+
+#if OTAUPDATE && !defined(OTAPUBLICKEY)
+#error "ota needs ota-public-key, the key that the updates are signed with"
+#endif
+
+#if OTAUPDATE && (!defined(MBED_APP_START) || MBED_APP_START != SLOTAPPSTART)
+#error "ota needs target.bootloader_img set to the bootloader of Bootloader/"
+#endif
+
+#if OTAUPDATE && defined(MBED_CONF_FLASHIAP_BLOCK_DEVICE_BASE_ADDRESS) &&    \
+    MBED_CONF_FLASHIAP_BLOCK_DEVICE_BASE_ADDRESS < SLOTSTOREADDRESS
+#error "ota needs flashiap-block-device.base-address after the update slot"
+#endif
+
+/// Returns the running image, which starts at SLOTAPPSTART
+const uint8_t *runningImage();
+
+/// Returns the CRC-32 of the Size bytes at Image
+uint32_t imageCrc(const uint8_t *Image, uint32_t Size);
+
+/// Returns true if Manifest has the right magic and CRC, and its images
+/// fit into the slot
+bool manifestValid(const SlotManifest &Manifest);
+
+/// Returns true if Signature is the signature of Manifest with the key of
+/// OTAPUBLICKEY
+bool manifestSigned(const SlotManifest &Manifest,
+                    const SlotSignature &Signature);
+
+/// Reads the manifest of the update in the slot
+/// \returns false if there is none, or it is not valid
+bool slotManifest(SlotManifest &Manifest);
+
+/// Returns true if the image in the slot is whole and checked, and waits
+/// for the bootloader
+bool slotReady();
+
+/// Erases the trailer and starts on the update of Manifest, which it keeps
+/// with its Signature
+/// \returns 0, or the error of FlashIAP
+int beginSlot(const SlotManifest &Manifest, const SlotSignature &Signature);
+
+/// Finds the last checkpoint of the update in the slot
+/// \returns false if it has none, it then starts from the first byte
+bool lastCheckpoint(SlotCheckpoint &At);
+
+/// Programs the Length bytes of Data as the sector of the new image at
+/// offset At, which is a multiple of SLOTSECTOR. A shorter last sector is
+/// filled up with 0xFF
+/// \returns 0, or the error of FlashIAP
+int writeSlotSector(uint32_t At, const uint8_t *Data, size_t Length);
+
+/// Keeps At after the last checkpoint, once its sector was written
+/// \returns 0, or -1 if the trailer is full or it could not be programmed
+int keepCheckpoint(SlotCheckpoint &At);
+
+/// Checks the Size bytes of the new image against the CRC-32 and SHA-256
+/// of Manifest, and Manifest against the signature in the trailer, and
+/// marks the slot ready for the bootloader if they match
+/// \returns true if the slot is ready
+bool finishSlot(const SlotManifest &Manifest);
+
+#endif // FIRMWARESLOT
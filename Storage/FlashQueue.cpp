@@ -0,0 +1,434 @@
+/// \file
+/// \brief Implementation of the flash queue
+#include "FlashQueue.h"
+
+#if FLASHQUEUE
+#include "CrashLog.h"
+#include "FlashIAPBlockDevice.h"
+#include "NumberFormat.h"
+#include "TDBStore.h"
+
+#include <cstddef>
+#include <cstdlib>
+
+/// the key that holds the cached configuration
+#define CONFIGKEY "config"
+
+/// the key that holds the cached access point
+#define WIFIKEY "wifi"
+
+/// the key that holds the pre-shared key of the DTLS uplink
+#define PSKKEY "psk"
+
+/// the key that holds the resolved server address
+#define DNSKEY "dns"
+
+/// the key that holds the calibration of the ADCs
+#define CALIBRATIONKEY "adccal"
+
+/// the key of the SD card clock
+#define CARDCLOCKKEY "cardclk"
+
+/// the key that holds the key of the backup log
+#define LOGKEYKEY "logkey"
+
+/// the key that holds the reservation of the sequence numbers
+#define SEQUENCEKEY "seq"
+
+/// the key that holds the energy totals of the ports
+#define ENERGYKEY "energy"
+
+/// "q", 8 hex digits and the '\0'
+#define QUEUEKEYLEN (10)
+
+static FlashIAPBlockDevice QueueBD;
+static TDBStore Store(&QueueBD);
+
+/// the sequence number of the oldest reading
+static uint32_t Head = 0;
+
+/// the sequence number the next reading gets
+static uint32_t Tail = 0;
+
+static bool Ready = false;
+
+// writes the key of sequence number Seq into Key
+static void queueKey(uint32_t Seq, char *Key) {
+    Key[0] = 'q';
+    formatHex(Key + 1, Seq, 8);
+}
+
+// removes the oldest reading, whether it was sent or not
+static void dropHead() {
+    char Key[QUEUEKEYLEN];
+    queueKey(Head, Key);
+    crashLogBegin(CrashFlashQueue, FlashQueueRemove);
+    Store.remove(Key);
+    crashLogEnd(CrashFlashQueue);
+    Head++;
+}
+
+// ============================================================================
+int initFlashQueue() {
+    printf("Starting the flash queue... ");
+    fflush(stdout);
+    int err = Store.init();
+    if (err) {
+        // a store that is not valid can only hold readings that were lost
+        err = Store.reset();
+    }
+    printf("%s\r\n", (err ? "Fail :(" : "OK"));
+    if (err) {
+        return err;
+    }
+
+    // the keys come back in no order, so look at all of them
+    KVStore::iterator_t it;
+    err = Store.iterator_open(&it, "q");
+    if (err) {
+        return err;
+    }
+    bool found = false;
+    char Key[QUEUEKEYLEN];
+    while (Store.iterator_next(it, Key, sizeof(Key)) == MBED_SUCCESS) {
+        uint32_t Seq = strtoul(Key + 1, NULL, 16);
+        if (!found || Seq < Head) {
+            Head = Seq;
+        }
+        if (!found || Seq >= Tail) {
+            Tail = Seq + 1;
+        }
+        found = true;
+    }
+    Store.iterator_close(it);
+
+    Ready = true;
+    if (found) {
+        printf("%lu readings are waiting in the flash queue\r\n",
+               (unsigned long)(Tail - Head));
+    }
+    return 0;
+}
+
+// ============================================================================
+bool pushFlashQueue(const SampleFrame &Frame) {
+    if (!Ready) {
+        return false;
+    }
+    if (Tail - Head >= FLASHQUEUELEN) {
+        printf("The flash queue is full, dropping its oldest reading\r\n");
+        dropHead();
+    }
+    char Key[QUEUEKEYLEN];
+    queueKey(Tail, Key);
+    crashLogBegin(CrashFlashQueue, FlashQueueSet);
+    int err = Store.set(Key, &Frame, sizeof(Frame), 0);
+    crashLogEnd(CrashFlashQueue, err);
+    if (err) {
+        printf("Failed to write %s to the flash queue (%d)\r\n", Key, err);
+        return false;
+    }
+    Tail++;
+    return true;
+}
+
+// ============================================================================
+bool peekFlashQueue(SampleFrame &Frame) {
+    while (Ready && Head != Tail) {
+        char Key[QUEUEKEYLEN];
+        queueKey(Head, Key);
+        size_t Size = 0;
+        crashLogBegin(CrashFlashQueue, FlashQueueGet);
+        int err = Store.get(Key, &Frame, sizeof(Frame), &Size);
+        crashLogEnd(CrashFlashQueue, err);
+        if (err == MBED_SUCCESS && Size == sizeof(Frame)) {
+            return true;
+        }
+        // queued by older firmware, before the frames had a sequence
+        if (err == MBED_SUCCESS &&
+            Size == offsetof(SampleFrame, Sequence)) {
+            Frame.Sequence = 0;
+            return true;
+        }
+        // queued by older firmware, before the frames had a kind
+        if (err == MBED_SUCCESS && Size == sizeof(SampleFrameV1)) {
+            SampleFrameV1 Old;
+            memcpy(&Old, &Frame, sizeof(Old));
+            Frame.load(Old);
+            return true;
+        }
+        // TDBStore checked its CRC, so this reading is gone
+        printf("Dropping %s from the flash queue (%d)\r\n", Key, err);
+        dropHead();
+    }
+    return false;
+}
+
+// ============================================================================
+void popFlashQueue() {
+    if (Ready && Head != Tail) {
+        dropHead();
+    }
+}
+
+// ============================================================================
+size_t flashQueueSize() { return Ready ? Tail - Head : 0; }
+
+// ============================================================================
+void stepFlashQueue() {
+    if (Ready) {
+        crashLogBegin(CrashFlashQueue, FlashQueueCollect);
+        Store.garbage_collection_step();
+        crashLogEnd(CrashFlashQueue);
+    }
+}
+
+// ============================================================================
+int saveConfigCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+
+    // only write when it changed, the flash wears out
+    uint8_t *Copy = new uint8_t[FLASHCONFIGMAX];
+    size_t CopySize = readConfigCache(Copy, FLASHCONFIGMAX);
+    int err = 0;
+    if (CopySize != Size || memcmp(Copy, Data, Size) != 0) {
+        err = Store.set(CONFIGKEY, Data, Size, 0);
+    }
+    delete[] Copy;
+    return err;
+}
+
+// ============================================================================
+size_t readConfigCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(CONFIGKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveWifiCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHWIFIMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(WIFIKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readWifiCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(WIFIKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int savePskCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHPSKMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(PSKKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readPskCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(PSKKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveDnsCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHDNSMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(DNSKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readDnsCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(DNSKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveCalibrationCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHCALIBRATIONMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(CALIBRATIONKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readCalibrationCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready ||
+        Store.get(CALIBRATIONKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveCardClockCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHCARDCLOCKMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(CARDCLOCKKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readCardClockCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready ||
+        Store.get(CARDCLOCKKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveLogKeyCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHLOGKEYMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(LOGKEYKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readLogKeyCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(LOGKEYKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveSequenceCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHSEQUENCEMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(SEQUENCEKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readSequenceCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready ||
+        Store.get(SEQUENCEKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+// ============================================================================
+int saveEnergyCache(const void *Data, size_t Size) {
+    if (!Ready) {
+        return MBED_ERROR_NOT_READY;
+    }
+    if (Size > FLASHENERGYMAX) {
+        return MBED_ERROR_INVALID_SIZE;
+    }
+    return Store.set(ENERGYKEY, Data, Size, 0);
+}
+
+// ============================================================================
+size_t readEnergyCache(void *Data, size_t Size) {
+    size_t Actual = 0;
+    if (!Ready || Store.get(ENERGYKEY, Data, Size, &Actual) != MBED_SUCCESS ||
+        Actual > Size) {
+        return 0;
+    }
+    return Actual;
+}
+
+#else
+// without the queue, readings that the SD card can not take are lost
+
+int initFlashQueue() { return 0; }
+
+bool pushFlashQueue(const SampleFrame &Frame) { return false; }
+
+bool peekFlashQueue(SampleFrame &Frame) { return false; }
+
+void popFlashQueue() {}
+
+size_t flashQueueSize() { return 0; }
+
+void stepFlashQueue() {}
+
+int saveConfigCache(const void *Data, size_t Size) { return 0; }
+
+size_t readConfigCache(void *Data, size_t Size) { return 0; }
+
+int saveWifiCache(const void *Data, size_t Size) { return 0; }
+
+size_t readWifiCache(void *Data, size_t Size) { return 0; }
+
+int savePskCache(const void *Data, size_t Size) { return 0; }
+
+size_t readPskCache(void *Data, size_t Size) { return 0; }
+
+int saveDnsCache(const void *Data, size_t Size) { return 0; }
+
+size_t readDnsCache(void *Data, size_t Size) { return 0; }
+
+int saveCalibrationCache(const void *Data, size_t Size) { return 0; }
+
+size_t readCalibrationCache(void *Data, size_t Size) { return 0; }
+
+int saveCardClockCache(const void *Data, size_t Size) { return 0; }
+
+size_t readCardClockCache(void *Data, size_t Size) { return 0; }
+
+int saveLogKeyCache(const void *Data, size_t Size) { return 0; }
+
+size_t readLogKeyCache(void *Data, size_t Size) { return 0; }
+
+int saveSequenceCache(const void *Data, size_t Size) { return 0; }
+
+size_t readSequenceCache(void *Data, size_t Size) { return 0; }
+
+int saveEnergyCache(const void *Data, size_t Size) { return 0; }
+
+size_t readEnergyCache(void *Data, size_t Size) { return 0; }
+#endif
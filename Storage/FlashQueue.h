@@ -0,0 +1,178 @@
+#ifndef FLASHQUEUE_H
+#define FLASHQUEUE_H
+/// \file
+/// \brief A small queue of readings in the K64F's internal flash, for when
+/// the SD card is missing or stops working.
+///
+/// The queue is a TDBStore on the "flashiap-block-device" region. Every
+/// reading is its own key, "q" and an 8 digit hex sequence number, so
+/// pushing and popping only appends a record, and the oldest key is found
+/// from the sequence numbers that are kept in RAM. The parsed config file
+/// is cached in the same store, so the board can still sample without the
+/// SD card, and an unchanged config file is not parsed again. So is the
+/// access point the ESP8266 joined last, for a faster join after a reboot,
+/// and the pre-shared key of the DTLS uplink and the key of the backup log,
+/// so they are never kept on the SD card. The reservation of the sequence
+/// numbers is kept here too, a set only appends a record where the file
+/// rewrites a sector.
+///
+/// TDBStore compacts an area by copying every live key to the other area.
+/// With "tdbstore.gc_step_records" set, this is done a few records at a time
+/// on every push and pop and from stepFlashQueue(), so no single write has
+/// to copy the whole queue. The queue holds at most FLASHQUEUELEN readings,
+/// and the RAM table is sized for them up front with
+/// "tdbstore.initial_max_keys" so it is not grown one key at a time. The
+/// keys are short enough for "tdbstore.key_prefix_size" to keep all of them
+/// in RAM, so finding one does not read the flash. Only the uploader thread
+/// uses the queue, so the sampling loop never waits for it.
+
+#include "BackupStore.h"
+#include "Structs.h"
+
+/// Set to 1 to queue readings in the internal flash when the SD card can not
+/// take them. Set with "flash-queue" in mbed_app.json.
+#ifdef MBED_CONF_APP_FLASH_QUEUE
+#define FLASHQUEUE MBED_CONF_APP_FLASH_QUEUE
+#else
+#define FLASHQUEUE 0
+#endif
+
+#if FLASHQUEUE && BACKUPINFLASH
+#error "flash-queue and backup-store 1 or 3 both use the flashiap-block-device region"
+#endif
+
+/// The most readings in the queue, the oldest is dropped to make room
+#define FLASHQUEUELEN (512)
+
+/// The largest cached configuration
+#define FLASHCONFIGMAX (4096)
+
+/// The largest cached access point
+#define FLASHWIFIMAX (128)
+
+/// The largest cached pre-shared key, with its identity
+#define FLASHPSKMAX (96)
+
+/// The largest cached server address, with its name
+#define FLASHDNSMAX (128)
+
+/// The largest cached calibration of the ADCs
+#define FLASHCALIBRATIONMAX (96)
+
+/// The largest cached SD card clock, with the card it is for
+#define FLASHCARDCLOCKMAX (32)
+
+/// The largest cached key of the backup log
+#define FLASHLOGKEYMAX (32)
+
+/// The largest cached reservation of sequence numbers
+#define FLASHSEQUENCEMAX (16)
+
+/// The largest cached energy totals of the ports
+#define FLASHENERGYMAX (272)
+
+/// Sets up the store, formatting it if it is not valid, and finds the
+/// oldest and newest readings in it.
+/// \returns 0 on success, or a negative error code
+int initFlashQueue();
+
+/// Adds Frame to the end of the queue. The oldest reading is dropped if
+/// FLASHQUEUELEN readings are waiting.
+/// \returns false if it could not be written
+bool pushFlashQueue(const SampleFrame &Frame);
+
+/// Reads the oldest reading in the queue into Frame, without removing it.
+/// Readings that can not be read are dropped.
+/// \returns false if the queue is empty
+bool peekFlashQueue(SampleFrame &Frame);
+
+/// Removes the oldest reading, once it was sent
+void popFlashQueue();
+
+/// Returns how many readings are waiting in the queue
+size_t flashQueueSize();
+
+/// Moves the store's garbage collection along by a few records, for when
+/// the uploader has nothing else to do
+void stepFlashQueue();
+
+/// Keeps Size bytes of Data as the cached configuration, unless the same
+/// bytes are there already.
+/// \returns 0 on success, or a negative error code
+int saveConfigCache(const void *Data, size_t Size);
+
+/// Reads the cached configuration into Data
+/// \param Size The size of Data, FLASHCONFIGMAX fits any configuration
+/// \returns the size of the configuration, or 0 if there is none
+size_t readConfigCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHWIFIMAX, as the cached access point
+/// \returns 0 on success, or a negative error code
+int saveWifiCache(const void *Data, size_t Size);
+
+/// Reads the cached access point into Data
+/// \returns the size of the access point, or 0 if there is none
+size_t readWifiCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHPSKMAX, as the pre-shared key
+/// \returns 0 on success, or a negative error code
+int savePskCache(const void *Data, size_t Size);
+
+/// Reads the pre-shared key into Data
+/// \returns the size of the key, or 0 if there is none
+size_t readPskCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHDNSMAX, as the resolved server
+/// address
+/// \returns 0 on success, or a negative error code
+int saveDnsCache(const void *Data, size_t Size);
+
+/// Reads the resolved server address into Data
+/// \returns the size of the address, or 0 if there is none
+size_t readDnsCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHCALIBRATIONMAX, as the calibration
+/// of the ADCs
+/// \returns 0 on success, or a negative error code
+int saveCalibrationCache(const void *Data, size_t Size);
+
+/// Reads the calibration of the ADCs into Data
+/// \returns the size of the calibration, or 0 if there is none
+size_t readCalibrationCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHCARDCLOCKMAX, as the SD card clock
+/// \returns 0 on success, or a negative error code
+int saveCardClockCache(const void *Data, size_t Size);
+
+/// Reads the SD card clock into Data
+/// \returns the size of the clock, or 0 if there is none
+size_t readCardClockCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHLOGKEYMAX, as the key of the backup
+/// log, see LogCipher.h
+/// \returns 0 on success, or a negative error code
+int saveLogKeyCache(const void *Data, size_t Size);
+
+/// Reads the key of the backup log into Data
+/// \returns the size of the key, or 0 if there is none
+size_t readLogKeyCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHSEQUENCEMAX, as the reservation of
+/// the sequence numbers, see Sequence.h
+/// \returns 0 on success, or a negative error code
+int saveSequenceCache(const void *Data, size_t Size);
+
+/// Reads the reservation of the sequence numbers into Data
+/// \returns the size of the reservation, or 0 if there is none
+size_t readSequenceCache(void *Data, size_t Size);
+
+/// Keeps Size bytes of Data, up to FLASHENERGYMAX, as the energy totals of
+/// the ports, see EnergyIntegrator.h
+/// \returns 0 on success, or a negative error code
+int saveEnergyCache(const void *Data, size_t Size);
+
+/// Reads the energy totals of the ports into Data
+/// \returns the size of the totals, or 0 if there are none
+size_t readEnergyCache(void *Data, size_t Size);
+
+#endif // FLASHQUEUE
@@ -0,0 +1,240 @@
+/// \file
+/// \brief Implementation of the staged flash block device
+#include "FlashStageBlockDevice.h"
+
+#if FLASHSTAGE
+#include <algorithm>
+
+FlashStageBlockDevice::FlashStageBlockDevice(BlockDevice *device)
+    : Device(device), Stage(NULL), StageAddr(0), StageSize(0), SectorSize(0),
+      Sectors(0), Erased(NULL), Trimmed(NULL), NextSector(0),
+      Initialized(false) {}
+
+FlashStageBlockDevice::~FlashStageBlockDevice() { deinit(); }
+
+// ============================================================================
+int FlashStageBlockDevice::init() {
+    Lock.lock();
+    if (Initialized) {
+        Lock.unlock();
+        return BD_ERROR_OK;
+    }
+    int err = Device->init();
+    if (!err) {
+        SectorSize = Device->get_erase_size();
+        Sectors = Device->size() / SectorSize;
+        size_t Words = (Sectors + 31) / 32;
+        Stage = new uint8_t[SectorSize];
+        Erased = new uint32_t[Words]();
+        Trimmed = new uint32_t[Words]();
+        StageSize = 0;
+        NextSector = 0;
+        Initialized = true;
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::deinit() {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return BD_ERROR_OK;
+    }
+    int err = flush();
+    delete[] Stage;
+    delete[] Erased;
+    delete[] Trimmed;
+    Stage = NULL;
+    Erased = NULL;
+    Trimmed = NULL;
+    Initialized = false;
+    int stopped = Device->deinit();
+    Lock.unlock();
+    return err ? err : stopped;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::sync() {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    int err = flush();
+    if (!err) {
+        err = Device->sync();
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::read(void *buffer, bd_addr_t addr, bd_size_t size) {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    int err = Device->read(buffer, addr, size);
+
+    // the flash under the staged bytes is still erased
+    bd_addr_t StageEnd = StageAddr + StageSize;
+    if (!err && StageSize > 0 && addr < StageEnd && StageAddr < addr + size) {
+        bd_addr_t From = std::max(addr, StageAddr);
+        bd_addr_t To = std::min(addr + size, StageEnd);
+        memcpy(static_cast<uint8_t *>(buffer) + (From - addr),
+               Stage + (From - StageAddr), To - From);
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::program(const void *buffer, bd_addr_t addr,
+                                   bd_size_t size) {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    if (!is_valid_program(addr, size)) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_PARAMETER;
+    }
+
+    const uint8_t *in = static_cast<const uint8_t *>(buffer);
+    int err = BD_ERROR_OK;
+    while (size > 0 && !err) {
+        size_t Sector = addr / SectorSize;
+        bd_size_t Room = (Sector + 1) * SectorSize - addr;
+        bd_size_t Chunk = size < Room ? size : Room;
+
+        // a full stage was already programmed, so one that this follows is
+        // in the same sector
+        if (StageSize > 0 && addr != StageAddr + StageSize) {
+            err = flush();
+            if (err) {
+                break;
+            }
+        }
+        if (StageSize == 0) {
+            StageAddr = addr;
+        }
+        memcpy(Stage + StageSize, in, Chunk);
+        StageSize += Chunk;
+        mark(Erased, Sector, false);
+        mark(Trimmed, Sector, false);
+        NextSector = (Sector + 1) % Sectors;
+
+        if ((StageAddr + StageSize) % SectorSize == 0) {
+            err = flush();
+        }
+        addr += Chunk;
+        in += Chunk;
+        size -= Chunk;
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::erase(bd_addr_t addr, bd_size_t size) {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    if (!is_valid_erase(addr, size)) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_PARAMETER;
+    }
+
+    // what is staged there is erased with it
+    if (StageSize > 0 && addr < StageAddr + StageSize &&
+        StageAddr < addr + size) {
+        StageSize = 0;
+    }
+    int err = BD_ERROR_OK;
+    size_t End = (addr + size) / SectorSize;
+    for (size_t i = addr / SectorSize; i < End && !err; ++i) {
+        if (!isErased(i)) {
+            err = eraseSector(i);
+        }
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::trim(bd_addr_t addr, bd_size_t size) {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    if (addr + size > Device->size()) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_PARAMETER;
+    }
+
+    int err = BD_ERROR_OK;
+    if (StageSize > 0 && addr < StageAddr + StageSize &&
+        StageAddr < addr + size) {
+        err = flush();
+    }
+
+    // only the sectors that are free as a whole can be erased
+    size_t End = (addr + size) / SectorSize;
+    for (size_t i = (addr + SectorSize - 1) / SectorSize; i < End; ++i) {
+        if (!isErased(i)) {
+            mark(Trimmed, i, true);
+        }
+    }
+    if (!err) {
+        err = Device->trim(addr, size);
+    }
+    Lock.unlock();
+    return err;
+}
+
+// ============================================================================
+int FlashStageBlockDevice::step() {
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return FLASHSTAGE_ERROR_NO_INIT;
+    }
+    int err = BD_ERROR_OK;
+    for (size_t k = 0; k < Sectors; ++k) {
+        size_t i = (NextSector + k) % Sectors;
+        if (isTrimmed(i)) {
+            // a sector that does not erase is left to the filesystem
+            err = eraseSector(i);
+            break;
+        }
+    }
+    Lock.unlock();
+    return err;
+}
+
+int FlashStageBlockDevice::flush() {
+    if (StageSize == 0) {
+        return BD_ERROR_OK;
+    }
+    int err = Device->program(Stage, StageAddr, StageSize);
+    StageSize = 0;
+    return err;
+}
+
+int FlashStageBlockDevice::eraseSector(size_t i) {
+    int err = Device->erase(i * SectorSize, SectorSize);
+    mark(Trimmed, i, false);
+    if (!err) {
+        mark(Erased, i, true);
+    }
+    return err;
+}
+
+#endif // FLASHSTAGE
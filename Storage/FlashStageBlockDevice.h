@@ -0,0 +1,135 @@
+#ifndef FLASHSTAGEBLOCKDEVICE_H
+#define FLASHSTAGEBLOCKDEVICE_H
+/// \file
+/// \brief BlockDevice that collects the programs to the internal flash in
+/// RAM, a sector at a time, and erases the free sectors ahead of time.
+///
+/// The K64F programs its flash in 8 byte phrases and erases it in 4 KB
+/// sectors. FlashIAPBlockDevice hands every program to the flash on its
+/// own, and LittleFS erases a block right before it writes it, so an
+/// append of the backup log waits for the erase of the next block. This
+/// device keeps the programs that follow each other in one sector in a
+/// sector sized buffer, and programs them as one burst when the next one
+/// goes elsewhere, the sector is full, or on sync(). LittleFS syncs after
+/// every commit, so nothing it relies on is only in RAM.
+///
+/// The sectors that the filesystem trims are free, and step() erases one
+/// of them at a time from the main loop's idle time, the one after the
+/// sector that was written last first, since the allocator goes through
+/// the blocks in order. The erase that LittleFS asks for later finds the
+/// sector erased and returns at once. Which sectors are erased is only
+/// kept in RAM, so after a reset every sector is erased again when asked.
+/// Set with "flash-stage" in mbed_app.json.
+
+#include "mbed.h"
+
+#include "BlockDevice.h"
+
+/// Set to 1 to put the backup log in the internal flash on a
+/// FlashStageBlockDevice. Set with "flash-stage" in mbed_app.json.
+#ifdef MBED_CONF_APP_FLASH_STAGE
+#define FLASHSTAGE MBED_CONF_APP_FLASH_STAGE
+#else
+#define FLASHSTAGE 0
+#endif
+
+/// Error codes
+#define FLASHSTAGE_ERROR_NO_INIT (-5201)
+#define FLASHSTAGE_ERROR_PARAMETER (-5202)
+
+/// Stages the programs to Device, which has sectors of one size
+class FlashStageBlockDevice : public BlockDevice,
+                              private NonCopyable<FlashStageBlockDevice> {
+  public:
+    /// \param device The flash, which has to outlive this device
+    FlashStageBlockDevice(BlockDevice *device);
+    virtual ~FlashStageBlockDevice();
+
+    /// Starts Device, and takes the RAM for one of its sectors
+    virtual int init();
+
+    /// Programs what is staged, and stops Device
+    virtual int deinit();
+
+    /// Programs what is staged
+    virtual int sync();
+
+    /// Reads the flash, with what is staged in place of it
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+
+    /// Stages the program, a program that does not follow the staged ones
+    /// programs them first
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+
+    /// Erases the sectors that are not erased yet
+    virtual int erase(bd_addr_t addr, bd_size_t size);
+
+    /// Marks the whole sectors in the range as free, step() erases them
+    virtual int trim(bd_addr_t addr, bd_size_t size);
+
+    /// Erases one of the free sectors, if there is one
+    /// \returns 0 on success, or the error of the erase
+    int step();
+
+    virtual bd_size_t get_read_size() const {
+        return Device->get_read_size();
+    }
+    virtual bd_size_t get_program_size() const {
+        return Device->get_program_size();
+    }
+    virtual bd_size_t get_erase_size() const {
+        return Device->get_erase_size();
+    }
+    virtual bd_size_t get_erase_size(bd_addr_t addr) const {
+        return Device->get_erase_size(addr);
+    }
+    virtual int get_erase_value() const { return Device->get_erase_value(); }
+    virtual bd_size_t size() const { return Device->size(); }
+    virtual const char *get_type() const { return Device->get_type(); }
+
+  private:
+    /// programs what is staged, and empties the stage
+    int flush();
+
+    /// erases sector i and marks it as erased
+    int eraseSector(size_t i);
+
+    bool isErased(size_t i) const {
+        return (Erased[i / 32] >> (i % 32)) & 1;
+    }
+    bool isTrimmed(size_t i) const {
+        return (Trimmed[i / 32] >> (i % 32)) & 1;
+    }
+    void mark(uint32_t *Bits, size_t i, bool set) {
+        if (set) {
+            Bits[i / 32] |= 1U << (i % 32);
+        } else {
+            Bits[i / 32] &= ~(1U << (i % 32));
+        }
+    }
+
+    BlockDevice *Device;
+
+    /// the staged bytes, which go to StageAddr and on
+    uint8_t *Stage;
+    bd_addr_t StageAddr;
+    bd_size_t StageSize;
+
+    /// the size of a sector of Device, and how many it has
+    bd_size_t SectorSize;
+    size_t Sectors;
+
+    /// one bit per sector, erased and not programmed since, or trimmed and
+    /// not erased since
+    uint32_t *Erased;
+    uint32_t *Trimmed;
+
+    /// the sector after the one that was programmed last, step() looks for
+    /// a free one from there
+    size_t NextSector;
+
+    PlatformMutex Lock;
+    bool Initialized;
+};
+
+#endif // FLASHSTAGEBLOCKDEVICE
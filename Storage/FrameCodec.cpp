@@ -0,0 +1,176 @@
+/// \file
+/// \brief Implementation of the frame codec
+#include "FrameCodec.h"
+
+#include <cstring>
+
+/// The flags byte bits for the masks that follow
+#define CODECPORTMASK (1U << 0)
+#define CODECOVERMASK (1U << 1)
+#define CODECUNDERMASK (1U << 2)
+
+/// The flags byte bit for the kind and count that follow
+#define CODECKIND (1U << 3)
+
+/// The flags byte bit for the sequence number that follows
+#define CODECSEQUENCE (1U << 4)
+
+// the sequence number that a frame after Last has if it has no CODECSEQUENCE,
+// frames without numbers stay without them
+static uint32_t followingSequence(const SampleFrame &Last) {
+    return Last.Sequence != 0 ? Last.Sequence + 1 : 0;
+}
+
+// ============================================================================
+size_t putVarint(uint8_t *Out, uint32_t Value) {
+    size_t Length = 0;
+    while (Value >= 0x80) {
+        Out[Length++] = (uint8_t)(Value | 0x80);
+        Value >>= 7;
+    }
+    Out[Length++] = (uint8_t)Value;
+    return Length;
+}
+
+// reads a varint at In[Pos] and moves Pos past it
+// returns false if In ends first or it has more than 32 bits
+static bool getVarint(const uint8_t *In, size_t Length, size_t &Pos,
+                      uint32_t &Value) {
+    Value = 0;
+    for (unsigned Shift = 0; Shift < 35; Shift += 7) {
+        if (Pos == Length) {
+            return false;
+        }
+        uint8_t Byte = In[Pos++];
+        Value |= (uint32_t)(Byte & 0x7F) << Shift;
+        if ((Byte & 0x80) == 0) {
+            return Shift < 28 || Byte <= 0x0F;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+uint32_t zigzag(int32_t Value) {
+    return ((uint32_t)Value << 1) ^ (uint32_t)(Value >> 31);
+}
+
+static int32_t unzigzag(uint32_t Value) {
+    return (int32_t)(Value >> 1) ^ -(int32_t)(Value & 1);
+}
+
+// ============================================================================
+void FrameCodec::reset() { memset(&Last, 0, sizeof(Last)); }
+
+// ============================================================================
+size_t FrameCodec::encode(const SampleFrame &Frame, uint8_t *Out) {
+    uint8_t Flags = 0;
+    Flags |= Frame.PortMask != Last.PortMask ? CODECPORTMASK : 0;
+    Flags |= Frame.OverMask != Last.OverMask ? CODECOVERMASK : 0;
+    Flags |= Frame.UnderMask != Last.UnderMask ? CODECUNDERMASK : 0;
+    Flags |= Frame.Kind != Last.Kind || Frame.Count != Last.Count ? CODECKIND
+                                                                  : 0;
+    Flags |= Frame.Sequence != followingSequence(Last) ? CODECSEQUENCE : 0;
+
+    size_t Length = 0;
+    Out[Length++] = Flags;
+    Length += putVarint(Out + Length,
+                        zigzag((int32_t)(Frame.Timestamp - Last.Timestamp)));
+    if (Flags & CODECPORTMASK) {
+        Length += putVarint(Out + Length, Frame.PortMask);
+    }
+    if (Flags & CODECOVERMASK) {
+        Length += putVarint(Out + Length, Frame.OverMask);
+    }
+    if (Flags & CODECUNDERMASK) {
+        Length += putVarint(Out + Length, Frame.UnderMask);
+    }
+    if (Flags & CODECKIND) {
+        Length += putVarint(Out + Length, Frame.Kind);
+        Length += putVarint(Out + Length, Frame.Count);
+    }
+    if (Flags & CODECSEQUENCE) {
+        Length += putVarint(Out + Length,
+                            zigzag((int32_t)(Frame.Sequence -
+                                             followingSequence(Last))));
+    }
+    Last.Timestamp = Frame.Timestamp;
+    Last.PortMask = Frame.PortMask;
+    Last.OverMask = Frame.OverMask;
+    Last.UnderMask = Frame.UnderMask;
+    Last.Kind = Frame.Kind;
+    Last.Count = Frame.Count;
+    Last.Sequence = Frame.Sequence;
+
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (Frame.hasPort(i)) {
+            Length += putVarint(Out + Length,
+                                zigzag((int32_t)Frame.Raw[i] - Last.Raw[i]));
+            Last.Raw[i] = Frame.Raw[i];
+        }
+    }
+    return Length;
+}
+
+// ============================================================================
+size_t FrameCodec::decode(const uint8_t *In, size_t Length,
+                          SampleFrame &Frame) {
+    if (Length == 0 ||
+        (In[0] & ~(CODECPORTMASK | CODECOVERMASK | CODECUNDERMASK |
+                   CODECKIND | CODECSEQUENCE)) != 0) {
+        return 0;
+    }
+    uint8_t Flags = In[0];
+    size_t Pos = 1;
+
+    // the state only changes once the whole frame was read
+    SampleFrame Next = Last;
+    uint32_t Value;
+    if (!getVarint(In, Length, Pos, Value)) {
+        return 0;
+    }
+    Next.Timestamp += (uint32_t)unzigzag(Value);
+
+    uint16_t *Masks[] = {&Next.PortMask, &Next.OverMask, &Next.UnderMask};
+    for (size_t m = 0; m < 3; ++m) {
+        if (Flags & (1U << m)) {
+            if (!getVarint(In, Length, Pos, Value) || Value > 0xFFFF) {
+                return 0;
+            }
+            *Masks[m] = (uint16_t)Value;
+        }
+    }
+    if (Flags & CODECKIND) {
+        uint32_t Count;
+        if (!getVarint(In, Length, Pos, Value) || Value >= FRAMEKINDS ||
+            !getVarint(In, Length, Pos, Count) || Count > 0xFFFF) {
+            return 0;
+        }
+        Next.Kind = (uint8_t)Value;
+        Next.Count = (uint16_t)Count;
+    }
+    Next.Sequence = followingSequence(Last);
+    if (Flags & CODECSEQUENCE) {
+        if (!getVarint(In, Length, Pos, Value)) {
+            return 0;
+        }
+        Next.Sequence += (uint32_t)unzigzag(Value);
+    }
+
+    for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+        if (Next.hasPort(i)) {
+            if (!getVarint(In, Length, Pos, Value)) {
+                return 0;
+            }
+            int32_t Raw = Next.Raw[i] + unzigzag(Value);
+            if (Raw < 0 || Raw > 0xFFFF) {
+                return 0;
+            }
+            Next.Raw[i] = (uint16_t)Raw;
+        }
+    }
+
+    Last = Next;
+    Frame = Next;
+    return Pos;
+}
@@ -0,0 +1,73 @@
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+/// \file
+/// \brief Packs a stream of sample frames into a few bytes each.
+///
+/// The readings of a port change slowly, so every frame is stored as the
+/// difference to the frame before it. The timestamp and every reading in the
+/// port mask are written as a zig-zag varint of the difference, so a change
+/// of up to +-63 takes one byte. The masks are only written when they change.
+/// A frame of 16 ports takes about 18 bytes instead of the 48 of a
+/// SampleFrame.
+///
+/// Each frame is:
+///  - a flags byte, bit 0 to 2 are set if the port, over range and under
+///    range mask follow, bit 3 if the kind and count do, bit 4 if the
+///    sequence number does
+///  - the zig-zag varint of the timestamp minus the one before
+///  - the changed masks, as varints, in that order
+///  - the kind and the count as varints, if either changed
+///  - the zig-zag varint of the sequence number minus the one after the
+///    last, if it is not that one. A frame without a number, 0, is followed
+///    by frames without numbers, so streams from before the numbers decode
+///    the same
+///  - the zig-zag varint of Raw[i] minus the last Raw[i] of the stream, for
+///    every port i in the port mask
+///
+/// The first frame of a stream is taken against an all zero frame. The
+/// backup log starts a stream with every block, see OfflineLogging.h, and
+/// the CBOR body with every request, see Networking.cpp.
+
+#include "Structs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// The most bytes one frame can take
+#define FRAMECODEDMAX (1 + 5 + 3 * 3 + 1 + 3 + 5 + FRAMEMAXPORTS * 3)
+
+/// Writes Value to Out 7 bits at a time, the low ones first, with the top
+/// bit set on every byte but the last. Out needs room for 5 bytes
+/// \returns the number of bytes written
+size_t putVarint(uint8_t *Out, uint32_t Value);
+
+/// Maps 0, -1, 1, -2 ... to 0, 1, 2, 3 ... so small changes either way
+/// stay small varints
+uint32_t zigzag(int32_t Value);
+
+/// Remembers the last frame of a stream, which the next one is taken
+/// against. The encoder and the decoder keep the same state, so they have
+/// to see the same frames in the same order.
+class FrameCodec {
+  public:
+    FrameCodec() { reset(); }
+
+    /// Starts a new stream
+    void reset();
+
+    /// Writes Frame to Out, which has room for FRAMECODEDMAX bytes
+    /// \returns the number of bytes written
+    size_t encode(const SampleFrame &Frame, uint8_t *Out);
+
+    /// Reads the frame at the start of In into Frame
+    /// \returns the number of bytes it took, or 0 if In ends before the frame
+    /// does or the frame can not be right
+    size_t decode(const uint8_t *In, size_t Length, SampleFrame &Frame);
+
+  private:
+    /// the last frame, with the last reading of every port even if it was
+    /// not in that frame's mask
+    SampleFrame Last;
+};
+
+#endif // FRAMECODEC
@@ -0,0 +1,115 @@
+/// \file
+/// \brief Implementation of the encryption of the backup log
+#define TRACE_GROUP "bkup"
+#include "LogCipher.h"
+
+#if LOGENCRYPT
+
+#include "DeferredLog.h"
+#include "FlashQueue.h"
+#include "hal/trng_api.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/platform_util.h"
+
+#include <cstring>
+
+#if !FLASHQUEUE
+#error "backlog-encrypt needs flash-queue set to 1 for its key"
+#endif
+
+#if !DEVICE_TRNG
+#error "backlog-encrypt needs the TRNG to make its key and nonces"
+#endif
+
+/// The counter block of the check value, the offsets never get this high
+#define KEYCHECKCOUNTER (0xFFFFFFFFUL)
+
+/// the key schedule, set up once. mbed TLS uses the AES hardware of a
+/// target that has it
+static mbedtls_aes_context Aes;
+static bool Ready = false;
+
+// fills Data with Size bytes of the TRNG
+// returns false if it gave fewer
+static bool randomBytes(uint8_t *Data, size_t Size) {
+    trng_t Trng;
+    size_t Got = 0;
+    trng_init(&Trng);
+    bool Filled = trng_get_bytes(&Trng, Data, Size, &Got) == 0 && Got == Size;
+    trng_free(&Trng);
+    return Filled;
+}
+
+// makes the counter block of Nonce, Block and Last, and encrypts it into
+// Stream
+static void keyStream(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t Block,
+                      uint32_t Last, uint8_t (&Stream)[16]) {
+    uint8_t Counter[16];
+    memcpy(Counter, Nonce, LOGNONCESIZE);
+    for (int i = 0; i < 4; ++i) {
+        Counter[LOGNONCESIZE + i] = Block >> (24 - 8 * i);
+        Counter[LOGNONCESIZE + 4 + i] = Last >> (24 - 8 * i);
+    }
+    mbedtls_aes_crypt_ecb(&Aes, MBEDTLS_AES_ENCRYPT, Counter, Stream);
+}
+
+// ============================================================================
+bool logCipherReady() {
+    if (Ready) {
+        return true;
+    }
+    uint8_t Key[LOGKEYSIZE];
+    if (readLogKeyCache(Key, sizeof(Key)) != sizeof(Key)) {
+        // data encrypted with a key that is only in RAM is lost on a reset
+        if (!randomBytes(Key, sizeof(Key)) ||
+            saveLogKeyCache(Key, sizeof(Key)) != 0) {
+            tr_error("Could not keep a key for the backup log");
+            mbedtls_platform_zeroize(Key, sizeof(Key));
+            return false;
+        }
+        tr_info("Made a new key for the backup log");
+    }
+    mbedtls_aes_init(&Aes);
+    Ready = mbedtls_aes_setkey_enc(&Aes, Key, 8 * sizeof(Key)) == 0;
+    mbedtls_platform_zeroize(Key, sizeof(Key));
+    return Ready;
+}
+
+// ============================================================================
+void newLogNonce(uint8_t (&Nonce)[LOGNONCESIZE], uint32_t &KeyCheck) {
+    if (!randomBytes(Nonce, LOGNONCESIZE)) {
+        // the nonce only has to differ from every other one, not be secret
+        uint64_t Now = Kernel::get_ms_count() ^ ((uint64_t)time(NULL) << 32);
+        memcpy(Nonce, &Now, LOGNONCESIZE);
+    }
+    uint8_t Stream[16];
+    keyStream(Nonce, KEYCHECKCOUNTER, KEYCHECKCOUNTER, Stream);
+    memcpy(&KeyCheck, Stream, sizeof(KeyCheck));
+}
+
+// ============================================================================
+bool logKeyMatches(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t KeyCheck) {
+    uint8_t Stream[16];
+    keyStream(Nonce, KEYCHECKCOUNTER, KEYCHECKCOUNTER, Stream);
+    return memcmp(&KeyCheck, Stream, sizeof(KeyCheck)) == 0;
+}
+
+// ============================================================================
+void cryptLog(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t Offset,
+              uint8_t *Data, size_t Size) {
+    uint8_t Stream[16];
+    size_t Skip = Offset % sizeof(Stream);
+    uint32_t Block = Offset / sizeof(Stream);
+    while (Size > 0) {
+        keyStream(Nonce, Block++, 0, Stream);
+        size_t Piece = sizeof(Stream) - Skip < Size ? sizeof(Stream) - Skip
+                                                    : Size;
+        for (size_t i = 0; i < Piece; ++i) {
+            *Data++ ^= Stream[Skip + i];
+        }
+        Size -= Piece;
+        Skip = 0;
+    }
+}
+
+#endif // LOGENCRYPT
@@ -0,0 +1,76 @@
+#ifndef LOGCIPHER_H
+#define LOGCIPHER_H
+/// \file
+/// \brief Encrypts the blocks of the backup log, so the readings on a
+/// removable SD card can not be read off it.
+///
+/// Every block is encrypted once, when it is written, with AES-128 in
+/// counter mode. The counter block is the segment's nonce, then the byte
+/// offset of the 16 bytes in the segment divided by 16, big endian, then
+/// four zero bytes. The heads of the blocks and their CRC32s stay as they
+/// are, with the CRC32 taken over the encrypted bytes, so damaged and torn
+/// blocks are still found and skipped without the key. A segment gets a new
+/// random nonce whenever it is written from the start, a compacted one as
+/// well, so no two blocks use the same counters. The headers, the port
+/// names, index.dat and index.jnl are not encrypted.
+///
+/// The key is made from the TRNG the first time and kept in the flash
+/// store, see FlashQueue.h, never on the SD card. A segment holds a check
+/// value of the key it was written with, so a segment from another key, or
+/// another board, is not read as garbage. The records cost one AES block
+/// per 16 bytes, the stage is written a sector at a time either way. Set
+/// with "backlog-encrypt" in mbed_app.json.
+
+#include <cstddef>
+#include <cstdint>
+
+/// Set to 1 to encrypt the blocks of the backup log. Needs FLASHQUEUE for
+/// the key. Set with "backlog-encrypt" in mbed_app.json.
+#ifdef MBED_CONF_APP_BACKLOG_ENCRYPT
+#define LOGENCRYPT MBED_CONF_APP_BACKLOG_ENCRYPT
+#else
+#define LOGENCRYPT 0
+#endif
+
+/// The bytes of the nonce of a segment
+#define LOGNONCESIZE (8)
+
+/// The bytes of the key
+#define LOGKEYSIZE (16)
+
+#if LOGENCRYPT
+
+/// Loads the key from the flash store, or makes one and keeps it there.
+/// \returns false if there is no key that the board will still have after
+/// a reset, nothing is encrypted or decrypted then
+bool logCipherReady();
+
+/// Fills Nonce with random bytes for a segment that is written from the
+/// start, and KeyCheck with the check value of the key for it
+void newLogNonce(uint8_t (&Nonce)[LOGNONCESIZE], uint32_t &KeyCheck);
+
+/// Returns true if KeyCheck is the check value of the key for Nonce
+bool logKeyMatches(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t KeyCheck);
+
+/// Encrypts or decrypts the Size bytes of Data in place, which are at byte
+/// Offset of the segment with Nonce
+void cryptLog(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t Offset,
+              uint8_t *Data, size_t Size);
+
+#else
+
+inline bool logCipherReady() { return false; }
+
+inline void newLogNonce(uint8_t (&Nonce)[LOGNONCESIZE], uint32_t &KeyCheck) {}
+
+inline bool logKeyMatches(const uint8_t (&Nonce)[LOGNONCESIZE],
+                          uint32_t KeyCheck) {
+    return false;
+}
+
+inline void cryptLog(const uint8_t (&Nonce)[LOGNONCESIZE], uint32_t Offset,
+                     uint8_t *Data, size_t Size) {}
+
+#endif // LOGENCRYPT
+
+#endif // LOGCIPHER
@@ -0,0 +1,147 @@
+/// \file
+/// \brief Implementation of the ring of readings that survives a reset
+#define TRACE_GROUP "bkup"
+#include "RetainedFrames.h"
+
+#if RETAINEDFRAMES
+
+#include "DeferredLog.h"
+#include "MbedCRC.h"
+#include "ResetReason.h"
+
+/// Marks the ring as written by this firmware, anything else in the RAM is
+/// what was there at power on
+#define RETAINEDMAGIC (0x52544E46u)
+
+/// One reading in the ring
+struct RetainedSlot {
+    SampleFrame Frame;
+
+    /// CRC32 of Frame, its complement if the reading was dropped
+    uint32_t CRC;
+};
+
+/// Everything that has to survive the reset. The counts only go up, the
+/// reading Number is in Slots[Number % RETAINEDFRAMES]. Each count is
+/// followed by its complement, so it is not taken after power on
+struct RetainedRing {
+    uint32_t Magic;
+
+    /// the readings that were retained
+    volatile uint32_t Taken;
+    volatile uint32_t NotTaken;
+
+    /// the readings in front of this one are kept elsewhere
+    volatile uint32_t Done;
+    volatile uint32_t NotDone;
+
+    RetainedSlot Slots[RETAINEDFRAMES];
+};
+
+/// The startup code only sets .data and clears .bss, so this keeps what the
+/// last boot wrote
+MBED_SECTION(".noinit") static RetainedRing Ring;
+
+/// the readings that the sampling loop passed on or dropped, and that the
+/// uploader took. Not retained, they start at Ring.Taken
+static uint32_t Offered = 0;
+static uint32_t Handled = 0;
+
+/// the next reading of the last boot for takeRetainedFrame(), and the end
+/// of them
+static uint32_t Replay = 0;
+static uint32_t ReplayEnd = 0;
+
+static uint32_t frameCRC(const SampleFrame &Frame) {
+    MbedCRC<POLY_32BIT_ANSI, 32> ct;
+    uint32_t crc = 0;
+    ct.compute(&Frame, sizeof(Frame), &crc);
+    return crc;
+}
+
+// sets Done, which only the uploader changes
+static void setDone(uint32_t Done) {
+    Ring.Done = Done;
+    Ring.NotDone = ~Done;
+}
+
+// ============================================================================
+void startRetainedFrames() {
+    reset_reason_t Reason = ResetReason::get();
+    bool Valid = Ring.Magic == RETAINEDMAGIC &&
+                 Ring.Taken == ~Ring.NotTaken && Ring.Done == ~Ring.NotDone &&
+                 Ring.Taken - Ring.Done <= (uint32_t)INT32_MAX;
+    if (Valid && (Reason == RESET_REASON_WATCHDOG ||
+                  Reason == RESET_REASON_SOFTWARE)) {
+        ReplayEnd = Ring.Taken;
+        Replay = ReplayEnd - Ring.Done > RETAINEDFRAMES
+                     ? ReplayEnd - RETAINEDFRAMES
+                     : Ring.Done;
+        if (Replay != ReplayEnd) {
+            tr_info("%lu readings were kept in RAM over the reset",
+                    (unsigned long)(ReplayEnd - Replay));
+        }
+    } else {
+        Ring.Magic = RETAINEDMAGIC;
+        Ring.Taken = 0;
+        Ring.NotTaken = ~0U;
+        setDone(0);
+    }
+    Offered = Ring.Taken;
+    Handled = Ring.Taken;
+}
+
+// ============================================================================
+bool takeRetainedFrame(SampleFrame &Frame) {
+    while (Replay != ReplayEnd) {
+        const RetainedSlot &Slot = Ring.Slots[Replay++ % RETAINEDFRAMES];
+        if (Slot.CRC == frameCRC(Slot.Frame)) {
+            Frame = Slot.Frame;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+void retainFrame(const SampleFrame &Frame) {
+    // the reading goes in before it is counted
+    uint32_t Taken = Ring.Taken;
+    RetainedSlot &Slot = Ring.Slots[Taken % RETAINEDFRAMES];
+    Slot.Frame = Frame;
+    Slot.CRC = frameCRC(Frame);
+    Ring.Taken = Taken + 1;
+    Ring.NotTaken = ~(Taken + 1);
+}
+
+// ============================================================================
+void retainedOffered(bool Taken) {
+    if (Offered == Ring.Taken) {
+        return;
+    }
+    if (!Taken) {
+        RetainedSlot &Slot = Ring.Slots[Offered % RETAINEDFRAMES];
+        Slot.CRC = ~Slot.CRC;
+    }
+    ++Offered;
+}
+
+// ============================================================================
+void retainedHandled() {
+    // the readings that were dropped in front of it never come
+    while (Handled != Ring.Taken) {
+        const RetainedSlot &Slot = Ring.Slots[Handled++ % RETAINEDFRAMES];
+        if (Slot.CRC == frameCRC(Slot.Frame)) {
+            return;
+        }
+    }
+}
+
+// ============================================================================
+void retainedKept() {
+    if (Ring.Done != Handled) {
+        setDone(Handled);
+    }
+}
+
+#endif // RETAINEDFRAMES
@@ -0,0 +1,79 @@
+#ifndef RETAINEDFRAMES_H
+#define RETAINEDFRAMES_H
+/// \file
+/// \brief A ring of the readings that are only in RAM, kept in RAM that the
+/// startup code does not clear, so a watchdog or software reset does not
+/// lose them.
+///
+/// The sampling loop copies every reading it passes on into the ring with
+/// retainFrame(), before it waits in the low-power batch or in the mail to
+/// the uploader. The uploader counts the readings it took with
+/// retainedHandled(). retainedKept() marks all of them as kept once none
+/// are staged in RAM for the backup log, after they were sent or written
+/// to the log or the flash queue. The ring is in a ".noinit" section like
+/// the crash log, with a magic and each count next to its complement, and
+/// a CRC32 with every reading.
+///
+/// After a reset by the watchdog or the software, see ResetReason.h,
+/// takeRetainedFrame() returns the readings of the last boot that were not
+/// kept yet, which main() backs up before it takes new ones. Any other reset
+/// starts the ring empty. The ring holds RETAINEDFRAMES readings, the
+/// oldest are dropped if more than that were never kept. Set with
+/// "retained-frames" in mbed_app.json.
+
+#include "Structs.h"
+
+/// How many readings the ring keeps, 0 turns it off. It needs room for the
+/// mail, the low-power batch and the staged block of the backup log. Set
+/// with "retained-frames" in mbed_app.json.
+#ifdef MBED_CONF_APP_RETAINED_FRAMES
+#define RETAINEDFRAMES MBED_CONF_APP_RETAINED_FRAMES
+#else
+#define RETAINEDFRAMES 0
+#endif
+
+#if RETAINEDFRAMES
+
+/// Checks what the last boot left in the ring, and keeps its readings for
+/// takeRetainedFrame() after a watchdog or software reset. Called once,
+/// early in main()
+void startRetainedFrames();
+
+/// Reads the next reading of the last boot that was not kept into Frame.
+/// Called before the sampling loop and the uploader start
+/// \returns false once there are none left
+bool takeRetainedFrame(SampleFrame &Frame);
+
+/// Copies Frame into the ring. Only the sampling loop calls this, in the
+/// order it passes the readings on
+void retainFrame(const SampleFrame &Frame);
+
+/// Marks the oldest reading that was retained but not passed on as passed
+/// to the uploader, or as dropped if Taken is false. Only the sampling loop
+/// calls this
+void retainedOffered(bool Taken);
+
+/// Counts a reading that the uploader took. Only the uploader calls this
+void retainedHandled();
+
+/// Marks every reading that the uploader took as kept, they are not in RAM
+/// anymore. Only the uploader calls this
+void retainedKept();
+
+#else
+
+inline void startRetainedFrames() {}
+
+inline bool takeRetainedFrame(SampleFrame &Frame) { return false; }
+
+inline void retainFrame(const SampleFrame &Frame) {}
+
+inline void retainedOffered(bool Taken) {}
+
+inline void retainedHandled() {}
+
+inline void retainedKept() {}
+
+#endif // RETAINEDFRAMES
+
+#endif // RETAINEDFRAMES
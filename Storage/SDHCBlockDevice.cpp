@@ -0,0 +1,475 @@
+/// \file
+/// \brief Implementation of the SDHC block device
+#include "SDHCBlockDevice.h"
+
+#include "EnergyMeter.h"
+#include "pinmap.h"
+
+/// from fsl_sdhc.c, it hands the interrupt to the handle of SDHC0
+extern "C" void SDHC_DriverIRQHandler(void);
+
+// SD commands, the ACMDs have to follow CMD55
+#define CMD0_GO_IDLE_STATE (0)
+#define CMD2_ALL_SEND_CID (2)
+#define CMD3_SEND_RELATIVE_ADDR (3)
+#define CMD6_SWITCH_FUNC (6)
+#define CMD7_SELECT_CARD (7)
+#define CMD8_SEND_IF_COND (8)
+#define CMD9_SEND_CSD (9)
+#define CMD13_SEND_STATUS (13)
+#define CMD16_SET_BLOCKLEN (16)
+#define CMD17_READ_SINGLE_BLOCK (17)
+#define CMD18_READ_MULTIPLE_BLOCK (18)
+#define CMD24_WRITE_BLOCK (24)
+#define CMD25_WRITE_MULTIPLE_BLOCK (25)
+#define CMD32_ERASE_WR_BLK_START (32)
+#define CMD33_ERASE_WR_BLK_END (33)
+#define CMD38_ERASE (38)
+#define CMD55_APP_CMD (55)
+#define ACMD6_SET_BUS_WIDTH (6)
+#define ACMD41_SD_SEND_OP_COND (41)
+
+/// CMD8 argument, 2.7-3.6 V and the 0xAA check pattern
+#define IFCOND (0x1AA)
+
+/// ACMD41 argument, the 3.2-3.4 V window and HCS for CMD8 cards
+#define OCRWINDOW (0x00FF8000)
+#define OCRHCS (1U << 30)
+#define OCRBUSY (1U << 31)
+
+/// How many times ACMD41 is sent before the card is given up on, 1 ms apart
+#define OPCONDTRIES (1000)
+
+/// the error bits of an R1 card status
+#define R1ERRORS (0xFDF98008)
+#define R1READYFORDATA (1U << 8)
+#define R1STATE(status) (((status) >> 9) & 0xF)
+#define R1STATETRAN (4)
+
+/// CMD6 argument that switches function group 1 to high speed
+#define SWITCHHIGHSPEED (0x80FFFFF1)
+
+/// the size of the CMD6 switch status
+#define SWITCHSTATUSSIZE (64)
+
+// ============================================================================
+SDHCBlockDevice::SDHCBlockDevice(PinName card_detect)
+    : Done(0), TransferStatus(kStatus_Success), CardDetect(card_detect),
+      RCA(0), HighCapacity(false), Blocks(0), Frequency(0),
+      MaxFrequency(0), Initialized(false) {
+    if (card_detect != NC) {
+        CardDetect.mode(PullDown);
+    }
+}
+
+SDHCBlockDevice::~SDHCBlockDevice() {
+    if (Initialized) {
+        deinit();
+    }
+}
+
+void SDHCBlockDevice::onTransferDone(SDHC_Type *base, sdhc_handle_t *handle,
+                                     status_t status, void *data) {
+    SDHCBlockDevice *device = static_cast<SDHCBlockDevice *>(data);
+    device->TransferStatus = status;
+    device->Done.release();
+}
+
+// ============================================================================
+int SDHCBlockDevice::command(uint32_t index, uint32_t argument,
+                             sdhc_response_type_t type, sdhc_data_t *data,
+                             uint32_t *response) {
+    sdhc_command_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.index = index;
+    cmd.argument = argument;
+    cmd.type = kSDHC_CommandTypeNormal;
+    cmd.responseType = type;
+
+    sdhc_transfer_t content;
+    content.command = &cmd;
+    content.data = data;
+
+    TransferStatus = kStatus_Success;
+    status_t status = SDHC_TransferNonBlocking(SDHC, &Handle, AdmaTable,
+                                               SDHCADMAWORDS, &content);
+    if (status != kStatus_Success) {
+        return SDHC_BLOCK_DEVICE_ERROR_TRANSFER;
+    }
+
+    // the calling thread sleeps until the interrupt is done with the block
+    if (!Done.try_acquire_for(SDHCTIMEOUTMS)) {
+        SDHC_Reset(SDHC, kSDHC_ResetCommand | kSDHC_ResetData, 100);
+        return SDHC_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    if (TransferStatus != kStatus_Success) {
+        return (TransferStatus == kStatus_SDHC_SendCommandFailed)
+                   ? SDHC_BLOCK_DEVICE_ERROR_NO_RESPONSE
+                   : SDHC_BLOCK_DEVICE_ERROR_TRANSFER;
+    }
+
+    if ((type == kSDHC_ResponseTypeR1 || type == kSDHC_ResponseTypeR1b) &&
+        (cmd.response[0] & R1ERRORS)) {
+        return SDHC_BLOCK_DEVICE_ERROR_TRANSFER;
+    }
+    if (response) {
+        memcpy(response, cmd.response, sizeof(cmd.response));
+    }
+    return BD_ERROR_OK;
+}
+
+int SDHCBlockDevice::appCommand(uint32_t index, uint32_t argument,
+                                sdhc_response_type_t type,
+                                uint32_t *response) {
+    int err = command(CMD55_APP_CMD, RCA << 16, kSDHC_ResponseTypeR1);
+    if (err) {
+        return err;
+    }
+    return command(index, argument, type, NULL, response);
+}
+
+int SDHCBlockDevice::waitReady() {
+    uint64_t start = Kernel::get_ms_count();
+    uint32_t status[4];
+    do {
+        int err = command(CMD13_SEND_STATUS, RCA << 16, kSDHC_ResponseTypeR1,
+                          NULL, status);
+        if (err) {
+            return err;
+        }
+        if ((status[0] & R1READYFORDATA) &&
+            R1STATE(status[0]) == R1STATETRAN) {
+            return BD_ERROR_OK;
+        }
+        thread_sleep_for(1);
+    } while (Kernel::get_ms_count() - start < SDHCTIMEOUTMS);
+    return SDHC_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+}
+
+// ============================================================================
+/// Returns bits msb to lsb of the CSD, the driver already shifted out the CRC
+/// so that bit n is bit n%32 of word n/32
+static uint32_t csdBits(const uint32_t *csd, int msb, int lsb) {
+    uint32_t value = 0;
+    for (int bit = msb; bit >= lsb; --bit) {
+        value = (value << 1) | ((csd[bit / 32] >> (bit % 32)) & 1);
+    }
+    return value;
+}
+
+int SDHCBlockDevice::initCard() {
+    uint32_t response[4];
+    int err;
+
+    command(CMD0_GO_IDLE_STATE, 0, kSDHC_ResponseTypeNone);
+
+    // only version 2 cards answer CMD8, and only they can be high capacity
+    bool v2 = command(CMD8_SEND_IF_COND, IFCOND, kSDHC_ResponseTypeR7, NULL,
+                      response) == BD_ERROR_OK;
+    if (v2 && (response[0] & 0xFFF) != IFCOND) {
+        return SDHC_BLOCK_DEVICE_ERROR_UNUSABLE;
+    }
+
+    int tries = 0;
+    do {
+        err = appCommand(ACMD41_SD_SEND_OP_COND,
+                         OCRWINDOW | (v2 ? OCRHCS : 0), kSDHC_ResponseTypeR3,
+                         response);
+        if (err) {
+            return err;
+        }
+        if (response[0] & OCRBUSY) {
+            break;
+        }
+        thread_sleep_for(1);
+    } while (++tries < OPCONDTRIES);
+    if (tries == OPCONDTRIES) {
+        return SDHC_BLOCK_DEVICE_ERROR_UNUSABLE;
+    }
+    HighCapacity = (response[0] & OCRHCS) != 0;
+
+    err = command(CMD2_ALL_SEND_CID, 0, kSDHC_ResponseTypeR2);
+    if (err) {
+        return err;
+    }
+    err = command(CMD3_SEND_RELATIVE_ADDR, 0, kSDHC_ResponseTypeR6, NULL,
+                  response);
+    if (err) {
+        return err;
+    }
+    RCA = response[0] >> 16;
+
+    err = command(CMD9_SEND_CSD, RCA << 16, kSDHC_ResponseTypeR2, NULL,
+                  response);
+    if (err) {
+        return err;
+    }
+    if (csdBits(response, 127, 126) == 1) {
+        // CSD version 2: C_SIZE counts 512 KB
+        Blocks = ((bd_size_t)csdBits(response, 69, 48) + 1) * 1024;
+    } else {
+        uint32_t c_size = csdBits(response, 73, 62);
+        uint32_t mult = csdBits(response, 49, 47);
+        uint32_t read_bl_len = csdBits(response, 83, 80);
+        Blocks = ((bd_size_t)(c_size + 1) << (mult + 2 + read_bl_len)) /
+                 SDHCBLOCKSIZE;
+    }
+
+    err = command(CMD7_SELECT_CARD, RCA << 16, kSDHC_ResponseTypeR1b);
+    if (err) {
+        return err;
+    }
+
+    err = appCommand(ACMD6_SET_BUS_WIDTH, 2, kSDHC_ResponseTypeR1);
+    if (err) {
+        return err;
+    }
+    SDHC_SetDataBusWidth(SDHC, kSDHC_DataBusWidth4Bit);
+
+    // SDHC cards ignore this, SDSC cards can have other block sizes
+    return command(CMD16_SET_BLOCKLEN, SDHCBLOCKSIZE, kSDHC_ResponseTypeR1);
+}
+
+int SDHCBlockDevice::switchHighSpeed() {
+    // the 512 bit switch status goes into Bounce
+    sdhc_data_t data;
+    memset(&data, 0, sizeof(data));
+    data.blockSize = SWITCHSTATUSSIZE;
+    data.blockCount = 1;
+    data.rxData = Bounce;
+
+    int err = command(CMD6_SWITCH_FUNC, SWITCHHIGHSPEED, kSDHC_ResponseTypeR1,
+                      &data);
+    if (err) {
+        return err;
+    }
+
+    // bits 379:376 are the function group 1 that the card switched to
+    const uint8_t *status = reinterpret_cast<const uint8_t *>(Bounce);
+    if ((status[16] & 0xF) != 1) {
+        return SDHC_BLOCK_DEVICE_ERROR_UNUSABLE;
+    }
+    return BD_ERROR_OK;
+}
+
+// ============================================================================
+int SDHCBlockDevice::init() {
+    Lock.lock();
+    if (Initialized) {
+        Lock.unlock();
+        return BD_ERROR_OK;
+    }
+    if (CardDetect.is_connected() && !CardDetect.read()) {
+        Lock.unlock();
+        return SDHC_BLOCK_DEVICE_ERROR_NO_DEVICE;
+    }
+
+    // PTE0-PTE5 are D1, D0, DCLK, CMD, D3, D2 on ALT4
+    const PinName pins[] = {PTE0, PTE1, PTE2, PTE3, PTE4, PTE5};
+    for (size_t i = 0; i < sizeof(pins) / sizeof(pins[0]); ++i) {
+        pin_function(pins[i], 4);
+        if (pins[i] != PTE2) {
+            pin_mode(pins[i], PullUp);
+        }
+    }
+
+    sdhc_config_t config;
+    config.cardDetectDat3 = false;
+    config.endianMode = kSDHC_EndianModeLittle;
+    config.dmaMode = kSDHC_DmaModeAdma2;
+    config.readWatermarkLevel = 128;
+    config.writeWatermarkLevel = 128;
+    SDHC_Init(SDHC, &config);
+
+    sdhc_transfer_callback_t callback;
+    memset(&callback, 0, sizeof(callback));
+    callback.TransferComplete = &SDHCBlockDevice::onTransferDone;
+    SDHC_TransferCreateHandle(SDHC, &Handle, &callback, this);
+
+    // the vector table is in RAM, the startup file only has a default handler
+    NVIC_SetVector(SDHC_IRQn, (uint32_t)SDHC_DriverIRQHandler);
+
+    uint32_t source = CLOCK_GetFreq(kCLOCK_CoreSysClk);
+    Frequency = SDHC_SetSdClock(SDHC, source, SDHCINITHZ);
+    SDHC_SetCardActive(SDHC, 100);
+
+    int err = initCard();
+    if (!err) {
+        if (MaxFrequency != 0 && MaxFrequency < SDHCHIGHSPEEDHZ) {
+            // the card stays in default speed mode
+            Frequency = SDHC_SetSdClock(SDHC, source,
+                                        MaxFrequency < SDHCDEFAULTHZ
+                                            ? MaxFrequency
+                                            : SDHCDEFAULTHZ);
+        } else if (switchHighSpeed() == BD_ERROR_OK) {
+            Frequency = SDHC_SetSdClock(SDHC, source, SDHCHIGHSPEEDHZ);
+        } else {
+            Frequency = SDHC_SetSdClock(SDHC, source, SDHCDEFAULTHZ);
+        }
+        Initialized = true;
+    } else {
+        SDHC_Deinit(SDHC);
+    }
+    Lock.unlock();
+    return err;
+}
+
+int SDHCBlockDevice::deinit() {
+    Lock.lock();
+    if (Initialized) {
+        SDHC_Deinit(SDHC);
+        Initialized = false;
+    }
+    Lock.unlock();
+    return BD_ERROR_OK;
+}
+
+// ============================================================================
+int SDHCBlockDevice::transfer(bool write, uint32_t *buffer, bd_addr_t block,
+                              bd_size_t count) {
+    sdhc_data_t data;
+    memset(&data, 0, sizeof(data));
+    data.enableAutoCommand12 = count > 1;
+    data.blockSize = SDHCBLOCKSIZE;
+    data.blockCount = count;
+    if (write) {
+        data.txData = buffer;
+    } else {
+        data.rxData = buffer;
+    }
+
+    uint32_t index;
+    if (write) {
+        index = count > 1 ? CMD25_WRITE_MULTIPLE_BLOCK : CMD24_WRITE_BLOCK;
+    } else {
+        index = count > 1 ? CMD18_READ_MULTIPLE_BLOCK : CMD17_READ_SINGLE_BLOCK;
+    }
+
+    uint32_t argument = HighCapacity ? block : block * SDHCBLOCKSIZE;
+    energyActive(EnergySD, true);
+    int err = command(index, argument, kSDHC_ResponseTypeR1, &data);
+
+    // the card keeps programming after the last block is on the bus
+    if (!err && write) {
+        err = waitReady();
+    }
+    energyActive(EnergySD, false);
+    return err;
+}
+
+int SDHCBlockDevice::read(void *buffer, bd_addr_t addr, bd_size_t size) {
+    if (!is_valid_read(addr, size)) {
+        return SDHC_BLOCK_DEVICE_ERROR_PARAMETER;
+    }
+
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return SDHC_BLOCK_DEVICE_ERROR_NO_INIT;
+    }
+
+    uint8_t *out = static_cast<uint8_t *>(buffer);
+    bd_addr_t block = addr / SDHCBLOCKSIZE;
+    bd_size_t left = size / SDHCBLOCKSIZE;
+    bool aligned = ((uintptr_t)out & 3) == 0;
+    int err = BD_ERROR_OK;
+
+    while (left > 0 && !err) {
+        if (aligned) {
+            bd_size_t count = left > SDHCMAXBLOCKS ? SDHCMAXBLOCKS : left;
+            err = transfer(false, reinterpret_cast<uint32_t *>(out), block,
+                           count);
+            out += count * SDHCBLOCKSIZE;
+            block += count;
+            left -= count;
+        } else {
+            // ADMA2 can only move words, so this goes one block at a time
+            err = transfer(false, Bounce, block, 1);
+            memcpy(out, Bounce, SDHCBLOCKSIZE);
+            out += SDHCBLOCKSIZE;
+            ++block;
+            --left;
+        }
+    }
+    Lock.unlock();
+    return err;
+}
+
+int SDHCBlockDevice::program(const void *buffer, bd_addr_t addr,
+                             bd_size_t size) {
+    if (!is_valid_program(addr, size)) {
+        return SDHC_BLOCK_DEVICE_ERROR_PARAMETER;
+    }
+
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return SDHC_BLOCK_DEVICE_ERROR_NO_INIT;
+    }
+
+    const uint8_t *in = static_cast<const uint8_t *>(buffer);
+    bd_addr_t block = addr / SDHCBLOCKSIZE;
+    bd_size_t left = size / SDHCBLOCKSIZE;
+    bool aligned = ((uintptr_t)in & 3) == 0;
+    int err = BD_ERROR_OK;
+
+    while (left > 0 && !err) {
+        if (aligned) {
+            bd_size_t count = left > SDHCMAXBLOCKS ? SDHCMAXBLOCKS : left;
+            err = transfer(true,
+                           const_cast<uint32_t *>(
+                               reinterpret_cast<const uint32_t *>(in)),
+                           block, count);
+            in += count * SDHCBLOCKSIZE;
+            block += count;
+            left -= count;
+        } else {
+            memcpy(Bounce, in, SDHCBLOCKSIZE);
+            err = transfer(true, Bounce, block, 1);
+            in += SDHCBLOCKSIZE;
+            ++block;
+            --left;
+        }
+    }
+    Lock.unlock();
+    return err;
+}
+
+int SDHCBlockDevice::trim(bd_addr_t addr, bd_size_t size) {
+    if (!is_valid_erase(addr, size)) {
+        return SDHC_BLOCK_DEVICE_ERROR_PARAMETER;
+    }
+    if (size == 0) {
+        return BD_ERROR_OK;
+    }
+
+    Lock.lock();
+    if (!Initialized) {
+        Lock.unlock();
+        return SDHC_BLOCK_DEVICE_ERROR_NO_INIT;
+    }
+
+    bd_addr_t first = addr / SDHCBLOCKSIZE;
+    bd_addr_t last = first + size / SDHCBLOCKSIZE - 1;
+    if (!HighCapacity) {
+        first *= SDHCBLOCKSIZE;
+        last *= SDHCBLOCKSIZE;
+    }
+
+    int err = command(CMD32_ERASE_WR_BLK_START, first, kSDHC_ResponseTypeR1);
+    if (!err) {
+        err = command(CMD33_ERASE_WR_BLK_END, last, kSDHC_ResponseTypeR1);
+    }
+    if (!err) {
+        err = command(CMD38_ERASE, 0, kSDHC_ResponseTypeR1b);
+    }
+    if (!err) {
+        err = waitReady();
+    }
+    Lock.unlock();
+    return err;
+}
+
+bd_size_t SDHCBlockDevice::size() const {
+    return Initialized ? Blocks * SDHCBLOCKSIZE : 0;
+}
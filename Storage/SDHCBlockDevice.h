@@ -0,0 +1,138 @@
+#ifndef SDHCBLOCKDEVICE_H
+#define SDHCBLOCKDEVICE_H
+/// \file
+/// \brief BlockDevice for the SD card slot of the FRDM-K64F on the SDHC.
+///
+/// SDBlockDevice talks to the card over SPI one byte at a time. The K64F's
+/// SDHC controller moves whole blocks over the 4 bit bus with its own ADMA2
+/// engine, and the calling thread sleeps on a semaphore until the transfer
+/// complete interrupt.
+
+#include "mbed.h"
+
+#include "BlockDevice.h"
+#include "fsl_sdhc.h"
+
+/// Set to 1 to use SDHCBlockDevice for the SD card instead of the default
+/// SPI SDBlockDevice. Set with "sdhc-block-device" in mbed_app.json.
+#ifdef MBED_CONF_APP_SDHC_BLOCK_DEVICE
+#define USESDHC MBED_CONF_APP_SDHC_BLOCK_DEVICE
+#else
+#define USESDHC 0
+#endif
+
+/// The block size of every SD card in SDHC mode
+#define SDHCBLOCKSIZE (512)
+
+/// The most blocks that are moved in one multiple block command
+#define SDHCMAXBLOCKS (128)
+
+/// Words in the ADMA2 descriptor table, two per descriptor. One descriptor
+/// moves up to 64 KB
+#define SDHCADMAWORDS (8)
+
+/// How long a command or a transfer can take, in milliseconds
+#define SDHCTIMEOUTMS (1000)
+
+/// The SD clock while the card is identified
+#define SDHCINITHZ (400000)
+
+/// The SD clock in default speed mode
+#define SDHCDEFAULTHZ (25000000)
+
+/// The SD clock if the card switches to high speed mode
+#define SDHCHIGHSPEEDHZ (50000000)
+
+/// Error codes, with the same meaning as the SD_BLOCK_DEVICE_ERROR codes
+#define SDHC_BLOCK_DEVICE_ERROR_PARAMETER (-5103)
+#define SDHC_BLOCK_DEVICE_ERROR_NO_INIT (-5104)
+#define SDHC_BLOCK_DEVICE_ERROR_NO_DEVICE (-5105)
+#define SDHC_BLOCK_DEVICE_ERROR_UNUSABLE (-5107)
+#define SDHC_BLOCK_DEVICE_ERROR_NO_RESPONSE (-5108)
+#define SDHC_BLOCK_DEVICE_ERROR_TRANSFER (-5111)
+
+/// An SD or SDHC card on the SDHC0 pins (PTE0 to PTE5)
+class SDHCBlockDevice : public BlockDevice,
+                        private NonCopyable<SDHCBlockDevice> {
+  public:
+    /// \param card_detect The slot's card detect switch, which is high with a
+    /// card in it. NC skips the check
+    SDHCBlockDevice(PinName card_detect = PTE6);
+
+    virtual ~SDHCBlockDevice();
+
+    /// Identifies the card, switches it to the 4 bit bus and the fastest
+    /// clock that it supports
+    virtual int init();
+
+    virtual int deinit();
+
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size);
+
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size);
+
+    /// Erases the blocks with CMD38, the card may then read them as 0 or 1
+    virtual int trim(bd_addr_t addr, bd_size_t size);
+
+    virtual bd_size_t get_read_size() const { return SDHCBLOCKSIZE; }
+
+    virtual bd_size_t get_program_size() const { return SDHCBLOCKSIZE; }
+
+    virtual bd_size_t size() const;
+
+    virtual const char *get_type() const { return "SDHC"; }
+
+    /// Returns the SD clock that init() set up, in Hz
+    uint32_t frequency() const { return Frequency; }
+
+    /// Keeps the SD clock at or below hz from the next init(), for a card
+    /// that does not work at full speed. 0 takes the limit away
+    void limitFrequency(uint32_t hz) { MaxFrequency = hz; }
+
+  private:
+    int command(uint32_t index, uint32_t argument, sdhc_response_type_t type,
+                sdhc_data_t *data = NULL, uint32_t *response = NULL);
+    int appCommand(uint32_t index, uint32_t argument,
+                   sdhc_response_type_t type, uint32_t *response = NULL);
+    int initCard();
+    int switchHighSpeed();
+    int waitReady();
+    int transfer(bool write, uint32_t *buffer, bd_addr_t block,
+                 bd_size_t count);
+
+    static void onTransferDone(SDHC_Type *base, sdhc_handle_t *handle,
+                               status_t status, void *data);
+
+    sdhc_handle_t Handle;
+
+    /// released by the transfer complete interrupt
+    Semaphore Done;
+
+    volatile status_t TransferStatus;
+
+    uint32_t AdmaTable[SDHCADMAWORDS];
+
+    /// used for buffers that are not word aligned, which ADMA2 can not use
+    uint32_t Bounce[SDHCBLOCKSIZE / sizeof(uint32_t)];
+
+    DigitalIn CardDetect;
+
+    PlatformMutex Lock;
+
+    /// the card's relative address from CMD3
+    uint32_t RCA;
+
+    /// SDHC and SDXC cards are addressed by block, SDSC cards by byte
+    bool HighCapacity;
+
+    bd_size_t Blocks;
+
+    uint32_t Frequency;
+
+    /// the limit of limitFrequency(), 0 for none
+    uint32_t MaxFrequency;
+
+    bool Initialized;
+};
+
+#endif // SDHCBLOCKDEVICE
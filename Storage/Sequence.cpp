@@ -0,0 +1,136 @@
+/// \file
+/// \brief Implementation of the sequence numbers
+#define TRACE_GROUP "seq"
+#include "Sequence.h"
+
+#include "DeferredLog.h"
+#include "MbedCRC.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+
+/// Identifies SEQUENCEFILE, "IACS" in little endian
+#define SEQUENCEMAGIC (0x53434149)
+
+/// The contents of SEQUENCEFILE
+struct SequenceFile {
+    uint32_t Magic;    ///< always SEQUENCEMAGIC
+    uint32_t Stream;   ///< the time the stream was started at
+    uint32_t Reserved; ///< the numbers below this one may have been used
+    uint32_t CRC;      ///< CRC32 of everything above
+};
+
+/// what is in SEQUENCEFILE, and the next number
+static SequenceFile Saved;
+static uint32_t Next = 0;
+static uint32_t Acked = 0;
+
+static uint32_t sequenceCRC(const SequenceFile &File) {
+    MbedCRC<POLY_32BIT_ANSI, 32> ct;
+    uint32_t crc = 0;
+    ct.compute(&File, offsetof(SequenceFile, CRC), &crc);
+    return crc;
+}
+
+/// true once the flash store took a reservation, SEQUENCEFILE is gone then
+static bool InFlash = false;
+
+// returns true if Stored is a reservation that was written whole
+static bool sequenceValid(const SequenceFile &Stored) {
+    return Stored.Magic == SEQUENCEMAGIC &&
+           Stored.CRC == sequenceCRC(Stored) && Stored.Reserved != 0;
+}
+
+// reads the reservation from the flash store and from SEQUENCEFILE, and
+// takes the higher one of the same stream. The file is only there next to
+// the flash store if the store did not take a write. A new stream is started
+// if neither is valid
+static void loadSequence() {
+    SequenceFile Stored;
+    bool Valid = false;
+#if FLASHQUEUE
+    Valid = readSequenceCache(&Saved, sizeof(Saved)) == sizeof(Saved) &&
+            sequenceValid(Saved);
+    InFlash = Valid;
+#endif
+    FILE *File = fopen(SEQUENCEFILE, "rb");
+    if (File != NULL) {
+        if (fread(&Stored, sizeof(Stored), 1, File) == 1 &&
+            sequenceValid(Stored) &&
+            (!Valid || (Stored.Stream == Saved.Stream &&
+                        Stored.Reserved > Saved.Reserved))) {
+            Saved = Stored;
+            Valid = true;
+        }
+        fclose(File);
+    }
+    if (!Valid) {
+        Saved.Magic = SEQUENCEMAGIC;
+        Saved.Stream = (uint32_t)time(NULL);
+        Saved.Reserved = 1;
+        tr_warn("Starting sequence stream %lu", (unsigned long)Saved.Stream);
+    }
+    Next = Saved.Reserved;
+}
+
+// keeps Saved with the end of the reservation at Reserved, in the flash
+// store if it takes it and in SEQUENCEFILE if not. If that can not be
+// written the numbers are used anyway, a reset may then use them again
+static void saveSequence(uint32_t Reserved) {
+    Saved.Reserved = Reserved;
+    Saved.CRC = sequenceCRC(Saved);
+#if FLASHQUEUE
+    if (saveSequenceCache(&Saved, sizeof(Saved)) == 0) {
+        if (!InFlash) {
+            // a file that was left behind would hold an older reservation
+            remove(SEQUENCEFILE);
+            InFlash = true;
+        }
+        return;
+    }
+#endif
+    FILE *File = fopen(SEQUENCEFILE, "wb");
+    if (File == NULL || fwrite(&Saved, sizeof(Saved), 1, File) != 1) {
+        tr_error("Could not write %s", SEQUENCEFILE);
+    }
+    if (File != NULL) {
+        fclose(File);
+    }
+}
+
+// reserves the next numbers, fewer of them once the flash store has them
+static void reserveSequence() {
+    saveSequence(Next + (InFlash ? SEQUENCEFLASHRESERVE : SEQUENCERESERVE));
+}
+
+// ============================================================================
+uint32_t nextSequence() {
+    if (Next == 0) {
+        loadSequence();
+        reserveSequence();
+    } else if (Next == Saved.Reserved) {
+        reserveSequence();
+    }
+    return Next++;
+}
+
+// ============================================================================
+void commitSequence() {
+    if (Next != 0 && Next != Saved.Reserved) {
+        saveSequence(Next);
+    }
+}
+
+// ============================================================================
+uint32_t sequenceStream() { return Saved.Stream; }
+
+// ============================================================================
+void sequenceAcked(uint32_t Number) {
+    if (Number > Acked && Number < Next) {
+        Acked = Number;
+    }
+}
+
+// ============================================================================
+uint32_t ackedSequence() { return Acked; }
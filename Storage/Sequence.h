@@ -0,0 +1,65 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+/// \file
+/// \brief The sequence numbers of the readings, so that the server can tell
+/// a reading that was sent twice.
+///
+/// With SEQUENCEDUPLOADS, see Networking.h, the uploader gives every reading
+/// the next number of the board's stream when it takes it. The number stays
+/// with the reading in the backup log and the flash queue. The server keeps
+/// one reading of every number, so a request that went out again because
+/// its response was lost is not stored twice. Every response has acked="N",
+/// the highest number up to which the server has every reading of the
+/// stream, and the backlog drops the readings up to it without sending them
+/// again.
+///
+/// Writing the counter for every reading would wear the store, so
+/// SEQUENCERESERVE numbers are reserved at a time in SEQUENCEFILE, and a
+/// reset skips the rest of a reservation. A file that is lost starts a new
+/// stream, named after the time, so the new numbers are not taken for old
+/// ones. With FLASHQUEUE the reservation is kept in the flash store instead,
+/// where a write appends one record and does not rewrite a sector of the
+/// FAT, so only SEQUENCEFLASHRESERVE numbers are reserved at a time. The
+/// file is removed once the flash has the stream. commitSequence() keeps
+/// the exact next number, so a reset skips none of them.
+
+#include "BackupStore.h"
+#include "FlashQueue.h"
+
+#include <cstdint>
+
+/// How many numbers are reserved with one write of SEQUENCEFILE
+#define SEQUENCERESERVE (1024)
+
+/// How many numbers are reserved with one write of the flash store
+#define SEQUENCEFLASHRESERVE (64)
+
+/// Where the stream and the end of its reservation are kept, on the same
+/// filesystem as the backup log
+#if BACKUPSTORE == BACKUPSTOREFAT
+#define SEQUENCEFILE "/sd/Sequence.dat"
+#else
+#define SEQUENCEFILE "/log/Sequence.dat"
+#endif
+
+/// Returns the next number of the stream, never 0. The first call reads
+/// SEQUENCEFILE. Only the uploader thread numbers readings.
+uint32_t nextSequence();
+
+/// Keeps the next number as the end of the reservation, so no numbers are
+/// skipped if the board resets now, as before a reset or when the supply
+/// falls. The next nextSequence() reserves again. Only the uploader thread
+/// calls this
+void commitSequence();
+
+/// Returns the stream the numbers belong to, after the first nextSequence()
+uint32_t sequenceStream();
+
+/// Keeps Acked if it is higher than the number the server acked last
+void sequenceAcked(uint32_t Acked);
+
+/// Returns the highest number the server acked since the start, 0 before
+/// the first ack
+uint32_t ackedSequence();
+
+#endif // SEQUENCE
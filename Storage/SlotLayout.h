@@ -0,0 +1,134 @@
+#ifndef SLOTLAYOUT_H
+#define SLOTLAYOUT_H
+/// \file
+/// \brief Where the bootloader, the running firmware and the update slot are
+/// in the K64F's flash, and the records at the end of the slot.
+///
+/// This is shared by the firmware, see FirmwareSlot.h, and the bootloader
+/// in Bootloader/, so it only needs <cstdint>. The 1 MB of flash is:
+///  - SLOTBOOTSIZE bytes of the bootloader at 0
+///  - the running firmware at SLOTAPPSTART, "target.bootloader_img" in
+///    mbed_app.json puts it there, up to SLOTIMAGEMAX bytes
+///  - the update slot at SLOTSTART, the same size
+///  - the "flashiap-block-device" region at SLOTSTOREADDRESS
+///
+/// The slot's last sector is its trailer. A SlotManifest and its
+/// SlotSignature at its start are the first bytes of the update,
+/// SlotCheckpoint records follow them, and a SlotReady at its end tells the
+/// bootloader that the image in the slot is whole and checked. The flash is
+/// 0xFF where nothing was programmed, so each of them is only programmed
+/// once, and the trailer is erased for the next update.
+
+#include <cstdint>
+
+/// The K64F's erase sector
+#define SLOTSECTOR (0x1000)
+
+/// The bootloader's part of the flash
+#define SLOTBOOTSIZE (0x10000)
+
+/// Where the running firmware starts
+#define SLOTAPPSTART (SLOTBOOTSIZE)
+
+/// The size of the running firmware's part and of the slot, with the
+/// trailer
+#define SLOTSIZE (0x58000)
+
+/// Where the update slot starts
+#define SLOTSTART (SLOTAPPSTART + SLOTSIZE)
+
+/// Where the trailer of the slot is
+#define SLOTTRAILER (SLOTSTART + SLOTSIZE - SLOTSECTOR)
+
+/// The largest firmware image, what the slot has without its trailer
+#define SLOTIMAGEMAX (SLOTSIZE - SLOTSECTOR)
+
+/// The start of "flashiap-block-device.base-address", which has to stay
+/// clear of the slot
+#define SLOTSTOREADDRESS (SLOTSTART + SLOTSIZE)
+
+/// The first word of a SlotManifest, "IACU"
+#define SLOTMANIFESTMAGIC (0x55434149UL)
+
+/// The first word of a SlotCheckpoint, "IACC"
+#define SLOTCHECKPOINTMAGIC (0x43434149UL)
+
+/// The first word of a SlotReady, "IACR"
+#define SLOTREADYMAGIC (0x52434149UL)
+
+/// The first bytes of an update as the server sends it, kept at the start
+/// of the trailer. Little endian, like the K64F
+struct SlotManifest {
+    uint32_t Magic;
+    /// the firmware version of the new image
+    uint32_t Firmware;
+    /// the size and CRC-32 of the new image
+    uint32_t Size;
+    uint32_t Crc;
+    /// the size and CRC-32 of the running image that the patch is against
+    uint32_t BaseSize;
+    uint32_t BaseCrc;
+    /// the size of the whole patch with this manifest
+    uint32_t PatchSize;
+    /// the CRC-32 of the words in front of it
+    uint32_t ManifestCrc;
+    /// the SHA-256 of the new image
+    uint8_t Sha256[32];
+};
+
+/// The ECDSA signature of the SHA-256 of a SlotManifest, with the P-256 key
+/// whose public half the firmware is built with, see FirmwareSlot.h. Its
+/// r and s are big endian. Follows the manifest in the patch and in the
+/// trailer
+struct SlotSignature {
+    uint8_t R[32];
+    uint8_t S[32];
+};
+
+/// The bytes of a patch in front of its operations
+#define SLOTPATCHHEAD (sizeof(SlotManifest) + sizeof(SlotSignature))
+
+/// Where the patch was when a sector of the new image was programmed, so an
+/// update goes on from there after a reset. Follows the signature
+struct SlotCheckpoint {
+    uint32_t Magic;
+    /// the bytes of the patch that were taken, with the manifest and the
+    /// signature
+    uint32_t PatchAt;
+    /// the bytes of the new image that were programmed
+    uint32_t NewAt;
+    /// where the patch reads in the running image
+    uint32_t OldAt;
+    /// the bytes left of the operation the patch is in, its length while
+    /// it is read, and the bits of it so far
+    uint32_t Left;
+    uint8_t Phase;
+    uint8_t Op;
+    uint8_t Shift;
+    uint8_t Pad;
+    uint32_t Reserved;
+    /// the CRC-32 of the words in front of it
+    uint32_t Crc;
+};
+
+/// The image in the slot is whole and matches its manifest. At the end of
+/// the trailer
+struct SlotReady {
+    uint32_t Magic;
+    /// the ManifestCrc of the image
+    uint32_t ManifestCrc;
+};
+
+static_assert(sizeof(SlotManifest) == 64, "the manifest is 64 bytes");
+static_assert(sizeof(SlotSignature) == 64, "the signature is 64 bytes");
+static_assert(sizeof(SlotCheckpoint) == 32, "a checkpoint is 32 bytes");
+
+/// How many checkpoints fit between the signature and the SlotReady, one
+/// for each sector of the largest image
+#define SLOTCHECKPOINTS                                                        \
+    ((SLOTSECTOR - SLOTPATCHHEAD - sizeof(SlotReady)) / sizeof(SlotCheckpoint))
+
+/// Where the SlotReady is
+#define SLOTREADYADDRESS (SLOTTRAILER + SLOTSECTOR - sizeof(SlotReady))
+
+#endif // SLOTLAYOUT
@@ -0,0 +1,82 @@
+/// \file
+/// \brief Implementation of the USB mass storage service mode
+#include "USBService.h"
+
+#if USBSERVICE
+
+#include "USBMSD.h"
+
+/// The flags of USBService::Flags
+#define USBSERVICEPROCESS (1U << 0)
+#define USBSERVICESTOP (1U << 1)
+
+USBService::USBService(BlockDevice *bd)
+    : Device(bd), Disk(NULL), Worker(NULL) {}
+
+USBService::~USBService() { stop(); }
+
+// ============================================================================
+int USBService::start() {
+    if (Disk != NULL) {
+        return USBSERVICESUCCESS;
+    }
+    Flags.clear(USBSERVICEPROCESS | USBSERVICESTOP);
+    Worker = new Thread(osPriorityNormal, USBSERVICESTACKSIZE, NULL, "usb");
+    if (Worker->start(callback(this, &USBService::run)) != osOK) {
+        delete Worker;
+        Worker = NULL;
+        return -1;
+    }
+
+    // the device is started disconnected, so the interrupt has somewhere to
+    // go before the computer sees it
+    Disk = new USBMSD(Device, false);
+    Disk->attach(callback(this, &USBService::wake));
+
+    // the USB clock does not run in deep sleep
+    sleep_manager_lock_deep_sleep();
+    if (!Disk->connect()) {
+        stop();
+        return -2;
+    }
+    return USBSERVICESUCCESS;
+}
+
+// ============================================================================
+void USBService::stop() {
+    if (Disk == NULL) {
+        return;
+    }
+    // disconnect() waits for the requests that are still worked off
+    Disk->disconnect();
+    Flags.set(USBSERVICESTOP);
+    Worker->join();
+    delete Worker;
+    Worker = NULL;
+    delete Disk;
+    Disk = NULL;
+    sleep_manager_unlock_deep_sleep();
+}
+
+// ============================================================================
+bool USBService::ejected() { return Disk != NULL && Disk->media_removed(); }
+
+void USBService::run() {
+    while (true) {
+        uint32_t Got =
+            Flags.wait_any(USBSERVICEPROCESS | USBSERVICESTOP, osWaitForever);
+        if (Got & osFlagsError) {
+            continue;
+        }
+        if (Disk != NULL) {
+            Disk->process();
+        }
+        if (Got & USBSERVICESTOP) {
+            return;
+        }
+    }
+}
+
+void USBService::wake() { Flags.set(USBSERVICEPROCESS); }
+
+#endif // USBSERVICE
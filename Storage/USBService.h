@@ -0,0 +1,101 @@
+#ifndef USBSERVICE_H
+#define USBSERVICE_H
+/// \file
+/// \brief A service mode that hands the SD card to a computer on the K64F's
+/// USB device port as a mass storage drive, to copy the backlog off at USB
+/// speed.
+///
+/// After weeks offline the backlog is far too big for the ESP8266, and
+/// taking the card out of a running board can leave the FAT half written.
+/// A press of USBSERVICEPIN starts the service mode on the uploader thread:
+/// the staged records are written out, the backup log and the captures are
+/// let go of, the FAT is unmounted, and the card shows up on the computer
+/// through USBMSD. Readings that can not be sent in the meantime go to the
+/// flash queue, the same as when the card fails. Once the computer ejects
+/// the drive, or the button is pressed again, the USB device disconnects
+/// and the FAT is mounted again. The log's index is read from the card
+/// again, so segments that were deleted on the computer are gone from the
+/// backlog too.
+///
+/// The USB requests are worked off on a thread of its own that only lives
+/// during the service mode, so a slow upload never stalls the computer.
+
+#include "mbed.h"
+
+#include "BackupStore.h"
+#include "BlockDevice.h"
+
+/// Set to 1 to have the service mode. Set with "usb-service" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_USB_SERVICE
+#define USBSERVICE MBED_CONF_APP_USB_SERVICE
+#else
+#define USBSERVICE (0)
+#endif
+
+/// The button that starts and ends the service mode, low when pressed. Set
+/// with "usb-service-pin" in mbed_app.json.
+#ifdef MBED_CONF_APP_USB_SERVICE_PIN
+#define USBSERVICEPIN MBED_CONF_APP_USB_SERVICE_PIN
+#else
+#define USBSERVICEPIN SW2
+#endif
+
+#if USBSERVICE && BACKUPSTORE != BACKUPSTOREFAT
+#error "the backlog has to be on the FAT for usb-service, set backup-store 0"
+#endif
+
+/// the stack size of the thread that works off the USB requests.
+/// Set with "usb-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_USB_STACK_SIZE
+#define USBSERVICESTACKSIZE MBED_CONF_APP_USB_STACK_SIZE
+#else
+#define USBSERVICESTACKSIZE (2048)
+#endif
+
+/// a constant value that is returned from service functions upon success
+#define USBSERVICESUCCESS (0)
+
+class USBMSD;
+
+class USBService {
+  public:
+    /// \param bd The SD card's block device
+    USBService(BlockDevice *bd);
+
+    ~USBService();
+
+    /// Connects the card to the computer. The FAT on it has to be unmounted
+    /// already
+    /// \returns USBSERVICESUCCESS, or a negative integer if the USB device
+    /// could not be started
+    int start();
+
+    /// Disconnects the card from the computer, it can be mounted again
+    /// once this returns
+    void stop();
+
+    /// Returns true between start() and stop()
+    bool active() const { return Disk != NULL; }
+
+    /// Returns true once the computer ejected the drive
+    bool ejected();
+
+  private:
+    /// calls USBMSD::process() every time the USB interrupt asks for it
+    void run();
+
+    /// the callback of the USB interrupt
+    void wake();
+
+    BlockDevice *Device;
+
+    USBMSD *Disk;
+
+    Thread *Worker;
+
+    /// set from the USB interrupt, and by stop()
+    EventFlags Flags;
+};
+
+#endif // USBSERVICE
@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Writes the patch of an over the air update, see DeltaPatch.h.
+
+The patch turns the image the boards run into the new one. It starts with the
+SlotManifest of SlotLayout.h, which the boards check the running image and the
+new one against, and its SlotSignature. The server hands it out in pieces for
+firmware="Version" of its responses, see FirmwareUpdate.h.
+
+The manifest is signed with a P-256 key through openssl, whose public half the
+boards are built with as "ota-public-key":
+
+    openssl ecparam -name prime256v1 -genkey -noout -out ota-key.pem
+    python3 Storage/make_delta.py --key ota-key.pem --show-key
+    python3 Storage/make_delta.py --key ota-key.pem \\
+        old/firmware.bin new/firmware.bin 42 -o firmware-42.delta
+"""
+
+import argparse
+import hashlib
+import struct
+import subprocess
+import sys
+import zlib
+
+# keep in step with SlotLayout.h and DeltaPatch.h
+SLOTMANIFESTMAGIC = 0x55434149
+SLOTIMAGEMAX = 0x58000 - 0x1000
+SLOTPATCHHEAD = 64 + 64
+DELTAEND, DELTACOPY, DELTAADD, DELTAINSERT, DELTASEEK = range(5)
+
+# old and new bytes are matched from runs of this many equal bytes
+BLOCK = 8
+
+# the most places of a block in the old image that are tried
+CANDIDATES = 16
+
+# a run of equal bytes inside a match that is copied instead of added to
+COPYRUN = 4
+
+# a match goes on while this many of the last WINDOW bytes are equal
+WINDOW = 16
+WINDOWEQUAL = 8
+
+
+def varint(value):
+    """value 7 bits at a time, the low ones first, like putVarint()."""
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    """Like zigzag() of FrameCodec.h."""
+    return value << 1 if value >= 0 else ((-value) << 1) - 1
+
+
+def index(old):
+    """The places of every BLOCK bytes of old."""
+    places = {}
+    for i in range(len(old) - BLOCK + 1):
+        places.setdefault(old[i:i + BLOCK], []).append(i)
+    return places
+
+
+def exact(old, new, o, n, limit=None):
+    """How many bytes are equal from old[o] and new[n] on, up to limit."""
+    if limit is None:
+        limit = min(len(old) - o, len(new) - n)
+    length = 0
+    while length < limit and old[o + length] == new[n + length]:
+        length += 1
+    return length
+
+
+def stretch(old, new, o, n):
+    """How far the match of old[o] and new[n] goes with changed bytes in it,
+    as long as most of every WINDOW bytes stay the same."""
+    length = 0
+    equal = []
+    last_good = 0
+    while o + length < len(old) and n + length < len(new):
+        equal.append(old[o + length] == new[n + length])
+        length += 1
+        if equal[-1]:
+            last_good = length
+        if len(equal) >= WINDOW and sum(equal[-WINDOW:]) < WINDOWEQUAL:
+            break
+    return last_good
+
+
+def match(old, new, places, n, at):
+    """The best place in old for the bytes of new from n, the one at the
+    current place in old first, as (place, length)."""
+    best = (at, exact(old, new, at, n) if at < len(old) else 0)
+    for o in places.get(new[n:n + BLOCK], [])[:CANDIDATES]:
+        length = exact(old, new, o, n)
+        if length > best[1]:
+            best = (o, length)
+    return best
+
+
+class Writer:
+    """The ops of the patch."""
+
+    def __init__(self):
+        self.out = bytearray()
+        self.inserted = bytearray()
+
+    def op(self, code, value, data=b""):
+        self.flush()
+        self.out += bytes([code]) + varint(value) + data
+
+    def insert(self, byte):
+        self.inserted.append(byte)
+
+    def flush(self):
+        if self.inserted:
+            data = bytes(self.inserted)
+            self.inserted = bytearray()
+            self.op(DELTAINSERT, len(data), data)
+
+
+def diff(old, new):
+    """The ops that make new out of old."""
+    places = index(old)
+    patch = Writer()
+    at = 0
+    n = 0
+    while n < len(new):
+        o, length = match(old, new, places, n, at)
+        if length < BLOCK:
+            patch.insert(new[n])
+            n += 1
+            continue
+        length = stretch(old, new, o, n)
+        if o != at:
+            patch.op(DELTASEEK, zigzag(o - at))
+        # the equal runs are copied, the bytes between them added to
+        i = 0
+        while i < length:
+            run = exact(old, new, o + i, n + i, length - i)
+            if run >= COPYRUN or i + run == length:
+                patch.op(DELTACOPY, run)
+                i += run
+                continue
+            start = i
+            while i < length and \
+                    exact(old, new, o + i, n + i,
+                          min(COPYRUN, length - i)) < COPYRUN:
+                i += 1
+            patch.op(DELTAADD, i - start, bytes(
+                (new[n + k] - old[o + k]) & 0xFF for k in range(start, i)))
+        at = o + length
+        n += length
+    patch.flush()
+    patch.out.append(DELTAEND)
+    return bytes(patch.out)
+
+
+def manifest(old, new, version, patch_size):
+    """The SlotManifest in front of the patch."""
+    head = struct.pack("<7I", SLOTMANIFESTMAGIC, version, len(new),
+                       zlib.crc32(new), len(old), zlib.crc32(old),
+                       patch_size)
+    return head + struct.pack("<I", zlib.crc32(head)) + \
+        hashlib.sha256(new).digest()
+
+
+def der_length(der, at):
+    """The length of the DER value whose length starts at der[at], and where
+    the value starts."""
+    length = der[at]
+    if length < 0x80:
+        return length, at + 1
+    count = length & 0x7F
+    return int.from_bytes(der[at + 1:at + 1 + count], "big"), at + 1 + count
+
+
+def sign(key, data):
+    """The SlotSignature of data with the private key in the file key, r and s
+    as 32 bytes each out of the DER signature of openssl."""
+    der = subprocess.run(["openssl", "dgst", "-sha256", "-sign", key],
+                         input=data, stdout=subprocess.PIPE,
+                         check=True).stdout
+    # SEQUENCE { INTEGER r, INTEGER s }
+    _, at = der_length(der, 1)
+    out = b""
+    for _ in range(2):
+        length, at = der_length(der, at + 1)
+        value = int.from_bytes(der[at:at + length], "big")
+        out += value.to_bytes(32, "big")
+        at += length
+    return out
+
+
+def public_key(key):
+    """The ota-public-key of the private key in the file key, the uncompressed
+    point at the end of the DER public key."""
+    der = subprocess.run(["openssl", "ec", "-in", key, "-pubout", "-outform",
+                          "DER"], stdout=subprocess.PIPE,
+                         stderr=subprocess.DEVNULL, check=True).stdout
+    return "{" + ", ".join("0x%02x" % b for b in der[-65:]) + "}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("old", nargs="?", help="the .bin that the boards run")
+    parser.add_argument("new", nargs="?", help="the .bin of the update")
+    parser.add_argument("version", nargs="?", type=int,
+                        help="the firmware-version of the update")
+    parser.add_argument("-o", "--output")
+    parser.add_argument("--key", required=True,
+                        help="the private P-256 key that signs the manifest")
+    parser.add_argument("--show-key", action="store_true",
+                        help="print the ota-public-key of --key and stop")
+    args = parser.parse_args()
+    if args.show_key:
+        print(public_key(args.key))
+        return
+    if args.version is None or args.output is None:
+        parser.error("old, new, version and -o are needed for a patch")
+
+    old = open(args.old, "rb").read()
+    new = open(args.new, "rb").read()
+    if len(new) > SLOTIMAGEMAX:
+        sys.exit("%s has %d bytes, the slot only takes %d" %
+                 (args.new, len(new), SLOTIMAGEMAX))
+    ops = diff(old, new)
+    head = manifest(old, new, args.version, SLOTPATCHHEAD + len(ops))
+    data = head + sign(args.key, head) + ops
+    open(args.output, "wb").write(data)
+    print("%d bytes of patch for %d bytes of image" % (len(data), len(new)))
+
+
+if __name__ == "__main__":
+    main()
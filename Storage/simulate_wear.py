@@ -0,0 +1,522 @@
+#!/usr/bin/env python3
+"""Estimates how the backup log wears its store, and how long its writes take.
+
+Months of readings and outages are replayed through the writes that the
+backup log makes, see OfflineLogging.h:
+
+- while the site is offline every reading is staged, and the stage is
+  written to its segment as one block once it is LOGSTAGESIZE bytes or
+  LOGFLUSHMS old. Every flush appends the new counts of the segment to
+  index.jnl
+- a segment that has LOGSEGMENTRECORDS records is closed, the next record
+  starts a new one, and index.dat is written again with it
+- once the site is back the backlog is sent in batches of BACKUPBATCHMAX,
+  and every batch that was acked appends the segments it moved to
+  index.jnl. A segment that was all sent is removed with another index.dat
+
+The same writes then go to a model of each store that "backup-store" and
+"flash-queue" can pick, see BackupStore.h and FlashQueue.h:
+
+- fat, the segments on the SD card's FAT. A segment is set aside as
+  LOGSEGMENTEXTENT bytes of zeros when it starts, every write is a sector
+  and the directory sector of its file
+- littlefs, the segments on LittleFS in the internal flash, with its 4 KB
+  sectors. A write after a sync copies the end of the file to a new block,
+  the small files are inline in the metadata of the directory, and a
+  metadata block that is full is compacted into the other one of its pair
+- littlefs-sd, the same on the SD card's BACKUPPARTITION, 512 byte blocks
+- tdbstore, every reading as a key of the flash queue, a delete record
+  for every reading that was sent, and the whole queue copied to the other
+  area when one is full
+
+    python3 Storage/simulate_wear.py --days 180 --interval 5 \\
+        --outages 4 --outage-hours 6
+
+For each store it prints the bytes of readings that were logged, the bytes
+that went to the store for them and their ratio, the write amplification,
+how often the most worn block was erased and how many years of the same
+load the flash lasts, and the p50, p99 and max of the latency of a flush,
+an ack and a new segment. The models count what the firmware asks for, the
+SD card's own wear leveling is not known and not modeled.
+
+The host test in mbed-os/UNITTESTS/app/Storage/wear makes the same writes
+through mbed-os's own FATFileSystem, LittleFileSystem and TDBStore on
+simulated block devices, which is slower but has no model of them to get
+wrong. Its numbers are the ones to trust where the two differ.
+"""
+
+import argparse
+import random
+
+# keep in step with OfflineLogging.h, FrameCodec.h, Networking.h,
+# BackupStore.h, FlashQueue.h and mbed_app.json
+LOGSTAGESIZE = 512
+LOGFLUSHMS = 60000
+LOGSEGMENTRECORDS = 256
+LOGSEGMENTEXTENT = 16384
+LOGBLOCKHEAD = 8
+LOGHEADERSIZE = 4 + 2 + 2 + 2 + 2 + 16 * (16 + 4) + 4
+LOGINDEXSIZE = 4 + 2 + 2 + 4 + 64 * 20 + 4
+LOGJOURNALSIZE = 512
+LOGJOURNALENTRIES = LOGJOURNALSIZE // 24
+FRAMECODEDMAX = 1 + 5 + 3 * 3 + 1 + 3 + 5 + 16 * 3
+BACKUPBATCHMAX = 32
+FLASHQUEUELEN = 512
+FLASHREGION = 0x40000
+SAMPLEFRAMESIZE = 56
+TDBHEADERSIZE = 24
+TDBKEYSIZE = 9
+
+# the K64F's flash, from its data sheet: an 8 byte phrase takes about
+# 65 us to program and a 4 KB sector about 14 ms to erase, 10000 times
+FLASHSECTOR = 4096
+FLASHPHRASE = 8
+FLASHPROGRAMUS = 65
+FLASHERASEMS = 14
+FLASHENDURANCE = 10000
+
+# an SD sector over SPI at 25 MHz, then the card is busy. Now and then it
+# moves its own blocks around and is busy for much longer
+SDSECTOR = 512
+SDTRANSFERMS = 0.2
+SDBUSYMS = 0.8
+SDSTALLCHANCE = 0.005
+SDSTALLMS = (20.0, 250.0)
+
+
+class Store:
+    """What a store was asked to write and what it wrote and erased for it.
+
+    flush(), ack() and segment() return how long the write took in ms.
+    """
+
+    def __init__(self, name, rng):
+        self.name = name
+        self.rng = rng
+        self.written = 0
+        self.erases = {}
+        self.blocks = 0
+        self.endurance = 0
+
+    def erase(self, block):
+        self.erases[block] = self.erases.get(block, 0) + 1
+        return FLASHERASEMS
+
+    def program(self, count):
+        self.written += count
+        phrases = (count + FLASHPHRASE - 1) // FLASHPHRASE
+        return phrases * FLASHPROGRAMUS / 1000.0
+
+    def sector(self, where):
+        """One SD sector write, where counts how often each sector is hit."""
+        self.written += SDSECTOR
+        self.erases[where] = self.erases.get(where, 0) + 1
+        took = SDTRANSFERMS + self.rng.expovariate(1.0 / SDBUSYMS)
+        if self.rng.random() < SDSTALLCHANCE:
+            took += self.rng.uniform(*SDSTALLMS)
+        return took
+
+
+class FatStore(Store):
+    """The segments, index.dat and index.jnl on the SD card's FAT. The
+    erases are the writes of every sector, the card maps them to its own
+    blocks."""
+
+    def __init__(self, rng):
+        super().__init__("fat", rng)
+        self.next_cluster = 0
+
+    def sync(self, name):
+        # the size and the time of the file in its directory entry
+        return self.sector(("dir", name))
+
+    def segment(self, number):
+        took = self.sector(("fat", self.next_cluster // 128))
+        first = self.next_cluster
+        self.next_cluster += LOGSEGMENTEXTENT // FLASHSECTOR
+        for i in range(LOGSEGMENTEXTENT // SDSECTOR):
+            took += self.sector(("seg", number, i))
+        return took + self.sync(number)
+
+    def flush(self, number, offset, count):
+        took = 0.0
+        for i in range(offset // SDSECTOR,
+                       (offset + count - 1) // SDSECTOR + 1):
+            took += self.sector(("seg", number, i))
+        return took + self.sync(number)
+
+    def journal(self, entry):
+        took = self.sector(("jnl", 0))
+        return took + self.sync("jnl")
+
+    def index(self):
+        took = 0.0
+        for i in range((LOGINDEXSIZE + SDSECTOR - 1) // SDSECTOR):
+            took += self.sector(("idx", i))
+        return took + self.sync("idx")
+
+    def remove(self, number):
+        return self.sector(("dir", number)) + self.sector(("fat", 0))
+
+
+class LittleStore(Store):
+    """The backup log on LittleFS, blocks of block bytes that are erased
+    whole, programmed in prog bytes.
+
+    Every file that is larger than its inline limit has its own blocks, a
+    write after a sync copies the last block of it to a fresh one. The
+    directory is a pair of metadata blocks that every sync commits to.
+    """
+
+    def __init__(self, name, rng, block, blocks, sd):
+        super().__init__(name, rng)
+        self.block = block
+        self.blocks = blocks
+        self.prog = 512
+        self.sd = sd
+        self.endurance = 0 if sd else FLASHENDURANCE
+        self.inline = min(self.prog, block // 8)
+        self.next_block = 2
+        self.meta = [0, 1]
+        self.meta_used = 0
+        self.files = {}
+
+    def erase_block(self, block):
+        if self.sd:
+            # the card erases for itself, its writes are counted instead
+            return 0.0
+        return self.erase(block)
+
+    def program_block(self, block, count):
+        if self.sd:
+            took = 0.0
+            for _ in range((count + SDSECTOR - 1) // SDSECTOR):
+                took += self.sector(block)
+            return took
+        return self.program(count)
+
+    def allocate(self):
+        # the lookahead moves on through the blocks, so the wear is spread
+        while True:
+            block = self.next_block
+            self.next_block = (self.next_block + 1) % self.blocks
+            if block not in self.meta:
+                return block
+
+    def commit(self, count):
+        # a commit of the directory, its tags padded to a whole prog
+        size = ((count + 16 + self.prog - 1) // self.prog) * self.prog
+        took = 0.0
+        if self.meta_used + size > self.block:
+            # compaction writes what is live into the other block
+            self.meta.reverse()
+            took += self.erase_block(self.meta[0])
+            self.meta_used = self.prog
+            took += self.program_block(self.meta[0], self.prog)
+        self.meta_used += size
+        return took + self.program_block(self.meta[0], size)
+
+    def write_file(self, name, offset, count):
+        end = offset + count
+        if end <= self.inline:
+            return self.commit(end)
+        took = 0.0
+        length = self.files.get(name, 0)
+        start = (min(offset, length) // self.block) * self.block
+        # the block that offset is in is copied from its start to a new
+        # one, and the blocks after it are fresh
+        for first in range(start, end, self.block):
+            block = self.allocate()
+            took += self.erase_block(block)
+            took += self.program_block(block, min(end, first + self.block) -
+                                       first)
+        self.files[name] = max(length, end)
+        return took + self.commit(32)
+
+    def segment(self, number):
+        return self.write_file(number, 0, LOGHEADERSIZE)
+
+    def flush(self, number, offset, count):
+        return self.write_file(number, offset, count)
+
+    def journal(self, entry):
+        return self.write_file("jnl", entry * 24, 24)
+
+    def index(self):
+        return self.write_file("idx", 0, LOGINDEXSIZE)
+
+    def remove(self, number):
+        self.files.pop(number, None)
+        return self.commit(16)
+
+
+class TdbStore(Store):
+    """Every reading as a key of the flash queue's TDBStore, in two areas
+    of half the flashiap-block-device region each."""
+
+    def __init__(self, rng):
+        super().__init__("tdbstore", rng)
+        self.area = FLASHREGION // 2
+        self.blocks = FLASHREGION // FLASHSECTOR
+        self.endurance = FLASHENDURANCE
+        self.active = 0
+        self.used = 0
+        self.live = 0
+        self.erased = [True, True]
+
+    @staticmethod
+    def record(data):
+        size = TDBHEADERSIZE + TDBKEYSIZE + data
+        return ((size + FLASHPHRASE - 1) // FLASHPHRASE) * FLASHPHRASE
+
+    def append(self, data):
+        size = self.record(data)
+        took = 0.0
+        if self.used + size > self.area:
+            # every live key goes to the other area, which is erased first.
+            # gc_step_records spreads this over the pushes before, so the
+            # latency of it is the worst case
+            other = 1 - self.active
+            if not self.erased[other]:
+                sectors = self.area // FLASHSECTOR
+                for i in range(sectors):
+                    took += self.erase(other * sectors + i)
+            self.erased[self.active] = False
+            self.erased[other] = False
+            self.active = other
+            self.used = self.live * self.record(SAMPLEFRAMESIZE)
+            took += self.program(self.used)
+        self.used += size
+        return took + self.program(size)
+
+    def push(self):
+        if self.live == FLASHQUEUELEN:
+            # the oldest reading is dropped to make room
+            self.pop()
+        self.live += 1
+        return self.append(SAMPLEFRAMESIZE)
+
+    def pop(self):
+        self.live -= 1
+        return self.append(0)
+
+
+class Backlog:
+    """The writes of the backup log, handed to a store as they happen."""
+
+    def __init__(self, store, record_bytes, rng):
+        self.store = store
+        self.rng = rng
+        self.record_bytes = record_bytes
+        self.number = 0
+        self.segments = []
+        self.stage = 0
+        self.stage_records = 0
+        self.stage_oldest = 0.0
+        self.seg_records = 0
+        self.seg_end = 0
+        self.journal_used = 1
+        self.logged = 0
+        self.latency = {"flush": [], "ack": [], "segment": []}
+
+    def index(self):
+        # index.dat, and index.jnl starts over with a new base
+        self.journal_used = 1
+        return self.store.index() + self.store.journal(0)
+
+    def journal(self, changed):
+        took = 0.0
+        if self.journal_used + changed > LOGJOURNALENTRIES:
+            took += self.index()
+        for _ in range(changed):
+            took += self.store.journal(self.journal_used)
+            self.journal_used += 1
+        return took
+
+    def flush(self):
+        if self.stage == 0:
+            return
+        took = self.store.flush(self.number, self.seg_end, self.stage)
+        self.seg_end += self.stage
+        took += self.journal(1)
+        self.latency["flush"].append(took)
+        self.segments[-1][1] += self.stage_records
+        self.stage = 0
+        self.stage_records = 0
+
+    def record(self, now):
+        if not self.segments or self.seg_records >= LOGSEGMENTRECORDS:
+            self.flush()
+            self.number += 1
+            self.segments.append([self.number, 0, 0])
+            self.seg_records = 0
+            self.seg_end = LOGHEADERSIZE
+            took = self.store.segment(self.number)
+            self.latency["segment"].append(took + self.index())
+        if self.stage + FRAMECODEDMAX > LOGSTAGESIZE:
+            self.flush()
+        if self.stage == 0:
+            self.stage = LOGBLOCKHEAD
+            self.stage_oldest = now
+        size = max(4, int(self.rng.gauss(self.record_bytes,
+                                         self.record_bytes / 4)))
+        self.stage += size
+        self.stage_records += 1
+        self.seg_records += 1
+        self.logged += size
+        if (now - self.stage_oldest) * 1000 >= LOGFLUSHMS:
+            self.flush()
+
+    def pending(self):
+        return sum(seg[1] - seg[2] for seg in self.segments) + \
+            self.stage_records
+
+    def ack(self, count):
+        # the staged records go to the segment before they are read
+        self.flush()
+        took = 0.0
+        changed = 0
+        for seg in self.segments:
+            if count == 0:
+                break
+            moved = min(count, seg[1] - seg[2])
+            if moved > 0:
+                seg[2] += moved
+                count -= moved
+                changed += 1
+        done = [seg for seg in self.segments
+                if seg[2] >= seg[1] and seg is not self.segments[-1]]
+        for seg in done:
+            took += self.store.remove(seg[0])
+            self.segments.remove(seg)
+        took += self.index() if done else self.journal(changed)
+        self.latency["ack"].append(took)
+
+
+class QueueLog:
+    """The writes of the flash queue, every reading a push and every sent
+    reading a pop."""
+
+    def __init__(self, store, record_bytes, rng):
+        self.store = store
+        self.count = 0
+        self.logged = 0
+        self.latency = {"flush": [], "ack": [], "segment": []}
+
+    def record(self, now):
+        self.latency["flush"].append(self.store.push())
+        self.count = min(self.count + 1, FLASHQUEUELEN)
+        self.logged += SAMPLEFRAMESIZE
+
+    def pending(self):
+        return self.count
+
+    def ack(self, count):
+        took = 0.0
+        for _ in range(min(count, self.count)):
+            took += self.store.pop()
+        self.count -= min(count, self.count)
+        self.latency["ack"].append(took)
+
+
+def replay(log, args, rng):
+    """Runs the days of args through log, offline for the outages."""
+    day = 86400.0
+    end = args.days * day
+    now = 0.0
+    outage_rate = args.outages / (30.0 * day)
+    while now < end:
+        # online until the next outage, the backlog drains meanwhile
+        online = rng.expovariate(outage_rate) if outage_rate > 0 else end
+        stop = min(end, now + online)
+        while now < stop and log.pending() > 0:
+            batch = min(BACKUPBATCHMAX, log.pending())
+            log.ack(batch)
+            now += batch / args.drain_rate
+        now = stop
+        if now >= end:
+            break
+        length = rng.expovariate(1.0 / (args.outage_hours * 3600.0))
+        stop = min(end, now + length)
+        while now < stop:
+            log.record(now)
+            now += args.interval
+    log.ack(log.pending())
+
+
+def percentiles(values):
+    if not values:
+        return "       -"
+    values = sorted(values)
+    return "%8.1f %8.1f %8.1f" % (values[len(values) // 2],
+                                  values[(len(values) * 99) // 100],
+                                  values[-1])
+
+
+def report(log, args):
+    store = log.store
+    ratio = store.written / log.logged if log.logged else 0.0
+    line = "%-12s %9d KB logged %9d KB written  WA %6.1f" % (
+        store.name, log.logged // 1024, store.written // 1024, ratio)
+    if store.erases:
+        worst = max(store.erases.values())
+        mean = sum(store.erases.values()) / float(
+            max(store.blocks, len(store.erases)))
+        line += "  worst block %7d, mean %9.1f" % (worst, mean)
+        if store.endurance and worst:
+            line += ", lasts %.1f years" % (
+                store.endurance / float(worst) * args.days / 365.0)
+    print(line)
+    for kind in ("flush", "ack", "segment"):
+        if log.latency[kind]:
+            print("    %-8s %7d   p50/p99/max ms %s" % (
+                kind, len(log.latency[kind]),
+                percentiles(log.latency[kind])))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description=__doc__.split("\n")[0])
+    parser.add_argument("--days", type=float, default=180,
+                        help="how long to replay")
+    parser.add_argument("--interval", type=float, default=5,
+                        help="seconds between two readings")
+    parser.add_argument("--outages", type=float, default=4,
+                        help="outages in a month, on average")
+    parser.add_argument("--outage-hours", type=float, default=6,
+                        help="the mean length of an outage")
+    parser.add_argument("--record-bytes", type=int, default=20,
+                        help="the mean size of a packed record")
+    parser.add_argument("--drain-rate", type=float, default=16,
+                        help="readings of the backlog sent every second")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--stores", default="fat,littlefs,littlefs-sd,"
+                        "tdbstore", help="the stores to compare")
+    args = parser.parse_args()
+
+    print("%g days, a reading every %g s, %g outages a month of %g hours" % (
+        args.days, args.interval, args.outages, args.outage_hours))
+    for name in args.stores.split(","):
+        # every store sees the same readings and outages, the latencies
+        # of the card are drawn apart from them
+        rng = random.Random(args.seed)
+        card = random.Random(args.seed + 1)
+        if name == "fat":
+            log = Backlog(FatStore(card), args.record_bytes, rng)
+        elif name == "littlefs":
+            store = LittleStore(name, card, FLASHSECTOR,
+                                FLASHREGION // FLASHSECTOR, False)
+            log = Backlog(store, args.record_bytes, rng)
+        elif name == "littlefs-sd":
+            store = LittleStore(name, card, SDSECTOR, 1 << 16, True)
+            log = Backlog(store, args.record_bytes, rng)
+        elif name == "tdbstore":
+            log = QueueLog(TdbStore(card), args.record_bytes, rng)
+        else:
+            parser.error("unknown store %s" % name)
+        replay(log, args, rng)
+        report(log, args)
+
+
+if __name__ == "__main__":
+    main()
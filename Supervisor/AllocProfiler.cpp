@@ -0,0 +1,254 @@
+/// \file
+/// \brief Implementation of the allocation profiler
+#include "AllocProfiler.h"
+
+#if ALLOCPROFILER
+
+#include "platform/mbed_critical.h"
+#include "platform/mbed_mem_trace.h"
+
+#include <cstdarg>
+#include <cstring>
+
+/// what one call site allocated, a Caller of NULL is a free slot
+struct AllocSite {
+    void *Caller;
+    uint32_t Allocs;
+    uint32_t Bytes;
+    uint32_t Live;
+    uint32_t LiveBytes;
+    uint32_t MaxLiveBytes;
+};
+
+/// one allocation that was not freed yet, a Ptr of NULL is a free slot
+struct LiveAlloc {
+    void *Ptr;
+    uint32_t Size;
+    uint16_t Site;
+};
+
+/// one place that must not allocate
+struct AllocChecked {
+    const char *Where;
+    uint32_t Runs;
+    uint32_t Allocs;
+};
+
+/// only changed by the callback, which the mbed_mem_trace lock serializes
+static AllocSite Sites[ALLOCSITES];
+static LiveAlloc Live[ALLOCLIVE];
+static volatile uint32_t Allocs = 0;
+
+/// allocations of callers that found no slot, frees of pointers that were
+/// not in Live, and allocations that did not fit into Live
+static uint32_t NoSite = 0;
+static uint32_t Unknown = 0;
+static uint32_t Untracked = 0;
+
+/// changed by the threads that call allocCheck() in critical sections
+static AllocChecked Checks[ALLOCCHECKS];
+
+/// copied out of Sites by allocReport(), too big for its stack
+static AllocSite Report[ALLOCSITES];
+
+/// when allocReport() last printed, from Kernel::get_ms_count()
+static uint64_t LastReport = 0;
+
+// the slot that Key hashes to in a table of 1 << Bits. The heap and the
+// code are word aligned, so the low bits are left out
+static uint32_t hashSlot(const void *Key, uint32_t Bits) {
+    return (((uint32_t)(uintptr_t)Key >> 2) * 2654435761U) >> (32 - Bits);
+}
+
+// the bits of a power of two
+static constexpr uint32_t log2Of(uint32_t Value) {
+    return Value <= 1 ? 0 : 1 + log2Of(Value >> 1);
+}
+
+// the index of the site of Caller, ALLOCSITES if the table is full
+static uint32_t findSite(void *Caller) {
+    uint32_t Slot = hashSlot(Caller, log2Of(ALLOCSITES));
+    for (uint32_t i = 0; i < ALLOCSITES; ++i) {
+        AllocSite &Site = Sites[(Slot + i) & (ALLOCSITES - 1)];
+        if (Site.Caller == NULL) {
+            Site.Caller = Caller;
+        }
+        if (Site.Caller == Caller) {
+            return (Slot + i) & (ALLOCSITES - 1);
+        }
+    }
+    return ALLOCSITES;
+}
+
+// counts an allocation of Size bytes at Ptr by Caller
+static void addAlloc(void *Ptr, uint32_t Size, void *Caller) {
+    ++Allocs;
+    uint32_t Index = findSite(Caller);
+    if (Index == ALLOCSITES) {
+        ++NoSite;
+        return;
+    }
+    AllocSite &Site = Sites[Index];
+    ++Site.Allocs;
+    Site.Bytes += Size;
+
+    uint32_t Slot = hashSlot(Ptr, log2Of(ALLOCLIVE));
+    for (uint32_t i = 0; i < ALLOCLIVE; ++i) {
+        LiveAlloc &Entry = Live[(Slot + i) & (ALLOCLIVE - 1)];
+        if (Entry.Ptr == NULL) {
+            Entry.Ptr = Ptr;
+            Entry.Size = Size;
+            Entry.Site = Index;
+            ++Site.Live;
+            Site.LiveBytes += Size;
+            if (Site.LiveBytes > Site.MaxLiveBytes) {
+                Site.MaxLiveBytes = Site.LiveBytes;
+            }
+            return;
+        }
+    }
+    ++Untracked;
+}
+
+// takes the allocation at Ptr out of Live and off its site
+static void removeAlloc(void *Ptr) {
+    uint32_t Slot = hashSlot(Ptr, log2Of(ALLOCLIVE));
+    for (uint32_t i = 0; i < ALLOCLIVE; ++i) {
+        uint32_t At = (Slot + i) & (ALLOCLIVE - 1);
+        if (Live[At].Ptr == NULL) {
+            break;
+        }
+        if (Live[At].Ptr != Ptr) {
+            continue;
+        }
+        AllocSite &Site = Sites[Live[At].Site];
+        --Site.Live;
+        Site.LiveBytes -= Live[At].Size;
+        // the entries after it that were pushed past their slot have to
+        // move up, or they could not be found again
+        uint32_t Hole = At;
+        for (uint32_t j = (At + 1) & (ALLOCLIVE - 1); Live[j].Ptr != NULL;
+             j = (j + 1) & (ALLOCLIVE - 1)) {
+            uint32_t Home = hashSlot(Live[j].Ptr, log2Of(ALLOCLIVE));
+            if (((j - Home) & (ALLOCLIVE - 1)) >=
+                ((j - Hole) & (ALLOCLIVE - 1))) {
+                Live[Hole] = Live[j];
+                Hole = j;
+            }
+        }
+        Live[Hole].Ptr = NULL;
+        return;
+    }
+    ++Unknown;
+}
+
+// the mbed_mem_trace callback, see mbed_mem_trace_cb_t for the arguments
+static void allocTraced(uint8_t Op, void *Res, void *Caller, ...) {
+    va_list Args;
+    va_start(Args, Caller);
+    switch (Op) {
+    case MBED_MEM_TRACE_MALLOC:
+        if (Res != NULL) {
+            addAlloc(Res, va_arg(Args, size_t), Caller);
+        }
+        break;
+    case MBED_MEM_TRACE_CALLOC:
+        if (Res != NULL) {
+            size_t Members = va_arg(Args, size_t);
+            addAlloc(Res, Members * va_arg(Args, size_t), Caller);
+        }
+        break;
+    case MBED_MEM_TRACE_REALLOC: {
+        void *Old = va_arg(Args, void *);
+        size_t Size = va_arg(Args, size_t);
+        // a failed realloc leaves the old block where it was
+        if (Res != NULL || Size == 0) {
+            if (Old != NULL) {
+                removeAlloc(Old);
+            }
+            if (Res != NULL) {
+                addAlloc(Res, Size, Caller);
+            }
+        }
+        break;
+    }
+    case MBED_MEM_TRACE_FREE: {
+        void *Ptr = va_arg(Args, void *);
+        if (Ptr != NULL) {
+            removeAlloc(Ptr);
+        }
+        break;
+    }
+    }
+    va_end(Args);
+}
+
+// ============================================================================
+void startAllocProfiler() {
+    LastReport = Kernel::get_ms_count();
+    mbed_mem_trace_set_callback(allocTraced);
+}
+
+// ============================================================================
+uint32_t allocCount() { return Allocs; }
+
+// ============================================================================
+void allocCheck(const char *Where, uint32_t Before) {
+    uint32_t Made = Allocs - Before;
+    core_util_critical_section_enter();
+    for (size_t i = 0; i < ALLOCCHECKS; ++i) {
+        if (Checks[i].Where == NULL) {
+            Checks[i].Where = Where;
+        }
+        if (Checks[i].Where == Where) {
+            ++Checks[i].Runs;
+            Checks[i].Allocs += Made;
+            break;
+        }
+    }
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void allocReport() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (Now - LastReport < ALLOCREPORTMS) {
+        return;
+    }
+    LastReport = Now;
+
+    // printf may allocate, so nothing is printed while the lock is held
+    mbed_mem_trace_lock();
+    memcpy(Report, Sites, sizeof(Report));
+    uint32_t Total = Allocs;
+    uint32_t Lost[3] = {NoSite, Unknown, Untracked};
+    mbed_mem_trace_unlock();
+
+    printf("\r\n%lu allocations, %lu of unknown callers, %lu unknown frees, "
+           "%lu not followed\r\n",
+           (unsigned long)Total, (unsigned long)Lost[0],
+           (unsigned long)Lost[1], (unsigned long)Lost[2]);
+    printf("caller        allocs      bytes   live  live bytes  max live\r\n");
+    for (size_t i = 0; i < ALLOCSITES; ++i) {
+        const AllocSite &Site = Report[i];
+        if (Site.Caller == NULL) {
+            continue;
+        }
+        printf("%-10p %9lu %10lu %6lu %11lu %9lu\r\n", Site.Caller,
+               (unsigned long)Site.Allocs, (unsigned long)Site.Bytes,
+               (unsigned long)Site.Live, (unsigned long)Site.LiveBytes,
+               (unsigned long)Site.MaxLiveBytes);
+    }
+
+    AllocChecked Checked[ALLOCCHECKS];
+    core_util_critical_section_enter();
+    memcpy(Checked, Checks, sizeof(Checked));
+    core_util_critical_section_exit();
+    for (size_t i = 0; i < ALLOCCHECKS && Checked[i].Where != NULL; ++i) {
+        printf("%s allocated %lu times in %lu runs\r\n", Checked[i].Where,
+               (unsigned long)Checked[i].Allocs,
+               (unsigned long)Checked[i].Runs);
+    }
+}
+
+#endif // ALLOCPROFILER
@@ -0,0 +1,79 @@
+#ifndef ALLOCPROFILER_H
+#define ALLOCPROFILER_H
+/// \file
+/// \brief Heap allocations summed up by the code that made them, cheap
+/// enough to leave on, to find leaks and the allocations of the hot path.
+///
+/// With "platform.memory-tracing-enabled" every malloc, calloc, realloc and
+/// free calls the mbed_mem_trace callback with the address it was called
+/// from. The default callback prints each of them, which is far too slow to
+/// leave on. This one adds them up instead, in a table of ALLOCSITES call
+/// sites: how many allocations and bytes each made, and how many of them are
+/// still live, with the most bytes it held at once. For the live count every
+/// allocation is kept in a second table of ALLOCLIVE pointers, so its free
+/// finds the site it came from. A site whose live count only goes up leaks,
+/// many small live objects of many sites fragment the heap.
+///
+/// allocCount() and allocCheck() wrap code that must not allocate at all,
+/// the formatting of a request, reading the backup log and the sampling
+/// loop. allocReport() prints every call site and how many allocations each
+/// of those checks saw, every ALLOCREPORTMS. The callers are addresses,
+/// arm-none-eabi-addr2line -f with the firmware's .elf turns them into
+/// functions. Set with "alloc-profiler" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to sum the allocations up by caller. Set with "alloc-profiler"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_ALLOC_PROFILER
+#define ALLOCPROFILER MBED_CONF_APP_ALLOC_PROFILER
+#else
+#define ALLOCPROFILER 0
+#endif
+
+#if ALLOCPROFILER && !defined(MBED_MEM_TRACING_ENABLED)
+#error "alloc-profiler needs platform.memory-tracing-enabled set to 1"
+#endif
+
+/// How many call sites are told apart, a power of two
+#define ALLOCSITES (64)
+
+/// How many live allocations are followed to their free, a power of two
+#define ALLOCLIVE (256)
+
+/// How many places allocCheck() is called from
+#define ALLOCCHECKS (8)
+
+/// How often allocReport() prints the table, in milliseconds
+#define ALLOCREPORTMS (60000)
+
+#if ALLOCPROFILER
+
+/// Starts adding the allocations up. Called once at boot, the allocations
+/// that were made before are not known to it
+void startAllocProfiler();
+
+/// Returns how many allocations were made since the start
+uint32_t allocCount();
+
+/// Counts the allocations since Before, an allocCount(), to the code at
+/// Where. Where has to be a string literal, it is kept
+void allocCheck(const char *Where, uint32_t Before);
+
+/// Prints the call sites and the checks once ALLOCREPORTMS have passed,
+/// only the uploader thread calls this
+void allocReport();
+
+#else
+
+inline void startAllocProfiler() {}
+
+inline uint32_t allocCount() { return 0; }
+
+inline void allocCheck(const char *Where, uint32_t Before) {}
+
+inline void allocReport() {}
+
+#endif // ALLOCPROFILER
+
+#endif // ALLOCPROFILER
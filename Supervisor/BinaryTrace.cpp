@@ -0,0 +1,97 @@
+/// \file
+/// \brief Implementation of the binary trace
+#include "BinaryTrace.h"
+
+#if BINARYTRACE
+
+#include "SPSCRing.h"
+#include "hal/us_ticker_api.h"
+#include "platform/mbed_critical.h"
+
+#if DEVICE_ITM
+#include "hal/itm_api.h"
+#endif
+
+/// The records that wait for btraceFlush(). Writers take a critical section,
+/// so there is only one producer at a time
+static SPSCRing<uint32_t, BTRACERINGLEN> Ring;
+
+/// counts up with every record, written ones and dropped ones
+static uint32_t Sequence = 0;
+
+static uint32_t Dropped = 0;
+
+// ============================================================================
+void btraceWrite(const char *Format, const uint32_t *Arguments, size_t Count) {
+    uint32_t Header[BTRACEHEADER] = {0, (uint32_t)(uintptr_t)Format,
+                                     us_ticker_read()};
+
+    core_util_critical_section_enter();
+    Header[0] = (BTRACEMAGIC << 24) | (Count << 16) | (Sequence++ & 0xFFFF);
+    if (Ring.capacity() - Ring.size() >= BTRACEHEADER + Count) {
+        Ring.push_n(Header, BTRACEHEADER);
+        Ring.push_n(Arguments, Count);
+    } else {
+        ++Dropped;
+    }
+    core_util_critical_section_exit();
+}
+
+#if DEVICE_ITM
+// sends one piece of the ring, the stimulus port takes it as fast as the
+// SWO pin goes
+static bool sendRecords(Span<const uint32_t> Words) {
+    mbed_itm_send_block(BTRACEITMPORT, Words.data(),
+                        Words.size() * sizeof(uint32_t));
+    return true;
+}
+#else
+/// the file is only opened while there are records to write
+static FILE *TraceFile = NULL;
+
+// appends one piece of the ring to BTRACEFILE
+static bool sendRecords(Span<const uint32_t> Words) {
+    size_t Written = fwrite(Words.data(), sizeof(uint32_t), Words.size(),
+                            TraceFile);
+    return Written == (size_t)Words.size();
+}
+#endif
+
+// ============================================================================
+void btraceFlush() {
+    if (Ring.empty()) {
+        return;
+    }
+
+#if !DEVICE_ITM
+    TraceFile = fopen(BTRACEFILE, "ab");
+    if (TraceFile != NULL && fseek(TraceFile, 0, SEEK_END) == 0 &&
+        ftell(TraceFile) >= BTRACEFILEMAX) {
+        TraceFile = freopen(BTRACEFILE, "wb", TraceFile);
+    }
+    if (TraceFile == NULL) {
+        // no SD card, the records wait in the ring and new ones are
+        // dropped once it is full
+        return;
+    }
+#endif
+
+    // the span ends at the end of the buffer, the rest comes next time
+    for (Span<const uint32_t> Words = Ring.peek(); !Words.empty();
+         Words = Ring.peek()) {
+        if (!sendRecords(Words)) {
+            break;
+        }
+        Ring.consume(Words.size());
+    }
+
+#if !DEVICE_ITM
+    fclose(TraceFile);
+    TraceFile = NULL;
+#endif
+}
+
+// ============================================================================
+uint32_t btraceDropped() { return core_util_atomic_load_u32(&Dropped); }
+
+#endif // BINARYTRACE
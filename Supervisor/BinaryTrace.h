@@ -0,0 +1,114 @@
+#ifndef BINARYTRACE_H
+#define BINARYTRACE_H
+/// \file
+/// \brief A trace that keeps the address of the format string and the raw
+/// arguments instead of formatting them.
+///
+/// BTRACE("%u: %f", Port, Value) writes a record of a few words to a RAM
+/// ring, which takes about as long as a few stores. Nothing is formatted on
+/// the board. The format string stays in the flash, and decode_btrace.py
+/// looks it up by its address in the firmware's .elf and formats the record
+/// on the host. The .elf has to be the one the board runs.
+///
+/// Each record is
+/// - a word with BTRACEMAGIC in the top byte, the number of arguments in the
+///   next one and a sequence number in the low half, so the host sees which
+///   records were dropped
+/// - the address of the format string
+/// - us_ticker_read() when it was written
+/// - one word for each argument
+///
+/// Arguments are numbers of up to 32 bits. Float and double are kept as a
+/// float, so %f, %e and %g get the float's bits. There is no %s, the string
+/// would be gone by the time the record is read.
+///
+/// btraceFlush() takes the records out of the ring on the uploader thread.
+/// It sends them over the ITM stimulus port BTRACEITMPORT where the target
+/// has DEVICE_ITM, and appends them to BTRACEFILE on the SD card otherwise.
+/// The K64F has no ITM support in mbed-os 5.14, so its records go to the SD
+/// card. Set with "binary-trace" in mbed_app.json. Without it BTRACE() is
+/// compiled out.
+
+#include "mbed.h"
+
+/// Set to 1 to keep the binary trace. Set with "binary-trace" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_BINARY_TRACE
+#define BINARYTRACE MBED_CONF_APP_BINARY_TRACE
+#else
+#define BINARYTRACE 0
+#endif
+
+/// How many words of records the ring holds, a power of two
+#define BTRACERINGLEN (1024)
+
+/// The most arguments one record can have
+#define BTRACEMAXARGS (8)
+
+/// The top byte of the first word of every record
+#define BTRACEMAGIC (0xB7)
+
+/// The words before the arguments
+#define BTRACEHEADER (3)
+
+/// The stimulus port the records are sent on where there is an ITM
+#define BTRACEITMPORT (1)
+
+/// The file that the records are appended to where there is no ITM
+#define BTRACEFILE "/sd/trace.bin"
+
+/// The file is started over once it is this big, in bytes
+#define BTRACEFILEMAX (1024 * 1024)
+
+#if BINARYTRACE
+
+/// Keeps only the values, the format is looked up on the host
+#define BTRACE(...) btrace(__VA_ARGS__)
+
+/// Writes one record to the ring, or counts it as dropped if there is no
+/// room. Can be called from any thread or interrupt handler
+void btraceWrite(const char *Format, const uint32_t *Arguments, size_t Count);
+
+/// Sends or saves the records in the ring, only the uploader thread calls
+/// this
+void btraceFlush();
+
+/// Returns how many records did not fit into the ring since the start
+uint32_t btraceDropped();
+
+// the word an argument is kept as
+inline uint32_t btraceWord(float Value) {
+    uint32_t Word;
+    memcpy(&Word, &Value, sizeof(Word));
+    return Word;
+}
+
+inline uint32_t btraceWord(double Value) { return btraceWord((float)Value); }
+
+template <typename T> inline uint32_t btraceWord(T Value) {
+    MBED_STATIC_ASSERT(sizeof(T) <= sizeof(uint32_t),
+                       "BTRACE arguments are 32 bits at most");
+    return (uint32_t)Value;
+}
+
+inline void btrace(const char *Format) { btraceWrite(Format, NULL, 0); }
+
+template <typename... Values>
+inline void btrace(const char *Format, Values... Arguments) {
+    MBED_STATIC_ASSERT(sizeof...(Values) <= BTRACEMAXARGS,
+                       "Too many BTRACE arguments");
+    const uint32_t Words[] = {btraceWord(Arguments)...};
+    btraceWrite(Format, Words, sizeof...(Values));
+}
+
+#else
+
+#define BTRACE(...)
+
+inline void btraceFlush() {}
+
+inline uint32_t btraceDropped() { return 0; }
+
+#endif // BINARYTRACE
+
+#endif // BINARYTRACE
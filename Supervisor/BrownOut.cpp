@@ -0,0 +1,67 @@
+/// \file
+/// \brief Implementation of the low voltage warning
+#include "BrownOut.h"
+
+#if BROWNOUTWARNING
+
+#include "fsl_pmc.h"
+
+/// The warning level of the high range, about 2.92 V
+#define BROWNOUTTRIP (kPMC_LowVoltWarningHighTrip)
+
+/// the callback of the warning, and whether its interrupt is off after
+/// it fired
+static Callback<void()> Handler;
+static volatile bool Fired = false;
+static volatile uint32_t Warnings = 0;
+
+// the interrupt of the low voltage detect and warning, only the warning is
+// turned on. It stays off until rearmBrownOutWarning()
+static void onWarning() {
+    pmc_low_volt_warning_config_t Off = {false, BROWNOUTTRIP};
+    PMC_ConfigureLowVoltWarning(PMC, &Off);
+    PMC_ClearLowVoltWarningFlag(PMC);
+    Fired = true;
+    ++Warnings;
+    if (Handler) {
+        Handler();
+    }
+}
+
+// ============================================================================
+void startBrownOutWarning(Callback<void()> Warned) {
+    Handler = Warned;
+
+    // the reset stays on, it only comes at the higher voltage
+    pmc_low_volt_detect_config_t Detect = {false, true,
+                                           kPMC_LowVoltDetectHighTrip};
+    PMC_ConfigureLowVoltDetect(PMC, &Detect);
+    PMC_ClearLowVoltWarningFlag(PMC);
+    NVIC_SetVector(LVD_LVW_IRQn, (uint32_t)onWarning);
+    NVIC_EnableIRQ(LVD_LVW_IRQn);
+    pmc_low_volt_warning_config_t Warning = {true, BROWNOUTTRIP};
+    PMC_ConfigureLowVoltWarning(PMC, &Warning);
+}
+
+// ============================================================================
+void rearmBrownOutWarning() {
+    if (!Fired) {
+        return;
+    }
+    // the flag comes back right away while the supply is still low
+    PMC_ClearLowVoltWarningFlag(PMC);
+    if (PMC_GetLowVoltWarningFlag(PMC)) {
+        return;
+    }
+    Fired = false;
+    pmc_low_volt_warning_config_t Warning = {true, BROWNOUTTRIP};
+    PMC_ConfigureLowVoltWarning(PMC, &Warning);
+}
+
+// ============================================================================
+bool brownOutActive() { return Fired; }
+
+// ============================================================================
+uint32_t brownOutWarnings() { return Warnings; }
+
+#endif // BROWNOUTWARNING
@@ -0,0 +1,68 @@
+#ifndef BROWNOUT_H
+#define BROWNOUT_H
+/// \file
+/// \brief Warns of a falling supply before the PMC resets the board, so
+/// what is only kept in RAM can still be written out.
+///
+/// The PMC's low voltage detect is moved to its high range, which resets
+/// the board at about 2.56 V instead of 1.6 V, while the SD card still
+/// works. The low voltage warning of that range interrupts at about 2.9 V,
+/// and the interrupt calls the callback of startBrownOutWarning(), which
+/// only hands the work to a thread. The uploader then writes the staged
+/// records of the backup log and the sequence numbers that were used, see
+/// commitSequence(), and puts the readings that wait for it into the flash
+/// queue, where each one is kept once its push returns. Until the supply is
+/// back, see brownOutActive(), the sampler leaves the ADCs off and hands
+/// over its batch, and the uploader keeps the readings it gets the same way
+/// instead of sending them. The interrupt is off after it fired, until
+/// rearmBrownOutWarning() finds the supply back above the warning level,
+/// so a sagging supply does not write the flash over and over. The
+/// warning's event goes into the crash log, which a reset by the low
+/// voltage detect keeps. Set with "brownout-warning" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to write out what is in RAM when the supply falls. Set with
+/// "brownout-warning" in mbed_app.json.
+#ifdef MBED_CONF_APP_BROWNOUT_WARNING
+#define BROWNOUTWARNING MBED_CONF_APP_BROWNOUT_WARNING
+#else
+#define BROWNOUTWARNING 0
+#endif
+
+#if BROWNOUTWARNING && !defined(TARGET_K64F) && !defined(TARGET_K66F)
+#error "brownout-warning needs the PMC of the K64F or the K66F"
+#endif
+
+/// How often the sampler looks whether the supply is back, in milliseconds
+#define BROWNOUTPOLLMS (100)
+
+#if BROWNOUTWARNING
+
+/// Moves the reset to the high range and calls Warned from the interrupt
+/// of the low voltage warning. Warned may only do what an interrupt can
+void startBrownOutWarning(Callback<void()> Warned);
+
+/// Turns the interrupt back on after it fired, once the supply is above the
+/// warning level again. Called from the uploader's housekeeping
+void rearmBrownOutWarning();
+
+/// Returns true from the warning until the supply is back above its level
+bool brownOutActive();
+
+/// Returns how many warnings there were since the boot
+uint32_t brownOutWarnings();
+
+#else
+
+inline void startBrownOutWarning(Callback<void()> Warned) {}
+
+inline void rearmBrownOutWarning() {}
+
+inline bool brownOutActive() { return false; }
+
+inline uint32_t brownOutWarnings() { return 0; }
+
+#endif // BROWNOUTWARNING
+
+#endif // BROWNOUT
@@ -0,0 +1,132 @@
+/// \file
+/// \brief Implementation of the switch between RUN and VLPR
+#define TRACE_GROUP "clk"
+#include "ClockScaler.h"
+
+#if CLOCKSCALING
+
+#include "DeferredLog.h"
+#include "fsl_clock.h"
+#include "fsl_smc.h"
+#include "fsl_uart.h"
+#include "platform/mbed_critical.h"
+
+/// The core clocks of RUN and VLPR
+#define CLOCKRUNHZ (120000000U)
+#define CLOCKVLPRHZ (4000000U)
+
+/// what the MCG and the SIM are set to in RUN, the same as
+/// BOARD_BootClockRUN(): PEE from the 50 MHz OSC, the PLL at 120 MHz, the
+/// bus at 60 MHz and the flash at 24 MHz
+static const mcg_config_t RunMcg = {
+    kMCG_ModePEE,      kMCG_IrclkEnable, kMCG_IrcSlow, 0, 7, kMCG_DrsLow,
+    kMCG_Dmx32Default, kMCG_OscselOsc,   {0, 0x13, 0x18}};
+static const sim_clock_config_t RunSim = {1, 2, 0x01140000U};
+
+/// and in VLPR, as BOARD_BootClockVLPR(): BLPI from the 4 MHz IRC with the
+/// core and the bus at 4 MHz and the flash at 800 kHz
+static const mcg_config_t VlprMcg = {
+    kMCG_ModeBLPI,     kMCG_IrclkEnable, kMCG_IrcFast, 0, 0, kMCG_DrsLow,
+    kMCG_Dmx32Default, kMCG_OscselOsc,   {0, 0, 0}};
+static const sim_clock_config_t VlprSim = {3, 2, 0x00040000U};
+
+/// the holds on the full speed, the sampler's is there from the boot on.
+/// Only changed in a critical section
+static uint32_t Holds = 1;
+
+static bool Slow = false;
+
+/// the times the clock changed, for the log
+static uint32_t Switches = 0;
+
+static Callback<void()> Listeners[CLOCKMAXLISTENERS];
+static size_t ListenerCount = 0;
+
+// sets up everything that counts on the clock again
+static void retime() {
+    // the us_ticker counts on PIT channel 1 and times its interrupt on
+    // channel 3, both behind a prescaler to 1 MHz. The count goes on
+    uint32_t Prescale = CLOCK_GetFreq(kCLOCK_BusClk) / 1000000 - 1;
+    PIT->CHANNEL[0].LDVAL = Prescale;
+    PIT->CHANNEL[2].LDVAL = Prescale;
+
+    // the console is on UART0, which runs from the core clock
+    UART_SetBaudRate(UART0, MBED_CONF_PLATFORM_STDIO_BAUD_RATE,
+                     CLOCK_GetFreq(kCLOCK_CoreSysClk));
+
+    for (size_t i = 0; i < ListenerCount; ++i) {
+        Listeners[i]();
+    }
+}
+
+// RUN to VLPR, the clocks come down first
+static void goSlow() {
+    CLOCK_SetSimSafeDivs();
+    CLOCK_SetMcgConfig(&VlprMcg);
+    CLOCK_SetSimConfig(&VlprSim);
+    SystemCoreClock = CLOCKVLPRHZ;
+    SMC_SetPowerModeProtection(SMC, kSMC_AllowPowerModeAll);
+    SMC_SetPowerModeVlpr(SMC, false);
+    while (SMC_GetPowerModeState(SMC) != kSMC_PowerStateVlpr) {
+    }
+    retime();
+}
+
+// VLPR to RUN, RUN comes first so the PLL may run
+static void goFast() {
+    SMC_SetPowerModeRun(SMC);
+    while (SMC_GetPowerModeState(SMC) != kSMC_PowerStateRun) {
+    }
+    CLOCK_SetSimSafeDivs();
+    CLOCK_SetMcgConfig(&RunMcg);
+    CLOCK_SetSimConfig(&RunSim);
+    SystemCoreClock = CLOCKRUNHZ;
+    retime();
+}
+
+// ============================================================================
+void clockHold() {
+    core_util_critical_section_enter();
+    bool Switch = Holds++ == 0 && Slow;
+    if (Switch) {
+        // the PLL takes about a millisecond to lock
+        goFast();
+        Slow = false;
+        ++Switches;
+    }
+    core_util_critical_section_exit();
+    if (Switch) {
+        tr_debug("Clock at 120 MHz, %lu switches", (unsigned long)Switches);
+    }
+}
+
+// ============================================================================
+void clockRelease() {
+    core_util_critical_section_enter();
+    bool Switch = Holds > 0 && --Holds == 0 && !Slow;
+    if (Switch) {
+        goSlow();
+        Slow = true;
+        ++Switches;
+    }
+    core_util_critical_section_exit();
+    if (Switch) {
+        tr_debug("Clock at 4 MHz, %lu switches", (unsigned long)Switches);
+    }
+}
+
+// ============================================================================
+bool clockAttach(Callback<void()> Retime) {
+    core_util_critical_section_enter();
+    bool Room = ListenerCount < CLOCKMAXLISTENERS;
+    if (Room) {
+        Listeners[ListenerCount++] = Retime;
+    }
+    core_util_critical_section_exit();
+    return Room;
+}
+
+// ============================================================================
+bool clockSlow() { return Slow; }
+
+#endif // CLOCKSCALING
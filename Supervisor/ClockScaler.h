@@ -0,0 +1,73 @@
+#ifndef CLOCKSCALER_H
+#define CLOCKSCALER_H
+/// \file
+/// \brief Runs the core at 120 MHz while there is work, and at 4 MHz in VLPR
+/// while every thread that needs it waits.
+///
+/// The sampler holds the full speed while the scan runs, and lets it go
+/// while it sleeps between readings in low-power mode. Every event of the
+/// uploader, which does the encoding, TLS and the SD card, holds it with
+/// a ClockHold. Once nothing holds it the MCG goes to BLPI on the 4 MHz
+/// IRC and the SMC to VLPR, the first hold takes it back to PEE and RUN.
+/// The us_ticker's PIT prescalers and the console's baud rate follow the
+/// clock right away, and the callbacks from clockAttach() re-time their
+/// peripherals, like DMAUARTSerial::retime(). A UART can only reach a
+/// sixteenth of the 4 MHz bus, so a faster link drops what comes in in
+/// VLPR. Flash writes and USB do not work in VLPR at all. The OS tick comes
+/// from the LPTMR, which does not care. Set with "clock-scaling" in
+/// mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to drop to VLPR while nothing holds the full speed. Set with
+/// "clock-scaling" in mbed_app.json.
+#ifdef MBED_CONF_APP_CLOCK_SCALING
+#define CLOCKSCALING MBED_CONF_APP_CLOCK_SCALING
+#else
+#define CLOCKSCALING 0
+#endif
+
+#if CLOCKSCALING && !defined(MBED_TICKLESS)
+#error "clock-scaling needs MBED_TICKLESS, SysTick runs from the core clock"
+#endif
+
+/// The most callbacks that re-time their peripherals
+#define CLOCKMAXLISTENERS (4)
+
+#if CLOCKSCALING
+
+/// Takes a hold on the full speed, and goes back to it if nothing held it.
+/// The sampler holds one from the boot on. Only called from threads
+void clockHold();
+
+/// Lets go of a hold, and goes to VLPR if it was the last one
+void clockRelease();
+
+/// Has Retime called after every change of the clock, with interrupts off.
+/// Returns false if there are CLOCKMAXLISTENERS callbacks already
+bool clockAttach(Callback<void()> Retime);
+
+/// Returns true while the core runs in VLPR
+bool clockSlow();
+
+#else
+
+inline void clockHold() {}
+
+inline void clockRelease() {}
+
+inline bool clockAttach(Callback<void()> Retime) { return true; }
+
+inline bool clockSlow() { return false; }
+
+#endif // CLOCKSCALING
+
+/// Holds the full speed while it is in scope
+class ClockHold {
+  public:
+    ClockHold() { clockHold(); }
+
+    ~ClockHold() { clockRelease(); }
+};
+
+#endif // CLOCKSCALING
@@ -0,0 +1,232 @@
+/// \file
+/// \brief Implementation of the crash log
+#include "CrashLog.h"
+
+#include "NumberFormat.h"
+#include "RequestWriter.h"
+#include "ResetReason.h"
+#include "platform/mbed_critical.h"
+#include "platform/mbed_error.h"
+
+#include <cctype>
+
+/// Marks the ring as written by this firmware, anything else in the RAM is
+/// what was there at power on
+#define CRASHLOGMAGIC (0xC7A5410Au)
+
+/// One begin or end of an operation
+struct CrashEvent {
+    /// the low 32 bits of Kernel::get_ms_count()
+    uint32_t Ms;
+    int32_t Value;
+    uint8_t Op;
+    uint8_t End;
+};
+
+/// Everything that has to survive the reset
+struct CrashLogData {
+    uint32_t Magic;
+
+    /// counts up with every event, the next one goes to Count %
+    /// CRASHLOGEVENTS
+    uint32_t Count;
+    CrashEvent Events[CRASHLOGEVENTS];
+
+    /// the thread that stopped checking in, empty if none did
+    char StallName[CRASHNAMEMAX];
+    uint32_t StallAge;
+    uint32_t StallMs;
+};
+
+/// The startup code only sets .data and clears .bss, so this keeps what the
+/// last boot wrote
+MBED_SECTION(".noinit") static CrashLogData Log;
+
+static const char *const OpNames[CRASHOPS] = {
+    "sample",      "backup",  "backlog-read", "backlog-delete",
+    "flash-queue", "connect", "send",         "ack",
+    "brownout"};
+
+/// the report of the last reset, empty if there is none
+static char Report[CRASHREPORTMAX + 1];
+
+/// true once the report was sent
+static bool Reported = true;
+
+// returns true if Log was written by this firmware before the reset
+static bool logValid() {
+    if (Log.Magic != CRASHLOGMAGIC) {
+        return false;
+    }
+    for (size_t i = 0; i < CRASHLOGEVENTS; ++i) {
+        if (Log.Events[i].Op >= CRASHOPS || Log.Events[i].End > 1) {
+            return false;
+        }
+    }
+    return Log.StallName[CRASHNAMEMAX - 1] == 0;
+}
+
+// the reason of the last reset, as one word
+static const char *resetName(bool Error) {
+    switch (ResetReason::get()) {
+    case RESET_REASON_WATCHDOG:
+        return "watchdog";
+    case RESET_REASON_SOFTWARE:
+        // mbed-os resets the board itself after a fatal error
+        return Error ? "error" : "software";
+    case RESET_REASON_LOCKUP:
+        return "lockup";
+    case RESET_REASON_PIN_RESET:
+        return "pin";
+    case RESET_REASON_BROWN_OUT:
+        return "brownout";
+    case RESET_REASON_POWER_ON:
+        return "power";
+    default:
+        return "other";
+    }
+}
+
+// appends Name with only the characters that can go into a URL
+static void appendName(RequestWriter &Text, const char *Name) {
+    for (; *Name != 0; ++Name) {
+        char c = *Name;
+        bool Safe = isalnum((unsigned char)c) || c == '-' || c == '_';
+        Text.append(Safe ? Name : "_", 1);
+    }
+}
+
+static void appendHex(RequestWriter &Text, uint32_t Value) {
+    char Digits[FORMATUNSIGNEDMAX + 1];
+    Text.append(Digits, formatHex(Digits, Value));
+}
+
+// appends ",op:value:ms" for each of the last events of a ring that had
+// Count events, the newest first, with how long before Last they were. A
+// full Text keeps the ones closest to Last
+static void appendEvents(RequestWriter &Text, const CrashEvent *Events,
+                         uint32_t Count, uint32_t Last) {
+    size_t Kept = Count < CRASHLOGEVENTS ? Count : CRASHLOGEVENTS;
+    for (size_t i = 0; i < Kept; ++i) {
+        const CrashEvent &Event = Events[(Count - 1 - i) % CRASHLOGEVENTS];
+        size_t Before = Text.length();
+        Text.append(",");
+        Text.append(OpNames[Event.Op]);
+        Text.append(Event.End ? "-end:" : ":");
+        if (Event.Value < 0) {
+            Text.append("-");
+            Text.appendUnsigned(-(uint32_t)Event.Value);
+        } else {
+            Text.appendUnsigned(Event.Value);
+        }
+        Text.append(":");
+        Text.appendUnsigned(Last - Event.Ms);
+        if (Text.overflowed()) {
+            Text.truncate(Before);
+            break;
+        }
+    }
+}
+
+// writes the report of the last boot into Report
+static void makeReport(bool Valid) {
+    mbed_error_ctx Error;
+    bool HasError = mbed_get_reboot_error_info(&Error) == MBED_SUCCESS;
+
+    // reason[,error:status:address][,stall:thread:ms][,op:value:ms...]
+    RequestWriter Text(Report, sizeof(Report));
+    Text.append(resetName(HasError));
+    if (HasError) {
+        // the address is where a fault happened, or who called mbed_error()
+        Text.append(",error:");
+        appendHex(Text, (uint32_t)Error.error_status);
+        Text.append(":");
+        appendHex(Text, Error.error_address);
+    }
+    if (!Valid) {
+        return;
+    }
+
+    // the events are timed back from the last thing that was seen
+    uint32_t Last = Log.StallName[0] != 0 ? Log.StallMs : 0;
+    size_t Kept = Log.Count < CRASHLOGEVENTS ? Log.Count : CRASHLOGEVENTS;
+    if (Kept > 0) {
+        uint32_t Newest = Log.Events[(Log.Count - 1) % CRASHLOGEVENTS].Ms;
+        if (Log.StallName[0] == 0 || (int32_t)(Newest - Last) > 0) {
+            Last = Newest;
+        }
+    }
+    if (Log.StallName[0] != 0) {
+        Text.append(",stall:");
+        appendName(Text, Log.StallName);
+        Text.append(":");
+        Text.appendUnsigned(Log.StallAge);
+    }
+
+    appendEvents(Text, Log.Events, Log.Count, Last);
+}
+
+// ============================================================================
+void crashLogStart() {
+    bool Valid = logValid();
+    Reported = ResetReason::get() == RESET_REASON_POWER_ON && !Valid;
+    if (!Reported) {
+        makeReport(Valid);
+    }
+
+    memset(&Log, 0, sizeof(Log));
+    Log.Magic = CRASHLOGMAGIC;
+}
+
+// writes one event into the ring
+static void addEvent(CrashOp Op, int32_t Value, bool End) {
+    uint32_t Now = (uint32_t)Kernel::get_ms_count();
+    core_util_critical_section_enter();
+    CrashEvent &Event = Log.Events[Log.Count++ % CRASHLOGEVENTS];
+    Event.Ms = Now;
+    Event.Value = Value;
+    Event.Op = Op;
+    Event.End = End;
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void crashLogBegin(CrashOp Op, int32_t Value) { addEvent(Op, Value, false); }
+
+// ============================================================================
+void crashLogEnd(CrashOp Op, int32_t Result) { addEvent(Op, Result, true); }
+
+// ============================================================================
+void crashLogStall(const char *Name, uint32_t AgeMs) {
+    if (Name == NULL) {
+        Log.StallName[0] = 0;
+        return;
+    }
+    strncpy(Log.StallName, Name, CRASHNAMEMAX - 1);
+    Log.StallName[CRASHNAMEMAX - 1] = 0;
+    Log.StallAge = AgeMs;
+    Log.StallMs = (uint32_t)Kernel::get_ms_count();
+}
+
+// ============================================================================
+const char *crashReport() { return Reported ? NULL : Report; }
+
+// ============================================================================
+void crashReportSent() {
+    if (!Reported) {
+        Reported = true;
+        // the next fatal error is reported on its own
+        mbed_reset_reboot_error_info();
+    }
+}
+
+// ============================================================================
+void crashLogRecent(RequestWriter &Text) {
+    // a copy, the other threads go on adding events
+    CrashEvent Events[CRASHLOGEVENTS];
+    core_util_critical_section_enter();
+    uint32_t Count = Log.Count;
+    memcpy(Events, Log.Events, sizeof(Events));
+    core_util_critical_section_exit();
+    appendEvents(Text, Events, Count, (uint32_t)Kernel::get_ms_count());
+}
@@ -0,0 +1,91 @@
+#ifndef CRASHLOG_H
+#define CRASHLOG_H
+/// \file
+/// \brief The last operations before a reset, kept in RAM that the startup
+/// code does not clear, and sent with the first upload after the reset.
+///
+/// crashLogBegin() and crashLogEnd() mark where the slow operations start and
+/// end, the AT commands, the SD card and the flash queue, in a ring of
+/// CRASHLOGEVENTS events in a ".noinit" section. A reset leaves the RAM as it
+/// was, so after the watchdog goes off the ring still shows which operation
+/// was running and for how long. The supervisor adds the thread that stopped
+/// checking in. A fault or a fatal error is taken from mbed-os's own crash
+/// capture, mbed_get_reboot_error_info(), which keeps its context in the
+/// crash data RAM of mbed_crash_data_offsets.h.
+///
+/// crashLogStart() turns what the last boot left into a line of text, before
+/// it starts the ring over. crashReport() returns it until crashReportSent()
+/// is called after a request that carried it was answered.
+
+#include "mbed.h"
+
+class RequestWriter;
+
+/// How many events the ring keeps
+#define CRASHLOGEVENTS (32)
+
+/// The longest crash report, in characters
+#define CRASHREPORTMAX (512)
+
+/// The longest thread name the supervisor keeps with a stall
+#define CRASHNAMEMAX (12)
+
+/// What an event marks
+enum CrashOp {
+    /// reading the ports out of the ADC frame
+    CrashSample,
+    /// writing a reading to the backup log
+    CrashBackup,
+    /// reading backed up readings
+    CrashBacklogRead,
+    /// marking backed up readings as sent
+    CrashBacklogDelete,
+    /// a TDBStore call of the flash queue, the value is a FlashQueueOp
+    CrashFlashQueue,
+    /// joining the access point
+    CrashConnect,
+    /// a request going out on a link, the value is the link
+    CrashSend,
+    /// waiting for a response on a link, the value is the link
+    CrashAck,
+    /// writing out what is in RAM as the supply falls, the value is the
+    /// number of the warning, see BrownOut.h
+    CrashBrownOut,
+    CRASHOPS
+};
+
+/// What the flash queue was doing, the value of a CrashFlashQueue event
+enum FlashQueueOp {
+    FlashQueueSet,
+    FlashQueueGet,
+    FlashQueueRemove,
+    FlashQueueCollect
+};
+
+/// Reads what the last boot left behind into the report, and starts the ring
+/// over. Called once, early in main()
+void crashLogStart();
+
+/// Marks the start of Op, with a value that tells more about it
+void crashLogBegin(CrashOp Op, int32_t Value = 0);
+
+/// Marks the end of Op, with its result
+void crashLogEnd(CrashOp Op, int32_t Result = 0);
+
+/// Keeps the thread that stopped checking in, called by the supervisor from
+/// its interrupt before it lets the watchdog go off
+void crashLogStall(const char *Name, uint32_t AgeMs);
+
+/// Returns the report of the last reset, or NULL if there is none or it was
+/// sent. It has only characters that can go into a URL query as they are
+const char *crashReport();
+
+/// Drops the report once the server has it
+void crashReportSent();
+
+/// Appends the events of this boot as the report has them,
+/// ",op:value:ms" with the newest first, timed back from now. Only as many
+/// as fit into Text
+void crashLogRecent(RequestWriter &Text);
+
+#endif // CRASHLOG
@@ -0,0 +1,63 @@
+/// \file
+/// \brief Implementation of the critical section report
+#include "CriticalStats.h"
+
+#if CRITICALSTATS
+
+#include "platform/mbed_stats.h"
+
+/// when criticalReport() last printed, from Kernel::get_ms_count()
+static uint64_t LastReport = 0;
+
+// the microseconds of Cycles core cycles
+static unsigned long cyclesUs(uint32_t Cycles) {
+    return (unsigned long)(Cycles / (SystemCoreClock / 1000000));
+}
+
+// prints one histogram on a line
+static void printHistogram(const char *Name, const uint32_t *Buckets) {
+    printf("%-8s", Name);
+    for (int i = 0; i < MBED_CRITICAL_STATS_BUCKETS; ++i) {
+        printf(" %7lu", (unsigned long)Buckets[i]);
+    }
+    printf("\r\n");
+}
+
+// ============================================================================
+void criticalReport() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (LastReport == 0) {
+        LastReport = Now;
+    }
+    if (Now - LastReport < CRITICALREPORTMS) {
+        return;
+    }
+    LastReport = Now;
+
+    mbed_stats_critical_t Stats;
+    mbed_stats_critical_get(&Stats, true);
+
+    printf("\r\ncritical %lu, longest %lu us from %p\r\n",
+           (unsigned long)Stats.count, cyclesUs(Stats.max_cycles),
+           Stats.max_caller);
+    if (Stats.blocked_count != 0) {
+        printf("held up an IRQ %lu, longest %lu us from %p, IRQ %ld\r\n",
+               (unsigned long)Stats.blocked_count,
+               cyclesUs(Stats.blocked_max_cycles), Stats.blocked_caller,
+               (long)Stats.blocked_irq);
+    }
+    if (Stats.irq_latency_count != 0) {
+        printf("IRQ latency %lu, longest %lu us\r\n",
+               (unsigned long)Stats.irq_latency_count,
+               cyclesUs(Stats.irq_latency_max_cycles));
+    }
+    printf("cycles  ");
+    for (int i = 0; i < MBED_CRITICAL_STATS_BUCKETS - 1; ++i) {
+        printf(" <%6lu", 64UL << (2 * i));
+    }
+    printf("    more\r\n");
+    printHistogram("critical", Stats.histogram);
+    printHistogram("latency", Stats.irq_latency_histogram);
+}
+
+#endif // CRITICALSTATS
@@ -0,0 +1,48 @@
+#ifndef CRITICALSTATS_H
+#define CRITICALSTATS_H
+/// \file
+/// \brief How long interrupts are kept off, and how long an interrupt waits
+/// to be taken, printed now and then.
+///
+/// With "platform.critical-stats-enabled" mbed_critical.c times every
+/// outermost critical section with the DWT cycle counter, and keeps the
+/// longest one with the address it was entered from. A section that ends
+/// with a device interrupt pending held that interrupt up, those are counted
+/// apart with the IRQ that waited. With "pc-profiler" as well, the SysTick
+/// handler measures its own entry latency against the hardware count down,
+/// which is how long any interrupt of the highest priority waits.
+/// Bucket i of a histogram holds the durations under 64 << (2 * i) cycles,
+/// see mbed_stats_critical_t. criticalReport() prints them every
+/// CRITICALREPORTMS and starts them over. The callers are printed as
+/// addresses, arm-none-eabi-addr2line -f with the firmware's .elf turns them
+/// into functions. Set with "critical-stats" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to print the critical section times. Set with "critical-stats"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_CRITICAL_STATS
+#define CRITICALSTATS MBED_CONF_APP_CRITICAL_STATS
+#else
+#define CRITICALSTATS 0
+#endif
+
+#if CRITICALSTATS && !defined(MBED_CRITICAL_STATS_ENABLED)
+#error "critical-stats needs platform.critical-stats-enabled set to 1"
+#endif
+
+/// How often criticalReport() prints the times, in milliseconds
+#define CRITICALREPORTMS (60000)
+
+#if CRITICALSTATS
+
+/// Prints the times once CRITICALREPORTMS have passed, and starts them over
+void criticalReport();
+
+#else
+
+inline void criticalReport() {}
+
+#endif // CRITICALSTATS
+
+#endif // CRITICALSTATS
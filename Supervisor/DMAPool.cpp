@@ -0,0 +1,39 @@
+/// \file
+/// \brief Implementation of the DMA buffer pool
+#include "DMAPool.h"
+
+#include "platform/mbed_critical.h"
+
+/// the pool, wherever the linker put it, it can cross SRAMUSTART itself
+MBED_ALIGN(8) static uint8_t Pool[DMAPOOLSIZE];
+
+/// the address of the first byte that was not handed out
+static uintptr_t Next = (uintptr_t)Pool;
+
+// ============================================================================
+void *dmaAlloc(size_t Size, size_t Align) {
+    core_util_critical_section_enter();
+    uintptr_t Start = (Next + Align - 1) & ~(uintptr_t)(Align - 1);
+    if (!dmaSafe((const void *)Start, Size)) {
+        Start = SRAMUSTART;
+    }
+    uintptr_t End = Start + Size;
+    bool Fits = End <= (uintptr_t)Pool + sizeof(Pool);
+    if (Fits) {
+        Next = End;
+    }
+    core_util_critical_section_exit();
+
+    if (!Fits) {
+        printf("The DMA pool has no %u bytes left, see dma-pool-size\r\n",
+               Size);
+        return NULL;
+    }
+    return (void *)Start;
+}
+
+// ============================================================================
+bool dmaSafe(const void *Buffer, size_t Size) {
+    uintptr_t Start = (uintptr_t)Buffer;
+    return Start >= SRAMUSTART || Start + Size <= SRAMUSTART;
+}
@@ -0,0 +1,37 @@
+#ifndef DMAPOOL_H
+#define DMAPOOL_H
+/// \file
+/// \brief The buffers that the eDMA drivers read and write, taken from a
+/// static pool so that none of them crosses from SRAM_L into SRAM_U.
+///
+/// The K64F's RAM is two blocks on two buses that meet at SRAMUSTART. A
+/// transfer or an unaligned access that runs over from one into the other
+/// faults, or quietly goes wrong. The heap, the stacks and .bss do not know
+/// about this, so a buffer in a driver object can end up across it. The
+/// drivers take their buffers from dmaAlloc() instead when they start, once,
+/// and keep them. A buffer that would cross is moved up to SRAMUSTART, so
+/// the DMA can work on it in place without copying it anywhere.
+
+#include "mbed.h"
+
+/// Where SRAM_U starts, SRAM_L ends right below it
+#define SRAMUSTART (0x20000000U)
+
+/// The bytes of the pool, enough for the ADC scan, the rings of the ESP8266
+/// and of the Modbus master, and the external ADC. Set with "dma-pool-size"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_DMA_POOL_SIZE
+#define DMAPOOLSIZE MBED_CONF_APP_DMA_POOL_SIZE
+#else
+#define DMAPOOLSIZE (8192)
+#endif
+
+/// Returns Size bytes aligned to Align, a power of two, that are all in
+/// SRAM_L or all in SRAM_U, or NULL if the pool does not have them. The
+/// buffers are never given back
+void *dmaAlloc(size_t Size, size_t Align);
+
+/// Returns true if the Size bytes at Buffer do not cross SRAMUSTART
+bool dmaSafe(const void *Buffer, size_t Size);
+
+#endif // DMAPOOL
@@ -0,0 +1,131 @@
+/// \file
+/// \brief Implementation of the deadlines of the periodic tasks
+#define TRACE_GROUP "dead"
+#include "DeadlineMonitor.h"
+
+#if DEADLINEMONITOR
+
+#include "DeferredLog.h"
+
+/// The misses of one task
+struct DeadlineStats {
+    uint64_t DueMs;    ///< when the round is due, 0 if it has no deadline
+    uint32_t Misses;   ///< since the start
+    uint32_t Reported; ///< Misses at the last report
+    uint32_t LastAt;   ///< the time(NULL) of the last miss
+    uint32_t LastLate; ///< how many milliseconds late it was
+    uint32_t MostLate; ///< the most milliseconds late since the start
+};
+
+static const char *const TaskNames[DeadlineTasks] = {"sample",
+                                                     "housekeeping"};
+
+/// taken around everything below, the sampler and the uploader both end
+/// rounds
+static Mutex DeadlineLock;
+
+static DeadlineStats Tasks[DeadlineTasks];
+
+/// when the last DEADLINESHEDMISSES misses were, a ring of
+/// Kernel::get_ms_count() times
+static uint64_t MissMs[DEADLINESHEDMISSES];
+static size_t MissNext = 0;
+
+static bool Shedding = false;
+
+// starts or ends the shedding, DeadlineLock is held
+static void shed(bool On) {
+    if (On == Shedding) {
+        return;
+    }
+    Shedding = On;
+    logQuiet(On);
+    if (On) {
+        tr_warn("%d deadlines were missed within %d s, the backlog and the "
+                "reports wait",
+                DEADLINESHEDMISSES, DEADLINESHEDWINDOWMS / 1000);
+    } else {
+        tr_warn("No deadline was missed for %d s, the backlog and the "
+                "reports go on",
+                DEADLINECALMMS / 1000);
+    }
+}
+
+// ============================================================================
+void deadlineRan(DeadlineTask Task, uint32_t PeriodMs) {
+    uint64_t Now = Kernel::get_ms_count();
+    DeadlineLock.lock();
+    DeadlineStats &Stats = Tasks[Task];
+    if (Stats.DueMs != 0 && Now > Stats.DueMs + DEADLINESLACKMS) {
+        uint64_t Late = Now - Stats.DueMs;
+        ++Stats.Misses;
+        Stats.LastAt = time(NULL);
+        Stats.LastLate = Late > UINT32_MAX ? UINT32_MAX : (uint32_t)Late;
+        if (Stats.LastLate > Stats.MostLate) {
+            Stats.MostLate = Stats.LastLate;
+        }
+
+        // the oldest of the last misses is the one that is overwritten
+        uint64_t Oldest = MissMs[MissNext];
+        MissMs[MissNext] = Now;
+        MissNext = (MissNext + 1) % DEADLINESHEDMISSES;
+        if (Oldest != 0 && Now - Oldest <= DEADLINESHEDWINDOWMS) {
+            shed(true);
+        }
+    }
+    Stats.DueMs = Now + PeriodMs;
+    DeadlineLock.unlock();
+}
+
+// ============================================================================
+void deadlineRestart(DeadlineTask Task) {
+    DeadlineLock.lock();
+    Tasks[Task].DueMs = 0;
+    DeadlineLock.unlock();
+}
+
+// ============================================================================
+uint32_t deadlineMisses() {
+    uint32_t Misses = 0;
+    DeadlineLock.lock();
+    for (int i = 0; i < DeadlineTasks; ++i) {
+        Misses += Tasks[i].Misses;
+    }
+    DeadlineLock.unlock();
+    return Misses;
+}
+
+// ============================================================================
+bool deadlineShedding() {
+    DeadlineLock.lock();
+    if (Shedding) {
+        uint64_t Last = MissMs[(MissNext + DEADLINESHEDMISSES - 1) %
+                               DEADLINESHEDMISSES];
+        if (Kernel::get_ms_count() - Last >= DEADLINECALMMS) {
+            shed(false);
+        }
+    }
+    bool On = Shedding;
+    DeadlineLock.unlock();
+    return On;
+}
+
+// ============================================================================
+void deadlineReport() {
+    DeadlineLock.lock();
+    for (int i = 0; i < DeadlineTasks; ++i) {
+        DeadlineStats &Stats = Tasks[i];
+        if (Stats.Misses == Stats.Reported) {
+            continue;
+        }
+        tr_warn("The %s task missed %lu deadlines, %lu in all, the last at "
+                "%lu by %lu ms, at most by %lu ms",
+                TaskNames[i], (unsigned long)(Stats.Misses - Stats.Reported),
+                (unsigned long)Stats.Misses, (unsigned long)Stats.LastAt,
+                (unsigned long)Stats.LastLate, (unsigned long)Stats.MostLate);
+        Stats.Reported = Stats.Misses;
+    }
+    DeadlineLock.unlock();
+}
+
+#endif // DEADLINEMONITOR
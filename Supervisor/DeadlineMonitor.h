@@ -0,0 +1,90 @@
+#ifndef DEADLINEMONITOR_H
+#define DEADLINEMONITOR_H
+/// \file
+/// \brief The deadlines of the periodic tasks, how often they were missed,
+/// and the work that is put off while they are.
+///
+/// The sampler starts the next reading over when one ran longer than its
+/// interval, and the time that was lost went unseen. Each periodic task
+/// calls deadlineRan() where it ends a round, with the period of the next
+/// one, and a round that ends more than DEADLINESLACKMS after its period
+/// missed its deadline. The misses of each task are counted and the last
+/// one is kept with its time and how late it was. deadlineReport() prints
+/// the tasks that missed since the last report, and the stats command of
+/// RemoteShell.h answers with the count.
+///
+/// Once DEADLINESHEDMISSES misses, of any task, come within
+/// DEADLINESHEDWINDOWMS, deadlineShedding() is true until DEADLINECALMMS
+/// pass without one. While it is, the work that can wait gives way to the
+/// sampler:
+/// - the log only keeps warnings and errors, see logQuiet()
+/// - the backlog is not sent, the new readings still are
+/// - the reports of the profilers and meters are not printed
+///
+/// Set with "deadline-monitor" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to count the missed deadlines and put work off under overload.
+/// Set with "deadline-monitor" in mbed_app.json.
+#ifdef MBED_CONF_APP_DEADLINE_MONITOR
+#define DEADLINEMONITOR MBED_CONF_APP_DEADLINE_MONITOR
+#else
+#define DEADLINEMONITOR 0
+#endif
+
+/// How much later than its period a round may end, in milliseconds
+#define DEADLINESLACKMS (500)
+
+/// How many misses within DEADLINESHEDWINDOWMS start the shedding
+#define DEADLINESHEDMISSES (3)
+
+/// The time the DEADLINESHEDMISSES misses have to come in, in milliseconds
+#define DEADLINESHEDWINDOWMS (60000)
+
+/// How long the shedding goes on after the last miss, in milliseconds
+#define DEADLINECALMMS (300000)
+
+/// The periodic tasks that have a deadline
+enum DeadlineTask {
+    DeadlineSample,       ///< the sampler takes a reading
+    DeadlineHousekeeping, ///< the uploader's housekeeping event
+    DeadlineTasks
+};
+
+#if DEADLINEMONITOR
+
+/// Ends a round of Task and checks it against the deadline of the round
+/// before. The next round is due PeriodMs from now. Any thread can call
+/// this, not an interrupt handler
+void deadlineRan(DeadlineTask Task, uint32_t PeriodMs);
+
+/// Forgets the deadline of Task, for a pause that was meant. The next
+/// deadlineRan() has no deadline to miss
+void deadlineRestart(DeadlineTask Task);
+
+/// Returns how many deadlines all the tasks missed since the start
+uint32_t deadlineMisses();
+
+/// Returns true while the work that can wait is put off
+bool deadlineShedding();
+
+/// Prints the misses of the tasks that missed since the last report, only
+/// the uploader thread calls this
+void deadlineReport();
+
+#else
+
+inline void deadlineRan(DeadlineTask Task, uint32_t PeriodMs) {}
+
+inline void deadlineRestart(DeadlineTask Task) {}
+
+inline uint32_t deadlineMisses() { return 0; }
+
+inline bool deadlineShedding() { return false; }
+
+inline void deadlineReport() {}
+
+#endif // DEADLINEMONITOR
+
+#endif // DEADLINEMONITOR
@@ -0,0 +1,209 @@
+/// \file
+/// \brief Implementation of the deferred log
+#include "DeferredLog.h"
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+
+#include "SPSCRing.h"
+
+/// The lines that wait to be printed, ended with "\r\n". mbed-trace holds
+/// LogLock while it prints a line, so there is only one producer at a time
+static SPSCRing<char, LOGRINGLEN> Ring;
+
+/// taken by mbed-trace around each line, its line buffer is shared
+static Mutex LogLock;
+
+/// tells the log thread that there are lines in the ring
+static EventFlags LogFlags;
+#define LOGWAITING (1)
+
+/// how many lines can be kept right now, the rate adds one every
+/// 1000 / LOGRATE milliseconds up to LOGBURST
+static uint32_t Tokens = LOGBURST;
+static uint64_t LastToken = 0;
+
+static uint32_t Dropped = 0;
+
+/// a group that is logged at a level of its own
+struct GroupLevel {
+    char Name[LOGGROUPLEN];
+    uint8_t Level;
+};
+
+/// the levels set by logLevel(), only used with LogLock held
+static GroupLevel Groups[LOGGROUPS];
+static size_t GroupCount = 0;
+static uint8_t DefaultLevel = TRACE_ACTIVE_LEVEL_ALL;
+
+/// set by logQuiet(), only used with LogLock held
+static bool Quiet = false;
+
+static Thread LogThread(osPriorityLow, LOGSTACKSIZE, NULL, "log");
+
+static void lockLog() { LogLock.lock(); }
+
+static void unlockLog() { LogLock.unlock(); }
+
+// returns true if the rate lets another line in, LogLock is held
+static bool takeToken() {
+    uint64_t Now = Kernel::get_ms_count();
+    uint64_t Earned = (Now - LastToken) * LOGRATE / 1000;
+    if (Earned > 0) {
+        Tokens = Tokens + Earned > LOGBURST ? LOGBURST : Tokens + Earned;
+        LastToken += Earned * 1000 / LOGRATE;
+    }
+    if (Tokens == 0) {
+        return false;
+    }
+    --Tokens;
+    return true;
+}
+
+// returns true if the group of Line, "[INFO][net ]: ..." and the like, is
+// kept at the level of Line. LogLock is held
+static bool groupKeeps(const char *Line) {
+    if (GroupCount == 0 || Line[0] != '[' || strncmp(Line + 5, "][", 2)) {
+        return true;
+    }
+    uint8_t Bit = TRACE_LEVEL_CMD;
+    switch (Line[1]) {
+    case 'E':
+        Bit = TRACE_LEVEL_ERROR;
+        break;
+    case 'W':
+        Bit = TRACE_LEVEL_WARN;
+        break;
+    case 'I':
+        Bit = TRACE_LEVEL_INFO;
+        break;
+    case 'D':
+        Bit = TRACE_LEVEL_DEBUG;
+        break;
+    }
+    const char *Name = Line + 7;
+    const char *End = strchr(Name, ']');
+    if (End == NULL) {
+        return true;
+    }
+    size_t Length = End - Name;
+    while (Length > 0 && Name[Length - 1] == ' ') {
+        --Length;
+    }
+    uint8_t Level = DefaultLevel;
+    for (size_t i = 0; i < GroupCount; ++i) {
+        if (strlen(Groups[i].Name) == Length &&
+            strncmp(Groups[i].Name, Name, Length) == 0) {
+            Level = Groups[i].Level;
+        }
+    }
+    return (Level & Bit) != 0;
+}
+
+// mbed-trace's print function, it runs on the thread that logs
+static void keepLine(const char *Line) {
+    if (!groupKeeps(Line)) {
+        return;
+    }
+    size_t Length = strlen(Line);
+    if (!takeToken() || Ring.capacity() - Ring.size() < Length + 2) {
+        core_util_atomic_incr_u32(&Dropped, 1);
+        return;
+    }
+    Ring.push_n(Line, Length);
+    Ring.push_n("\r\n", 2);
+    LogFlags.set(LOGWAITING);
+}
+
+// prints the ring whenever there is something in it
+static void printLog() {
+    uint32_t Reported = 0;
+    while (true) {
+        LogFlags.wait_any(LOGWAITING);
+
+        // the span ends at the end of the buffer, the rest comes next time
+        for (Span<const char> Lines = Ring.peek(); !Lines.empty();
+             Lines = Ring.peek()) {
+            fwrite(Lines.data(), 1, Lines.size(), stdout);
+            Ring.consume(Lines.size());
+        }
+        fflush(stdout);
+
+        uint32_t Now = core_util_atomic_load_u32(&Dropped);
+        if (Now != Reported) {
+            printf("(%lu log lines were dropped)\r\n",
+                   (unsigned long)(Now - Reported));
+            Reported = Now;
+        }
+    }
+}
+
+// has mbed-trace format every line that one of the groups keeps, LogLock
+// is held
+static void applyLevels() {
+    uint8_t Any = DefaultLevel;
+    for (size_t i = 0; i < GroupCount; ++i) {
+        Any |= Groups[i].Level;
+    }
+    if (Quiet) {
+        Any &= TRACE_ACTIVE_LEVEL_WARN;
+    }
+    mbed_trace_config_set((mbed_trace_config_get() & ~TRACE_MASK_LEVEL) | Any);
+}
+
+// ============================================================================
+void startLog() {
+    mbed_trace_buffer_sizes(LOGLINEMAX, LOGLINEMAX);
+    if (mbed_trace_init() != 0) {
+        printf("There is no room for the log's line buffers\r\n");
+        return;
+    }
+    mbed_trace_config_set(TRACE_ACTIVE_LEVEL_ALL);
+    mbed_trace_mutex_wait_function_set(lockLog);
+    mbed_trace_mutex_release_function_set(unlockLog);
+    mbed_trace_print_function_set(keepLine);
+
+    LastToken = Kernel::get_ms_count();
+    LogThread.start(printLog);
+}
+
+// ============================================================================
+uint32_t logDropped() { return core_util_atomic_load_u32(&Dropped); }
+
+// ============================================================================
+bool logLevel(const char *Group, uint8_t Level) {
+    bool Set = true;
+    LogLock.lock();
+    if (Group == NULL) {
+        DefaultLevel = Level;
+        GroupCount = 0;
+    } else {
+        size_t i = 0;
+        while (i < GroupCount && strcmp(Groups[i].Name, Group) != 0) {
+            ++i;
+        }
+        if (i == GroupCount && GroupCount < LOGGROUPS) {
+            strncpy(Groups[i].Name, Group, LOGGROUPLEN - 1);
+            Groups[i].Name[LOGGROUPLEN - 1] = 0;
+            ++GroupCount;
+        }
+        if (i < GroupCount) {
+            Groups[i].Level = Level;
+        } else {
+            Set = false;
+        }
+    }
+
+    applyLevels();
+    LogLock.unlock();
+    return Set;
+}
+
+// ============================================================================
+void logQuiet(bool On) {
+    LogLock.lock();
+    Quiet = On;
+    applyLevels();
+    LogLock.unlock();
+}
+
+#endif // MBED_CONF_MBED_TRACE_ENABLE
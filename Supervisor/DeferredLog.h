@@ -0,0 +1,101 @@
+#ifndef DEFERREDLOG_H
+#define DEFERREDLOG_H
+/// \file
+/// \brief Log lines that are written to a RAM ring and printed later by a
+/// low priority thread.
+///
+/// The lines are made with mbed-trace's tr_debug(), tr_info(), tr_warn() and
+/// tr_error(), with the TRACE_GROUP of the file they are in. Levels above
+/// MBED_TRACE_MAX_LEVEL, set with "macros" in mbed_app.json, are not even
+/// compiled in. startLog() hands mbed-trace a print function that only
+/// copies the finished line into a ring of LOGRINGLEN bytes, so a line costs
+/// its formatting and not the milliseconds the UART takes at the stdio baud
+/// rate. The log thread prints the ring whenever the CPU has nothing better
+/// to do. At most LOGRATE lines a second are kept, with bursts of up to
+/// LOGBURST, and lines that do not fit are dropped and counted instead of
+/// waiting. Nothing may be logged from an interrupt handler, mbed-trace
+/// takes a mutex.
+///
+/// A file that logs defines TRACE_GROUP before it includes this header.
+///
+/// logLevel() changes which lines are kept while the board runs, for all of
+/// them or for up to LOGGROUPS groups apart. mbed-trace leaves out the lines
+/// that no group wants before it formats them, the levels of the groups are
+/// checked on the finished line.
+///
+/// With "mbed-trace.enable" at 0 in mbed_app.json there are no lines, and
+/// the ring, the thread and the lock are not built in at all.
+
+#include "mbed.h"
+
+#include "mbed-trace/mbed_trace.h"
+
+/// Set to 1 to echo every AT command and response of the ESP8266. They are
+/// printed by ATCmdParser as they go, which blocks, so it is only for
+/// bringing up a board. Set with "log-at-commands" in mbed_app.json.
+#ifdef MBED_CONF_APP_LOG_AT_COMMANDS
+#define LOGATCOMMANDS MBED_CONF_APP_LOG_AT_COMMANDS
+#else
+#define LOGATCOMMANDS 0
+#endif
+
+/// How many bytes of lines wait for the log thread, a power of two
+#define LOGRINGLEN (2048)
+
+/// The longest line, with its level and group, longer ones are cut off
+#define LOGLINEMAX (128)
+
+/// How many lines a second are kept, over a longer time
+#define LOGRATE (10)
+
+/// How many lines can come in at once before the rate applies
+#define LOGBURST (32)
+
+/// How many groups can have a level of their own
+#define LOGGROUPS (8)
+
+/// The longest group name with a level of its own, with the '\0'
+#define LOGGROUPLEN (8)
+
+/// The stack size of the log thread.
+/// Set with "log-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_LOG_STACK_SIZE
+#define LOGSTACKSIZE MBED_CONF_APP_LOG_STACK_SIZE
+#else
+#define LOGSTACKSIZE (1536)
+#endif
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+
+/// Starts mbed-trace and the thread that prints the log. The lines that are
+/// logged before are dropped
+void startLog();
+
+/// Returns how many lines were dropped since the start, because of the rate
+/// or because the ring was full
+uint32_t logDropped();
+
+/// Keeps the lines of Group at Level and above from now on, Level is one of
+/// mbed-trace's TRACE_ACTIVE_LEVEL_ values. A Group of NULL sets the level
+/// of all groups, and drops the levels that groups had of their own.
+/// \returns false if LOGGROUPS groups have a level of their own already
+bool logLevel(const char *Group, uint8_t Level);
+
+/// Keeps only the warnings and errors while Quiet, whatever the levels of
+/// logLevel() are, and goes back to them after. The lines that are left out
+/// are not even formatted
+void logQuiet(bool Quiet);
+
+#else
+
+inline void startLog() {}
+
+inline uint32_t logDropped() { return 0; }
+
+inline bool logLevel(const char *Group, uint8_t Level) { return true; }
+
+inline void logQuiet(bool Quiet) {}
+
+#endif // MBED_CONF_MBED_TRACE_ENABLE
+
+#endif // DEFERREDLOG
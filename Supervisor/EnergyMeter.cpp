@@ -0,0 +1,124 @@
+/// \file
+/// \brief Implementation of the energy meter
+#include "EnergyMeter.h"
+
+#if ENERGYMETER
+
+#include "hal/lp_ticker_api.h"
+#include "hal/ticker_api.h"
+#include "platform/mbed_atomic.h"
+#include "platform/mbed_critical.h"
+#include "platform/mbed_stats.h"
+
+/// whether each part is on, since when, and how long it was on since the
+/// last report. Only changed in a critical section
+static bool On[EnergyParts];
+static uint64_t Since[EnergyParts];
+static uint64_t OnUs[EnergyParts];
+
+/// the readings that were uploaded since the last report
+static volatile uint32_t Uploaded = 0;
+
+/// the CPU times at the last report
+static mbed_stats_cpu_t LastCpu;
+
+/// the result of the last report
+static uint32_t PerSample = 0;
+
+/// when energyReport() last printed, from Kernel::get_ms_count()
+static uint64_t LastReport = 0;
+
+static const char *const PartNames[EnergyParts] = {"esp8266", "sd", "adc"};
+static const uint32_t PartUa[EnergyParts] = {ENERGYESPUA, ENERGYSDUA,
+                                             ENERGYADCUA};
+
+// the microjoules of Us microseconds at Ua microamps
+static uint64_t microjoules(uint64_t Us, uint32_t Ua) {
+    return Us * Ua / 1000 * ENERGYSUPPLYMV / 1000000;
+}
+
+// ============================================================================
+void energyActive(EnergyPart Part, bool Active) {
+    uint64_t Now = ticker_read_us(get_lp_ticker_data());
+    core_util_critical_section_enter();
+    if (On[Part] != Active) {
+        if (!Active) {
+            OnUs[Part] += Now - Since[Part];
+        }
+        On[Part] = Active;
+        Since[Part] = Now;
+    }
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void energyUploaded(size_t Readings) {
+    core_util_atomic_incr_u32(&Uploaded, Readings);
+}
+
+// ============================================================================
+uint32_t energyPerSample() { return PerSample; }
+
+// ============================================================================
+void energyReport() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (LastReport == 0) {
+        // the boot, up to here, is not part of any window
+        LastReport = Now;
+        mbed_stats_cpu_get(&LastCpu);
+        return;
+    }
+    if (Now - LastReport < ENERGYREPORTMS) {
+        return;
+    }
+    LastReport = Now;
+
+    // the parts that are on now are counted up to here
+    uint64_t Us[EnergyParts];
+    uint64_t Tick = ticker_read_us(get_lp_ticker_data());
+    core_util_critical_section_enter();
+    for (int i = 0; i < EnergyParts; ++i) {
+        if (On[i]) {
+            OnUs[i] += Tick - Since[i];
+            Since[i] = Tick;
+        }
+        Us[i] = OnUs[i];
+        OnUs[i] = 0;
+    }
+    uint32_t Readings = Uploaded;
+    Uploaded = 0;
+    core_util_critical_section_exit();
+
+    mbed_stats_cpu_t Cpu;
+    mbed_stats_cpu_get(&Cpu);
+    uint64_t Sleep = Cpu.sleep_time - LastCpu.sleep_time;
+    uint64_t Deep = Cpu.deep_sleep_time - LastCpu.deep_sleep_time;
+    uint64_t Up = Cpu.uptime - LastCpu.uptime;
+    uint64_t Run = Up > Sleep + Deep ? Up - (Sleep + Deep) : 0;
+    LastCpu = Cpu;
+
+    uint64_t Total = microjoules(Run, ENERGYRUNUA) +
+                     microjoules(Sleep, ENERGYSLEEPUA) +
+                     microjoules(Deep, ENERGYDEEPSLEEPUA);
+    printf("\r\nenergy over %lu s, %lu readings uploaded\r\n",
+           (unsigned long)(Up / 1000000), (unsigned long)Readings);
+    printf("%-10s %9lu ms %10lu uJ\r\n", "run", (unsigned long)(Run / 1000),
+           (unsigned long)microjoules(Run, ENERGYRUNUA));
+    printf("%-10s %9lu ms %10lu uJ\r\n", "sleep",
+           (unsigned long)(Sleep / 1000),
+           (unsigned long)microjoules(Sleep, ENERGYSLEEPUA));
+    printf("%-10s %9lu ms %10lu uJ\r\n", "deep sleep",
+           (unsigned long)(Deep / 1000),
+           (unsigned long)microjoules(Deep, ENERGYDEEPSLEEPUA));
+    for (int i = 0; i < EnergyParts; ++i) {
+        uint64_t Part = microjoules(Us[i], PartUa[i]);
+        Total += Part;
+        printf("%-10s %9lu ms %10lu uJ\r\n", PartNames[i],
+               (unsigned long)(Us[i] / 1000), (unsigned long)Part);
+    }
+    PerSample = Readings == 0 ? 0 : (uint32_t)(Total / Readings);
+    printf("%-10s %24lu uJ, %lu uJ per reading\r\n", "total",
+           (unsigned long)Total, (unsigned long)PerSample);
+}
+
+#endif // ENERGYMETER
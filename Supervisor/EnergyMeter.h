@@ -0,0 +1,130 @@
+#ifndef ENERGYMETER_H
+#define ENERGYMETER_H
+/// \file
+/// \brief Where the energy of a battery site goes, worked out from how long
+/// each part was on, per reading that reached the server.
+///
+/// Nothing on the board measures its own current, so the meter counts time
+/// instead. mbed_stats_cpu_get() has how long the core ran, slept and was
+/// in deep sleep, and the drivers mark when the ESP8266 is awake, when the
+/// SD card moves blocks and when the ADC scan runs with energyActive(). The
+/// parts are timed on the low power ticker, which goes on in deep sleep.
+/// Each time is multiplied with the current that part draws, set in
+/// mbed_app.json from the data sheets or from a meter on the supply, and
+/// with ENERGYSUPPLYMV. energyReport() prints the microjoules of each part
+/// every ENERGYREPORTMS, and what that comes to per reading that was
+/// uploaded in that time, energyUploaded() counts them. A larger batch or
+/// a longer sleep of the ESP8266 should bring the last number down, this is
+/// what they are tuned by. Set with "energy-meter" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to print where the energy goes. Set with "energy-meter" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_METER
+#define ENERGYMETER MBED_CONF_APP_ENERGY_METER
+#else
+#define ENERGYMETER 0
+#endif
+
+#if ENERGYMETER && !defined(MBED_CPU_STATS_ENABLED)
+#error "energy-meter needs platform.cpu-stats-enabled set to 1"
+#endif
+
+/// The supply voltage, in millivolts. Set with "energy-supply-mv" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_SUPPLY_MV
+#define ENERGYSUPPLYMV MBED_CONF_APP_ENERGY_SUPPLY_MV
+#else
+#define ENERGYSUPPLYMV (3300)
+#endif
+
+/// What the board draws while the core runs, in microamps. Set with
+/// "energy-run-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_RUN_UA
+#define ENERGYRUNUA MBED_CONF_APP_ENERGY_RUN_UA
+#else
+#define ENERGYRUNUA (40000)
+#endif
+
+/// What the board draws while the core sleeps, in microamps. Set with
+/// "energy-sleep-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_SLEEP_UA
+#define ENERGYSLEEPUA MBED_CONF_APP_ENERGY_SLEEP_UA
+#else
+#define ENERGYSLEEPUA (15000)
+#endif
+
+/// What the board draws in deep sleep, in microamps. Set with
+/// "energy-deep-sleep-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_DEEP_SLEEP_UA
+#define ENERGYDEEPSLEEPUA MBED_CONF_APP_ENERGY_DEEP_SLEEP_UA
+#else
+#define ENERGYDEEPSLEEPUA (1000)
+#endif
+
+/// What the ESP8266 draws while it is awake, in microamps. Set with
+/// "energy-esp-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_ESP_UA
+#define ENERGYESPUA MBED_CONF_APP_ENERGY_ESP_UA
+#else
+#define ENERGYESPUA (80000)
+#endif
+
+/// What the SD card draws while it moves blocks, in microamps. Set with
+/// "energy-sd-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_SD_UA
+#define ENERGYSDUA MBED_CONF_APP_ENERGY_SD_UA
+#else
+#define ENERGYSDUA (50000)
+#endif
+
+/// What the ADCs and the external ADC draw while the scan runs, in
+/// microamps. Set with "energy-adc-ua" in mbed_app.json.
+#ifdef MBED_CONF_APP_ENERGY_ADC_UA
+#define ENERGYADCUA MBED_CONF_APP_ENERGY_ADC_UA
+#else
+#define ENERGYADCUA (2000)
+#endif
+
+/// How often energyReport() prints, in milliseconds
+#define ENERGYREPORTMS (600000)
+
+/// The parts that are timed apart from the core
+enum EnergyPart {
+    EnergyESP, ///< the ESP8266 is awake
+    EnergySD,  ///< the SD card moves blocks
+    EnergyADC, ///< the ADC scan runs
+    EnergyParts
+};
+
+#if ENERGYMETER
+
+/// Marks Part as on or off from now on. Marking it the way it already is
+/// changes nothing, any thread can call this
+void energyActive(EnergyPart Part, bool Active);
+
+/// Counts Readings more readings as uploaded
+void energyUploaded(size_t Readings);
+
+/// Returns the microjoules per uploaded reading of the last report, 0 if
+/// no reading was uploaded in its time
+uint32_t energyPerSample();
+
+/// Prints the energy once ENERGYREPORTMS have passed and starts it over,
+/// only the uploader thread calls this
+void energyReport();
+
+#else
+
+inline void energyActive(EnergyPart Part, bool Active) {}
+
+inline void energyUploaded(size_t Readings) {}
+
+inline uint32_t energyPerSample() { return 0; }
+
+inline void energyReport() {}
+
+#endif // ENERGYMETER
+
+#endif // ENERGYMETER
@@ -0,0 +1,50 @@
+/// \file
+/// \brief Implementation of the flash cache set up
+#include "FlashCache.h"
+
+#if FLASHCACHE
+
+/// The FMC's cache replacement control for FLASHCACHEWAYS instruction ways
+#if FLASHCACHEWAYS == 2
+#define FLASHCACHECRC (2)
+#elif FLASHCACHEWAYS == 3
+#define FLASHCACHECRC (3)
+#else
+#define FLASHCACHECRC (0)
+#endif
+
+/// The prefetch and cache bits of a bank, in the same places for both
+#define FLASHBANKBITS                                                          \
+    (FMC_PFB0CR_B0SEBE_MASK | FMC_PFB0CR_B0IPE_MASK | FMC_PFB0CR_B0DPE_MASK |  \
+     FMC_PFB0CR_B0ICE_MASK | FMC_PFB0CR_B0DCE_MASK)
+
+// ============================================================================
+RAMFUNC void configureFlashCache() {
+    uint32_t Bank = FLASHBANKBITS;
+    if (!FLASHDATAPREFETCH) {
+        Bank &= ~FMC_PFB0CR_B0DPE_MASK;
+    }
+
+    // nothing may fetch from the flash while the ways change, so with
+    // "ram-functions" this runs from SRAM_L and calls nothing in here
+    uint32_t Primask = __get_PRIMASK();
+    __disable_irq();
+    FMC->PFB0CR = (FMC->PFB0CR & ~(FMC_PFB0CR_CRC_MASK | FLASHBANKBITS)) |
+                  FMC_PFB0CR_CRC(FLASHCACHECRC) | Bank |
+                  FMC_PFB0CR_CINV_WAY(0xF) | FMC_PFB0CR_S_B_INV_MASK;
+    FMC->PFB1CR = (FMC->PFB1CR & ~FLASHBANKBITS) | Bank;
+    __DSB();
+    __ISB();
+    __set_PRIMASK(Primask);
+
+    if (FLASHCACHEWAYS == 4) {
+        printf("Flash cache: ways shared, data prefetch %s\r\n",
+               FLASHDATAPREFETCH ? "on" : "off");
+    } else {
+        printf("Flash cache: %d of 4 ways for instructions, data prefetch "
+               "%s\r\n",
+               FLASHCACHEWAYS, FLASHDATAPREFETCH ? "on" : "off");
+    }
+}
+
+#endif // FLASHCACHE
@@ -0,0 +1,80 @@
+#ifndef FLASHCACHE_H
+#define FLASHCACHE_H
+/// \file
+/// \brief Code that runs from SRAM_L, and how the K64F's flash memory
+/// controller caches and prefetches the rest.
+///
+/// The flash needs wait states at the core clock, and the FMC has only four
+/// ways of cache that the interrupt handlers share with newlib and FatFs. A
+/// function marked RAMFUNC goes into .data.ramfunc, which the .data rule of
+/// the GCC_ARM linker script puts into m_data in SRAM_L, on the code bus.
+/// The startup code copies it there with the rest of .data, so it takes no
+/// wait states and no cache lines. Other toolchains leave it in flash. Set
+/// with "ram-functions" in mbed_app.json.
+///
+/// configureFlashCache() splits the cache ways between instructions and
+/// data, and turns the data prefetch on or off, before anything else runs.
+/// Set with "flash-cache" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to run the functions marked RAMFUNC from SRAM_L. Set with
+/// "ram-functions" in mbed_app.json.
+#ifdef MBED_CONF_APP_RAM_FUNCTIONS
+#define RAMFUNCTIONS MBED_CONF_APP_RAM_FUNCTIONS
+#else
+#define RAMFUNCTIONS 0
+#endif
+
+/// Set to 1 to set up the flash cache at boot. Set with "flash-cache" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_FLASH_CACHE
+#define FLASHCACHE MBED_CONF_APP_FLASH_CACHE
+#else
+#define FLASHCACHE 0
+#endif
+
+/// How many of the four cache ways only hold instructions, 2 or 3, the
+/// others only hold data. 4 has all ways hold both, as after a reset. Set
+/// with "flash-cache-ways" in mbed_app.json.
+#ifdef MBED_CONF_APP_FLASH_CACHE_WAYS
+#define FLASHCACHEWAYS MBED_CONF_APP_FLASH_CACHE_WAYS
+#else
+#define FLASHCACHEWAYS (3)
+#endif
+
+/// Set to 1 to prefetch data from the flash too, not only instructions. Set
+/// with "flash-data-prefetch" in mbed_app.json.
+#ifdef MBED_CONF_APP_FLASH_DATA_PREFETCH
+#define FLASHDATAPREFETCH MBED_CONF_APP_FLASH_DATA_PREFETCH
+#else
+#define FLASHDATAPREFETCH 0
+#endif
+
+#if FLASHCACHE && FLASHCACHEWAYS != 2 && FLASHCACHEWAYS != 3 &&              \
+    FLASHCACHEWAYS != 4
+#error "flash-cache-ways needs to be 2, 3 or 4"
+#endif
+
+/// Marks a function that runs from SRAM_L. It is never inlined into code in
+/// flash, and is called with a long call, as SRAM_L is too far from the
+/// flash for a branch
+#if RAMFUNCTIONS && defined(__GNUC__) && !defined(__ARMCC_VERSION)
+#define RAMFUNC __attribute__((section(".data.ramfunc"), long_call, noinline))
+#else
+#define RAMFUNC
+#endif
+
+#if FLASHCACHE
+
+/// Sets up the cache ways and the prefetch of both flash banks, and empties
+/// the cache. Called first thing in main()
+void configureFlashCache();
+
+#else
+
+inline void configureFlashCache() {}
+
+#endif // FLASHCACHE
+
+#endif // FLASHCACHE
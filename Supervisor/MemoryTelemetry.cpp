@@ -0,0 +1,96 @@
+/// \file
+/// \brief Implementation of the memory telemetry
+#include "MemoryTelemetry.h"
+
+#if MEMORYTELEMETRY
+
+#include "platform/mbed_stats.h"
+
+#ifdef TOOLCHAIN_GCC
+#include <malloc.h>
+#endif
+
+static MemoryTelemetry Latest;
+
+/// false until the first sample was taken
+static bool Sampled = false;
+
+/// when the last sample was taken, from Kernel::get_ms_count()
+static uint64_t LastSample = 0;
+
+/// the CPU stats of the last sample, the idle time is the difference
+static mbed_stats_cpu_t LastCpu;
+
+// fills Latest with what the stats have now
+static void takeSample() {
+    MemoryTelemetry Sample;
+    memset(&Sample, 0, sizeof(Sample));
+
+    mbed_stats_heap_t Heap;
+    mbed_stats_heap_get(&Heap);
+    Sample.HeapUsed = Heap.current_size;
+    Sample.HeapMax = Heap.max_size;
+    Sample.AllocFails = Heap.alloc_fail_cnt;
+
+#ifdef TOOLCHAIN_GCC
+    // fordblks are the free bytes between the allocations, ordblks the
+    // number of pieces they are split into
+    struct mallinfo Info = mallinfo();
+    Sample.HeapFree = Info.fordblks;
+    Sample.FreeChunks = Info.ordblks;
+#endif
+
+    static mbed_stats_stack_t Stacks[TELEMETRYTHREADS];
+    size_t Threads = mbed_stats_stack_get_each(Stacks, TELEMETRYTHREADS);
+    for (size_t i = 0; i < Threads; ++i) {
+        uint32_t Free = Stacks[i].reserved_size - Stacks[i].max_size;
+        if (i == 0 || Free < Sample.StackFree) {
+            Sample.StackFree = Free;
+        }
+    }
+
+    mbed_stats_cpu_t Cpu;
+    mbed_stats_cpu_get(&Cpu);
+    us_timestamp_t Uptime = Cpu.uptime - LastCpu.uptime;
+    if (Uptime > 0) {
+        Sample.IdlePercent =
+            (uint32_t)((Cpu.idle_time - LastCpu.idle_time) * 100 / Uptime);
+        Sample.DeepSleepPercent = (uint32_t)(
+            (Cpu.deep_sleep_time - LastCpu.deep_sleep_time) * 100 / Uptime);
+    }
+    LastCpu = Cpu;
+
+    Latest = Sample;
+    Sampled = true;
+    LastSample = Kernel::get_ms_count();
+}
+
+// ============================================================================
+void sampleMemoryTelemetry() {
+    if (!Sampled || Kernel::get_ms_count() - LastSample >= TELEMETRYMS) {
+        takeSample();
+    }
+}
+
+// ============================================================================
+const MemoryTelemetry &memoryTelemetry() {
+    if (!Sampled) {
+        takeSample();
+    }
+    return Latest;
+}
+
+// ============================================================================
+void telemetryValues(const MemoryTelemetry &Sample,
+                     uint32_t (&Values)[TELEMETRYVALUES]) {
+    Values[0] = Sample.HeapUsed;
+    Values[1] = Sample.HeapMax;
+    Values[2] = Sample.AllocFails;
+    Values[3] = Sample.HeapFree;
+    Values[4] = Sample.FreeChunks;
+    Values[5] = Sample.StackFree;
+    Values[6] = Sample.IdlePercent;
+    Values[7] = Sample.DeepSleepPercent;
+}
+
+#endif // MEMORYTELEMETRY
@@ -0,0 +1,71 @@
+#ifndef MEMORYTELEMETRY_H
+#define MEMORYTELEMETRY_H
+/// \file
+/// \brief Heap, stack and CPU use, sampled now and then and sent with the
+/// readings.
+///
+/// The heap numbers come from mbed_stats_heap_get() and newlib's
+/// mallinfo(), which also tells how many free chunks the free bytes are
+/// split into, so fragmentation shows up before an allocation fails. The
+/// stack headroom is the smallest of every thread, from
+/// mbed_stats_stack_get_each(), and the idle and deep sleep time come from
+/// mbed_stats_cpu_get(). The deep sleep time shows whether the tickless idle
+/// on the LPTMR, see mbed_app.json, really gets the K64F into VLPS between
+/// the readings, or whether something holds a DeepSleepLock. They only
+/// report something with "platform.all-stats-enabled", or the single stats
+/// that are wanted, set in mbed_app.json, the rest are sent as 0. Set with
+/// "memory-telemetry" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to send the memory telemetry with every request. Set with
+/// "memory-telemetry" in mbed_app.json.
+#ifdef MBED_CONF_APP_MEMORY_TELEMETRY
+#define MEMORYTELEMETRY MBED_CONF_APP_MEMORY_TELEMETRY
+#else
+#define MEMORYTELEMETRY 0
+#endif
+
+/// How often sampleMemoryTelemetry() takes a new sample, in milliseconds
+#define TELEMETRYMS (60000)
+
+/// The most threads whose stacks are looked at
+#define TELEMETRYTHREADS (8)
+
+/// The number of values in a sample, in the order they are sent
+#define TELEMETRYVALUES (8)
+
+/// One sample, every value is sent as an unsigned number
+struct MemoryTelemetry {
+    /// bytes allocated on the heap now, and the most since the reset
+    uint32_t HeapUsed;
+    uint32_t HeapMax;
+
+    /// allocations that failed since the reset
+    uint32_t AllocFails;
+
+    /// free bytes inside the heap, and how many chunks they are in
+    uint32_t HeapFree;
+    uint32_t FreeChunks;
+
+    /// the fewest bytes any thread had left on its stack
+    uint32_t StackFree;
+
+    /// how much of the time since the last sample was spent idle, in percent
+    uint32_t IdlePercent;
+
+    /// how much of it was spent in deep sleep, in percent
+    uint32_t DeepSleepPercent;
+};
+
+/// Takes a new sample once TELEMETRYMS have passed since the last one
+void sampleMemoryTelemetry();
+
+/// Returns the latest sample, one is taken if there is none yet
+const MemoryTelemetry &memoryTelemetry();
+
+/// Copies the values of Sample into Values in the order they are sent
+void telemetryValues(const MemoryTelemetry &Sample,
+                     uint32_t (&Values)[TELEMETRYVALUES]);
+
+#endif // MEMORYTELEMETRY
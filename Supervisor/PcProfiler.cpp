@@ -0,0 +1,175 @@
+/// \file
+/// \brief Implementation of the sampling profiler
+#include "PcProfiler.h"
+
+#if PCPROFILER
+
+#include "cmsis.h"
+#include "hal/us_ticker_api.h"
+#include "platform/mbed_critical.h"
+#include "platform/mbed_stats.h"
+
+#include <cstring>
+
+#if DEVICE_ITM
+#include "hal/itm_api.h"
+#endif
+
+/// One address that was sampled, a Count of 0 is a free slot
+struct ProfileSlot {
+    uint32_t Pc;
+    uint32_t Count;
+};
+
+/// The counts of one window
+struct ProfileTable {
+    ProfileSlot Slots[PROFILERSLOTS];
+    uint32_t Samples;
+    uint32_t Missed;
+
+    /// us_ticker_read() when the window started
+    uint32_t Start;
+};
+
+/// The handler counts into Tables[Active], profilerFlush() sends the other
+/// one and clears it, so it is empty when the two are swapped again
+static ProfileTable Tables[2];
+static volatile uint32_t Active = 0;
+
+/// when the window started, in Kernel::get_ms_count() milliseconds
+static uint64_t WindowMs = 0;
+
+/// how long the window runs, and the one after it, in milliseconds
+static uint32_t WindowLength = PROFILERWINDOWMS;
+static uint32_t NextLength = PROFILERWINDOWMS;
+
+// counts Pc in the active table. It runs in the SysTick handler
+extern "C" void profilerSample(uint32_t Pc) {
+#ifdef MBED_CRITICAL_STATS_ENABLED
+    // SysTick reloaded when it raised the interrupt, what it counted down
+    // since then is how long the handler took to start
+    mbed_stats_irq_latency_add(SysTick->LOAD - SysTick->VAL);
+#endif
+    ProfileTable &Table = Tables[Active];
+    ++Table.Samples;
+    // Fibonacci hashing, the low bit of a Thumb address is always 0
+    uint32_t Slot = ((Pc >> 1) * 2654435761U) >> (32 - PROFILERSLOTBITS);
+    for (size_t i = 0; i < PROFILERPROBES; ++i) {
+        ProfileSlot &Entry = Table.Slots[(Slot + i) & (PROFILERSLOTS - 1)];
+        if (Entry.Count == 0) {
+            Entry.Pc = Pc;
+        }
+        if (Entry.Pc == Pc) {
+            ++Entry.Count;
+            return;
+        }
+    }
+    ++Table.Missed;
+}
+
+// the SysTick handler. Bit 2 of EXC_RETURN in LR tells whether the
+// interrupted code was on the main or the process stack, the PC is the
+// seventh word of the frame that was stacked there. profilerSample()
+// returns with the EXC_RETURN that is still in LR
+extern "C" __attribute__((naked)) void profilerTick() {
+    __asm volatile("tst lr, #4\n"
+                   "ite eq\n"
+                   "mrseq r0, msp\n"
+                   "mrsne r0, psp\n"
+                   "ldr r0, [r0, #24]\n"
+                   "b profilerSample\n");
+}
+
+#if DEVICE_ITM
+// sends Count words over the stimulus port, it takes them as fast as the
+// SWO pin goes
+static bool sendWords(const void *Words, size_t Count) {
+    mbed_itm_send_block(PROFILERITMPORT, Words, Count * sizeof(uint32_t));
+    return true;
+}
+#else
+/// the file is only opened while a window is written
+static FILE *ProfileFile = NULL;
+
+// appends Count words to PROFILERFILE
+static bool sendWords(const void *Words, size_t Count) {
+    return fwrite(Words, sizeof(uint32_t), Count, ProfileFile) == Count;
+}
+#endif
+
+// ============================================================================
+void startProfiler() {
+    memset(Tables, 0, sizeof(Tables));
+    Tables[0].Start = us_ticker_read();
+    WindowMs = Kernel::get_ms_count();
+#if DEVICE_ITM
+    mbed_itm_init();
+#endif
+
+    NVIC_SetVector(SysTick_IRQn, (uint32_t)profilerTick);
+    NVIC_SetPriority(SysTick_IRQn, 0);
+    SysTick->LOAD = SystemCoreClock / PROFILERHZ - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk |
+                    SysTick_CTRL_ENABLE_Msk;
+}
+
+// ============================================================================
+void profilerFlush() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (Now - WindowMs < WindowLength) {
+        return;
+    }
+
+#if !DEVICE_ITM
+    ProfileFile = fopen(PROFILERFILE, "ab");
+    if (ProfileFile != NULL && fseek(ProfileFile, 0, SEEK_END) == 0 &&
+        ftell(ProfileFile) >= PROFILERFILEMAX) {
+        ProfileFile = freopen(PROFILERFILE, "wb", ProfileFile);
+    }
+    if (ProfileFile == NULL) {
+        // no SD card, the window goes on until there is one
+        return;
+    }
+#endif
+
+    // the handler counts into the empty table from here on
+    core_util_critical_section_enter();
+    uint32_t Full = Active;
+    uint32_t End = us_ticker_read();
+    Tables[1 - Full].Start = End;
+    Active = 1 - Full;
+    core_util_critical_section_exit();
+    WindowMs = Now;
+    WindowLength = NextLength;
+    NextLength = PROFILERWINDOWMS;
+
+    // the used slots go out without the free ones between them
+    ProfileTable &Table = Tables[Full];
+    size_t Entries = 0;
+    for (size_t i = 0; i < PROFILERSLOTS; ++i) {
+        if (Table.Slots[i].Count != 0) {
+            Table.Slots[Entries++] = Table.Slots[i];
+        }
+    }
+    uint32_t Header[PROFILERHEADER] = {(PROFILERMAGIC << 24) | Entries,
+                                       Table.Start, End, Table.Samples,
+                                       Table.Missed};
+    if (sendWords(Header, PROFILERHEADER)) {
+        sendWords(Table.Slots, 2 * Entries);
+    }
+    memset(&Table, 0, sizeof(Table));
+
+#if !DEVICE_ITM
+    fclose(ProfileFile);
+    ProfileFile = NULL;
+#endif
+}
+
+// ============================================================================
+void profilerCapture(uint32_t Ms) {
+    WindowLength = 0;
+    NextLength = Ms;
+}
+
+#endif // PCPROFILER
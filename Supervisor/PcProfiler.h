@@ -0,0 +1,106 @@
+#ifndef PCPROFILER_H
+#define PCPROFILER_H
+/// \file
+/// \brief A sampling profiler that counts where the CPU was at a steady
+/// rate, to find on the board itself what makes a loop slow.
+///
+/// SysTick interrupts PROFILERHZ times a second. With MBED_TICKLESS the
+/// kernel runs on the LPTMR and leaves SysTick alone, so the profiler takes
+/// it over. Its handler reads the PC that the interrupt stacked, on the main
+/// or the process stack, and counts it in a hash table of PROFILERSLOTS
+/// addresses. That takes a few dozen cycles, about 0.05% of the CPU at 1 kHz,
+/// so it can stay on in the field. The handler has the highest priority, so
+/// the other interrupt handlers are counted too. Code that runs with
+/// interrupts off is counted where they come back on, and the idle thread
+/// shows up as the WFI of its loop. In deep sleep SysTick stops with the
+/// core and nothing is counted. The rate is a prime by default, so the
+/// samples do not keep hitting the same place of something that runs every
+/// millisecond.
+///
+/// profilerFlush() swaps the table for an empty one every PROFILERWINDOWMS,
+/// on the uploader thread, and sends the full one like the binary trace does:
+/// over the ITM stimulus port PROFILERITMPORT, the SWO pin, where the target
+/// has DEVICE_ITM, and appended to PROFILERFILE on the SD card otherwise.
+/// decode_profile.py looks the addresses up in the firmware's .elf and prints
+/// the functions with the most samples. Each window is
+/// - a word with PROFILERMAGIC in the top byte and the number of entries in
+///   the low half
+/// - us_ticker_read() when the window started and when it ended
+/// - the number of samples, and how many of them found no slot in the table
+/// - the address and the count of each entry
+///
+/// Set with "pc-profiler" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to count where the CPU is. Set with "pc-profiler" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_PC_PROFILER
+#define PCPROFILER MBED_CONF_APP_PC_PROFILER
+#else
+#define PCPROFILER 0
+#endif
+
+/// How many samples are taken a second. Set with "pc-profiler-hz" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_PC_PROFILER_HZ
+#define PROFILERHZ MBED_CONF_APP_PC_PROFILER_HZ
+#else
+#define PROFILERHZ (997)
+#endif
+
+#if PCPROFILER && !defined(MBED_TICKLESS)
+#error "pc-profiler needs MBED_TICKLESS, the kernel's tick is on SysTick"
+#endif
+
+/// How many addresses one window counts, a power of two
+#define PROFILERSLOTBITS (8)
+#define PROFILERSLOTS (1 << PROFILERSLOTBITS)
+
+/// How many slots a sample tries before it is counted as missed
+#define PROFILERPROBES (8)
+
+/// How long one window counts, in milliseconds
+#define PROFILERWINDOWMS (60000)
+
+/// The top byte of the first word of every window
+#define PROFILERMAGIC (0xC5)
+
+/// The words before the entries
+#define PROFILERHEADER (5)
+
+/// The stimulus port the windows are sent on where there is an ITM
+#define PROFILERITMPORT (2)
+
+/// The file that the windows are appended to where there is no ITM
+#define PROFILERFILE "/sd/profile.bin"
+
+/// The file is started over once it is this big, in bytes
+#define PROFILERFILEMAX (1024 * 1024)
+
+#if PCPROFILER
+
+/// Takes over SysTick and starts counting. Called once at boot
+void startProfiler();
+
+/// Sends or saves the window once PROFILERWINDOWMS have passed, only the
+/// uploader thread calls this. Without an SD card the window goes on
+/// counting until the card is back
+void profilerFlush();
+
+/// Ends the window at the next profilerFlush(), and makes the one after it
+/// Ms long, for a look at the CPU right now. The windows after that are
+/// PROFILERWINDOWMS again. Only the uploader thread calls this
+void profilerCapture(uint32_t Ms);
+
+#else
+
+inline void startProfiler() {}
+
+inline void profilerFlush() {}
+
+inline void profilerCapture(uint32_t Ms) {}
+
+#endif // PCPROFILER
+
+#endif // PCPROFILER
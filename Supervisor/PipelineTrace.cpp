@@ -0,0 +1,179 @@
+/// \file
+/// \brief Implementation of the pipeline trace
+#include "PipelineTrace.h"
+
+#if PIPELINETRACE
+
+#include "cmsis.h"
+#include "hal/us_ticker_api.h"
+#include "platform/mbed_critical.h"
+
+/// The durations of one stage
+struct TraceRing {
+    TraceMark Took[TRACERINGLEN];
+
+    /// counts up with every duration, the next one goes to Count %
+    /// TRACERINGLEN
+    uint32_t Count;
+};
+
+static TraceRing Rings[TRACESTAGES];
+
+static const char *const StageNames[TRACESTAGES] = {
+    "sample", "format", "backup", "send", "ack", "jitter", "frame", "latency"};
+
+/// The most that the p99 of a stage may be in microseconds, 0 for the
+/// stages without a limit
+static const uint32_t StageLimits[TRACESTAGES] = {
+    0, 0, 0, 0, 0, TRACEJITTERLIMITUS, TRACEFRAMELIMITUS,
+    TRACELATENCYLIMITS * 1000000U};
+
+/// the start and the interval of the last reading for traceCadence(), an
+/// interval of 0 is not compared
+static TraceMark LastStart = {0, 0};
+static uint32_t LastPeriodUs = 0;
+
+/// the last frame for traceFrame(), and if there was one
+static TraceMark LastFrame = {0, 0};
+static bool FrameSeen = false;
+
+/// when traceReport() last printed, from Kernel::get_ms_count()
+static uint64_t LastReport = 0;
+
+// ============================================================================
+void traceStart() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    LastReport = Kernel::get_ms_count();
+}
+
+// ============================================================================
+TraceMark traceMark() {
+    TraceMark Mark = {us_ticker_read(), DWT->CYCCNT};
+    return Mark;
+}
+
+// ============================================================================
+TraceMark traceElapsed(const TraceMark &Start) {
+    TraceMark Now = traceMark();
+    // both wrap around, the unsigned difference is still right
+    TraceMark Took = {Now.Us - Start.Us, Now.Cycles - Start.Cycles};
+    return Took;
+}
+
+// ============================================================================
+void traceSince(TraceStage Stage, const TraceMark &Start) {
+    traceRecord(Stage, traceElapsed(Start));
+}
+
+// ============================================================================
+void traceRecord(TraceStage Stage, const TraceMark &Took) {
+    // the sampling loop and the uploader both record
+    TraceRing &Ring = Rings[Stage];
+    core_util_critical_section_enter();
+    Ring.Took[Ring.Count % TRACERINGLEN] = Took;
+    ++Ring.Count;
+    core_util_critical_section_exit();
+}
+
+// ============================================================================
+void traceCadence(const TraceMark &Start, uint32_t PeriodUs) {
+    if (LastPeriodUs != 0) {
+        // early or late is the same jitter
+        uint32_t Took = Start.Us - LastStart.Us;
+        uint32_t Cycles = Start.Cycles - LastStart.Cycles;
+        TraceMark Off = {Took > LastPeriodUs ? Took - LastPeriodUs
+                                             : LastPeriodUs - Took,
+                         Cycles};
+        traceRecord(TraceJitter, Off);
+    }
+    LastStart = Start;
+    LastPeriodUs = PeriodUs;
+}
+
+// ============================================================================
+void traceFrame(const uint16_t *frame, size_t count) {
+    TraceMark Now = traceMark();
+    if (FrameSeen) {
+        TraceMark Gap = {Now.Us - LastFrame.Us, Now.Cycles - LastFrame.Cycles};
+        traceRecord(TraceFrame, Gap);
+    }
+    LastFrame = Now;
+    FrameSeen = true;
+}
+
+// ============================================================================
+void traceWaited(uint32_t Taken) {
+    uint32_t Now = time(NULL);
+    uint32_t Seconds = Now > Taken ? Now - Taken : 0;
+    TraceMark Waited = {Seconds < UINT32_MAX / 1000000U ? Seconds * 1000000U
+                                                        : UINT32_MAX,
+                        0};
+    traceRecord(TraceLatency, Waited);
+}
+
+// sorts the Count values in Values, there are only TRACERINGLEN of them
+static void sortValues(uint32_t *Values, size_t Count) {
+    for (size_t i = 1; i < Count; ++i) {
+        uint32_t Value = Values[i];
+        size_t j = i;
+        for (; j > 0 && Values[j - 1] > Value; --j) {
+            Values[j] = Values[j - 1];
+        }
+        Values[j] = Value;
+    }
+}
+
+// ============================================================================
+void traceGetStats(TraceStats *Stats, TraceStage Stage) {
+    memset(Stats, 0, sizeof(*Stats));
+
+    TraceMark Took[TRACERINGLEN];
+    core_util_critical_section_enter();
+    Stats->Count = Rings[Stage].Count;
+    memcpy(Took, Rings[Stage].Took, sizeof(Took));
+    core_util_critical_section_exit();
+
+    size_t Kept = Stats->Count < TRACERINGLEN ? Stats->Count : TRACERINGLEN;
+    if (Kept == 0) {
+        return;
+    }
+
+    uint32_t Values[TRACERINGLEN];
+    for (size_t i = 0; i < Kept; ++i) {
+        Values[i] = Took[i].Us;
+    }
+    sortValues(Values, Kept);
+    Stats->P50Us = Values[Kept / 2];
+    Stats->P99Us = Values[(Kept * 99) / 100];
+    Stats->MaxUs = Values[Kept - 1];
+
+    for (size_t i = 0; i < Kept; ++i) {
+        Values[i] = Took[i].Cycles;
+    }
+    sortValues(Values, Kept);
+    Stats->P50Cycles = Values[Kept / 2];
+}
+
+// ============================================================================
+void traceReport() {
+    uint64_t Now = Kernel::get_ms_count();
+    if (Now - LastReport < TRACEREPORTMS) {
+        return;
+    }
+    LastReport = Now;
+
+    printf("\r\nstage     count    p50 us    p99 us    max us  p50 cycles\r\n");
+    for (int i = 0; i < TRACESTAGES; ++i) {
+        TraceStats Stats;
+        traceGetStats(&Stats, (TraceStage)i);
+        bool Over = StageLimits[i] != 0 && Stats.Count > 0 &&
+                    Stats.P99Us > StageLimits[i];
+        printf("%-8s %6lu %9lu %9lu %9lu %11lu%s\r\n", StageNames[i],
+               (unsigned long)Stats.Count, (unsigned long)Stats.P50Us,
+               (unsigned long)Stats.P99Us, (unsigned long)Stats.MaxUs,
+               (unsigned long)Stats.P50Cycles, Over ? " over limit" : "");
+    }
+}
+
+#endif // PIPELINETRACE
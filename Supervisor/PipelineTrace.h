@@ -0,0 +1,172 @@
+#ifndef PIPELINETRACE_H
+#define PIPELINETRACE_H
+/// \file
+/// \brief Timestamps of each stage of a reading, from the ADC to the
+/// server's response.
+///
+/// Every stage keeps its last TRACERINGLEN durations in a RAM ring, as
+/// microseconds of the us_ticker and as cycles of the DWT cycle counter. The
+/// ticker runs while the CPU sleeps in WFI and the cycle counter does not, so
+/// the first is how long the stage took and the second how much of the CPU
+/// it used. traceGetStats() reads the p50 and p99 of a stage the way the
+/// mbed_stats functions do, and traceReport() prints them all every
+/// TRACEREPORTMS. Set with "pipeline-trace" in mbed_app.json. Without it
+/// every function is empty and inline, so the call sites cost nothing.
+///
+/// Three of the stages are not durations of work but the cadence of the
+/// sampler under the load that the board really has, the network and the
+/// SD card: how far each reading started from the interval after the one
+/// before, the time between two frames of the ADC scan, and how long a
+/// reading waited from when it was taken until it was sent or backed up.
+/// The report checks their p99 against TRACEJITTERLIMITUS,
+/// TRACEFRAMELIMITUS and TRACELATENCYLIMITS and marks a stage that is over
+/// its limit, so a change to the sampler, the DMA or the threads that
+/// makes them worse shows up in the log of the next run.
+
+#include "mbed.h"
+
+/// Set to 1 to record the stage timestamps. Set with "pipeline-trace" in
+/// mbed_app.json.
+#ifdef MBED_CONF_APP_PIPELINE_TRACE
+#define PIPELINETRACE MBED_CONF_APP_PIPELINE_TRACE
+#else
+#define PIPELINETRACE 0
+#endif
+
+/// How many durations of each stage are kept
+#define TRACERINGLEN (64)
+
+/// How often traceReport() prints the summary, in milliseconds
+#define TRACEREPORTMS (60000)
+
+/// The p99 of the jitter of the readings that is still fine, in
+/// microseconds. Set with "trace-jitter-limit-us" in mbed_app.json.
+#ifdef MBED_CONF_APP_TRACE_JITTER_LIMIT_US
+#define TRACEJITTERLIMITUS MBED_CONF_APP_TRACE_JITTER_LIMIT_US
+#else
+#define TRACEJITTERLIMITUS (5000)
+#endif
+
+/// The p99 of the time between two scan frames that is still fine, in
+/// microseconds. Set with "trace-frame-limit-us" in mbed_app.json.
+#ifdef MBED_CONF_APP_TRACE_FRAME_LIMIT_US
+#define TRACEFRAMELIMITUS MBED_CONF_APP_TRACE_FRAME_LIMIT_US
+#else
+#define TRACEFRAMELIMITUS (1000)
+#endif
+
+/// The p99 of the wait of a reading that is still fine, in seconds.
+/// Set with "trace-latency-limit-s" in mbed_app.json.
+#ifdef MBED_CONF_APP_TRACE_LATENCY_LIMIT_S
+#define TRACELATENCYLIMITS MBED_CONF_APP_TRACE_LATENCY_LIMIT_S
+#else
+#define TRACELATENCYLIMITS (30)
+#endif
+
+/// The stages of a reading
+enum TraceStage {
+    /// reading the ports out of the ADC frame
+    TraceSample,
+    /// formatting a request, without the time spent sending it
+    TraceFormat,
+    /// writing a reading to the backup log or the flash queue
+    TraceBackup,
+    /// one piece of a request going out with AT+CIPSEND or a socket
+    TraceSend,
+    /// waiting for the server's response after the request was sent
+    TraceAck,
+    /// how far a reading started from the interval after the reading before
+    TraceJitter,
+    /// the time between two frames of the ADC scan
+    TraceFrame,
+    /// from when a reading was taken until it was sent or backed up, in
+    /// whole seconds
+    TraceLatency,
+    TRACESTAGES
+};
+
+/// When a stage started, or how long it took
+struct TraceMark {
+    uint32_t Us;
+    uint32_t Cycles;
+};
+
+/// What traceGetStats() reads out of the ring of a stage
+struct TraceStats {
+    /// how many durations were recorded since the start, not only the ones
+    /// in the ring
+    uint32_t Count;
+    uint32_t P50Us;
+    uint32_t P99Us;
+    uint32_t MaxUs;
+    uint32_t P50Cycles;
+};
+
+#if PIPELINETRACE
+
+/// Starts the DWT cycle counter
+void traceStart();
+
+/// Returns the time now, to hand to traceSince() at the end of the stage
+TraceMark traceMark();
+
+/// Returns how long it has been since Start
+TraceMark traceElapsed(const TraceMark &Start);
+
+/// Records the time since Start as a duration of Stage
+void traceSince(TraceStage Stage, const TraceMark &Start);
+
+/// Records Took as a duration of Stage
+void traceRecord(TraceStage Stage, const TraceMark &Took);
+
+/// Records how far Start is from PeriodUs after the Start of the reading
+/// before, and keeps both for the next reading. A PeriodUs of 0 is a
+/// reading that is not on the interval after the one before, like the
+/// first one after the scan stopped, so the next one is not compared.
+void traceCadence(const TraceMark &Start, uint32_t PeriodUs);
+
+/// Records the time since the frame before as a TraceFrame, attached to the
+/// frame callback of the scan.
+/// This is safe to call from interrupt context.
+void traceFrame(const uint16_t *frame, size_t count);
+
+/// Records the time since Taken, a time(NULL), as a TraceLatency
+void traceWaited(uint32_t Taken);
+
+/// Reads the durations of Stage that are in its ring into Stats
+void traceGetStats(TraceStats *Stats, TraceStage Stage);
+
+/// Prints the stats of every stage once TRACEREPORTMS have passed since the
+/// last time
+void traceReport();
+
+#else
+
+inline void traceStart() {}
+
+inline TraceMark traceMark() {
+    TraceMark Mark = {0, 0};
+    return Mark;
+}
+
+inline TraceMark traceElapsed(const TraceMark &Start) { return Start; }
+
+inline void traceSince(TraceStage Stage, const TraceMark &Start) {}
+
+inline void traceRecord(TraceStage Stage, const TraceMark &Took) {}
+
+inline void traceCadence(const TraceMark &Start, uint32_t PeriodUs) {}
+
+inline void traceFrame(const uint16_t *frame, size_t count) {}
+
+inline void traceWaited(uint32_t Taken) {}
+
+inline void traceGetStats(TraceStats *Stats, TraceStage Stage) {
+    memset(Stats, 0, sizeof(*Stats));
+}
+
+inline void traceReport() {}
+
+#endif // PIPELINETRACE
+
+#endif // PIPELINETRACE
@@ -0,0 +1,203 @@
+/// \file
+/// \brief Implementation of the diagnostic commands from the server
+#define TRACE_GROUP "diag"
+#include "RemoteShell.h"
+
+#if REMOTESHELL
+
+#include "CrashLog.h"
+#include "DeadlineMonitor.h"
+#include "DeferredLog.h"
+#include "PcProfiler.h"
+#include "RequestWriter.h"
+#include "platform/mbed_stats.h"
+
+#include <cctype>
+
+/// What precedes the commands in a response
+#define SHELLSTART "diag=\""
+
+/// the commands that wait for runShellCommands(), empty if there are none
+static char Pending[SHELLCOMMANDMAX];
+
+/// the Id of the last commands that were taken
+static uint32_t LastId = 0;
+
+/// the answer to them, and whether the server has it
+static char Reply[SHELLREPLYMAX];
+static bool Replied = true;
+
+/// when the AT echo ends, from Kernel::get_ms_count(), 0 while it is off
+static uint64_t AtUntil = 0;
+
+/// the names of the levels of trace=, by TRACE_ACTIVE_LEVEL_
+struct LevelName {
+    const char *Name;
+    uint8_t Level;
+};
+
+static const LevelName Levels[] = {{"none", TRACE_ACTIVE_LEVEL_NONE},
+                                   {"error", TRACE_ACTIVE_LEVEL_ERROR},
+                                   {"warn", TRACE_ACTIVE_LEVEL_WARN},
+                                   {"info", TRACE_ACTIVE_LEVEL_INFO},
+                                   {"debug", TRACE_ACTIVE_LEVEL_ALL}};
+
+// ============================================================================
+void offerShellCommands(const char *Response) {
+    const char *Start = strstr(Response, SHELLSTART);
+    if (Start == NULL) {
+        return;
+    }
+    Start += strlen(SHELLSTART);
+    const char *End = strchr(Start, '"');
+    char *Rest;
+    uint32_t Id = strtoul(Start, &Rest, 10);
+    if (End == NULL || Rest == Start || *Rest != ':' || Id <= LastId) {
+        return;
+    }
+    size_t Length = End - (Rest + 1);
+    if (Length >= SHELLCOMMANDMAX) {
+        printf("The diagnostic commands from the server are too long\r\n");
+        return;
+    }
+    memcpy(Pending, Rest + 1, Length);
+    Pending[Length] = 0;
+    LastId = Id;
+}
+
+// sets the log level to Args, "Level" or "Group,Level"
+static bool setTrace(char *Args) {
+    char *Group = NULL;
+    char *Name = strchr(Args, ',');
+    if (Name != NULL) {
+        *Name++ = 0;
+        Group = Args;
+    } else {
+        Name = Args;
+    }
+    for (size_t i = 0; i < sizeof(Levels) / sizeof(Levels[0]); ++i) {
+        if (strcmp(Levels[i].Name, Name) == 0) {
+            return logLevel(Group, Levels[i].Level);
+        }
+    }
+    return false;
+}
+
+// echoes the AT commands for Args seconds
+static bool echoAT(ATCmdParser *Parser, const char *Args) {
+    if (!isdigit((unsigned char)Args[0])) {
+        return false;
+    }
+    uint32_t Seconds = strtoul(Args, NULL, 10);
+    if (Seconds > SHELLATMAXS) {
+        Seconds = SHELLATMAXS;
+    }
+    Parser->debug_on(Seconds > 0 ? 1 : LOGATCOMMANDS);
+    AtUntil = Seconds > 0 ? Kernel::get_ms_count() + Seconds * 1000ULL : 0;
+    return true;
+}
+
+// appends the numbers of stats
+static void appendStats(RequestWriter &Text) {
+    Text.append("up:");
+    Text.appendUnsigned((uint32_t)(Kernel::get_ms_count() / 1000));
+#ifdef MBED_HEAP_STATS_ENABLED
+    mbed_stats_heap_t Heap;
+    mbed_stats_heap_get(&Heap);
+    Text.append(",heap:");
+    Text.appendUnsigned(Heap.current_size);
+    Text.append(":");
+    Text.appendUnsigned(Heap.max_size);
+    Text.append(":");
+    Text.appendUnsigned(Heap.alloc_fail_cnt);
+#endif
+#ifdef MBED_CPU_STATS_ENABLED
+    mbed_stats_cpu_t Cpu;
+    mbed_stats_cpu_get(&Cpu);
+    Text.append(",idle:");
+    Text.appendUnsigned(
+        Cpu.uptime == 0 ? 0 : (uint32_t)(Cpu.idle_time * 100 / Cpu.uptime));
+#endif
+    Text.append(",drop:");
+    Text.appendUnsigned(logDropped());
+#if DEADLINEMONITOR
+    Text.append(",late:");
+    Text.appendUnsigned(deadlineMisses());
+    if (deadlineShedding()) {
+        Text.append(":shed");
+    }
+#endif
+}
+
+// runs one command and appends its answer
+static void runCommand(ATCmdParser *Parser, char *Command,
+                       RequestWriter &Text) {
+    char *Args = strchr(Command, '=');
+    if (Args != NULL) {
+        *Args++ = 0;
+    }
+    bool Worked = false;
+    if (strcmp(Command, "stats") == 0) {
+        appendStats(Text);
+        return;
+    } else if (strcmp(Command, "crashlog") == 0) {
+        Text.append("events");
+        crashLogRecent(Text);
+        return;
+    } else if (Args == NULL) {
+        // the others all have arguments
+    } else if (strcmp(Command, "trace") == 0) {
+        Worked = setTrace(Args);
+    } else if (strcmp(Command, "at") == 0) {
+        Worked = echoAT(Parser, Args);
+    } else if (strcmp(Command, "profile") == 0 &&
+               isdigit((unsigned char)Args[0])) {
+        profilerCapture(strtoul(Args, NULL, 10) * 1000);
+        Worked = PCPROFILER;
+    }
+    Text.append(Worked ? "ok" : "err");
+}
+
+// ============================================================================
+void runShellCommands(ATCmdParser *Parser) {
+    if (AtUntil != 0 && Kernel::get_ms_count() >= AtUntil) {
+        Parser->debug_on(LOGATCOMMANDS);
+        AtUntil = 0;
+    }
+    if (Pending[0] == 0) {
+        return;
+    }
+
+    RequestWriter Text(Reply, sizeof(Reply));
+    Text.appendUnsigned(LastId);
+    Text.append(":");
+    char *Next = Pending;
+    for (bool First = true; Next != NULL; First = false) {
+        char *Command = Next;
+        Next = strchr(Command, ';');
+        if (Next != NULL) {
+            *Next++ = 0;
+        }
+        size_t Before = Text.length();
+        if (!First) {
+            Text.append(";");
+        }
+        runCommand(Parser, Command, Text);
+        if (Text.overflowed()) {
+            // the commands still run, their answers do not fit
+            Text.truncate(Before);
+        }
+    }
+    Pending[0] = 0;
+    Replied = false;
+    tr_info("Ran the diagnostic commands %lu from the server",
+            (unsigned long)LastId);
+}
+
+// ============================================================================
+const char *shellReply() { return Replied ? NULL : Reply; }
+
+// ============================================================================
+void shellReplySent() { Replied = true; }
+
+#endif // REMOTESHELL
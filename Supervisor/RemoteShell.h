@@ -0,0 +1,82 @@
+#ifndef REMOTESHELL_H
+#define REMOTESHELL_H
+/// \file
+/// \brief Diagnostic commands that the server sends back in its responses,
+/// so a slow board can be looked at in the field without a debug build.
+///
+/// Next to samplerate=, a response can hold diag="Id:Command;Command;..."
+/// with these commands:
+/// - trace=Level sets the level of the log for all groups, one of none,
+///   error, warn, info or debug, and trace=Group,Level for one TRACE_GROUP,
+///   see logLevel()
+/// - at=Seconds echoes the AT commands to the console for that long, 0 ends
+///   it early
+/// - stats answers with up:seconds, heap:used:most:failed with
+///   MBED_HEAP_STATS_ENABLED, idle:percent with MBED_CPU_STATS_ENABLED,
+///   drop:log lines dropped, and late:deadlines missed with
+///   DEADLINEMONITOR, late:missed:shed while the work that can wait is put
+///   off
+/// - crashlog answers with the events of the crash log ring of this boot,
+///   see crashLogRecent()
+/// - profile=Seconds has the profiler send the window it has now and count
+///   a window of that many seconds after it, see profilerCapture()
+///
+/// The uploader runs the commands between uploads. Their answers go out with
+/// the next requests as &Diag=Id:Answer;Answer;... until one of them was
+/// answered, "ok" for a command that worked and "err" for one that did not.
+/// The server keeps sending the commands until it has their answer, a diag=
+/// with an Id that was run already is left alone. Set with "remote-shell" in
+/// mbed_app.json.
+
+#include "ATCmdParser.h"
+#include "mbed.h"
+
+/// Set to 1 to take diagnostic commands from the server. Set with
+/// "remote-shell" in mbed_app.json.
+#ifdef MBED_CONF_APP_REMOTE_SHELL
+#define REMOTESHELL MBED_CONF_APP_REMOTE_SHELL
+#else
+#define REMOTESHELL 0
+#endif
+
+/// The longest diag="..." that is taken, with the '\0'
+#define SHELLCOMMANDMAX (128)
+
+/// The longest answer to one diag="...", with the '\0'
+#define SHELLREPLYMAX (384)
+
+/// The most seconds that the AT commands are echoed for
+#define SHELLATMAXS (600)
+
+#if REMOTESHELL
+
+/// Keeps the commands in Response, if there are new ones, until
+/// runShellCommands(). Called from the uploader thread by
+/// parseServerSettings()
+void offerShellCommands(const char *Response);
+
+/// Runs the waiting commands, and ends the AT echo once it is due. Only the
+/// uploader thread calls this, Parser is the ESP8266's
+void runShellCommands(ATCmdParser *Parser);
+
+/// Returns the answer to the last commands, or NULL if there is none or it
+/// was sent. It has only characters that can go into a URL query as they
+/// are
+const char *shellReply();
+
+/// Drops the answer once the server has it
+void shellReplySent();
+
+#else
+
+inline void offerShellCommands(const char *Response) {}
+
+inline void runShellCommands(ATCmdParser *Parser) {}
+
+inline const char *shellReply() { return NULL; }
+
+inline void shellReplySent() {}
+
+#endif // REMOTESHELL
+
+#endif // REMOTESHELL
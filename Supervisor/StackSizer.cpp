@@ -0,0 +1,140 @@
+/// \file
+/// \brief Implementation of the stack sizer
+#include "StackSizer.h"
+
+#if STACKSIZER
+
+#include "platform/mbed_stats.h"
+
+#include <cstring>
+
+/// the deepest a thread went, a Name of NULL is a free slot
+struct StackPeak {
+    const char *Name;
+    uint32_t Reserved;
+    uint32_t Peak;
+};
+
+/// the mbed_app.json settings of the threads that are not "<name>-stack-size"
+struct StackSetting {
+    const char *Name;
+    const char *Setting;
+};
+
+static const StackSetting Settings[] = {
+    {"main", "rtos.main-thread-stack-size"},
+    {"rtx_idle", "rtos.idle-thread-stack-size"},
+    {"rtx_timer", "rtos.timer-thread-stack-size"},
+};
+
+/// the threads of the app that have a "<name>-stack-size"
+static const char *const AppThreads[] = {"uploader", "esp",    "log",
+                                         "prefetch", "usb",    "stream",
+                                         "modbus",   "lora",   "mbtcp",
+                                         "local"};
+
+/// stackSample() may be called from the boot and the uploader thread
+static Mutex PeaksLock;
+static StackPeak Peaks[STACKTHREADS];
+
+/// the threads that did not fit into Peaks
+static uint32_t Dropped = 0;
+
+/// when stackReport() last printed, from Kernel::get_ms_count()
+static uint64_t LastReport = 0;
+
+// the peak of the thread called Name, NULL if there is no room for it
+static StackPeak *findPeak(const char *Name) {
+    for (size_t i = 0; i < STACKTHREADS; ++i) {
+        if (Peaks[i].Name == NULL) {
+            Peaks[i].Name = Name;
+            return &Peaks[i];
+        }
+        if (strcmp(Peaks[i].Name, Name) == 0) {
+            return &Peaks[i];
+        }
+    }
+    return NULL;
+}
+
+// the size that would do for a thread that used Peak bytes at most
+static uint32_t suggestSize(uint32_t Peak) {
+    uint32_t Size = Peak + Peak * STACKMARGIN / 100 + STACKHEADROOM;
+    return (Size + STACKROUND - 1) / STACKROUND * STACKROUND;
+}
+
+// prints the mbed_app.json setting of the thread called Name with Size,
+// nothing for a thread that has none
+static void printSetting(const char *Name, uint32_t Size) {
+    for (size_t i = 0; i < sizeof(Settings) / sizeof(Settings[0]); ++i) {
+        if (strcmp(Settings[i].Name, Name) == 0) {
+            printf("    \"%s\": %lu,\r\n", Settings[i].Setting,
+                   (unsigned long)Size);
+            return;
+        }
+    }
+    for (size_t i = 0; i < sizeof(AppThreads) / sizeof(AppThreads[0]); ++i) {
+        if (strcmp(AppThreads[i], Name) == 0) {
+            printf("    \"%s-stack-size\": %lu,\r\n", Name,
+                   (unsigned long)Size);
+            return;
+        }
+    }
+}
+
+// ============================================================================
+void stackSample() {
+    static mbed_stats_stack_t Stacks[STACKTHREADS];
+    PeaksLock.lock();
+    size_t Threads = mbed_stats_stack_get_each(Stacks, STACKTHREADS);
+    for (size_t i = 0; i < Threads; ++i) {
+        // a thread without a name cannot be told apart from the next one
+        StackPeak *Peak =
+            Stacks[i].name != NULL ? findPeak(Stacks[i].name) : NULL;
+        if (Peak == NULL) {
+            ++Dropped;
+            continue;
+        }
+        Peak->Reserved = Stacks[i].reserved_size;
+        if (Stacks[i].max_size > Peak->Peak) {
+            Peak->Peak = Stacks[i].max_size;
+        }
+    }
+    PeaksLock.unlock();
+}
+
+// ============================================================================
+void stackReport() {
+    uint64_t Now = Kernel::get_ms_count();
+    stackSample();
+    if (Now - LastReport < STACKREPORTMS) {
+        return;
+    }
+    LastReport = Now;
+
+    StackPeak Report[STACKTHREADS];
+    PeaksLock.lock();
+    memcpy(Report, Peaks, sizeof(Report));
+    PeaksLock.unlock();
+
+    printf("\r\nthread      reserved   peak  suggested\r\n");
+    int32_t Freed = 0;
+    for (size_t i = 0; i < STACKTHREADS && Report[i].Name != NULL; ++i) {
+        uint32_t Size = suggestSize(Report[i].Peak);
+        printf("%-10s %9lu %6lu %10lu\r\n", Report[i].Name,
+               (unsigned long)Report[i].Reserved,
+               (unsigned long)Report[i].Peak, (unsigned long)Size);
+        Freed += (int32_t)Report[i].Reserved - (int32_t)Size;
+    }
+    if (Dropped != 0) {
+        printf("%lu stacks had no name or no room\r\n",
+               (unsigned long)Dropped);
+    }
+    printf("the suggested sizes free %ld bytes, in mbed_app.json:\r\n",
+           (long)Freed);
+    for (size_t i = 0; i < STACKTHREADS && Report[i].Name != NULL; ++i) {
+        printSetting(Report[i].Name, suggestSize(Report[i].Peak));
+    }
+}
+
+#endif // STACKSIZER
@@ -0,0 +1,68 @@
+#ifndef STACKSIZER_H
+#define STACKSIZER_H
+/// \file
+/// \brief The most stack every thread used over the whole run, and the
+/// stack size that would do for it.
+///
+/// mbed_stats_stack_get_each() reads how deep each stack went from the fill
+/// pattern RTX puts on it, but only for the threads that are running when
+/// it is called. The sizer keeps the deepest of every thread by its name,
+/// so a thread that is started again, or that ended since, is still
+/// counted. Every STACKREPORTMS it prints each thread with the size it has,
+/// the most it used and a suggested size: the peak with STACKMARGIN percent
+/// more on top, and STACKHEADROOM for an interrupted thread's frame, rounded
+/// up to STACKROUND. The suggestion is printed as the mbed_app.json setting
+/// of that thread, the app's threads each have a "<name>-stack-size", so the
+/// sizes that were measured can be built in, and the RAM they free goes to
+/// the sample ring and the batches. A suggestion is only as good as the run
+/// it comes from, it should have gone through an upload of the backlog and
+/// a config change. Set with "stack-sizer" in mbed_app.json.
+
+#include "mbed.h"
+
+/// Set to 1 to print the stack sizes that would do. Set with "stack-sizer"
+/// in mbed_app.json.
+#ifdef MBED_CONF_APP_STACK_SIZER
+#define STACKSIZER MBED_CONF_APP_STACK_SIZER
+#else
+#define STACKSIZER 0
+#endif
+
+#if STACKSIZER && !defined(MBED_STACK_STATS_ENABLED)
+#error "stack-sizer needs platform.stack-stats-enabled set to 1"
+#endif
+
+/// How many threads are told apart
+#define STACKTHREADS (16)
+
+/// How much more than the peak is suggested, in percent
+#define STACKMARGIN (25)
+
+/// What is added to the suggestion for the frame of an interrupt, with the
+/// registers of the FPU, in bytes
+#define STACKHEADROOM (128)
+
+/// The suggestion is rounded up to this many bytes
+#define STACKROUND (64)
+
+/// How often stackReport() prints, in milliseconds
+#define STACKREPORTMS (600000)
+
+#if STACKSIZER
+
+/// Takes the peaks of the threads that are running now
+void stackSample();
+
+/// Takes a sample and prints the sizes once STACKREPORTMS have passed, only
+/// the uploader thread calls this
+void stackReport();
+
+#else
+
+inline void stackSample() {}
+
+inline void stackReport() {}
+
+#endif // STACKSIZER
+
+#endif // STACKSIZER
@@ -0,0 +1,122 @@
+/// \file
+/// \brief Implementation of the watchdog supervisor
+#include "Supervisor.h"
+
+#include "CrashLog.h"
+#include "LowPowerTicker.h"
+#include "ResetReason.h"
+#include "Watchdog.h"
+#include "platform/mbed_atomic.h"
+
+/// The heartbeat of one thread
+struct HeartbeatInfo {
+    const char *Name;
+
+    /// how long the thread can go without a heartbeat
+    volatile uint32_t TimeoutMs;
+
+    /// counted up by heartbeat()
+    volatile uint32_t Beats;
+
+    /// the value of Beats at the last check
+    uint32_t Seen;
+
+    /// how long Beats has not changed for
+    uint32_t AgeMs;
+};
+
+static HeartbeatInfo Tasks[SUPERVISORMAXTASKS];
+
+static volatile int TaskCount = 0;
+
+// the lp_ticker keeps running in deep sleep and does not lock it, unlike the
+// us_ticker behind Ticker
+static LowPowerTicker Checker;
+
+/// true while a stall is kept in the crash log
+static bool Stalled = false;
+
+// ============================================================================
+// runs from the LowPowerTicker interrupt
+static void checkHeartbeats() {
+    bool alive = true;
+
+    for (int i = 0; i < TaskCount; ++i) {
+        HeartbeatInfo &Task = Tasks[i];
+        uint32_t beats = Task.Beats;
+
+        if (beats != Task.Seen) {
+            Task.Seen = beats;
+            Task.AgeMs = 0;
+        } else if (Task.AgeMs <= Task.TimeoutMs) {
+            Task.AgeMs += SUPERVISORCHECKMS;
+        }
+
+        if (Task.AgeMs > Task.TimeoutMs) {
+            // the crash log keeps it through the watchdog reset
+            if (alive) {
+                crashLogStall(Task.Name, Task.AgeMs);
+                Stalled = true;
+            }
+            alive = false;
+        }
+    }
+    if (alive && Stalled) {
+        crashLogStall(NULL, 0);
+        Stalled = false;
+    }
+
+    // without the kick, the watchdog resets the board
+    if (alive) {
+        Watchdog::get_instance().kick();
+    }
+}
+
+bool startSupervisor() {
+    if (!Watchdog::get_instance().start(SUPERVISORTIMEOUTMS)) {
+        printf("Could not start the watchdog\r\n");
+        return false;
+    }
+    Checker.attach_us(callback(checkHeartbeats), SUPERVISORCHECKMS * 1000);
+    return true;
+}
+
+// ============================================================================
+int registerHeartbeat(const char *Name, uint32_t TimeoutMs) {
+    core_util_critical_section_enter();
+    int Id = TaskCount;
+    if (Id < SUPERVISORMAXTASKS) {
+        Tasks[Id].Name = Name;
+        Tasks[Id].TimeoutMs = TimeoutMs;
+        Tasks[Id].Beats = 0;
+        Tasks[Id].Seen = 0;
+        Tasks[Id].AgeMs = 0;
+        TaskCount = Id + 1;
+    } else {
+        Id = -1;
+    }
+    core_util_critical_section_exit();
+
+    if (Id < 0) {
+        printf("No room for the %s heartbeat\r\n", Name);
+    }
+    return Id;
+}
+
+void setHeartbeatTimeout(int Id, uint32_t TimeoutMs) {
+    if (Id >= 0 && Id < TaskCount) {
+        Tasks[Id].TimeoutMs = TimeoutMs;
+    }
+}
+
+void heartbeat(int Id) {
+    if (Id >= 0 && Id < TaskCount) {
+        core_util_atomic_incr_u32(&Tasks[Id].Beats, 1);
+    }
+}
+
+void printResetReason() {
+    if (ResetReason::get() == RESET_REASON_WATCHDOG) {
+        printf("\r\nThe last reset was caused by the watchdog\r\n");
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+/// \file
+/// \brief Hardware watchdog supervisor with a heartbeat for every thread.
+///
+/// Every thread that has to keep running registers a heartbeat with a
+/// timeout. A LowPowerTicker checks the heartbeats every SUPERVISORCHECKMS
+/// and kicks the K64F's hardware watchdog only while every thread has
+/// checked in within its timeout. A stuck thread, or an interrupt that never
+/// returns, stops the kicks and the watchdog resets the board.
+
+#include "mbed.h"
+
+/// The most threads that can register a heartbeat
+#define SUPERVISORMAXTASKS (4)
+
+/// How often the heartbeats are checked, in milliseconds
+#define SUPERVISORCHECKMS (1000)
+
+/// The hardware watchdog's timeout, in milliseconds. It has to be longer than
+/// SUPERVISORCHECKMS so that the checks can keep it from going off
+#define SUPERVISORTIMEOUTMS (5000)
+
+/// Starts the hardware watchdog and the heartbeat checks.
+/// \returns false if the watchdog could not be started
+bool startSupervisor();
+
+/// Adds a thread that has to call heartbeat() at least every TimeoutMs
+/// milliseconds. Name is only used for printing.
+/// \returns the id to give to heartbeat(), or -1 if SUPERVISORMAXTASKS
+/// threads are already registered
+int registerHeartbeat(const char *Name, uint32_t TimeoutMs);
+
+/// Changes how often the thread Id has to call heartbeat()
+void setHeartbeatTimeout(int Id, uint32_t TimeoutMs);
+
+/// Tells the supervisor that the thread Id is still running. This only
+/// counts up, so it can be called as often as needed.
+void heartbeat(int Id);
+
+/// Prints a line if the last reset was caused by the watchdog
+void printResetReason();
+
+#endif // SUPERVISOR
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+"""Decodes the binary trace of BinaryTrace.h into text.
+
+The records only hold the address of their format string, so the decoder needs
+the .elf of the firmware that wrote them. The trace comes from the SD card's
+trace.bin, or from a capture of ITM stimulus port BTRACEITMPORT on boards that
+have one.
+
+    python3 Supervisor/decode_btrace.py BUILD/K64F/GCC_ARM/firmware.elf \\
+        /media/sd/trace.bin
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+# keep in step with BinaryTrace.h
+BTRACEMAGIC = 0xB7
+BTRACEHEADER = 3
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+# a printf conversion, with its length modifier apart so it can be dropped
+CONVERSION = re.compile(
+    r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t|L)?([diouxXeEfFgGcp%])")
+
+
+class Firmware:
+    """The loaded sections of a 32 bit little endian ELF file."""
+
+    def __init__(self, path):
+        with open(path, "rb") as elf:
+            data = elf.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError(path + " is not a 32 bit little endian ELF file")
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            (_, kind, flags, addr, offset,
+             size) = struct.unpack_from("<IIIIII", data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and kind != SHT_NOBITS and size > 0:
+                self.sections.append((addr, size, data[offset:offset + size]))
+
+    def string(self, address):
+        """The NUL terminated string at address, None if it is not loaded."""
+        for addr, size, contents in self.sections:
+            if addr <= address < addr + size:
+                start = address - addr
+                end = contents.find(b"\0", start)
+                if end < 0:
+                    end = size
+                return contents[start:end].decode("latin-1")
+        return None
+
+
+def argument(conversion, word):
+    """The Python value of a 32 bit argument word for a printf conversion."""
+    if conversion in "eEfFgG":
+        return struct.unpack("<f", struct.pack("<I", word))[0]
+    if conversion in "di":
+        return word - (1 << 32) if word & 0x80000000 else word
+    if conversion == "c":
+        return chr(word & 0xFF)
+    return word
+
+
+def format_record(form, words):
+    """Formats words like printf() would have with the format string form."""
+    out = []
+    last = 0
+    args = iter(words)
+    for match in CONVERSION.finditer(form):
+        out.append(form[last:match.start()])
+        last = match.end()
+        flags, _, conversion = match.groups()
+        if conversion == "%":
+            out.append("%")
+            continue
+        word = next(args, 0)
+        if conversion == "p":
+            out.append("0x%08x" % word)
+        else:
+            python = "d" if conversion == "u" else conversion
+            out.append(("%" + flags + python) % argument(conversion, word))
+    out.append(form[last:])
+    return "".join(out).rstrip("\r\n")
+
+
+def records(trace):
+    """Yields (sequence, address, time in us, arguments) from the trace.
+
+    Anything that does not start with BTRACEMAGIC is skipped a word at a time,
+    so a record that was cut off does not spoil the ones after it.
+    """
+    count = len(trace) // 4
+    words = struct.unpack("<%dI" % count, trace[:count * 4])
+    i = 0
+    while i + BTRACEHEADER <= len(words):
+        head = words[i]
+        count = (head >> 16) & 0xFF
+        if head >> 24 != BTRACEMAGIC or i + BTRACEHEADER + count > len(words):
+            i += 1
+            continue
+        start = i + BTRACEHEADER
+        yield (head & 0xFFFF, words[i + 1], words[i + 2],
+               words[start:start + count])
+        i = start + count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="the .elf of the firmware on the board")
+    parser.add_argument("trace",
+                        help="trace.bin, or a capture of the ITM port")
+    args = parser.parse_args()
+
+    firmware = Firmware(args.elf)
+    with open(args.trace, "rb") as trace:
+        data = trace.read()
+
+    last_sequence = None
+    last_time = None
+    elapsed = 0
+    for sequence, address, time, words in records(data):
+        if last_sequence is not None:
+            lost = (sequence - last_sequence - 1) & 0xFFFF
+            if lost:
+                print("... %d records dropped" % lost)
+        last_sequence = sequence
+
+        # the microsecond ticker wraps every 71 minutes
+        if last_time is not None:
+            elapsed += (time - last_time) & 0xFFFFFFFF
+        last_time = time
+
+        form = firmware.string(address)
+        if form is None:
+            text = "unknown format 0x%08x %s" % (
+                address, " ".join("%08x" % w for w in words))
+        else:
+            text = format_record(form, words)
+        print("%12.6f %s" % (elapsed / 1e6, text))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Prints where the CPU was from the windows of PcProfiler.h.
+
+The windows only hold the sampled addresses, so the decoder needs the .elf of
+the firmware that took them to find the functions. The windows come from the
+SD card's profile.bin, or from a capture of ITM stimulus port PROFILERITMPORT
+on boards that have one.
+
+    python3 Supervisor/decode_profile.py BUILD/K64F/GCC_ARM/firmware.elf \\
+        /media/sd/profile.bin | c++filt
+
+c++filt turns the C++ names of the .elf back into their declarations.
+"""
+
+import argparse
+import bisect
+import struct
+import sys
+
+# keep in step with PcProfiler.h
+PROFILERMAGIC = 0xC5
+PROFILERHEADER = 5
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+
+
+class Symbols:
+    """The functions of a 32 bit little endian ELF file, by address."""
+
+    def __init__(self, path):
+        with open(path, "rb") as elf:
+            data = elf.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError(path + " is not a 32 bit little endian ELF file")
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+        sections = [struct.unpack_from("<IIIIIIIIII", data,
+                                       shoff + i * shentsize)
+                    for i in range(shnum)]
+        functions = []
+        for section in sections:
+            if section[1] != SHT_SYMTAB:
+                continue
+            offset, size, link = section[4], section[5], section[6]
+            strings = sections[link][4]
+            for at in range(offset, offset + size, 16):
+                name, value, length, info = struct.unpack_from("<IIIB",
+                                                               data, at)
+                if info & 0xF != STT_FUNC or value == 0:
+                    continue
+                end = data.find(b"\0", strings + name)
+                text = data[strings + name:end].decode("latin-1")
+                # the low bit of a Thumb function's address is set
+                functions.append((value & ~1, length, text))
+        functions.sort()
+        self.starts = [start for start, _, _ in functions]
+        self.functions = functions
+
+    def function(self, address):
+        """The name of the function at address, None if there is none."""
+        i = bisect.bisect_right(self.starts, address) - 1
+        if i < 0:
+            return None
+        start, length, name = self.functions[i]
+        if address >= start + max(length, 2):
+            return None
+        return name
+
+
+def windows(profile):
+    """Yields (start us, end us, samples, missed, [(address, count)]).
+
+    Anything that does not start with PROFILERMAGIC is skipped a word at a
+    time, so a window that was cut off does not spoil the ones after it.
+    """
+    count = len(profile) // 4
+    words = struct.unpack("<%dI" % count, profile[:count * 4])
+    i = 0
+    while i + PROFILERHEADER <= len(words):
+        head = words[i]
+        entries = head & 0xFFFF
+        end = i + PROFILERHEADER + 2 * entries
+        if head >> 24 != PROFILERMAGIC or end > len(words):
+            i += 1
+            continue
+        start = i + PROFILERHEADER
+        pairs = list(zip(words[start:end:2], words[start + 1:end:2]))
+        yield words[i + 1], words[i + 2], words[i + 3], words[i + 4], pairs
+        i = end
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="the .elf of the firmware on the board")
+    parser.add_argument("profile",
+                        help="profile.bin, or a capture of the ITM port")
+    parser.add_argument("--top", type=int, default=30,
+                        help="how many functions to print")
+    parser.add_argument("--addresses", action="store_true",
+                        help="count every address apart, for addr2line")
+    args = parser.parse_args()
+
+    symbols = Symbols(args.elf)
+    with open(args.profile, "rb") as profile:
+        data = profile.read()
+
+    counts = {}
+    samples = 0
+    missed = 0
+    elapsed = 0
+    for start, end, taken, lost, pairs in windows(data):
+        # the microsecond ticker wraps every 71 minutes
+        elapsed += (end - start) & 0xFFFFFFFF
+        samples += taken
+        missed += lost
+        for address, count in pairs:
+            if args.addresses:
+                key = "0x%08x %s" % (address,
+                                     symbols.function(address) or "?")
+            else:
+                key = symbols.function(address) or "0x%08x" % address
+            counts[key] = counts.get(key, 0) + count
+
+    if samples == 0:
+        print("No samples in " + args.profile)
+        return 1
+    print("%d samples in %.1f s, %d (%.1f%%) did not fit into the table" %
+          (samples, elapsed / 1e6, missed, 100.0 * missed / samples))
+    ranked = sorted(counts.items(), key=lambda item: item[1], reverse=True)
+    for key, count in ranked[:args.top]:
+        print("%6.2f%% %8d  %s" % (100.0 * count / samples, count, key))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,432 @@
+/// \file
+/// \brief Greentea test of the sampling cadence under uplink and storage
+/// load.
+///
+/// The scan and the sample clock run like in the firmware, while threads
+/// load the ESP8266's UART with requests and the SD card with sector
+/// reads and writes. The frame callback keeps the DWT cycle counter of
+/// every frame, and every reading is handed to the uplink thread, which
+/// keeps how long it took to get there. Each case asserts the frame
+/// jitter, the frame rate, the reading jitter, the wake-up latency of the
+/// reading and the end-to-end latency against the bounds below, and sends
+/// what it measured to the host as "cadence" keys for trend tracking.
+///
+/// The storage load writes back the bytes it read, near the end of the
+/// card, so the config file and the logs on it are left as they are.
+/// Without a card it loads a HeapBlockDevice instead.
+///
+/// The last case stops the scan like the low-power mode does between its
+/// readings, and checks that the tickless kernel of the K64F overrides in
+/// mbed_app.json spends the wait in deep sleep, from the deep_sleep_time of
+/// mbed_stats_cpu_get(). It sends the share as a "cadence" key too.
+
+#include "mbed.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include "hal/lp_ticker_api.h"
+#include "hal/ticker_api.h"
+
+#include "ADCScan.h"
+#include "BoardPins.h"
+#include "DMAUARTSerial.h"
+#include "HeapBlockDevice.h"
+#include "RequestWriter.h"
+#include "SDHCBlockDevice.h"
+#include "SampleClock.h"
+
+#include <algorithm>
+
+using namespace utest::v1;
+
+/// The frames per second of the scan, the firmware's SCANRATE
+#define CADENCESCANRATE (2000.0f)
+
+/// The seconds between two readings
+#define CADENCEINTERVAL (0.1f)
+
+/// The readings of one case, 30 seconds of them
+#define CADENCEREADINGS (300)
+
+/// How far a frame may come from 1 / CADENCESCANRATE after the one
+/// before, in microseconds
+#ifndef CADENCEFRAMEJITTERUS
+#define CADENCEFRAMEJITTERUS (50)
+#endif
+
+/// How far the frame rate may be from CADENCESCANRATE, in parts per
+/// million
+#ifndef CADENCERATEPPM
+#define CADENCERATEPPM (1000)
+#endif
+
+/// How far a reading may be taken from CADENCEINTERVAL after the one
+/// before, in microseconds. The lp ticker that times them ticks in 31 us
+#ifndef CADENCEREADINGJITTERUS
+#define CADENCEREADINGJITTERUS (600)
+#endif
+
+/// The p99 of how long a reading may wait for its thread after it was
+/// taken, in microseconds
+#ifndef CADENCEWAKEUS
+#define CADENCEWAKEUS (2000)
+#endif
+
+/// The p99 of how long a reading may take from its frame until the
+/// uplink sent it, in microseconds
+#ifndef CADENCELATENCYUS
+#define CADENCELATENCYUS (50000)
+#endif
+
+/// The baud rate of the uplink load, the fastest the firmware runs the
+/// ESP8266 at
+#define CADENCEUPLINKBAUD (921600)
+
+/// The bytes the uplink load sends for every reading
+#define CADENCEREQUESTSIZE (1024)
+
+/// The bytes of one read and write back of the storage load
+#define CADENCESTORAGECHUNK (4096)
+
+/// The bytes at the end of the card that the storage load goes through
+#define CADENCESTORAGEWINDOW (1024 * 1024)
+
+/// The size of the HeapBlockDevice without a card
+#define CADENCEHEAPSIZE (32 * 1024)
+
+/// The milliseconds of the idle wait of the deep sleep case, a third of the
+/// firmware's LOWPOWERINTERVAL
+#define CADENCEIDLEMS (10000)
+
+/// The least share of the idle wait that has to be spent in deep sleep, in
+/// percent. The LPTMR wakes the kernel for its own timers in between
+#ifndef CADENCEDEEPSLEEPPERCENT
+#define CADENCEDEEPSLEEPPERCENT (90)
+#endif
+
+/// A reading on its way to the uplink thread, a Taken of 0 stops it
+struct CadenceReading {
+    uint64_t Taken;
+};
+
+/// what the frame callback keeps, in DWT cycles
+static volatile uint32_t LastFrame = 0;
+static volatile uint64_t FrameCycles = 0;
+static volatile uint32_t Frames = 0;
+static volatile uint32_t MaxFrameError = 0;
+
+/// the cycles between two frames at CADENCESCANRATE
+static uint32_t FramePeriod = 0;
+
+/// every reading of a case, in microseconds
+static uint32_t ReadingJitter[CADENCEREADINGS];
+static uint32_t WakeLatency[CADENCEREADINGS];
+static uint32_t EndToEnd[CADENCEREADINGS];
+static volatile uint32_t Sent = 0;
+
+static Mail<CadenceReading, 16> Readings;
+static ADCScan *Scanner = NULL;
+static volatile bool StorageRunning = false;
+static uint8_t StorageChunk[CADENCESTORAGECHUNK];
+
+#if USESDHC
+static SDHCBlockDevice Card(BOARDSDDETECT);
+#endif
+
+static uint64_t lpMicros() { return ticker_read_us(get_lp_ticker_data()); }
+
+static uint32_t cyclesToUs(uint64_t Cycles) {
+    return Cycles / (SystemCoreClock / 1000000);
+}
+
+// keeps the gap to the frame before, from interrupt context
+static void onFrame(const uint16_t *frame, size_t count) {
+    uint32_t Now = DWT->CYCCNT;
+    if (Frames > 0) {
+        // the counter wraps around, the unsigned difference is still right
+        uint32_t Gap = Now - LastFrame;
+        uint32_t Error = Gap > FramePeriod ? Gap - FramePeriod
+                                           : FramePeriod - Gap;
+        if (Error > MaxFrameError) {
+            MaxFrameError = Error;
+        }
+        FrameCycles += Gap;
+    }
+    LastFrame = Now;
+    ++Frames;
+}
+
+static DMAUARTSerial &uplinkPort() {
+    static DMAUARTSerial Port(BOARDESPTX, BOARDESPRX, CADENCEUPLINKBAUD);
+    return Port;
+}
+
+static bool sendToUplink(const char *Data, size_t Length) {
+    return uplinkPort().write(Data, Length) == (ssize_t)Length;
+}
+
+// writes a request for every reading out of the ESP8266's UART, and keeps
+// how long after its frame it went out
+static void uplinkLoad(bool *Load) {
+    char Window[64];
+    for (;;) {
+        osEvent Event = Readings.get();
+        if (Event.status != osEventMail) {
+            continue;
+        }
+        CadenceReading *Reading = (CadenceReading *)Event.value.p;
+        uint64_t Taken = Reading->Taken;
+        Readings.free(Reading);
+        if (Taken == 0) {
+            return;
+        }
+        if (*Load) {
+            RequestWriter Message(Window, sizeof(Window),
+                                  callback(sendToUplink));
+            Message.append("GET /bulk_sensor_readings.php?Board_ID=cadence");
+            while (Message.flushed() + Message.length() < CADENCEREQUESTSIZE) {
+                Message.append("&Port[]=");
+                Message.appendFloat(Taken % 1000 * 0.001f);
+            }
+            Message.finish();
+        }
+        if (Sent < CADENCEREADINGS) {
+            EndToEnd[Sent] = lpMicros() - Taken;
+        }
+        ++Sent;
+    }
+}
+
+// reads chunks near the end of Device and writes them back as they were
+static void storageLoad(BlockDevice *Device) {
+    bd_size_t Window = std::min<bd_size_t>(Device->size(),
+                                           CADENCESTORAGEWINDOW);
+    bd_addr_t Start = Device->size() - Window;
+    bd_addr_t At = 0;
+    while (StorageRunning) {
+        if (Device->read(StorageChunk, Start + At, CADENCESTORAGECHUNK) ||
+            Device->program(StorageChunk, Start + At, CADENCESTORAGECHUNK)) {
+            printf("The storage load failed at %llu\r\n", Start + At);
+            return;
+        }
+        At = (At + CADENCESTORAGECHUNK) % Window;
+    }
+}
+
+// the card the firmware logs to, or a heap device without one
+static BlockDevice *storageDevice() {
+#if USESDHC
+    BlockDevice *Device = &Card;
+#else
+    BlockDevice *Device = BlockDevice::get_default_instance();
+#endif
+    if (Device != NULL && Device->init() == 0 &&
+        Device->size() >= CADENCESTORAGECHUNK) {
+        return Device;
+    }
+    printf("There is no SD card, the storage load goes to the heap\r\n");
+    static HeapBlockDevice Heap(CADENCEHEAPSIZE, 512);
+    Heap.init();
+    return &Heap;
+}
+
+static uint32_t percentile(uint32_t *Values, size_t Count, unsigned Percent) {
+    if (Count == 0) {
+        return 0;
+    }
+    std::sort(Values, Values + Count);
+    return Values[Count * Percent / 100 < Count ? Count * Percent / 100
+                                                : Count - 1];
+}
+
+static void sendResult(const char *Case, const char *Name, uint32_t Value) {
+    char Text[64];
+    snprintf(Text, sizeof(Text), "%s,%s,%lu", Case, Name,
+             (unsigned long)Value);
+    greentea_send_kv("cadence", Text);
+}
+
+// takes CADENCEREADINGS readings with the uplink and storage load that are
+// asked for, and checks them against the bounds
+static void runCadence(const char *Case, bool Uplink, bool Storage) {
+    static SampleClock Clock;
+    static const PinName Pins[] = {BOARDPORTPINS};
+    if (Scanner == NULL) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        FramePeriod = SystemCoreClock / CADENCESCANRATE;
+        Scanner = new ADCScan(Pins, sizeof(Pins) / sizeof(Pins[0]));
+        Scanner->attach(callback(&Clock, &SampleClock::push));
+        Scanner->attach(onFrame);
+        TEST_ASSERT_EQUAL(SCANSUCCESS, Scanner->start(CADENCESCANRATE));
+    }
+
+    static bool UplinkLoad;
+    UplinkLoad = Uplink;
+    Sent = 0;
+    Thread Uplinker(osPriorityNormal, 2048, NULL, "uplink");
+    Uplinker.start(callback(uplinkLoad, &UplinkLoad));
+
+    Thread Storer(osPriorityNormal, 2048, NULL, "storage");
+    if (Storage) {
+        StorageRunning = true;
+        Storer.start(callback(storageLoad, storageDevice()));
+    }
+
+    core_util_critical_section_enter();
+    Frames = 0;
+    FrameCycles = 0;
+    MaxFrameError = 0;
+    core_util_critical_section_exit();
+
+    uint16_t Frame[SCANMAXPORTS];
+    Clock.start(CADENCEINTERVAL, CADENCESCANRATE);
+    uint32_t Missed = Clock.missed();
+    uint64_t Before = 0;
+    const uint32_t IntervalUs = CADENCEINTERVAL * 1000000;
+    size_t Taken = 0;
+    for (; Taken < CADENCEREADINGS; ++Taken) {
+        if (!Clock.wait(Frame, CADENCEINTERVAL * 1000 + 1000)) {
+            break;
+        }
+        uint64_t Now = lpMicros();
+        uint64_t At = Clock.takenMicros();
+        WakeLatency[Taken] = Now - At;
+        uint32_t Gap = Before == 0 ? IntervalUs : At - Before;
+        ReadingJitter[Taken] =
+            Gap > IntervalUs ? Gap - IntervalUs : IntervalUs - Gap;
+        Before = At;
+
+        CadenceReading *Reading = Readings.alloc();
+        if (Reading != NULL) {
+            Reading->Taken = At;
+            Readings.put(Reading);
+        }
+    }
+    Missed = Clock.missed() - Missed;
+
+    // stop the loads
+    StorageRunning = false;
+    CadenceReading *Stop = NULL;
+    while ((Stop = Readings.alloc()) == NULL) {
+        ThisThread::sleep_for(1);
+    }
+    Stop->Taken = 0;
+    Readings.put(Stop);
+    Uplinker.join();
+    if (Storage) {
+        Storer.join();
+    }
+
+    core_util_critical_section_enter();
+    uint32_t FrameCount = Frames;
+    uint64_t Cycles = FrameCycles;
+    uint32_t FrameError = cyclesToUs(MaxFrameError);
+    core_util_critical_section_exit();
+
+    // the frames per million seconds, so the ppm are whole numbers
+    uint64_t RateMicroHz =
+        Cycles ? (uint64_t)(FrameCount - 1) * SystemCoreClock * 1000000 /
+                     Cycles
+               : 0;
+    uint64_t Expected = CADENCESCANRATE * 1000000;
+    uint32_t RatePpm =
+        (RateMicroHz > Expected ? RateMicroHz - Expected
+                                : Expected - RateMicroHz) *
+        1000000 / Expected;
+    size_t Delivered = std::min<size_t>(Sent, Taken);
+    uint32_t JitterMax = percentile(ReadingJitter, Taken, 100);
+    uint32_t WakeP99 = percentile(WakeLatency, Taken, 99);
+    uint32_t LatencyP99 = percentile(EndToEnd, Delivered, 99);
+    uint32_t LatencyMax = percentile(EndToEnd, Delivered, 100);
+
+    printf("%s: %lu frames at %lu.%06lu Hz (%lu ppm off), frame jitter "
+           "%lu us, reading jitter %lu us, wake p99 %lu us, end to end "
+           "p99 %lu us max %lu us, %lu missed\r\n",
+           Case, (unsigned long)FrameCount,
+           (unsigned long)(RateMicroHz / 1000000),
+           (unsigned long)(RateMicroHz % 1000000), (unsigned long)RatePpm,
+           (unsigned long)FrameError, (unsigned long)JitterMax,
+           (unsigned long)WakeP99, (unsigned long)LatencyP99,
+           (unsigned long)LatencyMax, (unsigned long)Missed);
+    sendResult(Case, "frame_jitter_us", FrameError);
+    sendResult(Case, "rate_ppm", RatePpm);
+    sendResult(Case, "reading_jitter_us", JitterMax);
+    sendResult(Case, "wake_p99_us", WakeP99);
+    sendResult(Case, "latency_p99_us", LatencyP99);
+    sendResult(Case, "missed", Missed);
+
+    TEST_ASSERT_EQUAL(CADENCEREADINGS, Taken);
+    TEST_ASSERT_EQUAL(CADENCEREADINGS, Delivered);
+    TEST_ASSERT_EQUAL(0, Missed);
+    TEST_ASSERT_UINT32_WITHIN(CADENCEFRAMEJITTERUS, 0, FrameError);
+    TEST_ASSERT_UINT32_WITHIN(CADENCERATEPPM, 0, RatePpm);
+    TEST_ASSERT_UINT32_WITHIN(CADENCEREADINGJITTERUS, 0, JitterMax);
+    TEST_ASSERT_UINT32_WITHIN(CADENCEWAKEUS, 0, WakeP99);
+    TEST_ASSERT_UINT32_WITHIN(CADENCELATENCYUS, 0, LatencyP99);
+}
+
+static void testIdle() { runCadence("idle", false, false); }
+
+static void testUplink() { runCadence("uplink", true, false); }
+
+static void testStorage() { runCadence("storage", false, true); }
+
+static void testUplinkAndStorage() { runCadence("uplink+storage", true, true); }
+
+// waits CADENCEIDLEMS with the scan stopped, like the low-power mode between
+// two readings, and checks how much of it was deep sleep
+static void testDeepSleep() {
+#if !defined(MBED_TICKLESS) || !MBED_CPU_STATS_ENABLED
+    TEST_FAIL_MESSAGE("The K64F overrides in mbed_app.json add MBED_TICKLESS "
+                      "and platform.cpu-stats-enabled");
+#else
+    if (Scanner != NULL) {
+        Scanner->stop();
+    }
+    // the console is done with what the cases before printed
+    ThisThread::sleep_for(100);
+    bool CanDeepSleep = sleep_manager_can_deep_sleep();
+
+    mbed_stats_cpu_t Before;
+    mbed_stats_cpu_get(&Before);
+    ThisThread::sleep_for(CADENCEIDLEMS);
+    mbed_stats_cpu_t After;
+    mbed_stats_cpu_get(&After);
+
+    us_timestamp_t Uptime = After.uptime - Before.uptime;
+    uint32_t DeepPercent = (uint32_t)(
+        (After.deep_sleep_time - Before.deep_sleep_time) * 100 / Uptime);
+    uint32_t IdlePercent =
+        (uint32_t)((After.idle_time - Before.idle_time) * 100 / Uptime);
+    printf("idle wait: %lu %% deep sleep, %lu %% idle over %lu ms\r\n",
+           (unsigned long)DeepPercent, (unsigned long)IdlePercent,
+           (unsigned long)(Uptime / 1000));
+    sendResult("deepsleep", "deep_sleep_percent", DeepPercent);
+    sendResult("deepsleep", "idle_percent", IdlePercent);
+
+    TEST_ASSERT_TRUE_MESSAGE(CanDeepSleep,
+                             "Something holds a DeepSleepLock while idle");
+    TEST_ASSERT_TRUE_MESSAGE(DeepPercent >= CADENCEDEEPSLEEPPERCENT,
+                             "The idle wait was not spent in deep sleep");
+#endif
+}
+
+static utest::v1::status_t testSetup(const size_t Cases) {
+    GREENTEA_SETUP(300, "default_auto");
+    return verbose_test_setup_handler(Cases);
+}
+
+static Case Cases[] = {
+    Case("Cadence without load", testIdle),
+    Case("Cadence under uplink load", testUplink),
+    Case("Cadence under storage load", testStorage),
+    Case("Cadence under uplink and storage load", testUplinkAndStorage),
+    Case("Deep sleep while idle between readings", testDeepSleep),
+};
+
+static Specification Spec(testSetup, Cases);
+
+int main() { return !Harness::run(Spec); }
@@ -0,0 +1,191 @@
+/// \file
+/// \brief Greentea benchmark of the LittleFS cache profile of the backup
+/// log.
+///
+/// Appends the same records with the generic profile of littlefs'
+/// mbed_lib.json and with the backup store's profile from BackupStore.h,
+/// each synced after every record and after every staged block of
+/// LOGSTAGESIZE, the way the backup log flushes. The block device is
+/// wrapped in a ProfilingBlockDevice, so every run prints the time and the
+/// bytes read, programmed and erased per record, and sends them to the host
+/// as "littlefs" keys.
+///
+/// The runs go to the stores of the backup log, which they format: the
+/// flashiap-block-device region of the internal flash, and the SD card's
+/// BACKUPPARTITION when the card has one. Neither holds the config file.
+
+#include "mbed.h"
+
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest/utest.h"
+
+#include "LittleFileSystem.h"
+#include "MBRBlockDevice.h"
+#include "ProfilingBlockDevice.h"
+
+#include "BackupStore.h"
+#include "OfflineLogging.h"
+#include "SDHCBlockDevice.h"
+
+#if COMPONENT_FLASHIAP
+#include "FlashIAPBlockDevice.h"
+#endif
+
+using namespace utest::v1;
+
+/// The bytes of one record, about one reading of a few ports
+#define PROFILERECORDSIZE (32)
+
+/// The records of one run
+#define PROFILERECORDS (512)
+
+/// How one run appends
+struct ProfileRun {
+    const char *Name;
+    lfs_size_t ReadSize;
+    lfs_size_t ProgSize;
+    lfs_size_t Lookahead;
+    /// the records between two syncs
+    size_t SyncEvery;
+};
+
+/// How many records make a staged block
+#define PROFILEBLOCKRECORDS (LOGSTAGESIZE / PROFILERECORDSIZE)
+
+static const ProfileRun Runs[] = {
+    {"generic, every record", MBED_LFS_READ_SIZE, MBED_LFS_PROG_SIZE,
+     MBED_LFS_LOOKAHEAD, 1},
+    {"generic, every block", MBED_LFS_READ_SIZE, MBED_LFS_PROG_SIZE,
+     MBED_LFS_LOOKAHEAD, PROFILEBLOCKRECORDS},
+    {"logging, every record", BACKUPLFSREADSIZE, BACKUPLFSPROGSIZE,
+     BACKUPLFSLOOKAHEAD, 1},
+    {"logging, every block", BACKUPLFSREADSIZE, BACKUPLFSPROGSIZE,
+     BACKUPLFSLOOKAHEAD, PROFILEBLOCKRECORDS},
+};
+
+#define PROFILERUNS (sizeof(Runs) / sizeof(Runs[0]))
+
+/// What one run cost per record
+struct ProfileCost {
+    uint32_t Us;
+    uint32_t Read;
+    uint32_t Programmed;
+    uint32_t Erased;
+};
+
+#if USESDHC
+static SDHCBlockDevice Card(BOARDSDDETECT);
+#endif
+
+static uint8_t Record[PROFILERECORDSIZE];
+
+static void sendResult(const char *Store, const char *Run, const char *Name,
+                       uint32_t Value) {
+    char Text[96];
+    snprintf(Text, sizeof(Text), "%s,%s,%s,%lu", Store, Run, Name,
+             (unsigned long)Value);
+    greentea_send_kv("littlefs", Text);
+}
+
+// formats Device with the profile of Run and appends PROFILERECORDS
+// records to one file
+static ProfileCost appendRecords(const char *Store, BlockDevice *Device,
+                                 const ProfileRun &Run) {
+    ProfilingBlockDevice Profile(Device);
+    LittleFileSystem Fs("bench", NULL, Run.ReadSize, Run.ProgSize,
+                        MBED_LFS_BLOCK_SIZE, Run.Lookahead);
+    TEST_ASSERT_EQUAL(0, Fs.reformat(&Profile));
+
+    File Log;
+    TEST_ASSERT_EQUAL(0, Log.open(&Fs, "PortReadings.dat",
+                                  O_WRONLY | O_CREAT | O_APPEND));
+    Profile.reset();
+    Timer Took;
+    Took.start();
+    for (size_t i = 0; i < PROFILERECORDS; ++i) {
+        memset(Record, i, sizeof(Record));
+        TEST_ASSERT_EQUAL(PROFILERECORDSIZE,
+                          Log.write(Record, sizeof(Record)));
+        if ((i + 1) % Run.SyncEvery == 0) {
+            TEST_ASSERT_EQUAL(0, Log.sync());
+        }
+    }
+    TEST_ASSERT_EQUAL(0, Log.close());
+    Took.stop();
+
+    ProfileCost Cost = {
+        (uint32_t)(Took.read_high_resolution_us() / PROFILERECORDS),
+        (uint32_t)(Profile.get_read_count() / PROFILERECORDS),
+        (uint32_t)(Profile.get_program_count() / PROFILERECORDS),
+        (uint32_t)(Profile.get_erase_count() / PROFILERECORDS)};
+    TEST_ASSERT_EQUAL(0, Fs.unmount());
+
+    printf("%s, %s: %lu us, %lu B read, %lu B programmed, %lu B erased "
+           "per record\r\n",
+           Store, Run.Name, (unsigned long)Cost.Us, (unsigned long)Cost.Read,
+           (unsigned long)Cost.Programmed, (unsigned long)Cost.Erased);
+    sendResult(Store, Run.Name, "us", Cost.Us);
+    sendResult(Store, Run.Name, "read", Cost.Read);
+    sendResult(Store, Run.Name, "programmed", Cost.Programmed);
+    sendResult(Store, Run.Name, "erased", Cost.Erased);
+    return Cost;
+}
+
+// goes through every run on Device. The logging profile, synced once a
+// block, has to move fewer bytes per record than the generic one synced
+// after every record, which is what the backup store did before
+static void benchmarkStore(const char *Store, BlockDevice *Device) {
+    ProfileCost Costs[PROFILERUNS];
+    for (size_t i = 0; i < PROFILERUNS; ++i) {
+        Costs[i] = appendRecords(Store, Device, Runs[i]);
+    }
+    const ProfileCost &Before = Costs[0];
+    const ProfileCost &After = Costs[PROFILERUNS - 1];
+    TEST_ASSERT_TRUE(After.Read + After.Programmed <
+                     Before.Read + Before.Programmed);
+}
+
+#if COMPONENT_FLASHIAP
+static void testFlash() {
+    static FlashIAPBlockDevice Flash;
+    benchmarkStore("internal flash", &Flash);
+}
+#endif
+
+static void testCardPartition() {
+#if USESDHC
+    BlockDevice *Sd = &Card;
+#else
+    BlockDevice *Sd = BlockDevice::get_default_instance();
+#endif
+    TEST_SKIP_UNLESS_MESSAGE(Sd != NULL && Sd->init() == 0,
+                             "There is no SD card");
+    MBRBlockDevice Partition(Sd, BACKUPPARTITION);
+    int Err = Partition.init();
+    if (Err == 0) {
+        Partition.deinit();
+    } else {
+        Sd->deinit();
+    }
+    TEST_SKIP_UNLESS_MESSAGE(Err == 0, "The SD card has no backup partition");
+    benchmarkStore("SD card partition", &Partition);
+    Sd->deinit();
+}
+
+static utest::v1::status_t testSetup(const size_t Cases) {
+    GREENTEA_SETUP(600, "default_auto");
+    return verbose_test_setup_handler(Cases);
+}
+
+static Case Cases[] = {
+#if COMPONENT_FLASHIAP
+    Case("LittleFS profiles on the internal flash", testFlash),
+#endif
+    Case("LittleFS profiles on the SD card's backup partition",
+         testCardPartition),
+};
+
+static Specification Spec(testSetup, Cases);
+
+int main() { return !Harness::run(Spec); }
@@ -1,105 +1,1411 @@
 /// \file
 /// \brief Contains the logic and control flow for the entire program.
-
+#define TRACE_GROUP "main"
+
+#include "ADCScan.h"
+#include "AdaptiveRate.h"
+#include "Aggregator.h"
+#include "AllocProfiler.h"
+#include "BacklogThrottle.h"
+#include "BackupStore.h"
+#include "BinaryTrace.h"
 #include "BoardConfig.h"
+#include "BoardPins.h"
+#include "BrownOut.h"
+#include "Calibration.h"
+#include "CaptureStore.h"
+#include "CardClock.h"
+#include "CardRecovery.h"
+#include "ClockScaler.h"
+#include "ClockSync.h"
+#include "ConfigDelta.h"
+#include "CrashLog.h"
+#include "CriticalStats.h"
+#include "Deadband.h"
+#include "DeadlineMonitor.h"
+#include "DeferredLog.h"
+#include "ESPTranscript.h"
+#include "EnergyIntegrator.h"
+#include "EnergyMeter.h"
+#include "ExternalADC.h"
+#include "FixedPorts.h"
+#include "FirmwareUpdate.h"
+#include "FlashCache.h"
+#include "FlashQueue.h"
+#include "FrameStream.h"
+#include "LinkStats.h"
+#include "LocalServer.h"
+#include "MemoryTelemetry.h"
+#include "ModbusMaster.h"
+#include "ModbusServer.h"
 #include "Networking.h"
 #include "OfflineLogging.h"
+#include "Oversampler.h"
+#include "PcProfiler.h"
+#include "PipelineTrace.h"
+#include "PowerQuality.h"
+#include "PulseCounter.h"
+#include "RMSEngine.h"
+#include "RangeCheck.h"
+#include "RateSchedule.h"
+#include "ReconnectScheduler.h"
+#include "RemoteShell.h"
+#include "RetainedFrames.h"
+#include "SampleClock.h"
+#include "SensorHealth.h"
+#include "Sequence.h"
+#include "StackSizer.h"
+#include "Supervisor.h"
+#include "ThresholdMonitor.h"
+#include "TimeSync.h"
+#include "USBService.h"
+#include "VirtualPorts.h"
+#include "WaveCapture.h"
 #include "debugging.h"
 #include "mbed.h"
 #include <cmath>
 
 #include "BlockDevice.h"
+#include "SDHCBlockDevice.h"
 
 #include "ATCmdParser.h"
-#include "UARTSerial.h"
+#include "DMAUARTSerial.h"
 
+#if USESDHC
+// The SD card slot on the SDHC's 4 bit bus
+SDHCBlockDevice sdhc(BOARDSDDETECT);
+BlockDevice *bd = &sdhc;
+#else
 // This will take the system's default block device
 BlockDevice *bd = BlockDevice::get_default_instance();
+#endif
 
 #include "FATFileSystem.h"
 FATFileSystem fs("sd");
 
 using namespace std;
 
-/// The watchdog timer goes off after PollingInterval*WATCHDOGCOEFF seconds
+/// The watchdog resets the board if the sampling loop does not come around
+/// for PollingInterval*WATCHDOGCOEFF seconds
 #define WATCHDOGCOEFF (5)
 
-/// the serial timeout for the ESP8266 in milliseconds
-#define SERIALTIMEOUT (3000)
+/// The watchdog resets the board if the uploader thread is stuck for this
+/// many milliseconds
+#define UPLOADERTIMEOUTMS (60000)
+
+/// how many frames per second the ADC scan converts
+#define SCANRATE (2000.0f)
+
+/// how many frames go into each RMS window of the AC ports (200 ms)
+#define RMSWINDOW (400)
+
+/// how many sample frames can wait in RAM for the network or the SD card
+#define SAMPLEBUFFERLEN (32)
+
+/// Readings that are at least this many seconds apart are taken in low-power
+/// mode. The ADC scan only runs around each reading, and the readings are
+/// handed to the uploader in batches, so the MCU can stay in VLPS between
+/// them.
+#define LOWPOWERINTERVAL (30.0f)
+
+/// How many readings are kept in RAM in low-power mode before they are sent
+/// or backed up. Has to be SAMPLEBUFFERLEN or less
+#define LOWPOWERBATCH (8)
+
+/// How much longer than the interval the loop waits for the sample clock's
+/// frame, in milliseconds, before it takes the latest frame instead
+#define SAMPLECLOCKSLACKMS (1000)
+
+/// How long the ADC scan runs before a reading in low-power mode, in
+/// milliseconds. This fills a whole RMS window
+#define SCANWARMUPMS ((int)(RMSWINDOW * 1000 / SCANRATE) + 50)
+
+/// the stack size of the uploader thread, a batch upload keeps
+/// BACKUPBATCHMAX frames on it.
+/// Set with "uploader-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_UPLOADER_STACK_SIZE
+#define UPLOADERSTACKSIZE MBED_CONF_APP_UPLOADER_STACK_SIZE
+#else
+#define UPLOADERSTACKSIZE (8192)
+#endif
+
+/// the stack size of the thread that brings up the ESP8266 at boot.
+/// Set with "esp-stack-size" in mbed_app.json.
+#ifdef MBED_CONF_APP_ESP_STACK_SIZE
+#define ESPBOOTSTACKSIZE MBED_CONF_APP_ESP_STACK_SIZE
+#else
+#define ESPBOOTSTACKSIZE (2048)
+#endif
+
+/// how often the uploader checks in and flushes the backup log, whether
+/// readings come in or not, in milliseconds
+#define HOUSEKEEPINGMS (SUPERVISORCHECKMS)
+
+/// how often the uploader looks for the answers to the commands that went
+/// out without waiting, while they are outstanding, in milliseconds
+#define ANSWERPOLLMS (10)
+
+/// The ESP8266 is brought up on a thread of its own at boot, while the SD
+/// card is mounted, the config is loaded and the first readings are taken.
+/// The uploader waits for it before it uses the ESP8266
+struct ESPBoot {
+    ATCmdParser *Parser;
+    DMAUARTSerial *Serial;
+    Thread *Worker;
+
+    /// what startESP() returned
+    int Result;
+};
+
+// waits for the ESP8266 to boot and starts it, it runs on its own thread
+static void bootESP(ESPBoot *Boot) {
+    if (!waitESPReady(Boot->Parser)) {
+        printf("The ESP8266 did not say it is ready\r\n");
+    }
+    Boot->Result = startESP(Boot->Parser, Boot->Serial);
+    // the thread ends here, its stack is only seen while it runs
+    stackSample();
+}
 
-// for the watchdog timer, we will have a timeout that goes off
-// and resets the program. This function will be detached and reattached
-// throughout the life of the program to keep from resetting all the time
-/// Resets timeout by detaching first, and then attaching the NVIC_SystemReset()
-/// function to the timeout with the new_delay
-void resetWatchdog(Timeout &timeout, float new_delay) {
-    timeout.detach();
-    timeout.attach(&NVIC_SystemReset, new_delay);
+/// An event of the uploader's queue. It is posted without taking any of the
+/// queue's memory, so it can not fail or allocate at runtime
+typedef UserAllocatedEvent<Callback<void()>, void()> UploaderEvent;
+
+/// Everything the uploader thread works with. Once it is started, only the
+/// uploader thread uses the ESP8266 and the backup file.
+struct UploaderState {
+    ATCmdParser *Parser;
+    BoardSpecs *Specs;
+    const char *BackupLogDir;
+
+    /// false if the backup log could not be mounted, readings then go to
+    /// the flash queue
+    bool LogReady;
+
+    /// when the SD card was last tried again while LogReady is false, in
+    /// Kernel::get_ms_count() milliseconds
+    uint64_t RemountMs;
+
+    /// readings from the sampling loop that are waiting to be sent
+    Mail<SampleFrame, SAMPLEBUFFERLEN> *Samples;
+
+    /// set from the server's response, the sampling loop waits this long
+    volatile float PollingInterval;
+
+    /// set by the uploader if the ESP8266 did not start, the sampling loop
+    /// reads it
+    volatile bool OfflineMode;
+
+    /// the ESP8266's bring-up, it is done once the first event ran
+    ESPBoot *Boot;
+
+    /// sends the readings in Samples, the sampling loop posts it
+    UploaderEvent *Sending;
+
+    /// wakes the ESP8266 espWakeMs() before the readings are handed off, the
+    /// sampling loop posts it
+    UploaderEvent *Waking;
+
+    /// saves Capture once it froze, the sampling loop posts it. The SD card
+    /// is only used from the uploader thread, so the sampling loop never
+    /// waits for a long read of the backlog to let go of the card
+    UploaderEvent *SavingCapture;
+    WaveCapture *Capture;
+
+    /// tries the wifi again while it is down
+    ReconnectScheduler *Reconnect;
+
+    /// takes the answers to the commands that went out without waiting.
+    /// The ESP8266's serial port posts it from sigio, and while answers are
+    /// outstanding it posts one of Polling, the other one while the first
+    /// still dispatches
+    UploaderEvent *Answering;
+    UploaderEvent *Polling[2];
+
+    /// the one of Polling that waits, -1 if there is none
+    int PollingWaiting;
+
+    /// the one of Polling that is posted next
+    int PollingNext;
+
+#if USBSERVICE
+    /// hands the SD card to a computer on the USB port, or takes it back.
+    /// The service button posts it
+    UploaderEvent *Servicing;
+    USBService *Service;
+
+    /// when Servicing last ran, in Kernel::get_ms_count() milliseconds
+    uint64_t ServicedMs;
+#endif
+
+    /// the uploader thread's id for heartbeat()
+    int Heartbeat;
+
+    /// held by the uploader while it uses Specs, the sampling loop only
+    /// changes Specs while it holds it
+    Mutex SpecsLock;
+};
+
+#if BACKLOGPRIORITY
+/// The log of every LogClass, the raw readings stay in BACKUPLOGDIR
+static const char *const ClassLogDirs[LOGCLASSES] = {
+    BACKUPEVENTDIR, BACKUPSUMMARYDIR, BACKUPLOGDIR};
+#endif
+
+// returns the log that Sample is backed up to
+static const char *backupDir(UploaderState &State, const SampleFrame &Sample) {
+#if BACKLOGPRIORITY
+    return ClassLogDirs[logClass(Sample)];
+#else
+    return State.BackupLogDir;
+#endif
 }
 
-int main() {
+// returns the log that the backlog is sent from next, the one of the first
+// class that has readings to send. NULL if there are none
+static const char *nextBacklog(UploaderState &State) {
+    if (!State.LogReady) {
+        return NULL;
+    }
+#if BACKLOGPRIORITY
+    for (const char *LogDir : ClassLogDirs) {
+        if (checkForBackupFile(LogDir)) {
+            return LogDir;
+        }
+    }
+    return NULL;
+#else
+    return checkForBackupFile(State.BackupLogDir) ? State.BackupLogDir : NULL;
+#endif
+}
 
-    // interval for the sensor polling
-    float PollingInterval = 5.0f;
+#if NETWORKMESH
+// returns how many readings of every class wait in the backup log
+static size_t backlogPending(UploaderState &State) {
+#if BACKLOGPRIORITY
+    size_t Pending = 0;
+    for (const char *LogDir : ClassLogDirs) {
+        Pending += pendingSensorData(LogDir);
+    }
+    return Pending;
+#else
+    return pendingSensorData(State.BackupLogDir);
+#endif
+}
+#endif
+
+// backs Sample up to the backup log, or to the flash queue if the log can
+// not take it
+static void backUp(UploaderState &State, const SampleFrame &Sample) {
+    TraceMark Start = traceMark();
+    crashLogBegin(CrashBackup);
+    if (!(State.LogReady && dumpSensorDataToFile(*State.Specs, Sample,
+                                                 backupDir(State, Sample))) &&
+        !pushFlashQueue(Sample)) {
+        tr_error("The reading could not be backed up");
+    }
+    crashLogEnd(CrashBackup);
+    traceSince(TraceBackup, Start);
+}
+
+// returns true if the backup log or the flash queue has readings to send
+static bool backlogWaiting(UploaderState &State) {
+    return nextBacklog(State) != NULL || flashQueueSize() > 0;
+}
+
+// returns true if a waveform capture waits to be sent. Captures go after the
+// readings of the backlog, and a live reading does not wait for them
+static bool captureWaiting(UploaderState &State) {
+    return CAPTUREPORTS != 0 && State.LogReady && captureCount(CAPTUREDIR) > 0;
+}
+
+// returns true if the server asked for a range of the backup log that was
+// not all sent yet. It goes before the rest of the backlog
+static bool queryWaiting(UploaderState &State) {
+#if BACKLOGQUERY
+    return State.LogReady && backlogQueryWaiting();
+#else
+    return false;
+#endif
+}
+
+// connects to the wifi if it is not connected, returns true if it is
+static bool joinWifi(UploaderState *State) {
+    if (isConnected(State->Parser)) {
+        return true;
+    }
+    BoardSpecs &Specs = *State->Specs;
+    tr_info("Trying to connect to %s", Specs.NetworkSSID.c_str());
+    crashLogBegin(CrashConnect);
+    int wifi_err = connectESPWiFi(State->Parser, Specs);
+    crashLogEnd(CrashConnect, wifi_err);
+    if (wifi_err != NETWORKSUCCESS) {
+        tr_warn("Connection attempt %u failed error = %d",
+                State->Reconnect->failures() + 1, wifi_err);
+        return false;
+    }
+    tr_info("Connected to %s", Specs.NetworkSSID.c_str());
+    return true;
+}
+
+// one attempt of the reconnect scheduler, it runs on the uploader thread
+static bool reconnectWifi(UploaderState *State) {
+    ClockHold Burst;
+    State->SpecsLock.lock();
+    bool Connected = joinWifi(State);
+    State->SpecsLock.unlock();
+    return Connected;
+}
+
+// sends backed up readings and captures for as long as no new reading waits,
+// and the backlog did not use up its share of the interval or of the site's
+// network
+static void drainBacklog(UploaderState &State) {
+    ATCmdParser *_parser = State.Parser;
+    BoardSpecs &Specs = *State.Specs;
+    int wifi_err = NETWORKSUCCESS;
+
+    // the backlog waits while the tasks miss their deadlines
+    if (deadlineShedding()) {
+        return;
+    }
+
+    // the backlog only gets its share of the time until the next reading
+    uint64_t Start = Kernel::get_ms_count();
+    uint64_t Budget = (uint64_t)(State.PollingInterval * 10.0f * BACKLOGSHARE);
+
+    // send backed up data while no new reading is waiting, the backup log
+    // first and then the flash queue
+    while (State.Samples->empty() &&
+           (queryWaiting(State) || backlogWaiting(State) ||
+            captureWaiting(State))) {
+        if (BACKLOGSHARE < 100 && Kernel::get_ms_count() - Start >= Budget) {
+            break;
+        }
+#if LORAWANUPLINK
+        // one uplink per slot of the duty cycle, the rest waits for the next
+        if (!loraSlotDue()) {
+            break;
+        }
+#endif
+        if (!backlogMayGo()) {
+            break;
+        }
+
+        heartbeat(State.Heartbeat);
+#if GATEWAYROLE == GATEWAYHUB
+        // the children wait for their acks while the backlog is sent
+        pollGateway(_parser);
+#endif
+        float tmp = -1.0f;
+        size_t sent = 0;
+        bool FromQuery = queryWaiting(State);
+        // the events and the summaries go before the raw readings
+        const char *BackupLogDir = FromQuery ? NULL : nextBacklog(State);
+        bool FromLog = BackupLogDir != NULL;
+        bool FromCapture = !FromQuery && !FromLog && flashQueueSize() == 0 &&
+                           captureWaiting(State);
+        SampleFrame Queued;
+        uint32_t SentBefore = uplinkBytes();
+        if (FromQuery) {
+#if BACKLOGQUERY
+            tr_info("Sending readings the database asked for again.");
+            wifi_err =
+                sendQueriedBatchTCP(_parser, Specs, State.BackupLogDir, tmp);
+#endif
+        } else if (FromLog) {
+            tr_info("Sending backed up data to the database.");
+            wifi_err =
+                sendBackupBatchTCP(_parser, Specs, BackupLogDir, tmp, sent);
+        } else if (FromCapture) {
+            tr_info("Sending a waveform capture to the database.");
+            wifi_err = sendCaptureTCP(_parser, Specs, CAPTUREDIR, tmp);
+        } else if (peekFlashQueue(Queued)) {
+            tr_info("Sending a reading from the flash queue.");
+            wifi_err = sendBulkDataTCP(_parser, Specs, Queued, tmp);
+        } else {
+            break;
+        }
+
+        backlogUsed(uplinkBytes() - SentBefore);
+
+        if (tmp != -1.0f && tmp > 0.0f) {
+            State.PollingInterval = tmp;
+            tr_info("Sample interval is now %f", tmp);
+        }
+
+        if (wifi_err == NETWORKSUCCESS) {
+            // the server has the report of the last reset now, the answer
+            // to its commands and the link counters
+            crashReportSent();
+            shellReplySent();
+            linkStatsSent();
+        }
+
+        if (FromQuery &&
+            (wifi_err == NETWORKSUCCESS || wifi_err == NETWORKNOTHINGSENT)) {
+            // the readings stay in the log, the query moved on by itself
+
+        } else if (FromCapture && (wifi_err == NETWORKSUCCESS ||
+                                   wifi_err == NETWORKNOTHINGSENT ||
+                                   wifi_err == NETWORKNOTFOUND)) {
+            // a server that does not take captures answers with a 404,
+            // keeping them would hold up the backlog
+            dropCapture(CAPTUREDIR);
+
+        } else if (FromLog && wifi_err == NETWORKNOTHINGSENT) {
+            // nothing valid left to send, drop what is left
+            crashLogBegin(CrashBacklogDelete, sent);
+            deleteDataEntries(Specs, BackupLogDir, sent > 0 ? sent : 1);
+            crashLogEnd(CrashBacklogDelete);
+
+        } else if (wifi_err != NETWORKSUCCESS) {
+            tr_warn("Failed to transmit backed up data to the Database, "
+                    "error code = %d",
+                    wifi_err);
+            break; // stop transmitting if data transmission failed.
+
+        } else if (FromLog) { // delete data entries if data was sent
+            crashLogBegin(CrashBacklogDelete, sent);
+            deleteDataEntries(Specs, BackupLogDir, sent);
+            crashLogEnd(CrashBacklogDelete);
+            energyUploaded(sent);
+
+        } else {
+            popFlashQueue();
+            energyUploaded(1);
+        }
+    }
+}
+
+// sends Sample on the live link, or backs it up if that did not work.
+// Returns true if it was sent
+static bool sendLive(UploaderState &State, const SampleFrame &Sample) {
+    BoardSpecs &Specs = *State.Specs;
+    tr_debug("Sending the last port reading to the database");
+    float tmp = -1;
+    int wifi_err = sendBulkDataTCP(State.Parser, Specs, Sample, tmp);
+
+    if (tmp != -1.0f && tmp > 0.0f) {
+        State.PollingInterval = tmp;
+        tr_info("Sample interval is now %f", tmp);
+    }
+    BTRACE("sent a reading, error = %d", wifi_err);
+    if (wifi_err == NETWORKSUCCESS) {
+        crashReportSent();
+        shellReplySent();
+        linkStatsSent();
+        energyUploaded(1);
+    } else {
+        tr_warn("Could not send data to database, error = %d", wifi_err);
+        backUp(State, Sample);
+    }
+    return wifi_err == NETWORKSUCCESS;
+}
+
+// sends Sample to the server, or backs it up if that is not possible. With
+// LIVEFIRST it goes out before the backlog, else the backlog is sent first
+// and Sample is backed up behind it if the backlog is not done by then.
+static void uploadSample(UploaderState &State, const SampleFrame &Sample) {
+    ATCmdParser *_parser = State.Parser;
+
+    // in offline mode, just dump data to file
+    if (State.OfflineMode) {
+        tr_debug("In offline mode. Dumping data to file.");
+        backUp(State, Sample);
+        return;
+    }
+
+#if NETWORKMESH || LORAWANUPLINK || NETWORKCELLULAR
+    // every request wakes the radio of every hop on its way, so the reading
+    // waits in the backup log until there are MESHBATCH for one request. An
+    // uplink only goes when the duty cycle lets it, with the readings of
+    // every window since the last one. The modem only wakes for the batch
+    // of each PSM period
+    if (State.LogReady) {
+        backUp(State, Sample);
+#if NETWORKMESH
+        if (backlogPending(State) < MESHBATCH) {
+            return;
+        }
+#elif NETWORKCELLULAR
+        if (!cellularWindowDue()) {
+            return;
+        }
+#else
+        if (!loraSlotDue()) {
+            return;
+        }
+#endif
+        if (!isConnected(_parser)) {
+            State.Reconnect->lost();
+            return;
+        }
+        State.Reconnect->connected();
+        drainBacklog(State);
+#if NETWORKCELLULAR
+        cellularBatchSent();
+#endif
+        return;
+    }
+#endif
+
+    // back up data if you are not connected, the reconnect scheduler tries
+    // the wifi again in the meantime. It is woken early by the sampling loop
+    // and awake already, unless the reading came sooner than expected
+    if (!wakeESP(_parser) || !isConnected(_parser)) {
+        State.Reconnect->lost();
+        backUp(State, Sample);
+        tr_debug("Backed up Active Port data");
+        return;
+    }
+    // the ESP8266 may have joined again on its own
+    State.Reconnect->connected();
+
+#if LIVEFIRST
+    // the dashboards get the reading right away, even after an outage with
+    // hours of backlog
+    if (sendLive(State, Sample)) {
+        drainBacklog(State);
+    }
+#else
+    drainBacklog(State);
+
+    // older readings are still waiting, so this one goes after them. One
+    // that is held back by the site's rate does not hold up the live ones
+    if (backlogWaiting(State) && backlogMayGo()) {
+        backUp(State, Sample);
+        return;
+    }
+    sendLive(State, Sample);
+#endif
+}
 
-    Timeout watchdog;
+#if BROWNOUTWARNING
+// keeps Sample where it lasts right away while the supply is low: in the
+// flash queue, or in the backup log with its block written out
+static void keepForBrownOut(UploaderState &State, const SampleFrame &Sample) {
+    if (FLASHQUEUE && pushFlashQueue(Sample)) {
+        return;
+    }
+    backUp(State, Sample);
+    flushSensorData();
+}
+#endif
+
+#if RETAINEDFRAMES
+#if RETAINEDFRAMES < SAMPLEBUFFERLEN + LOWPOWERBATCH
+#error "retained-frames needs room for the mail and the low-power batch"
+#endif
+
+// backs up the readings that the last boot had in RAM when it was reset,
+// they are sent with the rest of the backlog
+static void keepRetainedFrames(UploaderState &State) {
+    SampleFrame Frame;
+    while (takeRetainedFrame(Frame)) {
+        Frame.Timestamp = syncedTime(Frame.Timestamp);
+#if SEQUENCEDUPLOADS
+        Frame.Sequence = nextSequence();
+#endif
+        backUp(State, Frame);
+    }
+    flushSensorData();
+    retainedKept();
+}
+#endif
+
+/// The upload event. It takes readings out of State.Samples until there
+/// are none left, so a slow server only delays the uploads.
+static void sendReadings(UploaderState *State) {
+    ClockHold Burst;
+    while (true) {
+        osEvent evt = State->Samples->get(0);
+        if (evt.status != osEventMail) {
+            // nothing left to send until the next handoff
+            sleepESP(State->Parser);
+            return;
+        }
+        heartbeat(State->Heartbeat);
+
+        SampleFrame *Slot = static_cast<SampleFrame *>(evt.value.p);
+        SampleFrame Sample = *Slot;
+        State->Samples->free(Slot);
+
+        // a reading from before the clock was set is logged with the time
+        // it was taken at, once the clock is set
+        Sample.Timestamp = syncedTime(Sample.Timestamp);
+#if SEQUENCEDUPLOADS
+        // the number stays with the reading if it is backed up
+        Sample.Sequence = nextSequence();
+#else
+        Sample.Sequence = 0;
+#endif
+        retainedHandled();
+#if BROWNOUTWARNING
+        if (brownOutActive()) {
+            keepForBrownOut(*State, Sample);
+            retainedKept();
+            continue;
+        }
+#endif
+
+        State->SpecsLock.lock();
+#if POWERQUALITY
+        // between requests, so the metrics stay the same while one is sent
+        powerQuality().update();
+#endif
+        uploadSample(*State, Sample);
+        State->SpecsLock.unlock();
+        traceWaited(Sample.Timestamp);
+
+        // the reading was sent, or backed up where it lasts
+        if (!sensorDataStaged()) {
+            retainedKept();
+        }
+    }
+}
+
+/// The answer event, see UploaderState::Answering. The DMA serial port only
+/// raises sigio when its ring wraps, so an answer that is outstanding is
+/// also looked for every ANSWERPOLLMS
+static void answerCommands(UploaderState *State) {
+    ClockHold Burst;
+    int WaitMs = answerESP(State->Parser);
+    if (WaitMs < 0 || State->PollingWaiting >= 0) {
+        return;
+    }
+    UploaderEvent *Polling = State->Polling[State->PollingNext];
+    Polling->delay(WaitMs < ANSWERPOLLMS ? WaitMs : ANSWERPOLLMS);
+    if (Polling->try_call()) {
+        State->PollingWaiting = State->PollingNext;
+        State->PollingNext ^= 1;
+    }
+}
+
+static void pollCommands(UploaderState *State) {
+    State->PollingWaiting = -1;
+    answerCommands(State);
+}
+
+// the ESP8266's serial port has data, from its interrupt
+static void postAnswering(UploaderEvent *Answering) { Answering->try_call(); }
+
+/// The first event of the uploader. It waits for the ESP8266 to start, then
+/// joins the wifi. The readings that were taken until then wait in Samples
+static void finishBoot(UploaderState *State) {
+    ClockHold Burst;
+    State->Boot->Worker->join();
+    if (State->Boot->Result != NETWORKSUCCESS) {
+        printf("\r\n ESP Chip was not initialized, entering offline mode\r\n");
+        State->OfflineMode = true;
+        return;
+    }
+    if (State->Boot->Serial != NULL) {
+        State->Boot->Serial->sigio(callback(postAnswering, State->Answering));
+    }
+    if (!State->OfflineMode && !reconnectWifi(State)) {
+        State->Reconnect->lost();
+    }
+}
 
-    // name of the file where data is stored
-    const char BackupFileName[] = "/sd/PortReadings.dat";
+/// The wake event, posted ahead of a handoff so that the ESP8266 is awake
+/// when the readings come in.
+static void wakeRadio(UploaderState *State) {
+    ClockHold Burst;
+    if (!State->OfflineMode) {
+        wakeESP(State->Parser);
+    }
+}
 
-    Timer PollingTimer; // Timer that controlls when polling happens
+#if USBSERVICE
+/// A press of the button does not toggle the service mode again for this
+/// many milliseconds, the contacts bounce
+#define SERVICEDEBOUNCEMS (1000)
+
+// unmounts the FAT and hands the SD card to the computer. The log and the
+// captures must not have anything open or cached, the computer may change
+// them
+static void startService(UploaderState &State) {
+    if (!State.LogReady) {
+        tr_warn("The SD card is not mounted, there is nothing to hand out");
+        return;
+    }
+    flushSensorData();
+    releaseSensorData();
+    releaseCaptures();
+    State.LogReady = false;
+    fs.unmount();
+
+    int err = State.Service->start();
+    if (err != USBSERVICESUCCESS) {
+        tr_error("The SD card could not be put on the USB port (%d)", err);
+        State.LogReady = fs.mount(bd) == 0;
+        return;
+    }
+    tr_info("The SD card is on the USB port, readings go to the flash queue");
+}
 
-    // Try to mount the filesystem
-    printf("Mounting the filesystem... ");
-    fflush(stdout);
+// takes the SD card back from the computer and mounts the FAT again
+static void endService(UploaderState &State) {
+    State.Service->stop();
     int err = fs.mount(bd);
-    printf("%s\n", (err ? "Fail :(" : "OK"));
-    printf("\r\n");
+    State.LogReady = err == 0;
+    if (err) {
+        tr_error("The SD card could not be mounted after the USB service "
+                 "mode (%d)",
+                 err);
+        return;
+    }
+    tr_info("The SD card is back from the USB port");
+}
+
+/// The service event, posted by the button. It starts or ends the USB
+/// service mode, see USBService.h.
+static void toggleService(UploaderState *State) {
+    uint64_t Now = Kernel::get_ms_count();
+    if (Now - State->ServicedMs < SERVICEDEBOUNCEMS) {
+        return;
+    }
+    State->ServicedMs = Now;
+    if (State->Service->active()) {
+        endService(*State);
+    } else {
+        startService(*State);
+    }
+}
+
+// the fall of the service button, in interrupt context
+static void pressService(UploaderEvent *Servicing) { Servicing->try_call(); }
+#endif
+
+#if BROWNOUTWARNING
+// writes out what a reset would lose, the supply is falling. The staged
+// block holds the most readings and is one write, it goes first. The SD
+// card still works until the PMC resets the board
+static void saveForBrownOut(UploaderState *State) {
+    ClockHold Burst;
+    crashLogBegin(CrashBrownOut, brownOutWarnings());
+    tr_warn("The supply is low, writing out the readings in RAM");
+    flushSensorData();
+#if SEQUENCEDUPLOADS
+    commitSequence();
+#endif
+#if ENERGYINTEGRATOR
+    energyIntegrator().save();
+#endif
+    // the readings that wait for the uploader are kept, not sent
+    sendReadings(State);
+    crashLogEnd(CrashBrownOut);
+}
+
+// the low voltage warning, in interrupt context
+static void warnBrownOut(UploaderEvent *Saving) { Saving->try_call(); }
+#endif
+
+#if !BACKUPINFLASH
+// mounts the SD card again after it did not mount, or only read-only. The
+// readings that went to the flash queue meanwhile stay there until they
+// are sent
+static void remountCard(UploaderState &State) {
+    State.RemountMs = Kernel::get_ms_count();
+    bool ReadOnly = false;
+    if (mountCard(fs, bd, ReadOnly) != 0 || ReadOnly) {
+        return;
+    }
+    int err = mountBackupStore(bd);
+    State.LogReady = err == 0;
     if (err) {
-        // Reformat if we can't mount the filesystem
-        // this should only happen on the first boot
-        printf("No filesystem found, formatting... ");
-        fflush(stdout);
-        err = fs.reformat(bd);
-        printf("%s\n", (err ? "Fail :(" : "OK"));
-        if (err) {
-            error("error: %s (%d)\n", strerror(-err), err);
+        tr_error("The backup log could not be mounted (%d)", err);
+        return;
+    }
+    tr_info("The SD card is back, readings are backed up to it again");
+}
+#endif
+
+#if GATEWAYROLE == GATEWAYHUB
+// acks the datagrams of the children, and sends what they queued to the
+// server once the batch is due and the network is up
+static void relayChildren(UploaderState &State) {
+    pollGateway(State.Parser);
+    if (!gatewayBatchDue() || !isConnected(State.Parser)) {
+        return;
+    }
+    float tmp = -1.0f;
+    int wifi_err = sendGatewayBatchTCP(State.Parser, *State.Specs, tmp);
+    if (tmp > 0.0f) {
+        State.PollingInterval = tmp;
+        tr_info("Sample interval is now %f", tmp);
+    }
+    if (wifi_err != NETWORKSUCCESS && wifi_err != NETWORKNOTHINGSENT) {
+        tr_warn("Failed to relay the readings of the children, error code = "
+                "%d",
+                wifi_err);
+    }
+    // the datagrams that came in while the batch was sent
+    pollGateway(State.Parser);
+}
+#endif
+
+/// The periodic event of the uploader, every HOUSEKEEPINGMS. The writes to
+/// the SD card and the reports are left to it, so they never hold up a
+/// reading that is being sent.
+static void houseKeep(UploaderState *State) {
+    ClockHold Burst;
+    heartbeat(State->Heartbeat);
+    deadlineRan(DeadlineHousekeeping, HOUSEKEEPINGMS);
+
+    // a lost link is noticed between readings too, the reconnect attempts
+    // are events of their own
+    if (!State->OfflineMode) {
+        State->SpecsLock.lock();
+        if (!isConnected(State->Parser)) {
+            State->Reconnect->lost();
         }
-        printf(
-            "There is not config file since the drive was just formatted\r\n");
-        printf("Exiting\r\n");
-        return -1;
+        State->SpecsLock.unlock();
+        // the link status query isConnected() sent is answered meanwhile
+        answerCommands(State);
     }
 
-    // data is gathered from these ports/sensor pins
-    AnalogIn Port[] = {PTB2,  PTB3, PTB10, PTB11, PTC11,
-                       PTC10, PTC2, PTC0,  PTC9,  PTC8};
-    const char *config_file = "/sd/IAC_Config_File.txt";
+#if POWERQUALITY
+    State->SpecsLock.lock();
+    powerQuality().update();
+    State->SpecsLock.unlock();
+#endif
+#if ENERGYINTEGRATOR
+    State->SpecsLock.lock();
+    energyIntegrator().update(State->Specs->Ports);
+    State->SpecsLock.unlock();
+#endif
+
+#if USBSERVICE
+    // the FAT is mounted again as soon as the computer let go of it
+    if (State->Service->ejected()) {
+        endService(*State);
+    }
+#endif
+
+#if !BACKUPINFLASH
+    // a card that did not mount is tried again now and then, the readings
+    // go to the flash queue until it works
+    if (!State->LogReady &&
+        Kernel::get_ms_count() - State->RemountMs >= CARDREMOUNTMS) {
+#if USBSERVICE
+        if (!State->Service->active())
+#endif
+            remountCard(*State);
+    }
+#endif
 
-    bool OfflineMode = false; // indicates whether to actually send data or not
+    // backed up readings only wait in RAM for so long
+    flushSensorData(LOGFLUSHMS);
+    if (!sensorDataStaged()) {
+        retainedKept();
+    }
+
+    // a supply that came back may warn again
+    rearmBrownOutWarning();
 
-    /// how many times to try connecting to the wifi before giving up
-    int wifi_tries = WIFITRIES;
+    // a backlog that fills the store is summed up before it runs out
+    if (State->LogReady) {
+        compactSensorData(State->BackupLogDir);
+    }
+    stepFlashQueue();
+    stepBackupStore();
+    deadlineReport();
+    if (!deadlineShedding()) {
+        traceReport();
+        criticalReport();
+        allocReport();
+        stackReport();
+        energyReport();
+    }
+    btraceFlush();
+    profilerFlush();
+    linkStatsRoll();
+    runShellCommands(State->Parser);
+#if MEMORYTELEMETRY
+    sampleMemoryTelemetry();
+#endif
+#if MQTTPUBLISH
+    // settings from the broker can come in at any time
+    float tmp = -1.0f;
+    pollMqtt(tmp);
+    if (tmp > 0.0f) {
+        State->PollingInterval = tmp;
+        tr_info("Sample interval is now %f", tmp);
+    }
+#endif
+#if GATEWAYROLE == GATEWAYHUB
+    // the readings of the children go in a request of their own, between
+    // the ones of the gateway
+    if (!State->OfflineMode) {
+        State->SpecsLock.lock();
+        relayChildren(*State);
+        State->SpecsLock.unlock();
+    }
+#endif
+#if CLOCKSYNC
+    // the network time is asked for every CLOCKSYNCPERIODS
+    if (!State->OfflineMode) {
+        State->SpecsLock.lock();
+        if (isConnected(State->Parser)) {
+            syncNetworkTime();
+        }
+        State->SpecsLock.unlock();
+    }
+#endif
+#if OTAUPDATE
+    // an update comes in a few pieces at a time, between the uploads
+    if (!State->OfflineMode) {
+        State->SpecsLock.lock();
+        int Update = isConnected(State->Parser)
+                         ? stepFirmwareUpdate(State->Parser, *State->Specs)
+                         : FIRMWAREIDLE;
+        State->SpecsLock.unlock();
+        if (Update == FIRMWAREREADY) {
+            // the bootloader swaps it in, the readings in RAM go first
+            flushSensorData();
+#if SEQUENCEDUPLOADS
+            commitSequence();
+#endif
+#if ENERGYINTEGRATOR
+            energyIntegrator().save();
+#endif
+            printf("Restarting into the new firmware\r\n");
+            NVIC_SystemReset();
+        }
+    }
+#endif
 
-    UARTSerial *_serial = new UARTSerial(PTC17, PTC16, 115200);
+    // the upload event can not be posted again while it runs, so a reading
+    // that was handed off just as it returned is picked up here
+    sendReadings(State);
+}
+
+/// The capture event. It saves the frozen capture, which then looks for the
+/// next trigger.
+static void saveFrozenCapture(UploaderState *State) {
+    ClockHold Burst;
+    WaveCapture &Capture = *State->Capture;
+    uint32_t Age = Capture.framesSinceTrigger() / (uint32_t)SCANRATE;
+    State->SpecsLock.lock();
+    if (!State->LogReady ||
+        !saveCapture(CAPTUREDIR, Capture, *State->Specs, time(NULL) - Age,
+                     (uint32_t)SCANRATE)) {
+        tr_warn("The waveform capture could not be kept");
+    }
+    State->SpecsLock.unlock();
+    Capture.rearm();
+}
+
+static_assert(sizeof(ScanCalibration) * SCANADCCOUNT <= FLASHCALIBRATIONMAX,
+              "the ADC calibration does not fit into FLASHCALIBRATIONMAX");
+
+// keeps the calibration of the ADCs in the flash if the scan ran a new one
+// since Saved, for the next boot
+static void keepCalibration(const ADCScan &Scanner, uint32_t &Saved) {
+    ScanCalibration Calibration[SCANADCCOUNT];
+    uint32_t Runs = Scanner.calibration(Calibration);
+    if (Runs == Saved) {
+        return;
+    }
+    Saved = Runs;
+    int err = saveCalibrationCache(Calibration, sizeof(Calibration));
+    if (err) {
+        tr_warn("The ADC calibration could not be kept in the flash (%d)",
+                err);
+    }
+}
+
+#if CLOCKSYNC
+// moves the sample clock's next frame onto the next whole Tick of the
+// network time, which is the same instant on every board with that interval
+static void alignSampleClock(SampleClock &Clock, float Tick) {
+    uint64_t Taken = Clock.takenMicros();
+    uint64_t TakenUtc;
+    if (!networkTime(Taken, TakenUtc)) {
+        return;
+    }
+    // the last frame was on a whole Tick already, or near one
+    uint64_t Period = (uint64_t)(Tick * 1000000.0f + 0.5f);
+    uint64_t Next = ((TakenUtc + Period / 2) / Period + 1) * Period;
+    Clock.align(Taken + (Next - TakenUtc));
+}
+#endif
+
+// hands Sample to the uploader thread
+static void handOff(UploaderState &State, const SampleFrame &Sample) {
+    SampleFrame *Slot = State.Samples->alloc();
+    retainedOffered(Slot != NULL);
+    if (Slot != NULL) {
+        *Slot = Sample;
+        State.Samples->put(Slot);
+        // does nothing if the event is still waiting to run
+        State.Sending->try_call();
+    } else {
+        tr_warn("The uploader is behind, dropping this reading");
+        BTRACE("dropped a reading");
+    }
+}
+
+// the name of a port, for the printouts
+static inline const char *portName(const PortInfo &Port) {
+    return Port.Name.c_str();
+}
+
+static inline const char *portName(const FixedPort &Port) {
+    return Port.Name;
+}
+
+// keeps the latest value of a configured port, and its waveform if it was
+// used. The fixed table is constant, so nothing is kept for it
+static inline void keepReading(PortInfo &Port, float Value,
+                               const WaveformStats *Waveform) {
+    Port.Value = Value;
+    if (Waveform != NULL) {
+        Port.Mean = Waveform->Mean * Port.Multiplier;
+        Port.RMS = Waveform->RMS * Port.Multiplier;
+        Port.Peak = Waveform->Peak * Port.Multiplier;
+    }
+}
+
+static inline void keepReading(const FixedPort &Port, float Value,
+                               const WaveformStats *Waveform) {}
+
+#if PULSECHANNELS
+// reads the pulses of every counter since the last reading into the ports
+// from First on, after the pins. A counter without a configured port is
+// still taken, so its next reading does not hold the pulses of before
+static void readPulses(PulseCounter &Pulses, vector<PortInfo> &Ports,
+                       size_t First, size_t NumPorts, SampleFrame &Sample) {
+    for (size_t c = 0; c < Pulses.count(); ++c) {
+        uint32_t Count = Pulses.take(c);
+        size_t i = First + c;
+        if (i >= NumPorts || i >= FRAMEMAXPORTS ||
+            Ports[i].Multiplier == 0.0f || !Ports[i].Formula.empty()) {
+            continue;
+        }
+        Sample.Raw[i] = Count > 0xFFFF ? 0xFFFF : Count;
+        Sample.PortMask |= 1U << i;
+        keepReading(Ports[i], Sample.value(i, Ports[i].Multiplier), NULL);
+        BTRACE("pulses %u = %lu", (unsigned)i, (unsigned long)Count);
+    }
+}
+#endif
+
+#if MODBUSPOINTS
+// reads the latest value of every Modbus register into the ports from
+// First on, after the pulse counters. A register that the bus did not
+// bring in lately is left out of the reading
+static void readModbus(const ModbusMaster &Modbus, vector<PortInfo> &Ports,
+                       size_t First, size_t NumPorts, SampleFrame &Sample) {
+    for (size_t k = 0; k < Modbus.count(); ++k) {
+        size_t i = First + k;
+        uint16_t Raw;
+        if (i >= NumPorts || i >= FRAMEMAXPORTS ||
+            Ports[i].Multiplier == 0.0f || !Ports[i].Formula.empty() ||
+            !Modbus.read(k, Raw)) {
+            continue;
+        }
+        Sample.Raw[i] = Raw;
+        Sample.PortMask |= 1U << i;
+        keepReading(Ports[i], Sample.value(i, Ports[i].Multiplier), NULL);
+        BTRACE("modbus %u = %u", (unsigned)i, (unsigned)Raw);
+    }
+}
+#endif
+
+// reads port i out of the latest frame into Sample. Port is a PortInfo or
+// a FixedPort, they have the same multiplier, range and AC members
+template <typename Port>
+static inline void readPort(size_t i, Port &Info, uint16_t Raw,
+                            Oversampler &Decimator, RMSEngine &Waveforms,
+                            const CalibrationTables &Calibration,
+                            SampleFrame &Sample) {
+    // read the port, scaled the same way as AnalogIn::read()
+    // use the raw frame until the first burst is averaged
+    float reading = Raw * (1.0f / (float)0xFFFF);
+    Decimator.read(i, reading);
+
+    WaveformStats stats;
+    bool Waveform = Info.AC && Waveforms.read(i, stats);
+    if (Waveform) {
+        reading = stats.RMS;
+    }
+    Sample.setReading(i, reading);
+
+    // the calibration works on the raw reading, so the frame has the
+    // calibrated one too
+    Sample.Raw[i] = Calibration.apply(i, Sample.Raw[i]);
+    float Value = Sample.Raw[i] * (1.0f / (float)0xFFFF) * Info.Multiplier;
+
+    // the range is checked for the whole frame once all ports are read
+    keepReading(Info, Value, Waveform ? &stats : NULL);
+
+    // only compiled in with MBED_TRACE_MAX_LEVEL at TRACE_LEVEL_DEBUG
+    tr_debug("%s's value = %f", portName(Info), Value);
+    BTRACE("port %u = %f", (unsigned)i, Value);
+}
+
+// reads the ports from the config file, however many there are
+static void readPorts(vector<PortInfo> &Ports, size_t NumPorts,
+                      const uint16_t *Frame, Oversampler &Decimator,
+                      RMSEngine &Waveforms,
+                      const CalibrationTables &Calibration,
+                      SampleFrame &Sample) {
+    for (size_t i = 0; i < NumPorts && i < FRAMEMAXPORTS; ++i) {
+
+        // only reads the port if a port is connected, a virtual port is
+        // worked out after the others
+        if (Ports[i].Multiplier != 0.0f && Ports[i].Formula.empty()) {
+            readPort(i, Ports[i], Frame[i], Decimator, Waveforms, Calibration,
+                     Sample);
+        }
+    }
+}
+
+#if FIXEDPORTS
+// reads the ports of the fixed table. N and every multiplier are known when
+// this is compiled, so the loop is unrolled
+template <size_t N>
+static void readPorts(const std::array<FixedPort, N> &Ports,
+                      const uint16_t *Frame, Oversampler &Decimator,
+                      RMSEngine &Waveforms,
+                      const CalibrationTables &Calibration,
+                      SampleFrame &Sample) {
+    for (size_t i = 0; i < N; ++i) {
+        readPort(i, Ports[i], Frame[i], Decimator, Waveforms, Calibration,
+                 Sample);
+    }
+}
+#endif
+
+// marks the ports of Sample that are out of range, and says which ones
+static void checkRanges(const RangeCheck &Limits, const vector<PortInfo> &Ports,
+                        SampleFrame &Sample) {
+    Limits.check(Sample);
+    uint16_t Outside = Sample.OverMask | Sample.UnderMask;
+    for (size_t i = 0; Outside != 0 && i < Ports.size(); ++i) {
+        if ((Sample.OverMask >> i) & 1U) {
+            tr_warn("%s's value exceeded valid sample value range, assigning "
+                    "error value",
+                    Ports[i].Name.c_str());
+        } else if ((Sample.UnderMask >> i) & 1U) {
+            tr_warn("%s's value is under the valid sample range, assigning "
+                    "error value",
+                    Ports[i].Name.c_str());
+        }
+        Outside &= ~(1U << i);
+    }
+}
+
+// `mbed test` builds the rest of the app into the Greentea tests in TESTS/,
+// which bring their own main()
+#ifndef MBED_TEST_MODE
+int main() {
+    // the cache ways are split before the code that fills them runs
+    configureFlashCache();
+
+    // interval for the sensor polling
+    float PollingInterval = 5.0f;
+
+    // the directory where readings that could not be sent are stored
+    const char BackupLogDir[] = BACKUPLOGDIR;
+
+    const char *config_file = "/sd/IAC_Config_File.txt";
+
+    // the log is printed by its own thread, so logging does not wait for
+    // the UART
+    startLog();
+    // what the last boot was doing when it was reset, before anything
+    // writes over it
+    crashLogStart();
+    startRetainedFrames();
+    printResetReason();
+    traceStart();
+    startProfiler();
+    startAllocProfiler();
+    timeSyncStart();
+
+#if ESPTRANSCRIPT && (NETWORKSOCKETS || LORAWANUPLINK)
+#error "esp-transcript needs the AT commands, not network-sockets or lorawan"
+#endif
+#if CLOCKSCALING && (LOCALSERVER || MODBUSSERVER || USBSERVICE)
+#error "clock-scaling needs local-server, modbus-server and usb-service off"
+#endif
+#if NETWORKSOCKETS || LORAWANUPLINK
+    // the ESP8266Interface in the Networking module owns the serial port,
+    // and with LoRaWAN there is no ESP8266
+    ATCmdParser *_parser = NULL;
+    DMAUARTSerial *_serial = NULL;
+#else
+#if ESPTRANSCRIPT == ESPTRANSCRIPTREPLAY
+    // the ESP8266 is played from the transcript, so there is no baud rate
+    // to find
+    DMAUARTSerial *_serial = NULL;
+    ATCmdParser *_parser =
+        new ATCmdParser(new TranscriptReplay(ESPTRANSCRIPTFILE));
+#else
+    // the ESP8266 replies go straight into RAM through DMA
+    DMAUARTSerial *_serial =
+        new DMAUARTSerial(BOARDESPTX, BOARDESPRX, ESPDEFAULTBAUD);
+    clockAttach(callback(_serial, &DMAUARTSerial::retime));
+#if ESPTRANSCRIPT == ESPTRANSCRIPTRECORD
+    ATCmdParser *_parser =
+        new ATCmdParser(new TranscriptRecorder(_serial, ESPTRANSCRIPTFILE));
+#else
     ATCmdParser *_parser = new ATCmdParser(_serial);
+#endif
+#endif
 
-    _parser->debug_on(1);
+    _parser->debug_on(LOGATCOMMANDS);
     _parser->set_delimiter("\r\n");
     _parser->set_timeout(SERIALTIMEOUT);
+#endif
 
-    printf("\r\nReading board settings from %s\r\n", config_file);
-    BoardSpecs Specs = readSDCard("/sd/IAC_Config_File.txt");
-    // wait_us() is not deprecated, but wait() is
-    wait_us(1000000);
+    // the ESP8266 takes a second or more to boot and start, the readings
+    // do not wait for it
+    Thread ESPBooter(osPriorityNormal, ESPBOOTSTACKSIZE, NULL, "esp");
+    ESPBoot Boot = {_parser, _serial, &ESPBooter, NETWORKSUCCESS};
+    ESPBooter.start(callback(bootESP, &Boot));
 
-    // if (!checkESPWiFiConnection(_parser))
-    if (startESP(_parser) != NETWORKSUCCESS) {
+    // readings go here when the SD card is missing or fails
+    int err = initFlashQueue();
+    if (err) {
+        printf("The flash queue could not be started (%d)\r\n", err);
+    }
+#if ENERGYINTEGRATOR
+    // the totals go on from the ones that were kept
+    energyIntegrator().restore();
+#endif
+
+#if CARDCLOCKTUNE
+    // the SPI clock of the SD card is tuned once per card, the flash queue
+    // keeps it
+    err = tuneCardClock(bd);
+    if (err != CARDCLOCKSUCCESS) {
+        printf("The SD card clock could not be tuned (%d)\r\n", err);
+    }
+#endif
+
+    // a card that does not mount is tried again slower and repaired, but
+    // never formatted unless it is blank, see CardRecovery.h
+    printf("Mounting the filesystem...\r\n");
+    bool ReadOnlyCard = false;
+    err = mountCard(fs, bd, ReadOnlyCard);
+    bool SDCard = (err == 0);
+
+    // the backlog can be on its own LittleFS, see BackupStore.h. A card
+    // that can only be read keeps the config file, not the backlog
+    bool LogReady = false;
+    if ((SDCard && !ReadOnlyCard) || BACKUPINFLASH) {
+        err = mountBackupStore(bd);
+        LogReady = (err == 0);
+    }
+    if (!LogReady) {
+        printf("The backup log could not be mounted (%d), readings that "
+               "can not be sent go to the flash queue\r\n",
+               err);
+    }
 
-        printf("\r\n ESP Chip was not initialized, entering offline mode\r\n");
-        OfflineMode = true;
+    // data is gathered from these ports/sensor pins
+#if FIXEDPORTS
+#if EXTERNALADC
+#error "the fixed port table only has the K64F's pins, turn off external-adc"
+#endif
+    PinName PortPins[FIXEDPORTCOUNT];
+    for (size_t i = 0; i < FIXEDPORTCOUNT; ++i) {
+        PortPins[i] = FixedPortTable[i].Pin;
+    }
+#else
+    const PinName PortPins[] = {BOARDPORTPINS};
+#endif
+    // the channels of the external ADC are the ports after the pins
+    const size_t NumPortPins =
+        sizeof(PortPins) / sizeof(PortPins[0]) + EXTADCCHANNELS;
+    static_assert(NumPortPins <= SCANMAXPORTS,
+                  "too many ports for the frames, lower "
+                  "external-adc-channels");
+
+    // the pulse counters and the Modbus registers are the ports after
+    // those, they are not in the scan's frames
+    const size_t NumPortInputs = NumPortPins + PULSECHANNELS + MODBUSPOINTS;
+    static_assert(NumPortInputs <= FRAMEMAXPORTS,
+                  "too many ports for the frames, lower pulse-counters or "
+                  "modbus-points");
+#if PULSECHANNELS
+    static PulseCounter Pulses;
+    err = Pulses.start();
+    if (err != PULSESUCCESS) {
+        error("error: could not start the pulse counters (%d)\n", err);
+    }
+#endif
+
+    // the pins are converted in the background by the PDB and DMA, so
+    // the loop just picks up the latest frame
+    ADCScan Scanner(PortPins, NumPortPins - EXTADCCHANNELS);
+#if EXTERNALADC
+    static ExternalADC External;
+    Scanner.extend(&External);
+#endif
+    uint16_t Frame[NumPortPins];
+
+    // the calibration of the last boot saves running it again, until it is
+    // SCANCALIBRATIONS old
+    ScanCalibration AdcCalibration[SCANADCCOUNT];
+    if (readCalibrationCache(AdcCalibration, sizeof(AdcCalibration)) ==
+        sizeof(AdcCalibration)) {
+        Scanner.useCalibration(AdcCalibration);
+    }
+    uint32_t SavedCalibrations = 0;
+    err = Scanner.start(SCANRATE);
+    if (err != SCANSUCCESS) {
+        error("error: could not start the ADC scan (%d)\n", err);
     }
+    keepCalibration(Scanner, SavedCalibrations);
 
+    bool OfflineMode = false; // indicates whether to actually send data or not
+
+    // an unchanged config file is not parsed again, and the settings in the
+    // flash keep the board going without the SD card
+    BoardSpecs Specs;
+    if (!loadBoardSpecs(config_file, SDCard, Specs)) {
+        printf("There is no config file on the SD card or in the flash\r\n");
+        printf("Exiting\r\n");
+        return -1;
+    }
+    // the wiring of this board is compiled in, see FixedPorts.h
+    useFixedPorts(Specs);
+
+    // the resolution, averaging and sample time of the ports, the scan
+    // started with the defaults. The ADCs keep their calibration
+    Scanner.configure(Specs.Ports);
+    err = Scanner.start(SCANRATE);
+    if (err != SCANSUCCESS) {
+        error("error: could not start the ADC scan (%d)\n", err);
+    }
+
+#if THRESHOLDPORTS
+    // the comparators watch the ports over their ceiling while the scan is
+    // stopped in low-power mode
+    ThresholdMonitor Threshold(PortPins, NumPortPins - EXTADCCHANNELS);
+    Threshold.configure(Specs.Ports);
+#endif
+
+#if MODBUSPOINTS
+    // the meters on the RS-485 bus are polled on a thread of their own, the
+    // loop takes the latest registers
+    static ModbusMaster Modbus;
+    err = Modbus.start(Specs.Modbus);
+    if (err != MODBUSSUCCESS) {
+        error("error: could not start the Modbus master (%d)\n", err);
+    }
+#endif
+
+    // the server may have set the interval with a config delta
+    if (Specs.PollingInterval > 0.0f) {
+        PollingInterval = Specs.PollingInterval;
+    }
     // if there is no database tableName, or it is all spaces, then exit
     if (Specs.DatabaseTableName == "" || Specs.DatabaseTableName == " ") {
         printf(
@@ -133,166 +1439,519 @@ int main() {
         printf("\r\n No Remote Hostname found, Entering offline mode\r\n");
     }
 
-    resetWatchdog(watchdog, PollingInterval*WATCHDOGCOEFF);
+    // the hardware watchdog resets the board if a thread stops checking in
+    int SamplerBeat =
+        registerHeartbeat("sampler", PollingInterval * WATCHDOGCOEFF * 1000);
+    startSupervisor();
 
-    int wifi_err = NETWORKSUCCESS;
-    if (!OfflineMode) {
-        if (!checkESPWiFiConnection(_parser)) {
-            printf("trying to connect to %s\r\n", Specs.NetworkSSID.c_str());
-            wifi_err = connectESPWiFi(_parser, Specs);
-        }
+    // get the number of ports for the loop
+    size_t NumPorts = Specs.Ports.size() < NumPortPins ? Specs.Ports.size()
+                                                       : NumPortPins;
 
-        if (wifi_err != NETWORKSUCCESS) {
-            printf("\r\n failed to connect to %s. Error code = %d \r\n",
-                   Specs.NetworkSSID.c_str(), wifi_err);
-            wifi_tries -= 1;
-        } else {
-            printf(" connected to %s\r\n", Specs.NetworkSSID.c_str());
-        }
+    // every scan frame is averaged into the ports' oversampling bursts
+    Oversampler Decimator(NumPortPins);
+    for (size_t i = 0; i < NumPorts; ++i) {
+        Decimator.setRatio(i, Specs.Ports[i].Oversample);
     }
-
-    // get the number of ports for the loop
-    const size_t NumPorts = Specs.Ports.size();
+    Scanner.attach(callback(&Decimator, &Oversampler::push));
+
+    // AC ports are reported as the RMS of the last window of frames
+    RMSEngine Waveforms(NumPortPins, RMSWINDOW);
+    Scanner.attach(callback(&Waveforms, &RMSEngine::push));
+
+    // the CAPTUREPORTS keep their last frames, to save the waveform around
+    // a spike. Only the rings are static, they do not fit on the stack
+    static WaveCapture Capture(NumPortPins);
+    Scanner.attach(callback(&Capture, &WaveCapture::push));
+
+    // the scan's frames time the readings while it runs
+    SampleClock Clock;
+    Scanner.attach(callback(&Clock, &SampleClock::push));
+
+#if PIPELINETRACE
+    // the time between frames shows if the DMA keeps up under load
+    Scanner.attach(callback(traceFrame));
+#endif
+
+#if POWERQUALITY
+    // the harmonics of the AC ports go with every request
+    powerQuality().configure(Specs.Ports, SCANRATE);
+    Scanner.attach(callback(&powerQuality(), &PowerQuality::push));
+#endif
+
+#if FRAMESTREAM
+    // every frame of the scan goes to a computer on the USB port, out of
+    // the scan's frame queue
+    static FrameStream Stream(Scanner);
+    err = Stream.start(SCANRATE);
+    if (err != FRAMESTREAMSUCCESS) {
+        error("error: could not start the frame stream (%d)\n", err);
+    }
+#endif
+
+#if LOCALSERVER
+    // the SCADA clients on the site's network get every reading as it is
+    // taken, the thread waits for the Ethernet port before it listens
+    static LocalServer Local;
+    Local.configure(Specs.Ports);
+    err = Local.start();
+    if (err != LOCALSERVERSUCCESS) {
+        error("error: could not start the local server (%d)\n", err);
+    }
+#endif
+
+#if MODBUSSERVER
+    // the SCADA systems poll the latest values as Modbus TCP registers
+    static ModbusServer ModbusTcp;
+    ModbusTcp.registers().configure(Specs.Ports);
+    err = ModbusTcp.start();
+    if (err != MODBUSSERVERSUCCESS) {
+        error("error: could not start the Modbus TCP server (%d)\n", err);
+    }
+#endif
+
+    // readings wait here until they are sent or logged, the port names and
+    // multipliers stay in Specs
+    Mail<SampleFrame, SAMPLEBUFFERLEN> Samples;
+    SampleFrame Sample;
+
+    // ports with a deadband only send readings that moved
+    DeadbandFilter Deadband;
+    Deadband.configure(Specs.Ports);
+
+#if SENSORHEALTH
+    // the analog ports whose sensors are broken are left out
+    sensorHealth().configure(Specs.Ports, NumPorts);
+#endif
+
+    // the sensors with a Calibration line get their tables, the fixed table
+    // has no sensors, so its ports are not calibrated
+    CalibrationTables Calibration;
+#if !FIXEDPORTS
+    Calibration.configure(Specs);
+#endif
+
+    // the Virtual lines are worked out from the other ports of a reading
+    VirtualPorts Virtual;
+#if !FIXEDPORTS
+    Virtual.configure(Specs.Ports);
+#endif
+
+#if ENERGYINTEGRATOR
+    // every scan frame goes into the energy and run time of the ports
+    energyIntegrator().configure(Specs.Ports, Calibration, SCANRATE);
+    Scanner.attach(callback(&energyIntegrator(), &EnergyIntegrator::push));
+#endif
+
+    // the ranges as raw readings, for the check of every frame
+    RangeCheck Limits;
+    Limits.configure(Specs.Ports);
+
+    // the ports with an Interval of their own are only read every that
+    // many seconds, the loop runs at the tick of all of them
+    RateSchedule Schedule;
+    Schedule.configure(Specs.Ports);
+
+#if ADAPTIVESAMPLING
+    // the other ports are read at the fast bound, and only sent that often
+    // while they move
+    AdaptiveRate Adaptive;
+    Adaptive.configure(Specs.Ports);
+#endif
+
+    // with AGGREGATEWINDOW, the readings are summed up over windows and
+    // only the summaries go on. The sketches of the quantiles are too big
+    // for the stack
+#if AGGREGATEQUANTILES
+    static QuantileSketch Sketches[FRAMEMAXPORTS];
+    WindowAggregator Aggregator(AGGREGATEWINDOW, Sketches);
+#else
+    WindowAggregator Aggregator;
+#endif
+
+    // the network and the backup file are handled on their own thread, so
+    // a slow server does not hold up the next reading
+    UploaderState Upload;
+    Upload.Parser = _parser;
+    Upload.Specs = &Specs;
+    Upload.BackupLogDir = BackupLogDir;
+    Upload.LogReady = LogReady;
+    Upload.RemountMs = Kernel::get_ms_count();
+    Upload.Samples = &Samples;
+    Upload.PollingInterval = PollingInterval;
+    Upload.OfflineMode = OfflineMode;
+    Upload.Boot = &Boot;
+    Upload.Heartbeat = registerHeartbeat("uploader", UPLOADERTIMEOUTMS);
+
+#if RETAINEDFRAMES
+    // what a watchdog or software reset caught in RAM is backed up before
+    // any new readings are taken
+    keepRetainedFrames(Upload);
+#endif
+
+    // the uploader thread only dispatches its queue: the uploads, the
+    // housekeeping, the capture saves and the reconnect attempts. All of
+    // them are user allocated events, so the queue has no memory of its
+    // own. mbed_app.json gives every queue the events.timer-wheel-size
+    // timing wheel, so a post only sorts its timer into its own slot
+    EventQueue Events(0);
+    UploaderEvent Sending(&Events, callback(sendReadings, &Upload));
+    UploaderEvent Housekeeping(&Events, callback(houseKeep, &Upload));
+    UploaderEvent SavingCapture(&Events, callback(saveFrozenCapture, &Upload));
+    UploaderEvent Waking(&Events, callback(wakeRadio, &Upload));
+    Upload.Sending = &Sending;
+    Upload.Waking = &Waking;
+    Upload.SavingCapture = &SavingCapture;
+    Upload.Capture = &Capture;
+
+    // the wifi is tried again with a growing backoff instead of giving up
+    ReconnectScheduler Reconnect(Events, callback(reconnectWifi, &Upload));
+    Upload.Reconnect = &Reconnect;
+
+    // the answers to the link status queries come in between the other
+    // events
+    UploaderEvent Answering(&Events, callback(answerCommands, &Upload));
+    UploaderEvent Polling[2] = {{&Events, callback(pollCommands, &Upload)},
+                                {&Events, callback(pollCommands, &Upload)}};
+    Upload.Answering = &Answering;
+    Upload.Polling[0] = &Polling[0];
+    Upload.Polling[1] = &Polling[1];
+    Upload.PollingWaiting = -1;
+    Upload.PollingNext = 0;
+
+    // the wifi is joined on the uploader thread once the ESP8266 started,
+    // so the first readings are not held up by it
+    UploaderEvent Booting(&Events, callback(finishBoot, &Upload));
+    Booting.call();
+
+#if USBSERVICE
+    // the button hands the SD card to a computer on the USB port
+    static USBService Service(bd);
+    UploaderEvent Servicing(&Events, callback(toggleService, &Upload));
+    Upload.Servicing = &Servicing;
+    Upload.Service = &Service;
+    Upload.ServicedMs = 0;
+    InterruptIn ServiceButton(USBSERVICEPIN, PullUp);
+    ServiceButton.fall(callback(pressService, &Servicing));
+#endif
+
+#if BROWNOUTWARNING
+    // a falling supply has the uploader write out what is in RAM
+    UploaderEvent SavingForBrownOut(&Events,
+                                    callback(saveForBrownOut, &Upload));
+    startBrownOutWarning(callback(warnBrownOut, &SavingForBrownOut));
+#endif
+
+    Housekeeping.delay(HOUSEKEEPINGMS);
+    Housekeeping.period(HOUSEKEEPINGMS);
+    Housekeeping.call();
+
+    Thread Uploader(osPriorityNormal, UPLOADERSTACKSIZE, NULL, "uploader");
+    Uploader.start(callback(&Events, &EventQueue::dispatch_forever));
+
+    // readings are taken on a fixed schedule in kernel time, so the time
+    // spent reading the ports does not add up from one reading to the next
+    uint64_t NextReading = Kernel::get_ms_count();
+
+    // readings that wait in RAM for the rest of their batch in low-power
+    // mode
+    SampleFrame Batch[LOWPOWERBATCH];
+    size_t BatchCount = 0;
+
+    // true if Frame is the one the sample clock took
+    bool Clocked = false;
 
     while (true) {
 
-        // Read all of the ports
-        for (size_t i = 0; i < NumPorts; ++i) {
-
-            // only reads the port if a port is connected
-            if (Specs.Ports[i].Multiplier != 0.0f) {
-
-                // read the port
-                Specs.Ports[i].Value =
-                    Port[i].read() * Specs.Ports[i].Multiplier;
-
-                // set error indicator if the sample is out of range
-                if (Specs.Ports[i].Value > Specs.Ports[i].RangeCeiling) {
-                    Specs.Ports[i].Value = HUGE_VAL;
-                    printf("\r\nPort value exceeded valid sample value range, "
-                           "assigning "
-                           "error value\r\n");
-                } else if (Specs.Ports[i].Value < Specs.Ports[i].RangeFloor) {
-                    Specs.Ports[i].Value = -HUGE_VAL;
-                    printf("\r\nPort value is under the valid sample range, "
-                           "assigning "
-                           "error value\r\n");
+#if BROWNOUTWARNING
+        // the supply is falling: the batch goes to the uploader to be kept,
+        // and the ADCs stay off until the supply is back
+        if (brownOutActive()) {
+            for (size_t i = 0; i < BatchCount; ++i) {
+                handOff(Upload, Batch[i]);
+            }
+            BatchCount = 0;
+            if (Scanner.running()) {
+                Scanner.stop();
+            }
+            Clocked = false;
+            heartbeat(SamplerBeat);
+            deadlineRestart(DeadlineSample);
+            traceCadence(traceMark(), 0);
+            ThisThread::sleep_for(BROWNOUTPOLLMS);
+            continue;
+        }
+#endif
+
+        // a config delta from the server is applied between readings, once
+        // the uploader is not using Specs and has every reading that was
+        // taken with the old ports
+        if (configDeltaPending() && BatchCount == 0 && Samples.empty() &&
+            Upload.SpecsLock.trylock()) {
+            if (applyConfigDelta(Specs, NumPortInputs)) {
+                NumPorts = Specs.Ports.size() < NumPortPins
+                               ? Specs.Ports.size()
+                               : NumPortPins;
+                for (size_t i = 0; i < NumPorts; ++i) {
+                    Decimator.setRatio(i, Specs.Ports[i].Oversample);
+                }
+                Deadband.configure(Specs.Ports);
+#if SENSORHEALTH
+                sensorHealth().configure(Specs.Ports, NumPorts);
+#endif
+#if !FIXEDPORTS
+                Calibration.configure(Specs);
+                Virtual.configure(Specs.Ports);
+#endif
+                Limits.configure(Specs.Ports);
+#if POWERQUALITY
+                powerQuality().configure(Specs.Ports, SCANRATE);
+#endif
+#if ENERGYINTEGRATOR
+                energyIntegrator().configure(Specs.Ports, Calibration,
+                                             SCANRATE);
+#endif
+#if LOCALSERVER
+                Local.configure(Specs.Ports);
+#endif
+#if MODBUSSERVER
+                ModbusTcp.registers().configure(Specs.Ports);
+#endif
+                // the ADCs take the new resolutions when the scan starts
+                // again below
+                Scanner.configure(Specs.Ports);
+                Scanner.stop();
+#if THRESHOLDPORTS
+                Threshold.configure(Specs.Ports);
+#endif
+                Schedule.configure(Specs.Ports);
+#if ADAPTIVESAMPLING
+                Adaptive.configure(Specs.Ports);
+#endif
+                if (Specs.PollingInterval > 0.0f) {
+                    Upload.PollingInterval = Specs.PollingInterval;
                 }
-                // print data
-                printf("\r\n%s's value = %f\r\n", Specs.Ports[i].Name.c_str(),
-                       Specs.Ports[i].Value);
 
-                resetWatchdog(watchdog, PollingInterval * WATCHDOGCOEFF);
+                // a reboot keeps the new settings
+                err = saveBoardSpecs(Specs);
+                if (err) {
+                    tr_error("The new settings could not be kept in the flash "
+                             "(%d)",
+                             err);
+                }
             }
+            Upload.SpecsLock.unlock();
         }
 
-        // data will be transmitted while this timer is below the
-        // PollingInterval
-        PollingTimer.start();
-
-        // only try to send data if the wifi chip is working
-        if (!OfflineMode) {
-
-            // try to connect to wifi again if you are not connected now
-            if (!checkESPWiFiConnection(_parser)) {
-
-                printf("Trying to connect to %s \r\n",
-                       Specs.NetworkSSID.c_str());
-                wifi_err = connectESPWiFi(_parser, Specs);
-
-                if (wifi_err != NETWORKSUCCESS) {
-                    printf("Connection attempt failed error = %d\r\n",
-                           wifi_err);
-
-                    wifi_tries -= 1;
-                    if (wifi_tries <= 0) {
-
-                        printf("Wifi connection failed %d times, activating "
-                               "offline mode\r\n",
-                               WIFITRIES);
-                        OfflineMode = true;
-                    }
-
-                } else {
-                    printf("Connected to %s \r\n", Specs.NetworkSSID.c_str());
-                    wifi_tries = WIFITRIES;
-                }
+        // the scan is stopped between readings in low-power mode, start it
+        // early enough to fill the oversampling bursts and RMS windows
+        if (!Scanner.running()) {
+            err = Scanner.start(SCANRATE);
+            if (err != SCANSUCCESS) {
+                error("error: could not start the ADC scan (%d)\n", err);
+            }
+            keepCalibration(Scanner, SavedCalibrations);
+            // the frames from before the scan stopped are not before the
+            // next trigger. A capture that waits to be saved is rearmed
+            // once it is
+            if (!Capture.frozen()) {
+                Capture.rearm();
             }
+            ThisThread::sleep_for(SCANWARMUPMS);
+        }
 
-            // if the board is connected to the network, send data to the
-            // database
-            if (checkESPWiFiConnection(_parser)) {
+        // wait for the first frame after boot, and after the scan started
+        // again
+        while (!Clocked && !Scanner.readFrame(Frame)) {
+            ThisThread::sleep_for(1);
+        }
 
-                // send backed up data while waiting for the polling rate to
-                // expire
-                while ((PollingTimer.read() <= PollingInterval) &&
-                       checkForBackupFile(BackupFileName)) {
+        TraceMark SampleStart = traceMark();
+        uint32_t Allocated = allocCount();
+        crashLogBegin(CrashSample);
+        Sample.clear();
+        Sample.Timestamp = time(NULL);
+#if CLOCKSYNC
+        // the frame of the sample clock is on a whole interval of the
+        // network time, which the reading is stamped with
+        uint64_t TakenUtc;
+        if (Clocked && networkTime(Clock.takenMicros(), TakenUtc)) {
+            Sample.Timestamp = (uint32_t)((TakenUtc + 500000) / 1000000);
+        }
+#endif
 
-                    printf("\r\n Sending backed up data to the database. \r\n");
-                    float tmp = -1.0f;
-                    wifi_err =
-                        sendBackupDataTCP(_parser, Specs, BackupFileName, tmp);
+        // Read all of the ports
+#if FIXEDPORTS
+        readPorts(FixedPortTable, Frame, Decimator, Waveforms, Calibration,
+                  Sample);
+#else
+        readPorts(Specs.Ports, NumPorts, Frame, Decimator, Waveforms,
+                  Calibration, Sample);
+#endif
+#if PULSECHANNELS
+        readPulses(Pulses, Specs.Ports, NumPortPins, Specs.Ports.size(),
+                   Sample);
+#endif
+#if MODBUSPOINTS
+        readModbus(Modbus, Specs.Ports, NumPortPins + PULSECHANNELS,
+                   Specs.Ports.size(), Sample);
+#endif
+#if !FIXEDPORTS
+        Virtual.read(Specs.Ports, Sample);
+#endif
+        checkRanges(Limits, Specs.Ports, Sample);
+#if SENSORHEALTH
+        sensorHealth().check(Sample);
+#endif
+
+        // the ports that are not due in this tick are left out. The tick
+        // only changes with the interval, which starts the schedule over
+#if ADAPTIVESAMPLING
+        // the polling interval is the slow bound, the loop runs at the
+        // fast one and the steady ports are taken out
+        float Tick = Schedule.tick(Adaptive.tick(Upload.PollingInterval));
+        Schedule.filter(Sample);
+        Adaptive.filter(Sample, Tick);
+#else
+        float Tick = Schedule.tick(Upload.PollingInterval);
+        Schedule.filter(Sample);
+#endif
+        crashLogEnd(CrashSample);
+        traceSince(TraceSample, SampleStart);
+        allocCheck("sample", Allocated);
+
+        // a capture that is complete is saved by the uploader, and the
+        // rings then look for the next trigger. Does nothing while the save
+        // is still waiting to run
+        if (Capture.frozen()) {
+            Upload.SavingCapture->try_call();
+        }
 
-                    if (tmp != -1.0f && tmp > 0.0f) {
-                        PollingInterval = tmp;
-                        printf("Sample interval is now %f\r\n",
-                               PollingInterval);
-                    }
+        // the reading itself, or the summary of a window that ended and
+        // the readings of a burst
+        SampleFrame Ready[AGGREGATEFRAMES];
+        size_t ReadyCount = Aggregator.push(Sample, Ready);
 
-                    if (wifi_err != NETWORKSUCCESS) {
-                        printf("\r\n Failed to transmit backed up data to the "
-                               "Database \r\n");
-                        printf("Error code = %d\r\n", wifi_err);
-                        break; // stop transmitting if data transmission failed.
+        bool LowPower = Tick >= LOWPOWERINTERVAL;
+        if (LowPower) {
+            // nothing needs the ADCs until the next reading
+            Scanner.stop();
+        } else {
+            // the batch from before the interval got shorter
+            for (size_t i = 0; i < BatchCount; ++i) {
+                handOff(Upload, Batch[i]);
+            }
+            BatchCount = 0;
+        }
 
-                    } else { // delete data entry if data was sent
-                        deleteDataEntry(Specs, BackupFileName);
-                    }
+        for (size_t i = 0; i < ReadyCount; ++i) {
+#if LOCALSERVER
+            // the local clients get every frame, the deadband is for the
+            // server
+            Local.publish(Ready[i]);
+#endif
+#if MODBUSSERVER
+            ModbusTcp.registers().publish(Ready[i]);
+#endif
+
+            // a frame without a port that moved is neither sent nor logged
+            if (!Deadband.filter(Ready[i])) {
+                continue;
+            }
+            retainFrame(Ready[i]);
+
+            // hand the readings to the uploader thread, only once the batch
+            // is full in low-power mode so the network and SD card are used
+            // in one go
+            if (!LowPower) {
+                handOff(Upload, Ready[i]);
+                continue;
+            }
+            Batch[BatchCount++] = Ready[i];
+            if (BatchCount == LOWPOWERBATCH) {
+                for (size_t j = 0; j < BatchCount; ++j) {
+                    handOff(Upload, Batch[j]);
                 }
+                BatchCount = 0;
+            }
+        }
 
-                if (!checkForBackupFile(BackupFileName)) {
-                    printf("\r\n Sending the last port reading to the database "
-                           "\r\n");
-                    float tmp = -1;
-                    wifi_err = sendBulkDataTCP(_parser, Specs, tmp);
-
-                    if (tmp != -1.0f && tmp > 0.0f) {
-                        PollingInterval = tmp;
-                        printf("Sample interval is now %f\r\n",
-                               PollingInterval);
-                    }
-                    if (wifi_err != NETWORKSUCCESS) {
-
-                        printf(
-                            "Could not send data to database, error = %d\r\n",
-
-                            wifi_err);
+        // once per reading, the interval may have changed
+        setHeartbeatTimeout(SamplerBeat, Tick * WATCHDOGCOEFF * 1000);
+        heartbeat(SamplerBeat);
+        deadlineRan(DeadlineSample, Tick * 1000);
+
+        // sleep until the next reading is due. Nothing here holds a
+        // DeepSleepLock, so the idle thread can go into deep sleep if the
+        // rest of the system lets it. The kernel is tickless on the K64F,
+        // so only the LPTMR wakes it for the next thread or event that is due
+        NextReading += (uint64_t)(Tick * 1000);
+        traceCadence(SampleStart, (uint32_t)(Tick * 1000000));
+        uint64_t Now = Kernel::get_ms_count();
+        if (NextReading < Now) {
+            // this reading took longer than the interval, start over
+            NextReading = Now;
+        }
 
-                        dumpSensorDataToFile(Specs, BackupFileName);
+        // the ESP8266 wakes while this loop sleeps, if the next reading is
+        // likely to be handed off. AGGREGATEWINDOW may hold it back still,
+        // then the uploader only puts it back to sleep
+        if (ESPSLEEP && !Upload.OfflineMode &&
+            (!LowPower || BatchCount + 1 >= LOWPOWERBATCH)) {
+            uint64_t Lead = espWakeMs();
+            Upload.Waking->cancel();
+            Upload.Waking->delay(NextReading > Now + Lead
+                                     ? (int)(NextReading - Now - Lead)
+                                     : 0);
+            Upload.Waking->try_call();
+        }
+        if (LowPower) {
+            // nothing of the sampler needs the full speed until the next
+            // reading, the uploader holds it while it works
+            clockRelease();
+#if THRESHOLDPORTS
+            // a port over its ceiling takes the next reading now, and the
+            // capture of it once the scan runs again
+            Threshold.arm();
+            bool Tripped = Threshold.wait(NextReading);
+            Threshold.disarm();
+            if (Tripped) {
+                uint16_t Ports = Threshold.tripped();
+                tr_warn("Ports 0x%04x went over their ceiling", Ports);
+                for (size_t i = 0; i < NumPorts; ++i) {
+                    if ((Ports >> i) & 1U) {
+                        Capture.force(i);
                     }
-                } else {
-                    dumpSensorDataToFile(Specs, BackupFileName);
                 }
-
-            } else { // back up data if you are not connected
-                dumpSensorDataToFile(Specs, BackupFileName);
-                printf("\r\n Backed up Active Port data\r\n");
+                NextReading = Kernel::get_ms_count();
             }
-
-        } else { // in offline mode, just dump data to file
-            printf("\r\nIn offline mode. Dumping data to file.\r\n");
-            dumpSensorDataToFile(Specs, BackupFileName);
+#else
+            ThisThread::sleep_until(NextReading);
+#endif
+            clockHold();
+            Clocked = false;
+            continue;
         }
 
-        // wait until the Polling rate is up before reading again.
-        while (PollingTimer.read() <= PollingInterval) {
+        // with the scan running, the sample clock takes the frame of the
+        // next reading, one interval after the one that was not clocked
+        if (!Clocked) {
+            Clock.start(Tick, SCANRATE);
+        } else if (Clock.interval() != Tick) {
+            Clock.setInterval(Tick);
         }
-
-        // Reset Timer
-        PollingTimer.stop();
-        PollingTimer.reset();
+#if CLOCKSYNC
+        alignSampleClock(Clock, Tick);
+#endif
+        Clocked = Clock.wait(Frame, Tick * 1000 + SAMPLECLOCKSLACKMS);
+        if (!Clocked) {
+            tr_warn("The sample clock did not take a frame in time");
+        }
+        NextReading = Kernel::get_ms_count();
     }
 }
+#endif // MBED_TEST_MODE
+
 /**
  * \mainpage IAC Energy Monitoring project
  *
@@ -305,13 +1964,255 @@ int main() {
  * If you have any questions, please email me at klapatchaaron at gmail dot com
  *
  * Here is how some of the code is organized:
- * - main.cpp -> Well, it's where everything starts.
+ * - main.cpp -> Well, it's where everything starts. The readings are taken
+ *   on the main thread and sent or backed up by the events of the uploader
+ *   thread's queue. When the readings are LOWPOWERINTERVAL or more apart,
+ *   the ADC scan is stopped between them and they are sent in batches
  * - Networking.cpp / Networking.h -> functions related to networking
+ * - RequestWriter.cpp / RequestWriter.h -> formats requests into a fixed
+ *   buffer without using the heap
+ * - NumberFormat.cpp / NumberFormat.h -> numbers to text without printf,
+ *   so the output is the same with minimal-printf.json
+ * - CborWriter.cpp / CborWriter.h -> encodes the CBOR body of the POST
+ *   requests, used when "request-format" is set in mbed_app.json
+ * - HttpResponse.cpp / HttpResponse.h -> parses the server's response as
+ *   its bytes come in, so it is read to its exact length
+ * - ATTimeouts.cpp / ATTimeouts.h -> the timeout of each kind of AT command,
+ *   from how long its answers took
+ * - HeatshrinkEncoder.cpp / HeatshrinkEncoder.h -> compresses the CBOR body
+ *   of a batch as it is sent, set with "compress-batches" in mbed_app.json
+ * - BatchSizer.cpp / BatchSizer.h -> how many backed up readings go into a
+ *   request on each backlog link, from how well the last ones went
+ * - Gateway.cpp / Gateway.h -> one board takes the readings of the boards
+ *   around it as UDP datagrams on the ESP8266's access point and sends them
+ *   to the server in one POST, set with "gateway-role" in mbed_app.json
+ * - NetworkBackend.h -> the links to the server that SocketBackend.cpp and
+ *   the AT commands in Networking.cpp both provide, one for live readings
+ *   and the rest for backed up batches
+ * - SocketBackend.cpp -> the networking functions on top of ESP8266Interface,
+ *   used instead of the raw AT commands when "network-sockets" is set in
+ *   mbed_app.json, or on EthernetInterface when "ethernet" is set too
+ * - Multipath.cpp / Multipath.h -> picks Ethernet or the wifi for the server
+ *   links from their failures and latency when "ethernet" is 2. With "mesh"
+ *   the sockets are on a 6LoWPAN or Thread mesh of nanostack instead, and
+ *   with "cellular" on an LTE-M or NB-IoT modem in PSM
+ * - TlsLink.cpp / TlsLink.h -> TLS on the server links when "tls" is set in
+ *   mbed_app.json, which resumes the last session of a link on a reconnect
+ * - TlsConfig.h -> the mbed TLS settings, which keep the P-256 tables
+ *   between handshakes when "tls-fast-ecc" is set
+ * - DnsCache.cpp / DnsCache.h -> keeps the address that the server name
+ *   resolved to, in the flash too, for "dns-cache-s" seconds
+ * - ReconnectScheduler.cpp / ReconnectScheduler.h -> tries the wifi again
+ *   with a jittered exponential backoff on the uploader's EventQueue
+ * - simulate_fleet.py -> a fleet of simulated boards on the host that send
+ *   the requests of the firmware to a real server, with the backlog of an
+ *   outage and the backoff of the reconnects, to load test the server
+ * - TimeSync.cpp / TimeSync.h -> sets the clock from the Date of the
+ *   server's responses, and moves the stamps taken before that
+ * - ClockSync.cpp / ClockSync.h -> the network time to the microsecond from
+ *   SNTP, which the readings of every board are aligned to, set with
+ *   "clock-sync" in mbed_app.json
+ * - MqttClient.cpp / MqttClient.h -> a small MQTT 3.1.1 client that
+ *   publishes the readings with QoS 1 when "mqtt" is set in mbed_app.json
+ * - BlockPool.h -> a static pool of fixed size blocks with occupancy
+ *   counts, used instead of the heap for the buffers of each message
+ * - CoapUplink.cpp / CoapUplink.h -> confirmable CoAP POSTs over UDP with
+ *   mbed-coap, used for the readings when "coap" is set in mbed_app.json,
+ *   over DTLS with a pre-shared key when "coap-dtls" is set
+ * - LoraUplink.cpp / LoraUplink.h -> the readings as LoRaWAN uplinks of an
+ *   SX1276 instead of the ESP8266, one per slot of the duty cycle, set with
+ *   "lorawan" in mbed_app.json
+ * - LoraPacker.cpp / LoraPacker.h -> packs the readings of an uplink bit by
+ *   bit, as the changes of each port in the bits it needs
+ * - LocalServer.cpp / LocalServer.h -> gives the latest reading to SCADA
+ *   clients on the site's network over TCP, and pushes every new one to
+ *   the ones that subscribed, set with "local-server" in mbed_app.json
+ * - ModbusServer.cpp / ModbusServer.h -> the latest value of every port as
+ *   registers of a Modbus TCP server, set with "modbus-server" in
+ *   mbed_app.json
+ * - FirmwareUpdate.cpp / FirmwareUpdate.h -> fetches the patch of a
+ *   firmware update that the server offers a piece at a time, when "ota"
+ *   is set in mbed_app.json
+ * - ESPTranscript.cpp / ESPTranscript.h -> records the ESP8266's UART with
+ *   its timing, and plays it back in place of the ESP8266 to time the AT
+ *   code on the same input, set with "esp-transcript" in mbed_app.json
+ * - BacklogThrottle.cpp / BacklogThrottle.h -> a token bucket that holds
+ *   the backlog to the rate of the site's network, when "backlog-throttle"
+ *   is set in mbed_app.json
+ * - DMAUARTSerial.cpp / DMAUARTSerial.h -> the serial port to the ESP8266,
+ *   which receives into a ring buffer with DMA
  * - BoardConfig.cpp / BoardConfig.h -> functions for getting, and holding the
- *   configuration for the board
+ *   configuration for the board. gen_config_bin.py makes the binary config
+ *   file that is loaded in place of the config file
+ * - BoardPins.h -> the analog pins of the ports, the pins of the ESP8266
+ *   and the SD slot and the peripherals of the part, for the FRDM-K64F and
+ *   the FRDM-K66F, set with "port-pins" and "sd-detect" in mbed_app.json
+ * - ConfigParser.cpp / ConfigParser.h -> splits the config file into lines
+ *   and fields in one pass, without copying it
+ * - ConfigDelta.cpp / ConfigDelta.h -> changes to the ports and the
+ *   interval that the server sends back, applied between readings
+ * - FixedPorts.cpp / FixedPorts.h -> the compiled in port table of a board
+ *   whose wiring never changes, set with "fixed-ports" in mbed_app.json.
+ *   gen_port_table.py makes PortTable.h from the config file
+ * - NameTable.cpp / NameTable.h -> the names of the ports and sensors,
+ *   interned once into a static table and held as two byte handles
  * - Structs.h -> structs that contain configuration items
  * - OfflineLogging.cpp / OfflineLogging.h -> functions that relate to logging
- *   and deleting data to and from a file
+ *   and deleting data to and from a file, and reading a range of it again
+ *   that the server asks for, set with "backlog-query" in mbed_app.json
+ * - BackupStore.cpp / BackupStore.h -> mounts the backup log on the SD
+ *   card's FAT, on its own LittleFS, or on the internal flash with the
+ *   older segments moved to the SD card, set with "backup-store" in
+ *   mbed_app.json
+ * - FlashStageBlockDevice.cpp / FlashStageBlockDevice.h -> the internal
+ *   flash under the backup log, with its programs collected a sector at a
+ *   time and its free sectors erased ahead of time, set with "flash-stage"
+ *   in mbed_app.json
+ * - FlashQueue.cpp / FlashQueue.h -> a queue of readings and the parsed
+ *   config file in the internal flash, used when the SD card is missing or
+ *   fails, set with "flash-queue" in mbed_app.json
+ * - simulate_wear.py -> replays months of readings and outages through the
+ *   writes of the backup log on the host, and prints the write
+ *   amplification, the wear and the latency of each store
+ * - FirmwareSlot.cpp / FirmwareSlot.h -> the update slot in the internal
+ *   flash that a new image is built in, a sector and a checkpoint at a
+ *   time, and checked before the bootloader takes it. SlotLayout.h has
+ *   where it is, for the bootloader in Bootloader/ too
+ * - DeltaPatch.cpp / DeltaPatch.h -> builds the new image from the running
+ *   one and a patch of copies, changes and new bytes that make_delta.py
+ *   writes
+ * - USBService.cpp / USBService.h -> hands the SD card to a computer on the
+ *   USB port as a mass storage drive, to copy the backlog off, set with
+ *   "usb-service" in mbed_app.json
+ * - FrameCodec.cpp / FrameCodec.h -> packs sample frames as varints of the
+ *   changes from the frame before, for the backup log's blocks and the
+ *   CBOR body with "packed-readings"
+ * - Sequence.cpp / Sequence.h -> the sequence numbers of the readings and
+ *   the server's acks of them, set with "sequenced-uploads" in mbed_app.json
+ * - CardClock.cpp / CardClock.h -> finds the fastest SPI clock that the SD
+ *   card reads at without CRC errors, set with "sd-clock-tune" in
+ *   mbed_app.json
+ * - RetainedFrames.cpp / RetainedFrames.h -> a ring of the readings that
+ *   are only in RAM, which a watchdog or software reset leaves alone, so
+ *   they are backed up after it, set with "retained-frames" in
+ *   mbed_app.json
+ * - LogCipher.cpp / LogCipher.h -> encrypts the blocks of the backup log
+ *   with AES-128 in counter mode, with the key in the internal flash, set
+ *   with "backlog-encrypt" in mbed_app.json
+ * - CardRecovery.cpp / CardRecovery.h -> mounts the SD card again at slower
+ *   clocks and puts a broken FAT32 boot sector back, instead of formatting
+ * - SDHCBlockDevice.cpp / SDHCBlockDevice.h -> the SD card on the SDHC's
+ *   4 bit bus, used instead of the SPI SDBlockDevice when
+ *   "sdhc-block-device" is set in mbed_app.json
+ * - ADCScan.cpp / ADCScan.h -> converts all of the sensor ports in the
+ *   background with the PDB and DMA
+ * - SampleClock.cpp / SampleClock.h -> picks the frame of every reading by
+ *   counting the scan's frames, so the interval does not drift
+ * - AdaptiveRate.cpp / AdaptiveRate.h -> sends the ports that move at the
+ *   fast bound and backs the steady ones off to the polling interval, set
+ *   with "adaptive-sampling" in mbed_app.json
+ * - RateSchedule.cpp / RateSchedule.h -> reads every port at the Interval
+ *   of its Sensor line, on a tick that all of the intervals are multiples of
+ * - ExternalADC.cpp / ExternalADC.h -> reads the channels of an ADS1115 or
+ *   MCP3208 as more ports after the K64F's pins, set with "external-adc" in
+ *   mbed_app.json
+ * - PulseCounter.cpp / PulseCounter.h -> counts the pulses of utility
+ *   meters with the FTMs' quadrature decoders, as the ports after those,
+ *   set with "pulse-counters" in mbed_app.json
+ * - ModbusMaster.cpp / ModbusMaster.h -> polls registers of meters over
+ *   Modbus RTU on RS-485, as the ports after the pulse counters, set with
+ *   "modbus-points" in mbed_app.json
+ * - FrameStream.cpp / FrameStream.h -> streams every raw scan frame to a
+ *   computer on the USB port as binary packets, set with "frame-stream" in
+ *   mbed_app.json
+ * - SPSCRing.h -> a ring buffer for handing data from an interrupt to a
+ *   thread without critical sections
+ * - Oversampler.cpp / Oversampler.h -> averages bursts of scan frames for
+ *   every port
+ * - RMSEngine.cpp / RMSEngine.h -> mean, RMS and peak of the AC ports
+ * - PowerQuality.cpp / PowerQuality.h -> RMS, fundamental and THD of the
+ *   AC ports with CMSIS-DSP, when "power-quality" is set in mbed_app.json
+ * - EnergyIntegrator.cpp / EnergyIntegrator.h -> the energy and run time
+ *   of every port from every scan frame, kept in the flash store and sent
+ *   as totals, set with "energy-integrator" in mbed_app.json
+ * - Aggregator.cpp / Aggregator.h -> the mean, min and max of every port
+ *   over windows of "aggregate-window" seconds, with bursts of raw readings
+ *   when a port leaves its range
+ * - QuantileSketch.cpp / QuantileSketch.h -> the p50, p95 and p99 of every
+ *   port over a window, with "aggregate-quantiles"
+ * - Deadband.cpp / Deadband.h -> drops the readings of the ports that did
+ *   not move past their deadband since the last one that was sent
+ * - SensorHealth.cpp / SensorHealth.h -> leaves out the analog ports whose
+ *   sensor is stuck, open, saturated or noisy, and reports the faults
+ * - VirtualPorts.cpp / VirtualPorts.h -> the ports of the Virtual lines,
+ *   worked out on every reading from the other ports with a formula that
+ *   is compiled once
+ * - Calibration.cpp / Calibration.h -> applies the gain, offset and curve
+ *   of a Calibration line to the raw readings with integer lookup tables
+ * - RangeCheck.cpp / RangeCheck.h -> marks the ports of a frame that are out
+ *   of range, comparing two raw readings at a time
+ * - WaveCapture.cpp / WaveCapture.h -> keeps the last scan frames of the
+ *   "capture-ports" and freezes the waveform around a spike
+ * - ThresholdMonitor.cpp / ThresholdMonitor.h -> the comparators that wake
+ *   the sampling loop in low-power mode when one of the "threshold-ports"
+ *   goes over its ceiling
+ * - CaptureStore.cpp / CaptureStore.h -> keeps the captures as CBOR files
+ *   until the uploader has sent them after the backlog
+ * - StackSizer.cpp / StackSizer.h -> the deepest every thread's stack went
+ *   over the run, and the "<name>-stack-size" that would do for it,
+ *   printed every ten minutes when "stack-sizer" is set in mbed_app.json
+ * - EnergyMeter.cpp / EnergyMeter.h -> the microjoules of the core, the
+ *   ESP8266, the SD card and the ADCs per uploaded reading, from how long
+ *   each was on, printed every ten minutes when "energy-meter" is set
+ * - LinkStats.cpp / LinkStats.h -> bytes, connects, failures, retries and
+ *   round trips of the links to the server over ten minute windows, sent
+ *   with the readings when "link-stats" is set in mbed_app.json
+ * - RemoteShell.cpp / RemoteShell.h -> diagnostic commands in the server's
+ *   responses, the log levels, the AT echo, stats, the crash log ring and
+ *   a profiler window, when "remote-shell" is set in mbed_app.json
+ * - ClockScaler.cpp / ClockScaler.h -> VLPR at 4 MHz while the sampler
+ *   sleeps in low-power mode and the uploader waits, when "clock-scaling"
+ *   is set in mbed_app.json
+ * - DMAPool.cpp / DMAPool.h -> the buffers of the eDMA drivers, from a
+ *   static pool so that none crosses from SRAM_L into SRAM_U
+ * - FlashCache.cpp / FlashCache.h -> RAMFUNC for the interrupt handlers
+ *   that run from SRAM_L with "ram-functions", and the split of the flash
+ *   cache ways with "flash-cache" in mbed_app.json
+ * - Supervisor.cpp / Supervisor.h -> the hardware watchdog, which is only
+ *   kicked while every thread checks in
+ * - DeadlineMonitor.cpp / DeadlineMonitor.h -> the readings and
+ *   housekeeping rounds that ended late, and the backlog, log lines and
+ *   reports that wait while they keep doing so, set with
+ *   "deadline-monitor" in mbed_app.json
+ * - MemoryTelemetry.cpp / MemoryTelemetry.h -> heap, stack and idle time
+ *   numbers that go with the readings when "memory-telemetry" is set in
+ *   mbed_app.json
+ * - DeferredLog.cpp / DeferredLog.h -> log lines from mbed-trace that are
+ *   kept in a RAM ring and printed by a low priority thread, so logging
+ *   does not wait for the UART
+ * - AllocProfiler.cpp / AllocProfiler.h -> the heap allocations of every
+ *   call site with the ones still live, and the allocations of the code
+ *   that should make none, printed every minute when "alloc-profiler" is
+ *   set in mbed_app.json
+ * - BinaryTrace.cpp / BinaryTrace.h -> a trace of format string addresses
+ *   and raw arguments, written to the SD card and decoded on the host by
+ *   decode_btrace.py, set with "binary-trace" in mbed_app.json
+ * - BrownOut.cpp / BrownOut.h -> the PMC's low voltage warning, which
+ *   stops the sampling and has the uploader write out the readings in RAM
+ *   before the board resets, set with "brownout-warning" in mbed_app.json
+ * - CrashLog.cpp / CrashLog.h -> the last operations before a reset, kept in
+ *   RAM that the reset leaves alone and sent with the first upload after it
+ * - CriticalStats.cpp / CriticalStats.h -> how long interrupts were kept
+ *   off and from where, and how long an interrupt waited, printed every
+ *   minute when "critical-stats" is set in mbed_app.json
+ * - PcProfiler.cpp / PcProfiler.h -> counts the interrupted PC on SysTick
+ *   and writes the counts to the SD card every minute, for
+ *   decode_profile.py to find the hot functions in the .elf, set with
+ *   "pc-profiler" in mbed_app.json
+ * - PipelineTrace.cpp / PipelineTrace.h -> how long each stage of a reading
+ *   takes, and the jitter, frame gap and latency of the sampler against
+ *   their limits, printed now and then when "pipeline-trace" is set in
+ *   mbed_app.json
  * - debugging.h -> Macros that are meant to assist in debugging
  *
  * 
@@ -336,13 +2237,14 @@ int main() {
  * ConnInfo:192.168.0.3,80,test-server.com,/sensor-readings.php
  *
  * Sensor:Voltage,Volts,10,-20,20
- * Sensor:Voltage,Volts,1000,-50,50
+ * Sensor:Voltage,Volts,1000,-50,50,64
+ * Sensor:Current,Amps,133.33,0,100,1,AC
  *
  * Port:Voltage Port,0
  * Port:Different Voltage Port,1
  * ```
  * 
- * In that configuration, there are 2 sensor types, 2 active ports.
+ * In that configuration, there are 3 sensor types, 2 active ports.
  * All of the following descriptions are related to the previous example.
  * ### BoardInfo
  * The board will try to connect to a wifi SSID `HomeWiFi` with the password `password123` and the board's name is `Test Board`.
@@ -354,6 +2256,11 @@ int main() {
  * The first sensor has an id of 0, is measuring voltage, has volts as a unit, has a multiplier of 10, and has a valid range is from -20 to 20.
  *
  * The second sensor has an id of 1, is measuring voltage, has volts as a unit, has a multiplier of 1000, and has a valid range is from -50 to 50.
+ * Every reading of that sensor is the average of 64 conversions.
+ *
+ * The oversampling ratio is optional. When it is left out, every reading is a single conversion. The ports are converted at `SCANRATE` frames per second, so a ratio of 64 at 2000 frames per second averages the last 32 ms of samples.
+ *
+ * The third sensor measures an AC current. The last field can be `AC` or `DC`, and is `DC` when it is left out. The value of an `AC` port is the RMS of the last `RMSWINDOW` frames (200 ms) with the DC part taken out.
  *
  * The `Voltage` and `Volts` text in this case is not important. The sensor descriptions are based on that text, but no sensor readings are derived from those labels
  *
@@ -218,6 +218,7 @@ Case cases[] = {
     Case("TCPSOCKET_RECV_100K_NONBLOCK", TCPSOCKET_RECV_100K_NONBLOCK),
     Case("TCPSOCKET_RECV_TIMEOUT", TCPSOCKET_RECV_TIMEOUT),
     Case("TCPSOCKET_SEND_REPEAT", TCPSOCKET_SEND_REPEAT),
+    Case("TCPSOCKET_SEND_THROUGHPUT", TCPSOCKET_SEND_THROUGHPUT),
     Case("TCPSOCKET_SEND_TIMEOUT", TCPSOCKET_SEND_TIMEOUT),
     Case("TCPSOCKET_ENDPOINT_CLOSE", TCPSOCKET_ENDPOINT_CLOSE),
 };
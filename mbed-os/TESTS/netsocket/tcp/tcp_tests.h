@@ -83,6 +83,7 @@ void TCPSOCKET_RECV_100K();
 void TCPSOCKET_RECV_100K_NONBLOCK();
 void TCPSOCKET_RECV_TIMEOUT();
 void TCPSOCKET_SEND_REPEAT();
+void TCPSOCKET_SEND_THROUGHPUT();
 void TCPSOCKET_SEND_TIMEOUT();
 void TCPSOCKET_THREAD_PER_SOCKET_SAFETY();
 void TCPSOCKET_SETSOCKOPT_KEEPALIVE_VALID();
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "TCPSocket.h"
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest.h"
+#include "tcp_tests.h"
+
+using namespace utest::v1;
+
+namespace {
+static const int BATCH_SIZE = 8000;
+static const int BATCH_COUNT = 64;
+static char batch[BATCH_SIZE];
+}
+
+void TCPSOCKET_SEND_THROUGHPUT()
+{
+    SKIP_IF_TCP_UNSUPPORTED();
+    TCPSocket sock;
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, tcpsocket_connect_to_discard_srv(sock));
+    fill_tx_buffer_ascii(batch, BATCH_SIZE);
+
+    Timer timer;
+    timer.start();
+    int sent_total = 0;
+    for (int i = 0; i < BATCH_COUNT; i++) {
+        int sent = 0;
+        while (sent < BATCH_SIZE) {
+            int snd = sock.send(batch + sent, BATCH_SIZE - sent);
+            if (snd <= 0) {
+                printf("[Batch#%02d] network error %d\n", i, snd);
+                TEST_FAIL();
+                sock.close();
+                return;
+            }
+            sent += snd;
+        }
+        sent_total += sent;
+    }
+    timer.stop();
+
+    int ms = timer.read_ms();
+    printf("MBED: sent %d bytes in %d ms, %d kB/s\n", sent_total, ms,
+           ms > 0 ? sent_total / ms : 0);
+    TEST_ASSERT_EQUAL(BATCH_SIZE * BATCH_COUNT, sent_total);
+    TEST_ASSERT_EQUAL(NSAPI_ERROR_OK, sock.close());
+}
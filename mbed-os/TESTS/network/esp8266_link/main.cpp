@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2019, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Throughput and latency of the AT command link to an ESP8266, through
+ * ATCmdParser on a UARTSerial. For each baud rate it measures the AT round
+ * trip as a utest BENCHMARK, then the payload rate of AT+CIPSEND with
+ * several chunk sizes, of transparent mode, and of the echo in active and
+ * passive receive mode with the bytes that did not come back.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest.h"
+#include "utest/utest_benchmark.h"
+
+#if !defined(MBED_CONF_ESP8266_TX) || !defined(MBED_CONF_ESP8266_RX)
+#error [NOT_SUPPORTED] esp8266.tx and esp8266.rx have to be set
+#endif
+
+#if !defined(MBED_CONF_APP_WIFI_SECURE_SSID) || !defined(MBED_CONF_APP_WIFI_PASSWORD)
+#error [NOT_SUPPORTED] wifi-secure-ssid and wifi-password have to be set
+#endif
+
+#ifndef ECHO_SERVER_ADDR
+#define ECHO_SERVER_ADDR "echo.mbedcloudtesting.com"
+#endif
+#ifndef ECHO_SERVER_PORT
+#define ECHO_SERVER_PORT 7
+#endif
+#ifndef ECHO_SERVER_DISCARD_PORT
+#define ECHO_SERVER_DISCARD_PORT 9
+#endif
+
+using namespace utest::v1;
+
+namespace {
+static const int default_baud = MBED_CONF_ESP8266_SERIAL_BAUDRATE;
+
+// what each throughput case sends
+static const int payload_size = 16384;
+
+// the most bytes of one AT+CIPSEND, and of one AT+CIPRECVDATA
+static const int chunk_max = 2048;
+
+// the round trips of one case in ms, in buckets of powers of two
+static const int histogram_buckets = 12;
+
+static const int command_timeout_ms = 2000;
+static const int join_timeout_ms = 20000;
+
+// in transparent mode the ESP8266 sends what it got after 20 ms without
+// more bytes, and "+++" has to come on its own
+static const int passthrough_gap_ms = 20;
+static const int passthrough_exit_ms = 1000;
+
+static UARTSerial serial(MBED_CONF_ESP8266_TX, MBED_CONF_ESP8266_RX,
+                         default_baud);
+static ATCmdParser parser(&serial, "\r\n");
+
+static char chunk[chunk_max];
+static int current_baud = default_baud;
+static const char *current_flow = "no flow control";
+
+// the AT round trips that did not get their OK
+static int failed_commands;
+
+// the bytes of +IPD, and the passive mode with only the notices
+static int received;
+static bool passive;
+
+static uint32_t histogram[histogram_buckets];
+}
+
+static void clear_histogram()
+{
+    memset(histogram, 0, sizeof(histogram));
+}
+
+static void add_to_histogram(int ms)
+{
+    int bucket = 0;
+    while (bucket < histogram_buckets - 1 && ms >= (1 << bucket)) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+static void print_histogram(const char *what)
+{
+    printf("MBED: %s ms:", what);
+    for (int i = 0; i < histogram_buckets; i++) {
+        printf(" <%d:%lu", 1 << i, (unsigned long)histogram[i]);
+    }
+    printf("\n");
+}
+
+static void print_rate(const char *what, int bytes, int ms)
+{
+    printf("MBED: %s at %d baud, %s: %d bytes in %d ms, %d B/s\n", what,
+           current_baud, current_flow, bytes, ms,
+           ms > 0 ? bytes * 1000 / ms : 0);
+}
+
+// the data of +IPD,<link>,<length>:, in passive mode only the notice comes
+static void on_ipd()
+{
+    int link, length;
+    if (passive || !parser.recv("%d,%d:", &link, &length)) {
+        return;
+    }
+    while (length > 0) {
+        int piece = length < chunk_max ? length : chunk_max;
+        int got = parser.read(chunk, piece);
+        if (got <= 0) {
+            break;
+        }
+        received += got;
+        length -= got;
+    }
+}
+
+static bool command(const char *cmd)
+{
+    return parser.send("%s", cmd) && parser.recv("OK");
+}
+
+static bool open_link(int port)
+{
+    parser.set_timeout(join_timeout_ms);
+    bool ok = parser.send("AT+CIPSTART=0,\"TCP\",\"%s\",%d", ECHO_SERVER_ADDR,
+                          port) && parser.recv("OK");
+    parser.set_timeout(command_timeout_ms);
+    return ok;
+}
+
+static void close_link()
+{
+    command("AT+CIPCLOSE=0");
+}
+
+// sends size bytes on link 0, and adds the round trip to the histogram
+static bool send_chunk(int size)
+{
+    Timer timer;
+    timer.start();
+    bool ok = parser.send("AT+CIPSEND=0,%d", size) && parser.recv(">") &&
+              parser.write(chunk, size) == size && parser.recv("SEND OK");
+    add_to_histogram(timer.read_ms());
+    return ok;
+}
+
+void test_join()
+{
+    parser.set_timeout(command_timeout_ms);
+    parser.oob("+IPD,", on_ipd);
+    for (int i = 0; i < chunk_max; i++) {
+        chunk[i] = 'a' + i % 26;
+    }
+
+    // the ESP8266 may still be starting up
+    bool ready = false;
+    for (int i = 0; i < 5 && !ready; i++) {
+        ready = command("AT");
+    }
+    TEST_ASSERT_TRUE_MESSAGE(ready, "The ESP8266 does not answer");
+    TEST_ASSERT_TRUE(command("ATE0"));
+    TEST_ASSERT_TRUE(command("AT+CWMODE_CUR=1"));
+
+    parser.set_timeout(join_timeout_ms);
+    bool joined = parser.send("AT+CWJAP_CUR=\"%s\",\"%s\"",
+                              MBED_CONF_APP_WIFI_SECURE_SSID,
+                              MBED_CONF_APP_WIFI_PASSWORD) &&
+                  parser.recv("OK");
+    parser.set_timeout(command_timeout_ms);
+    TEST_ASSERT_TRUE_MESSAGE(joined, "The ESP8266 did not join the AP");
+    TEST_ASSERT_TRUE(command("AT+CIPMUX=1"));
+}
+
+// moves both ends of the link to baud, with RTS/CTS if rtscts is set
+template <int baud, bool rtscts>
+void test_link()
+{
+    // 3 is RTS and CTS, the ESP8266 takes the new rate after its OK
+    TEST_ASSERT_TRUE(parser.send("AT+UART_CUR=%d,8,1,0,%d", baud,
+                                 rtscts ? 3 : 0) && parser.recv("OK"));
+    ThisThread::sleep_for(20);
+    serial.set_baud(baud);
+#if defined(MBED_CONF_ESP8266_RTS) && defined(MBED_CONF_ESP8266_CTS)
+    serial.set_flow_control(rtscts ? SerialBase::RTSCTS : SerialBase::Disabled,
+                            MBED_CONF_ESP8266_RTS, MBED_CONF_ESP8266_CTS);
+#endif
+    parser.flush();
+    current_baud = baud;
+    current_flow = rtscts ? "RTS/CTS" : "no flow control";
+
+    bool ready = false;
+    for (int i = 0; i < 3 && !ready; i++) {
+        ready = command("AT");
+    }
+    TEST_ASSERT_TRUE_MESSAGE(ready, "The ESP8266 does not answer at the new rate");
+    failed_commands = 0;
+}
+
+void bench_at(uint32_t iterations)
+{
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (!command("AT")) {
+            failed_commands++;
+        }
+    }
+}
+
+void test_at_result()
+{
+    TEST_ASSERT_EQUAL(0, failed_commands);
+}
+
+// sends payload_size bytes to the discard server in chunks of size
+template <int size>
+void test_cipsend()
+{
+    TEST_ASSERT_TRUE(open_link(ECHO_SERVER_DISCARD_PORT));
+    clear_histogram();
+    Timer timer;
+    timer.start();
+    int sent = 0;
+    while (sent < payload_size) {
+        if (!send_chunk(size)) {
+            break;
+        }
+        sent += size;
+    }
+    timer.stop();
+    close_link();
+
+    char what[32];
+    snprintf(what, sizeof(what), "AT+CIPSEND of %d", size);
+    print_rate(what, sent, timer.read_ms());
+    print_histogram(what);
+    TEST_ASSERT_EQUAL(payload_size, sent);
+}
+
+// sends payload_size bytes to the discard server in transparent mode
+void test_passthrough()
+{
+    TEST_ASSERT_TRUE(command("AT+CIPMUX=0"));
+    parser.set_timeout(join_timeout_ms);
+    bool started = parser.send("AT+CIPSTART=\"TCP\",\"%s\",%d", ECHO_SERVER_ADDR,
+                               ECHO_SERVER_DISCARD_PORT) && parser.recv("OK");
+    parser.set_timeout(command_timeout_ms);
+    started = started && command("AT+CIPMODE=1") &&
+              parser.send("AT+CIPSEND") && parser.recv(">");
+
+    int sent = 0;
+    Timer timer;
+    timer.start();
+    while (started && sent < payload_size) {
+        if (parser.write(chunk, chunk_max) != chunk_max) {
+            break;
+        }
+        sent += chunk_max;
+    }
+    timer.stop();
+
+    ThisThread::sleep_for(passthrough_gap_ms);
+    parser.write("+++", 3);
+    ThisThread::sleep_for(passthrough_exit_ms);
+    parser.flush();
+    command("AT+CIPMODE=0");
+    command("AT+CIPCLOSE");
+    TEST_ASSERT_TRUE(command("AT+CIPMUX=1"));
+
+    print_rate("Transparent mode", sent, timer.read_ms());
+    TEST_ASSERT_TRUE(started);
+    TEST_ASSERT_EQUAL(payload_size, sent);
+}
+
+// takes what the ESP8266 keeps for link 0 in passive mode
+static void pull_passive()
+{
+    int length = 0;
+    while (parser.send("AT+CIPRECVDATA=0,%d", chunk_max) &&
+            parser.recv("+CIPRECVDATA,%d:", &length) && length > 0) {
+        int got = parser.read(chunk, length);
+        parser.recv("OK");
+        if (got <= 0) {
+            break;
+        }
+        received += got;
+    }
+}
+
+// sends payload_size bytes to the echo server in chunks of 512, takes
+// them back in active or passive mode, and counts what did not come back
+template <bool passive_mode>
+void test_echo()
+{
+    TEST_ASSERT_TRUE(parser.send("AT+CIPRECVMODE=%d", passive_mode ? 1 : 0) &&
+                     parser.recv("OK"));
+    passive = passive_mode;
+    received = 0;
+    TEST_ASSERT_TRUE(open_link(ECHO_SERVER_PORT));
+
+    clear_histogram();
+    Timer timer;
+    timer.start();
+    int sent = 0;
+    while (sent < payload_size && send_chunk(512)) {
+        sent += 512;
+        if (passive) {
+            pull_passive();
+        } else {
+            parser.process_oob();
+        }
+    }
+
+    // what is still on its way back
+    Timer drain;
+    drain.start();
+    while (received < sent && drain.read_ms() < command_timeout_ms) {
+        if (passive) {
+            pull_passive();
+        } else {
+            parser.process_oob();
+        }
+    }
+    timer.stop();
+    close_link();
+    passive = false;
+    command("AT+CIPRECVMODE=0");
+
+    const char *what = passive_mode ? "Echo, passive receive" :
+                       "Echo, active receive";
+    print_rate(what, received, timer.read_ms());
+    print_histogram(what);
+    printf("MBED: %s: %d bytes sent, %d dropped\n", what, sent, sent - received);
+    TEST_ASSERT_EQUAL(payload_size, sent);
+    TEST_ASSERT_EQUAL(sent, received);
+}
+
+#define LINK_CASES(baud, rtscts, flow)                                       \
+    Case("Link at " #baud " baud, " flow, test_link<baud, rtscts>),          \
+    BENCHMARK("AT round trip at " #baud " baud, " flow, bench_at),           \
+    Case("AT round trips at " #baud " baud, " flow " got OK", test_at_result),\
+    Case("AT+CIPSEND of 64 at " #baud " baud, " flow, test_cipsend<64>),     \
+    Case("AT+CIPSEND of 512 at " #baud " baud, " flow, test_cipsend<512>),   \
+    Case("AT+CIPSEND of 2048 at " #baud " baud, " flow, test_cipsend<2048>), \
+    Case("Transparent mode at " #baud " baud, " flow, test_passthrough),     \
+    Case("Active receive at " #baud " baud, " flow, test_echo<false>),       \
+    Case("Passive receive at " #baud " baud, " flow, test_echo<true>)
+
+utest::v1::status_t test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(1200, "default_auto");
+    return verbose_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+    Case("Join the access point", test_join),
+    LINK_CASES(115200, false, "no flow control"),
+    LINK_CASES(460800, false, "no flow control"),
+    LINK_CASES(921600, false, "no flow control"),
+#if defined(MBED_CONF_ESP8266_RTS) && defined(MBED_CONF_ESP8266_CTS)
+    LINK_CASES(115200, true, "RTS/CTS"),
+    LINK_CASES(460800, true, "RTS/CTS"),
+    LINK_CASES(921600, true, "RTS/CTS"),
+#endif
+    Case("Back to the default baud", test_link<default_baud, false>),
+};
+
+Specification specification(test_setup, cases);
+
+int main()
+{
+    return !Harness::run(specification);
+}
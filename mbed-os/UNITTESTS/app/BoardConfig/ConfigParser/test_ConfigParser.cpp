@@ -0,0 +1,169 @@
+/// \file
+/// \brief Host tests of the config file tokenizer
+#include "gtest/gtest.h"
+#include "ConfigParser.h"
+
+#include <cstring>
+#include <string>
+
+using std::string;
+
+class TestConfigParser : public testing::Test {
+protected:
+    // the fields of the line nextLine() moved to, joined with '|'
+    string fields(ConfigParser &Parser, char Delimiter)
+    {
+        string Out;
+        Span<const char> Field;
+        while (Parser.nextField(Delimiter, Field)) {
+            if (!Out.empty()) {
+                Out += '|';
+            }
+            Out += spanToString(Field);
+        }
+        return Out;
+    }
+};
+
+TEST_F(TestConfigParser, lines)
+{
+    const char Text[] = "first\r\nsecond\n\nlast";
+    ConfigParser Parser(Text, strlen(Text));
+
+    ASSERT_TRUE(Parser.nextLine());
+    EXPECT_EQ("first", spanToString(Parser.line()));
+    ASSERT_TRUE(Parser.nextLine());
+    EXPECT_EQ("second", spanToString(Parser.line()));
+    ASSERT_TRUE(Parser.nextLine());
+    EXPECT_TRUE(Parser.line().empty());
+    ASSERT_TRUE(Parser.nextLine());
+    EXPECT_EQ("last", spanToString(Parser.line()));
+    EXPECT_FALSE(Parser.nextLine());
+}
+
+TEST_F(TestConfigParser, text_without_end)
+{
+    // only Size bytes are read, there is no '\0' to stop at
+    const char Text[] = {'P', 'o', 'r', 't', '\n', 'X'};
+    ConfigParser Parser(Text, 4);
+
+    ASSERT_TRUE(Parser.nextLine());
+    EXPECT_EQ("Port", spanToString(Parser.line()));
+    EXPECT_FALSE(Parser.nextLine());
+}
+
+TEST_F(TestConfigParser, empty_text)
+{
+    ConfigParser Parser("", 0);
+    EXPECT_FALSE(Parser.nextLine());
+}
+
+TEST_F(TestConfigParser, line_is)
+{
+    const char Text[] = "Sensor:Current\nPort:Sensor\n\n";
+    ConfigParser Parser(Text, strlen(Text));
+
+    Parser.nextLine();
+    EXPECT_TRUE(Parser.lineIs('S', "Sensor"));
+    EXPECT_FALSE(Parser.lineIs('P', "Port"));
+    Parser.nextLine();
+    EXPECT_TRUE(Parser.lineIs('P', "Port"));
+    // the word may be anywhere, only the first character is fixed
+    EXPECT_FALSE(Parser.lineIs('S', "Sensor"));
+    Parser.nextLine();
+    EXPECT_FALSE(Parser.lineIs('P', "Port"));
+}
+
+TEST_F(TestConfigParser, fields_like_strtok)
+{
+    const char Text[] = ",,Sensor:Current,,A,1.5,";
+    ConfigParser Parser(Text, strlen(Text));
+    Parser.nextLine();
+
+    // delimiters next to each other do not make empty fields
+    EXPECT_EQ("Sensor:Current|A|1.5", fields(Parser, ','));
+}
+
+TEST_F(TestConfigParser, fields_and_rest_of_line)
+{
+    const char Text[] = "Virtual:Power,3,max(a, b) * 2\r\n";
+    ConfigParser Parser(Text, strlen(Text));
+    Parser.nextLine();
+
+    Span<const char> Field;
+    ASSERT_TRUE(Parser.nextField(':', Field));
+    EXPECT_EQ("Virtual", spanToString(Field));
+    ASSERT_TRUE(Parser.nextField(',', Field));
+    EXPECT_EQ("Power", spanToString(Field));
+    ASSERT_TRUE(Parser.nextField(',', Field));
+    EXPECT_EQ(3, spanToInt(Field));
+
+    // the rest keeps its commas, and then nothing is left
+    ASSERT_TRUE(Parser.restOfLine(Field));
+    EXPECT_EQ("max(a, b) * 2", spanToString(Field));
+    EXPECT_FALSE(Parser.restOfLine(Field));
+    EXPECT_FALSE(Parser.nextField(',', Field));
+}
+
+TEST_F(TestConfigParser, missing_fields)
+{
+    const char Text[] = "ConnInfo:\nBoard:ssid";
+    ConfigParser Parser(Text, strlen(Text));
+    Span<const char> Field;
+
+    Parser.nextLine();
+    ASSERT_TRUE(Parser.nextField(':', Field));
+    EXPECT_FALSE(Parser.nextField(',', Field));
+    EXPECT_FALSE(Parser.restOfLine(Field));
+
+    // a new line starts from its first field again
+    Parser.nextLine();
+    ASSERT_TRUE(Parser.nextField(':', Field));
+    EXPECT_EQ("Board", spanToString(Field));
+    ASSERT_TRUE(Parser.restOfLine(Field));
+    EXPECT_EQ("ssid", spanToString(Field));
+}
+
+TEST_F(TestConfigParser, spans)
+{
+    const char Text[] = "hidden,AC";
+    Span<const char> Field(Text, strlen(Text));
+
+    EXPECT_TRUE(spanContains(Field, "AC"));
+    EXPECT_TRUE(spanContains(Field, "hidden"));
+    EXPECT_FALSE(spanContains(Field, "DC"));
+    EXPECT_FALSE(spanContains(Field.first(2), "hidden"));
+    EXPECT_TRUE(spanEquals(Field.first(6), "hidden"));
+    EXPECT_FALSE(spanEquals(Field, "hidden"));
+}
+
+TEST_F(TestConfigParser, numbers)
+{
+    const char Text[] = "42,-7.25,0x10,12abc";
+    ConfigParser Parser(Text, strlen(Text));
+    Parser.nextLine();
+    Span<const char> Field;
+
+    Parser.nextField(',', Field);
+    EXPECT_EQ(42, spanToInt(Field));
+    EXPECT_FLOAT_EQ(42.0f, spanToFloat(Field));
+    Parser.nextField(',', Field);
+    EXPECT_EQ(-7, spanToInt(Field));
+    EXPECT_FLOAT_EQ(-7.25f, spanToFloat(Field));
+    // like atoi(), the digits up to the first other character
+    Parser.nextField(',', Field);
+    EXPECT_EQ(0, spanToInt(Field));
+    Parser.nextField(',', Field);
+    EXPECT_EQ(12, spanToInt(Field));
+}
+
+TEST_F(TestConfigParser, long_number)
+{
+    // only the first CONFIGNUMBERLEN - 1 characters are read
+    string Digits(CONFIGNUMBERLEN + 8, '1');
+    Digits[CONFIGNUMBERLEN - 1] = '9';
+    Span<const char> Field(Digits.data(), Digits.size());
+
+    EXPECT_FLOAT_EQ(atof(Digits.substr(0, CONFIGNUMBERLEN - 1).c_str()),
+                    spanToFloat(Field));
+}
@@ -0,0 +1,18 @@
+
+####################
+# UNIT TESTS
+####################
+
+# the application's own code, next to mbed-os
+set(unittest-includes ${unittest-includes}
+  ../../BoardConfig
+)
+
+set(unittest-sources
+  ../../BoardConfig/ConfigParser.cpp
+)
+
+set(unittest-test-sources
+  app/BoardConfig/ConfigParser/test_ConfigParser.cpp
+  stubs/mbed_assert_stub.c
+)
@@ -0,0 +1,142 @@
+/// \file
+/// \brief Host tests of the printf-free number formatting, against the
+/// host's snprintf
+///
+/// formatFixed() has to write what "%.*f" writes for every float it takes,
+/// so the readings of the requests look the same with newlib's printf and
+/// with the minimal-printf profile. NUMBERFORMAT_VALUES in the environment
+/// compares that many random floats instead of NUMBERFORMATVALUES.
+#include "gtest/gtest.h"
+#include "NumberFormat.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <random>
+
+/// Random floats compared for every number of decimals, unless
+/// NUMBERFORMAT_VALUES says otherwise
+#define NUMBERFORMATVALUES (200000)
+
+/// Seeds the random floats
+#define NUMBERFORMATSEED (1)
+
+class TestNumberFormat : public testing::Test {
+protected:
+    // what "%.*f" writes for Value
+    static std::string printed(float Value, unsigned Decimals)
+    {
+        char Text[64];
+        snprintf(Text, sizeof(Text), "%.*f", (int)Decimals, Value);
+        return Text;
+    }
+
+    // what formatFixed() writes for Value, with its length checked
+    static std::string fixed(float Value, unsigned Decimals)
+    {
+        char Text[FORMATFIXEDMAX + 1];
+        size_t Length = formatFixed(Text, Value, Decimals);
+        EXPECT_EQ(strlen(Text), Length);
+        EXPECT_LE(Length, (size_t)FORMATFIXEDMAX);
+        return Text;
+    }
+};
+
+TEST_F(TestNumberFormat, unsigned_like_printf)
+{
+    const uint32_t Values[] = {0, 1, 9, 10, 99, 100, 65535, 999999, 1000000,
+                               4294967295u
+                              };
+    for (size_t i = 0; i < sizeof(Values) / sizeof(Values[0]); ++i) {
+        for (size_t Width = 0; Width <= FORMATUNSIGNEDMAX; ++Width) {
+            char Expected[16], Text[FORMATUNSIGNEDMAX + 1];
+            snprintf(Expected, sizeof(Expected), "%0*lu", (int)Width,
+                     (unsigned long)Values[i]);
+            EXPECT_EQ(strlen(Expected), formatUnsigned(Text, Values[i], Width));
+            EXPECT_STREQ(Expected, Text);
+
+            snprintf(Expected, sizeof(Expected), "%0*lx", (int)Width,
+                     (unsigned long)Values[i]);
+            EXPECT_EQ(strlen(Expected), formatHex(Text, Values[i], Width));
+            EXPECT_STREQ(Expected, Text);
+        }
+    }
+}
+
+TEST_F(TestNumberFormat, backup_log_names_and_queue_keys)
+{
+    // "%06lu.seg" and "q%08lx", the zero padding keeps them in order
+    char Text[16];
+    formatUnsigned(Text, 42, 6);
+    EXPECT_STREQ("000042", Text);
+    formatUnsigned(Text, 1234567, 6);
+    EXPECT_STREQ("1234567", Text);
+    formatHex(Text, 0xBEEF, 8);
+    EXPECT_STREQ("0000beef", Text);
+    formatHex(Text, 0xFFFFFFFF, 8);
+    EXPECT_STREQ("ffffffff", Text);
+}
+
+TEST_F(TestNumberFormat, fixed_rounding)
+{
+    // ties of the binary value are rounded to even, like printf
+    EXPECT_EQ("0", fixed(0.5f, 0));
+    EXPECT_EQ("2", fixed(1.5f, 0));
+    EXPECT_EQ("2", fixed(2.5f, 0));
+    EXPECT_EQ("0.12", fixed(0.125f, 2));
+    EXPECT_EQ("0.38", fixed(0.375f, 2));
+    // 0.15f is a little more than 0.15, and 2.675f a little less
+    EXPECT_EQ("0.2", fixed(0.15f, 1));
+    EXPECT_EQ("2.67", fixed(2.675f, 2));
+    EXPECT_EQ("10.0", fixed(9.96f, 1));
+    EXPECT_EQ("-0.00", fixed(-0.001f, 2));
+    EXPECT_EQ("-0.0", fixed(-0.0f, 1));
+    EXPECT_EQ("230.500000", fixed(230.5f, 9));
+}
+
+TEST_F(TestNumberFormat, fixed_special_values)
+{
+    const float Infinity = std::numeric_limits<float>::infinity();
+    EXPECT_EQ(printed(Infinity, 2), fixed(Infinity, 2));
+    EXPECT_EQ(printed(-Infinity, 2), fixed(-Infinity, 2));
+    EXPECT_EQ("nan", fixed(std::numeric_limits<float>::quiet_NaN(), 2));
+
+    // longer whole parts are left to snprintf
+    char Text[FORMATFIXEDMAX + 1];
+    EXPECT_EQ(0u, formatFixed(Text, 1.0e13f, 2));
+    EXPECT_STREQ("", Text);
+    EXPECT_EQ(printed(9.99e12f, 6), fixed(9.99e12f, 6));
+    EXPECT_EQ(printed(-9.99e12f, 6), fixed(-9.99e12f, 6));
+}
+
+TEST_F(TestNumberFormat, fixed_like_printf)
+{
+    const char *Override = getenv("NUMBERFORMAT_VALUES");
+    long Count = Override != NULL ? atol(Override) : NUMBERFORMATVALUES;
+
+    // every exponent a reading can have is as likely, and the last bits of
+    // the mantissa are random
+    std::mt19937 Random(NUMBERFORMATSEED);
+    std::uniform_real_distribution<double> Exponent(-8.0, 13.0);
+    long Mismatches = 0;
+    for (long i = 0; i < Count; ++i) {
+        float Value = (float)pow(10.0, Exponent(Random));
+        if (Random() & 1) {
+            Value = -Value;
+        }
+        if (Value >= 1.0e13f || Value <= -1.0e13f) {
+            continue;
+        }
+        for (unsigned Decimals = 0; Decimals <= FORMATMAXDECIMALS; ++Decimals) {
+            std::string Expected = printed(Value, Decimals);
+            std::string Got = fixed(Value, Decimals);
+            if (Expected != Got && ++Mismatches <= 10) {
+                ADD_FAILURE() << "%." << Decimals << "f of " << Value << " is "
+                              << Expected << ", formatFixed() wrote " << Got;
+            }
+        }
+    }
+    EXPECT_EQ(0, Mismatches);
+}
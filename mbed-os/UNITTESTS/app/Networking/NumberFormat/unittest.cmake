@@ -0,0 +1,16 @@
+####################
+# UNIT TESTS
+####################
+
+# the application's own code, next to mbed-os
+set(unittest-includes ${unittest-includes}
+  ../../Networking
+)
+
+set(unittest-sources
+  ../../Networking/NumberFormat.cpp
+)
+
+set(unittest-test-sources
+  app/Networking/NumberFormat/test_NumberFormat.cpp
+)
@@ -0,0 +1,345 @@
+/// \file
+/// \brief Host run of mbed-coap on the block pools of CoapUplink.cpp, with
+/// Block1 POSTs to a server that loses a datagram.
+///
+/// The POST is built and its responses waited for as in CoapUplink::post(),
+/// which needs the board's Networking.h and can not be built on the host.
+/// The server is a second mbed-coap on the heap. It acknowledges every block
+/// but the last with a 2.31 Continue, and answers the last one with a 2.04
+/// Changed. The datagrams go through a queue each way, a test can lose one
+/// of the board's, and the clock moves on COAPPOLLMS for every wait so
+/// mbed-coap resends it. No allocation may fail, and every block has to be
+/// back in its pool once mbed-coap is done. The pools' peaks are printed.
+#include "gtest/gtest.h"
+#include "CoapPools.h"
+#include "mbed-coap/sn_coap_header.h"
+#include "mbed-coap/sn_coap_protocol.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+using std::deque;
+using std::string;
+using std::vector;
+
+// keep in step with Networking.h and CoapUplink.h
+#define RESPONSESIZE (512)
+#define COAPPACKETMAX (RESPONSESIZE + 64)
+#define COAPPAYLOADMAX (1024)
+#define COAPTIMEOUT (15000)
+#define COAPPOLLMS (250)
+#define COAPRESENDSECONDS (2)
+#define COAPRESENDS (3)
+
+/// Bytes of the CBOR body of the POSTs, three blocks of
+/// SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE
+#define COAPTESTBODY (700)
+
+/// The datagrams of a POST of COAPTESTBODY bytes
+#define COAPTESTBLOCKS                                                          \
+    ((COAPTESTBODY + SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE - 1) /                  \
+     SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE)
+
+/// What the server answers with
+#define COAPTESTREPLY "samplerate=\"5\""
+
+// mbed-coap seeds its message ids with this
+extern "C" uint32_t arm_random_seed_get(void)
+{
+    return 1;
+}
+
+/// The pools of CoapUplink.cpp
+static CoapPools<COAPPACKETMAX, COAPPAYLOADMAX + 16> Pools;
+
+static void *coapMalloc(uint16_t Size)
+{
+    return Pools.alloc(Size);
+}
+
+static void coapFree(void *Pointer)
+{
+    Pools.free(Pointer);
+}
+
+static void *serverMalloc(uint16_t Size)
+{
+    return malloc(Size);
+}
+
+static void serverFree(void *Pointer)
+{
+    free(Pointer);
+}
+
+typedef vector<uint8_t> Datagram;
+
+/// The datagrams on their way, and the one of the board's that is lost
+struct CoapLink {
+    deque<Datagram> ToServer;
+    deque<Datagram> ToClient;
+    int Sent;
+    int Lost;
+    bool Failed;
+};
+
+static CoapLink Link;
+
+static uint8_t clientSend(uint8_t *Packet, uint16_t Length,
+                          sn_nsdl_addr_s *Address, void *Param)
+{
+    if (++Link.Sent != Link.Lost) {
+        Link.ToServer.push_back(Datagram(Packet, Packet + Length));
+    }
+    return 1;
+}
+
+static uint8_t serverSend(uint8_t *Packet, uint16_t Length,
+                          sn_nsdl_addr_s *Address, void *Param)
+{
+    Link.ToClient.push_back(Datagram(Packet, Packet + Length));
+    return 1;
+}
+
+// as CoapUplink::received()
+static int8_t clientReceived(sn_coap_hdr_s *Header, sn_nsdl_addr_s *Address,
+                             void *Param)
+{
+    if (Header != NULL &&
+            (Header->coap_status == COAP_STATUS_BUILDER_MESSAGE_SENDING_FAILED ||
+             Header->coap_status == COAP_STATUS_BUILDER_BLOCK_SENDING_FAILED)) {
+        Link.Failed = true;
+    }
+    return 0;
+}
+
+static int8_t serverReceived(sn_coap_hdr_s *Header, sn_nsdl_addr_s *Address,
+                             void *Param)
+{
+    return 0;
+}
+
+class TestCoapPools : public testing::Test {
+protected:
+    void SetUp()
+    {
+        Link = CoapLink();
+        Clock = 0;
+        Client = sn_coap_protocol_init(coapMalloc, coapFree, clientSend,
+                                       clientReceived);
+        Server = sn_coap_protocol_init(serverMalloc, serverFree, serverSend,
+                                       serverReceived);
+        ASSERT_TRUE(Client != NULL);
+        ASSERT_TRUE(Server != NULL);
+        sn_coap_protocol_set_retransmission_parameters(Client, COAPRESENDS,
+                                                       COAPRESENDSECONDS);
+
+        static uint8_t Ip[4] = {127, 0, 0, 1};
+        Address.addr_len = sizeof(Ip);
+        Address.type = SN_NSDL_ADDRESS_TYPE_IPV4;
+        Address.port = 5683;
+        Address.addr_ptr = Ip;
+    }
+
+    void TearDown()
+    {
+        // as CoapUplink::forget(), everything mbed-coap kept goes back
+        sn_coap_protocol_clear_retransmission_buffer(Client);
+        sn_coap_protocol_clear_sent_blockwise_messages(Client);
+        sn_coap_protocol_destroy(Client);
+        sn_coap_protocol_destroy(Server);
+
+        BlockPoolStats Stats[COAPPOOLS];
+        ASSERT_EQ((size_t)COAPPOOLS, Pools.stats(Stats, COAPPOOLS));
+        for (size_t i = 0; i < COAPPOOLS; ++i) {
+            EXPECT_EQ(0u, Stats[i].InUse) << Stats[i].BlockSize;
+            EXPECT_EQ(0u, Stats[i].Failed) << Stats[i].BlockSize;
+        }
+        // the pools are shared by every test
+        printf("peak blocks in use so far: %lu/%lu/%lu/%lu\n",
+               (unsigned long)Stats[0].Peak, (unsigned long)Stats[1].Peak,
+               (unsigned long)Stats[2].Peak, (unsigned long)Stats[3].Peak);
+    }
+
+    // takes every datagram the server got, the whole POST is answered
+    // with COAPTESTREPLY
+    void serve()
+    {
+        while (!Link.ToServer.empty()) {
+            Datagram Packet = Link.ToServer.front();
+            Link.ToServer.pop_front();
+            sn_coap_hdr_s *Request = sn_coap_protocol_parse(
+                                         Server, &Address, Packet.size(), &Packet[0], NULL);
+            if (Request == NULL) {
+                continue;
+            }
+            if (Request->coap_status == COAP_STATUS_PARSER_BLOCKWISE_MSG_RECEIVED ||
+                    Request->coap_status == COAP_STATUS_OK) {
+                Received.assign((const char *)Request->payload_ptr,
+                                Request->payload_len);
+                answer(Request);
+            }
+            if (Request->coap_status == COAP_STATUS_PARSER_BLOCKWISE_MSG_RECEIVED) {
+                // the server's copy of the whole payload
+                serverFree(Request->payload_ptr);
+                Request->payload_ptr = NULL;
+            }
+            sn_coap_parser_release_allocated_coap_msg_mem(Server, Request);
+        }
+    }
+
+    void answer(sn_coap_hdr_s *Request)
+    {
+        sn_coap_hdr_s *Reply = sn_coap_build_response(
+                                   Server, Request, COAP_MSG_CODE_RESPONSE_CHANGED);
+        ASSERT_TRUE(Reply != NULL);
+        Reply->payload_ptr = (uint8_t *)COAPTESTREPLY;
+        Reply->payload_len = strlen(COAPTESTREPLY);
+        uint8_t Packet[COAPPACKETMAX];
+        int16_t Built = sn_coap_protocol_build(Server, &Address, Packet, Reply, NULL);
+        ASSERT_GT(Built, 0);
+        serverSend(Packet, Built, &Address, NULL);
+        Reply->payload_ptr = NULL;
+        sn_coap_parser_release_allocated_coap_msg_mem(Server, Reply);
+    }
+
+    // CoapUplink::post() against the server
+    // returns the response code, or what post() returns on a failure
+    int post(uint8_t *Payload, size_t Length, char *Response, size_t Size)
+    {
+        static uint8_t Token[4] = {1, 2, 3, 4};
+        sn_coap_hdr_s Request;
+        sn_coap_parser_init_message(&Request);
+        Request.msg_type = COAP_MSG_TYPE_CONFIRMABLE;
+        Request.msg_code = COAP_MSG_CODE_REQUEST_POST;
+        Request.token_ptr = Token;
+        Request.token_len = sizeof(Token);
+        Request.uri_path_ptr = (uint8_t *)"emon/post";
+        Request.uri_path_len = strlen("emon/post");
+        // COAPCBOR of Networking.cpp
+        Request.content_format = (sn_coap_content_format_e)60;
+        Request.payload_ptr = Payload;
+        Request.payload_len = Length;
+        if (Length > SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) {
+            if (sn_coap_parser_alloc_options(Client, &Request) == NULL) {
+                return -1;
+            }
+            uint8_t SizeExponent = 0;
+            while ((16U << SizeExponent) < SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) {
+                ++SizeExponent;
+            }
+            Request.options_list_ptr->block1 = 0x08 | SizeExponent;
+            Request.options_list_ptr->use_size1 = true;
+            Request.options_list_ptr->size1 = Length;
+        }
+
+        uint8_t Packet[COAPPACKETMAX];
+        sn_coap_protocol_exec(Client, Clock / 1000);
+        int16_t Built = -1;
+        if (sn_coap_builder_calc_needed_packet_data_size_2(
+                    &Request, SN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE) <= sizeof(Packet)) {
+            Built = sn_coap_protocol_build(Client, &Address, Packet, &Request, NULL);
+        }
+        coapFree(Request.options_list_ptr);
+        if (Built < 0 || !clientSend(Packet, Built, &Address, NULL)) {
+            return -4;
+        }
+
+        uint32_t Start = Clock;
+        while (!Link.Failed && Clock - Start < COAPTIMEOUT) {
+            serve();
+            // a wait for the next datagram
+            if (Link.ToClient.empty()) {
+                Clock += COAPPOLLMS;
+                sn_coap_protocol_exec(Client, Clock / 1000);
+                continue;
+            }
+            Datagram Got = Link.ToClient.front();
+            Link.ToClient.pop_front();
+            sn_coap_protocol_exec(Client, Clock / 1000);
+            sn_coap_hdr_s *Reply = sn_coap_protocol_parse(
+                                       Client, &Address, Got.size(), &Got[0], NULL);
+            if (Reply == NULL) {
+                continue;
+            }
+            bool Ours = Reply->coap_status == COAP_STATUS_OK &&
+                        Reply->msg_code >= COAP_MSG_CODE_RESPONSE_CREATED &&
+                        Reply->token_len == sizeof(Token) &&
+                        memcmp(Reply->token_ptr, Token, sizeof(Token)) == 0;
+            int Code = 0;
+            if (Ours) {
+                Code = (Reply->msg_code >> 5) * 100 + (Reply->msg_code & 0x1F);
+                size_t Kept = Reply->payload_len < Size ? Reply->payload_len : Size - 1;
+                memcpy(Response, Reply->payload_ptr, Kept);
+                Response[Kept] = '\0';
+            }
+            sn_coap_parser_release_allocated_coap_msg_mem(Client, Reply);
+            if (Ours) {
+                return Code;
+            }
+        }
+        return -5;
+    }
+
+    // a POST of COAPTESTBODY bytes that has to reach the server whole
+    void expectPost()
+    {
+        uint8_t Body[COAPTESTBODY];
+        for (size_t i = 0; i < sizeof(Body); ++i) {
+            Body[i] = (uint8_t)(i * 7);
+        }
+        char Response[RESPONSESIZE + 1];
+        EXPECT_EQ(204, post(Body, sizeof(Body), Response, sizeof(Response)));
+        EXPECT_STREQ(COAPTESTREPLY, Response);
+        EXPECT_EQ(string((const char *)Body, sizeof(Body)), Received);
+    }
+
+    struct coap_s *Client;
+    struct coap_s *Server;
+    sn_nsdl_addr_s Address;
+    uint32_t Clock;
+    string Received;
+};
+
+TEST_F(TestCoapPools, block1_post)
+{
+    expectPost();
+    EXPECT_EQ(COAPTESTBLOCKS, Link.Sent);
+}
+
+TEST_F(TestCoapPools, first_block_lost)
+{
+    Link.Lost = 1;
+    expectPost();
+    // the lost one was sent again
+    EXPECT_EQ(COAPTESTBLOCKS + 1, Link.Sent);
+}
+
+TEST_F(TestCoapPools, middle_block_lost)
+{
+    Link.Lost = 2;
+    expectPost();
+    // the lost one was sent again
+    EXPECT_EQ(COAPTESTBLOCKS + 1, Link.Sent);
+}
+
+TEST_F(TestCoapPools, last_block_lost)
+{
+    Link.Lost = 3;
+    expectPost();
+    // the lost one was sent again
+    EXPECT_EQ(COAPTESTBLOCKS + 1, Link.Sent);
+}
+
+TEST_F(TestCoapPools, short_post)
+{
+    // fits into one datagram, there are no options to allocate
+    uint8_t Body[] = {0xA1, 0x61, 0x72, 0x80};
+    char Response[RESPONSESIZE + 1];
+    EXPECT_EQ(204, post(Body, sizeof(Body), Response, sizeof(Response)));
+    EXPECT_EQ(string((const char *)Body, sizeof(Body)), Received);
+}
@@ -0,0 +1,39 @@
+####################
+# UNIT TESTS
+####################
+
+# the block pools of CoapUplink.cpp under mbed-os's own mbed-coap. The real
+# randLIB.h goes in front of the stub in target_h, mbed-coap waits a random
+# part of the resend interval
+set(unittest-includes
+  ${PROJECT_SOURCE_DIR}/../features/frameworks/mbed-client-randlib/mbed-client-randlib
+  ${unittest-includes}
+  ../features/frameworks/mbed-coap
+  ../features/frameworks/mbed-coap/source/include
+  ../features/frameworks/mbed-trace
+  ../features/frameworks/nanostack-libservice/mbed-client-libservice
+  ../../Networking
+  ../../Storage
+)
+
+set(unittest-sources
+  ../features/frameworks/mbed-client-randlib/source/randLIB.c
+  ../features/frameworks/mbed-coap/source/sn_coap_builder.c
+  ../features/frameworks/mbed-coap/source/sn_coap_header_check.c
+  ../features/frameworks/mbed-coap/source/sn_coap_parser.c
+  ../features/frameworks/mbed-coap/source/sn_coap_protocol.c
+  ../features/frameworks/nanostack-libservice/source/libList/ns_list.c
+)
+
+set(unittest-test-sources
+  app/Networking/coap/test_coap.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_critical_stub.c
+)
+
+# the macros of mbed_app.json
+foreach(flag
+    -DSN_COAP_MAX_BLOCKWISE_PAYLOAD_SIZE=256)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${flag}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${flag}")
+endforeach()
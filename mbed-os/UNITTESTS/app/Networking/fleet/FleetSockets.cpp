@@ -0,0 +1,244 @@
+/// \file
+/// \brief The host's TCP sockets behind the emulated ESP8266s, and the
+/// loopback server.
+#include "FleetSockets.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/// The most bytes of a request that the server looks at, it is far more
+/// than REQUESTMAX
+#define LOOPBACKREQUESTMAX (65536)
+
+int fleetConnect(const char *Host, int Port, int Ms)
+{
+    char Service[8];
+    snprintf(Service, sizeof(Service), "%d", Port);
+    addrinfo Hints;
+    memset(&Hints, 0, sizeof(Hints));
+    Hints.ai_family = AF_UNSPEC;
+    Hints.ai_socktype = SOCK_STREAM;
+    addrinfo *Found = NULL;
+    if (getaddrinfo(Host, Service, &Hints, &Found) != 0) {
+        return -1;
+    }
+    int Socket = -1;
+    for (addrinfo *At = Found; At != NULL && Socket < 0; At = At->ai_next) {
+        Socket = socket(At->ai_family, At->ai_socktype, At->ai_protocol);
+        if (Socket < 0) {
+            continue;
+        }
+        // connects without blocking, so it can give up after Ms
+        int Flags = fcntl(Socket, F_GETFL, 0);
+        fcntl(Socket, F_SETFL, Flags | O_NONBLOCK);
+        int Err = connect(Socket, At->ai_addr, At->ai_addrlen);
+        if (Err < 0 && errno == EINPROGRESS) {
+            pollfd Wait = {Socket, POLLOUT, 0};
+            Err = -1;
+            if (poll(&Wait, 1, Ms) == 1) {
+                int Result = 0;
+                socklen_t Length = sizeof(Result);
+                getsockopt(Socket, SOL_SOCKET, SO_ERROR, &Result, &Length);
+                Err = Result == 0 ? 0 : -1;
+            }
+        }
+        if (Err < 0) {
+            close(Socket);
+            Socket = -1;
+        }
+    }
+    freeaddrinfo(Found);
+    if (Socket >= 0) {
+        // the ESP8266 sends every CIPSEND as it is
+        int On = 1;
+        setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, &On, sizeof(On));
+    }
+    return Socket;
+}
+
+int fleetWait(const int *Sockets, bool *Ready, size_t Count, int Ms)
+{
+    pollfd Waits[8];
+    if (Count > sizeof(Waits) / sizeof(Waits[0])) {
+        Count = sizeof(Waits) / sizeof(Waits[0]);
+    }
+    for (size_t i = 0; i < Count; ++i) {
+        Waits[i].fd = Sockets[i];
+        Waits[i].events = POLLIN;
+        Waits[i].revents = 0;
+    }
+    int Found = poll(Waits, Count, Ms);
+    for (size_t i = 0; i < Count; ++i) {
+        Ready[i] = Found > 0 && Waits[i].revents != 0;
+    }
+    return Found > 0 ? Found : 0;
+}
+
+long fleetReceive(int Socket, void *Data, size_t Size)
+{
+    ssize_t Got = recv(Socket, Data, Size, MSG_DONTWAIT);
+    if (Got < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? -1 : 0;
+    }
+    return Got;
+}
+
+bool fleetSend(int Socket, const void *Data, size_t Size)
+{
+    const char *Bytes = static_cast<const char *>(Data);
+    while (Size > 0) {
+        ssize_t Sent = send(Socket, Bytes, Size, MSG_NOSIGNAL);
+        if (Sent < 0 && errno == EAGAIN) {
+            pollfd Wait = {Socket, POLLOUT, 0};
+            poll(&Wait, 1, -1);
+            continue;
+        }
+        if (Sent <= 0) {
+            return false;
+        }
+        Bytes += Sent;
+        Size -= Sent;
+    }
+    return true;
+}
+
+void fleetClose(int Socket)
+{
+    close(Socket);
+}
+
+// ============================================================================
+LoopbackServer::LoopbackServer(int Rate)
+    : Rate(Rate), Listener(-1), Port(0), Stopping(false), Requests(0),
+      Pairs(0), Links(0)
+{
+}
+
+LoopbackServer::~LoopbackServer()
+{
+    stop();
+}
+
+bool LoopbackServer::start()
+{
+    Listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        return false;
+    }
+    sockaddr_in Address;
+    memset(&Address, 0, sizeof(Address));
+    Address.sin_family = AF_INET;
+    Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t Length = sizeof(Address);
+    if (bind(Listener, (sockaddr *)&Address, sizeof(Address)) < 0 ||
+            listen(Listener, SOMAXCONN) < 0 ||
+            getsockname(Listener, (sockaddr *)&Address, &Length) < 0) {
+        close(Listener);
+        Listener = -1;
+        return false;
+    }
+    Port = ntohs(Address.sin_port);
+    Acceptor = std::thread(&LoopbackServer::acceptLinks, this);
+    return true;
+}
+
+void LoopbackServer::stop()
+{
+    if (Listener < 0) {
+        return;
+    }
+    Stopping = true;
+    shutdown(Listener, SHUT_RDWR);
+    Acceptor.join();
+    close(Listener);
+    Listener = -1;
+
+    std::vector<std::thread> Done;
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        for (size_t i = 0; i < Sockets.size(); ++i) {
+            shutdown(Sockets[i], SHUT_RDWR);
+        }
+        Done.swap(Threads);
+    }
+    for (size_t i = 0; i < Done.size(); ++i) {
+        Done[i].join();
+    }
+    // only closed here, so the shutdowns above can not hit a socket that
+    // took the number of a closed one
+    for (size_t i = 0; i < Sockets.size(); ++i) {
+        close(Sockets[i]);
+    }
+    Sockets.clear();
+}
+
+void LoopbackServer::acceptLinks()
+{
+    while (!Stopping) {
+        int Socket = accept(Listener, NULL, NULL);
+        if (Socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        int On = 1;
+        setsockopt(Socket, IPPROTO_TCP, TCP_NODELAY, &On, sizeof(On));
+        ++Links;
+        std::lock_guard<std::mutex> Guard(Lock);
+        Sockets.push_back(Socket);
+        Threads.push_back(std::thread(&LoopbackServer::serve, this, Socket));
+    }
+}
+
+// answers the requests of one link until the board closes it. stop()
+// closes the socket
+void LoopbackServer::serve(int Socket)
+{
+    char Body[32];
+    int BodyLength = snprintf(Body, sizeof(Body), "samplerate=\"%d\"", Rate);
+    char Response[160];
+    int ResponseLength =
+        snprintf(Response, sizeof(Response),
+                 "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n"
+                 "Connection: keep-alive\r\n\r\n%s",
+                 BodyLength, Body);
+
+    std::string Pending;
+    char Piece[2048];
+    while (true) {
+        ssize_t Got = recv(Socket, Piece, sizeof(Piece), 0);
+        if (Got <= 0) {
+            break;
+        }
+        Pending.append(Piece, Got);
+        // a GET ends with its headers
+        size_t End;
+        while ((End = Pending.find("\r\n\r\n")) != std::string::npos) {
+            size_t Found = 0;
+            for (size_t At = Pending.find("Port_ID[]="); At < End;
+                    At = Pending.find("Port_ID[]=", At + 1)) {
+                ++Found;
+            }
+            Pairs += Found;
+            ++Requests;
+            Pending.erase(0, End + 4);
+            if (send(Socket, Response, ResponseLength, MSG_NOSIGNAL) < 0) {
+                break;
+            }
+        }
+        if (Pending.size() > LOOPBACKREQUESTMAX) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef FLEETSOCKETS_H
+#define FLEETSOCKETS_H
+/// \file
+/// \brief The host's TCP sockets behind the emulated ESP8266s of the fleet
+/// test, and a server on the loopback interface for them to load.
+///
+/// They are kept out of test_fleet.cpp, the host's poll.h and mbed-os's
+/// mbed_poll.h can not be included together.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Connects to Host at Port, waiting up to Ms milliseconds
+/// returns the socket, or -1 if it could not connect
+int fleetConnect(const char *Host, int Port, int Ms);
+
+/// Waits up to Ms milliseconds, or for ever if it is -1, until one of the
+/// Count sockets can be read or was closed by the other end. Ready[i] is set
+/// for each one that can
+/// returns how many can be read
+int fleetWait(const int *Sockets, bool *Ready, size_t Count, int Ms);
+
+/// Takes up to Size bytes that came in on Socket, without waiting
+/// returns how many it took, 0 once the other end closed it, or -1 if
+/// nothing came in
+long fleetReceive(int Socket, void *Data, size_t Size);
+
+/// Sends all Size bytes of Data
+/// returns false if the link broke
+bool fleetSend(int Socket, const void *Data, size_t Size);
+
+void fleetClose(int Socket);
+
+/// A keep-alive HTTP server on 127.0.0.1 with a thread for every link. It
+/// answers every request with a 200 and samplerate="Rate", and counts the
+/// requests and the Port_ID[] of the readings in them
+class LoopbackServer {
+public:
+    explicit LoopbackServer(int Rate);
+
+    ~LoopbackServer();
+
+    /// Listens on a free port
+    /// returns false if it could not
+    bool start();
+
+    /// Closes every link and waits for their threads
+    void stop();
+
+    int port() const
+    {
+        return Port;
+    }
+
+    uint32_t requests() const
+    {
+        return Requests;
+    }
+
+    /// Returns how many port readings came in, over every request
+    uint64_t pairs() const
+    {
+        return Pairs;
+    }
+
+    /// Returns how many links the boards opened
+    uint32_t links() const
+    {
+        return Links;
+    }
+
+private:
+    void acceptLinks();
+    void serve(int Socket);
+
+    int Rate;
+    int Listener;
+    int Port;
+    std::atomic<bool> Stopping;
+    std::atomic<uint32_t> Requests;
+    std::atomic<uint64_t> Pairs;
+    std::atomic<uint32_t> Links;
+    std::thread Acceptor;
+
+    /// the links and their threads, stop() shuts them down
+    std::mutex Lock;
+    std::vector<int> Sockets;
+    std::vector<std::thread> Threads;
+};
+
+#endif // FLEETSOCKETS_H
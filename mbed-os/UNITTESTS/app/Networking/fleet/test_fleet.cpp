@@ -0,0 +1,1039 @@
+/// \file
+/// \brief Host load test of the server with a fleet of simulated boards,
+/// each talking AT to an emulated ESP8266 on a real TCP socket.
+///
+/// Every board is a thread with the firmware's own ATCmdParser,
+/// RequestWriter and HttpResponse, on top of an EmulatedESP8266. That is a
+/// FileHandle that answers the AT commands of Networking.cpp like the
+/// ESP8266 does, and connects each AT+CIPSTART link to the server with a
+/// socket of the host. What the server sends comes back as +IPD the same
+/// way. The readings come from a SimulatedAnalogIn for each port.
+///
+/// The fleet replays a site wide outage. The access point goes away for
+/// FLEETOUTAGE seconds, while every board backs up a reading each interval
+/// and tries the access point again with the jittered backoff of
+/// ReconnectScheduler. Once it is back, each board sends its live reading
+/// on LIVELINK and drains its backlog in batches of up to BACKUPBATCHMAX
+/// readings below REQUESTMAX bytes, one on each of the BACKLOGLINKS links
+/// before the first response is read, as Networking.cpp does it. The boards'
+/// intervals and backoffs go by FLEETSPEEDUP times faster than on a board,
+/// the links and the server keep their own pace.
+///
+/// Without FLEET_SERVER in the environment the fleet loads a server on the
+/// loopback interface, which has to get every reading that the boards had
+/// acknowledged. FLEET_SERVER="host:port/path" loads that server instead,
+/// FLEET_BOARDS and FLEET_OUTAGE change how many boards there are and how
+/// long the outage is in seconds. That is the host build of the uplink,
+/// Networking.cpp itself needs the K64F's eDMA for the ESP8266's UART.
+#include "gtest/gtest.h"
+#include "ATCmdParser.h"
+#include "FleetSockets.h"
+#include "HttpResponse.h"
+#include "RequestWriter.h"
+#include "Structs.h"
+#include "mbed_poll.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/// The boards of the fleet, unless FLEET_BOARDS says otherwise
+#define FLEETBOARDS (32)
+
+/// The ports of every board
+#define FLEETPORTS (8)
+
+/// The seconds between two readings, until the server says otherwise
+#define FLEETINTERVAL (5)
+
+/// How long the access point is gone, in seconds, unless FLEET_OUTAGE says
+/// otherwise
+#define FLEETOUTAGE (300)
+
+/// How much faster than on a board the intervals and the backoff go by
+#define FLEETSPEEDUP (100)
+
+/// How long the boards have to drain their backlog once the access point is
+/// back, in milliseconds of the host
+#define FLEETLIMITMS (60000)
+
+/// How often the numbers of the fleet are printed, in milliseconds
+#define FLEETREPORTMS (1000)
+
+/// The time of the first reading, in seconds since 1970
+#define FLEETEPOCH (1600000000)
+
+/// The links of the ESP8266 with CIPMUX=1
+#define ESPLINKS (5)
+
+/// The most bytes of a link that one +IPD carries, about a TCP segment
+#define ESPPACKETMAX (1460)
+
+// keep in step with Networking.h, NetworkBackend.h and ReconnectScheduler.h
+#define SENDCHUNKSIZE (512)
+#define REQUESTMAX (8000)
+#define BACKUPBATCHMAX (32)
+#define RESPONSEPIECE (64)
+#define RESPONSESIZE (512)
+#define SERIALTIMEOUT (3000)
+#define SERVERLINKS (4)
+#define LIVELINK (0)
+#define BACKLOGLINK (1)
+#define BACKLOGLINKS (SERVERLINKS - BACKLOGLINK)
+#define RECONNECTFIRSTMS (2000)
+#define RECONNECTMAXMS (300000)
+
+// the strings of the requests, as in Networking.cpp
+static const char *get_req_start = "GET ";
+static const char *id_get_str = "Board_ID=";
+static const char *version_get_str = "&Config_Version=";
+static const char *port_get_str = "&Port_ID[]=";
+static const char *value_get_str = "&Value[]=";
+static const char *time_get_str = "&Time[]=";
+static const char *http_version = " HTTP/1.1\r\n";
+static const char *req_header = "Host: ";
+static const char *get_req_end = "\r\n";
+static const char *keep_alive_header = "Connection: keep-alive\r\n";
+
+typedef std::chrono::steady_clock Clock;
+
+// the time of the host that Ms milliseconds on a board take
+static Clock::duration boardTime(uint32_t Ms)
+{
+    return std::chrono::microseconds((uint64_t)Ms * 1000 / FLEETSPEEDUP);
+}
+
+static uint32_t msSince(Clock::time_point Start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               Clock::now() - Start).count();
+}
+
+// swallows everything, used to measure requests
+static bool discardText(const char *data, size_t length)
+{
+    return true;
+}
+
+// ============================================================================
+// The hardware of a board
+
+/// Stands in for the AnalogIn of a current clamp, on a load that switches on
+/// and off now and then, with a bit of noise
+class SimulatedAnalogIn {
+public:
+    explicit SimulatedAnalogIn(uint32_t Seed)
+        : Random(Seed), Level(0.0f), On(Seed % 2 == 0)
+    {
+    }
+
+    /// Like AnalogIn::read_u16(), 0xFFFF is full scale
+    uint16_t read_u16()
+    {
+        // the load changes about every 50 readings
+        if (Random() % 50 == 0) {
+            On = !On;
+        }
+        float Target = On ? 0.6f : 0.05f;
+        Level += (Target - Level) * 0.2f;
+        float Noise = std::uniform_real_distribution<float>(-0.01f,
+                      0.01f)(Random);
+        float Value = std::min(1.0f, std::max(0.0f, Level + Noise));
+        return (uint16_t)(Value * 0xFFFF + 0.5f);
+    }
+
+    /// Like AnalogIn::read(), from 0.0 to 1.0
+    float read()
+    {
+        return read_u16() * (1.0f / (float)0xFFFF);
+    }
+
+private:
+    std::minstd_rand Random;
+    float Level;
+    bool On;
+};
+
+/// The serial port of the ESP8266, with its AT firmware behind it. The
+/// access point is shared by the whole fleet, and AT+CWJAP fails while it
+/// is down. Each link is a socket of the host, what it receives is read
+/// whenever the board waits for the ESP8266
+class EmulatedESP8266 : public mbed::FileHandle {
+public:
+    explicit EmulatedESP8266(const std::atomic<bool> &AccessPoint)
+        : AccessPoint(AccessPoint), RxAt(0), SendLink(-1), SendLeft(0),
+          Joined(false)
+    {
+        for (int i = 0; i < ESPLINKS; ++i) {
+            Sockets[i] = -1;
+        }
+    }
+
+    virtual ~EmulatedESP8266()
+    {
+        for (int i = 0; i < ESPLINKS; ++i) {
+            if (Sockets[i] >= 0) {
+                fleetClose(Sockets[i]);
+            }
+        }
+    }
+
+    virtual ssize_t read(void *buffer, size_t size)
+    {
+        if (RxAt == Rx.size()) {
+            receive();
+        }
+        if (RxAt == Rx.size()) {
+            return -EAGAIN;
+        }
+        size_t Length = std::min(size, Rx.size() - RxAt);
+        memcpy(buffer, Rx.data() + RxAt, Length);
+        RxAt += Length;
+        if (RxAt == Rx.size()) {
+            Rx.clear();
+            RxAt = 0;
+        }
+        return Length;
+    }
+
+    virtual ssize_t write(const void *buffer, size_t size)
+    {
+        const char *Bytes = static_cast<const char *>(buffer);
+        for (size_t i = 0; i < size; ++i) {
+            if (SendLink >= 0) {
+                // the data of AT+CIPSEND
+                SendData += Bytes[i];
+                if (--SendLeft == 0) {
+                    sendData();
+                }
+                continue;
+            }
+            Line += Bytes[i];
+            size_t End = Line.size();
+            if (End >= 2 && Line[End - 2] == '\r' && Line[End - 1] == '\n') {
+                Line.resize(End - 2);
+                command(Line);
+                Line.clear();
+            }
+        }
+        return size;
+    }
+
+    virtual short poll(short events) const
+    {
+        return POLLOUT | (RxAt < Rx.size() || waitLinks(0) ? POLLIN : 0);
+    }
+
+    virtual off_t seek(off_t offset, int whence)
+    {
+        return -ESPIPE;
+    }
+
+    virtual int close()
+    {
+        return 0;
+    }
+
+    /// Waits up to Ms milliseconds until something can be read
+    void wait(int Ms)
+    {
+        if (RxAt < Rx.size()) {
+            return;
+        }
+        if (!waitLinks(Ms)) {
+            return;
+        }
+        receive();
+    }
+
+private:
+    void answer(const char *Format, int Value = 0)
+    {
+        char Text[64];
+        snprintf(Text, sizeof(Text), Format, Value);
+        Rx += Text;
+    }
+
+    bool linkValid(int Link) const
+    {
+        return Link >= 0 && Link < ESPLINKS;
+    }
+
+    // answers one line that the board sent
+    void command(const string &Text)
+    {
+        int Link = -1;
+        int Number = 0;
+        char Host[128];
+        if (sscanf(Text.c_str(), "AT+CIPSTART=%d,\"TCP\",\"%127[^\"]\",%d",
+                   &Link, Host, &Number) == 3 && linkValid(Link)) {
+            if (!Joined) {
+                answer("no ip\r\n\r\nERROR\r\n");
+            } else if (Sockets[Link] >= 0) {
+                answer("ALREADY CONNECTED\r\n\r\nERROR\r\n");
+            } else if ((Sockets[Link] = fleetConnect(Host, Number,
+                                        SERIALTIMEOUT)) < 0) {
+                answer("\r\nERROR\r\nCLOSED\r\n");
+            } else {
+                answer("%d,CONNECT\r\n\r\nOK\r\n", Link);
+            }
+        } else if (sscanf(Text.c_str(), "AT+CIPSEND=%d,%d", &Link,
+                          &Number) == 2 && linkValid(Link)) {
+            if (Sockets[Link] < 0 || Number <= 0 || Number > 2048) {
+                answer("link is not valid\r\n\r\nERROR\r\n");
+            } else {
+                SendLink = Link;
+                SendLeft = Number;
+                SendData.clear();
+                answer("\r\nOK\r\n> ");
+            }
+        } else if (sscanf(Text.c_str(), "AT+CIPCLOSE=%d", &Link) == 1) {
+            if (!linkValid(Link) || Sockets[Link] < 0) {
+                answer("UNLINK\r\n\r\nERROR\r\n");
+            } else {
+                closeLink(Link);
+                answer("\r\nOK\r\n");
+            }
+        } else if (Text.compare(0, 8, "AT+CWJAP") == 0) {
+            Joined = AccessPoint;
+            answer(Joined ? "WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n"
+                   : "+CWJAP:3\r\n\r\nFAIL\r\n");
+        } else {
+            answer("\r\nOK\r\n");
+        }
+    }
+
+    // the data of AT+CIPSEND is complete
+    void sendData()
+    {
+        int Link = SendLink;
+        SendLink = -1;
+        answer("\r\nRecv %d bytes\r\n", (int)SendData.size());
+        if (fleetSend(Sockets[Link], SendData.data(), SendData.size())) {
+            answer("\r\nSEND OK\r\n");
+        } else {
+            answer("\r\nSEND FAIL\r\n");
+            closeLink(Link);
+        }
+    }
+
+    void closeLink(int Link)
+    {
+        fleetClose(Sockets[Link]);
+        Sockets[Link] = -1;
+        answer("%d,CLOSED\r\n", Link);
+    }
+
+    // returns true if one of the links can be read within Ms
+    bool waitLinks(int Ms) const
+    {
+        int Open[ESPLINKS];
+        bool Ready[ESPLINKS];
+        size_t Count = 0;
+        for (int i = 0; i < ESPLINKS; ++i) {
+            if (Sockets[i] >= 0) {
+                Open[Count++] = Sockets[i];
+            }
+        }
+        if (Count == 0) {
+            // nothing can come in
+            if (Ms > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(Ms));
+            }
+            return false;
+        }
+        return fleetWait(Open, Ready, Count, Ms) > 0;
+    }
+
+    // turns what came in on the links into +IPD and CLOSED
+    void receive()
+    {
+        char Packet[ESPPACKETMAX];
+        for (int i = 0; i < ESPLINKS; ++i) {
+            if (Sockets[i] < 0) {
+                continue;
+            }
+            long Got = fleetReceive(Sockets[i], Packet, sizeof(Packet));
+            if (Got > 0) {
+                char Head[32];
+                snprintf(Head, sizeof(Head), "\r\n+IPD,%d,%ld:", i, Got);
+                Rx += Head;
+                Rx.append(Packet, Got);
+            } else if (Got == 0) {
+                closeLink(i);
+            }
+        }
+    }
+
+    const std::atomic<bool> &AccessPoint;
+
+    /// what the ESP8266 sent that was not read yet
+    string Rx;
+    size_t RxAt;
+
+    /// the command that is coming in
+    string Line;
+
+    /// the link of the AT+CIPSEND whose data is coming in, -1 for none
+    int SendLink;
+    size_t SendLeft;
+    string SendData;
+
+    int Sockets[ESPLINKS];
+    bool Joined;
+};
+
+namespace mbed {
+
+// the ESP8266s are the only FileHandles of the test, and only what comes in
+// on their sockets can make them readable
+int poll(pollfh fhs[], unsigned nfhs, int timeout)
+{
+    for (int Pass = 0; Pass < 2; ++Pass) {
+        int Ready = 0;
+        for (unsigned i = 0; i < nfhs; ++i) {
+            fhs[i].revents = fhs[i].fh->poll(fhs[i].events) & fhs[i].events;
+            Ready += fhs[i].revents != 0;
+        }
+        if (Ready > 0 || timeout == 0 || Pass > 0) {
+            return Ready;
+        }
+        static_cast<EmulatedESP8266 *>(fhs[0].fh)->wait(timeout);
+    }
+    return 0;
+}
+
+} // namespace mbed
+
+// ============================================================================
+// The fleet
+
+/// What the fleet sent and how the server answered
+struct FleetStats {
+    FleetStats()
+        : Requests(0), Readings(0), Failures(0), Connects(0), Pending(0)
+    {
+    }
+
+    std::mutex Lock;
+    uint32_t Requests;
+
+    /// the readings of the requests that got a 200
+    uint64_t Readings;
+    uint32_t Failures;
+    uint32_t Connects;
+
+    /// the readings that the boards hold
+    std::atomic<int64_t> Pending;
+
+    /// from the first byte of a request to the end of its response, in ms,
+    /// since the last report
+    vector<uint32_t> Latencies;
+
+    /// when each board had sent its backlog, in ms after the access point
+    /// came back
+    vector<uint32_t> Drained;
+};
+
+/// Where the fleet goes and the outage it replays
+struct FleetConfig {
+    string Host;
+    int Port;
+    string Dir;
+    int Boards;
+    int Outage;
+    std::atomic<bool> AccessPoint;
+
+    /// when the access point went
+    Clock::time_point Start;
+
+    /// when the boards give up
+    Clock::time_point Deadline;
+
+    FleetStats Stats;
+};
+
+// returns the number in the environment variable Name, or Default
+static int environmentNumber(const char *Name, int Default)
+{
+    const char *Text = getenv(Name);
+    return Text != NULL && atoi(Text) > 0 ? atoi(Text) : Default;
+}
+
+/// One link to the server, as in Networking.cpp
+struct ServerLink {
+    ServerLink() : Open(false), Http(Body, sizeof(Body))
+    {
+    }
+
+    bool Open;
+    char Body[RESPONSESIZE + 1];
+    HttpResponse Http;
+};
+
+/// One simulated board
+class Board {
+public:
+    Board(FleetConfig &Fleet, int Number)
+        : Fleet(Fleet), Number(Number), Esp(Fleet.AccessPoint),
+          Parser(&Esp, "\r\n", 256, SERIALTIMEOUT), Random(0x2545F491),
+          IntervalMs(FLEETINTERVAL * 1000), CommandFailed(false),
+          WritingLink(-1)
+    {
+        snprintf(Name, sizeof(Name), "sim%04d", Number);
+        for (int i = 0; i < FLEETPORTS; ++i) {
+            Inputs.push_back(SimulatedAnalogIn(Number * FLEETPORTS + i + 1));
+        }
+        // Random is the xorshift of ReconnectScheduler, it never leaves 0
+        Random ^= (uint32_t)Number * 2654435761u;
+        if (Random == 0) {
+            Random = 0x2545F491;
+        }
+
+        // the handlers of startESP()
+        for (int i = 0; i < SERVERLINKS; ++i) {
+            snprintf(ClosedMessages[i], sizeof(ClosedMessages[i]),
+                     "%d,CLOSED", i);
+            Parser.oob(ClosedMessages[i], callback(onLinkClosed, &Links[i]));
+        }
+        Parser.oob("+IPD,", callback(this, &Board::onPacket));
+        Parser.oob("ERROR", callback(this, &Board::onCommandFailed));
+        Parser.oob("FAIL", callback(this, &Board::onCommandFailed));
+        Parser.oob("SEND FAIL", callback(this, &Board::onCommandFailed));
+    }
+
+    /// Replays the outage, and drains the backlog once the access point is
+    /// back
+    void run();
+
+private:
+    static void onLinkClosed(ServerLink *Link)
+    {
+        Link->Open = false;
+        Link->Http.closed();
+    }
+
+    // "+IPD,<link>,<length>:" and the data, like onPacket() of
+    // Networking.cpp
+    void onPacket()
+    {
+        int Id = -1;
+        int Received = 0;
+        if (!Parser.recv("%d,%d:", &Id, &Received)) {
+            return;
+        }
+        char Piece[RESPONSEPIECE];
+        while (Received > 0) {
+            int Got = Parser.read(Piece, std::min(Received, RESPONSEPIECE));
+            if (Got <= 0) {
+                break;
+            }
+            if (Id >= 0 && Id < SERVERLINKS) {
+                Links[Id].Http.feed(Piece, Got);
+            }
+            Received -= Got;
+        }
+    }
+
+    void onCommandFailed()
+    {
+        CommandFailed = true;
+        Parser.abort();
+    }
+
+    void beginCommand()
+    {
+        CommandFailed = false;
+    }
+
+    // a reading of every port
+    SampleFrame sample()
+    {
+        SampleFrame Frame;
+        Frame.clear();
+        uint64_t Ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          Clock::now() - Fleet.Start).count();
+        Frame.Timestamp = FLEETEPOCH + (uint32_t)(Ms * FLEETSPEEDUP / 1000);
+        for (int i = 0; i < FLEETPORTS; ++i) {
+            Frame.setReading(i, Inputs[i].read());
+        }
+        return Frame;
+    }
+
+    // the wait of ReconnectScheduler::jittered()
+    uint32_t jittered(uint32_t DelayMs)
+    {
+        Random ^= Random << 13;
+        Random ^= Random >> 17;
+        Random ^= Random << 5;
+        uint32_t Half = DelayMs / 2;
+        return Half + Random % (DelayMs - Half + 1);
+    }
+
+    bool join()
+    {
+        beginCommand();
+        Parser.send("AT+CWJAP=\"%s\",\"%s\"", "fleet", "password");
+        return Parser.recv("OK");
+    }
+
+    // openServerLink()
+    bool openLink(int Link)
+    {
+        ServerLink &Server = Links[Link];
+        Server.Http = HttpResponse(Server.Body, sizeof(Server.Body));
+        if (Server.Open) {
+            return true;
+        }
+        beginCommand();
+        Parser.send("AT+CIPSTART=%d,\"TCP\",\"%s\",%d", Link,
+                    Fleet.Host.c_str(), Fleet.Port);
+        if (!Parser.recv("OK")) {
+            beginCommand();
+            Parser.send("AT+CIPCLOSE=%d", Link);
+            Parser.recv("OK");
+            return false;
+        }
+        Server.Open = true;
+        std::lock_guard<std::mutex> Guard(Fleet.Stats.Lock);
+        ++Fleet.Stats.Connects;
+        return true;
+    }
+
+    void closeLink(int Link)
+    {
+        beginCommand();
+        Parser.send("AT+CIPCLOSE=%d", Link);
+        Parser.recv("OK");
+        Links[Link].Open = false;
+    }
+
+    // writeServerLink(), the flush function of the requests
+    bool writePiece(const char *data, size_t length)
+    {
+        beginCommand();
+        Parser.send("AT+CIPSEND=%d,%d", WritingLink, (int)length);
+        if (!Parser.recv(">")) {
+            return false;
+        }
+        if (Parser.write(data, length) != (int)length) {
+            return false;
+        }
+        return Parser.recv("SEND OK");
+    }
+
+    // appendRequestStart() and appendReadings() of Networking.cpp, without
+    // the telemetry
+    void appendStart(RequestWriter &Message)
+    {
+        Message.append(get_req_start);
+        Message.append(Fleet.Dir.c_str());
+        Message.append("?");
+        Message.append(id_get_str);
+        Message.append(Name);
+        Message.append(version_get_str);
+        Message.appendUnsigned(0);
+    }
+
+    void appendReadings(RequestWriter &Message, const SampleFrame &Frame,
+                        bool Stamp)
+    {
+        char Port[8];
+        for (int i = 0; i < FLEETPORTS; ++i) {
+            if (Frame.hasPort(i)) {
+                snprintf(Port, sizeof(Port), "P%d", i);
+                Message.append(port_get_str);
+                Message.append(Port);
+                Message.append(value_get_str);
+                Message.appendFloat(Frame.value(i, 100.0f));
+                if (Stamp) {
+                    Message.append(time_get_str);
+                    Message.appendUnsigned(Frame.Timestamp);
+                }
+            }
+        }
+    }
+
+    void appendEnd(RequestWriter &Message)
+    {
+        Message.append(http_version);
+        Message.append(req_header);
+        Message.append(Fleet.Host.c_str());
+        Message.append(get_req_end);
+        Message.append(keep_alive_header);
+        Message.append(get_req_end);
+    }
+
+    // the bytes of the request without the readings
+    size_t overheadSize()
+    {
+        char Scratch[64];
+        RequestWriter Measure(Scratch, sizeof(Scratch), callback(discardText));
+        appendStart(Measure);
+        appendEnd(Measure);
+        Measure.finish();
+        return Measure.flushed();
+    }
+
+    size_t readingSize(const SampleFrame &Frame)
+    {
+        char Scratch[64];
+        RequestWriter Measure(Scratch, sizeof(Scratch), callback(discardText));
+        appendReadings(Measure, Frame, true);
+        Measure.finish();
+        return Measure.flushed();
+    }
+
+    // writeRequestTCP(): a link that the server closed without the CLOSED
+    // being seen yet is opened again once
+    bool writeRequest(int Link, const SampleFrame *Frames, size_t Count,
+                      bool Stamp)
+    {
+        for (int Attempt = 0; Attempt < 2; ++Attempt) {
+            bool Reused = Links[Link].Open;
+            if (!openLink(Link)) {
+                return false;
+            }
+            WritingLink = Link;
+            RequestWriter Message(Chunk, sizeof(Chunk),
+                                  callback(this, &Board::writePiece));
+            appendStart(Message);
+            for (size_t i = 0; i < Count; ++i) {
+                appendReadings(Message, Frames[i], Stamp);
+            }
+            appendEnd(Message);
+            if (Message.finish()) {
+                return true;
+            }
+            closeLink(Link);
+            if (!Reused || Message.flushed() != 0) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // awaitResponse(): waits until the response on Link is complete, and
+    // closes the link if it can not take the next request
+    bool awaitResponse(int Link)
+    {
+        HttpResponse &Http = Links[Link].Http;
+        Clock::time_point LastData = Clock::now();
+        while (!Http.complete() && !Http.failed()) {
+            if (Parser.process_oob()) {
+                LastData = Clock::now();
+            } else if (msSince(LastData) >= SERIALTIMEOUT) {
+                break;
+            } else {
+                Esp.wait(SERIALTIMEOUT - msSince(LastData));
+            }
+        }
+        if (!Http.complete() || !Http.keepAlive()) {
+            closeLink(Link);
+        }
+        if (Http.complete() && Http.status() == 200) {
+            // parseServerSettings()
+            const char *Rate = strstr(Http.body(), "samplerate=\"");
+            if (Rate != NULL && atof(Rate + 12) > 0) {
+                IntervalMs = (uint32_t)(atof(Rate + 12) * 1000);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // counts a request that took Ms and carried Readings
+    void record(bool Answered, uint32_t Ms, size_t Readings)
+    {
+        std::lock_guard<std::mutex> Guard(Fleet.Stats.Lock);
+        ++Fleet.Stats.Requests;
+        if (Answered) {
+            Fleet.Stats.Readings += Readings;
+            Fleet.Stats.Latencies.push_back(Ms);
+        } else {
+            ++Fleet.Stats.Failures;
+        }
+    }
+
+    bool sendLive(const SampleFrame &Frame)
+    {
+        Clock::time_point Start = Clock::now();
+        bool Answered = writeRequest(LIVELINK, &Frame, 1, false) &&
+                        awaitResponse(LIVELINK);
+        record(Answered, msSince(Start), 1);
+        return Answered;
+    }
+
+    /// sends a batch of the backlog on each of the backlog links, and then
+    /// waits for their responses. Returns false if none got through
+    bool drainBacklog();
+
+    void backUp(const SampleFrame &Frame)
+    {
+        Backlog.push_back(Frame);
+        ++Fleet.Stats.Pending;
+    }
+
+    FleetConfig &Fleet;
+    int Number;
+    char Name[16];
+    EmulatedESP8266 Esp;
+    ATCmdParser Parser;
+    vector<SimulatedAnalogIn> Inputs;
+    uint32_t Random;
+    uint32_t IntervalMs;
+    bool CommandFailed;
+
+    ServerLink Links[SERVERLINKS];
+    char ClosedMessages[SERVERLINKS][12];
+
+    /// the request is formatted into here while it is sent
+    char Chunk[SENDCHUNKSIZE + 1];
+    int WritingLink;
+
+    /// the readings that are backed up, oldest first
+    vector<SampleFrame> Backlog;
+};
+
+bool Board::drainBacklog()
+{
+    size_t Overhead = overheadSize();
+    size_t From[BACKLOGLINKS];
+    size_t Count[BACKLOGLINKS];
+    Clock::time_point Started[BACKLOGLINKS];
+    bool Written[BACKLOGLINKS];
+    size_t Taken = 0;
+    for (int i = 0; i < BACKLOGLINKS; ++i) {
+        From[i] = Taken;
+        Count[i] = 0;
+        Written[i] = false;
+        size_t Size = Overhead;
+        while (Taken < Backlog.size() && Count[i] < BACKUPBATCHMAX) {
+            size_t Reading = readingSize(Backlog[Taken]);
+            if (Count[i] > 0 && Size + Reading > REQUESTMAX) {
+                break;
+            }
+            Size += Reading;
+            ++Count[i];
+            ++Taken;
+        }
+        if (Count[i] == 0) {
+            continue;
+        }
+        Started[i] = Clock::now();
+        Written[i] = writeRequest(BACKLOGLINK + i, &Backlog[From[i]], Count[i],
+                                  true);
+        if (!Written[i]) {
+            record(false, 0, Count[i]);
+        }
+    }
+
+    // only the batches that the server answered are taken out
+    vector<bool> Sent(Backlog.size(), false);
+    bool Any = false;
+    for (int i = 0; i < BACKLOGLINKS; ++i) {
+        if (!Written[i]) {
+            continue;
+        }
+        bool Answered = awaitResponse(BACKLOGLINK + i);
+        record(Answered, msSince(Started[i]), Count[i]);
+        if (Answered) {
+            std::fill(Sent.begin() + From[i],
+                      Sent.begin() + From[i] + Count[i], true);
+            Fleet.Stats.Pending -= Count[i];
+            Any = true;
+        }
+    }
+    size_t Kept = 0;
+    for (size_t i = 0; i < Backlog.size(); ++i) {
+        if (!Sent[i]) {
+            Backlog[Kept++] = Backlog[i];
+        }
+    }
+    Backlog.resize(Kept);
+    return Any;
+}
+
+void Board::run()
+{
+    beginCommand();
+    Parser.send("AT+CIPMUX=1");
+    Parser.recv("OK");
+
+    // the access point went at Fleet.Start, ReconnectScheduler tries it
+    // again while the readings are backed up
+    uint32_t DelayMs = RECONNECTFIRSTMS;
+    Clock::time_point NextReading = Fleet.Start;
+    Clock::time_point NextAttempt = Fleet.Start + boardTime(jittered(DelayMs));
+    while (true) {
+        if (Clock::now() >= Fleet.Deadline) {
+            return;
+        }
+        if (Clock::now() >= NextReading) {
+            backUp(sample());
+            NextReading += boardTime(IntervalMs);
+        }
+        if (Clock::now() >= NextAttempt) {
+            if (join()) {
+                break;
+            }
+            DelayMs = DelayMs < RECONNECTMAXMS / 2 ? DelayMs * 2
+                      : RECONNECTMAXMS;
+            NextAttempt = Clock::now() + boardTime(jittered(DelayMs));
+        }
+        std::this_thread::sleep_until(std::min(NextReading, NextAttempt));
+    }
+
+    // the live reading first, then the backlog until the next one is due
+    Clock::time_point Back = Fleet.Start + boardTime(Fleet.Outage * 1000);
+    while (Clock::now() < Fleet.Deadline) {
+        SampleFrame Frame = sample();
+        if (!sendLive(Frame)) {
+            backUp(Frame);
+        }
+        NextReading += boardTime(IntervalMs);
+        while (!Backlog.empty() && Clock::now() < NextReading &&
+                Clock::now() < Fleet.Deadline) {
+            if (!drainBacklog()) {
+                break;
+            }
+        }
+        if (Backlog.empty()) {
+            std::lock_guard<std::mutex> Guard(Fleet.Stats.Lock);
+            Fleet.Stats.Drained.push_back(msSince(Back));
+            break;
+        }
+        std::this_thread::sleep_until(NextReading);
+    }
+    for (int i = 0; i < SERVERLINKS; ++i) {
+        if (Links[i].Open) {
+            closeLink(i);
+        }
+    }
+}
+
+// prints what the fleet sent so far, and the latencies since the last
+// report
+static void report(FleetConfig &Fleet)
+{
+    FleetStats &Stats = Fleet.Stats;
+    std::lock_guard<std::mutex> Guard(Stats.Lock);
+    vector<uint32_t> &Latencies = Stats.Latencies;
+    std::sort(Latencies.begin(), Latencies.end());
+    printf("%7.1f s %6u requests %8llu readings %5u failed %5u connects",
+           msSince(Fleet.Start) / 1000.0, (unsigned)Stats.Requests,
+           (unsigned long long)Stats.Readings, (unsigned)Stats.Failures,
+           (unsigned)Stats.Connects);
+    if (!Latencies.empty()) {
+        printf(" latency p50 %u p99 %u max %u ms",
+               (unsigned)Latencies[Latencies.size() / 2],
+               (unsigned)Latencies[Latencies.size() * 99 / 100],
+               (unsigned)Latencies.back());
+    }
+    printf(", %lld readings backed up\n", (long long)Stats.Pending.load());
+    Latencies.clear();
+}
+
+// runs Fleet.Boards boards against the server in Fleet until every one of
+// them drained its backlog or FLEETLIMITMS passed
+static void runFleet(FleetConfig &Fleet)
+{
+    Fleet.AccessPoint = false;
+    Fleet.Start = Clock::now();
+    Clock::time_point Back = Fleet.Start + boardTime(Fleet.Outage * 1000);
+    Fleet.Deadline = Back + std::chrono::milliseconds(FLEETLIMITMS);
+
+    vector<Board *> Boards;
+    for (int i = 0; i < Fleet.Boards; ++i) {
+        Boards.push_back(new Board(Fleet, i));
+    }
+    printf("%d boards, the access point is gone for %d s\n", Fleet.Boards,
+           Fleet.Outage);
+    vector<std::thread> Threads;
+    for (size_t i = 0; i < Boards.size(); ++i) {
+        Threads.push_back(std::thread(&Board::run, Boards[i]));
+    }
+
+    std::this_thread::sleep_until(Back);
+    Fleet.AccessPoint = true;
+    Clock::time_point NextReport = Clock::now();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> Guard(Fleet.Stats.Lock);
+            if (Fleet.Stats.Drained.size() == Boards.size() ||
+                    Clock::now() >= Fleet.Deadline) {
+                break;
+            }
+        }
+        if (Clock::now() >= NextReport) {
+            report(Fleet);
+            NextReport += std::chrono::milliseconds(FLEETREPORTMS);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (size_t i = 0; i < Threads.size(); ++i) {
+        Threads[i].join();
+        delete Boards[i];
+    }
+    report(Fleet);
+
+    vector<uint32_t> &Drained = Fleet.Stats.Drained;
+    std::sort(Drained.begin(), Drained.end());
+    if (Drained.empty()) {
+        printf("No board drained its backlog\n");
+    } else {
+        printf("%u of %d boards drained their backlog, half after %.1f s, "
+               "the last after %.1f s\n",
+               (unsigned)Drained.size(), Fleet.Boards,
+               Drained[Drained.size() / 2] / 1000.0, Drained.back() / 1000.0);
+    }
+}
+
+TEST(Fleet, drains_after_outage)
+{
+    std::unique_ptr<LoopbackServer> Server;
+    FleetConfig Fleet;
+    Fleet.Boards = environmentNumber("FLEET_BOARDS", FLEETBOARDS);
+    Fleet.Outage = environmentNumber("FLEET_OUTAGE", FLEETOUTAGE);
+    Fleet.Dir = "/";
+    const char *Target = getenv("FLEET_SERVER");
+    if (Target != NULL && *Target != 0) {
+        string Text = Target;
+        size_t Colon = Text.find(':');
+        size_t Slash = Text.find('/');
+        Fleet.Host = Text.substr(0, std::min(Colon, Slash));
+        Fleet.Port = Colon < Slash ? atoi(Text.c_str() + Colon + 1) : 80;
+        if (Slash != string::npos) {
+            Fleet.Dir = Text.substr(Slash);
+        }
+    } else {
+        Server.reset(new LoopbackServer(FLEETINTERVAL));
+        ASSERT_TRUE(Server->start());
+        Fleet.Host = "127.0.0.1";
+        Fleet.Port = Server->port();
+    }
+
+    runFleet(Fleet);
+    EXPECT_EQ((size_t)Fleet.Boards, Fleet.Stats.Drained.size());
+    EXPECT_EQ(0, Fleet.Stats.Pending.load());
+    if (Server) {
+        Server->stop();
+        printf("The loopback server took %u requests on %u links\n",
+               (unsigned)Server->requests(), (unsigned)Server->links());
+        // every reading that a board took out of its backlog is there
+        EXPECT_EQ(0u, Fleet.Stats.Failures);
+        EXPECT_EQ(Fleet.Stats.Readings * FLEETPORTS, Server->pairs());
+        EXPECT_EQ(Fleet.Stats.Requests, Server->requests());
+    }
+}
@@ -0,0 +1,28 @@
+
+####################
+# UNIT TESTS
+####################
+
+# the application's own code, next to mbed-os. The real ATCmdParser.h goes
+# in front of the stub in target_h
+set(unittest-includes
+  ${PROJECT_SOURCE_DIR}/../platform
+  ${unittest-includes}
+  ../../BoardConfig
+  ../../Networking
+)
+
+set(unittest-sources
+  ../../Networking/HttpResponse.cpp
+  ../../Networking/NumberFormat.cpp
+  ../../Networking/RequestWriter.cpp
+  ../platform/source/ATCmdParser.cpp
+)
+
+set(unittest-test-sources
+  app/Networking/fleet/FleetSockets.cpp
+  app/Networking/fleet/test_fleet.cpp
+  stubs/FileHandle_stub.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_thread_stub.cpp
+)
@@ -0,0 +1,154 @@
+/// \file
+/// \brief Host tests of the power quality analysis on synthetic waveforms,
+/// with mbed-os's own CMSIS-DSP kernels
+///
+/// The scan frames are made up of tones at the scan rate of the board, on
+/// the raw 16 bit scale of the ADC around the middle of its range. A tone
+/// that is not on a bin of the FFT, like 50.3 Hz, checks how the
+/// fundamental is found between the bins, and harmonics of a known size
+/// check the THD.
+#include "gtest/gtest.h"
+#include "PowerQuality.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using std::vector;
+
+/// Scan frames a second, as the sampling profile runs the K64F
+#define PQTESTRATE (2000.0f)
+
+/// The amplitude of the fundamental, in raw counts
+#define PQTESTAMPLITUDE (20000.0)
+
+/// How many raw counts are one unit of the port
+#define PQTESTMULTIPLIER (100.0f)
+
+// the CMSIS-DSP sources do this in arm_bitreversal2.S, in Arm assembly.
+// Every pair of the table swaps the two complex values at those offsets,
+// which are 8 times the index of each
+extern "C" void arm_bitreversal_32(uint32_t *pSrc, const uint16_t bitRevLen,
+                                   const uint16_t *pBitRevTab)
+{
+    for (uint16_t i = 0; i < bitRevLen; i += 2) {
+        uint32_t *A = pSrc + pBitRevTab[i] / 4;
+        uint32_t *B = pSrc + pBitRevTab[i + 1] / 4;
+        uint32_t Real = A[0], Imaginary = A[1];
+        A[0] = B[0];
+        A[1] = B[1];
+        B[0] = Real;
+        B[1] = Imaginary;
+    }
+}
+
+class TestPowerQuality : public testing::Test {
+protected:
+    void SetUp()
+    {
+        // a DC port first, only the AC ports are analyzed
+        Ports.resize(4);
+        for (size_t i = 0; i < Ports.size(); ++i) {
+            Ports[i].AC = i > 0;
+            Ports[i].Multiplier = PQTESTMULTIPLIER;
+        }
+        powerQuality().configure(Ports, PQTESTRATE);
+    }
+
+    // a block of frames where ports 1 and 2 carry a tone of Hz with a
+    // harmonic of Harmonic times the amplitude, and the metrics of it
+    size_t analyze(double Hz, int Order, double Harmonic,
+                   PowerStats (&Stats)[PQMAXPORTS],
+                   double Amplitude = PQTESTAMPLITUDE)
+    {
+        for (size_t n = 0; n < PQFFTSIZE; ++n) {
+            double Phase = 2.0 * M_PI * Hz * n / PQTESTRATE;
+            double Value = Amplitude * (sin(Phase) +
+                                        Harmonic * sin(Order * Phase + 0.3));
+            uint16_t Frame[4];
+            Frame[0] = 1000;
+            Frame[1] = (uint16_t)lround(32768.0 + Value);
+            Frame[2] = (uint16_t)lround(32768.0 + Value / 2);
+            Frame[3] = 0;
+            powerQuality().push(Frame, 4);
+        }
+        powerQuality().update();
+        return powerQuality().latest(Stats);
+    }
+
+    vector<PortInfo> Ports;
+};
+
+TEST_F(TestPowerQuality, nothing_before_a_block)
+{
+    PowerStats Stats[PQMAXPORTS];
+    EXPECT_EQ(0u, powerQuality().latest(Stats));
+
+    // update() only analyzes complete blocks
+    uint16_t Frame[4] = {0, 32768, 32768, 0};
+    for (size_t n = 0; n + 1 < PQFFTSIZE; ++n) {
+        powerQuality().push(Frame, 4);
+    }
+    powerQuality().update();
+    EXPECT_EQ(0u, powerQuality().latest(Stats));
+}
+
+TEST_F(TestPowerQuality, pure_tone)
+{
+    const double Tones[] = {50.0, 50.3, 60.0, 59.7};
+    for (size_t t = 0; t < sizeof(Tones) / sizeof(Tones[0]); ++t) {
+        PowerStats Stats[PQMAXPORTS];
+        ASSERT_EQ((size_t)PQMAXPORTS, analyze(Tones[t], 3, 0.0, Stats));
+
+        // the first AC ports, in order
+        EXPECT_EQ(1, Stats[0].Port);
+        EXPECT_EQ(2, Stats[1].Port);
+        for (size_t i = 0; i < PQMAXPORTS; ++i) {
+            double Rms = PQTESTAMPLITUDE / (i + 1) / sqrt(2.0) / 0xFFFF *
+                         PQTESTMULTIPLIER;
+            EXPECT_NEAR(Tones[t], Stats[i].Fundamental, 0.01) << Tones[t];
+            EXPECT_NEAR(0.0, Stats[i].THD, 0.05) << Tones[t];
+            // the block is not a whole number of cycles
+            EXPECT_NEAR(Rms, Stats[i].RMS, Rms * 0.01) << Tones[t];
+            EXPECT_NEAR(sqrt(2.0), Stats[i].Crest, 0.02) << Tones[t];
+        }
+    }
+}
+
+TEST_F(TestPowerQuality, harmonic_distortion)
+{
+    // the low-pass takes a little off the higher harmonics
+    const int Orders[] = {3, 5, 7};
+    const double Sizes[] = {0.05, 0.20};
+    for (size_t o = 0; o < sizeof(Orders) / sizeof(Orders[0]); ++o) {
+        for (size_t s = 0; s < sizeof(Sizes) / sizeof(Sizes[0]); ++s) {
+            PowerStats Stats[PQMAXPORTS];
+            ASSERT_EQ((size_t)PQMAXPORTS,
+                      analyze(50.3, Orders[o], Sizes[s], Stats));
+            printf("harmonic %d of %.0f %%: %.3f Hz, THD %.3f %%\n",
+                   Orders[o], 100.0 * Sizes[s], Stats[0].Fundamental,
+                   Stats[0].THD);
+            for (size_t i = 0; i < PQMAXPORTS; ++i) {
+                EXPECT_NEAR(50.3, Stats[i].Fundamental, 0.01);
+                EXPECT_NEAR(100.0 * Sizes[s], Stats[i].THD, 0.05)
+                        << "harmonic " << Orders[o];
+            }
+        }
+    }
+}
+
+TEST_F(TestPowerQuality, quiet_port)
+{
+    // a few counts of noise have no fundamental
+    PowerStats Stats[PQMAXPORTS];
+    ASSERT_EQ((size_t)PQMAXPORTS, analyze(60.0, 3, 0.0, Stats, 8.0));
+    EXPECT_EQ(0.0f, Stats[0].Fundamental);
+    EXPECT_EQ(0.0f, Stats[0].THD);
+
+    // the values go out in this order
+    float Values[PQVALUES];
+    powerValues(Stats[0], Values);
+    EXPECT_EQ(1.0f, Values[0]);
+    EXPECT_EQ(Stats[0].RMS, Values[1]);
+    EXPECT_EQ(0.0f, Values[2]);
+}
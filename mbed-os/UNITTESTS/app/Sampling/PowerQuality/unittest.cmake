@@ -0,0 +1,50 @@
+####################
+# UNIT TESTS
+####################
+
+# Sampling/PowerQuality.cpp with the CMSIS-DSP sources of mbed-os, built
+# with their portable C paths. The real arm_math.h goes in front of the
+# stub in target_h
+set(unittest-includes
+  ${PROJECT_SOURCE_DIR}/../cmsis/TARGET_CORTEX_M
+  ${unittest-includes}
+  ../features/unsupported/dsp/cmsis_dsp
+  ../../BoardConfig
+  ../../Sampling
+)
+
+set(unittest-sources
+  ../../Sampling/PowerQuality.cpp
+  ../features/unsupported/dsp/cmsis_dsp/CommonTables/arm_common_tables.c
+  ../features/unsupported/dsp/cmsis_dsp/CommonTables/arm_const_structs.c
+  ../features/unsupported/dsp/cmsis_dsp/ComplexMathFunctions/arm_cmplx_mag_squared_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/FastMathFunctions/arm_sqrt_q15.c
+  ../features/unsupported/dsp/cmsis_dsp/FilteringFunctions/arm_biquad_cascade_df1_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/FilteringFunctions/arm_biquad_cascade_df1_init_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/StatisticsFunctions/arm_rms_q15.c
+  ../features/unsupported/dsp/cmsis_dsp/SupportFunctions/arm_q15_to_float.c
+  ../features/unsupported/dsp/cmsis_dsp/TransformFunctions/arm_cfft_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/TransformFunctions/arm_cfft_radix8_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/TransformFunctions/arm_rfft_fast_f32.c
+  ../features/unsupported/dsp/cmsis_dsp/TransformFunctions/arm_rfft_fast_init_f32.c
+)
+
+set(unittest-test-sources
+  app/Sampling/PowerQuality/test_PowerQuality.cpp
+  stubs/mbed_critical_stub.c
+)
+
+# the K64F is a Cortex-M4, the M0 paths of CMSIS-DSP are the ones in plain C
+foreach(flag
+    -DARM_MATH_CM0
+    -DMBED_CONF_APP_POWER_QUALITY=1)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${flag}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${flag}")
+endforeach()
+
+# arm_math.h casts pointers to int32_t in its circular buffer helpers, which
+# C++ only takes as an error on a 64 bit host. Nothing here calls them
+set_source_files_properties(
+  ../../Sampling/PowerQuality.cpp
+  app/Sampling/PowerQuality/test_PowerQuality.cpp
+  PROPERTIES COMPILE_OPTIONS -fpermissive)
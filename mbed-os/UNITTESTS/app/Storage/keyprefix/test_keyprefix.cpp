@@ -0,0 +1,249 @@
+/// \file
+/// \brief Host tests of the key prefixes that TDBStore keeps in its RAM
+/// table, with the 12 bytes of "tdbstore.key_prefix_size" in mbed_app.json.
+///
+/// The flash queue's "q%08lx" keys and "config" fit in the prefix, so get()
+/// and an iteration find them without reading the key from the BD. Longer
+/// keys, such as "sample_" and a counter, share their first 12 bytes and
+/// still have to be read. A ProfilingBlockDevice under the store counts the
+/// bytes it reads.
+#include "gtest/gtest.h"
+#include "FlashSimBlockDevice.h"
+#include "HeapBlockDevice.h"
+#include "ProfilingBlockDevice.h"
+#include "SystemStorage.h"
+#include "TDBStore.h"
+#include "mbed_error.h"
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+
+using mbed::KVStore;
+using mbed::TDBStore;
+using std::set;
+using std::string;
+
+/// Bytes of the RAM table's prefix of every key, as in mbed_app.json
+#define PREFIXSIZE (12)
+
+/// Flash queue keys in the store
+#define PREFIXQUEUEKEYS (64)
+
+/// Keys longer than the prefix in the store
+#define PREFIXLONGKEYS (8)
+
+/// Bytes of every value
+#define PREFIXVALUESIZE (16)
+
+/// The store, two areas of 4 sectors of the K64F's internal flash
+#define PREFIXSECTOR (4096)
+#define PREFIXSECTORS (8)
+
+// the block devices count how often they were initialized with these, the
+// stubs of them always return 0 and the devices would never start
+extern "C" uint32_t core_util_atomic_incr_u32(volatile uint32_t *valuePtr,
+                                              uint32_t delta)
+{
+    return *valuePtr += delta;
+}
+
+extern "C" uint32_t core_util_atomic_decr_u32(volatile uint32_t *valuePtr,
+                                              uint32_t delta)
+{
+    return *valuePtr -= delta;
+}
+
+// SystemStorage.cpp shares the internal flash between NVStore and TDBStore,
+// the store here is on a FlashSimBlockDevice and never asks it
+int avoid_conflict_nvstore_tdbstore(owner_type_e in_mem_owner)
+{
+    return MBED_SUCCESS;
+}
+
+/// The store on a simulated internal flash, with a count of the bytes read
+class TestKeyPrefix : public testing::Test {
+protected:
+    TestKeyPrefix()
+        : Heap(PREFIXSECTOR * PREFIXSECTORS, 1, 1, PREFIXSECTOR), Flash(&Heap),
+          Profiled(&Flash), Store(&Profiled)
+    {
+    }
+
+    void SetUp()
+    {
+        ASSERT_EQ(MBED_SUCCESS, Store.init());
+        ASSERT_EQ(MBED_SUCCESS, Store.reset());
+    }
+
+    void TearDown()
+    {
+        Store.deinit();
+    }
+
+    static string queueKey(unsigned Index)
+    {
+        char Key[16];
+        snprintf(Key, sizeof(Key), "q%08x", Index);
+        return Key;
+    }
+
+    static string longKey(unsigned Index)
+    {
+        char Key[32];
+        snprintf(Key, sizeof(Key), "sample_%012u", Index);
+        return Key;
+    }
+
+    // the value of Key, each byte is the length of Key and Index
+    static void value(const string &Key, unsigned Index, uint8_t *Value)
+    {
+        memset(Value, (uint8_t)(Key.size() + Index), PREFIXVALUESIZE);
+    }
+
+    void setKey(const string &Key, unsigned Index)
+    {
+        uint8_t Value[PREFIXVALUESIZE];
+        value(Key, Index, Value);
+        ASSERT_EQ(MBED_SUCCESS, Store.set(Key.c_str(), Value, sizeof(Value), 0));
+    }
+
+    void expectKey(const string &Key, unsigned Index)
+    {
+        uint8_t Expected[PREFIXVALUESIZE], Value[PREFIXVALUESIZE];
+        size_t Size = 0;
+        value(Key, Index, Expected);
+        ASSERT_EQ(MBED_SUCCESS, Store.get(Key.c_str(), Value, sizeof(Value), &Size)) << Key;
+        EXPECT_EQ(sizeof(Value), Size);
+        EXPECT_EQ(0, memcmp(Expected, Value, sizeof(Value))) << Key;
+    }
+
+    void fill()
+    {
+        setKey("config", 0);
+        for (unsigned i = 0; i < PREFIXQUEUEKEYS; ++i) {
+            setKey(queueKey(i), i);
+        }
+        for (unsigned i = 0; i < PREFIXLONGKEYS; ++i) {
+            setKey(longKey(i), i);
+        }
+    }
+
+    // the keys that start with Prefix, in any order
+    set<string> keys(const char *Prefix)
+    {
+        set<string> Found;
+        KVStore::iterator_t It;
+        EXPECT_EQ(MBED_SUCCESS, Store.iterator_open(&It, Prefix));
+        char Key[KVStore::MAX_KEY_SIZE];
+        while (Store.iterator_next(It, Key, sizeof(Key)) == MBED_SUCCESS) {
+            EXPECT_TRUE(Found.insert(Key).second) << Key;
+        }
+        Store.iterator_close(It);
+        return Found;
+    }
+
+    // the bytes read from the flash since the last call
+    bd_size_t reads()
+    {
+        bd_size_t Count = Profiled.get_read_count() - LastReads;
+        LastReads = Profiled.get_read_count();
+        return Count;
+    }
+
+    HeapBlockDevice Heap;
+    FlashSimBlockDevice Flash;
+    ProfilingBlockDevice Profiled;
+    TDBStore Store;
+    bd_size_t LastReads = 0;
+};
+
+TEST_F(TestKeyPrefix, keys_are_found)
+{
+    // with the '\0', the queue keys are cached whole and the long ones are not
+    ASSERT_LT(queueKey(0).size(), (size_t)PREFIXSIZE);
+    ASSERT_GT(longKey(0).size(), (size_t)PREFIXSIZE);
+
+    fill();
+    expectKey("config", 0);
+    for (unsigned i = 0; i < PREFIXQUEUEKEYS; ++i) {
+        expectKey(queueKey(i), i);
+    }
+    for (unsigned i = 0; i < PREFIXLONGKEYS; ++i) {
+        expectKey(longKey(i), i);
+    }
+
+    // keys that share the prefix of one in the store, or are a prefix of it
+    uint8_t Value[PREFIXVALUESIZE];
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get("sample_0000000", Value, sizeof(Value)));
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get("sample_000000000099", Value, sizeof(Value)));
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get("q0000000", Value, sizeof(Value)));
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get("configs", Value, sizeof(Value)));
+}
+
+TEST_F(TestKeyPrefix, prefixes_follow_changes)
+{
+    fill();
+    ASSERT_EQ(MBED_SUCCESS, Store.remove(queueKey(3).c_str()));
+    ASSERT_EQ(MBED_SUCCESS, Store.remove(longKey(3).c_str()));
+    setKey(queueKey(4), 100);
+    setKey(longKey(4), 100);
+
+    // the RAM table is built again from the BD
+    ASSERT_EQ(MBED_SUCCESS, Store.deinit());
+    ASSERT_EQ(MBED_SUCCESS, Store.init());
+
+    uint8_t Value[PREFIXVALUESIZE];
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get(queueKey(3).c_str(), Value, sizeof(Value)));
+    EXPECT_EQ(MBED_ERROR_ITEM_NOT_FOUND, Store.get(longKey(3).c_str(), Value, sizeof(Value)));
+    expectKey(queueKey(4), 100);
+    expectKey(longKey(4), 100);
+    expectKey(queueKey(5), 5);
+    expectKey(longKey(5), 5);
+    EXPECT_EQ((size_t)PREFIXQUEUEKEYS - 1, keys("q").size());
+    EXPECT_EQ((size_t)PREFIXLONGKEYS - 1, keys("sample_").size());
+}
+
+TEST_F(TestKeyPrefix, get_reads_the_record_once)
+{
+    fill();
+    uint8_t Value[PREFIXVALUESIZE];
+    reads();
+    ASSERT_EQ(MBED_SUCCESS, Store.get(queueKey(7).c_str(), Value, sizeof(Value)));
+    bd_size_t Cached = reads();
+    ASSERT_EQ(MBED_SUCCESS, Store.get(longKey(7).c_str(), Value, sizeof(Value)));
+    bd_size_t Read = reads();
+
+    // the cached key is matched in RAM and its record read once, the long
+    // key is matched against the record on the BD and then read again
+    size_t ExtraKey = longKey(7).size() - queueKey(7).size();
+    EXPECT_GT(Cached, 0u);
+    EXPECT_EQ(2 * (Cached + ExtraKey), Read);
+    printf("get() read %lu bytes of a cached key and %lu of a longer one\n",
+           (unsigned long)Cached, (unsigned long)Read);
+}
+
+TEST_F(TestKeyPrefix, iteration_skips_other_keys)
+{
+    fill();
+    reads();
+    set<string> Queue = keys("q");
+    EXPECT_EQ(0u, reads());
+    EXPECT_EQ((size_t)PREFIXQUEUEKEYS, Queue.size());
+    EXPECT_EQ(1u, Queue.count(queueKey(PREFIXQUEUEKEYS - 1)));
+    EXPECT_EQ(1u, keys("config").size());
+    EXPECT_EQ(0u, keys("x").size());
+    EXPECT_EQ(0u, reads());
+
+    // only the long keys are read, the queue keys are skipped in RAM
+    set<string> Samples = keys("sample_");
+    bd_size_t SampleReads = reads();
+    EXPECT_EQ((size_t)PREFIXLONGKEYS, Samples.size());
+    EXPECT_EQ(1u, Samples.count(longKey(PREFIXLONGKEYS - 1)));
+    EXPECT_GT(SampleReads, 0u);
+
+    // and every key, which reads the same long keys
+    EXPECT_EQ((size_t)1 + PREFIXQUEUEKEYS + PREFIXLONGKEYS, keys(NULL).size());
+    EXPECT_EQ(SampleReads, reads());
+}
@@ -0,0 +1,42 @@
+####################
+# UNIT TESTS
+####################
+
+# mbed-os's TDBStore on a FlashSimBlockDevice, with the key prefix of
+# mbed_app.json
+set(unittest-includes
+  ${unittest-includes}
+  ../features/storage/blockdevice
+  ../features/storage/kvstore/include
+  ../features/storage/kvstore/tdbstore
+  ../features/storage/kvstore/conf
+  ../features/storage/system_storage
+  ../features/storage
+)
+
+set(unittest-sources
+  ../drivers/source/MbedCRC.cpp
+  ../drivers/source/TableCRC.cpp
+  ../features/storage/blockdevice/BufferedBlockDevice.cpp
+  ../features/storage/blockdevice/FlashSimBlockDevice.cpp
+  ../features/storage/blockdevice/HeapBlockDevice.cpp
+  ../features/storage/blockdevice/ProfilingBlockDevice.cpp
+  ../features/storage/kvstore/tdbstore/TDBStore.cpp
+)
+
+set(unittest-test-sources
+  app/Storage/keyprefix/test_keyprefix.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_critical_stub.c
+  stubs/mbed_error.c
+  stubs/mbed_wait_api_stub.cpp
+  stubs/Mutex_stub.cpp
+)
+
+foreach(flag
+    -DMBED_CONF_TDBSTORE_INITIAL_MAX_KEYS=520
+    -DMBED_CONF_TDBSTORE_GC_STEP_RECORDS=8
+    -DMBED_CONF_TDBSTORE_KEY_PREFIX_SIZE=12)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${flag}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${flag}")
+endforeach()
@@ -0,0 +1,1044 @@
+/// \file
+/// \brief Host replay of months of readings and outages through the backup
+/// log and the flash queue, on each store that "backup-store" and
+/// "flash-queue" can pick.
+///
+/// This is Storage/simulate_wear.py with mbed-os's own FATFileSystem,
+/// LittleFileSystem and TDBStore in place of its models of them. The log
+/// makes the same writes as OfflineLogging.cpp: a segment file per
+/// LOGSEGMENTRECORDS readings, set aside in one piece on FAT, a staged block
+/// appended and synced once it is full or LOGFLUSHMS old, an entry of
+/// index.jnl for every segment that changed, and index.dat once the journal
+/// is full or a segment is added or removed. The flash queue is a key per
+/// reading, as in FlashQueue.cpp.
+///
+/// Every store is a HeapBlockDevice. The internal flash is a
+/// FlashSimBlockDevice on top of it, so a program needs an erase first,
+/// under an ExhaustibleBlockDevice that counts the erases of every sector
+/// and wears it out after FLASHENDURANCE of them. A LatencyBlockDevice
+/// adds up how long each read, program and erase would take on the board,
+/// from the same data sheet numbers as simulate_wear.py, and a
+/// ProfilingBlockDevice counts the bytes.
+///
+/// Each test prints the bytes of readings logged and written and their
+/// ratio, the write amplification, the erases of every block as a
+/// histogram, how long the flash lasts at that rate, and the p50, p99 and
+/// max of the time a flush, an ack and a new segment take. WEAR_DAYS in the
+/// environment replays that many days instead of WEARDAYS.
+#include "gtest/gtest.h"
+#include "BackupStore.h"
+#include "ExhaustibleBlockDevice.h"
+#include "FATFileSystem.h"
+#include "File.h"
+#include "FlashQueue.h"
+#include "FlashSimBlockDevice.h"
+#include "FrameCodec.h"
+#include "HeapBlockDevice.h"
+#include "LittleFileSystem.h"
+#include "MbedCRC.h"
+#include "NumberFormat.h"
+#include "ProfilingBlockDevice.h"
+#include "TDBStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using std::vector;
+
+/// The days that are replayed, unless WEAR_DAYS says otherwise
+#define WEARDAYS (180)
+
+/// Seconds between two readings
+#define WEARINTERVAL (5)
+
+/// Outages in a month, on average
+#define WEAROUTAGES (4)
+
+/// The mean length of an outage in hours
+#define WEAROUTAGEHOURS (6)
+
+/// Readings of the backlog sent every second once the site is back
+#define WEARDRAINRATE (16)
+
+/// Seeds the readings and the outages, the SD card's latencies get the next
+/// seed
+#define WEARSEED (1)
+
+/// The most a reading moves from the one before, in ADC counts
+#define WEARSTEP (24)
+
+// keep in step with OfflineLogging.h, which needs the board's Networking.h
+// and can not be built on the host, Networking.h and simulate_wear.py
+#define LOGMAGIC (0x4C434149)
+#define LOGSTAGESIZE (512)
+#define LOGFLUSHMS (60000)
+#define LOGSEGMENTRECORDS (256)
+#define LOGSEGMENTEXTENT (16384)
+#define LOGMAXSEGMENTS (64)
+#define LOGJOURNALSIZE (512)
+#define LOGJOURNALBASE (0xFFFFFFFFUL)
+#define LOGCOMPACTFILL (90)
+#define LOGHEADERSIZE (4 + 2 + 2 + 2 + 2 + FRAMEMAXPORTS * (16 + 4) + 4)
+#define BACKUPBATCHMAX (32)
+
+/// The flashiap-block-device region in mbed_app.json
+#define FLASHREGION (0x40000)
+
+// the K64F's flash, from its data sheet
+#define FLASHSECTOR (4096)
+#define FLASHPHRASE (8)
+#define FLASHPROGRAMUS (65)
+#define FLASHERASEUS (14000)
+#define FLASHENDURANCE (10000)
+
+// an SD card sector over SPI at 25 MHz, then the card is busy. Now and then
+// it moves its own blocks around and is busy for much longer
+#define SDSECTOR (512)
+#define SDTRANSFERUS (200)
+#define SDBUSYUS (800)
+#define SDSTALLCHANCE (0.005)
+#define SDSTALLMINUS (20000)
+#define SDSTALLMAXUS (250000)
+
+/// The SD card that the FAT and the backup partition are on, the segments
+/// fill a small part of it
+#define SDCARDSIZE (8 * 1024 * 1024)
+
+/// The backup partition, BACKUPPARTITION
+#define SDPARTITIONSIZE (4 * 1024 * 1024)
+
+/// One segment file of a backup log, as in OfflineLogging.h
+struct LogSegment {
+    uint32_t Number;
+    uint32_t FirstTime;
+    uint32_t LastTime;
+    uint32_t Records;
+    uint32_t Acked;
+};
+
+/// The index.dat of a backup log directory, as in OfflineLogging.h
+struct LogIndex {
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t Count;
+    uint32_t NextNumber;
+    LogSegment Segments[LOGMAXSEGMENTS];
+    uint32_t CRC;
+};
+
+/// One entry of index.jnl, as in OfflineLogging.h
+struct LogJournalEntry {
+    LogSegment Segment;
+    uint32_t CRC;
+};
+
+#define LOGJOURNALENTRIES (LOGJOURNALSIZE / sizeof(LogJournalEntry))
+
+/// The start of a block of packed records, as in OfflineLogging.h
+struct LogBlock {
+    uint32_t CRC;
+    uint16_t Count;
+    uint16_t Size;
+};
+
+// the block devices count how often they were initialized with these, the
+// stubs of them always return 0 and the devices would never start. The
+// tests have one thread
+extern "C" uint32_t core_util_atomic_incr_u32(volatile uint32_t *valuePtr,
+                                              uint32_t delta)
+{
+    return *valuePtr += delta;
+}
+
+extern "C" uint32_t core_util_atomic_decr_u32(volatile uint32_t *valuePtr,
+                                              uint32_t delta)
+{
+    return *valuePtr -= delta;
+}
+
+namespace mbed {
+// FileBase.cpp tells the retarget layer that a file is closed, there is none
+// on the host
+void remove_filehandle(FileHandle *file)
+{
+}
+}
+
+static uint32_t logCRC(const void *Data, size_t Size)
+{
+    MbedCRC<POLY_32BIT_ANSI, 32> ct;
+    uint32_t crc = 0;
+    ct.compute(Data, Size, &crc);
+    return crc;
+}
+
+/// Adds up how long the reads, programs and erases of the block device under
+/// it would take on the board, and counts how often every sector of an SD
+/// card is programmed. The card moves its sectors around for itself, so
+/// that count is the wear the firmware asks for
+class LatencyBlockDevice : public BlockDevice {
+public:
+    LatencyBlockDevice(BlockDevice *Under, bool Card, uint32_t Seed)
+        : Us(0), Under(Under), Card(Card), Rng(Seed)
+    {
+    }
+
+    virtual int init()
+    {
+        int err = Under->init();
+        if (err == 0 && Writes.empty() && Card) {
+            Writes.assign(Under->size() / SDSECTOR, 0);
+        }
+        return err;
+    }
+
+    virtual int deinit()
+    {
+        return Under->deinit();
+    }
+
+    virtual int sync()
+    {
+        return Under->sync();
+    }
+
+    virtual int read(void *Buffer, bd_addr_t Addr, bd_size_t Size)
+    {
+        if (Card) {
+            Us += (Size + SDSECTOR - 1) / SDSECTOR * SDTRANSFERUS;
+        }
+        return Under->read(Buffer, Addr, Size);
+    }
+
+    virtual int program(const void *Buffer, bd_addr_t Addr, bd_size_t Size)
+    {
+        if (Card) {
+            for (bd_addr_t At = Addr; At < Addr + Size; At += SDSECTOR) {
+                Us += SDTRANSFERUS + busy();
+                ++Writes[At / SDSECTOR];
+            }
+        } else {
+            Us += (Size + FLASHPHRASE - 1) / FLASHPHRASE * FLASHPROGRAMUS;
+        }
+        return Under->program(Buffer, Addr, Size);
+    }
+
+    virtual int erase(bd_addr_t Addr, bd_size_t Size)
+    {
+        if (!Card) {
+            Us += Size / FLASHSECTOR * FLASHERASEUS;
+        }
+        return Under->erase(Addr, Size);
+    }
+
+    virtual int trim(bd_addr_t Addr, bd_size_t Size)
+    {
+        return Under->trim(Addr, Size);
+    }
+
+    virtual bd_size_t get_read_size() const
+    {
+        return Under->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const
+    {
+        return Under->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const
+    {
+        return Under->get_erase_size();
+    }
+
+    virtual bd_size_t get_erase_size(bd_addr_t Addr) const
+    {
+        return Under->get_erase_size(Addr);
+    }
+
+    virtual int get_erase_value() const
+    {
+        return Under->get_erase_value();
+    }
+
+    virtual bd_size_t size() const
+    {
+        return Under->size();
+    }
+
+    virtual const char *get_type() const
+    {
+        return "LATENCY";
+    }
+
+    /// the time the operations so far took, in us
+    uint64_t Us;
+
+    /// how often each sector of a card was programmed
+    vector<uint32_t> Writes;
+
+private:
+    // how long the card is busy after a sector is programmed
+    uint32_t busy()
+    {
+        std::exponential_distribution<double> Busy(1.0 / SDBUSYUS);
+        std::uniform_real_distribution<double> Chance(0.0, 1.0);
+        double Took = Busy(Rng);
+        if (Chance(Rng) < SDSTALLCHANCE) {
+            std::uniform_real_distribution<double> Stall(SDSTALLMINUS,
+                                                         SDSTALLMAXUS);
+            Took += Stall(Rng);
+        }
+        return (uint32_t)Took;
+    }
+
+    BlockDevice *Under;
+    bool Card;
+    std::mt19937 Rng;
+};
+
+/// What a store was asked to write, and how long each write took
+class WearLog {
+public:
+    explicit WearLog(LatencyBlockDevice &Latency)
+        : Logged(0), Dropped(0), Failed(0), Corrupt(0), Latency(Latency)
+    {
+    }
+
+    virtual ~WearLog() {}
+
+    /// Logs Frame, its Timestamp is now
+    virtual void record(const SampleFrame &Frame) = 0;
+
+    /// Returns how many readings wait to be sent
+    virtual size_t pending() const = 0;
+
+    /// Reads the Count oldest readings and marks them as sent
+    virtual void ack(size_t Count) = 0;
+
+    /// the bytes of the readings that were logged
+    uint64_t Logged;
+
+    /// the readings that were dropped to make room, before they were sent
+    size_t Dropped;
+
+    /// the writes that returned an error
+    size_t Failed;
+
+    /// the blocks or readings that did not read back as they were written
+    size_t Corrupt;
+
+    /// the time of every flush, ack and new segment, in us
+    vector<uint32_t> Flushes;
+    vector<uint32_t> Acks;
+    vector<uint32_t> Segments;
+
+protected:
+    LatencyBlockDevice &Latency;
+};
+
+/// Where the blocks of a segment are
+struct SegmentBlocks {
+    /// the offset, bytes and records of every block
+    vector<uint32_t> Offsets;
+    vector<uint16_t> Sizes;
+    vector<uint16_t> Counts;
+
+    /// where the next block goes
+    uint32_t End;
+};
+
+/// The backup log on a filesystem, Fat is set if it is the FAT on the card
+class SegmentLog : public WearLog {
+public:
+    SegmentLog(FileSystem &Fs, FATFileSystem *Fat, LatencyBlockDevice &Latency)
+        : WearLog(Latency), Fs(Fs), Fat(Fat), JournalUsed(0),
+          StageOpen(false), Used(0), Count(0), Oldest(0), Newest(0)
+    {
+        memset(&Index, 0, sizeof(Index));
+        memset(&Written, 0, sizeof(Written));
+    }
+
+    /// Formats Bd and starts an empty log on it
+    int start(BlockDevice *Bd)
+    {
+        int err = Fs.reformat(Bd);
+        if (err == 0) {
+            err = Fs.mkdir("PortReadings", 0777);
+        }
+        Index.NextNumber = 1;
+        writeIndex();
+        return err;
+    }
+
+    /// Closes the open segment and unmounts the store
+    int stop()
+    {
+        closeStage();
+        return Fs.unmount();
+    }
+
+    virtual void record(const SampleFrame &Frame)
+    {
+        if (Index.Count == 0 ||
+                Index.Segments[Index.Count - 1].Records + Count >=
+                LOGSEGMENTRECORDS) {
+            closeStage();
+            uint64_t Before = Latency.Us;
+            createSegment(Frame.Timestamp);
+            Segments.push_back(Latency.Us - Before);
+        }
+        if (Used + FRAMECODEDMAX > LOGSTAGESIZE) {
+            flush();
+        }
+        if (Used == 0) {
+            // every block starts a stream of its own
+            Used = sizeof(LogBlock);
+            Codec.reset();
+            Oldest = Frame.Timestamp;
+        }
+        size_t Size = Codec.encode(Frame, Stage + Used);
+        Used += Size;
+        ++Count;
+        Logged += Size;
+        Newest = Frame.Timestamp;
+        if ((uint64_t)(Frame.Timestamp - Oldest) * 1000 >= LOGFLUSHMS) {
+            flush();
+        }
+    }
+
+    virtual size_t pending() const
+    {
+        size_t Unsent = Count;
+        for (size_t i = 0; i < Index.Count; ++i) {
+            Unsent += Index.Segments[i].Records - Index.Segments[i].Acked;
+        }
+        return Unsent;
+    }
+
+    virtual void ack(size_t Left)
+    {
+        // the staged records go to the segment before they are read
+        flush();
+        uint64_t Before = Latency.Us;
+        for (size_t i = 0; Left > 0 && i < Index.Count; ++i) {
+            LogSegment &Seg = Index.Segments[i];
+            size_t Moved = std::min<size_t>(Left, Seg.Records - Seg.Acked);
+            if (Moved > 0) {
+                readRecords(i, Seg.Acked, Moved);
+                Seg.Acked += Moved;
+                Left -= Moved;
+            }
+        }
+        // a segment that was all sent is removed, unless it is still written
+        while (Index.Count > 1 &&
+                Index.Segments[0].Acked >= Index.Segments[0].Records) {
+            removeOldest();
+        }
+        storeIndex();
+        Acks.push_back(Latency.Us - Before);
+    }
+
+private:
+    void segmentName(uint32_t Number, char *Name, size_t Size)
+    {
+        snprintf(Name, Size, "PortReadings/%06lu.seg", (unsigned long)Number);
+    }
+
+    // starts index.jnl over with the base of the index.dat that was just
+    // written, and zeros after it
+    void startJournal()
+    {
+        LogJournalEntry Journal[LOGJOURNALENTRIES];
+        memset(Journal, 0, sizeof(Journal));
+        Journal[0].Segment.Number = LOGJOURNALBASE;
+        Journal[0].Segment.Records = Index.CRC;
+        Journal[0].CRC = logCRC(&Journal[0].Segment, sizeof(LogSegment));
+
+        File Jnl;
+        JournalUsed = 0;
+        if (Jnl.open(&Fs, "PortReadings/index.jnl", O_RDWR | O_CREAT) != 0) {
+            ++Failed;
+            return;
+        }
+        bool Started = Jnl.write(Journal, sizeof(Journal)) ==
+                       (ssize_t)sizeof(Journal);
+        if (Jnl.close() == 0 && Started) {
+            JournalUsed = 1;
+        } else {
+            ++Failed;
+        }
+    }
+
+    // appends Seg to index.jnl
+    // returns false if it is full or the entry could not be written
+    bool journalSegment(const LogSegment &Seg)
+    {
+        if (JournalUsed == 0 || JournalUsed >= LOGJOURNALENTRIES) {
+            return false;
+        }
+        LogJournalEntry Entry;
+        Entry.Segment = Seg;
+        Entry.CRC = logCRC(&Entry.Segment, sizeof(LogSegment));
+
+        File Jnl;
+        if (Jnl.open(&Fs, "PortReadings/index.jnl", O_RDWR) != 0) {
+            JournalUsed = 0;
+            return false;
+        }
+        bool Appended =
+            Jnl.seek(JournalUsed * sizeof(Entry), SEEK_SET) ==
+            (off_t)(JournalUsed * sizeof(Entry)) &&
+            Jnl.write(&Entry, sizeof(Entry)) == (ssize_t)sizeof(Entry);
+        if (Jnl.close() != 0 || !Appended) {
+            JournalUsed = 0;
+            return false;
+        }
+        ++JournalUsed;
+        return true;
+    }
+
+    // stores Index in index.dat, in place
+    void writeIndex()
+    {
+        Index.Magic = LOGMAGIC;
+        Index.Version = 1;
+        Index.CRC = logCRC(&Index, offsetof(LogIndex, CRC));
+
+        File Dat;
+        if (Dat.open(&Fs, "PortReadings/index.dat", O_RDWR | O_CREAT) != 0) {
+            ++Failed;
+            JournalUsed = 0;
+            return;
+        }
+        bool Stored = Dat.write(&Index, sizeof(Index)) ==
+                      (ssize_t)sizeof(Index);
+        if (Dat.close() != 0 || !Stored) {
+            ++Failed;
+            JournalUsed = 0;
+            return;
+        }
+        Written = Index;
+        startJournal();
+    }
+
+    // stores what changed in Index since it was last stored, in index.jnl
+    // if only the counts and times of a few segments changed
+    void storeIndex()
+    {
+        bool Same = Index.Count == Written.Count &&
+                    Index.NextNumber == Written.NextNumber;
+        size_t Changed = 0;
+        for (size_t i = 0; Same && i < Index.Count; ++i) {
+            Same = Index.Segments[i].Number == Written.Segments[i].Number;
+            Changed += memcmp(&Index.Segments[i], &Written.Segments[i],
+                              sizeof(LogSegment)) != 0;
+        }
+        if (Same && Changed == 0) {
+            return;
+        }
+        if (Same && JournalUsed + Changed <= LOGJOURNALENTRIES) {
+            for (size_t i = 0; Same && i < Index.Count; ++i) {
+                LogSegment &Seg = Written.Segments[i];
+                if (memcmp(&Index.Segments[i], &Seg, sizeof(Seg)) == 0) {
+                    continue;
+                }
+                Same = journalSegment(Index.Segments[i]);
+                if (Same) {
+                    Seg = Index.Segments[i];
+                }
+            }
+            if (Same) {
+                return;
+            }
+        }
+        writeIndex();
+    }
+
+    // true once the store is LOGCOMPACTFILL percent full
+    bool full()
+    {
+        struct statvfs St;
+        if (Fs.statvfs("", &St) != 0 || St.f_blocks == 0) {
+            return false;
+        }
+        return (St.f_blocks - St.f_bfree) * 100 >=
+               St.f_blocks * LOGCOMPACTFILL;
+    }
+
+    // removes the oldest segment, whether it was sent or not. The firmware
+    // replaces its raw readings with summaries, which frees as much
+    void removeOldest()
+    {
+        LogSegment &Seg = Index.Segments[0];
+        Dropped += Seg.Records - Seg.Acked;
+        char Name[32];
+        segmentName(Seg.Number, Name, sizeof(Name));
+        Fs.remove(Name);
+        memmove(&Index.Segments[0], &Index.Segments[1],
+                (Index.Count - 1) * sizeof(LogSegment));
+        memset(&Index.Segments[Index.Count - 1], 0, sizeof(LogSegment));
+        --Index.Count;
+        Blocks.erase(Blocks.begin());
+    }
+
+    // makes the next segment and opens it as the stage, Now is the time of
+    // its first record
+    void createSegment(uint32_t Now)
+    {
+        while (Index.Count > 0 &&
+                (Index.Count >= LOGMAXSEGMENTS || full())) {
+            removeOldest();
+        }
+        LogSegment &Seg = Index.Segments[Index.Count++];
+        Seg.Number = Index.NextNumber++;
+        Seg.FirstTime = Now;
+        Seg.LastTime = Now;
+        Seg.Records = 0;
+        Seg.Acked = 0;
+        SegmentBlocks Fresh;
+        Fresh.End = LOGHEADERSIZE;
+        Blocks.push_back(Fresh);
+
+        uint8_t Header[LOGHEADERSIZE];
+        memset(Header, 0, sizeof(Header));
+        uint32_t Magic = LOGMAGIC;
+        memcpy(Header, &Magic, sizeof(Magic));
+        uint32_t CRC = logCRC(Header, sizeof(Header) - sizeof(CRC));
+        memcpy(Header + sizeof(Header) - sizeof(CRC), &CRC, sizeof(CRC));
+
+        char Name[32];
+        segmentName(Seg.Number, Name, sizeof(Name));
+        bool Made = false;
+        if (Fat != NULL && Fat->expand(Name, LOGSEGMENTEXTENT) == 0 &&
+                Open.open(&Fs, Name, O_RDWR) == 0) {
+            // the clusters are cleared once, whatever they held before
+            // could pass for blocks
+            Made = Open.write(Header, sizeof(Header)) ==
+                   (ssize_t)sizeof(Header);
+            memset(Stage, 0, sizeof(Stage));
+            for (long At = sizeof(Header); Made && At < LOGSEGMENTEXTENT;
+                    At += sizeof(Stage)) {
+                size_t Piece = std::min<size_t>(LOGSEGMENTEXTENT - At,
+                                                sizeof(Stage));
+                Made = Open.write(Stage, Piece) == (ssize_t)Piece;
+            }
+            Made = Made && Open.sync() == 0 &&
+                   Open.seek(sizeof(Header), SEEK_SET) ==
+                   (off_t)sizeof(Header);
+            if (!Made) {
+                Open.close();
+            }
+        }
+        if (!Made && Open.open(&Fs, Name, O_RDWR | O_CREAT | O_TRUNC) == 0) {
+            Made = Open.write(Header, sizeof(Header)) ==
+                   (ssize_t)sizeof(Header) && Open.sync() == 0;
+            if (!Made) {
+                Open.close();
+            }
+        }
+        StageOpen = Made;
+        Failed += !Made;
+        storeIndex();
+    }
+
+    // writes the staged records to the open segment as one block
+    void flush()
+    {
+        if (Used == 0) {
+            return;
+        }
+        uint64_t Before = Latency.Us;
+        SegmentBlocks &Seg = Blocks.back();
+        if (!StageOpen) {
+            char Name[32];
+            segmentName(Index.Segments[Index.Count - 1].Number, Name,
+                        sizeof(Name));
+            StageOpen = Open.open(&Fs, Name, O_RDWR) == 0 &&
+                        Open.seek(Seg.End, SEEK_SET) == (off_t)Seg.End;
+        }
+        LogBlock Head;
+        Head.Count = Count;
+        Head.Size = Used - sizeof(LogBlock);
+        memcpy(Stage, &Head, sizeof(Head));
+        Head.CRC = logCRC(Stage + sizeof(Head.CRC), Used - sizeof(Head.CRC));
+        memcpy(Stage, &Head, sizeof(Head));
+        if (!StageOpen || Open.write(Stage, Used) != (ssize_t)Used ||
+                Open.sync() != 0) {
+            ++Failed;
+        }
+
+        Seg.Offsets.push_back(Seg.End);
+        Seg.Sizes.push_back(Used);
+        Seg.Counts.push_back(Count);
+        Seg.End += Used;
+        LogSegment &Last = Index.Segments[Index.Count - 1];
+        Last.Records += Count;
+        Last.LastTime = Newest;
+        Used = 0;
+        Count = 0;
+        storeIndex();
+        Flushes.push_back(Latency.Us - Before);
+    }
+
+    // flushes and closes the segment, so that it can be removed
+    void closeStage()
+    {
+        flush();
+        if (StageOpen) {
+            Open.close();
+            StageOpen = false;
+        }
+    }
+
+    // reads the blocks that hold Moved records of segment i from record
+    // First on, and checks them
+    void readRecords(size_t i, uint32_t First, size_t Moved)
+    {
+        const SegmentBlocks &Seg = Blocks[i];
+        char Name[32];
+        segmentName(Index.Segments[i].Number, Name, sizeof(Name));
+        File In;
+        if (In.open(&Fs, Name, O_RDONLY) != 0) {
+            Corrupt += Moved;
+            return;
+        }
+        uint8_t Block[LOGSTAGESIZE];
+        uint32_t Record = 0;
+        for (size_t b = 0; b < Seg.Offsets.size(); ++b) {
+            uint32_t Next = Record + Seg.Counts[b];
+            if (Next > First && Record < First + Moved) {
+                LogBlock Head;
+                bool Read = In.seek(Seg.Offsets[b], SEEK_SET) ==
+                            (off_t)Seg.Offsets[b] &&
+                            In.read(Block, Seg.Sizes[b]) ==
+                            (ssize_t)Seg.Sizes[b];
+                memcpy(&Head, Block, sizeof(Head));
+                Corrupt += !Read || Head.Count != Seg.Counts[b] ||
+                           Head.CRC != logCRC(Block + sizeof(Head.CRC),
+                                              Seg.Sizes[b] -
+                                              sizeof(Head.CRC));
+            }
+            Record = Next;
+        }
+        In.close();
+    }
+
+    FileSystem &Fs;
+    FATFileSystem *Fat;
+
+    /// the index in RAM, and what index.dat and index.jnl hold of it
+    LogIndex Index;
+    LogIndex Written;
+    size_t JournalUsed;
+
+    /// the blocks of every segment of Index
+    vector<SegmentBlocks> Blocks;
+
+    /// the open segment, and the block that is staged for it
+    File Open;
+    bool StageOpen;
+    uint8_t Stage[LOGSTAGESIZE];
+    size_t Used;
+    uint16_t Count;
+    uint32_t Oldest;
+    uint32_t Newest;
+    FrameCodec Codec;
+};
+
+/// The flash queue, a key for every reading and a delete record for every
+/// reading that was sent
+class QueueLog : public WearLog {
+public:
+    QueueLog(TDBStore &Store, LatencyBlockDevice &Latency)
+        : WearLog(Latency), Store(Store), Head(0), Tail(0)
+    {
+    }
+
+    /// Starts an empty queue on the store
+    int start()
+    {
+        int err = Store.init();
+        return err ? err : Store.reset();
+    }
+
+    int stop()
+    {
+        return Store.deinit();
+    }
+
+    virtual void record(const SampleFrame &Frame)
+    {
+        uint64_t Before = Latency.Us;
+        char Key[10];
+        if (Tail - Head >= FLASHQUEUELEN) {
+            // the oldest reading is dropped to make room
+            queueKey(Head++, Key);
+            Failed += Store.remove(Key) != 0;
+            ++Dropped;
+        }
+        queueKey(Tail++, Key);
+        Failed += Store.set(Key, &Frame, sizeof(Frame), 0) != 0;
+        Logged += sizeof(Frame);
+        Flushes.push_back(Latency.Us - Before);
+    }
+
+    virtual size_t pending() const
+    {
+        return Tail - Head;
+    }
+
+    virtual void ack(size_t Left)
+    {
+        uint64_t Before = Latency.Us;
+        for (; Left > 0 && Head != Tail; --Left) {
+            char Key[10];
+            queueKey(Head++, Key);
+            SampleFrame Frame;
+            size_t Size = 0;
+            Corrupt += Store.get(Key, &Frame, sizeof(Frame), &Size) != 0 ||
+                       Size != sizeof(Frame);
+            Failed += Store.remove(Key) != 0;
+        }
+        // the uploader moves the collection along while it waits
+        Store.garbage_collection_step();
+        Acks.push_back(Latency.Us - Before);
+    }
+
+private:
+    static void queueKey(uint32_t Seq, char *Key)
+    {
+        Key[0] = 'q';
+        formatHex(Key + 1, Seq, 8);
+    }
+
+    TDBStore &Store;
+    uint32_t Head;
+    uint32_t Tail;
+};
+
+/// The readings of a site, a random walk of every port
+class ReadingSource {
+public:
+    explicit ReadingSource(std::mt19937 &Rng) : Rng(Rng)
+    {
+        memset(&Frame, 0, sizeof(Frame));
+        for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+            Frame.setReading(i, 0.5f);
+        }
+    }
+
+    /// Returns the reading at Now seconds into the replay
+    const SampleFrame &next(double Now)
+    {
+        std::uniform_int_distribution<int> Step(-WEARSTEP, WEARSTEP);
+        for (size_t i = 0; i < FRAMEMAXPORTS; ++i) {
+            int Raw = Frame.Raw[i] + Step(Rng);
+            Frame.Raw[i] = (uint16_t)std::min(std::max(Raw, 0), 0xFFFF);
+        }
+        Frame.Timestamp = 1600000000UL + (uint32_t)Now;
+        ++Frame.Sequence;
+        return Frame;
+    }
+
+private:
+    std::mt19937 &Rng;
+    SampleFrame Frame;
+};
+
+// the days to replay, WEAR_DAYS or WEARDAYS
+static double wearDays()
+{
+    const char *Days = getenv("WEAR_DAYS");
+    return Days != NULL && atof(Days) > 0 ? atof(Days) : WEARDAYS;
+}
+
+// runs the days through Log, a reading every WEARINTERVAL seconds while the
+// site is offline, and the backlog sent in batches once it is back
+static void replay(WearLog &Log, double Days)
+{
+    std::mt19937 Rng(WEARSEED);
+    ReadingSource Readings(Rng);
+    std::exponential_distribution<double> Online(WEAROUTAGES /
+                                                 (30.0 * 86400.0));
+    std::exponential_distribution<double> Outage(1.0 /
+                                                 (WEAROUTAGEHOURS * 3600.0));
+    double End = Days * 86400.0;
+    double Now = 0.0;
+    while (Now < End) {
+        double Stop = std::min(End, Now + Online(Rng));
+        while (Now < Stop && Log.pending() > 0) {
+            size_t Batch = std::min<size_t>(BACKUPBATCHMAX, Log.pending());
+            Log.ack(Batch);
+            Now += double(Batch) / WEARDRAINRATE;
+        }
+        Now = Stop;
+        if (Now >= End) {
+            break;
+        }
+        Stop = std::min(End, Now + Outage(Rng));
+        for (; Now < Stop; Now += WEARINTERVAL) {
+            Log.record(Readings.next(Now));
+        }
+    }
+    while (Log.pending() > 0) {
+        Log.ack(std::min<size_t>(BACKUPBATCHMAX, Log.pending()));
+    }
+}
+
+// prints how many of the times in Us there are and their p50, p99 and max
+static void printLatency(const char *Kind, vector<uint32_t> Us)
+{
+    if (Us.empty()) {
+        return;
+    }
+    std::sort(Us.begin(), Us.end());
+    printf("    %-8s %7lu   p50/p99/max ms %8.1f %8.1f %8.1f\n", Kind,
+           (unsigned long)Us.size(), Us[Us.size() / 2] / 1000.0,
+           Us[Us.size() * 99 / 100] / 1000.0, Us.back() / 1000.0);
+}
+
+// prints what Log cost the store under Profile, Wear is how often each of
+// its blocks was erased and Endurance how often they can be, 0 for a card
+static void report(const char *Name, const WearLog &Log,
+                   ProfilingBlockDevice &Profile,
+                   const vector<uint32_t> &Wear, uint32_t Endurance,
+                   double Days)
+{
+    double Ratio = Log.Logged ? double(Profile.get_program_count()) /
+                   Log.Logged : 0.0;
+    printf("%-12s %9lu KB logged %9lu KB written  WA %6.1f\n", Name,
+           (unsigned long)(Log.Logged / 1024),
+           (unsigned long)(Profile.get_program_count() / 1024), Ratio);
+    printf("    %lu KB read, %lu KB erased, %lu readings dropped\n",
+           (unsigned long)(Profile.get_read_count() / 1024),
+           (unsigned long)(Profile.get_erase_count() / 1024),
+           (unsigned long)Log.Dropped);
+
+    uint32_t Worst = 0;
+    uint64_t Total = 0;
+    size_t Used = 0;
+    for (size_t i = 0; i < Wear.size(); ++i) {
+        Worst = std::max(Worst, Wear[i]);
+        Total += Wear[i];
+        Used += Wear[i] > 0;
+    }
+    printf("    worst block %lu, mean %.1f of the %lu blocks used",
+           (unsigned long)Worst, Used ? double(Total) / Used : 0.0,
+           (unsigned long)Used);
+    if (Endurance && Worst) {
+        printf(", lasts %.1f years", double(Endurance) / Worst * Days / 365.0);
+    }
+    printf("\n    blocks by erases:");
+    for (uint32_t From = 1; From <= Worst; From *= 2) {
+        size_t Blocks = 0;
+        for (size_t i = 0; i < Wear.size(); ++i) {
+            Blocks += Wear[i] >= From && Wear[i] < From * 2;
+        }
+        printf(" %lu-%lu: %lu", (unsigned long)From,
+               (unsigned long)(From * 2 - 1), (unsigned long)Blocks);
+    }
+    printf("\n");
+    printLatency("flush", Log.Flushes);
+    printLatency("ack", Log.Acks);
+    printLatency("segment", Log.Segments);
+}
+
+// the erases of every sector of a flash under Exhaustible
+static vector<uint32_t> flashWear(ExhaustibleBlockDevice &Exhaustible)
+{
+    vector<uint32_t> Wear;
+    for (bd_addr_t At = 0; At < Exhaustible.size(); At += FLASHSECTOR) {
+        Wear.push_back(FLASHENDURANCE - Exhaustible.get_erase_cycles(At));
+    }
+    return Wear;
+}
+
+// what has to hold for every store once the replay is done
+static void expectClean(const WearLog &Log, ProfilingBlockDevice &Profile)
+{
+    EXPECT_EQ(0u, Log.Failed);
+    EXPECT_EQ(0u, Log.Corrupt);
+    EXPECT_EQ(0u, Log.pending());
+    EXPECT_GT(Log.Logged, 0u);
+    EXPECT_GE(Profile.get_program_count(), Log.Logged);
+}
+
+TEST(TestWear, fat_on_sd)
+{
+    HeapBlockDevice Heap(SDCARDSIZE, SDSECTOR);
+    LatencyBlockDevice Latency(&Heap, true, WEARSEED + 1);
+    ProfilingBlockDevice Profile(&Latency);
+    FATFileSystem Fs("sd");
+    SegmentLog Log(Fs, &Fs, Latency);
+    ASSERT_EQ(0, Log.start(&Profile));
+    Profile.reset();
+
+    double Days = wearDays();
+    replay(Log, Days);
+    report("fat", Log, Profile, Latency.Writes, 0, Days);
+    expectClean(Log, Profile);
+    EXPECT_EQ(0, Log.stop());
+}
+
+TEST(TestWear, littlefs_on_flash)
+{
+    HeapBlockDevice Heap(FLASHREGION, 1, FLASHPHRASE, FLASHSECTOR);
+    FlashSimBlockDevice Flash(&Heap);
+    ExhaustibleBlockDevice Exhaustible(&Flash, FLASHENDURANCE);
+    LatencyBlockDevice Latency(&Exhaustible, false, WEARSEED + 1);
+    ProfilingBlockDevice Profile(&Latency);
+    LittleFileSystem Fs("log", NULL, BACKUPLFSREADSIZE, BACKUPLFSPROGSIZE,
+                        MBED_LFS_BLOCK_SIZE, BACKUPLFSLOOKAHEAD);
+    SegmentLog Log(Fs, NULL, Latency);
+    ASSERT_EQ(0, Log.start(&Profile));
+    Profile.reset();
+
+    double Days = wearDays();
+    replay(Log, Days);
+    report("littlefs", Log, Profile, flashWear(Exhaustible), FLASHENDURANCE,
+           Days);
+    expectClean(Log, Profile);
+    EXPECT_EQ(0, Log.stop());
+}
+
+TEST(TestWear, littlefs_on_sd_partition)
+{
+    HeapBlockDevice Heap(SDPARTITIONSIZE, SDSECTOR);
+    LatencyBlockDevice Latency(&Heap, true, WEARSEED + 1);
+    ProfilingBlockDevice Profile(&Latency);
+    LittleFileSystem Fs("log", NULL, BACKUPLFSREADSIZE, BACKUPLFSPROGSIZE,
+                        MBED_LFS_BLOCK_SIZE, BACKUPLFSLOOKAHEAD);
+    SegmentLog Log(Fs, NULL, Latency);
+    ASSERT_EQ(0, Log.start(&Profile));
+    Profile.reset();
+
+    double Days = wearDays();
+    replay(Log, Days);
+    report("littlefs-sd", Log, Profile, Latency.Writes, 0, Days);
+    expectClean(Log, Profile);
+    EXPECT_EQ(0, Log.stop());
+}
+
+TEST(TestWear, tdbstore_flash_queue)
+{
+    HeapBlockDevice Heap(FLASHREGION, 1, FLASHPHRASE, FLASHSECTOR);
+    FlashSimBlockDevice Flash(&Heap);
+    ExhaustibleBlockDevice Exhaustible(&Flash, FLASHENDURANCE);
+    LatencyBlockDevice Latency(&Exhaustible, false, WEARSEED + 1);
+    ProfilingBlockDevice Profile(&Latency);
+    TDBStore Store(&Profile);
+    QueueLog Log(Store, Latency);
+    ASSERT_EQ(0, Log.start());
+    Profile.reset();
+
+    double Days = wearDays();
+    replay(Log, Days);
+    report("tdbstore", Log, Profile, flashWear(Exhaustible), FLASHENDURANCE,
+           Days);
+    expectClean(Log, Profile);
+    EXPECT_EQ(0, Log.stop());
+}
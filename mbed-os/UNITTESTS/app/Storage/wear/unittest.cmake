@@ -0,0 +1,73 @@
+####################
+# UNIT TESTS
+####################
+
+# the backup log's stores with mbed-os's own block devices, filesystems and
+# TDBStore, configured as mbed_app.json configures them for the K64F
+set(unittest-includes
+  ${unittest-includes}
+  ../features/storage/blockdevice
+  ../features/storage/filesystem
+  ../features/storage/filesystem/fat
+  ../features/storage/filesystem/fat/ChaN
+  ../features/storage/filesystem/littlefs
+  ../features/storage/filesystem/littlefs/littlefs
+  ../features/storage/kvstore/include
+  ../features/storage/kvstore/tdbstore
+  ../features/storage/kvstore/conf
+  ../features/storage/system_storage
+  ../features/storage
+  ../../BoardConfig
+  ../../Networking
+  ../../Storage
+)
+
+set(unittest-sources
+  ../../Networking/NumberFormat.cpp
+  ../../Storage/FrameCodec.cpp
+  ../drivers/source/MbedCRC.cpp
+  ../drivers/source/TableCRC.cpp
+  ../features/storage/blockdevice/ExhaustibleBlockDevice.cpp
+  ../features/storage/blockdevice/FlashSimBlockDevice.cpp
+  ../features/storage/blockdevice/HeapBlockDevice.cpp
+  ../features/storage/blockdevice/ProfilingBlockDevice.cpp
+  ../features/storage/filesystem/Dir.cpp
+  ../features/storage/filesystem/File.cpp
+  ../features/storage/filesystem/FileSystem.cpp
+  ../features/storage/filesystem/fat/ChaN/ff.cpp
+  ../features/storage/filesystem/fat/ChaN/ffunicode.cpp
+  ../features/storage/filesystem/fat/FATFileSystem.cpp
+  ../features/storage/filesystem/littlefs/LittleFileSystem.cpp
+  ../features/storage/filesystem/littlefs/littlefs/lfs.c
+  ../features/storage/filesystem/littlefs/littlefs/lfs_util.c
+  ../features/storage/blockdevice/BufferedBlockDevice.cpp
+  ../features/storage/kvstore/tdbstore/TDBStore.cpp
+  ../features/storage/system_storage/SystemStorage.cpp
+  ../platform/source/FileBase.cpp
+  ../platform/source/FileSystemHandle.cpp
+)
+
+set(unittest-test-sources
+  app/Storage/wear/test_wear.cpp
+  stubs/FileHandle_stub.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_critical_stub.c
+  stubs/mbed_error.c
+  stubs/mbed_wait_api_stub.cpp
+  stubs/Mutex_stub.cpp
+)
+
+# the config of mbed_app.json and of the mbed_lib.json files it overrides
+foreach(flag
+    -DMBED_LFS_READ_SIZE=64
+    -DMBED_LFS_PROG_SIZE=64
+    -DMBED_LFS_BLOCK_SIZE=512
+    -DMBED_LFS_LOOKAHEAD=512
+    -DMBED_CONF_FAT_CHAN_FF_USE_FASTSEEK=1
+    -DMBED_CONF_FAT_CHAN_FF_USE_EXPAND=1
+    -DMBED_CONF_TDBSTORE_INITIAL_MAX_KEYS=520
+    -DMBED_CONF_TDBSTORE_GC_STEP_RECORDS=8
+    -DMBED_CONF_TDBSTORE_KEY_PREFIX_SIZE=12)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${flag}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${flag}")
+endforeach()
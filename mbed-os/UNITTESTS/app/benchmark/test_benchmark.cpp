@@ -0,0 +1,424 @@
+/// \file
+/// \brief Host benchmarks of the config parser, the request writer and the
+/// AT command parser on canned input.
+///
+/// Each benchmark runs its operation BENCHMARKRUNS times and prints the ns
+/// and the heap allocations of one operation. The times are the PC's, they
+/// only mean something next to an earlier run on the same PC. The
+/// allocations do not depend on it: an operation that should not use the
+/// heap fails its test once it does.
+#include "gtest/gtest.h"
+#include "ATCmdParser.h"
+#include "ConfigParser.h"
+#include "RequestWriter.h"
+#include "mbed_poll_stub.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+/// How often each operation is timed
+#define BENCHMARKRUNS (2000)
+
+/// the heap allocations so far, of the whole test program
+static size_t Allocations = 0;
+
+void *operator new(size_t Size)
+{
+    ++Allocations;
+    void *Memory = malloc(Size > 0 ? Size : 1);
+    if (Memory == NULL) {
+        throw std::bad_alloc();
+    }
+    return Memory;
+}
+
+void operator delete(void *Memory) noexcept
+{
+    free(Memory);
+}
+
+void operator delete(void *Memory, size_t) noexcept
+{
+    free(Memory);
+}
+
+/// What one operation took
+struct BenchmarkResult {
+    double Ns;
+    double Allocations;
+};
+
+// runs Op once to warm up, then BENCHMARKRUNS times, and prints what one
+// run took
+template <typename Operation>
+static BenchmarkResult measure(const char *Name, Operation Op)
+{
+    Op();
+    size_t Before = Allocations;
+    std::chrono::steady_clock::time_point Start =
+        std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCHMARKRUNS; ++i) {
+        Op();
+    }
+    std::chrono::duration<double, std::nano> Took =
+        std::chrono::steady_clock::now() - Start;
+    BenchmarkResult Result = {Took.count() / BENCHMARKRUNS,
+                              double(Allocations - Before) / BENCHMARKRUNS
+                             };
+    printf("%-20s %10.0f ns/op %8.2f allocs/op\n", Name, Result.Ns,
+           Result.Allocations);
+    return Result;
+}
+
+// ============================================================================
+// The config file
+
+/// A config file of a board with four sensors and sixteen ports
+static const char ConfigText[] =
+    "# system info\r\n"
+    "BoardInfo:GenericWiFi,testpass,Test-Board\r\n"
+    "ConnInfo:192.168.43.220,80,localhost,"
+    "/seniorDesign/bulk_sensor_readings.php\r\n"
+    "\r\n"
+    "# SensorID: type, unit, multiplier, start, end, oversampling, AC/DC\r\n"
+    "Sensor:Current,A,0.00152590219,0,100,4,AC,0.5,600\r\n"
+    "Sensor:Voltage,V,0.00762951094,0,500,4,AC,2%,600\r\n"
+    "Sensor:Temperature,C,0.00152590219,-40,125,1,DC,0.2,900,12,32,20,60\r\n"
+    "Sensor:Pulses,kWh,65.535,0,1000000\r\n"
+    "Calibration:0,1.02,-0.01,100:0.5,20000:30.1,40000:61\r\n"
+    "\r\n"
+    "# Port:name,sensor\r\n"
+    "Port:main_current_a,0\r\nPort:main_current_b,0\r\n"
+    "Port:main_current_c,0\r\nPort:main_voltage_a,1\r\n"
+    "Port:main_voltage_b,1\r\nPort:main_voltage_c,1\r\n"
+    "Port:hvac_current,0\r\nPort:pump_current,0\r\n"
+    "Port:supply_air,2\r\nPort:return_air,2\r\n"
+    "Port:outside_air,2,hidden\r\nPort:meter_pulses,3\r\n"
+    "Port:spare_1,0\r\nPort:spare_2,0\r\nPort:spare_3,1\r\n"
+    "Virtual:main_power,3,main_current_a * main_voltage_a + "
+    "main_current_b * main_voltage_b\r\n";
+
+// reads every field of ConfigText like parseConfigText() does, and returns
+// a sum of what it read so nothing is optimized away
+static float parseConfig()
+{
+    ConfigParser Parser(ConfigText, sizeof(ConfigText) - 1);
+    Span<const char> Field;
+    float Sum = 0.0f;
+    while (Parser.nextLine()) {
+        if (Parser.lineIs('S', "Sensor") || Parser.lineIs('P', "Port")) {
+            Parser.nextField(':', Field);
+            while (Parser.nextField(',', Field)) {
+                Sum += spanToFloat(Field) + spanContains(Field, "AC");
+            }
+        } else if (Parser.lineIs('B', "Board") ||
+                   Parser.lineIs('C', "ConnInfo") ||
+                   Parser.lineIs('V', "Virtual")) {
+            Parser.nextField(':', Field);
+            Parser.nextField(',', Field);
+            Sum += Field.size();
+            if (Parser.restOfLine(Field)) {
+                Sum += Field.size();
+            }
+        }
+    }
+    return Sum;
+}
+
+TEST(Benchmark, config_parser)
+{
+    float Expected = parseConfig();
+    BenchmarkResult Result = measure("config parser", [&]() {
+        EXPECT_EQ(Expected, parseConfig());
+    });
+    EXPECT_EQ(0.0, Result.Allocations);
+}
+
+// ============================================================================
+// The GET request of a reading
+
+/// The names of the ports of ConfigText
+static const char *const PortNames[] = {
+    "main_current_a", "main_current_b", "main_current_c", "main_voltage_a",
+    "main_voltage_b", "main_voltage_c", "hvac_current", "pump_current",
+    "supply_air", "return_air", "outside_air", "meter_pulses", "spare_1",
+    "spare_2", "spare_3", "main_power"
+};
+
+// takes the flushed text of a request like the link to the ESP8266 does
+static bool countText(size_t *Total, const char *Data, size_t Length)
+{
+    *Total += Length;
+    return Data != NULL;
+}
+
+// formats the request of one reading of every port through a window of 64
+// bytes, the way the requests are streamed, and returns its length
+static size_t writeRequest(uint32_t Sequence)
+{
+    char Window[64];
+    size_t Total = 0;
+    RequestWriter Message(Window, sizeof(Window), callback(countText, &Total));
+    Message.append("GET /seniorDesign/bulk_sensor_readings.php?Board_ID=");
+    Message.append("Test-Board&Config_Version=");
+    Message.appendUnsigned(3);
+    Message.append("&Seq[]=");
+    Message.appendUnsigned(Sequence);
+    for (size_t i = 0; i < sizeof(PortNames) / sizeof(PortNames[0]); ++i) {
+        Message.append("&");
+        Message.append(PortNames[i]);
+        Message.append("[]=");
+        Message.appendFloat(12.345678f * (i + 1) + Sequence % 7);
+    }
+    Message.append(" HTTP/1.1\r\nHost: localhost\r\n"
+                   "Connection: keep-alive\r\n\r\n");
+    return Message.finish() ? Total : 0;
+}
+
+TEST(Benchmark, request_writer)
+{
+    uint32_t Sequence = 1000;
+    BenchmarkResult Result = measure("request writer", [&]() {
+        EXPECT_LT(0u, writeRequest(++Sequence));
+    });
+    EXPECT_EQ(0.0, Result.Allocations);
+}
+
+// ============================================================================
+// The AT commands of an upload
+
+/// What went over the ESP8266's UART for one upload, in the format of
+/// ESPTranscript.h: the microseconds of the first and last byte of a chunk,
+/// '>' for what the board wrote and '<' for what the ESP8266 sent
+static const char Transcript[] =
+    "0 3600 > AT+CIPSTART=\"TCP\",\"192.168.43.220\",80\\r\\n\n"
+    "41200 41900 < CONNECT\\r\\n\n"
+    "42000 42400 < \\r\\nOK\\r\\n\n"
+    "43100 45000 > AT+CIPSEND=46\\r\\n\n"
+    "46500 47100 < \\r\\nOK\\r\\n\n"
+    "47200 47300 < > \n"
+    "47400 51600 > GET /bulk.php?Board_ID=Test-Board HTTP/1.1\\r\\n\\r\\n\n"
+    "52900 54100 < \\r\\nRecv 46 bytes\\r\\n\n"
+    "61000 61900 < \\r\\nSEND OK\\r\\n\n"
+    "212000 213800 < \\r\\n+IPD,51:HTTP/1.1 200 OK\\r\\n\n"
+    "213900 215400 < Content-Length: 12\\r\\n\n"
+    "215500 216700 < \\r\\nsamplerate=5\n"
+    "301000 301800 < CLOSED\\r\\n\n";
+
+/// Plays Transcript in place of the ESP8266's serial port. A chunk the
+/// ESP8266 sent can be read once the board wrote every chunk in front of it,
+/// and stays there until it is read, like in the UART's buffer. What the
+/// board writes is compared with its chunks in order
+class TranscriptPort : public mbed::FileHandle {
+public:
+    explicit TranscriptPort(const char *Text) : Mismatches(0)
+    {
+        const char *Line = Text;
+        while (*Line != 0) {
+            const char *End = strchr(Line, '\n');
+            unsigned long First, Last;
+            char Direction;
+            int Used = 0;
+            if (sscanf(Line, "%lu %lu %c %n", &First, &Last, &Direction,
+                       &Used) == 3) {
+                Chunks.push_back(Direction + unescape(Line + Used, End));
+            }
+            Line = End + 1;
+        }
+        rewind();
+    }
+
+    /// Starts the transcript over
+    void rewind()
+    {
+        Read.Chunk = next('<', 0);
+        Read.At = 0;
+        Written.Chunk = next('>', 0);
+        Written.At = 0;
+        Mismatches = 0;
+    }
+
+    /// Returns true once every chunk was read or written
+    bool done() const
+    {
+        return Read.Chunk == Chunks.size() && Written.Chunk == Chunks.size();
+    }
+
+    /// Returns the bytes the board wrote that differ from the recording
+    size_t mismatches() const
+    {
+        return Mismatches;
+    }
+
+    virtual ssize_t read(void *buffer, size_t size)
+    {
+        if (Read.Chunk > Written.Chunk || Read.Chunk == Chunks.size()) {
+            // the ESP8266 waits for the board
+            return -EAGAIN;
+        }
+        const string &Bytes = Chunks[Read.Chunk];
+        size_t Left = Bytes.size() - 1 - Read.At;
+        size_t Length = size < Left ? size : Left;
+        memcpy(buffer, Bytes.data() + 1 + Read.At, Length);
+        advance(Read, '<', Length);
+        return Length;
+    }
+
+    virtual ssize_t write(const void *buffer, size_t size)
+    {
+        const char *Bytes = static_cast<const char *>(buffer);
+        for (size_t i = 0; i < size; ++i) {
+            if (Written.Chunk == Chunks.size()) {
+                ++Mismatches;
+                continue;
+            }
+            if (Chunks[Written.Chunk][1 + Written.At] != Bytes[i]) {
+                ++Mismatches;
+            }
+            advance(Written, '>', 1);
+        }
+        return size;
+    }
+
+    virtual short poll(short events) const
+    {
+        return POLLOUT | (Read.Chunk < Written.Chunk ? POLLIN : 0);
+    }
+
+    virtual off_t seek(off_t offset, int whence)
+    {
+        return -ESPIPE;
+    }
+
+    virtual int close()
+    {
+        return 0;
+    }
+
+private:
+    /// Where the board is in the chunks of one direction
+    struct Cursor {
+        size_t Chunk;
+        size_t At;
+    };
+
+    // the bytes of a chunk from From to End, with \r, \n, \\ and \xHH
+    static string unescape(const char *From, const char *End)
+    {
+        string Bytes;
+        while (From < End) {
+            if (*From != '\\' || From + 1 >= End) {
+                Bytes += *From++;
+            } else if (From[1] == 'x' && From + 3 < End) {
+                Bytes += (char)strtoul(string(From + 2, 2).c_str(), NULL, 16);
+                From += 4;
+            } else {
+                Bytes += From[1] == 'r'   ? '\r'
+                         : From[1] == 'n' ? '\n'
+                         : From[1];
+                From += 2;
+            }
+        }
+        return Bytes;
+    }
+
+    // the first chunk from From on that goes in Direction
+    size_t next(char Direction, size_t From) const
+    {
+        while (From < Chunks.size() && Chunks[From][0] != Direction) {
+            ++From;
+        }
+        return From;
+    }
+
+    void advance(Cursor &Where, char Direction, size_t Bytes)
+    {
+        Where.At += Bytes;
+        if (Where.At == Chunks[Where.Chunk].size() - 1) {
+            Where.Chunk = next(Direction, Where.Chunk + 1);
+            Where.At = 0;
+        }
+    }
+
+    /// each chunk is its direction and its bytes
+    vector<string> Chunks;
+    Cursor Read;
+    Cursor Written;
+    size_t Mismatches;
+};
+
+// goes through the upload of Transcript like the uploader does, and drops
+// what is left after the link closed
+// returns true if every answer came as recorded
+static bool upload(ATCmdParser &Parser, char (&Response)[64])
+{
+    static const char Request[] =
+        "GET /bulk.php?Board_ID=Test-Board HTTP/1.1\r\n\r\n";
+    int Length = 0;
+    return Parser.send("AT+CIPSTART=\"TCP\",\"%s\",%d", "192.168.43.220",
+                       80) &&
+           Parser.recv("OK") &&
+           Parser.send("AT+CIPSEND=%d", (int)sizeof(Request) - 1) &&
+           Parser.recv(">") &&
+           Parser.write(Request, sizeof(Request) - 1) ==
+           (int)sizeof(Request) - 1 &&
+           Parser.recv("SEND OK") && Parser.recv("+IPD,%d:", &Length) &&
+           Length < (int)sizeof(Response) &&
+           Parser.read(Response, Length) == Length && Parser.recv("CLOSED") &&
+           (Parser.flush(), true);
+}
+
+TEST(Benchmark, at_cmd_parser)
+{
+    // the poll stub answers for the port, it is always ready
+    mbed_poll_stub::revents_value = POLLIN | POLLOUT;
+    mbed_poll_stub::int_value = 1;
+
+    TranscriptPort Port(Transcript);
+    ATCmdParser Parser(&Port, "\r\n");
+    char Response[64];
+    BenchmarkResult Result = measure("at cmd parser", [&]() {
+        Port.rewind();
+        EXPECT_TRUE(upload(Parser, Response));
+        EXPECT_TRUE(Port.done());
+        EXPECT_EQ(0u, Port.mismatches());
+    });
+    EXPECT_EQ(0.0, Result.Allocations);
+}
+
+/// The ESP8266's answer to a query of the access point, with a long name.
+/// Each character of the line is matched once, however long the line is
+static const char JoinTranscript[] =
+    "0 1100 > AT+CWJAP?\\r\\n\n"
+    "2000 9800 < +CWJAP:\"IAC Energy Monitoring Network 2\","
+    "\"a0:b1:c2:d3:e4:f5\",11,-58\\r\\n\\r\\nOK\\r\\n\n";
+
+TEST(Benchmark, at_cmd_parser_conversions)
+{
+    mbed_poll_stub::revents_value = POLLIN | POLLOUT;
+    mbed_poll_stub::int_value = 1;
+
+    TranscriptPort Port(JoinTranscript);
+    ATCmdParser Parser(&Port, "\r\n");
+    char Ssid[33];
+    char Bssid[18];
+    int Channel = 0;
+    BenchmarkResult Result = measure("at cmd conversions", [&]() {
+        Port.rewind();
+        EXPECT_TRUE(Parser.send("AT+CWJAP?") &&
+                    Parser.recv("+CWJAP:\"%32[^\"]\",\"%17[^\"]\",%d,", Ssid,
+                                Bssid, &Channel) &&
+                    Parser.recv("OK") && (Parser.flush(), true));
+        EXPECT_TRUE(Port.done());
+        EXPECT_EQ(11, Channel);
+    });
+    EXPECT_EQ(0.0, Result.Allocations);
+}
@@ -25,6 +25,17 @@
 #define TEST_THREAD_STACK_SIZE 512
 #define DISPATCH_INFINITE -1
 #define ITERATION_TIMES 10
+#define ORDER_EVENTS 64
+#define ORDER_DELAYS 45
+
+// The lists of pending event slots of a queue, one per timing wheel slot
+#if EQUEUE_WHEEL_SIZE
+#define TEST_EQUEUE_LISTS EQUEUE_WHEEL_SIZE
+#define TEST_EQUEUE_LIST(q, i) ((q).wheel[i])
+#else
+#define TEST_EQUEUE_LISTS 1
+#define TEST_EQUEUE_LIST(q, i) ((q).queue)
+#endif
 
 extern unsigned int equeue_global_time;
 
@@ -146,6 +157,55 @@ static void multithread_func(void *p)
     }
 }
 
+struct order {
+    int index;
+    int *log;
+    int *count;
+};
+
+static void order_func(void *p)
+{
+    struct order *o = reinterpret_cast<struct order *>(p);
+    o->log[(*o->count)++] = o->index;
+}
+
+// post ORDER_EVENTS events with repeating delays and cancel every third
+static void order_post(equeue_t *q, int *ids, int *log, int *count)
+{
+    for (int i = 0; i < ORDER_EVENTS; i++) {
+        struct order *o = reinterpret_cast<struct order *>(equeue_alloc(q, sizeof(struct order)));
+        ASSERT_TRUE(o != NULL);
+
+        o->index = i;
+        o->log = log;
+        o->count = count;
+        equeue_event_delay(o, (i * 7) % ORDER_DELAYS);
+        ids[i] = equeue_post(q, order_func, o);
+        ASSERT_NE(0, ids[i]);
+    }
+
+    for (int i = 1; i < ORDER_EVENTS; i += 3) {
+        EXPECT_TRUE(equeue_cancel(q, ids[i]));
+    }
+}
+
+// check that the events that were not cancelled ran by delay, and in
+// order of posting for equal delays
+static void order_check(const int *log, int count)
+{
+    int n = 0;
+    for (int d = 0; d < ORDER_DELAYS; d++) {
+        for (int i = 0; i < ORDER_EVENTS; i++) {
+            if ((i * 7) % ORDER_DELAYS == d && i % 3 != 1) {
+                ASSERT_LT(n, count);
+                EXPECT_EQ(i, log[n]);
+                n++;
+            }
+        }
+    }
+    EXPECT_EQ(n, count);
+}
+
 static void background_func(void *p, int ms)
 {
     *(reinterpret_cast<int *>(p)) = ms;
@@ -986,11 +1046,11 @@ TEST_F(TestEqueue, test_equeue_sibling)
     int id1 = equeue_call_in(&q, 1, pass_func, 0);
     int id2 = equeue_call_in(&q, 1, pass_func, 0);
 
-    struct equeue_event *e = q.queue;
-
-    for (; e; e = e->next) {
-        for (struct equeue_event *s = e->sibling; s; s = s->sibling) {
-            EXPECT_TRUE(s->next == NULL);
+    for (int i = 0; i < TEST_EQUEUE_LISTS; i++) {
+        for (struct equeue_event *e = TEST_EQUEUE_LIST(q, i); e; e = e->next) {
+            for (struct equeue_event *s = e->sibling; s; s = s->sibling) {
+                EXPECT_TRUE(s->next == NULL);
+            }
         }
     }
     equeue_cancel(&q, id0);
@@ -1057,3 +1117,113 @@ TEST_F(TestEqueue, test_equeue_user_allocated_event_post)
 
     equeue_destroy(&q);
 }
+
+/** Test that equeue dispatches events in order of their targets.
+ *
+ *  Given queue is initialized.
+ *  When events are posted with repeating delays and some of them are cancelled.
+ *  Then equeue_dispatch executes the others by delay, and in order of posting for equal delays.
+ */
+TEST_F(TestEqueue, test_equeue_post_order)
+{
+    equeue_t q;
+    int err = equeue_create(&q, ORDER_EVENTS * (EQUEUE_EVENT_SIZE + sizeof(struct order)));
+    ASSERT_EQ(0, err);
+
+    int ids[ORDER_EVENTS];
+    int log[ORDER_EVENTS];
+    int count = 0;
+    order_post(&q, ids, log, &count);
+
+    equeue_dispatch(&q, 2 * ORDER_DELAYS);
+    order_check(log, count);
+
+    equeue_destroy(&q);
+}
+
+/** Test that equeue keeps the order of events when the dispatch falls behind.
+ *
+ *  Given queue is initialized and events are posted with repeating delays.
+ *  When the time passes all of the targets before equeue_dispatch is called.
+ *  Then equeue_dispatch executes the events by delay, and in order of posting for equal delays.
+ */
+TEST_F(TestEqueue, test_equeue_post_order_stalled)
+{
+    equeue_t q;
+    int err = equeue_create(&q, ORDER_EVENTS * (EQUEUE_EVENT_SIZE + sizeof(struct order)));
+    ASSERT_EQ(0, err);
+
+    int ids[ORDER_EVENTS];
+    int log[ORDER_EVENTS];
+    int count = 0;
+    order_post(&q, ids, log, &count);
+
+    equeue_global_time += 4 * ORDER_DELAYS;
+    equeue_dispatch(&q, 0);
+    order_check(log, count);
+
+    equeue_destroy(&q);
+}
+
+/** Test that equeue keeps the order of events across the overflow of the tick.
+ *
+ *  Given queue is initialized just before the tick overflows.
+ *  When events are posted with delays that reach past the overflow.
+ *  Then equeue_dispatch executes the events by delay, and in order of posting for equal delays.
+ */
+TEST_F(TestEqueue, test_equeue_post_order_overflow)
+{
+    equeue_global_time = -ORDER_DELAYS / 2;
+
+    equeue_t q;
+    int err = equeue_create(&q, ORDER_EVENTS * (EQUEUE_EVENT_SIZE + sizeof(struct order)));
+    ASSERT_EQ(0, err);
+
+    int ids[ORDER_EVENTS];
+    int log[ORDER_EVENTS];
+    int count = 0;
+    order_post(&q, ids, log, &count);
+
+    equeue_dispatch(&q, 2 * ORDER_DELAYS);
+    order_check(log, count);
+
+    equeue_destroy(&q);
+}
+
+/** Test that equeue tells the background timer about the nearest target.
+ *
+ *  Given queue is initialized with a background timer.
+ *  When events are posted with delays both shorter and longer than the earlier ones.
+ *  Then the background timer is updated only with the delay of the nearest event.
+ */
+TEST_F(TestEqueue, test_equeue_background_nearest)
+{
+    equeue_t q;
+    int err = equeue_create(&q, TEST_EQUEUE_SIZE);
+    ASSERT_EQ(0, err);
+
+    int ms = 0;
+    equeue_background(&q, background_func, &ms);
+    EXPECT_EQ(0, ms);
+
+    int id0 = equeue_call_in(&q, 100, pass_func, 0);
+    EXPECT_EQ(100, ms);
+
+    int id1 = equeue_call_in(&q, 45, pass_func, 0);
+    EXPECT_EQ(45, ms);
+
+    int id2 = equeue_call_in(&q, 50, pass_func, 0);
+    EXPECT_EQ(45, ms);
+
+    int id3 = equeue_call_in(&q, 3, pass_func, 0);
+    EXPECT_EQ(3, ms);
+
+    equeue_cancel(&q, id3);
+    equeue_dispatch(&q, 10);
+    EXPECT_EQ(35, ms);
+
+    equeue_cancel(&q, id0);
+    equeue_cancel(&q, id1);
+    equeue_cancel(&q, id2);
+    equeue_destroy(&q);
+}
@@ -0,0 +1,25 @@
+
+####################
+# UNIT TESTS
+####################
+
+list(REMOVE_ITEM unittest-includes ${PROJECT_SOURCE_DIR}/target_h/events ${PROJECT_SOURCE_DIR}/target_h/events/equeue)
+
+set(unittest-includes ${unittest-includes}
+  ../events/source
+  ../events
+  ../events/internal
+)
+
+set(unittest-sources
+  ../events/source/equeue.c
+)
+
+set(unittest-test-sources
+  events/equeue/test_equeue.cpp
+  stubs/EqueuePosix_stub.c
+)
+
+# a small wheel, so the tests' delays take the wheel around more than once
+set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -pthread -DEQUEUE_PLATFORM_POSIX -DMBED_CONF_EVENTS_TIMER_WHEEL_SIZE=8 -DMBED_CONF_EVENTS_TIMER_WHEEL_RESOLUTION=4")
+set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -pthread -DEQUEUE_PLATFORM_POSIX -DMBED_CONF_EVENTS_TIMER_WHEEL_SIZE=8 -DMBED_CONF_EVENTS_TIMER_WHEEL_RESOLUTION=4")
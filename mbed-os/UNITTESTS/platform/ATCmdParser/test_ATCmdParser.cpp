@@ -0,0 +1,676 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+#include "ATCmdParser.h"
+#include "mbed_poll_stub.h"
+#include "mbed_thread_stub.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using mbed::ATCmdParser;
+using std::string;
+using std::vector;
+
+// the values one recv() can store, each big enough for any line
+#define VALUE_SLOTS 8
+#define VALUE_SIZE 256
+
+// a port that gives the parser the bytes of a script, then times out
+class ScriptPort : public mbed::FileHandle {
+public:
+    explicit ScriptPort(const string &script) : script(script), at(0)
+    {
+    }
+
+    size_t consumed() const
+    {
+        return at;
+    }
+
+    // more bytes that came after the script
+    void receive(const string &more)
+    {
+        script += more;
+    }
+
+    // what the parser wrote
+    string written;
+
+    virtual ssize_t read(void *buffer, size_t size)
+    {
+        if (at == script.size()) {
+            return -EAGAIN;
+        }
+        size_t length = std::min(size, script.size() - at);
+        memcpy(buffer, script.data() + at, length);
+        at += length;
+        return length;
+    }
+
+    virtual ssize_t write(const void *buffer, size_t size)
+    {
+        written.append(static_cast<const char *>(buffer), size);
+        return size;
+    }
+
+    virtual short poll(short events) const
+    {
+        return (at < script.size() ? POLLIN : 0) | POLLOUT;
+    }
+
+    virtual off_t seek(off_t offset, int whence)
+    {
+        return -ESPIPE;
+    }
+
+    virtual int close()
+    {
+        return 0;
+    }
+
+private:
+    string script;
+    size_t at;
+};
+
+// the values a recv() stored
+struct Values {
+    char slot[VALUE_SLOTS][VALUE_SIZE];
+
+    Values()
+    {
+        memset(slot, 0, sizeof(slot));
+    }
+};
+
+// recv() of the line by line sscanf matching the parser had before it
+// compiled the lines, on the bytes of script from at on
+class ReferenceParser {
+public:
+    ReferenceParser(const string &script, int buffer_size)
+        : script(script), at(0), buffer(buffer_size), in_prev(0), oob_count(0)
+    {
+    }
+
+    void oob(const char *prefix)
+    {
+        oobs.push_back(prefix);
+    }
+
+    bool recv(const char *response, Values &values);
+
+    size_t consumed() const
+    {
+        return at;
+    }
+
+    int oobs_seen() const
+    {
+        return oob_count;
+    }
+
+private:
+    int getc()
+    {
+        return at < script.size() ? (unsigned char)script[at++] : -1;
+    }
+
+    string script;
+    size_t at;
+    vector<char> buffer;
+    char in_prev;
+    vector<string> oobs;
+    int oob_count;
+};
+
+bool ReferenceParser::recv(const char *response, Values &values)
+{
+    char *_buffer = buffer.data();
+    int _buffer_size = buffer.size();
+restart:
+    while (response[0]) {
+        int i = 0;
+        int offset = 0;
+        bool whole_line_wanted = false;
+
+        while (response[i]) {
+            if (response[i] == '%' && response[i + 1] != '%' && response[i + 1] != '*') {
+                _buffer[offset++] = '%';
+                _buffer[offset++] = '*';
+                i++;
+            } else {
+                _buffer[offset++] = response[i++];
+                if (response[i - 1] == '\n' && !(i >= 3 && response[i - 3] == '[' && response[i - 2] == '^')) {
+                    whole_line_wanted = true;
+                    break;
+                }
+            }
+        }
+        _buffer[offset++] = '%';
+        _buffer[offset++] = 'n';
+        _buffer[offset++] = 0;
+
+        int j = 0;
+        while (true) {
+            int c = getc();
+            if (c < 0) {
+                return false;
+            }
+            if ((c == '\r' && in_prev != '\n') ||
+                    (c == '\n' && in_prev != '\r')) {
+                in_prev = c;
+                c = '\n';
+            } else if ((c == '\r' && in_prev == '\n') ||
+                       (c == '\n' && in_prev == '\r')) {
+                in_prev = c;
+                continue;
+            } else {
+                in_prev = c;
+            }
+            _buffer[offset + j++] = c;
+            _buffer[offset + j] = 0;
+
+            for (size_t k = 0; k < oobs.size(); k++) {
+                if ((size_t)j == oobs[k].size() &&
+                        memcmp(oobs[k].data(), _buffer + offset, j) == 0) {
+                    oob_count++;
+                    goto restart;
+                }
+            }
+
+            int count = -1;
+            if (!whole_line_wanted || c == '\n') {
+                sscanf(_buffer + offset, _buffer, &count);
+            }
+            if (count == j) {
+                memcpy(_buffer, response, i);
+                _buffer[i] = 0;
+                sscanf(_buffer + offset, _buffer, values.slot[0], values.slot[1],
+                       values.slot[2], values.slot[3], values.slot[4],
+                       values.slot[5], values.slot[6], values.slot[7]);
+                response += i;
+                break;
+            }
+
+            if (c == '\n' || j + 1 >= _buffer_size - offset) {
+                j = 0;
+            }
+        }
+    }
+    return true;
+}
+
+class TestATCmdParser : public testing::Test {
+public:
+    // counts the callbacks of the oob
+    void seen()
+    {
+        oob_count++;
+    }
+
+protected:
+    virtual void SetUp()
+    {
+        // the port answers poll() itself, the stub only has to let it
+        mbed_poll_stub::revents_value = POLLIN | POLLOUT;
+        mbed_poll_stub::int_value = 1;
+    }
+
+    // runs recv(response) on script with both parsers, and checks that
+    // they return, store and consume the same
+    void compare(const char *response, const string &script)
+    {
+        ScriptPort port(script);
+        ATCmdParser parser(&port, "\r\n", 256, 1);
+        ReferenceParser reference(script, 256);
+        parser.oob("+IPD", mbed::callback(this, &TestATCmdParser::seen));
+        reference.oob("+IPD");
+        oob_count = 0;
+
+        Values got;
+        Values expected;
+        bool matched = parser.recv(response, got.slot[0], got.slot[1],
+                                   got.slot[2], got.slot[3], got.slot[4],
+                                   got.slot[5], got.slot[6], got.slot[7]);
+        bool reference_matched = reference.recv(response, expected);
+
+        SCOPED_TRACE(testing::Message() << "format \"" << response
+                     << "\" on \"" << script << "\"");
+        ASSERT_EQ(reference_matched, matched);
+        EXPECT_EQ(reference.consumed(), port.consumed());
+        EXPECT_EQ(reference.oobs_seen(), oob_count);
+        for (int i = 0; i < VALUE_SLOTS; i++) {
+            EXPECT_EQ(0, memcmp(expected.slot[i], got.slot[i], VALUE_SIZE)) << "value " << i;
+        }
+    }
+
+    int oob_count;
+};
+
+TEST_F(TestATCmdParser, recv_join_reply)
+{
+    ScriptPort port("busy p...\r\n+CWJAP:\"IAC Net\",\"a0:b1:c2:d3:e4:f5\",-7\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    char ssid[33];
+    char bssid[18];
+    int channel = 0;
+
+    EXPECT_TRUE(parser.recv("+CWJAP:\"%32[^\"]\",\"%17[^\"]\",%d", ssid, bssid, &channel));
+    EXPECT_STREQ("IAC Net", ssid);
+    EXPECT_STREQ("a0:b1:c2:d3:e4:f5", bssid);
+    EXPECT_EQ(-7, channel);
+}
+
+TEST_F(TestATCmdParser, recv_lines)
+{
+    ScriptPort port("+CWMODE_DEF:2\r\n\r\nOK\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    signed char mode = 0;
+
+    EXPECT_TRUE(parser.recv("+CWMODE_DEF:%hhd\nOK", &mode));
+    EXPECT_EQ(2, mode);
+    EXPECT_EQ(19u, port.consumed());
+}
+
+TEST_F(TestATCmdParser, recv_timeout)
+{
+    ScriptPort port("+CIPRECVDATA,:\r\n+CIPRECVDATA,-:\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    int length = 0;
+
+    EXPECT_FALSE(parser.recv("+CIPRECVDATA,%d:", &length));
+    EXPECT_EQ(0, length);
+}
+
+TEST_F(TestATCmdParser, recv_matches_sscanf)
+{
+    // the formats of the tree, and some that go through each step and the
+    // sscanf fallback
+    static const char *const formats[] = {
+        "+CWJAP:\"%32[^\"]\",\"%17[^\"]\",%d",
+        "+CWJAP_CUR:\"%*[^\"]\",\"%17[^\"]\"",
+        "+CIPDOMAIN:%15[0-9.]",
+        "+CIPDOMAIN:%s%*[\r]%*[\n]",
+        "+CIPSTA_CUR:ip:\"%15[^\"]\"",
+        "+CIFSR:STAIP,\"%15[^\"]\"",
+        "+CIPRECVDATA,%d:",
+        "%d,%d,%15[^,],%d:",
+        "%d,%d:",
+        "%d,%d\n",
+        "%d\n",
+        "SDK version:%d.%d.%d",
+        "AT version:%d.%d.%d.%d",
+        "+CWMODE_DEF:%hhd",
+        "+CWMODE_DEF:%hhd\nOK",
+        "%12[^\"]\n",
+        "OK",
+        "OK\n",
+        ">",
+        "SEND OK",
+        "ready",
+        "%3d,%2u %ld%n %hu",
+        "%lld:%zu %*d:%jd,%td",
+        "%4s %s,%*s",
+        "%[]a-c] %[^]-] %[-0]",
+        "+IPD,%d:",
+        "+%x,%c",
+        "%d%% %i",
+    };
+    static const char alphabet[] = "0123456789 +-,.:\"\r\n]abc%OKSEND+IPD\t";
+    std::mt19937 random(13);
+
+    for (const char *format : formats) {
+        for (int run = 0; run < 400; run++) {
+            string script;
+            int lines = random() % 4 + 1;
+            for (int line = 0; line < lines; line++) {
+                // a line like the format, with some characters changed
+                string text;
+                for (const char *f = format; *f; f++) {
+                    if (*f == '%') {
+                        f++;
+                        while (strchr("*0123456789hlzjt", *f)) {
+                            f++;
+                        }
+                        if (*f == '[') {
+                            f = strchr(f + 2, ']');
+                        }
+                        static const char *const values[] = {
+                            "42", "-7", "+3", "123456", "", "-", "IAC", "1.2.3.4", "a]b", "%",
+                        };
+                        text += values[random() % 10];
+                    } else {
+                        text += *f == '\n' ? "\r\n" : string(1, *f);
+                    }
+                }
+                int changes = random() % 3;
+                for (int change = 0; change < changes && !text.empty(); change++) {
+                    size_t where = random() % text.size();
+                    char c = alphabet[random() % (sizeof(alphabet) - 1)];
+                    switch (random() % 3) {
+                        case 0:
+                            text[where] = c;
+                            break;
+                        case 1:
+                            text.insert(where, 1, c);
+                            break;
+                        default:
+                            text.erase(where, 1);
+                            break;
+                    }
+                }
+                if (random() % 8 == 0) {
+                    text.insert(random() % (text.size() + 1), 1, '\0');
+                }
+                script += text + "\r\n";
+            }
+            compare(format, script);
+        }
+    }
+}
+
+TEST_F(TestATCmdParser, recv_long_line)
+{
+    // a line that fills the buffer starts over, as it did with sscanf
+    string numbers;
+    for (int i = 0; i < 150; i++) {
+        numbers += "1,";
+    }
+    compare("%d,%d:", numbers + "2:\r\n3,4:\r\n");
+    compare("%d,%d:", numbers + "\r\n3,4:\r\n");
+    compare("%s\n", string(400, 'x') + "\r\n");
+}
+
+TEST_F(TestATCmdParser, recv_failure_line)
+{
+    ScriptPort port("+CIPSTART:ERROR 3\r\nERROR CODE:0x0108\r\nERROR\r\nOK\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    parser.fail("ERROR");
+
+    // only the whole line fails the command
+    EXPECT_TRUE(parser.send("AT+CIPSTART=0"));
+    EXPECT_FALSE(parser.recv("OK"));
+    EXPECT_TRUE(parser.failed());
+    EXPECT_EQ(44u, port.consumed());
+    EXPECT_FALSE(parser.recv("OK"));
+    EXPECT_EQ(44u, port.consumed());
+
+    // the next command is answered again
+    EXPECT_TRUE(parser.send("AT"));
+    EXPECT_FALSE(parser.failed());
+    EXPECT_TRUE(parser.recv("OK"));
+}
+
+TEST_F(TestATCmdParser, recv_failure_line_wanted)
+{
+    ScriptPort port("ERROR\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    parser.fail("ERROR");
+
+    EXPECT_TRUE(parser.recv("ERROR"));
+    EXPECT_FALSE(parser.failed());
+}
+
+class TestATCmdParserCommands : public TestATCmdParser {
+protected:
+    virtual void SetUp()
+    {
+        TestATCmdParser::SetUp();
+        mbed_thread_stub::ms_count = 1000;
+    }
+
+    // a command whose callback records what became of it
+    struct Recorded {
+        ATCmdParser::command cmd;
+        int calls;
+        ATCmdParser::command_result result;
+        string line;
+    };
+
+    static void recordDone(Recorded *recorded, ATCmdParser::command_result result,
+                           const char *line)
+    {
+        recorded->calls++;
+        recorded->result = result;
+        recorded->line = line ? line : "(none)";
+    }
+
+    static void setUp(Recorded &recorded, const char *text, const char *response,
+                      int timeout = 100)
+    {
+        recorded.cmd.text = text;
+        recorded.cmd.response = response;
+        recorded.cmd.timeout = timeout;
+        recorded.cmd.done = mbed::callback(recordDone, &recorded);
+        recorded.calls = 0;
+    }
+};
+
+TEST_F(TestATCmdParserCommands, submit_answered)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Recorded status;
+    setUp(status, "AT+CIPSTATUS", "STATUS:%d\nOK");
+
+    ASSERT_TRUE(parser.submit(&status.cmd));
+    EXPECT_EQ("AT+CIPSTATUS\r\n", port.written);
+    EXPECT_FALSE(parser.process_commands());
+    EXPECT_EQ(100, parser.next_timeout());
+
+    // the lines come in pieces, nothing waits for the rest
+    port.receive("STAT");
+    EXPECT_TRUE(parser.process_commands());
+    port.receive("US:2\r\n\r\nO");
+    EXPECT_TRUE(parser.process_commands());
+    EXPECT_EQ(0, status.calls);
+    port.receive("K\r\n");
+    EXPECT_TRUE(parser.process_commands());
+    EXPECT_EQ(1, status.calls);
+    EXPECT_EQ(ATCmdParser::COMMAND_OK, status.result);
+    EXPECT_EQ("STATUS:2", status.line);
+    EXPECT_EQ(-1, parser.next_timeout());
+}
+
+TEST_F(TestATCmdParserCommands, submit_pipeline)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Recorded first;
+    Recorded second;
+    Recorded third;
+    setUp(first, "AT+CWMODE?", "+CWMODE:%d");
+    setUp(second, "AT+CIPMUX?", "+CIPMUX:%d");
+    setUp(third, "AT", "OK");
+    parser.set_pipeline(2);
+
+    ASSERT_TRUE(parser.submit(&first.cmd));
+    ASSERT_TRUE(parser.submit(&second.cmd));
+    ASSERT_TRUE(parser.submit(&third.cmd));
+    EXPECT_EQ("AT+CWMODE?\r\nAT+CIPMUX?\r\n", port.written);
+
+    port.receive("+CIPMUX:1\r\n+CWMODE:3\r\nOK\r\n+CIPMUX:1\r\n");
+    parser.process_commands();
+    EXPECT_EQ("+CWMODE:3", first.line);
+    EXPECT_EQ("+CIPMUX:1", second.line);
+    EXPECT_EQ(0, third.calls);
+    EXPECT_EQ("AT+CWMODE?\r\nAT+CIPMUX?\r\nAT\r\n", port.written);
+
+    port.receive("OK\r\n");
+    parser.process_commands();
+    EXPECT_EQ(1, third.calls);
+    EXPECT_EQ(ATCmdParser::COMMAND_OK, third.result);
+}
+
+TEST_F(TestATCmdParserCommands, submit_timeout)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Recorded lost;
+    Recorded next;
+    setUp(lost, "AT+CIFSR", "OK", 20);
+    setUp(next, "AT", "OK", 20);
+
+    ASSERT_TRUE(parser.submit(&lost.cmd));
+    ASSERT_TRUE(parser.submit(&next.cmd));
+    mbed_thread_stub::ms_count += 19;
+    EXPECT_EQ(1, parser.next_timeout());
+    parser.process_commands();
+    EXPECT_EQ(0, lost.calls);
+
+    mbed_thread_stub::ms_count += 1;
+    parser.process_commands();
+    EXPECT_EQ(1, lost.calls);
+    EXPECT_EQ(ATCmdParser::COMMAND_TIMEOUT, lost.result);
+    EXPECT_EQ("AT+CIFSR\r\nAT\r\n", port.written);
+    EXPECT_EQ(20, parser.next_timeout());
+
+    port.receive("OK\r\n");
+    parser.process_commands();
+    EXPECT_EQ(ATCmdParser::COMMAND_OK, next.result);
+}
+
+TEST_F(TestATCmdParserCommands, submit_failure_and_oob)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    parser.fail("ERROR");
+    parser.oob("WIFI GOT IP", mbed::callback(this, &TestATCmdParser::seen));
+    oob_count = 0;
+    Recorded start;
+    Recorded wanted;
+    setUp(start, "AT+CIPSTART=0", "OK");
+    setUp(wanted, "AT+CIPCLOSE=5", "ERROR");
+
+    ASSERT_TRUE(parser.submit(&start.cmd));
+    ASSERT_TRUE(parser.submit(&wanted.cmd));
+    port.receive("WIFI GOT IP\r\nERROR CODE:0x0108\r\nERROR\r\nERROR\r\n");
+    parser.process_commands();
+    EXPECT_EQ(1, oob_count);
+    EXPECT_EQ(ATCmdParser::COMMAND_FAILED, start.result);
+    EXPECT_EQ("ERROR", start.line);
+    EXPECT_EQ(ATCmdParser::COMMAND_OK, wanted.result);
+    // a failed command does not fail the blocking ones
+    EXPECT_FALSE(parser.failed());
+}
+
+TEST_F(TestATCmdParserCommands, send_waits_for_commands)
+{
+    ScriptPort port("+CWMODE:1\r\nOK\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Recorded mode;
+    setUp(mode, "AT+CWMODE?", "+CWMODE:%d\nOK");
+
+    ASSERT_TRUE(parser.submit(&mode.cmd));
+    EXPECT_TRUE(parser.send("AT+CIPMUX=1"));
+    EXPECT_EQ(1, mode.calls);
+    EXPECT_EQ(ATCmdParser::COMMAND_OK, mode.result);
+    EXPECT_EQ("AT+CWMODE?\r\nAT+CIPMUX=1\r\n", port.written);
+}
+
+TEST_F(TestATCmdParserCommands, submit_rejected_and_cancelled)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Recorded scanned;
+    Recorded empty;
+    Recorded cancelled;
+    setUp(scanned, "AT+CIPSTAMAC?", "+CIPSTAMAC:%c");
+    setUp(empty, "AT", "");
+    setUp(cancelled, "AT+RST", "ready");
+
+    EXPECT_FALSE(parser.submit(&scanned.cmd));
+    EXPECT_FALSE(parser.submit(&empty.cmd));
+    EXPECT_EQ("", port.written);
+
+    ASSERT_TRUE(parser.submit(&cancelled.cmd));
+    parser.cancel_commands();
+    EXPECT_EQ(1, cancelled.calls);
+    EXPECT_EQ(ATCmdParser::COMMAND_CANCELLED, cancelled.result);
+    EXPECT_EQ(-1, parser.next_timeout());
+}
+
+// takes the length of an +IPD message, like a handler of the ESP8266's data
+struct PacketHandler {
+    ATCmdParser *parser;
+    int length;
+
+    void onPacket()
+    {
+        parser->recv("%d:", &length);
+    }
+};
+
+TEST_F(TestATCmdParser, oob_recv_after_failure)
+{
+    ScriptPort port("ERROR\r\n+IPD,5:hello\r\n");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    PacketHandler handler = {&parser, 0};
+    parser.fail("ERROR");
+    parser.oob("+IPD,", mbed::callback(&handler, &PacketHandler::onPacket));
+
+    EXPECT_TRUE(parser.send("AT+CIPCLOSE=0"));
+    EXPECT_FALSE(parser.recv("OK"));
+    EXPECT_TRUE(parser.failed());
+
+    // the handler's recv() is not the failed command's
+    EXPECT_TRUE(parser.process_oob());
+    EXPECT_EQ(5, handler.length);
+    EXPECT_TRUE(parser.failed());
+}
+
+// submits the next command from the callback of the one before
+struct Chain {
+    ATCmdParser *parser;
+    ATCmdParser::command commands[2];
+    int answered;
+
+    void done(ATCmdParser::command_result result, const char *line)
+    {
+        if (result == ATCmdParser::COMMAND_OK && answered++ == 0) {
+            parser->submit(&commands[1]);
+        }
+    }
+};
+
+TEST_F(TestATCmdParserCommands, submit_from_callback)
+{
+    ScriptPort port("");
+    ATCmdParser parser(&port, "\r\n", 256, 1);
+    Chain chain;
+    chain.parser = &parser;
+    chain.answered = 0;
+    for (int i = 0; i < 2; i++) {
+        chain.commands[i].text = i == 0 ? "AT+CWMODE=1" : "AT+CIPMUX=1";
+        chain.commands[i].response = "OK";
+        chain.commands[i].timeout = 100;
+        chain.commands[i].done = mbed::callback(&chain, &Chain::done);
+    }
+
+    ASSERT_TRUE(parser.submit(&chain.commands[0]));
+    port.receive("OK\r\nOK\r\n");
+    parser.process_commands();
+    EXPECT_EQ(2, chain.answered);
+    EXPECT_EQ("AT+CWMODE=1\r\nAT+CIPMUX=1\r\n", port.written);
+    EXPECT_EQ(-1, parser.next_timeout());
+}
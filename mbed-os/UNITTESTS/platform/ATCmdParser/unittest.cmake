@@ -0,0 +1,22 @@
+
+####################
+# UNIT TESTS
+####################
+
+# the real ATCmdParser.h goes in front of the stub in target_h
+set(unittest-includes
+  ${PROJECT_SOURCE_DIR}/../platform
+  ${unittest-includes}
+)
+
+set(unittest-sources
+  ../platform/source/ATCmdParser.cpp
+)
+
+set(unittest-test-sources
+  platform/ATCmdParser/test_ATCmdParser.cpp
+  stubs/FileHandle_stub.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_poll_stub.cpp
+  stubs/mbed_thread_stub.cpp
+)
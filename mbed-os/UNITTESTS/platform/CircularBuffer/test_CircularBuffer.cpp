@@ -37,3 +37,74 @@ TEST_F(TestCircularBuffer, constructor)
 {
     EXPECT_TRUE(buf);
 }
+
+TEST_F(TestCircularBuffer, push_pop_multiple)
+{
+    const int src[] = {1, 2, 3, 4, 5, 6};
+    int dest[10];
+
+    buf->push(src, 6);
+    EXPECT_EQ(6, buf->size());
+    EXPECT_EQ(4, buf->pop(dest, 4));
+    EXPECT_EQ(1, dest[0]);
+    EXPECT_EQ(4, dest[3]);
+
+    // wraps around the end of the storage
+    buf->push(mbed::Span<const int>(src, 6));
+    EXPECT_EQ(8, buf->size());
+    mbed::Span<int> popped = buf->pop(mbed::Span<int>(dest, 10));
+    EXPECT_EQ(8, popped.size());
+    EXPECT_EQ(5, dest[0]);
+    EXPECT_EQ(6, dest[1]);
+    EXPECT_EQ(1, dest[2]);
+    EXPECT_EQ(6, dest[7]);
+    EXPECT_TRUE(buf->empty());
+}
+
+TEST_F(TestCircularBuffer, push_multiple_overwrite)
+{
+    int src[12];
+    int dest[10];
+    for (int i = 0; i < 12; i++) {
+        src[i] = i;
+    }
+
+    buf->push(src, 8);
+    buf->push(src + 8, 4);
+    EXPECT_TRUE(buf->full());
+    EXPECT_EQ(10, buf->pop(dest, 10));
+    EXPECT_EQ(2, dest[0]);
+    EXPECT_EQ(11, dest[9]);
+
+    // only the last ten are kept
+    buf->push(src, 12);
+    EXPECT_TRUE(buf->full());
+    EXPECT_EQ(10, buf->pop(dest, 10));
+    EXPECT_EQ(2, dest[0]);
+    EXPECT_EQ(11, dest[9]);
+}
+
+TEST_F(TestCircularBuffer, peek_drop_multiple)
+{
+    const int src[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    mbed::Span<const int> first;
+    mbed::Span<const int> second;
+
+    EXPECT_EQ(0, buf->peek(first, second));
+    EXPECT_TRUE(first.empty());
+    EXPECT_TRUE(second.empty());
+
+    buf->push(src, 8);
+    EXPECT_EQ(6, buf->drop(6));
+    buf->push(src, 6);
+    EXPECT_EQ(8, buf->peek(first, second));
+    EXPECT_EQ(4, first.size());
+    EXPECT_EQ(7, first[0]);
+    EXPECT_EQ(2, first[3]);
+    EXPECT_EQ(4, second.size());
+    EXPECT_EQ(3, second[0]);
+    EXPECT_EQ(6, second[3]);
+
+    EXPECT_EQ(8, buf->drop(20));
+    EXPECT_TRUE(buf->empty());
+}
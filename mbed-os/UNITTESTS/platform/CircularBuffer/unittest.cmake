@@ -8,4 +8,6 @@ set(unittest-sources
 
 set(unittest-test-sources
   platform/CircularBuffer/test_CircularBuffer.cpp
+  stubs/mbed_assert_stub.c
+  stubs/mbed_critical_stub.c
 )
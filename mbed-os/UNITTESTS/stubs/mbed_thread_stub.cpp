@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2026, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "platform/mbed_thread.h"
+#include "mbed_thread_stub.h"
+
+uint64_t mbed_thread_stub::ms_count = 0;
+
+uint64_t get_ms_count(void)
+{
+    return mbed_thread_stub::ms_count;
+}
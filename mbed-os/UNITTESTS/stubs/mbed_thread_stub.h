@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2026, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MBED_THREAD_STUB_H__
+#define __MBED_THREAD_STUB_H__
+
+#include <stdint.h>
+
+namespace mbed_thread_stub {
+extern uint64_t ms_count;
+}
+
+#endif
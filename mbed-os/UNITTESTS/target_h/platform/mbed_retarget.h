@@ -20,6 +20,7 @@
 
 #include <inttypes.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 
 #include <time.h>
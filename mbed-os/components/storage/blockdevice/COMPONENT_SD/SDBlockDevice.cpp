@@ -166,6 +166,7 @@ using namespace mbed;
 #define SD_CMD0_GO_IDLE_STATE_RETRIES            MBED_CONF_SD_CMD0_IDLE_STATE_RETRIES
 #define SD_DBG                                   0      /*!< 1 - Enable debugging */
 #define SD_CMD_TRACE                             0      /*!< 1 - Enable SD command tracing */
+#define SD_BUSY_SPIN_POLLS                       16     /*!< Busy polls before _wait_ready() sleeps */
 
 #define SD_BLOCK_DEVICE_ERROR_WOULD_BLOCK        -5001  /*!< operation would block */
 #define SD_BLOCK_DEVICE_ERROR_UNSUPPORTED        -5002  /*!< unsupported operation */
@@ -637,6 +638,32 @@ const char *SDBlockDevice::get_type() const
     return "SD";
 }
 
+void SDBlockDevice::crc(bool on)
+{
+#if MBED_CONF_SD_CRC_ENABLED
+    lock();
+    _crc_on = on;
+    unlock();
+#endif
+}
+
+int SDBlockDevice::cid(uint8_t *cid)
+{
+    lock();
+    if (!_is_initialized) {
+        unlock();
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;
+    }
+    // CMD10, Response R2 (R1 byte + 16-byte block read)
+    int status = BD_ERROR_OK;
+    if (_cmd(CMD10_SEND_CID, 0x0) != 0x0 || _read_bytes(cid, 16) != 0) {
+        debug_if(SD_DBG, "Couldn't read cid response from disk\n");
+        status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    unlock();
+    return status;
+}
+
 void SDBlockDevice::debug(bool dbg)
 {
     _dbg = dbg;
@@ -826,7 +853,7 @@ int SDBlockDevice::_cmd(SDBlockDevice::cmdSupported cmd, uint32_t arg, bool isAc
     }
 
     // Do not deselect card if read is in progress.
-    if (((CMD9_SEND_CSD == cmd) || (ACMD22_SEND_NUM_WR_BLOCKS == cmd) ||
+    if (((CMD9_SEND_CSD == cmd) || (CMD10_SEND_CID == cmd) || (ACMD22_SEND_NUM_WR_BLOCKS == cmd) ||
             (CMD24_WRITE_BLOCK == cmd) || (CMD25_WRITE_MULTIPLE_BLOCK == cmd) ||
             (CMD17_READ_SINGLE_BLOCK == cmd) || (CMD18_READ_MULTIPLE_BLOCK == cmd))
             && (BD_ERROR_OK == status)) {
@@ -926,7 +953,13 @@ int SDBlockDevice::_read(uint8_t *buffer, uint32_t length)
     }
 
     // read data
+#if SD_ASYNC_TRANSFERS
+    if (0 != _transfer(NULL, buffer, length)) {
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+#else
     _spi.write(NULL, 0, (char *)buffer, length);
+#endif
 
     // Read the CRC16 checksum for the data block
     crc = (_spi.write(SPI_FILL_CHAR) << 8);
@@ -958,7 +991,13 @@ uint8_t SDBlockDevice::_write(const uint8_t *buffer, uint8_t token, uint32_t len
     _spi.write(token);
 
     // write the data
+#if SD_ASYNC_TRANSFERS
+    if (0 != _transfer(buffer, NULL, length)) {
+        return SPI_DATA_WRITE_ERROR;
+    }
+#else
     _spi.write((char *)buffer, length, NULL, 0);
+#endif
 
 #if MBED_CONF_SD_CRC_ENABLED
     if (_crc_on) {
@@ -1079,6 +1118,9 @@ bool SDBlockDevice::_wait_token(uint8_t token)
 bool SDBlockDevice::_wait_ready(uint16_t ms)
 {
     uint8_t response;
+#if SD_ASYNC_TRANSFERS
+    uint32_t polls = 0;
+#endif
     _spi_timer.reset();
     _spi_timer.start();
     do {
@@ -1087,11 +1129,56 @@ bool SDBlockDevice::_wait_ready(uint16_t ms)
             _spi_timer.stop();
             return true;
         }
+#if SD_ASYNC_TRANSFERS
+        // A block write keeps the card busy for a millisecond or more, let
+        // the other threads run instead of spinning on the bus
+        if (++polls > SD_BUSY_SPIN_POLLS) {
+            rtos::ThisThread::sleep_for(1);
+        }
+#endif
     } while (_spi_timer.read_ms() < ms);
     _spi_timer.stop();
     return false;
 }
 
+#if SD_ASYNC_TRANSFERS
+int SDBlockDevice::_transfer(const uint8_t *tx_buffer, uint8_t *rx_buffer, uint32_t length)
+{
+    // DSPI sends 0x00 without a tx buffer, but the card needs 0xFF while it
+    // sends. The rx buffer can double as the tx buffer, since every byte is
+    // sent before the byte at the same position is received.
+    if (tx_buffer == NULL) {
+        memset(rx_buffer, SPI_FILL_CHAR, length);
+        tx_buffer = rx_buffer;
+    }
+
+    _transfer_event = 0;
+    if (0 != _spi.transfer(tx_buffer, length, rx_buffer, rx_buffer ? length : 0,
+                           mbed::callback(this, &SDBlockDevice::_transfer_complete),
+                           SPI_EVENT_COMPLETE | SPI_EVENT_ERROR)) {
+        debug_if(SD_DBG, "_transfer: SPI busy\n");
+        return SD_BLOCK_DEVICE_ERROR_WOULD_BLOCK;
+    }
+
+    if (!_transfer_done.try_acquire_for(SD_COMMAND_TIMEOUT)) {
+        _spi.abort_transfer();
+        debug_if(SD_DBG, "_transfer: timeout\n");
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    if (!(_transfer_event & SPI_EVENT_COMPLETE) || (_transfer_event & SPI_EVENT_ERROR)) {
+        debug_if(SD_DBG, "_transfer: SPI event 0x%x\n", _transfer_event);
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+    }
+    return 0;
+}
+
+void SDBlockDevice::_transfer_complete(int event)
+{
+    _transfer_event = event;
+    _transfer_done.release();
+}
+#endif
+
 // SPI function to wait for count
 void SDBlockDevice::_spi_wait(uint8_t count)
 {
@@ -1107,6 +1194,10 @@ void SDBlockDevice::_spi_init()
     _spi.frequency(_init_sck);
     _spi.format(8, 0);
     _spi.set_default_write_value(SPI_FILL_CHAR);
+#if SD_ASYNC_TRANSFERS
+    // keep the DMA channels between blocks instead of allocating them each time
+    _spi.set_dma_usage(DMA_USAGE_ALWAYS);
+#endif
     // Initial 74 cycles required for few cards, before selecting SPI mode
     _cs = 1;
     _spi_wait(10);
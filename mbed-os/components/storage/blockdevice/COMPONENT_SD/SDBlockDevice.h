@@ -28,6 +28,16 @@
 #include "platform/platform.h"
 #include "platform/PlatformMutex.h"
 
+/* Block payloads move with SPI::transfer() and DMA, and the calling thread
+ * sleeps until the transfer completes, if the target can do it and
+ * sd.ASYNC_TRANSFERS is set */
+#if DEVICE_SPI_ASYNCH && MBED_CONF_SD_ASYNC_TRANSFERS && MBED_CONF_RTOS_PRESENT
+#define SD_ASYNC_TRANSFERS 1
+#include "rtos/Semaphore.h"
+#else
+#define SD_ASYNC_TRANSFERS 0
+#endif
+
 /** SDBlockDevice class
  *
  * Access an SD Card using SPI bus
@@ -145,6 +155,20 @@ public:
      */
     virtual int frequency(uint64_t freq);
 
+    /** Turn the CRC of the commands and data blocks on or off
+     *
+     *  @param on       true to have every command and block checked
+     *  @note Takes effect with the next init(), and needs MBED_CONF_SD_CRC_ENABLED
+     */
+    void crc(bool on);
+
+    /** Read the Card Identification register of the card
+     *
+     *  @param cid      Buffer of 16 bytes for the register
+     *  @return         0 on success or a negative error code on failure
+     */
+    int cid(uint8_t *cid);
+
     /** Get the BlockDevice class type.
      *
      *  @return         A string representation of the BlockDevice class type.
@@ -230,6 +254,15 @@ private:
     int _read(uint8_t *buffer, uint32_t length);
     int _read_bytes(uint8_t *buffer, uint32_t length);
     uint8_t _write(const uint8_t *buffer, uint8_t token, uint32_t length);
+#if SD_ASYNC_TRANSFERS
+    /* Moves a block payload with DMA. A NULL tx_buffer clocks out fill
+     * characters and a NULL rx_buffer drops what is received */
+    int _transfer(const uint8_t *tx_buffer, uint8_t *rx_buffer, uint32_t length);
+    void _transfer_complete(int event);
+
+    rtos::Semaphore _transfer_done;             /**< Released by the SPI event callback */
+    volatile int _transfer_event;               /**< SPI_EVENT_* of the last transfer */
+#endif
     int _freq(void);
 
     /* Chip Select and SPI mode select */
@@ -86,6 +86,19 @@ public:
      */
     unsigned short read_u16();
 
+    /** Set how the conversions of this pin are made, trading precision
+     * against time
+     *
+     * read_u16() still returns 16-bit values. Targets that can not change a
+     * setting keep their own one.
+     *
+     * @param bits The resolution of a conversion, such as 16, 12 or 8
+     * @param average How many conversions the hardware averages into one
+     * @param sample_cycles Extra converter clock cycles of sample time, for
+     *   sources with a high impedance. 0 for the shortest
+     */
+    void set_format(uint8_t bits, uint8_t average, uint8_t sample_cycles = 0);
+
     /** An operator shorthand for read()
      *
      * The float() operator can be used as a shorthand for read() to simplify common code sequences
@@ -112,6 +125,9 @@ public:
 
 protected:
 #if !defined(DOXYGEN_ONLY)
+    /* a group uses the same converters, so it takes the same lock */
+    friend class AnalogInGroup;
+
     virtual void lock()
     {
         _mutex->lock();
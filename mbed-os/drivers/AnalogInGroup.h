@@ -0,0 +1,117 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2019 ARM Limited
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MBED_ANALOGINGROUP_H
+#define MBED_ANALOGINGROUP_H
+
+#include "platform/platform.h"
+
+#if DEVICE_ANALOGIN || defined(DOXYGEN_ONLY)
+
+#include "hal/analogin_api.h"
+#include "platform/NonCopyable.h"
+
+namespace mbed {
+/**
+ * \defgroup drivers_AnalogInGroup AnalogInGroup class
+ * \ingroup drivers-public-api-gpio
+ * @{
+ */
+
+/** The most pins that one AnalogInGroup can read */
+#define MBED_ANALOGINGROUP_MAX 16
+
+/** A group of analog inputs, read together in one call
+ *
+ * The values of all of the pins come from one call to analogin_read_multi(),
+ * which targets implement to set up the converters once for the group, and
+ * to convert on several ADC instances at the same time.
+ *
+ * @note Synchronization level: Thread safe
+ *
+ * Example:
+ * @code
+ * // Print the voltage and the current of one circuit
+ *
+ * #include "mbed.h"
+ *
+ * const PinName pins[] = {PTB2, PTB10};
+ * AnalogInGroup circuit(pins, 2);
+ *
+ * int main() {
+ *     float values[2];
+ *     while(1) {
+ *         circuit.read(values);
+ *         printf("%f %f\n", values[0], values[1]);
+ *     }
+ * }
+ * @endcode
+ */
+class AnalogInGroup : private NonCopyable<AnalogInGroup> {
+
+public:
+
+    /** Create an AnalogInGroup, connected to the specified pins
+     *
+     * @param pins  AnalogIn pins to connect to, up to MBED_ANALOGINGROUP_MAX
+     * @param count The number of pins
+     */
+    AnalogInGroup(const PinName *pins, size_t count);
+
+    /** Read the input voltages, represented as floats in the range [0.0, 1.0]
+     *
+     * @param values Receives one value for every pin, in the order of the pins
+     */
+    void read(float *values);
+
+    /** Read the input voltages, represented as unsigned shorts in the range [0x0, 0xFFFF]
+     *
+     * @param values Receives one value for every pin, in the order of the pins
+     */
+    void read_u16(uint16_t *values);
+
+    /** The number of pins in the group
+     */
+    size_t count() const
+    {
+        return _count;
+    }
+
+    virtual ~AnalogInGroup()
+    {
+        // Do nothing
+    }
+
+protected:
+#if !defined(DOXYGEN_ONLY)
+    virtual void lock();
+
+    virtual void unlock();
+
+    analogin_t _adcs[MBED_ANALOGINGROUP_MAX];
+    analogin_t *_objs[MBED_ANALOGINGROUP_MAX];
+    size_t _count;
+#endif //!defined(DOXYGEN_ONLY)
+
+};
+
+/** @}*/
+
+} // namespace mbed
+
+#endif
+
+#endif
@@ -46,6 +46,13 @@ unsigned short AnalogIn::read_u16()
     return ret;
 }
 
+void AnalogIn::set_format(uint8_t bits, uint8_t average, uint8_t sample_cycles)
+{
+    lock();
+    analogin_set_format(&_adc, bits, average, sample_cycles);
+    unlock();
+}
+
 } // namespace mbed
 
 #endif
@@ -0,0 +1,65 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2019 ARM Limited
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "drivers/AnalogInGroup.h"
+#include "drivers/AnalogIn.h"
+#include "platform/mbed_assert.h"
+
+#if DEVICE_ANALOGIN
+
+namespace mbed {
+
+AnalogInGroup::AnalogInGroup(const PinName *pins, size_t count) : _count(count)
+{
+    MBED_ASSERT(count <= MBED_ANALOGINGROUP_MAX);
+    lock();
+    for (size_t i = 0; i < _count; i++) {
+        analogin_init(&_adcs[i], pins[i]);
+        _objs[i] = &_adcs[i];
+    }
+    unlock();
+}
+
+void AnalogInGroup::read(float *values)
+{
+    uint16_t raw[MBED_ANALOGINGROUP_MAX];
+    read_u16(raw);
+    for (size_t i = 0; i < _count; i++) {
+        values[i] = (float)raw[i] * (1.0f / (float)0xFFFF);
+    }
+}
+
+void AnalogInGroup::read_u16(uint16_t *values)
+{
+    lock();
+    analogin_read_multi(_objs, values, _count);
+    unlock();
+}
+
+void AnalogInGroup::lock()
+{
+    AnalogIn::_mutex->lock();
+}
+
+void AnalogInGroup::unlock()
+{
+    AnalogIn::_mutex->unlock();
+}
+
+} // namespace mbed
+
+#endif
@@ -178,10 +178,12 @@ ssize_t UARTSerial::write(const void *buffer, size_t length)
             } while (_txbuf.full());
         }
 
-        while (data_written < length && !_txbuf.full()) {
-            _txbuf.push(*buf_ptr++);
-            data_written++;
-        }
+        // only tx_irq() takes out of the buffer, so the room can only grow
+        size_t room = MBED_CONF_DRIVERS_UART_SERIAL_TXBUF_SIZE - _txbuf.size();
+        size_t chunk = std::min(length - data_written, room);
+        _txbuf.push(buf_ptr, chunk);
+        buf_ptr += chunk;
+        data_written += chunk;
 
         core_util_critical_section_enter();
         if (_tx_enabled && !_tx_irq_enabled) {
@@ -220,10 +222,7 @@ ssize_t UARTSerial::read(void *buffer, size_t length)
         api_lock();
     }
 
-    while (data_read < length && !_rxbuf.empty()) {
-        _rxbuf.pop(*ptr++);
-        data_read++;
-    }
+    data_read = _rxbuf.pop(ptr, length);
 
     core_util_critical_section_enter();
     if (_rx_enabled && !_rx_irq_enabled) {
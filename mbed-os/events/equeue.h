@@ -38,6 +38,33 @@ extern "C" {
 // This size is guaranteed to fit events created by event_call
 #define EQUEUE_EVENT_SIZE (sizeof(struct equeue_event) + 2*sizeof(void*))
 
+// The timing wheel of pending events
+// With EQUEUE_WHEEL_SIZE slots, the pending events are kept in one sorted
+// list per slot instead of a single sorted list, and each slot takes the
+// targets of EQUEUE_WHEEL_RESOLUTION ms in turn. A post only sorts its
+// event into the events of its own slot. Both must be powers of two
+#ifndef EQUEUE_WHEEL_SIZE
+#ifdef MBED_CONF_EVENTS_TIMER_WHEEL_SIZE
+#define EQUEUE_WHEEL_SIZE MBED_CONF_EVENTS_TIMER_WHEEL_SIZE
+#else
+#define EQUEUE_WHEEL_SIZE 0
+#endif
+#endif
+
+#ifndef EQUEUE_WHEEL_RESOLUTION
+#ifdef MBED_CONF_EVENTS_TIMER_WHEEL_RESOLUTION
+#define EQUEUE_WHEEL_RESOLUTION MBED_CONF_EVENTS_TIMER_WHEEL_RESOLUTION
+#else
+#define EQUEUE_WHEEL_RESOLUTION 1
+#endif
+#endif
+
+#if (EQUEUE_WHEEL_SIZE & (EQUEUE_WHEEL_SIZE - 1)) || \
+    (EQUEUE_WHEEL_RESOLUTION <= 0) || \
+    (EQUEUE_WHEEL_RESOLUTION & (EQUEUE_WHEEL_RESOLUTION - 1))
+#error "events.timer-wheel-size and events.timer-wheel-resolution must be powers of two"
+#endif
+
 // Internal event structure
 struct equeue_event {
     unsigned size;
@@ -58,7 +85,11 @@ struct equeue_event {
 
 // Event queue structure
 typedef struct equeue {
+#if EQUEUE_WHEEL_SIZE
+    struct equeue_event *wheel[EQUEUE_WHEEL_SIZE];
+#else
     struct equeue_event *queue;
+#endif
     unsigned tick;
     bool break_requested;
     uint8_t generation;
@@ -39,6 +39,66 @@ static inline int equeue_clampdiff(unsigned a, unsigned b)
     return ~(diff >> (8 * sizeof(int) -1)) & diff;
 }
 
+#if EQUEUE_WHEEL_SIZE
+// find the wheel slot that holds the events of a target
+static inline unsigned equeue_slot(unsigned target)
+{
+    return (target / EQUEUE_WHEEL_RESOLUTION) % EQUEUE_WHEEL_SIZE;
+}
+
+// find the pending event slot with the nearest target, walking the
+// wheel from the slot of the last dequeue until a slot holds a target of
+// the current turn of the wheel, otherwise the nearest of the later turns
+static struct equeue_event *equeue_first(equeue_t *q)
+{
+    struct equeue_event *first = 0;
+    unsigned start = q->tick - q->tick % EQUEUE_WHEEL_RESOLUTION;
+    for (unsigned i = 0; i < EQUEUE_WHEEL_SIZE; i++) {
+        struct equeue_event *e = q->wheel[equeue_slot(start)];
+        if (e && e->target - start < EQUEUE_WHEEL_RESOLUTION) {
+            return e;
+        }
+
+        if (e && (!first || equeue_tickdiff(e->target, first->target) < 0)) {
+            first = e;
+        }
+
+        start += EQUEUE_WHEEL_RESOLUTION;
+    }
+
+    return first;
+}
+
+// move the expired event slots at the front of a wheel slot to the end
+// of a list and return the new end of the list
+static struct equeue_event **equeue_expire(struct equeue_event **slot,
+                                           struct equeue_event **tail, unsigned target)
+{
+    struct equeue_event **p = slot;
+    while (*p && equeue_tickdiff((*p)->target, target) <= 0) {
+        p = &(*p)->next;
+    }
+
+    if (p == slot) {
+        return tail;
+    }
+
+    *tail = *slot;
+    *slot = *p;
+    if (*slot) {
+        (*slot)->ref = slot;
+    }
+
+    *p = 0;
+    return p;
+}
+#else
+static inline struct equeue_event *equeue_first(equeue_t *q)
+{
+    return q->queue;
+}
+#endif
+
 // Increment the unique id in an event, hiding the event from cancel
 static inline void equeue_incid(equeue_t *q, struct equeue_event *e)
 {
@@ -88,7 +148,11 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer)
     q->slab.size = size;
     q->slab.data = q->buffer;
 
+#if EQUEUE_WHEEL_SIZE
+    memset(q->wheel, 0, sizeof(q->wheel));
+#else
     q->queue = 0;
+#endif
     equeue_tick_init();
     q->tick = equeue_tick();
     q->generation = 0;
@@ -118,10 +182,9 @@ int equeue_create_inplace(equeue_t *q, size_t size, void *buffer)
     return 0;
 }
 
-void equeue_destroy(equeue_t *q)
+static void equeue_destroy_slots(struct equeue_event *queue)
 {
-    // call destructors on pending events
-    for (struct equeue_event *es = q->queue; es; es = es->next) {
+    for (struct equeue_event *es = queue; es; es = es->next) {
         for (struct equeue_event *e = es->sibling; e; e = e->sibling) {
             if (e->dtor) {
                 e->dtor(e + 1);
@@ -131,6 +194,18 @@ void equeue_destroy(equeue_t *q)
             es->dtor(es + 1);
         }
     }
+}
+
+void equeue_destroy(equeue_t *q)
+{
+    // call destructors on pending events
+#if EQUEUE_WHEEL_SIZE
+    for (unsigned i = 0; i < EQUEUE_WHEEL_SIZE; i++) {
+        equeue_destroy_slots(q->wheel[i]);
+    }
+#else
+    equeue_destroy_slots(q->queue);
+#endif
     // notify background timer
     if (q->background.update) {
         q->background.update(q->background.timer, -1);
@@ -242,7 +317,18 @@ void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
     equeue_mutex_lock(&q->queuelock);
 
     // find the event slot
+#if EQUEUE_WHEEL_SIZE
+    // a target behind the last dequeue would sit in a wheel slot that the
+    // next dequeue does not reach, so it expires at the last dequeue instead
+    if (equeue_tickdiff(e->target, q->tick) < 0) {
+        e->target = q->tick;
+        e->generation = q->generation;
+    }
+
+    struct equeue_event **p = &q->wheel[equeue_slot(e->target)];
+#else
     struct equeue_event **p = &q->queue;
+#endif
     while (*p && equeue_tickdiff((*p)->target, e->target) < 0) {
         p = &(*p)->next;
     }
@@ -269,7 +355,7 @@ void equeue_enqueue(equeue_t *q, struct equeue_event *e, unsigned tick)
 
     // notify background timer
     if ((q->background.update && q->background.active) &&
-            (q->queue == e && !e->sibling)) {
+            (!e->sibling && equeue_first(q) == e)) {
         q->background.update(q->background.timer,
                              equeue_clampdiff(e->target, tick));
     }
@@ -343,11 +429,48 @@ static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target)
     equeue_mutex_lock(&q->queuelock);
 
     // find all expired events and mark a new generation
+#if EQUEUE_WHEEL_SIZE
+    unsigned tick = q->tick;
+#endif
     q->generation += 1;
     if (equeue_tickdiff(q->tick, target) <= 0) {
         q->tick = target;
     }
 
+#if EQUEUE_WHEEL_SIZE
+    struct equeue_event *head = 0;
+    struct equeue_event **p = &head;
+    unsigned start = tick - tick % EQUEUE_WHEEL_RESOLUTION;
+    unsigned slots = (target - start) / EQUEUE_WHEEL_RESOLUTION;
+    if (slots < EQUEUE_WHEEL_SIZE) {
+        // until the wheel comes around, the expired targets of a slot all
+        // belong to the current turn, so visiting the slots from the last
+        // dequeue on finds the expired events in order
+        for (unsigned i = 0; i <= slots; i++) {
+            p = equeue_expire(&q->wheel[equeue_slot(start)], p, target);
+            start += EQUEUE_WHEEL_RESOLUTION;
+        }
+    } else {
+        // the wheel came around since the last dequeue, so take the slot
+        // with the nearest expired target until none is left
+        while (1) {
+            struct equeue_event **first = 0;
+            for (unsigned i = 0; i < EQUEUE_WHEEL_SIZE; i++) {
+                struct equeue_event *e = q->wheel[i];
+                if (e && equeue_tickdiff(e->target, target) <= 0 &&
+                        (!first || equeue_tickdiff(e->target, (*first)->target) < 0)) {
+                    first = &q->wheel[i];
+                }
+            }
+
+            if (!first) {
+                break;
+            }
+
+            p = equeue_expire(first, p, (*first)->target);
+        }
+    }
+#else
     struct equeue_event *head = q->queue;
     struct equeue_event **p = &head;
     while (*p && equeue_tickdiff((*p)->target, target) <= 0) {
@@ -360,6 +483,7 @@ static struct equeue_event *equeue_dequeue(equeue_t *q, unsigned target)
     }
 
     *p = 0;
+#endif
 
     equeue_mutex_unlock(&q->queuelock);
 
@@ -521,9 +645,10 @@ void equeue_dispatch(equeue_t *q, int ms)
                 // update background timer if necessary
                 if (q->background.update) {
                     equeue_mutex_lock(&q->queuelock);
-                    if (q->background.update && q->queue) {
+                    struct equeue_event *first = equeue_first(q);
+                    if (q->background.update && first) {
                         q->background.update(q->background.timer,
-                                             equeue_clampdiff(q->queue->target, tick));
+                                             equeue_clampdiff(first->target, tick));
                     }
                     q->background.active = true;
                     equeue_mutex_unlock(&q->queuelock);
@@ -535,8 +660,9 @@ void equeue_dispatch(equeue_t *q, int ms)
 
         // find closest deadline
         equeue_mutex_lock(&q->queuelock);
-        if (q->queue) {
-            int diff = equeue_clampdiff(q->queue->target, tick);
+        struct equeue_event *first = equeue_first(q);
+        if (first) {
+            int diff = equeue_clampdiff(first->target, tick);
             if ((unsigned)diff < (unsigned)deadline) {
                 deadline = diff;
             }
@@ -647,9 +773,10 @@ void equeue_background(equeue_t *q,
     q->background.update = update;
     q->background.timer = timer;
 
-    if (q->background.update && q->queue) {
+    struct equeue_event *first = equeue_first(q);
+    if (q->background.update && first) {
         q->background.update(q->background.timer,
-                             equeue_clampdiff(q->queue->target, equeue_tick()));
+                             equeue_clampdiff(first->target, equeue_tick()));
     }
     q->background.active = true;
     equeue_mutex_unlock(&q->queuelock);
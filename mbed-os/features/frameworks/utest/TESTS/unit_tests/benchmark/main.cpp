@@ -0,0 +1,85 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2020 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "utest/utest.h"
+#include "unity/unity.h"
+#include "utest/utest_stack_trace.h"
+
+using namespace utest::v1;
+
+static uint8_t source[64];
+static uint8_t destination[64];
+
+void bench_empty(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        benchmark_keep(&i);
+    }
+}
+
+void bench_memcpy(uint32_t iterations) {
+    for (uint32_t i = 0; i < iterations; i++) {
+        memcpy(destination, source, sizeof(source));
+        benchmark_keep(destination);
+    }
+}
+
+void test_result_order() {
+    UTEST_LOG_FUNCTION();
+    benchmark_result_t result;
+    benchmark_run(bench_memcpy, &result);
+    TEST_ASSERT_NOT_EQUAL(0, result.iterations);
+    TEST_ASSERT_EQUAL(UTEST_BENCHMARK_SAMPLES, result.samples);
+    TEST_ASSERT(result.min <= result.median);
+    TEST_ASSERT(result.median <= result.p99);
+    TEST_ASSERT(result.p99 <= result.max);
+    // 64 bytes can not be copied in fewer cycles than words
+    TEST_ASSERT(result.min >= sizeof(source) / 4 / 2);
+}
+
+void test_calibration() {
+    UTEST_LOG_FUNCTION();
+    benchmark_result_t result;
+    benchmark_run(bench_empty, &result);
+    // a sample of the calibrated iterations is long enough to be measured
+    TEST_ASSERT(result.iterations == UTEST_BENCHMARK_MAX_ITERATIONS ||
+                (uint64_t)result.iterations * (result.max + 1) >= UTEST_BENCHMARK_MIN_CYCLES / 2);
+}
+
+// Custom setup handler required for proper Greentea support
+utest::v1::status_t greentea_setup(const size_t number_of_cases) {
+    UTEST_LOG_FUNCTION();
+    GREENTEA_SETUP(60, "default_auto");
+    // Call the default reporting function
+    return greentea_test_setup_handler(number_of_cases);
+}
+
+// Specify all your test cases here
+Case cases[] = {
+    Case("Result order", test_result_order),
+    Case("Calibration", test_calibration),
+    BENCHMARK("Benchmark empty loop", bench_empty),
+    BENCHMARK("Benchmark memcpy 64 bytes", bench_memcpy)
+};
+
+// Declare your test specification with a custom setup handler
+Specification specification(greentea_setup, cases);
+
+int main()
+{
+    UTEST_LOG_FUNCTION();
+    Harness::run(specification);
+}
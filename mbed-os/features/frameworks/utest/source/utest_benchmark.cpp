@@ -0,0 +1,133 @@
+/****************************************************************************
+ * Copyright (c) 2020, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************
+ */
+
+#include "utest/utest_default_handlers.h"
+
+#include "utest/utest_benchmark.h"
+#include "utest/utest_default_handlers.h"
+#include "utest/utest_serial.h"
+#include "greentea-client/test_env.h"
+#include "cmsis.h"
+#include "hal/us_ticker_api.h"
+#include <stdio.h>
+
+using namespace utest::v1;
+
+static const char *current_description = "";
+
+#if !defined(__GNUC__) && !defined(__clang__)
+const void *volatile utest::v1::benchmark_sink;
+#endif
+
+// sorts the samples, there are only UTEST_BENCHMARK_SAMPLES of them
+static void sort_samples(uint32_t *samples, size_t count)
+{
+    for (size_t i = 1; i < count; i++) {
+        uint32_t value = samples[i];
+        size_t j = i;
+        for (; j > 0 && samples[j - 1] > value; j--) {
+            samples[j] = samples[j - 1];
+        }
+        samples[j] = value;
+    }
+}
+
+// the cycles that body takes for iterations
+static uint32_t measure(benchmark_handler_t body, uint32_t iterations)
+{
+    uint32_t start = benchmark_cycles();
+    body(iterations);
+    return benchmark_cycles() - start;
+}
+
+uint32_t utest::v1::benchmark_cycles()
+{
+#if defined(DWT) && defined(DWT_CTRL_CYCCNTENA_Msk)
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+    return DWT->CYCCNT;
+#else
+    // a core without a cycle counter, to the microsecond
+    return us_ticker_read() * (SystemCoreClock / 1000000);
+#endif
+}
+
+void utest::v1::benchmark_run(benchmark_handler_t body, benchmark_result_t *result)
+{
+    for (int i = 0; i < UTEST_BENCHMARK_WARMUP; i++) {
+        body(1);
+    }
+
+    // what calling the body costs without running anything
+    uint32_t overhead = UINT32_MAX;
+    for (int i = 0; i < UTEST_BENCHMARK_WARMUP; i++) {
+        uint32_t cycles = measure(body, 0);
+        if (cycles < overhead) {
+            overhead = cycles;
+        }
+    }
+
+    uint32_t iterations = 1;
+    while (iterations < UTEST_BENCHMARK_MAX_ITERATIONS &&
+            measure(body, iterations) < UTEST_BENCHMARK_MIN_CYCLES) {
+        iterations *= 2;
+    }
+
+    uint32_t samples[UTEST_BENCHMARK_SAMPLES];
+    for (int i = 0; i < UTEST_BENCHMARK_SAMPLES; i++) {
+        uint32_t cycles = measure(body, iterations);
+        cycles = cycles > overhead ? cycles - overhead : 0;
+        samples[i] = cycles / iterations;
+    }
+    sort_samples(samples, UTEST_BENCHMARK_SAMPLES);
+
+    result->iterations = iterations;
+    result->samples = UTEST_BENCHMARK_SAMPLES;
+    result->min = samples[0];
+    result->median = samples[UTEST_BENCHMARK_SAMPLES / 2];
+    result->p99 = samples[(UTEST_BENCHMARK_SAMPLES * 99) / 100];
+    result->max = samples[UTEST_BENCHMARK_SAMPLES - 1];
+}
+
+void utest::v1::benchmark_report(const char *description, const benchmark_result_t &result)
+{
+    utest_printf(">>> '%s': %lu iterations, cycles min %lu median %lu p99 %lu max %lu\n",
+                 description, (unsigned long)result.iterations,
+                 (unsigned long)result.min, (unsigned long)result.median,
+                 (unsigned long)result.p99, (unsigned long)result.max);
+
+    char value[128];
+    snprintf(value, sizeof(value), "%s,%lu,%lu,%lu,%lu,%lu,%lu", description,
+             (unsigned long)result.iterations, (unsigned long)result.min,
+             (unsigned long)result.median, (unsigned long)result.p99,
+             (unsigned long)result.max, (unsigned long)SystemCoreClock);
+    greentea_send_kv("benchmark", value);
+}
+
+status_t utest::v1::benchmark_case_setup_handler(const Case *const source, const size_t index_of_case)
+{
+    current_description = source->get_description();
+    return greentea_case_setup_handler(source, index_of_case);
+}
+
+const char *utest::v1::benchmark_description()
+{
+    return current_description;
+}
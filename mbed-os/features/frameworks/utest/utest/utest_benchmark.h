@@ -0,0 +1,141 @@
+/****************************************************************************
+ * Copyright (c) 2020, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************
+ */
+
+#include "utest/utest_default_handlers.h"
+#ifndef UTEST_BENCHMARK_H
+#define UTEST_BENCHMARK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utest/utest_case.h"
+#include "utest/utest_types.h"
+
+/** How often the body runs before anything is measured */
+#ifndef UTEST_BENCHMARK_WARMUP
+#define UTEST_BENCHMARK_WARMUP 3
+#endif
+
+/** How many times the calibrated number of iterations is measured */
+#ifndef UTEST_BENCHMARK_SAMPLES
+#define UTEST_BENCHMARK_SAMPLES 31
+#endif
+
+/** The iterations are doubled until one sample takes at least this many
+ *  cycles, so the cost of reading the counter does not matter */
+#ifndef UTEST_BENCHMARK_MIN_CYCLES
+#define UTEST_BENCHMARK_MIN_CYCLES 20000
+#endif
+
+/** The most iterations of one sample */
+#ifndef UTEST_BENCHMARK_MAX_ITERATIONS
+#define UTEST_BENCHMARK_MAX_ITERATIONS (1UL << 20)
+#endif
+
+/** Declares a benchmark case, see benchmark_handler_t for the body.
+ *
+ *  @code
+ *  void bench_memcpy(uint32_t iterations)
+ *  {
+ *      for (uint32_t i = 0; i < iterations; i++) {
+ *          memcpy(dst, src, sizeof(src));
+ *          benchmark_keep(dst);
+ *      }
+ *  }
+ *
+ *  Case cases[] = {
+ *      BENCHMARK("memcpy 64 bytes", bench_memcpy)
+ *  };
+ *  @endcode
+ */
+#define BENCHMARK(description, body) \
+    utest::v1::Case(description, utest::v1::benchmark_case_setup_handler, \
+                    utest::v1::benchmark_case<body>)
+
+namespace utest {
+/** \addtogroup frameworks */
+/** @{*/
+namespace v1 {
+
+    /** The body of a benchmark, it runs what is measured iterations times */
+    typedef void (*benchmark_handler_t)(uint32_t iterations);
+
+    /** What benchmark_run() measured, the cycles are of one iteration, with
+     *  the cost of calling the body taken out */
+    struct benchmark_result_t {
+        uint32_t iterations;    ///< iterations of one sample
+        uint32_t samples;       ///< how many samples were taken
+        uint32_t min;
+        uint32_t median;
+        uint32_t p99;
+        uint32_t max;
+    };
+
+    /** Keeps the compiler from leaving out the computation of value */
+#if defined(__GNUC__) || defined(__clang__)
+    inline void benchmark_keep(const void *value)
+    {
+        __asm volatile("" : : "r"(value) : "memory");
+    }
+#else
+    extern const void *volatile benchmark_sink;
+
+    inline void benchmark_keep(const void *value)
+    {
+        benchmark_sink = value;
+    }
+#endif
+
+    /** Returns the core cycle counter, the DWT's where there is one */
+    uint32_t benchmark_cycles();
+
+    /** Warms the body up, calibrates its iterations and measures it.
+     *
+     *  @param body     what is measured
+     *  @param result   filled with the cycles of one iteration
+     */
+    void benchmark_run(benchmark_handler_t body, benchmark_result_t *result);
+
+    /** Prints the result of the benchmark called description, and sends it
+     *  to the host as the key "benchmark" with the value
+     *  "description,iterations,min,median,p99,max,core hz" */
+    void benchmark_report(const char *description,
+                          const benchmark_result_t &result);
+
+    /** The setup handler of BENCHMARK(), it keeps the description of the
+     *  case for benchmark_case() and calls greentea_case_setup_handler */
+    status_t benchmark_case_setup_handler(const Case *const source,
+                                          const size_t index_of_case);
+
+    /** Returns the description of the benchmark that is running */
+    const char *benchmark_description();
+
+    /** The case handler of BENCHMARK() */
+    template <benchmark_handler_t body>
+    void benchmark_case()
+    {
+        benchmark_result_t result;
+        benchmark_run(body, &result);
+        benchmark_report(benchmark_description(), result);
+    }
+
+}   // namespace v1
+}   // namespace utest
+
+#endif // UTEST_BENCHMARK_H
+
+/** @}*/
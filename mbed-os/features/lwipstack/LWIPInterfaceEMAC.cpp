@@ -178,6 +178,11 @@ err_t LWIP::Interface::emac_if_init(struct netif *netif)
 
     netif->linkoutput = &LWIP::Interface::emac_low_level_output;
 
+#if MBED_CONF_LWIP_EMAC_CHECKSUM_OFFLOAD
+    /* ICMPv6 is still checksummed here, the EMAC does the rest */
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_GEN_ICMP6 | NETIF_CHECKSUM_CHECK_ICMP6);
+#endif
+
     return err;
 }
 
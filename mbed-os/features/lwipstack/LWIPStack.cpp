@@ -244,6 +244,14 @@ nsapi_error_t LWIP::socket_open(nsapi_socket_t *handle, nsapi_protocol_t proto)
         return NSAPI_ERROR_NO_SOCKET;
     }
 
+#if LWIP_TCP && MBED_CONF_LWIP_BULK_UPLINK
+    // Nagle would hold the last, partial segment of each batch back until
+    // the full ones before it are acknowledged
+    if (proto == NSAPI_TCP) {
+        tcp_nagle_disable(s->conn->pcb.tcp);
+    }
+#endif
+
     netconn_set_recvtimeout(s->conn, 1);
     *(struct mbed_lwip_socket **)handle = s;
     return 0;
@@ -146,16 +146,23 @@
 // Number of simultaneously queued TCP segments.
 #ifdef MBED_CONF_LWIP_MEMP_NUM_TCP_SEG
 #define MEMP_NUM_TCP_SEG            MBED_CONF_LWIP_MEMP_NUM_TCP_SEG
+#elif MBED_CONF_LWIP_BULK_UPLINK
+// TCP_SND_QUEUELEN of the bulk send buffer
+#define MEMP_NUM_TCP_SEG            24
 #endif
 
 // TCP Maximum segment size.
 #ifdef MBED_CONF_LWIP_TCP_MSS
 #define TCP_MSS                     MBED_CONF_LWIP_TCP_MSS
+#elif MBED_CONF_LWIP_BULK_UPLINK
+#define TCP_MSS                     1460
 #endif
 
 // TCP sender buffer space (bytes).
 #ifdef MBED_CONF_LWIP_TCP_SND_BUF
 #define TCP_SND_BUF                 MBED_CONF_LWIP_TCP_SND_BUF
+#elif MBED_CONF_LWIP_BULK_UPLINK
+#define TCP_SND_BUF                 (6 * TCP_MSS)
 #endif
 
 // TCP sender buffer space (bytes).
@@ -198,6 +205,9 @@
 #ifdef MBED_CONF_LWIP_MEM_SIZE
 #undef MEM_SIZE
 #define MEM_SIZE                    MBED_CONF_LWIP_MEM_SIZE
+#elif MBED_CONF_LWIP_BULK_UPLINK
+// The send buffer, and room for the frames the driver receives
+#define MEM_SIZE                    (TCP_SND_BUF + 4 * 1536)
 #endif
 
 // One tcp_pcb_listen is needed for each TCPServer.
@@ -390,6 +400,12 @@
 // Checksum-on-copy disabled due to https://savannah.nongnu.org/bugs/?50914
 #define LWIP_CHECKSUM_ON_COPY       0
 
+// The EMAC computes and checks the checksums itself, lwIP leaves them to it
+// on its netif only, PPP still needs them from lwIP
+#if MBED_CONF_LWIP_EMAC_CHECKSUM_OFFLOAD
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
+#endif
+
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
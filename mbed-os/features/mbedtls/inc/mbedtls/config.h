@@ -780,6 +780,25 @@
  */
 #define MBEDTLS_ECP_NIST_OPTIM
 
+/**
+ * \def MBEDTLS_ECP_FIXED_POINT_CACHE
+ *
+ * Keep the table of precomputed multiples of the base point of each curve
+ * for the lifetime of the program, instead of in the group that computed it.
+ * The groups of the ECDH and ECDSA contexts of a TLS handshake are loaded
+ * anew for every handshake, so without this every handshake computes the
+ * table again. With this, only the first one does, and it uses the largest
+ * window that MBEDTLS_ECP_WINDOW_SIZE allows since the cost is paid once.
+ *
+ * Requires: MBEDTLS_ECP_FIXED_POINT_OPTIM set to 1
+ *
+ * \note The tables are shared without a lock: only use this when at most
+ *       one thread at a time does elliptic curve operations.
+ *
+ * Uncomment this macro to keep the base point tables.
+ */
+//#define MBEDTLS_ECP_FIXED_POINT_CACHE
+
 /**
  * \def MBEDTLS_ECP_RESTARTABLE
  *
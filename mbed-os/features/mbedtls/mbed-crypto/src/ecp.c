@@ -2030,6 +2030,49 @@ cleanup:
 /*
  * Pick window size based on curve size and whether we optimize for base point
  */
+#if defined(MBEDTLS_ECP_FIXED_POINT_CACHE)
+#if MBEDTLS_ECP_FIXED_POINT_OPTIM != 1
+#error "MBEDTLS_ECP_FIXED_POINT_CACHE needs MBEDTLS_ECP_FIXED_POINT_OPTIM set to 1"
+#endif
+
+/*
+ * The tables of precomputed multiples of the base point, by group id. They
+ * are never freed, the groups that use them do not own them.
+ */
+static mbedtls_ecp_point *ecp_base_T[MBEDTLS_ECP_DP_CURVE448 + 1];
+static unsigned char ecp_base_T_size[MBEDTLS_ECP_DP_CURVE448 + 1];
+
+/*
+ * The kept table of the base point of grp, if it has T_size points
+ */
+static mbedtls_ecp_point *ecp_cached_base_T( const mbedtls_ecp_group *grp,
+                                             unsigned char T_size )
+{
+    if( grp->id == MBEDTLS_ECP_DP_NONE ||
+        (size_t) grp->id >= sizeof( ecp_base_T ) / sizeof( ecp_base_T[0] ) ||
+        ecp_base_T_size[grp->id] != T_size )
+        return( NULL );
+
+    return( ecp_base_T[grp->id] );
+}
+
+/*
+ * Keeps T as the table of the base point of grp, if there is none yet
+ */
+static int ecp_cache_base_T( const mbedtls_ecp_group *grp,
+                             mbedtls_ecp_point *T, unsigned char T_size )
+{
+    if( grp->id == MBEDTLS_ECP_DP_NONE ||
+        (size_t) grp->id >= sizeof( ecp_base_T ) / sizeof( ecp_base_T[0] ) ||
+        ecp_base_T[grp->id] != NULL )
+        return( 0 );
+
+    ecp_base_T[grp->id] = T;
+    ecp_base_T_size[grp->id] = T_size;
+    return( 1 );
+}
+#endif /* MBEDTLS_ECP_FIXED_POINT_CACHE */
+
 static unsigned char ecp_pick_window_size( const mbedtls_ecp_group *grp,
                                            unsigned char p_eq_g )
 {
@@ -2050,6 +2093,15 @@ static unsigned char ecp_pick_window_size( const mbedtls_ecp_group *grp,
     if( p_eq_g )
         w++;
 
+#if defined(MBEDTLS_ECP_FIXED_POINT_CACHE)
+    /*
+     * The table of G is computed once and kept, so it is only the cost of
+     * the multiplications that counts.
+     */
+    if( p_eq_g )
+        w = MBEDTLS_ECP_WINDOW_SIZE;
+#endif
+
     /*
      * Make sure w is within bounds.
      * (The last test is useful only for very small curves in the test suite.)
@@ -2112,6 +2164,15 @@ static int ecp_mul_comb( mbedtls_ecp_group *grp, mbedtls_ecp_point *R,
         T_ok = 1;
     }
     else
+#if defined(MBEDTLS_ECP_FIXED_POINT_CACHE)
+    /* Pre-computed table: was it kept from an earlier group? */
+    if( p_eq_g && ecp_cached_base_T( grp, T_size ) != NULL )
+    {
+        T = ecp_cached_base_T( grp, T_size );
+        T_ok = 1;
+    }
+    else
+#endif
 #if defined(MBEDTLS_ECP_RESTARTABLE)
     /* Pre-computed table: do we have one in progress? complete? */
     if( rs_ctx != NULL && rs_ctx->rsm != NULL && rs_ctx->rsm->T != NULL )
@@ -2146,7 +2207,13 @@ static int ecp_mul_comb( mbedtls_ecp_group *grp, mbedtls_ecp_point *R,
     {
         MBEDTLS_MPI_CHK( ecp_precompute_comb( grp, T, P, w, d, rs_ctx ) );
 
-        if( p_eq_g )
+        if( p_eq_g
+#if defined(MBEDTLS_ECP_FIXED_POINT_CACHE)
+            /* or keep T for the groups that are loaded later, grp does not
+             * own it then */
+            && !ecp_cache_base_T( grp, T, T_size )
+#endif
+          )
         {
             /* almost transfer ownership of T to the group, but keep a copy of
              * the pointer to use for calling the next function more easily */
@@ -2166,6 +2233,12 @@ cleanup:
     if( T == grp->T )
         T = NULL;
 
+#if defined(MBEDTLS_ECP_FIXED_POINT_CACHE)
+    /* was T kept for later groups? */
+    if( p_eq_g && T != NULL && T == ecp_cached_base_T( grp, T_size ) )
+        T = NULL;
+#endif
+
     /* does T belong to the restart context? */
 #if defined(MBEDTLS_ECP_RESTARTABLE)
     if( rs_ctx != NULL && rs_ctx->rsm != NULL && ret == MBEDTLS_ERR_ECP_IN_PROGRESS && T != NULL )
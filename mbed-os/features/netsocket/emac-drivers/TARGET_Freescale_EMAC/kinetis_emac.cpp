@@ -243,8 +243,16 @@ bool Kinetis_EMAC::low_level_init_successful()
     config.interrupt = kENET_RxFrameInterrupt | kENET_TxFrameInterrupt;
     config.rxMaxFrameLen = ENET_ETH_MAX_FLEN;
     config.macSpecialConfig = kENET_ControlFlowControlEnable;
+#if MBED_CONF_KINETIS_EMAC_CHECKSUM_OFFLOAD
+    /* The checksum fields of the frames sent are left 0 by lwIP for the
+       ENET to fill in, and received frames with a bad checksum are dropped */
+    config.txAccelerConfig = kENET_TxAccelIpCheckEnabled | kENET_TxAccelProtoCheckEnabled;
+    config.rxAccelerConfig = kENET_RxAccelMacCheckEnabled | kENET_RxAccelIpCheckEnabled |
+                             kENET_RxAccelProtoCheckEnabled;
+#else
     config.txAccelerConfig = 0;
     config.rxAccelerConfig = kENET_RxAccelMacCheckEnabled;
+#endif
     ENET_Init(ENET, &g_handle, &config, &buffCfg, hwaddr, sysClock);
 
 #if defined(TOOLCHAIN_ARM)
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2019, ARM Limited, All Rights Reserved
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Throughput and latency of a backlog of readings on each store it can be
+ * kept in: FAT and LittleFS on the SD card, LittleFS and TDBStore on the
+ * internal flash. The store's block device is wrapped in a
+ * ProfilingBlockDevice, so every phase also prints the bytes read,
+ * programmed and erased per record.
+ */
+
+#include "mbed.h"
+#include "greentea-client/test_env.h"
+#include "unity/unity.h"
+#include "utest.h"
+#include "ProfilingBlockDevice.h"
+#include "LittleFileSystem.h"
+#include "TDBStore.h"
+
+#include <algorithm>
+
+#if COMPONENT_SD
+#include "SDBlockDevice.h"
+#include "FATFileSystem.h"
+#endif
+#if COMPONENT_FLASHIAP
+#include "FlashIAPBlockDevice.h"
+#endif
+
+#if !COMPONENT_SD && !COMPONENT_FLASHIAP
+#error [NOT_SUPPORTED] storage test not supported on this platform
+#endif
+
+using namespace utest::v1;
+using namespace mbed;
+
+namespace {
+// a block of records as it is flushed from RAM
+static const size_t block_size = 512;
+static const size_t block_count = 32;
+
+// one reading as it is appended on its own
+static const size_t record_size = 32;
+static const size_t record_count = 256;
+
+static const size_t random_reads = 256;
+
+static uint8_t buffer[block_size];
+static uint32_t latency_us[record_count];
+
+#if COMPONENT_SD
+static SDBlockDevice sd(MBED_CONF_SD_SPI_MOSI, MBED_CONF_SD_SPI_MISO,
+                        MBED_CONF_SD_SPI_CLK, MBED_CONF_SD_SPI_CS);
+#endif
+#if COMPONENT_FLASHIAP
+static FlashIAPBlockDevice flashiap;
+#endif
+}
+
+/* A backlog of records on one store. The records are appended at the end and
+ * dequeued from the front, like the readings that wait for the network */
+class Backlog {
+public:
+    Backlog(const char *name, BlockDevice *bd) : name(name), profile(bd) {}
+    virtual ~Backlog() {}
+
+    virtual int start() = 0;
+    virtual int stop() = 0;
+
+    // appends a record of size bytes, the blocks are kept apart from the
+    // small records
+    virtual int append(bool block, size_t index, const void *data,
+                       size_t size) = 0;
+
+    // reads the record with the index
+    virtual int read(size_t index, void *data, size_t size) = 0;
+
+    // reads the oldest record and removes it
+    virtual int dequeue(size_t index, void *data, size_t size) = 0;
+
+    const char *name;
+    ProfilingBlockDevice profile;
+};
+
+/* The backlog as two files of a filesystem: the blocks, and the records with
+ * a cursor file that remembers how many were dequeued */
+class FileBacklog : public Backlog {
+public:
+    FileBacklog(const char *name, BlockDevice *bd, FileSystem &fs)
+        : Backlog(name, bd), fs(fs) {}
+
+    virtual int start()
+    {
+        int err = fs.reformat(&profile);
+        if (!err) {
+            err = blocks.open(&fs, "blocks", O_RDWR | O_CREAT | O_TRUNC);
+        }
+        if (!err) {
+            err = records.open(&fs, "records", O_RDWR | O_CREAT | O_TRUNC);
+        }
+        if (!err) {
+            err = cursor.open(&fs, "cursor", O_RDWR | O_CREAT | O_TRUNC);
+        }
+        return err;
+    }
+
+    virtual int stop()
+    {
+        blocks.close();
+        records.close();
+        cursor.close();
+        return fs.unmount();
+    }
+
+    virtual int append(bool block, size_t index, const void *data,
+                       size_t size)
+    {
+        File &file = block ? blocks : records;
+        file.seek(0, SEEK_END);
+        if (file.write(data, size) != (ssize_t)size) {
+            return -1;
+        }
+        return file.sync();
+    }
+
+    virtual int read(size_t index, void *data, size_t size)
+    {
+        records.seek(index * size, SEEK_SET);
+        return records.read(data, size) == (ssize_t)size ? 0 : -1;
+    }
+
+    virtual int dequeue(size_t index, void *data, size_t size)
+    {
+        int err = read(index, data, size);
+        if (!err) {
+            uint32_t next = index + 1;
+            cursor.seek(0, SEEK_SET);
+            err = cursor.write(&next, sizeof(next)) == sizeof(next) ?
+                  cursor.sync() : -1;
+        }
+        return err;
+    }
+
+private:
+    FileSystem &fs;
+    File blocks;
+    File records;
+    File cursor;
+};
+
+/* The backlog as a key for every record */
+class KVBacklog : public Backlog {
+public:
+    KVBacklog(const char *name, BlockDevice *bd)
+        : Backlog(name, bd), store(&profile) {}
+
+    virtual int start()
+    {
+        int err = store.init();
+        return err ? err : store.reset();
+    }
+
+    virtual int stop()
+    {
+        return store.deinit();
+    }
+
+    virtual int append(bool block, size_t index, const void *data,
+                       size_t size)
+    {
+        return store.set(key(block, index), data, size, 0);
+    }
+
+    virtual int read(size_t index, void *data, size_t size)
+    {
+        size_t actual = 0;
+        int err = store.get(key(false, index), data, size, &actual);
+        return err ? err : actual == size ? 0 : -1;
+    }
+
+    virtual int dequeue(size_t index, void *data, size_t size)
+    {
+        int err = read(index, data, size);
+        return err ? err : store.remove(key(false, index));
+    }
+
+private:
+    const char *key(bool block, size_t index)
+    {
+        snprintf(name_buffer, sizeof(name_buffer), "%c%05u",
+                 block ? 'b' : 'r', (unsigned)index);
+        return name_buffer;
+    }
+
+    TDBStore store;
+    char name_buffer[8];
+};
+
+// prints the rate, the latency percentiles of count operations, and what
+// they cost the block device per record
+static void report(Backlog &backlog, const char *phase, size_t count,
+                   size_t size, uint32_t total_us)
+{
+    std::sort(latency_us, latency_us + count);
+    uint64_t rate = total_us ? uint64_t(count) * size * 1000000 / total_us : 0;
+    printf("MBED: %s %s: %u ops, %u B/s, p50 %lu us, p90 %lu us, "
+           "p99 %lu us, max %lu us\n", backlog.name, phase, (unsigned)count,
+           (unsigned)rate,
+           (unsigned long)latency_us[count / 2],
+           (unsigned long)latency_us[count * 9 / 10],
+           (unsigned long)latency_us[count * 99 / 100],
+           (unsigned long)latency_us[count - 1]);
+    printf("MBED: %s %s: per record %u B read, %u B programmed, "
+           "%u B erased\n", backlog.name, phase,
+           (unsigned)(backlog.profile.get_read_count() / count),
+           (unsigned)(backlog.profile.get_program_count() / count),
+           (unsigned)(backlog.profile.get_erase_count() / count));
+}
+
+// times every call of op(i) for i below count
+template <typename Op>
+static void measure(Backlog &backlog, const char *phase, size_t count,
+                    size_t size, Op op)
+{
+    Timer timer;
+    backlog.profile.reset();
+    uint32_t total_us = 0;
+    for (size_t i = 0; i < count; i++) {
+        timer.reset();
+        timer.start();
+        int err = op(i);
+        timer.stop();
+        TEST_ASSERT_EQUAL(0, err);
+        latency_us[i] = timer.read_us();
+        total_us += latency_us[i];
+    }
+    report(backlog, phase, count, size, total_us);
+}
+
+// goes through the phases of an outage on one store
+static void test_backlog(Backlog &backlog)
+{
+    TEST_ASSERT_EQUAL(0, backlog.start());
+    for (size_t i = 0; i < block_size; i++) {
+        buffer[i] = i;
+    }
+
+    measure(backlog, "sequential append", block_count, block_size,
+    [&](size_t i) {
+        return backlog.append(true, i, buffer, block_size);
+    });
+    measure(backlog, "small record append", record_count, record_size,
+    [&](size_t i) {
+        return backlog.append(false, i, buffer, record_size);
+    });
+    measure(backlog, "random read", random_reads, record_size,
+    [&](size_t i) {
+        return backlog.read(rand() % record_count, buffer, record_size);
+    });
+    measure(backlog, "dequeue", record_count, record_size,
+    [&](size_t i) {
+        return backlog.dequeue(i, buffer, record_size);
+    });
+
+    TEST_ASSERT_EQUAL(0, backlog.stop());
+}
+
+#if COMPONENT_SD
+void test_fat_on_sd()
+{
+    static FATFileSystem fs("fat");
+    FileBacklog backlog("FAT on SD", &sd, fs);
+    test_backlog(backlog);
+}
+
+void test_littlefs_on_sd()
+{
+    static LittleFileSystem fs("sdlfs");
+    FileBacklog backlog("LittleFS on SD", &sd, fs);
+    test_backlog(backlog);
+}
+#endif
+
+#if COMPONENT_FLASHIAP
+void test_littlefs_on_flash()
+{
+    static LittleFileSystem fs("flashlfs");
+    FileBacklog backlog("LittleFS on flash", &flashiap, fs);
+    test_backlog(backlog);
+}
+
+void test_tdbstore_on_flash()
+{
+    KVBacklog backlog("TDBStore on flash", &flashiap);
+    test_backlog(backlog);
+}
+#endif
+
+utest::v1::status_t test_setup(const size_t number_of_cases)
+{
+    GREENTEA_SETUP(600, "default_auto");
+    return verbose_test_setup_handler(number_of_cases);
+}
+
+Case cases[] = {
+#if COMPONENT_SD
+    Case("Backlog on FAT on the SD card", test_fat_on_sd),
+    Case("Backlog on LittleFS on the SD card", test_littlefs_on_sd),
+#endif
+#if COMPONENT_FLASHIAP
+    Case("Backlog on LittleFS on the internal flash", test_littlefs_on_flash),
+    Case("Backlog on TDBStore on the internal flash", test_tdbstore_on_flash),
+#endif
+};
+
+Specification specification(test_setup, cases);
+
+int main()
+{
+    return !Harness::run(specification);
+}
@@ -613,6 +613,291 @@ static void error_inject_test()
     delete tdbs;
 }
 
+// Cuts the power after a number of programs and erases. The program that hits the limit only
+// writes the first half of its data and the erase erases nothing, both fail like every program
+// and erase after them, until the power is restored
+class PowerCutBlockDevice : public BlockDevice {
+public:
+    PowerCutBlockDevice(BlockDevice *bd) : _bd(bd), _ops_left(-1), _programs(0), _erases(0)
+    {
+    }
+
+    // Cuts the power once ops more programs and erases were started
+    void cut_after(int ops)
+    {
+        _ops_left = ops;
+    }
+
+    void restore()
+    {
+        _ops_left = -1;
+    }
+
+    bool is_cut() const
+    {
+        return _ops_left == 0;
+    }
+
+    uint32_t programs() const
+    {
+        return _programs;
+    }
+
+    uint32_t erases() const
+    {
+        return _erases;
+    }
+
+    void reset_counts()
+    {
+        _programs = 0;
+        _erases = 0;
+    }
+
+    virtual int init()
+    {
+        return _bd->init();
+    }
+
+    virtual int deinit()
+    {
+        return _bd->deinit();
+    }
+
+    virtual int sync()
+    {
+        return is_cut() ? BD_ERROR_DEVICE_ERROR : _bd->sync();
+    }
+
+    virtual int read(void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        return _bd->read(buffer, addr, size);
+    }
+
+    virtual int program(const void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        if (is_cut()) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+        _programs++;
+        if (_ops_left > 0 && --_ops_left == 0) {
+            bd_size_t half = size / 2 / get_program_size() * get_program_size();
+            if (half) {
+                _bd->program(buffer, addr, half);
+            }
+            return BD_ERROR_DEVICE_ERROR;
+        }
+        return _bd->program(buffer, addr, size);
+    }
+
+    virtual int erase(bd_addr_t addr, bd_size_t size)
+    {
+        if (is_cut()) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+        _erases += size / get_erase_size();
+        if (_ops_left > 0 && --_ops_left == 0) {
+            return BD_ERROR_DEVICE_ERROR;
+        }
+        return _bd->erase(addr, size);
+    }
+
+    virtual bd_size_t get_read_size() const
+    {
+        return _bd->get_read_size();
+    }
+
+    virtual bd_size_t get_program_size() const
+    {
+        return _bd->get_program_size();
+    }
+
+    virtual bd_size_t get_erase_size() const
+    {
+        return _bd->get_erase_size();
+    }
+
+    virtual bd_size_t get_erase_size(bd_addr_t addr) const
+    {
+        return _bd->get_erase_size(addr);
+    }
+
+    virtual int get_erase_value() const
+    {
+        return _bd->get_erase_value();
+    }
+
+    virtual bd_size_t size() const
+    {
+        return _bd->size();
+    }
+
+    virtual const char *get_type() const
+    {
+        return _bd->get_type();
+    }
+
+private:
+    BlockDevice *_bd;
+    int _ops_left;
+    uint32_t _programs;
+    uint32_t _erases;
+};
+
+static void incremental_gc_test()
+{
+
+#if !defined(TARGET_K64F)
+    TEST_SKIP_MESSAGE("Kvstore API tests run only on K64F devices");
+#endif
+
+#if !MBED_CONF_TDBSTORE_GC_STEP_RECORDS
+    TEST_SKIP_MESSAGE("tdbstore.gc_step_records is 0, there is no incremental garbage collection");
+#endif
+
+    char key[9];
+    uint8_t get_buf[24], set_buf[24];
+    size_t key_size = sizeof(key) - 1;
+    size_t data_size = sizeof(set_buf);
+    size_t num_keys = 'Z' - 'A' + 1;
+    size_t num_blocks = 8;
+    size_t block_size = 1024;
+    size_t num_ops = 3000;
+    size_t ops_between_cuts = 150;
+    size_t actual_data_size;
+    int result;
+    size_t i, key_ind;
+
+    // the value of every key is data_size times one byte, 0 is a key that is not there
+    uint8_t values[26];
+    uint32_t max_programs = 0, max_erases = 0, cuts = 0;
+
+    uint8_t *dummy = new (std::nothrow) uint8_t[heap_alloc_threshold_size];
+    TEST_SKIP_UNLESS_MESSAGE(dummy, "Not enough heap to run test");
+
+    // Don't use a non volatile BD here (won't work in this test)
+    HeapBlockDevice bd(num_blocks * block_size, 1,  1, block_size);
+    FlashSimBlockDevice flash_bd(&bd);
+    PowerCutBlockDevice cut_bd(&flash_bd);
+
+    result = flash_bd.init();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+    // We need to skip the test if we don't have enough memory for the heap block device.
+    // However, this device allocates the erase units on the fly, so "erase" it via the flash
+    // simulator. A failure here means we haven't got enough memory.
+    result = flash_bd.erase(0, flash_bd.size());
+    TEST_SKIP_UNLESS_MESSAGE(!result, "Not enough heap to run test");
+    result = flash_bd.deinit();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+
+    delete[] dummy;
+
+    TDBStore *tdbs = new TDBStore(&cut_bd);
+
+    result = tdbs->init();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+    result = tdbs->reset();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+
+    memset(values, 0, sizeof(values));
+    key[key_size] = '\0';
+    srand(1);
+
+    for (i = 0; i < num_ops; i++) {
+        key_ind = rand() % num_keys;
+        memset(key, 'A' + key_ind, key_size);
+        uint8_t old_value = values[key_ind];
+        uint8_t new_value = 1 + i % 255;
+
+        if ((i % ops_between_cuts) == ops_between_cuts - 1) {
+            cut_bd.cut_after(1 + rand() % 40);
+        }
+
+        // Churn the keys, and step the collection like an idle writer would now and then
+        cut_bd.reset_counts();
+        if (old_value && !(rand() % 3)) {
+            new_value = 0;
+            result = tdbs->remove(key);
+        } else {
+            memset(set_buf, new_value, data_size);
+            result = tdbs->set(key, set_buf, data_size, 0);
+        }
+        if (!cut_bd.is_cut() && (result == MBED_SUCCESS) && !(i % 7)) {
+            result = tdbs->garbage_collection_step();
+        }
+
+        if (!cut_bd.is_cut()) {
+            TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+            values[key_ind] = new_value;
+            max_programs = std::max(max_programs, cut_bd.programs());
+            max_erases = std::max(max_erases, cut_bd.erases());
+            continue;
+        }
+
+        // The power went in the middle of it, maybe of a collection. Reboot, the key that was
+        // written holds either value, every other key what it held before
+        cuts++;
+        tdbs->deinit();
+        delete tdbs;
+        cut_bd.restore();
+        tdbs = new TDBStore(&cut_bd);
+        result = tdbs->init();
+        TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+
+        result = tdbs->get(key, get_buf, data_size, &actual_data_size);
+        if (result == MBED_ERROR_ITEM_NOT_FOUND) {
+            TEST_ASSERT_TRUE(!old_value || !new_value);
+            values[key_ind] = 0;
+        } else {
+            TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+            TEST_ASSERT_EQUAL(data_size, actual_data_size);
+            TEST_ASSERT_TRUE(get_buf[0] == old_value || get_buf[0] == new_value);
+            values[key_ind] = get_buf[0];
+        }
+
+        for (size_t check_ind = 0; check_ind < num_keys; check_ind++) {
+            memset(key, 'A' + check_ind, key_size);
+            memset(set_buf, values[check_ind], data_size);
+            result = tdbs->get(key, get_buf, data_size, &actual_data_size);
+            if (values[check_ind]) {
+                TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+                TEST_ASSERT_EQUAL(data_size, actual_data_size);
+                TEST_ASSERT_EQUAL_STRING_LEN(set_buf, get_buf, data_size);
+            } else {
+                TEST_ASSERT_EQUAL_ERROR_CODE(MBED_ERROR_ITEM_NOT_FOUND, result);
+            }
+        }
+    }
+
+    // A clean reboot keeps every key too
+    result = tdbs->deinit();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+    result = tdbs->init();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+    for (key_ind = 0; key_ind < num_keys; key_ind++) {
+        memset(key, 'A' + key_ind, key_size);
+        memset(set_buf, values[key_ind], data_size);
+        result = tdbs->get(key, get_buf, data_size, &actual_data_size);
+        if (values[key_ind]) {
+            TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+            TEST_ASSERT_EQUAL_STRING_LEN(set_buf, get_buf, data_size);
+        } else {
+            TEST_ASSERT_EQUAL_ERROR_CODE(MBED_ERROR_ITEM_NOT_FOUND, result);
+        }
+    }
+
+    printf("%d operations, %d power cuts: at most %d programs and %d erases in one operation\n",
+           (int)num_ops, (int)cuts, (int)max_programs, (int)max_erases);
+
+    // A collection at once would copy every key and erase the whole standby area in one set
+    TEST_ASSERT_TRUE(max_erases < num_blocks / 2);
+
+    result = tdbs->deinit();
+    TEST_ASSERT_EQUAL_ERROR_CODE(MBED_SUCCESS, result);
+
+    delete tdbs;
+}
+
 
 utest::v1::status_t greentea_failure_handler(const Case *const source, const failure_t reason)
 {
@@ -624,6 +909,7 @@ Case cases[] = {
     Case("TDBStore: White box test",     white_box_test,    greentea_failure_handler),
     Case("TDBStore: Multiple set test",  multi_set_test,    greentea_failure_handler),
     Case("TDBStore: Error inject test",  error_inject_test, greentea_failure_handler),
+    Case("TDBStore: Incremental GC test", incremental_gc_test, greentea_failure_handler),
 };
 
 utest::v1::status_t greentea_test_setup(const size_t number_of_cases)
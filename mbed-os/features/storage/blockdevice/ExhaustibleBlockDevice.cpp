@@ -30,6 +30,25 @@ ExhaustibleBlockDevice::~ExhaustibleBlockDevice()
     delete[] _erase_array;
 }
 
+uint32_t ExhaustibleBlockDevice::get_erase_cycles(bd_addr_t addr) const
+{
+    // the cycles are only known once the device was initialized
+    if (!_erase_array) {
+        return _erase_cycles;
+    }
+
+    return _erase_array[addr / get_erase_size()];
+}
+
+void ExhaustibleBlockDevice::set_erase_cycles(bd_addr_t addr, uint32_t cycles)
+{
+    if (!_erase_array) {
+        return;
+    }
+
+    _erase_array[addr / get_erase_size()] = cycles;
+}
+
 int ExhaustibleBlockDevice::init()
 {
     int err;
@@ -364,6 +364,16 @@ int MBRBlockDevice::erase(bd_addr_t addr, bd_size_t size)
     return _bd->erase(addr + _offset, size);
 }
 
+int MBRBlockDevice::trim(bd_addr_t addr, bd_size_t size)
+{
+    MBED_ASSERT(is_valid_erase(addr, size));
+    if (!_is_initialized) {
+        return BD_ERROR_DEVICE_ERROR;
+    }
+
+    return _bd->trim(addr + _offset, size);
+}
+
 bd_size_t MBRBlockDevice::get_read_size() const
 {
     if (!_is_initialized) {
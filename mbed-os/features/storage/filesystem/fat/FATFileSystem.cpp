@@ -29,6 +29,10 @@
 #include <errno.h>
 #include <stdlib.h>
 
+#ifndef MBED_CONF_FAT_CHAN_FASTSEEK_CLMT_SIZE
+#define MBED_CONF_FAT_CHAN_FASTSEEK_CLMT_SIZE 64
+#endif
+
 namespace mbed {
 
 using namespace mbed;
@@ -527,6 +531,33 @@ int FATFileSystem::stat(const char *path, struct stat *st)
     return 0;
 }
 
+int FATFileSystem::expand(const char *path, off_t size)
+{
+#if FF_USE_EXPAND
+    FIL *fh = new FIL;
+    Deferred<const char *> fpath = fat_path_prefix(_id, path);
+
+    lock();
+    FRESULT res = f_open(fh, fpath, FA_WRITE | FA_CREATE_ALWAYS);
+    if (res == FR_OK) {
+        res = f_expand(fh, size, 1);
+        FRESULT closed = f_close(fh);
+        if (res == FR_OK) {
+            res = closed;
+        }
+    }
+    unlock();
+
+    delete fh;
+    if (res != FR_OK) {
+        debug_if(FFS_DBG, "f_expand() failed: %d\n", res);
+    }
+    return fat_error_remap(res);
+#else
+    return -ENOSYS;
+#endif
+}
+
 int FATFileSystem::statvfs(const char *path, struct statvfs *buf)
 {
 
@@ -607,6 +638,22 @@ int FATFileSystem::file_open(fs_file_t *file, const char *path, int flags)
         return fat_error_remap(res);
     }
 
+#if FF_USE_FASTSEEK
+    // A file that is only read can not grow, so the cluster chain can be
+    // mapped once and every seek after that is a table lookup. Files with
+    // too many fragments for the table keep the normal seek.
+    if (openmode == FA_READ) {
+        DWORD *clmt = new DWORD[MBED_CONF_FAT_CHAN_FASTSEEK_CLMT_SIZE];
+        clmt[0] = MBED_CONF_FAT_CHAN_FASTSEEK_CLMT_SIZE;
+        fh->cltbl = clmt;
+        if (f_lseek(fh, CREATE_LINKMAP) != FR_OK) {
+            debug_if(FFS_DBG, "f_lseek(CREATE_LINKMAP) failed, using normal seek\n");
+            fh->cltbl = NULL;
+            delete[] clmt;
+        }
+    }
+#endif
+
     unlock();
 
     *file = fh;
@@ -621,6 +668,9 @@ int FATFileSystem::file_close(fs_file_t file)
     FRESULT res = f_close(fh);
     unlock();
 
+#if FF_USE_FASTSEEK
+    delete[] fh->cltbl;
+#endif
     delete fh;
     return fat_error_remap(res);
 }
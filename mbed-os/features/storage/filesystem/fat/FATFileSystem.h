@@ -145,6 +145,19 @@ public:
      */
     virtual int mkdir(const char *path, mode_t mode);
 
+    /** Create an empty file with a contiguous area of the file system
+     *  allocated to it.
+     *
+     *  The file is size bytes long afterwards, and writes inside of it do not
+     *  allocate clusters. What the area held before is not cleared.
+     *
+     *  @param path     The name of the file to create, an existing one is truncated.
+     *  @param size     The size of the area in bytes.
+     *  @return         0 on success, negative error code on failure, -ENOSYS
+     *                  without fat_chan.ff_use_expand.
+     */
+    int expand(const char *path, off_t size);
+
     /** Store information about the mounted file system in a statvfs structure.
      *
      *  @param path     The name of the file to store information about.
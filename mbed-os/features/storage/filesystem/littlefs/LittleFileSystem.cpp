@@ -408,6 +408,57 @@ int LittleFileSystem::statvfs(const char *name, struct statvfs *st)
     return 0;
 }
 
+// how many blocks trim_free() looks at with every walk of the file system
+#define LFS_TRIM_WINDOW 4096
+
+struct lfs_trim_window {
+    lfs_block_t off;
+    uint32_t used[LFS_TRIM_WINDOW / 32];
+};
+
+static int lfs_trim_mark(void *p, lfs_block_t b)
+{
+    struct lfs_trim_window *w = (struct lfs_trim_window *)p;
+    if (b >= w->off && b - w->off < LFS_TRIM_WINDOW) {
+        lfs_block_t i = b - w->off;
+        w->used[i / 32] |= 1U << (i % 32);
+    }
+    return 0;
+}
+
+int LittleFileSystem::trim_free()
+{
+    struct lfs_trim_window *w = new struct lfs_trim_window;
+    int err = 0;
+    _mutex.lock();
+    LFS_INFO("trim_free()");
+    for (lfs_block_t off = 0; !err && off < _config.block_count;
+            off += LFS_TRIM_WINDOW) {
+        memset(w, 0, sizeof(*w));
+        w->off = off;
+        err = lfs_toerror(lfs_traverse(&_lfs, lfs_trim_mark, w));
+
+        // trims every run of unused blocks in the window at once
+        lfs_block_t end = lfs_min(LFS_TRIM_WINDOW, _config.block_count - off);
+        lfs_block_t run = 0;
+        for (lfs_block_t i = 0; !err && i <= end; i++) {
+            if (i < end && !(w->used[i / 32] & (1U << (i % 32)))) {
+                run++;
+                continue;
+            }
+            if (run > 0) {
+                err = _bd->trim((bd_addr_t)(off + i - run) * _config.block_size,
+                                (bd_size_t)run * _config.block_size);
+                run = 0;
+            }
+        }
+    }
+    LFS_INFO("trim_free -> %d", err);
+    _mutex.unlock();
+    delete w;
+    return err;
+}
+
 ////// File operations //////
 int LittleFileSystem::file_open(fs_file_t *file, const char *path, int flags)
 {
@@ -157,6 +157,17 @@ public:
      */
     virtual int statvfs(const char *path, struct statvfs *buf);
 
+    /** Trim the blocks that are not used by the file system
+     *
+     *  Removing a file frees its blocks without telling the block device.
+     *  This walks the file system and passes every run of unused blocks to
+     *  BlockDevice::trim, so that a flash-translation-layer like the one of
+     *  an SD card can erase them while it is not busy.
+     *
+     *  @return         0 on success, negative error code on failure
+     */
+    int trim_free();
+
 protected:
 #if !(DOXYGEN_ONLY)
     /** Open a file on the file system.
@@ -38,6 +38,14 @@ static const uint32_t internal_flags = delete_flag;
 // Only write once flag is supported, other two are kept in storage but ignored
 static const uint32_t supported_flags = KVStore::WRITE_ONCE_FLAG | KVStore::REQUIRE_CONFIDENTIALITY_FLAG | KVStore::REQUIRE_REPLAY_PROTECTION_FLAG;
 
+// Bytes of every key that are kept in the RAM table. Keys shorter than this are compared and
+// iterated without reading them from the BD (0 keeps none)
+#ifdef MBED_CONF_TDBSTORE_KEY_PREFIX_SIZE
+#define TDBSTORE_KEY_PREFIX_SIZE MBED_CONF_TDBSTORE_KEY_PREFIX_SIZE
+#else
+#define TDBSTORE_KEY_PREFIX_SIZE 0
+#endif
+
 namespace {
 
 typedef struct {
@@ -53,6 +61,9 @@ typedef struct {
 
 typedef struct {
     uint32_t  hash;
+#if TDBSTORE_KEY_PREFIX_SIZE
+    char      key_prefix[TDBSTORE_KEY_PREFIX_SIZE];
+#endif
     bd_size_t bd_offset;
 } ram_table_entry_t;
 
@@ -80,7 +91,25 @@ typedef struct {
 
 static const uint32_t work_buf_size = 64;
 static const uint32_t initial_crc = 0xFFFFFFFF;
+#ifdef MBED_CONF_TDBSTORE_INITIAL_MAX_KEYS
+static const uint32_t initial_max_keys = MBED_CONF_TDBSTORE_INITIAL_MAX_KEYS;
+#else
 static const uint32_t initial_max_keys = 16;
+#endif
+
+// Records walked by each step of an incremental garbage collection (0 disables it)
+#ifdef MBED_CONF_TDBSTORE_GC_STEP_RECORDS
+static const uint32_t gc_step_records = MBED_CONF_TDBSTORE_GC_STEP_RECORDS;
+#else
+static const uint32_t gc_step_records = 0;
+#endif
+
+// How full the active area gets before an incremental garbage collection starts
+#ifdef MBED_CONF_TDBSTORE_GC_START_PERCENT
+static const uint32_t gc_start_percent = MBED_CONF_TDBSTORE_GC_START_PERCENT;
+#else
+static const uint32_t gc_start_percent = 50;
+#endif
 
 // incremental set handle
 typedef struct {
@@ -91,6 +120,9 @@ typedef struct {
     uint32_t ram_table_ind;
     uint32_t hash;
     bool new_key;
+#if TDBSTORE_KEY_PREFIX_SIZE
+    char key_prefix[TDBSTORE_KEY_PREFIX_SIZE];
+#endif
 } inc_set_handle_t;
 
 // iterator handle
@@ -121,12 +153,22 @@ static uint32_t calc_crc(uint32_t init_crc, uint32_t data_size, const void *data
     return crc;
 }
 
+#if TDBSTORE_KEY_PREFIX_SIZE
+// The whole key is in the prefix if it ends inside it
+static inline bool whole_key_cached(const char *key_prefix)
+{
+    return memchr(key_prefix, 0, TDBSTORE_KEY_PREFIX_SIZE) != NULL;
+}
+#endif
+
 // Class member functions
 
 TDBStore::TDBStore(BlockDevice *bd) : _ram_table(0), _max_keys(0),
     _num_keys(0), _bd(bd), _buff_bd(0),  _free_space_offset(0), _master_record_offset(0),
     _master_record_size(0), _is_initialized(false), _active_area(0), _active_area_version(0), _size(0),
-    _area_params{}, _prog_size(0), _work_buf(0), _key_buf(0), _variant_bd_erase_unit_size(false), _inc_set_handle(0)
+    _area_params{}, _prog_size(0), _work_buf(0), _key_buf(0), _variant_bd_erase_unit_size(false), _inc_set_handle(0),
+    _gc_in_progress(false), _gc_base_offset(0), _gc_from_offset(0), _gc_to_offset(0),
+    _gc_start_offset(0)
 {
     for (int i = 0; i < _num_areas; i++) {
         _area_params[i] = { 0 };
@@ -251,7 +293,7 @@ int TDBStore::read_record(uint8_t area, uint32_t offset, char *key,
         return MBED_ERROR_INVALID_SIZE;
     }
 
-    actual_data_size = std::min(data_buf_size, data_size - data_offset);
+    actual_data_size = std::min<uint32_t>(data_buf_size, data_size - data_offset);
 
     if (copy_data && actual_data_size && !data_buf) {
         return MBED_ERROR_INVALID_ARGUMENT;
@@ -295,7 +337,7 @@ int TDBStore::read_record(uint8_t area, uint32_t offset, char *key,
             // 3. After actual part is finished - read to work buffer
             // 4. Copy data flag not set - read to work buffer
             if (curr_data_offset < data_offset) {
-                chunk_size = std::min(work_buf_size, data_offset - curr_data_offset);
+                chunk_size = std::min<uint32_t>(work_buf_size, data_offset - curr_data_offset);
                 dest_buf = _work_buf;
             } else if (copy_data && (curr_data_offset < data_offset + actual_data_size)) {
                 chunk_size = actual_data_size;
@@ -363,15 +405,34 @@ int TDBStore::find_record(uint8_t area, const char *key, uint32_t &offset,
 
     hash = calc_crc(initial_crc, strlen(key), key);
 
-    for (ram_table_ind = 0; ram_table_ind < _num_keys; ram_table_ind++) {
+    // The table is sorted by descending hash, find the first entry that is not above ours
+    uint32_t low = 0, high = _num_keys;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (ram_table[mid].hash > hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (ram_table_ind = low; ram_table_ind < _num_keys; ram_table_ind++) {
         entry = &ram_table[ram_table_ind];
         offset = entry->bd_offset;
-        if (hash < entry->hash)  {
-            continue;
-        }
         if (hash > entry->hash)  {
             return MBED_ERROR_ITEM_NOT_FOUND;
         }
+#if TDBSTORE_KEY_PREFIX_SIZE
+        // Another key with the same hash
+        if (strncmp(entry->key_prefix, key, TDBSTORE_KEY_PREFIX_SIZE)) {
+            continue;
+        }
+        // Nothing more to compare on the BD
+        if (whole_key_cached(entry->key_prefix)) {
+            ret = MBED_SUCCESS;
+            break;
+        }
+#endif
         ret = read_record(_active_area, offset, const_cast<char *>(key), 0, 0, actual_data_size, 0,
                           false, false, true, false, dummy_hash, flags, next_offset);
         // not found return code here means that hash doesn't belong to name. Continue searching.
@@ -433,10 +494,19 @@ int TDBStore::set_start(set_handle_t *handle, const char *key, size_t final_data
         // If we have no room for the record, perform garbage collection
         uint32_t rec_size = record_size(key, final_data_size);
         if (_free_space_offset + rec_size > _size) {
+            bool was_incremental = _gc_in_progress;
             ret = garbage_collection();
             if (ret) {
                 goto fail;
             }
+            // Records that were replaced while an incremental garbage collection ran are still
+            // in the new area, a full one drops them
+            if (was_incremental && (_free_space_offset + rec_size > _size)) {
+                ret = garbage_collection();
+                if (ret) {
+                    goto fail;
+                }
+            }
         }
 
         // If even after GC we have no room for the record, return error
@@ -481,6 +551,9 @@ int TDBStore::set_start(set_handle_t *handle, const char *key, size_t final_data
     ih->offset_in_data = 0;
     ih->hash = hash;
     ih->ram_table_ind = ram_table_ind;
+#if TDBSTORE_KEY_PREFIX_SIZE
+    strncpy(ih->key_prefix, key, TDBSTORE_KEY_PREFIX_SIZE);
+#endif
     ih->header.magic = tdbstore_magic;
     ih->header.header_size = sizeof(record_header_t);
     ih->header.revision = tdbstore_revision;
@@ -640,6 +713,9 @@ int TDBStore::set_finalize(set_handle_t handle)
         entry = &ram_table[ih->ram_table_ind];
         entry->hash = ih->hash;
         entry->bd_offset = ih->bd_base_offset;
+#if TDBSTORE_KEY_PREFIX_SIZE
+        memcpy(entry->key_prefix, ih->key_prefix, TDBSTORE_KEY_PREFIX_SIZE);
+#endif
     }
 
     _free_space_offset = align_up(ih->bd_curr_offset, _prog_size);
@@ -655,6 +731,12 @@ end:
     _inc_set_mutex.unlock();
 
     if (ih->bd_base_offset != _master_record_offset) {
+        // Spread the garbage collection over the writes. This comes last, as it may write the
+        // master record through the same handle. A failure here is not the record's failure,
+        // the collection starts over next time.
+        if (ret == MBED_SUCCESS) {
+            incremental_gc_step();
+        }
         _mutex.unlock();
     }
     return ret;
@@ -823,13 +905,11 @@ int TDBStore::copy_record(uint8_t from_area, uint32_t from_offset, uint32_t to_o
     return MBED_SUCCESS;
 }
 
-int TDBStore::garbage_collection()
+int TDBStore::prepare_standby_area()
 {
-    ram_table_entry_t *ram_table = (ram_table_entry_t *) _ram_table;
-    uint32_t to_offset, to_next_offset;
+    uint32_t to_offset;
     uint32_t chunk_size, reserved_size;
     int ret;
-    size_t ind;
 
     ret = check_erase_before_write(1 - _active_area, 0, _master_record_offset + _master_record_size);
     if (ret) {
@@ -858,6 +938,30 @@ int TDBStore::garbage_collection()
         }
     }
 
+    return MBED_SUCCESS;
+}
+
+int TDBStore::garbage_collection()
+{
+    ram_table_entry_t *ram_table = (ram_table_entry_t *) _ram_table;
+    uint32_t to_offset, to_next_offset;
+    int ret;
+    size_t ind;
+
+    if (_gc_in_progress) {
+        ret = incremental_gc_copy(0);
+        if (ret) {
+            _gc_in_progress = false;
+            return ret;
+        }
+        return incremental_gc_finish();
+    }
+
+    ret = prepare_standby_area();
+    if (ret) {
+        return ret;
+    }
+
     to_offset = _master_record_offset + _master_record_size;
 
     // Initialize in case table is empty
@@ -894,9 +998,133 @@ int TDBStore::garbage_collection()
         return ret;
     }
 
+    _gc_base_offset = _free_space_offset;
     return MBED_SUCCESS;
 }
 
+int TDBStore::incremental_gc_copy(uint32_t max_records)
+{
+    uint32_t offset, next_offset, to_next_offset;
+    uint32_t hash, flags, actual_data_size, ram_table_ind;
+    uint32_t walked = 0;
+    int ret;
+
+    // The active area only grows while the collection runs, so walking it in order sees every
+    // record, including the ones that are written between the steps
+    while ((_gc_from_offset < _free_space_offset) && (!max_records || (walked < max_records))) {
+        ret = read_record(_active_area, _gc_from_offset, _key_buf, 0, 0, actual_data_size, 0,
+                          true, false, false, true, hash, flags, next_offset);
+        if (ret) {
+            return ret;
+        }
+
+        bool in_use;
+        if (flags & delete_flag) {
+            // The key may have been copied before it was deleted, so a deletion made during the
+            // collection has to be copied too. Older ones are not needed anymore.
+            in_use = (_gc_from_offset >= _gc_start_offset);
+        } else {
+            ret = find_record(_active_area, _key_buf, offset, ram_table_ind, hash);
+            if ((ret != MBED_SUCCESS) && (ret != MBED_ERROR_ITEM_NOT_FOUND)) {
+                return ret;
+            }
+            in_use = (ret == MBED_SUCCESS) && (offset == _gc_from_offset);
+        }
+
+        if (in_use) {
+            ret = copy_record(_active_area, _gc_from_offset, _gc_to_offset, to_next_offset);
+            if (ret) {
+                return ret;
+            }
+            _gc_to_offset = to_next_offset;
+        }
+
+        _gc_from_offset = next_offset;
+        walked++;
+    }
+
+    return MBED_SUCCESS;
+}
+
+int TDBStore::incremental_gc_finish()
+{
+    uint32_t next_offset;
+    int ret;
+
+    _gc_in_progress = false;
+    _active_area = 1 - _active_area;
+    _free_space_offset = _gc_to_offset;
+
+    // Now write master record, with version incremented by 1.
+    _active_area_version++;
+    ret = write_master_record(_active_area, _active_area_version, next_offset);
+    if (ret) {
+        return ret;
+    }
+
+    // The copied records are not where the RAM table says, and some keys may have been copied
+    // more than once, so read the table back from the new area
+    ret = build_ram_table();
+    if (ret) {
+        return ret;
+    }
+    _gc_base_offset = _free_space_offset;
+
+    // Now reset standby area
+    return reset_area(1 - _active_area);
+}
+
+int TDBStore::incremental_gc_step()
+{
+    int ret;
+
+    if (!gc_step_records) {
+        return MBED_SUCCESS;
+    }
+
+    if (!_gc_in_progress) {
+        // Start once the writes since the last collection used up that much of the free space
+        uint32_t free_size = _size - _gc_base_offset;
+        if (_free_space_offset < _gc_base_offset + free_size / 100 * gc_start_percent) {
+            return MBED_SUCCESS;
+        }
+        ret = prepare_standby_area();
+        if (ret) {
+            return ret;
+        }
+        _gc_from_offset = _master_record_offset;
+        _gc_to_offset = _master_record_offset + _master_record_size;
+        _gc_start_offset = _free_space_offset;
+        _gc_in_progress = true;
+    }
+
+    ret = incremental_gc_copy(gc_step_records);
+    if (ret) {
+        _gc_in_progress = false;
+        return ret;
+    }
+
+    if (_gc_from_offset >= _free_space_offset) {
+        return incremental_gc_finish();
+    }
+    return MBED_SUCCESS;
+}
+
+int TDBStore::garbage_collection_step()
+{
+    int ret;
+
+    if (!_is_initialized) {
+        return MBED_ERROR_NOT_READY;
+    }
+
+    _mutex.lock();
+    ret = incremental_gc_step();
+    _mutex.unlock();
+
+    return ret;
+}
+
 
 int TDBStore::build_ram_table()
 {
@@ -955,6 +1183,9 @@ int TDBStore::build_ram_table()
         // update record parameters
         ram_table[ram_table_ind].hash = hash;
         ram_table[ram_table_ind].bd_offset = save_offset;
+#if TDBSTORE_KEY_PREFIX_SIZE
+        strncpy(ram_table[ram_table_ind].key_prefix, _key_buf, TDBSTORE_KEY_PREFIX_SIZE);
+#endif
     }
 
 end:
@@ -1011,6 +1242,7 @@ int TDBStore::init()
 #endif
 
     _max_keys = initial_max_keys;
+    _gc_in_progress = false;
 
     ram_table = new ram_table_entry_t[_max_keys];
     _ram_table = ram_table;
@@ -1137,6 +1369,8 @@ int TDBStore::init()
     }
 
 end:
+    // How much of the area the last garbage collection left is not known, so assume it was empty
+    _gc_base_offset = _master_record_offset;
     _is_initialized = true;
     _mutex.unlock();
     return ret;
@@ -1190,6 +1424,8 @@ int TDBStore::reset()
     _num_keys = 0;
     _free_space_offset = _master_record_offset;
     _active_area_version = 1;
+    _gc_in_progress = false;
+    _gc_base_offset = _free_space_offset;
 
     // Write an initial master record on active area
     ret = write_master_record(_active_area, _active_area_version, _free_space_offset);
@@ -1262,10 +1498,27 @@ int TDBStore::iterator_next(iterator_t it, char *key, size_t key_size)
     ret = MBED_ERROR_ITEM_NOT_FOUND;
 
     while (ret && (handle->ram_table_ind < _num_keys)) {
-        ret = read_record(_active_area, ram_table[handle->ram_table_ind].bd_offset, _key_buf,
-                          0, 0, actual_data_size, 0, true, false, false, false, hash, flags, next_offset);
-        if (ret) {
-            goto end;
+#if TDBSTORE_KEY_PREFIX_SIZE
+        const char *key_prefix = ram_table[handle->ram_table_ind].key_prefix;
+        if (handle->prefix) {
+            // Skip the keys that do not start like the prefix without reading them
+            size_t prefix_len = std::min(strlen(handle->prefix), (size_t) TDBSTORE_KEY_PREFIX_SIZE);
+            if (strncmp(key_prefix, handle->prefix, prefix_len)) {
+                handle->ram_table_ind++;
+                continue;
+            }
+        }
+        if (whole_key_cached(key_prefix)) {
+            strcpy(_key_buf, key_prefix);
+            ret = MBED_SUCCESS;
+        } else
+#endif
+        {
+            ret = read_record(_active_area, ram_table[handle->ram_table_ind].bd_offset, _key_buf,
+                              0, 0, actual_data_size, 0, true, false, false, false, hash, flags, next_offset);
+            if (ret) {
+                goto end;
+            }
         }
         if (!handle->prefix || (strstr(_key_buf, handle->prefix) == _key_buf)) {
             if (strlen(_key_buf) >= key_size) {
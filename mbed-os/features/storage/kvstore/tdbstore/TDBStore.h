@@ -280,6 +280,19 @@ public:
     virtual int reserved_data_get(void *reserved_data, size_t reserved_data_buf_size,
                                   size_t *actual_data_size = 0);
 
+    /**
+     * @brief Move a few records of an incremental garbage collection, which starts once the active
+     *        area is "tdbstore.gc_start_percent" full. Every set and remove does this already, calling
+     *        it while the store is idle lets the collection finish before a write needs the space.
+     *        Does nothing unless "tdbstore.gc_step_records" is set.
+     *
+     * @returns MBED_SUCCESS                        Success.
+     *          MBED_ERROR_NOT_READY                Not initialized.
+     *          MBED_ERROR_READ_FAILED              Unable to read from media.
+     *          MBED_ERROR_WRITE_FAILED             Unable to write to media.
+     */
+    virtual int garbage_collection_step();
+
 #if !defined(DOXYGEN_ONLY)
 private:
 
@@ -312,6 +325,11 @@ private:
     bool _variant_bd_erase_unit_size;
     void *_inc_set_handle;
     void *_iterator_table[_max_open_iterators];
+    bool _gc_in_progress;
+    uint32_t _gc_base_offset;
+    uint32_t _gc_from_offset;
+    uint32_t _gc_to_offset;
+    uint32_t _gc_start_offset;
 
     /**
      * @brief Read a block from an area.
@@ -413,11 +431,46 @@ private:
 
     /**
      * @brief Garbage collection (compact all records from active area to the standby one).
+     *        Finishes an incremental garbage collection instead if one is in progress.
      *
      * @returns 0 for success, nonzero for failure.
      */
     int garbage_collection();
 
+    /**
+     * @brief Erase the start of the standby area and copy the reserved data to it.
+     *
+     * @returns 0 for success, nonzero for failure.
+     */
+    int prepare_standby_area();
+
+    /**
+     * @brief Walk the active area from the incremental garbage collection's position, copying the
+     *        records that are still in use to the standby area. Records that are written while the
+     *        collection runs are walked as well.
+     *
+     * @param[in]  max_records            Most records to walk, 0 walks to the end of the active area.
+     *
+     * @returns 0 for success, nonzero for failure.
+     */
+    int incremental_gc_copy(uint32_t max_records);
+
+    /**
+     * @brief Switch to the standby area once the incremental garbage collection walked the whole
+     *        active area, and rebuild the RAM table from it.
+     *
+     * @returns 0 for success, nonzero for failure.
+     */
+    int incremental_gc_finish();
+
+    /**
+     * @brief Start an incremental garbage collection if the active area is full enough, and move
+     *        one step of it. The mutex has to be held.
+     *
+     * @returns 0 for success, nonzero for failure.
+     */
+    int incremental_gc_step();
+
     /**
      * @brief Return record size given key and data size.
      *
@@ -22,6 +22,7 @@
 
 #include "device.h"
 #include "pinmap.h"
+#include <stddef.h>
 
 #if DEVICE_ANALOGIN
 
@@ -60,6 +61,32 @@ float analogin_read(analogin_t *obj);
  */
 uint16_t analogin_read_u16(analogin_t *obj);
 
+/** Read the values from several analogin pins, represented as unsigned 16bit values
+ *
+ * The default implementation calls analogin_read_u16() for every object.
+ * Targets override it to set up the converters once for the whole group,
+ * and to convert on several ADC instances at the same time.
+ *
+ * @param objs   The analogin objects, initialized with analogin_init()
+ * @param values Receives the value of every object, in the same order
+ * @param count  The number of objects
+ */
+void analogin_read_multi(analogin_t *const *objs, uint16_t *values, size_t count);
+
+/** Set how the conversions of an analogin pin are made
+ *
+ * The values are still returned as 16bit values, a lower resolution fills
+ * the upper bits. Targets that can not change a setting keep their own one,
+ * the default implementation does nothing.
+ *
+ * @param obj           The analogin object
+ * @param bits          The resolution of a conversion, such as 16, 12 or 8
+ * @param average       How many conversions the hardware averages into one
+ * @param sample_cycles Extra converter clock cycles of sample time, 0 for
+ *                      the shortest
+ */
+void analogin_set_format(analogin_t *obj, uint8_t bits, uint8_t average, uint8_t sample_cycles);
+
 /** Get the pins that support analogin
  *
  * Return a PinMap array of pins that support analogin. The
@@ -0,0 +1,37 @@
+/* mbed Microcontroller Library
+ * Copyright (c) 2019 ARM Limited
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "hal/analogin_api.h"
+#include "platform/mbed_toolchain.h"
+
+#if DEVICE_ANALOGIN
+
+MBED_WEAK void analogin_read_multi(analogin_t *const *objs, uint16_t *values, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        values[i] = analogin_read_u16(objs[i]);
+    }
+}
+
+MBED_WEAK void analogin_set_format(analogin_t *obj, uint8_t bits, uint8_t average, uint8_t sample_cycles)
+{
+    (void)obj;
+    (void)bits;
+    (void)average;
+    (void)sample_cycles;
+}
+
+#endif
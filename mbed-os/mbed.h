@@ -60,6 +60,7 @@
 #include "drivers/PortInOut.h"
 #include "drivers/PortOut.h"
 #include "drivers/AnalogIn.h"
+#include "drivers/AnalogInGroup.h"
 #include "drivers/AnalogOut.h"
 #include "drivers/PwmOut.h"
 #include "drivers/Serial.h"
@@ -26,6 +26,13 @@
 #include "platform/NonCopyable.h"
 #include "platform/FileHandle.h"
 
+/** The most directives of a line of a recv() format that are matched as
+ *  the characters arrive, a longer line is matched with sscanf
+ */
+#ifndef ATCMDPARSER_SCAN_STEPS
+#define ATCMDPARSER_SCAN_STEPS 12
+#endif
+
 namespace mbed {
 /** \addtogroup platform-public-api Platform */
 /** @{*/
@@ -79,6 +86,47 @@ private:
     };
     oob *_oobs;
 
+    // Bit n is set if an oob prefix is n characters long, so the oob list
+    // only has to be walked at those line positions
+    uint32_t _oob_lengths;
+    unsigned _oob_max_len;
+
+    // One directive of a line of a response format. A line is compiled into
+    // these once, so each received character is matched as it comes in and
+    // the values are stored without scanning the line again
+    struct scan_step {
+        uint16_t text;  // where the literal or the scanset starts in the line
+        uint16_t len;   // the characters of the literal or the scanset
+        uint16_t width; // the most characters a conversion takes, 0 for any
+        uint16_t start; // where the conversion starts in the received line
+        uint16_t count; // the characters this step matched so far
+        char type;      // 'l' literal, ' ' white space, or d, u, s, [ or n
+        char size;      // the length modifier, 'H' for hh and 'L' for ll
+        bool store;     // false for a %* conversion
+    };
+
+    // A whole line that answers a command with a failure
+    struct failure {
+        unsigned len;
+        const char *line;
+        failure *next;
+    };
+    failure *_failures;
+    bool _failed;
+
+    static int line_length(const char *response, bool &whole_line);
+    static int compile_line(const char *line, int len, scan_step *steps);
+    static void reset_line(scan_step *steps, int count);
+    static bool match_char(const char *line, scan_step *steps, int count, int &at,
+                           const char *received, int pos);
+    static bool match_done(scan_step *steps, int count, int at,
+                           const char *received, int pos);
+    static void store_line(const char *received, const scan_step *steps, int count,
+                           std::va_list args);
+    int simplify_newline(int c);
+    struct oob *find_oob(const char *line, int len);
+    bool is_failure(const char *line, int len);
+
 public:
 
     /**
@@ -92,7 +140,11 @@ public:
      */
     ATCmdParser(FileHandle *fh, const char *output_delimiter = "\r",
                 int buffer_size = 256, int timeout = 8000, bool debug = false)
-        : _fh(fh), _buffer_size(buffer_size), _oob_cb_count(0), _in_prev(0), _aborted(false), _oobs(NULL)
+        : _fh(fh), _buffer_size(buffer_size), _oob_cb_count(0), _in_prev(0), _aborted(false), _oobs(NULL),
+          _oob_lengths(0), _oob_max_len(0), _failures(NULL), _failed(false), _commands(NULL),
+          _commands_sent(0), _pipeline(1), _command_line(NULL), _command_chars(0),
+          _command_steps_count(0), _command_at(0), _command_len(0), _command_whole_line(false),
+          _command_mismatch(false), _processing(false)
     {
         _buffer = new char[buffer_size];
         set_timeout(timeout);
@@ -110,6 +162,12 @@ public:
             _oobs = oob->next;
             delete oob;
         }
+        while (_failures) {
+            struct failure *failure = _failures;
+            _failures = failure->next;
+            delete failure;
+        }
+        delete[] _command_line;
         delete[] _buffer;
     }
 
@@ -216,6 +274,11 @@ public:
      * Any received data that does not match the response is ignored until
      * a timeout occurs.
      *
+     * A line whose conversions are all %d, %u, %s, %[ and %n, with their
+     * widths, length modifiers and *, is matched character by character as
+     * it arrives. Other lines, and lines of more than ATCMDPARSER_SCAN_STEPS
+     * directives, are matched with sscanf after every character.
+     *
      * @param response scanf-like format string of response to expect
      * @param ... all scanf-like arguments to extract from response
      * @return true only if response is successfully matched
@@ -315,6 +378,140 @@ public:
     * @return true if out-of-band data processed, false otherwise
     */
     bool process_oob(void);
+
+    /**
+     * Attach a line that answers a command with a failure
+     *
+     * Once a received line is the whole of such a line, and not what the
+     * response waited for, recv() returns false at once, and so do the
+     * recv() calls after it until the next send(), other than those of an
+     * oob() callback. A response can still wait for such a line.
+     *
+     * @param line The line, without the delimiter, such as "ERROR"
+     */
+    void fail(const char *line);
+
+    /**
+     * Tells if the command sent last was answered with a line of fail()
+     *
+     * @return true if the recv() since the last send() came to such a line
+     */
+    bool failed() const
+    {
+        return _failed;
+    }
+
+    /** What became of a command of submit() */
+    enum command_result {
+        COMMAND_OK,        ///< The whole response came
+        COMMAND_FAILED,    ///< A line of fail() came instead
+        COMMAND_TIMEOUT,   ///< The response did not come in time
+        COMMAND_CANCELLED  ///< cancel_commands() was called first
+    };
+
+    /**
+     * A command of submit()
+     *
+     * The caller owns it, and keeps it until its callback was called.
+     */
+    struct command {
+        /** The command, sent as it is and appended with the delimiter */
+        const char *text;
+        /** scanf-like format of the lines of the response. Its conversions
+         *  are only matched, the callback gets the first line to scan */
+        const char *response;
+        /** ms the response may take, from when the command was sent */
+        int timeout;
+        /** Called with the result, and the line that matched the first line
+         *  of the response or the line of fail(), otherwise NULL. The line
+         *  is only valid during the call */
+        mbed::Callback<void(command_result result, const char *line)> done;
+
+        // the parser's from submit() until done is called
+        command *next;
+        const char *rest;
+        uint64_t deadline;
+    };
+
+    /**
+     * Sets how many commands of submit() are sent before the first of them
+     * is answered
+     *
+     * @param depth The commands sent ahead, 1 sends each one once the one
+     *              before it was answered
+     */
+    void set_pipeline(int depth)
+    {
+        _pipeline = depth > 0 ? depth : 1;
+    }
+
+    /**
+     * Sends a command without waiting for its response
+     *
+     * The command is sent now if the pipeline has room, otherwise once the
+     * commands in front of it were answered. Its callback is called from
+     * process_commands(), or cancel_commands(). The responses are matched
+     * in the order the commands were submitted.
+     *
+     * @param cmd The command, kept by the caller until its callback
+     * @return true if the command was taken, false if its response has a
+     *         conversion other than %d, %u, %s, %[ and %n, or too many
+     *         directives in a line
+     * @note Call this and process_commands() on the thread of the other
+     *       calls. send() first waits for all the submitted commands.
+     */
+    bool submit(command *cmd);
+
+    /**
+     * Process the responses of submitted commands and out-of-band data
+     *
+     * Takes what was received so far and returns without waiting for the
+     * rest of a line. Calls the callbacks of the commands that were
+     * answered, or that timed out. Call it when the FileHandle's sigio
+     * reports data, and after next_timeout().
+     *
+     * @return true if anything was received
+     */
+    bool process_commands();
+
+    /**
+     * Tells when the first submitted command times out
+     *
+     * @return ms until then, or -1 if no command is waiting
+     */
+    int next_timeout() const;
+
+    /**
+     * Calls the callbacks of all the submitted commands with
+     * COMMAND_CANCELLED, and sends no more of them
+     */
+    void cancel_commands();
+
+private:
+    void write_command(command *cmd);
+    void start_commands();
+    void compile_command();
+    void reset_command_line();
+    void finish_command(command_result result, const char *line);
+    void drain_commands();
+
+    // The commands of submit(), the sent ones in front
+    command *_commands;
+    int _commands_sent;
+    int _pipeline;
+
+    // The line received so far, then the first line of the response
+    char *_command_line;
+    int _command_chars;
+
+    // The line of the response of the first command, as in vrecv()
+    scan_step _command_steps[ATCMDPARSER_SCAN_STEPS];
+    int _command_steps_count;
+    int _command_at;
+    int _command_len;
+    bool _command_whole_line;
+    bool _command_mismatch;
+    bool _processing;
 };
 
 /**@}*/
@@ -18,8 +18,10 @@
 #define MBED_CIRCULARBUFFER_H
 
 #include <stdint.h>
+#include <algorithm>
 #include "platform/mbed_critical.h"
 #include "platform/mbed_assert.h"
+#include "platform/Span.h"
 
 namespace mbed {
 
@@ -108,6 +110,46 @@ public:
         core_util_critical_section_exit();
     }
 
+    /** Push a number of items to the buffer in one critical section. This
+     *  overwrites the oldest items if there is not enough room, and only the
+     *  last BufferSize items are kept if there are more than that
+     *
+     * @param src  Items to be pushed to the buffer
+     * @param len  Number of items to be pushed
+     */
+    void push(const T *src, CounterType len)
+    {
+        core_util_critical_section_enter();
+        if (len >= BufferSize) {
+            std::copy(src + len - BufferSize, src + len, _pool);
+            _head = 0;
+            _tail = 0;
+            _full = true;
+        } else if (len > 0) {
+            bool overwrite = BufferSize - non_critical_size() <= len;
+            /* up to the end of the storage, then on from its start */
+            CounterType first = std::min<CounterType>(len, BufferSize - _head);
+            std::copy(src, src + first, _pool + _head);
+            std::copy(src + first, src + len, _pool);
+            _head = increment(_head, len);
+            if (overwrite) {
+                _tail = _head;
+                _full = true;
+            }
+        }
+        core_util_critical_section_exit();
+    }
+
+    /** Push a span of items to the buffer in one critical section, like
+     *  push(const T *, CounterType)
+     *
+     * @param src  Items to be pushed to the buffer
+     */
+    void push(mbed::Span<const T> src)
+    {
+        push(src.data(), src.size());
+    }
+
     /** Pop the transaction from the buffer
      *
      * @param data Data to be popped from the buffer
@@ -129,6 +171,70 @@ public:
         return data_popped;
     }
 
+    /** Pop up to len items from the buffer in one critical section
+     *
+     * @param dest  Where the items are copied to
+     * @param len   Most number of items to be popped
+     * @return Number of items that were popped
+     */
+    CounterType pop(T *dest, CounterType len)
+    {
+        core_util_critical_section_enter();
+        CounterType popped = std::min(len, non_critical_size());
+        CounterType first = std::min<CounterType>(popped, BufferSize - _tail);
+        std::copy(_pool + _tail, _pool + _tail + first, dest);
+        std::copy(_pool, _pool + popped - first, dest + first);
+        non_critical_drop(popped);
+        core_util_critical_section_exit();
+        return popped;
+    }
+
+    /** Pop items from the buffer into a span in one critical section
+     *
+     * @param dest  Where the items are copied to, as many as fit
+     * @return The part of dest that holds the popped items
+     */
+    mbed::Span<T> pop(mbed::Span<T> dest)
+    {
+        return dest.first(pop(dest.data(), dest.size()));
+    }
+
+    /** Peek at the items in place, without popping or copying them. They are
+     *  the oldest ones up to the end of the storage, followed by the ones
+     *  that continue at its start
+     *
+     * @param first   Set to the items starting at the oldest one
+     * @param second  Set to the items after the wrap point, empty if there
+     *                are none
+     * @return Number of items in both spans
+     * @note The spans stay valid until the items are dropped or popped, as
+     *       long as nothing is pushed over them while the buffer is full
+     */
+    CounterType peek(mbed::Span<const T> &first, mbed::Span<const T> &second) const
+    {
+        core_util_critical_section_enter();
+        CounterType stored = non_critical_size();
+        CounterType up_to_end = std::min<CounterType>(stored, BufferSize - _tail);
+        first = mbed::Span<const T>(_pool + _tail, up_to_end);
+        second = mbed::Span<const T>(_pool, stored - up_to_end);
+        core_util_critical_section_exit();
+        return stored;
+    }
+
+    /** Drop up to len of the oldest items, typically after peek()
+     *
+     * @param len  Most number of items to be dropped
+     * @return Number of items that were dropped
+     */
+    CounterType drop(CounterType len)
+    {
+        core_util_critical_section_enter();
+        CounterType dropped = std::min(len, non_critical_size());
+        non_critical_drop(dropped);
+        core_util_critical_section_exit();
+        return dropped;
+    }
+
     /** Check if the buffer is empty
      *
      * @return True if the buffer is empty, false if not
@@ -169,16 +275,7 @@ public:
     CounterType size() const
     {
         core_util_critical_section_enter();
-        CounterType elements;
-        if (!_full) {
-            if (_head < _tail) {
-                elements = BufferSize + _head - _tail;
-            } else {
-                elements = _head - _tail;
-            }
-        } else {
-            elements = BufferSize;
-        }
+        CounterType elements = non_critical_size();
         core_util_critical_section_exit();
         return elements;
     }
@@ -201,6 +298,34 @@ public:
     }
 
 private:
+    /* the number of items, called in a critical section */
+    CounterType non_critical_size() const
+    {
+        if (_full) {
+            return BufferSize;
+        }
+        if (_head < _tail) {
+            return BufferSize + _head - _tail;
+        }
+        return _head - _tail;
+    }
+
+    /* drops len <= size() items, called in a critical section */
+    void non_critical_drop(CounterType len)
+    {
+        if (len > 0) {
+            _tail = increment(_tail, len);
+            _full = false;
+        }
+    }
+
+    /* adds len <= BufferSize to a position in the storage */
+    static CounterType increment(CounterType position, CounterType len)
+    {
+        return len >= BufferSize - position ? position + len - BufferSize
+                                           : position + len;
+    }
+
     T _pool[BufferSize];
     CounterType _head;
     CounterType _tail;
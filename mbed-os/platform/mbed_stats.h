@@ -18,6 +18,7 @@
 #define MBED_STATS_H
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "hal/ticker_api.h"
 
 #ifdef __cplusplus
@@ -83,6 +84,7 @@ typedef struct {
     uint32_t max_size;          /**< Maximum number of bytes used on the stack since the thread was started */
     uint32_t reserved_size;     /**< Current number of bytes reserved for the stack */
     uint32_t stack_cnt;         /**< The number of stacks represented in the accumulated statistics or 1 if representing a single stack */
+    const char *name;           /**< The name the thread was created with, NULL if it has none or for accumulated statistics */
 } mbed_stats_stack_t;
 
 /**
@@ -174,6 +176,48 @@ typedef struct {
  */
 void mbed_stats_sys_get(mbed_stats_sys_t *stats);
 
+/** Number of buckets in the histograms of mbed_stats_critical_t */
+#define MBED_CRITICAL_STATS_BUCKETS 8
+
+/**
+ * struct mbed_stats_critical_t definition
+ *
+ * Bucket i of a histogram counts the durations of less than 64 << (2 * i)
+ * core cycles that are not in the bucket before it, the last bucket counts
+ * the rest.
+ */
+typedef struct {
+    uint32_t count;                                         /**< Outermost critical sections since the last reset */
+    uint32_t max_cycles;                                    /**< Longest critical section, in core cycles */
+    void *max_caller;                                       /**< Where core_util_critical_section_enter() was called for the longest one */
+    uint32_t histogram[MBED_CRITICAL_STATS_BUCKETS];        /**< Durations of the critical sections */
+    uint32_t blocked_count;                                 /**< Critical sections that ended with a device interrupt pending */
+    uint32_t blocked_max_cycles;                            /**< Longest of those, the most they may have held the interrupt up */
+    void *blocked_caller;                                   /**< Where the longest of those was entered */
+    int32_t blocked_irq;                                    /**< The IRQn that was pending at its end */
+    uint32_t irq_latency_count;                             /**< Latencies given to mbed_stats_irq_latency_add() */
+    uint32_t irq_latency_max_cycles;                        /**< Longest of those, in core cycles */
+    uint32_t irq_latency_histogram[MBED_CRITICAL_STATS_BUCKETS]; /**< The latencies */
+} mbed_stats_critical_t;
+
+/**
+ *  Fill the passed in structure with the critical section statistics.
+ *  Needs MBED_CRITICAL_STATS_ENABLED and a core with a DWT cycle counter.
+ *
+ *  @param stats    A pointer to the mbed_stats_critical_t structure to fill
+ *  @param reset    Start the statistics over after they were copied
+ */
+void mbed_stats_critical_get(mbed_stats_critical_t *stats, bool reset);
+
+/**
+ *  Count the entry latency of an interrupt, measured by its handler against
+ *  the hardware time the interrupt was raised at. Can be called from any
+ *  interrupt handler.
+ *
+ *  @param cycles   How many core cycles the interrupt waited to be taken
+ */
+void mbed_stats_irq_latency_add(uint32_t cycles);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,9 +22,13 @@
 #include "ATCmdParser.h"
 #include "mbed_poll.h"
 #include "mbed_debug.h"
+#include "platform/mbed_thread.h"
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #ifdef LF
 #undef LF
@@ -189,6 +193,10 @@ int ATCmdParser::vscanf(const char *format, std::va_list args)
 // Command parsing with line handling
 bool ATCmdParser::vsend(const char *command, std::va_list args)
 {
+    // The answers of the submitted commands come in front of its answer
+    drain_commands();
+    _failed = false;
+
     // Create and send command
     if (vsprintf(_buffer, command, args) < 0) {
         return false;
@@ -211,8 +219,368 @@ bool ATCmdParser::vsend(const char *command, std::va_list args)
     return true;
 }
 
+// Returns the characters of the first line of response, up to its newline
+// if it has one. whole_line is set if it has
+int ATCmdParser::line_length(const char *response, bool &whole_line)
+{
+    int i = 0;
+    whole_line = false;
+    while (response[i]) {
+        // a newline in a %[^\n] conversion does not end the line
+        if (response[i++] == '\n' && !(i >= 3 && response[i - 3] == '[' && response[i - 2] == '^')) {
+            whole_line = true;
+            break;
+        }
+    }
+    return i;
+}
+
+// Compiles the len characters of a line of a response format into steps.
+// Returns the number of steps, or -1 if only sscanf can match the line
+int ATCmdParser::compile_line(const char *line, int len, scan_step *steps)
+{
+    int count = 0;
+    int i = 0;
+    while (i < len) {
+        if (count == ATCMDPARSER_SCAN_STEPS || i > UINT16_MAX) {
+            return -1;
+        }
+        scan_step &step = steps[count++];
+        step.text = i;
+        step.len = 0;
+        step.width = 0;
+        step.size = 0;
+        step.store = false;
+
+        // any white space in the format matches any amount of it
+        if (isspace((unsigned char)line[i])) {
+            step.type = ' ';
+            while (i < len && isspace((unsigned char)line[i])) {
+                i++;
+            }
+            continue;
+        }
+
+        if (line[i] != '%') {
+            step.type = 'l';
+            while (i < len && line[i] != '%' && !isspace((unsigned char)line[i])) {
+                i++;
+                step.len++;
+            }
+            continue;
+        }
+
+        // a conversion, %[*][width][length]type
+        i++;
+        step.store = true;
+        if (i < len && line[i] == '*') {
+            step.store = false;
+            i++;
+        }
+        while (i < len && isdigit((unsigned char)line[i])) {
+            if (step.width > (UINT16_MAX - 9) / 10) {
+                return -1;
+            }
+            step.width = step.width * 10 + (line[i++] - '0');
+        }
+        if (i < len && (line[i] == 'h' || line[i] == 'l')) {
+            step.size = line[i++];
+            if (i < len && line[i] == step.size) {
+                step.size = step.size == 'h' ? 'H' : 'L';
+                i++;
+            }
+        } else if (i < len && (line[i] == 'z' || line[i] == 'j' || line[i] == 't')) {
+            step.size = line[i++];
+        }
+        if (i >= len) {
+            return -1;
+        }
+        step.type = line[i++];
+        switch (step.type) {
+            case 'd':
+            case 'u':
+            case 's':
+            case 'n':
+                break;
+            case '[':
+                // a ] right after [ or [^ is one of the set
+                step.text = i;
+                if (i < len && line[i] == '^') {
+                    i++;
+                }
+                if (i < len && line[i] == ']') {
+                    i++;
+                }
+                while (i < len && line[i] != ']') {
+                    i++;
+                }
+                if (i >= len) {
+                    return -1;
+                }
+                step.len = i++ - step.text;
+                break;
+            default:
+                // %c, %x, %f, %% and the rest are left to sscanf
+                return -1;
+        }
+    }
+    return count;
+}
+
+// Starts matching a new line against the steps
+void ATCmdParser::reset_line(scan_step *steps, int count)
+{
+    for (int i = 0; i < count; i++) {
+        steps[i].count = 0;
+    }
+}
+
+// Returns true if c is in the scanset of len characters, as sscanf takes it
+static bool in_scanset(const char *set, int len, char c)
+{
+    int i = 0;
+    bool negated = len > 0 && set[0] == '^';
+    if (negated) {
+        i++;
+    }
+    int first = i;
+    bool found = false;
+    for (; i < len && !found; i++) {
+        if (set[i] == '-' && i > first && i + 1 < len) {
+            found = (unsigned char)c >= (unsigned char)set[i - 1] &&
+                    (unsigned char)c <= (unsigned char)set[i + 1];
+        } else {
+            found = set[i] == c;
+        }
+    }
+    return found != negated;
+}
+
+// Matches the received character at pos against the steps, from step at on.
+// scanf does not go back, so once a character does not match, no line that
+// starts with these characters can. Returns false then
+bool ATCmdParser::match_char(const char *line, scan_step *steps, int count, int &at,
+                             const char *received, int pos)
+{
+    char c = received[pos];
+    // sscanf would end the line there
+    if (c == '\0') {
+        return false;
+    }
+
+    for (; at < count; at++) {
+        scan_step &step = steps[at];
+        bool room = step.width == 0 || step.count < step.width;
+        switch (step.type) {
+            case 'l':
+                if (c != line[step.text + step.count]) {
+                    return false;
+                }
+                if (++step.count == step.len) {
+                    at++;
+                }
+                return true;
+            case ' ':
+                if (isspace((unsigned char)c)) {
+                    return true;
+                }
+                break;
+            case 'n':
+                step.start = pos;
+                break;
+            case 'd':
+            case 'u':
+                if (step.count == 0 && isspace((unsigned char)c)) {
+                    return true;
+                }
+                if (room && (isdigit((unsigned char)c) ||
+                             (step.count == 0 && (c == '+' || c == '-')))) {
+                    if (step.count++ == 0) {
+                        step.start = pos;
+                    }
+                    return true;
+                }
+                // a sign on its own is not a number
+                if (step.count == 0 || !isdigit((unsigned char)received[pos - 1])) {
+                    return false;
+                }
+                break;
+            case 's':
+                if (step.count == 0 && isspace((unsigned char)c)) {
+                    return true;
+                }
+                if (room && !isspace((unsigned char)c)) {
+                    if (step.count++ == 0) {
+                        step.start = pos;
+                    }
+                    return true;
+                }
+                break;
+            case '[':
+                if (room && in_scanset(line + step.text, step.len, c)) {
+                    if (step.count++ == 0) {
+                        step.start = pos;
+                    }
+                    return true;
+                }
+                if (step.count == 0) {
+                    return false;
+                }
+                break;
+        }
+        // the step is done, the character is for the next one
+    }
+    // more characters than the format has
+    return false;
+}
+
+// Returns true if the pos characters matched so far are all of the steps,
+// the way sscanf would have matched them with nothing after them
+bool ATCmdParser::match_done(scan_step *steps, int count, int at,
+                             const char *received, int pos)
+{
+    for (; at < count; at++) {
+        scan_step &step = steps[at];
+        switch (step.type) {
+            case ' ':
+                break;
+            case 'n':
+                step.start = pos;
+                break;
+            case 'd':
+            case 'u':
+                // only the step in progress can have characters, and a
+                // number needs a digit after its sign
+                if (step.count == 0 || !isdigit((unsigned char)received[pos - 1])) {
+                    return false;
+                }
+                break;
+            case 's':
+            case '[':
+                if (step.count == 0) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Stores the conversions of a matched line into args, like vsscanf does
+void ATCmdParser::store_line(const char *received, const scan_step *steps, int count,
+                             std::va_list args)
+{
+    for (int i = 0; i < count; i++) {
+        const scan_step &step = steps[i];
+        if (!step.store || step.type == 'l' || step.type == ' ') {
+            continue;
+        }
+
+        if (step.type == 's' || step.type == '[') {
+            char *value = va_arg(args, char *);
+            memcpy(value, received + step.start, step.count);
+            value[step.count] = '\0';
+            continue;
+        }
+
+        // scanf leaves a value that does not fit undefined too
+        unsigned long long value = step.start;
+        if (step.type != 'n') {
+            const char *digit = received + step.start;
+            const char *end = digit + step.count;
+            bool negative = *digit == '-';
+            if (*digit == '+' || *digit == '-') {
+                digit++;
+            }
+            value = 0;
+            while (digit < end) {
+                value = value * 10 + (*digit++ - '0');
+            }
+            if (negative) {
+                value = 0 - value;
+            }
+        }
+        switch (step.size) {
+            case 'H':
+                *va_arg(args, signed char *) = (signed char)value;
+                break;
+            case 'h':
+                *va_arg(args, short *) = (short)value;
+                break;
+            case 'l':
+                *va_arg(args, long *) = (long)value;
+                break;
+            case 'L':
+                *va_arg(args, long long *) = (long long)value;
+                break;
+            case 'z':
+                *va_arg(args, size_t *) = (size_t)value;
+                break;
+            case 'j':
+                *va_arg(args, intmax_t *) = (intmax_t)value;
+                break;
+            case 't':
+                *va_arg(args, ptrdiff_t *) = (ptrdiff_t)value;
+                break;
+            default:
+                *va_arg(args, int *) = (int)value;
+                break;
+        }
+    }
+}
+
+// Simplifies newlines (borrowed from retarget.cpp). Returns -1 for the
+// second character of a CR LF or LF CR pair
+int ATCmdParser::simplify_newline(int c)
+{
+    char prev = _in_prev;
+    _in_prev = c;
+    if ((c == CR && prev != LF) || (c == LF && prev != CR)) {
+        return '\n';
+    } else if (c == CR || c == LF) {
+        return -1;
+    }
+    return c;
+}
+
+// Returns the oob whose prefix is the len characters of line, only looking
+// where a prefix could end
+struct ATCmdParser::oob *ATCmdParser::find_oob(const char *line, int len)
+{
+    bool oob_length = (unsigned)len <= _oob_max_len &&
+                      (len >= 32 || (_oob_lengths & (1UL << len)));
+    for (struct oob *oob = oob_length ? _oobs : NULL; oob; oob = oob->next) {
+        if ((unsigned)len == oob->len && memcmp(oob->prefix, line, len) == 0) {
+            return oob;
+        }
+    }
+    return NULL;
+}
+
+// Returns true if the len characters of line are a line of fail()
+bool ATCmdParser::is_failure(const char *line, int len)
+{
+    for (struct failure *failure = _failures; failure; failure = failure->next) {
+        if ((unsigned)len == failure->len && memcmp(failure->line, line, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool ATCmdParser::vrecv(const char *response, std::va_list args)
 {
+    // The command was answered with a failure, the rest of its response
+    // does not come
+    if (response && _failed) {
+        return false;
+    }
+    if (response) {
+        drain_commands();
+    }
+
 restart:
     _aborted = false;
     // Iterate through each line in the expected response
@@ -248,6 +616,22 @@ restart:
         _buffer[offset++] = 'n';
         _buffer[offset++] = 0;
 
+        // The line is compiled into steps that are matched as the
+        // characters arrive, so it is never scanned again. A line the steps
+        // cannot take is left to sscanf, but the characters before its first
+        // conversion or whitespace are still checked one for one, so a line
+        // that went wrong is not scanned again either.
+        scan_step steps[ATCMDPARSER_SCAN_STEPS];
+        int steps_count = response ? compile_line(response, i, steps) : -1;
+        int at = 0;
+        reset_line(steps, steps_count);
+        int literal = 0;
+        while (steps_count < 0 && literal < i && response[literal] != '%' &&
+                !isspace((unsigned char)response[literal])) {
+            literal++;
+        }
+        bool mismatch = false;
+
         debug_if(_dbg_on, "AT? %s\n", _buffer);
         // To workaround scanf's lack of error reporting, we actually
         // make two passes. One checks the validity with the modified
@@ -270,38 +654,40 @@ restart:
                 debug_if(_dbg_on, "AT(Timeout)\n");
                 return false;
             }
-            // Simplify newlines (borrowed from retarget.cpp)
-            if ((c == CR && _in_prev != LF) ||
-                    (c == LF && _in_prev != CR)) {
-                _in_prev = c;
-                c = '\n';
-            } else if ((c == CR && _in_prev == LF) ||
-                       (c == LF && _in_prev == CR)) {
-                _in_prev = c;
+            c = simplify_newline(c);
+            if (c < 0) {
                 // onto next character
                 continue;
-            } else {
-                _in_prev = c;
             }
             _buffer[offset + j++] = c;
             _buffer[offset + j] = 0;
 
+            if (response && !mismatch) {
+                if (steps_count >= 0) {
+                    mismatch = !match_char(response, steps, steps_count, at, _buffer + offset, j - 1);
+                } else if (j <= literal && c != response[j - 1]) {
+                    mismatch = true;
+                }
+            }
+
             // Check for oob data
-            for (struct oob *oob = _oobs; oob; oob = oob->next) {
-                if ((unsigned)j == oob->len && memcmp(
-                            oob->prefix, _buffer + offset, oob->len) == 0) {
-                    debug_if(_dbg_on, "AT! %s\n", oob->prefix);
-                    _oob_cb_count++;
-                    oob->cb();
-
-                    if (_aborted) {
-                        debug_if(_dbg_on, "AT(Aborted)\n");
-                        return false;
-                    }
-                    // oob may have corrupted non-reentrant buffer,
-                    // so we need to set it up again
-                    goto restart;
+            struct oob *oob = find_oob(_buffer + offset, j);
+            if (oob) {
+                debug_if(_dbg_on, "AT! %s\n", oob->prefix);
+                _oob_cb_count++;
+                // the handler's own recv() calls are not the failed command's
+                bool failed = _failed;
+                _failed = false;
+                oob->cb();
+                _failed = failed;
+
+                if (_aborted) {
+                    debug_if(_dbg_on, "AT(Aborted)\n");
+                    return false;
                 }
+                // oob may have corrupted non-reentrant buffer,
+                // so we need to set it up again
+                goto restart;
             }
 
             // Check for match
@@ -309,19 +695,25 @@ restart:
             if (whole_line_wanted && c != '\n') {
                 // Don't attempt scanning until we get delimiter if they included it in format
                 // This allows recv("Foo: %s\n") to work, and not match with just the first character of a string
-            } else if (response) {
+            } else if (response && !mismatch && steps_count >= 0) {
+                count = match_done(steps, steps_count, at, _buffer + offset, j) ? j : -1;
+            } else if (response && !mismatch && j >= literal) {
                 sscanf(_buffer + offset, _buffer, &count);
             }
 
             // We only succeed if all characters in the response are matched
             if (count == j) {
                 debug_if(_dbg_on, "AT= %s\n", _buffer + offset);
-                // Reuse the front end of the buffer
-                memcpy(_buffer, response, i);
-                _buffer[i] = 0;
+                if (steps_count >= 0) {
+                    store_line(_buffer + offset, steps, steps_count, args);
+                } else {
+                    // Reuse the front end of the buffer
+                    memcpy(_buffer, response, i);
+                    _buffer[i] = 0;
 
-                // Store the found results
-                vsscanf(_buffer + offset, _buffer, args);
+                    // Store the found results
+                    vsscanf(_buffer + offset, _buffer, args);
+                }
 
                 // Jump to next line and continue parsing
                 response += i;
@@ -332,7 +724,16 @@ restart:
             // running out of space usually means we ran into binary data
             if (c == '\n' || j + 1 >= _buffer_size - offset) {
                 debug_if(_dbg_on, "AT< %s", _buffer + offset);
+                // A line that is a failure instead of the response
+                if (response && c == '\n' && is_failure(_buffer + offset, j - 1)) {
+                    debug_if(_dbg_on, "AT(Failed)\n");
+                    _failed = true;
+                    return false;
+                }
                 j = 0;
+                mismatch = false;
+                at = 0;
+                reset_line(steps, steps_count);
             }
         }
     }
@@ -386,6 +787,13 @@ void ATCmdParser::oob(const char *prefix, Callback<void()> cb)
     oob->cb = cb;
     oob->next = _oobs;
     _oobs = oob;
+
+    if (oob->len < 32) {
+        _oob_lengths |= 1UL << oob->len;
+    }
+    if (oob->len > _oob_max_len) {
+        _oob_max_len = oob->len;
+    }
 }
 
 void ATCmdParser::abort()
@@ -395,9 +803,245 @@ void ATCmdParser::abort()
 
 bool ATCmdParser::process_oob()
 {
+    // A submitted command's answer must not be taken for other data
+    if (_commands) {
+        return process_commands();
+    }
     int pre_count = _oob_cb_count;
     static_cast<void>(recv(NULL));
     return _oob_cb_count != pre_count;
 }
 
+void ATCmdParser::fail(const char *line)
+{
+    struct failure *failure = new struct failure;
+    failure->len = strlen(line);
+    failure->line = line;
+    failure->next = _failures;
+    _failures = failure;
+}
+
+// Command submission without waiting
+bool ATCmdParser::submit(command *cmd)
+{
+    // Each line is compiled again once it is waited for, only check now
+    // that they all can be
+    scan_step steps[ATCMDPARSER_SCAN_STEPS];
+    const char *line = cmd->response;
+    while (*line) {
+        bool whole_line;
+        int len = line_length(line, whole_line);
+        if (compile_line(line, len, steps) < 0) {
+            return false;
+        }
+        line += len;
+    }
+    if (line == cmd->response) {
+        return false;
+    }
+
+    if (!_command_line) {
+        _command_line = new char[2 * _buffer_size];
+        _command_chars = 0;
+    }
+    cmd->next = NULL;
+    cmd->rest = cmd->response;
+    command **last = &_commands;
+    while (*last) {
+        last = &(*last)->next;
+    }
+    *last = cmd;
+    start_commands();
+    return true;
+}
+
+// Sends the command, and times out its response from now
+void ATCmdParser::write_command(command *cmd)
+{
+    cmd->deadline = get_ms_count() + cmd->timeout;
+    if (write(cmd->text, strlen(cmd->text)) < 0 ||
+            write(_output_delimiter, _output_delim_size) < 0) {
+        cmd->deadline = 0;
+    }
+    debug_if(_dbg_on, "AT>> %s\n", cmd->text);
+    _commands_sent++;
+    if (cmd == _commands) {
+        compile_command();
+    }
+}
+
+// Sends the commands the pipeline has room for
+void ATCmdParser::start_commands()
+{
+    command *cmd = _commands;
+    for (int i = 0; cmd && i < _commands_sent; i++) {
+        cmd = cmd->next;
+    }
+    for (; cmd && _commands_sent < _pipeline; cmd = cmd->next) {
+        write_command(cmd);
+    }
+}
+
+// Compiles the line of the response the first command waits for
+void ATCmdParser::compile_command()
+{
+    command *cmd = _commands;
+    _command_len = line_length(cmd->rest, _command_whole_line);
+    _command_steps_count = compile_line(cmd->rest, _command_len, _command_steps);
+    reset_command_line();
+}
+
+// Starts matching the line of the response again, with the next character
+void ATCmdParser::reset_command_line()
+{
+    _command_at = 0;
+    _command_mismatch = false;
+    reset_line(_command_steps, _command_steps_count);
+}
+
+// Takes the first command off, and calls its callback once the next ones
+// were sent
+void ATCmdParser::finish_command(command_result result, const char *line)
+{
+    command *cmd = _commands;
+    _commands = cmd->next;
+    _commands_sent--;
+    if (_commands && _commands_sent > 0) {
+        compile_command();
+    }
+    start_commands();
+    cmd->done(result, line);
+}
+
+bool ATCmdParser::process_commands()
+{
+    // a callback that processes the commands again would skip lines
+    if (_processing) {
+        return false;
+    }
+    _processing = true;
+    if (!_command_line) {
+        _command_line = new char[2 * _buffer_size];
+        _command_chars = 0;
+    }
+
+    bool received = false;
+    char *line = _command_line;
+    char *first_line = _command_line + _buffer_size;
+    while (true) {
+        // the first command got no answer in time, nor may the ones after
+        // it that were sent as long ago
+        uint64_t now = get_ms_count();
+        while (_commands && _commands_sent > 0 && now >= _commands->deadline) {
+            debug_if(_dbg_on, "AT(Timeout) %s\n", _commands->text);
+            finish_command(COMMAND_TIMEOUT, NULL);
+        }
+        if (!_fh->readable()) {
+            break;
+        }
+        int c = getc();
+        if (c < 0) {
+            break;
+        }
+        received = true;
+        c = simplify_newline(c);
+        if (c < 0) {
+            continue;
+        }
+        int j = _command_chars;
+        line[j++] = c;
+        line[j] = 0;
+        _command_chars = j;
+
+        struct oob *oob = find_oob(line, j);
+        if (oob) {
+            debug_if(_dbg_on, "AT! %s\n", oob->prefix);
+            _oob_cb_count++;
+            _aborted = false;
+            oob->cb();
+            // the line starts over, like in vrecv()
+            _command_chars = 0;
+            if (_commands && _commands_sent > 0) {
+                reset_command_line();
+            }
+            continue;
+        }
+
+        command *cmd = _commands_sent > 0 ? _commands : NULL;
+        if (cmd && !_command_mismatch) {
+            _command_mismatch = !match_char(cmd->rest, _command_steps, _command_steps_count,
+                                            _command_at, line, j - 1);
+        }
+        if (cmd && !_command_mismatch && (!_command_whole_line || c == '\n') &&
+                match_done(_command_steps, _command_steps_count, _command_at, line, j)) {
+            debug_if(_dbg_on, "AT= %s\n", line);
+            if (cmd->rest == cmd->response) {
+                memcpy(first_line, line, j + 1);
+                if (first_line[j - 1] == '\n') {
+                    first_line[j - 1] = 0;
+                }
+            }
+            _command_chars = 0;
+            cmd->rest += _command_len;
+            if (*cmd->rest) {
+                compile_command();
+            } else {
+                finish_command(COMMAND_OK, first_line);
+            }
+        } else if (c == '\n' || j + 1 >= _buffer_size) {
+            debug_if(_dbg_on, "AT< %s", line);
+            _command_chars = 0;
+            line[j - 1] = 0;
+            if (cmd && c == '\n' && is_failure(line, j - 1)) {
+                debug_if(_dbg_on, "AT(Failed) %s\n", cmd->text);
+                finish_command(COMMAND_FAILED, line);
+            } else if (cmd) {
+                reset_command_line();
+            }
+        }
+    }
+    _processing = false;
+    return received;
+}
+
+int ATCmdParser::next_timeout() const
+{
+    if (!_commands || _commands_sent == 0) {
+        return -1;
+    }
+    uint64_t now = get_ms_count();
+    return now >= _commands->deadline ? 0 : int(_commands->deadline - now);
+}
+
+void ATCmdParser::cancel_commands()
+{
+    command *cmd = _commands;
+    _commands = NULL;
+    _commands_sent = 0;
+    while (cmd) {
+        command *next = cmd->next;
+        cmd->done(COMMAND_CANCELLED, NULL);
+        cmd = next;
+    }
+}
+
+// Waits for the responses of all the submitted commands
+void ATCmdParser::drain_commands()
+{
+    if (_processing) {
+        return;
+    }
+    while (_commands) {
+        pollfh fhs;
+        fhs.fh = _fh;
+        fhs.events = POLLIN;
+        poll(&fhs, 1, next_timeout());
+        process_commands();
+    }
+    // what is left of a line goes to recv()
+    if (_command_line) {
+        _command_chars = 0;
+    }
+}
+
 }
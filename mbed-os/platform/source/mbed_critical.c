@@ -22,9 +22,64 @@
 #include "cmsis.h"
 #include "platform/mbed_assert.h"
 #include "platform/mbed_critical.h"
+#include "platform/mbed_stats.h"
+#include "platform/mbed_toolchain.h"
+#include <string.h>
 
 static uint32_t critical_section_reentrancy_counter = 0;
 
+#if defined(MBED_CRITICAL_STATS_ENABLED) && defined(DWT)
+#define CRITICAL_STATS 1
+
+/* Only changed with interrupts disabled */
+static mbed_stats_critical_t critical_stats;
+static uint32_t critical_start;
+static void *critical_caller;
+
+static unsigned critical_bucket(uint32_t cycles)
+{
+    unsigned bucket = 0;
+    while (bucket < MBED_CRITICAL_STATS_BUCKETS - 1 &&
+            cycles >= (64UL << (2 * bucket))) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void critical_stats_start(void *caller)
+{
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+    critical_start = DWT->CYCCNT;
+    critical_caller = caller;
+}
+
+static void critical_stats_end(void)
+{
+    uint32_t cycles = DWT->CYCCNT - critical_start;
+    ++critical_stats.count;
+    ++critical_stats.histogram[critical_bucket(cycles)];
+    if (cycles > critical_stats.max_cycles) {
+        critical_stats.max_cycles = cycles;
+        critical_stats.max_caller = critical_caller;
+    }
+
+    /* A pending system exception, like PendSV for a context switch, is not
+     * held up by much */
+    uint32_t pending = (SCB->ICSR & SCB_ICSR_VECTPENDING_Msk) >> SCB_ICSR_VECTPENDING_Pos;
+    if (pending >= 16) {
+        ++critical_stats.blocked_count;
+        if (cycles > critical_stats.blocked_max_cycles) {
+            critical_stats.blocked_max_cycles = cycles;
+            critical_stats.blocked_caller = critical_caller;
+            critical_stats.blocked_irq = (int32_t)pending - 16;
+        }
+    }
+}
+#endif
+
 bool core_util_are_interrupts_enabled(void)
 {
 #if defined(__CORTEX_A9)
@@ -62,6 +117,11 @@ void core_util_critical_section_enter(void)
     // If the reentrancy counter overflows something has gone badly wrong.
     MBED_ASSERT(critical_section_reentrancy_counter < UINT32_MAX);
 
+#ifdef CRITICAL_STATS
+    if (critical_section_reentrancy_counter == 0) {
+        critical_stats_start(MBED_CALLER_ADDR());
+    }
+#endif
     ++critical_section_reentrancy_counter;
 }
 
@@ -76,6 +136,39 @@ void core_util_critical_section_exit(void)
     --critical_section_reentrancy_counter;
 
     if (critical_section_reentrancy_counter == 0) {
+#ifdef CRITICAL_STATS
+        critical_stats_end();
+#endif
         hal_critical_section_exit();
     }
 }
+
+void mbed_stats_critical_get(mbed_stats_critical_t *stats, bool reset)
+{
+    MBED_ASSERT(stats != NULL);
+#ifdef CRITICAL_STATS
+    core_util_critical_section_enter();
+    *stats = critical_stats;
+    if (reset) {
+        memset(&critical_stats, 0, sizeof(critical_stats));
+    }
+    core_util_critical_section_exit();
+#else
+    memset(stats, 0, sizeof(mbed_stats_critical_t));
+#endif
+}
+
+void mbed_stats_irq_latency_add(uint32_t cycles)
+{
+#ifdef CRITICAL_STATS
+    core_util_critical_section_enter();
+    ++critical_stats.irq_latency_count;
+    ++critical_stats.irq_latency_histogram[critical_bucket(cycles)];
+    if (cycles > critical_stats.irq_latency_max_cycles) {
+        critical_stats.irq_latency_max_cycles = cycles;
+    }
+    core_util_critical_section_exit();
+#else
+    (void)cycles;
+#endif
+}
@@ -101,6 +101,7 @@ size_t mbed_stats_stack_get_each(mbed_stats_stack_t *stats, size_t count)
         stats[i].reserved_size = stack_size;
         stats[i].thread_id = (uint32_t)threads[i];
         stats[i].stack_cnt = 1;
+        stats[i].name = osThreadGetName(threads[i]);
     }
     osKernelUnlock();
 
@@ -29,12 +29,74 @@ static ADC_Type *const adc_addrs[] = ADC_BASE_PTRS;
 
 #define MAX_FADC 6000000
 
+#define ADC_INSTANCES (sizeof(adc_addrs) / sizeof(adc_addrs[0]))
+
+/* Set once an ADC instance was initialized and calibrated, the pins after
+ * the first one on it only need their pinout */
+static bool adc_ready[ADC_INSTANCES];
+
+/* The format that every ADC instance converts with, from
+ * analogin_format_key(), so that it is only written when a pin needs
+ * another one */
+static uint32_t adc_format[ADC_INSTANCES];
+
+static uint32_t analogin_format_key(const analogin_t *obj)
+{
+    return ((uint32_t)obj->bits << 16) | ((uint32_t)obj->average << 8) | obj->sample_cycles;
+}
+
+/* The resolution that obj converts with, the next one up from its bits */
+static uint32_t analogin_bits(const analogin_t *obj)
+{
+    return obj->bits <= 8 ? 8U : obj->bits <= 10 ? 10U : obj->bits <= 12 ? 12U : 16U;
+}
+
+/* Writes the format of obj into its ADC instance, unless the last
+ * conversion on it had the same one */
+static void analogin_apply_format(analogin_t *obj)
+{
+    uint32_t instance = obj->adc >> ADC_INSTANCE_SHIFT;
+    uint32_t key = analogin_format_key(obj);
+    if (adc_format[instance] == key) {
+        return;
+    }
+    ADC_Type *base = adc_addrs[instance];
+
+    uint32_t bits = analogin_bits(obj);
+    uint32_t mode = bits == 8 ? 0U : bits == 12 ? 1U : bits == 10 ? 2U : 3U;
+    uint32_t cfg1 = (base->CFG1 & ~(ADC_CFG1_MODE_MASK | ADC_CFG1_ADLSMP_MASK)) | ADC_CFG1_MODE(mode);
+    uint32_t cfg2 = base->CFG2 & ~ADC_CFG2_ADLSTS_MASK;
+    if (obj->sample_cycles > 0) {
+        /* 20, 12, 6 or 2 extra cycles, the next one up */
+        cfg1 |= ADC_CFG1_ADLSMP_MASK;
+        cfg2 |= ADC_CFG2_ADLSTS(obj->sample_cycles > 12 ? 0U : obj->sample_cycles > 6 ? 1U : obj->sample_cycles > 2 ? 2U : 3U);
+    }
+    uint32_t sc3 = base->SC3 & ~(ADC_SC3_CAL_MASK | ADC_SC3_CALF_MASK | ADC_SC3_AVGE_MASK | ADC_SC3_AVGS_MASK);
+    if (obj->average > 1) {
+        sc3 |= ADC_SC3_AVGE_MASK |
+               ADC_SC3_AVGS(obj->average <= 4 ? 0U : obj->average <= 8 ? 1U : obj->average <= 16 ? 2U : 3U);
+    }
+    base->CFG1 = cfg1;
+    base->CFG2 = cfg2;
+    base->SC3 = sc3;
+    adc_format[instance] = key;
+}
+
 void analogin_init(analogin_t *obj, PinName pin)
 {
     obj->adc = (ADCName)pinmap_peripheral(pin, PinMap_ADC);
     MBED_ASSERT(obj->adc != (ADCName)NC);
 
+    obj->bits = 16;
+    obj->average = 4;
+    obj->sample_cycles = 0;
+
     uint32_t instance = obj->adc >> ADC_INSTANCE_SHIFT;
+    if (adc_ready[instance]) {
+        pinmap_pinout(pin, PinMap_ADC);
+        return;
+    }
+
     uint32_t bus_clock;
     adc16_config_t adc16_config;
 
@@ -54,8 +116,22 @@ void analogin_init(analogin_t *obj, PinName pin)
     adc16_config.resolution = kADC16_ResolutionSE16Bit;
     ADC16_Init(adc_addrs[instance], &adc16_config);
     ADC16_EnableHardwareTrigger(adc_addrs[instance], false);
+#if defined(FSL_FEATURE_ADC16_HAS_CALIBRATION) && FSL_FEATURE_ADC16_HAS_CALIBRATION
+    /* The calibration works best with the most averaging */
+    ADC16_SetHardwareAverage(adc_addrs[instance], kADC16_HardwareAverageCount32);
+    ADC16_DoAutoCalibration(adc_addrs[instance]);
+#endif
     ADC16_SetHardwareAverage(adc_addrs[instance], kADC16_HardwareAverageCount4);
     pinmap_pinout(pin, PinMap_ADC);
+    adc_format[instance] = analogin_format_key(obj);
+    adc_ready[instance] = true;
+}
+
+void analogin_set_format(analogin_t *obj, uint8_t bits, uint8_t average, uint8_t sample_cycles)
+{
+    obj->bits = bits;
+    obj->average = average;
+    obj->sample_cycles = sample_cycles;
 }
 
 uint16_t analogin_read_u16(analogin_t *obj)
@@ -72,6 +148,7 @@ uint16_t analogin_read_u16(analogin_t *obj)
 
     ADC16_SetChannelMuxMode(adc_addrs[instance],
         obj->adc & (1 << ADC_B_CHANNEL_SHIFT) ? kADC16_ChannelMuxB : kADC16_ChannelMuxA);
+    analogin_apply_format(obj);
 
     /*
      * When in software trigger mode, each conversion would be launched once calling the "ADC16_ChannelConfigure()"
@@ -82,7 +159,69 @@ uint16_t analogin_read_u16(analogin_t *obj)
                       ADC16_GetChannelStatusFlags(adc_addrs[instance], 0)))
     {
     }
-    return ADC16_GetChannelConversionValue(adc_addrs[instance], 0);
+    return ADC16_GetChannelConversionValue(adc_addrs[instance], 0) << (16 - analogin_bits(obj));
+}
+
+/* Starts a software triggered conversion of obj on its ADC, and switches the
+ * a/b mux only if the last conversion on that ADC used the other side */
+static void analogin_start(analogin_t *obj, int32_t *mux_b)
+{
+    uint32_t instance = obj->adc >> ADC_INSTANCE_SHIFT;
+    int32_t b_side = (obj->adc & (1 << ADC_B_CHANNEL_SHIFT)) ? 1 : 0;
+    if (mux_b[instance] != b_side) {
+        ADC16_SetChannelMuxMode(adc_addrs[instance], b_side ? kADC16_ChannelMuxB : kADC16_ChannelMuxA);
+        mux_b[instance] = b_side;
+    }
+    analogin_apply_format(obj);
+
+    adc16_channel_config_t adc16_channel_config;
+    adc16_channel_config.channelNumber = obj->adc & 0x1F;
+    adc16_channel_config.enableInterruptOnConversionCompleted = false;
+#if defined(FSL_FEATURE_ADC16_HAS_DIFF_MODE) && FSL_FEATURE_ADC16_HAS_DIFF_MODE
+    adc16_channel_config.enableDifferentialConversion = false;
+#endif
+    ADC16_SetChannelConfig(adc_addrs[instance], 0, &adc16_channel_config);
+}
+
+void analogin_read_multi(analogin_t *const *objs, uint16_t *values, size_t count)
+{
+    /* every ADC instance works through its own objects in order, and all of
+     * them convert at the same time. pending is the object that an instance
+     * is converting, next where it looks for its next one */
+    int32_t mux_b[ADC_INSTANCES];
+    size_t pending[ADC_INSTANCES];
+    size_t next[ADC_INSTANCES];
+    for (size_t i = 0; i < ADC_INSTANCES; i++) {
+        mux_b[i] = -1;
+        pending[i] = count;
+        next[i] = 0;
+    }
+
+    size_t done = 0;
+    while (done < count) {
+        for (size_t i = 0; i < ADC_INSTANCES; i++) {
+            if (pending[i] != count) {
+                continue;
+            }
+            while (next[i] < count && (objs[next[i]]->adc >> ADC_INSTANCE_SHIFT) != i) {
+                next[i]++;
+            }
+            if (next[i] < count) {
+                pending[i] = next[i]++;
+                analogin_start(objs[pending[i]], mux_b);
+            }
+        }
+
+        for (size_t i = 0; i < ADC_INSTANCES; i++) {
+            if (pending[i] != count &&
+                    (kADC16_ChannelConversionDoneFlag & ADC16_GetChannelStatusFlags(adc_addrs[i], 0))) {
+                values[pending[i]] = ADC16_GetChannelConversionValue(adc_addrs[i], 0)
+                                     << (16 - analogin_bits(objs[pending[i]]));
+                pending[i] = count;
+                done++;
+            }
+        }
+    }
 }
 
 float analogin_read(analogin_t *obj)
@@ -63,6 +63,11 @@ struct serial_s {
 
 struct analogin_s {
     ADCName adc;
+    /* the format of analogin_set_format(), 16 bits, 4 averaged and the
+     * short sample time after analogin_init() */
+    uint8_t bits;
+    uint8_t average;
+    uint8_t sample_cycles;
 };
 
 struct i2c_s {